@@ -0,0 +1,106 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file benchmarks/b-event.c
+ * @brief Event loop benchmarks
+ *
+ * Each operation is one trip round ev_run()'s dispatch loop.
+ */
+#include "bench.h"
+
+#include <unistd.h>
+#include <errno.h>
+
+#include "event.h"
+#include "syscalls.h"
+
+/** @brief State for the benchmarks */
+struct ping {
+  /** @brief Operations remaining */
+  long remaining;
+
+  /** @brief Write end of the pipe */
+  int wfd;
+};
+
+/** @brief Called when a byte arrives; sends another */
+static int ping_fd(ev_source attribute((unused)) *ev, int fd, void *u) {
+  struct ping *p = u;
+  char c;
+
+  if(read(fd, &c, 1) < 0)
+    disorder_fatal(errno, "read");
+  if(--p->remaining <= 0)
+    return 1;
+  if(write(p->wfd, &c, 1) < 0)
+    disorder_fatal(errno, "write");
+  return 0;
+}
+
+/** @brief Bounce a byte through a pipe */
+void bench_event_fd(long n) {
+  ev_source *ev = ev_new();
+  struct ping p[1];
+  int fds[2];
+
+  xpipe(fds);
+  p->remaining = n;
+  p->wfd = fds[1];
+  ev_fd(ev, ev_read, fds[0], ping_fd, p, "bench");
+  if(write(fds[1], "x", 1) < 0)
+    disorder_fatal(errno, "write");
+  bench_reset();
+  ev_run(ev);
+  ev_fd_cancel(ev, ev_read, fds[0]);
+  xclose(fds[0]);
+  xclose(fds[1]);
+}
+
+/** @brief A time that has already passed */
+static const struct timeval past;
+
+/** @brief Called when a timeout expires; sets another */
+static int ping_timeout(ev_source *ev,
+                        const struct timeval attribute((unused)) *now,
+                        void *u) {
+  struct ping *p = u;
+
+  if(--p->remaining <= 0)
+    return 1;
+  ev_timeout(ev, 0, &past, ping_timeout, p);
+  return 0;
+}
+
+/** @brief Run a chain of timeouts that are already due */
+void bench_event_timeout(long n) {
+  ev_source *ev = ev_new();
+  struct ping p[1];
+
+  p->remaining = n;
+  ev_timeout(ev, 0, &past, ping_timeout, p);
+  bench_reset();
+  ev_run(ev);
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -0,0 +1,91 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file benchmarks/b-hash.c
+ * @brief Hash table benchmarks
+ */
+#include "bench.h"
+
+#include "hash.h"
+#include "printf.h"
+
+/** @brief Number of distinct keys */
+#define NKEYS 4096
+
+/** @brief Keys, created on first use */
+static char *keys[NKEYS];
+
+/** @brief Create the keys
+ *
+ * They look like track names since those are the most common keys.
+ */
+static void make_keys(void) {
+  int n;
+
+  if(keys[0])
+    return;
+  for(n = 0; n < NKEYS; ++n)
+    byte_xasprintf(&keys[n], "/export/jukebox/artist%d/album%d/%02d:track.ogg",
+                   n % 97, n % 13, n % 20);
+}
+
+/** @brief Add keys to a hash table
+ *
+ * Each group of @ref NKEYS operations starts with an empty table, so this
+ * covers both insertion and growth.
+ */
+void bench_hash_add(long n) {
+  hash *h = NULL;
+  long i;
+
+  make_keys();
+  bench_reset();
+  for(i = 0; i < n; ++i) {
+    if(i % NKEYS == 0)
+      h = hash_new(sizeof i);
+    hash_add(h, keys[i % NKEYS], &i, HASH_INSERT_OR_REPLACE);
+  }
+  bench_sink += hash_count(h);
+}
+
+/** @brief Look up keys in a hash table
+ *
+ * A quarter of the lookups are for keys that are not present.
+ */
+void bench_hash_find(long n) {
+  hash *h = hash_new(sizeof n);
+  long i;
+
+  make_keys();
+  for(i = 0; i < NKEYS; i += 4) {
+    hash_add(h, keys[i], &i, HASH_INSERT);
+    hash_add(h, keys[i + 1], &i, HASH_INSERT);
+    hash_add(h, keys[i + 2], &i, HASH_INSERT);
+  }
+  bench_reset();
+  for(i = 0; i < n; ++i)
+    bench_sink += !!hash_find(h, keys[i % NKEYS]);
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
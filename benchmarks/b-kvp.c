@@ -0,0 +1,46 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file benchmarks/b-kvp.c
+ * @brief URL-decoding benchmark
+ */
+#include "bench.h"
+
+#include "kvp.h"
+
+/** @brief A typical CGI query string */
+static const char query[] =
+  "action=play&file=%2Fexport%2Fjukebox%2FThe%20Beatles%2FAbbey%20Road"
+  "%2F01%3ACome%20Together.ogg&back=http%3A%2F%2Fexample.com%2Fdisorder"
+  "%2F%3Faction%3Dplaying&nonce=NqsOaTxzL7bIRPkfE1kAVw";
+
+/** @brief Decode a query string */
+void bench_kvp_urldecode(long n) {
+  long i;
+
+  for(i = 0; i < n; ++i)
+    bench_sink += !!kvp_urldecode(query, sizeof query - 1);
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -0,0 +1,71 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file benchmarks/b-queue.c
+ * @brief Queue entry marshalling benchmarks
+ */
+#include "bench.h"
+
+#include "queue.h"
+#include "arena.h"
+
+/** @brief A marshalled queue entry, as found in the queue file */
+static const char marshalled[] =
+  " expected 1357924680 id OgWcgs6QuJZtVcT3NBzH8A origin picked"
+  " played 1357924601 sofar 79 state started submitter rjk"
+  " track \"/export/jukebox/Pink Floyd/The Wall/01:In the Flesh?.ogg\""
+  " when 1357924000";
+
+/** @brief Unmarshalling errors are not expected */
+static void queue_error(const char *msg, void attribute((unused)) *u) {
+  disorder_fatal(0, "queue_unmarshall: %s", msg);
+}
+
+/** @brief Marshall a queue entry */
+void bench_queue_marshall(long n) {
+  struct queue_entry *q = xmalloc(sizeof *q);
+  struct arena a[1];
+  long i;
+
+  queue_unmarshall(q, marshalled, queue_error, 0);
+  arena_init(a);
+  bench_reset();
+  for(i = 0; i < n; ++i) {
+    bench_sink += strlen(queue_marshall_arena(q, a));
+    arena_reset(a);
+  }
+}
+
+/** @brief Unmarshall a queue entry */
+void bench_queue_unmarshall(long n) {
+  struct queue_entry *q = xmalloc(sizeof *q);
+  long i;
+
+  for(i = 0; i < n; ++i) {
+    queue_unmarshall(q, marshalled, queue_error, 0);
+    bench_sink += q->when;
+  }
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
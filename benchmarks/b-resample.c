@@ -0,0 +1,77 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file benchmarks/b-resample.c
+ * @brief Sample format conversion benchmarks
+ *
+ * Each operation converts one 4KiB chunk of CD-quality sound, the size the
+ * speaker typically gets from a decoder.
+ */
+#include "bench.h"
+
+#include "resample.h"
+
+/** @brief Size of each input chunk */
+#define CHUNK 4096
+
+/** @brief Discard converted sound */
+static void converted(uint8_t attribute((unused)) *bytes,
+                      size_t nbytes,
+                      void attribute((unused)) *cd) {
+  bench_sink += nbytes;
+}
+
+/** @brief Convert @p n chunks from big-endian 44.1KHz 16-bit stereo
+ * @param n Number of chunks
+ * @param output_rate Output sample rate
+ */
+static void bench_resample(long n, int output_rate) {
+  struct resampler rs[1];
+  uint8_t input[CHUNK];
+  size_t m, done;
+  long i;
+
+  for(m = 0; m < CHUNK; ++m)
+    input[m] = (uint8_t)(m * 37 + (m >> 8));
+  resample_init(rs, 16, 2, 44100, 1, ENDIAN_BIG,
+                16, 2, output_rate, 1, ENDIAN_NATIVE);
+  bench_reset();
+  for(i = 0; i < n; ++i)
+    for(done = 0; done < CHUNK;)
+      done += resample_convert(rs, input + done, CHUNK - done, 0,
+                               converted, 0);
+  resample_close(rs);
+}
+
+/** @brief Convert byte order only */
+void bench_resample_format(long n) {
+  bench_resample(n, 44100);
+}
+
+/** @brief Convert byte order and sample rate */
+void bench_resample_rate(long n) {
+  bench_resample(n, 48000);
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -0,0 +1,52 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file benchmarks/b-split.c
+ * @brief Line splitting benchmark
+ */
+#include "bench.h"
+
+#include "split.h"
+
+/** @brief A configuration line of typical complexity */
+static const char line[] =
+  "stopword \"the\" a an 'and' \"\\\"quoted\\\"\" of in on # comment";
+
+/** @brief Split errors are not expected */
+static void split_error(const char *msg, void attribute((unused)) *u) {
+  disorder_fatal(0, "split: %s", msg);
+}
+
+/** @brief Split a line into words */
+void bench_split(long n) {
+  long i;
+  int nvec;
+
+  for(i = 0; i < n; ++i) {
+    split(line, &nvec, SPLIT_COMMENTS|SPLIT_QUOTES, split_error, 0);
+    bench_sink += nvec;
+  }
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -0,0 +1,67 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file benchmarks/b-unicode.c
+ * @brief Unicode benchmarks
+ */
+#include "bench.h"
+
+#include "unicode.h"
+
+/** @brief A track name with some non-ASCII characters in
+ *
+ * Searching and sorting mostly see names rather than prose, so that is what
+ * is used here.
+ */
+static const char title[] =
+  "Sigur R\xC3\xB3s - \xC3\x81g\xC3\xA6tis Byrjun - "
+  "Sv\xC3\xA1""fnir Englar (Live at the Caf\xC3\xA9 "
+  "Stra\xC3\x9F" "e, 1999)";
+
+/** @brief Fold case for comparison */
+void bench_casefold(long n) {
+  long i;
+  size_t nd;
+
+  for(i = 0; i < n; ++i) {
+    char *folded = utf8_casefold_compat(title, sizeof title - 1, &nd);
+    bench_sink += nd;
+    xfree(folded);
+  }
+}
+
+/** @brief Split into words */
+void bench_word_split(long n) {
+  size_t ns, nw;
+  uint32_t *s = utf8_to_utf32(title, sizeof title - 1, &ns);
+  long i;
+
+  bench_reset();
+  for(i = 0; i < n; ++i) {
+    utf32_word_split(s, ns, &nw, 0);
+    bench_sink += nw;
+  }
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
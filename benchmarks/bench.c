@@ -0,0 +1,207 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file benchmarks/bench.c
+ * @brief Microbenchmarks for library hot paths
+ *
+ * Each benchmark is a function that performs a given number of operations.
+ * The number is doubled until a single run takes long enough to time
+ * reliably, and then several runs of that size are timed.  The result for
+ * each benchmark is one tab-separated line giving its name, the number of
+ * operations per run and the fastest and median time per operation in
+ * nanoseconds.
+ *
+ * Inputs are fixed so that results can be compared from one build to the
+ * next.
+ */
+#include "bench.h"
+
+#include <getopt.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <time.h>
+
+#include "syscalls.h"
+#include "version.h"
+
+volatile unsigned long bench_sink;
+
+/** @brief One benchmark */
+struct benchmark {
+  /** @brief Name */
+  const char *name;
+
+  /** @brief Function to run */
+  bench_function *run;
+};
+
+/** @brief All benchmarks */
+static const struct benchmark benchmarks[] = {
+  { "hash-add", bench_hash_add },
+  { "hash-find", bench_hash_find },
+  { "kvp-urldecode", bench_kvp_urldecode },
+  { "utf8-casefold-compat", bench_casefold },
+  { "utf32-word-split", bench_word_split },
+  { "resample-format", bench_resample_format },
+  { "resample-rate", bench_resample_rate },
+  { "split", bench_split },
+  { "queue-marshall", bench_queue_marshall },
+  { "queue-unmarshall", bench_queue_unmarshall },
+  { "event-fd", bench_event_fd },
+  { "event-timeout", bench_event_timeout },
+};
+
+/** @brief Number of benchmarks */
+#define NBENCHMARKS (sizeof benchmarks / sizeof *benchmarks)
+
+/** @brief Largest number of timed runs */
+#define MAX_REPEAT 100
+
+/** @brief When the current run started */
+static struct timespec bench_started;
+
+/** @brief Minimum duration of a run in nanoseconds */
+static double min_run_ns = 1e8;
+
+/** @brief Number of timed runs */
+static int repeat = 5;
+
+/** @brief Restart the clock
+ *
+ * Called by benchmarks after setup that should not be counted.
+ */
+void bench_reset(void) {
+  clock_gettime(CLOCK_MONOTONIC, &bench_started);
+}
+
+/** @brief Time one run of a benchmark
+ * @param b Benchmark
+ * @param n Number of operations
+ * @return Elapsed time in nanoseconds
+ */
+static double bench_time(const struct benchmark *b, long n) {
+  struct timespec finished;
+
+  bench_reset();
+  b->run(n);
+  clock_gettime(CLOCK_MONOTONIC, &finished);
+  return (finished.tv_sec - bench_started.tv_sec) * 1e9
+    + (finished.tv_nsec - bench_started.tv_nsec);
+}
+
+/** @brief qsort() comparison for doubles */
+static int compare_double(const void *av, const void *bv) {
+  const double a = *(const double *)av, b = *(const double *)bv;
+
+  return a < b ? -1 : a > b;
+}
+
+/** @brief Run one benchmark and report the result
+ * @param b Benchmark
+ */
+static void bench_run(const struct benchmark *b) {
+  double times[MAX_REPEAT];
+  long n = 1;
+  int r;
+
+  /* Warm up, and find a run size that takes long enough to measure */
+  while(bench_time(b, n) < min_run_ns && n < LONG_MAX / 2)
+    n *= 2;
+  for(r = 0; r < repeat; ++r)
+    times[r] = bench_time(b, n) / n;
+  qsort(times, repeat, sizeof *times, compare_double);
+  if(printf("%s\t%ld\t%.1f\t%.1f\n", b->name, n, times[0],
+            times[repeat / 2]) < 0
+     || fflush(stdout) < 0)
+    disorder_fatal(errno, "writing to stdout");
+}
+
+static const struct option options[] = {
+  { "help", no_argument, 0, 'h' },
+  { "version", no_argument, 0, 'V' },
+  { "list", no_argument, 0, 'l' },
+  { "time", required_argument, 0, 't' },
+  { "repeat", required_argument, 0, 'r' },
+  { 0, 0, 0, 0 }
+};
+
+/* display usage message and terminate */
+static void attribute((noreturn)) help(void) {
+  xprintf("Usage:\n"
+          "  %s [OPTIONS] [PATTERN ...]\n"
+          "Options:\n"
+          "  --help, -h               Display usage message\n"
+          "  --version, -V            Display version number\n"
+          "  --list, -l               List benchmarks\n"
+          "  --time, -t MS            Minimum duration of each run (100)\n"
+          "  --repeat, -r COUNT       Number of timed runs (5)\n"
+          "\n"
+          "Runs the benchmarks whose names match any PATTERN, or all of\n"
+          "them.  Output is one tab-separated line per benchmark:\n"
+          "name, operations per run, fastest and median ns per operation.\n",
+          progname);
+  xfclose(stdout);
+  exit(0);
+}
+
+int main(int argc, char **argv) {
+  int n, list = 0;
+  size_t b;
+
+  set_progname(argv);
+  mem_init();
+  while((n = getopt_long(argc, argv, "hVlt:r:", options, 0)) >= 0) {
+    switch(n) {
+    case 'h': help();
+    case 'V': version(progname);
+    case 'l': list = 1; break;
+    case 't': min_run_ns = atol(optarg) * 1e6; break;
+    case 'r':
+      repeat = atoi(optarg);
+      if(repeat < 1 || repeat > MAX_REPEAT)
+        disorder_fatal(0, "--repeat must be between 1 and %d", MAX_REPEAT);
+      break;
+    default: exit(1);
+    }
+  }
+  if(!list)
+    xprintf("# benchmark\titerations\tmin_ns_per_op\tmedian_ns_per_op\n");
+  for(b = 0; b < NBENCHMARKS; ++b) {
+    if(optind < argc) {
+      for(n = optind; n < argc; ++n)
+        if(!fnmatch(argv[n], benchmarks[b].name, 0))
+          break;
+      if(n == argc)
+        continue;
+    }
+    if(list)
+      xprintf("%s\n", benchmarks[b].name);
+    else
+      bench_run(&benchmarks[b]);
+  }
+  xfclose(stdout);
+  return 0;
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
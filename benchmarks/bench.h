@@ -0,0 +1,64 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file benchmarks/bench.h
+ * @brief Microbenchmark support
+ */
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "common.h"
+
+#include "mem.h"
+#include "log.h"
+
+/** @brief Signature of a benchmark
+ * @param n Number of operations to perform
+ *
+ * The whole call is timed.  Setup work that should not be counted can be done
+ * first, followed by bench_reset().
+ */
+typedef void bench_function(long n);
+
+void bench_reset(void);
+
+/** @brief Somewhere to put results so the compiler cannot discard them */
+extern volatile unsigned long bench_sink;
+
+bench_function bench_hash_add;
+bench_function bench_hash_find;
+bench_function bench_kvp_urldecode;
+bench_function bench_casefold;
+bench_function bench_word_split;
+bench_function bench_resample_format;
+bench_function bench_resample_rate;
+bench_function bench_split;
+bench_function bench_queue_marshall;
+bench_function bench_queue_unmarshall;
+bench_function bench_event_fd;
+bench_function bench_event_timeout;
+
+#endif /* BENCH_H */
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
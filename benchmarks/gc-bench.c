@@ -0,0 +1,211 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file benchmarks/gc-bench.c
+ * @brief Garbage collector pause benchmark
+ *
+ * Builds a long-lived heap shaped roughly like a server's, with a hash of
+ * track names and a string for each, and then runs many small "commands"
+ * against it.  Each command looks up and replaces a few entries and builds a
+ * response from short strings, which are then garbage.  Every command is
+ * timed, so collections show up as slow commands.
+ *
+ * The collector is configured as usual by @c ${DISORDER_GC} and
+ * @c ${DISORDER_GC_HEAP} (see @ref mem_init()), so running this once with
+ * each setting shows their effect on command latency.
+ *
+ * The result is one tab-separated line giving the mode, the number of live
+ * entries and commands, the median, 99th and 99.9th percentile and maximum
+ * command times in microseconds, and the collector's own figures: the number
+ * of collections, the total and longest time spent in them (milliseconds, or
+ * - if it cannot say) and the final heap size in kilobytes.
+ */
+#include "common.h"
+
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+
+#include "mem.h"
+#include "log.h"
+#include "hash.h"
+#include "printf.h"
+#include "syscalls.h"
+#include "vector.h"
+#include "version.h"
+
+/** @brief Number of long-lived entries */
+static long live = 500000;
+
+/** @brief Number of commands to run */
+static long commands = 200000;
+
+/** @brief Strings in each command's response */
+#define RESPONSE_LINES 50
+
+/** @brief Entries each command replaces */
+#define COMMAND_UPDATES 4
+
+/** @brief Somewhere to put results so the compiler cannot discard them */
+static volatile unsigned long sink;
+
+/** @brief Construct the name of entry @p n */
+static char *entry_name(long n) {
+  char *s;
+
+  byte_xasprintf(&s, "/export/jukebox/artist%ld/album%ld/%02ld:title%ld.ogg",
+                 n / 1000, n / 10, n % 100, n);
+  return s;
+}
+
+/** @brief Run one command against @p h
+ * @param h Long-lived entries
+ * @param seed Which command this is
+ */
+static void command(hash *h, long seed) {
+  struct vector v[1];
+  char **value, *s;
+  long n;
+  int i;
+
+  vector_init(v);
+  for(i = 0; i < RESPONSE_LINES; ++i) {
+    n = (seed * 7919 + i * 104729) % live;
+    if((value = hash_find(h, entry_name(n)))) {
+      byte_xasprintf(&s, "%ld %s", n, *value);
+      vector_append(v, s);
+    }
+  }
+  for(i = 0; i < COMMAND_UPDATES; ++i) {
+    n = (seed * 15485863 + i) % live;
+    byte_xasprintf(&s, "value %ld updated by %ld", n, seed);
+    hash_add(h, entry_name(n), &s, HASH_INSERT_OR_REPLACE);
+  }
+  sink += v->nvec;
+}
+
+/** @brief qsort() comparison for command times */
+static int compare_ulong(const void *av, const void *bv) {
+  const unsigned long a = *(const unsigned long *)av;
+  const unsigned long b = *(const unsigned long *)bv;
+
+  return a < b ? -1 : a > b;
+}
+
+/** @brief Format a collector time in milliseconds */
+static const char *gc_ms(const struct mem_gc_stats *ms,
+                         unsigned long long us) {
+  char *s;
+
+  if(!ms->pauses)
+    return "-";
+  byte_xasprintf(&s, "%llu.%03llu", us / 1000, us % 1000);
+  return s;
+}
+
+static const struct option options[] = {
+  { "help", no_argument, 0, 'h' },
+  { "version", no_argument, 0, 'V' },
+  { "live", required_argument, 0, 'l' },
+  { "commands", required_argument, 0, 'n' },
+  { 0, 0, 0, 0 }
+};
+
+/* display usage message and terminate */
+static void attribute((noreturn)) help(void) {
+  xprintf("Usage:\n"
+          "  disorder-gc-bench [OPTIONS]\n"
+          "Options:\n"
+          "  --help, -h               Display usage message\n"
+          "  --version, -V            Display version number\n"
+          "  --live, -l COUNT         Long-lived entries (500000)\n"
+          "  --commands, -n COUNT     Commands to time (200000)\n"
+          "\n"
+          "Times commands against a large garbage-collected heap.  Set\n"
+          "DISORDER_GC=incremental or DISORDER_GC_HEAP=KBYTES to compare\n"
+          "collector settings.\n");
+  xfclose(stdout);
+  exit(0);
+}
+
+int main(int argc, char **argv) {
+  struct timespec started, finished;
+  struct mem_gc_stats before, after;
+  unsigned long *times;
+  const char *mode;
+  hash *h;
+  char *s;
+  long n;
+
+  set_progname(argv);
+  mem_init();
+  while((n = getopt_long(argc, argv, "hVl:n:", options, 0)) >= 0) {
+    switch(n) {
+    case 'h': help();
+    case 'V': version(progname);
+    case 'l': live = atol(optarg); break;
+    case 'n': commands = atol(optarg); break;
+    default: exit(1);
+    }
+  }
+  if(live <= 0 || commands <= 0)
+    disorder_fatal(0, "invalid --live or --commands");
+  if(mem_gc_stats(&before))
+    disorder_fatal(0, "garbage collector not in use");
+  if(!(mode = getenv("DISORDER_GC")) || !*mode)
+    mode = "full";
+  /* Build the long-lived heap */
+  h = hash_new(sizeof (char *));
+  for(n = 0; n < live; ++n) {
+    byte_xasprintf(&s, "value %ld", n);
+    hash_add(h, entry_name(n), &s, HASH_INSERT);
+  }
+  times = xmalloc_noptr(commands * sizeof *times);
+  mem_gc_stats(&before);
+  for(n = 0; n < commands; ++n) {
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    command(h, n);
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    times[n] = (finished.tv_sec - started.tv_sec) * 1000000000UL
+      + finished.tv_nsec - started.tv_nsec;
+  }
+  mem_gc_stats(&after);
+  qsort(times, commands, sizeof *times, compare_ulong);
+  xprintf("# mode\tlive\tcommands\tmedian_us\tp99_us\tp999_us\tmax_us"
+          "\tcollections\tgc_total_ms\tgc_max_ms\theap_kbytes\n");
+  xprintf("%s\t%ld\t%ld\t%lu\t%lu\t%lu\t%lu\t%lu\t%s\t%s\t%zu\n",
+          mode, live, commands,
+          times[commands / 2] / 1000,
+          times[commands * 99 / 100] / 1000,
+          times[commands * 999 / 1000] / 1000,
+          times[commands - 1] / 1000,
+          after.collections - before.collections,
+          gc_ms(&after, after.total_us - before.total_us),
+          gc_ms(&after, after.max_us),
+          after.heap_bytes / 1024);
+  xfclose(stdout);
+  return 0;
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
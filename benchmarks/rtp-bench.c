@@ -0,0 +1,458 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file benchmarks/rtp-bench.c
+ * @brief RTP fan-out benchmark
+ *
+ * Runs the speaker's RTP backend, @ref lib/uaudio-rtp.c, in a child process
+ * fed with synthetic sound, and receives what it sends on local sockets.
+ * Each run uses a different number of unicast recipients, as if that many
+ * <tt>disorder-playrtp</tt> instances had asked for the stream; a final run
+ * uses multicast.  The backend is driven just as disorder-speaker drives it,
+ * including any RTP settings from the configuration file, but without needing
+ * a server.
+ *
+ * For each run there is one tab-separated line reporting:
+ * - packets received per recipient and packets lost;
+ * - the departure jitter of the packets from each recipient: how far the gap
+ *   between consecutive packets differs from the sound they contain (mean,
+ *   99th percentile and maximum, in microseconds);
+ * - the fan-out skew: how long after the first recipient got each packet
+ *   the others got it (99th percentile, in microseconds);
+ * - timestamp error: how far packets actually departed from the times their
+ *   RTP timestamps imply, as scheduled by uaudio_schedule_sync() (spread
+ *   and end-to-end drift, in microseconds);
+ * - the sender's CPU use, in total and per packet per recipient.
+ *
+ * Recipients are on the loopback interface, so arrival time is a good proxy
+ * for departure time.
+ */
+#include "common.h"
+
+#include <getopt.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <gcrypt.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "mem.h"
+#include "log.h"
+#include "syscalls.h"
+#include "version.h"
+#include "configuration.h"
+#include "uaudio.h"
+#include "rtp.h"
+
+/** @brief RTP payload type for 44.1KHz 16-bit stereo */
+#define PAYLOAD_L16_STEREO 10
+
+/** @brief Samples per second, counting both channels */
+#define SAMPLE_RATE (44100 * 2)
+
+/** @brief Packets to ignore at the start of each run */
+#define WARMUP_PACKETS 10
+
+/** @brief One recipient */
+struct recipient {
+  /** @brief Socket */
+  int fd;
+
+  /** @brief Address */
+  struct sockaddr_storage sa;
+
+  /** @brief Packets received */
+  long packets;
+
+  /** @brief Sequence number of the first packet */
+  uint16_t first_seq;
+
+  /** @brief Sequence number of the latest packet */
+  uint16_t last_seq;
+
+  /** @brief Arrival time of the latest packet in nanoseconds */
+  int64_t last_arrival;
+
+  /** @brief Timestamp of the latest packet */
+  uint32_t last_timestamp;
+};
+
+/** @brief A growable array of measurements in nanoseconds */
+struct samples {
+  /** @brief Values */
+  int64_t *v;
+
+  /** @brief Number of values */
+  size_t n;
+
+  /** @brief Space allocated */
+  size_t size;
+};
+
+/** @brief How long each run lasts, in seconds */
+static long duration = 5;
+
+/** @brief Multicast group, or NULL to skip the multicast run */
+static const char *multicast_group = "239.255.42.42";
+
+/** @brief Multicast port */
+static const char *multicast_port = "9042";
+
+/** @brief Return the time in nanoseconds */
+static int64_t now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/** @brief Add a measurement
+ * @param s Where to add it
+ * @param v Value
+ */
+static void samples_add(struct samples *s, int64_t v) {
+  if(s->n == s->size) {
+    s->size = s->size ? 2 * s->size : 4096;
+    s->v = xrealloc_noptr(s->v, s->size * sizeof *s->v);
+  }
+  s->v[s->n++] = v;
+}
+
+/** @brief qsort() comparison for measurements */
+static int compare_samples(const void *av, const void *bv) {
+  const int64_t a = *(const int64_t *)av, b = *(const int64_t *)bv;
+
+  return a < b ? -1 : a > b;
+}
+
+/** @brief Return a percentile of some sorted measurements in microseconds */
+static double percentile(const struct samples *s, int p) {
+  size_t n = (s->n * p + 99) / 100;
+
+  if(!s->n)
+    return 0;
+  return s->v[n ? n - 1 : 0] / 1000.0;
+}
+
+/** @brief Return the mean of some measurements in microseconds */
+static double mean(const struct samples *s) {
+  double total = 0;
+  size_t n;
+
+  for(n = 0; n < s->n; ++n)
+    total += s->v[n];
+  return s->n ? total / s->n / 1000.0 : 0;
+}
+
+/** @brief Synthetic sound source
+ *
+ * A quiet square wave.  The content doesn't affect the timing at all, but
+ * makes a capture recognizable.
+ */
+static size_t pcm_callback(void *buffer, size_t max_samples,
+                           void attribute((unused)) *userdata) {
+  static unsigned long phase;
+  int16_t *const s = buffer;
+  size_t n;
+
+  for(n = 0; n < max_samples; ++n)
+    s[n] = (phase++ / 200) & 1 ? 1000 : -1000;
+  return max_samples;
+}
+
+/** @brief Run the RTP backend until killed
+ * @param recipients Unicast recipients, or NULL for multicast
+ * @param nrecipients Number of recipients
+ */
+static void attribute((noreturn)) sender(const struct recipient *recipients,
+                                         int nrecipients) {
+  const struct timespec forever = { 3600, 0 };
+  int n;
+
+  if(uaudio_rtp.configure)
+    uaudio_rtp.configure();
+  if(recipients)
+    uaudio_set("rtp-mode", "request");
+  else {
+    uaudio_set("rtp-mode", "multicast");
+    uaudio_set("rtp-destination-af", "-4");
+    uaudio_set("rtp-destination", multicast_group);
+    uaudio_set("rtp-destination-port", multicast_port);
+    uaudio_set("multicast-loop", "yes");
+  }
+  uaudio_set_format(44100, 2, 16, 1);
+  uaudio_rtp.start(pcm_callback, NULL);
+  for(n = 0; n < nrecipients; ++n)
+    if(rtp_add_recipient(&recipients[n].sa, RTP_CODEC_L16))
+      disorder_fatal(0, "cannot add recipient");
+  uaudio_rtp.activate();
+  for(;;)
+    nanosleep(&forever, NULL);
+}
+
+/** @brief Create a socket to receive on
+ * @param r Recipient to fill in
+ * @param group Multicast group to join, or NULL for unicast
+ */
+static void recipient_init(struct recipient *r, const char *group) {
+  struct sockaddr_in *const sin = (struct sockaddr_in *)&r->sa;
+  socklen_t len = sizeof *sin;
+  static const int one = 1;
+  int size = 1 << 20;
+
+  memset(r, 0, sizeof *r);
+  if((r->fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0)
+    disorder_fatal(errno, "error creating socket");
+  setsockopt(r->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof size);
+  sin->sin_family = AF_INET;
+  if(group) {
+    struct ip_mreq mreq;
+
+    if(setsockopt(r->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one) < 0)
+      disorder_fatal(errno, "error setting SO_REUSEADDR");
+    sin->sin_port = htons(atoi(multicast_port));
+    sin->sin_addr.s_addr = htonl(INADDR_ANY);
+    if(bind(r->fd, (struct sockaddr *)sin, sizeof *sin) < 0)
+      disorder_fatal(errno, "error binding socket");
+    memset(&mreq, 0, sizeof mreq);
+    if(!inet_aton(group, &mreq.imr_multiaddr))
+      disorder_fatal(0, "invalid multicast group '%s'", group);
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+    if(setsockopt(r->fd, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+                  &mreq, sizeof mreq) < 0)
+      disorder_fatal(errno, "error joining multicast group %s", group);
+  } else {
+    sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(bind(r->fd, (struct sockaddr *)sin, sizeof *sin) < 0)
+      disorder_fatal(errno, "error binding socket");
+    if(getsockname(r->fd, (struct sockaddr *)sin, &len) < 0)
+      disorder_fatal(errno, "error calling getsockname");
+  }
+  nonblock(r->fd);
+}
+
+/** @brief Run one benchmark and report the result
+ * @param nrecipients Number of recipients
+ * @param multicast Nonzero for a multicast run
+ */
+static void run(int nrecipients, int multicast) {
+  struct recipient *const recipients = xcalloc(nrecipients,
+                                               sizeof *recipients);
+  struct pollfd *const fds = xcalloc(nrecipients, sizeof *fds);
+  /* First arrival of each sequence number, for the skew */
+  int64_t *const first_arrival = xcalloc_noptr(65536, sizeof (int64_t));
+  struct samples jitter[1] = { { 0 } }, skew[1] = { { 0 } };
+  int64_t started, finish, arrival, error, error_min = 0, error_max = 0;
+  int64_t error_first = 0, error_last = 0, base_arrival = 0;
+  uint32_t base_timestamp = 0;
+  int n, w, have_base = 0;
+  long received = 0, lost = 0;
+  struct rusage ru;
+  double cpu_us;
+  pid_t pid;
+  union {
+    struct rtp_header header;
+    char bytes[2048];
+  } buffer;
+
+  for(n = 0; n < nrecipients; ++n) {
+    recipient_init(&recipients[n], multicast ? multicast_group : NULL);
+    fds[n].fd = recipients[n].fd;
+    fds[n].events = POLLIN;
+  }
+  if(fflush(stdout) < 0)
+    disorder_fatal(errno, "error writing to stdout");
+  if(!(pid = xfork()))
+    sender(multicast ? NULL : recipients, multicast ? 0 : nrecipients);
+  started = now_ns();
+  finish = started + (int64_t)duration * 1000000000;
+  while((arrival = now_ns()) < finish) {
+    if(poll(fds, nrecipients, 100) < 0 && errno != EINTR)
+      disorder_fatal(errno, "error calling poll");
+    arrival = now_ns();
+    for(n = 0; n < nrecipients; ++n) {
+      struct recipient *const r = &recipients[n];
+      uint16_t seq;
+      uint32_t timestamp;
+
+      if(!(fds[n].revents & POLLIN))
+        continue;
+      while(recv(r->fd, buffer.bytes, sizeof buffer.bytes, 0)
+            >= (ssize_t)sizeof buffer.header) {
+        if((buffer.header.mpt & 0x7F) != PAYLOAD_L16_STEREO)
+          continue;                     /* e.g. FEC */
+        seq = ntohs(buffer.header.seq);
+        timestamp = ntohl(buffer.header.timestamp);
+        if(r->packets++ < WARMUP_PACKETS) {
+          r->first_seq = seq + 1;
+          r->last_seq = seq;
+          r->last_arrival = arrival;
+          r->last_timestamp = timestamp;
+          continue;
+        }
+        ++received;
+        lost += (uint16_t)(seq - r->last_seq - 1);
+        /* Departure jitter */
+        samples_add(jitter,
+                    llabs((arrival - r->last_arrival)
+                          - (int64_t)(uint32_t)(timestamp - r->last_timestamp)
+                          * 1000000000 / SAMPLE_RATE));
+        /* Fan-out skew */
+        if(!first_arrival[seq] || arrival - first_arrival[seq] > 1000000000)
+          first_arrival[seq] = arrival;
+        else
+          samples_add(skew, arrival - first_arrival[seq]);
+        /* Timestamp error, from the first recipient */
+        if(!n) {
+          if(!have_base) {
+            base_arrival = arrival;
+            base_timestamp = timestamp;
+            have_base = 1;
+          }
+          error = (arrival - base_arrival)
+            - (int64_t)(uint32_t)(timestamp - base_timestamp)
+            * 1000000000 / SAMPLE_RATE;
+          if(error < error_min) error_min = error;
+          if(error > error_max) error_max = error;
+          if(!error_first)
+            error_first = error ? error : 1;
+          error_last = error;
+        }
+        r->last_seq = seq;
+        r->last_arrival = arrival;
+        r->last_timestamp = timestamp;
+      }
+    }
+  }
+  kill(pid, SIGKILL);
+  while(wait4(pid, &w, 0, &ru) < 0)
+    if(errno != EINTR)
+      disorder_fatal(errno, "error calling wait4");
+  for(n = 0; n < nrecipients; ++n)
+    xclose(recipients[n].fd);
+  if(!received) {
+    xprintf("# %s run with %d recipients received nothing\n",
+            multicast ? "multicast" : "unicast", nrecipients);
+    return;
+  }
+  cpu_us = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e6
+    + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+  qsort(jitter->v, jitter->n, sizeof *jitter->v, compare_samples);
+  qsort(skew->v, skew->n, sizeof *skew->v, compare_samples);
+  if(printf("%s\t%d\t%ld\t%ld\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f"
+            "\t%.2f\t%.3f\n",
+            multicast ? "multicast" : "unicast", nrecipients,
+            received / nrecipients, lost,
+            mean(jitter), percentile(jitter, 99), percentile(jitter, 100),
+            percentile(skew, 99),
+            (error_max - error_min) / 1000.0,
+            (error_last - error_first) / 1000.0,
+            cpu_us / ((now_ns() - started) / 1000.0) * 100,
+            cpu_us / received) < 0)
+    disorder_fatal(errno, "error writing to stdout");
+}
+
+static const struct option options[] = {
+  { "help", no_argument, 0, 'h' },
+  { "version", no_argument, 0, 'V' },
+  { "config", required_argument, 0, 'c' },
+  { "duration", required_argument, 0, 't' },
+  { "multicast", required_argument, 0, 'm' },
+  { "no-multicast", no_argument, 0, 'M' },
+  { 0, 0, 0, 0 }
+};
+
+/* display usage message and terminate */
+static void attribute((noreturn)) help(void) {
+  xprintf("Usage:\n"
+          "  disorder-rtp-bench [OPTIONS] [RECIPIENTS ...]\n"
+          "Options:\n"
+          "  --help, -h               Display usage message\n"
+          "  --version, -V            Display version number\n"
+          "  --config PATH, -c PATH   Set configuration file\n"
+          "  --duration, -t SECONDS   Length of each run (5)\n"
+          "  --multicast, -m GROUP:PORT\n"
+          "                           Multicast group (239.255.42.42:9042)\n"
+          "  --no-multicast, -M       Skip the multicast run\n"
+          "\n"
+          "Runs the RTP backend with each number of unicast RECIPIENTS\n"
+          "(default 1 10 50 100), then once with multicast, and reports\n"
+          "jitter, fan-out skew, timestamp error and CPU use.\n");
+  xfclose(stdout);
+  exit(0);
+}
+
+int main(int argc, char **argv) {
+  static const int default_recipients[] = { 1, 10, 50, 100 };
+  char *colon;
+  int n;
+
+  set_progname(argv);
+  mem_init();
+  while((n = getopt_long(argc, argv, "hVc:t:m:M", options, 0)) >= 0) {
+    switch(n) {
+    case 'h': help();
+    case 'V': version(progname);
+    case 'c': configfile = optarg; break;
+    case 't': duration = atol(optarg); break;
+    case 'm':
+      if(!(colon = strchr(optarg, ':')))
+        disorder_fatal(0, "--multicast requires GROUP:PORT");
+      multicast_group = xstrndup(optarg, colon - optarg);
+      multicast_port = colon + 1;
+      break;
+    case 'M': multicast_group = NULL; break;
+    default: exit(1);
+    }
+  }
+  if(duration <= 0)
+    disorder_fatal(0, "invalid --duration");
+  if(!gcry_check_version(NULL))
+    disorder_fatal(0, "gcry_check_version failed");
+  gcry_control(GCRYCTL_INITIALIZATION_FINISHED, 0);
+  config_per_user = 0;
+  if(config_read(0, NULL))
+    disorder_fatal(0, "cannot read configuration");
+  xprintf("# mode\trecipients\tpackets\tlost\tjitter_mean_us"
+          "\tjitter_p99_us\tjitter_max_us\tskew_p99_us\tts_spread_us"
+          "\tts_drift_us\tcpu_percent\tcpu_us_per_packet\n");
+  if(optind < argc)
+    for(n = optind; n < argc; ++n)
+      run(atoi(argv[n]), 0);
+  else
+    for(n = 0; n < (int)(sizeof default_recipients
+                         / sizeof *default_recipients); ++n)
+      run(default_recipients[n], 0);
+  if(multicast_group)
+    run(1, 1);
+  xfclose(stdout);
+  return 0;
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
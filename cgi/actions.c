@@ -28,6 +28,8 @@
 
 #include "disorder-cgi.h"
 
+#include "hex.h"
+
 /** @brief Redirect to some other action or URL */
 static void redirect(const char *url) {
   /* By default use the 'back' argument */
@@ -47,12 +49,95 @@ static void redirect(const char *url) {
     disorder_fatal(errno, "error writing to stdout");
 }
 
+/** @brief The playing page's refresh interval
+ *
+ * When @ref dcgi_events is set this is left to the page itself, for browsers
+ * that can't follow the event stream.
+ */
+long dcgi_refresh;
+
+/** @brief Work out the playing page's refresh interval
+ * @param now Current time
+ * @param fin When the page should next change, or 0 if not known
+ * @return Refresh interval in seconds
+ */
+static long playing_refresh(time_t now, time_t fin) {
+  long refresh = config->refresh;
+
+  if(fin && now + refresh > fin)
+    refresh = fin - now;
+  /* Bound the refresh interval below as a back-stop against the above
+   * calculations coming up with a stupid answer */
+  if(refresh < config->refresh_min)
+    refresh = config->refresh_min;
+  return refresh;
+}
+
+/** @brief Construct the playing page's entity tag
+ * @param generation Server state generation
+ * @param fin When the page should next change, or 0 if not known
+ * @return Entity tag, without quotes
+ *
+ * @p fin is included so that a browser holding the page can be told when to
+ * refresh it without consulting the server.  The user is included since
+ * rights affect what the page contains.
+ */
+static char *playing_etag(const char *generation, time_t fin) {
+  const char *user = disorder_user(dcgi_client);
+  char *tag;
+
+  byte_xasprintf(&tag, "%s-%s-%lx", generation,
+                 hex((const uint8_t *)user, strlen(user)),
+                 (unsigned long)fin);
+  return tag;
+}
+
+/** @brief Check whether the browser's copy of the playing page is current
+ * @param generation Server state generation
+ * @param finp Where to store when the page should next change
+ * @return Nonzero if the browser's copy can be used
+ */
+static int playing_current(const char *generation, time_t *finp) {
+  const char *inm = getenv("HTTP_IF_NONE_MATCH"), *ptr;
+  char *prefix, *end, *fend;
+  unsigned long fin;
+
+  if(!inm)
+    return 0;
+  /* The tag carries its own fin, so only the rest need match; drop the
+   * trailing "0" to get the part before it */
+  prefix = playing_etag(generation, 0);
+  prefix[strlen(prefix) - 1] = 0;
+  for(ptr = inm; (ptr = strchr(ptr, '"')); ptr = end) {
+    ++ptr;
+    if(!(end = strchr(ptr, '"')))
+      break;
+    if(!strncmp(ptr, prefix, strlen(prefix))) {
+      errno = 0;
+      fin = strtoul(ptr + strlen(prefix), &fend, 16);
+      if(!errno && fend == end) {
+        *finp = (time_t)fin;
+        return 1;
+      }
+    }
+    ++end;
+  }
+  return 0;
+}
+
 /*$ playing
  *
  * Expands \fIplaying.tmpl\fR as if there was no special 'playing' action, but
  * adds a Refresh: field to the HTTP header.  The maximum refresh interval is
  * defined by \fBrefresh\fR (see \fBdisorder_config\fR(5)) but may be less if
  * the end of the track is near.
+ *
+ * If the browser already has a copy of the page and nothing has changed on
+ * the server since it was made, the browser is told to use that instead.
+ *
+ * In SCGI mode there is no Refresh: field.  Instead the page follows the
+ * event stream and updates itself when something changes, and only falls
+ * back to refreshing on a timer if the browser can't do that.
  */
 /*$ manage
  *
@@ -62,27 +147,45 @@ static void redirect(const char *url) {
  * \fBdisorder_config\fR(5)) but may be less if the end of the track is near.
  */
 static void act_playing(void) {
-  long refresh = config->refresh;
   long length;
-  time_t now, fin;
-  char *url;
+  time_t now, fin = 0;
+  char *url, *generation = 0;
   const char *action;
 
+  xtime(&now);
+  if((action = cgi_get("action")))
+    url = cgi_makeurl(config->url, "action", action, (char *)0);
+  else
+    url = config->url;
+  /* Find out whether anything has changed before fetching the page's data */
+  if(dcgi_client
+     && disorder_state_generation(dcgi_client, &generation))
+    generation = 0;
+  if(generation && playing_current(generation, &fin)) {
+    if(printf("Status: 304\n"
+              "ETag: \"%s\"\n",
+              playing_etag(generation, fin)) < 0
+       || (!dcgi_events
+           && printf("Refresh: %ld;url=%s\n",
+                     playing_refresh(now, fin), url) < 0)
+       || printf("%s\n"
+                 "\n",
+                 dcgi_cookie_header()) < 0)
+      disorder_fatal(errno, "error writing to stdout");
+    return;
+  }
   dcgi_lookup(DCGI_PLAYING|DCGI_QUEUE|DCGI_ENABLED|DCGI_RANDOM_ENABLED);
   if(dcgi_playing
      && dcgi_playing->state == playing_started /* i.e. not paused */
-     && !disorder_length(dcgi_client, dcgi_playing->track, &length)
+     && !dcgi_length(dcgi_playing->track, &length)
      && length
      && dcgi_playing->sofar >= 0) {
     /* Try to put the next refresh at the start of the next track. */
-    xtime(&now);
     fin = now + length - dcgi_playing->sofar;
-    if(now + refresh > fin)
-      refresh = fin - now;
   }
   if(dcgi_queue && dcgi_queue->origin == origin_scratch) {
     /* next track is a scratch, refresh immediately */
-    refresh = 0;
+    fin = now;
   }
   if(!dcgi_playing
      && ((dcgi_queue
@@ -91,18 +194,14 @@ static void act_playing(void) {
      && dcgi_enabled) {
     /* no track playing but playing is enabled and there is something coming
      * up, so refresh immediately */
-    refresh = 0;
+    fin = now;
   }
-  /* Bound the refresh interval below as a back-stop against the above
-   * calculations coming up with a stupid answer */
-  if(refresh < config->refresh_min)
-    refresh = config->refresh_min;
-  if((action = cgi_get("action")))
-    url = cgi_makeurl(config->url, "action", action, (char *)0);
-  else
-    url = config->url;
-  if(printf("Refresh: %ld;url=%s\n",
-            refresh, url) < 0)
+  dcgi_refresh = playing_refresh(now, fin);
+  if(!dcgi_events
+     && printf("Refresh: %ld;url=%s\n", dcgi_refresh, url) < 0)
+    disorder_fatal(errno, "error writing to stdout");
+  if(generation
+     && printf("ETag: \"%s\"\n", playing_etag(generation, fin)) < 0)
     disorder_fatal(errno, "error writing to stdout");
   dcgi_expand("playing", 1);
 }
@@ -668,6 +767,33 @@ static void act_set(void) {
   redirect(0);
 }
 
+/*$ json
+ *
+ * Reports the sections named in \fBwhat\fR, a comma-separated list, as a
+ * JSON object with a member for each.  The default is \fBplaying,queue\fR.
+ * The sections are:
+ *
+ * - \fBplaying\fR: the playing track, or null
+ * - \fBqueue\fR: the queue
+ * - \fBrecent\fR: the recently played list, most recent first
+ * - \fBdirs\fR: the directories below \fBdir\fR, optionally restricted to
+ *   those matching \fBre\fR
+ * - \fBfiles\fR: the tracks below \fBdir\fR, optionally restricted to
+ *   those matching \fBre\fR
+ * - \fBsearch\fR: the tracks matching \fBquery\fR
+ *
+ * Queue entries and tracks include their artist, album, title and length.
+ * Directories include the number of tracks below them, their total length,
+ * how many of those lengths are not known, and the artist and album of the
+ * first of them, as \fBtracks\fR, \fBlength\fR, \fBunknown\fR,
+ * \fBartist\fR and \fBalbum\fR.
+ * Responses without the playing track carry an entity tag, so a client can
+ * cache them and will be told when nothing has changed.
+ */
+static void act_json(void) {
+  dcgi_json();
+}
+
 /** @brief Table of actions */
 static const struct action {
   /** @brief Action name */
@@ -681,6 +807,7 @@ static const struct action {
   { "disable", act_disable, RIGHT_GLOBAL_PREFS },
   { "edituser", act_edituser, 0 },
   { "enable", act_enable, RIGHT_GLOBAL_PREFS },
+  { "json", act_json, 0 },
   { "login", act_login, 0 },
   { "logout", act_logout, 0 },
   { "manage", act_playing, 0 },
@@ -771,6 +898,7 @@ void dcgi_action(const char *action) {
     /* Make sure 'action' is always set */
     cgi_set("action", action);
   }
+  dcgi_lookup_expect(action);
   if((n = TABLE_FIND(actions, name, action)) >= 0) {
     if(actions[n].rights) {
       /* Some right or other is required */
@@ -21,14 +21,42 @@
 
 #include "disorder-cgi.h"
 
-int main(int argc, char **argv) {
+/** @brief True if @c config->url should be inferred for each request */
+static int infer_config_url;
+
+/** @brief Set up everything that doesn't depend on the request */
+static void dcgi_setup(void) {
   const char *conf;
 
-  if(argc > 0)
-    progname = argv[0];
+  /* We allow various things to be overridden from the environment.  This is
+   * intended for debugging and is not a documented feature. */
+  if((conf = getenv("DISORDER_CONFIG")))
+    configfile = xstrdup(conf);
+  if(getenv("DISORDER_DEBUG"))
+    debugging = 1;
+  /* Read configuration */
+  if(config_read(0/*!server*/, NULL))
+    exit(EXIT_FAILURE);
+  infer_config_url = !config->url;
+  /* Register expansions */
+  mx_register_builtin();
+  dcgi_expansions();
+  /* Update search path.  We look in the config directory first and the data
+   * directory second, so that the latter overrides the former. */
+  mx_search_path(pkgconfdir);
+  mx_search_path(pkgdatadir);
+}
+
+/** @brief Handle one request
+ *
+ * The request is described by the environment and standard input, and the
+ * response written to standard output, as for any CGI program.  If @ref
+ * dcgi_client is already set then it is used instead of making a new
+ * connection.
+ */
+void dcgi_request(void) {
   /* RFC 3875 s8.2 recommends rejecting PATH_INFO if we don't make use of
    * it. */
-  if(!setlocale(LC_CTYPE, "")) disorder_error(errno, "error calling setlocale");
   /* TODO we could make disorder/ACTION equivalent to disorder?action=ACTION */
   if(getenv("PATH_INFO")) {
     /* TODO it might be nice to link back to the right place... */
@@ -42,40 +70,42 @@ int main(int argc, char **argv) {
   }
   /* Parse CGI arguments */
   cgi_init();
-  /* We allow various things to be overridden from the environment.  This is
-   * intended for debugging and is not a documented feature. */
-  if((conf = getenv("DISORDER_CONFIG")))
-    configfile = xstrdup(conf);
-  if(getenv("DISORDER_DEBUG"))
-    debugging = 1;
-  /* Read configuration */
-  if(config_read(0/*!server*/, NULL))
-    exit(EXIT_FAILURE);
   /* Figure out our URL.  This can still be overridden from the config file if
    * necessary but it shouldn't be necessary in ordinary installations. */
-  if(!config->url)
+  if(infer_config_url)
     config->url = infer_url(1/*include_path_info*/);
   /* Pick up the cookie, if there is one */
   dcgi_get_cookie();
-  /* Register expansions */
-  mx_register_builtin();
-  dcgi_expansions();
-  /* Update search path.  We look in the config directory first and the data
-   * directory second, so that the latter overrides the former. */
-  mx_search_path(pkgconfdir);
-  mx_search_path(pkgdatadir);
   /* Never cache anythging */
   if(printf("Cache-Control: no-cache\n") < 0)
     disorder_fatal(errno, "error writing to stdout");
   /* Create the initial connection, trying the cookie if we found a suitable
    * one. */
-  dcgi_login();
+  if(dcgi_client)
+    dcgi_check_cookie();
+  else
+    dcgi_login();
   /* Do whatever the user wanted */
   dcgi_action(NULL);
   /* In practice if a write fails that probably means the web server went away,
    * but we log it anyway. */
   if(fclose(stdout) < 0)
     disorder_fatal(errno, "error closing stdout");
+}
+
+int main(int argc, char **argv) {
+  if(argc > 0)
+    progname = argv[0];
+  mem_init();
+  if(!setlocale(LC_CTYPE, "")) disorder_error(errno, "error calling setlocale");
+  /* Web servers may pass words from the query string as arguments (RFC 3875
+   * s4.4), so arguments are only believed when not run as a CGI program. */
+  if(argc > 1 && !strcmp(argv[1], "--scgi") && !getenv("GATEWAY_INTERFACE")) {
+    dcgi_setup();
+    dcgi_scgi(argc - 2, argv + 2);
+  }
+  dcgi_setup();
+  dcgi_request();
   return 0;
 }
 
@@ -59,6 +59,8 @@ extern disorder_client *dcgi_client;
 extern char *dcgi_cookie;
 extern const char *dcgi_error_string;
 extern const char *dcgi_status_string;
+extern int dcgi_events;
+extern long dcgi_refresh;
 
 /** @brief Compare two @ref entry objects */
 int dcgi_compare_entry(const void *a, const void *b);
@@ -67,9 +69,20 @@ void dcgi_expand(const char *name, int header);
 void dcgi_action(const char *action);
 void dcgi_error(const char *key);
 void dcgi_login(void);
+void dcgi_check_cookie(void);
+void dcgi_request(void);
+void dcgi_scgi(int nvec, char **vec) attribute((noreturn));
 void dcgi_lookup(unsigned want);
 void dcgi_lookup_reset(void);
+void dcgi_lookup_expect(const char *page);
+void dcgi_lookup_tracks(char **tracks, int ntracks);
+void dcgi_lookup_dirs(char **dirs, int ndirs);
+const struct kvp *dcgi_dir_summary(const char *dir);
+int dcgi_part(const char *track, const char *context, const char *part,
+              char **sp);
+int dcgi_length(const char *track, long *lp);
 void dcgi_expansions(void);
+void dcgi_json(void);
 char *dcgi_cookie_header(void);
 void dcgi_login(void);
 void dcgi_get_cookie(void);
@@ -87,6 +100,7 @@ int option_label_exists(const char *key);
 #define DCGI_RIGHTS 0x0080
 #define DCGI_ENABLED 0x0100
 #define DCGI_RANDOM_ENABLED 0x0200
+#define DCGI_TRACKDATA 0x0400
 
 extern struct queue_entry *dcgi_queue;
 extern struct queue_entry *dcgi_playing;
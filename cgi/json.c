@@ -0,0 +1,368 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file cgi/json.c
+ * @brief JSON responses
+ *
+ * The @b json action reports the same things the templates can, as a single
+ * JSON object, for clients that render pages themselves.  The object is
+ * written out as it is generated rather than built up in memory first.
+ *
+ * Names, lengths and directory summaries come from the bulk lookups in @ref
+ * cgi/lookup.c, so a response costs a handful of server round trips however
+ * many tracks it lists.
+ */
+
+#include "disorder-cgi.h"
+
+#include "hex.h"
+
+/** @brief Sections of a JSON response */
+enum {
+  JSON_PLAYING = 0x0001,
+  JSON_QUEUE = 0x0002,
+  JSON_RECENT = 0x0004,
+  JSON_DIRS = 0x0008,
+  JSON_FILES = 0x0010,
+  JSON_SEARCH = 0x0020,
+};
+
+/** @brief Names of the sections of a JSON response */
+static const struct {
+  const char *name;
+  unsigned bit;
+} json_sections[] = {
+  { "dirs", JSON_DIRS },
+  { "files", JSON_FILES },
+  { "playing", JSON_PLAYING },
+  { "queue", JSON_QUEUE },
+  { "recent", JSON_RECENT },
+  { "search", JSON_SEARCH },
+};
+
+/** @brief Sections that depend on the server state generation */
+#define JSON_STATE (JSON_PLAYING|JSON_QUEUE|JSON_RECENT)
+
+/** @brief Write to stdout, or give up */
+static void json_printf(const char *fmt, ...) {
+  va_list ap;
+  int rc;
+
+  va_start(ap, fmt);
+  rc = vprintf(fmt, ap);
+  va_end(ap);
+  if(rc < 0)
+    disorder_fatal(errno, "error writing to stdout");
+}
+
+/** @brief Write a JSON string, or null for a null pointer
+ * @param s String (UTF-8) or NULL
+ */
+static void json_string(const char *s) {
+  const char *t;
+
+  if(!s) {
+    json_printf("null");
+    return;
+  }
+  json_printf("\"");
+  while(*s) {
+    /* Copy everything that needs no escaping in one go */
+    for(t = s;
+        *t && *t != '"' && *t != '\\' && (unsigned char)*t >= 0x20;
+        ++t)
+      ;
+    if(t > s) {
+      json_printf("%.*s", (int)(t - s), s);
+      s = t;
+      continue;
+    }
+    if(*s == '"' || *s == '\\')
+      json_printf("\\%c", *s);
+    else
+      json_printf("\\u%04x", (unsigned char)*s);
+    ++s;
+  }
+  json_printf("\"");
+}
+
+/** @brief Write a track's name parts and length as members of an object
+ * @param track Track name
+ */
+static void json_trackdata(const char *track) {
+  static const char *const parts[] = { "artist", "album", "title" };
+  size_t n;
+  char *s;
+  long length;
+
+  for(n = 0; n < sizeof parts / sizeof *parts; ++n) {
+    json_printf(",\"%s\":", parts[n]);
+    json_string(dcgi_part(track, "display", parts[n], &s) ? NULL : s);
+  }
+  if(dcgi_length(track, &length))
+    json_printf(",\"length\":null");
+  else
+    json_printf(",\"length\":%ld", length);
+}
+
+/** @brief Write a queue entry as a JSON object
+ * @param q Queue entry
+ */
+static void json_entry(const struct queue_entry *q) {
+  json_printf("{\"id\":");
+  json_string(q->id);
+  json_printf(",\"track\":");
+  json_string(q->track);
+  json_printf(",\"state\":");
+  json_string(playing_states[q->state]);
+  json_printf(",\"origin\":");
+  json_string(track_origins[q->origin]);
+  json_printf(",\"submitter\":");
+  json_string(q->submitter);
+  json_printf(",\"when\":%jd", (intmax_t)q->when);
+  if(q->played)
+    json_printf(",\"played\":%jd", (intmax_t)q->played);
+  if(q->expected)
+    json_printf(",\"expected\":%jd", (intmax_t)q->expected);
+  if(q->state == playing_started || q->state == playing_paused)
+    json_printf(",\"sofar\":%ld", q->sofar);
+  if(q->scratched) {
+    json_printf(",\"scratched\":");
+    json_string(q->scratched);
+  }
+  json_trackdata(q->track);
+  json_printf("}");
+}
+
+/** @brief Write a list of queue entries as a JSON array
+ * @param q First entry
+ */
+static void json_entries(const struct queue_entry *q) {
+  json_printf("[");
+  for(; q; q = q->next) {
+    json_entry(q);
+    if(q->next)
+      json_printf(",");
+  }
+  json_printf("]");
+}
+
+/** @brief Write a directory's summary as members of an object
+ * @param dir Directory name
+ *
+ * Fields the server doesn't supply are null.
+ */
+static void json_dirsummary(const char *dir) {
+  static const char *const counts[] = { "tracks", "length", "unknown" };
+  static const char *const strings[] = { "artist", "album" };
+  const struct kvp *k = dcgi_dir_summary(dir);
+  const char *v;
+  size_t n;
+
+  for(n = 0; n < sizeof counts / sizeof *counts; ++n)
+    if((v = kvp_get(k, counts[n])))
+      json_printf(",\"%s\":%ld", counts[n], atol(v));
+    else
+      json_printf(",\"%s\":null", counts[n]);
+  for(n = 0; n < sizeof strings / sizeof *strings; ++n) {
+    json_printf(",\"%s\":", strings[n]);
+    json_string(kvp_get(k, strings[n]));
+  }
+}
+
+/** @brief Write a list of tracks or directories as a JSON array
+ * @param names Track or directory names
+ * @param nnames Number of names
+ * @param type @c "track" or @c "dir"
+ *
+ * The list is sorted in the same way as the choose pages.  Directories come
+ * with their summaries.
+ */
+static void json_names(char **names, int nnames, const char *type) {
+  struct tracksort_data *tsd;
+  int n;
+
+  tsd = tracksort_init(nnames, names, type);
+  if(!strcmp(type, "track"))
+    dcgi_lookup_tracks(names, nnames);
+  else
+    dcgi_lookup_dirs(names, nnames);
+  json_printf("[");
+  for(n = 0; n < nnames; ++n) {
+    json_printf("%s{\"%s\":", n ? "," : "", type);
+    json_string(tsd[n].track);
+    json_printf(",\"display\":");
+    json_string(tsd[n].display);
+    if(!strcmp(type, "track"))
+      json_trackdata(tsd[n].track);
+    else
+      json_dirsummary(tsd[n].track);
+    json_printf("}");
+  }
+  json_printf("]");
+}
+
+/** @brief Construct the entity tag for a JSON response
+ * @param want Sections wanted
+ * @return Entity tag without quotes, or NULL if there can't be one
+ *
+ * The response can only be reused if neither the server state (for the
+ * queue and so on) nor the track database (for names and lengths) has
+ * changed.  The time played so far changes all the time, so there is no tag
+ * when the playing track is included.
+ */
+static char *json_etag(unsigned want) {
+  const char *user = disorder_user(dcgi_client);
+  char *sg = 0, *tg = 0, *tag;
+
+  if(want & JSON_PLAYING)
+    return NULL;
+  if(((want & JSON_STATE) && disorder_state_generation(dcgi_client, &sg))
+     || disorder_track_generation(dcgi_client, &tg))
+    return NULL;
+  byte_xasprintf(&tag, "json-%s-%s-%s", sg ? sg : "", tg,
+                 hex((const uint8_t *)user, strlen(user)));
+  return tag;
+}
+
+/** @brief Test whether the browser already has this response
+ * @param tag Entity tag
+ * @return Nonzero if it does
+ */
+static int json_current(const char *tag) {
+  const char *inm = getenv("HTTP_IF_NONE_MATCH"), *ptr;
+  size_t len = strlen(tag);
+
+  if(!inm)
+    return 0;
+  for(ptr = inm; (ptr = strchr(ptr, '"')); ++ptr) {
+    ++ptr;
+    if(!strncmp(ptr, tag, len) && ptr[len] == '"')
+      return 1;
+    if(!(ptr = strchr(ptr, '"')))
+      break;
+  }
+  return 0;
+}
+
+/** @brief Generate a JSON response
+ *
+ * See the @b json action in @ref cgi/actions.c.
+ */
+void dcgi_json(void) {
+  const char *what = cgi_get("what"), *dir = cgi_get("dir"),
+    *re = cgi_get("re"), *query = cgi_get("query"), *ptr, *end;
+  char **names = 0, *name, *tag;
+  unsigned want = 0, lookup = 0;
+  int n, nnames, first = 1;
+
+  if(!what)
+    what = "playing,queue";
+  for(ptr = what; *ptr; ptr = end + (*end == ',')) {
+    end = ptr + strcspn(ptr, ",");
+    name = xstrndup(ptr, end - ptr);
+    if(!*name)
+      continue;
+    if((n = TABLE_FIND(json_sections, name, name)) < 0) {
+      json_printf("Status: 400\n"
+                  "Content-Type: text/plain; charset=UTF-8\n"
+                  "\n"
+                  "unknown section '%s'\n", name);
+      return;
+    }
+    want |= json_sections[n].bit;
+  }
+  if(!dcgi_client) {
+    json_printf("Status: 503\n"
+                "Content-Type: text/plain; charset=UTF-8\n"
+                "\n"
+                "cannot connect to server\n");
+    return;
+  }
+  if((tag = json_etag(want)) && json_current(tag)) {
+    json_printf("Status: 304\n"
+                "ETag: \"%s\"\n"
+                "%s\n"
+                "\n", tag, dcgi_cookie_header());
+    return;
+  }
+  /* Fetch the queue and so on, and their names and lengths, in bulk */
+  if(want & JSON_PLAYING)
+    lookup |= DCGI_PLAYING;
+  if(want & JSON_QUEUE)
+    lookup |= DCGI_QUEUE;
+  if(want & JSON_RECENT)
+    lookup |= DCGI_RECENT;
+  if(lookup)
+    dcgi_lookup(lookup|DCGI_TRACKDATA);
+  json_printf("Content-Type: application/json\n");
+  if(tag)
+    json_printf("ETag: \"%s\"\n", tag);
+  json_printf("%s\n"
+              "\n"
+              "{", dcgi_cookie_header());
+  if(want & JSON_PLAYING) {
+    json_printf("\"playing\":");
+    if(dcgi_playing)
+      json_entry(dcgi_playing);
+    else
+      json_printf("null");
+    first = 0;
+  }
+  if(want & JSON_QUEUE) {
+    json_printf("%s\"queue\":", first ? "" : ",");
+    json_entries(dcgi_queue);
+    first = 0;
+  }
+  if(want & JSON_RECENT) {
+    json_printf("%s\"recent\":", first ? "" : ",");
+    json_entries(dcgi_recent);
+    first = 0;
+  }
+  if(want & JSON_DIRS) {
+    json_printf("%s\"dirs\":", first ? "" : ",");
+    if(!dir || disorder_dirs(dcgi_client, dir, re, &names, &nnames))
+      nnames = 0;
+    json_names(names, nnames, "dir");
+    first = 0;
+  }
+  if(want & JSON_FILES) {
+    json_printf("%s\"files\":", first ? "" : ",");
+    if(!dir || disorder_files(dcgi_client, dir, re, &names, &nnames))
+      nnames = 0;
+    json_names(names, nnames, "track");
+    first = 0;
+  }
+  if(want & JSON_SEARCH) {
+    json_printf("%s\"search\":", first ? "" : ",");
+    if(!query || disorder_search(dcgi_client, query, &names, &nnames))
+      nnames = 0;
+    json_names(names, nnames, "track");
+  }
+  json_printf("}\n");
+  if(fflush(stdout) < 0)
+    disorder_fatal(errno, "error writing to stdout");
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
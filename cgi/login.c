@@ -135,6 +135,11 @@ void dcgi_login(void) {
     dcgi_error("connect");
     exit(0);
   }
+  dcgi_check_cookie();
+}
+
+/** @brief Forget the cookie if the server did not accept it */
+void dcgi_check_cookie(void) {
   /* If there was a cookie but it went bad, we forget it */
   if(dcgi_cookie && !strcmp(disorder_user(dcgi_client), "guest"))
     dcgi_cookie = 0;
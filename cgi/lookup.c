@@ -18,14 +18,60 @@
 /** @file cgi/lookup.c
  * @brief Server lookups
  *
- * To improve performance many server lookups are cached.
+ * To improve performance many server lookups are cached.  Everything a page
+ * is expected to need is requested from the server in a single pipelined
+ * burst, followed by a second burst for the names and lengths of the tracks
+ * that turned up in the first.
  */
 
 #include "disorder-cgi.h"
 
+#include "client-common.h"
+
 /** @brief Cached data */
 static unsigned flags;
 
+/** @brief Data the current page is expected to need */
+static unsigned expected;
+
+/** @brief Cached track name parts
+ *
+ * Keys are "CONTEXT PART TRACK" and values are @c char *.
+ */
+static hash *partmap;
+
+/** @brief Cached track lengths
+ *
+ * Values are @c long, with -1 meaning the length is not known.
+ */
+static hash *lengthmap;
+
+/** @brief Cached directory summaries
+ *
+ * Values are @c struct @c kvp *, with a null pointer for a directory the
+ * server knows nothing about.
+ */
+static hash *dirmap;
+
+/** @brief Maximum number of tracks per bulk request */
+#define TRACKDATA_CHUNK 256
+
+/** @brief Track name parts fetched in bulk */
+static const char *const trackdata_parts[] = { "artist", "album", "title" };
+
+/** @brief What each page is expected to need */
+static const struct {
+  const char *page;
+  unsigned want;
+} page_wants[] = {
+  { "manage", DCGI_PLAYING|DCGI_QUEUE|DCGI_VOLUME|DCGI_ENABLED
+              |DCGI_RANDOM_ENABLED|DCGI_RIGHTS|DCGI_TRACKDATA },
+  { "new", DCGI_NEW|DCGI_RIGHTS|DCGI_TRACKDATA },
+  { "playing", DCGI_PLAYING|DCGI_QUEUE|DCGI_VOLUME|DCGI_ENABLED
+               |DCGI_RANDOM_ENABLED|DCGI_RIGHTS|DCGI_TRACKDATA },
+  { "recent", DCGI_RECENT|DCGI_RIGHTS|DCGI_TRACKDATA },
+};
+
 /** @brief Map of hashes to queud data */
 static hash *queuemap;
 
@@ -51,27 +97,225 @@ static void queuemap_add(struct queue_entry *q) {
     hash_add(queuemap, q->id, &q, HASH_INSERT_OR_REPLACE);
 }
 
-/** @brief Fetch cachable data */
+/** @brief Report a malformed queue entry */
+static void lookup_error(const char *msg,
+                         void attribute((unused)) *u) {
+  disorder_error(0, "error parsing playing track: %s", msg);
+}
+
+/** @brief Parse a yes/no response */
+static int parse_yes(const char *r, int *flagp) {
+  char **vec;
+  int nvec;
+
+  if(!r || !(vec = split(r, &nvec, SPLIT_QUOTES, 0, 0)) || nvec < 1)
+    return -1;
+  *flagp = !strcmp(vec[0], "yes");
+  return 0;
+}
+
+/** @brief Note a track whose data should be fetched in bulk */
+static void trackdata_want(struct vector *v, hash *seen, const char *track) {
+  if(lengthmap && hash_find(lengthmap, track))
+    return;
+  if(hash_add(seen, track, "", HASH_INSERT))
+    return;
+  vector_append(v, (char *)track);
+}
+
+/** @brief Fetch names and lengths of tracks in bulk
+ * @param v Track names
+ *
+ * Servers without the bulk commands just leave the caches empty; dcgi_part()
+ * and dcgi_length() then fall back to asking about one track at a time.
+ */
+static void trackdata_fetch(const struct vector *v) {
+  char **lines, **fields, *key;
+  int n, m, l, nlines, nfields, chunk;
+  long length;
+  const size_t nparts = sizeof trackdata_parts / sizeof *trackdata_parts;
+
+  if(!v->nvec)
+    return;
+  if(!partmap)
+    partmap = hash_new(sizeof (char *));
+  if(!lengthmap)
+    lengthmap = hash_new(sizeof (long));
+  for(n = 0; n < v->nvec; n += chunk) {
+    chunk = v->nvec - n > TRACKDATA_CHUNK ? TRACKDATA_CHUNK : v->nvec - n;
+    for(m = 0; m < (int)nparts; ++m)
+      disorder_pipeline_send(dcgi_client, "parts-multi",
+                             "display", trackdata_parts[m],
+                             disorder__list, v->vec + n, chunk,
+                             (char *)0);
+    disorder_pipeline_send(dcgi_client, "lengths-multi",
+                           disorder__list, v->vec + n, chunk,
+                           (char *)0);
+    for(m = 0; m <= (int)nparts; ++m) {
+      if(disorder_pipeline_receive_list(dcgi_client, &lines, &nlines))
+        continue;
+      for(l = 0; l < nlines; ++l) {
+        if(!(fields = split(lines[l], &nfields, SPLIT_QUOTES, 0, 0))
+           || nfields < 1)
+          continue;
+        if(m < (int)nparts) {
+          if(nfields < 2)
+            continue;
+          byte_xasprintf(&key, "display %s %s",
+                         trackdata_parts[m], fields[0]);
+          hash_add(partmap, key, &fields[1], HASH_INSERT_OR_REPLACE);
+        } else {
+          length = nfields < 2 ? -1 : atol(fields[1]);
+          hash_add(lengthmap, fields[0], &length, HASH_INSERT_OR_REPLACE);
+        }
+      }
+    }
+  }
+}
+
+/** @brief Fetch names and lengths of the tracks already looked up */
+static void trackdata_lists(void) {
+  struct vector v;
+  hash *seen = hash_new(1);
+  const struct queue_entry *const lists[] = {
+    dcgi_playing, dcgi_queue, dcgi_recent
+  };
+  const struct queue_entry *q;
+  int n;
+
+  vector_init(&v);
+  for(n = 0; n < (int)(sizeof lists / sizeof *lists); ++n)
+    for(q = lists[n]; q; q = q->next)
+      trackdata_want(&v, seen, q->track);
+  for(n = 0; n < dcgi_nnew; ++n)
+    trackdata_want(&v, seen, dcgi_new[n]);
+  trackdata_fetch(&v);
+}
+
+/** @brief Fetch names and lengths of some tracks in bulk
+ * @param tracks Track names
+ * @param ntracks Number of tracks
+ *
+ * Tracks whose details are already known are skipped.  Afterwards
+ * dcgi_part() and dcgi_length() will find the rest without asking the server
+ * again.
+ */
+void dcgi_lookup_tracks(char **tracks, int ntracks) {
+  struct vector v;
+  hash *seen = hash_new(1);
+  int n;
+
+  if(!dcgi_client)
+    return;
+  vector_init(&v);
+  for(n = 0; n < ntracks; ++n)
+    trackdata_want(&v, seen, tracks[n]);
+  trackdata_fetch(&v);
+}
+
+/** @brief Fetch summaries of some directories in bulk
+ * @param dirs Directory names
+ * @param ndirs Number of directories
+ *
+ * Afterwards dcgi_dir_summary() will find them without asking the server
+ * again.  Directories a server without the @b dir-summaries command can't
+ * summarize are remembered as having no summary.
+ */
+void dcgi_lookup_dirs(char **dirs, int ndirs) {
+  char **lines, **fields;
+  int n, m, l, nlines, nfields, chunk;
+  struct kvp *k;
+
+  if(!dcgi_client)
+    return;
+  if(!dirmap)
+    dirmap = hash_new(sizeof (struct kvp *));
+  for(n = 0; n < ndirs; n += chunk) {
+    chunk = ndirs - n > TRACKDATA_CHUNK ? TRACKDATA_CHUNK : ndirs - n;
+    k = 0;
+    for(m = 0; m < chunk; ++m)
+      hash_add(dirmap, dirs[n + m], &k, HASH_INSERT_OR_REPLACE);
+    if(disorder_dir_summaries(dcgi_client, dirs + n, chunk, &lines, &nlines))
+      continue;
+    for(l = 0; l < nlines; ++l) {
+      if(!(fields = split(lines[l], &nfields, SPLIT_QUOTES, 0, 0))
+         || nfields < 1)
+        continue;
+      k = 0;
+      for(m = 1; m + 1 < nfields; m += 2)
+        kvp_set(&k, fields[m], fields[m + 1]);
+      hash_add(dirmap, fields[0], &k, HASH_INSERT_OR_REPLACE);
+    }
+  }
+}
+
+/** @brief Look up a directory summary
+ * @param dir Directory name
+ * @return Summary fields, as for @b dir-summaries, or NULL
+ */
+const struct kvp *dcgi_dir_summary(const char *dir) {
+  struct kvp **k;
+
+  if(!dirmap || !(k = hash_find(dirmap, dir))) {
+    dcgi_lookup_dirs((char **)&dir, 1);
+    if(!dirmap || !(k = hash_find(dirmap, dir)))
+      return NULL;
+  }
+  return *k;
+}
+
+/** @brief Fetch cachable data
+ * @param want Bitmap of @c DCGI_... values
+ *
+ * Anything the current page is expected to need (see dcgi_lookup_expect()) is
+ * fetched at the same time.
+ */
 void dcgi_lookup(unsigned want) {
-  unsigned need = want ^ (flags & want);
+  unsigned need = (want | expected) & ~flags;
   struct queue_entry *r, *rnext;
-  char *rs;
+  char *rs, **vec;
+  int nvec;
 
   if(!dcgi_client || !need)
     return;
+  /* Send everything at once... */
+  if(need & DCGI_QUEUE)
+    disorder_pipeline_send(dcgi_client, "queue", (char *)0);
+  if(need & DCGI_PLAYING)
+    disorder_pipeline_send(dcgi_client, "playing", (char *)0);
+  if(need & DCGI_NEW)
+    disorder_pipeline_send(dcgi_client, "new", "0", (char *)0);
+  if(need & DCGI_RECENT)
+    disorder_pipeline_send(dcgi_client, "recent", (char *)0);
+  if(need & DCGI_VOLUME)
+    disorder_pipeline_send(dcgi_client, "volume", (char *)0);
+  if(need & DCGI_RIGHTS)
+    disorder_pipeline_send(dcgi_client, "userinfo",
+                           disorder_user(dcgi_client), "rights", (char *)0);
+  if(need & DCGI_ENABLED)
+    disorder_pipeline_send(dcgi_client, "enabled", (char *)0);
+  if(need & DCGI_RANDOM_ENABLED)
+    disorder_pipeline_send(dcgi_client, "random-enabled", (char *)0);
+  /* ...and collect the responses in the same order */
   if(need & DCGI_QUEUE) {
-    disorder_queue(dcgi_client, &dcgi_queue);
+    disorder_pipeline_receive_queue(dcgi_client, &dcgi_queue);
     queuemap_add(dcgi_queue);
   }
   if(need & DCGI_PLAYING) {
-    disorder_playing(dcgi_client, &dcgi_playing);
+    rs = NULL;
+    if(!disorder_pipeline_receive(dcgi_client, &rs) && rs) {
+      dcgi_playing = xmalloc(sizeof *dcgi_playing);
+      if(queue_unmarshall(dcgi_playing, rs, lookup_error, 0))
+        dcgi_playing = NULL;
+    }
     queuemap_add(dcgi_playing);
   }
   if(need & DCGI_NEW)
-    disorder_new_tracks(dcgi_client, 0, &dcgi_new, &dcgi_nnew);
+    disorder_pipeline_receive_list(dcgi_client, &dcgi_new, &dcgi_nnew);
   if(need & DCGI_RECENT) {
     /* we need to reverse the order of the list */
-    disorder_recent(dcgi_client, &r);
+    r = NULL;
+    disorder_pipeline_receive_queue(dcgi_client, &r);
     while(r) {
       rnext = r->next;
       r->next = dcgi_recent;
@@ -80,22 +324,96 @@ void dcgi_lookup(unsigned want) {
     }
     queuemap_add(dcgi_recent);
   }
-  if(need & DCGI_VOLUME)
-    disorder_get_volume(dcgi_client,
-                        &dcgi_volume_left, &dcgi_volume_right);
+  if(need & DCGI_VOLUME) {
+    rs = NULL;
+    if(!disorder_pipeline_receive(dcgi_client, &rs) && rs
+       && (vec = split(rs, &nvec, SPLIT_QUOTES, 0, 0)) && nvec >= 2) {
+      dcgi_volume_left = atol(vec[0]);
+      dcgi_volume_right = atol(vec[1]);
+    }
+  }
   if(need & DCGI_RIGHTS) {
     dcgi_rights = RIGHT_READ;	/* fail-safe */
-    if(!disorder_userinfo(dcgi_client, disorder_user(dcgi_client),
-                          "rights", &rs))
-      parse_rights(rs, &dcgi_rights, 1);
+    rs = NULL;
+    if(!disorder_pipeline_receive(dcgi_client, &rs) && rs
+       && (vec = split(rs, &nvec, SPLIT_QUOTES, 0, 0)) && nvec >= 1)
+      parse_rights(vec[0], &dcgi_rights, 1);
   }
-  if(need & DCGI_ENABLED)
-    disorder_enabled(dcgi_client, &dcgi_enabled);
-  if(need & DCGI_RANDOM_ENABLED)
-    disorder_random_enabled(dcgi_client, &dcgi_random_enabled);
+  if(need & DCGI_ENABLED) {
+    rs = NULL;
+    if(!disorder_pipeline_receive(dcgi_client, &rs))
+      parse_yes(rs, &dcgi_enabled);
+  }
+  if(need & DCGI_RANDOM_ENABLED) {
+    rs = NULL;
+    if(!disorder_pipeline_receive(dcgi_client, &rs))
+      parse_yes(rs, &dcgi_random_enabled);
+  }
+  if(need & DCGI_TRACKDATA)
+    trackdata_lists();
   flags |= need;
 }
 
+/** @brief Declare what the current page will need
+ * @param page Action or template name
+ *
+ * The next call to dcgi_lookup() will fetch all of it in one go, rather than
+ * piecemeal as the template asks for it.
+ */
+void dcgi_lookup_expect(const char *page) {
+  int n;
+
+  if((n = TABLE_FIND(page_wants, page, page)) >= 0)
+    expected = page_wants[n].want;
+  else
+    expected = DCGI_RIGHTS;
+}
+
+/** @brief Look up a track name part
+ * @param track Track name
+ * @param context Context
+ * @param part Part name
+ * @param sp Where to store result
+ * @return 0 on success, non-0 on error
+ */
+int dcgi_part(const char *track, const char *context, const char *part,
+              char **sp) {
+  char *key, **v;
+
+  if(!dcgi_client)
+    return -1;
+  byte_xasprintf(&key, "%s %s %s", context, part, track);
+  if(partmap && (v = hash_find(partmap, key))) {
+    *sp = *v;
+    return 0;
+  }
+  if(disorder_part(dcgi_client, track, context, part, sp))
+    return -1;
+  if(!partmap)
+    partmap = hash_new(sizeof (char *));
+  hash_add(partmap, key, sp, HASH_INSERT_OR_REPLACE);
+  return 0;
+}
+
+/** @brief Look up a track's length
+ * @param track Track name
+ * @param lp Where to store length in seconds
+ * @return 0 on success, non-0 on error or if the length is not known
+ */
+int dcgi_length(const char *track, long *lp) {
+  long *v;
+
+  if(!dcgi_client)
+    return -1;
+  if(lengthmap && (v = hash_find(lengthmap, track))) {
+    if(*v < 0)
+      return -1;
+    *lp = *v;
+    return 0;
+  }
+  return disorder_length(dcgi_client, track, lp);
+}
+
 /** @brief Locate a track by ID */
 struct queue_entry *dcgi_findtrack(const char *id) {
   struct queue_entry **qq;
@@ -117,6 +435,10 @@ struct queue_entry *dcgi_findtrack(const char *id) {
 void dcgi_lookup_reset(void) {
   /* Forget everything we knew */
   flags = 0;
+  expected = 0;
+  partmap = 0;
+  lengthmap = 0;
+  dirmap = 0;
   queuemap = 0;
   dcgi_recent = 0;
   dcgi_queue = 0;
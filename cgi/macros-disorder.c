@@ -158,12 +158,10 @@ static int exp_part(int nargs,
     else
       return 0;
   }
-  if(dcgi_client
-     && !disorder_part(dcgi_client,
-                       track,
-                       !strcmp(context, "short") ? "display" : context,
-                       part,
-                       (char **)&s)) {
+  if(!dcgi_part(track,
+                !strcmp(context, "short") ? "display" : context,
+                part,
+                (char **)&s)) {
     if(!strcmp(context, "short"))
       s = truncate_for_display(s, config->short_display);
     return sink_writes(output, cgi_sgmlquote(s)) < 0 ? -1 : 0;
@@ -262,12 +260,47 @@ static int exp_length(int attribute((unused)) nargs,
         return -1;
     name = q->track;
   }
-  if(dcgi_client && !disorder_length(dcgi_client, name, &length))
+  if(!dcgi_length(name, &length))
     return sink_printf(output, "%ld:%02ld",
                        length / 60, length % 60) < 0 ? -1 : 0;
   return sink_writes(output, "&nbsp;") < 0 ? -1 : 0;
 }
 
+/*$ @dirsummary{DIR}{FIELD}
+ *
+ * Expands to part of the summary of the tracks below directory DIR.  FIELD
+ * can be:
+ * - tracks: the number of tracks
+ * - length: their total length, as hours, minutes and seconds
+ * - unknown: the number of tracks whose length is not yet known
+ * - first: the first track
+ * - artist, album: the artist and album of the first track
+ * - sort-artist, sort-album: the same, as sort keys
+ *
+ * Expands to nothing if there is no such field, for instance because there
+ * are no tracks below DIR.  Summaries of the directories listed by @dirs are
+ * fetched in advance.
+ */
+static int exp_dirsummary(int attribute((unused)) nargs,
+                          char **args,
+                          struct sink *output,
+                          void attribute((unused)) *u) {
+  const char *v = kvp_get(dcgi_dir_summary(args[0]), args[1]);
+  long length;
+
+  if(!v)
+    return 0;
+  if(!strcmp(args[1], "length")) {
+    length = atol(v);
+    if(length >= 3600)
+      return sink_printf(output, "%ld:%02ld:%02ld", length / 3600,
+                         length / 60 % 60, length % 60) < 0 ? -1 : 0;
+    return sink_printf(output, "%ld:%02ld",
+                       length / 60, length % 60) < 0 ? -1 : 0;
+  }
+  return sink_writes(output, cgi_sgmlquote(v)) < 0 ? -1 : 0;
+}
+
 /*$ @removable{ID}
  *
  * Expands to "true" if track ID is removable (or scratchable, if it is the
@@ -597,6 +630,31 @@ static int exp_enabled(int attribute((unused)) nargs,
   return mx_bool_result(output, e);
 }
 
+/*$ @events
+ *
+ * Expands to "true" if pages can follow the event stream at
+ * \fIaction=events\fR instead of refreshing on a timer, otherwise "false".
+ * This is the case in SCGI mode.
+ */
+static int exp_events(int attribute((unused)) nargs,
+                      char attribute((unused)) **args,
+                      struct sink *output,
+                      void attribute((unused)) *u) {
+  return mx_bool_result(output, dcgi_events);
+}
+
+/*$ @refresh
+ *
+ * Expands to the number of seconds after which the playing page should be
+ * refreshed, when it can't follow the event stream.
+ */
+static int exp_refresh(int attribute((unused)) nargs,
+                       char attribute((unused)) **args,
+                       struct sink *output,
+                       void attribute((unused)) *u) {
+  return sink_printf(output, "%ld", dcgi_refresh) < 0 ? -1 : 0;
+}
+
 /*$ @random-enabled
  *
  * Expands to "true" if random play is enabled, otherwise "false".
@@ -860,6 +918,9 @@ static int exp__files_dirs(int nargs,
   /* Get the list */
   if(fn(dcgi_client, dir, re, &tracks, &ntracks))
     return 0;
+  /* @dirsummary will want these */
+  if(type && !strcmp(type, "dir"))
+    dcgi_lookup_dirs(tracks, ntracks);
   if(type) {
     /* Sort it.  NB trackname_transform() does not go to the server. */
     tsd = tracksort_init(ntracks, tracks, type);
@@ -1015,8 +1076,10 @@ static int exp_breadcrumbs(int attribute((unused)) nargs,
 void dcgi_expansions(void) {
   mx_register("arg", 1, 1, exp_arg);
   mx_register("argq", 1, 1, exp_argq);
+  mx_register("dirsummary", 2, 2, exp_dirsummary);
   mx_register("enabled", 0, 0, exp_enabled);
   mx_register("error", 0, 0, exp_error);
+  mx_register("events", 0, 0, exp_events);
   mx_register("image", 1, 1, exp_image);
   mx_register("isnew", 0, 0, exp_isnew);
   mx_register("isplaying", 0, 0, exp_isplaying);
@@ -1031,6 +1094,7 @@ void dcgi_expansions(void) {
   mx_register("pref", 2, 2, exp_pref);
   mx_register("quote", 1, 1, exp_quote);
   mx_register("random-enabled", 0, 0, exp_random_enabled);
+  mx_register("refresh", 0, 0, exp_refresh);
   mx_register("removable", 1, 1, exp_removable);
   mx_register("resolve", 1, 1, exp_resolve);
   mx_register("server-version", 0, 0, exp_server_version);
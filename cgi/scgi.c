@@ -0,0 +1,582 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file cgi/scgi.c
+ * @brief Persistent SCGI mode
+ *
+ * In this mode the CGI listens for SCGI requests from the web server.  The
+ * configuration, registered expansions and parsed templates are set up once.
+ * Each request is then handled by a child process, which sees the request
+ * exactly as a CGI program would: the SCGI headers become environment
+ * variables and the connection becomes standard input and output.
+ *
+ * The parent keeps a pool of connections to the server, keyed by login
+ * cookie, and lends one to each child.  A child that finishes normally
+ * without replacing its connection exits with @ref SCGI_KEEP, and the
+ * connection goes back into the pool; otherwise it is discarded.
+ *
+ * Requests for @c action=events are not passed to a child.  The parent keeps
+ * the connection and sends the server's event log down it as Server-Sent
+ * Events, so that pages can update themselves when something changes instead
+ * of refreshing on a timer.  A single log connection to the server, made by a
+ * helper process and read through a pipe, is shared by every browser.
+ */
+
+#include "disorder-cgi.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include "addr.h"
+#include "kvp.h"
+#include "sink.h"
+
+/** @brief Exit status meaning the lent connection can be reused */
+#define SCGI_KEEP 64
+
+/** @brief Maximum size of the SCGI header block */
+#define SCGI_MAX_HEADERS 65536
+
+/** @brief Seconds to wait for a slow web server */
+#define SCGI_TIMEOUT 30
+
+/** @brief Maximum number of idle connections to keep */
+#define POOL_MAX 16
+
+/** @brief Seconds for which a connection is reused
+ *
+ * A cookie revoked by some other client is still honoured by a pooled
+ * connection for up to this long.
+ */
+#define POOL_LIFETIME 60
+
+/** @brief Seconds between keepalive comments on event streams
+ *
+ * These stop proxies timing out idle streams, and find browsers that have
+ * gone away.
+ */
+#define EVENTS_KEEPALIVE 30
+
+/** @brief Minimum seconds between attempts to follow the event log */
+#define EVENTS_RETRY 10
+
+/** @brief A pooled connection to the server */
+struct pooled {
+  /** @brief Next connection */
+  struct pooled *next;
+
+  /** @brief Login cookie, or "" for guest */
+  char *cookie;
+
+  /** @brief Connection */
+  disorder_client *client;
+
+  /** @brief When the connection was made */
+  time_t created;
+
+  /** @brief Child using the connection, or 0 if idle */
+  pid_t pid;
+};
+
+/** @brief Pooled connections, most recently made first */
+static struct pooled *pool;
+
+/** @brief Set if connections turn out not to be reusable */
+static int pool_disabled;
+
+/** @brief A browser receiving events */
+struct stream {
+  /** @brief Next stream */
+  struct stream *next;
+
+  /** @brief Connection from web server */
+  int fd;
+};
+
+/** @brief Browsers receiving events */
+static struct stream *streams;
+
+/** @brief Pipe from the process following the event log, or -1 */
+static int events_fd = -1;
+
+/** @brief When the process following the event log was last started */
+static time_t events_started;
+
+/** @brief When keepalives were last sent */
+static time_t events_keptalive;
+
+/** @brief Partial line read from @ref events_fd */
+static struct dynstr events_input;
+
+/** @brief Listening socket */
+static int scgi_fd;
+
+/** @brief Set when event streams are available
+ *
+ * Pages that would otherwise refresh on a timer can follow
+ * <tt>action=events</tt> instead.
+ */
+int dcgi_events;
+
+/** @brief Remove @p *pp from the pool and close it */
+static void pool_discard(struct pooled **pp) {
+  struct pooled *p = *pp;
+
+  *pp = p->next;
+  disorder_close(p->client);
+}
+
+/** @brief Find or make a connection for @p cookie
+ * @param cookie Login cookie or NULL
+ * @return Connection to lend, or NULL to let the child connect itself
+ */
+static struct pooled *pool_get(const char *cookie) {
+  struct pooled *p, **pp, **oldest;
+  disorder_client *c;
+  time_t now = xtime(0);
+  int idle = 0;
+
+  if(pool_disabled)
+    return NULL;
+  if(!cookie)
+    cookie = "";
+  for(pp = &pool; (p = *pp);) {
+    if(!p->pid) {
+      if(p->created + POOL_LIFETIME <= now || !disorder_reusable(p->client)) {
+        pool_discard(pp);
+        continue;
+      }
+      if(!strcmp(p->cookie, cookie))
+        return p;
+      ++idle;
+    }
+    pp = &p->next;
+  }
+  /* Make room by dropping the oldest idle connection */
+  if(idle >= POOL_MAX) {
+    oldest = NULL;
+    for(pp = &pool; (p = *pp); pp = &p->next)
+      if(!p->pid)
+        oldest = pp;
+    pool_discard(oldest);
+  }
+  c = disorder_new(0);
+  if(disorder_connect_cookie(c, *cookie ? cookie : NULL)) {
+    disorder_close(c);
+    return NULL;
+  }
+  if(!disorder_reusable(c)) {
+    /* e.g. a compressed connection */
+    disorder_info("server connections cannot be shared, not pooling them");
+    pool_disabled = 1;
+    disorder_close(c);
+    return NULL;
+  }
+  p = xmalloc(sizeof *p);
+  p->cookie = xstrdup(cookie);
+  p->client = c;
+  p->created = now;
+  p->next = pool;
+  pool = p;
+  return p;
+}
+
+/** @brief Collect finished children and put their connections back */
+static void scgi_reap(void) {
+  struct pooled *p, **pp;
+  pid_t pid;
+  int w;
+
+  while((pid = waitpid(-1, &w, WNOHANG)) > 0) {
+    for(pp = &pool; (p = *pp) && p->pid != pid; pp = &p->next)
+      ;
+    if(!p)
+      continue;
+    if(WIFEXITED(w) && WEXITSTATUS(w) == SCGI_KEEP)
+      p->pid = 0;
+    else
+      pool_discard(pp);
+  }
+}
+
+/** @brief Read exactly @p n bytes from @p fd
+ * @return 0 on success, -1 on error or EOF
+ */
+static int scgi_read(int fd, char *buffer, size_t n) {
+  ssize_t r;
+
+  while(n > 0) {
+    r = read(fd, buffer, n);
+    if(r > 0) {
+      buffer += r;
+      n -= r;
+    } else if(r == 0) {
+      disorder_error(0, "unexpected EOF reading SCGI request");
+      return -1;
+    } else if(errno != EINTR) {
+      disorder_error(errno, "error reading SCGI request");
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/** @brief Read an SCGI request's headers into the environment
+ * @param fd Connection from web server
+ * @param names Where to record the names of the variables set
+ * @return 0 on success, -1 on error
+ *
+ * The headers are a netstring containing alternating null-terminated names
+ * and values.  The request body, if any, is left unread.
+ */
+static int scgi_headers(int fd, struct vector *names) {
+  char c, *headers, *ptr, *end, *name, *value;
+  size_t n = 0;
+
+  /* Netstring length, terminated by a colon */
+  for(;;) {
+    if(scgi_read(fd, &c, 1))
+      return -1;
+    if(c == ':')
+      break;
+    if(c < '0' || c > '9' || (n = 10 * n + c - '0') > SCGI_MAX_HEADERS) {
+      disorder_error(0, "malformed SCGI header length");
+      return -1;
+    }
+  }
+  headers = xmalloc_noptr(n + 1);
+  if(scgi_read(fd, headers, n + 1))
+    return -1;
+  if(headers[n] != ',' || (n && headers[n - 1])) {
+    disorder_error(0, "malformed SCGI headers");
+    return -1;
+  }
+  for(ptr = headers, end = headers + n; ptr < end;) {
+    name = ptr;
+    ptr += strlen(ptr) + 1;
+    if(ptr >= end) {
+      disorder_error(0, "SCGI header %s has no value", name);
+      return -1;
+    }
+    value = ptr;
+    ptr += strlen(ptr) + 1;
+    if(setenv(name, value, 1) < 0) {
+      disorder_error(errno, "error setting %s", name);
+      return -1;
+    }
+    vector_append(names, name);
+  }
+  return 0;
+}
+
+/** @brief Remove @p *sp from the list of streams and close it */
+static void stream_discard(struct stream **sp) {
+  struct stream *s = *sp;
+
+  *sp = s->next;
+  xclose(s->fd);
+}
+
+/** @brief Send @p n bytes at @p data to every stream
+ *
+ * A browser that can't keep up is disconnected rather than buffered for.  It
+ * will reconnect, and fetch the page again to catch up.
+ */
+static void streams_send(const char *data, size_t n) {
+  struct stream *s, **sp;
+
+  for(sp = &streams; (s = *sp);) {
+    if(write(s->fd, data, n) != (ssize_t)n) {
+      stream_discard(sp);
+      continue;
+    }
+    sp = &s->next;
+  }
+}
+
+/** @brief Test whether the current request is for the event stream
+ * @return Nonzero for an event stream request
+ */
+static int scgi_is_events(void) {
+  const char *method = getenv("REQUEST_METHOD"), *q, *action;
+
+  if(method && strcmp(method, "GET"))
+    return 0;
+  if(!(q = getenv("QUERY_STRING")))
+    return 0;
+  action = kvp_get(kvp_urldecode(q, strlen(q)), "action");
+  return action && !strcmp(action, "events");
+}
+
+/** @brief Start a process following the event log, if there isn't one
+ *
+ * The process logs in as guest and copies each line of the log to a pipe.
+ * It exits if its connection fails, after which we try again, but not more
+ * than once every @ref EVENTS_RETRY seconds.
+ */
+static void events_start(void) {
+  struct stream *s;
+  disorder_client *c;
+  time_t now = xtime(0);
+  FILE *fp;
+  int p[2];
+
+  if(events_fd != -1 || now < events_started + EVENTS_RETRY)
+    return;
+  events_started = now;
+  xpipe(p);
+  if(!xfork()) {
+    xclose(p[0]);
+    xclose(scgi_fd);
+    for(s = streams; s; s = s->next)
+      xclose(s->fd);
+    if(!(fp = fdopen(p[1], "w")))
+      disorder_fatal(errno, "error calling fdopen");
+    /* Each event should reach the browsers promptly */
+    setvbuf(fp, 0, _IOLBF, BUFSIZ);
+    c = disorder_new(0);
+    if(disorder_connect_cookie(c, 0))
+      _exit(1);
+    disorder_log(c, sink_stdio("event pipe", fp));
+    _exit(0);
+  }
+  xclose(p[1]);
+  nonblock(p[0]);
+  cloexec(p[0]);
+  events_fd = p[0];
+  dynstr_init(&events_input);
+}
+
+/** @brief Read events from @ref events_fd and pass them on */
+static void events_read(void) {
+  char buffer[4096], *start, *nl, *frame;
+  ssize_t r;
+  size_t n;
+
+  r = read(events_fd, buffer, sizeof buffer);
+  if(r < 0 && (errno == EINTR || errno == EAGAIN))
+    return;
+  if(r <= 0) {
+    if(r < 0)
+      disorder_error(errno, "error reading event pipe");
+    xclose(events_fd);
+    events_fd = -1;
+    /* Events will have been missed; make browsers reconnect and catch up */
+    while(streams)
+      stream_discard(&streams);
+    return;
+  }
+  dynstr_append_bytes(&events_input, buffer, r);
+  start = events_input.vec;
+  n = events_input.nvec;
+  while((nl = memchr(start, '\n', n))) {
+    *nl++ = 0;
+    n -= nl - start;
+    byte_xasprintf(&frame, "data: %s\n\n", start);
+    streams_send(frame, strlen(frame));
+    start = nl;
+  }
+  memmove(events_input.vec, start, n);
+  events_input.nvec = n;
+}
+
+/** @brief Start sending events to a browser
+ * @param fd Connection from web server
+ */
+static void stream_add(int fd) {
+  static const char headers[] = "Content-Type: text/event-stream\n"
+                                "Cache-Control: no-cache\n"
+                                "\n";
+  struct stream *s;
+
+  if(write(fd, headers, sizeof headers - 1) != sizeof headers - 1) {
+    xclose(fd);
+    return;
+  }
+  nonblock(fd);
+  s = xmalloc(sizeof *s);
+  s->fd = fd;
+  s->next = streams;
+  streams = s;
+  events_start();
+}
+
+/** @brief Wait for something to happen
+ * @return Nonzero if a new SCGI connection is waiting
+ *
+ * Meanwhile events are passed on to the streams, and streams whose browsers
+ * have gone away are closed.
+ */
+static int scgi_wait(void) {
+  struct pollfd *fds;
+  struct stream *s, **sp;
+  char buffer[256];
+  int nfds = 0, n, nstreams = 0;
+  ssize_t r;
+  time_t now;
+
+  for(s = streams; s; s = s->next)
+    ++nstreams;
+  fds = xcalloc(nstreams + 2, sizeof *fds);
+  fds[nfds].fd = scgi_fd;
+  fds[nfds++].events = POLLIN;
+  if(events_fd != -1) {
+    fds[nfds].fd = events_fd;
+    fds[nfds++].events = POLLIN;
+  }
+  /* Browsers shouldn't send anything, but we need to notice them going */
+  for(s = streams; s; s = s->next) {
+    fds[nfds].fd = s->fd;
+    fds[nfds++].events = POLLIN;
+  }
+  if(poll(fds, nfds, streams ? 1000 * EVENTS_RETRY : -1) < 0) {
+    if(errno != EINTR)
+      disorder_fatal(errno, "error calling poll");
+    return 0;
+  }
+  n = events_fd != -1 ? 2 : 1;
+  for(sp = &streams; (s = *sp); ++n) {
+    if(fds[n].revents) {
+      r = read(s->fd, buffer, sizeof buffer);
+      if(!r || (r < 0 && errno != EINTR && errno != EAGAIN)) {
+        stream_discard(sp);
+        continue;
+      }
+    }
+    sp = &s->next;
+  }
+  if(events_fd != -1 && fds[1].revents)
+    events_read();
+  if(streams) {
+    now = xtime(0);
+    if(now >= events_keptalive + EVENTS_KEEPALIVE) {
+      streams_send(":\n\n", 3);
+      events_keptalive = now;
+    }
+    events_start();
+  }
+  return fds[0].revents != 0;
+}
+
+/** @brief Handle one connection from the web server */
+static void scgi_serve(int fd) {
+  struct vector names;
+  struct pooled *p = 0;
+  struct stream *s;
+  struct timeval tv;
+  pid_t pid;
+  int n, status, bad;
+
+  tv.tv_sec = SCGI_TIMEOUT;
+  tv.tv_usec = 0;
+  xsetsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+  xsetsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+  vector_init(&names);
+  if(!(bad = scgi_headers(fd, &names)) && scgi_is_events()) {
+    /* The stream keeps the connection */
+    stream_add(fd);
+    fd = -1;
+  } else if(!bad) {
+    /* Borrow a connection for the cookie the child will pick */
+    dcgi_cookie = 0;
+    dcgi_get_cookie();
+    p = pool_get(dcgi_cookie);
+    dcgi_cookie = 0;
+    if(!(pid = xfork())) {
+      xclose(scgi_fd);
+      if(events_fd != -1)
+        xclose(events_fd);
+      for(s = streams; s; s = s->next)
+        xclose(s->fd);
+      xdup2(fd, 0);
+      xdup2(fd, 1);
+      xclose(fd);
+      dcgi_client = p ? p->client : 0;
+      dcgi_request();
+      status = p && dcgi_client == p->client ? SCGI_KEEP : 0;
+      exit(status);
+    }
+    if(p)
+      p->pid = pid;
+  }
+  if(fd != -1)
+    xclose(fd);
+  /* Don't let this request's headers leak into the next */
+  for(n = 0; n < names.nvec; ++n)
+    unsetenv(names.vec[n]);
+}
+
+/** @brief Serve SCGI requests
+ * @param nvec Length of @p vec
+ * @param vec Address to listen on, as for the @c listen option
+ *
+ * Never returns.
+ */
+void dcgi_scgi(int nvec, char **vec) {
+  struct netaddress na;
+  struct resolved *res;
+  size_t nres;
+  int fd, one = 1;
+
+  if(netaddress_parse(&na, nvec, vec))
+    disorder_fatal(0, "invalid SCGI listen address");
+  if(netaddress_resolve(&na, 1, SOCK_STREAM, &res, &nres) || !nres)
+    disorder_fatal(0, "cannot resolve SCGI listen address");
+  if(na.af == AF_UNIX && unlink(na.address) < 0 && errno != ENOENT)
+    disorder_fatal(errno, "error removing %s", na.address);
+  scgi_fd = xsocket(res[0].sa->sa_family, SOCK_STREAM, 0);
+  if(na.af != AF_UNIX)
+    xsetsockopt(scgi_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+  if(bind(scgi_fd, res[0].sa, res[0].len) < 0)
+    disorder_fatal(errno, "error binding to %s", format_sockaddr(res[0].sa));
+  xlisten(scgi_fd, 128);
+  cloexec(scgi_fd);
+  /* If the browser goes away the child should find out from write() */
+  signal(SIGPIPE, SIG_IGN);
+  mx_preload();
+  disorder_info("accepting SCGI requests on %s", format_sockaddr(res[0].sa));
+  netaddress_free_resolved(res, nres);
+  dcgi_events = 1;
+  for(;;) {
+    scgi_reap();
+    if(!scgi_wait())
+      continue;
+    if((fd = accept(scgi_fd, 0, 0)) < 0) {
+      if(errno != EINTR && errno != ECONNABORTED)
+        disorder_fatal(errno, "error calling accept");
+      continue;
+    }
+    cloexec(fd);
+    if(fflush(stdout) < 0)
+      disorder_fatal(errno, "error writing to stdout");
+    scgi_serve(fd);
+  }
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
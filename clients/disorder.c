@@ -49,6 +49,7 @@
 #include "log.h"
 #include "queue.h"
 #include "client.h"
+#include "client-common.h"
 #if !_WIN32
 # include "wstat.h"
 #endif
@@ -80,6 +81,7 @@ static const struct option options[] = {
   { "help-commands", no_argument, 0, 'H' },
   { "user", required_argument, 0, 'U' },
   { "password", required_argument, 0, 'P' },
+  { "batch", required_argument, 0, 'b' },
   { 0, 0, 0, 0 }
 };
 
@@ -94,6 +96,7 @@ static void attribute((noreturn)) help(void) {
 	  "  --config PATH, -c PATH  Set system configuration file\n"
 	  "  --user-config PATH, -u PATH  Set user configuration file\n"
 	  "  --local, -l             Force connection to local server\n"
+	  "  --batch PATH, -b PATH   Run server commands from PATH\n"
 	  "  --debug, -d             Turn on debugging\n");
   xfclose(stdout);
   exit(0);
@@ -313,7 +316,39 @@ static void cf_search(char **argv) {
   char **results;
   int nresults, n;
 
-  if(disorder_search(getclient(), *argv, &results, &nresults)) exit(EXIT_FAILURE);
+  if(argv[1]) {
+    if(disorder_search_page(getclient(), argv[0], atol(argv[1]),
+                            argv[2] ? atol(argv[2]) : 0,
+                            &results, &nresults))
+      exit(EXIT_FAILURE);
+  } else if(disorder_search(getclient(), *argv, &results, &nresults))
+    exit(EXIT_FAILURE);
+  for(n = 0; n < nresults; ++n)
+    xprintf("%s\n", nullcheck(utf82mb(results[n])));
+  free_strings(nresults, results);
+}
+
+static void cf_search_fuzzy(char **argv) {
+  char **results;
+  int nresults, n;
+
+  if(disorder_search_fuzzy(getclient(), argv[0],
+                           argv[1] ? atol(argv[1]) : 0,
+                           &results, &nresults))
+    exit(EXIT_FAILURE);
+  for(n = 0; n < nresults; ++n)
+    xprintf("%s\n", nullcheck(utf82mb(results[n])));
+  free_strings(nresults, results);
+}
+
+static void cf_search_prefix(char **argv) {
+  char **results;
+  int nresults, n;
+
+  if(disorder_search_prefix(getclient(), argv[0],
+                            argv[1] ? atol(argv[1]) : 0,
+                            &results, &nresults))
+    exit(EXIT_FAILURE);
   for(n = 0; n < nresults; ++n)
     xprintf("%s\n", nullcheck(utf82mb(results[n])));
   free_strings(nresults, results);
@@ -349,9 +384,21 @@ static void cf_set_volume(char **argv) {
   if(disorder_set_volume(getclient(), atoi(argv[0]), atoi(argv[1]))) exit(EXIT_FAILURE);
 }
 
-static void cf_log(char attribute((unused)) **argv) {
+static int isarg_event(const char attribute((unused)) *s) {
+  /* log never returns, so anything after it is an event name, even if it
+   * looks like a command (e.g. "playing") */
+  return 1;
+}
+
+static void cf_log(char **argv) {
+  int nevents;
+
+  for(nevents = 0; argv[nevents]; ++nevents)
+    ;
   setvbuf(stdout, 0, _IOLBF, BUFSIZ);
-  if(disorder_log(getclient(), sink_stdio("stdout", stdout))) exit(EXIT_FAILURE);
+  if(disorder_log_events(getclient(), sink_stdio("stdout", stdout),
+                         argv, nevents))
+    exit(EXIT_FAILURE);
 }
 
 static void cf_move(char **argv) {
@@ -454,6 +501,50 @@ static void cf_rtp_address(char attribute((unused)) **argv) {
   xprintf("address: %s\nport: %s\n", address, port);
 }
 
+static void cf_rtp_stats(char attribute((unused)) **argv) {
+  char **vec;
+  int nvec;
+  int n;
+
+  if(disorder_rtp_stats(getclient(), &vec, &nvec)) exit(EXIT_FAILURE);
+  for(n = 0; n < nvec; ++n)
+    xprintf("%s\n", nullcheck(utf82mb(vec[n])));
+  free_strings(nvec, vec);
+}
+
+static void cf_db_stats(char attribute((unused)) **argv) {
+  char **vec;
+  int nvec;
+  int n;
+
+  if(disorder_db_stats(getclient(), &vec, &nvec)) exit(EXIT_FAILURE);
+  for(n = 0; n < nvec; ++n)
+    xprintf("%s\n", nullcheck(utf82mb(vec[n])));
+  free_strings(nvec, vec);
+}
+
+static void cf_event_stats(char attribute((unused)) **argv) {
+  char **vec;
+  int nvec;
+  int n;
+
+  if(disorder_event_stats(getclient(), &vec, &nvec)) exit(EXIT_FAILURE);
+  for(n = 0; n < nvec; ++n)
+    xprintf("%s\n", nullcheck(utf82mb(vec[n])));
+  free_strings(nvec, vec);
+}
+
+static void cf_metrics(char attribute((unused)) **argv) {
+  char **vec;
+  int nvec;
+  int n;
+
+  if(disorder_metrics(getclient(), &vec, &nvec)) exit(EXIT_FAILURE);
+  for(n = 0; n < nvec; ++n)
+    xprintf("%s\n", nullcheck(utf82mb(vec[n])));
+  free_strings(nvec, vec);
+}
+
 static int isarg_rights(const char *arg) {
   return strchr(arg, ',') || !parse_rights(arg, 0, 0);
 }
@@ -702,6 +793,63 @@ static void cf_playlist_set(char **argv) {
     exit(EXIT_FAILURE);
 }
 
+/** @brief Convert a playlist position or count */
+static long playlist_position(const char *s) {
+  long n;
+  int e;
+
+  if((e = xstrtol(&n, s, 0, 10)))
+    disorder_fatal(e, "cannot convert '%s'", s);
+  if(n < 0 || n > INT_MAX)
+    disorder_fatal(0, "%ld out of range", n);
+  return n;
+}
+
+static void cf_playlist_insert(char **argv) {
+  int ntracks = 0;
+
+  while(argv[2 + ntracks])
+    ++ntracks;
+  if(disorder_playlist_lock(getclient(), argv[0])
+     || disorder_playlist_insert(getclient(), argv[0],
+                                 playlist_position(argv[1]),
+                                 argv + 2, ntracks)
+     || disorder_playlist_unlock(getclient()))
+    exit(EXIT_FAILURE);
+}
+
+static void cf_playlist_move(char **argv) {
+  if(disorder_playlist_lock(getclient(), argv[0])
+     || disorder_playlist_move(getclient(), argv[0],
+                               playlist_position(argv[1]),
+                               playlist_position(argv[2]),
+                               playlist_position(argv[3]))
+     || disorder_playlist_unlock(getclient()))
+    exit(EXIT_FAILURE);
+}
+
+static void cf_playlist_play(char **argv) {
+  char *id;
+  const char *order = "in-order";
+
+  if(argv[1]) {
+    if(strcmp(argv[1], "shuffle"))
+      disorder_fatal(0, "invalid order '%s'", argv[1]);
+    order = argv[1];
+  }
+  if(disorder_playlist_play(getclient(), argv[0], order, &id))
+    exit(EXIT_FAILURE);
+}
+
+static void cf_playlist_remove(char **argv) {
+  if(disorder_playlist_lock(getclient(), argv[0])
+     || disorder_playlist_remove(getclient(), argv[0],
+                                 playlist_position(argv[1]),
+                                 playlist_position(argv[2]))
+     || disorder_playlist_unlock(getclient()))
+    exit(EXIT_FAILURE);
+}
+
 /** @brief Command-line client's definition of a command */
 static const struct client_command {
   /** @brief Command name */
@@ -735,6 +883,8 @@ static const struct client_command {
   { "authorize",      1, 2, cf_authorize, isarg_rights, "USERNAME [RIGHTS]",
                       "Authorize user USERNAME to connect" },
 #endif
+  { "db-stats",       0, 0, cf_db_stats, 0, "",
+                      "Report database cache and lock statistics" },
   { "deluser",        1, 1, cf_deluser, 0, "USERNAME",
                       "Delete user USERNAME" },
   { "dirs",           1, 2, cf_dirs, isarg_regexp, "DIR [~REGEXP]",
@@ -749,6 +899,8 @@ static const struct client_command {
                       "Enable play" },
   { "enable-random",  0, 0, cf_random_enable, 0, "",
                       "Enable random play" },
+  { "event-stats",    0, 0, cf_event_stats, 0, "",
+                      "Report server event loop callback timings" },
   { "files",          1, 2, cf_files, isarg_regexp, "DIR [~REGEXP]",
                       "List files in DIR" },
   { "get",            2, 2, cf_get, 0, "TRACK NAME",
@@ -759,8 +911,10 @@ static const struct client_command {
                       "Get the current volume" },
   { "length",         1, 1, cf_length, 0, "TRACK",
                       "Get the length of TRACK in seconds" },
-  { "log",            0, 0, cf_log, 0, "",
-                      "Copy event log to stdout" },
+  { "log",            0, INT_MAX, cf_log, isarg_event, "[EVENT...]",
+                      "Copy event log (or just EVENTs) to stdout" },
+  { "metrics",        0, 0, cf_metrics, 0, "",
+                      "Report per-command server statistics" },
   { "move",           2, 2, cf_move, 0, "TRACK DELTA",
                       "Move a track in the queue" },
   { "new",            0, 1, cf_new, isarg_integer, "[MAX]",
@@ -777,6 +931,18 @@ static const struct client_command {
                       "Delete a playlist" },
   { "playlist-get",   1, 1, cf_playlist_get, 0, "PLAYLIST",
                       "Get the contents of a playlist" },
+  { "playlist-insert", 3, INT_MAX, cf_playlist_insert, isarg_filename,
+                      "PLAYLIST POSITION TRACKS...",
+                      "Insert tracks into a playlist" },
+  { "playlist-move",  4, 4, cf_playlist_move, 0,
+                      "PLAYLIST POSITION COUNT TO",
+                      "Move tracks within a playlist" },
+  { "playlist-play",  1, 2, cf_playlist_play, 0,
+                      "PLAYLIST [shuffle]",
+                      "Add a playlist to the queue" },
+  { "playlist-remove", 3, 3, cf_playlist_remove, 0,
+                      "PLAYLIST POSITION COUNT",
+                      "Remove tracks from a playlist" },
   { "playlist-set",   1, 2, cf_playlist_set, isarg_filename, "PLAYLIST [PATH]",
                       "Set the contents of a playlist" },
   { "playlists",      0, 0, cf_playlists, 0, "",
@@ -804,6 +970,8 @@ static const struct client_command {
                       "Resume after a pause" },
   { "rtp-address",    0, 0, cf_rtp_address, 0, "",
                       "Report server's broadcast address" },
+  { "rtp-stats",      0, 0, cf_rtp_stats, 0, "",
+                      "Report RTP listeners' reception statistics" },
   { "schedule-del",   1, 1, cf_schedule_del, 0, "EVENT",
                       "Delete a scheduled event" },
   { "schedule-list",  0, 0, cf_schedule_list, 0, "",
@@ -818,8 +986,12 @@ static const struct client_command {
                       "Scratch the currently playing track" },
   { "scratch-id",     1, 1, cf_scratch, 0, "ID",
                       "Scratch the currently playing track" },
-  { "search",         1, 1, cf_search, 0, "WORDS",
+  { "search",         1, 3, cf_search, isarg_integer, "WORDS [OFFSET [LIMIT]]",
                       "Display tracks matching all the words" },
+  { "search-fuzzy",   1, 2, cf_search_fuzzy, isarg_integer, "WORDS [MAX]",
+                      "Display tracks matching words, allowing for typos" },
+  { "search-prefix",  1, 2, cf_search_prefix, isarg_integer, "WORDS [MAX]",
+                      "Display tracks matching words, the last one partial" },
   { "set",            3, 3, cf_set, 0, "TRACK NAME VALUE",
                       "Set a preference value" },
   { "set-global",     2, 2, cf_set_global, 0, "NAME VALUE",
@@ -873,11 +1045,116 @@ static void attribute((noreturn)) help_commands(void) {
   exit(0);
 }
 
+/* Batch mode ------------------------------------------------------------- */
+
+/** @brief Number of batch commands sent before collecting their responses
+ *
+ * Kept modest so that the server's replies can't back up far enough to stop
+ * it reading while we are still writing.
+ */
+#define BATCH_PIPELINE 256
+
+/** @brief Commands that can't be used in a batch
+ *
+ * @c log never finishes and @c playlist-set expects a body.  Must be kept in
+ * order.
+ */
+static const char *const batch_forbidden[] = {
+  "log",
+  "playlist-set",
+};
+
+/** @brief Batch input name, for error messages */
+static const char *batch_tag;
+
+/** @brief Batch input line number, for error messages */
+static int batch_line;
+
+static void batch_split_error(const char *msg, void attribute((unused)) *u) {
+  disorder_fatal(0, "%s:%d: %s", batch_tag, batch_line, msg);
+}
+
+/** @brief Collect and print the responses to batched commands
+ * @param ncommands Number of commands awaiting responses
+ * @return Number of commands that failed
+ */
+static int batch_collect(int ncommands) {
+  char *r, **body;
+  int rc, nbody, n, failed = 0;
+
+  while(ncommands-- > 0) {
+    if((rc = disorder_pipeline_receive_response(getclient(), &r,
+                                                &body, &nbody)) < 0)
+      exit(EXIT_FAILURE);
+    xprintf("%s\n", nullcheck(utf82mb_f(r)));
+    if(body) {
+      for(n = 0; n < nbody; ++n)
+        xprintf("%s%s\n", body[n][0] == '.' ? "." : "",
+                nullcheck(utf82mb(body[n])));
+      xprintf(".\n");
+      free_strings(nbody, body);
+    }
+    if(rc / 100 != 2)
+      ++failed;
+  }
+  return failed;
+}
+
+/** @brief Run a batch of server commands
+ * @param path File to read, or "-" for standard input
+ * @return Number of commands that failed
+ *
+ * Each line is a server command and its arguments, quoted as in a
+ * configuration file.  The commands are pipelined over the one connection and
+ * each response is printed as it came from the server.
+ */
+static int batch(const char *path) {
+  FILE *input;
+  char *l, **vec;
+  int nvec, n, pending = 0, failed = 0;
+
+  if(strcmp(path, "-")) {
+    if(!(input = fopen(path, "r")))
+      disorder_fatal(errno, "opening %s", path);
+    batch_tag = path;
+  } else {
+    input = stdin;
+    batch_tag = "stdin";
+  }
+  while(!inputline(batch_tag, input, &l, '\n')) {
+    ++batch_line;
+    vec = split(l, &nvec, SPLIT_QUOTES|SPLIT_COMMENTS, batch_split_error, 0);
+    xfree(l);
+    if(!nvec)
+      continue;
+    if(table_find(batch_forbidden, 0, sizeof *batch_forbidden,
+                  sizeof batch_forbidden / sizeof *batch_forbidden,
+                  vec[0]) >= 0)
+      disorder_fatal(0, "%s:%d: %s cannot be used in a batch",
+                     batch_tag, batch_line, vec[0]);
+    for(n = 0; n < nvec; ++n)
+      vec[n] = nullcheck(mb2utf8(vec[n]));
+    if(disorder_pipeline_send(getclient(), vec[0],
+                              disorder__list, vec + 1, nvec - 1,
+                              (char *)0))
+      exit(EXIT_FAILURE);
+    if(++pending == BATCH_PIPELINE) {
+      failed += batch_collect(pending);
+      pending = 0;
+    }
+  }
+  if(ferror(input))
+    disorder_fatal(errno, "reading %s", batch_tag);
+  if(input != stdin)
+    fclose(input);
+  return failed + batch_collect(pending);
+}
+
 int main(int argc, char **argv) {
   int n, i, j, local = 0;
   int status = 0;
   struct vector args;
-  const char *user = 0, *password = 0;
+  const char *user = 0, *password = 0, *batchfile = 0;
 
   mem_init();
   network_init();
@@ -885,7 +1162,7 @@ int main(int argc, char **argv) {
   regexp_setup();
   if(!setlocale(LC_CTYPE, "")) disorder_fatal(errno, "error calling setlocale");
   if(!setlocale(LC_TIME, "")) disorder_fatal(errno, "error calling setlocale");
-  while((n = getopt_long(argc, argv, "+hVc:dHlu:", options, 0)) >= 0) {
+  while((n = getopt_long(argc, argv, "+hVc:dHlu:b:", options, 0)) >= 0) {
     switch(n) {
     case 'h': help();
     case 'H': help_commands();
@@ -897,6 +1174,7 @@ int main(int argc, char **argv) {
     case 'N': config_per_user = 0; break;
     case 'U': user = optarg; break;
     case 'P': password = optarg; break;
+    case 'b': batchfile = optarg; break;
     default: disorder_fatal(0, "invalid option");
     }
   }
@@ -921,6 +1199,8 @@ int main(int argc, char **argv) {
   gcry_control(GCRYCTL_INIT_SECMEM, 0);
   gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
 #endif
+  if(batchfile && batch(batchfile))
+    status = EXIT_FAILURE;
   /* accumulate command args */
   while(n < argc) {
     if((i = TABLE_FIND(commands, name, argv[n])) < 0)
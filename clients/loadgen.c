@@ -0,0 +1,644 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file clients/loadgen.c
+ * @brief Protocol load generator
+ *
+ * Simulates a number of clients talking to the server at once and reports
+ * how long each kind of command took.  Each simulated client has one
+ * connection and runs one command at a time, picking each from a weighted
+ * mix:
+ * - @c browse: walk down the directory tree with @c dirs, then list the
+ *   tracks at the bottom with @c files
+ * - @c search: search for one of a list of terms
+ * - @c queue: fetch the queue, as a client polling for changes does
+ * - @c play: add a track found by browsing, move it and remove it again
+ *
+ * Separately, some clients just subscribe to the event log.
+ *
+ * Uses @ref lib/eclient.c, like Disobedience, so that a single process can
+ * drive many connections.  It is intended for test servers only: the play
+ * mix really does add tracks to the queue.
+ */
+#include "common.h"
+
+#include <getopt.h>
+#include <locale.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/time.h>
+
+#include "mem.h"
+#include "log.h"
+#include "syscalls.h"
+#include "timeval.h"
+#include "version.h"
+#include "configuration.h"
+#include "vector.h"
+#include "queue.h"
+#include "eclient.h"
+
+/** @brief Kinds of command that are timed */
+enum command {
+  cmd_connect,
+  cmd_dirs,
+  cmd_files,
+  cmd_search,
+  cmd_queue,
+  cmd_play,
+  cmd_move,
+  cmd_remove,
+  cmd_count
+};
+
+/** @brief Names of commands, for the report */
+static const char *const command_names[] = {
+  "connect", "dirs", "files", "search", "queue", "play", "move", "remove"
+};
+
+/** @brief Latency statistics for one kind of command */
+struct command_stats {
+  /** @brief Latencies in microseconds */
+  int64_t *samples;
+
+  /** @brief Number of latencies in @ref samples */
+  size_t nsamples;
+
+  /** @brief Size of @ref samples */
+  size_t size;
+
+  /** @brief Number of commands that failed */
+  unsigned long errors;
+};
+
+/** @brief Statistics for each command */
+static struct command_stats stats[cmd_count];
+
+/** @brief Kinds of activity that make up the mix */
+enum activity {
+  act_browse,
+  act_search,
+  act_queue,
+  act_play,
+  act_count
+};
+
+/** @brief Names of activities, for the --mix option */
+static const char *const activity_names[] = {
+  "browse", "search", "queue", "play"
+};
+
+/** @brief Relative weight of each activity */
+static unsigned weights[act_count] = { 40, 20, 30, 10 };
+
+/** @brief One simulated client */
+struct client {
+  /** @brief Connection */
+  disorder_eclient *ec;
+
+  /** @brief File descriptor, or -1 */
+  int fd;
+
+  /** @brief What to poll @ref fd for */
+  unsigned mode;
+
+  /** @brief Index of @ref fd in the poll() array, or -1 */
+  int slot;
+
+  /** @brief Nonzero while a command is outstanding */
+  int busy;
+
+  /** @brief Nonzero for a log subscriber */
+  int log;
+
+  /** @brief When to issue the next command */
+  struct timeval next;
+
+  /** @brief Current directory when browsing, or NULL for the top */
+  char *dir;
+
+  /** @brief Nonzero to list files in @ref dir rather than directories */
+  int want_files;
+
+  /** @brief Track to move and then remove (play mix) */
+  char *id;
+};
+
+/** @brief State of one outstanding command */
+struct request {
+  /** @brief Client that sent it */
+  struct client *c;
+
+  /** @brief What kind of command it is */
+  enum command cmd;
+
+  /** @brief When it was sent */
+  struct timeval sent;
+};
+
+/** @brief All clients */
+static struct client *clients;
+
+/** @brief Number of clients */
+static int nclients = 10;
+
+/** @brief Number of log subscribers */
+static int nlog = 1;
+
+/** @brief How long to run, in seconds */
+static long duration = 30;
+
+/** @brief Mean pause between commands, in milliseconds */
+static long think_ms = 0;
+
+/** @brief Search terms */
+static struct vector terms;
+
+/** @brief Tracks found by browsing, for the play mix */
+static struct vector tracks;
+
+/** @brief Most tracks to remember in @ref tracks */
+#define MAX_TRACKS 4096
+
+/** @brief Set once it is time to stop issuing commands */
+static int stopping;
+
+/** @brief Number of connection errors */
+static unsigned long comms_errors;
+
+/** @brief Number of log events received */
+static unsigned long log_events;
+
+/** @brief Record a command's latency
+ * @param r Request that has completed
+ * @param err Error string or NULL
+ */
+static void record(struct request *r, const char *err) {
+  struct command_stats *const s = &stats[r->cmd];
+  struct timeval now;
+
+  xgettimeofday(&now, NULL);
+  if(err) {
+    ++s->errors;
+    D(("%s: %s", command_names[r->cmd], err));
+  } else {
+    if(s->nsamples == s->size) {
+      s->size = s->size ? 2 * s->size : 1024;
+      s->samples = xrealloc_noptr(s->samples, s->size * sizeof *s->samples);
+    }
+    s->samples[s->nsamples++] = tvsub_us(now, r->sent);
+  }
+  r->c->busy = 0;
+  r->c->next = now;
+  if(think_ms) {
+    const long pause_us = random() % (2 * think_ms * 1000 + 1);
+    r->c->next.tv_sec += pause_us / 1000000;
+    r->c->next.tv_usec += pause_us % 1000000;
+    if(r->c->next.tv_usec >= 1000000) {
+      ++r->c->next.tv_sec;
+      r->c->next.tv_usec -= 1000000;
+    }
+  }
+}
+
+/** @brief Start timing a command
+ * @param c Client sending it
+ * @param cmd What kind of command it is
+ * @return Request to pass to the completion callback
+ */
+static struct request *request_new(struct client *c, enum command cmd) {
+  struct request *r = xmalloc(sizeof *r);
+
+  r->c = c;
+  r->cmd = cmd;
+  xgettimeofday(&r->sent, NULL);
+  c->busy = 1;
+  return r;
+}
+
+static void version_response(void *v, const char *err,
+                             const char attribute((unused)) *value) {
+  record(v, err);
+}
+
+static void queue_response(void *v, const char *err,
+                           struct queue_entry attribute((unused)) *q) {
+  record(v, err);
+}
+
+static void list_response(void *v, const char *err,
+                          int attribute((unused)) nvec,
+                          char attribute((unused)) **vec) {
+  record(v, err);
+}
+
+/** @brief Called with a directory listing; goes down a level */
+static void dirs_response(void *v, const char *err, int nvec, char **vec) {
+  struct request *r = v;
+  struct client *c = r->c;
+
+  record(r, err);
+  if(err)
+    c->dir = NULL;
+  else if(nvec > 0)
+    c->dir = xstrdup(vec[random() % nvec]);
+  else
+    c->want_files = 1;
+}
+
+/** @brief Called with a file listing; goes back to the top */
+static void files_response(void *v, const char *err, int nvec, char **vec) {
+  struct request *r = v;
+  struct client *c = r->c;
+  int n;
+
+  record(r, err);
+  for(n = 0; !err && n < nvec; ++n) {
+    if(tracks.nvec < MAX_TRACKS)
+      vector_append(&tracks, xstrdup(vec[n]));
+    else
+      tracks.vec[random() % MAX_TRACKS] = xstrdup(vec[n]);
+  }
+  c->dir = NULL;
+  c->want_files = 0;
+}
+
+/** @brief Called when a remove completes; the play mix is over */
+static void remove_response(void *v, const char *err) {
+  struct request *r = v;
+
+  record(r, err);
+  r->c->id = NULL;
+}
+
+/** @brief Called when a move completes; removes the track */
+static void move_response(void *v, const char *err) {
+  struct request *r = v;
+  struct client *c = r->c;
+
+  record(r, err);
+  disorder_eclient_remove(c->ec, remove_response, c->id,
+                          request_new(c, cmd_remove));
+}
+
+/** @brief Called when a play completes; moves the new track */
+static void play_response(void *v, const char *err, const char *id) {
+  struct request *r = v;
+  struct client *c = r->c;
+
+  record(r, err);
+  if(err || !id)
+    return;
+  c->id = xstrdup(id);
+  disorder_eclient_move(c->ec, move_response, c->id, 1,
+                        request_new(c, cmd_move));
+}
+
+/** @brief Issue a client's next command
+ * @param c Client
+ */
+static void next_command(struct client *c) {
+  unsigned total = 0, pick;
+  int a;
+
+  for(a = 0; a < act_count; ++a)
+    total += weights[a];
+  pick = random() % total;
+  for(a = 0; pick >= weights[a]; ++a)
+    pick -= weights[a];
+  if(a == act_play && !tracks.nvec)
+    a = act_browse;                     /* nothing to play yet */
+  switch(a) {
+  case act_browse:
+    if(c->want_files)
+      disorder_eclient_files(c->ec, files_response, c->dir, NULL,
+                             request_new(c, cmd_files));
+    else
+      disorder_eclient_dirs(c->ec, dirs_response, c->dir, NULL,
+                            request_new(c, cmd_dirs));
+    break;
+  case act_search:
+    disorder_eclient_search(c->ec, list_response,
+                            terms.vec[random() % terms.nvec],
+                            request_new(c, cmd_search));
+    break;
+  case act_queue:
+    disorder_eclient_queue(c->ec, queue_response,
+                           request_new(c, cmd_queue));
+    break;
+  case act_play:
+    disorder_eclient_play(c->ec, play_response,
+                          tracks.vec[random() % tracks.nvec],
+                          request_new(c, cmd_play));
+    break;
+  }
+}
+
+static void comms_error(void attribute((unused)) *u, const char *msg) {
+  ++comms_errors;
+  D(("comms error: %s", msg));
+}
+
+static void protocol_error(void attribute((unused)) *u,
+                           void attribute((unused)) *v,
+                           int attribute((unused)) code,
+                           const char *msg) {
+  D(("protocol error: %s", msg));
+}
+
+static void poll_callback(void *u, disorder_eclient attribute((unused)) *ec,
+                          int fd, unsigned mode) {
+  struct client *c = u;
+
+  c->fd = mode ? fd : -1;
+  c->mode = mode;
+}
+
+static void report(void attribute((unused)) *u,
+                   const char attribute((unused)) *msg) {
+}
+
+static const disorder_eclient_callbacks callbacks = {
+  comms_error,
+  protocol_error,
+  poll_callback,
+  report
+};
+
+static void log_event(void attribute((unused)) *v,
+                      const char attribute((unused)) *track) {
+  ++log_events;
+}
+
+static void log_playing(void attribute((unused)) *v,
+                        const char attribute((unused)) *track,
+                        const char attribute((unused)) *user) {
+  ++log_events;
+}
+
+static void log_queue(void attribute((unused)) *v,
+                      struct queue_entry attribute((unused)) *q) {
+  ++log_events;
+}
+
+static void log_removed(void attribute((unused)) *v,
+                        const char attribute((unused)) *id,
+                        const char attribute((unused)) *user) {
+  ++log_events;
+}
+
+static const disorder_eclient_log_callbacks log_callbacks = {
+  .completed = log_event,
+  .moved = log_event,
+  .playing = log_playing,
+  .queue = log_queue,
+  .removed = log_removed,
+};
+
+/** @brief Compare latencies for qsort() */
+static int compare_samples(const void *av, const void *bv) {
+  const int64_t a = *(const int64_t *)av, b = *(const int64_t *)bv;
+
+  return a < b ? -1 : a > b;
+}
+
+/** @brief Return a percentile of some sorted latencies in milliseconds */
+static double percentile(const struct command_stats *s, int p) {
+  size_t n = (s->nsamples * p + 99) / 100;
+
+  if(!s->nsamples)
+    return 0;
+  return s->samples[n ? n - 1 : 0] / 1000.0;
+}
+
+/** @brief Write the report
+ * @param elapsed Seconds spent running
+ */
+static void write_report(double elapsed) {
+  unsigned long total = 0;
+  int n;
+
+  xprintf("# command\tcount\terrors\tp50_ms\tp90_ms\tp99_ms\tmax_ms\n");
+  for(n = 0; n < cmd_count; ++n) {
+    struct command_stats *const s = &stats[n];
+
+    qsort(s->samples, s->nsamples, sizeof *s->samples, compare_samples);
+    total += s->nsamples;
+    if(printf("%s\t%zu\t%lu\t%.3f\t%.3f\t%.3f\t%.3f\n", command_names[n],
+              s->nsamples, s->errors, percentile(s, 50), percentile(s, 90),
+              percentile(s, 99), percentile(s, 100)) < 0)
+      disorder_fatal(errno, "error writing to stdout");
+  }
+  if(printf("# %lu commands from %d clients in %.1fs (%.1f/s); "
+            "%lu log events to %d subscribers; %lu connection errors\n",
+            total, nclients, elapsed, total / elapsed,
+            log_events, nlog, comms_errors) < 0)
+    disorder_fatal(errno, "error writing to stdout");
+}
+
+/** @brief Parse a --mix argument
+ * @param s Argument, e.g. "browse=40,search=20,queue=30,play=10"
+ *
+ * Activities that are not mentioned get weight 0.
+ */
+static void parse_mix(const char *s) {
+  char *copy = xstrdup(s), *element, *eq, *e, *saveptr;
+  unsigned total = 0;
+  int a;
+
+  for(a = 0; a < act_count; ++a)
+    weights[a] = 0;
+  for(element = strtok_r(copy, ",", &saveptr); element;
+      element = strtok_r(NULL, ",", &saveptr)) {
+    if(!(eq = strchr(element, '=')))
+      disorder_fatal(0, "invalid mix element '%s'", element);
+    *eq++ = 0;
+    for(a = 0; a < act_count && strcmp(element, activity_names[a]); ++a)
+      ;
+    if(a == act_count)
+      disorder_fatal(0, "unknown activity '%s'", element);
+    weights[a] = strtoul(eq, &e, 10);
+    if(*e || e == eq)
+      disorder_fatal(0, "invalid weight '%s'", eq);
+    total += weights[a];
+  }
+  if(!total)
+    disorder_fatal(0, "--mix must give something a nonzero weight");
+}
+
+static const struct option options[] = {
+  { "help", no_argument, 0, 'h' },
+  { "version", no_argument, 0, 'V' },
+  { "config", required_argument, 0, 'c' },
+  { "debug", no_argument, 0, 'd' },
+  { "clients", required_argument, 0, 'n' },
+  { "log-clients", required_argument, 0, 'l' },
+  { "duration", required_argument, 0, 't' },
+  { "think", required_argument, 0, 'k' },
+  { "mix", required_argument, 0, 'm' },
+  { "search", required_argument, 0, 's' },
+  { "seed", required_argument, 0, 'S' },
+  { 0, 0, 0, 0 }
+};
+
+/* display usage message and terminate */
+static void attribute((noreturn)) help(void) {
+  xprintf("Usage:\n"
+          "  disorder-loadgen [OPTIONS]\n"
+          "Options:\n"
+          "  --help, -h              Display usage message\n"
+          "  --version, -V           Display version number\n"
+          "  --config PATH, -c PATH  Set configuration file\n"
+          "  --debug, -d             Turn on debugging\n"
+          "  --clients, -n COUNT     Number of active clients (10)\n"
+          "  --log-clients, -l COUNT Number of log subscribers (1)\n"
+          "  --duration, -t SECONDS  How long to run (30)\n"
+          "  --think, -k MS          Mean pause between commands (0)\n"
+          "  --mix, -m SPEC          Activity weights\n"
+          "                          (browse=40,search=20,queue=30,play=10)\n"
+          "  --search, -s TERM       Add a search term (may be repeated)\n"
+          "  --seed, -S SEED         Random seed (1)\n"
+          "\n"
+          "Simulates many clients and reports per-command latency\n"
+          "percentiles.  The play mix adds tracks to the queue and\n"
+          "removes them again; use a test server.\n");
+  xfclose(stdout);
+  exit(0);
+}
+
+int main(int argc, char **argv) {
+  struct pollfd *fds;
+  struct timeval started, now, finish;
+  unsigned mode;
+  int n, nfds, timeout, outstanding;
+
+  set_progname(argv);
+  mem_init();
+  if(!setlocale(LC_CTYPE, ""))
+    disorder_fatal(errno, "error calling setlocale");
+  vector_init(&terms);
+  vector_init(&tracks);
+  srandom(1);
+  while((n = getopt_long(argc, argv, "hVc:dn:l:t:k:m:s:S:",
+                         options, 0)) >= 0) {
+    switch(n) {
+    case 'h': help();
+    case 'V': version("disorder-loadgen");
+    case 'c': configfile = optarg; break;
+    case 'd': debugging = 1; break;
+    case 'n': nclients = atoi(optarg); break;
+    case 'l': nlog = atoi(optarg); break;
+    case 't': duration = atol(optarg); break;
+    case 'k': think_ms = atol(optarg); break;
+    case 'm': parse_mix(optarg); break;
+    case 's': vector_append(&terms, optarg); break;
+    case 'S': srandom(strtoul(optarg, 0, 0)); break;
+    default: disorder_fatal(0, "invalid option");
+    }
+  }
+  if(optind != argc)
+    disorder_fatal(0, "too many arguments");
+  if(nclients < 0 || nlog < 0 || nclients + nlog == 0)
+    disorder_fatal(0, "no clients");
+  if(duration <= 0 || think_ms < 0)
+    disorder_fatal(0, "invalid timing option");
+  if(!terms.nvec) {
+    vector_append(&terms, (char *)"love");
+    vector_append(&terms, (char *)"night");
+    vector_append(&terms, (char *)"blue song");
+  }
+  if(config_read(0, NULL))
+    disorder_fatal(0, "cannot read configuration");
+  clients = xcalloc(nclients + nlog, sizeof *clients);
+  fds = xcalloc(nclients + nlog, sizeof *fds);
+  for(n = 0; n < nclients + nlog; ++n) {
+    struct client *const c = &clients[n];
+
+    c->fd = -1;
+    c->log = n >= nclients;
+    c->ec = disorder_eclient_new(&callbacks, c);
+    /* The first command's latency includes connecting and logging in */
+    disorder_eclient_version(c->ec, version_response,
+                             request_new(c, cmd_connect));
+    if(c->log)
+      disorder_eclient_log(c->ec, &log_callbacks, c);
+  }
+  xgettimeofday(&started, NULL);
+  finish = started;
+  finish.tv_sec += duration;
+  for(;;) {
+    xgettimeofday(&now, NULL);
+    if(!stopping && tvge(&now, &finish))
+      stopping = 1;
+    outstanding = 0;
+    for(n = 0; n < nclients; ++n) {
+      struct client *const c = &clients[n];
+
+      if(!c->busy && !stopping && tvge(&now, &c->next))
+        next_command(c);
+      outstanding += c->busy;
+    }
+    if(stopping && !outstanding)
+      break;
+    if(stopping && tvsub_us(now, finish) > 10000000) {
+      disorder_error(0, "giving up on %d outstanding commands", outstanding);
+      break;
+    }
+    /* Wait for something to happen */
+    for(n = nfds = 0; n < nclients + nlog; ++n) {
+      struct client *const c = &clients[n];
+
+      if(c->fd != -1) {
+        fds[nfds].fd = c->fd;
+        fds[nfds].events = ((c->mode & DISORDER_POLL_READ ? POLLIN : 0)
+                            | (c->mode & DISORDER_POLL_WRITE ? POLLOUT : 0));
+        fds[nfds].revents = 0;
+        c->slot = nfds++;
+      } else
+        c->slot = -1;
+    }
+    timeout = think_ms ? 10 : 100;
+    if(poll(fds, nfds, timeout) < 0 && errno != EINTR)
+      disorder_fatal(errno, "error calling poll");
+    /* Tell every client what happened, so that retries work too */
+    for(n = 0; n < nclients + nlog; ++n) {
+      struct client *const c = &clients[n];
+
+      mode = 0;
+      if(c->slot != -1) {
+        if(fds[c->slot].revents & (POLLIN|POLLHUP|POLLERR))
+          mode |= DISORDER_POLL_READ;
+        if(fds[c->slot].revents & (POLLOUT|POLLERR))
+          mode |= DISORDER_POLL_WRITE;
+      }
+      disorder_eclient_polled(c->ec, mode);
+    }
+  }
+  xgettimeofday(&now, NULL);
+  write_report(tvsub_us(now, started) / 1e6);
+  xfclose(stdout);
+  return 0;
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -283,6 +283,9 @@ int main(int argc, char **argv) {
       disorder_info("ignored a short packet");
       continue;
     }
+    /* Skip RTCP packets (RFC5761) */
+    if(header.mpt >= 192 && header.mpt <= 223)
+      continue;
     frames(&when, (n - sizeof header) / bpf);
   }
 }
@@ -24,9 +24,16 @@
 #include <string.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <errno.h>
 #include <unistd.h>
 
+/** @brief Size of the buffer used when the file can't be mapped */
+#define HREADER_BUFFER 65536
+
+/** @brief Size of the window mapped at a time (a multiple of any page size) */
+#define HREADER_WINDOW 1048576
+
 static int hreader_fill(struct hreader *h, off_t offset);
 
 int hreader_init(const char *path, struct hreader *h) {
@@ -36,14 +43,24 @@ int hreader_init(const char *path, struct hreader *h) {
   memset(h, 0, sizeof *h);
   h->path = xstrdup(path);
   h->size = sb.st_size;
-  h->bufsize = 65536;
-  h->buffer = xmalloc_noptr(h->bufsize);
+  h->nomap = !S_ISREG(sb.st_mode);
   return 0;
 }
 
+/** @brief Discard the buffer or mapping */
+static void hreader_discard(struct hreader *h) {
+  if(h->mapped)
+    munmap(h->buffer, h->bytes);
+  else
+    xfree(h->buffer);
+  h->buffer = 0;
+  h->mapped = 0;
+  h->bytes = 0;
+}
+
 void hreader_close(struct hreader *h) {
   xfree(h->path);
-  xfree(h->buffer);
+  hreader_discard(h);
 }
 
 int hreader_read(struct hreader *h, void *buffer, size_t n) {
@@ -57,32 +74,83 @@ int hreader_pread(struct hreader *h, void *buffer, size_t n, off_t offset) {
   size_t bytes_read = 0;
 
   while(bytes_read < n) {
-    // If the desired byte range is outside the file, fetch new contents
-    if(offset < h->buf_offset || offset >= h->buf_offset + (off_t)h->bytes) {
-      int r = hreader_fill(h, offset);
-      if(r < 0)
-        return -1;                      /* disaster! */
-      else if(r == 0)
-        break;                          /* end of file */
-    }
-    // Figure out how much we can read this time round
-    size_t left = h->bytes - (offset - h->buf_offset);
+    size_t left;
+    const char *ptr = hreader_peek(h, offset, &left);
+    if(!ptr)
+      return -1;                        /* disaster! */
+    else if(!left)
+      break;                            /* end of file */
     // Truncate the read if we don't want that much
     if(left > (n - bytes_read))
       left = n - bytes_read;
-    memcpy((char *)buffer + bytes_read,
-           h->buffer + (offset - h->buf_offset),
-           left);
+    memcpy((char *)buffer + bytes_read, ptr, left);
     offset += left;
     bytes_read += left;
   }
   return bytes_read;
 }
 
+const char *hreader_peek(struct hreader *h, off_t offset, size_t *np) {
+  // If the desired byte range is outside the file, fetch new contents
+  if(offset < h->buf_offset || offset >= h->buf_offset + (off_t)h->bytes) {
+    int r = hreader_fill(h, offset);
+    if(r < 0)
+      return 0;
+    else if(r == 0) {
+      *np = 0;
+      return h->buffer ? h->buffer : "";
+    }
+  }
+  *np = h->bytes - (offset - h->buf_offset);
+  return h->buffer + (offset - h->buf_offset);
+}
+
+/** @brief Map the window of the file containing @p offset
+ * @return Bytes mapped, 0 at end of file, or -1 if mapping failed
+ */
+static int hreader_map(struct hreader *h, int fd, off_t offset) {
+  const off_t start = offset - offset % HREADER_WINDOW;
+  size_t len;
+  void *map;
+
+  if(start >= h->size)
+    return 0;
+  len = h->size - start < HREADER_WINDOW ? h->size - start : HREADER_WINDOW;
+  if((map = mmap(0, len, PROT_READ, MAP_SHARED, fd, start)) == MAP_FAILED)
+    return -1;
+#if HAVE_MADVISE
+  madvise(map, len, MADV_SEQUENTIAL);
+#endif
+#if HAVE_POSIX_FADVISE
+  /* Ask for the next window early too, which matters most on network
+   * filesystems */
+  posix_fadvise(fd, start + len, HREADER_WINDOW, POSIX_FADV_WILLNEED);
+#endif
+  hreader_discard(h);
+  h->buffer = map;
+  h->mapped = 1;
+  h->buf_offset = start;
+  h->bytes = len;
+  return len;
+}
+
 static int hreader_fill(struct hreader *h, off_t offset) {
   int fd = open(h->path, O_RDONLY);
   if(fd < 0)
     return -1;
+  if(!h->nomap) {
+    int r = hreader_map(h, fd, offset);
+    if(r >= 0) {
+      close(fd);
+      return r;
+    }
+    h->nomap = 1;                       /* don't try again */
+  }
+  if(h->mapped || !h->buffer) {
+    hreader_discard(h);
+    h->bufsize = HREADER_BUFFER;
+    h->buffer = xmalloc_noptr(h->bufsize);
+  }
   int n = pread(fd, h->buffer, h->bufsize, offset);
   close(fd);
   if(n < 0)
@@ -213,17 +213,29 @@ int wav_data(struct wavfile *f,
   off_t left = f->datasize;
   off_t where = f->data + 8;
   char buffer[4096];
+  const char *ptr;
   int err;
   ssize_t n;
+  size_t avail;
   const size_t bytes_per_frame = f->channels * ((f->bits + 7) / 8);
 
   while(left > 0) {
     size_t want = (off_t)sizeof buffer > left ? (size_t)left : sizeof buffer;
 
     want -= want % bytes_per_frame;
-    if((n = hreader_pread(f->input, buffer, want, where)) < 0) return errno;
-    if((size_t)n < want) return EINVAL;
-    if((err = callback(f, buffer, n, u))) return err;
+    /* Hand over the reader's own copy if it has whole frames of it */
+    if(!(ptr = hreader_peek(f->input, where, &avail))) return errno;
+    if((off_t)avail > left) avail = left;
+    avail -= avail % bytes_per_frame;
+    if(avail) {
+      if((err = callback(f, ptr, avail, u))) return err;
+      n = avail;
+    } else {
+      /* A frame straddles the end of what the reader has */
+      if((n = hreader_pread(f->input, buffer, want, where)) < 0) return errno;
+      if((size_t)n < want) return EINVAL;
+      if((err = callback(f, buffer, n, u))) return err;
+    }
     where += n;
     left -= n;
   }
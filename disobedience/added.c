@@ -28,6 +28,9 @@
  * disobedience/queue-generic.c requires @ref queue_entry structures
  * with a valid and unique @c id field.  This function fakes it.
  */
+/** @brief Interned ID for @c added-list-changed */
+static event_id added_list_changed;
+
 static void added_completed(void attribute((unused)) *v,
                             const char *err,
                             int nvec, char **vec) {
@@ -51,7 +54,9 @@ static void added_completed(void attribute((unused)) *v,
   *qq = 0;
   ql_new_queue(&ql_added, qh);
   /* Tell anyone who cares */
-  event_raise("added-list-changed", qh);
+  if(!added_list_changed)
+    added_list_changed = event_intern("added-list-changed");
+  event_raise_id(added_list_changed, qh);
 }
 
 /** @brief Update the newly-added list */
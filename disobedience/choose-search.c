@@ -67,9 +67,6 @@ static guint choose_search_timeout_id;
 
 static void choose_search_entry_changed(GtkEditable *editable,
                                         gpointer user_data);
-static gboolean choose_get_visible_range(GtkTreeView *tree_view,
-                                         GtkTreePath **startpathp,
-                                         GtkTreePath **endpathp);
 
 int choose_is_search_result(const char *track) {
   return choose_search_hash && hash_find(choose_search_hash, track);
@@ -327,13 +324,15 @@ static void initiate_search(void) {
     return;
   }
   char *terms = xstrdup(gtk_entry_get_text(GTK_ENTRY(choose_search_entry)));
-  /* Strip leading and trailing space */
+  /* Strip leading space, and all but one trailing space.  A trailing space
+   * means the last word is finished; otherwise it is matched as a prefix. */
   while(*terms == ' ')
     ++terms;
   char *e = terms + strlen(terms);
-  while(e > terms && e[-1] == ' ')
+  while(e > terms + 1 && e[-1] == ' ' && e[-2] == ' ')
     --e;
   *e = 0;
+  const int prefix = e > terms && e[-1] != ' ';
   if(choose_search_terms && !strcmp(terms, choose_search_terms)) {
     /* Search terms have not actually changed in any way that matters */
     return;
@@ -345,7 +344,10 @@ static void initiate_search(void) {
     choose_search_completed(0, 0, 0, 0);
     return;
   }
-  if(disorder_eclient_search(client, choose_search_completed, terms, 0)) {
+  if(prefix
+     ? disorder_eclient_search_prefix(client, choose_search_completed, terms,
+                                      SEARCH_PREFIX_MAX, 0)
+     : disorder_eclient_search(client, choose_search_completed, terms, 0)) {
     /* Bad search terms.  Fake a completion call. */
     choose_search_completed(0, 0, 0, 0);
     return;
@@ -401,9 +403,9 @@ static void choose_search_entry_changed
  * out of date at time of writing), and I'm not yet prepared to rule out Fink
  * support.
  */
-static gboolean choose_get_visible_range(GtkTreeView *tree_view,
-                                         GtkTreePath **startpathp,
-                                         GtkTreePath **endpathp) {
+gboolean choose_get_visible_range(GtkTreeView *tree_view,
+                                  GtkTreePath **startpathp,
+                                  GtkTreePath **endpathp) {
   GdkRectangle visible_tc[1];
 
   /* Get the visible rectangle in tree coordinates */
@@ -164,13 +164,135 @@ static gboolean choose_set_state_callback(GtkTreeModel attribute((unused)) *mode
   return FALSE;                         /* continue walking */
 }
 
+/** @brief Step to the previous row in display order
+ * @param it Iterator, updated to point to previous row
+ * @return True if there was a previous row
+ *
+ * Only rows that are showing (i.e. whose parents are all expanded) are
+ * visited.
+ */
+static gboolean choose_prev_row(GtkTreeIter *it) {
+  GtkTreeModel *const model = GTK_TREE_MODEL(choose_store);
+  GtkTreePath *path = gtk_tree_model_get_path(model, it);
+  GtkTreeIter child[1];
+  gboolean valid;
+  int n;
+
+  if(gtk_tree_path_prev(path)) {
+    valid = gtk_tree_model_get_iter(model, it, path);
+    /* Descend to the last showing row below the previous sibling */
+    while(valid
+          && gtk_tree_view_row_expanded(GTK_TREE_VIEW(choose_view), path)
+          && (n = gtk_tree_model_iter_n_children(model, it)) > 0) {
+      gtk_tree_model_iter_nth_child(model, child, it, n - 1);
+      *it = *child;
+      gtk_tree_path_free(path);
+      path = gtk_tree_model_get_path(model, it);
+    }
+  } else if((valid = gtk_tree_model_iter_parent(model, child, it)))
+    *it = *child;
+  gtk_tree_path_free(path);
+  return valid;
+}
+
+/** @brief Step to the next row in display order
+ * @param it Iterator, updated to point to next row
+ * @return True if there was a next row
+ */
+static gboolean choose_next_row(GtkTreeIter *it) {
+  GtkTreeModel *const model = GTK_TREE_MODEL(choose_store);
+  GtkTreePath *path = gtk_tree_model_get_path(model, it);
+  GtkTreeIter next[1];
+  gboolean expanded;
+
+  expanded = gtk_tree_view_row_expanded(GTK_TREE_VIEW(choose_view), path);
+  gtk_tree_path_free(path);
+  if(expanded && gtk_tree_model_iter_children(model, next, it)) {
+    *it = *next;
+    return TRUE;
+  }
+  for(;;) {
+    *next = *it;
+    if(gtk_tree_model_iter_next(model, next)) {
+      *it = *next;
+      return TRUE;
+    }
+    if(!gtk_tree_model_iter_parent(model, next, it))
+      return FALSE;
+    *it = *next;
+  }
+}
+
+/** @brief Idle callback ID for choose_update_window(), or 0 */
+static guint choose_window_id;
+
+/** @brief Update the rows in and near the visible part of the tree
+ *
+ * Filling in every row of a large directory means a length and a resolve
+ * lookup for every track, so only the rows on screen, and @ref
+ * CHOOSE_PREFETCH_ROWS either side of them, are updated.  Other rows are
+ * updated as they are scrolled into view.
+ */
+static gboolean choose_update_window(gpointer attribute((unused)) data) {
+  GtkTreeModel *const model = GTK_TREE_MODEL(choose_store);
+  GtkTreePath *startpath = 0, *endpath = 0, *path;
+  GtkTreeIter it[1], prev[1];
+  gboolean itv;
+  int n, after = -1;
+
+  choose_window_id = 0;
+  choose_get_visible_range(GTK_TREE_VIEW(choose_view), &startpath, &endpath);
+  if(startpath) {
+    itv = gtk_tree_model_get_iter(model, it, startpath);
+    /* Back up to cover the rows just above the visible ones */
+    for(n = 0; itv && n < CHOOSE_PREFETCH_ROWS; ++n) {
+      *prev = *it;
+      if(!choose_prev_row(prev))
+        break;
+      *it = *prev;
+    }
+  } else {
+    /* Nothing visible yet; do the first few rows */
+    itv = gtk_tree_model_get_iter_first(model, it);
+    after = 2 * CHOOSE_PREFETCH_ROWS;
+  }
+  while(itv && after != 0) {
+    choose_set_state_callback(0, 0, it, 0);
+    if(after > 0)
+      --after;
+    else if(endpath) {
+      path = gtk_tree_model_get_path(model, it);
+      if(!gtk_tree_path_compare(path, endpath))
+        /* Reached the last visible row; do a few more */
+        after = CHOOSE_PREFETCH_ROWS;
+      gtk_tree_path_free(path);
+    }
+    itv = choose_next_row(it);
+  }
+  if(startpath)
+    gtk_tree_path_free(startpath);
+  if(endpath)
+    gtk_tree_path_free(endpath);
+  return FALSE;                         /* don't call again */
+}
+
+/** @brief Arrange for choose_update_window() to be called */
+static void choose_schedule_update(void) {
+  if(!choose_window_id)
+    choose_window_id = g_idle_add(choose_update_window, 0);
+}
+
 /** @brief Called when the queue or playing track change */
 static void choose_set_state(const char attribute((unused)) *event,
                              void attribute((unused)) *eventdata,
                              void attribute((unused)) *callbackdata) {
-  gtk_tree_model_foreach(GTK_TREE_MODEL(choose_store),
-                         choose_set_state_callback,
-                         NULL);
+  choose_schedule_update();
+}
+
+/** @brief Called when the tree is scrolled */
+static void choose_scrolled(GtkAdjustment attribute((unused)) *adjustment,
+                            gpointer attribute((unused)) user_data) {
+  choose_schedule_update();
 }
 
 /** @brief (Re-)populate a node
@@ -282,9 +404,6 @@ static void choose_populate(GtkTreeRowReference *parent_ref,
                          SORT_COLUMN, td->sort,
                          AUTOCOLLAPSE_COLUMN, FALSE,
                          -1);
-      /* Update length and state; we expect this to kick off length lookups
-       * rather than necessarily get the right value the first time round. */
-      choose_set_state_callback(0, 0, child, 0);
       /* If we inserted a directory, insert a placeholder too, so it appears to
        * have children; it will be deleted when we expand the directory. */
       if(!isfile) {
@@ -330,6 +449,11 @@ static void choose_populate(GtkTreeRowReference *parent_ref,
     gtk_tree_row_reference_free(parent_ref);
     gtk_tree_path_free(parent_path);
   }
+  /* Fill in length and state for the new rows that can be seen; we expect
+   * this to kick off lookups rather than necessarily get the right values the
+   * first time round. */
+  if(inserted)
+    choose_schedule_update();
 skip:
   /* We only notify others that we've inserted tracks when there are no more
    * insertions pending, so that they don't have to keep track of how many
@@ -683,6 +807,10 @@ GtkWidget *choose_widget(void) {
   /* Catch row expansions so we can fill in placeholders */
   g_signal_connect(choose_view, "row-expanded",
                    G_CALLBACK(choose_row_expanded), 0);
+  /* Catch scrolling so we can fill in rows as they come into view */
+  g_signal_connect(gtk_tree_view_get_vadjustment(GTK_TREE_VIEW(choose_view)),
+                   "value-changed",
+                   G_CALLBACK(choose_scrolled), 0);
 
   event_register("queue-list-changed", choose_set_state, 0);
   event_register("playing-track-changed", choose_set_state, 0);
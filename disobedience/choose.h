@@ -47,7 +47,17 @@ enum {
 
 #ifndef SEARCH_DELAY_MS
 /** @brief Delay between last keypress in search entry and start of search */
-# define SEARCH_DELAY_MS 500            /* milliseconds */
+# define SEARCH_DELAY_MS 200            /* milliseconds */
+#endif
+
+#ifndef CHOOSE_PREFETCH_ROWS
+/** @brief Rows either side of the visible ones to fill in */
+# define CHOOSE_PREFETCH_ROWS 50
+#endif
+
+#ifndef SEARCH_PREFIX_MAX
+/** @brief Most results to ask for while the last search word is unfinished */
+# define SEARCH_PREFIX_MAX 500
 #endif
 
 extern GtkTreeStore *choose_store;
@@ -83,6 +93,9 @@ void choose_search_new(void);
 void choose_menu_moretracks(const char *event,
                             void *eventdata,
                             void *callbackdata);
+gboolean choose_get_visible_range(GtkTreeView *tree_view,
+                                  GtkTreePath **startpathp,
+                                  GtkTreePath **endpathp);
 
 #endif /* CHOOSE_H */
 
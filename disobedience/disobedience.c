@@ -30,6 +30,9 @@
 /* Apologies for the numerous de-consting casts, but GLib et al do not seem to
  * have heard of const. */
 
+/** @brief Maximum number of objects (names, lengths, images) to cache */
+#define CACHE_OBJECTS 20000
+
 /* Variables --------------------------------------------------------------- */
 
 /** @brief Event loop */
@@ -359,6 +362,9 @@ static gboolean periodic_slow(gpointer attribute((unused)) data) {
 }
 
 /** @brief Called frequently */
+/** @brief Interned ID for @c periodic-fast */
+static event_id periodic_fast_event;
+
 static gboolean periodic_fast(gpointer attribute((unused)) data) {
 #if 0                                   /* debugging hack */
   static struct timeval last;
@@ -394,7 +400,9 @@ static gboolean periodic_fast(gpointer attribute((unused)) data) {
     recheck_rights = 0;
   if(recheck_rights)
     check_rights();
-  event_raise("periodic-fast", 0);
+  if(!periodic_fast_event)
+    periodic_fast_event = event_intern("periodic-fast");
+  event_raise_id(periodic_fast_event, 0);
   return TRUE;
 }
 
@@ -577,6 +585,10 @@ int main(int argc, char **argv) {
   if(!(client = gtkclient())
      || !(logclient = gtkclient()))
     return 1;                           /* already reported an error */
+  /* keep the cache within bounds on big libraries */
+  cache_limit(CACHE_OBJECTS);
+  /* reuse track details saved last time */
+  lookups_init();
   /* periodic operations (e.g. expiring the cache, checking local volume) */
   g_timeout_add(600000/*milliseconds*/, periodic_slow, 0);
   g_timeout_add(1000/*milliseconds*/, periodic_fast, 0);
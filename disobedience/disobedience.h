@@ -197,7 +197,11 @@ void queue_properties(struct queuelike *ql);
 int queued(const char *track);
 /* Return nonzero iff TRACK is queued or playing */
 
+void queue_delta(int nvec, char **vec);
+/* Apply a queue_change log entry */
+
 extern struct queue_entry *playing_track;
+extern int queue_deltas;
 
 /* Lookups */
 const char *namepart(const char *track,
@@ -211,6 +215,8 @@ void namepart_update(const char *track,
                      const char *part);
 /* Called when a namepart might have changed */
 
+void lookups_init(void);
+
 /* Choose */
 
 GtkWidget *choose_widget(void);
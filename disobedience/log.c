@@ -33,6 +33,7 @@ static void log_failed(void *v, const char *track, const char *status);
 static void log_moved(void *v, const char *user);
 static void log_playing(void *v, const char *track, const char *user);
 static void log_queue(void *v, struct queue_entry *q);
+static void log_queue_change(void *v, int nvec, char **vec);
 static void log_recent_added(void *v, struct queue_entry *q);
 static void log_recent_removed(void *v, const char *id);
 static void log_removed(void *v, const char *id, const char *user);
@@ -50,6 +51,7 @@ static void log_playlist_deleted(void *v,
                                  const char *playlist);
 static void log_global_pref(void *v,
                             const char *name, const char *value);
+static void log_resumed(void *v);
 
 /** @brief Callbacks for server state monitoring */
 const disorder_eclient_log_callbacks log_callbacks = {
@@ -59,6 +61,7 @@ const disorder_eclient_log_callbacks log_callbacks = {
   .moved = log_moved,
   .playing = log_playing,
   .queue = log_queue,
+  .queue_change = log_queue_change,
   .recent_added = log_recent_added,
   .recent_removed = log_recent_removed,
   .removed = log_removed,
@@ -72,6 +75,7 @@ const disorder_eclient_log_callbacks log_callbacks = {
   .playlist_modified = log_playlist_modified,
   .playlist_deleted = log_playlist_deleted,
   .global_pref = log_global_pref,
+  .resumed = log_resumed,
 };
 
 /** @brief Update everything */
@@ -98,6 +102,15 @@ static void log_connected(void attribute((unused)) *v) {
   event_raise("log-connected", 0);
 }
 
+/** @brief Called when the client reconnects and the log is resumed
+ *
+ * The server will send everything we missed, so there's no need to fetch
+ * everything again.
+ */
+static void log_resumed(void attribute((unused)) *v) {
+  event_raise("log-connected", 0);
+}
+
 /** @brief Called when the current track finishes playing */
 static void log_completed(void attribute((unused)) *v,
                           const char attribute((unused)) *track) {
@@ -112,7 +125,8 @@ static void log_failed(void attribute((unused)) *v,
 /** @brief Called when some track is moved within the queue */
 static void log_moved(void attribute((unused)) *v,
                       const char attribute((unused)) *user) {
-  event_raise("queue-changed", 0);
+  if(!queue_deltas)
+    event_raise("queue-changed", 0);
 }
 
 static void log_playing(void attribute((unused)) *v,
@@ -124,7 +138,18 @@ static void log_playing(void attribute((unused)) *v,
 /** @brief Called when a track is added to the queue */
 static void log_queue(void attribute((unused)) *v,
                       struct queue_entry attribute((unused)) *q) {
-  event_raise("queue-changed", 0);
+  if(!queue_deltas)
+    event_raise("queue-changed", 0);
+}
+
+/** @brief Called when the queue changes
+ *
+ * Servers that send this also send the older entries above, which are
+ * ignored once queue_delta() is keeping the queue up to date.
+ */
+static void log_queue_change(void attribute((unused)) *v,
+                             int nvec, char **vec) {
+  queue_delta(nvec, vec);
 }
 
 /** @brief Called when a track is added to the recently-played list */
@@ -146,7 +171,8 @@ static void log_recent_removed(void attribute((unused)) *v,
 static void log_removed(void attribute((unused)) *v,
                         const char attribute((unused)) *id,
                         const char attribute((unused)) *user) {
-  event_raise("queue-changed", 0);
+  if(!queue_deltas)
+    event_raise("queue-changed", 0);
 }
 
 /** @brief Called when the current track is scratched */
@@ -221,7 +247,8 @@ static void log_rights_changed(void attribute((unused)) *v,
 static void log_adopted(void attribute((unused)) *v,
                         const char attribute((unused)) *id,
                         const char attribute((unused)) *who) {
-  event_raise("queue-changed", 0);
+  if(!queue_deltas)
+    event_raise("queue-changed", 0);
 }
 
 static void log_playlist_created(void attribute((unused)) *v,
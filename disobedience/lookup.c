@@ -17,65 +17,363 @@
  */
 /** @file disobedience/lookup.c
  * @brief Disobedience server lookups and caching
+ *
+ * Name part and length lookups are gathered for a short while and then sent
+ * as bulk requests.  As each response arrives the @c lookups-arrived event is
+ * raised with the affected tracks; once nothing is outstanding @c
+ * lookups-completed is raised too.
+ *
+ * Answers are also saved to a file in the user's profile directory, with
+ * the server's track database generation.  At startup they are loaded back
+ * into the cache if the generation still matches.  Until the server has
+ * said what its generation is, lookups are held back.
  */
 #include "disobedience.h"
+#include <sys/stat.h>
+
+/** @brief How long to gather lookups before sending them, in milliseconds */
+#define LOOKUP_DELAY_MS 20
+
+/** @brief Maximum number of tracks in one bulk request */
+#define LOOKUP_CHUNK 256
+
+/** @brief Maximum number of answers to save */
+#define LOOKUP_SAVE_MAX 20000
 
 static int namepart_lookups_outstanding;
 static const struct cache_type cachetype_string = { 3600 };
 static const struct cache_type cachetype_integer = { 3600 };
 
+/** @brief A single lookup */
+struct lookup {
+  /** @brief Cache key */
+  const char *key;
+
+  /** @brief Track the lookup is about */
+  const char *track;
+};
+
+/** @brief Lookups gathered into one bulk request */
+struct lookup_batch {
+  /** @brief Next batch */
+  struct lookup_batch *next;
+
+  /** @brief Context, or NULL for lengths */
+  const char *context;
+
+  /** @brief Name part, or NULL for lengths */
+  const char *part;
+
+  /** @brief Tracks to look up */
+  struct vector tracks;
+};
+
+/** @brief Batches being gathered */
+static struct lookup_batch *lookup_batches;
+
+/** @brief Keys of lookups queued or in flight */
+static hash *lookups_pending;
+
+/** @brief Tracks with new data not yet announced */
+static hash *lookups_arrived;
+
+/** @brief Timeout that sends gathered batches, or 0 */
+static guint lookup_timeout_id;
+
+/** @brief Set while waiting for the first track generation */
+static int lookup_holding;
+
+/** @brief Track generation that @ref lookups_saved belong to, or NULL */
+static char *saved_generation;
+
+/** @brief Answers to save
+ *
+ * Keys are cache keys and values are @c char *.  Lengths are kept in
+ * decimal.
+ */
+static hash *lookups_saved;
+
+/** @brief Track generation and answers loaded from the file */
+static char *loaded_generation;
+
+/** @brief Answers loaded from the file, as for @ref lookups_saved */
+static hash *lookups_loaded;
+
+/** @brief Set when @ref lookups_saved has changed since it was written */
+static int lookups_dirty;
+
+/** @brief Construct the cache key for a namepart */
+static char *namepart_key(const char *track,
+                          const char *context,
+                          const char *part) {
+  char *key;
+
+  byte_xasprintf(&key, "namepart context=%s part=%s track=%s",
+                 context, part, track);
+  return key;
+}
+
+/** @brief Construct the cache key for a length */
+static char *length_key(const char *track) {
+  char *key;
+
+  byte_xasprintf(&key, "length track=%s", track);
+  return key;
+}
+
+/** @brief Remember an answer to save
+ * @param key Cache key
+ * @param value Value
+ */
+static void lookup_save(const char *key, const char *value) {
+  if(!saved_generation)
+    return;
+  if(!lookups_saved)
+    lookups_saved = hash_new(sizeof (char *));
+  if(hash_count(lookups_saved) >= LOOKUP_SAVE_MAX
+     && !hash_find(lookups_saved, key))
+    return;
+  value = xstrdup(value);
+  hash_add(lookups_saved, key, &value, HASH_INSERT_OR_REPLACE);
+  lookups_dirty = 1;
+}
+
+/** @brief Cache a name part or resolved name
+ * @param key Cache key
+ * @param value Value
+ * @param save Nonzero to save it to the file too
+ */
+static void put_string(const char *key, const char *value, int save) {
+  cache_put(&cachetype_string, key, value);
+  if(save)
+    lookup_save(key, value);
+}
+
+/** @brief Cache a length
+ * @param key Cache key
+ * @param len Length or -1 if not known
+ * @param save Nonzero to save it to the file too
+ */
+static void put_length(const char *key, long len, int save) {
+  long *value = xmalloc(sizeof *value);
+  char buffer[32];
+
+  *value = len;
+  cache_put(&cachetype_integer, key, value);
+  if(save) {
+    byte_snprintf(buffer, sizeof buffer, "%ld", len);
+    lookup_save(key, buffer);
+  }
+}
+
+/** @brief Announce tracks with new data
+ *
+ * Raises @c lookups-arrived with a hash of the track names, so that displays
+ * can update just the affected rows.
+ */
+static void lookups_announce(void) {
+  static event_id lookups_arrived_event;
+  hash *const tracks = lookups_arrived;
+
+  if(!tracks)
+    return;
+  lookups_arrived = 0;
+  if(!lookups_arrived_event)
+    lookups_arrived_event = event_intern("lookups-arrived");
+  event_raise_id(lookups_arrived_event, tracks);
+}
+
+/** @brief Record the end of a lookup
+ * @param key Cache key
+ * @param track Track the lookup was about
+ */
+static void lookup_done(const char *key, const char *track) {
+  if(lookups_pending)
+    hash_remove(lookups_pending, key);
+  if(!lookups_arrived)
+    lookups_arrived = hash_new(1);
+  hash_add(lookups_arrived, track, "", HASH_INSERT_OR_REPLACE);
+}
+
 /** @brief Called when a namepart lookup has completed or failed
  *
  * When there are no lookups in flight a redraw is provoked.  This might well
  * provoke further lookups.
  */
 static void namepart_completed_or_failed(void) {
+  static event_id lookups_completed;
+
   --namepart_lookups_outstanding;
-  if(!namepart_lookups_outstanding)
+  if(!namepart_lookups_outstanding) {
+    lookups_announce();
     /* When all lookups complete, we update any displays that care */
-    event_raise("lookups-completed", 0);
+    if(!lookups_completed)
+      lookups_completed = event_intern("lookups-completed");
+    event_raise_id(lookups_completed, 0);
+  }
 }
 
 /** @brief Called when a namepart lookup has completed */
 static void namepart_completed(void *v, const char *err, const char *value) {
+  const struct lookup *l = v;
+
   D(("namepart_completed"));
   if(err) {
     gtk_label_set_text(GTK_LABEL(report_label), err);
     value = "?";
   }
-  const char *key = v;
-  
-  cache_put(&cachetype_string, key, value);
+  put_string(l->key, value, !err);
+  lookup_done(l->key, l->track);
   namepart_completed_or_failed();
 }
 
 /** @brief Called when a length lookup has completed */
-static void length_completed(void *v, const char *err, long l) {
+static void length_completed(void *v, const char *err, long len) {
+  const struct lookup *l = v;
+
   D(("length_completed"));
   if(err) {
     gtk_label_set_text(GTK_LABEL(report_label), err);
-    l = -1;
+    len = -1;
   }
-  const char *key = v;
-  long *value;
-  
-  D(("namepart_completed"));
-  value = xmalloc(sizeof *value);
-  *value = l;
-  cache_put(&cachetype_integer, key, value);
+  put_length(l->key, len, !err);
+  lookup_done(l->key, l->track);
   namepart_completed_or_failed();
 }
 
-/** @brief Arrange to fill in a namepart cache entry */
-static void namepart_fill(const char *track,
-                          const char *context,
-                          const char *part,
-                          const char *key) {
-  D(("namepart_fill %s %s %s %s", track, context, part, key));
+/** @brief Make a @ref lookup */
+static struct lookup *lookup_new(const char *key, const char *track) {
+  struct lookup *l = xmalloc(sizeof *l);
+
+  l->key = key;
+  l->track = xstrdup(track);
+  return l;
+}
+
+/** @brief Called when a bulk lookup has completed
+ *
+ * If the bulk command failed, e.g. because the server is too old to support
+ * it, the tracks are looked up one at a time instead.
+ */
+static void batch_completed(void *v, const char *err, int nvec, char **vec) {
+  struct lookup_batch *b = v;
+  char **fields, *key;
+  int n, nfields;
+  const char *track;
+
+  D(("batch_completed %d", b->tracks.nvec));
+  if(err) {
+    for(n = 0; n < b->tracks.nvec; ++n) {
+      track = b->tracks.vec[n];
+      if(b->part) {
+        key = namepart_key(track, b->context, b->part);
+        disorder_eclient_part(client, namepart_completed,
+                              track, b->context, b->part,
+                              lookup_new(key, track));
+      } else
+        disorder_eclient_length(client, length_completed, track,
+                                lookup_new(length_key(track), track));
+    }
+    return;
+  }
+  for(n = 0; n < nvec; ++n) {
+    if(!(fields = split(vec[n], &nfields, SPLIT_QUOTES, 0, 0)) || !nfields)
+      continue;
+    if(b->part)
+      put_string(namepart_key(fields[0], b->context, b->part),
+                 nfields > 1 ? fields[1] : "?", nfields > 1);
+    else
+      put_length(length_key(fields[0]), nfields > 1 ? atol(fields[1]) : -1,
+                 1);
+  }
+  for(n = 0; n < b->tracks.nvec; ++n) {
+    track = b->tracks.vec[n];
+    if(b->part) {
+      key = namepart_key(track, b->context, b->part);
+      /* Don't ask again for anything the server left out */
+      if(!cache_get(&cachetype_string, key))
+        put_string(key, "?", 0);
+    } else {
+      key = length_key(track);
+      if(!cache_get(&cachetype_integer, key))
+        put_length(key, -1, 0);
+    }
+    lookup_done(key, track);
+  }
+  /* Update displays as each batch arrives, rather than waiting for them all */
+  lookups_announce();
+  for(n = 0; n < b->tracks.nvec; ++n)
+    namepart_completed_or_failed();
+}
+
+/** @brief Send a batch to the server */
+static void batch_send(struct lookup_batch *b) {
+  D(("batch_send %s %s %d", b->context ? b->context : "-",
+     b->part ? b->part : "length", b->tracks.nvec));
+  if(b->part)
+    disorder_eclient_parts_multi(client, batch_completed,
+                                 b->context, b->part,
+                                 b->tracks.vec, b->tracks.nvec, b);
+  else
+    disorder_eclient_lengths_multi(client, batch_completed,
+                                   b->tracks.vec, b->tracks.nvec, b);
+}
+
+/** @brief Send all gathered batches */
+static gboolean lookup_timeout(gpointer attribute((unused)) data) {
+  struct lookup_batch *b, *next;
+
+  lookup_timeout_id = 0;
+  if(lookup_holding)
+    return FALSE;
+  for(b = lookup_batches, lookup_batches = 0; b; b = next) {
+    next = b->next;
+    if(b->tracks.nvec)
+      batch_send(b);
+  }
+  return FALSE;
+}
+
+/** @brief Queue a lookup
+ * @param track Track name
+ * @param context Context, or NULL for a length
+ * @param part Name part, or NULL for a length
+ * @param key Cache key
+ *
+ * Lookups are gathered for @ref LOOKUP_DELAY_MS and then sent as one bulk
+ * request per kind of lookup.  A lookup that is already on its way is not
+ * repeated.
+ */
+static void lookup_queue(const char *track,
+                         const char *context,
+                         const char *part,
+                         const char *key) {
+  struct lookup_batch *b, **bb;
+
+  if(!lookups_pending)
+    lookups_pending = hash_new(1);
+  if(hash_add(lookups_pending, key, "", HASH_INSERT))
+    return;
   ++namepart_lookups_outstanding;
   D(("namepart_lookups_outstanding -> %d\n", namepart_lookups_outstanding));
-  disorder_eclient_part(client, namepart_completed,
-                        track, context, part, (void *)key);
+  for(bb = &lookup_batches; (b = *bb); bb = &b->next)
+    if(!part ? !b->part
+       : b->part && !strcmp(b->part, part) && !strcmp(b->context, context))
+      break;
+  if(!b) {
+    b = xmalloc(sizeof *b);
+    b->context = context ? xstrdup(context) : 0;
+    b->part = part ? xstrdup(part) : 0;
+    vector_init(&b->tracks);
+    *bb = b;
+  }
+  vector_append(&b->tracks, xstrdup(track));
+  if(b->tracks.nvec >= LOOKUP_CHUNK && !lookup_holding) {
+    /* Full up; send it now */
+    *bb = b->next;
+    batch_send(b);
+  } else if(!lookup_timeout_id)
+    lookup_timeout_id = g_timeout_add(LOOKUP_DELAY_MS, lookup_timeout, 0);
 }
 
 /** @brief Look up a namepart
@@ -92,12 +390,11 @@ const char *namepart(const char *track,
   const char *value;
 
   D(("namepart %s %s %s", track, context, part));
-  byte_xasprintf(&key, "namepart context=%s part=%s track=%s",
-                 context, part, track);
+  key = namepart_key(track, context, part);
   value = cache_get(&cachetype_string, key);
   if(!value) {
     D(("deferring..."));
-    namepart_fill(track, context, part, key);
+    lookup_queue(track, context, part, key);
     value = "?";
   }
   return value;
@@ -109,11 +406,10 @@ void namepart_update(const char *track,
                      const char *part) {
   char *key;
 
-  byte_xasprintf(&key, "namepart context=%s part=%s track=%s",
-                 context, part, track);
+  key = namepart_key(track, context, part);
   /* Only refetch if it's actually in the cache. */
   if(cache_get(&cachetype_string, key))
-    namepart_fill(track, context, part, key);
+    lookup_queue(track, context, part, key);
 }
 
 /** @brief Look up a track length
@@ -125,14 +421,12 @@ long namepart_length(const char *track) {
   const long *value;
 
   D(("getlength %s", track));
-  byte_xasprintf(&key, "length track=%s", track);
+  key = length_key(track);
   value = cache_get(&cachetype_integer, key);
   if(value)
     return *value;
   D(("deferring..."));;
-  ++namepart_lookups_outstanding;
-  D(("namepart_lookups_outstanding -> %d\n", namepart_lookups_outstanding));
-  disorder_eclient_length(client, length_completed, track, key);
+  lookup_queue(track, 0, 0, key);
   return -1;
 }
 
@@ -147,15 +441,187 @@ char *namepart_resolve(const char *track) {
   const char *value = cache_get(&cachetype_string, key);
   if(!value) {
     D(("deferring..."));
-    ++namepart_lookups_outstanding;
-    D(("namepart_lookups_outstanding -> %d\n", namepart_lookups_outstanding));
-    disorder_eclient_resolve(client, namepart_completed,
-                             track, (void *)key);
+    if(!lookups_pending)
+      lookups_pending = hash_new(1);
+    if(!hash_add(lookups_pending, key, "", HASH_INSERT)) {
+      ++namepart_lookups_outstanding;
+      D(("namepart_lookups_outstanding -> %d\n", namepart_lookups_outstanding));
+      disorder_eclient_resolve(client, namepart_completed,
+                               track, lookup_new(key, track));
+    }
     value = track;
   }
   return xstrdup(value);
 }
 
+/** @brief Read saved answers into @ref lookups_loaded */
+static void lookups_read(void) {
+  char *path, *line, **vec;
+  FILE *fp;
+  int nvec;
+
+  if(!(path = profile_filename("disobedience-cache")))
+    return;
+  if(!(fp = fopen(path, "r"))) {
+    if(errno != ENOENT)
+      disorder_error(errno, "error opening %s", path);
+    return;
+  }
+  lookups_loaded = hash_new(sizeof (char *));
+  while(!inputline(path, fp, &line, '\n')) {
+    if(!(vec = split(line, &nvec, SPLIT_COMMENTS|SPLIT_QUOTES, 0, 0))
+       || !nvec)
+      continue;
+    if(!strcmp(vec[0], "generation") && nvec == 2)
+      loaded_generation = vec[1];
+    else if(!strcmp(vec[0], "answer") && nvec == 3)
+      hash_add(lookups_loaded, vec[1], &vec[2], HASH_INSERT_OR_REPLACE);
+  }
+  fclose(fp);
+}
+
+/** @brief Write @ref lookups_saved to the file if it has changed */
+static void lookups_write(void) {
+  const char *dir;
+  char *path, *tmp, **keys, **value;
+  FILE *fp;
+  size_t n;
+
+  if(!lookups_dirty || !saved_generation)
+    return;
+  if(!(dir = profile_directory()))
+    return;
+  byte_xasprintf(&path, "%s/disobedience-cache", dir);
+  byte_xasprintf(&tmp, "%s.tmp", path);
+  mkdir(dir, 02700);                    /* make sure directory exists */
+  if(!(fp = fopen(tmp, "w"))) {
+    disorder_error(errno, "error opening %s", tmp);
+    return;
+  }
+  if(fprintf(fp, "# automatically generated!\n\ngeneration %s\n",
+             quoteutf8(saved_generation)) < 0)
+    goto write_error;
+  keys = lookups_saved ? hash_keys(lookups_saved) : 0;
+  for(n = 0; keys && keys[n]; ++n) {
+    value = hash_find(lookups_saved, keys[n]);
+    if(fprintf(fp, "answer %s", quoteutf8(keys[n])) < 0
+       || fprintf(fp, " %s\n", quoteutf8(*value)) < 0)
+      goto write_error;
+  }
+  if(fclose(fp) < 0) {
+    fp = 0;
+  write_error:
+    disorder_error(errno, "error writing to %s", tmp);
+    if(fp)
+      fclose(fp);
+    return;
+  }
+  if(rename(tmp, path) < 0) {
+    disorder_error(errno, "error renaming %s to %s", tmp, path);
+    return;
+  }
+  lookups_dirty = 0;
+}
+
+/** @brief Stop holding back lookups
+ *
+ * Anything the saved answers have satisfied is completed straight away and
+ * the rest is sent to the server.
+ */
+static void lookups_release(void) {
+  struct lookup_batch *b;
+  struct vector left;
+  const char *track;
+  char *key;
+  int n, satisfied = 0;
+
+  lookup_holding = 0;
+  for(b = lookup_batches; b; b = b->next) {
+    vector_init(&left);
+    for(n = 0; n < b->tracks.nvec; ++n) {
+      track = b->tracks.vec[n];
+      if(b->part) {
+        key = namepart_key(track, b->context, b->part);
+        if(!cache_get(&cachetype_string, key)) {
+          vector_append(&left, (char *)track);
+          continue;
+        }
+      } else {
+        key = length_key(track);
+        if(!cache_get(&cachetype_integer, key)) {
+          vector_append(&left, (char *)track);
+          continue;
+        }
+      }
+      lookup_done(key, track);
+      ++satisfied;
+    }
+    b->tracks = left;
+  }
+  lookups_announce();
+  while(satisfied-- > 0)
+    namepart_completed_or_failed();
+  lookup_timeout(0);
+}
+
+/** @brief Called with the server's track generation */
+static void track_generation_completed(void attribute((unused)) *v,
+                                       const char *err,
+                                       const char *generation) {
+  char **keys, **value;
+  size_t n;
+
+  if(err || !generation) {
+    /* Maybe the server is too old; don't save anything */
+    D(("track-generation: %s", err ? err : "no value"));
+    saved_generation = 0;
+    lookups_saved = 0;
+  } else if(!saved_generation || strcmp(saved_generation, generation)) {
+    /* Answers from before now may be out of date */
+    saved_generation = xstrdup(generation);
+    lookups_saved = 0;
+    lookups_dirty = 1;
+    if(lookups_loaded && loaded_generation
+       && !strcmp(loaded_generation, generation)) {
+      /* The saved answers are still good */
+      keys = hash_keys(lookups_loaded);
+      for(n = 0; keys[n]; ++n) {
+        value = hash_find(lookups_loaded, keys[n]);
+        if(!strncmp(keys[n], "length ", 7))
+          put_length(keys[n], atol(*value), 1);
+        else
+          put_string(keys[n], *value, 1);
+      }
+      lookups_dirty = 0;
+    }
+    lookups_loaded = 0;
+    loaded_generation = 0;
+  }
+  if(lookup_holding)
+    lookups_release();
+  lookups_write();
+}
+
+/** @brief Check the server's track generation */
+static void lookups_check(const char attribute((unused)) *event,
+                          void attribute((unused)) *eventdata,
+                          void attribute((unused)) *callbackdata) {
+  disorder_eclient_track_generation(client, track_generation_completed, 0);
+}
+
+/** @brief Set up saved lookups
+ *
+ * Called at startup, once @ref client exists.  Lookups are held back until
+ * the server's track generation is known.
+ */
+void lookups_init(void) {
+  lookups_read();
+  lookup_holding = 1;
+  event_register("periodic-slow", lookups_check, 0);
+  atexit(lookups_write);
+  lookups_check(0, 0, 0);
+}
+
 /*
 Local Variables:
 c-basic-offset:2
@@ -89,6 +89,7 @@ void playlist_modify_retrieved(void *v, const char *err,
                                int nvec,
                                char **vec);
 static void playlist_modify_updated(void *v, const char *err);
+static void playlist_modify_partial(void *v, const char *err);
 static void playlist_modify_unlocked(void *v, const char *err);
 static void playlist_drop(struct queuelike *ql,
                           int ntracks,
@@ -261,7 +262,8 @@ static void playlist_menu_playing(void attribute((unused)) *v,
 
 /** @brief Play received playlist contents
  *
- * Passed as a completion callback by menu_activate_playlist().
+ * Used by playlist_menu_played() with servers too old to have
+ * @b playlist-play.
  */
 static void playlist_menu_received_content(void attribute((unused)) *v,
                                            const char *err,
@@ -274,6 +276,30 @@ static void playlist_menu_received_content(void attribute((unused)) *v,
     disorder_eclient_play(client, playlist_menu_playing, vec[n], NULL);
 }
 
+/** @brief Called when a playlist has been added to the queue
+ * @param v Playlist name
+ */
+static void playlist_menu_played(void *v,
+                                 const char *err,
+                                 const char attribute((unused)) *id) {
+  if(err && !strncmp(err, "500", 3)) {
+    /* Presumably an older server; queue the tracks one at a time */
+    disorder_eclient_playlist_get(client, playlist_menu_received_content,
+                                  v, NULL);
+    return;
+  }
+  if(err)
+    popup_submsg(playlist_window, GTK_MESSAGE_ERROR, err);
+}
+
+/** @brief Add a playlist to the queue
+ * @param playlist Playlist name
+ */
+static void playlist_menu_play(const char *playlist) {
+  disorder_eclient_playlist_play(client, playlist_menu_played, playlist,
+                                 "in-order", xstrdup(playlist));
+}
+
 /** @brief Called to activate a playlist
  *
  * Called when the menu item for a playlist is clicked.
@@ -283,8 +309,7 @@ static void playlist_menu_activate(GtkMenuItem *menuitem,
   GtkLabel *label = GTK_LABEL(GTK_BIN(menuitem)->child);
   const char *playlist = gtk_label_get_text(label);
 
-  disorder_eclient_playlist_get(client, playlist_menu_received_content,
-                                playlist, NULL);
+  playlist_menu_play(playlist);
 }
 
 /** @brief Called when the playlists change
@@ -963,9 +988,7 @@ static int playlist_picker_select_sensitive(void *extra) {
 
 static void playlist_picker_play_activate(GtkMenuItem attribute((unused)) *item,
                                           gpointer attribute((unused)) userdata) {
-  /* Re-use the menu-based activation callback */
-  disorder_eclient_playlist_get(client, playlist_menu_received_content,
-                                playlist_picker_selected, NULL);
+  playlist_menu_play(playlist_picker_selected);
 }
 
 static int playlist_picker_play_sensitive(void *extra) {
@@ -1358,6 +1381,16 @@ static void playlist_modify_updated(void attribute((unused)) *v,
   disorder_eclient_playlist_unlock(client, playlist_modify_unlocked, NULL);
 }
 
+/** @brief Called when one of several updates to the playlist is done
+ *
+ * The last update uses playlist_modify_updated() to unlock the playlist.
+ */
+static void playlist_modify_partial(void attribute((unused)) *v,
+                                    const char *err) {
+  if(err) 
+    popup_submsg(playlist_window, GTK_MESSAGE_ERROR, err);
+}
+
 /** @brief Called when the playlist has been unlocked */
 static void playlist_modify_unlocked(void attribute((unused)) *v,
                                      const char *err) {
@@ -1439,14 +1472,25 @@ static void playlist_drop_modify(struct playlist_modify_data *mod,
      * ins downwards as necessary.
      */
     /* First zero out anything that's moved */
-    int before_ins = 0;
+    int before_ins = 0, first = -1, last = -1, nmoved = 0;
     for(int n = 0; n < nvec; ++n) {
       if(playlist_drop_is_moved(mod, n)) {
         vec[n] = NULL;
         if(n < ins)
           ++before_ins;
+        if(first < 0)
+          first = n;
+        last = n;
+        ++nmoved;
       }
     }
+    /* A contiguous range can be moved without sending the whole playlist */
+    if(nmoved == mod->ntracks && first >= 0 && last - first + 1 == nmoved) {
+      disorder_eclient_playlist_move(client, playlist_modify_updated,
+                                     mod->playlist, first, mod->ntracks,
+                                     ins - before_ins, mod);
+      return;
+    }
     /* Now collapse down the array */
     int i = 0;
     for(int n = 0; n < nvec; ++n) {
@@ -1459,6 +1503,12 @@ static void playlist_drop_modify(struct playlist_modify_data *mod,
      * it */
     ins -= before_ins;
     /* The effect is now the same as an insertion */
+  } else {
+    /* A plain insertion only sends the new tracks */
+    disorder_eclient_playlist_insert(client, playlist_modify_updated,
+                                     mod->playlist, ins,
+                                     mod->tracks, mod->ntracks, mod);
+    return;
   }
   /* This is (now) an insertion */
   nnewvec = nvec + mod->ntracks;
@@ -1492,9 +1542,7 @@ static void playlist_playall_activate(GtkMenuItem attribute((unused)) *menuitem,
                                       gpointer attribute((unused)) user_data) {
   if(!playlist_picker_selected)
     return;
-  /* Re-use the menu-based activation callback */
-  disorder_eclient_playlist_get(client, playlist_menu_received_content,
-                                playlist_picker_selected, NULL);
+  playlist_menu_play(playlist_picker_selected);
 }
 
 /** @brief Called to determine whether the playlist is playable */
@@ -1523,20 +1571,44 @@ static void playlist_remove_activate(GtkMenuItem attribute((unused)) *menuitem,
 }
 
 static void playlist_remove_modify(struct playlist_modify_data *mod,
-                                   int attribute((unused)) nvec, char **vec) {
+                                   int nvec, char attribute((unused)) **vec) {
   GtkTreeIter iter[1];
   gboolean it = gtk_tree_model_get_iter_first(GTK_TREE_MODEL(ql_playlist.store),
                                               iter);
-  int n = 0, m = 0;
-  while(it) {
-    if(!gtk_tree_selection_iter_is_selected(ql_playlist.selection, iter))
-      vec[m++] = vec[n++];
-    else
-      n++;
+  /* selected[n] is nonzero if track n is to be removed */
+  char *selected = xmalloc_noptr(nvec + 1);
+  int n = 0, first = -1;
+  while(it && n < nvec) {
+    selected[n] = gtk_tree_selection_iter_is_selected(ql_playlist.selection,
+                                                      iter);
+    if(selected[n] && first < 0)
+      first = n;
+    ++n;
     it = gtk_tree_model_iter_next(GTK_TREE_MODEL(ql_playlist.store), iter);
   }
-  disorder_eclient_playlist_set(client, playlist_modify_updated, mod->playlist,
-                                vec, m, mod);
+  while(n < nvec)
+    selected[n++] = 0;
+  /* Remove each run of selected tracks, starting from the end so that the
+   * earlier positions stay valid.  Only the last removal unlocks. */
+  n = nvec;
+  while(n > 0) {
+    while(n > 0 && !selected[n - 1])
+      --n;
+    if(!n)
+      break;
+    int end = n;
+    while(n > 0 && selected[n - 1])
+      --n;
+    int more = n > first;
+    disorder_eclient_playlist_remove(client,
+                                     more ? playlist_modify_partial
+                                          : playlist_modify_updated,
+                                     mod->playlist, n, end - n, mod);
+    if(!more)
+      return;
+  }
+  /* Nothing was selected */
+  disorder_eclient_playlist_unlock(client, playlist_modify_unlocked, NULL);
 }
 
 /* Playlists window --------------------------------------------------------- */
@@ -45,11 +45,26 @@
 
 /* Track detail lookup ----------------------------------------------------- */
 
-static void queue_lookups_completed(const char attribute((unused)) *event,
-                                   void attribute((unused)) *eventdata,
-                                   void *callbackdata) {
+/** @brief Called when track details arrive
+ *
+ * @p eventdata is a hash whose keys are the tracks with new details.  Only
+ * their rows are updated.
+ */
+static void queue_lookups_arrived(const char attribute((unused)) *event,
+                                  void *eventdata,
+                                  void *callbackdata) {
   struct queuelike *ql = callbackdata;
-  ql_update_list_store(ql);
+  hash *tracks = eventdata;
+  GtkTreeIter iter[1];
+
+  if(!ql->store)
+    return;
+  gtk_tree_model_get_iter_first(GTK_TREE_MODEL(ql->store), iter);
+  for(struct queue_entry *q = ql->q; q; q = q->next) {
+    if(hash_find(tracks, q->track))
+      ql_update_row(q, iter);
+    gtk_tree_model_iter_next(GTK_TREE_MODEL(ql->store), iter);
+  }
 }
 
 /* Column formatting -------------------------------------------------------- */
@@ -304,12 +319,15 @@ void ql_new_queue(struct queuelike *ql,
   D(("ql_new_queue"));
   ++suppress_actions;
 
-  /* Tell every queue entry which queue owns it */
+  /* Tell every queue entry which queue owns it, and make sure the back links
+   * are right for the incremental updates below */
 #if DEBUG_QUEUE
   fprintf(stderr, "%s: filling in q->ql\n", ql->name);
 #endif
-  for(struct queue_entry *q = newq; q; q = q->next)
+  for(struct queue_entry *q = newq, *prev = 0; q; prev = q, q = q->next) {
     q->ql = ql;
+    q->prev = prev;
+  }
 
 #if DEBUG_QUEUE
   fprintf(stderr, "%s: constructing h\n", ql->name);
@@ -458,6 +476,159 @@ void ql_new_queue(struct queuelike *ql,
   --suppress_actions;
 }
 
+/* Incremental updates ------------------------------------------------------ */
+
+/** @brief Find the row for a queue entry
+ * @param ql Queuelike
+ * @param q Queue entry, or NULL
+ * @param iter Where to store the row
+ * @return TRUE if @p q was found
+ *
+ * Only the linked list is walked to find the row number; the list store is
+ * then indexed directly.
+ */
+static gboolean ql_entry_row(struct queuelike *ql,
+                             const struct queue_entry *q,
+                             GtkTreeIter *iter) {
+  const struct queue_entry *qq;
+  int row = 0;
+
+  for(qq = ql->q; qq && qq != q; qq = qq->next)
+    ++row;
+  if(!qq)
+    return FALSE;
+  return gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(ql->store), iter,
+                                       NULL, row);
+}
+
+/** @brief Link @p q into @p ql's queue just after @p after, or at the head */
+static void ql_link(struct queuelike *ql,
+                    struct queue_entry *q,
+                    struct queue_entry *after) {
+  q->ql = ql;
+  q->prev = after;
+  if(after) {
+    q->next = after->next;
+    after->next = q;
+  } else {
+    q->next = ql->q;
+    ql->q = q;
+  }
+  if(q->next)
+    q->next->prev = q;
+}
+
+/** @brief Unlink @p q from @p ql's queue */
+static void ql_unlink(struct queuelike *ql,
+                      struct queue_entry *q) {
+  struct queue_entry **qq;
+
+  for(qq = &ql->q; *qq != q; qq = &(*qq)->next)
+    ;
+  *qq = q->next;
+  if(q->next)
+    q->next->prev = q->prev;
+}
+
+/** @brief Find a queue entry by ID
+ * @param ql Queuelike
+ * @param id ID to find
+ * @return Queue entry or NULL
+ */
+struct queue_entry *ql_find_id(struct queuelike *ql, const char *id) {
+  struct queue_entry *q;
+
+  for(q = ql->q; q && strcmp(q->id, id); q = q->next)
+    ;
+  return q;
+}
+
+/** @brief Add a new entry to a queuelike
+ * @param ql Queuelike
+ * @param q New entry
+ * @param after Existing entry to insert after, or NULL for the head
+ *
+ * Unlike ql_new_queue(), only the new row is touched.
+ */
+void ql_insert_entry(struct queuelike *ql,
+                     struct queue_entry *q,
+                     struct queue_entry *after) {
+  GtkTreeIter iter[1], where[1];
+
+  ++suppress_actions;
+  if(after && ql_entry_row(ql, after, where))
+    gtk_list_store_insert_after(ql->store, iter, where);
+  else
+    gtk_list_store_prepend(ql->store, iter);
+  ql_link(ql, q, after);
+  ql_update_row(q, iter);
+  --suppress_actions;
+}
+
+/** @brief Remove an entry from a queuelike
+ * @param ql Queuelike
+ * @param q Entry to remove
+ */
+void ql_remove_entry(struct queuelike *ql,
+                     struct queue_entry *q) {
+  GtkTreeIter iter[1];
+
+  ++suppress_actions;
+  if(ql_entry_row(ql, q, iter))
+    gtk_list_store_remove(ql->store, iter);
+  ql_unlink(ql, q);
+  --suppress_actions;
+}
+
+/** @brief Move an entry within a queuelike
+ * @param ql Queuelike
+ * @param q Entry to move
+ * @param after Entry to move after, or NULL for the head
+ */
+void ql_move_entry(struct queuelike *ql,
+                   struct queue_entry *q,
+                   struct queue_entry *after) {
+  GtkTreeIter iter[1], where[1];
+
+  if(q == after || q->prev == after)
+    return;                             /* nothing to do */
+  ++suppress_actions;
+  if(ql_entry_row(ql, q, iter))
+    gtk_list_store_move_after(ql->store, iter,
+                              after && ql_entry_row(ql, after, where)
+                                ? where : NULL);
+  ql_unlink(ql, q);
+  ql_link(ql, q, after);
+  --suppress_actions;
+}
+
+/** @brief Replace an entry in a queuelike with a new version of it
+ * @param ql Queuelike
+ * @param old Existing entry
+ * @param q Replacement
+ */
+void ql_replace_entry(struct queuelike *ql,
+                      struct queue_entry *old,
+                      struct queue_entry *q) {
+  GtkTreeIter iter[1];
+  gboolean found;
+
+  ++suppress_actions;
+  found = ql_entry_row(ql, old, iter);
+  q->ql = ql;
+  q->prev = old->prev;
+  q->next = old->next;
+  if(q->prev)
+    q->prev->next = q;
+  else
+    ql->q = q;
+  if(q->next)
+    q->next->prev = q;
+  if(found)
+    ql_update_row(q, iter);
+  --suppress_actions;
+}
+
 /* Drag and drop ------------------------------------------------------------ */
 
 /** @brief Identify the drop path
@@ -901,8 +1072,8 @@ GtkWidget *init_queuelike(struct queuelike *ql) {
   if(ql->init)
     ql->init(ql);
 
-  /* Update display text when lookups complete */
-  event_register("lookups-completed", queue_lookups_completed, ql);
+  /* Update display text as lookups complete */
+  event_register("lookups-arrived", queue_lookups_arrived, ql);
   
   GtkWidget *scrolled = scroll_widget(ql->view);
   g_object_set_data(G_OBJECT(scrolled), "type", (void *)ql_tabtype(ql));
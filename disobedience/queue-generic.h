@@ -176,6 +176,18 @@ void ql_update_row(struct queue_entry *q,
                    GtkTreeIter *iter);
 void ql_new_queue(struct queuelike *ql,
                   struct queue_entry *newq);
+struct queue_entry *ql_find_id(struct queuelike *ql, const char *id);
+void ql_insert_entry(struct queuelike *ql,
+                     struct queue_entry *q,
+                     struct queue_entry *after);
+void ql_remove_entry(struct queuelike *ql,
+                     struct queue_entry *q);
+void ql_move_entry(struct queuelike *ql,
+                   struct queue_entry *q,
+                   struct queue_entry *after);
+void ql_replace_entry(struct queuelike *ql,
+                      struct queue_entry *old,
+                      struct queue_entry *q);
 const char *column_when(const struct queue_entry *q,
                         const char *data);
 const char *column_who(const struct queue_entry *q,
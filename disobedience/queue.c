@@ -35,12 +35,49 @@ struct queue_entry *playing_track;
  */
 time_t last_playing;
 
+/** @brief Nonzero if the queue is kept up to date from queue_change entries
+ *
+ * Set once we know the generation the queue we have corresponds to.  Until
+ * then, and with servers too old to report it, every change to the queue
+ * means fetching it again.
+ */
+int queue_deltas;
+
+/** @brief Generation that @ref actual_queue corresponds to */
+static unsigned long queue_generation;
+
+/** @brief Generation reported just before the queue now being fetched */
+static unsigned long fetched_generation;
+
+/** @brief Nonzero if @ref fetched_generation is valid */
+static int fetched_generation_valid;
+
+/** @brief Nonzero if the server doesn't support queue-generation */
+static int no_queue_generation;
+
+/** @brief Number of queue fetches in flight */
+static int queue_fetches;
+
+/** @brief A queue change that arrived while the queue was being fetched */
+struct pending_change {
+  struct pending_change *next;
+  int nvec;
+  char **vec;
+};
+
+/** @brief Changes that arrived while the queue was being fetched */
+static struct pending_change *pending_changes, **pending_tail = &pending_changes;
+
 static void queue_completed(void *v,
                             const char *err,
                             struct queue_entry *q);
 static void playing_completed(void *v,
                               const char *err,
                               struct queue_entry *q);
+static void queue_fetch(void);
+
+/** @brief Interned IDs for events raised by queue_playing_changed() */
+static event_id queue_list_changed, playing_track_changed;
 
 /** @brief Called when either the actual queue or the playing track change */
 static void queue_playing_changed(void) {
@@ -55,7 +92,7 @@ static void queue_playing_changed(void) {
         break;
     if(q) {
       disorder_eclient_playing(client, playing_completed, 0);
-      disorder_eclient_queue(client, queue_completed, 0);
+      queue_fetch();
       return;
     }
   }
@@ -71,20 +108,206 @@ static void queue_playing_changed(void) {
   }
   ql_new_queue(&ql_queue, q);
   /* Tell anyone who cares */
-  event_raise("queue-list-changed", q);
-  event_raise("playing-track-changed", playing_track);
+  if(!queue_list_changed) {
+    queue_list_changed = event_intern("queue-list-changed");
+    playing_track_changed = event_intern("playing-track-changed");
+  }
+  event_raise_id(queue_list_changed, q);
+  event_raise_id(playing_track_changed, playing_track);
+}
+
+/** @brief Called when the displayed queue has been changed incrementally */
+static void queue_list_updated(void) {
+  actual_queue = playing_track ? ql_queue.q->next : ql_queue.q;
+  if(!queue_list_changed)
+    queue_list_changed = event_intern("queue-list-changed");
+  event_raise_id(queue_list_changed, ql_queue.q);
+}
+
+/** @brief Report a malformed queue change */
+static void queue_delta_error(const char *msg,
+                              void attribute((unused)) *u) {
+  popup_protocol_error(0, msg);
+}
+
+/** @brief Find the entry a queue change puts things after
+ * @param id ID from the change, or "" for the head of the queue
+ * @param afterp Where to store the entry, or NULL for the head
+ * @return 0 on success, -1 if @p id isn't in the queue
+ *
+ * The head of the server's queue is just after the playing track.
+ */
+static int queue_delta_after(const char *id, struct queue_entry **afterp) {
+  if(!*id)
+    *afterp = playing_track;
+  else if(!(*afterp = ql_find_id(&ql_queue, id)))
+    return -1;
+  return 0;
+}
+
+/** @brief Apply one queue change to the displayed queue
+ * @param nvec Number of fields
+ * @param vec Fields, as in a queue_change log entry
+ * @return 0 on success, -1 if it doesn't fit the queue we have
+ *
+ * As described in disorder_protocol(5), an insertion of an entry we already
+ * have is treated as a move and a removal of one we don't have is ignored,
+ * since after a fetch some of the changes may already be reflected.
+ */
+static int queue_apply_change(int nvec, char **vec) {
+  struct queue_entry *q, *old, *after;
+
+  if(!strcmp(vec[1], "insert") && nvec >= 4) {
+    q = xmalloc(sizeof *q);
+    if(queue_unmarshall_vec(q, nvec - 3, vec + 3, queue_delta_error, 0)
+       || queue_delta_after(vec[2], &after))
+      return -1;
+    if((old = ql_find_id(&ql_queue, q->id)))
+      ql_move_entry(&ql_queue, old, after);
+    else
+      ql_insert_entry(&ql_queue, q, after);
+  } else if(!strcmp(vec[1], "move") && nvec == 4) {
+    if(!(q = ql_find_id(&ql_queue, vec[2]))
+       || queue_delta_after(vec[3], &after))
+      return -1;
+    ql_move_entry(&ql_queue, q, after);
+  } else if(!strcmp(vec[1], "remove") && nvec == 3) {
+    if((q = ql_find_id(&ql_queue, vec[2])) && q != playing_track)
+      ql_remove_entry(&ql_queue, q);
+  } else if(!strcmp(vec[1], "update") && nvec >= 3) {
+    q = xmalloc(sizeof *q);
+    if(queue_unmarshall_vec(q, nvec - 2, vec + 2, queue_delta_error, 0)
+       || !(old = ql_find_id(&ql_queue, q->id)))
+      return -1;
+    ql_replace_entry(&ql_queue, old, q);
+  } else
+    return -1;
+  return 0;
+}
+
+/** @brief Apply a queue change if it is the next one
+ * @param nvec Number of fields
+ * @param vec Fields, as in a queue_change log entry
+ * @return 0 on success or if it's already reflected, -1 if the whole queue
+ * must be fetched again
+ */
+static int queue_next_change(int nvec, char **vec) {
+  unsigned long generation;
+  char *end;
+
+  errno = 0;
+  generation = strtoul(vec[0], &end, 10);
+  if(errno || end == vec[0] || *end)
+    return -1;
+  if(generation <= queue_generation)
+    return 0;                           /* already have it */
+  if(generation != queue_generation + 1 || queue_apply_change(nvec, vec))
+    return -1;
+  queue_generation = generation;
+  return 0;
+}
+
+/** @brief Apply the changes that arrived during a fetch
+ *
+ * If any of them doesn't fit, the queue is fetched again.
+ */
+static void queue_apply_pending(void) {
+  struct pending_change *p;
+  int changed = 0, failed = 0;
+
+  for(p = pending_changes; p && !failed; p = p->next) {
+    if(queue_next_change(p->nvec, p->vec))
+      failed = 1;
+    else
+      changed = 1;
+  }
+  pending_changes = 0;
+  pending_tail = &pending_changes;
+  if(changed)
+    queue_list_updated();
+  if(failed)
+    queue_fetch();
+}
+
+/** @brief Called with a queue change from the server's log
+ * @param nvec Number of fields
+ * @param vec Fields: generation, keyword and arguments
+ *
+ * Changes are applied to the displayed queue directly, so only the affected
+ * rows are touched.  While the queue is being fetched they are saved up for
+ * when it arrives.
+ */
+void queue_delta(int nvec, char **vec) {
+  struct pending_change *p;
+
+  if(queue_fetches) {
+    p = xmalloc(sizeof *p);
+    p->nvec = nvec;
+    p->vec = vec;
+    *pending_tail = p;
+    pending_tail = &p->next;
+    return;
+  }
+  if(!queue_deltas)
+    return;
+  if(queue_next_change(nvec, vec)) {
+    /* We've lost track; start again */
+    queue_fetch();
+    return;
+  }
+  queue_list_updated();
+}
+
+/** @brief Called with the generation of the queue being fetched */
+static void queue_generation_completed(void attribute((unused)) *v,
+                                       const char *err,
+                                       const char *value) {
+  if(err) {
+    /* Presumably an older server; just fetch the whole queue every time */
+    no_queue_generation = 1;
+    fetched_generation_valid = 0;
+    return;
+  }
+  fetched_generation = strtoul(value, 0, 10);
+  fetched_generation_valid = 1;
 }
 
 /** @brief Update the queue itself */
 static void queue_completed(void attribute((unused)) *v,
                             const char *err,
                             struct queue_entry *q) {
+  --queue_fetches;
   if(err) {
     popup_protocol_error(0, err);
     return;
   }
   actual_queue = q;
+  queue_deltas = fetched_generation_valid;
+  queue_generation = fetched_generation;
+  fetched_generation_valid = 0;
   queue_playing_changed();
+  /* Catch up with anything that changed while we were waiting */
+  if(!queue_fetches) {
+    if(queue_deltas)
+      queue_apply_pending();
+    else {
+      pending_changes = 0;
+      pending_tail = &pending_changes;
+    }
+  }
+}
+
+/** @brief Fetch the whole queue
+ *
+ * The queue generation is asked for first, so we know which changes are
+ * reflected in what comes back.
+ */
+static void queue_fetch(void) {
+  gtk_label_set_text(GTK_LABEL(report_label), "updating queue");
+  ++queue_fetches;
+  if(!no_queue_generation)
+    disorder_eclient_queue_generation(client, queue_generation_completed, 0);
+  disorder_eclient_queue(client, queue_completed, 0);
 }
 
 /** @brief Update the playing track */
@@ -108,8 +331,7 @@ static void queue_changed(const char attribute((unused)) *event,
                            void  attribute((unused)) *eventdata,
                            void  attribute((unused)) *callbackdata) {
   D(("queue_changed"));
-  gtk_label_set_text(GTK_LABEL(report_label), "updating queue");
-  disorder_eclient_queue(client, queue_completed, 0);
+  queue_fetch();
 }
 
 /** @brief Schedule an update to the playing track
@@ -162,7 +384,8 @@ static void queue_init(struct queuelike attribute((unused)) *ql) {
    * can be computed correctly */
   event_register("pause-changed", playing_changed, 0);
   event_register("pause-changed", queue_changed, 0);
-  /* Reget the queue whenever it changes */
+  /* Reget the queue whenever it changes (unless queue_delta() is keeping it
+   * up to date) */
   event_register("queue-changed", queue_changed, 0);
   /* ...and once a second anyway */
   g_timeout_add(1000/*ms*/, playing_periodic, 0);
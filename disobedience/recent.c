@@ -23,6 +23,9 @@
 #include "queue-generic.h"
 
 /** @brief Update the recently played list */
+/** @brief Interned ID for @c recent-list-changed */
+static event_id recent_list_changed;
+
 static void recent_completed(void attribute((unused)) *v,
                              const char *err,
                              struct queue_entry *q) {
@@ -45,7 +48,9 @@ static void recent_completed(void attribute((unused)) *v,
   /* Update the display */
   ql_new_queue(&ql_recent, qr);
   /* Tell anyone who cares */
-  event_raise("recent-list-changed", qr);
+  if(!recent_list_changed)
+    recent_list_changed = event_intern("recent-list-changed");
+  event_raise_id(recent_list_changed, qr);
 }
 
 /** @brief Schedule an update to the recently played list
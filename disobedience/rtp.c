@@ -20,185 +20,54 @@
  */
 
 #include "disobedience.h"
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <unistd.h>
-#include <fcntl.h>
-#include <sys/un.h>
-#include <sys/utsname.h>
-#include <sys/wait.h>
+#include "playrtp.h"
 
-/** @brief Path to RTP player's control socket */
-static char *rtp_socket;
-
-/** @brief Path to RTP player's logfile */
-static char *rtp_log;
-
-static char *substitute_instance_name(void) {
-  const char *p = config->rtp_instance_name;
-  struct utsname uts;
-  size_t n;
-  int ok;
-  struct dynstr z;
-
-  ok = (uname(&uts) >= 0);
-  if(!p) p = "%h-rtp";
-  dynstr_init(&z);
-  for(;;) {
-    n = strcspn(p, "%");
-    if(n) { dynstr_append_bytes(&z, p, n); p += n; }
-    if(!*p) break;
-    p++;
-    switch(*p) {
-    case '%': dynstr_append_bytes(&z, "%", 1); p++; break;
-    case 'h':
-      if(ok) { dynstr_append_string(&z, uts.nodename); p++; }
-      else { p++; if(*p) p++; }
-    case 0: break;
-    default: dynstr_append_bytes(&z, p - 1, 2); p++; break;
-    }
-  }
-  dynstr_terminate(&z);
-  return z.vec;
-}
-
-/** @brief Initialize @ref rtp_socket and @ref rtp_log if necessary */
-static void rtp_init(void) {
-  if(!rtp_socket) {
-    const char *dir, *instance;
-    if(!(dir = profile_directory()))
-      disorder_fatal(0, "failed to find profile directory");
-    mkdir(dir, 02700);
-    instance = substitute_instance_name();
-    byte_xasprintf(&rtp_socket, "%s/%s", dir, instance);
-    byte_xasprintf(&rtp_log, "%s/%s.log", dir, instance);
-  }
-}
-
-/** @brief Return a connection to the RTP player's control socket */
-static FILE *rtp_connect(void) {
-  struct sockaddr_un un;
-  int fd;
-  FILE *fp;
-
-  rtp_init();
-  memset(&un, 0, sizeof un);
-  un.sun_family = AF_UNIX;
-  strcpy(un.sun_path, rtp_socket);
-  fd = xsocket(PF_UNIX, SOCK_STREAM, 0);
-  if(connect(fd, (const struct sockaddr *)&un, sizeof un) < 0) {
-    /* Connection refused just means that the player quit without deleting its
-     * socket */
-    switch(errno) {
-    case ECONNREFUSED:
-    case ENOENT:
-      break;
-    default:
-      /* Anything else may be a problem */
-      fpopup_msg(GTK_MESSAGE_ERROR, "connecting to %s: %s",
-                 rtp_socket, strerror(errno));
-      break;
-    }
-    close(fd);
-    return 0;
-  }
-  if(!(fp = fdopen(fd, "r+"))) {
-    fpopup_msg(GTK_MESSAGE_ERROR, "error calling fdopen: %s", strerror(errno));
-    close(fd);
-    return 0;
-  }
-  return fp;
-}
-
-/** @brief Return non-0 iff the RTP player is running */
+/** @brief Return non-0 iff the RTP player is running
+ *
+ * If the player has stopped itself because of an error then it is tidied up
+ * and the error reported.
+ */
 int rtp_running(void) {
-  FILE *fp = rtp_connect();
+  char *msg;
+  int err;
 
-  if(!fp)
-    return 0;                           /* no connection -> not running */
-  fclose(fp);                           /* connection -> running */
-  return 1;
+  if((err = playrtp_failed())) {
+    playrtp_stop();
+    byte_xasprintf(&msg, "network play stopped: %s", strerror(err));
+    popup_msg(GTK_MESSAGE_ERROR, msg);
+  }
+  return playrtp_running();
 }
 
 int rtp_getvol(int *l, int *r) {
-  FILE *fp;
-  int rc = -1;
-
-  fp = rtp_connect(); if(!fp) goto end;
-  fprintf(fp, "getvol\n"); fflush(fp);
-  if(fscanf(fp, "%d %d\n", l, r) != 2) goto end;
-  rc = 0;
-end:
-  if(fp) fclose(fp);
-  return rc;
+  return playrtp_get_volume(l, r);
 }
 
 int rtp_setvol(int *l, int *r) {
-  FILE *fp = rtp_connect(); if(!fp) return -1;
-  fprintf(fp, "setvol %d %d\n", *l, *r); fflush(fp);
-  if(fscanf(fp, "%d %d\n", l, r) != 2) { /* do nothing */ }
-  fclose(fp);
-  return 0;
+  return playrtp_set_volume(l, r);
 }
 
-/** @brief Activate the RTP player if it is not running */
+/** @brief Activate the RTP player if it is not running
+ *
+ * The player runs in background threads within Disobedience, so it stops
+ * when Disobedience does.
+ */
 void start_rtp(void) {
-  pid_t pid;
-  int w, fd;
+  struct playrtp_settings s;
 
   if(rtp_running())
     return;                             /* already running */
-  /* double-fork so we don't have to wait() later */
-  if(!(pid = xfork())) {
-    if(setsid() < 0)
-      disorder_fatal(errno, "error calling setsid");
-    if(!xfork()) {
-      /* grandchild */
-      exitfn = _exit;
-      /* log errors and output somewhere reasonably sane.  rtp_running()
-       * will have made sure the directory exists. */
-      if((fd = open(rtp_log, O_WRONLY|O_CREAT|O_TRUNC, 0600)) < 0)
-	disorder_fatal(errno, "creating %s", rtp_log);
-      if(dup2(fd, 1) < 0
-	 || dup2(fd, 2) < 0)
-	disorder_fatal(errno, "dup2");
-      if(close(fd) < 0)
-	disorder_fatal(errno, "close");
-      /* We don't want to hang onto whatever stdin was */
-      if((fd = open("/dev/null", O_RDONLY)) < 0)
-        disorder_fatal(errno, "opening /dev/null");
-      if(dup2(fd, 0) < 0)
-        disorder_fatal(errno, "dup2");
-      if(close(fd) < 0)
-	disorder_fatal(errno, "close");
-      /* execute the player */
-      execlp("disorder-playrtp",
-	     "disorder-playrtp",
-             "--socket", rtp_socket,
-             "--api", rtp_api,
-             "--config", configfile,
-             "--user-config", userconfigfile,
-             (char *)0);
-      disorder_fatal(errno, "disorder-playrtp");
-    } else {
-      /* child */
-      _exit(0);
-    }
-  } else {
-    /* parent */
-    while(waitpid(pid, &w, 0) < 0 && errno == EINTR)
-      ;
-  }
+  memset(&s, 0, sizeof s);
+  s.backend = uaudio_find(rtp_api);
+  s.rcvbuf = -1;
+  uaudio_set("application", "disobedience");
+  if(playrtp_start(&s))
+    popup_msg(GTK_MESSAGE_ERROR, "cannot start network play");
 }
 
 /** @brief Stop the RTP player if it is running */
 void stop_rtp(void) {
-  FILE *fp = rtp_connect();
-
-  if(!fp)
-    return;                             /* already stopped */
-  fprintf(fp, "stop\n");
-  fclose(fp);
+  playrtp_stop();
 }
 
 static char *rtp_config_file(void) {
@@ -263,8 +132,6 @@ void change_rtp_api(const char *api) {
     stop_rtp();
   rtp_api = api;
   save_rtp_config();
-  // TODO this is racy and does not work; the player doesn't shut down quickly
-  // enough.
   if(running)
     start_rtp();
 }
@@ -0,0 +1,163 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file lib/arena.c @brief Region allocation for short-lived objects */
+
+#include "common.h"
+
+#include "arena.h"
+#include "mem.h"
+
+/** @brief Usual size of a chunk's data area */
+#define ARENA_CHUNK 8192
+
+/** @brief Most data (in bytes) kept across arena_reset()
+ *
+ * Anything beyond this is left for the garbage collector, so that one huge
+ * response doesn't pin its memory forever.
+ */
+#define ARENA_KEEP 65536
+
+/** @brief Alignment of allocations */
+#define ARENA_ALIGN (sizeof (union { long l; double d; void *p; }))
+
+/** @brief One chunk of an arena */
+struct arena_chunk {
+  /** @brief Next chunk */
+  struct arena_chunk *next;
+
+  /** @brief Size of data area */
+  size_t size;
+
+  /** @brief Bytes of data area in use */
+  size_t used;
+
+  /** @brief Data area */
+  union { long l; double d; void *p; } data[];
+};
+
+/** @brief Create a new chunk
+ * @param size Minimum size of data area
+ * @return New chunk
+ */
+static struct arena_chunk *arena_chunk_new(size_t size) {
+  struct arena_chunk *ac;
+
+  if(size < ARENA_CHUNK)
+    size = ARENA_CHUNK;
+  ac = xmalloc(sizeof *ac + size);
+  ac->next = 0;
+  ac->size = size;
+  ac->used = 0;
+  return ac;
+}
+
+/** @brief Initialize an arena
+ * @param a Arena to initialize
+ *
+ * No memory is allocated until it is needed.
+ */
+void arena_init(struct arena *a) {
+  a->chunks = a->current = 0;
+}
+
+/** @brief Allocate memory from an arena
+ * @param a Arena
+ * @param n Number of bytes required
+ * @return Pointer to uninitialized memory, suitably aligned for any type
+ *
+ * The memory remains valid until the next arena_reset().
+ */
+void *arena_alloc(struct arena *a, size_t n) {
+  struct arena_chunk *ac, *new;
+  void *ptr;
+
+  n = (n + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+  if(!a->current)
+    a->current = a->chunks = arena_chunk_new(n);
+  /* Move on through chunks kept from before the last reset; a chunk too
+   * small for this allocation just stays unused until the reset after. */
+  ac = a->current;
+  while(ac->size - ac->used < n && ac->next)
+    ac = ac->next;
+  if(ac->size - ac->used < n) {
+    new = arena_chunk_new(n);
+    ac->next = new;
+    ac = new;
+  }
+  a->current = ac;
+  ptr = (char *)ac->data + ac->used;
+  ac->used += n;
+  return ptr;
+}
+
+/** @brief Duplicate a string into an arena
+ * @param a Arena
+ * @param s String to copy
+ * @return Copy of @p s, valid until the next arena_reset()
+ */
+char *arena_strdup(struct arena *a, const char *s) {
+  return arena_strndup(a, s, strlen(s));
+}
+
+/** @brief Duplicate a prefix of a string into an arena
+ * @param a Arena
+ * @param s String to copy
+ * @param n Number of bytes to copy
+ * @return Copy of the first @p n bytes of @p s, 0-terminated, valid until
+ * the next arena_reset()
+ */
+char *arena_strndup(struct arena *a, const char *s, size_t n) {
+  char *r = arena_alloc(a, n + 1);
+
+  memcpy(r, s, n);
+  r[n] = 0;
+  return r;
+}
+
+/** @brief Release everything allocated from an arena
+ * @param a Arena
+ *
+ * Chunks are kept for reuse, up to @ref ARENA_KEEP bytes' worth.  The space
+ * that was in use is cleared, so that stale pointers don't keep garbage
+ * alive.
+ */
+void arena_reset(struct arena *a) {
+  struct arena_chunk *ac, **acp = &a->chunks;
+  size_t kept = 0;
+
+  while((ac = *acp)) {
+    if(kept + ac->size > ARENA_KEEP && kept) {
+      *acp = 0;
+      break;
+    }
+    memset(ac->data, 0, ac->used);
+    ac->used = 0;
+    kept += ac->size;
+    acp = &ac->next;
+  }
+  a->current = a->chunks;
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
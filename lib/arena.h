@@ -0,0 +1,60 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file lib/arena.h @brief Region allocation for short-lived objects */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+struct arena_chunk;
+
+/** @brief A region of memory that is released all at once
+ *
+ * Allocation is just a pointer bump.  Nothing is freed individually;
+ * instead arena_reset() makes all the space available again, keeping the
+ * chunks for reuse.  This suits things like the formatting of a single
+ * command's response, which would otherwise leave a pile of small objects
+ * behind for the garbage collector.
+ *
+ * Chunks come from xmalloc() so they are scanned by the collector, but
+ * anything allocated from an arena must not be used after the next
+ * arena_reset().
+ */
+struct arena {
+  /** @brief First chunk */
+  struct arena_chunk *chunks;
+
+  /** @brief Chunk currently being allocated from */
+  struct arena_chunk *current;
+};
+
+void arena_init(struct arena *a);
+void *arena_alloc(struct arena *a, size_t n);
+char *arena_strdup(struct arena *a, const char *s);
+char *arena_strndup(struct arena *a, const char *s, size_t n);
+void arena_reset(struct arena *a);
+
+#endif /* ARENA_H */
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
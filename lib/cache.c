@@ -1,6 +1,6 @@
 /*
  * This file is part of DisOrder
- * Copyright (C) 2006-2008 Richard Kettlewell
+ * Copyright (C) 2006-2008, 2013 Richard Kettlewell
  *
  * This program is free software: you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
@@ -15,7 +15,13 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
-/** @file lib/cache.c @brief Object caching */
+/** @file lib/cache.c @brief Object caching
+ *
+ * Entries are kept on two lists in order of use, most recent first: one
+ * for objects with a known size and one for the rest.  When the cache is
+ * over a limit the least recently used entry is thrown out.  Since sized
+ * and unsized entries are on separate lists, this never needs a search.
+ */
 
 #include "common.h"
 
@@ -27,9 +33,6 @@
 #include "syscalls.h"
 #include "cache.h"
 
-/** @brief The global cache */
-static hash *h;
-
 /** @brief One cache entry */
 struct cache_entry {
   /** @brief What type of object this is */
@@ -40,13 +43,158 @@ struct cache_entry {
 
   /** @brief Time that object was inserted into cache */
   time_t birth;
+
+  /** @brief Size of object, or 0 if not known */
+  size_t size;
+
+  /** @brief Key of object */
+  const char *key;
+
+  /** @brief When the object was last used, counting in uses */
+  unsigned long used;
+
+  /** @brief Statistics for @ref type */
+  struct cache_stats *stats;
+
+  /** @brief More recently used entry on the same list, or NULL */
+  struct cache_entry *prev;
+
+  /** @brief Less recently used entry on the same list, or NULL */
+  struct cache_entry *next;
+};
+
+/** @brief A list of entries in order of use */
+struct cache_list {
+  /** @brief Most recently used entry, or NULL */
+  struct cache_entry *head;
+
+  /** @brief Least recently used entry, or NULL */
+  struct cache_entry *tail;
+};
+
+/** @brief Statistics for one object type */
+struct cache_type_stats {
+  /** @brief Object type */
+  const struct cache_type *type;
+
+  /** @brief Statistics */
+  struct cache_stats stats;
+
+  /** @brief Next type */
+  struct cache_type_stats *next;
 };
 
+/** @brief The global cache
+ *
+ * Maps keys to pointers to @ref cache_entry.
+ */
+static hash *h;
+
+/** @brief Entries in order of use
+ *
+ * Element 0 holds unsized objects and element 1 sized ones.
+ */
+static struct cache_list lists[2];
+
+/** @brief Statistics for each type that has been used */
+static struct cache_type_stats *type_stats;
+
+/** @brief Use counter for @ref cache_entry::used */
+static unsigned long uses;
+
+/** @brief Total size of objects in the cache, as given to cache_put_sized() */
+static size_t total_bytes;
+
+/** @brief Limit on @ref total_bytes, or 0 for no limit */
+static size_t budget_bytes;
+
+/** @brief Limit on number of objects, or 0 for no limit */
+static size_t limit_entries;
+
 /** @brief Return true if object @p c has expired */
 static int expired(const struct cache_entry *c, time_t now) {
   return now - c->birth > c->type->lifetime;
 }
 
+/** @brief Find the statistics for a type
+ * @param type Object type
+ * @return Pointer to statistics, created if necessary
+ */
+static struct cache_stats *find_stats(const struct cache_type *type) {
+  struct cache_type_stats *ts;
+
+  for(ts = type_stats; ts; ts = ts->next)
+    if(ts->type == type)
+      return &ts->stats;
+  ts = xmalloc(sizeof *ts);
+  ts->type = type;
+  ts->next = type_stats;
+  type_stats = ts;
+  return &ts->stats;
+}
+
+/** @brief Take an entry off its list
+ * @param c Entry
+ */
+static void unlink_entry(struct cache_entry *c) {
+  struct cache_list *l = &lists[!!c->size];
+
+  if(c->prev)
+    c->prev->next = c->next;
+  else
+    l->head = c->next;
+  if(c->next)
+    c->next->prev = c->prev;
+  else
+    l->tail = c->prev;
+}
+
+/** @brief Put an entry at the front of its list
+ * @param c Entry
+ */
+static void push_entry(struct cache_entry *c) {
+  struct cache_list *l = &lists[!!c->size];
+
+  c->used = ++uses;
+  c->prev = NULL;
+  c->next = l->head;
+  if(l->head)
+    l->head->prev = c;
+  else
+    l->tail = c;
+  l->head = c;
+}
+
+/** @brief Remove an entry from the cache
+ * @param c Entry to remove
+ */
+static void remove_entry(struct cache_entry *c) {
+  unlink_entry(c);
+  total_bytes -= c->size;
+  hash_remove(h, c->key);
+}
+
+/** @brief Throw out an entry to make room
+ * @param c Entry to remove
+ */
+static void evict_entry(struct cache_entry *c) {
+  ++c->stats->evictions;
+  remove_entry(c);
+}
+
+/** @brief Throw out least recently used objects until within limits */
+static void cache_trim(void) {
+  struct cache_entry *u, *s;
+
+  while(budget_bytes && total_bytes > budget_bytes && lists[1].tail)
+    evict_entry(lists[1].tail);
+  while(limit_entries && hash_count(h) > limit_entries) {
+    u = lists[0].tail;
+    s = lists[1].tail;
+    evict_entry(!s || (u && u->used < s->used) ? u : s);
+  }
+}
+
 /** @brief Insert an object into the cache
  * @param type Pointer to object type
  * @param key Unique key
@@ -54,64 +202,137 @@ static int expired(const struct cache_entry *c, time_t now) {
  */
 void cache_put(const struct cache_type *type,
                const char *key, const void *value) {
-  struct cache_entry *c;
+  cache_put_sized(type, key, value, 0);
+}
+
+/** @brief Insert an object of known size into the cache
+ * @param type Pointer to object type
+ * @param key Unique key
+ * @param value Pointer to value
+ * @param size Approximate size of @p value in bytes, or 0 if not known
+ *
+ * Objects with a known size count towards the limit set by cache_budget().
+ * If the cache is over its limit then the least recently used of them are
+ * thrown out, possibly including this one.
+ */
+void cache_put_sized(const struct cache_type *type,
+                     const char *key, const void *value,
+                     size_t size) {
+  struct cache_entry *c, **cp;
   
   if(!h)
-    h = hash_new(sizeof (struct cache_entry));
+    h = hash_new(sizeof (struct cache_entry *));
+  if((cp = hash_find(h, key)))
+    remove_entry(*cp);
   c = xmalloc(sizeof *c);
   c->type = type;
   c->value = value;
+  c->size = size;
+  c->key = xstrdup(key);
+  c->stats = find_stats(type);
   xtime(&c->birth);
-  hash_add(h, key, c,  HASH_INSERT_OR_REPLACE);
+  hash_add(h, key, &c, HASH_INSERT_OR_REPLACE);
+  push_entry(c);
+  total_bytes += size;
+  cache_trim();
+}
+
+/** @brief Set the cache's size limit
+ * @param bytes Maximum total size of sized objects, or 0 for no limit
+ *
+ * Only objects inserted with cache_put_sized() count towards the limit.
+ */
+void cache_budget(size_t bytes) {
+  budget_bytes = bytes;
+  if(h)
+    cache_trim();
+}
+
+/** @brief Set the cache's object limit
+ * @param entries Maximum number of objects, or 0 for no limit
+ *
+ * All objects count towards this limit, whether their size is known or not.
+ */
+void cache_limit(size_t entries) {
+  limit_entries = entries;
+  if(h)
+    cache_trim();
+}
+
+/** @brief Report total size of sized objects in the cache */
+size_t cache_bytes(void) {
+  return total_bytes;
 }
 
 /** @brief Look up an object in the cache
  * @param type Pointer to object type
  * @param key Unique key
  * @return Pointer to object value or NULL if not found
+ *
+ * A hit makes the object the most recently used one.  An expired object is
+ * removed.
  */
 const void *cache_get(const struct cache_type *type, const char *key) {
-  const struct cache_entry *c;
+  struct cache_entry **cp, *c;
   
   if(h
-     && (c = hash_find(h, key))
-     && c->type == type
-     && !expired(c, xtime(0)))
-    return c->value;
-  else
-    return 0;
+     && (cp = hash_find(h, key))
+     && (c = *cp)->type == type) {
+    if(expired(c, xtime(0))) {
+      ++c->stats->expiries;
+      remove_entry(c);
+    } else {
+      ++c->stats->hits;
+      unlink_entry(c);
+      push_entry(c);
+      return c->value;
+    }
+  }
+  ++find_stats(type)->misses;
+  return 0;
 }
 
-/** @brief Call used by from cache_expire() */
-static int expiry_callback(const char *key, void *value, void *u) {
-  const struct cache_entry *c = value;
-  const time_t *now = u;
-  
-  if(expired(c, *now))
-    hash_remove(h, key);
-  return 0;
+/** @brief Remove entries from a list
+ * @param l List
+ * @param type Type to remove, or NULL for all types
+ * @param now Remove only expired entries, else remove all
+ */
+static void remove_entries(struct cache_list *l,
+                           const struct cache_type *type,
+                           const time_t *now) {
+  struct cache_entry *c, *next;
+
+  for(c = l->head; c; c = next) {
+    next = c->next;
+    if(now) {
+      if(expired(c, *now)) {
+        ++c->stats->expiries;
+        remove_entry(c);
+      }
+    } else if(!type || c->type == type)
+      remove_entry(c);
+  }
 }
 
 /** @brief Expire the cache
  *
- * Called from time to time to expire cache entries. */
+ * Called from time to time to expire cache entries.  Also reports the
+ * statistics for each type of object, if debugging is enabled.
+ */
 void cache_expire(void) {
+  const struct cache_type_stats *ts;
   time_t now;
 
   if(h) {
     xtime(&now);
-    hash_foreach(h, expiry_callback, &now);
+    remove_entries(&lists[0], NULL, &now);
+    remove_entries(&lists[1], NULL, &now);
   }
-}
-
-/** @brief Callback used by cache_clean() */
-static int clean_callback(const char *key, void *value, void *u) {
-  const struct cache_entry *c = value;
-  const struct cache_type *type = u;
-
-  if(!type || c->type == type)
-    hash_remove(h, key);
-  return 0;
+  for(ts = type_stats; ts; ts = ts->next)
+    D(("cache type %p (lifetime %d): %lu hits %lu misses %lu evictions"
+       " %lu expiries",
+       (void *)ts->type, ts->type->lifetime, ts->stats.hits,
+       ts->stats.misses, ts->stats.evictions, ts->stats.expiries));
 }
 
 /** @brief Clean the cache
@@ -120,8 +341,10 @@ static int clean_callback(const char *key, void *value, void *u) {
  * Removes all entries of type @p type from the cache.
  */
 void cache_clean(const struct cache_type *type) {
-  if(h)
-    hash_foreach(h, clean_callback, (void *)type);
+  if(h) {
+    remove_entries(&lists[0], type, NULL);
+    remove_entries(&lists[1], type, NULL);
+  }
 }
 
 /** @brief Report cache size
@@ -132,6 +355,14 @@ size_t cache_count(void) {
   return h ? hash_count(h) : 0;
 }
 
+/** @brief Get the statistics for a type of object
+ * @param type Object type
+ * @param stats Where to store the statistics
+ */
+void cache_stats(const struct cache_type *type, struct cache_stats *stats) {
+  *stats = *find_stats(type);
+}
+
 /*
 Local Variables:
 c-basic-offset:2
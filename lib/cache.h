@@ -19,7 +19,8 @@
  * @brief Object caching
  *
  * There is a single cache for the whole process.  Objects of different types
- * are distinguished.  Objects might be thrown out of the cache at any point.
+ * are distinguished.  Objects might be thrown out of the cache at any point;
+ * when it is over its limits, the least recently used go first.
  */
 
 #ifndef CACHE_H
@@ -33,11 +34,31 @@ struct cache_type {
   int lifetime;
 };
 
+/** @brief Statistics for one type of cache object */
+struct cache_stats {
+  /** @brief Lookups that found an object */
+  unsigned long hits;
+
+  /** @brief Lookups that didn't */
+  unsigned long misses;
+
+  /** @brief Objects thrown out to keep the cache within its limits */
+  unsigned long evictions;
+
+  /** @brief Objects that expired */
+  unsigned long expiries;
+};
+
 void cache_put(const struct cache_type *type,
                const char *key, const void *value);
 /* Inserts KEY into the cache with value VALUE.  If KEY is already
  * present it is overwritten. */
 
+void cache_put_sized(const struct cache_type *type,
+                     const char *key, const void *value,
+                     size_t size);
+/* As cache_put(), but SIZE counts towards the limit set by cache_budget() */
+
 const void *cache_get(const struct cache_type *type, const char *key);
 /* Get a value from the cache. */
 
@@ -50,6 +71,18 @@ void cache_clean(const struct cache_type *type);
 size_t cache_count(void);
 /* Return the size of the cache */
 
+void cache_budget(size_t bytes);
+/* Limit the total size of objects added with cache_put_sized() (0 = none) */
+
+size_t cache_bytes(void);
+/* Return the total size of objects added with cache_put_sized() */
+
+void cache_limit(size_t entries);
+/* Limit the number of objects in the cache (0 = none) */
+
+void cache_stats(const struct cache_type *type, struct cache_stats *stats);
+/* Get hit/miss/eviction/expiry counts for TYPE */
+
 #endif /* CACHE_H */
 
 /*
@@ -45,12 +45,75 @@ char *utf82mb(const char *utf8) {
 }
 #else
 
+/** @brief Number of conversion descriptors to keep open */
+#define CONVERTERS 8
+
+/** @brief Cached conversion descriptors
+ *
+ * iconv_open() is expensive, so descriptors are kept for reuse.  Entries are
+ * replaced round-robin when the cache is full.
+ */
+static struct converter {
+  /** @brief Source encoding */
+  char *from;
+  /** @brief Destination encoding */
+  char *to;
+  /** @brief Conversion descriptor */
+  iconv_t i;
+} converters[CONVERTERS];
+
+/** @brief Next entry in @ref converters to replace */
+static int next_converter;
+
+/** @brief Find or open a descriptor converting @p from to @p to */
+static iconv_t converter(const char *from, const char *to) {
+  struct converter *c;
+  iconv_t i;
+  int n;
+
+  for(n = 0; n < CONVERTERS; ++n) {
+    c = &converters[n];
+    if(c->from && !strcmp(c->from, from) && !strcmp(c->to, to))
+      return c->i;
+  }
+  if((i = iconv_open(to, from)) == (iconv_t)-1)
+    disorder_fatal(errno, "error calling iconv_open");
+  c = &converters[next_converter];
+  next_converter = (next_converter + 1) % CONVERTERS;
+  if(c->from) {
+    iconv_close(c->i);
+    xfree(c->from);
+    xfree(c->to);
+  }
+  c->from = xstrdup(from);
+  c->to = xstrdup(to);
+  c->i = i;
+  return i;
+}
+
+/** @brief Classify an encoding name
+ * @param name Encoding name
+ * @return 2 for UTF-8, 1 for ASCII, 0 for anything else
+ */
+static int encoding_kind(const char *name) {
+  if(!strcasecmp(name, "UTF-8") || !strcasecmp(name, "UTF8"))
+    return 2;
+  if(!strcasecmp(name, "ASCII")
+     || !strcasecmp(name, "US-ASCII")
+     || !strcasecmp(name, "ANSI_X3.4-1968"))
+    return 1;
+  return 0;
+}
+
 /** @brief Low-level converstion routine
  * @param from Source encoding
  * @param to Destination encoding
  * @param ptr First byte to convert
  * @param n Number of bytes to convert
  * @return Converted text, 0-terminated; or NULL on error.
+ *
+ * Conversions between UTF-8 and ASCII that would not change anything are done
+ * without iconv.
  */
 static void *convert(const char *from, const char *to,
 		     const void *ptr, size_t n) {
@@ -58,9 +121,28 @@ static void *convert(const char *from, const char *to,
   size_t len;
   char *buf = 0, *s, *d;
   size_t bufsize = 0, sl, dl;
+  int kfrom = encoding_kind(from), kto = encoding_kind(to);
 
-  if((i = iconv_open(to, from)) == (iconv_t)-1)
-    disorder_fatal(errno, "error calling iconv_open");
+  if(kfrom && kto) {
+    const unsigned char *p = ptr;
+
+    if(kfrom == 2 && kto == 2) {
+      if(!utf8_valid(ptr, n)) {
+        disorder_error(EILSEQ, "error converting from %s to %s", from, to);
+        return 0;
+      }
+      len = n;
+    } else
+      for(len = 0; len < n && p[len] < 128; ++len)
+        ;
+    if(len == n) {
+      buf = xmalloc_noptr(n);
+      memcpy(buf, ptr, n);
+      return buf;
+    }
+    /* Non-ASCII characters; let iconv sort it out */
+  }
+  i = converter(from, to);
   do {
     bufsize = bufsize ? 2 * bufsize : 32;
     buf = xrealloc_noptr(buf, bufsize);
@@ -72,7 +154,6 @@ static void *convert(const char *from, const char *to,
     /* (void *) to work around FreeBSD's nonstandard iconv prototype */
     len = iconv(i, (void *)&s, &sl, &d, &dl);
   } while(len == (size_t)-1 && errno == E2BIG);
-  iconv_close(i);
   if(len == (size_t)-1) {
     disorder_error(errno, "error converting from %s to %s", from, to);
     return 0;
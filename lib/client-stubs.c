@@ -63,10 +63,28 @@ int disorder_cookie(disorder_client *c, const char *cookie) {
   return 0;
 }
 
+int disorder_db_stats(disorder_client *c, char ***statsp, int *nstatsp) {
+  int rc = disorder_simple(c, NULL, "db-stats", (char *)NULL);
+  if(rc)
+    return rc;
+  if(readlist(c, statsp, nstatsp))
+    return -1;
+  return 0;
+}
+
 int disorder_deluser(disorder_client *c, const char *user) {
   return disorder_simple(c, NULL, "deluser", user, (char *)NULL);
 }
 
+int disorder_dir_summaries(disorder_client *c, char **dirs, int ndirs, char ***summariesp, int *nsummariesp) {
+  int rc = disorder_simple(c, NULL, "dir-summaries", disorder__list, dirs, ndirs, (char *)NULL);
+  if(rc)
+    return rc;
+  if(readlist(c, summariesp, nsummariesp))
+    return -1;
+  return 0;
+}
+
 int disorder_dirs(disorder_client *c, const char *dir, const char *re, char ***filesp, int *nfilesp) {
   int rc = disorder_simple(c, NULL, "dirs", dir, re, (char *)NULL);
   if(rc)
@@ -99,6 +117,15 @@ int disorder_enabled(disorder_client *c, int *enabledp) {
   return 0;
 }
 
+int disorder_event_stats(disorder_client *c, char ***timingsp, int *ntimingsp) {
+  int rc = disorder_simple(c, NULL, "event-stats", (char *)NULL);
+  if(rc)
+    return rc;
+  if(readlist(c, timingsp, ntimingsp))
+    return -1;
+  return 0;
+}
+
 int disorder_exists(disorder_client *c, const char *track, int *existsp) {
   char **v;
   int nv, rc = disorder_simple_split(c, &v, &nv, 1, "exists", track, (char *)NULL);
@@ -151,6 +178,15 @@ int disorder_length(disorder_client *c, const char *track, long *lengthp) {
   return 0;
 }
 
+int disorder_lengths_multi(disorder_client *c, char **tracks, int ntracks, char ***lengthsp, int *nlengthsp) {
+  int rc = disorder_simple(c, NULL, "lengths-multi", disorder__list, tracks, ntracks, (char *)NULL);
+  if(rc)
+    return rc;
+  if(readlist(c, lengthsp, nlengthsp))
+    return -1;
+  return 0;
+}
+
 int disorder_make_cookie(disorder_client *c, char **cookiep) {
   char **v;
   int nv, rc = disorder_simple_split(c, &v, &nv, 1, "make-cookie", (char *)NULL);
@@ -162,6 +198,15 @@ int disorder_make_cookie(disorder_client *c, char **cookiep) {
   return 0;
 }
 
+int disorder_metrics(disorder_client *c, char ***metricsp, int *nmetricsp) {
+  int rc = disorder_simple(c, NULL, "metrics", (char *)NULL);
+  if(rc)
+    return rc;
+  if(readlist(c, metricsp, nmetricsp))
+    return -1;
+  return 0;
+}
+
 int disorder_move(disorder_client *c, const char *track, long delta) {
   return disorder_simple(c, NULL, "move", track, disorder__integer, delta, (char *)NULL);
 }
@@ -194,6 +239,15 @@ int disorder_part(disorder_client *c, const char *track, const char *context, co
   return 0;
 }
 
+int disorder_parts_multi(disorder_client *c, const char *context, const char *part, char **tracks, int ntracks, char ***partsp, int *npartsp) {
+  int rc = disorder_simple(c, NULL, "parts-multi", context, part, disorder__list, tracks, ntracks, (char *)NULL);
+  if(rc)
+    return rc;
+  if(readlist(c, partsp, npartsp))
+    return -1;
+  return 0;
+}
+
 int disorder_pause(disorder_client *c) {
   return disorder_simple(c, NULL, "pause", (char *)NULL);
 }
@@ -227,10 +281,30 @@ int disorder_playlist_get_share(disorder_client *c, const char *playlist, char *
   return disorder_simple(c, sharep, "playlist-get-share", playlist, (char *)NULL);
 }
 
+int disorder_playlist_insert(disorder_client *c, const char *playlist, long position, char **tracks, int ntracks) {
+  return disorder_simple(c, NULL, "playlist-insert", playlist, disorder__integer, position, disorder__body, tracks, ntracks, (char *)NULL);
+}
+
 int disorder_playlist_lock(disorder_client *c, const char *playlist) {
   return disorder_simple(c, NULL, "playlist-lock", playlist, (char *)NULL);
 }
 
+int disorder_playlist_move(disorder_client *c, const char *playlist, long position, long count, long to) {
+  return disorder_simple(c, NULL, "playlist-move", playlist, disorder__integer, position, disorder__integer, count, disorder__integer, to, (char *)NULL);
+}
+
+int disorder_playlist_play(disorder_client *c, const char *playlist, const char *order, char **idp) {
+  return disorder_simple(c, idp, "playlist-play", playlist, order, (char *)NULL);
+}
+
+int disorder_playlist_play_after(disorder_client *c, const char *playlist, const char *order, const char *target, char **idp) {
+  return disorder_simple(c, idp, "playlist-play", playlist, order, target, (char *)NULL);
+}
+
+int disorder_playlist_remove(disorder_client *c, const char *playlist, long position, long count) {
+  return disorder_simple(c, NULL, "playlist-remove", playlist, disorder__integer, position, disorder__integer, count, (char *)NULL);
+}
+
 int disorder_playlist_set(disorder_client *c, const char *playlist, char **tracks, int ntracks) {
   return disorder_simple(c, NULL, "playlist-set", playlist, disorder__body, tracks, ntracks, (char *)NULL);
 }
@@ -256,6 +330,15 @@ int disorder_prefs(disorder_client *c, const char *track, struct kvp **prefsp) {
   return pairlist(c, prefsp, "prefs", track, (char *)NULL);
 }
 
+int disorder_prefs_multi(disorder_client *c, char **tracks, int ntracks, char ***prefsp, int *nprefsp) {
+  int rc = disorder_simple(c, NULL, "prefs-multi", disorder__list, tracks, ntracks, (char *)NULL);
+  if(rc)
+    return rc;
+  if(readlist(c, prefsp, nprefsp))
+    return -1;
+  return 0;
+}
+
 int disorder_queue(disorder_client *c, struct queue_entry **queuep) {
   int rc = disorder_simple(c, NULL, "queue", (char *)NULL);
   if(rc)
@@ -265,6 +348,26 @@ int disorder_queue(disorder_client *c, struct queue_entry **queuep) {
   return 0;
 }
 
+int disorder_queue_changes(disorder_client *c, const char *generation, char ***changesp, int *nchangesp) {
+  int rc = disorder_simple(c, NULL, "queue-changes", generation, (char *)NULL);
+  if(rc)
+    return rc;
+  if(readlist(c, changesp, nchangesp))
+    return -1;
+  return 0;
+}
+
+int disorder_queue_generation(disorder_client *c, char **generationp) {
+  char **v;
+  int nv, rc = disorder_simple_split(c, &v, &nv, 1, "queue-generation", (char *)NULL);
+  if(rc)
+    return rc;
+  *generationp = v[0];
+  v[0] = NULL;
+  free_strings(nv, v);
+  return 0;
+}
+
 int disorder_random_disable(disorder_client *c) {
   return disorder_simple(c, NULL, "random-disable", (char *)NULL);
 }
@@ -356,10 +459,27 @@ int disorder_rtp_cancel(disorder_client *c) {
   return disorder_simple(c, NULL, "rtp-cancel", (char *)NULL);
 }
 
+int disorder_rtp_report(disorder_client *c, long expected, long lost, long jitter) {
+  return disorder_simple(c, NULL, "rtp-report", disorder__integer, expected, disorder__integer, lost, disorder__integer, jitter, (char *)NULL);
+}
+
 int disorder_rtp_request(disorder_client *c, const char *address, const char *port) {
   return disorder_simple(c, NULL, "rtp-request", address, port, (char *)NULL);
 }
 
+int disorder_rtp_request_codec(disorder_client *c, const char *address, const char *port, const char *codec) {
+  return disorder_simple(c, NULL, "rtp-request", address, port, codec, (char *)NULL);
+}
+
+int disorder_rtp_stats(disorder_client *c, char ***statsp, int *nstatsp) {
+  int rc = disorder_simple(c, NULL, "rtp-stats", (char *)NULL);
+  if(rc)
+    return rc;
+  if(readlist(c, statsp, nstatsp))
+    return -1;
+  return 0;
+}
+
 int disorder_scratch(disorder_client *c, const char *id) {
   return disorder_simple(c, NULL, "scratch", id, (char *)NULL);
 }
@@ -402,6 +522,33 @@ int disorder_search(disorder_client *c, const char *terms, char ***tracksp, int
   return 0;
 }
 
+int disorder_search_page(disorder_client *c, const char *terms, long offset, long limit, char ***tracksp, int *ntracksp) {
+  int rc = disorder_simple(c, NULL, "search", terms, disorder__integer, offset, disorder__integer, limit, (char *)NULL);
+  if(rc)
+    return rc;
+  if(readlist(c, tracksp, ntracksp))
+    return -1;
+  return 0;
+}
+
+int disorder_search_fuzzy(disorder_client *c, const char *terms, long max, char ***tracksp, int *ntracksp) {
+  int rc = disorder_simple(c, NULL, "search-fuzzy", terms, disorder__integer, max, (char *)NULL);
+  if(rc)
+    return rc;
+  if(readlist(c, tracksp, ntracksp))
+    return -1;
+  return 0;
+}
+
+int disorder_search_prefix(disorder_client *c, const char *terms, long max, char ***tracksp, int *ntracksp) {
+  int rc = disorder_simple(c, NULL, "search-prefix", terms, disorder__integer, max, (char *)NULL);
+  if(rc)
+    return rc;
+  if(readlist(c, tracksp, ntracksp))
+    return -1;
+  return 0;
+}
+
 int disorder_set(disorder_client *c, const char *track, const char *pref, const char *value) {
   return disorder_simple(c, NULL, "set", track, pref, value, (char *)NULL);
 }
@@ -414,6 +561,17 @@ int disorder_shutdown(disorder_client *c) {
   return disorder_simple(c, NULL, "shutdown", (char *)NULL);
 }
 
+int disorder_state_generation(disorder_client *c, char **generationp) {
+  char **v;
+  int nv, rc = disorder_simple_split(c, &v, &nv, 1, "state-generation", (char *)NULL);
+  if(rc)
+    return rc;
+  *generationp = v[0];
+  v[0] = NULL;
+  free_strings(nv, v);
+  return 0;
+}
+
 int disorder_stats(disorder_client *c, char ***statsp, int *nstatsp) {
   int rc = disorder_simple(c, NULL, "stats", (char *)NULL);
   if(rc)
@@ -432,6 +590,17 @@ int disorder_tags(disorder_client *c, char ***tagsp, int *ntagsp) {
   return 0;
 }
 
+int disorder_track_generation(disorder_client *c, char **generationp) {
+  char **v;
+  int nv, rc = disorder_simple_split(c, &v, &nv, 1, "track-generation", (char *)NULL);
+  if(rc)
+    return rc;
+  *generationp = v[0];
+  v[0] = NULL;
+  free_strings(nv, v);
+  return 0;
+}
+
 int disorder_unset(disorder_client *c, const char *track, const char *pref) {
   return disorder_simple(c, NULL, "unset", track, pref, (char *)NULL);
 }
@@ -83,6 +83,17 @@ int disorder_confirm(disorder_client *c, const char *confirmation);
  */
 int disorder_cookie(disorder_client *c, const char *cookie);
 
+/** @brief Get database cache and lock statistics
+ *
+ * Requires the 'admin' right.
+ *
+ * @param c Client
+ * @param statsp Statistics, one per line
+ * @param nstatsp Number of elements in statsp
+ * @return 0 on success, non-0 on error
+ */
+int disorder_db_stats(disorder_client *c, char ***statsp, int *nstatsp);
+
 /** @brief Delete user
  *
  * Requires the 'admin' right.
@@ -93,6 +104,19 @@ int disorder_cookie(disorder_client *c, const char *cookie);
  */
 int disorder_deluser(disorder_client *c, const char *user);
 
+/** @brief Summarize many directories
+ *
+ * Each line of the response is the quoted directory name followed by alternating quoted field names and values: 'tracks', 'length' and 'unknown' give the number of tracks below the directory, their total length in seconds and how many of their lengths are not known, and 'first' the first track below it, whose name parts follow as 'artist', 'album', 'sort-artist' and 'sort-album'.  Directories with no tracks have no fields.  The summaries are kept up to date as tracks are added and removed, so no track need be visited.
+ *
+ * @param c Client
+ * @param dirs Directory names
+ * @param ndirs Length of dirs
+ * @param summariesp Directory summaries
+ * @param nsummariesp Number of elements in summariesp
+ * @return 0 on success, non-0 on error
+ */
+int disorder_dir_summaries(disorder_client *c, char **dirs, int ndirs, char ***summariesp, int *nsummariesp);
+
 /** @brief List directories in a directory
  *
  * 
@@ -146,6 +170,17 @@ int disorder_enable(disorder_client *c);
  */
 int disorder_enabled(disorder_client *c, int *enabledp);
 
+/** @brief Get event loop callback timings
+ *
+ * Requires the 'admin' right.  Timings are only collected if slow_callback_ms is set.  Each line is a list of the callback description, number of calls, total and maximum time in microseconds, and counts of calls taking under 10us, 100us, 1ms, 10ms, 100ms, 1s and longer.
+ *
+ * @param c Client
+ * @param timingsp Callback timings
+ * @param ntimingsp Number of elements in timingsp
+ * @return 0 on success, non-0 on error
+ */
+int disorder_event_stats(disorder_client *c, char ***timingsp, int *ntimingsp);
+
 /** @brief Test whether a track exists
  *
  * 
@@ -204,6 +239,19 @@ int disorder_get_global(disorder_client *c, const char *pref, char **valuep);
  */
 int disorder_length(disorder_client *c, const char *track, long *lengthp);
 
+/** @brief Get the lengths of many tracks
+ *
+ * Each line of the response is the quoted track name followed by its length in seconds, or by nothing if the track does not exist or its length is not known.  The tracks are all looked up in a single database transaction.
+ *
+ * @param c Client
+ * @param tracks Track names
+ * @param ntracks Length of tracks
+ * @param lengthsp Track lengths
+ * @param nlengthsp Number of elements in lengthsp
+ * @return 0 on success, non-0 on error
+ */
+int disorder_lengths_multi(disorder_client *c, char **tracks, int ntracks, char ***lengthsp, int *nlengthsp);
+
 /** @brief Create a login cookie for this user
  *
  * The cookie may be redeemed via the 'cookie' command
@@ -214,6 +262,17 @@ int disorder_length(disorder_client *c, const char *track, long *lengthp);
  */
 int disorder_make_cookie(disorder_client *c, char **cookiep);
 
+/** @brief Get per-command statistics
+ *
+ * Requires the 'admin' right.  The body is in Prometheus text format and covers the number of times each command has been used, how many got an error response, a histogram of response latency and the time spent in the database.
+ *
+ * @param c Client
+ * @param metricsp Metrics
+ * @param nmetricsp Number of elements in metricsp
+ * @return 0 on success, non-0 on error
+ */
+int disorder_metrics(disorder_client *c, char ***metricsp, int *nmetricsp);
+
 /** @brief Move a track
  *
  * Requires one of the 'move mine', 'move random' or 'move any' rights depending on how the track came to be added to the queue.
@@ -271,6 +330,21 @@ int disorder_nop(disorder_client *c);
  */
 int disorder_part(disorder_client *c, const char *track, const char *context, const char *part, char **partp);
 
+/** @brief Get a name part for many tracks
+ *
+ * Each line of the response is the quoted track name followed by the quoted name part, or by nothing if the track does not exist.  The tracks are all looked up in a single database transaction.
+ *
+ * @param c Client
+ * @param context Context ("sort" or "display")
+ * @param part Name part ("artist", "album" or "title")
+ * @param tracks Track names
+ * @param ntracks Length of tracks
+ * @param partsp Name parts
+ * @param npartsp Number of elements in partsp
+ * @return 0 on success, non-0 on error
+ */
+int disorder_parts_multi(disorder_client *c, const char *context, const char *part, char **tracks, int ntracks, char ***partsp, int *npartsp);
+
 /** @brief Pause the currently playing track
  *
  * Requires the 'pause' right.
@@ -346,6 +420,19 @@ int disorder_playlist_get(disorder_client *c, const char *playlist, char ***trac
  */
 int disorder_playlist_get_share(disorder_client *c, const char *playlist, char **sharep);
 
+/** @brief Insert tracks into a playlist
+ *
+ * Requires the 'play' right and permission to modify the playlist, which must be locked.
+ *
+ * @param c Client
+ * @param playlist Playlist to modify
+ * @param position Index to insert before, or the playlist length to append
+ * @param tracks Tracks to insert
+ * @param ntracks Length of tracks
+ * @return 0 on success, non-0 on error
+ */
+int disorder_playlist_insert(disorder_client *c, const char *playlist, long position, char **tracks, int ntracks);
+
 /** @brief Lock a playlist
  *
  * Requires the 'play' right and permission to modify the playlist.  A given connection may lock at most one playlist.
@@ -356,6 +443,56 @@ int disorder_playlist_get_share(disorder_client *c, const char *playlist, char *
  */
 int disorder_playlist_lock(disorder_client *c, const char *playlist);
 
+/** @brief Move tracks within a playlist
+ *
+ * Requires the 'play' right and permission to modify the playlist, which must be locked.
+ *
+ * @param c Client
+ * @param playlist Playlist to modify
+ * @param position Index of first track to move
+ * @param count Number of tracks to move
+ * @param to Index to move them to, counting without the moved tracks
+ * @return 0 on success, non-0 on error
+ */
+int disorder_playlist_move(disorder_client *c, const char *playlist, long position, long count, long to);
+
+/** @brief Add a playlist to the queue
+ *
+ * Requires the 'play' right and permission to read the playlist.  The order may be "in-order" or "shuffle".
+ *
+ * @param c Client
+ * @param playlist Playlist to play
+ * @param order Order to add the tracks in
+ * @param idp Queue ID of last new track
+ * @return 0 on success, non-0 on error
+ */
+int disorder_playlist_play(disorder_client *c, const char *playlist, const char *order, char **idp);
+
+/** @brief Add a playlist to a specific point in the queue
+ *
+ * Requires the 'play' right and permission to read the playlist.  The order may be "in-order" or "shuffle".
+ *
+ * @param c Client
+ * @param playlist Playlist to play
+ * @param order Order to add the tracks in
+ * @param target Insert into queue after this track, or at head if ""
+ * @param idp Queue ID of last new track
+ * @return 0 on success, non-0 on error
+ */
+int disorder_playlist_play_after(disorder_client *c, const char *playlist, const char *order, const char *target, char **idp);
+
+/** @brief Remove tracks from a playlist
+ *
+ * Requires the 'play' right and permission to modify the playlist, which must be locked.
+ *
+ * @param c Client
+ * @param playlist Playlist to modify
+ * @param position Index of first track to remove
+ * @param count Number of tracks to remove
+ * @return 0 on success, non-0 on error
+ */
+int disorder_playlist_remove(disorder_client *c, const char *playlist, long position, long count);
+
 /** @brief Set the contents of a playlist
  *
  * Requires the 'play' right and permission to modify the playlist, which must be locked.
@@ -410,6 +547,19 @@ int disorder_playlists(disorder_client *c, char ***playlistsp, int *nplaylistsp)
  */
 int disorder_prefs(disorder_client *c, const char *track, struct kvp **prefsp);
 
+/** @brief Get all the preferences for many tracks
+ *
+ * Each line of the response is the quoted track name followed by the names and values of its preferences, alternately, each quoted.  The tracks are all looked up in a single database transaction.
+ *
+ * @param c Client
+ * @param tracks Track names
+ * @param ntracks Length of tracks
+ * @param prefsp Track preferences
+ * @param nprefsp Number of elements in prefsp
+ * @return 0 on success, non-0 on error
+ */
+int disorder_prefs_multi(disorder_client *c, char **tracks, int ntracks, char ***prefsp, int *nprefsp);
+
 /** @brief List the queue
  *
  * 
@@ -420,6 +570,28 @@ int disorder_prefs(disorder_client *c, const char *track, struct kvp **prefsp);
  */
 int disorder_queue(disorder_client *c, struct queue_entry **queuep);
 
+/** @brief List changes to the queue
+ *
+ * Each line of the response is a change to the queue since @p generation, oldest first, as described in disorder_protocol(5).  If the changes since @p generation are no longer known then the response code is 555 and the whole queue must be fetched again.
+ *
+ * @param c Client
+ * @param generation Last generation the caller knows about
+ * @param changesp Changes to the queue
+ * @param nchangesp Number of elements in changesp
+ * @return 0 on success, non-0 on error
+ */
+int disorder_queue_changes(disorder_client *c, const char *generation, char ***changesp, int *nchangesp);
+
+/** @brief Get the queue generation
+ *
+ * The generation changes whenever the queue does.  Pass it to queue-changes to find out what changed.
+ *
+ * @param c Client
+ * @param generationp Current queue generation
+ * @return 0 on success, non-0 on error
+ */
+int disorder_queue_generation(disorder_client *c, char **generationp);
+
 /** @brief Disable random play
  *
  * Requires the 'global prefs' right.
@@ -558,6 +730,18 @@ int disorder_rtp_address(disorder_client *c, char **addressp, char **portp);
  */
 int disorder_rtp_cancel(disorder_client *c);
 
+/** @brief Report RTP reception statistics
+ *
+ * Sent periodically by disorder-playrtp.  All values cover the whole stream so far.
+ *
+ * @param c Client
+ * @param expected Number of packets expected
+ * @param lost Number of packets lost
+ * @param jitter Interarrival jitter in microseconds
+ * @return 0 on success, non-0 on error
+ */
+int disorder_rtp_report(disorder_client *c, long expected, long lost, long jitter);
+
 /** @brief Request a unicast RTP stream
  *
  * 
@@ -569,6 +753,29 @@ int disorder_rtp_cancel(disorder_client *c);
  */
 int disorder_rtp_request(disorder_client *c, const char *address, const char *port);
 
+/** @brief Request a unicast RTP stream with a particular payload encoding
+ *
+ * The encoding may be "l16" (uncompressed, the default) or "opus".
+ *
+ * @param c Client
+ * @param address Destination address
+ * @param port Destination port number
+ * @param codec Payload encoding
+ * @return 0 on success, non-0 on error
+ */
+int disorder_rtp_request_codec(disorder_client *c, const char *address, const char *port, const char *codec);
+
+/** @brief Get RTP reception statistics
+ *
+ * Requires the 'admin' right.  Each line describes one listener and is a list of the user name, the requested destination address (or "-"), packets expected, packets lost, jitter in microseconds and age of the report in seconds.
+ *
+ * @param c Client
+ * @param statsp Reception statistics
+ * @param nstatsp Number of elements in statsp
+ * @return 0 on success, non-0 on error
+ */
+int disorder_rtp_stats(disorder_client *c, char ***statsp, int *nstatsp);
+
 /** @brief Terminate the playing track.
  *
  * Requires one of the 'scratch mine', 'scratch random' or 'scratch any' rights depending on how the track came to be added to the queue.
@@ -660,6 +867,46 @@ int disorder_schedule_list(disorder_client *c, char ***idsp, int *nidsp);
  */
 int disorder_search(disorder_client *c, const char *terms, char ***tracksp, int *ntracksp);
 
+/** @brief Search for tracks, ranking the results
+ *
+ * Terms are as for 'search'.  Tracks are ranked by how often and where the terms appear in their names, then by how often they have been played or requested.  Only the tracks from position OFFSET onwards are sent, and at most LIMIT of them.
+ *
+ * @param c Client
+ * @param terms List of search terms
+ * @param offset Number of top-ranked tracks to skip
+ * @param limit Maximum tracks to fetch, or 0 for all available
+ * @param tracksp List of matching tracks
+ * @param ntracksp Number of elements in tracksp
+ * @return 0 on success, non-0 on error
+ */
+int disorder_search_page(disorder_client *c, const char *terms, long offset, long limit, char ***tracksp, int *ntracksp);
+
+/** @brief Search for tracks, allowing for misspelt terms
+ *
+ * Like 'search', except that a term that no track contains is replaced by the closest word that one does.  Tags must still match exactly.
+ *
+ * @param c Client
+ * @param terms List of search terms
+ * @param max Maximum tracks to fetch, or 0 for all available
+ * @param tracksp List of matching tracks
+ * @param ntracksp Number of elements in tracksp
+ * @return 0 on success, non-0 on error
+ */
+int disorder_search_fuzzy(disorder_client *c, const char *terms, long max, char ***tracksp, int *ntracksp);
+
+/** @brief Search for tracks as the search terms are typed
+ *
+ * Like 'search', except that the last term matches any word that starts with it.  Tracks with the last term as a whole word come first.
+ *
+ * @param c Client
+ * @param terms List of search terms
+ * @param max Maximum tracks to fetch, or 0 for all available
+ * @param tracksp List of matching tracks
+ * @param ntracksp Number of elements in tracksp
+ * @return 0 on success, non-0 on error
+ */
+int disorder_search_prefix(disorder_client *c, const char *terms, long max, char ***tracksp, int *ntracksp);
+
 /** @brief Set a track preference
  *
  * Requires the 'prefs' right.
@@ -692,6 +939,16 @@ int disorder_set_global(disorder_client *c, const char *pref, const char *value)
  */
 int disorder_shutdown(disorder_client *c);
 
+/** @brief Get the server state generation
+ *
+ * The generation changes whenever anything is logged to the event log, i.e. whenever the queue, playing track, volume, settings etc. change.  It does not change as the playing track progresses.  Clients can compare it with a previous value to find out cheaply whether anything has changed.
+ *
+ * @param c Client
+ * @param generationp Opaque generation token
+ * @return 0 on success, non-0 on error
+ */
+int disorder_state_generation(disorder_client *c, char **generationp);
+
 /** @brief Get server statistics
  *
  * The details of what the server reports are not really defined.  The returned strings are intended to be printed out one to a line.
@@ -714,6 +971,16 @@ int disorder_stats(disorder_client *c, char ***statsp, int *nstatsp);
  */
 int disorder_tags(disorder_client *c, char ***tagsp, int *ntagsp);
 
+/** @brief Get the track database generation
+ *
+ * The generation changes whenever track names, name parts or lengths might have changed, and when the server restarts.  Clients that keep such details can compare it with the value when they were fetched.
+ *
+ * @param c Client
+ * @param generationp Opaque generation token
+ * @return 0 on success, non-0 on error
+ */
+int disorder_track_generation(disorder_client *c, char **generationp);
+
 /** @brief Unset a track preference
  *
  * Requires the 'prefs' right.
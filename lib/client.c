@@ -41,6 +41,9 @@
 #if HAVE_NETDB_H
 # include <netdb.h>
 #endif
+#if !_WIN32
+# include <poll.h>
+#endif
 
 #include "log.h"
 #include "mem.h"
@@ -50,7 +53,6 @@
 #include "hex.h"
 #include "split.h"
 #include "vector.h"
-#include "inputline.h"
 #include "kvp.h"
 #include "syscalls.h"
 #include "printf.h"
@@ -64,8 +66,8 @@
 
 /** @brief Client handle contents */
 struct disorder_client {
-  /** @brief Stream to read from */
-  struct source *input;
+  /** @brief Buffer for the line being read */
+  struct dynstr line;
   /** @brief Stream to write to */
   struct sink *output;
   /** @brief Peer description */
@@ -98,6 +100,7 @@ disorder_client *disorder_new(int verbose) {
   disorder_client *c = xmalloc(sizeof (struct disorder_client));
 
   c->verbose = verbose;
+  dynstr_init(&c->line);
   c->family = -1;
   c->trypriv = 1;
   return c;
@@ -132,20 +135,62 @@ int disorder_client_peername(disorder_client *c,
   return rc;
 }
 
+/** @brief Read a line from the server
+ * @param c Client
+ * @param lp Where to store the line, without its newline (UTF-8)
+ * @return 0 on success, -1 on error or EOF
+ *
+ * The line is read in bulk from the socket buffer, rather than a byte at a
+ * time, into @c c->line.  @p *lp points there so it is only valid until the
+ * next call.
+ */
+static int read_line(disorder_client *c, const char **lp) {
+  int err;
+  char errbuf[1024];
+
+  c->line.nvec = 0;
+  if(socketio_getline(&c->sio, &c->line)) {
+    if((err = socketio_error(&c->sio)))
+      disorder_error(0, "error reading %s: %s", c->ident,
+                     format_error(ec_native, err, errbuf, sizeof errbuf));
+    else if(c->line.nvec)
+      disorder_error(0, "error reading %s: unexpected EOF", c->ident);
+    return -1;
+  }
+  dynstr_terminate(&c->line);
+  *lp = c->line.vec;
+  return 0;
+}
+
+/** @brief Describe a read error in @c c->last
+ * @param c Client
+ * @param eof Message to use for EOF
+ */
+static void read_failed(disorder_client *c, const char *eof) {
+  char errbuf[1024];
+
+  if(socketio_error(&c->sio))
+    byte_xasprintf((char **)&c->last, "input error: %s",
+                   format_error(ec_native, socketio_error(&c->sio),
+                                errbuf, sizeof errbuf));
+  else
+    c->last = eof;
+}
+
 /** @brief Read a response line
  * @param c Client
  * @param rp Where to store response, or NULL (UTF-8)
  * @return Response code 0-999 or -1 on error
  */
 static int response(disorder_client *c, char **rp) {
+  const char *l;
   char *r;
-  char errbuf[1024];
 
-  if(inputlines(c->ident, c->input, &r, '\n')) {
-    byte_xasprintf((char **)&c->last, "input error: %s",
-                   format_error(c->input->eclass, source_err(c->input), errbuf, sizeof errbuf));
+  if(read_line(c, &l)) {
+    read_failed(c, "input error: unexpected EOF");
     return -1;
   }
+  r = xstrndup(l, c->line.nvec);
   D(("response: %s", r));
   if(rp)
     *rp = r;
@@ -201,20 +246,26 @@ static int check_response(disorder_client *c, char **rp) {
   }
 }
 
-/** @brief Issue a command and parse a simple response
+/** @brief Report a write error
+ * @param c Client
+ * @return -1
+ */
+static int write_error(disorder_client *c) {
+  char errbuf[1024];
+
+  byte_xasprintf((char **)&c->last, "write error: %s", 
+                 format_error(c->output->eclass, sink_err(c->output), errbuf, sizeof errbuf));
+  disorder_error(0, "%s: %s", c->ident, c->last);
+  return -1;
+}
+
+/** @brief Send a command without waiting for the response
  * @param c Client
- * @param rp Where to store result, or NULL
  * @param cmd Command
  * @param ap Arguments (UTF-8), terminated by (char *)0
  * @return 0 on success, non-0 on error
  *
- * 5xx responses count as errors.
- *
- * @p rp will NOT be filled in for xx9 responses (where it is just
- * commentary for a command where it would normally be meaningful).
- *
- * NB that the response will NOT be converted to the local encoding
- * nor will quotes be stripped.  See dequote().
+ * The command is buffered, not necessarily sent yet.
  *
  * Put @ref disorder__body in the argument list followed by a char **
  * and int giving the body to follow the command.  If the int is @c -1
@@ -235,92 +286,119 @@ static int check_response(disorder_client *c, char **rp) {
  *
  * Usually you would call this via one of the following interfaces:
  * - disorder_simple()
+ * - disorder_pipeline_send()
  */
-static int disorder_simple_v(disorder_client *c,
-			     char **rp,
-			     const char *cmd,
-                             va_list ap) {
+static int disorder_send_v(disorder_client *c,
+                           const char *cmd,
+                           va_list ap) {
   const char *arg;
   struct dynstr d;
   char **body = NULL;
   int nbody = 0;
   int has_body = 0;
-  char errbuf[1024];
 
   if(!c->open) {
     c->last = "not connected";
     disorder_error(0, "not connected to server");
     return -1;
   }
-  if(cmd) {
-    dynstr_init(&d);
-    dynstr_append_string(&d, cmd);
-    while((arg = va_arg(ap, const char *))) {
-      if(arg == disorder__body) {
-	body = va_arg(ap, char **);
-	nbody = va_arg(ap, int);
-	has_body = 1;
-      } else if(arg == disorder__list) {
-	char **list = va_arg(ap, char **);
-	int nlist = va_arg(ap, int);
-        int n;
-	if(nlist < 0) {
-	  for(nlist = 0; list[nlist]; ++nlist)
-	    ;
-	}
-	for(n = 0; n < nlist; ++n) {
-	  dynstr_append(&d, ' ');
-	  dynstr_append_string(&d, quoteutf8(arg));
-	}
-      } else if(arg == disorder__integer) {
-	long n = va_arg(ap, long);
-	char buffer[16];
-	byte_snprintf(buffer, sizeof buffer, "%ld", n);
-	dynstr_append(&d, ' ');
-	dynstr_append_string(&d, buffer);
-      } else if(arg == disorder__time) {
-	time_t n = va_arg(ap, time_t);
-	char buffer[16];
-	byte_snprintf(buffer, sizeof buffer, "%lld", (long long)n);
-	dynstr_append(&d, ' ');
-	dynstr_append_string(&d, buffer);
-      } else {
-	dynstr_append(&d, ' ');
-	dynstr_append_string(&d, quoteutf8(arg));
-      }
-    }
-    dynstr_append(&d, '\n');
-    dynstr_terminate(&d);
-    D(("command: %s", d.vec));
-    if(sink_write(c->output, d.vec, d.nvec) < 0)
-      goto write_error;
-    xfree(d.vec);
-    if(has_body) {
+  dynstr_init(&d);
+  dynstr_append_string(&d, cmd);
+  while((arg = va_arg(ap, const char *))) {
+    if(arg == disorder__body) {
+      body = va_arg(ap, char **);
+      nbody = va_arg(ap, int);
+      has_body = 1;
+    } else if(arg == disorder__list) {
+      char **list = va_arg(ap, char **);
+      int nlist = va_arg(ap, int);
       int n;
-      if(nbody < 0)
-        for(nbody = 0; body[nbody]; ++nbody)
+      if(nlist < 0) {
+        for(nlist = 0; list[nlist]; ++nlist)
           ;
-      for(n = 0; n < nbody; ++n) {
-        if(body[n][0] == '.')
-          if(sink_writec(c->output, '.') < 0)
-            goto write_error;
-        if(sink_writes(c->output, body[n]) < 0)
-          goto write_error;
-        if(sink_writec(c->output, '\n') < 0)
-          goto write_error;
       }
-      if(sink_writes(c->output, ".\n") < 0)
-        goto write_error;
+      for(n = 0; n < nlist; ++n) {
+        dynstr_append(&d, ' ');
+        dynstr_append_string(&d, quoteutf8(list[n]));
+      }
+    } else if(arg == disorder__integer) {
+      long n = va_arg(ap, long);
+      char buffer[16];
+      byte_snprintf(buffer, sizeof buffer, "%ld", n);
+      dynstr_append(&d, ' ');
+      dynstr_append_string(&d, buffer);
+    } else if(arg == disorder__time) {
+      time_t n = va_arg(ap, time_t);
+      char buffer[16];
+      byte_snprintf(buffer, sizeof buffer, "%lld", (long long)n);
+      dynstr_append(&d, ' ');
+      dynstr_append_string(&d, buffer);
+    } else {
+      dynstr_append(&d, ' ');
+      dynstr_append_string(&d, quoteutf8(arg));
+    }
+  }
+  dynstr_append(&d, '\n');
+  dynstr_terminate(&d);
+  D(("command: %s", d.vec));
+  if(sink_write(c->output, d.vec, d.nvec) < 0)
+    return write_error(c);
+  xfree(d.vec);
+  if(has_body) {
+    int n;
+    if(nbody < 0)
+      for(nbody = 0; body[nbody]; ++nbody)
+        ;
+    for(n = 0; n < nbody; ++n) {
+      if(body[n][0] == '.')
+        if(sink_writec(c->output, '.') < 0)
+          return write_error(c);
+      if(sink_writes(c->output, body[n]) < 0)
+        return write_error(c);
+      if(sink_writec(c->output, '\n') < 0)
+        return write_error(c);
     }
+    if(sink_writes(c->output, ".\n") < 0)
+      return write_error(c);
+  }
+  return 0;
+}
+
+/** @brief Issue a command and parse a simple response
+ * @param c Client
+ * @param rp Where to store result, or NULL
+ * @param cmd Command
+ * @param ap Arguments (UTF-8), terminated by (char *)0
+ * @return 0 on success, non-0 on error
+ *
+ * 5xx responses count as errors.
+ *
+ * @p rp will NOT be filled in for xx9 responses (where it is just
+ * commentary for a command where it would normally be meaningful).
+ *
+ * NB that the response will NOT be converted to the local encoding
+ * nor will quotes be stripped.  See dequote().
+ *
+ * See disorder_send_v() for the arguments.  If @p cmd is NULL then only a
+ * response is read.
+ */
+static int disorder_simple_v(disorder_client *c,
+			     char **rp,
+			     const char *cmd,
+                             va_list ap) {
+  int rc;
+
+  if(cmd) {
+    if((rc = disorder_send_v(c, cmd, ap)))
+      return rc;
     if(sink_flush(c->output))
-      goto write_error;
+      return write_error(c);
+  } else if(!c->open) {
+    c->last = "not connected";
+    disorder_error(0, "not connected to server");
+    return -1;
   }
   return check_response(c, rp);
-write_error:
-  byte_xasprintf((char **)&c->last, "write error: %s", 
-                 format_error(c->output->eclass, sink_err(c->output), errbuf, sizeof errbuf));
-  disorder_error(0, "%s: %s", c->ident, c->last);
-  return -1;
 }
 
 /** @brief Issue a command and parse a simple response
@@ -428,6 +506,37 @@ static int dequote(int rc, char **rp) {
   return rc;
 }
 
+/** @brief Ask the server to compress its responses
+ * @param c Client
+ * @param conf Configuration to follow
+ * @return 0 on success, non-0 on error
+ *
+ * This is only worth doing over TCP.  It is not an error if the server
+ * doesn't support compression.
+ */
+#if HAVE_ZLIB_H
+static int negotiate_compression(disorder_client *c,
+                                 const struct config *conf) {
+  int rc;
+
+  if(!conf->compress || c->family == AF_UNIX)
+    return 0;
+  if((rc = disorder_simple(c, 0, "compress", "deflate", (char *)0)))
+    return rc == -1 ? -1 : 0;
+  if(socketio_decompress(&c->sio)) {
+    c->last = "cannot decompress";
+    disorder_error(0, "cannot decompress responses from %s", c->ident);
+    return -1;
+  }
+  return 0;
+}
+#else
+static int negotiate_compression(disorder_client attribute((unused)) *c,
+                                 const struct config attribute((unused)) *conf) {
+  return 0;
+}
+#endif
+
 /** @brief Generic connection routine
  * @param conf Configuration to follow
  * @param c Client
@@ -460,7 +569,6 @@ int disorder_connect_generic(struct config *conf,
 				   (c->trypriv ? 0 : DISORDER_FS_NOTPRIV),
 				   &sa, &c->ident)) == (socklen_t)-1)
     return -1;
-  c->input = 0;
   c->output = 0;
   if((sd = socket(sa->sa_family, SOCK_STREAM, 0)) < 0) {
     byte_xasprintf((char **)&c->last, "socket: %s",
@@ -475,11 +583,11 @@ int disorder_connect_generic(struct config *conf,
     disorder_error(0, "%s", c->last);
     goto error;
   }
+  nodelay(sd);
   socketio_init(&c->sio, sd);
   c->open = 1;
   sd = INVALID_SOCKET;
   c->output = sink_socketio(&c->sio);
-  c->input = source_socketio(&c->sio);
   if((rc = disorder_simple(c, &r, 0, (const char *)0)))
     goto error_rc;
   if(!(rvec = split(r, &nrvec, SPLIT_QUOTES, 0, 0)))
@@ -501,8 +609,11 @@ int disorder_connect_generic(struct config *conf,
     goto error;
   if(cookie) {
     if(!dequote(disorder_simple(c, &c->user, "cookie", cookie, (char *)0),
-		&c->user))
+		&c->user)) {
+      if((rc = negotiate_compression(c, conf)))
+        goto error_rc;
       return 0;				/* success */
+    }
     if(!username) {
       c->last = "cookie failed and no username";
       disorder_error(0, "cookie did not work and no username available");
@@ -515,6 +626,8 @@ int disorder_connect_generic(struct config *conf,
   }
   if((rc = disorder_simple(c, 0, "user", username, res, (char *)0)))
     goto error_rc;
+  if((rc = negotiate_compression(c, conf)))
+    goto error_rc;
   c->user = xstrdup(username);
   xfree(res);
   free_strings(nrvec, rvec);
@@ -527,8 +640,6 @@ error:
 error_rc:
   xfree(c->output);
   c->output = NULL;
-  xfree(c->input);
-  c->input = NULL;
   if(c->open) { socketio_close(&c->sio); c->open = 0; }
   if(sd != INVALID_SOCKET) closesocket(sd);
   return rc;
@@ -605,6 +716,34 @@ int disorder_connect_cookie(disorder_client *c,
 				  cookie);
 }
 
+/** @brief Test whether an idle client can be used again by another process
+ * @param c Client
+ * @return Nonzero if @p c can be reused
+ *
+ * This is true if @p c is open, has no input buffered or waiting, and is not
+ * using compression (whose state would not be shared with the process that
+ * originally connected).  It is intended to let a parent process lend
+ * connections to its children.
+ */
+int disorder_reusable(disorder_client *c) {
+#if _WIN32
+  (void)c;
+  return 0;
+#else
+  struct pollfd pfd;
+
+  if(!c->open
+     || c->sio.inflate
+     || c->sio.inputptr != c->sio.inputlimit
+     || c->sio.outputused)
+    return 0;
+  pfd.fd = c->sio.sd;
+  pfd.events = POLLIN;
+  /* A readable socket here means either EOF or data we don't expect */
+  return poll(&pfd, 1, 0) == 0;
+#endif
+}
+
 /** @brief Close a client
  * @param c Client
  * @return 0 on succcess, non-0 on errior
@@ -619,8 +758,6 @@ int disorder_close(disorder_client *c) {
     socketio_close(&c->sio);
   xfree(c->output);
   c->output = NULL;
-  xfree(c->input);
-  c->input = NULL;
   xfree(c->ident);
   c->ident = 0;
   xfree(c->user);
@@ -661,14 +798,12 @@ static int onequeue(disorder_client *c, const char *cmd,
 static int readqueue(disorder_client *c,
 		     struct queue_entry **qp) {
   struct queue_entry *qh, **qt = &qh, *q;
-  char *l;
-  char errbuf[1024];
+  const char *l;
 
-  while(inputlines(c->ident, c->input, &l, '\n') >= 0) {
+  while(read_line(c, &l) >= 0) {
     if(!strcmp(l, ".")) {
       *qt = 0;
       *qp = qh;
-      xfree(l);
       return 0;
     }
     q = xmalloc(sizeof *q);
@@ -676,14 +811,8 @@ static int readqueue(disorder_client *c,
       *qt = q;
       qt = &q->next;
     }
-    xfree(l);
-  }
-  if(source_err(c->input)) {
-    byte_xasprintf((char **)&c->last, "input error: %s",
-                   format_error(c->input->eclass, source_err(c->input), errbuf, sizeof errbuf));
-  } else {
-    c->last = "input error: unexpected EOF";
   }
+  read_failed(c, "input error: unexpected EOF");
   disorder_error(0, "%s: %s", c->ident, c->last);
   return -1;
 }
@@ -697,33 +826,121 @@ static int readqueue(disorder_client *c,
  * The list will have a final NULL not counted in @p nvecp.
  */
 static int readlist(disorder_client *c, char ***vecp, int *nvecp) {
-  char *l;
+  const char *l;
   struct vector v;
-  char errbuf[1024];
+  size_t dot;
 
   vector_init(&v);
-  while(inputlines(c->ident, c->input, &l, '\n') >= 0) {
+  while(read_line(c, &l) >= 0) {
     if(!strcmp(l, ".")) {
       vector_terminate(&v);
       if(nvecp)
 	*nvecp = v.nvec;
       *vecp = v.vec;
-      xfree(l);
       return 0;
     }
-    vector_append(&v, xstrdup(l + (*l == '.')));
-    xfree(l);
-  }
-  if(source_err(c->input)) {
-    byte_xasprintf((char **)&c->last, "input error: %s",
-                   format_error(c->input->eclass, source_err(c->input), errbuf, sizeof errbuf));
-  } else {
-    c->last = "input error: unexpxected EOF";
+    dot = (*l == '.');
+    vector_append(&v, xstrndup(l + dot, c->line.nvec - dot));
   }
+  read_failed(c, "input error: unexpxected EOF");
   disorder_error(0, "%s: %s", c->ident, c->last);
   return -1;
 }
 
+/** @brief Send a command without waiting for its response
+ * @param c Client
+ * @param cmd Command
+ * @return 0 on success, non-0 on error
+ *
+ * The remaining arguments are command arguments, terminated by (char *)0, as
+ * for the generated command functions; they may include @ref disorder__list
+ * etc.  They should be in UTF-8.
+ *
+ * Any number of commands can be sent this way.  Their responses must then be
+ * collected, in the same order, with disorder_pipeline_receive() or one of
+ * its relatives.  The commands are only actually
+ * transmitted when the first response is requested, so they go to the server
+ * together and its replies come back together.
+ */
+int disorder_pipeline_send(disorder_client *c, const char *cmd, ...) {
+  va_list ap;
+  int ret;
+
+  va_start(ap, cmd);
+  ret = disorder_send_v(c, cmd, ap);
+  va_end(ap);
+  return ret;
+}
+
+/** @brief Collect the response to a pipelined command
+ * @param c Client
+ * @param rp Where to store result, or NULL (UTF-8)
+ * @return 0 on success, non-0 on error
+ *
+ * As with the generated command functions, 5xx responses count as errors and
+ * @p rp is not filled in for xx9 responses.  The response is not dequoted.
+ */
+int disorder_pipeline_receive(disorder_client *c, char **rp) {
+  if(sink_flush(c->output))
+    return write_error(c);
+  return disorder_simple(c, rp, NULL, (char *)0);
+}
+
+/** @brief Collect the response to a pipelined command that returns a list
+ * @param c Client
+ * @param vecp Where to store list (UTF-8)
+ * @param nvecp Where to store number of items, or NULL
+ * @return 0 on success, non-0 on error
+ */
+int disorder_pipeline_receive_list(disorder_client *c,
+                                   char ***vecp, int *nvecp) {
+  int rc;
+
+  if((rc = disorder_pipeline_receive(c, NULL)))
+    return rc;
+  return readlist(c, vecp, nvecp);
+}
+
+/** @brief Collect the response to a pipelined command that returns a queue
+ * @param c Client
+ * @param qp Where to store list of queue entries
+ * @return 0 on success, non-0 on error
+ */
+int disorder_pipeline_receive_queue(disorder_client *c,
+                                    struct queue_entry **qp) {
+  int rc;
+
+  if((rc = disorder_pipeline_receive(c, NULL)))
+    return rc;
+  return readqueue(c, qp);
+}
+
+/** @brief Collect the response to an arbitrary pipelined command
+ * @param c Client
+ * @param rp Where to store the response line (UTF-8)
+ * @param vecp Where to store the body, or NULL if there wasn't one (UTF-8)
+ * @param nvecp Where to store number of body lines, or NULL
+ * @return Response code, or -1 on error
+ *
+ * Unlike disorder_pipeline_receive(), this is for callers that don't know in
+ * advance what the response will look like.  The whole response line is
+ * returned, including its code, and 5xx responses are not errors.  A body is
+ * read if the response code says one follows.
+ */
+int disorder_pipeline_receive_response(disorder_client *c, char **rp,
+                                       char ***vecp, int *nvecp) {
+  int rc;
+
+  if(sink_flush(c->output))
+    return write_error(c);
+  *vecp = NULL;
+  if((rc = response(c, rp)) == -1)
+    return -1;
+  if(rc / 100 == 2 && rc % 10 == 3 && readlist(c, vecp, nvecp))
+    return -1;
+  return rc;
+}
+
 /** @brief Return the user we logged in with
  * @param c Client
  * @return User name (owned by @p c, don't modify)
@@ -802,20 +1019,28 @@ static int boolean(const char *cmd, const char *value,
  * @return 0 on success, non-0 on error
  */
 int disorder_log(disorder_client *c, struct sink *s) {
-  char *l;
+  return disorder_log_events(c, s, NULL, 0);
+}
+
+/** @brief Log selected events to a sink
+ * @param c Client
+ * @param s Sink to write log lines to
+ * @param events Event keywords to log
+ * @param nevents Number of keywords, or 0 for all events
+ * @return 0 on success, non-0 on error
+ */
+int disorder_log_events(disorder_client *c, struct sink *s,
+                        char **events, int nevents) {
+  const char *l;
   int rc;
-  char errbuf[1024];
     
-  if((rc = disorder_simple(c, 0, "log", (char *)0)))
+  if((rc = disorder_simple(c, 0, "log", disorder__list, events, nevents,
+                           (char *)0)))
     return rc;
-  while(inputlines(c->ident, c->input, &l, '\n') >= 0 && strcmp(l, "."))
+  while(read_line(c, &l) >= 0 && strcmp(l, "."))
     if(sink_printf(s, "%s\n", l) < 0) return -1;
-  if(source_err(c->input)) {
-    byte_xasprintf((char **)&c->last, "input error: %s",
-		   format_error(c->input->eclass, source_err(c->input), errbuf, sizeof errbuf));
-    return -1;
-  } else if(source_eof(c->input)) {
-    byte_xasprintf((char **)&c->last, "input error: unexpected EOF");
+  if(socketio_error(&c->sio) || socketio_eof(&c->sio)) {
+    read_failed(c, "input error: unexpected EOF");
     return -1;
   }
 
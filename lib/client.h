@@ -55,8 +55,19 @@ int disorder_connect_generic(struct config *conf,
                              const char *password,
                              const char *cookie);
 int disorder_close(disorder_client *c);
+int disorder_reusable(disorder_client *c);
 char *disorder_user(disorder_client *c);
 int disorder_log(disorder_client *c, struct sink *s);
+int disorder_log_events(disorder_client *c, struct sink *s,
+                        char **events, int nevents);
+int disorder_pipeline_send(disorder_client *c, const char *cmd, ...);
+int disorder_pipeline_receive(disorder_client *c, char **rp);
+int disorder_pipeline_receive_list(disorder_client *c,
+                                   char ***vecp, int *nvecp);
+int disorder_pipeline_receive_queue(disorder_client *c,
+                                    struct queue_entry **qp);
+int disorder_pipeline_receive_response(disorder_client *c, char **rp,
+                                       char ***vecp, int *nvecp);
 const char *disorder_last(disorder_client *c);
 
 #include "client-stubs.h"
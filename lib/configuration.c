@@ -56,8 +56,10 @@
 #include "signame.h"
 #include "authhash.h"
 #include "vector.h"
+#include "rtp.h"
 #if !_WIN32
 #include "uaudio.h"
+#include "realtime.h"
 #endif
 
 /** @brief Path to config file 
@@ -727,6 +729,33 @@ static int validate_tracklength(const struct config_state *cs,
   return 0;
 }
 
+/** @brief Validate a database page size
+ * @param cs Configuration state
+ * @param nvec Length of (proposed) new value
+ * @param vec Elements of new value
+ * @return 0 on success, non-0 on error
+ */
+static int validate_db_page_size(const struct config_state *cs,
+                                 int nvec,
+                                 char **vec) {
+  long n;
+
+  if(!nvec)
+    return 0;
+  if(nvec != 2) {
+    disorder_error(0, "%s:%d: should be 'db_page_size DATABASE BYTES'",
+		   cs->path, cs->line);
+    return -1;
+  }
+  if(xstrtol(&n, vec[1], 0, 0)
+     || n < 512 || n > 65536 || (n & (n - 1))) {
+    disorder_error(0, "%s:%d: page size must be a power of 2 from 512 to 65536",
+		   cs->path, cs->line);
+    return -1;
+  }
+  return 0;
+}
+
 /** @brief Common code for validating integer values
  * @param cs Configuration state
  * @param nvec Length of (proposed) new value
@@ -770,6 +799,24 @@ static int validate_non_negative(const struct config_state *cs,
   return 0;
 }
 
+/** @brief Validate an RTP FEC group size
+ * @param cs Configuration state
+ * @param nvec Length of (proposed) new value
+ * @param vec Elements of new value
+ * @return 0 on success, non-0 on error
+ */
+static int validate_fec(const struct config_state *cs,
+                        int nvec, char **vec) {
+  long n;
+  if(common_validate_integer(cs, nvec, vec, &n)) return -1;
+  if(n < 0 || n > RTP_FEC_MAX_GROUP) {
+    disorder_error(0, "%s:%d: must be between 0 and %d",
+                   cs->path, cs->line, RTP_FEC_MAX_GROUP);
+    return -1;
+  }
+  return 0;
+}
+
 /** @brief Validate a positive (@c long) integer
  * @param cs Configuration state
  * @param nvec Length of (proposed) new value
@@ -971,8 +1018,48 @@ static int validate_backend(const struct config_state attribute((unused)) *cs,
   /* In non-server processes we have no idea what's valid */
   return 0;
 }
+
+/** @brief Validate a list of playback backend names
+ * @param cs Configuration state
+ * @param nvec Length of (proposed) new value
+ * @param vec Elements of new value
+ * @return 0 on success, non-0 on error
+ */
+static int validate_backends(const struct config_state *cs,
+                             int nvec,
+                             char **vec) {
+  int n;
+
+  for(n = 0; n < nvec; ++n) {
+    if(!strcmp(vec[n], "multi")) {
+      disorder_error(0, "%s:%d: multi_api cannot include multi",
+                     cs->path, cs->line);
+      return -1;
+    }
+    if(validate_backend(cs, 1, &vec[n]))
+      return -1;
+  }
+  return 0;
+}
 #endif
 
+/** @brief Test whether a sound API is in use
+ * @param c Configuration
+ * @param name API name
+ * @return Nonzero if @p name is @c c->api or listed in @c c->multi_api
+ */
+static int api_in_use(const struct config *c, const char *name) {
+  int n;
+
+  if(!strcmp(c->api, name))
+    return 1;
+  if(!strcmp(c->api, "multi"))
+    for(n = 0; n < c->multi_api.n; ++n)
+      if(!strcmp(c->multi_api.s[n], name))
+        return 1;
+  return 0;
+}
+
 /** @brief Validate a pause mode string
  * @param cs Configuration state
  * @param nvec Length of (proposed) new value
@@ -988,6 +1075,21 @@ static int validate_pausemode(const struct config_state attribute((unused)) *cs,
   return -1;
 }
 
+/** @brief Validate an ALSA access mode
+ * @param cs Configuration state
+ * @param nvec Length of (proposed) new value
+ * @param vec Elements of new value
+ * @return 0 on success, non-0 on error
+ */
+static int validate_alsa_access(const struct config_state attribute((unused)) *cs,
+                                int nvec,
+                                char **vec) {
+  if(nvec == 1 && (!strcmp(vec[0], "rw") || !strcmp(vec[0], "mmap")))
+    return 0;
+  disorder_error(0, "%s:%d: invalid ALSA access mode", cs->path, cs->line);
+  return -1;
+}
+
 /** @brief Validate an MTU-discovery setting
  * @param cs Configuration state
  * @param nvec Length of (proposed) new value
@@ -1006,6 +1108,68 @@ static int validate_mtu_discovery(const struct config_state attribute((unused))
   return -1;
 }
 
+#if !_WIN32
+/** @brief Validate an audio thread scheduling policy
+ * @param cs Configuration state
+ * @param nvec Length of (proposed) new value
+ * @param vec Elements of new value
+ * @return 0 on success, non-0 on error
+ */
+static int validate_scheduling(const struct config_state *cs,
+                               int nvec, char **vec) {
+  if(nvec == 1
+     && (!strcmp(vec[0], "normal")
+         || !strcmp(vec[0], "fifo")
+         || !strcmp(vec[0], "rr")))
+    return 0;
+  disorder_error(0, "%s:%d: invalid scheduling policy", cs->path, cs->line);
+  return -1;
+}
+
+/** @brief Validate a list of CPUs
+ * @param cs Configuration state
+ * @param nvec Length of (proposed) new value
+ * @param vec Elements of new value
+ * @return 0 on success, non-0 on error
+ */
+static int validate_cpus(const struct config_state *cs,
+                         int nvec, char **vec) {
+  unsigned long long mask;
+
+  if(nvec == 1 && !realtime_parse_cpus(vec[0], &mask))
+    return 0;
+  disorder_error(0, "%s:%d: invalid CPU list", cs->path, cs->line);
+  return -1;
+}
+
+/** @brief Validate a zone name
+ * @param cs Configuration state
+ * @param nvec Length of (proposed) new value
+ * @param vec Elements of new value
+ * @return 0 on success, non-0 on error
+ *
+ * Zone names may contain letters, digits, '-' and '_'.
+ */
+static int validate_zone(const struct config_state *cs,
+                         int nvec, char **vec) {
+  const char *s;
+
+  if(nvec != 1) {
+    disorder_error(0, "%s:%d: expected one zone name", cs->path, cs->line);
+    return -1;
+  }
+  for(s = vec[0]; *s; ++s)
+    if(!isalnum((unsigned char)*s) && *s != '-' && *s != '_')
+      break;
+  if(*s || s == vec[0]) {
+    disorder_error(0, "%s:%d: invalid zone name '%s'",
+                   cs->path, cs->line, vec[0]);
+    return -1;
+  }
+  return 0;
+}
+#endif
+
 /** @brief Validate a destination network address
  * @param cs Configuration state
  * @param nvec Length of (proposed) new value
@@ -1066,30 +1230,61 @@ static int validate_inetaddr(const struct config_state *cs,
 /** @brief All configuration items */
 static const struct conf conf[] = {
   { C(alias),            &type_string,           validate_alias },
+  { C(alsa_access),      &type_string,           validate_alsa_access },
+  { C(alsa_buffer_size), &type_integer,          validate_non_negative },
+  { C(alsa_period_size), &type_integer,          validate_non_negative },
 #if !_WIN32
   { C(api),              &type_string,           validate_backend },
+#if !_WIN32
+  { C(audio_cpus),       &type_string,           validate_cpus },
+  { C(audio_huge_pages), &type_boolean,          validate_any },
+  { C(audio_memory_kbyte), &type_integer,        validate_non_negative },
+  { C(audio_priority),   &type_integer,          validate_non_negative },
+  { C(audio_scheduling), &type_string,           validate_scheduling },
+#endif
 #endif
   { C(authorization_algorithm), &type_string,    validate_algo },
   { C(broadcast),        &type_netaddress,       validate_destaddr },
   { C(broadcast_from),   &type_netaddress,       validate_any },
   { C(channel),          &type_string,           validate_any },
   { C(checkpoint_kbyte), &type_integer,          validate_non_negative },
+  { C(checkpoint_log_kbyte), &type_integer,      validate_non_negative },
   { C(checkpoint_min),   &type_integer,          validate_non_negative },
+  { C(choose_resident),  &type_boolean,          validate_any },
   { C(collection),       &type_collections,      validate_any },
+  { C(compress),         &type_boolean,          validate_any },
   { C(connect),          &type_netaddress,       validate_destaddr },
   { C(cookie_key_lifetime),  &type_integer,      validate_positive },
   { C(cookie_login_lifetime),  &type_integer,    validate_positive },
+  { C(db_cache_kbyte),   &type_integer,          validate_non_negative },
+  { C(db_log_buffer_kbyte), &type_integer,       validate_non_negative },
+  { C(db_mmap_kbyte),    &type_integer,          validate_non_negative },
+  { C(db_online_upgrade), &type_boolean,         validate_any },
+  { C(db_page_size),     &type_stringlist_accum, validate_db_page_size },
   { C(dbversion),        &type_integer,          validate_positive },
+  { C(decode_ahead),     &type_integer,          validate_non_negative },
+  { C(decode_cache),     &type_string,           validate_isabspath },
+  { C(decode_cache_kbyte), &type_integer,        validate_positive },
   { C(default_rights),   &type_rights,           validate_any },
   { C(device),           &type_string,           validate_any },
   { C(history),          &type_integer,          validate_positive },
 #if !_WIN32
   { C(home),             &type_string,           validate_isabspath },
+#endif
+  { C(http_listen),      &type_netaddress,       validate_any },
+  { C(http_opus_bitrate), &type_integer,         validate_positive },
+#if !_WIN32
+  { C(library),          &type_string,           validate_isabspath },
 #endif
   { C(listen),           &type_netaddress,       validate_any },
+  { C(loudness_analysis), &type_boolean,         validate_any },
+  { C(loudness_target),  &type_integer,          validate_any },
   { C(mail_sender),      &type_string,           validate_any },
   { C(mixer),            &type_string,           validate_any },
   { C(mount_rescan),     &type_boolean,          validate_any },
+#if !_WIN32
+  { C(multi_api),        &type_string_accum,     validate_backends },
+#endif
   { C(multicast_loop),   &type_boolean,          validate_any },
   { C(multicast_ttl),    &type_integer,          validate_non_negative },
   { C(namepart),         &type_namepart,         validate_any },
@@ -1103,26 +1298,41 @@ static const struct conf conf[] = {
   { C(noticed_history),  &type_integer,          validate_positive },
   { C(password),         &type_string,           validate_any },
   { C(pause_mode),       &type_string,           validate_pausemode },
+  { C(pipe_size),        &type_integer,          validate_non_negative },
   { C(player),           &type_stringlist_accum, validate_player },
+  { C(player_pool),      &type_integer,          validate_non_negative },
   { C(playlist_lock_timeout), &type_integer,     validate_positive },
   { C(playlist_max) ,    &type_integer,          validate_positive },
   { C(plugins),          &type_string_accum,     validate_isdir },
+  { C(prefetch_ahead),   &type_integer,          validate_non_negative },
+  { C(query_cache_kbyte), &type_integer,         validate_non_negative },
+  { C(query_workers),    &type_integer,          validate_non_negative },
   { C(queue_pad),        &type_integer,          validate_positive },
   { C(refresh),          &type_integer,          validate_positive },
   { C(refresh_min),      &type_integer,          validate_non_negative },
   { C(reminder_interval), &type_integer,         validate_positive },
   { C(remote_userman),   &type_boolean,          validate_any },
   { C(replay_min),       &type_integer,          validate_non_negative },
+  { C(rescan_backoff),   &type_integer,          validate_non_negative },
+  { C(rescan_idle_io),   &type_boolean,          validate_any },
+  { C(rescan_rate),      &type_integer,          validate_non_negative },
+  { C(rescan_scanners),  &type_integer,          validate_positive },
+  { C(rescan_split),     &type_boolean,          validate_any },
+  { C(rescan_watch),     &type_boolean,          validate_any },
   { C(rtp_always_request), &type_boolean,	 validate_any },
   { C(rtp_delay_threshold), &type_integer,       validate_positive },
+  { C(rtp_fec),		 &type_integer,		 validate_fec },
+  { C(rtp_gso),		 &type_integer,		 validate_non_negative },
   { C(rtp_instance_name), &type_string,		 validate_any },
   { C(rtp_max_payload),	 &type_integer,		 validate_positive },
   { C(rtp_maxbuffer),	 &type_integer,		 validate_non_negative },
   { C(rtp_minbuffer),	 &type_integer,		 validate_non_negative },
   { C(rtp_mode),         &type_string,           validate_any },
   { C(rtp_mtu_discovery), &type_string,		 validate_mtu_discovery },
+  { C(rtp_opus_bitrate), &type_integer,		 validate_positive },
   { C(rtp_rcvbuf),	 &type_integer,		 validate_non_negative },
   { C(rtp_request_address), &type_netaddress,	 validate_inetaddr },
+  { C(rtp_rtcp),	 &type_boolean,		 validate_any },
   { C(rtp_verbose),      &type_boolean,          validate_any },
   { C(sample_format),    &type_sample_format,    validate_sample_format },
   { C(scratch),          &type_string_accum,     validate_isreg },
@@ -1131,21 +1341,35 @@ static const struct conf conf[] = {
 #endif
   { C(short_display),    &type_integer,          validate_positive },
   { C(signal),           &type_signal,           validate_any },
+  { C(slow_callback_ms), &type_integer,          validate_non_negative },
   { C(smtp_server),      &type_string,           validate_any },
   { C(sox_generation),   &type_integer,          validate_non_negative },
 #if !_WIN32
   { C2(speaker_backend, api),  &type_string,     validate_backend },
 #endif
+  { C(speaker_buffer),   &type_integer,          validate_positive },
+  { C(speaker_chunk_max), &type_integer,         validate_non_negative },
+  { C(speaker_chunk_min), &type_integer,         validate_non_negative },
   { C(speaker_command),  &type_string,           validate_any },
+  { C(speaker_crossfade), &type_integer,         validate_non_negative },
+  { C(speaker_memory_kbyte), &type_integer,      validate_positive },
+  { C(speaker_prefill),  &type_integer,          validate_non_negative },
+  { C(speaker_thread_buffers), &type_integer,    validate_non_negative },
   { C(stopword),         &type_string_accum,     validate_any },
   { C(templates),        &type_string_accum,     validate_isdir },
+  { C(trace_file),       &type_string,           validate_isabspath },
   { C(tracklength),      &type_stringlist_accum, validate_tracklength },
   { C(transform),        &type_transform,        validate_any },
   { C(url),              &type_string,           validate_url },
 #if !_WIN32
   { C(user),             &type_string,           validate_isauser },
 #endif
+  { C(user_max_connections), &type_integer,      validate_non_negative },
+  { C(user_max_pending), &type_integer,          validate_non_negative },
   { C(username),         &type_string,           validate_any },
+#if !_WIN32
+  { C(zone),             &type_string,           validate_zone },
+#endif
 };
 
 /** @brief Find a configuration item's definition by key */
@@ -1385,8 +1609,13 @@ static struct config *config_default(void) {
 #endif
   c->alias = xstrdup("{/artist}{/album}{/title}{ext}");
   c->device = xstrdup("default");
+  c->alsa_access = xstrdup("rw");
   c->nice_rescan = 10;
   c->speaker_command = 0;
+  c->speaker_buffer = 6000;
+  c->speaker_prefill = 250;
+  c->speaker_memory_kbyte = 16384;
+  c->speaker_crossfade = 0;
   c->sample_format.bits = 16;
   c->sample_format.rate = 44100;
   c->sample_format.channels = 2;
@@ -1401,7 +1630,7 @@ static struct config *config_default(void) {
   c->short_display = 32;
   c->mixer = 0;
   c->channel = 0;
-  c->dbversion = 2;
+  c->dbversion = 4;
   c->cookie_login_lifetime = 86400;
   c->cookie_key_lifetime = 86400 * 7;
 #if !_WIN32
@@ -1417,13 +1646,26 @@ static struct config *config_default(void) {
   c->playlist_max = INT_MAX;            /* effectively no limit */
   c->playlist_lock_timeout = 10;        /* 10s */
   c->mount_rescan = 1;
+  c->choose_resident = 1;
+  c->player_pool = 2;
+  c->query_workers = 2;
+  c->rescan_scanners = 4;
+  c->loudness_target = -18;
+  c->rescan_backoff = 30;
+  c->rescan_idle_io = 1;
+  c->checkpoint_log_kbyte = 65536;
+  c->query_cache_kbyte = 8192;
+  c->user_max_pending = 4;
+  c->decode_cache_kbyte = 524288;
+  c->prefetch_ahead = 3;
   /* Default stopwords */
   if(config_set(&cs, (int)NDEFAULT_STOPWORDS, (char **)default_stopwords))
     exit(1);
   /* Default player configuration */
   for(n = 0; n < NDEFAULT_PLAYERS; ++n) {
     if(config_set_args(&cs, "player",
-		       default_players[n], "execraw", "disorder-decode", (char *)0))
+		       default_players[n], "decode", "--direct",
+                       (char *)0))
       exit(1);
     if(config_set_args(&cs, "tracklength",
 		       default_players[n], "disorder-tracklength", (char *)0))
@@ -1432,10 +1674,14 @@ static struct config *config_default(void) {
   c->broadcast.af = -1;
   c->broadcast_from.af = -1;
   c->listen.af = -1;
+  c->http_listen.af = -1;
+  c->http_opus_bitrate = 96000;
   c->connect.af = -1;
+  c->compress = 1;
   c->rtp_mode = xstrdup("auto");
   c->rtp_max_payload = -1;
   c->rtp_mtu_discovery = xstrdup("default");
+  c->rtp_opus_bitrate = 96000;
   return c;
 }
 
@@ -1551,21 +1797,32 @@ static void config_postdefaults(struct config *c,
   if(!strcmp(c->api, "network"))
     c->api = xstrdup("rtp");
   if(server) {
-    if(!strcmp(c->api, "command") && !c->speaker_command)
+    if(!strcmp(c->api, "multi") && !c->multi_api.n)
+      disorder_fatal(0, "'api multi' but multi_api is not set");
+    if(api_in_use(c, "command") && !c->speaker_command)
       disorder_fatal(0, "'api command' but speaker_command is not set");
-    if((!strcmp(c->api, "rtp")) &&
+    if(api_in_use(c, "rtp") &&
        c->broadcast.af == -1 && strcmp(c->rtp_mode, "request"))
       disorder_fatal(0, "'api rtp' but broadcast is not set "
 		     "and mode is not not 'request'");
+    if(api_in_use(c, "http") && c->http_listen.af == -1)
+      disorder_fatal(0, "'api http' but http_listen is not set");
   }
   /* Override sample format */
   if(!strcmp(c->api, "rtp")) {
+    /* Network byte order, so that decoders produce it directly and the RTP
+     * backend doesn't have to convert */
+    c->sample_format.rate = 44100;
+    c->sample_format.channels = 2;
+    c->sample_format.bits = 16;
+    c->sample_format.endian = ENDIAN_BIG;
+  } else if(api_in_use(c, "rtp")) {
+    /* Other outputs want native byte order, so the RTP backend converts */
     c->sample_format.rate = 44100;
     c->sample_format.channels = 2;
     c->sample_format.bits = 16;
-    c->sample_format.endian = ENDIAN_NATIVE;
   }
-  if(!strcmp(c->api, "coreaudio")) {
+  if(api_in_use(c, "coreaudio") || api_in_use(c, "http")) {
     c->sample_format.rate = 44100;
     c->sample_format.channels = 2;
     c->sample_format.bits = 16;
@@ -1626,6 +1883,17 @@ int config_read(int server,
   }
   /* install default namepart and transform settings */
   config_postdefaults(c, server);
+#if !_WIN32
+  /* 'library' on its own makes a replica */
+  if(server && c->zone && !c->library) {
+    disorder_error(0, "'zone' requires 'library'");
+    return -1;
+  }
+  if(server && c->library && !strcmp(c->library, c->home)) {
+    disorder_error(0, "'library' cannot be the same as 'home'");
+    return -1;
+  }
+#endif
   if(oldconfig)  {
     int failed = 0;
 #if !_WIN32
@@ -1633,6 +1901,14 @@ int config_read(int server,
       disorder_error(0, "'home' cannot be changed without a restart");
       failed = 1;
     }
+    if(!c->library != !oldconfig->library
+       || (c->library && strcmp(c->library, oldconfig->library))
+       || !c->zone != !oldconfig->zone
+       || (c->zone && strcmp(c->zone, oldconfig->zone))) {
+      disorder_error(0, "'library' and 'zone' cannot be changed"
+                     " without a restart");
+      failed = 1;
+    }
 #endif
     if(strcmp(c->alias, oldconfig->alias)) {
       disorder_error(0, "'alias' cannot be changed without a restart");
@@ -1650,6 +1926,17 @@ int config_read(int server,
       disorder_error(0, "'nice_server' cannot be changed without a restart");
       /* ...but we accept the new config anyway */
     }
+    if(c->sample_format.rate != oldconfig->sample_format.rate
+       || c->sample_format.channels != oldconfig->sample_format.channels
+       || c->sample_format.bits != oldconfig->sample_format.bits
+       || c->sample_format.endian != oldconfig->sample_format.endian) {
+      disorder_error(0, "'sample_format' cannot be changed without a restart");
+      /* ...but we accept the new config anyway */
+    }
+    if(stringlist_compare(&c->multi_api, &oldconfig->multi_api)) {
+      disorder_error(0, "'multi_api' cannot be changed without a restart");
+      /* ...but we accept the new config anyway */
+    }
     if(namepartlist_compare(&c->namepart, &oldconfig->namepart)) {
       disorder_error(0, "'namepart' settings cannot be changed without a restart");
       failed = 1;
@@ -105,9 +105,24 @@ struct config {
   /** @brief Authorization algorithm */
   char *authorization_algorithm;
   
+  /** @brief Number of queued tracks to decode ahead */
+  long decode_ahead;
+
+  /** @brief Decode-ahead cache directory, or NULL */
+  const char *decode_cache;
+
+  /** @brief Maximum size of decode-ahead cache in kilobytes */
+  long decode_cache_kbyte;
+
+  /** @brief Number of queued tracks to read ahead */
+  long prefetch_ahead;
+
   /** @brief All players */
   struct stringlistlist player;
 
+  /** @brief Number of pre-forked player processes */
+  long player_pool;
+
   /** @brief All tracklength plugins */
   struct stringlistlist tracklength;
 
@@ -141,6 +156,24 @@ struct config {
   /** @brief Databsase checkpoint minimum */
   long checkpoint_min;
 
+  /** @brief Log written since the last checkpoint that forces a new one */
+  long checkpoint_log_kbyte;
+
+  /** @brief Database cache size in kilobytes, or 0 for the default */
+  long db_cache_kbyte;
+
+  /** @brief Database log buffer size in kilobytes, or 0 for the default */
+  long db_log_buffer_kbyte;
+
+  /** @brief Largest read-only database file to map in kilobytes, or 0 */
+  long db_mmap_kbyte;
+
+  /** @brief Whether to upgrade the database while the server runs */
+  int db_online_upgrade;
+
+  /** @brief Page sizes for new databases */
+  struct stringlistlist db_page_size;
+
   /** @brief Path to mixer device */
   char *mixer;
 
@@ -159,11 +192,41 @@ struct config {
   /** @brief Nice value for speaker */
   long nice_speaker;
 
+  /** @brief Threshold for logging slow event loop callbacks, or 0 */
+  long slow_callback_ms;
+
+  /** @brief File to record track lifecycle trace events in, or NULL */
+  const char *trace_file;
+
   /** @brief Command execute by speaker to play audio */
   const char *speaker_command;
 
+  /** @brief Per-track speaker buffer size in milliseconds */
+  long speaker_buffer;
+
+  /** @brief Largest chunk of audio to hand to the backend, or 0 */
+  long speaker_chunk_max;
+
+  /** @brief Smallest chunk of audio to hand to the backend, or 0 */
+  long speaker_chunk_min;
+
+  /** @brief Crossfade between tracks in milliseconds */
+  long speaker_crossfade;
+
+  /** @brief Total speaker buffer memory in kilobytes */
+  long speaker_memory_kbyte;
+
+  /** @brief Minimum audio to buffer before a track starts, in milliseconds */
+  long speaker_prefill;
+
+  /** @brief Number of audio thread buffers, or 0 for the default */
+  long speaker_thread_buffers;
+
   /** @brief Pause mode for command backend */
   const char *pause_mode;
+
+  /** @brief Pipe capacity for command backend in bytes, or 0 */
+  long pipe_size;
   
   /** @brief Target sample format */
   struct stream_header sample_format;
@@ -174,6 +237,21 @@ struct config {
   /** @brief API used to play sound */
   const char *api;
 
+  /** @brief Scheduling policy for audio threads, or NULL */
+  const char *audio_scheduling;
+
+  /** @brief Realtime priority for audio threads */
+  long audio_priority;
+
+  /** @brief CPUs to run audio threads on, or NULL */
+  const char *audio_cpus;
+
+  /** @brief Size of locked memory for audio buffers, or 0 */
+  long audio_memory_kbyte;
+
+  /** @brief Use huge pages for locked audio memory */
+  int audio_huge_pages;
+
   /** @brief Maximum size of a playlist */
   long playlist_max;
 
@@ -183,6 +261,15 @@ struct config {
 #if !_WIN32
   /** @brief Home directory for state files */
   const char *home;
+
+  /** @brief Home directory of the server whose database we share, or NULL
+   *
+   * Set for a zone.
+   */
+  const char *library;
+
+  /** @brief Name of this zone, or NULL */
+  const char *zone;
 #endif
 
   /** @brief Login username */
@@ -194,6 +281,9 @@ struct config {
   /** @brief Address to connect to */
   struct netaddress connect;
 
+  /** @brief Ask for compressed responses over TCP */
+  int compress;
+
   /** @brief Directories to search for web templates */
   struct stringlist templates;
 
@@ -212,8 +302,47 @@ struct config {
   /** @brief Target queue length */
   long queue_pad;
 
+  /** @brief Keep random choice weights in the server */
+  int choose_resident;
+
+  /** @brief Number of database query worker processes */
+  long query_workers;
+
+  /** @brief Size limit for cached query results in kilobytes */
+  long query_cache_kbyte;
+
+  /** @brief Maximum connections per user, or 0 */
+  long user_max_connections;
+
+  /** @brief Maximum outstanding slow commands per user, or 0 */
+  long user_max_pending;
+
   /** @brief Minimum time between a track being played again */
   long replay_min;
+
+  /** @brief Seconds to pause a rescan for when playback drops out, or 0 */
+  long rescan_backoff;
+
+  /** @brief Put the rescanner in the idle I/O class, where possible */
+  int rescan_idle_io;
+
+  /** @brief Maximum files per second for the rescanner to visit, or 0 */
+  long rescan_rate;
+
+  /** @brief Maximum number of scanner or tracklength subprocesses at once */
+  long rescan_scanners;
+
+  /** @brief Scan each top-level entry of a collection separately */
+  int rescan_split;
+
+  /** @brief Watch collections for changes between rescans */
+  int rescan_watch;
+
+  /** @brief Measure track loudness when rechecking, and play to match it */
+  int loudness_analysis;
+
+  /** @brief Loudness to play tracks at, in LUFS */
+  long loudness_target;
   
   struct namepartlist namepart;		/* transformations */
 
@@ -223,6 +352,18 @@ struct config {
   /** @brief ALSA output device */
   const char *device;
 
+  /** @brief Backends for @c api @c multi */
+  struct stringlist multi_api;
+
+  /** @brief ALSA access mode ("rw" or "mmap") */
+  char *alsa_access;
+
+  /** @brief ALSA period size in frames, or 0 to let ALSA choose */
+  long alsa_period_size;
+
+  /** @brief ALSA buffer size in frames, or 0 to let ALSA choose */
+  long alsa_buffer_size;
+
   struct transformlist transform;	/* path name transformations */
 
   /** @brief Address to send audio data to */
@@ -272,6 +413,27 @@ struct config {
    */
   long rtp_max_payload;
 
+  /** @brief Most RTP packets to send in one go using UDP GSO
+   *
+   * 0 means not to use generic segmentation offload.
+   */
+  long rtp_gso;
+
+  /** @brief Bit rate for Opus-compressed RTP streams */
+  long rtp_opus_bitrate;
+
+  /** @brief Address to serve HTTP audio streams on */
+  struct netaddress http_listen;
+
+  /** @brief Bit rate for HTTP audio streams */
+  long http_opus_bitrate;
+
+  /** @brief Whether to send RTCP sender reports */
+  int rtp_rtcp;
+
+  /** @brief Number of RTP packets per parity FEC packet, or 0 */
+  long rtp_fec;
+
   /** @brief Whether to allow MTU discovery
    *
    * This is `yes' to force it on, `no' to force it off, or `default' to do
@@ -54,6 +54,33 @@ static time_t signing_key_validity_limit;
 /** @brief Hash of revoked cookies */
 static hash *revoked;
 
+/** @brief Maximum number of entries in @ref verified */
+#define VERIFIED_MAX 256
+
+/** @brief A cookie that has already been verified */
+struct verified_cookie {
+  /** @brief User it logs in as */
+  const char *user;
+
+  /** @brief That user's rights */
+  rights_type rights;
+
+  /** @brief Expiry time of the cookie */
+  time_t expires;
+
+  /** @brief Value of @ref trackdb_users_generation when verified */
+  unsigned long generation;
+};
+
+/** @brief Cache of recently verified cookies
+ *
+ * Values are <tt>struct verified_cookie</tt>.  Entries are only valid while
+ * @ref trackdb_users_generation is unchanged, since the user's password or
+ * rights might have changed.  The whole cache is discarded when the signing
+ * key changes, or when it fills up.
+ */
+static hash *verified;
+
 /** @brief Callback to expire revocation list */
 static int revoked_cleanup_callback(const char *key, void *value,
                                     void *u) {
@@ -70,6 +97,8 @@ static void newkey(void) {
   memcpy(old_signing_key, signing_key, HASHSIZE);
   gcry_randomize(signing_key, HASHSIZE, GCRY_STRONG_RANDOM);
   signing_key_validity_limit = now + config->cookie_key_lifetime;
+  /* Cookies signed with the key just discarded are no longer valid */
+  verified = NULL;
   /* Now is a good time to clean up the revocation list... */
   if(revoked)
     hash_foreach(revoked, revoked_cleanup_callback, &now);
@@ -149,10 +178,32 @@ char *make_cookie(const char *user) {
   return c;
 }
 
+/** @brief Remember a verified cookie
+ * @param cookie Cookie
+ * @param user User it logs in as
+ * @param rights User's rights
+ * @param expires Expiry time of the cookie
+ */
+static void remember_cookie(const char *cookie, const char *user,
+                            rights_type rights, time_t expires) {
+  struct verified_cookie v;
+
+  if(!verified || hash_count(verified) >= VERIFIED_MAX)
+    verified = hash_new(sizeof v);
+  v.user = user;
+  v.rights = rights;
+  v.expires = expires;
+  v.generation = trackdb_users_generation;
+  hash_add(verified, cookie, &v, HASH_INSERT_OR_REPLACE);
+}
+
 /** @brief Verify a cookie
  * @param cookie Cookie to verify
  * @param rights Where to store rights value
  * @return Verified user or NULL
+ *
+ * Cookies that have been verified recently are found in @ref verified and
+ * need neither the users database nor any cryptography.
  */
 char *verify_cookie(const char *cookie, rights_type *rights) {
   char *c1, *c2;
@@ -161,12 +212,22 @@ char *verify_cookie(const char *cookie, rights_type *rights) {
   char *user, *bp, *sig;
   const char *password;
   struct kvp *k;
+  const struct verified_cookie *v;
 
   /* check the revocation list */
   if(revoked && hash_find(revoked, cookie)) {
     disorder_error(0, "attempt to log in with revoked cookie");
     return 0;
   }
+  /* check the cache */
+  if(verified && (v = hash_find(verified, cookie))) {
+    xtime(&now);
+    if(v->generation == trackdb_users_generation && now < v->expires) {
+      *rights = v->rights;
+      return xstrdup(v->user);
+    }
+    hash_remove(verified, cookie);
+  }
   /* parse the cookie */
   errno = 0;
   t = strtoimax(cookie, &c1, 16);
@@ -209,13 +270,17 @@ char *verify_cookie(const char *cookie, rights_type *rights) {
    * compare that rather than exposing our base64 parser to the cookie. */
   if(!(sig = sign(signing_key, bp)))
     return 0;
-  if(!strcmp(sig, c2 + 1))
+  if(!strcmp(sig, c2 + 1)) {
+    remember_cookie(cookie, user, *rights, t);
     return user;
+  }
   /* that didn't match, try the old key */
   if(!(sig = sign(old_signing_key, bp)))
     return 0;
-  if(!strcmp(sig, c2 + 1))
+  if(!strcmp(sig, c2 + 1)) {
+    remember_cookie(cookie, user, *rights, t);
     return user;
+  }
   /* that didn't match either */
   disorder_error(0, "cookie signature does not match");
   return 0;
@@ -243,6 +308,8 @@ void revoke_cookie(const char *cookie) {
     revoked = hash_new(sizeof(time_t));
   /* add the cookie to it; its value is the expiry time */
   hash_add(revoked, cookie, &when, HASH_INSERT);
+  if(verified)
+    hash_remove(verified, cookie);
 }
 
 /*
@@ -102,6 +102,16 @@ long disorder_tracklength(const char *track, const char *path);
  * exist in the filesystem).  The return value should be a positive
  * number of seconds, 0 for unknown or -1 if an error occurred. */
 
+void disorder_tracklength_batch(int ntracks,
+                                const char *const *tracks,
+                                const char *const *paths,
+                                void (*callback)(int n, long length, void *u),
+                                void *u);
+/* optional: compute the lengths of @ntracks@ tracks, calling @callback@
+ * once for each with its index and length as above, in any order.  The
+ * server uses this in preference to disorder_tracklength() when computing
+ * many lengths at once. */
+
 void disorder_scan(const char *root);
 /* write a list of path names below @root@ to standard output. */
 
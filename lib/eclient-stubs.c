@@ -36,10 +36,18 @@ int disorder_eclient_allfiles(disorder_eclient *c, disorder_eclient_list_respons
   return simple(c, list_response_opcallback, (void (*)())completed, v, "allfiles", dir, re, (char *)0);
 }
 
+int disorder_eclient_db_stats(disorder_eclient *c, disorder_eclient_list_response *completed, void *v) {
+  return simple(c, list_response_opcallback, (void (*)())completed, v, "db-stats", (char *)0);
+}
+
 int disorder_eclient_deluser(disorder_eclient *c, disorder_eclient_no_response *completed, const char *user, void *v) {
   return simple(c, no_response_opcallback, (void (*)())completed, v, "deluser", user, (char *)0);
 }
 
+int disorder_eclient_dir_summaries(disorder_eclient *c, disorder_eclient_list_response *completed, char **dirs, int ndirs, void *v) {
+  return simple(c, list_response_opcallback, (void (*)())completed, v, "dir-summaries", disorder__list, dirs, ndirs, (char *)0);
+}
+
 int disorder_eclient_dirs(disorder_eclient *c, disorder_eclient_list_response *completed, const char *dir, const char *re, void *v) {
   return simple(c, list_response_opcallback, (void (*)())completed, v, "dirs", dir, re, (char *)0);
 }
@@ -60,6 +68,10 @@ int disorder_eclient_enabled(disorder_eclient *c, disorder_eclient_integer_respo
   return simple(c, integer_response_opcallback, (void (*)())completed, v, "enabled", (char *)0);
 }
 
+int disorder_eclient_event_stats(disorder_eclient *c, disorder_eclient_list_response *completed, void *v) {
+  return simple(c, list_response_opcallback, (void (*)())completed, v, "event-stats", (char *)0);
+}
+
 int disorder_eclient_exists(disorder_eclient *c, disorder_eclient_integer_response *completed, const char *track, void *v) {
   return simple(c, integer_response_opcallback, (void (*)())completed, v, "exists", track, (char *)0);
 }
@@ -80,10 +92,18 @@ int disorder_eclient_length(disorder_eclient *c, disorder_eclient_integer_respon
   return simple(c, integer_response_opcallback, (void (*)())completed, v, "length", track, (char *)0);
 }
 
+int disorder_eclient_lengths_multi(disorder_eclient *c, disorder_eclient_list_response *completed, char **tracks, int ntracks, void *v) {
+  return simple(c, list_response_opcallback, (void (*)())completed, v, "lengths-multi", disorder__list, tracks, ntracks, (char *)0);
+}
+
 int disorder_eclient_make_cookie(disorder_eclient *c, disorder_eclient_string_response *completed, void *v) {
   return simple(c, string_response_opcallback, (void (*)())completed, v, "make-cookie", (char *)0);
 }
 
+int disorder_eclient_metrics(disorder_eclient *c, disorder_eclient_list_response *completed, void *v) {
+  return simple(c, list_response_opcallback, (void (*)())completed, v, "metrics", (char *)0);
+}
+
 int disorder_eclient_move(disorder_eclient *c, disorder_eclient_no_response *completed, const char *track, long delta, void *v) {
   return simple(c, no_response_opcallback, (void (*)())completed, v, "move", track, disorder__integer, delta, (char *)0);
 }
@@ -104,6 +124,10 @@ int disorder_eclient_part(disorder_eclient *c, disorder_eclient_string_response
   return simple(c, string_response_opcallback, (void (*)())completed, v, "part", track, context, part, (char *)0);
 }
 
+int disorder_eclient_parts_multi(disorder_eclient *c, disorder_eclient_list_response *completed, const char *context, const char *part, char **tracks, int ntracks, void *v) {
+  return simple(c, list_response_opcallback, (void (*)())completed, v, "parts-multi", context, part, disorder__list, tracks, ntracks, (char *)0);
+}
+
 int disorder_eclient_pause(disorder_eclient *c, disorder_eclient_no_response *completed, void *v) {
   return simple(c, no_response_opcallback, (void (*)())completed, v, "pause", (char *)0);
 }
@@ -132,10 +156,30 @@ int disorder_eclient_playlist_get_share(disorder_eclient *c, disorder_eclient_st
   return simple(c, string_response_opcallback, (void (*)())completed, v, "playlist-get-share", playlist, (char *)0);
 }
 
+int disorder_eclient_playlist_insert(disorder_eclient *c, disorder_eclient_no_response *completed, const char *playlist, long position, char **tracks, int ntracks, void *v) {
+  return simple(c, no_response_opcallback, (void (*)())completed, v, "playlist-insert", playlist, disorder__integer, position, disorder__body, tracks, ntracks, (char *)0);
+}
+
 int disorder_eclient_playlist_lock(disorder_eclient *c, disorder_eclient_no_response *completed, const char *playlist, void *v) {
   return simple(c, no_response_opcallback, (void (*)())completed, v, "playlist-lock", playlist, (char *)0);
 }
 
+int disorder_eclient_playlist_move(disorder_eclient *c, disorder_eclient_no_response *completed, const char *playlist, long position, long count, long to, void *v) {
+  return simple(c, no_response_opcallback, (void (*)())completed, v, "playlist-move", playlist, disorder__integer, position, disorder__integer, count, disorder__integer, to, (char *)0);
+}
+
+int disorder_eclient_playlist_play(disorder_eclient *c, disorder_eclient_string_response *completed, const char *playlist, const char *order, void *v) {
+  return simple(c, string_response_opcallback, (void (*)())completed, v, "playlist-play", playlist, order, (char *)0);
+}
+
+int disorder_eclient_playlist_play_after(disorder_eclient *c, disorder_eclient_string_response *completed, const char *playlist, const char *order, const char *target, void *v) {
+  return simple(c, string_response_opcallback, (void (*)())completed, v, "playlist-play", playlist, order, target, (char *)0);
+}
+
+int disorder_eclient_playlist_remove(disorder_eclient *c, disorder_eclient_no_response *completed, const char *playlist, long position, long count, void *v) {
+  return simple(c, no_response_opcallback, (void (*)())completed, v, "playlist-remove", playlist, disorder__integer, position, disorder__integer, count, (char *)0);
+}
+
 int disorder_eclient_playlist_set(disorder_eclient *c, disorder_eclient_no_response *completed, const char *playlist, char **tracks, int ntracks, void *v) {
   return simple(c, no_response_opcallback, (void (*)())completed, v, "playlist-set", playlist, disorder__body, tracks, ntracks, (char *)0);
 }
@@ -152,10 +196,22 @@ int disorder_eclient_playlists(disorder_eclient *c, disorder_eclient_list_respon
   return simple(c, list_response_opcallback, (void (*)())completed, v, "playlists", (char *)0);
 }
 
+int disorder_eclient_prefs_multi(disorder_eclient *c, disorder_eclient_list_response *completed, char **tracks, int ntracks, void *v) {
+  return simple(c, list_response_opcallback, (void (*)())completed, v, "prefs-multi", disorder__list, tracks, ntracks, (char *)0);
+}
+
 int disorder_eclient_queue(disorder_eclient *c, disorder_eclient_queue_response *completed, void *v) {
   return simple(c, queue_response_opcallback, (void (*)())completed, v, "queue", (char *)0);
 }
 
+int disorder_eclient_queue_changes(disorder_eclient *c, disorder_eclient_list_response *completed, const char *generation, void *v) {
+  return simple(c, list_response_opcallback, (void (*)())completed, v, "queue-changes", generation, (char *)0);
+}
+
+int disorder_eclient_queue_generation(disorder_eclient *c, disorder_eclient_string_response *completed, void *v) {
+  return simple(c, string_response_opcallback, (void (*)())completed, v, "queue-generation", (char *)0);
+}
+
 int disorder_eclient_random_disable(disorder_eclient *c, disorder_eclient_no_response *completed, void *v) {
   return simple(c, no_response_opcallback, (void (*)())completed, v, "random-disable", (char *)0);
 }
@@ -208,10 +264,22 @@ int disorder_eclient_rtp_cancel(disorder_eclient *c, disorder_eclient_no_respons
   return simple(c, no_response_opcallback, (void (*)())completed, v, "rtp-cancel", (char *)0);
 }
 
+int disorder_eclient_rtp_report(disorder_eclient *c, disorder_eclient_no_response *completed, long expected, long lost, long jitter, void *v) {
+  return simple(c, no_response_opcallback, (void (*)())completed, v, "rtp-report", disorder__integer, expected, disorder__integer, lost, disorder__integer, jitter, (char *)0);
+}
+
 int disorder_eclient_rtp_request(disorder_eclient *c, disorder_eclient_no_response *completed, const char *address, const char *port, void *v) {
   return simple(c, no_response_opcallback, (void (*)())completed, v, "rtp-request", address, port, (char *)0);
 }
 
+int disorder_eclient_rtp_request_codec(disorder_eclient *c, disorder_eclient_no_response *completed, const char *address, const char *port, const char *codec, void *v) {
+  return simple(c, no_response_opcallback, (void (*)())completed, v, "rtp-request", address, port, codec, (char *)0);
+}
+
+int disorder_eclient_rtp_stats(disorder_eclient *c, disorder_eclient_list_response *completed, void *v) {
+  return simple(c, list_response_opcallback, (void (*)())completed, v, "rtp-stats", (char *)0);
+}
+
 int disorder_eclient_scratch(disorder_eclient *c, disorder_eclient_no_response *completed, const char *id, void *v) {
   return simple(c, no_response_opcallback, (void (*)())completed, v, "scratch", id, (char *)0);
 }
@@ -240,6 +308,18 @@ int disorder_eclient_search(disorder_eclient *c, disorder_eclient_list_response
   return simple(c, list_response_opcallback, (void (*)())completed, v, "search", terms, (char *)0);
 }
 
+int disorder_eclient_search_page(disorder_eclient *c, disorder_eclient_list_response *completed, const char *terms, long offset, long limit, void *v) {
+  return simple(c, list_response_opcallback, (void (*)())completed, v, "search", terms, disorder__integer, offset, disorder__integer, limit, (char *)0);
+}
+
+int disorder_eclient_search_fuzzy(disorder_eclient *c, disorder_eclient_list_response *completed, const char *terms, long max, void *v) {
+  return simple(c, list_response_opcallback, (void (*)())completed, v, "search-fuzzy", terms, disorder__integer, max, (char *)0);
+}
+
+int disorder_eclient_search_prefix(disorder_eclient *c, disorder_eclient_list_response *completed, const char *terms, long max, void *v) {
+  return simple(c, list_response_opcallback, (void (*)())completed, v, "search-prefix", terms, disorder__integer, max, (char *)0);
+}
+
 int disorder_eclient_set(disorder_eclient *c, disorder_eclient_no_response *completed, const char *track, const char *pref, const char *value, void *v) {
   return simple(c, no_response_opcallback, (void (*)())completed, v, "set", track, pref, value, (char *)0);
 }
@@ -252,6 +332,10 @@ int disorder_eclient_shutdown(disorder_eclient *c, disorder_eclient_no_response
   return simple(c, no_response_opcallback, (void (*)())completed, v, "shutdown", (char *)0);
 }
 
+int disorder_eclient_state_generation(disorder_eclient *c, disorder_eclient_string_response *completed, void *v) {
+  return simple(c, string_response_opcallback, (void (*)())completed, v, "state-generation", (char *)0);
+}
+
 int disorder_eclient_stats(disorder_eclient *c, disorder_eclient_list_response *completed, void *v) {
   return simple(c, list_response_opcallback, (void (*)())completed, v, "stats", (char *)0);
 }
@@ -260,6 +344,10 @@ int disorder_eclient_tags(disorder_eclient *c, disorder_eclient_list_response *c
   return simple(c, list_response_opcallback, (void (*)())completed, v, "tags", (char *)0);
 }
 
+int disorder_eclient_track_generation(disorder_eclient *c, disorder_eclient_string_response *completed, void *v) {
+  return simple(c, string_response_opcallback, (void (*)())completed, v, "track-generation", (char *)0);
+}
+
 int disorder_eclient_unset(disorder_eclient *c, disorder_eclient_no_response *completed, const char *track, const char *pref, void *v) {
   return simple(c, no_response_opcallback, (void (*)())completed, v, "unset", track, pref, (char *)0);
 }
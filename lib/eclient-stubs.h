@@ -67,6 +67,17 @@ int disorder_eclient_adduser(disorder_eclient *c, disorder_eclient_no_response *
  */
 int disorder_eclient_allfiles(disorder_eclient *c, disorder_eclient_list_response *completed, const char *dir, const char *re, void *v);
 
+/** @brief Get database cache and lock statistics
+ *
+ * Requires the 'admin' right.
+ *
+ * @param c Client
+ * @param completed Called upon completion
+ * @param v Passed to @p completed
+ * @return 0 if the command was queued successfuly, non-0 on error
+ */
+int disorder_eclient_db_stats(disorder_eclient *c, disorder_eclient_list_response *completed, void *v);
+
 /** @brief Delete user
  *
  * Requires the 'admin' right.
@@ -79,6 +90,19 @@ int disorder_eclient_allfiles(disorder_eclient *c, disorder_eclient_list_respons
  */
 int disorder_eclient_deluser(disorder_eclient *c, disorder_eclient_no_response *completed, const char *user, void *v);
 
+/** @brief Summarize many directories
+ *
+ * Each line of the response is the quoted directory name followed by alternating quoted field names and values: 'tracks', 'length' and 'unknown' give the number of tracks below the directory, their total length in seconds and how many of their lengths are not known, and 'first' the first track below it, whose name parts follow as 'artist', 'album', 'sort-artist' and 'sort-album'.  Directories with no tracks have no fields.  The summaries are kept up to date as tracks are added and removed, so no track need be visited.
+ *
+ * @param c Client
+ * @param completed Called upon completion
+ * @param dirs Directory names
+ * @param ndirs Length of dirs
+ * @param v Passed to @p completed
+ * @return 0 if the command was queued successfuly, non-0 on error
+ */
+int disorder_eclient_dir_summaries(disorder_eclient *c, disorder_eclient_list_response *completed, char **dirs, int ndirs, void *v);
+
 /** @brief List directories in a directory
  *
  * 
@@ -139,6 +163,17 @@ int disorder_eclient_enable(disorder_eclient *c, disorder_eclient_no_response *c
  */
 int disorder_eclient_enabled(disorder_eclient *c, disorder_eclient_integer_response *completed, void *v);
 
+/** @brief Get event loop callback timings
+ *
+ * Requires the 'admin' right.  Timings are only collected if slow_callback_ms is set.  Each line is a list of the callback description, number of calls, total and maximum time in microseconds, and counts of calls taking under 10us, 100us, 1ms, 10ms, 100ms, 1s and longer.
+ *
+ * @param c Client
+ * @param completed Called upon completion
+ * @param v Passed to @p completed
+ * @return 0 if the command was queued successfuly, non-0 on error
+ */
+int disorder_eclient_event_stats(disorder_eclient *c, disorder_eclient_list_response *completed, void *v);
+
 /** @brief Test whether a track exists
  *
  * 
@@ -201,6 +236,19 @@ int disorder_eclient_get_global(disorder_eclient *c, disorder_eclient_string_res
  */
 int disorder_eclient_length(disorder_eclient *c, disorder_eclient_integer_response *completed, const char *track, void *v);
 
+/** @brief Get the lengths of many tracks
+ *
+ * Each line of the response is the quoted track name followed by its length in seconds, or by nothing if the track does not exist or its length is not known.  The tracks are all looked up in a single database transaction.
+ *
+ * @param c Client
+ * @param completed Called upon completion
+ * @param tracks Track names
+ * @param ntracks Length of tracks
+ * @param v Passed to @p completed
+ * @return 0 if the command was queued successfuly, non-0 on error
+ */
+int disorder_eclient_lengths_multi(disorder_eclient *c, disorder_eclient_list_response *completed, char **tracks, int ntracks, void *v);
+
 /** @brief Create a login cookie for this user
  *
  * The cookie may be redeemed via the 'cookie' command
@@ -212,6 +260,17 @@ int disorder_eclient_length(disorder_eclient *c, disorder_eclient_integer_respon
  */
 int disorder_eclient_make_cookie(disorder_eclient *c, disorder_eclient_string_response *completed, void *v);
 
+/** @brief Get per-command statistics
+ *
+ * Requires the 'admin' right.  The body is in Prometheus text format and covers the number of times each command has been used, how many got an error response, a histogram of response latency and the time spent in the database.
+ *
+ * @param c Client
+ * @param completed Called upon completion
+ * @param v Passed to @p completed
+ * @return 0 if the command was queued successfuly, non-0 on error
+ */
+int disorder_eclient_metrics(disorder_eclient *c, disorder_eclient_list_response *completed, void *v);
+
 /** @brief Move a track
  *
  * Requires one of the 'move mine', 'move random' or 'move any' rights depending on how the track came to be added to the queue.
@@ -276,6 +335,21 @@ int disorder_eclient_nop(disorder_eclient *c, disorder_eclient_no_response *comp
  */
 int disorder_eclient_part(disorder_eclient *c, disorder_eclient_string_response *completed, const char *track, const char *context, const char *part, void *v);
 
+/** @brief Get a name part for many tracks
+ *
+ * Each line of the response is the quoted track name followed by the quoted name part, or by nothing if the track does not exist.  The tracks are all looked up in a single database transaction.
+ *
+ * @param c Client
+ * @param completed Called upon completion
+ * @param context Context ("sort" or "display")
+ * @param part Name part ("artist", "album" or "title")
+ * @param tracks Track names
+ * @param ntracks Length of tracks
+ * @param v Passed to @p completed
+ * @return 0 if the command was queued successfuly, non-0 on error
+ */
+int disorder_eclient_parts_multi(disorder_eclient *c, disorder_eclient_list_response *completed, const char *context, const char *part, char **tracks, int ntracks, void *v);
+
 /** @brief Pause the currently playing track
  *
  * Requires the 'pause' right.
@@ -360,6 +434,21 @@ int disorder_eclient_playlist_get(disorder_eclient *c, disorder_eclient_list_res
  */
 int disorder_eclient_playlist_get_share(disorder_eclient *c, disorder_eclient_string_response *completed, const char *playlist, void *v);
 
+/** @brief Insert tracks into a playlist
+ *
+ * Requires the 'play' right and permission to modify the playlist, which must be locked.
+ *
+ * @param c Client
+ * @param completed Called upon completion
+ * @param playlist Playlist to modify
+ * @param position Index to insert before, or the playlist length to append
+ * @param tracks Tracks to insert
+ * @param ntracks Length of tracks
+ * @param v Passed to @p completed
+ * @return 0 if the command was queued successfuly, non-0 on error
+ */
+int disorder_eclient_playlist_insert(disorder_eclient *c, disorder_eclient_no_response *completed, const char *playlist, long position, char **tracks, int ntracks, void *v);
+
 /** @brief Lock a playlist
  *
  * Requires the 'play' right and permission to modify the playlist.  A given connection may lock at most one playlist.
@@ -372,6 +461,62 @@ int disorder_eclient_playlist_get_share(disorder_eclient *c, disorder_eclient_st
  */
 int disorder_eclient_playlist_lock(disorder_eclient *c, disorder_eclient_no_response *completed, const char *playlist, void *v);
 
+/** @brief Move tracks within a playlist
+ *
+ * Requires the 'play' right and permission to modify the playlist, which must be locked.
+ *
+ * @param c Client
+ * @param completed Called upon completion
+ * @param playlist Playlist to modify
+ * @param position Index of first track to move
+ * @param count Number of tracks to move
+ * @param to Index to move them to, counting without the moved tracks
+ * @param v Passed to @p completed
+ * @return 0 if the command was queued successfuly, non-0 on error
+ */
+int disorder_eclient_playlist_move(disorder_eclient *c, disorder_eclient_no_response *completed, const char *playlist, long position, long count, long to, void *v);
+
+/** @brief Add a playlist to the queue
+ *
+ * Requires the 'play' right and permission to read the playlist.  The order may be "in-order" or "shuffle".
+ *
+ * @param c Client
+ * @param completed Called upon completion
+ * @param playlist Playlist to play
+ * @param order Order to add the tracks in
+ * @param v Passed to @p completed
+ * @return 0 if the command was queued successfuly, non-0 on error
+ */
+int disorder_eclient_playlist_play(disorder_eclient *c, disorder_eclient_string_response *completed, const char *playlist, const char *order, void *v);
+
+/** @brief Add a playlist to a specific point in the queue
+ *
+ * Requires the 'play' right and permission to read the playlist.  The order may be "in-order" or "shuffle".
+ *
+ * @param c Client
+ * @param completed Called upon completion
+ * @param playlist Playlist to play
+ * @param order Order to add the tracks in
+ * @param target Insert into queue after this track, or at head if ""
+ * @param v Passed to @p completed
+ * @return 0 if the command was queued successfuly, non-0 on error
+ */
+int disorder_eclient_playlist_play_after(disorder_eclient *c, disorder_eclient_string_response *completed, const char *playlist, const char *order, const char *target, void *v);
+
+/** @brief Remove tracks from a playlist
+ *
+ * Requires the 'play' right and permission to modify the playlist, which must be locked.
+ *
+ * @param c Client
+ * @param completed Called upon completion
+ * @param playlist Playlist to modify
+ * @param position Index of first track to remove
+ * @param count Number of tracks to remove
+ * @param v Passed to @p completed
+ * @return 0 if the command was queued successfuly, non-0 on error
+ */
+int disorder_eclient_playlist_remove(disorder_eclient *c, disorder_eclient_no_response *completed, const char *playlist, long position, long count, void *v);
+
 /** @brief Set the contents of a playlist
  *
  * Requires the 'play' right and permission to modify the playlist, which must be locked.
@@ -421,6 +566,19 @@ int disorder_eclient_playlist_unlock(disorder_eclient *c, disorder_eclient_no_re
  */
 int disorder_eclient_playlists(disorder_eclient *c, disorder_eclient_list_response *completed, void *v);
 
+/** @brief Get all the preferences for many tracks
+ *
+ * Each line of the response is the quoted track name followed by the names and values of its preferences, alternately, each quoted.  The tracks are all looked up in a single database transaction.
+ *
+ * @param c Client
+ * @param completed Called upon completion
+ * @param tracks Track names
+ * @param ntracks Length of tracks
+ * @param v Passed to @p completed
+ * @return 0 if the command was queued successfuly, non-0 on error
+ */
+int disorder_eclient_prefs_multi(disorder_eclient *c, disorder_eclient_list_response *completed, char **tracks, int ntracks, void *v);
+
 /** @brief List the queue
  *
  * 
@@ -432,6 +590,29 @@ int disorder_eclient_playlists(disorder_eclient *c, disorder_eclient_list_respon
  */
 int disorder_eclient_queue(disorder_eclient *c, disorder_eclient_queue_response *completed, void *v);
 
+/** @brief List changes to the queue
+ *
+ * Each line of the response is a change to the queue since @p generation, oldest first, as described in disorder_protocol(5).  If the changes since @p generation are no longer known then the response code is 555 and the whole queue must be fetched again.
+ *
+ * @param c Client
+ * @param completed Called upon completion
+ * @param generation Last generation the caller knows about
+ * @param v Passed to @p completed
+ * @return 0 if the command was queued successfuly, non-0 on error
+ */
+int disorder_eclient_queue_changes(disorder_eclient *c, disorder_eclient_list_response *completed, const char *generation, void *v);
+
+/** @brief Get the queue generation
+ *
+ * The generation changes whenever the queue does.  Pass it to queue-changes to find out what changed.
+ *
+ * @param c Client
+ * @param completed Called upon completion
+ * @param v Passed to @p completed
+ * @return 0 if the command was queued successfuly, non-0 on error
+ */
+int disorder_eclient_queue_generation(disorder_eclient *c, disorder_eclient_string_response *completed, void *v);
+
 /** @brief Disable random play
  *
  * Requires the 'global prefs' right.
@@ -581,6 +762,20 @@ int disorder_eclient_revoke(disorder_eclient *c, disorder_eclient_no_response *c
  */
 int disorder_eclient_rtp_cancel(disorder_eclient *c, disorder_eclient_no_response *completed, void *v);
 
+/** @brief Report RTP reception statistics
+ *
+ * Sent periodically by disorder-playrtp.  All values cover the whole stream so far.
+ *
+ * @param c Client
+ * @param completed Called upon completion
+ * @param expected Number of packets expected
+ * @param lost Number of packets lost
+ * @param jitter Interarrival jitter in microseconds
+ * @param v Passed to @p completed
+ * @return 0 if the command was queued successfuly, non-0 on error
+ */
+int disorder_eclient_rtp_report(disorder_eclient *c, disorder_eclient_no_response *completed, long expected, long lost, long jitter, void *v);
+
 /** @brief Request a unicast RTP stream
  *
  * 
@@ -594,6 +789,31 @@ int disorder_eclient_rtp_cancel(disorder_eclient *c, disorder_eclient_no_respons
  */
 int disorder_eclient_rtp_request(disorder_eclient *c, disorder_eclient_no_response *completed, const char *address, const char *port, void *v);
 
+/** @brief Request a unicast RTP stream with a particular payload encoding
+ *
+ * The encoding may be "l16" (uncompressed, the default) or "opus".
+ *
+ * @param c Client
+ * @param completed Called upon completion
+ * @param address Destination address
+ * @param port Destination port number
+ * @param codec Payload encoding
+ * @param v Passed to @p completed
+ * @return 0 if the command was queued successfuly, non-0 on error
+ */
+int disorder_eclient_rtp_request_codec(disorder_eclient *c, disorder_eclient_no_response *completed, const char *address, const char *port, const char *codec, void *v);
+
+/** @brief Get RTP reception statistics
+ *
+ * Requires the 'admin' right.  Each line describes one listener and is a list of the user name, the requested destination address (or "-"), packets expected, packets lost, jitter in microseconds and age of the report in seconds.
+ *
+ * @param c Client
+ * @param completed Called upon completion
+ * @param v Passed to @p completed
+ * @return 0 if the command was queued successfuly, non-0 on error
+ */
+int disorder_eclient_rtp_stats(disorder_eclient *c, disorder_eclient_list_response *completed, void *v);
+
 /** @brief Terminate the playing track.
  *
  * Requires one of the 'scratch mine', 'scratch random' or 'scratch any' rights depending on how the track came to be added to the queue.
@@ -684,6 +904,46 @@ int disorder_eclient_schedule_list(disorder_eclient *c, disorder_eclient_list_re
  */
 int disorder_eclient_search(disorder_eclient *c, disorder_eclient_list_response *completed, const char *terms, void *v);
 
+/** @brief Search for tracks, ranking the results
+ *
+ * Terms are as for 'search'.  Tracks are ranked by how often and where the terms appear in their names, then by how often they have been played or requested.  Only the tracks from position OFFSET onwards are sent, and at most LIMIT of them.
+ *
+ * @param c Client
+ * @param completed Called upon completion
+ * @param terms List of search terms
+ * @param offset Number of top-ranked tracks to skip
+ * @param limit Maximum tracks to fetch, or 0 for all available
+ * @param v Passed to @p completed
+ * @return 0 if the command was queued successfuly, non-0 on error
+ */
+int disorder_eclient_search_page(disorder_eclient *c, disorder_eclient_list_response *completed, const char *terms, long offset, long limit, void *v);
+
+/** @brief Search for tracks, allowing for misspelt terms
+ *
+ * Like 'search', except that a term that no track contains is replaced by the closest word that one does.  Tags must still match exactly.
+ *
+ * @param c Client
+ * @param completed Called upon completion
+ * @param terms List of search terms
+ * @param max Maximum tracks to fetch, or 0 for all available
+ * @param v Passed to @p completed
+ * @return 0 if the command was queued successfuly, non-0 on error
+ */
+int disorder_eclient_search_fuzzy(disorder_eclient *c, disorder_eclient_list_response *completed, const char *terms, long max, void *v);
+
+/** @brief Search for tracks as the search terms are typed
+ *
+ * Like 'search', except that the last term matches any word that starts with it.  Tracks with the last term as a whole word come first.
+ *
+ * @param c Client
+ * @param completed Called upon completion
+ * @param terms List of search terms
+ * @param max Maximum tracks to fetch, or 0 for all available
+ * @param v Passed to @p completed
+ * @return 0 if the command was queued successfuly, non-0 on error
+ */
+int disorder_eclient_search_prefix(disorder_eclient *c, disorder_eclient_list_response *completed, const char *terms, long max, void *v);
+
 /** @brief Set a track preference
  *
  * Requires the 'prefs' right.
@@ -722,6 +982,17 @@ int disorder_eclient_set_global(disorder_eclient *c, disorder_eclient_no_respons
  */
 int disorder_eclient_shutdown(disorder_eclient *c, disorder_eclient_no_response *completed, void *v);
 
+/** @brief Get the server state generation
+ *
+ * The generation changes whenever anything is logged to the event log, i.e. whenever the queue, playing track, volume, settings etc. change.  It does not change as the playing track progresses.  Clients can compare it with a previous value to find out cheaply whether anything has changed.
+ *
+ * @param c Client
+ * @param completed Called upon completion
+ * @param v Passed to @p completed
+ * @return 0 if the command was queued successfuly, non-0 on error
+ */
+int disorder_eclient_state_generation(disorder_eclient *c, disorder_eclient_string_response *completed, void *v);
+
 /** @brief Get server statistics
  *
  * The details of what the server reports are not really defined.  The returned strings are intended to be printed out one to a line.
@@ -744,6 +1015,17 @@ int disorder_eclient_stats(disorder_eclient *c, disorder_eclient_list_response *
  */
 int disorder_eclient_tags(disorder_eclient *c, disorder_eclient_list_response *completed, void *v);
 
+/** @brief Get the track database generation
+ *
+ * The generation changes whenever track names, name parts or lengths might have changed, and when the server restarts.  Clients that keep such details can compare it with the value when they were fetched.
+ *
+ * @param c Client
+ * @param completed Called upon completion
+ * @param v Passed to @p completed
+ * @return 0 if the command was queued successfuly, non-0 on error
+ */
+int disorder_eclient_track_generation(disorder_eclient *c, disorder_eclient_string_response *completed, void *v);
+
 /** @brief Unset a track preference
  *
  * Requires the 'prefs' right.
@@ -133,6 +133,15 @@ struct disorder_eclient {
   void *log_v;                          /**< @brief user data */
   unsigned long statebits;              /**< @brief latest state */
 
+  unsigned long log_seq;
+  /**< @brief sequence number of the last log line or 0
+   *
+   * Sent with @b log-resume on reconnection so that the server can fill in
+   * just what we missed.
+   */
+  unsigned long log_statebits;          /**< @brief state when disconnected */
+  int log_plain;                        /**< @brief no @b log-resume */
+
   time_t last_prod;
   /**< @brief last time we sent a prod
    *
@@ -171,12 +180,14 @@ static void stash_command(disorder_eclient *c,
                           const char *cmd,
                           ...);
 static void log_opcallback(disorder_eclient *c, struct operation *op);
+static void log_command(disorder_eclient *c);
 static void logline(disorder_eclient *c, const char *line);
 static void logentry_completed(disorder_eclient *c, int nvec, char **vec);
 static void logentry_failed(disorder_eclient *c, int nvec, char **vec);
 static void logentry_moved(disorder_eclient *c, int nvec, char **vec);
 static void logentry_playing(disorder_eclient *c, int nvec, char **vec);
 static void logentry_queue(disorder_eclient *c, int nvec, char **vec);
+static void logentry_queue_change(disorder_eclient *c, int nvec, char **vec);
 static void logentry_recent_added(disorder_eclient *c, int nvec, char **vec);
 static void logentry_recent_removed(disorder_eclient *c, int nvec, char **vec);
 static void logentry_removed(disorder_eclient *c, int nvec, char **vec);
@@ -220,6 +231,7 @@ static const struct logentry_handler logentry_handlers[] = {
   LE(playlist_deleted, 1, 1),
   LE(playlist_modified, 2, 2),
   LE(queue, 2, INT_MAX),
+  LE(queue_change, 3, INT_MAX),
   LE(recent_added, 2, INT_MAX),
   LE(recent_removed, 1, 1),
   LE(removed, 1, 2),
@@ -272,6 +284,8 @@ void disorder_eclient_close(disorder_eclient *c) {
     xclose(c->fd);
     c->fd = -1;
     c->state = state_disconnected;
+    /* Kept in case the log can be resumed */
+    c->log_statebits = c->statebits;
     c->statebits = 0;
   }
   c->output.nvec = 0;
@@ -451,6 +465,12 @@ void disorder_eclient_polled(disorder_eclient *c, unsigned mode) {
      || c->state == state_body
      || c->state == state_log) {
     D(("state_%s", states[c->state]));
+    /* Commands issued while we await a response can go out behind it
+     * straight away, rather than waiting for it to complete */
+    if(c->authenticated && c->state != state_log)
+      for(op = c->ops; op; op = op->next)
+        if(!op->sent)
+          op_send(op);
     /* We are awaiting a response */
     if(mode & DISORDER_POLL_WRITE) send_output(c);
     if(mode & DISORDER_POLL_READ) read_input(c);
@@ -538,8 +558,10 @@ static int start_connect(disorder_eclient *c) {
       /* Signal the error to the caller. */
       return comms_error(c, "connecting to %s: %s", c->ident, strerror(errno));
     }
-  } else
+  } else {
+    nodelay(c->fd);
     c->state = state_connected;
+  }
   return 0;
 }
 
@@ -561,6 +583,7 @@ static void maybe_connected(disorder_eclient *c) {
     char *r;
     
     /* The connection succeeded */
+    nodelay(c->fd);
     c->state = state_connected;
     byte_xasprintf(&r, "connected to %s", c->ident);
     c->callbacks->report(c->u, r);
@@ -650,9 +673,7 @@ static void authuser_opcallback(disorder_eclient *c,
   c->callbacks->report(c->u, r);
   if(c->log_callbacks && !(c->ops && c->ops->opcallback == log_opcallback))
     /* We are a log client, switch to logging mode */
-    stash_command(c, 0/*queuejump*/, log_opcallback, 0/*completed*/, c->log_v,
-                  -1/*nbody*/, 0/*body*/,
-                  "log", (char *)0);
+    log_command(c);
 }
 
 /* Output ********************************************************************/
@@ -754,7 +775,17 @@ static void process_line(disorder_eclient *c, char *line) {
       break;
     case 4:
       assert(c->log_callbacks != 0);
-      if(c->log_callbacks->connected)
+      if(!c->log_plain && !strcmp(line + 4, "resumed")) {
+        /* We will be sent what we missed rather than the current state */
+        c->statebits = c->log_statebits;
+        if(c->log_callbacks->state)
+          c->log_callbacks->state(c->log_v,
+                                  c->statebits | DISORDER_CONNECTED);
+        if(c->log_callbacks->resumed)
+          c->log_callbacks->resumed(c->log_v);
+        else if(c->log_callbacks->connected)
+          c->log_callbacks->connected(c->log_v);
+      } else if(c->log_callbacks->connected)
         c->log_callbacks->connected(c->log_v);
       c->state = state_log;
       break;
@@ -1178,16 +1209,37 @@ int disorder_eclient_log(disorder_eclient *c,
   /* Repoort initial state */
   if(c->log_callbacks->state)
     c->log_callbacks->state(c->log_v, c->statebits);
-  stash_command(c, 0/*queuejump*/, log_opcallback, 0/*completed*/, v,
-                -1, 0, "log", (char *)0);
+  log_command(c);
   disorder_eclient_polled(c, 0);
   return 0;
 }
 
+/* Issue the log command, picking up where we left off if we can */
+static void log_command(disorder_eclient *c) {
+  char seq[32];
+
+  if(c->log_plain) {
+    stash_command(c, 0/*queuejump*/, log_opcallback, 0/*completed*/, c->log_v,
+                  -1/*nbody*/, 0/*body*/,
+                  "log", (char *)0);
+    return;
+  }
+  snprintf(seq, sizeof seq, "%lx", c->log_seq);
+  stash_command(c, 0/*queuejump*/, log_opcallback, 0/*completed*/, c->log_v,
+                -1/*nbody*/, 0/*body*/,
+                "log-resume", seq, (char *)0);
+}
+
 /* If we get here we've stopped being a log client */
 static void log_opcallback(disorder_eclient *c,
                            struct operation attribute((unused)) *op) {
   D(("log_opcallback"));
+  if(!c->log_plain && c->rc / 100 == 5) {
+    /* Probably an older server without log-resume */
+    c->log_plain = 1;
+    log_command(c);
+    return;
+  }
   c->log_callbacks = 0;
   c->log_v = 0;
 }
@@ -1207,6 +1259,17 @@ static void logline(disorder_eclient *c, const char *line) {
 
   D(("logline [%s]", line));
   vec = split(line, &nvec, SPLIT_QUOTES, logline_error, c);
+  if(!c->log_plain && nvec > 0) {
+    /* log-resume puts a sequence number first */
+    if(sscanf(vec[0], "%lx", &c->log_seq) != 1) {
+      /* TODO don't use protocol_error here */
+      protocol_error(c, c->ops, -1, "invalid log sequence number '%s'",
+                     vec[0]);
+      return;
+    }
+    ++vec;
+    --nvec;
+  }
   if(nvec < 2) return;                  /* probably an error, already
                                          * reported */
   if(sscanf(vec[0], "%"SCNxMAX, &when) != 1) {
@@ -1275,6 +1338,12 @@ static void logentry_queue(disorder_eclient *c,
   c->log_callbacks->queue(c->log_v, q);
 }
 
+static void logentry_queue_change(disorder_eclient *c,
+                                  int nvec, char **vec) {
+  if(c->log_callbacks->queue_change)
+    c->log_callbacks->queue_change(c->log_v, nvec, vec);
+}
+
 static void logentry_recent_added(disorder_eclient *c,
                                   int attribute((unused)) nvec, char **vec) {
   struct queue_entry *q;
@@ -121,6 +121,14 @@ typedef struct disorder_eclient_log_callbacks {
    */   
   void (*queue)(void *v, struct queue_entry *q);
 
+  /** @brief Called when the queue changes
+   *
+   * @p vec is a change as returned by disorder_eclient_queue_changes(),
+   * split into fields: the generation, a keyword and its arguments.  Older
+   * servers don't send this.
+   */
+  void (*queue_change)(void *v, int nvec, char **vec);
+
   /** @brief Called when @p q is added to the recent list */
   void (*recent_added)(void *v, struct queue_entry *q);
 
@@ -182,6 +190,14 @@ typedef struct disorder_eclient_log_callbacks {
 
   /** @brief Called when a global pref is changed or delete */
   void (*global_pref)(void *v, const char *pref, const char *value/*or NULL*/);
+
+  /** @brief Called on reconnection if the log was resumed
+   *
+   * The events missed while disconnected will follow, so there is no need to
+   * fetch everything again.  If this is a null pointer then @c connected is
+   * called instead.
+   */
+  void (*resumed)(void *v);
 } disorder_eclient_log_callbacks;
 
 /* State bits */
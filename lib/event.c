@@ -34,6 +34,10 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <sys/un.h>
+#include <sys/uio.h>
+#if HAVE_SYS_SENDFILE_H
+# include <sys/sendfile.h>
+#endif
 #include "event.h"
 #include "mem.h"
 #include "log.h"
@@ -43,13 +47,53 @@
 #include "vector.h"
 #include "timeval.h"
 #include "heap.h"
+#include "pollset.h"
+#include "hash.h"
+#include "split.h"
+
+/** @brief log2 of the number of slots in each level of the timer wheel */
+#define WHEEL_BITS 8
+
+/** @brief Number of slots in each level of the timer wheel */
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+
+/** @brief Mask for a slot number */
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+
+/** @brief Number of levels in the timer wheel
+ *
+ * With millisecond ticks, the wheel covers timeouts up to about 4.6 hours
+ * into the future.  Later ones go in the heap.
+ */
+#define WHEEL_LEVELS 3
 
 /** @brief A timeout */
 struct timeout {
+  /** @brief Next timeout in the same list */
   struct timeout *next;
+
+  /** @brief Pointer to this timeout in its list, or NULL if not in one
+   *
+   * Timeouts in the heap are not in a list.
+   */
+  struct timeout **prevp;
+
   struct timeval when;
+
+  /** @brief @ref when in milliseconds, rounded up */
+  uint64_t tick;
+
+  /** @brief Level of the wheel, or @ref WHEEL_LEVELS if not in the wheel */
+  int level;
+
   ev_timeout_callback *callback;
   void *u;
+
+  /** @brief Cleared when a timeout is cancelled
+   *
+   * Only timeouts in the heap need this; the others are just removed from
+   * their list.
+   */
   int active;
 };
 
@@ -64,7 +108,12 @@ HEAP_DEFINE(timeout_heap, struct timeout *, timeout_lt);
 
 /** @brief A file descriptor in one mode */
 struct fd {
+  /** @brief File descriptor, or -1 if this slot is not in use */
   int fd;
+
+  /** @brief Nonzero if callbacks are enabled */
+  int enabled;
+
   ev_fd_callback *callback;
   void *u;
   const char *what;
@@ -72,23 +121,37 @@ struct fd {
 
 /** @brief All the file descriptors in a given mode */
 struct fdmode {
-  /** @brief Mask of active file descriptors passed to @c select() */
-  fd_set enabled;
-
-  /** @brief File descriptor mask returned from @c select() */
-  fd_set tripped;
-
-  /** @brief Number of file descriptors in @p fds */
+  /** @brief Number of file descriptors registered */
   int nfds;
 
   /** @brief Number of slots in @p fds */
   int fdslots;
 
-  /** @brief Array of all active file descriptors */
+  /** @brief Registered file descriptors, indexed by file descriptor */
   struct fd *fds;
+};
 
-  /** @brief Highest-numbered file descriptor or 0 */
-  int maxfd;
+/** @brief Number of histogram buckets for callback timings
+ *
+ * Bucket 0 counts callbacks taking less than 10us, and each bucket after
+ * that is ten times wider than the last, so bucket 6 counts those taking a
+ * second or more.
+ */
+#define TIMING_BUCKETS 7
+
+/** @brief Timings for one kind of callback */
+struct timing {
+  /** @brief Number of calls */
+  unsigned long count;
+
+  /** @brief Total time spent, in seconds */
+  double total;
+
+  /** @brief Longest call, in seconds */
+  double max;
+
+  /** @brief Histogram of call durations */
+  unsigned long buckets[TIMING_BUCKETS];
 };
 
 /** @brief A signal handler */
@@ -111,16 +174,44 @@ struct ev_source {
   /** @brief File descriptors, per mode */
   struct fdmode mode[ev_nmodes];
 
-  /** @brief Heap of timeouts */
+  /** @brief Set of file descriptors to wait for */
+  struct pollset *pollset;
+
+  /** @brief Heap of timeouts that are too far in the future for the wheel */
   struct timeout_heap timeouts[1];
 
+  /** @brief Timer wheel
+   *
+   * A timeout due at tick @c T, placed when the wheel has reached tick @c C,
+   * goes in the lowest level @c L for which <code>T-C</code> is less than
+   * <code>2^(WHEEL_BITS*(L+1))</code>, in slot
+   * <code>(T >> (WHEEL_BITS*L)) & WHEEL_MASK</code>.  Slots in each level
+   * above 0 are moved down a level when the wheel reaches their start.
+   */
+  struct timeout *wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+
+  /** @brief Number of timeouts in each level of the wheel */
+  int wheel_count[WHEEL_LEVELS];
+
+  /** @brief Last tick the wheel has reached */
+  uint64_t wheel_now;
+
+  /** @brief Timeouts that are due, in the order they are to be run */
+  struct timeout *due;
+
+  /** @brief Where to add the next due timeout */
+  struct timeout **due_tail;
+
+  /** @brief Timeouts being run by ev_run() */
+  struct timeout *running;
+
   /** @brief Array of handled signals */
   struct signal signals[NSIG];
 
   /** @brief Mask of handled signals */
   sigset_t sigmask;
 
-  /** @brief Escape early from handling of @c select() results
+  /** @brief Escape early from handling of pollset_wait() results
    *
    * This is set if any of the file descriptor arrays are invalidated, since
    * it's then not safe for processing of them to continue.
@@ -141,31 +232,250 @@ struct ev_source {
 
   /** @brief Array of child processes */
   struct child *children;
+
+  /** @brief Nonzero if callbacks are being timed */
+  int instrumented;
+
+  /** @brief Threshold for logging slow callbacks, in seconds */
+  double slow;
+
+  /** @brief Callback timings, keyed by description, or NULL */
+  hash *timings;
 };
 
 /** @brief Names of file descriptor modes */
 static const char *modenames[] = { "read", "write", "except" };
 
+/** @brief Pollset events for each file descriptor mode
+ *
+ * Exceptional conditions are not supported.
+ */
+static const unsigned pollset_modes[] = { POLLSET_READ, POLLSET_WRITE, 0 };
+
 /* utilities ******************************************************************/
 
+/** @brief Note the start of a callback
+ * @param ev Event loop
+ * @return Start time, or 0 if not instrumented
+ */
+static double timing_start(const ev_source *ev) {
+  struct timespec ts;
+
+  if(!ev->instrumented)
+    return 0;
+  xgettime(CLOCK_MONOTONIC, &ts);
+  return ts_to_double(ts);
+}
+
+/** @brief Note the end of a callback
+ * @param ev Event loop
+ * @param kind Kind of callback, for logging
+ * @param what Description of callback
+ * @param started Value returned from timing_start()
+ */
+static void timing_stop(ev_source *ev, const char *kind, const char *what,
+			double started) {
+  struct timespec ts;
+  struct timing *t, zero;
+  double elapsed, limit;
+  int b;
+
+  if(!started || !ev->instrumented)
+    return;
+  xgettime(CLOCK_MONOTONIC, &ts);
+  elapsed = ts_to_double(ts) - started;
+  if(!what)
+    what = kind;
+  if(!(t = hash_find(ev->timings, what))) {
+    memset(&zero, 0, sizeof zero);
+    hash_add(ev->timings, what, &zero, HASH_INSERT);
+    t = hash_find(ev->timings, what);
+  }
+  ++t->count;
+  t->total += elapsed;
+  if(elapsed > t->max)
+    t->max = elapsed;
+  for(b = 0, limit = 0.00001; b < TIMING_BUCKETS - 1 && elapsed >= limit; ++b)
+    limit *= 10;
+  ++t->buckets[b];
+  if(elapsed >= ev->slow)
+    disorder_info("slow %s callback '%s' took %lums",
+		  kind, what, (unsigned long)(elapsed * 1000));
+}
+
 /* creation *******************************************************************/
 
 /** @brief Create a new event loop */
 ev_source *ev_new(void) {
   ev_source *ev = xmalloc(sizeof *ev);
-  int n;
+  struct timeval now;
 
   memset(ev, 0, sizeof *ev);
-  for(n = 0; n < ev_nmodes; ++n)
-    FD_ZERO(&ev->mode[n].enabled);
+  ev->pollset = pollset_new();
+  D(("using %s", pollset_backend()));
   ev->sigpipe[0] = ev->sigpipe[1] = -1;
   sigemptyset(&ev->sigmask);
   timeout_heap_init(ev->timeouts);
+  xgettimeofday(&now, 0);
+  ev->wheel_now = (uint64_t)now.tv_sec * 1000 + now.tv_usec / 1000;
+  ev->due_tail = &ev->due;
   return ev;
 }
 
+/* timer wheel ****************************************************************/
+
+/** @brief Add a timeout to the front of a list
+ * @param head List head
+ * @param t Timeout
+ */
+static void timeout_link(struct timeout **head, struct timeout *t) {
+  if((t->next = *head))
+    t->next->prevp = &t->next;
+  *head = t;
+  t->prevp = head;
+}
+
+/** @brief Add a timeout to the end of the due list
+ * @param ev Event loop
+ * @param t Timeout
+ */
+static void timeout_due(ev_source *ev, struct timeout *t) {
+  t->level = WHEEL_LEVELS;
+  t->next = 0;
+  t->prevp = ev->due_tail;
+  *ev->due_tail = t;
+  ev->due_tail = &t->next;
+}
+
+/** @brief Remove a timeout from whatever list it is in
+ * @param ev Event loop
+ * @param t Timeout
+ */
+static void timeout_unlink(ev_source *ev, struct timeout *t) {
+  if(ev->due_tail == &t->next)
+    ev->due_tail = t->prevp;
+  if((*t->prevp = t->next))
+    t->next->prevp = t->prevp;
+  t->prevp = 0;
+  if(t->level < WHEEL_LEVELS) {
+    --ev->wheel_count[t->level];
+    t->level = WHEEL_LEVELS;
+  }
+}
+
+/** @brief Put a timeout in the right place
+ * @param ev Event loop
+ * @param t Timeout
+ *
+ * Timeouts that are already due go straight on the due list; those too far
+ * in the future for the wheel go in the heap.
+ */
+static void timeout_place(ev_source *ev, struct timeout *t) {
+  uint64_t delta;
+  int level, shift;
+
+  if(t->tick <= ev->wheel_now) {
+    timeout_due(ev, t);
+    return;
+  }
+  delta = t->tick - ev->wheel_now;
+  for(level = 0; level < WHEEL_LEVELS; ++level) {
+    shift = WHEEL_BITS * level;
+    if(delta >> shift < WHEEL_SLOTS) {
+      t->level = level;
+      ++ev->wheel_count[level];
+      timeout_link(&ev->wheel[level][(t->tick >> shift) & WHEEL_MASK], t);
+      return;
+    }
+  }
+  t->level = WHEEL_LEVELS;
+  t->prevp = 0;
+  timeout_heap_insert(ev->timeouts, t);
+}
+
+/** @brief Advance the wheel
+ * @param ev Event loop
+ * @param now Current tick
+ *
+ * Timeouts due at or before @p now are added to the due list.
+ */
+static void wheel_advance(ev_source *ev, uint64_t now) {
+  struct timeout *t, **slot;
+  uint64_t tick, skip;
+  int level;
+
+  while(ev->wheel_now < now) {
+    if(!ev->wheel_count[0]) {
+      /* Nothing to do until the next slot in a higher level comes round */
+      for(level = 1; level < WHEEL_LEVELS && !ev->wheel_count[level]; ++level)
+        ;
+      if(level == WHEEL_LEVELS) {
+        ev->wheel_now = now;
+        break;
+      }
+      skip = ev->wheel_now | WHEEL_MASK;
+      if(skip > now)
+        skip = now;
+      if(skip > ev->wheel_now) {
+        ev->wheel_now = skip;
+        continue;
+      }
+    }
+    tick = ++ev->wheel_now;
+    /* Find the levels whose next slot starts at this tick... */
+    for(level = 1;
+        level < WHEEL_LEVELS
+          && !(tick & (((uint64_t)1 << (WHEEL_BITS * level)) - 1));
+        ++level)
+      ;
+    /* ...and move their contents down, highest first */
+    while(--level > 0) {
+      slot = &ev->wheel[level][(tick >> (WHEEL_BITS * level)) & WHEEL_MASK];
+      while((t = *slot)) {
+        timeout_unlink(ev, t);
+        timeout_place(ev, t);
+      }
+    }
+    slot = &ev->wheel[0][tick & WHEEL_MASK];
+    while((t = *slot)) {
+      timeout_unlink(ev, t);
+      timeout_due(ev, t);
+    }
+  }
+}
+
+/** @brief Find when the wheel next needs advancing
+ * @param ev Event loop
+ * @return Tick, or 0 if the wheel is empty
+ *
+ * For levels above 0 this is when the next occupied slot is moved down,
+ * rather than when the first timeout in it is due.
+ */
+static uint64_t wheel_next(const ev_source *ev) {
+  uint64_t base, tick, best = 0;
+  int level, shift, k;
+
+  for(level = 0; level < WHEEL_LEVELS; ++level) {
+    if(!ev->wheel_count[level])
+      continue;
+    shift = WHEEL_BITS * level;
+    base = ev->wheel_now >> shift;
+    for(k = 1; k <= WHEEL_SLOTS; ++k)
+      if(ev->wheel[level][(base + k) & WHEEL_MASK]) {
+        tick = (base + k) << shift;
+        if(!best || tick < best)
+          best = tick;
+        break;
+      }
+  }
+  return best;
+}
+
 /* event loop *****************************************************************/
 
+/** @brief Maximum number of file descriptor events handled per iteration */
+#define NEVENTS 64
+
 /** @brief Run the event loop
  * @return -1 on error, non-0 if any callback returned non-0
  */
@@ -173,115 +483,145 @@ int ev_run(ev_source *ev) {
   for(;;) {
     struct timeval now;
     struct timeval delta;
-    int n, mode;
+    int n, m, mode;
     int ret;
-    int maxfd;
-    struct timeout *timeouts, *t, **tt;
+    int timeout;
+    struct timeout *t;
+    struct timeval next;
+    uint64_t tick;
+    int have_next;
     struct stat sb;
+    struct pollset_event events[NEVENTS];
+    double started;
 
     xgettimeofday(&now, 0);
     /* Handle timeouts.  We don't want to handle any timeouts that are added
      * while we're handling them (otherwise we'd have to break out of infinite
      * loops, preferrably without starving better-behaved subsystems).  Hence
      * the slightly complicated two-phase approach here. */
-    /* First we read those timeouts that have triggered out of the heap.  We
-     * keep them in the same order they came out of the heap in. */
-    tt = &timeouts;
+    /* First we collect those timeouts that have triggered onto the due list,
+     * after any that were already due when they were set.  Those from the
+     * wheel come out in the order they are due. */
+    wheel_advance(ev, (uint64_t)now.tv_sec * 1000 + now.tv_usec / 1000);
     while(timeout_heap_count(ev->timeouts)
 	  && tvle(&timeout_heap_first(ev->timeouts)->when, &now)) {
       /* This timeout has reached its trigger time; provided it has not been
-       * cancelled we add it to the timeouts list. */
+       * cancelled we add it to the due list. */
       t = timeout_heap_remove(ev->timeouts);
-      if(t->active) {
-	*tt = t;
-	tt = &t->next;
-      }
+      if(t->active)
+	timeout_due(ev, t);
     }
-    *tt = 0;
     /* Now we can run the callbacks for those timeouts.  They might add further
-     * timeouts that are already in the past but they won't trigger until the
-     * next time round the event loop. */
-    for(t = timeouts; t; t = t->next) {
+     * timeouts that are already in the past but they go on a fresh due list
+     * and won't trigger until the next time round the event loop.  They might
+     * also cancel timeouts we haven't got to yet. */
+    if((ev->running = ev->due))
+      ev->running->prevp = &ev->running;
+    ev->due = 0;
+    ev->due_tail = &ev->due;
+    while((t = ev->running)) {
+      timeout_unlink(ev, t);
       D(("calling timeout for %ld.%ld callback %p %p",
 	 (long)t->when.tv_sec, (long)t->when.tv_usec,
 	 (void *)t->callback, t->u));
+      started = timing_start(ev);
       ret = t->callback(ev, &now, t->u);
-      if(ret)
+      timing_stop(ev, "timeout", NULL, started);
+      if(ret) {
+	/* Any we didn't get to go back on the front of the due list */
+	if(ev->running) {
+	  for(t = ev->running; t->next; t = t->next)
+	    ;
+	  if((t->next = ev->due))
+	    ev->due->prevp = &t->next;
+	  else
+	    ev->due_tail = &t->next;
+	  ev->due = ev->running;
+	  ev->due->prevp = &ev->due;
+	  ev->running = 0;
+	}
 	return ret;
-    }
-    maxfd = 0;
-    for(mode = 0; mode < ev_nmodes; ++mode) {
-      ev->mode[mode].tripped = ev->mode[mode].enabled;
-      if(ev->mode[mode].maxfd > maxfd)
-	maxfd = ev->mode[mode].maxfd;
+      }
     }
     xsigprocmask(SIG_UNBLOCK, &ev->sigmask, 0);
     do {
-      if(timeout_heap_count(ev->timeouts)) {
-	t = timeout_heap_first(ev->timeouts);
+      /* Find the earliest of the wheel and the heap */
+      have_next = 0;
+      if((tick = wheel_next(ev))) {
+	next.tv_sec = tick / 1000;
+	next.tv_usec = tick % 1000 * 1000;
+	have_next = 1;
+      }
+      if(timeout_heap_count(ev->timeouts)
+	 && (!have_next
+	     || tvlt(&timeout_heap_first(ev->timeouts)->when, &next))) {
+	next = timeout_heap_first(ev->timeouts)->when;
+	have_next = 1;
+      }
+      if(ev->due)
+	timeout = 0;
+      else if(have_next) {
 	xgettimeofday(&now, 0);
-	delta.tv_sec = t->when.tv_sec - now.tv_sec;
-	delta.tv_usec = t->when.tv_usec - now.tv_usec;
+	delta.tv_sec = next.tv_sec - now.tv_sec;
+	delta.tv_usec = next.tv_usec - now.tv_usec;
 	if(delta.tv_usec < 0) {
 	  delta.tv_usec += 1000000;
 	  --delta.tv_sec;
 	}
+	/* Round up, so we don't wake up just before the timeout is due */
 	if(delta.tv_sec < 0)
-	  delta.tv_sec = delta.tv_usec = 0;
-	n = select(maxfd + 1,
-		   &ev->mode[ev_read].tripped,
-		   &ev->mode[ev_write].tripped,
-		   &ev->mode[ev_except].tripped,
-		   &delta);
-      } else {
-	n = select(maxfd + 1,
-		   &ev->mode[ev_read].tripped,
-		   &ev->mode[ev_write].tripped,
-		   &ev->mode[ev_except].tripped,
-		   0);
-      }
+	  timeout = 0;
+	else if(delta.tv_sec >= INT_MAX / 1000 - 1)
+	  timeout = INT_MAX;
+	else
+	  timeout = delta.tv_sec * 1000 + (delta.tv_usec + 999) / 1000;
+      } else
+	timeout = -1;
+      n = pollset_wait(ev->pollset, events, NEVENTS, timeout);
     } while(n < 0 && errno == EINTR);
     xsigprocmask(SIG_BLOCK, &ev->sigmask, 0);
     if(n < 0) {
-      disorder_error(errno, "error calling select");
+      disorder_error(errno, "error calling pollset_wait");
       if(errno == EBADF) {
 	/* If there's a bad FD in the mix then check them all and log what we
 	 * find, to ease debugging */
-	for(mode = 0; mode < ev_nmodes; ++mode) {
-	  for(n = 0; n < ev->mode[mode].nfds; ++n) {
-	    const int fd = ev->mode[mode].fds[n].fd;
+	for(mode = 0; mode < ev_nmodes; ++mode)
+	  for(m = 0; m < ev->mode[mode].fdslots; ++m) {
+	    const struct fd *f = &ev->mode[mode].fds[m];
 
-	    if(FD_ISSET(fd, &ev->mode[mode].enabled)
-	       && fstat(fd, &sb) < 0)
+	    if(f->fd >= 0 && f->enabled && fstat(f->fd, &sb) < 0)
 	      disorder_error(errno, "mode %s fstat %d (%s)",
-			     modenames[mode], fd, ev->mode[mode].fds[n].what);
+			     modenames[mode], f->fd, f->what);
 	  }
-	  for(n = 0; n <= maxfd; ++n)
-	    if(FD_ISSET(n, &ev->mode[mode].enabled)
-	       && fstat(n, &sb) < 0)
-	      disorder_error(errno, "mode %s fstat %d", modenames[mode], n);
-	}
       }
       return -1;
     }
-    if(n > 0) {
-      /* if anything deranges the meaning of an fd, or re-orders the
-       * fds[] tables, we'd better give up; such operations will
-       * therefore set @escape@. */
-      ev->escape = 0;
-      for(mode = 0; mode < ev_nmodes && !ev->escape; ++mode)
-	for(n = 0; n < ev->mode[mode].nfds && !ev->escape; ++n) {
-	  int fd = ev->mode[mode].fds[n].fd;
-	  if(FD_ISSET(fd, &ev->mode[mode].tripped)) {
-	    D(("calling %s fd %d callback %p %p", modenames[mode], fd,
-	       (void *)ev->mode[mode].fds[n].callback,
-	       ev->mode[mode].fds[n].u));
-	    ret = ev->mode[mode].fds[n].callback(ev, fd,
-						 ev->mode[mode].fds[n].u);
-	    if(ret)
-	      return ret;
-	  }
-	}
+    /* if anything deranges the meaning of an fd we'd better give up; such
+     * operations will therefore set @escape@. */
+    ev->escape = 0;
+    for(m = 0; m < n && !ev->escape; ++m) {
+      const int fd = events[m].fd;
+
+      for(mode = 0; mode < ev_nmodes && !ev->escape; ++mode) {
+	const struct fd *f;
+	const char *what;
+
+	if(!(events[m].events & pollset_modes[mode])
+	   || fd >= ev->mode[mode].fdslots)
+	  continue;
+	f = &ev->mode[mode].fds[fd];
+	if(f->fd != fd || !f->enabled)
+	  continue;
+	D(("calling %s fd %d callback %p %p", modenames[mode], fd,
+	   (void *)f->callback, f->u));
+	/* f may not survive the callback */
+	what = f->what;
+	started = timing_start(ev);
+	ret = f->callback(ev, fd, f->u);
+	timing_stop(ev, modenames[mode], what, started);
+	if(ret)
+	  return ret;
+      }
     }
     /* we'll pick up timeouts back round the loop */
   }
@@ -289,6 +629,27 @@ int ev_run(ev_source *ev) {
 
 /* file descriptors ***********************************************************/
 
+/** @brief Tell the pollset what we want from a file descriptor
+ * @param ev Event loop
+ * @param fd File descriptor
+ * @return 0 on success, non-0 on error
+ */
+static int ev_fd_update(ev_source *ev, int fd) {
+  unsigned events = 0;
+  int mode;
+
+  for(mode = 0; mode < ev_nmodes; ++mode)
+    if(fd < ev->mode[mode].fdslots
+       && ev->mode[mode].fds[fd].fd == fd
+       && ev->mode[mode].fds[fd].enabled)
+      events |= pollset_modes[mode];
+  if(pollset_set(ev->pollset, fd, events, NULL) < 0) {
+    disorder_error(errno, "error updating pollset for fd %d", fd);
+    return -1;
+  }
+  return 0;
+}
+
 /** @brief Register a file descriptor
  * @param ev Event loop
  * @param mode @c ev_read or @c ev_write
@@ -300,6 +661,8 @@ int ev_run(ev_source *ev) {
  *
  * Sets @ref ev_source::escape, so no further processing of file descriptors
  * will occur this time round the event loop.
+ *
+ * @c ev_except is not supported and always fails.
  */
 int ev_fd(ev_source *ev,
 	  ev_fdmode mode,
@@ -307,30 +670,34 @@ int ev_fd(ev_source *ev,
 	  ev_fd_callback *callback,
 	  void *u,
 	  const char *what) {
+  struct fdmode *const fm = &ev->mode[mode];
   int n;
 
   D(("registering %s fd %d callback %p %p", modenames[mode], fd,
      (void *)callback, u));
-  /* FreeBSD defines FD_SETSIZE as 1024u for some reason */
-  if((unsigned)fd >= FD_SETSIZE)
-    return -1;
   assert(mode < ev_nmodes);
-  if(ev->mode[mode].nfds >= ev->mode[mode].fdslots) {
-    ev->mode[mode].fdslots = (ev->mode[mode].fdslots
-			       ? 2 * ev->mode[mode].fdslots : 16);
-    D(("expanding %s fd table to %d entries", modenames[mode],
-       ev->mode[mode].fdslots));
-    ev->mode[mode].fds = xrealloc(ev->mode[mode].fds,
-				  ev->mode[mode].fdslots * sizeof (struct fd));
+  if(fd < 0 || !pollset_modes[mode])
+    return -1;
+  if(fd >= fm->fdslots) {
+    n = fm->fdslots ? fm->fdslots : 16;
+    while(n <= fd)
+      n *= 2;
+    D(("expanding %s fd table to %d entries", modenames[mode], n));
+    fm->fds = xrealloc(fm->fds, n * sizeof (struct fd));
+    while(fm->fdslots < n)
+      fm->fds[fm->fdslots++].fd = -1;
+  }
+  assert(fm->fds[fd].fd == -1);
+  fm->fds[fd].fd = fd;
+  fm->fds[fd].enabled = 1;
+  fm->fds[fd].callback = callback;
+  fm->fds[fd].u = u;
+  fm->fds[fd].what = what;
+  if(ev_fd_update(ev, fd)) {
+    fm->fds[fd].fd = -1;
+    return -1;
   }
-  n = ev->mode[mode].nfds++;
-  FD_SET(fd, &ev->mode[mode].enabled);
-  ev->mode[mode].fds[n].fd = fd;
-  ev->mode[mode].fds[n].callback = callback;
-  ev->mode[mode].fds[n].u = u;
-  ev->mode[mode].fds[n].what = what;
-  if(fd > ev->mode[mode].maxfd)
-    ev->mode[mode].maxfd = fd;
+  ++fm->nfds;
   ev->escape = 1;
   return 0;
 }
@@ -345,30 +712,15 @@ int ev_fd(ev_source *ev,
  * will occur this time round the event loop.
  */
 int ev_fd_cancel(ev_source *ev, ev_fdmode mode, int fd) {
-  int n;
-  int maxfd;
+  struct fdmode *const fm = &ev->mode[mode];
 
   D(("cancelling mode %s fd %d", modenames[mode], fd));
-  /* find the right struct fd */
-  for(n = 0; n < ev->mode[mode].nfds && fd != ev->mode[mode].fds[n].fd; ++n)
-    ;
-  assert(n < ev->mode[mode].nfds);
-  /* swap in the last fd and reduce the count */
-  if(n != ev->mode[mode].nfds - 1)
-    ev->mode[mode].fds[n] = ev->mode[mode].fds[ev->mode[mode].nfds - 1];
-  --ev->mode[mode].nfds;
-  /* if that was the biggest fd, find the new biggest one */
-  if(fd == ev->mode[mode].maxfd) {
-    maxfd = 0;
-    for(n = 0; n < ev->mode[mode].nfds; ++n)
-      if(ev->mode[mode].fds[n].fd > maxfd)
-	maxfd = ev->mode[mode].fds[n].fd;
-    ev->mode[mode].maxfd = maxfd;
-  }
-  /* don't tell select about this fd any more */
-  FD_CLR(fd, &ev->mode[mode].enabled);
+  assert(fd >= 0 && fd < fm->fdslots && fm->fds[fd].fd == fd);
+  fm->fds[fd].fd = -1;
+  --fm->nfds;
   ev->escape = 1;
-  return 0;
+  /* don't wait for this fd any more */
+  return ev_fd_update(ev, fd);
 }
 
 /** @brief Re-enable a file descriptor
@@ -381,10 +733,14 @@ int ev_fd_cancel(ev_source *ev, ev_fdmode mode, int fd) {
  * cancelled.
  */
 int ev_fd_enable(ev_source *ev, ev_fdmode mode, int fd) {
-  assert(fd >= 0);
+  struct fdmode *const fm = &ev->mode[mode];
+
   D(("enabling mode %s fd %d", modenames[mode], fd));
-  FD_SET(fd, &ev->mode[mode].enabled);
-  return 0;
+  assert(fd >= 0 && fd < fm->fdslots && fm->fds[fd].fd == fd);
+  if(fm->fds[fd].enabled)
+    return 0;
+  fm->fds[fd].enabled = 1;
+  return ev_fd_update(ev, fd);
 }
 
 /** @brief Temporarily disable a file descriptor
@@ -397,17 +753,21 @@ int ev_fd_enable(ev_source *ev, ev_fdmode mode, int fd) {
  * but it must not have been cancelled.
  */
 int ev_fd_disable(ev_source *ev, ev_fdmode mode, int fd) {
+  struct fdmode *const fm = &ev->mode[mode];
+
   D(("disabling mode %s fd %d", modenames[mode], fd));
-  FD_CLR(fd, &ev->mode[mode].enabled);
-  FD_CLR(fd, &ev->mode[mode].tripped);
+  assert(fd >= 0 && fd < fm->fdslots && fm->fds[fd].fd == fd);
   /* Suppress any pending callbacks */
   ev->escape = 1;
-  return 0;
+  if(!fm->fds[fd].enabled)
+    return 0;
+  fm->fds[fd].enabled = 0;
+  return ev_fd_update(ev, fd);
 }
 
 /** @brief Log a report of file descriptor state */
 void ev_report(ev_source *ev) {
-  int n, fd;
+  int fd;
   ev_fdmode mode;
   struct dynstr d[1];
   char b[4096];
@@ -416,26 +776,19 @@ void ev_report(ev_source *ev) {
     return;
   dynstr_init(d);
   for(mode = 0; mode < ev_nmodes; ++mode) {
-    D(("mode %s maxfd %d", modenames[mode], ev->mode[mode].maxfd));
-    for(n = 0; n < ev->mode[mode].nfds; ++n) {
-      fd = ev->mode[mode].fds[n].fd;
-      D(("fd %s %d%s%s (%s)", modenames[mode], fd,
-	 FD_ISSET(fd, &ev->mode[mode].enabled) ? " enabled" : "",
-	 FD_ISSET(fd, &ev->mode[mode].tripped) ? " tripped" : "",
-	 ev->mode[mode].fds[n].what));
-    }
+    const struct fdmode *const fm = &ev->mode[mode];
+
+    D(("mode %s nfds %d", modenames[mode], fm->nfds));
     d->nvec = 0;
-    for(fd = 0; fd <= ev->mode[mode].maxfd; ++fd) {
-      if(!FD_ISSET(fd, &ev->mode[mode].enabled))
+    for(fd = 0; fd < fm->fdslots; ++fd) {
+      if(fm->fds[fd].fd != fd)
 	continue;
-      for(n = 0; n < ev->mode[mode].nfds; ++n) {
-	if(ev->mode[mode].fds[n].fd == fd)
-	  break;
-      }
-      if(n < ev->mode[mode].nfds)
-	snprintf(b, sizeof b, "%d(%s)", fd, ev->mode[mode].fds[n].what);
-      else
-	snprintf(b, sizeof b, "%d", fd);
+      D(("fd %s %d%s (%s)", modenames[mode], fd,
+	 fm->fds[fd].enabled ? " enabled" : "",
+	 fm->fds[fd].what));
+      if(!fm->fds[fd].enabled)
+	continue;
+      snprintf(b, sizeof b, "%d(%s)", fd, fm->fds[fd].what);
       dynstr_append(d, ' ');
       dynstr_append_string(d, b);
     }
@@ -444,6 +797,66 @@ void ev_report(ev_source *ev) {
   }
 }
 
+/* instrumentation ************************************************************/
+
+/** @brief Turn callback timing on or off
+ * @param ev Event loop
+ * @param slow_ms Threshold for logging slow callbacks in milliseconds, or 0
+ *
+ * If @p slow_ms is positive then every callback is timed, and any that take
+ * at least @p slow_ms milliseconds are logged.  If it is 0 then timing is
+ * turned off, but timings collected so far are kept.
+ */
+void ev_instrument(ev_source *ev, long slow_ms) {
+  ev->instrumented = slow_ms > 0;
+  ev->slow = slow_ms / 1000.0;
+  if(ev->instrumented && !ev->timings)
+    ev->timings = hash_new(sizeof (struct timing));
+}
+
+/** @brief Compare strings for qsort() */
+static int timing_compare(const void *a, const void *b) {
+  return strcmp(*(char **)a, *(char **)b);
+}
+
+/** @brief Return callback timings
+ * @param ev Event loop
+ * @return NULL-terminated list of descriptions of callback timings
+ *
+ * Each string is a quoted list of the callback's description, the number of
+ * calls, the total and maximum time taken in microseconds, and then the
+ * histogram of call durations (see @ref TIMING_BUCKETS).
+ */
+char **ev_timings(ev_source *ev) {
+  struct vector v[1];
+  struct dynstr d[1];
+  struct sink *s;
+  const struct timing *t;
+  char **keys;
+  size_t n;
+  int b;
+
+  vector_init(v);
+  if(ev->timings) {
+    keys = hash_keys(ev->timings);
+    qsort(keys, hash_count(ev->timings), sizeof *keys, timing_compare);
+    for(n = 0; keys[n]; ++n) {
+      t = hash_find(ev->timings, keys[n]);
+      dynstr_init(d);
+      s = sink_dynstr(d);
+      sink_printf(s, "%s %lu %lu %lu", quoteutf8(keys[n]), t->count,
+		  (unsigned long)(t->total * 1000000),
+		  (unsigned long)(t->max * 1000000));
+      for(b = 0; b < TIMING_BUCKETS; ++b)
+	sink_printf(s, " %lu", t->buckets[b]);
+      dynstr_terminate(d);
+      vector_append(v, d->vec);
+    }
+  }
+  vector_terminate(v);
+  return v->vec;
+}
+
 /* timeouts *******************************************************************/
 
 /** @brief Register a timeout
@@ -472,12 +885,16 @@ int ev_timeout(ev_source *ev,
      when ? (long)when->tv_sec : 0, when ? (long)when->tv_usec : 0,
      (void *)callback, u));
   t = xmalloc(sizeof *t);
-  if(when)
+  if(when) {
     t->when = *when;
+    if(t->when.tv_sec >= 0)
+      t->tick = ((uint64_t)t->when.tv_sec * 1000000 + t->when.tv_usec + 999)
+	/ 1000;
+  }
   t->callback = callback;
   t->u = u;
   t->active = 1;
-  timeout_heap_insert(ev->timeouts, t);
+  timeout_place(ev, t);
   if(handlep)
     *handlep = t;
   return 0;
@@ -488,14 +905,18 @@ int ev_timeout(ev_source *ev,
  * @param handle Handle returned from ev_timeout(), or 0
  * @return 0 on success, non-0 on error
  *
- * If @p handle is 0 then this is a no-op.
+ * If @p handle is 0, or the timeout has already been called, then this is a
+ * no-op.
  */
-int ev_timeout_cancel(ev_source attribute((unused)) *ev,
+int ev_timeout_cancel(ev_source *ev,
 		      ev_timeout_handle handle) {
   struct timeout *t = handle;
 
-  if(t)
+  if(t) {
+    if(t->prevp)
+      timeout_unlink(ev, t);
     t->active = 0;
+  }
   return 0;
 }
 
@@ -534,10 +955,17 @@ static int signal_read(ev_source *ev,
   unsigned char s;
   int n;
   int ret;
-
-  if((n = read(ev->sigpipe[0], &s, 1)) == 1)
-    if((ret = ev->signals[s].callback(ev, s, ev->signals[s].u)))
+  double started;
+  char what[32];
+
+  if((n = read(ev->sigpipe[0], &s, 1)) == 1) {
+    started = timing_start(ev);
+    ret = ev->signals[s].callback(ev, s, ev->signals[s].u);
+    snprintf(what, sizeof what, "signal %d", s);
+    timing_stop(ev, "signal", what, started);
+    if(ret)
       return ret;
+  }
   assert(n != 0);
   if(n < 0 && (errno != EINTR && errno != EAGAIN)) {
     disorder_error(errno, "error reading from signal pipe %d", ev->sigpipe[0]);
@@ -654,6 +1082,7 @@ static int sigchld_callback(ev_source *ev,
   struct rusage ru;
   pid_t r;
   int status, n, ret, revisit;
+  double started;
 
   do {
     revisit = 0;
@@ -669,7 +1098,10 @@ static int sigchld_callback(ev_source *ev,
 	if(WIFEXITED(status) || WIFSIGNALED(status))
 	  ev_child_cancel(ev, r);
 	revisit = 1;
-	if((ret = c(ev, r, status, &ru, cu)))
+	started = timing_start(ev);
+	ret = c(ev, r, status, &ru, cu);
+	timing_stop(ev, "child", NULL, started);
+	if(ret)
 	  return ret;
       } else if(r < 0) {
 	/* We should "never" get an ECHILD but it can in fact happen.  For
@@ -907,6 +1339,50 @@ static void buffer_space(struct buffer *b, size_t bytes) {
      (void *)b->base, (void *)b->start, (void *)b->end, (void *)b->top));
 }
 
+/** @brief Size of a writer's buffer chunks */
+#define CHUNK_SIZE 4096
+
+/** @brief Maximum number of chunks passed to a single @c writev() */
+#define WRITEV_MAX 64
+
+/** @brief One piece of a writer's output */
+struct chunk {
+  /** @brief Next chunk in the chain */
+  struct chunk *next;
+
+  /** @brief First byte not yet written */
+  const char *start;
+
+  /** @brief End of the data */
+  char *end;
+
+  /** @brief End of the space in @ref data, or NULL for a referenced chunk
+   *
+   * A referenced chunk points at the caller's memory instead of @ref
+   * data, and can't be appended to.  File chunks are also referenced
+   * chunks.
+   */
+  char *top;
+
+  /** @brief Nonzero if this chunk is a region of a file
+   *
+   * File chunks don't use @ref start and @ref end.
+   */
+  int is_file;
+
+  /** @brief File to send from */
+  int file;
+
+  /** @brief Offset in @ref file of the next byte to send */
+  off_t offset;
+
+  /** @brief Bytes still to send from @ref file */
+  size_t length;
+
+  /** @brief Data for this chunk */
+  char data[];
+};
+
 /* readers and writers *******************************************************/
 
 /** @brief State structure for a buffered writer */
@@ -914,8 +1390,23 @@ struct ev_writer {
   /** @brief Sink used for writing to the buffer */
   struct sink s;
 
-  /** @brief Output buffer */
-  struct buffer b;
+  /** @brief First chunk of output */
+  struct chunk *head;
+
+  /** @brief Last chunk of output, or NULL */
+  struct chunk *tail;
+
+  /** @brief Unused chunk kept for the next write, or NULL */
+  struct chunk *spare;
+
+  /** @brief Total bytes waiting to be written */
+  size_t buffered;
+
+  /** @brief How many of @ref buffered are to be sent from files
+   *
+   * These don't count towards @ref spacebound.
+   */
+  size_t file_bytes;
 
   /** @brief File descriptor to write to */
   int fd;
@@ -949,6 +1440,39 @@ struct ev_writer {
 
   /** @brief Set when abandoned */
   int abandoned;
+
+  /** @brief Called when the buffer drains, or NULL
+   *
+   * See ev_writer_drained().
+   */
+  ev_drained_callback *drained;
+
+  /** @brief Passed to @ref drained */
+  void *drained_u;
+
+  /** @brief Buffer level at which to call @ref drained */
+  size_t drained_low;
+
+  /** @brief Called with each write, or NULL
+   *
+   * See ev_writer_tap().
+   */
+  ev_writer_tap_callback *tap;
+
+  /** @brief Passed to @ref tap */
+  void *tap_u;
+
+  /** @brief Transforms output before it is buffered, or NULL
+   *
+   * See ev_writer_filter().
+   */
+  ev_writer_filter_callback *filter;
+
+  /** @brief Passed to @ref filter */
+  void *filter_u;
+
+  /** @brief Set when @ref filter needs flushing */
+  int filter_pending;
 };
 
 /** @brief State structure for a buffered reader */
@@ -975,6 +1499,53 @@ struct ev_reader {
 
 /* buffered writer ************************************************************/
 
+/** @brief Discard written bytes from the front of a writer's chain
+ * @param w Writer
+ * @param n Number of bytes written
+ */
+static void writer_consume(ev_writer *w, size_t n) {
+  struct chunk *c;
+  size_t have;
+
+  w->buffered -= n;
+  while(n) {
+    c = w->head;
+    have = c->is_file ? c->length : (size_t)(c->end - c->start);
+    if(n < have) {
+      if(c->is_file) {
+        c->offset += n;
+        c->length -= n;
+        w->file_bytes -= n;
+      } else
+        c->start += n;
+      break;
+    }
+    n -= have;
+    if(!(w->head = c->next))
+      w->tail = NULL;
+    if(c->is_file) {
+      w->file_bytes -= have;
+      xclose(c->file);
+    }
+    if(c->top && !w->spare) {
+      c->start = c->end = c->data;
+      c->next = NULL;
+      w->spare = c;
+    } else
+      xfree(c);
+  }
+}
+
+/** @brief Add a chunk to the end of a writer's chain */
+static void writer_link(ev_writer *w, struct chunk *c) {
+  c->next = NULL;
+  if(w->tail)
+    w->tail->next = c;
+  else
+    w->head = c;
+  w->tail = c;
+}
+
 /** @brief Shut down the writer
  *
  * This is called to shut down a writer.  The error callback is not called
@@ -986,10 +1557,25 @@ struct ev_reader {
  *
  * Calls @p callback with @p w->syntherr as the error code (which might be 0).
  */
+/** @brief Call a writer's drain callback if it is due
+ * @param ev Event loop
+ * @param w Writer
+ * @return Return value from the callback, or 0
+ */
+static int writer_notify_drained(ev_source *ev, ev_writer *w) {
+  ev_drained_callback *const callback = w->drained;
+
+  if(!callback || (w->fd != -1 && w->buffered > w->drained_low))
+    return 0;
+  w->drained = 0;
+  return callback(ev, w->drained_u);
+}
+
 static int writer_shutdown(ev_source *ev,
 			   const attribute((unused)) struct timeval *now,
 			   void *u) {
   ev_writer *w = u;
+  int ret;
 
   if(w->fd == -1)
     return 0;				/* already shut down */
@@ -997,6 +1583,10 @@ static int writer_shutdown(ev_source *ev,
   ev_timeout_cancel(ev, w->timeout);
   ev_fd_cancel(ev, ev_write, w->fd);
   w->timeout = 0;
+  /* Anything left over will never be written */
+  writer_consume(w, w->buffered);
+  xfree(w->spare);
+  w->spare = NULL;
   if(w->reader) {
     D(("found a tied reader"));
     /* If there is a reader still around we just untie it */
@@ -1008,7 +1598,10 @@ static int writer_shutdown(ev_source *ev,
     xclose(w->fd);
   }
   w->fd = -1;
-  return w->callback(ev, w->error, w->u);
+  if((ret = w->callback(ev, w->error, w->u)))
+    return ret;
+  /* Anyone waiting for the buffer to drain won't wait any longer */
+  return writer_notify_drained(ev, w);
 }
 
 /** @brief Called when a writer's @p timebound expires */
@@ -1038,21 +1631,103 @@ static void writer_set_timebound(ev_writer *w) {
   }
 }
 
+/** @brief Check whether a writer can accept more output
+ * @param w Writer
+ * @param n Number of bytes to be added
+ * @param retp Where to store the return value if refused
+ * @return Nonzero if the output should be discarded
+ *
+ * Also re-enables the writer's file descriptor if it will need it.
+ */
+static int writer_admit(ev_writer *w, size_t n, int *retp) {
+  if(w->fd == -1)
+    disorder_error(0, "ev_writer_write on %s after shutdown", w->what);
+  if(w->spacebound
+     && w->buffered - w->file_bytes + n > (size_t)w->spacebound) {
+    /* The new buffer contents will exceed the space bound.  We assume that the
+     * remote client has gone away and TCP hasn't noticed yet, or that it's got
+     * hopelessly stuck. */
+    if(!w->abandoned) {
+      w->abandoned = 1;
+      disorder_error(0, "abandoning writer '%s' because buffer has reached %lu bytes",
+		     w->what, (unsigned long)w->buffered);
+      ev_fd_disable(w->ev, ev_write, w->fd);
+      w->error = EPIPE;
+      *retp = ev_timeout(w->ev, 0, 0, writer_shutdown, w);
+    } else
+      *retp = 0;
+    return 1;
+  }
+  /* If the buffer was formerly empty then we'll need to re-enable the FD */
+  if(!w->buffered)
+    ev_fd_enable(w->ev, ev_write, w->fd);
+  return 0;
+}
+
+/** @brief Send some of a file chunk
+ * @param fd File descriptor to write to
+ * @param c File chunk
+ * @return Bytes written, or -1 on error
+ *
+ * Uses @c sendfile() if possible, which copies the data without it passing
+ * through userspace.  Otherwise it goes via a buffer.
+ */
+static ssize_t writer_sendfile(int fd, struct chunk *c) {
+  char buffer[CHUNK_SIZE];
+  ssize_t n;
+  size_t len;
+
+#if HAVE_SYS_SENDFILE_H && HAVE_SENDFILE
+  off_t offset = c->offset;
+
+  if((n = sendfile(fd, c->file, &offset, c->length)) >= 0
+     || (errno != EINVAL && errno != ENOSYS))
+    goto done;
+  /* The file or destination isn't suitable; do it the slow way */
+#endif
+  len = c->length < sizeof buffer ? c->length : sizeof buffer;
+  if((n = pread(c->file, buffer, len, c->offset)) > 0)
+    n = write(fd, buffer, n);
+#if HAVE_SYS_SENDFILE_H && HAVE_SENDFILE
+done:
+#endif
+  if(n == 0) {
+    /* The file was shorter than promised */
+    errno = EIO;
+    return -1;
+  }
+  return n;
+}
+
 /** @brief Called when a writer's file descriptor is writable */
 static int writer_callback(ev_source *ev, int fd, void *u) {
   ev_writer *const w = u;
-  int n;
-
-  n = write(fd, w->b.start, w->b.end - w->b.start);
-  D(("callback for writer fd %d, %ld bytes, n=%d, errno=%d",
-     fd, (long)(w->b.end - w->b.start), n, errno));
+  struct iovec vec[WRITEV_MAX];
+  struct chunk *c;
+  ssize_t n;
+  int nvec = 0;
+
+  /* Gather up memory chunks as far as the first file chunk */
+  for(c = w->head; c && !c->is_file && nvec < WRITEV_MAX; c = c->next) {
+    vec[nvec].iov_base = (void *)c->start;
+    vec[nvec].iov_len = c->end - c->start;
+    ++nvec;
+  }
+  if(nvec)
+    n = writev(fd, vec, nvec);
+  else if(c)
+    n = writer_sendfile(fd, c);
+  else
+    n = 0;
+  D(("callback for writer fd %d, %lu bytes, n=%ld, errno=%d",
+     fd, (unsigned long)w->buffered, (long)n, errno));
   if(n >= 0) {
     /* Consume bytes from the buffer */
-    w->b.start += n;
+    writer_consume(w, n);
     /* Suppress any outstanding timeout */
     ev_timeout_cancel(ev, w->timeout);
     w->timeout = 0;
-    if(w->b.start == w->b.end) {
+    if(!w->buffered) {
       /* The buffer is empty */
       if(w->eof) {
 	/* We're done, we can shut down this writer */
@@ -1066,6 +1741,7 @@ static int writer_callback(ev_source *ev, int fd, void *u) {
       /* The buffer isn't empty, set a timeout so we give up if we don't manage
        * to write some more within a reasonable time */
       writer_set_timebound(w);
+    return writer_notify_drained(ev, w);
   } else {
     switch(errno) {
     case EINTR:
@@ -1079,6 +1755,76 @@ static int writer_callback(ev_source *ev, int fd, void *u) {
   return 0;
 }
 
+/** @brief Called from ev_run() to flush a writer's filter */
+static int writer_filter_timeout(ev_source attribute((unused)) *ev,
+				 const attribute((unused)) struct timeval *now,
+				 void *u) {
+  ev_writer *const w = u;
+
+  if(!w->filter_pending)
+    return 0;				/* already flushed */
+  w->filter_pending = 0;
+  if(w->fd != -1 && !w->eof)
+    w->filter(w, NULL, 0, w->filter_u);
+  return 0;
+}
+
+/** @brief Pass bytes through a writer's filter
+ * @param w Writer
+ * @param ptr Bytes to write
+ * @param n Number of bytes to write
+ * @return 0 on success, non-0 on error
+ *
+ * The filter is flushed next time around the event loop, so that everything
+ * written in the meantime is flushed together.
+ */
+static int writer_filter(ev_writer *w, const void *ptr, size_t n) {
+  if(w->tap)
+    w->tap(ptr, n, w->tap_u);
+  if(!w->filter_pending) {
+    w->filter_pending = 1;
+    ev_timeout(w->ev, 0, 0, writer_filter_timeout, w);
+  }
+  return w->filter(w, ptr, n, w->filter_u);
+}
+
+/** @brief Copy bytes into a writer's buffer
+ * @param w Writer
+ * @param s Bytes to write
+ * @param n Number of bytes to write
+ *
+ * The caller is responsible for writer_admit().
+ */
+static void writer_copy(ev_writer *w, const void *s, size_t n) {
+  const char *ptr = s;
+  struct chunk *c;
+  size_t space;
+
+  w->buffered += n;
+  while(n > 0) {
+    /* Fill up the last chunk before starting another */
+    if(!(c = w->tail) || !c->top || c->end == c->top) {
+      if((c = w->spare))
+	w->spare = NULL;
+      else {
+	c = xmalloc(sizeof *c + CHUNK_SIZE);
+	c->start = c->end = c->data;
+	c->top = c->data + CHUNK_SIZE;
+      }
+      writer_link(w, c);
+    }
+    space = c->top - c->end;
+    if(space > n)
+      space = n;
+    memcpy(c->end, ptr, space);
+    c->end += space;
+    ptr += space;
+    n -= space;
+  }
+  /* Arrange a timeout if there wasn't one set already */
+  writer_set_timebound(w);
+}
+
 /** @brief Write bytes to a writer's buffer
  *
  * This is the sink write callback.
@@ -1088,33 +1834,128 @@ static int writer_callback(ev_source *ev, int fd, void *u) {
  */
 static int ev_writer_write(struct sink *sk, const void *s, int n) {
   ev_writer *w = (ev_writer *)sk;
+  int ret;
 
   if(!n)
     return 0;				/* avoid silliness */
-  if(w->fd == -1)
-    disorder_error(0, "ev_writer_write on %s after shutdown", w->what);
-  if(w->spacebound && w->b.end - w->b.start + n > w->spacebound) {
-    /* The new buffer contents will exceed the space bound.  We assume that the
-     * remote client has gone away and TCP hasn't noticed yet, or that it's got
-     * hopelessly stuck. */
-    if(!w->abandoned) {
-      w->abandoned = 1;
-      disorder_error(0, "abandoning writer '%s' because buffer has reached %td bytes",
-		     w->what, w->b.end - w->b.start);
-      ev_fd_disable(w->ev, ev_write, w->fd);
-      w->error = EPIPE;
-      return ev_timeout(w->ev, 0, 0, writer_shutdown, w);
-    } else
-      return 0;
+  if(w->filter)
+    return writer_filter(w, s, n);
+  if(writer_admit(w, n, &ret))
+    return ret;
+  if(w->tap)
+    w->tap(s, n, w->tap_u);
+  writer_copy(w, s, n);
+  return 0;
+}
+
+/** @brief Write bytes to a writer, bypassing its filter
+ * @param w Writer
+ * @param ptr Bytes to write
+ * @param n Number of bytes to write
+ * @return 0 on success, non-0 on error
+ *
+ * This is for use by filters (see ev_writer_filter()) to write their output.
+ * The bytes are copied.
+ */
+int ev_writer_raw(ev_writer *w, const void *ptr, size_t n) {
+  int ret;
+
+  if(!n)
+    return 0;
+  if(writer_admit(w, n, &ret))
+    return ret;
+  writer_copy(w, ptr, n);
+  return 0;
+}
+
+/** @brief Write bytes to a writer without copying them
+ * @param w Writer
+ * @param ptr Bytes to write
+ * @param n Number of bytes to write
+ * @return 0 on success, non-0 on error
+ *
+ * The bytes are written in order with anything written via the writer's
+ * sink.  They must remain valid and unchanged until they have been written,
+ * so this is intended for static data or memory from xmalloc(), which the
+ * writer keeps alive for as long as it needs it.
+ */
+int ev_writer_reference(ev_writer *w, const void *ptr, size_t n) {
+  struct chunk *c;
+  int ret;
+
+  if(!n)
+    return 0;
+  if(w->filter)
+    return writer_filter(w, ptr, n);
+  if(writer_admit(w, n, &ret))
+    return ret;
+  if(w->tap)
+    w->tap(ptr, n, w->tap_u);
+  w->buffered += n;
+  c = xmalloc(sizeof *c);
+  c->start = ptr;
+  c->end = (char *)ptr + n;
+  c->top = NULL;
+  writer_link(w, c);
+  writer_set_timebound(w);
+  return 0;
+}
+
+/** @brief Write a region of a file to a writer
+ * @param w Writer
+ * @param file File to write from
+ * @param offset Offset of the start of the region
+ * @param n Number of bytes to write
+ * @return 0 on success, non-0 on error
+ *
+ * The bytes are written in order with anything written via the writer's
+ * sink, without being read into memory first where the platform allows.
+ * The writer takes ownership of @p file and closes it once the region has
+ * been written or the writer has shut down.  File regions don't count
+ * towards the writer's space bound.
+ *
+ * If the writer has a filter then the region is read immediately and passed
+ * through it.
+ */
+int ev_writer_file(ev_writer *w, int file, off_t offset, size_t n) {
+  struct chunk *c;
+  int ret;
+  char buffer[CHUNK_SIZE];
+  ssize_t r;
+
+  if(!n) {
+    xclose(file);
+    return 0;
   }
-  /* Make sure there is space */
-  buffer_space(&w->b, n);
-  /* If the buffer was formerly empty then we'll need to re-enable the FD */
-  if(w->b.start == w->b.end)
-    ev_fd_enable(w->ev, ev_write, w->fd);
-  memcpy(w->b.end, s, n);
-  w->b.end += n;
-  /* Arrange a timeout if there wasn't one set already */
+  if(w->filter) {
+    ret = 0;
+    while(n > 0 && !ret) {
+      if((r = pread(file, buffer, n < sizeof buffer ? n : sizeof buffer,
+                    offset)) <= 0) {
+        disorder_error(r ? errno : 0, "error reading file for %s", w->what);
+        ret = -1;
+        break;
+      }
+      ret = writer_filter(w, buffer, r);
+      offset += r;
+      n -= r;
+    }
+    xclose(file);
+    return ret;
+  }
+  if(writer_admit(w, 0, &ret)) {
+    xclose(file);
+    return ret;
+  }
+  w->buffered += n;
+  w->file_bytes += n;
+  c = xmalloc(sizeof *c);
+  c->top = NULL;
+  c->is_file = 1;
+  c->file = file;
+  c->offset = offset;
+  c->length = n;
+  writer_link(w, c);
   writer_set_timebound(w);
   return 0;
 }
@@ -1213,6 +2054,82 @@ struct sink *ev_writer_sink(ev_writer *w) {
   return &w->s;
 }
 
+/** @brief Return the number of bytes waiting to be written
+ * @param w Writer
+ * @return Bytes buffered, including any file regions
+ */
+size_t ev_writer_buffered(ev_writer *w) {
+  return w->buffered;
+}
+
+/** @brief Watch the bytes written to a writer
+ * @param w Writer
+ * @param tap Called with each write, or NULL to stop watching
+ * @param u Passed to @p tap
+ *
+ * @p tap is called as bytes are added to the buffer via the writer's sink or
+ * ev_writer_reference(), not as they reach the file descriptor.  Bytes
+ * refused because of the space bound are not seen.  Regions written with
+ * ev_writer_file() are not seen either.
+ */
+void ev_writer_tap(ev_writer *w, ev_writer_tap_callback *tap, void *u) {
+  w->tap = tap;
+  w->tap_u = u;
+}
+
+/** @brief Transform the output of a writer
+ * @param w Writer
+ * @param filter Called with each write, or NULL to stop filtering
+ * @param u Passed to @p filter
+ *
+ * Once a filter is installed, everything written to @p w is passed to it
+ * instead of being buffered directly, and the filter writes its output with
+ * ev_writer_raw().  It is also called with @c ptr set to NULL when it should
+ * flush anything it is holding back: after each iteration of the event loop
+ * in which something was written, and when the writer is closed.  This is
+ * intended for compression.
+ *
+ * The tap (see ev_writer_tap()) sees the bytes before they are filtered.
+ */
+void ev_writer_filter(ev_writer *w, ev_writer_filter_callback *filter,
+		      void *u) {
+  w->filter = filter;
+  w->filter_u = u;
+}
+
+/** @brief Called from ev_run() for ev_writer_drained() */
+static int writer_drained_timeout(ev_source *ev,
+				  const attribute((unused)) struct timeval *now,
+				  void *u) {
+  return writer_notify_drained(ev, u);
+}
+
+/** @brief Arrange a callback when a writer's buffer drains
+ * @param w Writer
+ * @param low Buffer level to wait for
+ * @param callback Called when no more than @p low bytes are buffered
+ * @param u Passed to @p callback
+ * @return 0 on success, non-0 on error
+ *
+ * This allows a producer to stop generating output when the writer falls
+ * behind and carry on when it catches up, rather than filling the buffer up
+ * to its space bound.
+ *
+ * @p callback is called once, from the event loop, and never from inside this
+ * function.  It is also called if the writer shuts down first, so the caller
+ * must check whether there is still anywhere to write to.  Only one callback
+ * can be waiting at a time; a new one replaces the old.
+ */
+int ev_writer_drained(ev_writer *w, size_t low,
+		      ev_drained_callback *callback, void *u) {
+  w->drained = callback;
+  w->drained_u = u;
+  w->drained_low = low;
+  if(w->fd == -1 || w->buffered <= low)
+    return ev_timeout(w->ev, 0, 0, writer_drained_timeout, w);
+  return 0;
+}
+
 /** @brief Close a writer
  * @param w Writer to close
  * @return 0 on success, non-0 on error
@@ -1228,8 +2145,12 @@ int ev_writer_close(ev_writer *w) {
   D(("close writer fd %d", w->fd));
   if(w->eof)
     return 0;				/* already closed */
+  if(w->filter_pending) {
+    w->filter_pending = 0;
+    w->filter(w, NULL, 0, w->filter_u);
+  }
   w->eof = 1;
-  if(w->b.start == w->b.end) {
+  if(!w->buffered) {
     /* We're already finished */
     w->error = 0;			/* no error */
     return ev_timeout(w->ev, 0, 0, writer_shutdown, w);
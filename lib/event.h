@@ -21,6 +21,7 @@
 #ifndef EVENT_H
 #define EVENT_H
 
+#include <sys/types.h>
 #include <sys/socket.h>
 
 typedef struct ev_source ev_source;
@@ -41,7 +42,7 @@ int ev_run(ev_source *ev);
 typedef enum {
   ev_read,
   ev_write,
-  ev_except,
+  ev_except,				/* not supported */
 
   ev_nmodes
 } ev_fdmode;
@@ -74,6 +75,15 @@ int ev_fd_enable(ev_source *ev,
 
 void ev_report(ev_source *ev);
 
+/* instrumentation ************************************************************/
+
+void ev_instrument(ev_source *ev, long slow_ms);
+/* time callbacks, logging those taking at least @slow_ms@ milliseconds; 0 to
+ * stop */
+
+char **ev_timings(ev_source *ev);
+/* return a NULL-terminated list of callback timings */
+
 /* timeouts *******************************************************************/
 
 typedef int ev_timeout_callback(ev_source *ev,
@@ -208,6 +218,42 @@ int ev_writer_flush(ev_writer *w);
 struct sink *ev_writer_sink(ev_writer *w) attribute((const));
 /* return a sink for the writer - use this to actually write to it */
 
+int ev_writer_reference(ev_writer *w, const void *ptr, size_t n);
+/* write caller-owned bytes without copying them */
+
+int ev_writer_file(ev_writer *w, int file, off_t offset, size_t n);
+/* write a region of a file, closing it when done */
+
+size_t ev_writer_buffered(ev_writer *w);
+/* return the number of bytes waiting to be written */
+
+typedef int ev_drained_callback(ev_source *ev,
+				void *u);
+
+int ev_writer_drained(ev_writer *w, size_t low,
+		      ev_drained_callback *callback, void *u);
+/* call @callback@ once no more than @low@ bytes are buffered, or the writer
+ * has shut down */
+
+typedef void ev_writer_tap_callback(const void *ptr,
+				    size_t n,
+				    void *u);
+
+void ev_writer_tap(ev_writer *w, ev_writer_tap_callback *tap, void *u);
+/* call @tap@ with each write to @w@ */
+
+typedef int ev_writer_filter_callback(ev_writer *w,
+				      const void *ptr,
+				      size_t n,
+				      void *u);
+
+void ev_writer_filter(ev_writer *w, ev_writer_filter_callback *filter,
+		      void *u);
+/* pass everything written to @w@ through @filter@; @ptr@ is NULL to flush */
+
+int ev_writer_raw(ev_writer *w, const void *ptr, size_t n);
+/* write bytes to @w@ without filtering them */
+
 /* buffered reader ************************************************************/
 
 typedef struct ev_reader ev_reader;
@@ -24,17 +24,42 @@
 #include "eventdist.h"
 #include "hash.h"
 
+/** @brief An event type
+ *
+ * Handlers are kept in an array in registration order.  Cancelled handlers
+ * leave a null pointer behind, which is squeezed out once enough have
+ * accumulated and the event is not being raised.
+ */
+struct event_type {
+  /** @brief Name of event */
+  const char *event;
+
+  /** @brief Handlers */
+  struct event_data **handlers;
+
+  /** @brief Number of elements of @ref handlers in use */
+  int nhandlers;
+
+  /** @brief Number of elements allocated for @ref handlers */
+  int nslots;
+
+  /** @brief Number of null elements in @ref handlers */
+  int ncancelled;
+
+  /** @brief Nesting depth of event_raise_id() for this event */
+  int raising;
+};
+
 /** @brief Event data
  *
- * @c event_data structures form linked lists; one list per event and one node
- * per handler.
+ * One per handler.
  */
 struct event_data {
-  /** @brief Next handler */
-  struct event_data *next;
+  /** @brief Event type */
+  struct event_type *type;
 
-  /** @brief Name of event */
-  const char *event;
+  /** @brief Index in @c type->handlers */
+  int index;
 
   /** @brief Handler callback */
   event_handler *callback;
@@ -45,6 +70,39 @@ struct event_data {
 
 static hash *events;
 
+/** @brief Find the ID for an event type
+ * @param event Event type
+ * @return Event ID (for use with event_raise_id())
+ *
+ * The ID is valid for the life of the program.
+ */
+event_id event_intern(const char *event) {
+  struct event_type *t, **tp;
+
+  if(!events)
+    events = hash_new(sizeof (struct event_type *));
+  if((tp = hash_find(events, event)))
+    return *tp;
+  t = xmalloc(sizeof *t);
+  t->event = xstrdup(event);
+  hash_add(events, event, &t, HASH_INSERT);
+  return t;
+}
+
+/** @brief Squeeze cancelled handlers out of @p t */
+static void event_compact(struct event_type *t) {
+  int n, m = 0;
+
+  for(n = 0; n < t->nhandlers; ++n)
+    if(t->handlers[n]) {
+      t->handlers[m] = t->handlers[n];
+      t->handlers[m]->index = m;
+      ++m;
+    }
+  t->nhandlers = m;
+  t->ncancelled = 0;
+}
+
 /** @brief Register an event handler
  * @param event Event type to handle
  * @param callback Function to call when event occurs
@@ -54,20 +112,18 @@ static hash *events;
 event_handle event_register(const char *event,
                             event_handler *callback,
                             void *callbackdata) {
-  static const struct event_data *null;
-  struct event_data *ed = xmalloc(sizeof *ed), **head;
+  struct event_type *t = event_intern(event);
+  struct event_data *ed = xmalloc(sizeof *ed);
 
-  if(!events)
-    events = hash_new(sizeof (struct event_data *));
-  if(!(head = hash_find(events, event))) {
-    hash_add(events, event, &null, HASH_INSERT);
-    head = hash_find(events, event);
+  if(t->nhandlers >= t->nslots) {
+    t->nslots = t->nslots ? 2 * t->nslots : 4;
+    t->handlers = xrealloc(t->handlers, t->nslots * sizeof *t->handlers);
   }
-  ed->next = *head;
-  ed->event = xstrdup(event);
+  ed->type = t;
+  ed->index = t->nhandlers;
   ed->callback = callback;
   ed->callbackdata = callbackdata;
-  *head = ed;
+  t->handlers[t->nhandlers++] = ed;
   return ed;
 }
 
@@ -77,31 +133,55 @@ event_handle event_register(const char *event,
  * @p handle is allowed to be NULL.
  */
 void event_cancel(event_handle handle) {
-  struct event_data **head, **edp;
-  
+  struct event_type *t;
+
   if(!handle)
     return;
-  assert(events);
-  head = hash_find(events, handle->event);
-  for(edp = head; *edp && *edp != handle; edp = &(*edp)->next)
-    ;
-  assert(*edp == handle);
-  *edp = handle->next;
+  t = handle->type;
+  assert(t->handlers[handle->index] == handle);
+  t->handlers[handle->index] = NULL;
+  ++t->ncancelled;
+  if(!t->raising && 2 * t->ncancelled > t->nhandlers)
+    event_compact(t);
+}
+
+/** @brief Raise an event
+ * @param id Event type to raise (as returned from event_intern())
+ * @param eventdata Event-specific data
+ *
+ * Handlers are called most recently registered first.  Handlers registered
+ * while the event is being raised are not called; handlers cancelled while
+ * the event is being raised are not called if they have not been already.
+ */
+void event_raise_id(event_id id,
+                    void *eventdata) {
+  struct event_data *ed;
+  int n;
+
+  ++id->raising;
+  for(n = id->nhandlers; n-- > 0;)
+    if((ed = id->handlers[n]))
+      ed->callback(id->event, eventdata, ed->callbackdata);
+  if(!--id->raising && 2 * id->ncancelled > id->nhandlers)
+    event_compact(id);
 }
 
 /** @brief Raise an event
  * @param event Event type to raise
  * @param eventdata Event-specific data
+ *
+ * Frequently raised events should use event_intern() and event_raise_id()
+ * instead.
  */
 void event_raise(const char *event,
                  void *eventdata) {
-  struct event_data *ed, **head;
+  struct event_type **tp;
+
   if(!events)
     return;
-  if(!(head = hash_find(events, event)))
+  if(!(tp = hash_find(events, event)))
     return;
-  for(ed = *head; ed; ed = ed->next)
-    ed->callback(event, eventdata, ed->callbackdata);
+  event_raise_id(*tp, eventdata);
 }
 
 /*
@@ -33,12 +33,18 @@ typedef void event_handler(const char *event,
 /** @brief Handle identifying an event monitor */
 typedef struct event_data *event_handle;
 
+/** @brief Interned event type */
+typedef struct event_type *event_id;
+
 event_handle event_register(const char *event,
                             event_handler *callback,
                             void *callbackdata);
 void event_cancel(event_handle handle);
 void event_raise(const char *event,
                  void *eventdata);
+event_id event_intern(const char *event);
+void event_raise_id(event_id id,
+                    void *eventdata);
 
 #endif /* EVENTDIST_H */
 
@@ -17,20 +17,80 @@
  */
 /** @file lib/eventlog.c
  * @brief Event logging
+ *
+ * Each event gets a sequence number, one more than the last, and the most
+ * recent @ref EVENTLOG_RING events are kept so that a client that loses its
+ * connection can be sent just the ones it missed (see eventlog_replay()).
+ * Numbering starts from a value derived from the time, so that numbers from
+ * different runs of the server are unlikely to be confused.
  */
 #include "common.h"
 
 #include <stdarg.h>
+#include <time.h>
 
 #include "mem.h"
 #include "vector.h"
 #include "printf.h"
 #include "eventlog.h"
 #include "split.h"
+#include "syscalls.h"
+
+/** @brief Number of recent events kept for eventlog_replay() */
+#define EVENTLOG_RING 1024
+
+/** @brief A recent event */
+struct eventlog_recent {
+  /** @brief Sequence number */
+  unsigned long seq;
+
+  /** @brief When it happened */
+  time_t when;
+
+  /** @brief Message */
+  char *msg;
+};
 
 /** @brief Linked list of event logs */
 static struct eventlog_output *outputs;
 
+/** @brief Recent events
+ *
+ * The event numbered @c S is at index @c S % @ref EVENTLOG_RING.
+ */
+static struct eventlog_recent ring[EVENTLOG_RING];
+
+/** @brief Sequence number of the most recent event
+ *
+ * 0 until eventlog_sequence() or an event first sets it.
+ */
+static unsigned long last_seq;
+
+/** @brief Number of valid entries in @ref ring */
+static unsigned long nring;
+
+unsigned long eventlog_sequence(void) {
+  if(!last_seq)
+    last_seq = (unsigned long)xtime(0) << 8;
+  return last_seq;
+}
+
+int eventlog_replay(unsigned long after,
+                    void (*fn)(unsigned long seq, time_t when,
+                               const char *msg, void *u),
+                    void *u) {
+  unsigned long latest = eventlog_sequence(), seq;
+
+  if(after > latest || latest - after > nring)
+    return -1;
+  for(seq = after + 1; fn && seq <= latest; ++seq) {
+    const struct eventlog_recent *r = &ring[seq % EVENTLOG_RING];
+
+    fn(r->seq, r->when, r->msg, u);
+  }
+  return 0;
+}
+
 void eventlog_add(struct eventlog_output *lo) {
   lo->next = outputs;
   outputs = lo;
@@ -52,9 +112,11 @@ void eventlog_remove(struct eventlog_output *lo) {
  */
 static void veventlog(const char *keyword, const char *raw, va_list ap) {
   struct eventlog_output *p, *pnext;
+  struct eventlog_recent *r;
   struct dynstr d;
   const char *param;
 
+  eventlog_sequence();
   dynstr_init(&d);
   dynstr_append_string(&d, keyword);
   while((param = va_arg(ap, const char *))) {
@@ -66,6 +128,12 @@ static void veventlog(const char *keyword, const char *raw, va_list ap) {
     dynstr_append_string(&d, raw);
   }
   dynstr_terminate(&d);
+  r = &ring[++last_seq % EVENTLOG_RING];
+  r->seq = last_seq;
+  r->when = xtime(0);
+  r->msg = d.vec;
+  if(nring < EVENTLOG_RING)
+    ++nring;
   for(p = outputs; p; p = pnext) {
     /* We must be able to cope with eventlog_remove() being called from inside
      * the callback */
@@ -62,6 +62,30 @@ void eventlog(const char *keyword, ...) attribute((nonnull(1)));
 void eventlog_raw(const char *keyword, const char *raw, ...)
   attribute((nonnull(1, 2)));
 
+/** @brief Return the sequence number of the most recent event
+ * @return Sequence number
+ *
+ * During an output's callback this is the number of the event being
+ * delivered.  Before there have been any events it is still a valid number,
+ * one less than the first event's will be.
+ */
+unsigned long eventlog_sequence(void);
+
+/** @brief Deliver recent events again
+ * @param after Sequence number of the last event already seen
+ * @param fn Called for each later event, oldest first, or NULL
+ * @param u Passed to @p fn
+ * @return 0 on success, -1 if some of those events have been forgotten
+ *
+ * Nothing is delivered if -1 is returned.  If @p after is the current
+ * sequence number, nothing is delivered and 0 is returned.  With a null @p fn
+ * this just tests whether a replay is possible.
+ */
+int eventlog_replay(unsigned long after,
+                    void (*fn)(unsigned long seq, time_t when,
+                               const char *msg, void *u),
+                    void *u);
+
 #endif /* EVENTLOG_H */
 
 /*
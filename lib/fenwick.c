@@ -0,0 +1,96 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file lib/fenwick.c @brief Weighted sampling with a Fenwick tree */
+
+#include "common.h"
+
+#include "fenwick.h"
+#include "mem.h"
+
+/** @brief Initialize a list of weights
+ * @param f Weights to initialize
+ * @param weights Initial weights, or NULL for all 0
+ * @param n Number of elements
+ *
+ * Takes time linear in @p n.
+ */
+void fenwick_init(struct fenwick *f, const unsigned long *weights, size_t n) {
+  f->n = n;
+  f->weights = xcalloc_noptr(n ? n : 1, sizeof *f->weights);
+  f->tree = xcalloc_noptr(n + 1, sizeof *f->tree);
+  f->total = 0;
+  if(!weights)
+    return;
+  memcpy(f->weights, weights, n * sizeof *weights);
+  /* Each node passes its sum on to the next node that covers it */
+  for(size_t i = 1; i <= n; ++i) {
+    const size_t j = i + (i & -i);
+
+    f->tree[i] += weights[i - 1];
+    f->total += weights[i - 1];
+    if(j <= n)
+      f->tree[j] += f->tree[i];
+  }
+}
+
+/** @brief Change the weight of an element
+ * @param f Weights
+ * @param i Element index
+ * @param weight New weight
+ */
+void fenwick_set(struct fenwick *f, size_t i, unsigned long weight) {
+  /* Unsigned arithmetic wraps, so a decrease is added as its complement */
+  const unsigned long long delta
+    = (unsigned long long)weight - f->weights[i];
+
+  f->weights[i] = weight;
+  f->total += delta;
+  for(size_t j = i + 1; j <= f->n; j += j & -j)
+    f->tree[j] += delta;
+}
+
+/** @brief Find the element at a cumulative weight
+ * @param f Weights
+ * @param r Value in [0, @c f->total)
+ * @return Index of the element whose weight covers @p r
+ *
+ * If @p r is chosen uniformly at random then each element is returned with
+ * probability proportional to its weight.  Elements with weight 0 are never
+ * returned.
+ */
+size_t fenwick_find(const struct fenwick *f, unsigned long long r) {
+  size_t pos = 0, step = 1;
+
+  while(step * 2 <= f->n)
+    step *= 2;
+  for(; step; step /= 2)
+    if(pos + step <= f->n && f->tree[pos + step] <= r) {
+      pos += step;
+      r -= f->tree[pos];
+    }
+  return pos;
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
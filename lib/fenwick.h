@@ -0,0 +1,68 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file lib/fenwick.h @brief Weighted sampling with a Fenwick tree */
+
+#ifndef FENWICK_H
+#define FENWICK_H
+
+/** @brief A list of weights supporting weighted sampling
+ *
+ * Changing a weight and finding the element at a given cumulative weight
+ * both take time logarithmic in the number of elements.
+ */
+struct fenwick {
+  /** @brief Number of elements */
+  size_t n;
+
+  /** @brief Weight of each element */
+  unsigned long *weights;
+
+  /** @brief Fenwick tree of @ref weights
+   *
+   * Element @c i (counting from 1) holds the sum of the weights of elements
+   * <tt>i-(i&-i)</tt> to <tt>i-1</tt> (counting from 0).
+   */
+  unsigned long long *tree;
+
+  /** @brief Sum of all weights */
+  unsigned long long total;
+};
+
+void fenwick_init(struct fenwick *f, const unsigned long *weights, size_t n);
+void fenwick_set(struct fenwick *f, size_t i, unsigned long weight);
+size_t fenwick_find(const struct fenwick *f, unsigned long long r);
+
+/** @brief Get the weight of an element
+ * @param f Weights
+ * @param i Element index
+ * @return Weight of element @p i
+ */
+static inline unsigned long fenwick_get(const struct fenwick *f, size_t i) {
+  return f->weights[i];
+}
+
+#endif /* FENWICK_H */
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -0,0 +1,553 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file lib/gain.c
+ * @brief Software gain
+ *
+ * These functions scale sample data in place.  They are intended to be
+ * called from audio callbacks, so they never allocate memory or block.
+ *
+ * The 16-bit and floating point kernels have SSE2 and NEON versions, used
+ * when the compiler targets those instruction sets.  They produce exactly
+ * the same results as the portable versions.  The byte-swapped 16-bit
+ * kernels swap in registers, so samples in the opposite byte order cost
+ * little more than native ones.
+ */
+
+#include "common.h"
+
+#include <math.h>
+
+#if __SSE2__
+# include <emmintrin.h>
+#endif
+#if __ARM_NEON || __ARM_NEON__
+# include <arm_neon.h>
+# define GAIN_NEON 1
+#endif
+
+#include "gain.h"
+
+/** @brief Initialize a gain
+ * @param g Gain to initialize
+ * @param db Gain in decibels
+ *
+ * @p db is clamped to the range @ref GAIN_MIN_DB to @ref GAIN_MAX_DB; the
+ * smallest value gives silence.
+ */
+void gain_init(struct gain *g, double db) {
+  double f;
+
+  if(db > GAIN_MAX_DB)
+    db = GAIN_MAX_DB;
+  if(db <= GAIN_MIN_DB) {
+    g->factor = 0;
+    g->mul = 0;
+    g->shift = 0;
+    return;
+  }
+  f = pow(10.0, db / 20.0);
+  g->factor = f;
+  /* Use the largest shift that keeps the multiplier within 16 bits, so that
+   * the vector kernels can use 16x16->32 bit multiplies. */
+  g->shift = 14;
+  while(g->shift > 0 && f * (1 << g->shift) > 32767)
+    --g->shift;
+  g->mul = (int)floor(f * (1 << g->shift) + 0.5);
+}
+
+/** @brief Scale one 16-bit sample */
+static inline int16_t gain_one_s16(int16_t s, const struct gain *g) {
+  int32_t p = (int32_t)s * g->mul;
+
+  if(g->shift)
+    p = (p + (1 << (g->shift - 1))) >> g->shift;
+  if(p > 32767)
+    return 32767;
+  if(p < -32768)
+    return -32768;
+  return p;
+}
+
+/** @brief Swap the bytes of a 16-bit sample */
+static inline int16_t gain_swap(int16_t s) {
+  uint16_t u = s;
+
+  return (int16_t)(uint16_t)((u >> 8) | (u << 8));
+}
+
+#if __SSE2__
+/** @brief Swap the bytes of eight 16-bit samples */
+static inline __m128i gain_swap_sse2(__m128i v) {
+  return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+#elif GAIN_NEON
+/** @brief Swap the bytes of eight 16-bit samples */
+static inline int16x8_t gain_swap_neon(int16x8_t v) {
+  return vreinterpretq_s16_u8(vrev16q_u8(vreinterpretq_u8_s16(v)));
+}
+#endif
+
+/** @brief Scale signed 16-bit samples
+ * @param samples Sample data
+ * @param n Number of samples
+ * @param g Gain
+ * @param swapped Nonzero if samples are byte-swapped
+ *
+ * Always inlined with a constant @p swapped, so the test disappears.
+ */
+static inline void gain_s16_body(int16_t *samples, size_t n,
+                                 const struct gain *g, int swapped) {
+#if __SSE2__
+  const __m128i mul = _mm_set1_epi16(g->mul);
+  const __m128i round = _mm_set1_epi32(g->shift ? 1 << (g->shift - 1) : 0);
+  const __m128i shift = _mm_cvtsi32_si128(g->shift);
+
+  while(n >= 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *)samples);
+    if(swapped)
+      v = gain_swap_sse2(v);
+    __m128i lo = _mm_mullo_epi16(v, mul);
+    __m128i hi = _mm_mulhi_epi16(v, mul);
+    __m128i p0 = _mm_unpacklo_epi16(lo, hi);
+    __m128i p1 = _mm_unpackhi_epi16(lo, hi);
+
+    p0 = _mm_sra_epi32(_mm_add_epi32(p0, round), shift);
+    p1 = _mm_sra_epi32(_mm_add_epi32(p1, round), shift);
+    v = _mm_packs_epi32(p0, p1);
+    if(swapped)
+      v = gain_swap_sse2(v);
+    _mm_storeu_si128((__m128i *)samples, v);
+    samples += 8;
+    n -= 8;
+  }
+#elif GAIN_NEON
+  const int16x4_t mul = vdup_n_s16(g->mul);
+  const int32x4_t shift = vdupq_n_s32(-g->shift);
+
+  while(n >= 8) {
+    int16x8_t v = vld1q_s16(samples);
+    if(swapped)
+      v = gain_swap_neon(v);
+    int32x4_t p0 = vmull_s16(vget_low_s16(v), mul);
+    int32x4_t p1 = vmull_s16(vget_high_s16(v), mul);
+
+    /* vrshlq with a negative count is a rounding right shift */
+    p0 = vrshlq_s32(p0, shift);
+    p1 = vrshlq_s32(p1, shift);
+    v = vcombine_s16(vqmovn_s32(p0), vqmovn_s32(p1));
+    if(swapped)
+      v = gain_swap_neon(v);
+    vst1q_s16(samples, v);
+    samples += 8;
+    n -= 8;
+  }
+#endif
+  while(n > 0) {
+    if(swapped)
+      *samples = gain_swap(gain_one_s16(gain_swap(*samples), g));
+    else
+      *samples = gain_one_s16(*samples, g);
+    ++samples;
+    --n;
+  }
+}
+
+/** @brief Scale native-endian signed 16-bit samples
+ * @param samples Sample data
+ * @param n Number of samples
+ * @param g Gain
+ */
+void gain_s16(int16_t *samples, size_t n, const struct gain *g) {
+  gain_s16_body(samples, n, g, 0);
+}
+
+/** @brief Scale byte-swapped signed 16-bit samples
+ * @param samples Sample data
+ * @param n Number of samples
+ * @param g Gain
+ */
+void gain_s16_swapped(int16_t *samples, size_t n, const struct gain *g) {
+  gain_s16_body(samples, n, g, 1);
+}
+
+/** @brief Copy 16-bit samples, swapping their bytes
+ * @param dst Where to put swapped samples
+ * @param src Samples to swap
+ * @param n Number of samples
+ *
+ * @p dst and @p src may be equal, but must not otherwise overlap.  This can
+ * be used to convert between native and network byte order.
+ */
+void gain_swap_s16(int16_t *dst, const int16_t *src, size_t n) {
+#if __SSE2__
+  while(n >= 8) {
+    _mm_storeu_si128((__m128i *)dst,
+                     gain_swap_sse2(_mm_loadu_si128((const __m128i *)src)));
+    dst += 8;
+    src += 8;
+    n -= 8;
+  }
+#elif GAIN_NEON
+  while(n >= 8) {
+    vst1q_s16(dst, gain_swap_neon(vld1q_s16(src)));
+    dst += 8;
+    src += 8;
+    n -= 8;
+  }
+#endif
+  while(n > 0) {
+    *dst++ = gain_swap(*src++);
+    --n;
+  }
+}
+
+/** @brief Scale unsigned 8-bit samples
+ * @param samples Sample data
+ * @param n Number of samples
+ * @param g Gain
+ */
+void gain_u8(uint8_t *samples, size_t n, const struct gain *g) {
+  while(n > 0) {
+    int32_t p = ((int32_t)*samples - 128) * g->mul;
+
+    if(g->shift)
+      p = (p + (1 << (g->shift - 1))) >> g->shift;
+    if(p > 127)
+      p = 127;
+    if(p < -128)
+      p = -128;
+    *samples++ = p + 128;
+    --n;
+  }
+}
+
+/** @brief Scale floating point samples
+ * @param samples Sample data
+ * @param n Number of samples
+ * @param g Gain
+ *
+ * No clipping is done.
+ */
+void gain_float(float *samples, size_t n, const struct gain *g) {
+#if __SSE2__
+  const __m128 f = _mm_set1_ps(g->factor);
+
+  while(n >= 4) {
+    _mm_storeu_ps(samples, _mm_mul_ps(_mm_loadu_ps(samples), f));
+    samples += 4;
+    n -= 4;
+  }
+#elif GAIN_NEON
+  while(n >= 4) {
+    vst1q_f32(samples, vmulq_n_f32(vld1q_f32(samples), g->factor));
+    samples += 4;
+    n -= 4;
+  }
+#endif
+  while(n > 0) {
+    *samples++ *= g->factor;
+    --n;
+  }
+}
+
+/** @brief Scale integer samples in any supported format
+ * @param samples Sample data
+ * @param n Number of samples
+ * @param bits Bits per sample; 8 means unsigned, 16 signed
+ * @param native Nonzero if 16-bit samples are in native byte order
+ * @param g Gain
+ */
+void gain_apply(void *samples, size_t n, int bits, int native,
+                const struct gain *g) {
+  switch(bits) {
+  case 8:
+    gain_u8(samples, n, g);
+    break;
+  case 16:
+    if(native)
+      gain_s16(samples, n, g);
+    else
+      gain_s16_swapped(samples, n, g);
+    break;
+  }
+}
+
+/** @brief Mix one pair of 16-bit samples */
+static inline int16_t gain_mix_one_s16(int16_t d, int16_t s, int a, int b) {
+  int32_t p = ((int32_t)d * a + (int32_t)s * b + GAIN_MIX_ONE / 2) >> 14;
+
+  if(p > 32767)
+    return 32767;
+  if(p < -32768)
+    return -32768;
+  return p;
+}
+
+/** @brief Mix signed 16-bit samples
+ * @param dst Samples to mix into
+ * @param src Samples to mix from
+ * @param n Number of samples
+ * @param a Weight of @p dst, 0 to @ref GAIN_MIX_ONE
+ * @param b Weight of @p src, 0 to @ref GAIN_MIX_ONE
+ * @param swapped Nonzero if samples are byte-swapped
+ *
+ * Always inlined with a constant @p swapped, so the test disappears.
+ */
+static inline void gain_mix_s16_body(int16_t *dst, const int16_t *src,
+                                     size_t n, int a, int b, int swapped) {
+#if __SSE2__
+  /* Interleave samples from dst and src, so that each 32-bit lane holds one
+   * pair; multiplying by (a,b) pairs and adding adjacent products is then
+   * exactly what PMADDWD does. */
+  const __m128i w = _mm_set1_epi32((int32_t)((uint32_t)b << 16 | (uint32_t)a));
+  const __m128i round = _mm_set1_epi32(GAIN_MIX_ONE / 2);
+
+  while(n >= 8) {
+    __m128i d = _mm_loadu_si128((const __m128i *)dst);
+    __m128i s = _mm_loadu_si128((const __m128i *)src);
+    if(swapped) {
+      d = gain_swap_sse2(d);
+      s = gain_swap_sse2(s);
+    }
+    __m128i p0 = _mm_madd_epi16(_mm_unpacklo_epi16(d, s), w);
+    __m128i p1 = _mm_madd_epi16(_mm_unpackhi_epi16(d, s), w);
+
+    p0 = _mm_srai_epi32(_mm_add_epi32(p0, round), 14);
+    p1 = _mm_srai_epi32(_mm_add_epi32(p1, round), 14);
+    d = _mm_packs_epi32(p0, p1);
+    if(swapped)
+      d = gain_swap_sse2(d);
+    _mm_storeu_si128((__m128i *)dst, d);
+    dst += 8;
+    src += 8;
+    n -= 8;
+  }
+#elif GAIN_NEON
+  while(n >= 8) {
+    int16x8_t d = vld1q_s16(dst);
+    int16x8_t s = vld1q_s16(src);
+    if(swapped) {
+      d = gain_swap_neon(d);
+      s = gain_swap_neon(s);
+    }
+    int32x4_t p0 = vmull_n_s16(vget_low_s16(d), a);
+    int32x4_t p1 = vmull_n_s16(vget_high_s16(d), a);
+
+    p0 = vmlal_n_s16(p0, vget_low_s16(s), b);
+    p1 = vmlal_n_s16(p1, vget_high_s16(s), b);
+    d = vcombine_s16(vqmovn_s32(vrshrq_n_s32(p0, 14)),
+                     vqmovn_s32(vrshrq_n_s32(p1, 14)));
+    if(swapped)
+      d = gain_swap_neon(d);
+    vst1q_s16(dst, d);
+    dst += 8;
+    src += 8;
+    n -= 8;
+  }
+#endif
+  while(n > 0) {
+    if(swapped)
+      *dst = gain_swap(gain_mix_one_s16(gain_swap(*dst), gain_swap(*src),
+                                        a, b));
+    else
+      *dst = gain_mix_one_s16(*dst, *src, a, b);
+    ++src;
+    ++dst;
+    --n;
+  }
+}
+
+/** @brief Mix native-endian signed 16-bit samples
+ * @param dst Samples to mix into
+ * @param src Samples to mix from
+ * @param n Number of samples
+ * @param a Weight of @p dst, 0 to @ref GAIN_MIX_ONE
+ * @param b Weight of @p src, 0 to @ref GAIN_MIX_ONE
+ *
+ * Each sample in @p dst becomes the weighted sum of itself and the
+ * corresponding sample of @p src, saturating if necessary.
+ */
+void gain_mix_s16(int16_t *dst, const int16_t *src, size_t n, int a, int b) {
+  gain_mix_s16_body(dst, src, n, a, b, 0);
+}
+
+/** @brief Mix byte-swapped signed 16-bit samples
+ * @param dst Samples to mix into
+ * @param src Samples to mix from
+ * @param n Number of samples
+ * @param a Weight of @p dst, 0 to @ref GAIN_MIX_ONE
+ * @param b Weight of @p src, 0 to @ref GAIN_MIX_ONE
+ */
+void gain_mix_s16_swapped(int16_t *dst, const int16_t *src, size_t n,
+                          int a, int b) {
+  gain_mix_s16_body(dst, src, n, a, b, 1);
+}
+
+/** @brief Mix unsigned 8-bit samples
+ * @param dst Samples to mix into
+ * @param src Samples to mix from
+ * @param n Number of samples
+ * @param a Weight of @p dst, 0 to @ref GAIN_MIX_ONE
+ * @param b Weight of @p src, 0 to @ref GAIN_MIX_ONE
+ */
+void gain_mix_u8(uint8_t *dst, const uint8_t *src, size_t n, int a, int b) {
+  while(n > 0) {
+    int32_t p = (((int32_t)*dst - 128) * a + ((int32_t)*src++ - 128) * b
+                 + GAIN_MIX_ONE / 2) >> 14;
+
+    if(p > 127)
+      p = 127;
+    if(p < -128)
+      p = -128;
+    *dst++ = p + 128;
+    --n;
+  }
+}
+
+/** @brief Mix integer samples in any supported format
+ * @param dst Samples to mix into
+ * @param src Samples to mix from
+ * @param n Number of samples
+ * @param bits Bits per sample; 8 means unsigned, 16 signed
+ * @param native Nonzero if 16-bit samples are in native byte order
+ * @param a Weight of @p dst, 0 to @ref GAIN_MIX_ONE
+ * @param b Weight of @p src, 0 to @ref GAIN_MIX_ONE
+ */
+void gain_mix(void *dst, const void *src, size_t n, int bits, int native,
+              int a, int b) {
+  switch(bits) {
+  case 8:
+    gain_mix_u8(dst, src, n, a, b);
+    break;
+  case 16:
+    if(native)
+      gain_mix_s16(dst, src, n, a, b);
+    else
+      gain_mix_s16_swapped(dst, src, n, a, b);
+    break;
+  }
+}
+
+/** @brief Fixed-point weights for gain_fade() */
+struct gain_weights {
+  /** @brief Weight of the destination samples */
+  int64_t a;
+
+  /** @brief Weight of the source samples */
+  int64_t b;
+
+  /** @brief Shift to apply to the weighted sum */
+  int shift;
+};
+
+/** @brief Combine gains and mixing weights
+ * @param w Where to store the combined weights
+ * @param gd Gain of @p dst
+ * @param gs Gain of @p src
+ * @param a Weight of @p dst, 0 to @ref GAIN_MIX_ONE
+ * @param b Weight of @p src, 0 to @ref GAIN_MIX_ONE
+ */
+static void gain_weights(struct gain_weights *w,
+                         const struct gain *gd, const struct gain *gs,
+                         int a, int b) {
+  const int s = gd->shift > gs->shift ? gd->shift : gs->shift;
+
+  /* At most 2^14 * 2^15 * 2^14, so the products with 16-bit samples fit
+   * comfortably in 64 bits */
+  w->a = ((int64_t)a * gd->mul) << (s - gd->shift);
+  w->b = ((int64_t)b * gs->mul) << (s - gs->shift);
+  w->shift = 14 + s;
+}
+
+/** @brief Mix one pair of samples with combined weights */
+static inline int32_t gain_fade_one(int32_t d, int32_t s,
+                                    const struct gain_weights *w) {
+  return (d * w->a + s * w->b + ((int64_t)1 << (w->shift - 1))) >> w->shift;
+}
+
+/** @brief Scale and mix integer samples in any supported format
+ * @param dst Samples to mix into
+ * @param src Samples to mix from
+ * @param n Number of samples
+ * @param bits Bits per sample; 8 means unsigned, 16 signed
+ * @param native Nonzero if 16-bit samples are in native byte order
+ * @param gd Gain to apply to @p dst
+ * @param gs Gain to apply to @p src
+ * @param a Weight of @p dst, 0 to @ref GAIN_MIX_ONE
+ * @param b Weight of @p src, 0 to @ref GAIN_MIX_ONE
+ *
+ * Equivalent to gain_apply() on both inputs followed by gain_mix(), except
+ * that each output sample is rounded only once instead of three times.  When
+ * both gains are unity it just calls gain_mix().
+ */
+void gain_fade(void *dst, const void *src, size_t n, int bits, int native,
+               const struct gain *gd, const struct gain *gs, int a, int b) {
+  struct gain_weights w;
+  int32_t p;
+
+  if(gain_is_unity(gd) && gain_is_unity(gs)) {
+    gain_mix(dst, src, n, bits, native, a, b);
+    return;
+  }
+  gain_weights(&w, gd, gs, a, b);
+  switch(bits) {
+  case 8: {
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+
+    while(n > 0) {
+      p = gain_fade_one((int32_t)*d - 128, (int32_t)*s++ - 128, &w);
+      if(p > 127)
+        p = 127;
+      if(p < -128)
+        p = -128;
+      *d++ = p + 128;
+      --n;
+    }
+    break;
+  }
+  case 16: {
+    int16_t *d = dst;
+    const int16_t *s = src;
+
+    while(n > 0) {
+      if(native)
+        p = gain_fade_one(*d, *s, &w);
+      else
+        p = gain_fade_one(gain_swap(*d), gain_swap(*s), &w);
+      if(p > 32767)
+        p = 32767;
+      if(p < -32768)
+        p = -32768;
+      *d++ = native ? p : gain_swap(p);
+      ++s;
+      --n;
+    }
+    break;
+  }
+  }
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -0,0 +1,93 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file lib/gain.h
+ * @brief Software gain
+ */
+
+#ifndef GAIN_H
+#define GAIN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** @brief Smallest gain accepted, in dB
+ *
+ * Anything quieter than this is treated as silence.
+ */
+#define GAIN_MIN_DB (-90.0)
+
+/** @brief Largest gain accepted, in dB */
+#define GAIN_MAX_DB 24.0
+
+/** @brief A precomputed gain
+ *
+ * Integer formats use a fixed-point multiplier: each sample is multiplied by
+ * @ref mul and then shifted right, with rounding, by @ref shift bits.  The
+ * result saturates rather than wrapping.
+ */
+struct gain {
+  /** @brief Linear gain factor */
+  float factor;
+
+  /** @brief Fixed-point multiplier */
+  int mul;
+
+  /** @brief Fixed-point shift */
+  int shift;
+};
+
+/** @brief Mixing weight representing unity gain
+ *
+ * See gain_mix().
+ */
+#define GAIN_MIX_ONE 16384
+
+void gain_init(struct gain *g, double db);
+
+/** @brief Return nonzero if a gain has no effect */
+static inline int gain_is_unity(const struct gain *g) {
+  return g->mul == 1 << g->shift;
+}
+
+void gain_s16(int16_t *samples, size_t n, const struct gain *g);
+void gain_s16_swapped(int16_t *samples, size_t n, const struct gain *g);
+void gain_u8(uint8_t *samples, size_t n, const struct gain *g);
+void gain_float(float *samples, size_t n, const struct gain *g);
+void gain_swap_s16(int16_t *dst, const int16_t *src, size_t n);
+void gain_apply(void *samples, size_t n, int bits, int native,
+                const struct gain *g);
+
+void gain_mix_s16(int16_t *dst, const int16_t *src, size_t n, int a, int b);
+void gain_mix_s16_swapped(int16_t *dst, const int16_t *src, size_t n,
+                          int a, int b);
+void gain_fade(void *dst, const void *src, size_t n, int bits, int native,
+               const struct gain *gd, const struct gain *gs, int a, int b);
+void gain_mix_u8(uint8_t *dst, const uint8_t *src, size_t n, int a, int b);
+void gain_mix(void *dst, const void *src, size_t n, int bits, int native,
+              int a, int b);
+
+#endif /* GAIN_H */
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
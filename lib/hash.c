@@ -1,6 +1,6 @@
 /*
  * This file is part of DisOrder
- * Copyright (C) 2005-2008 Richard Kettlewell
+ * Copyright (C) 2005-2008, 2013 Richard Kettlewell
  *
  * This program is free software: you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
@@ -17,62 +17,291 @@
  */
 /** @file lib/hash.c
  * @brief A simple hash table
+ *
+ * This is an open-addressing table using Robin Hood hashing: an entry being
+ * inserted takes the slot of any entry that is nearer its home slot, which
+ * keeps probe sequences short and lets a failed lookup stop early.
+ *
+ * When the table fills up a table twice the size is created and entries are
+ * moved across a few at a time by later insertions, so no single insertion
+ * has to rehash everything.  Until the move is complete, lookups check both
+ * tables.
+ *
+ * Keys are hashed with SipHash-1-3 under a random key, since many of them
+ * (track names, cookies, CGI arguments) come from outside.
  */
 #include "common.h"
 
+#include <stdint.h>
+
 #include "hash.h"
 #include "mem.h"
 #include "log.h"
 #include "kvp.h"
+#include "random.h"
+
+/** @brief One item in a hash table
+ *
+ * The value immediately follows the header and the key follows the value,
+ * all in one allocation.  The item never moves, so pointers returned by
+ * hash_find() stay valid as the table changes.
+ */
+struct item {
+  const char *key;                      /* key of this item */
+  union {
+    long l;
+    double d;
+    void *p;
+  } value[];                            /* value of this item */
+};
+
+/** @brief One slot in a table */
+struct slot {
+  size_t h;                             /* hash of key */
+  struct item *item;                    /* item, NULL or @ref tombstone */
+};
 
-/** @brief One entry in a hash table */
-struct entry {
-  struct entry *next;                   /* next entry same key */
-  size_t h;                             /* hash of KEY */
-  const char *key;                      /* key of this entry */
-  void *value;                          /* value of this entry */
+/** @brief One table of slots */
+struct table {
+  size_t nslots;                        /* number of slots, power of 2 */
+  struct slot *slots;                   /* table of slots */
 };
 
 /** @brief A hash table */
 struct hash {
-  size_t nslots;                        /* number of slots */
+  struct table cur;                     /* current table */
+  struct table old;                     /* table being moved out of */
+  size_t migrated;                      /* slots of @c old moved so far */
   size_t nitems;                        /* total number of entries */
-  struct entry **slots;                 /* table of slots */
   size_t valuesize;                     /* size of a value */
+  int iterating;                        /* hash_foreach() depth */
+  size_t tombstones;                    /* removed slots in @c cur */
 };
 
+/** @brief Marker for a removed item
+ *
+ * Removed items are replaced with this, rather than shuffling the table
+ * around, while the table is being iterated over, and always in the old
+ * table.  A tombstone keeps its hash so that probe distances still work.
+ */
+static struct item tombstone;
+
+/** @brief Initial number of slots */
+#define HASH_INITIAL 16
+
+/** @brief Slots of the old table to move per insertion
+ *
+ * A table grows when it is 3/4 full, and the new table has room for
+ * another 3/4 of the old table's size in entries before it grows in turn.
+ * So anything above 4/3 guarantees the move is finished by then.
+ */
+#define HASH_MIGRATE 4
+
+/** @brief Key for hashfn() */
+static uint64_t hash_key[2];
+
+/** @brief Set once @ref hash_key is set */
+static int hash_keyed;
+
+#define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND do {                                                   \
+  v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32);             \
+  v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2;                                \
+  v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0;                                \
+  v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32);             \
+} while(0)
+
 /** @brief Hash function
  * @param key Key to hash
  * @return Hash code
+ *
+ * This is SipHash-1-3 (one compression round, three finalization rounds).
  */
 static size_t hashfn(const char *key) {
-  size_t i = 0;
+  const unsigned char *p = (const unsigned char *)key;
+  const size_t len = strlen(key);
+  const unsigned char *end = p + (len & ~(size_t)7);
+  uint64_t v0 = hash_key[0] ^ 0x736f6d6570736575ULL;
+  uint64_t v1 = hash_key[1] ^ 0x646f72616e646f6dULL;
+  uint64_t v2 = hash_key[0] ^ 0x6c7967656e657261ULL;
+  uint64_t v3 = hash_key[1] ^ 0x7465646279746573ULL;
+  uint64_t m;
+  int n;
+
+  for(; p < end; p += 8) {
+    m = 0;
+    for(n = 7; n >= 0; --n)
+      m = (m << 8) | p[n];
+    v3 ^= m;
+    SIPROUND;
+    v0 ^= m;
+  }
+  m = (uint64_t)len << 56;
+  for(n = (int)(len & 7) - 1; n >= 0; --n)
+    m |= (uint64_t)p[n] << (8 * n);
+  v3 ^= m;
+  SIPROUND;
+  v0 ^= m;
+  v2 ^= 0xff;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  return (size_t)(v0 ^ v1 ^ v2 ^ v3);
+}
+
+/** @brief Create an empty table
+ * @param t Table to initialize
+ * @param nslots Number of slots (a power of 2)
+ */
+static void table_init(struct table *t, size_t nslots) {
+  t->nslots = nslots;
+  t->slots = xcalloc(nslots, sizeof *t->slots);
+}
+
+/** @brief Find a key in a table
+ * @param t Table
+ * @param n Hash of @p key
+ * @param key Key to find
+ * @return Slot index or -1 if not found
+ */
+static long table_find(const struct table *t, size_t n, const char *key) {
+  const size_t mask = t->nslots - 1;
+  size_t i = n & mask, d = 0;
+  const struct slot *s;
+
+  for(;;) {
+    s = &t->slots[i];
+    if(!s->item)
+      return -1;
+    /* Had the key been here, it would have displaced this entry */
+    if(((i - s->h) & mask) < d)
+      return -1;
+    if(s->h == n && s->item != &tombstone && !strcmp(s->item->key, key))
+      return (long)i;
+    i = (i + 1) & mask;
+    ++d;
+  }
+}
+
+/** @brief Insert an item into a table
+ * @param t Table
+ * @param n Hash of item's key
+ * @param item Item to insert, which must not be present already
+ *
+ * The table must not be full.
+ */
+static void table_insert(struct table *t, size_t n, struct item *item) {
+  const size_t mask = t->nslots - 1;
+  size_t i = n & mask, d = 0, sd;
+  struct slot *s, tmp;
+
+  for(;;) {
+    s = &t->slots[i];
+    if(!s->item) {
+      s->h = n;
+      s->item = item;
+      return;
+    }
+    /* Take the slot from any entry that is nearer home than us */
+    if((sd = (i - s->h) & mask) < d) {
+      tmp = *s;
+      s->h = n;
+      s->item = item;
+      n = tmp.h;
+      item = tmp.item;
+      d = sd;
+    }
+    i = (i + 1) & mask;
+    ++d;
+  }
+}
+
+/** @brief Remove the item in a slot from a table
+ * @param t Table
+ * @param i Slot index
+ *
+ * Later entries in the same run are moved back, so that no tombstone is
+ * needed.
+ */
+static void table_remove(struct table *t, size_t i) {
+  const size_t mask = t->nslots - 1;
+  size_t j;
+
+  for(;;) {
+    j = (i + 1) & mask;
+    if(!t->slots[j].item || ((j - t->slots[j].h) & mask) == 0)
+      break;
+    t->slots[i] = t->slots[j];
+    i = j;
+  }
+  t->slots[i].item = 0;
+}
+
+/** @brief Move some entries from the old table to the current one
+ * @param h Hash table
+ * @param count Maximum number of old slots to examine
+ *
+ * Moved slots are left in the old table; they are below @c h->migrated so
+ * lookups ignore them.
+ */
+static void migrate(hash *h, size_t count) {
+  const struct slot *s;
 
-  while(*key)
-    i = 33 * i + (unsigned char)*key++;
-  return i;
+  while(count-- > 0 && h->migrated < h->old.nslots) {
+    s = &h->old.slots[h->migrated++];
+    if(s->item && s->item != &tombstone)
+      table_insert(&h->cur, s->h, s->item);
+  }
+  if(h->old.slots && h->migrated == h->old.nslots) {
+    h->old.slots = 0;
+    h->old.nslots = 0;
+  }
 }
 
 /** @brief Expand a hash table
  * @param h Hash table to expand
+ *
+ * Entries are moved into the new table by later calls to migrate().
  */
 static void grow(hash *h) {
-  size_t n, newnslots;
-  struct entry **newslots, *e, *f;
-
-  /* Allocate a new, larger array */
-  newnslots = 2 * h->nslots;
-  newslots = xcalloc(newnslots, sizeof (struct entry *));
-  /* Copy everything to it */
-  for(n = 0; n < h->nslots; ++n) {
-    for(e = h->slots[n]; e; e = f) {
-      f = e->next;
-      e->next = newslots[e->h & (newnslots - 1)];
-      newslots[e->h & (newnslots - 1)] = e;
-    }
-  }
-  h->slots = newslots;
-  h->nslots = newnslots;
+  /* Finish any move already in progress */
+  migrate(h, h->old.nslots);
+  h->old = h->cur;
+  h->migrated = 0;
+  table_init(&h->cur, 2 * h->old.nslots);
+}
+
+/** @brief Rebuild the current table without its tombstones
+ * @param h Hash table
+ */
+static void purge(hash *h) {
+  const struct table t = h->cur;
+  size_t n;
+
+  table_init(&h->cur, t.nslots);
+  for(n = 0; n < t.nslots; ++n)
+    if(t.slots[n].item && t.slots[n].item != &tombstone)
+      table_insert(&h->cur, t.slots[n].h, t.slots[n].item);
+  h->tombstones = 0;
+}
+
+/** @brief Find a key
+ * @param h Hash table
+ * @param n Hash of @p key
+ * @param key Key to find
+ * @return Slot containing @p key or NULL if not found
+ */
+static struct slot *find(hash *h, size_t n, const char *key) {
+  long i;
+
+  if((i = table_find(&h->cur, n, key)) >= 0)
+    return &h->cur.slots[i];
+  if(h->old.slots
+     && (i = table_find(&h->old, n, key)) >= 0
+     && (size_t)i >= h->migrated)
+    return &h->old.slots[i];
+  return 0;
 }
 
 /** @brief Create a new hash table
@@ -82,8 +311,11 @@ static void grow(hash *h) {
 hash *hash_new(size_t valuesize) {
   hash *h = xmalloc(sizeof *h);
 
-  h->nslots = 256;
-  h->slots = xcalloc(h->nslots, sizeof (struct slot *));
+  if(!hash_keyed) {
+    random_get(hash_key, sizeof hash_key);
+    hash_keyed = 1;
+  }
+  table_init(&h->cur, HASH_INITIAL);
   h->valuesize = valuesize;
   return h;
 }
@@ -101,29 +333,28 @@ hash *hash_new(size_t valuesize) {
  * - @ref HASH_INSERT_OR_REPLACE - key may or may not exist
  */
 int hash_add(hash *h, const char *key, const void *value, int mode) {
-  size_t n = hashfn(key);
-  struct entry *e;
+  size_t n = hashfn(key), valuesize, keysize;
+  struct slot *s;
+  struct item *item;
   
-  for(e = h->slots[n & (h->nslots - 1)]; e; e = e->next)
-    if(e->h == n || !strcmp(e->key, key))
-      break;
-  if(e) {
+  if((s = find(h, n, key))) {
     /* This key is already present. */
     if(mode == HASH_INSERT) return -1;
-    if(value) memcpy(e->value, value, h->valuesize);
+    if(value) memcpy(s->item->value, value, h->valuesize);
     return 0;
   } else {
     /* This key is absent. */
     if(mode == HASH_REPLACE) return -1;
-    if(h->nitems >= h->nslots)          /* bound mean chain length */
+    if(4 * (h->nitems + h->tombstones + 1) > 3 * h->cur.nslots)
       grow(h);
-    e = xmalloc(sizeof *e);
-    e->next = h->slots[n & (h->nslots - 1)];
-    e->h = n;
-    e->key = xstrdup(key);
-    e->value = xmalloc(h->valuesize);
-    if(value) memcpy(e->value, value, h->valuesize);
-    h->slots[n & (h->nslots - 1)] = e;
+    migrate(h, HASH_MIGRATE);
+    valuesize = ((h->valuesize + sizeof *item->value - 1)
+                 & ~(sizeof *item->value - 1));
+    keysize = strlen(key) + 1;
+    item = xmalloc(sizeof *item + valuesize + keysize);
+    if(value) memcpy(item->value, value, h->valuesize);
+    item->key = memcpy((char *)item->value + valuesize, key, keysize);
+    table_insert(&h->cur, n, item);
     ++h->nitems;
     return 0;
   }
@@ -135,18 +366,20 @@ int hash_add(hash *h, const char *key, const void *value, int mode) {
  * @return 0 on success, -1 if the key wasn't found
  */
 int hash_remove(hash *h, const char *key) {
-  size_t n = hashfn(key);
-  struct entry *e, **ee;
+  struct slot *s;
   
-  for(ee = &h->slots[n & (h->nslots - 1)]; (e = *ee); ee = &e->next)
-    if(e->h == n || !strcmp(e->key, key))
-      break;
-  if(e) {
-    *ee = e->next;
-    --h->nitems;
-    return 0;
-  } else
+  if(!(s = find(h, hashfn(key), key)))
     return -1;
+  if(s >= h->cur.slots && s < h->cur.slots + h->cur.nslots) {
+    if(h->iterating) {
+      s->item = &tombstone;
+      ++h->tombstones;
+    } else
+      table_remove(&h->cur, s - h->cur.slots);
+  } else
+    s->item = &tombstone;
+  --h->nitems;
+  return 0;
 }
 
 /** @brief Find an item in a hash table
@@ -157,12 +390,30 @@ int hash_remove(hash *h, const char *key) {
  * The return value points inside the hash table and should not be modified.
  */
 void *hash_find(hash *h, const char *key) {
-  size_t n = hashfn(key);
-  struct entry *e;
+  struct slot *s = find(h, hashfn(key), key);
 
-  for(e = h->slots[n & (h->nslots - 1)]; e; e = e->next)
-    if(e->h == n || !strcmp(e->key, key))
-      return e->value;
+  return s ? s->item->value : 0;
+}
+
+/** @brief Visit every live slot of a table
+ * @param t Table
+ * @param start First slot to visit
+ * @param callback Function to call for each item
+ * @param u Passed to @p callback
+ * @return 0 on completion, else last return from @p callback
+ */
+static int table_foreach(const struct table *t, size_t start,
+                         int (*callback)(const char *key, void *value,
+                                         void *u),
+                         void *u) {
+  size_t n;
+  int ret;
+  struct item *item;
+
+  for(n = start; n < t->nslots; ++n)
+    if((item = t->slots[n].item) && item != &tombstone)
+      if((ret = callback(item->key, item->value, u)))
+        return ret;
   return 0;
 }
 
@@ -184,17 +435,16 @@ void *hash_find(hash *h, const char *key) {
 int hash_foreach(hash *h,
                  int (*callback)(const char *key, void *value, void *u),
                  void *u) {
-  size_t n;
+  const struct table cur = h->cur, old = h->old;
+  const size_t migrated = h->migrated;
   int ret;
-  struct entry *e, *f;
 
-  for(n = 0; n < h->nslots; ++n)
-    for(e = h->slots[n]; e; e = f) {
-      f = e->next;
-      if((ret = callback(e->key, e->value, u)))
-        return ret;
-    }
-  return 0;
+  ++h->iterating;
+  if(!(ret = table_foreach(&cur, 0, callback, u)))
+    ret = table_foreach(&old, migrated, callback, u);
+  if(!--h->iterating && h->tombstones)
+    purge(h);
+  return ret;
 }
 
 /** @brief Count the size of a hash table
@@ -216,11 +466,14 @@ size_t hash_count(hash *h) {
 char **hash_keys(hash *h) {
   size_t n;
   char **vec = xcalloc(h->nitems + 1, sizeof (char *)), **vp = vec;
-  struct entry *e;
+  const struct item *item;
 
-  for(n = 0; n < h->nslots; ++n)
-    for(e = h->slots[n]; e; e = e->next)
-      *vp++ = (char *)e->key;
+  for(n = 0; n < h->cur.nslots; ++n)
+    if((item = h->cur.slots[n].item) && item != &tombstone)
+      *vp++ = (char *)item->key;
+  for(n = h->migrated; n < h->old.nslots; ++n)
+    if((item = h->old.slots[n].item) && item != &tombstone)
+      *vp++ = (char *)item->key;
   *vp = 0;
   return vec;
 }
@@ -26,15 +26,22 @@
 /** @brief A hands-off reader
  *
  * Allows files to be read without holding them open.
+ *
+ * Regular files are read by mapping a window of the file at a time.  The
+ * descriptor is closed as soon as the window is mapped, though the mapping
+ * itself lasts until the next window is needed.  If mapping fails the
+ * reader falls back to reading into a buffer.
  */
 struct hreader {
   char *path;                   /* file to read */
   off_t size;                   /* file size */
   off_t read_offset;            /* for next hreader_read() */
   off_t buf_offset;             /* offset of start of buffer */
-  char *buffer;			/* input buffer */
+  char *buffer;			/* input buffer or mapped window */
   size_t bufsize;		/* buffer size */
   size_t bytes;			/* size of last read */
+  int mapped;                   /* nonzero if buffer is a mapping */
+  int nomap;                    /* nonzero if mapping is not possible */
 };
 
 /** @brief Initialize a hands-off reader
@@ -66,6 +73,18 @@ int hreader_read(struct hreader *h, void *buffer, size_t n);
  */
 int hreader_pread(struct hreader *h, void *buffer, size_t n, off_t offset);
 
+/** @brief Get a pointer to some bytes at a given offset
+ * @param h Reader to read from
+ * @param offset Offset to read at
+ * @param np Where to store the number of bytes available
+ * @return Pointer to bytes, or NULL on error
+ *
+ * At least one byte is available unless @p offset is at or beyond end of
+ * file, in which case @c *np is set to 0.  The bytes remain valid until the
+ * next call on @p h.  This avoids copying when the file is mapped.
+ */
+const char *hreader_peek(struct hreader *h, off_t offset, size_t *np);
+
 /** @brief Seek within a file
  * @param h Reader to seek
  * @param offset Offset
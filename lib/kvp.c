@@ -1,6 +1,6 @@
 /*
  * This file is part of DisOrder.
- * Copyright (C) 2004, 2005, 2007, 2008 Richard Kettlewell
+ * Copyright (C) 2004, 2005, 2007, 2008, 2013 Richard Kettlewell
  *
  * This program is free software: you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
@@ -204,6 +204,178 @@ char *kvp_urlencode(const struct kvp *kvp, size_t *np) {
   return d.vec;
 }
 
+/* Packed KVPs ***************************************************************/
+
+/** @brief Keys with a one-byte encoding in packed KVPs
+ *
+ * Key number @c n+1 is @c packed_keys[n].  Packed records are stored in
+ * databases, so new keys may only ever be added at the end.
+ */
+static const char *const packed_keys[] = {
+  "_alias_for",
+  "_length",
+  "_nolength",
+  "_noticed",
+  "_path",
+  "_stat",
+  "pick_at_random",
+  "played",
+  "played_time",
+  "requested",
+  "scratched",
+  "tags",
+  "weight",
+  "_words",
+  "_tagbits",
+};
+
+/** @brief Number of entries in @ref packed_keys */
+#define NPACKED_KEYS (sizeof packed_keys / sizeof *packed_keys)
+
+/** @brief First byte of a packed KVP
+ *
+ * URL-encoded data never contains a 0 byte, so this distinguishes the two
+ * encodings.
+ */
+#define PACKED_MAGIC 0
+
+/** @brief Packed KVP format version */
+#define PACKED_VERSION 1
+
+/** @brief Return true if [ptr,ptr+n) is a packed KVP */
+int kvp_is_packed(const char *ptr, size_t n) {
+  return n >= 2 && ptr[0] == PACKED_MAGIC && ptr[1] == PACKED_VERSION;
+}
+
+/** @brief Pack a KVP
+ * @param kvp Linked list to encode
+ * @param np Where to store length (or NULL)
+ * @return Newly created packed record
+ *
+ * The record starts with @ref PACKED_MAGIC and @ref PACKED_VERSION.  Each
+ * pair follows as a key byte, which is either an index into
+ * @ref packed_keys or 0 followed by a 0-terminated name, and then the
+ * value's length as a base-128 number (least significant 7 bits first),
+ * the value itself and a 0 terminator.
+ *
+ * The terminators mean that names and values can be used in place by
+ * kvp_unpack() and kvp_packed_get().
+ */
+char *kvp_pack(const struct kvp *kvp, size_t *np) {
+  struct dynstr d;
+  size_t n, len;
+
+  dynstr_init(&d);
+  dynstr_append(&d, PACKED_MAGIC);
+  dynstr_append(&d, PACKED_VERSION);
+  for(; kvp; kvp = kvp->next) {
+    for(n = 0; n < NPACKED_KEYS && strcmp(kvp->name, packed_keys[n]); ++n)
+      ;
+    if(n < NPACKED_KEYS)
+      dynstr_append(&d, n + 1);
+    else {
+      dynstr_append(&d, 0);
+      dynstr_append_bytes(&d, kvp->name, strlen(kvp->name) + 1);
+    }
+    len = strlen(kvp->value);
+    do {
+      dynstr_append(&d, (len & 127) | (len > 127 ? 128 : 0));
+      len >>= 7;
+    } while(len);
+    dynstr_append_bytes(&d, kvp->value, strlen(kvp->value) + 1);
+  }
+  if(np)
+    *np = d.nvec;
+  return d.vec;
+}
+
+/** @brief Find the next pair in a packed KVP
+ * @param ptrp Current position, updated to the following pair
+ * @param top End of record
+ * @param namep Where to store name
+ * @param valuep Where to store value
+ * @return 0 on success, non-0 at the end of the record or on error
+ */
+static int packed_next(const char **ptrp, const char *top,
+                       const char **namep, const char **valuep) {
+  const char *ptr = *ptrp, *nul;
+  unsigned char key;
+  size_t len = 0;
+  int shift = 0;
+
+  if(ptr >= top)
+    return -1;
+  key = *ptr++;
+  if(key) {
+    if(key > NPACKED_KEYS)
+      return -1;
+    *namep = packed_keys[key - 1];
+  } else {
+    if(!(nul = memchr(ptr, 0, top - ptr)))
+      return -1;
+    *namep = ptr;
+    ptr = nul + 1;
+  }
+  do {
+    if(ptr >= top || shift >= 35)
+      return -1;
+    len |= (size_t)(*ptr & 127) << shift;
+    shift += 7;
+  } while(*ptr++ & 128);
+  if(len >= (size_t)(top - ptr) || ptr[len])
+    return -1;
+  *valuep = ptr;
+  *ptrp = ptr + len + 1;
+  return 0;
+}
+
+/** @brief Decode a stored KVP in either encoding
+ * @param ptr Start of record
+ * @param n Length of record
+ * @return @ref kvp of values from input
+ *
+ * If the record is packed then the names and values in the result point into
+ * [ptr,ptr+n) (or at static strings), so the record must outlive the KVP.
+ * Otherwise this is the same as kvp_urldecode().
+ */
+struct kvp *kvp_unpack(const char *ptr, size_t n) {
+  struct kvp *kvp, **kk = &kvp, *k;
+  const char *const top = ptr + n, *name, *value;
+
+  if(!kvp_is_packed(ptr, n))
+    return kvp_urldecode(ptr, n);
+  ptr += 2;
+  while(!packed_next(&ptr, top, &name, &value)) {
+    *kk = k = xmalloc(sizeof *k);
+    k->name = name;
+    k->value = value;
+    kk = &k->next;
+  }
+  *kk = 0;
+  return kvp;
+}
+
+/** @brief Look up one value in a stored KVP
+ * @param ptr Start of record
+ * @param n Length of record
+ * @param name Key to search for
+ * @return Value or NULL
+ *
+ * Equivalent to kvp_get(kvp_unpack(ptr, n), name), but for packed records
+ * nothing is allocated and the result points into [ptr,ptr+n).
+ */
+const char *kvp_packed_get(const char *ptr, size_t n, const char *name) {
+  const char *const top = ptr + n, *kname, *value;
+
+  if(!kvp_is_packed(ptr, n))
+    return kvp_get(kvp_urldecode(ptr, n), name);
+  ptr += 2;
+  while(!packed_next(&ptr, top, &kname, &value))
+    if(!strcmp(kname, name))
+      return value;
+  return 0;
+}
+
 /** @brief Set or remove a value in a @ref kvp
  * @param kvpp Address of KVP head to modify
  * @param name Key to search for
@@ -259,6 +431,86 @@ const char *kvp_get(const struct kvp *kvp, const char *name) {
   return kvp ? kvp->value : 0;
 }
 
+/** @brief Lists shorter than this are searched directly by kvp_index_get()
+ *
+ * Sorting costs more than a few linear searches of a short list.
+ */
+#define KVP_INDEX_MIN 16
+
+/** @brief One entry in a @ref kvp_index */
+struct kvp_index_entry {
+  /** @brief Name */
+  const char *name;
+
+  /** @brief Value */
+  const char *value;
+
+  /** @brief Position in the list, so that the first of duplicates wins */
+  size_t position;
+};
+
+/** @brief Order index entries by name and then position */
+static int kvp_index_compare(const void *av, const void *bv) {
+  const struct kvp_index_entry *a = av, *b = bv;
+  int c;
+
+  if((c = strcmp(a->name, b->name)))
+    return c;
+  return a->position < b->position ? -1 : a->position > b->position;
+}
+
+/** @brief Index a KVP for repeated lookups
+ * @param ki Index to initialize
+ * @param kvp Head of KVP linked list
+ *
+ * Use kvp_index_get() to look up values.  @p kvp must not be modified
+ * while @p ki is in use.
+ */
+void kvp_index_init(struct kvp_index *ki, const struct kvp *kvp) {
+  const struct kvp *k;
+  size_t n;
+
+  ki->kvp = kvp;
+  ki->entries = 0;
+  for(n = 0, k = kvp; k; k = k->next)
+    ++n;
+  ki->n = n;
+  if(n < KVP_INDEX_MIN)
+    return;
+  ki->entries = xcalloc(n, sizeof *ki->entries);
+  for(n = 0, k = kvp; k; k = k->next, ++n) {
+    ki->entries[n].name = k->name;
+    ki->entries[n].value = k->value;
+    ki->entries[n].position = n;
+  }
+  qsort(ki->entries, n, sizeof *ki->entries, kvp_index_compare);
+}
+
+/** @brief Look up a value in an indexed KVP
+ * @param ki Index from kvp_index_init()
+ * @param name Key to search for
+ * @return Value or NULL
+ *
+ * The result is the same as kvp_get() would give.
+ */
+const char *kvp_index_get(const struct kvp_index *ki, const char *name) {
+  size_t lo = 0, hi = ki->n, mid;
+
+  if(!ki->entries)
+    return kvp_get(ki->kvp, name);
+  /* Find the first entry not before @p name */
+  while(lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if(strcmp(ki->entries[mid].name, name) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if(lo < ki->n && !strcmp(ki->entries[lo].name, name))
+    return ki->entries[lo].value;
+  return 0;
+}
+
 /** @brief Construct a KVP from arguments
  * @param name First name
  * @return Newly created KVP
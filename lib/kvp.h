@@ -50,6 +50,16 @@ char *kvp_urlencode(const struct kvp *kvp, size_t *np);
 /* url-encode @kvp@ into a null-terminated string.  If @np@ is not
  * null return the length thru it. */
 
+char *kvp_pack(const struct kvp *kvp, size_t *np);
+/* pack @kvp@ into the compact binary encoding.  If @np@ is not null return
+ * the length thru it. */
+
+struct kvp *kvp_unpack(const char *ptr, size_t n);
+/* decode [ptr,ptr+n), which may be packed or url-encoded */
+
+int kvp_is_packed(const char *ptr, size_t n);
+const char *kvp_packed_get(const char *ptr, size_t n, const char *name);
+
 int kvp_set(struct kvp **kvpp, const char *name, const char *value);
 /* set @name@ to @value@.  If @value@ is 0, remove @name@.
  * Returns 1 if we made a real change, else 0. */
@@ -57,6 +67,31 @@ int kvp_set(struct kvp **kvpp, const char *name, const char *value);
 const char *kvp_get(const struct kvp *kvp, const char *name);
 /* Get the value of @name@ */
 
+struct kvp_index_entry;
+
+/** @brief Index for repeated lookups in a @ref kvp
+ *
+ * Long lists are sorted by name so that kvp_index_get() can use a binary
+ * search; short ones are just searched directly.  The index refers to the
+ * list, which must not be changed while the index is in use.
+ */
+struct kvp_index {
+  /** @brief List being indexed */
+  const struct kvp *kvp;
+
+  /** @brief Entries sorted by name, or NULL to search @ref kvp directly */
+  struct kvp_index_entry *entries;
+
+  /** @brief Number of entries in @ref kvp */
+  size_t n;
+};
+
+void kvp_index_init(struct kvp_index *ki, const struct kvp *kvp);
+/* Index @kvp@ for lookup with kvp_index_get() */
+
+const char *kvp_index_get(const struct kvp_index *ki, const char *name);
+/* Get the value of @name@, as kvp_get() would */
+
 int urldecode(struct sink *sink, const char *ptr, size_t n);
 /* url-decode the @n@ bytes at @ptr@, writing the results to @s@.
  * Return 0 on success, -1 on error. */
@@ -0,0 +1,239 @@
+/*
+ * This file is part of DisOrder
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file lib/logring.c
+ * @brief Non-blocking logging for realtime threads
+ *
+ * disorder_info() and friends may block, for instance on syslog or a stalled
+ * stderr.  That is fine for most threads but not for the audio callback and
+ * its friends.  Those use logring_info() and logring_error() instead, which
+ * format the message into a ring buffer and return at once.  A separate
+ * thread, started by logring_start(), takes messages from the ring and logs
+ * them normally.
+ *
+ * The ring is a bounded multi-producer queue.  Each slot carries a sequence
+ * number that says whether it is free for the writer whose turn it is, or
+ * full and waiting for the reader.  It starts out all zeros, so messages can
+ * be written before the reader has been started.  No locks are taken and
+ * nothing is allocated on the writing side.
+ *
+ * At most @ref LOGRING_RATE messages a second are accepted.  Messages beyond
+ * that, or that find the ring full, are counted and discarded, and the count
+ * is logged in their place.
+ */
+#include "common.h"
+
+#include <pthread.h>
+#include <time.h>
+
+#include "log.h"
+#include "logring.h"
+#include "printf.h"
+
+/** @brief Number of slots in the ring */
+#define LOGRING_SLOTS 64
+
+/** @brief Maximum length of a message */
+#define LOGRING_MESSAGE 256
+
+/** @brief Maximum number of messages accepted per second */
+#define LOGRING_RATE 10
+
+/** @brief How often the ring is emptied, in nanoseconds */
+#define LOGRING_INTERVAL 100000000
+
+/** @brief One slot in the ring */
+struct logring_slot {
+  /** @brief Sequence number
+   *
+   * Position @c n uses this slot in round <tt>r = n / LOGRING_SLOTS</tt>.
+   * The slot is free for that position's writer when this is @c 2r, and
+   * holds its message for the reader when it is @c 2r+1.
+   */
+  size_t seq;
+
+  /** @brief Set for an error, clear for information */
+  int error;
+
+  /** @brief @c errno value for an error or 0 */
+  int errno_value;
+
+  /** @brief Message text */
+  char text[LOGRING_MESSAGE];
+};
+
+/** @brief The ring */
+static struct logring_slot logring[LOGRING_SLOTS];
+
+/** @brief Next position to write */
+static size_t logring_head;
+
+/** @brief Next position to read (reader thread only) */
+static size_t logring_tail;
+
+/** @brief Number of messages discarded since the last report */
+static unsigned long logring_suppressed;
+
+/** @brief Second to which @ref logring_count applies */
+static time_t logring_window;
+
+/** @brief Messages accepted during @ref logring_window */
+static unsigned logring_count;
+
+/** @brief Set once the reader thread is running */
+static int logring_started;
+
+/** @brief Decide whether to accept a message
+ * @return Nonzero to accept it
+ */
+static int logring_admit(void) {
+  struct timespec now;
+  time_t window;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  window = __atomic_load_n(&logring_window, __ATOMIC_RELAXED);
+  if(now.tv_sec != window
+     && __atomic_compare_exchange_n(&logring_window, &window, now.tv_sec, 0,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    __atomic_store_n(&logring_count, 0, __ATOMIC_RELAXED);
+  return (__atomic_fetch_add(&logring_count, 1, __ATOMIC_RELAXED)
+          < LOGRING_RATE);
+}
+
+/** @brief Add a message to the ring
+ * @param error Nonzero for an error
+ * @param errno_value @c errno value or 0
+ * @param msg Format string
+ * @param ap Arguments
+ */
+static void logring_vadd(int error, int errno_value,
+                         const char *msg, va_list ap) {
+  struct logring_slot *slot;
+  size_t pos, seq, round;
+
+  if(!logring_admit())
+    goto discard;
+  pos = __atomic_load_n(&logring_head, __ATOMIC_RELAXED);
+  for(;;) {
+    slot = &logring[pos % LOGRING_SLOTS];
+    round = pos / LOGRING_SLOTS;
+    seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if(seq == 2 * round) {
+      /* The slot is free; try to claim it */
+      if(__atomic_compare_exchange_n(&logring_head, &pos, pos + 1, 1,
+                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+      /* Someone else got it; pos now says where to try next */
+    } else if(seq < 2 * round)
+      /* The slot still holds a message from last time round */
+      goto discard;
+    else
+      pos = __atomic_load_n(&logring_head, __ATOMIC_RELAXED);
+  }
+  slot->error = error;
+  slot->errno_value = errno_value;
+  byte_vsnprintf(slot->text, sizeof slot->text, msg, ap);
+  __atomic_store_n(&slot->seq, 2 * round + 1, __ATOMIC_RELEASE);
+  return;
+discard:
+  __atomic_add_fetch(&logring_suppressed, 1, __ATOMIC_RELAXED);
+}
+
+/** @brief Log a message without blocking
+ * @param msg Format string
+ * @param ... Arguments
+ */
+void logring_info(const char *msg, ...) {
+  va_list ap;
+
+  va_start(ap, msg);
+  logring_vadd(0, 0, msg, ap);
+  va_end(ap);
+}
+
+/** @brief Log an error without blocking
+ * @param errno_value @c errno value or 0
+ * @param msg Format string
+ * @param ... Arguments
+ */
+void logring_error(int errno_value, const char *msg, ...) {
+  va_list ap;
+
+  va_start(ap, msg);
+  logring_vadd(1, errno_value, msg, ap);
+  va_end(ap);
+}
+
+/** @brief Log everything in the ring */
+static void logring_drain(void) {
+  struct logring_slot *slot;
+  unsigned long suppressed;
+  size_t round;
+
+  for(;;) {
+    slot = &logring[logring_tail % LOGRING_SLOTS];
+    round = logring_tail / LOGRING_SLOTS;
+    if(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != 2 * round + 1)
+      break;
+    if(slot->error)
+      disorder_error(slot->errno_value, "%s", slot->text);
+    else
+      disorder_info("%s", slot->text);
+    __atomic_store_n(&slot->seq, 2 * round + 2, __ATOMIC_RELEASE);
+    ++logring_tail;
+  }
+  if((suppressed = __atomic_exchange_n(&logring_suppressed, 0,
+                                       __ATOMIC_RELAXED)))
+    disorder_info("%lu log messages suppressed", suppressed);
+}
+
+/** @brief Reader thread */
+static void *logring_thread(void attribute((unused)) *arg) {
+  const struct timespec interval = { 0, LOGRING_INTERVAL };
+
+  for(;;) {
+    logring_drain();
+    nanosleep(&interval, NULL);
+  }
+  return NULL;
+}
+
+/** @brief Start logging messages from the ring
+ *
+ * Must be called from an ordinary thread.  Messages logged before it is
+ * called wait in the ring.  Does nothing if already called.
+ */
+void logring_start(void) {
+  pthread_t id;
+  int e;
+
+  if(logring_started)
+    return;
+  if((e = pthread_create(&id, NULL, logring_thread, NULL)))
+    disorder_fatal(e, "pthread_create");
+  pthread_detach(id);
+  logring_started = 1;
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
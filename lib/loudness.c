@@ -0,0 +1,180 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file lib/loudness.c
+ * @brief Loudness measurement
+ *
+ * Integrated loudness as defined by ITU-R BS.1770 and EBU R128: the signal
+ * is K-weighted, its mean square taken over 400ms blocks overlapping by 75%,
+ * and the blocks averaged with an absolute gate at -70LUFS and a relative
+ * gate 10LU below the absolutely-gated average.
+ *
+ * Blocks are kept in a histogram rather than a list, so memory use does not
+ * depend on the length of the track.  This limits the relative gate to the
+ * resolution of the histogram, 0.1LU.
+ */
+#include "common.h"
+
+#include <math.h>
+
+#include "loudness.h"
+
+/** @brief Initialize a loudness measurement
+ * @param l Measurement
+ * @param rate Sample rate
+ * @param channels Number of channels (1 or 2)
+ *
+ * The filter coefficients in BS.1770 are given for 48KHz only.  Here they
+ * are derived from the analogue prototypes, so any rate can be used.
+ */
+void loudness_init(struct loudness *l, int rate, int channels) {
+  double K, Vh, Vb, a0;
+  /* Pre-filter: high shelf, about +4dB above 1.5KHz */
+  const double f1 = 1681.974450955533, G1 = 3.999843853973347,
+    Q1 = 0.7071752369554196;
+  /* RLB weighting: high pass at about 38Hz */
+  const double f2 = 38.13547087602444, Q2 = 0.5003270373238773;
+
+  memset(l, 0, sizeof *l);
+  l->channels = channels;
+  l->subframes = rate / 10;
+  K = tan(M_PI * f1 / rate);
+  Vh = pow(10.0, G1 / 20);
+  Vb = pow(Vh, 0.4996667741545416);
+  a0 = 1 + K / Q1 + K * K;
+  l->stage[0].b0 = (Vh + Vb * K / Q1 + K * K) / a0;
+  l->stage[0].b1 = 2 * (K * K - Vh) / a0;
+  l->stage[0].b2 = (Vh - Vb * K / Q1 + K * K) / a0;
+  l->stage[0].a1 = 2 * (K * K - 1) / a0;
+  l->stage[0].a2 = (1 - K / Q1 + K * K) / a0;
+  K = tan(M_PI * f2 / rate);
+  a0 = 1 + K / Q2 + K * K;
+  l->stage[1].b0 = 1;
+  l->stage[1].b1 = -2;
+  l->stage[1].b2 = 1;
+  l->stage[1].a1 = 2 * (K * K - 1) / a0;
+  l->stage[1].a2 = (1 - K / Q2 + K * K) / a0;
+}
+
+/** @brief Pass a sample through a filter stage
+ * @param f Filter stage
+ * @param z Filter state (transposed direct form II)
+ * @param x Input sample
+ * @return Output sample
+ */
+static inline double loudness_filter(const struct loudness_biquad *f,
+                                     double z[2], double x) {
+  const double y = f->b0 * x + z[0];
+
+  z[0] = f->b1 * x - f->a1 * y + z[1];
+  z[1] = f->b2 * x - f->a2 * y;
+  return y;
+}
+
+/** @brief Finish a sub-block, and a gating block if there are enough */
+static void loudness_block(struct loudness *l) {
+  double z;
+  int bin;
+
+  l->recent[l->nsub++ % 4] = l->sum / l->subframes;
+  l->sum = 0;
+  l->fill = 0;
+  if(l->nsub < 4)
+    return;
+  z = (l->recent[0] + l->recent[1] + l->recent[2] + l->recent[3]) / 4;
+  if(z <= 0)
+    return;
+  bin = (int)floor((-0.691 + 10 * log10(z) - LOUDNESS_MIN)
+                   * LOUDNESS_BINS_PER_LU);
+  if(bin < 0)
+    return;                             /* below the absolute gate */
+  if(bin >= LOUDNESS_BINS)
+    bin = LOUDNESS_BINS - 1;
+  ++l->count[bin];
+  l->energy[bin] += z;
+}
+
+/** @brief Add samples to a loudness measurement
+ * @param l Measurement
+ * @param samples Interleaved 16-bit signed samples
+ * @param nframes Number of frames
+ * @param swapped Nonzero if @p samples are in the opposite byte order
+ */
+void loudness_add(struct loudness *l, const int16_t *samples, size_t nframes,
+                  int swapped) {
+  double x;
+  uint16_t u;
+  int c;
+
+  while(nframes-- > 0) {
+    for(c = 0; c < l->channels; ++c) {
+      u = (uint16_t)*samples++;
+      if(swapped)
+        u = (uint16_t)(u << 8 | u >> 8);
+      x = (int16_t)u / 32768.0;
+      x = loudness_filter(&l->stage[0], l->z[c][0], x);
+      x = loudness_filter(&l->stage[1], l->z[c][1], x);
+      /* Left and right both have weight 1 */
+      l->sum += x * x;
+    }
+    if(++l->fill == l->subframes)
+      loudness_block(l);
+  }
+}
+
+/** @brief Get the result of a loudness measurement
+ * @param l Measurement
+ * @param centilufs Where to store the integrated loudness, in hundredths of
+ * a LUFS
+ * @return 0 on success, -1 if there was nothing above the absolute gate
+ */
+int loudness_result(const struct loudness *l, long *centilufs) {
+  unsigned long count = 0;
+  double energy = 0, gate;
+  int n, first;
+
+  for(n = 0; n < LOUDNESS_BINS; ++n) {
+    count += l->count[n];
+    energy += l->energy[n];
+  }
+  if(!count)
+    return -1;
+  /* The relative gate is 10LU below the absolutely-gated loudness */
+  gate = -0.691 + 10 * log10(energy / count) - 10;
+  first = (int)floor((gate - LOUDNESS_MIN) * LOUDNESS_BINS_PER_LU);
+  if(first < 0)
+    first = 0;
+  count = 0;
+  energy = 0;
+  for(n = first; n < LOUDNESS_BINS; ++n) {
+    count += l->count[n];
+    energy += l->energy[n];
+  }
+  if(!count)
+    return -1;
+  *centilufs = lround(100 * (-0.691 + 10 * log10(energy / count)));
+  return 0;
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
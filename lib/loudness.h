@@ -0,0 +1,93 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file lib/loudness.h
+ * @brief Loudness measurement
+ */
+
+#ifndef LOUDNESS_H
+#define LOUDNESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** @brief Quietest block counted, in LUFS (the absolute gate) */
+#define LOUDNESS_MIN (-70)
+
+/** @brief Loudest block distinguished, in LUFS */
+#define LOUDNESS_MAX 5
+
+/** @brief Histogram bins per LU */
+#define LOUDNESS_BINS_PER_LU 10
+
+/** @brief Number of histogram bins */
+#define LOUDNESS_BINS ((LOUDNESS_MAX - LOUDNESS_MIN) * LOUDNESS_BINS_PER_LU)
+
+/** @brief A biquad filter stage */
+struct loudness_biquad {
+  /** @brief Coefficients */
+  double b0, b1, b2, a1, a2;
+};
+
+/** @brief State for measuring the loudness of one track */
+struct loudness {
+  /** @brief Number of channels (1 or 2) */
+  int channels;
+
+  /** @brief Frames per 100ms sub-block */
+  size_t subframes;
+
+  /** @brief Frames in the current sub-block so far */
+  size_t fill;
+
+  /** @brief Filter stages (pre-filter and RLB high-pass) */
+  struct loudness_biquad stage[2];
+
+  /** @brief Filter state, two values per stage per channel */
+  double z[2][2][2];
+
+  /** @brief Weighted sum of squares for the current sub-block */
+  double sum;
+
+  /** @brief Mean squares of the last four sub-blocks */
+  double recent[4];
+
+  /** @brief Number of sub-blocks so far */
+  unsigned long nsub;
+
+  /** @brief Number of gating blocks in each bin */
+  unsigned long count[LOUDNESS_BINS];
+
+  /** @brief Total mean square of the gating blocks in each bin */
+  double energy[LOUDNESS_BINS];
+};
+
+void loudness_init(struct loudness *l, int rate, int channels);
+void loudness_add(struct loudness *l, const int16_t *samples, size_t nframes,
+                  int swapped);
+int loudness_result(const struct loudness *l, long *centilufs);
+
+#endif /* LOUDNESS_H */
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -37,6 +37,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <dirent.h>
 
 #include "log.h"
 #include "hash.h"
@@ -458,6 +459,34 @@ void mx_search_path(const char *s) {
   vector_append(&include_path, xstrdup(s));
 }
 
+/** @brief Parse every template in the search path
+ *
+ * Used by long-lived processes so that later expansions (including those in
+ * forked children) find the parse trees ready.  Directories that can't be
+ * read are skipped.
+ */
+void mx_preload(void) {
+  DIR *dp;
+  struct dirent *de;
+  const char *found;
+  size_t l;
+  int n;
+
+  for(n = 0; n < include_path.nvec; ++n) {
+    if(!(dp = opendir(include_path.vec[n])))
+      continue;
+    while((de = readdir(dp))) {
+      l = strlen(de->d_name);
+      if(l < 5 || strcmp(de->d_name + l - 5, ".tmpl"))
+        continue;
+      /* Earlier directories take precedence */
+      if((found = mx_find(de->d_name, 0/*report*/)))
+        mx_parse_file(found);
+    }
+    closedir(dp);
+  }
+}
+
 /*
 Local Variables:
 c-basic-offset:2
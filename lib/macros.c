@@ -527,23 +527,55 @@ int mx_expandstr(const struct mx_node *m,
   return rc;
 }
 
-/** @brief Expand a template file
+/** @brief A parsed template file */
+struct mx_file {
+  /** @brief Device containing file */
+  dev_t dev;
+  /** @brief Inode number */
+  ino_t ino;
+  /** @brief Size of file */
+  off_t size;
+  /** @brief Modification time */
+  time_t mtime;
+  /** @brief Inode change time */
+  time_t ctime;
+  /** @brief Parse tree */
+  const struct mx_node *m;
+};
+
+/** @brief Parsed template files, keyed by filename */
+static hash *mx_files;
+
+/** @brief Return true if @p f is up to date with respect to @p sb */
+static int mx_file_current(const struct mx_file *f, const struct stat *sb) {
+  return f
+    && f->dev == sb->st_dev
+    && f->ino == sb->st_ino
+    && f->size == sb->st_size
+    && f->mtime == sb->st_mtime
+    && f->ctime == sb->st_ctime;
+}
+
+/** @brief Parse a template file
  * @param path Filename
- * @param output Where to send output
- * @param u User data
- * @return 0 on success, non-0 on error
+ * @return Parse tree
  *
- * Same return conventions as mx_expand().
+ * Parse trees are kept and reused until the file changes, so that processes
+ * that expand the same templates repeatedly (including included ones) only
+ * read and parse them once.  A cached parse tree costs a stat() to check.
  */
-int mx_expand_file(const char *path,
-                   struct sink *output,
-                   void *u) {
-  int fd, n, rc;
+const struct mx_node *mx_parse_file(const char *path) {
+  int fd, n;
   struct stat sb;
   char *b;
   off_t sofar;
-  const struct mx_node *m;
+  struct mx_file *f;
 
+  if(!mx_files)
+    mx_files = hash_new(sizeof (struct mx_file));
+  f = hash_find(mx_files, path);
+  if(f && stat(path, &sb) == 0 && mx_file_current(f, &sb))
+    return f->m;
   if((fd = open(path, O_RDONLY)) < 0)
     disorder_fatal(errno, "error opening %s", path);
   if(fstat(fd, &sb) < 0)
@@ -562,8 +594,33 @@ int mx_expand_file(const char *path,
       disorder_fatal(errno, "error reading %s", path);
   }
   xclose(fd);
-  m = mx_parse(path, 1, b, b + sb.st_size);
-  rc = mx_expand(m, output, u);
+  if(!f) {
+    hash_add(mx_files, path, 0, HASH_INSERT);
+    f = hash_find(mx_files, path);
+  }
+  f->dev = sb.st_dev;
+  f->ino = sb.st_ino;
+  f->size = sb.st_size;
+  f->mtime = sb.st_mtime;
+  f->ctime = sb.st_ctime;
+  f->m = mx_parse(path, 1, b, b + sb.st_size);
+  return f->m;
+}
+
+/** @brief Expand a template file
+ * @param path Filename
+ * @param output Where to send output
+ * @param u User data
+ * @return 0 on success, non-0 on error
+ *
+ * Same return conventions as mx_expand().
+ */
+int mx_expand_file(const char *path,
+                   struct sink *output,
+                   void *u) {
+  int rc;
+
+  rc = mx_expand(mx_parse_file(path), output, u);
   if(rc && rc != -1)
     /* Mention inclusion in backtrace */
     disorder_error(0, "  ...in inclusion of file '%s'", path);
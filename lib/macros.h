@@ -104,8 +104,10 @@ int mx_register_macro(const char *name,
 
 void mx_register_builtin(void);
 void mx_search_path(const char *s);
+void mx_preload(void);
 char *mx_find(const char *name, int report);
 
+const struct mx_node *mx_parse_file(const char *path);
 int mx_expand_file(const char *path,
                    struct sink *output,
                    void *u);
@@ -25,6 +25,11 @@
 #include <gc.h>
 #endif
 #include <errno.h>
+#include <time.h>
+#if MEM_PROFILE
+#include <stdint.h>
+#include <unistd.h>
+#endif
 
 #include "mem.h"
 #include "log.h"
@@ -55,13 +60,195 @@ static void *(*do_malloc_atomic)(size_t) = malloc;
 static void (*do_free)(void *) = free;
 #endif
 
+#if MEM_PROFILE
+/** @brief Maximum number of distinct call sites recorded
+ *
+ * Must be a power of 2.  Allocations from sites that don't fit are
+ * accounted to a null site.
+ */
+#define MEM_SITES 4096
+
+/** @brief Allocation statistics for one call site */
+struct mem_site {
+  /** @brief Return address of the allocation call, or NULL if unused */
+  void *site;
+
+  /** @brief Number of allocations */
+  unsigned long count;
+
+  /** @brief Total bytes allocated */
+  unsigned long long bytes;
+};
+
+/** @brief Call site table, hashed on the return address
+ *
+ * This is static so that recording an allocation never allocates.
+ */
+static struct mem_site mem_sites[MEM_SITES];
+
+/** @brief Statistics for allocations that didn't fit in @ref mem_sites */
+static struct mem_site mem_overflow;
+
+/** @brief Record an allocation
+ * @param site Return address of the allocation function
+ * @param n Bytes allocated
+ *
+ * Safe to call from multiple threads.
+ */
+static void mem_record(void *site, size_t n) {
+  size_t h = ((uintptr_t)site >> 2) * 2654435761u, i;
+  struct mem_site *s;
+  void *old;
+
+  for(i = 0; i < MEM_SITES; ++i) {
+    s = &mem_sites[(h + i) & (MEM_SITES - 1)];
+    if(s->site != site) {
+      if(s->site)
+        continue;
+      old = __sync_val_compare_and_swap(&s->site, NULL, site);
+      if(old && old != site)
+        continue;
+    }
+    __sync_fetch_and_add(&s->count, 1);
+    __sync_fetch_and_add(&s->bytes, n);
+    return;
+  }
+  __sync_fetch_and_add(&mem_overflow.count, 1);
+  __sync_fetch_and_add(&mem_overflow.bytes, n);
+}
+
+/** @brief Order call sites by decreasing bytes allocated */
+static int mem_site_compare(const void *av, const void *bv) {
+  const struct mem_site *a = *(const struct mem_site *const *)av;
+  const struct mem_site *b = *(const struct mem_site *const *)bv;
+
+  if(a->bytes != b->bytes)
+    return a->bytes > b->bytes ? -1 : 1;
+  if(a->count != b->count)
+    return a->count > b->count ? -1 : 1;
+  return 0;
+}
+
+/** @brief Start of the executable
+ *
+ * Defined by the GNU linker.  Reporting sites relative to this makes the
+ * offsets suitable for @c addr2line even in position-independent
+ * executables.
+ */
+extern const char __executable_start[];
+
+/** @brief Write an allocation report
+ * @param fp Where to write the report
+ *
+ * Lists every call site that has allocated memory, biggest first, with its
+ * address and its offset from the start of the executable.  Pass the
+ * offsets to <tt>addr2line -f -e PROGRAM</tt> to find the callers.
+ */
+void mem_report(FILE *fp) {
+  static struct mem_site *sorted[MEM_SITES];
+  size_t n, nsorted = 0;
+  unsigned long long total = 0;
+
+  for(n = 0; n < MEM_SITES; ++n)
+    if(mem_sites[n].site) {
+      sorted[nsorted++] = &mem_sites[n];
+      total += mem_sites[n].bytes;
+    }
+  qsort(sorted, nsorted, sizeof *sorted, mem_site_compare);
+  fprintf(fp, "# allocation profile for %s[%lu]: %zu sites, %llu bytes\n",
+          progname ? progname : "?", (unsigned long)getpid(), nsorted,
+          total + mem_overflow.bytes);
+  fprintf(fp, "# count bytes address offset\n");
+  for(n = 0; n < nsorted; ++n)
+    fprintf(fp, "%lu %llu %p %#lx\n",
+            sorted[n]->count, sorted[n]->bytes, sorted[n]->site,
+            (unsigned long)((const char *)sorted[n]->site
+                            - __executable_start));
+  if(mem_overflow.count)
+    fprintf(fp, "%lu %llu other -\n", mem_overflow.count, mem_overflow.bytes);
+  fflush(fp);
+}
+
+/** @brief Append an allocation report to @c ${DISORDER_MEM_PROFILE}
+ *
+ * Does nothing if the environment variable is not set.  Called at exit,
+ * and by the server on @c SIGUSR1.
+ */
+void mem_report_file(void) {
+  const char *path = getenv("DISORDER_MEM_PROFILE");
+  FILE *fp;
+
+  if(!path || !*path)
+    return;
+  if(!(fp = fopen(path, "a"))) {
+    disorder_error(errno, "error opening %s", path);
+    return;
+  }
+  mem_report(fp);
+  if(fclose(fp) < 0)
+    disorder_error(errno, "error writing %s", path);
+}
+
+# define MEM_RECORD(n) mem_record(__builtin_return_address(0), (n))
+#else
+# define MEM_RECORD(n) ((void)0)
+#endif
+
+#if GC && HAVE_GC_SET_ON_COLLECTION_EVENT
+/** @brief When the current collection started */
+static struct timespec mem_gc_started;
+
+/** @brief Total time spent in collections, in microseconds */
+static unsigned long long mem_gc_us;
+
+/** @brief Longest collection, in microseconds */
+static unsigned long long mem_gc_max_us;
+
+/** @brief Called by the collector at each stage of a collection
+ * @param e Stage
+ *
+ * The collector's lock is held, so this must not allocate.
+ */
+static void mem_gc_event(GC_EventType e) {
+  struct timespec now;
+  unsigned long long us;
+
+  switch(e) {
+  case GC_EVENT_START:
+    clock_gettime(CLOCK_MONOTONIC, &mem_gc_started);
+    break;
+  case GC_EVENT_END:
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    us = (now.tv_sec - mem_gc_started.tv_sec) * 1000000ULL
+      + now.tv_nsec / 1000 - mem_gc_started.tv_nsec / 1000;
+    mem_gc_us += us;
+    if(us > mem_gc_max_us)
+      mem_gc_max_us = us;
+    break;
+  default:
+    break;
+  }
+}
+#endif
+
 /** @brief Initialize memory management
  *
  * Must be called by all programs that use garbage collection.  Define
  * @c ${DISORDER_GC} to @c no to suppress use of the collector
- * (e.g. for debugging purposes).
+ * (e.g. for debugging purposes), or to @c incremental to have it collect a
+ * little at a time rather than stopping for whole collections.  Define
+ * @c ${DISORDER_GC_HEAP} to a number of kilobytes to start with a heap that
+ * size, so that a process known to need a big heap doesn't collect over and
+ * over while it grows.
+ *
+ * If DisOrder was configured with @c --with-mem-profile then allocations
+ * are recorded by call site and, if @c ${DISORDER_MEM_PROFILE} is set, a
+ * report is appended to the file it names at exit.  See mem_report().
  */
 void mem_init(void) {
+#if MEM_PROFILE
+  static int registered;
+#endif
 #if GC
   const char *e;
   
@@ -77,18 +264,28 @@ void mem_init(void) {
 #else
     assert(GC_all_interior_pointers);
 #endif
+#if HAVE_GC_SET_ON_COLLECTION_EVENT
+    GC_set_on_collection_event(mem_gc_event);
+#endif
+    if(e && !strcmp(e, "incremental"))
+      GC_enable_incremental();
+    if((e = getenv("DISORDER_GC_HEAP")) && atol(e) > 0)
+      GC_expand_hp((size_t)atol(e) * 1024);
   }
 #endif
+#if MEM_PROFILE
+  if(!registered++)
+    atexit(mem_report_file);
+#endif
 }
 
 /** @brief Allocate memory
  * @param n Bytes to allocate
  * @return Pointer to allocated memory
  *
- * Terminates the process on error.  The allocated memory is always
- * 0-filled.
+ * Common code for xmalloc() and xcalloc().
  */
-void *xmalloc(size_t n) {
+static inline void *mem__malloc(size_t n) {
   void *ptr;
 
   if(!(ptr = do_malloc(n)) && n)
@@ -96,6 +293,32 @@ void *xmalloc(size_t n) {
   return ptr;
 }
 
+/** @brief Allocate memory
+ * @param n Bytes to allocate
+ * @return Pointer to allocated memory
+ *
+ * Common code for the @c _noptr allocators.
+ */
+static inline void *mem__malloc_noptr(size_t n) {
+  void *ptr;
+
+  if(!(ptr = do_malloc_atomic(n)) && n)
+    disorder_fatal(errno, "error allocating memory");
+  return ptr;
+}
+
+/** @brief Allocate memory
+ * @param n Bytes to allocate
+ * @return Pointer to allocated memory
+ *
+ * Terminates the process on error.  The allocated memory is always
+ * 0-filled.
+ */
+void *xmalloc(size_t n) {
+  MEM_RECORD(n);
+  return mem__malloc(n);
+}
+
 /** @brief Reallocate memory
  * @param ptr Block to reallocated
  * @param n Bytes to allocate
@@ -105,6 +328,7 @@ void *xmalloc(size_t n) {
  * additional memory allocated is 0-filled.
  */
 void *xrealloc(void *ptr, size_t n) {
+  MEM_RECORD(n);
   if(!(ptr = do_realloc(ptr, n)) && n)
     disorder_fatal(errno, "error allocating memory");
   return ptr;
@@ -121,7 +345,8 @@ void *xrealloc(void *ptr, size_t n) {
 void *xcalloc(size_t count, size_t size) {
   if(count > SIZE_MAX / size)
     disorder_fatal(0, "excessively large calloc");
-  return xmalloc(count * size);
+  MEM_RECORD(count * size);
+  return mem__malloc(count * size);
 }
 
 /** @brief Allocate memory
@@ -133,11 +358,8 @@ void *xcalloc(size_t count, size_t size) {
  * in.
  */
 void *xmalloc_noptr(size_t n) {
-  void *ptr;
-
-  if(!(ptr = do_malloc_atomic(n)) && n)
-    disorder_fatal(errno, "error allocating memory");
-  return ptr;
+  MEM_RECORD(n);
+  return mem__malloc_noptr(n);
 }
 
 /** @brief Allocate memory
@@ -151,7 +373,8 @@ void *xmalloc_noptr(size_t n) {
 void *xcalloc_noptr(size_t count, size_t size) {
   if(count > SIZE_MAX / size)
     disorder_fatal(0, "excessively large calloc");
-  return xmalloc_noptr(count * size);
+  MEM_RECORD(count * size);
+  return mem__malloc_noptr(count * size);
 }
 
 /** @brief Reallocate memory
@@ -164,8 +387,9 @@ void *xcalloc_noptr(size_t count, size_t size) {
  * allocated with xmalloc_noptr() (or xrealloc_noptr()) initially.
  */
 void *xrealloc_noptr(void *ptr, size_t n) {
+  MEM_RECORD(n);
   if(ptr == 0)
-    return xmalloc_noptr(n);
+    return mem__malloc_noptr(n);
   if(!(ptr = do_realloc(ptr, n)) && n)
     disorder_fatal(errno, "error allocating memory");
   return ptr;
@@ -180,6 +404,7 @@ void *xrealloc_noptr(void *ptr, size_t n) {
 char *xstrdup(const char *s) {
   char *t;
 
+  MEM_RECORD(strlen(s) + 1);
   if(!(t = do_malloc_atomic(strlen(s) + 1)))
     disorder_fatal(errno, "error allocating memory");
   return strcpy(t, s);
@@ -196,6 +421,7 @@ char *xstrdup(const char *s) {
 char *xstrndup(const char *s, size_t n) {
   char *t;
 
+  MEM_RECORD(n + 1);
   if(!(t = do_malloc_atomic(n + 1)))
     disorder_fatal(errno, "error allocating memory");
   memcpy(t, s, n);
@@ -210,6 +436,80 @@ void xfree(void *ptr) {
   do_free(ptr);
 }
 
+/** @brief Add memory to the collector's roots
+ * @param ptr Start of memory
+ * @param n Size of memory
+ *
+ * Use this for memory not allocated by this file that may contain pointers
+ * into the garbage-collected heap.
+ */
+void mem_add_roots(void attribute((unused)) *ptr,
+                   size_t attribute((unused)) n) {
+#if GC
+  if(do_free == GC_free)
+    GC_add_roots(ptr, (char *)ptr + n);
+#endif
+}
+
+/** @brief Get garbage collector statistics
+ * @param ms Where to store the statistics
+ * @return 0 on success, -1 if the collector is not in use
+ *
+ * Collection times are only available if the collector can report when
+ * collections start and end; otherwise @c pauses is 0.  In incremental mode
+ * the small steps taken between collections may not be counted.
+ */
+int mem_gc_stats(struct mem_gc_stats *ms) {
+  memset(ms, 0, sizeof *ms);
+#if GC
+  if(do_free == GC_free) {
+    ms->collections = GC_get_gc_no();
+    ms->heap_bytes = GC_get_heap_size();
+    ms->free_bytes = GC_get_free_bytes();
+#if HAVE_GC_SET_ON_COLLECTION_EVENT
+    ms->pauses = 1;
+    ms->total_us = mem_gc_us;
+    ms->max_us = mem_gc_max_us;
+#endif
+    return 0;
+  }
+#endif
+  return -1;
+}
+
+/** @brief Prepare for threads that allocate memory
+ *
+ * Call this before creating any thread that calls mem_thread_begin().
+ */
+void mem_allow_threads(void) {
+#if GC && HAVE_GC_ALLOW_REGISTER_THREADS
+  if(do_free == GC_free)
+    GC_allow_register_threads();
+#endif
+}
+
+/** @brief Called at the start of a thread that allocates memory
+ *
+ * The collector must know about every thread that might hold pointers into
+ * its heap.  The thread must call mem_thread_end() before it exits.
+ */
+void mem_thread_begin(void) {
+#if GC && HAVE_GC_ALLOW_REGISTER_THREADS
+  struct GC_stack_base sb;
+
+  if(do_free == GC_free && GC_get_stack_base(&sb) == GC_SUCCESS)
+    GC_register_my_thread(&sb);
+#endif
+}
+
+/** @brief Called at the end of a thread that called mem_thread_begin() */
+void mem_thread_end(void) {
+#if GC && HAVE_GC_ALLOW_REGISTER_THREADS
+  if(do_free == GC_free)
+    GC_unregister_my_thread();
+#endif
+}
+
 /*
 Local Variables:
 c-basic-offset:2
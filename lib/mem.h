@@ -56,6 +56,47 @@ char *xstrndup(const char *, size_t);
 void xfree(void *ptr);
 /* As free, but calls GC_free instead if gc is enabled */
 
+void mem_add_roots(void *ptr, size_t n);
+/* Tell the garbage collector that memory it didn't allocate may point into
+ * its heap */
+
+/** @brief Garbage collector statistics */
+struct mem_gc_stats {
+  /** @brief Number of collections */
+  unsigned long collections;
+
+  /** @brief Nonzero if @ref total_us and @ref max_us are known */
+  int pauses;
+
+  /** @brief Total time spent collecting in microseconds */
+  unsigned long long total_us;
+
+  /** @brief Longest collection in microseconds */
+  unsigned long long max_us;
+
+  /** @brief Size of the heap in bytes */
+  size_t heap_bytes;
+
+  /** @brief Free bytes in the heap */
+  size_t free_bytes;
+};
+
+int mem_gc_stats(struct mem_gc_stats *ms);
+/* Get statistics from the garbage collector.  Return -1 if not in use. */
+
+void mem_allow_threads(void);
+void mem_thread_begin(void);
+void mem_thread_end(void);
+/* Tell the garbage collector about threads that allocate memory */
+
+#if MEM_PROFILE
+#include <stdio.h>
+
+void mem_report(FILE *fp);
+void mem_report_file(void);
+/* Report allocations by call site (only with --with-mem-profile) */
+#endif
+
 #endif /* MEM_H */
 
 /*
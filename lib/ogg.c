@@ -0,0 +1,116 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file lib/ogg.c
+ * @brief Ogg page construction
+ *
+ * Just enough of the Ogg container (RFC3533) to wrap a single stream of
+ * packets, such as Opus (RFC7845), for streaming.  Packets are never split
+ * across pages, so each page is complete in itself.
+ */
+#include "common.h"
+
+#include "ogg.h"
+
+/** @brief Update an Ogg CRC
+ * @param crc CRC so far (0 to start)
+ * @param buffer Data
+ * @param n Length of data
+ * @return Updated CRC
+ *
+ * This is the unreflected CRC-32 with polynomial 0x04C11DB7, an initial value
+ * of 0 and no final XOR.
+ */
+uint32_t ogg_crc(uint32_t crc, const void *buffer, size_t n) {
+  const unsigned char *ptr = buffer;
+  int bit;
+
+  while(n-- > 0) {
+    crc ^= (uint32_t)*ptr++ << 24;
+    for(bit = 0; bit < 8; ++bit)
+      crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+  }
+  return crc;
+}
+
+/** @brief Store a little-endian value
+ * @param ptr Where to store it
+ * @param value Value
+ * @param n Number of bytes
+ */
+static void ogg_put(unsigned char *ptr, uint64_t value, int n) {
+  while(n-- > 0) {
+    *ptr++ = value & 0xFF;
+    value >>= 8;
+  }
+}
+
+/** @brief Construct an Ogg page
+ * @param s Stream
+ * @param flags @ref OGG_BOS, @ref OGG_EOS or 0
+ * @param granule Granule position at the end of the last packet
+ * @param data Packets, one after the other
+ * @param lengths Length of each packet
+ * @param npackets Number of packets
+ * @param page Where to store the page
+ * @return Size of the page, or 0 if the packets won't fit in one page
+ *
+ * @p page must have room for @ref OGG_HEADER_MAX bytes plus the packets.  The
+ * packets will fit so long as none need more than their share of the 255
+ * lacing values; for instance, 10 packets of up to 6119 bytes each.
+ */
+size_t ogg_page(struct ogg_stream *s, unsigned flags, uint64_t granule,
+                const void *data, const size_t *lengths, int npackets,
+                unsigned char *page) {
+  size_t nsegments = 0, nbytes = 0, len, header;
+  int n;
+
+  for(n = 0; n < npackets; ++n) {
+    nsegments += lengths[n] / 255 + 1;
+    nbytes += lengths[n];
+  }
+  if(nsegments > 255)
+    return 0;
+  memcpy(page, "OggS", 4);
+  page[4] = 0;                          /* version */
+  page[5] = flags;
+  ogg_put(page + 6, granule, 8);
+  ogg_put(page + 14, s->serial, 4);
+  ogg_put(page + 18, s->sequence++, 4);
+  ogg_put(page + 22, 0, 4);             /* CRC, filled in below */
+  page[26] = nsegments;
+  header = 27;
+  /* A packet is a run of 255s followed by a shorter lacing value, which may
+   * be 0 */
+  for(n = 0; n < npackets; ++n) {
+    for(len = lengths[n]; len >= 255; len -= 255)
+      page[header++] = 255;
+    page[header++] = len;
+  }
+  memcpy(page + header, data, nbytes);
+  ogg_put(page + 22, ogg_crc(0, page, header + nbytes), 4);
+  return header + nbytes;
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -0,0 +1,60 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file lib/ogg.h
+ * @brief Ogg page construction
+ */
+
+#ifndef OGG_H
+#define OGG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** @brief Page flag: first page of a logical stream */
+#define OGG_BOS 0x02
+
+/** @brief Page flag: last page of a logical stream */
+#define OGG_EOS 0x04
+
+/** @brief Largest possible page header, in bytes */
+#define OGG_HEADER_MAX (27 + 255)
+
+/** @brief State for one logical Ogg stream */
+struct ogg_stream {
+  /** @brief Stream serial number */
+  uint32_t serial;
+
+  /** @brief Sequence number of the next page */
+  uint32_t sequence;
+};
+
+uint32_t ogg_crc(uint32_t crc, const void *buffer, size_t n);
+size_t ogg_page(struct ogg_stream *s, unsigned flags, uint64_t granule,
+                const void *data, const size_t *lengths, int npackets,
+                unsigned char *page);
+
+#endif /* OGG_H */
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
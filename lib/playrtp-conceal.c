@@ -0,0 +1,182 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file lib/playrtp-conceal.c
+ * @brief RTP player packet loss concealment
+ *
+ * Short gaps in the stream are filled by repeating the most recent pitch
+ * period of the audio, found by autocorrelation, fading out to silence by
+ * the end of the gap.  The audio after the gap is faded back in.  This is
+ * much less noticeable than a sudden silence.
+ *
+ * Everything here is called from playrtp_callback() with @ref lock held.
+ */
+
+#include "common.h"
+
+#include <pthread.h>
+
+#include "mem.h"
+#include "uaudio.h"
+#include "playrtp-int.h"
+
+/** @brief Frames of recent output kept (40ms) */
+#define HISTORY_FRAMES 1764
+
+/** @brief Frames compared when looking for the pitch period (10ms) */
+#define WINDOW_FRAMES 441
+
+/** @brief Shortest pitch period considered, in frames (2.5ms) */
+#define MIN_PERIOD 110
+
+/** @brief Longest pitch period considered, in frames (20ms) */
+#define MAX_PERIOD 882
+
+/** @brief Frames over which audio is faded back in after a gap (5ms) */
+#define FADE_FRAMES 220
+
+/** @brief Recent output, as a circular buffer of interleaved samples */
+static int16_t history[HISTORY_FRAMES * 2];
+
+/** @brief Index in @ref history of the next sample to write */
+static size_t history_index;
+
+/** @brief Samples written to @ref history, up to its size */
+static size_t history_fill;
+
+/** @brief Most recent output, oldest first, copied from @ref history */
+static int16_t recent[HISTORY_FRAMES * 2];
+
+/** @brief Pitch period being repeated, in frames */
+static size_t period;
+
+/** @brief Position in the repeated period, in frames */
+static size_t position;
+
+/** @brief Samples of following audio still to be faded in */
+static size_t fade;
+
+/** @brief Record samples that have been played
+ * @param samples Samples in native byte order
+ * @param n Number of samples
+ */
+void playrtp_conceal_record(const int16_t *samples, size_t n) {
+  const size_t size = (size_t)HISTORY_FRAMES * uaudio_channels;
+
+  while(n > 0) {
+    history[history_index++] = *samples++;
+    if(history_index >= size)
+      history_index = 0;
+    if(history_fill < size)
+      ++history_fill;
+    --n;
+  }
+}
+
+/** @brief Prepare to conceal a gap
+ * @return Nonzero if concealment is possible
+ *
+ * Concealment is not attempted if there is not enough history, or if it is
+ * silent, or if the output format is not one we can handle.
+ */
+int playrtp_conceal_start(void) {
+  const size_t channels = uaudio_channels;
+  const size_t size = HISTORY_FRAMES * channels;
+  size_t n, lag, c;
+  double energy = 0, best = 0, sum;
+  int32_t a, b;
+
+  if(channels < 1 || channels > 2 || history_fill < size)
+    return 0;
+  /* Unwrap the history to make life easier */
+  for(n = 0; n < size; ++n)
+    recent[n] = history[(history_index + n) % size];
+  /* Find the period whose repetition best matches the last window */
+  for(n = HISTORY_FRAMES - WINDOW_FRAMES; n < HISTORY_FRAMES; ++n) {
+    for(a = 0, c = 0; c < channels; ++c)
+      a += recent[n * channels + c];
+    energy += (double)a * a;
+  }
+  if(energy == 0)
+    return 0;
+  period = 0;
+  for(lag = MIN_PERIOD; lag <= MAX_PERIOD; ++lag) {
+    sum = 0;
+    for(n = HISTORY_FRAMES - WINDOW_FRAMES; n < HISTORY_FRAMES; ++n) {
+      for(a = b = 0, c = 0; c < channels; ++c) {
+        a += recent[n * channels + c];
+        b += recent[(n - lag) * channels + c];
+      }
+      sum += (double)a * b;
+    }
+    if(sum > best || !period) {
+      best = sum;
+      period = lag;
+    }
+  }
+  position = 0;
+  return 1;
+}
+
+/** @brief Fill part of a gap
+ * @param buffer Where to put samples, in native byte order
+ * @param n Number of samples to generate
+ * @param remaining Number of samples left to fill in the gap, including these
+ * @param total Total size of the gap
+ *
+ * The output fades from full volume at the start of the gap to silence at
+ * the end.
+ */
+void playrtp_conceal_fill(int16_t *buffer, size_t n,
+                          uint32_t remaining, uint32_t total) {
+  const size_t channels = uaudio_channels;
+  const int16_t *const start = recent + (HISTORY_FRAMES - period) * channels;
+  size_t i, c;
+
+  for(i = 0; i + channels <= n; i += channels) {
+    for(c = 0; c < channels; ++c)
+      buffer[i + c] = (int16_t)(start[position * channels + c]
+                                * (double)(remaining - i) / total);
+    if(++position >= period)
+      position = 0;
+  }
+  /* Partial frames shouldn't happen, but just in case */
+  for(; i < n; ++i)
+    buffer[i] = 0;
+  fade = FADE_FRAMES * channels;
+}
+
+/** @brief Fade in audio following a gap
+ * @param buffer Samples in native byte order
+ * @param n Number of samples
+ */
+void playrtp_conceal_fade_in(int16_t *buffer, size_t n) {
+  const size_t total = FADE_FRAMES * uaudio_channels;
+  size_t i;
+
+  for(i = 0; i < n && fade > 0; ++i, --fade)
+    buffer[i] = (int16_t)(buffer[i] * (double)(total - fade) / total);
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -15,18 +15,24 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
-/** @file clients/playrtp.h
- * @brief RTP player
+/** @file lib/playrtp-int.h
+ * @brief RTP player internals
+ *
+ * Shared between the parts of the RTP player; see @ref lib/playrtp.h for
+ * its interface.
  */
 
-#ifndef PLAYRTP_H
-#define PLAYRTP_H
+#ifndef PLAYRTP_INT_H
+#define PLAYRTP_INT_H
 
 /** @brief Maximum samples per packet we'll support
  *
  * NB that two channels = two samples in this program.
+ *
+ * This is enough for the largest payload that fits in a 9000-byte jumbo
+ * frame.
  */
-#define MAXSAMPLES 2048
+#define MAXSAMPLES 4608
 
 /** @brief Number of samples to infill by in one go
  *
@@ -37,11 +43,11 @@
 
 /** @brief Received packet
  *
- * Received packets are kept in a binary heap (see @ref pheap) ordered by
+ * Received packets are kept in a jitter buffer (see @ref pring) ordered by
  * timestamp.
  */
 struct packet {
-  /** @brief Next packet in @ref next_free_packet or @ref received_packets */
+  /** @brief Next packet in a free list or @ref pending_packets */
   struct packet *next;
   
   /** @brief Number of samples in this packet */
@@ -106,7 +112,7 @@ static inline int le(uint32_t a, uint32_t b) {
   return !lt(b, a);
 }
 
-/** @brief Ordering for packets, used by @ref pheap */
+/** @brief Ordering for packets */
 static inline int lt_packet(const struct packet *a, const struct packet *b) {
   return lt(a->timestamp, b->timestamp);
 }
@@ -123,35 +129,50 @@ static inline int contains(const struct packet *p, uint32_t timestamp) {
           && lt(timestamp, packet_end));
 }
 
-/** @struct pheap 
- * @brief Binary heap of packets ordered by timestamp */
-HEAP_TYPE(pheap, struct packet *, lt_packet);
+/** @brief Samples covered by each slot of a @ref pring */
+#define PRING_GRANULE 256
+
+/** @brief Jitter buffer of packets ordered by timestamp
+ *
+ * See @ref lib/playrtp-ring.c.
+ */
+struct pring {
+  /** @brief Slots, each a list of packets ordered by timestamp */
+  struct packet **slots;
+
+  /** @brief Number of slots minus 1 */
+  uint32_t mask;
+
+  /** @brief Slot number of the earliest packet, or a lower bound for it */
+  uint32_t first;
+
+  /** @brief Slot number of the latest packet */
+  uint32_t last;
+
+  /** @brief Number of packets */
+  uint32_t count;
+};
+
+void pring_init(struct pring *r, uint32_t span);
+int pring_insert(struct pring *r, struct packet *p);
+struct packet *pring_first(struct pring *r);
+struct packet *pring_remove(struct pring *r);
+
+/** @brief Return the number of packets in a jitter buffer */
+static inline uint32_t pring_count(const struct pring *r) {
+  return r->count;
+}
+
+void playrtp_conceal_record(const int16_t *samples, size_t n);
+int playrtp_conceal_start(void);
+void playrtp_conceal_fill(int16_t *buffer, size_t n,
+                          uint32_t remaining, uint32_t total);
+void playrtp_conceal_fade_in(int16_t *buffer, size_t n);
 
 struct packet *playrtp_new_packet(void);
 void playrtp_free_packet(struct packet *p);
-void playrtp_fill_buffer(void);
-struct packet *playrtp_next_packet(void);
-
-extern struct packet *received_packets;
-extern struct packet **received_tail;
-extern pthread_mutex_t receive_lock;
-extern pthread_cond_t receive_cond;
-extern uint32_t nreceived;
-extern struct pheap packets;
-extern volatile uint32_t nsamples;
-extern uint32_t next_timestamp;
-extern int active;
-extern pthread_mutex_t lock;
-extern pthread_cond_t cond;
-extern unsigned minbuffer;
-
-extern int16_t *dump_buffer;
-extern size_t dump_index;
-extern size_t dump_size;
-
-void playrtp_oss(void), playrtp_alsa(void), playrtp_coreaudio(void);
-
-#endif /* PLAYRTP_H */
+
+#endif /* PLAYRTP_INT_H */
 
 /*
 Local Variables:
@@ -15,7 +15,7 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
-/** @file clients/playrtp-mem.c
+/** @file lib/playrtp-mem.c
  * @brief RTP player memory management
  */
 
@@ -24,66 +24,84 @@
 #include <pthread.h>
 
 #include "mem.h"
+#include "realtime.h"
 #include "vector.h"
 #include "heap.h"
-#include "playrtp.h"
+#include "playrtp-int.h"
+
+/** @brief Linked list of freed packets
+ *
+ * Any thread may push packets onto this stack, with no locking.  Only
+ * playrtp_new_packet() takes packets off it, all at once, so there is no ABA
+ * problem.
+ */
+static union free_packet *freed_packets;
 
 /** @brief Linked list of free packets
  *
- * This is a linked list of formerly used packets.  For preference we re-use
- * packets that have already been used rather than unused ones, to limit the
- * size of the program's working set.  If there are no free packets in the list
- * we try @ref next_free_packet instead.
+ * This is a linked list of formerly used packets, taken from @ref
+ * freed_packets.  For preference we re-use packets that have already been
+ * used rather than unused ones, to limit the size of the program's working
+ * set.  If there are no free packets in the list we try @ref next_free_packet
+ * instead.
  *
- * Must hold @ref lock when accessing this.
+ * Only playrtp_new_packet() accesses this.
  */
 static union free_packet *free_packets;
 
 /** @brief Array of new free packets 
  *
  * There are @ref count_free_packets ready to use at this address.  If there
- * are none left we allocate more memory.
+ * are none left we allocate more memory, locked memory from
+ * realtime_alloc() for preference.
  *
- * Must hold @ref lock when accessing this.
+ * Only playrtp_new_packet() accesses this.
  */
 static union free_packet *next_free_packet;
 
 /** @brief Count of new free packets at @ref next_free_packet
  *
- * Must hold @ref lock when accessing this.
+ * Only playrtp_new_packet() accesses this.
  */
 static size_t count_free_packets;
 
-/** @brief Lock protecting packet allocator */
-static pthread_mutex_t mem_lock = PTHREAD_MUTEX_INITIALIZER;
-
-/** @brief Return a new packet */
+/** @brief Return a new packet
+ *
+ * Only listen_thread() may call this.
+ */
 struct packet *playrtp_new_packet(void) {
   struct packet *p;
   
-  pthread_mutex_lock(&mem_lock);
+  if(!free_packets)
+    free_packets = __atomic_exchange_n(&freed_packets, NULL,
+                                       __ATOMIC_ACQUIRE);
   if(free_packets) {
     p = &free_packets->p;
     free_packets = free_packets->next;
   } else {
     if(!count_free_packets) {
-      next_free_packet = xcalloc(1024, sizeof (union free_packet));
+      if(!(next_free_packet = realtime_alloc(1024
+                                             * sizeof (union free_packet))))
+        next_free_packet = xcalloc(1024, sizeof (union free_packet));
       count_free_packets = 1024;
     }
     p = &(next_free_packet++)->p;
     --count_free_packets;
   }
-  pthread_mutex_unlock(&mem_lock);
   return p;
 }
 
-/** @brief Free a packet */
+/** @brief Free a packet
+ *
+ * Any thread may call this.
+ */
 void playrtp_free_packet(struct packet *p) {
   union free_packet *u = (union free_packet *)p;
-  pthread_mutex_lock(&mem_lock);
-  u->next = free_packets;
-  free_packets = u;
-  pthread_mutex_unlock(&mem_lock);
+
+  u->next = __atomic_load_n(&freed_packets, __ATOMIC_RELAXED);
+  while(!__atomic_compare_exchange_n(&freed_packets, &u->next, u, 1,
+                                     __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
 }
 
 
@@ -0,0 +1,133 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file lib/playrtp-ring.c
+ * @brief RTP player jitter buffer
+ *
+ * Received packets are kept in a ring of slots indexed by timestamp.  Each
+ * slot covers @ref PRING_GRANULE samples, which is less than any packet the
+ * speaker sends, so a slot almost always holds at most one packet.  Slots are
+ * nonetheless lists ordered by timestamp, so that duplicates and unusually
+ * short packets are harmless.
+ *
+ * Since RTP timestamps mostly increase, inserting a packet and finding the
+ * earliest one are constant-time operations, and the ring only has to be
+ * large enough to cover the maximum buffer size.
+ */
+
+#include "common.h"
+
+#include <pthread.h>
+
+#include "mem.h"
+#include "playrtp-int.h"
+
+/** @brief Slot number for a timestamp
+ *
+ * Slot numbers wrap around at the same point as timestamps do.
+ */
+#define SLOT(timestamp) ((timestamp) / PRING_GRANULE)
+
+/** @brief Mask for slot number arithmetic */
+#define SLOT_MASK SLOT(0xFFFFFFFF)
+
+/** @brief Initialize a jitter buffer
+ * @param r Jitter buffer
+ * @param span Number of samples it must be able to hold
+ */
+void pring_init(struct pring *r, uint32_t span) {
+  uint32_t nslots = 64;
+
+  while(nslots < SLOT(span) && nslots <= SLOT_MASK / 2)
+    nslots *= 2;
+  r->slots = xcalloc(nslots, sizeof *r->slots);
+  r->mask = nslots - 1;
+  r->first = r->last = 0;
+  r->count = 0;
+}
+
+/** @brief Add a packet to a jitter buffer
+ * @param r Jitter buffer
+ * @param p Packet to add
+ * @return 0 on success, 1 if there is already a packet with the same
+ * timestamp, -1 if @p p is too far from the existing contents
+ *
+ * If @p p is rejected then the caller still owns it.
+ */
+int pring_insert(struct pring *r, struct packet *p) {
+  const uint32_t slot = SLOT(p->timestamp);
+  struct packet **pp;
+
+  if(!r->count)
+    r->first = r->last = slot;
+  else if(((slot - r->first) & SLOT_MASK) > SLOT_MASK / 2) {
+    /* Earlier than anything we've got */
+    if(((r->last - slot) & SLOT_MASK) > r->mask)
+      return -1;
+    r->first = slot;
+  } else if(((slot - r->first) & SLOT_MASK) > r->mask)
+    return -1;
+  else if(((slot - r->last) & SLOT_MASK) <= SLOT_MASK / 2)
+    r->last = slot;
+  /* Keep the slot in timestamp order */
+  pp = &r->slots[slot & r->mask];
+  while(*pp && le((*pp)->timestamp, p->timestamp)) {
+    if((*pp)->timestamp == p->timestamp)
+      return 1;
+    pp = &(*pp)->next;
+  }
+  p->next = *pp;
+  *pp = p;
+  ++r->count;
+  return 0;
+}
+
+/** @brief Return the earliest packet in a jitter buffer
+ * @param r Jitter buffer
+ * @return Earliest packet, or NULL if it is empty
+ */
+struct packet *pring_first(struct pring *r) {
+  if(!r->count)
+    return NULL;
+  /* There's always a packet within r->mask slots of r->first */
+  while(!r->slots[r->first & r->mask])
+    r->first = (r->first + 1) & SLOT_MASK;
+  return r->slots[r->first & r->mask];
+}
+
+/** @brief Remove the earliest packet from a jitter buffer
+ * @param r Jitter buffer
+ * @return Earliest packet, or NULL if it is empty
+ */
+struct packet *pring_remove(struct pring *r) {
+  struct packet *const p = pring_first(r);
+
+  if(p) {
+    r->slots[r->first & r->mask] = p->next;
+    --r->count;
+  }
+  return p;
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -0,0 +1,2203 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2007-2009, 2011, 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file lib/playrtp.c
+ * @brief RTP player
+ *
+ * This is the receiver, jitter buffer and playback engine behind
+ * disorder-playrtp(1), which Disobedience also runs directly.  It uses
+ * whichever @ref lib/uaudio.h backend it is given.
+ *
+ * playrtp_start() runs (at least) three threads:
+ *
+ * listen_thread() is responsible for reading RTP packets off the wire and
+ * adding them to the lock-free ring @ref received_packets, assuming they are
+ * basically sound.
+ *
+ * queue_thread() takes packets off this ring and adds them to @ref packets
+ * (an operation which might be much slower due to contention for @ref
+ * lock).
+ *
+ * play_thread() activates and deactivates audio playing via the @ref
+ * lib/uaudio.h API (which probably implies at least one further thread).
+ *
+ * If there is a connection to the server then report_thread() sends it
+ * reception statistics.
+ *
+ * playrtp_stop() shuts them all down again, so that the player can be
+ * started and stopped as often as necessary within one process.
+ *
+ * Sometimes it happens that there is no audio available to play.  This may
+ * because the server went away, or a packet was dropped, or the server
+ * deliberately did not send any sound because it encountered a silence.
+ *
+ * Assumptions:
+ * - it is safe to read uint32_t values without a lock protecting them
+ */
+
+#include "common.h"
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <math.h>
+#include <arpa/inet.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#if HAVE_OPUS_OPUS_H
+#include <opus/opus.h>
+#endif
+
+#include "log.h"
+#include "logring.h"
+#include "mem.h"
+#include "configuration.h"
+#include "addr.h"
+#include "syscalls.h"
+#include "printf.h"
+#include "rtp.h"
+#include "rtp-opus.h"
+#include "defs.h"
+#include "vector.h"
+#include "timeval.h"
+#include "client.h"
+#include "playrtp.h"
+#include "playrtp-int.h"
+#include "uaudio.h"
+#include "resample.h"
+#include "realtime.h"
+
+/** @brief Obsolete synonym */
+#ifndef IPV6_JOIN_GROUP
+# define IPV6_JOIN_GROUP IPV6_ADD_MEMBERSHIP
+#endif
+
+/** @brief RTP socket, or -1 */
+static int rtpfd = -1;
+
+/** @brief Connection to the server, or NULL
+ *
+ * Used to request a stream, and then by report_thread().
+ */
+static disorder_client *client;
+
+/** @brief Log output */
+static FILE *logfp;
+
+/** @brief Nonzero between playrtp_start() and playrtp_stop() */
+static int running;
+
+/** @brief Set by playrtp_stop() to make the threads finish */
+static int stopping;
+
+/** @brief Error that stopped listen_thread(), or 0
+ *
+ * See playrtp_failed().
+ */
+static int listen_error;
+
+/** @brief Thread IDs */
+static pthread_t listen_tid, queue_tid, play_tid, report_tid;
+
+/** @brief Set to log buffer occupancy once a minute */
+static int monitor;
+
+/** @brief Buffer low watermark in samples */
+static unsigned minbuffer;
+
+/** @brief Maximum buffer size in samples
+ *
+ * We'll stop reading from the network if we have this many samples.
+ */
+static unsigned maxbuffer;
+
+/** @brief Set to adapt @ref minbuffer to network conditions
+ *
+ * See playrtp_adapt() and playrtp_stretch().
+ */
+static int adaptive;
+
+/** @brief Smallest target buffer size in adaptive mode, in milliseconds */
+#define ADAPTIVE_FLOOR_MS 60
+
+/** @brief Default maximum buffer size in adaptive mode, in milliseconds
+ *
+ * The target buffer size can grow to half of this.
+ */
+#define ADAPTIVE_MAX_MS 4000
+
+/** @brief How often to reconsider the target buffer size, in seconds */
+#define ADAPT_INTERVAL 1
+
+/** @brief Minimum time between shrinking the target buffer size, in seconds */
+#define ADAPT_SETTLE 30
+
+/** @brief Output frames per repeated or skipped frame in adaptive mode */
+#define STRETCH_FRAMES 1024
+
+/** @brief Set to compensate for clock drift by resampling
+ *
+ * See playrtp_drift() and playrtp_resample().
+ */
+static int drift;
+
+/** @brief How often to update the drift correction, in seconds */
+#define DRIFT_INTERVAL 1
+
+/** @brief Proportional gain of the drift controller, per second */
+#define DRIFT_P 0.01
+
+/** @brief Integral gain of the drift controller, per second squared */
+#define DRIFT_I 0.00003
+
+/** @brief Largest drift correction (1000ppm) */
+#define DRIFT_MAX 0.001
+
+/** @brief Samples fetched at a time for resampling */
+#define DRIFT_CHUNK 1024
+
+/** @brief Resampler used for drift compensation */
+static struct resampler drift_resampler;
+
+/** @brief Current drift correction, as output samples per input sample
+ *
+ * Protected by @ref lock.
+ */
+static double drift_ratio = 1;
+
+/** @brief Smoothed buffer occupancy, in samples */
+static double drift_fill;
+
+/** @brief Accumulated occupancy error, in seconds squared */
+static double drift_integral;
+
+/** @brief Samples waiting to be resampled */
+static int16_t drift_input[DRIFT_CHUNK];
+
+/** @brief Number of samples in @ref drift_input */
+static size_t drift_input_count;
+
+/** @brief Size of @ref drift_output in samples
+ *
+ * This is far more than the callback should ever ask for at once.
+ */
+#define DRIFT_OUTPUT (16 * DRIFT_CHUNK)
+
+/** @brief Resampled samples waiting to be played
+ *
+ * This is a fixed buffer since the audio callback may run on a thread that
+ * must not allocate memory.
+ */
+static int16_t drift_output[DRIFT_OUTPUT];
+
+/** @brief Number of samples in @ref drift_output */
+static size_t drift_output_count;
+
+/** @brief Size of @ref received_packets (a power of 2) */
+#define RECEIVE_RING 4096
+
+/** @brief Received packets
+ *
+ * A single-producer, single-consumer ring: listen_thread() adds packets at
+ * @ref received_head and queue_thread() takes them from @ref received_tail,
+ * with no locking.
+ */
+static struct packet *received_packets[RECEIVE_RING];
+
+/** @brief Count of packets ever added to @ref received_packets
+ *
+ * Only written by listen_thread().
+ */
+static uint32_t received_head;
+
+/** @brief Count of packets ever taken from @ref received_packets
+ *
+ * Only written by queue_thread().
+ */
+static uint32_t received_tail;
+
+/** @brief Set while queue_thread() is waiting for packets
+ *
+ * listen_thread() only touches @ref receive_lock if this is set.
+ */
+static int queue_waiting;
+
+/** @brief Lock used by queue_thread() to wait for packets
+ *
+ * Only listen_thread() and queue_thread() ever hold this lock, and
+ * listen_thread() only when queue_thread() has nothing to do. */
+static pthread_mutex_t receive_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** @brief Condition variable signalled when @ref received_packets is updated
+ *
+ * Used by listen_thread() to wake up queue_thread() when it is waiting. */
+static pthread_cond_t receive_cond = PTHREAD_COND_INITIALIZER;
+
+/** @brief Jitter buffer of received packets */
+static struct pring packets;
+
+/** @brief Maximum number of packets read by one system call */
+#define RECV_BATCH 32
+
+/** @brief One message for playrtp_recvmmsg() */
+#if HAVE_RECVMMSG
+typedef struct mmsghdr playrtp_mmsghdr;
+#else
+typedef struct {
+  struct msghdr msg_hdr;
+  unsigned msg_len;
+} playrtp_mmsghdr;
+#endif
+
+/** @brief Packets accepted by listen_thread() but not yet queued
+ *
+ * Only used by listen_thread(), which moves them all to @ref received_packets
+ * at once.
+ */
+static struct packet *pending_packets;
+
+/** @brief Tail of @ref pending_packets */
+static struct packet **pending_tail = &pending_packets;
+
+/** @brief Packets that listen_thread() is reading into
+ *
+ * Only used by listen_thread(), and by playrtp_stop() once it has finished.
+ */
+static struct packet *listen_batch[RECV_BATCH];
+
+/** @brief Total number of samples available
+ *
+ * We make this volatile because we inspect it without a protecting lock,
+ * so the usual pthread_* guarantees aren't available.
+ */
+static volatile uint32_t nsamples;
+
+/** @brief Timestamp of next packet to play.
+ *
+ * This is set to the timestamp of the last packet, plus the number of
+ * samples it contained.  Only valid if @ref active is nonzero.
+ */
+static uint32_t next_timestamp;
+
+/** @brief True if actively playing
+ *
+ * This is true when playing and false when just buffering. */
+static int active;
+
+/** @brief Lock protecting @ref packets */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** @brief Condition variable signalled whenever @ref packets is changed */
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+/** @brief Backend to play with */
+static const struct uaudio *backend;
+
+/** @brief How often to send reception statistics to the server, in seconds */
+#define REPORT_INTERVAL 5
+
+/** @brief Reception statistics
+ *
+ * Maintained by listen_thread() along the lines of RFC3550 appendix A, and
+ * sent to the server by report_thread().  Protected by @ref stats_lock.
+ */
+static struct {
+  /** @brief Synchronization source that the statistics describe */
+  uint32_t ssrc;
+
+  /** @brief Number of packets received */
+  uint32_t received;
+
+  /** @brief First sequence number seen */
+  uint16_t base_seq;
+
+  /** @brief Highest sequence number seen */
+  uint16_t max_seq;
+
+  /** @brief Sequence number wraparounds, shifted left 16 bits */
+  uint32_t cycles;
+
+  /** @brief Relative transit time of the last packet, in timestamp units */
+  int32_t transit;
+
+  /** @brief Interarrival jitter, in timestamp units */
+  double jitter;
+
+  /** @brief Synchronization source of the last sender report */
+  uint32_t sr_ssrc;
+
+  /** @brief Wallclock time from the last sender report */
+  double sr_time;
+
+  /** @brief RTP timestamp from the last sender report */
+  uint32_t sr_timestamp;
+
+  /** @brief Nonzero once a sender report has arrived */
+  int sr_valid;
+
+  /** @brief Latest latency estimate in seconds, if @ref sr_valid is set */
+  double latency;
+
+  /** @brief Number of packets recovered using FEC */
+  unsigned long recovered;
+
+  /** @brief Number of packets that arrived too late to play */
+  uint32_t late;
+
+  /** @brief Number of duplicate packets */
+  uint32_t duplicates;
+
+  /** @brief Number of packets with an unsupported payload type */
+  uint32_t unsupported;
+
+  /** @brief Number of times the buffer ran dry while playing */
+  uint32_t underruns;
+
+  /** @brief Arrival time of the first packet from @ref ssrc */
+  double first_time;
+
+  /** @brief Timestamp of the first packet from @ref ssrc */
+  uint32_t first_timestamp;
+
+  /** @brief Arrival time of the latest packet from @ref ssrc */
+  double last_time;
+
+  /** @brief Timestamp of the latest packet from @ref ssrc */
+  uint32_t last_timestamp;
+} stats;
+
+/** @brief Samples played since @ref play_start
+ *
+ * Protected by @ref lock.
+ */
+static uint64_t played_samples;
+
+/** @brief When playing last started
+ *
+ * Protected by @ref lock.
+ */
+static double play_start;
+
+/** @brief Lock protecting @ref stats */
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** @brief Condition variable report_thread() waits on
+ *
+ * Signalled by playrtp_stop().  Used with @ref stats_lock.
+ */
+static pthread_cond_t report_cond = PTHREAD_COND_INITIALIZER;
+
+#if HAVE_OPUS_OPUS_H
+/** @brief Set to request an Opus-compressed stream */
+static int opus;
+
+/** @brief Opus decoder, if @ref opus is set */
+static OpusDecoder *opus_decoder;
+#endif
+
+/** @brief Number of recent packets kept for FEC recovery
+ *
+ * Must be a power of 2 comfortably bigger than @ref RTP_FEC_MAX_GROUP.
+ */
+#define FEC_HISTORY 64
+
+/** @brief Recently received audio packets, indexed by sequence number
+ *
+ * Only maintained once an FEC packet has been seen, i.e. when @ref
+ * fec_active is set.  Only used by listen_thread().
+ */
+static struct fec_entry {
+  /** @brief Nonzero if this entry holds a packet */
+  int valid;
+
+  /** @brief Sequence number */
+  uint16_t seq;
+
+  /** @brief First byte of RTP header */
+  uint8_t vpxcc;
+
+  /** @brief Marker bit and payload type */
+  uint8_t mpt;
+
+  /** @brief Timestamp, in network order */
+  uint32_t timestamp;
+
+  /** @brief Payload length in bytes */
+  uint16_t length;
+
+  /** @brief Payload */
+  unsigned char data[MAXSAMPLES * sizeof (uint16_t)];
+} fec_history[FEC_HISTORY];
+
+/** @brief Set once an FEC packet has been received */
+static int fec_active;
+
+/** @brief Buffer for debugging dump
+ *
+ * The debug dump is enabled by the @c --dump option.  It records the last 20s
+ * of audio to the specified file (which will be about 3.5Mbytes).  The file is
+ * written as as ring buffer, so the start point will progress through it.
+ *
+ * Use clients/dump2wav to convert this to a WAV file, which can then be loaded
+ * into (e.g.) Audacity for further inspection.
+ *
+ * All three backends (ALSA, OSS, Core Audio) now support this option.
+ *
+ * The idea is to allow the user a few seconds to react to an audible artefact.
+ */
+static int16_t *dump_buffer;
+
+/** @brief Current index within debugging dump */
+static size_t dump_index;
+
+/** @brief Size of debugging dump in samples */
+static const size_t dump_size = 44100/*Hz*/ * 2/*channels*/ * 20/*seconds*/;
+
+/** @brief Write reception statistics
+ * @param fp Where to write them
+ *
+ * Each line is a name and value separated by a space:
+ * - @c buffer_ms: current buffer occupancy
+ * - @c target_ms: target buffer occupancy (see @ref minbuffer)
+ * - @c received: packets received
+ * - @c lost: packets that never arrived
+ * - @c late: packets that arrived too late to play
+ * - @c duplicate: duplicate packets
+ * - @c unsupported: packets with a payload type we can't play
+ * - @c recovered: packets reconstructed by FEC
+ * - @c underruns: times the buffer ran dry while playing
+ * - @c jitter_ms: RFC3550 interarrival jitter
+ * - @c latency_ms: latency from the server, if it sends sender reports
+ * - @c drift_ppm: how much faster the server sends samples than we play
+ *   them, once we have been playing for long enough to tell
+ *
+ * Times are in milliseconds.  More names may be added in future.
+ */
+void playrtp_stats_report(FILE *fp) {
+  const double rate = uaudio_rate * uaudio_channels;
+  struct timespec ts;
+  double now, buffer_ms, target_ms, elapsed, server_rate = 0, card_rate = 0;
+  double ratio;
+  uint64_t played;
+  long lost = 0;
+
+  xgettime(CLOCK_REALTIME, &ts);
+  now = ts_to_double(ts);
+  pthread_mutex_lock(&lock);
+  buffer_ms = nsamples * 1000 / rate;
+  target_ms = minbuffer * 1000 / rate;
+  played = played_samples;
+  elapsed = now - play_start;
+  ratio = drift_ratio;
+  if(active && elapsed >= 10)
+    card_rate = played / elapsed;
+  pthread_mutex_unlock(&lock);
+  pthread_mutex_lock(&stats_lock);
+  fprintf(fp, "buffer_ms %.0f\n", buffer_ms);
+  fprintf(fp, "target_ms %.0f\n", target_ms);
+  fprintf(fp, "received %"PRIu32"\n", stats.received);
+  /* Unlike the RFC3550 figure, don't let duplicates hide losses */
+  if(stats.received)
+    lost = (long)stats.cycles + stats.max_seq - stats.base_seq + 1
+      - (long)stats.received + (long)stats.duplicates;
+  fprintf(fp, "lost %ld\n", lost > 0 ? lost : 0);
+  fprintf(fp, "late %"PRIu32"\n", stats.late);
+  fprintf(fp, "duplicate %"PRIu32"\n", stats.duplicates);
+  fprintf(fp, "unsupported %"PRIu32"\n", stats.unsupported);
+  fprintf(fp, "recovered %lu\n", stats.recovered);
+  fprintf(fp, "underruns %"PRIu32"\n", stats.underruns);
+  fprintf(fp, "jitter_ms %.1f\n", stats.jitter * 1000 / rate);
+  if(stats.sr_valid)
+    fprintf(fp, "latency_ms %.0f\n", stats.latency * 1000);
+  if(stats.last_time - stats.first_time >= 10)
+    server_rate = (uint32_t)(stats.last_timestamp - stats.first_timestamp)
+      / (stats.last_time - stats.first_time);
+  pthread_mutex_unlock(&stats_lock);
+  /* With --drift the played samples have already been corrected, so the
+   * resampler's own ratio is the better measure */
+  if(drift)
+    fprintf(fp, "drift_ppm %+.0f\n", (1 / ratio - 1) * 1000000);
+  else if(server_rate && card_rate)
+    fprintf(fp, "drift_ppm %+.0f\n", (server_rate / card_rate - 1) * 1000000);
+}
+
+/** @brief Drop the first packet
+ *
+ * Assumes that @ref lock is held. 
+ */
+static void drop_first_packet(void) {
+  if(pring_count(&packets)) {
+    struct packet *const p = pring_remove(&packets);
+    nsamples -= p->nsamples;
+    playrtp_free_packet(p);
+    pthread_cond_broadcast(&cond);
+  }
+}
+
+/** @brief Background thread adding packets to the jitter buffer
+ *
+ * This just transfers packets from @ref received_packets to @ref packets.
+ * Since @ref received_packets needs no lock, listen_thread() is never held
+ * up by this thread waiting for @ref lock.
+ */
+static void *queue_thread(void attribute((unused)) *arg) {
+  struct packet *p;
+  uint32_t head, tail = received_tail;
+
+  mem_thread_begin();
+  realtime_thread("RTP queue");
+  while(!__atomic_load_n(&stopping, __ATOMIC_SEQ_CST)) {
+    /* See what's waiting */
+    head = __atomic_load_n(&received_head, __ATOMIC_SEQ_CST);
+    if(head == tail) {
+      /* Nothing; go to sleep until listen_thread() sees queue_waiting and
+       * wakes us up */
+      pthread_mutex_lock(&receive_lock);
+      __atomic_store_n(&queue_waiting, 1, __ATOMIC_SEQ_CST);
+      if(__atomic_load_n(&received_head, __ATOMIC_SEQ_CST) == tail
+         && !__atomic_load_n(&stopping, __ATOMIC_SEQ_CST))
+        pthread_cond_wait(&receive_cond, &receive_lock);
+      __atomic_store_n(&queue_waiting, 0, __ATOMIC_SEQ_CST);
+      pthread_mutex_unlock(&receive_lock);
+      continue;
+    }
+    /* Add everything to the jitter buffer */
+    pthread_mutex_lock(&lock);
+    for(; tail != head; ++tail) {
+      p = received_packets[tail % RECEIVE_RING];
+      switch(pring_insert(&packets, p)) {
+      case 0:
+        nsamples += p->nsamples;
+        break;
+      case 1:
+        pthread_mutex_lock(&stats_lock);
+        ++stats.duplicates;
+        pthread_mutex_unlock(&stats_lock);
+        playrtp_free_packet(p);
+        break;
+      default:
+        logring_info("dropping packet outside buffer, timestamp=%"PRIx32,
+                     p->timestamp);
+        playrtp_free_packet(p);
+        break;
+      }
+    }
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&lock);
+    __atomic_store_n(&received_tail, tail, __ATOMIC_RELEASE);
+  }
+  mem_thread_end();
+  return NULL;
+}
+
+#if HAVE_OPUS_OPUS_H
+/** @brief Decode an Opus packet in place
+ * @param p Packet, with the compressed data in @c samples_raw
+ * @param nbytes Size of the compressed data
+ * @return 0 on success, -1 if the packet is unusable
+ *
+ * On success @c samples_raw contains network-order 44.1KHz samples, just as
+ * if the packet had been uncompressed.
+ */
+static int playrtp_decode_opus(struct packet *p, size_t nbytes) {
+  unsigned char data[RTP_OPUS_MAX_BYTES];
+  int n;
+
+  if(!opus_decoder || nbytes > sizeof data) {
+    logring_info("ignored an unexpected Opus packet");
+    return -1;
+  }
+  memcpy(data, p->samples_raw, nbytes);
+  n = rtp_opus_decode(opus_decoder, data, nbytes, p->samples_raw);
+  if(n < 0) {
+    logring_error(0, "error decoding Opus packet: %s", opus_strerror(n));
+    return -1;
+  }
+  if(n != RTP_OPUS_CODEC_FRAMES) {
+    logring_info("ignored an Opus packet with %d frames", n);
+    return -1;
+  }
+  p->nsamples = 2 * RTP_OPUS_FRAMES;
+  return 0;
+}
+#endif
+
+/** @brief Update @ref stats for an arriving RTP packet
+ * @param header Packet header
+ * @param now Arrival time
+ */
+static void playrtp_stats_packet(const struct rtp_header *header,
+                                 double now) {
+  const uint16_t seq = ntohs(header->seq);
+  const uint32_t timestamp = ntohl(header->timestamp);
+  const double rate = uaudio_rate * uaudio_channels;
+  /* Arrival time in timestamp units; only differences matter */
+  const uint32_t arrival = (uint32_t)(uint64_t)(now * rate);
+  const int32_t transit = (int32_t)(arrival - timestamp);
+
+  pthread_mutex_lock(&stats_lock);
+  if(!stats.received || header->ssrc != stats.ssrc) {
+    /* A new source, perhaps because the server restarted */
+    stats.ssrc = header->ssrc;
+    stats.received = 0;
+    stats.base_seq = stats.max_seq = seq;
+    stats.cycles = 0;
+    stats.jitter = 0;
+    stats.first_time = stats.last_time = now;
+    stats.first_timestamp = stats.last_timestamp = timestamp;
+  } else {
+    /* Big jumps are probably late or duplicate packets */
+    if((uint16_t)(seq - stats.max_seq) < 3000) {
+      if(seq < stats.max_seq)
+        stats.cycles += 65536;
+      stats.max_seq = seq;
+    }
+    stats.jitter += (fabs((double)(transit - stats.transit)) - stats.jitter)
+      / 16;
+    if(gt(timestamp, stats.last_timestamp)) {
+      stats.last_time = now;
+      stats.last_timestamp = timestamp;
+    }
+  }
+  stats.transit = transit;
+  ++stats.received;
+  if(stats.sr_valid && stats.sr_ssrc == header->ssrc)
+    stats.latency = now - (stats.sr_time
+                           + (int32_t)(timestamp - stats.sr_timestamp) / rate);
+  pthread_mutex_unlock(&stats_lock);
+}
+
+/** @brief Process an incoming RTCP packet
+ * @param data Packet contents
+ * @param n Size of packet
+ *
+ * Only sender reports are of interest; all we want from them is the mapping
+ * between RTP timestamps and wallclock time.
+ */
+static void playrtp_rtcp(const void *data, size_t n) {
+  struct rtcp_sender_report sr;
+
+  if(n < sizeof sr)
+    return;
+  memcpy(&sr, data, sizeof sr);
+  if(sr.pt != RTCP_SR)
+    return;
+  pthread_mutex_lock(&stats_lock);
+  stats.sr_ssrc = sr.ssrc;
+  stats.sr_time = (double)ntohl(sr.ntp_seconds) - NTP_EPOCH_OFFSET
+    + ntohl(sr.ntp_fraction) / 4294967296.0;
+  stats.sr_timestamp = ntohl(sr.rtp_timestamp);
+  stats.sr_valid = 1;
+  pthread_mutex_unlock(&stats_lock);
+}
+
+/** @brief Background thread sending reception statistics to the server
+ * @param arg Connection to the server
+ *
+ * Nothing else uses the connection once playing has started.  Gives up if
+ * the server rejects a report, e.g. because it is too old to know about
+ * them.
+ */
+static void *report_thread(void *arg) {
+  disorder_client *c = arg;
+  long expected, lost, jitter;
+  struct timespec when;
+
+  mem_thread_begin();
+  for(;;) {
+    xgettime(CLOCK_REALTIME, &when);
+    when.tv_sec += REPORT_INTERVAL;
+    pthread_mutex_lock(&stats_lock);
+    while(!__atomic_load_n(&stopping, __ATOMIC_SEQ_CST)
+          && pthread_cond_timedwait(&report_cond, &stats_lock, &when) == 0)
+      ;
+    if(__atomic_load_n(&stopping, __ATOMIC_SEQ_CST)) {
+      pthread_mutex_unlock(&stats_lock);
+      break;
+    }
+    if(!stats.received) {
+      pthread_mutex_unlock(&stats_lock);
+      continue;
+    }
+    expected = (long)stats.cycles + stats.max_seq - stats.base_seq + 1;
+    lost = expected - (long)stats.received;
+    jitter = stats.jitter * 1000000 / (uaudio_rate * uaudio_channels);
+    pthread_mutex_unlock(&stats_lock);
+    if(disorder_rtp_report(c, expected, lost, jitter)) {
+      disorder_info("not sending any more reception statistics");
+      break;
+    }
+  }
+  mem_thread_end();
+  return NULL;
+}
+
+/** @brief Process an incoming RTP audio packet
+ * @param header RTP header
+ * @param p Packet with payload in @c samples_raw
+ * @param nbytes Size of payload
+ * @return 0 if @p p was accepted, -1 if it was discarded
+ *
+ * Accepted packets are added to @ref pending_packets.  If @p p is discarded
+ * the caller still owns it.
+ */
+static int playrtp_receive(const struct rtp_header *header,
+                           struct packet *p,
+                           size_t nbytes) {
+  const uint16_t seq = htons(header->seq);
+  const uint32_t timestamp = htonl(header->timestamp);
+  const uint16_t *s;
+  uint32_t unsupported;
+  int n;
+
+  /* Ignore packets in the past */
+  if(active && lt(timestamp, next_timestamp)) {
+    logring_info("dropping old packet, timestamp=%"PRIx32" < %"PRIx32,
+         timestamp, next_timestamp);
+    pthread_mutex_lock(&stats_lock);
+    ++stats.late;
+    pthread_mutex_unlock(&stats_lock);
+    return -1;
+  }
+  /* Ignore packets with the extension bit set. */
+  if(header->vpxcc & 0x10)
+    return -1;
+  p->next = 0;
+  p->flags = 0;
+  p->timestamp = timestamp;
+  /* Convert to target format */
+  if(header->mpt & 0x80)
+    p->flags |= IDLE;
+  switch(header->mpt & 0x7F) {
+  case 10:                              /* L16 */
+    p->nsamples = nbytes / sizeof(uint16_t);
+    break;
+#if HAVE_OPUS_OPUS_H
+  case RTP_OPUS_PAYLOAD:
+    if(playrtp_decode_opus(p, nbytes))
+      return -1;
+    break;
+#endif
+    /* TODO support other RFC3551 media types (when the speaker does) */
+  default:
+    /* Perhaps someone else's stream on the same port.  Only log when the
+     * count reaches a power of two, so a steady stream of them can't flood
+     * the log. */
+    pthread_mutex_lock(&stats_lock);
+    unsupported = ++stats.unsupported;
+    pthread_mutex_unlock(&stats_lock);
+    if(!(unsupported & (unsupported - 1)))
+      logring_info("ignoring unsupported RTP payload type %d"
+                   " (%"PRIu32" packets so far)",
+                   header->mpt & 0x7F, unsupported);
+    return -1;
+  }
+  /* See if packet is silent */
+  s = p->samples_raw;
+  n = p->nsamples;
+  for(; n > 0; --n)
+    if(*s++)
+      break;
+  if(!n)
+    p->flags |= SILENT;
+  if(logfp)
+    fprintf(logfp, "sequence %u timestamp %"PRIx32" length %"PRIx32" end %"PRIx32"\n",
+            seq, timestamp, p->nsamples, timestamp + p->nsamples);
+  *pending_tail = p;
+  pending_tail = &p->next;
+  return 0;
+}
+
+/** @brief Pass @ref pending_packets on to queue_thread() */
+static void playrtp_queue_pending(void) {
+  struct packet *p, *next;
+  uint32_t head, tail;
+
+  if(!pending_packets)
+    return;
+  /* Stop reading if we've reached the maximum.
+   *
+   * This is rather unsatisfactory: it means that if packets get heavily
+   * out of order then we guarantee dropouts.  But for now... */
+  if(nsamples >= maxbuffer) {
+    pthread_mutex_lock(&lock);
+    while(nsamples >= maxbuffer && !stopping) {
+      pthread_cond_wait(&cond, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+  }
+  /* Add the packets to the receive queue */
+  head = received_head;
+  tail = __atomic_load_n(&received_tail, __ATOMIC_ACQUIRE);
+  for(p = pending_packets; p; p = next) {
+    next = p->next;
+    if(head - tail >= RECEIVE_RING) {
+      logring_info("dropping packet, receive queue full");
+      playrtp_free_packet(p);
+      continue;
+    }
+    received_packets[head++ % RECEIVE_RING] = p;
+  }
+  __atomic_store_n(&received_head, head, __ATOMIC_SEQ_CST);
+  /* Wake up queue_thread() if it's waiting */
+  if(__atomic_load_n(&queue_waiting, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&receive_lock);
+    pthread_cond_signal(&receive_cond);
+    pthread_mutex_unlock(&receive_lock);
+  }
+  pending_packets = 0;
+  pending_tail = &pending_packets;
+}
+
+/** @brief Receive several datagrams at once
+ * @param fd Socket
+ * @param msgs Buffers for messages
+ * @param n Number of buffers
+ * @return Number of messages received, or -1 on error
+ *
+ * Uses recvmmsg() where available, so that a burst of packets costs one
+ * system call.  Blocks until at least one packet is available.
+ */
+static int playrtp_recvmmsg(int fd, playrtp_mmsghdr *msgs, unsigned n) {
+#if HAVE_RECVMMSG
+  return recvmmsg(fd, msgs, n, MSG_WAITFORONE, NULL);
+#else
+  ssize_t bytes;
+
+  if(!n || (bytes = recvmsg(fd, &msgs[0].msg_hdr, 0)) < 0)
+    return -1;
+  msgs[0].msg_len = bytes;
+  return 1;
+#endif
+}
+
+/** @brief Remember an audio packet for FEC recovery
+ * @param header RTP header
+ * @param data Payload
+ * @param nbytes Size of payload
+ */
+static void playrtp_fec_record(const struct rtp_header *header,
+                               const void *data,
+                               size_t nbytes) {
+  const uint16_t seq = ntohs(header->seq);
+  struct fec_entry *const e = &fec_history[seq % FEC_HISTORY];
+
+  /* Only L16 is ever protected */
+  if((header->mpt & 0x7F) != 10 || nbytes > sizeof e->data)
+    return;
+  e->valid = 1;
+  e->seq = seq;
+  e->vpxcc = header->vpxcc;
+  e->mpt = header->mpt;
+  e->timestamp = header->timestamp;
+  e->length = nbytes;
+  memcpy(e->data, data, nbytes);
+}
+
+/** @brief Process an incoming FEC packet
+ * @param data FEC header and payload
+ * @param nbytes Size of FEC header and payload
+ *
+ * If exactly one of the protected packets is missing then it is
+ * reconstructed and treated as if it had just arrived.
+ */
+static void playrtp_fec(const void *data, size_t nbytes) {
+  struct rtp_fec_header f;
+  const unsigned char *const parity
+    = (const unsigned char *)data + sizeof f;
+  const struct fec_entry *e;
+  struct rtp_header header;
+  struct packet *p;
+  unsigned char *payload;
+  uint16_t seq, mask, length, missing = 0;
+  size_t protection_length, i;
+  int n, nmissing = 0;
+
+  fec_active = 1;
+  if(nbytes < sizeof f)
+    return;
+  memcpy(&f, data, sizeof f);
+  protection_length = ntohs(f.protection_length);
+  if(nbytes - sizeof f < protection_length
+     || protection_length > sizeof e->data)
+    return;
+  mask = ntohs(f.mask);
+  /* Find the missing packet, if there is exactly one */
+  for(n = 0; n < 16; ++n) {
+    if(!(mask & (0x8000 >> n)))
+      continue;
+    seq = ntohs(f.sn_base) + n;
+    e = &fec_history[seq % FEC_HISTORY];
+    if(!e->valid || e->seq != seq) {
+      missing = seq;
+      ++nmissing;
+    }
+  }
+  if(nmissing != 1)
+    return;
+  /* XOR everything else together to get it back */
+  p = playrtp_new_packet();
+  payload = (unsigned char *)p->samples_raw;
+  header.vpxcc = f.elpxcc;
+  header.mpt = f.mpt;
+  header.timestamp = f.ts_recovery;
+  length = ntohs(f.length_recovery);
+  memcpy(payload, parity, protection_length);
+  for(n = 0; n < 16; ++n) {
+    if(!(mask & (0x8000 >> n)))
+      continue;
+    seq = ntohs(f.sn_base) + n;
+    if(seq == missing)
+      continue;
+    e = &fec_history[seq % FEC_HISTORY];
+    header.vpxcc ^= e->vpxcc;
+    header.mpt ^= e->mpt;
+    header.timestamp ^= e->timestamp;
+    length ^= e->length;
+    for(i = 0; i < e->length; ++i)
+      payload[i] ^= e->data[i];
+  }
+  header.vpxcc = (header.vpxcc & 0x3F) | (2 << 6);
+  header.seq = htons(missing);
+  if((header.mpt & 0x7F) != 10 || length > protection_length) {
+    playrtp_free_packet(p);
+    return;
+  }
+  pthread_mutex_lock(&stats_lock);
+  ++stats.recovered;
+  pthread_mutex_unlock(&stats_lock);
+  if(logfp)
+    fprintf(logfp, "recovered sequence %u\n", missing);
+  playrtp_fec_record(&header, payload, length);
+  if(playrtp_receive(&header, p, length))
+    playrtp_free_packet(p);
+}
+
+/** @brief Tell all the threads to finish
+ *
+ * Used by playrtp_stop(), and by listen_thread() when it gives up.
+ */
+static void playrtp_finish(void) {
+  pthread_mutex_lock(&lock);
+  __atomic_store_n(&stopping, 1, __ATOMIC_SEQ_CST);
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&lock);
+  pthread_mutex_lock(&receive_lock);
+  pthread_cond_broadcast(&receive_cond);
+  pthread_mutex_unlock(&receive_lock);
+  pthread_mutex_lock(&stats_lock);
+  pthread_cond_broadcast(&report_cond);
+  pthread_mutex_unlock(&stats_lock);
+}
+
+/** @brief Called when listen_thread() is cancelled */
+static void listen_cleanup(void attribute((unused)) *arg) {
+  mem_thread_end();
+}
+
+/** @brief Background thread collecting samples
+ *
+ * This function collects samples, perhaps converts them to the target format,
+ * and adds them to the packet list.
+ *
+ * It is crucial that the gap between successive calls to read() is as small as
+ * possible: otherwise packets will be dropped.
+ *
+ * Adding a packet to the jitter buffer requires @ref lock, which the audio
+ * callback also uses, so instead packets are added to the lock-free ring @ref
+ * received_packets and queue_thread() moves them into the jitter buffer.
+ *
+ * We keep memory allocation (mostly) very fast by keeping pre-allocated
+ * packets around; see @ref playrtp_new_packet().
+ *
+ * playrtp_stop() cancels this thread, which can only happen while it is
+ * waiting for packets.
+ *
+ * If reading fails then the error is recorded in @ref listen_error and all
+ * the threads are told to finish.  The player must still be tidied up with
+ * playrtp_stop(); see playrtp_failed().
+ */
+static void *listen_thread(void attribute((unused)) *arg) {
+  struct packet **const batch = listen_batch;
+  struct rtp_header headers[RECV_BATCH];
+  struct iovec iov[RECV_BATCH][2];
+  playrtp_mmsghdr msgs[RECV_BATCH];
+  struct packet *p;
+  struct rtp_header *header;
+  int i, m;
+  size_t n;
+  struct timespec now;
+
+  pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+  mem_thread_begin();
+  pthread_cleanup_push(listen_cleanup, NULL);
+  memset(msgs, 0, sizeof msgs);
+  realtime_thread("RTP listen");
+  for(;;) {
+    /* Replace the packets used last time round */
+    for(i = 0; i < RECV_BATCH; ++i) {
+      if(!batch[i])
+        batch[i] = playrtp_new_packet();
+      iov[i][0].iov_base = &headers[i];
+      iov[i][0].iov_len = sizeof headers[i];
+      iov[i][1].iov_base = batch[i]->samples_raw;
+      iov[i][1].iov_len = sizeof batch[i]->samples_raw;
+      msgs[i].msg_hdr.msg_iov = iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 2;
+    }
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    pthread_testcancel();
+    m = playrtp_recvmmsg(rtpfd, msgs, RECV_BATCH);
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    if(m < 0) {
+      if(errno == EINTR)
+        continue;
+      logring_error(errno, "error reading from socket");
+      __atomic_store_n(&listen_error, errno, __ATOMIC_SEQ_CST);
+      playrtp_finish();
+      break;
+    }
+    /* All the packets in a batch arrived at much the same time */
+    xgettime(CLOCK_REALTIME, &now);
+    for(i = 0; i < m; ++i) {
+      p = batch[i];
+      header = &headers[i];
+      n = msgs[i].msg_len;
+      /* Ignore too-short packets */
+      if(n <= sizeof (struct rtp_header)) {
+        logring_info("ignored a short packet");
+        continue;
+      }
+      /* RTCP packets share the port (RFC5761) and are recognized by their
+       * packet type */
+      if(header->mpt >= 192 && header->mpt <= 223) {
+        unsigned char rtcp[sizeof (struct rtcp_sender_report)];
+        size_t len = n < sizeof rtcp ? n : sizeof rtcp;
+
+        memcpy(rtcp, header, sizeof *header);
+        memcpy(rtcp + sizeof *header, p->samples_raw, len - sizeof *header);
+        playrtp_rtcp(rtcp, len);
+        continue;
+      }
+      /* FEC packets have their own sequence numbers, so must not contribute
+       * to the statistics */
+      if((header->mpt & 0x7F) == RTP_FEC_PAYLOAD) {
+        playrtp_fec(p->samples_raw, n - sizeof *header);
+        continue;
+      }
+      playrtp_stats_packet(header, ts_to_double(now));
+      if(fec_active)
+        playrtp_fec_record(header, p->samples_raw, n - sizeof *header);
+      if(!playrtp_receive(header, p, n - sizeof *header))
+        /* We'll need a new packet */
+        batch[i] = 0;
+    }
+    /* Hand the whole batch over at once */
+    playrtp_queue_pending();
+  }
+  pthread_cleanup_pop(1);
+  return NULL;
+}
+
+/** @brief Wait until the buffer is adequately full
+ *
+ * Must be called with @ref lock held.  Returns early if playrtp_stop() is
+ * called.
+ */
+static void playrtp_fill_buffer(void) {
+  /* Discard current buffer contents */
+  while(nsamples) {
+    //fprintf(stderr, "%8u/%u (%u) DROPPING\n", nsamples, maxbuffer, minbuffer);
+    drop_first_packet();
+  }
+  disorder_info("Buffering...");
+  /* Wait until there's at least minbuffer samples available */
+  while(nsamples < minbuffer && !stopping) {
+    //fprintf(stderr, "%8u/%u (%u) FILLING\n", nsamples, maxbuffer, minbuffer);
+    pthread_cond_wait(&cond, &lock);
+  }
+  if(stopping)
+    return;
+  /* Start from whatever is earliest */
+  next_timestamp = pring_first(&packets)->timestamp;
+  active = 1;
+}
+
+/** @brief Reconsider the target buffer size
+ *
+ * In adaptive mode, @ref minbuffer follows network conditions.  It starts
+ * from a margin over the measured jitter, grows quickly whenever packets
+ * arrive too late to play, and shrinks slowly when things have been quiet
+ * for a while.  playrtp_stretch() then steers the buffer towards it.
+ *
+ * Must be called with @ref lock held.
+ */
+static void playrtp_adapt(void) {
+  static time_t last, last_change;
+  static uint32_t last_late;
+  const unsigned rate = uaudio_rate * uaudio_channels;
+  const unsigned lowest = rate * ADAPTIVE_FLOOR_MS / 1000;
+  const time_t now = xtime(0);
+  unsigned target = minbuffer, wanted;
+  uint32_t late;
+  double jitter;
+
+  if(now < last + ADAPT_INTERVAL)
+    return;
+  last = now;
+  pthread_mutex_lock(&stats_lock);
+  jitter = stats.jitter;
+  late = stats.late;
+  pthread_mutex_unlock(&stats_lock);
+  /* The RFC3550 jitter is a mean deviation; leave room for the peaks */
+  wanted = lowest + 4 * jitter;
+  if(late != last_late) {
+    target += target / 2;
+    last_change = now;
+  }
+  if(target < wanted) {
+    target = wanted;
+    last_change = now;
+  } else if(target > wanted && now >= last_change + ADAPT_SETTLE) {
+    target -= target / 10;
+    if(target < wanted)
+      target = wanted;
+    last_change = now;
+  }
+  if(target < lowest)
+    target = lowest;
+  if(target > maxbuffer / 2)
+    target = maxbuffer / 2;
+  last_late = late;
+  if(target != minbuffer) {
+    disorder_info("target buffer %ums (was %ums)",
+                  (unsigned)((uint64_t)target * 1000 / rate),
+                  (unsigned)((uint64_t)minbuffer * 1000 / rate));
+    minbuffer = target;
+  }
+}
+
+/** @brief Update the drift correction
+ *
+ * The difference between the smoothed buffer occupancy and @ref minbuffer
+ * reflects the difference between the rates at which the server sends
+ * samples (as measured by RTP timestamps) and the sound card plays them.
+ * A PI controller turns it into a resampling ratio which holds the buffer at
+ * its target.
+ *
+ * Called whenever the buffer changes while playing.  Must be called with
+ * @ref lock held.
+ */
+static void playrtp_drift(void) {
+  static time_t last;
+  const time_t now = xtime(0);
+  double error, correction;
+
+  drift_fill += (nsamples - drift_fill) / 256;
+  if(now < last + DRIFT_INTERVAL)
+    return;
+  last = now;
+  /* Positive if the buffer is too full, i.e. we are playing too slowly */
+  error = (drift_fill - minbuffer) / (uaudio_rate * uaudio_channels);
+  drift_integral += error * DRIFT_INTERVAL;
+  /* Don't let the integral term wind up beyond what it can correct */
+  if(drift_integral * DRIFT_I > DRIFT_MAX)
+    drift_integral = DRIFT_MAX / DRIFT_I;
+  if(drift_integral * DRIFT_I < -DRIFT_MAX)
+    drift_integral = -DRIFT_MAX / DRIFT_I;
+  correction = DRIFT_P * error + DRIFT_I * drift_integral;
+  if(correction > DRIFT_MAX)
+    correction = DRIFT_MAX;
+  if(correction < -DRIFT_MAX)
+    correction = -DRIFT_MAX;
+  drift_ratio = 1 - correction;
+}
+
+/** @brief Steer the buffer towards its target size in adaptive mode
+ * @param samples Number of samples just played from a packet
+ * @param silent Nonzero if they were silent
+ *
+ * If the buffer is running low then silence is played twice, and otherwise
+ * one frame in every @ref STRETCH_FRAMES is repeated; if it is too full then
+ * one frame in every @ref STRETCH_FRAMES is skipped.  (Surplus silence is
+ * already dropped by playrtp_callback().)  Either way the change is far too
+ * small to hear, unlike emptying and refilling the buffer.
+ *
+ * Must be called with @ref lock held, after @ref next_timestamp has been
+ * advanced past the samples played.
+ */
+static void playrtp_stretch(size_t samples, int silent) {
+  static size_t played;
+  const uint32_t low = minbuffer - minbuffer / 4;
+  const uint32_t high = minbuffer + minbuffer / 4;
+
+  if(nsamples >= low && nsamples <= high)
+    return;
+  if(silent && nsamples < low) {
+    next_timestamp -= samples;
+    return;
+  }
+  /* The resampler copes with everything else */
+  if(drift)
+    return;
+  played += samples;
+  if(played < (size_t)STRETCH_FRAMES * uaudio_channels
+     || samples < (size_t)uaudio_channels)
+    return;
+  played = 0;
+  if(nsamples < low)
+    next_timestamp -= uaudio_channels;
+  else
+    next_timestamp += uaudio_channels;
+}
+
+/** @brief Longest gap that will be concealed, in samples (60ms) */
+#define CONCEAL_MAX (2 * 44100 * 60 / 1000)
+
+/** @brief Set while a gap is being concealed
+ *
+ * See @ref clients/playrtp-conceal.c.
+ */
+static int concealing;
+
+/** @brief Size of the gap being concealed */
+static uint32_t conceal_total;
+
+/** @brief Find next packet
+ * @return Packet to play or NULL if none found
+ *
+ * The return packet is merely guaranteed not to be in the past: it might be
+ * the first packet in the future rather than one that is actually suitable to
+ * play.
+ *
+ * Must be called with @ref lock held.
+ */
+static struct packet *playrtp_next_packet(void) {
+  while(pring_count(&packets)) {
+    struct packet *const p = pring_first(&packets);
+    if(le(p->timestamp + p->nsamples, next_timestamp)) {
+      /* This packet is in the past.  Drop it and try another one. */
+      drop_first_packet();
+    } else
+      /* This packet is NOT in the past.  (It might be in the future
+       * however.) */
+      return p;
+  }
+  return 0;
+}
+
+/** @brief Get samples to play
+ * @param buffer Where to put samples
+ * @param max_samples Maximum number of samples to get
+ * @return Number of samples got
+ *
+ * This is where packets are turned into samples, with gaps filled in as
+ * necessary.
+ */
+static size_t playrtp_fetch(void *buffer, size_t max_samples) {
+  size_t samples;
+  int silent = 0, stretch = 0;
+
+  pthread_mutex_lock(&lock);
+  /* Get the next packet, junking any that are now in the past */
+  const struct packet *p = playrtp_next_packet();
+  if(p && contains(p, next_timestamp)) {
+    /* This packet is ready to play; the desired next timestamp points
+     * somewhere into it. */
+
+    /* Timestamp of end of packet */
+    const uint32_t packet_end = p->timestamp + p->nsamples;
+
+    /* Offset of desired next timestamp into current packet */
+    const uint32_t offset = next_timestamp - p->timestamp;
+
+    /* Pointer to audio data */
+    const uint16_t *ptr = (void *)(p->samples_raw + offset);
+
+    /* Compute number of samples left in packet, limited to output buffer
+     * size */
+    samples = packet_end - next_timestamp;
+    if(samples > max_samples)
+      samples = max_samples;
+
+    /* Copy into buffer, converting to native endianness */
+    size_t i = samples;
+    int16_t *bufptr = buffer;
+    while(i > 0) {
+      *bufptr++ = (int16_t)ntohs(*ptr++);
+      --i;
+    }
+    silent = !!(p->flags & SILENT);
+    stretch = adaptive;
+    /* Fade back in after a concealed gap */
+    concealing = 0;
+    playrtp_conceal_fade_in(buffer, samples);
+  } else {
+    /* There is no suitable packet.  We introduce 0s up to the next packet, or
+     * to fill the buffer if there's no next packet or that's too many.  The
+     * comparison with max_samples deals with the otherwise troubling overflow
+     * case. */
+    samples = p ? p->timestamp - next_timestamp : max_samples;
+    if(samples > max_samples)
+      samples = max_samples;
+    /* A short gap before the next packet is probably a lost packet, and is
+     * better concealed than played as silence */
+    if(!p)
+      concealing = 0;
+    else if(!concealing
+            && p->timestamp - next_timestamp <= CONCEAL_MAX
+            && playrtp_conceal_start()) {
+      concealing = 1;
+      conceal_total = p->timestamp - next_timestamp;
+    }
+    if(concealing) {
+      playrtp_conceal_fill(buffer, samples, p->timestamp - next_timestamp,
+                           conceal_total);
+    } else {
+      //info("infill by %zu", samples);
+      memset(buffer, 0, samples * uaudio_sample_size);
+      silent = 1;
+    }
+  }
+  /* Debug dump */
+  if(dump_buffer) {
+    for(size_t i = 0; i < samples; ++i) {
+      dump_buffer[dump_index++] = ((int16_t *)buffer)[i];
+      dump_index %= dump_size;
+    }
+  }
+  /* Advance timestamp */
+  next_timestamp += samples;
+  if(stretch)
+    playrtp_stretch(samples, silent);
+  /* If we're getting behind then try to drop just silent packets
+   *
+   * In theory this shouldn't be necessary.  The server is supposed to send
+   * packets at the right rate and compares the number of samples sent with the
+   * time in order to ensure this.
+   *
+   * However, various things could throw this off:
+   *
+   * - the server's clock could advance at the wrong rate.  This would cause it
+   *   to mis-estimate the right number of samples to have sent and
+   *   inappropriately throttle or speed up.
+   *
+   * - playback could happen at the wrong rate.  If the playback host's sound
+   *   card has a slightly incorrect clock then eventually it will get out
+   *   of step.
+   *
+   * So if we play back slightly slower than the server sends for either of
+   * these reasons then eventually our buffer, and the socket's buffer, will
+   * fill, and the kernel will start dropping packets.  The result is audible
+   * and not very nice.
+   *
+   * Therefore if we're getting behind, we pre-emptively drop silent packets,
+   * since a change in the duration of a silence is less noticeable than a
+   * dropped packet from the middle of continuous music.
+   *
+   * (If things go wrong the other way then eventually we run out of packets to
+   * play and are forced to play silence.  This doesn't seem to happen in
+   * practice but if it does then in the same way we can artificially extend
+   * silent packets to compensate.)
+   *
+   * Dropped packets are always logged; use 'disorder-playrtp --monitor' to
+   * track how close to target buffer occupancy we are on a once-a-minute
+   * basis.
+   */
+  if(nsamples > minbuffer && silent) {
+    logring_info("dropping %zu samples (%"PRIu32" > %"PRIu32")",
+                 samples, nsamples, minbuffer);
+    samples = 0;
+  }
+  playrtp_conceal_record(buffer, samples);
+  /* Junk obsolete packets */
+  playrtp_next_packet();
+  pthread_mutex_unlock(&lock);
+  return samples;
+}
+
+/** @brief Get samples to play, corrected for clock drift
+ * @param buffer Where to put samples
+ * @param max_samples Maximum number of samples to get
+ * @return Number of samples got
+ *
+ * Samples from playrtp_fetch() pass through @ref drift_resampler at the ratio
+ * chosen by playrtp_drift().  Nothing here allocates memory: the resampler's
+ * scratch space is reserved by playrtp_start().
+ */
+static size_t playrtp_resample(int16_t *buffer, size_t max_samples) {
+  size_t n, consumed, produced;
+
+  pthread_mutex_lock(&lock);
+  resample_set_ratio(&drift_resampler, drift_ratio);
+  pthread_mutex_unlock(&lock);
+  while(drift_output_count < max_samples) {
+    /* Top up the input and convert as much of it as possible */
+    n = playrtp_fetch(drift_input + drift_input_count,
+                      DRIFT_CHUNK - drift_input_count);
+    drift_input_count += n;
+    consumed = resample_convert_fixed(&drift_resampler,
+                                      (const uint8_t *)drift_input,
+                                      drift_input_count * sizeof (int16_t),
+                                      (uint8_t *)(drift_output
+                                                  + drift_output_count),
+                                      (DRIFT_OUTPUT - drift_output_count)
+                                      * sizeof (int16_t),
+                                      &produced) / sizeof (int16_t);
+    drift_output_count += produced / sizeof (int16_t);
+    memmove(drift_input, drift_input + consumed,
+            (drift_input_count - consumed) * sizeof (int16_t));
+    drift_input_count -= consumed;
+    /* If there's nothing new, let the caller have what we've got */
+    if(!n)
+      break;
+  }
+  n = drift_output_count < max_samples ? drift_output_count : max_samples;
+  memcpy(buffer, drift_output, n * sizeof (int16_t));
+  memmove(drift_output, drift_output + n,
+          (drift_output_count - n) * sizeof (int16_t));
+  drift_output_count -= n;
+  return n;
+}
+
+static size_t playrtp_callback(void *buffer,
+                               size_t max_samples,
+                               void attribute((unused)) *userdata) {
+  size_t samples;
+
+  if(drift)
+    samples = playrtp_resample(buffer, max_samples);
+  else
+    samples = playrtp_fetch(buffer, max_samples);
+  pthread_mutex_lock(&lock);
+  played_samples += samples;
+  pthread_mutex_unlock(&lock);
+  return samples;
+}
+
+/** @brief Background thread activating and deactivating the backend
+ *
+ * Waits for the buffer to fill, plays until it runs dry, and repeats, until
+ * playrtp_stop() is called.
+ */
+static void *play_thread(void attribute((unused)) *arg) {
+  time_t lastlog = 0;
+  struct timespec started;
+
+  mem_thread_begin();
+  pthread_mutex_lock(&lock);
+  for(;;) {
+    /* Wait for the buffer to fill up a bit */
+    playrtp_fill_buffer();
+    if(stopping)
+      break;
+    /* Start playing now */
+    disorder_info("Playing...");
+    next_timestamp = pring_first(&packets)->timestamp;
+    active = 1;
+    /* Don't play anything left over from before */
+    drift_input_count = drift_output_count = 0;
+    drift_fill = minbuffer;
+    played_samples = 0;
+    xgettime(CLOCK_REALTIME, &started);
+    play_start = ts_to_double(started);
+    pthread_mutex_unlock(&lock);
+    backend->activate();
+    pthread_mutex_lock(&lock);
+    /* Wait until the buffer empties out
+     *
+     * If there's a packet that we can play right now then we definitely
+     * continue.
+     *
+     * Also if there's at least minbuffer samples we carry on regardless and
+     * insert silence.  The assumption is there's been a pause but more data
+     * is now available.
+     */
+    while(!stopping
+          && (nsamples >= minbuffer
+              || (nsamples > 0
+                  && contains(pring_first(&packets), next_timestamp)))) {
+      if(monitor) {
+        time_t now = xtime(0);
+
+        if(now >= lastlog + 60) {
+          int offset = nsamples - minbuffer;
+          double offtime = (double)offset / (uaudio_rate * uaudio_channels);
+          long jitter;
+
+          disorder_info("%+d samples off (%d.%02ds, %d bytes)",
+                        offset,
+                        (int)fabs(offtime) * (offtime < 0 ? -1 : 1),
+                        (int)(fabs(offtime) * 100) % 100,
+                        offset * uaudio_bits / CHAR_BIT);
+          pthread_mutex_lock(&stats_lock);
+          /* disorder_info() can't format floating point values */
+          jitter = stats.jitter * 10000 / (uaudio_rate * uaudio_channels);
+          if(stats.sr_valid)
+            disorder_info("jitter %ld.%ldms, latency %ldms",
+                          jitter / 10, jitter % 10,
+                          (long)(stats.latency * 1000));
+          else
+            disorder_info("jitter %ld.%ldms", jitter / 10, jitter % 10);
+          if(fec_active)
+            disorder_info("%lu packets recovered by FEC", stats.recovered);
+          if(drift)
+            disorder_info("drift correction %ldppm",
+                          lround((drift_ratio - 1) * 1000000));
+          pthread_mutex_unlock(&stats_lock);
+          lastlog = now;
+        }
+      }
+      if(adaptive)
+        playrtp_adapt();
+      if(drift)
+        playrtp_drift();
+      //fprintf(stderr, "%8u/%u (%u) PLAYING\n", nsamples, maxbuffer, minbuffer);
+      pthread_cond_wait(&cond, &lock);
+    }
+    /* Stop playing for a bit until the buffer re-fills */
+    if(!stopping) {
+      pthread_mutex_lock(&stats_lock);
+      ++stats.underruns;
+      pthread_mutex_unlock(&stats_lock);
+    }
+    pthread_mutex_unlock(&lock);
+    backend->deactivate();
+    pthread_mutex_lock(&lock);
+    active = 0;
+    /* Go back round */
+  }
+  pthread_mutex_unlock(&lock);
+  mem_thread_end();
+  return NULL;
+}
+
+/** @brief Set up @ref rtpfd, requesting a stream if necessary
+ * @param s Settings
+ * @return 0 on success, -1 on error
+ *
+ * Any connection to the server is left in @ref client.  On error the caller
+ * cleans up.
+ */
+static int playrtp_open(const struct playrtp_settings *s) {
+  struct addrinfo *res;
+  struct stringlist sl;
+  char *sockname;
+  int rcvbuf, target_rcvbuf = s->rcvbuf;
+  socklen_t len;
+  struct ip_mreq mreq;
+  struct ipv6_mreq mreq6;
+  char *address, *port;
+  int is_multicast;
+  union any_sockaddr {
+    struct sockaddr sa;
+    struct sockaddr_in in;
+    struct sockaddr_in6 in6;
+  };
+  union any_sockaddr mgroup;
+  static const int one = 1;
+  struct addrinfo prefs = {
+    .ai_flags = AI_PASSIVE,
+    .ai_family = PF_INET,
+    .ai_socktype = SOCK_DGRAM,
+    .ai_protocol = IPPROTO_UDP
+  };
+
+  if(target_rcvbuf < 0) target_rcvbuf = config->rtp_rcvbuf;
+  switch(s->naddress) {
+  case 0:
+    sl.s = xcalloc(3, sizeof *sl.s);
+    if(config->rtp_always_request) {
+      sl.s[0] = sl.s[1] = (/*unconst*/ char *)"-";
+      sl.n = 2;
+    } else {
+      /* Get configuration from server */
+      if(!(client = disorder_new(1))) return -1;
+      if(disorder_connect(client)) return -1;
+      if(disorder_rtp_address(client, &address, &port)) return -1;
+      sl.s[0] = address;
+      sl.s[1] = port;
+      sl.n = 2;
+    }
+    /* If we're requesting a new stream then apply the local network address
+     * overrides.
+     */
+    if(!strcmp(sl.s[0], "-")) {
+      if(config->rtp_request_address.port)
+        byte_xasprintf(&sl.s[1], "%d", config->rtp_request_address.port);
+      if(config->rtp_request_address.address) {
+        sl.s[2] = sl.s[1];
+        sl.s[1] = config->rtp_request_address.address;
+        sl.n = 3;
+      }
+    }
+    break;
+  case 1: case 2: case 3:
+    /* Use the given ADDRESS+PORT or just PORT */
+    sl.n = s->naddress;
+    sl.s = s->address;
+    break;
+  default:
+    disorder_error(0, "too many address components");
+    return -1;
+  }
+  struct sockaddr *addr;
+  socklen_t addr_len;
+  if(!strcmp(sl.s[0], "-")) {
+    /* Syntax: - [[ADDRESS] PORT].  Here, the PORT may be `-' to get the local
+     * kernel to choose.  The ADDRESS may be omitted or `-' to pick something
+     * suitable. */
+    const char *node, *svc;
+    struct sockaddr *sa = 0;
+    switch (sl.n) {
+#define NULLDASH(s) (strcmp((s), "-") ? (s) : 0)
+      case 1: node = 0; svc = 0; break;
+      case 2: node = 0; svc = NULLDASH(sl.s[1]); break;
+      case 3: node = NULLDASH(sl.s[1]); svc = NULLDASH(sl.s[2]); break;
+      default:
+        disorder_error(0, "too many listening-address components");
+        return -1;
+#undef NULLDASH
+    }
+    /* We'll need a connection to request the incoming stream, so open one if
+     * we don't have one already */
+    if(!client) {
+      if(!(client = disorder_new(1))) return -1;
+      if(disorder_connect(client)) return -1;
+    }
+    /* If no address was given, we need to pick one.  But we already have a
+     * connection to the server, so we can probably use the address from that.
+     */
+    struct sockaddr_storage ss;
+    if(!node) {
+      addr_len = sizeof ss;
+      if(disorder_client_sockname(client, (struct sockaddr *)&ss, &addr_len))
+        return -1;
+      if(ss.ss_family != AF_INET && ss.ss_family != AF_INET6) {
+        /* We're using a Unix-domain socket, so use a loopback address.  I'm
+         * cowardly using IPv4 here. */
+        struct sockaddr_in *sin = (struct sockaddr_in *)&ss;
+        sin->sin_family = AF_INET;
+        sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      }
+      sa = (struct sockaddr *)&ss;
+      prefs.ai_family = sa->sa_family;
+    }
+    /* If we have an address or port to resolve then do that now */
+    if (node || svc) {
+      struct addrinfo *ai;
+      char errbuf[1024];
+      int rc;
+      if((rc = getaddrinfo(node, svc, &prefs, &ai))) {
+        disorder_error(0, "failed to resolve address `%s' and service `%s': %s",
+                       node ? node : "-", svc ? svc : "-",
+                       format_error(ec_getaddrinfo, rc,
+                                    errbuf, sizeof(errbuf)));
+        return -1;
+      }
+      if(!sa)
+        sa = ai->ai_addr;
+      else {
+        assert(sa->sa_family == ai->ai_addr->sa_family);
+        switch(sa->sa_family) {
+          case AF_INET:
+            ((struct sockaddr_in *)sa)->sin_port =
+              ((struct sockaddr_in *)ai->ai_addr)->sin_port;
+            break;
+          case AF_INET6:
+            ((struct sockaddr_in6 *)sa)->sin6_port =
+              ((struct sockaddr_in6 *)ai->ai_addr)->sin6_port;
+            break;
+          default:
+            assert(!"unexpected address family");
+        }
+      }
+    }
+    if((rtpfd = socket(sa->sa_family, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
+      disorder_error(errno, "error creating socket (family %d)",
+                     sa->sa_family);
+      return -1;
+    }
+    /* Bind the address */
+    if(bind(rtpfd, sa,
+            sa->sa_family == AF_INET
+            ? sizeof (struct sockaddr_in) : sizeof (struct sockaddr_in6)) < 0) {
+      disorder_error(errno, "error binding socket");
+      return -1;
+    }
+    static struct sockaddr_storage bound_address;
+    addr = (struct sockaddr *)&bound_address;
+    addr_len = sizeof bound_address;
+    if(getsockname(rtpfd, addr, &addr_len) < 0) {
+      disorder_error(errno, "error getting socket address");
+      return -1;
+    }
+    /* Convert to string */
+    char addrname[128], portname[32];
+    if(getnameinfo(addr, addr_len,
+                   addrname, sizeof addrname,
+                   portname, sizeof portname,
+                   NI_NUMERICHOST|NI_NUMERICSERV) < 0) {
+      disorder_error(errno, "getnameinfo");
+      return -1;
+    }
+    /* Ask for audio data */
+    const char *codec = NULL;
+#if HAVE_OPUS_OPUS_H
+    if(opus)
+      codec = "opus";
+#endif
+    if(codec ? disorder_rtp_request_codec(client, addrname, portname, codec)
+       : disorder_rtp_request(client, addrname, portname))
+      return -1;
+    /* Report what we did */
+    disorder_info("listening on %s (stream requested)",
+                  format_sockaddr(addr));
+  } else {
+    if(sl.n > 2) {
+      disorder_error(0, "too many address components");
+      return -1;
+    }
+    /* Look up address and port */
+    if(!(res = get_address(&sl, &prefs, &sockname)))
+      return -1;
+    addr = res->ai_addr;
+    addr_len = res->ai_addrlen;
+    /* Create the socket */
+    if((rtpfd = socket(res->ai_family,
+                       res->ai_socktype,
+                       res->ai_protocol)) < 0) {
+      disorder_error(errno, "error creating socket");
+      return -1;
+    }
+    /* Allow multiple listeners */
+    xsetsockopt(rtpfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+    is_multicast = multicast(addr);
+    /* The multicast and unicast/broadcast cases are different enough that they
+     * are totally split.  Trying to find commonality between them causes more
+     * trouble that it's worth. */
+    if(is_multicast) {
+      /* Stash the multicast group address */
+      memcpy(&mgroup, addr, addr_len);
+      switch(res->ai_addr->sa_family) {
+      case AF_INET:
+        mgroup.in.sin_port = 0;
+        break;
+      case AF_INET6:
+        mgroup.in6.sin6_port = 0;
+        break;
+      default:
+        disorder_error(0, "unsupported address family %d",
+                       (int)addr->sa_family);
+        return -1;
+      }
+      /* Bind to to the multicast group address */
+      if(bind(rtpfd, addr, addr_len) < 0) {
+        disorder_error(errno, "error binding socket to %s",
+                       format_sockaddr(addr));
+        return -1;
+      }
+      /* Add multicast group membership */
+      switch(mgroup.sa.sa_family) {
+      case PF_INET:
+        mreq.imr_multiaddr = mgroup.in.sin_addr;
+        mreq.imr_interface.s_addr = 0;      /* use primary interface */
+        if(setsockopt(rtpfd, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+                      &mreq, sizeof mreq) < 0) {
+          disorder_error(errno, "error calling setsockopt IP_ADD_MEMBERSHIP");
+          return -1;
+        }
+        break;
+      case PF_INET6:
+        mreq6.ipv6mr_multiaddr = mgroup.in6.sin6_addr;
+        memset(&mreq6.ipv6mr_interface, 0, sizeof mreq6.ipv6mr_interface);
+        if(setsockopt(rtpfd, IPPROTO_IPV6, IPV6_JOIN_GROUP,
+                      &mreq6, sizeof mreq6) < 0) {
+          disorder_error(errno, "error calling setsockopt IPV6_JOIN_GROUP");
+          return -1;
+        }
+        break;
+      default:
+        disorder_error(0, "unsupported address family %d", res->ai_family);
+        return -1;
+      }
+      /* Report what we did */
+      disorder_info("listening on %s multicast group %s",
+                    format_sockaddr(addr), format_sockaddr(&mgroup.sa));
+    } else {
+      /* Bind to 0/port */
+      switch(addr->sa_family) {
+      case AF_INET: {
+        struct sockaddr_in *in = (struct sockaddr_in *)addr;
+      
+        memset(&in->sin_addr, 0, sizeof (struct in_addr));
+        break;
+      }
+      case AF_INET6: {
+        struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)addr;
+      
+        memset(&in6->sin6_addr, 0, sizeof (struct in6_addr));
+        break;
+      }
+      default:
+        disorder_error(0, "unsupported family %d", (int)addr->sa_family);
+        return -1;
+      }
+      if(bind(rtpfd, addr, addr_len) < 0) {
+        disorder_error(errno, "error binding socket to %s",
+                       format_sockaddr(addr));
+        return -1;
+      }
+      /* Report what we did */
+      disorder_info("listening on %s", format_sockaddr(addr));
+    }
+  }
+  len = sizeof rcvbuf;
+  if(getsockopt(rtpfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &len) < 0) {
+    disorder_error(errno, "error calling getsockopt SO_RCVBUF");
+    return -1;
+  }
+  if(target_rcvbuf > rcvbuf) {
+    if(setsockopt(rtpfd, SOL_SOCKET, SO_RCVBUF,
+                  &target_rcvbuf, sizeof target_rcvbuf) < 0)
+      disorder_error(errno, "error calling setsockopt SO_RCVBUF %d", 
+                     target_rcvbuf);
+      /* We try to carry on anyway */
+    else
+      disorder_info("changed socket receive buffer from %d to %d",
+                    rcvbuf, target_rcvbuf);
+  } else
+    disorder_info("default socket receive buffer %d", rcvbuf);
+  return 0;
+}
+
+/** @brief Map the debugging dump
+ * @param dumpfile Path to dump file
+ * @return 0 on success, -1 on error
+ */
+static int playrtp_open_dump(const char *dumpfile) {
+  int fd;
+  unsigned char buffer[65536];
+  size_t written;
+
+  if((fd = open(dumpfile, O_RDWR|O_TRUNC|O_CREAT, 0666)) < 0) {
+    disorder_error(errno, "opening %s", dumpfile);
+    return -1;
+  }
+  /* Fill with 0s to a suitable size */
+  memset(buffer, 0, sizeof buffer);
+  for(written = 0; written < dump_size * sizeof(int16_t);
+      written += sizeof buffer) {
+    if(write(fd, buffer, sizeof buffer) < 0) {
+      disorder_error(errno, "clearing %s", dumpfile);
+      close(fd);
+      return -1;
+    }
+  }
+  /* Map the buffer into memory for convenience */
+  dump_buffer = mmap(0, dump_size * sizeof(int16_t), PROT_READ|PROT_WRITE,
+                     MAP_SHARED, fd, 0);
+  close(fd);
+  if(dump_buffer == (void *)-1) {
+    dump_buffer = NULL;
+    disorder_error(errno, "mapping %s", dumpfile);
+    return -1;
+  }
+  dump_index = 0;
+  disorder_info("dumping to %s", dumpfile);
+  return 0;
+}
+
+/** @brief Release everything playrtp_start() acquired
+ *
+ * The threads and the backend must already have stopped, if they were
+ * started.
+ */
+static void playrtp_close(void) {
+  struct packet *p, *next;
+  int n;
+
+  /* Return every packet to the free list */
+  if(packets.slots) {
+    while((p = pring_remove(&packets)))
+      playrtp_free_packet(p);
+    xfree(packets.slots);
+    packets.slots = NULL;
+  }
+  for(; received_tail != received_head; ++received_tail)
+    playrtp_free_packet(received_packets[received_tail % RECEIVE_RING]);
+  for(p = pending_packets; p; p = next) {
+    next = p->next;
+    playrtp_free_packet(p);
+  }
+  pending_packets = 0;
+  pending_tail = &pending_packets;
+  for(n = 0; n < RECV_BATCH; ++n)
+    if(listen_batch[n]) {
+      playrtp_free_packet(listen_batch[n]);
+      listen_batch[n] = NULL;
+    }
+  nsamples = 0;
+  if(drift)
+    resample_close(&drift_resampler);
+#if HAVE_OPUS_OPUS_H
+  if(opus_decoder) {
+    opus_decoder_destroy(opus_decoder);
+    opus_decoder = NULL;
+  }
+#endif
+  if(dump_buffer) {
+    munmap(dump_buffer, dump_size * sizeof(int16_t));
+    dump_buffer = NULL;
+  }
+  if(rtpfd >= 0) {
+    close(rtpfd);
+    rtpfd = -1;
+  }
+  if(client) {
+    disorder_close(client);
+    client = NULL;
+  }
+}
+
+/** @brief Start playing an RTP stream
+ * @param s Settings
+ * @return 0 on success, -1 on error
+ *
+ * Returns once the stream has been requested (if necessary) and the threads
+ * started.  Playing begins when enough has been buffered.
+ *
+ * The configuration must already have been read.  Any @ref lib/uaudio.h
+ * options, such as the device, should be set before calling this.  If
+ * reading from the network fails later on then the player stops itself; see
+ * playrtp_failed().
+ */
+int playrtp_start(const struct playrtp_settings *s) {
+  int err;
+
+  /* Tidy up after a player that stopped itself */
+  if(running && playrtp_failed())
+    playrtp_stop();
+  if(running) {
+    disorder_error(0, "RTP player already running");
+    return -1;
+  }
+  realtime_configure(config->audio_scheduling, config->audio_priority,
+                     config->audio_cpus);
+  realtime_memory((size_t)config->audio_memory_kbyte * 1024,
+                  config->audio_huge_pages);
+  /* Choose a sensible default audio backend */
+  backend = s->backend;
+  if(!backend) {
+    backend = uaudio_default(uaudio_apis, UAUDIO_API_CLIENT);
+    if(!backend) {
+      disorder_error(0, "no default uaudio API found");
+      return -1;
+    }
+    disorder_info("default audio API %s", backend->name);
+  }
+  if(backend == &uaudio_rtp) {
+    /* This means that you have NO local sound output.  This can happen if you
+     * use a non-Apple GCC on a Mac (because it doesn't know how to compile
+     * CoreAudio/AudioHardware.h). */
+    disorder_error(0, "cannot play RTP through RTP");
+    return -1;
+  }
+  adaptive = s->adaptive;
+  drift = s->drift;
+  monitor = s->monitor;
+  logfp = s->logfp;
+#if HAVE_OPUS_OPUS_H
+  opus = s->opus;
+#else
+  if(s->opus) {
+    disorder_error(0, "Opus is not supported");
+    return -1;
+  }
+#endif
+  /* Set buffering parameters if not overridden */
+  minbuffer = s->minbuffer;
+  if(!minbuffer) {
+    minbuffer = config->rtp_minbuffer;
+    /* In adaptive mode start small; the buffer will grow if necessary */
+    if(!minbuffer) minbuffer = adaptive ? (2*44100)*2*ADAPTIVE_FLOOR_MS/1000
+                                        : (2*44100)*4/10;
+  }
+  maxbuffer = s->maxbuffer;
+  if(!maxbuffer) {
+    maxbuffer = config->rtp_maxbuffer;
+    if(!maxbuffer) maxbuffer = adaptive ? (2*44100)*(ADAPTIVE_MAX_MS/1000)
+                                        : 2 * minbuffer;
+  }
+  /* Forget any previous run */
+  stopping = 0;
+  active = 0;
+  received_head = received_tail = 0;
+  memset(&stats, 0, sizeof stats);
+  memset(fec_history, 0, sizeof fec_history);
+  fec_active = 0;
+  concealing = 0;
+  drift_ratio = 1;
+  drift_integral = 0;
+  drift_input_count = drift_output_count = 0;
+  /* Leave plenty of room for gaps and stragglers */
+  pring_init(&packets, 4 * maxbuffer);
+  logring_start();
+  if(playrtp_open(s))
+    goto fail;
+  //info("minbuffer %u maxbuffer %u", minbuffer, maxbuffer);
+  if(logfp)
+    disorder_info("WARNING: -L option can impact performance");
+  if(s->dumpfile && playrtp_open_dump(s->dumpfile))
+    goto fail;
+  /* Set up output.  Currently we only support L16 so there's no harm setting
+   * the format before we know what it is! */
+  if(drift) {
+    resample_init(&drift_resampler,
+                  16, 2, 44100, 1, ENDIAN_NATIVE,
+                  16, 2, 44100, 1, ENDIAN_NATIVE);
+    if(resample_set_ratio(&drift_resampler, 1)) {
+      disorder_error(0, "drift compensation requires libsamplerate");
+      goto fail;
+    }
+    /* The audio callback may be on a thread that mustn't allocate */
+    resample_reserve(&drift_resampler, DRIFT_CHUNK);
+  }
+  uaudio_set_format(44100/*Hz*/, 2/*channels*/,
+                    16/*bits/channel*/, 1/*signed*/);
+#if HAVE_OPUS_OPUS_H
+  if(opus) {
+    if(!(opus_decoder = opus_decoder_create(RTP_OPUS_CODEC_RATE, 2, &err))) {
+      disorder_error(0, "error creating Opus decoder: %s", opus_strerror(err));
+      goto fail;
+    }
+  }
+#endif
+  backend->configure();
+  backend->start(playrtp_callback, NULL);
+  if(backend->open_mixer) backend->open_mixer();
+  mem_allow_threads();
+  /* We receive and convert audio data in a background thread */
+  if((err = pthread_create(&listen_tid, 0, listen_thread, 0)))
+    disorder_fatal(err, "pthread_create listen_thread");
+  /* We have a second thread to add received packets to the queue */
+  if((err = pthread_create(&queue_tid, 0, queue_thread, 0)))
+    disorder_fatal(err, "pthread_create queue_thread");
+  /* If we've got a connection to the server then we tell it how reception is
+   * going */
+  if(client && (err = pthread_create(&report_tid, 0, report_thread, client)))
+    disorder_fatal(err, "pthread_create report_thread");
+  if((err = pthread_create(&play_tid, 0, play_thread, 0)))
+    disorder_fatal(err, "pthread_create play_thread");
+  running = 1;
+  return 0;
+fail:
+  playrtp_close();
+  return -1;
+}
+
+/** @brief Stop playing
+ *
+ * Waits for all the threads to finish and stops the backend.  The server
+ * stops sending a requested stream when the connection is closed.  Does
+ * nothing if the player is not running.
+ */
+void playrtp_stop(void) {
+  if(!running)
+    return;
+  playrtp_finish();
+  pthread_cancel(listen_tid);
+  pthread_join(play_tid, NULL);
+  pthread_join(queue_tid, NULL);
+  pthread_join(listen_tid, NULL);
+  if(client)
+    pthread_join(report_tid, NULL);
+  if(backend->close_mixer) backend->close_mixer();
+  backend->stop();
+  playrtp_close();
+  running = 0;
+  __atomic_store_n(&listen_error, 0, __ATOMIC_SEQ_CST);
+  disorder_info("stopped playing");
+}
+
+/** @brief Return nonzero if the player is running
+ *
+ * A player that has stopped itself after an error does not count as running.
+ */
+int playrtp_running(void) {
+  return running && !playrtp_failed();
+}
+
+/** @brief Return the error that stopped the player
+ * @return @c errno value, or 0 if the player has not failed
+ *
+ * Once this is nonzero the player's threads have finished or are finishing.
+ * Call playrtp_stop() to tidy up; this then returns 0 again.
+ */
+int playrtp_failed(void) {
+  return __atomic_load_n(&listen_error, __ATOMIC_SEQ_CST);
+}
+
+/** @brief Get the volume
+ * @param left Where to store left channel volume
+ * @param right Where to store right channel volume
+ * @return 0 on success, -1 if not running or the backend has no mixer
+ *
+ * On error both volumes are set to 0.
+ */
+int playrtp_get_volume(int *left, int *right) {
+  if(!running || !backend->get_volume) {
+    *left = *right = 0;
+    return -1;
+  }
+  backend->get_volume(left, right);
+  return 0;
+}
+
+/** @brief Set the volume
+ * @param left Pointer to left channel volume
+ * @param right Pointer to right channel volume
+ * @return 0 on success, -1 if not running or the backend has no mixer
+ *
+ * The volumes actually set are stored back through @p left and @p right.  On
+ * error they are set to 0.
+ */
+int playrtp_set_volume(int *left, int *right) {
+  if(!running || !backend->set_volume) {
+    *left = *right = 0;
+    return -1;
+  }
+  backend->set_volume(left, right);
+  return 0;
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -0,0 +1,90 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file lib/playrtp.h
+ * @brief RTP player
+ */
+
+#ifndef PLAYRTP_H
+#define PLAYRTP_H
+
+#include <stdio.h>
+
+struct uaudio;
+
+/** @brief How to play an RTP stream
+ *
+ * Zero values, or -1 for @ref rcvbuf, mean the defaults from the
+ * configuration.
+ */
+struct playrtp_settings {
+  /** @brief Backend to play with, or NULL for the default */
+  const struct uaudio *backend;
+
+  /** @brief Buffer low watermark in samples */
+  unsigned minbuffer;
+
+  /** @brief Maximum buffer size in samples */
+  unsigned maxbuffer;
+
+  /** @brief Socket receive buffer size, or -1 */
+  int rcvbuf;
+
+  /** @brief Set to adapt the buffer size to network conditions */
+  int adaptive;
+
+  /** @brief Set to compensate for clock drift by resampling */
+  int drift;
+
+  /** @brief Set to request an Opus-compressed stream */
+  int opus;
+
+  /** @brief Set to log buffer occupancy once a minute */
+  int monitor;
+
+  /** @brief Where to log every packet, or NULL */
+  FILE *logfp;
+
+  /** @brief File to dump the last 20s of audio to, or NULL */
+  const char *dumpfile;
+
+  /** @brief Number of elements of @ref address */
+  int naddress;
+
+  /** @brief Address to listen on (@c [[ADDRESS] PORT] or @c -
+   * @c [[ADDRESS] PORT]), or NULL to ask the server */
+  char **address;
+};
+
+int playrtp_start(const struct playrtp_settings *s);
+void playrtp_stop(void);
+int playrtp_running(void);
+int playrtp_failed(void);
+void playrtp_stats_report(FILE *fp);
+int playrtp_get_volume(int *left, int *right);
+int playrtp_set_volume(int *left, int *right);
+
+#endif /* PLAYRTP_H */
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
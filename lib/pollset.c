@@ -0,0 +1,344 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file lib/pollset.c
+ * @brief Persistent sets of file descriptors to wait for
+ *
+ * Three implementations are available.  epoll is used on Linux and kqueue
+ * on BSD-derived systems; in both cases changes in interest are passed to the
+ * kernel as they happen and waiting costs nothing per idle descriptor.
+ * Elsewhere a @c struct @c pollfd array is maintained incrementally and
+ * passed to poll().
+ */
+
+#include "common.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#if HAVE_SYS_EPOLL_H && HAVE_EPOLL_CREATE1
+# include <sys/epoll.h>
+# define POLLSET_EPOLL 1
+#elif HAVE_SYS_EVENT_H && HAVE_KQUEUE
+# include <sys/event.h>
+# include <sys/time.h>
+# define POLLSET_KQUEUE 1
+#else
+# include <poll.h>
+# define POLLSET_POLL 1
+#endif
+
+#include "mem.h"
+#include "log.h"
+#include "syscalls.h"
+#include "pollset.h"
+
+/** @brief Interest in one file descriptor */
+struct pollset_watch {
+  /** @brief Events wanted, or 0 */
+  unsigned events;
+
+  /** @brief Caller's data pointer */
+  void *data;
+
+#if POLLSET_POLL
+  /** @brief Index in @ref pollset::pfds */
+  int slot;
+#endif
+};
+
+/** @brief A set of file descriptors to wait for */
+struct pollset {
+  /** @brief Interest, indexed by file descriptor */
+  struct pollset_watch *watches;
+
+  /** @brief Size of @ref watches */
+  int nwatches;
+
+#if POLLSET_EPOLL || POLLSET_KQUEUE
+  /** @brief Kernel event set */
+  int kfd;
+#endif
+
+#if POLLSET_POLL
+  /** @brief Array passed to poll() */
+  struct pollfd *pfds;
+
+  /** @brief Number of elements of @ref pfds in use */
+  int npfds;
+#endif
+};
+
+/** @brief Create a new, empty pollset
+ * @return New pollset
+ *
+ * Terminates the process on error.
+ */
+struct pollset *pollset_new(void) {
+  struct pollset *ps = xmalloc(sizeof *ps);
+
+#if POLLSET_EPOLL
+  if((ps->kfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    disorder_fatal(errno, "epoll_create1");
+#elif POLLSET_KQUEUE
+  if((ps->kfd = kqueue()) < 0)
+    disorder_fatal(errno, "kqueue");
+  cloexec(ps->kfd);
+#endif
+  return ps;
+}
+
+/** @brief Destroy a pollset
+ * @param ps Pollset to destroy
+ *
+ * The file descriptors in the set are not closed.
+ */
+void pollset_free(struct pollset *ps) {
+  if(ps) {
+#if POLLSET_EPOLL || POLLSET_KQUEUE
+    close(ps->kfd);
+#endif
+#if POLLSET_POLL
+    xfree(ps->pfds);
+#endif
+    xfree(ps->watches);
+    xfree(ps);
+  }
+}
+
+/** @brief Set interest in a file descriptor
+ * @param ps Pollset to modify
+ * @param fd File descriptor
+ * @param events Events to wait for, or 0 to stop waiting for @p fd
+ * @param data Pointer to return when an event occurs
+ * @return 0 on success, non-0 on error
+ *
+ * A file descriptor must be removed from the set (by setting @p events to
+ * 0) before it is closed.
+ */
+int pollset_set(struct pollset *ps, int fd, unsigned events, void *data) {
+  struct pollset_watch *w;
+  unsigned old;
+
+  if(fd < 0) {
+    errno = EBADF;
+    return -1;
+  }
+  if(fd >= ps->nwatches) {
+    int n = ps->nwatches ? ps->nwatches : 16;
+
+    if(!events)
+      return 0;                         /* wasn't in the set anyway */
+    while(n <= fd)
+      n *= 2;
+    ps->watches = xrealloc(ps->watches, n * sizeof *ps->watches);
+    memset(ps->watches + ps->nwatches, 0,
+           (n - ps->nwatches) * sizeof *ps->watches);
+    ps->nwatches = n;
+  }
+  w = &ps->watches[fd];
+  old = w->events;
+#if POLLSET_EPOLL
+  if(old || events) {
+    struct epoll_event ev;
+    int op;
+
+    memset(&ev, 0, sizeof ev);
+    if(events & POLLSET_READ)
+      ev.events |= EPOLLIN;
+    if(events & POLLSET_WRITE)
+      ev.events |= EPOLLOUT;
+    ev.data.fd = fd;
+    op = !old ? EPOLL_CTL_ADD : !events ? EPOLL_CTL_DEL : EPOLL_CTL_MOD;
+    if((old != events || op != EPOLL_CTL_MOD)
+       && epoll_ctl(ps->kfd, op, fd, &ev) < 0)
+      return -1;
+  }
+#elif POLLSET_KQUEUE
+  {
+    struct kevent changes[2];
+    int nchanges = 0;
+
+    if((old ^ events) & POLLSET_READ)
+      EV_SET(&changes[nchanges++], fd, EVFILT_READ,
+             (events & POLLSET_READ) ? EV_ADD : EV_DELETE, 0, 0, NULL);
+    if((old ^ events) & POLLSET_WRITE)
+      EV_SET(&changes[nchanges++], fd, EVFILT_WRITE,
+             (events & POLLSET_WRITE) ? EV_ADD : EV_DELETE, 0, 0, NULL);
+    if(nchanges && kevent(ps->kfd, changes, nchanges, NULL, 0, NULL) < 0)
+      return -1;
+  }
+#elif POLLSET_POLL
+  if(!old && events) {
+    ps->pfds = xrealloc(ps->pfds, (ps->npfds + 1) * sizeof *ps->pfds);
+    w->slot = ps->npfds++;
+    ps->pfds[w->slot].fd = fd;
+  } else if(old && !events) {
+    /* Move the last entry into the vacated slot */
+    if(w->slot != --ps->npfds) {
+      ps->pfds[w->slot] = ps->pfds[ps->npfds];
+      ps->watches[ps->pfds[w->slot].fd].slot = w->slot;
+    }
+  }
+  if(events) {
+    ps->pfds[w->slot].events = 0;
+    if(events & POLLSET_READ)
+      ps->pfds[w->slot].events |= POLLIN;
+    if(events & POLLSET_WRITE)
+      ps->pfds[w->slot].events |= POLLOUT;
+  }
+#endif
+  w->events = events;
+  w->data = events ? data : NULL;
+  return 0;
+}
+
+/** @brief Return the events a file descriptor is being waited for
+ * @param ps Pollset
+ * @param fd File descriptor
+ * @return Events set by pollset_set(), or 0
+ */
+unsigned pollset_get(const struct pollset *ps, int fd) {
+  if(fd < 0 || fd >= ps->nwatches)
+    return 0;
+  return ps->watches[fd].events;
+}
+
+/** @brief Wait for events
+ * @param ps Pollset to wait on
+ * @param events Where to store events
+ * @param maxevents Size of @p events
+ * @param timeout Maximum time to wait in milliseconds, or -1 to wait forever
+ * @return Number of events stored, 0 on timeout, or -1 on error
+ *
+ * Each file descriptor appears at most once in the result.  Hangups and
+ * errors are reported as whichever of @ref POLLSET_READ and @ref
+ * POLLSET_WRITE was wanted.
+ *
+ * Interest may be modified freely between calls, including by the caller
+ * as it works through the results; but a file descriptor removed from the set
+ * may still appear in the results of the call that was already in progress,
+ * so the results should be checked against pollset_get().
+ */
+int pollset_wait(struct pollset *ps,
+                 struct pollset_event *events, int maxevents,
+                 int timeout) {
+  int n, i, nevents = 0;
+  unsigned got, wanted;
+
+#if POLLSET_EPOLL
+  struct epoll_event ev[64];
+
+  if(maxevents > (int)(sizeof ev / sizeof *ev))
+    maxevents = sizeof ev / sizeof *ev;
+  if((n = epoll_wait(ps->kfd, ev, maxevents, timeout)) < 0)
+    return -1;
+  for(i = 0; i < n; ++i) {
+    const int fd = ev[i].data.fd;
+
+    wanted = pollset_get(ps, fd);
+    got = 0;
+    if(ev[i].events & (EPOLLIN|EPOLLHUP|EPOLLERR))
+      got |= POLLSET_READ;
+    if(ev[i].events & (EPOLLOUT|EPOLLHUP|EPOLLERR))
+      got |= POLLSET_WRITE;
+    if((got &= wanted)) {
+      events[nevents].fd = fd;
+      events[nevents].events = got;
+      events[nevents].data = ps->watches[fd].data;
+      ++nevents;
+    }
+  }
+#elif POLLSET_KQUEUE
+  struct kevent ev[64];
+  struct timespec ts, *tsp;
+  int j;
+
+  if(maxevents > (int)(sizeof ev / sizeof *ev))
+    maxevents = sizeof ev / sizeof *ev;
+  if(timeout >= 0) {
+    ts.tv_sec = timeout / 1000;
+    ts.tv_nsec = (timeout % 1000) * 1000000;
+    tsp = &ts;
+  } else
+    tsp = NULL;
+  if((n = kevent(ps->kfd, NULL, 0, ev, maxevents, tsp)) < 0)
+    return -1;
+  for(i = 0; i < n; ++i) {
+    const int fd = ev[i].ident;
+
+    wanted = pollset_get(ps, fd);
+    got = ev[i].filter == EVFILT_READ ? POLLSET_READ : POLLSET_WRITE;
+    if(!(got &= wanted))
+      continue;
+    /* Merge with an earlier event for the same file descriptor */
+    for(j = 0; j < nevents && events[j].fd != fd; ++j)
+      ;
+    if(j == nevents) {
+      events[nevents].fd = fd;
+      events[nevents].events = 0;
+      events[nevents].data = ps->watches[fd].data;
+      ++nevents;
+    }
+    events[j].events |= got;
+  }
+#elif POLLSET_POLL
+  if((n = poll(ps->pfds, ps->npfds, timeout)) < 0)
+    return -1;
+  for(i = 0; i < ps->npfds && n > 0 && nevents < maxevents; ++i) {
+    const struct pollfd *p = &ps->pfds[i];
+
+    if(!p->revents)
+      continue;
+    --n;
+    wanted = pollset_get(ps, p->fd);
+    got = 0;
+    if(p->revents & (POLLIN|POLLHUP|POLLERR|POLLNVAL))
+      got |= POLLSET_READ;
+    if(p->revents & (POLLOUT|POLLHUP|POLLERR|POLLNVAL))
+      got |= POLLSET_WRITE;
+    if((got &= wanted)) {
+      events[nevents].fd = p->fd;
+      events[nevents].events = got;
+      events[nevents].data = ps->watches[p->fd].data;
+      ++nevents;
+    }
+  }
+#endif
+  return nevents;
+}
+
+/** @brief Return the name of the implementation in use */
+const char *pollset_backend(void) {
+#if POLLSET_EPOLL
+  return "epoll";
+#elif POLLSET_KQUEUE
+  return "kqueue";
+#else
+  return "poll";
+#endif
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -0,0 +1,73 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file lib/pollset.h
+ * @brief Persistent sets of file descriptors to wait for
+ */
+
+#ifndef POLLSET_H
+#define POLLSET_H
+
+/** @brief A set of file descriptors to wait for
+ *
+ * Unlike a @c struct @c pollfd array or an @c fd_set, interest in a file
+ * descriptor persists until it is changed.  Where the platform supports it
+ * (epoll on Linux, kqueue on BSD and OS X) the kernel remembers the set too,
+ * so waiting costs nothing per idle descriptor.
+ */
+struct pollset;
+
+/** @brief Wait for a file descriptor to be readable
+ *
+ * End of file and errors count as readable.
+ */
+#define POLLSET_READ 1
+
+/** @brief Wait for a file descriptor to be writable */
+#define POLLSET_WRITE 2
+
+/** @brief One event returned by pollset_wait() */
+struct pollset_event {
+  /** @brief File descriptor */
+  int fd;
+
+  /** @brief Events that occurred (@ref POLLSET_READ, @ref POLLSET_WRITE) */
+  unsigned events;
+
+  /** @brief Pointer passed to pollset_set() */
+  void *data;
+};
+
+struct pollset *pollset_new(void);
+void pollset_free(struct pollset *ps);
+int pollset_set(struct pollset *ps, int fd, unsigned events, void *data);
+unsigned pollset_get(const struct pollset *ps, int fd);
+int pollset_wait(struct pollset *ps,
+                 struct pollset_event *events, int maxevents,
+                 int timeout);
+const char *pollset_backend(void);
+
+#endif /* POLLSET_H */
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -62,6 +62,9 @@ enum lengths {
 
 struct conversion;
 
+/** @brief Size of the formatter's output buffer */
+#define PRINTF_BUFFER 256
+
 /** @brief Formatter state */
 struct state {
   /** @brief Output stream */
@@ -70,6 +73,12 @@ struct state {
   /** @brief Number of bytes written */
   int bytes;
 
+  /** @brief Bytes not yet passed to @ref output */
+  char buffer[PRINTF_BUFFER];
+
+  /** @brief Number of bytes in @ref buffer */
+  int nbuffered;
+
   /** @brief Argument list */
   va_list ap;
 };
@@ -123,8 +132,22 @@ struct conversion {
 /** @brief Flag characters (order significant!) */
 static const char flags[] = "'-+ #0";
 
+/* pass any buffered output on to the sink.  Return -1 on error, 0 on
+ * success. */
+static int do_flush(struct state *s) {
+  int n = s->nbuffered;
+
+  s->nbuffered = 0;
+  if(n && s->output->write(s->output, s->buffer, n) < 0)
+    return -1;
+  return 0;
+}
+
 /* write @nbytes@ to the output.  Return -1 on error, 0 on success.
- * Keeps track of the number of bytes written. */
+ * Keeps track of the number of bytes written.
+ *
+ * The pieces of a conversion are mostly small, so they are gathered up and
+ * passed on to the sink in chunks rather than one write per piece. */
 static int do_write(struct state *s,
 		    const void *buffer,
 		    int nbytes) {
@@ -134,8 +157,15 @@ static int do_write(struct state *s,
 #endif
     return -1;
   }
-  if(s->output->write(s->output, buffer, nbytes) < 0)
+  if(nbytes > PRINTF_BUFFER - s->nbuffered && do_flush(s) < 0)
     return -1;
+  if(nbytes >= PRINTF_BUFFER) {
+    if(s->output->write(s->output, buffer, nbytes) < 0)
+      return -1;
+  } else {
+    memcpy(s->buffer + s->nbuffered, buffer, nbytes);
+    s->nbuffered += nbytes;
+  }
   s->bytes += nbytes;
   return 0;
 }
@@ -540,8 +570,9 @@ int byte_vsinkprintf(struct sink *output,
   struct state s;
   struct conversion c;
 
-  memset(&s, 0, sizeof s);
   s.output = output;
+  s.bytes = 0;
+  s.nbuffered = 0;
   va_copy(s.ap,ap);
   while(*fmt) {
     /* output text up to next conversion specification */
@@ -570,6 +601,8 @@ int byte_vsinkprintf(struct sink *output,
     if(c.specifier->output(&s, &c) < 0)
       goto error;
   }
+  if(do_flush(&s) < 0)
+    goto error;
   va_end(s.ap);
   return s.bytes;
 error:
@@ -577,6 +610,20 @@ error:
   return -1;
 }
 
+char *byte_itoa(char buffer[BYTE_ITOA_SIZE], intmax_t n) {
+  char *ptr = buffer + BYTE_ITOA_SIZE;
+  uintmax_t u = n < 0 ? -(uintmax_t)n : (uintmax_t)n;
+
+  *--ptr = 0;
+  do {
+    *--ptr = '0' + u % 10;
+    u /= 10;
+  } while(u);
+  if(n < 0)
+    *--ptr = '-';
+  return ptr;
+}
+
 int byte_sinkprintf(struct sink *output, const char *fmt, ...) {
   int n;
   va_list ap;
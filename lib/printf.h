@@ -71,6 +71,13 @@ int byte_xasprintf(char **ptrp,
   ;
 /* same but terminate on error */
 
+/** @brief Buffer size sufficient for byte_itoa() */
+#define BYTE_ITOA_SIZE 24
+
+char *byte_itoa(char buffer[BYTE_ITOA_SIZE], intmax_t n);
+/* format @n@ in decimal at the end of @buffer@ and return a pointer to the
+ * (null-terminated) result; equivalent to %jd but far cheaper */
+
 int byte_vfprintf(FILE *fp, const char *fmt, va_list ap);
 int byte_fprintf(FILE *fp, const char *fmt, ...)
 #ifndef INHIBIT_PRINTF_FORMAT_CHECKING
@@ -24,6 +24,7 @@
 #include <stddef.h>
 
 #include "mem.h"
+#include "arena.h"
 #include "queue.h"
 #include "log.h"
 #include "split.h"
@@ -85,16 +86,9 @@ static int unmarshall_long(char *data, struct queue_entry *q,
   return 0;
 }
 
-static const char *marshall_long(const struct queue_entry *q, size_t offset) {
-  char buffer[256];
-  int n;
-
-  n = byte_snprintf(buffer, sizeof buffer, "%ld", VALUE(q, offset, long));
-  if(n < 0)
-    disorder_fatal(errno, "error converting int");
-  else if((size_t)n >= sizeof buffer)
-    disorder_fatal(0, "long converted to decimal is too long");
-  return xstrdup(buffer);
+static const char *marshall_long(const struct queue_entry *q, size_t offset,
+                                 char *buffer) {
+  return byte_itoa(buffer, VALUE(q, offset, long));
 }
 
 static void free_none(struct queue_entry attribute((unused)) *q,
@@ -111,7 +105,8 @@ static int unmarshall_string(char *data, struct queue_entry *q,
   return 0;
 }
 
-static const char *marshall_string(const struct queue_entry *q, size_t offset) {
+static const char *marshall_string(const struct queue_entry *q, size_t offset,
+                                   char attribute((unused)) *buffer) {
   return VALUE(q, offset, char *);
 }
 
@@ -134,17 +129,9 @@ static int unmarshall_time_t(char *data, struct queue_entry *q,
   return 0;
 }
 
-static const char *marshall_time_t(const struct queue_entry *q, size_t offset) {
-  char buffer[256];
-  int n;
-
-  n = byte_snprintf(buffer, sizeof buffer,
-		    "%"PRIdMAX, (intmax_t)VALUE(q, offset, time_t));
-  if(n < 0)
-    disorder_fatal(errno, "error converting time");
-  else if((size_t)n >= sizeof buffer)
-    disorder_fatal(0, "time converted to decimal is too long");
-  return xstrdup(buffer);
+static const char *marshall_time_t(const struct queue_entry *q, size_t offset,
+                                   char *buffer) {
+  return byte_itoa(buffer, VALUE(q, offset, time_t));
 }
 
 #define free_time_t free_none
@@ -183,11 +170,13 @@ static int unmarshall_origin(char *data, struct queue_entry *q,
   return 0;
 }
 
-static const char *marshall_state(const struct queue_entry *q, size_t offset) {
+static const char *marshall_state(const struct queue_entry *q, size_t offset,
+                                  char attribute((unused)) *buffer) {
   return playing_states[VALUE(q, offset, enum playing_state)];
 }
 
-static const char *marshall_origin(const struct queue_entry *q, size_t offset) {
+static const char *marshall_origin(const struct queue_entry *q, size_t offset,
+                                   char attribute((unused)) *buffer) {
   return track_origins[VALUE(q, offset, enum track_origin)];
 }
 
@@ -204,8 +193,13 @@ static const struct queue_field {
   /** @brief Offset of value in @ref queue_entry structure */
   size_t offset;
 
-  /** @brief Marshaling function */
-  const char *(*marshall)(const struct queue_entry *q, size_t offset);
+  /** @brief Marshaling function
+   *
+   * Returns the unquoted value, or NULL to omit the field.  @c buffer has
+   * room for @ref BYTE_ITOA_SIZE bytes, for values that must be formatted.
+   */
+  const char *(*marshall)(const struct queue_entry *q, size_t offset,
+                          char *buffer);
 
   /** @brief Unmarshaling function */
   int (*unmarshall)(char *data, struct queue_entry *q, size_t offset,
@@ -233,20 +227,26 @@ static const struct queue_field {
 int queue_unmarshall(struct queue_entry *q, const char *s,
 		     void (*error_handler)(const char *, void *),
 		     void *u) {
-  char **vec;
+  char *vec[2 * NFIELDS + 1], *copy;
   int nvec, rc;
 
   q->pid = -1;                          /* =none */
-  if(!(vec = split(s, &nvec, SPLIT_QUOTES, error_handler, u)))
-    return -1;
-  rc = queue_unmarshall_vec(q, nvec, vec, error_handler, u);
-  free_strings(nvec, vec);
+  /* Split a single copy in place; each field is copied out of it again, so
+   * it needn't outlive this call */
+  copy = xstrdup(s);
+  if((nvec = split_fixed(copy, vec, 2 * NFIELDS, SPLIT_QUOTES,
+                         error_handler, u)) < 0)
+    rc = -1;
+  else
+    rc = queue_unmarshall_vec(q, nvec, vec, error_handler, u);
+  xfree(copy);
   return rc;
 }
 
 int queue_unmarshall_vec(struct queue_entry *q, int nvec, char **vec,
 			 void (*error_handler)(const char *, void *),
 			 void *u) {
+  unsigned next = 0;
   int n;
 
   if(nvec % 2 != 0) {
@@ -255,7 +255,14 @@ int queue_unmarshall_vec(struct queue_entry *q, int nvec, char **vec,
   }
   while(*vec) {
     D(("key %s value %s", vec[0], vec[1]));
-    if((n = TABLE_FIND(fields, name, *vec)) < 0) {
+    /* Keys are normally in table order, so try the next one first */
+    while(next < NFIELDS && strcmp(fields[next].name, *vec) < 0)
+      ++next;
+    if(next < NFIELDS && !strcmp(fields[next].name, *vec))
+      n = next++;
+    else
+      n = TABLE_FIND(fields, name, *vec);
+    if(n < 0) {
       error_handler("unknown key in queue data", u);
       return -1;
     } else {
@@ -267,29 +274,58 @@ int queue_unmarshall_vec(struct queue_entry *q, int nvec, char **vec,
   return 0;
 }
 
-char *queue_marshall(const struct queue_entry *q) {
+/** @brief Marshall a queue entry
+ * @param q Queue entry
+ * @param a Arena to allocate from, or NULL to use the garbage collector
+ * @param expected Nonzero to include the @c expected field
+ * @return Marshalled form of @p q
+ */
+static char *queue__marshall(const struct queue_entry *q, struct arena *a,
+                             int expected) {
   unsigned n;
-  const char *vec[sizeof fields / sizeof *fields], *v;
-  char *r, *s;
+  const char *vec[NFIELDS];
+  char buffers[NFIELDS][BYTE_ITOA_SIZE], *r, *s;
   size_t len = 1;
 
-  for(n = 0; n < sizeof fields / sizeof *fields; ++n)
-    if((v = fields[n].marshall(q, fields[n].offset))) {
-      vec[n] = quoteutf8(v);
-      len += strlen(vec[n]) + strlen(fields[n].name) + 2;
-    } else
+  /* Find the values and how much space they need quoted, then write them
+   * straight into the result; nothing else is allocated */
+  for(n = 0; n < NFIELDS; ++n)
+    if(!expected
+       && fields[n].offset == offsetof(struct queue_entry, expected))
       vec[n] = 0;
-  s = r = xmalloc_noptr(len);
-  for(n = 0; n < sizeof fields / sizeof *fields; ++n)
+    else if((vec[n] = fields[n].marshall(q, fields[n].offset, buffers[n])))
+      len += quoteutf8_size(vec[n]) + strlen(fields[n].name) + 2;
+  s = r = a ? arena_alloc(a, len) : xmalloc_noptr(len);
+  *s = 0;
+  for(n = 0; n < NFIELDS; ++n)
     if(vec[n]) {
       *s++ = ' ';
       s += strlen(strcpy(s, fields[n].name));
       *s++ = ' ';
-      s += strlen(strcpy(s, vec[n]));
+      s = quoteutf8_copy(s, vec[n]);
     }
   return r;
 }
 
+char *queue_marshall(const struct queue_entry *q) {
+  return queue__marshall(q, NULL, 1);
+}
+
+char *queue_marshall_arena(const struct queue_entry *q, struct arena *a) {
+  return queue__marshall(q, a, 1);
+}
+
+/** @brief Marshall a queue entry without its expected start time
+ * @param q Queue entry
+ * @return Marshalled form of @p q, less the @c expected field
+ *
+ * @c expected sorts first, so a marshalled entry can be put back together
+ * by following <tt>" expected "</tt> and its value with this.
+ */
+char *queue_marshall_unexpected(const struct queue_entry *q) {
+  return queue__marshall(q, NULL, 0);
+}
+
 void queue_free(struct queue_entry *q, int rest) {
   unsigned n;
   if(!q)
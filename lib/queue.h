@@ -26,6 +26,8 @@
 
 #include <time.h>
 
+struct arena;
+
 /** @brief Possible track states */
 enum playing_state {
   /** @brief Track failed to play */
@@ -188,6 +190,13 @@ struct queue_entry {
   /** @brief How much of track has been played so far (seconds) */
   long sofar;
 
+  /** @brief Seconds skipped at the start (raw-format tracks only)
+   *
+   * Set when a track that was interrupted by the server stopping is started
+   * again from where it got to.
+   */
+  long resume;
+
   /** @brief True if track preparation is underway
    *
    * This is set when a decoder has been started and is expected to connect to
@@ -204,6 +213,12 @@ struct queue_entry {
    * For non-raw tracks this should always be zero.
    */
   int prepared;
+
+  /** @brief True once the track has been read ahead
+   *
+   * See @ref server/prefetch.c.
+   */
+  int prefetched;
   /* For DISORDER_PLAYER_PAUSES only: */
 
   /** @brief When last paused or 0 */
@@ -244,6 +259,12 @@ int queue_unmarshall_vec(struct queue_entry *q, int nvec, char **vec,
 char *queue_marshall(const struct queue_entry *q);
 /* marshall @q@ into a UTF-8 string */
 
+char *queue_marshall_arena(const struct queue_entry *q, struct arena *a);
+/* marshall @q@ into a UTF-8 string allocated from @a@ */
+
+char *queue_marshall_unexpected(const struct queue_entry *q);
+/* marshall @q@ leaving out the expected field */
+
 void queue_free(struct queue_entry *q, int rest);
 
 #endif /* QUEUE_H */
@@ -37,6 +37,16 @@ static int random_count;
 static int random_fd = -1;
 static salsa208_context random_ctx[1];
 
+/** @brief Pool of generated random bytes
+ *
+ * The keystream is generated a pool at a time so that salsa208_stream() can
+ * produce many blocks at once, and small requests are just copies.
+ */
+static unsigned char random_pool[4096];
+
+/** @brief Number of bytes of @ref random_pool already used */
+static size_t random_used = sizeof random_pool;
+
 /** @brief Rekey the RNG
  *
  * Resets the RNG's key to a random one read from /dev/urandom
@@ -62,13 +72,25 @@ static void random__rekey(void) {
  * @param bytes How many random bytes to generate
  */
 void random_get(void *ptr, size_t bytes) {
-  if(random_count == 0)
-    random__rekey();
-  salsa208_stream(random_ctx, 0, ptr, bytes);
-  if(bytes > (size_t)random_count)
-    random_count = 0;
-  else
-    random_count -= bytes;
+  unsigned char *p = ptr;
+  size_t n;
+
+  while(bytes > 0) {
+    if(random_used == sizeof random_pool) {
+      if(random_count <= 0)
+        random__rekey();
+      salsa208_stream(random_ctx, 0, random_pool, sizeof random_pool);
+      random_count -= sizeof random_pool;
+      random_used = 0;
+    }
+    n = sizeof random_pool - random_used;
+    if(n > bytes)
+      n = bytes;
+    memcpy(p, random_pool + random_used, n);
+    random_used += n;
+    p += n;
+    bytes -= n;
+  }
 }
 
 /** @brief Return a random ID string */
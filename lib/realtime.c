@@ -0,0 +1,332 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file lib/realtime.c
+ * @brief Scheduling of audio threads
+ *
+ * Threads that feed the sound device or the network can ask for realtime
+ * scheduling and to be kept to particular CPUs, so that they aren't held up
+ * by rescans, database work and so on.  The program calls
+ * realtime_configure() once, before starting any audio threads, and each
+ * such thread calls realtime_thread() when it starts.
+ *
+ * Realtime scheduling normally needs privilege (e.g. @c CAP_SYS_NICE or a
+ * suitable @c RLIMIT_RTPRIO).  If realtime_configure() is called as root, as
+ * it is in the speaker, it raises @c RLIMIT_RTPRIO so that the threads can
+ * still have it after root has been given up.  If it is refused then a
+ * message is logged, once, and the thread carries on at normal priority.
+ *
+ * Audio buffers can also come from a region of memory reserved by
+ * realtime_memory(), which is touched and locked in advance so that the
+ * threads using them never wait for a page fault.  realtime_alloc() hands out
+ * blocks from it and realtime_free() returns them.  Freed blocks are kept on
+ * a list and reused for requests of no more than their size; they are not
+ * split or merged, which suits the small number of fixed sizes actually
+ * asked for.
+ */
+#include "common.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+
+#include "log.h"
+#include "mem.h"
+#include "realtime.h"
+
+/** @brief Highest CPU number that can be named */
+#define REALTIME_MAX_CPU 63
+
+/** @brief Scheduling policy, or -1 to leave it alone */
+static int realtime_policy = -1;
+
+/** @brief Scheduling priority */
+static int realtime_priority;
+
+/** @brief CPUs to run on, or 0 for any */
+static unsigned long long realtime_cpus;
+
+/** @brief Set once a scheduling failure has been logged */
+static int realtime_sched_warned;
+
+/** @brief Set once an affinity failure has been logged */
+static int realtime_cpus_warned;
+
+/** @brief Alignment and granularity of locked memory blocks */
+#define REALTIME_ALIGN 64
+
+/** @brief Size of a huge page, to which huge page regions are rounded */
+#define REALTIME_HUGE_PAGE (2 * 1024 * 1024)
+
+/** @brief Header for a block of locked memory
+ *
+ * The block proper follows after @ref REALTIME_ALIGN bytes.
+ */
+struct realtime_block {
+  /** @brief Usable size of the block */
+  size_t size;
+
+  /** @brief Next free block */
+  struct realtime_block *next;
+};
+
+/** @brief Start of locked memory, or NULL */
+static char *realtime_region;
+
+/** @brief Size of @ref realtime_region */
+static size_t realtime_region_size;
+
+/** @brief Bytes of @ref realtime_region not yet handed out */
+static size_t realtime_region_used;
+
+/** @brief Freed blocks */
+static struct realtime_block *realtime_free_blocks;
+
+/** @brief Lock protecting locked memory */
+static pthread_mutex_t realtime_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** @brief Parse a list of CPUs
+ * @param spec List of CPU numbers and ranges, e.g. "2,3" or "0-1,4"
+ * @param maskp Where to store the corresponding bitmap
+ * @return 0 on success, -1 on error
+ */
+int realtime_parse_cpus(const char *spec, unsigned long long *maskp) {
+  unsigned long long mask = 0;
+  unsigned long first, last, n;
+  char *end;
+
+  do {
+    if(*spec < '0' || *spec > '9')
+      return -1;
+    first = last = strtoul(spec, &end, 10);
+    if(*end == '-') {
+      spec = end + 1;
+      if(*spec < '0' || *spec > '9')
+        return -1;
+      last = strtoul(spec, &end, 10);
+    }
+    if(first > last || last > REALTIME_MAX_CPU)
+      return -1;
+    for(n = first; n <= last; ++n)
+      mask |= 1ULL << n;
+    spec = end;
+  } while(*spec++ == ',');
+  if(spec[-1])
+    return -1;
+  *maskp = mask;
+  return 0;
+}
+
+/** @brief Set the scheduling for audio threads
+ * @param policy "normal", "fifo" or "rr"
+ * @param priority Realtime priority, or 0 for the policy's minimum
+ * @param cpus CPUs to run audio threads on, or NULL or "" for any
+ *
+ * Must be called before any audio threads are started.  Invalid settings are
+ * reported and ignored.
+ */
+void realtime_configure(const char *policy, long priority, const char *cpus) {
+  realtime_cpus = 0;
+  if(!policy || !strcmp(policy, "normal"))
+    realtime_policy = -1;
+  else if(!strcmp(policy, "fifo"))
+    realtime_policy = SCHED_FIFO;
+  else if(!strcmp(policy, "rr"))
+    realtime_policy = SCHED_RR;
+  else {
+    disorder_error(0, "unknown scheduling policy '%s'", policy);
+    realtime_policy = -1;
+  }
+  if(realtime_policy != -1) {
+    const int min = sched_get_priority_min(realtime_policy);
+    const int max = sched_get_priority_max(realtime_policy);
+
+    if(priority < min)
+      realtime_priority = min;
+    else if(priority > max)
+      realtime_priority = max;
+    else
+      realtime_priority = priority;
+#ifdef RLIMIT_RTPRIO
+    /* If we're still root, allow for the threads being started after we've
+     * given it up */
+    struct rlimit rl;
+    if(getrlimit(RLIMIT_RTPRIO, &rl) == 0
+       && rl.rlim_cur != RLIM_INFINITY
+       && rl.rlim_cur < (rlim_t)realtime_priority) {
+      rl.rlim_cur = realtime_priority;
+      if(rl.rlim_max != RLIM_INFINITY && rl.rlim_max < rl.rlim_cur)
+        rl.rlim_max = rl.rlim_cur;
+      setrlimit(RLIMIT_RTPRIO, &rl);    /* fails if we're not root */
+    }
+#endif
+  }
+  if(cpus && *cpus && realtime_parse_cpus(cpus, &realtime_cpus))
+    disorder_error(0, "invalid CPU list '%s'", cpus);
+}
+
+/** @brief Apply the audio thread scheduling to the calling thread
+ * @param name Name of thread, for error messages
+ */
+void realtime_thread(const char *name) {
+  int e;
+
+  if(realtime_policy != -1) {
+    struct sched_param param;
+
+    memset(&param, 0, sizeof param);
+    param.sched_priority = realtime_priority;
+    if((e = pthread_setschedparam(pthread_self(), realtime_policy, &param))
+       && !__atomic_exchange_n(&realtime_sched_warned, 1, __ATOMIC_RELAXED))
+      disorder_error(e, "cannot use realtime scheduling for %s thread;"
+                     " continuing at normal priority", name);
+  }
+  if(realtime_cpus) {
+#if HAVE_PTHREAD_SETAFFINITY_NP
+    cpu_set_t set;
+    int n;
+
+    CPU_ZERO(&set);
+    for(n = 0; n <= REALTIME_MAX_CPU; ++n)
+      if(realtime_cpus & (1ULL << n))
+        CPU_SET(n, &set);
+    e = pthread_setaffinity_np(pthread_self(), sizeof set, &set);
+#else
+    e = ENOSYS;
+#endif
+    if(e && !__atomic_exchange_n(&realtime_cpus_warned, 1, __ATOMIC_RELAXED))
+      disorder_error(e, "cannot set CPU affinity for %s thread", name);
+  }
+}
+
+/** @brief Reserve locked memory for audio buffers
+ * @param bytes Size of memory to reserve, or 0 for none
+ * @param huge Nonzero to use huge pages if possible
+ *
+ * Should be called before any audio buffers are allocated, and only once.
+ * Locking memory normally needs privilege (e.g. @c CAP_IPC_LOCK or a
+ * suitable @c RLIMIT_MEMLOCK); memory locked while root stays locked after
+ * root is given up.  If the memory cannot be had then a message is logged and
+ * buffers are allocated normally.
+ */
+void realtime_memory(size_t bytes, int huge) {
+  void *region = MAP_FAILED;
+
+  if(!bytes || realtime_region)
+    return;
+#ifdef MAP_HUGETLB
+  if(huge) {
+    const size_t rounded = ((bytes + REALTIME_HUGE_PAGE - 1)
+                            / REALTIME_HUGE_PAGE * REALTIME_HUGE_PAGE);
+    region = mmap(NULL, rounded, PROT_READ|PROT_WRITE,
+                  MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+    if(region == MAP_FAILED)
+      disorder_error(errno, "cannot map %zu bytes of huge pages;"
+                     " using normal pages", rounded);
+    else
+      bytes = rounded;
+  }
+#else
+  if(huge)
+    disorder_error(0, "huge pages not supported; using normal pages");
+#endif
+  if(region == MAP_FAILED) {
+    region = mmap(NULL, bytes, PROT_READ|PROT_WRITE,
+                  MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if(region == MAP_FAILED) {
+      disorder_error(errno, "cannot map %zu bytes for audio buffers", bytes);
+      return;
+    }
+  }
+  /* mlock() faults everything in; the memset is for when it fails */
+  if(mlock(region, bytes) < 0)
+    disorder_error(errno, "cannot lock %zu bytes of audio buffers;"
+                   " continuing unlocked", bytes);
+  memset(region, 0, bytes);
+  /* Blocks may hold pointers to heap memory */
+  mem_add_roots(region, bytes);
+  realtime_region = region;
+  realtime_region_size = bytes;
+  realtime_region_used = 0;
+  disorder_info("reserved %zu bytes of memory for audio buffers", bytes);
+}
+
+/** @brief Allocate a block of locked memory
+ * @param bytes Size of block
+ * @return Pointer to zeroed block, or NULL if none is available
+ *
+ * Returns NULL if realtime_memory() hasn't reserved anything or if what it
+ * reserved is used up; callers should then allocate normally.
+ */
+void *realtime_alloc(size_t bytes) {
+  struct realtime_block *b, **bb;
+  size_t total;
+
+  if(!realtime_region)
+    return NULL;
+  bytes = (bytes + REALTIME_ALIGN - 1) / REALTIME_ALIGN * REALTIME_ALIGN;
+  pthread_mutex_lock(&realtime_lock);
+  for(bb = &realtime_free_blocks; (b = *bb); bb = &b->next)
+    if(b->size >= bytes) {
+      *bb = b->next;
+      pthread_mutex_unlock(&realtime_lock);
+      memset((char *)b + REALTIME_ALIGN, 0, b->size);
+      return (char *)b + REALTIME_ALIGN;
+    }
+  total = bytes + REALTIME_ALIGN;
+  if(realtime_region_size - realtime_region_used < total) {
+    pthread_mutex_unlock(&realtime_lock);
+    return NULL;
+  }
+  b = (struct realtime_block *)(realtime_region + realtime_region_used);
+  realtime_region_used += total;
+  pthread_mutex_unlock(&realtime_lock);
+  b->size = bytes;
+  return (char *)b + REALTIME_ALIGN;
+}
+
+/** @brief Free a block of locked memory
+ * @param ptr Block to free
+ * @return Nonzero if @p ptr was freed, 0 if it isn't locked memory
+ *
+ * If this returns 0 the caller should free @p ptr normally.
+ */
+int realtime_free(void *ptr) {
+  struct realtime_block *b;
+
+  if(!realtime_region
+     || (char *)ptr < realtime_region
+     || (char *)ptr >= realtime_region + realtime_region_size)
+    return 0;
+  b = (struct realtime_block *)((char *)ptr - REALTIME_ALIGN);
+  pthread_mutex_lock(&realtime_lock);
+  b->next = realtime_free_blocks;
+  realtime_free_blocks = b;
+  pthread_mutex_unlock(&realtime_lock);
+  return 1;
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
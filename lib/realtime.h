@@ -0,0 +1,41 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file lib/realtime.h
+ * @brief Scheduling of audio threads
+ */
+
+#ifndef REALTIME_H
+#define REALTIME_H
+
+int realtime_parse_cpus(const char *spec, unsigned long long *maskp);
+void realtime_configure(const char *policy, long priority, const char *cpus);
+void realtime_thread(const char *name);
+void realtime_memory(size_t bytes, int huge);
+void *realtime_alloc(size_t bytes);
+int realtime_free(void *ptr);
+
+#endif /* REALTIME_H */
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
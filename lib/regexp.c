@@ -17,17 +17,94 @@
  */
 /** @file lib/regexp.c
  * @brief Regular expressions
+ *
+ * With PCRE2, patterns are JIT-compiled where the library supports it, and
+ * the match data block is kept between calls to regexp_match().
+ *
+ * regexp_compile_cached() keeps recently used patterns so that the same
+ * filter, for instance from the web interface, isn't compiled afresh for
+ * every request.
  */
 #include "common.h"
 
 #include "regexp.h"
 #include "mem.h"
 
+/** @brief Number of patterns kept by regexp_compile_cached() */
+#define REGEXP_CACHE_SIZE 16
+
+/** @brief A cached pattern */
+struct regexp_cached {
+  /** @brief Pattern, or NULL if the slot is empty */
+  char *pat;
+
+  /** @brief Compilation flags */
+  unsigned flags;
+
+  /** @brief Compiled pattern */
+  regexp *re;
+
+  /** @brief When last used, by @ref regexp_cache_clock */
+  unsigned long used;
+};
+
+/** @brief Cached patterns */
+static struct regexp_cached regexp_cache[REGEXP_CACHE_SIZE];
+
+/** @brief Incremented on each call to regexp_compile_cached() */
+static unsigned long regexp_cache_clock;
+
+/** @brief Compile a regular expression, using a cache
+ * @param pat Pattern
+ * @param f Compilation flags
+ * @param errbuf Where to put the error message
+ * @param errlen Size of @p errbuf
+ * @param erroff_out Where to put the offset of the error
+ * @return Compiled pattern, or NULL on error
+ *
+ * The result belongs to the cache and must not be freed.  It is only valid
+ * until the next call to this function.  Errors are not cached.
+ */
+regexp *regexp_compile_cached(const char *pat, unsigned f,
+                              char *errbuf, size_t errlen, size_t *erroff_out)
+{
+  struct regexp_cached *c, *victim = &regexp_cache[0];
+  regexp *re;
+
+  ++regexp_cache_clock;
+  for(c = regexp_cache; c < regexp_cache + REGEXP_CACHE_SIZE; ++c) {
+    if(c->pat && c->flags == f && !strcmp(c->pat, pat)) {
+      c->used = regexp_cache_clock;
+      return c->re;
+    }
+    /* Remember an empty slot, or failing that the least recently used */
+    if(victim->pat && (!c->pat || c->used < victim->used))
+      victim = c;
+  }
+  if(!(re = regexp_compile(pat, f, errbuf, errlen, erroff_out)))
+    return NULL;
+  if(victim->pat) {
+    regexp_free(victim->re);
+    xfree(victim->pat);
+  }
+  victim->pat = xstrdup(pat);
+  victim->flags = f;
+  victim->re = re;
+  victim->used = regexp_cache_clock;
+  return re;
+}
+
 #ifdef HAVE_LIBPCRE2
 
 static pcre2_general_context *genctx = 0;
 static pcre2_compile_context *compctx = 0;
 
+/** @brief Match data kept between calls to regexp_match() */
+static pcre2_match_data *match_data;
+
+/** @brief Number of pairs @ref match_data has room for */
+static size_t match_data_size;
+
 static void *rxalloc(size_t sz, void attribute((unused)) *q)
   { return xmalloc(sz); }
 static void rxfree(void *p, void attribute((unused)) *q)
@@ -55,7 +132,9 @@ regexp *regexp_compile(const char *pat, unsigned f,
   if(!re) {
     *erroff_out = erroff;
     pcre2_get_error_message(errcode, (PCRE2_UCHAR *)errbuf, errlen);
-  }
+  } else
+    /* If there's no JIT support this fails and matching is interpreted */
+    pcre2_jit_compile(re, PCRE2_JIT_COMPLETE);
   return re;
 }
 
@@ -63,15 +142,18 @@ int regexp_match(const regexp *re, const char *s, size_t n, unsigned f,
 		 size_t *ov, size_t on)
 {
   int rc;
-  pcre2_match_data *m;
   PCRE2_SIZE *ovp;
   size_t i;
 
-  m = pcre2_match_data_create(on, genctx);
-  rc = pcre2_match(re, (PCRE2_SPTR)s, n, 0, f, m, 0);
-  ovp = pcre2_get_ovector_pointer(m);
+  if(on > match_data_size) {
+    if(match_data)
+      pcre2_match_data_free(match_data);
+    match_data = pcre2_match_data_create(on, genctx);
+    match_data_size = on;
+  }
+  rc = pcre2_match(re, (PCRE2_SPTR)s, n, 0, f, match_data, 0);
+  ovp = pcre2_get_ovector_pointer(match_data);
   for(i = 0; i < on; i++) ov[i] = ovp[i];
-  pcre2_match_data_free(m);
   return rc;
 }
 
@@ -44,6 +44,9 @@ void regexp_setup(void);
 regexp *regexp_compile(const char *pat, unsigned f,
 		       char *errbuf, size_t errlen, size_t *erroff_out);
 
+regexp *regexp_compile_cached(const char *pat, unsigned f,
+			      char *errbuf, size_t errlen, size_t *erroff_out);
+
 int regexp_match(const regexp *re, const char *s, size_t n, unsigned f,
 		 size_t *ov, size_t on);
 
@@ -19,12 +19,17 @@
 /** @file lib/resample.c
  * @brief Audio resampling
  *
- * General purpose audio format conversion.  Rate conversion only works if the
- * SRC samplerate library is available, but the bitness/channel/endianness
- * conversion works regardless.
+ * General purpose audio format conversion.  Rate conversion uses the SRC
+ * samplerate library if it is available.  If not then a built-in polyphase
+ * windowed-sinc filter is used instead; this is not as good but is fine for
+ * the usual conversions such as 44.1KHz to 48KHz.  The bitness, channel and
+ * endianness conversion is always done here.
  */
 
 #include "common.h"
+
+#include <math.h>
+
 #include "resample.h"
 #include "log.h"
 #include "mem.h"
@@ -35,6 +40,389 @@
 /** @brief Multiplier for signed formats to allow easy switching */
 #define SIGNED 4
 
+/* Input converters.  Each converts a block of samples in one format to floats
+ * in [-1,1].  They are written as simple loops over the block so that the
+ * compiler can vectorize them. */
+
+static void get_u8(const uint8_t *bytes, size_t n, float *floats) {
+  for(size_t i = 0; i < n; ++i)
+    floats[i] = (bytes[i] - 128) * (1.0f / 128);
+}
+
+static void get_s8(const uint8_t *bytes, size_t n, float *floats) {
+  for(size_t i = 0; i < n; ++i)
+    floats[i] = (int8_t)bytes[i] * (1.0f / 128);
+}
+
+static void get_u16be(const uint8_t *bytes, size_t n, float *floats) {
+  for(size_t i = 0; i < n; ++i)
+    floats[i] = (bytes[2 * i] * 256 + bytes[2 * i + 1] - 32768)
+                  * (1.0f / 32768);
+}
+
+static void get_u16le(const uint8_t *bytes, size_t n, float *floats) {
+  for(size_t i = 0; i < n; ++i)
+    floats[i] = (bytes[2 * i + 1] * 256 + bytes[2 * i] - 32768)
+                  * (1.0f / 32768);
+}
+
+static void get_s16be(const uint8_t *bytes, size_t n, float *floats) {
+  for(size_t i = 0; i < n; ++i)
+    floats[i] = (int16_t)(bytes[2 * i] * 256 + bytes[2 * i + 1])
+                  * (1.0f / 32768);
+}
+
+static void get_s16le(const uint8_t *bytes, size_t n, float *floats) {
+  for(size_t i = 0; i < n; ++i)
+    floats[i] = (int16_t)(bytes[2 * i + 1] * 256 + bytes[2 * i])
+                  * (1.0f / 32768);
+}
+
+/** @brief Scale and clip a sample value
+ * @param sample Sample value in [-1,1]
+ * @param scale 128 or 32768
+ * @return Sample value in [-scale,scale-1], rounded towards zero
+ *
+ * The value is clipped naively if it will not fit.  Clipping is done before
+ * rounding so that the conversion to an integer is always defined.
+ */
+static inline int scale_signed(float sample, float scale) {
+  float v = sample * scale;
+  if(v < -scale)
+    v = -scale;
+  else if(v > scale - 1)
+    v = scale - 1;
+  return (int)v;
+}
+
+/** @brief Scale and clip a sample value for an unsigned format
+ * @param sample Sample value in [-1,1]
+ * @param scale 128 or 32768
+ * @return Sample value in [0,2*scale-1]
+ *
+ * Rounds towards minus infinity, i.e. the offset is applied before rounding.
+ */
+static inline int scale_unsigned(float sample, float scale) {
+  float v = sample * scale;
+  if(v < -scale)
+    v = -scale;
+  else if(v > scale - 1)
+    v = scale - 1;
+  int i = (int)v;
+  i -= (i > v);
+  return i + (int)scale;
+}
+
+/* Output converters.  Each converts a block of floats to samples in one
+ * format. */
+
+static void put_u8(const float *floats, size_t n, uint8_t *bytes) {
+  for(size_t i = 0; i < n; ++i)
+    bytes[i] = scale_unsigned(floats[i], 128);
+}
+
+static void put_s8(const float *floats, size_t n, uint8_t *bytes) {
+  for(size_t i = 0; i < n; ++i)
+    bytes[i] = scale_signed(floats[i], 128);
+}
+
+static void put_u16be(const float *floats, size_t n, uint8_t *bytes) {
+  for(size_t i = 0; i < n; ++i) {
+    const unsigned value = scale_unsigned(floats[i], 32768);
+    bytes[2 * i] = value >> 8;
+    bytes[2 * i + 1] = value;
+  }
+}
+
+static void put_u16le(const float *floats, size_t n, uint8_t *bytes) {
+  for(size_t i = 0; i < n; ++i) {
+    const unsigned value = scale_unsigned(floats[i], 32768);
+    bytes[2 * i] = value;
+    bytes[2 * i + 1] = value >> 8;
+  }
+}
+
+static void put_s16be(const float *floats, size_t n, uint8_t *bytes) {
+  for(size_t i = 0; i < n; ++i) {
+    const unsigned value = scale_signed(floats[i], 32768);
+    bytes[2 * i] = value >> 8;
+    bytes[2 * i + 1] = value;
+  }
+}
+
+static void put_s16le(const float *floats, size_t n, uint8_t *bytes) {
+  for(size_t i = 0; i < n; ++i) {
+    const unsigned value = scale_signed(floats[i], 32768);
+    bytes[2 * i] = value;
+    bytes[2 * i + 1] = value >> 8;
+  }
+}
+
+#if !HAVE_SAMPLERATE_H
+/** @brief Zero crossings of the filter kernel on each side of its centre
+ *
+ * More gives a sharper filter at the cost of more arithmetic.
+ */
+#define FILTER_ZEROS 32
+
+/** @brief Kaiser window parameter
+ *
+ * This gives a stopband attenuation of about 80dB.
+ */
+#define FILTER_BETA 8.0
+
+/** @brief Filter cutoff as a fraction of the lower of the two Nyquist rates */
+#define FILTER_CUTOFF 0.92
+
+/** @brief Maximum number of filter phases
+ *
+ * If the ratio between the rates needs more phases than this then the nearest
+ * phase is used, which is a little less accurate.
+ */
+#define FILTER_MAX_PHASES 1024
+
+/** @brief State for the built-in rate converter
+ *
+ * The output rate is @c L/M times the input rate, with @c L and @c M having
+ * no common factor.  Output frame @c k is computed from the input around
+ * frame @c k*M/L using the filter phase for the fractional part of that.
+ */
+struct resample_filter {
+  /** @brief Channels per frame */
+  int channels;
+
+  /** @brief Upsampling factor */
+  uint64_t L;
+
+  /** @brief Downsampling factor */
+  uint64_t M;
+
+  /** @brief Number of phases in @ref coeffs, less one */
+  uint64_t phases;
+
+  /** @brief Taps per phase */
+  size_t taps;
+
+  /** @brief Filter coefficients, @ref taps for each phase */
+  float *coeffs;
+
+  /** @brief Buffered input frames */
+  float *buffer;
+
+  /** @brief Frames in @ref buffer */
+  size_t nbuffer;
+
+  /** @brief Size of @ref buffer in frames */
+  size_t size;
+
+  /** @brief Input frames ever discarded from the start of @ref buffer */
+  uint64_t dropped;
+
+  /** @brief Input frames ever supplied */
+  uint64_t in;
+
+  /** @brief Output frames ever generated */
+  uint64_t out;
+};
+
+/** @brief Modified Bessel function of the first kind, order 0 */
+static double bessel_i0(double x) {
+  double sum = 1, term = 1;
+
+  for(int k = 1; term > sum * 1e-12; ++k) {
+    term *= (x / (2 * k)) * (x / (2 * k));
+    sum += term;
+  }
+  return sum;
+}
+
+static uint64_t gcd(uint64_t a, uint64_t b) {
+  while(b) {
+    const uint64_t t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+/** @brief Discard all input and go back to the start */
+static void filter_reset(struct resample_filter *f) {
+  /* The kernel extends half its width before the first input frame */
+  f->nbuffer = f->taps / 2 - 1;
+  memset(f->buffer, 0, f->nbuffer * f->channels * sizeof (float));
+  f->dropped = f->in = f->out = 0;
+}
+
+/** @brief Create a rate converter
+ * @param input_rate Input rate
+ * @param output_rate Output rate
+ * @param channels Channels per frame
+ * @return New rate converter
+ */
+static struct resample_filter *filter_new(int input_rate, int output_rate,
+                                          int channels) {
+  struct resample_filter *f = xmalloc(sizeof *f);
+  const uint64_t g = gcd(input_rate, output_rate);
+  double fc;
+  size_t half;
+
+  f->channels = channels;
+  f->L = output_rate / g;
+  f->M = input_rate / g;
+  f->phases = f->L <= FILTER_MAX_PHASES ? f->L : FILTER_MAX_PHASES;
+  /* Cutoff relative to the input Nyquist rate */
+  fc = FILTER_CUTOFF * (f->L < f->M ? (double)f->L / f->M : 1.0);
+  half = ceil(FILTER_ZEROS / fc);
+  f->taps = 2 * half;
+  f->coeffs = xcalloc_noptr((f->phases + 1) * f->taps, sizeof (float));
+  /* Phase i is for output times i/phases of the way from one input frame to
+   * the next.  Tap t is for the input frame half-1-t before the output time's
+   * integer part.  The extra phase is the same as phase 0 for the next input
+   * frame, and is only used when rounding to the nearest phase. */
+  for(uint64_t i = 0; i <= f->phases; ++i) {
+    float *const h = f->coeffs + i * f->taps;
+    double sum = 0;
+
+    for(size_t t = 0; t < f->taps; ++t) {
+      const double x = (double)t - (half - 1) - (double)i / f->phases;
+      const double r = x / half;
+      double v = fc;
+
+      if(x != 0)
+        v = sin(M_PI * fc * x) / (M_PI * x);
+      v *= r * r < 1 ? bessel_i0(FILTER_BETA * sqrt(1 - r * r)) : 0;
+      h[t] = v;
+      sum += v;
+    }
+    /* Unity gain at DC for every phase */
+    for(size_t t = 0; t < f->taps; ++t)
+      h[t] /= sum;
+  }
+  f->size = 8192 + f->taps;
+  f->buffer = xcalloc_noptr(f->size * channels, sizeof (float));
+  filter_reset(f);
+  return f;
+}
+
+/** @brief Destroy a rate converter */
+static void filter_free(struct resample_filter *f) {
+  xfree(f->coeffs);
+  xfree(f->buffer);
+  xfree(f);
+}
+
+/** @brief Append frames to a rate converter's buffer */
+static void filter_append(struct resample_filter *f, const float *input,
+                          size_t nframes) {
+  if(f->nbuffer + nframes > f->size) {
+    f->size = f->nbuffer + nframes;
+    f->buffer = xrealloc_noptr(f->buffer,
+                               f->size * f->channels * sizeof (float));
+  }
+  if(input)
+    memcpy(f->buffer + f->nbuffer * f->channels, input,
+           nframes * f->channels * sizeof (float));
+  else
+    memset(f->buffer + f->nbuffer * f->channels, 0,
+           nframes * f->channels * sizeof (float));
+  f->nbuffer += nframes;
+}
+
+/** @brief Upper bound on the output of filter_run()
+ * @param f Rate converter
+ * @param nframes Number of input frames
+ * @return Maximum number of output frames
+ */
+static size_t filter_max_output(const struct resample_filter *f,
+                                size_t nframes) {
+  return ((nframes + f->taps) * f->L + f->M - 1) / f->M + 1;
+}
+
+/** @brief Rate-convert some frames into a buffer
+ * @param f Rate converter
+ * @param input Input frames
+ * @param nframes Number of input frames
+ * @param eof Set at end of input
+ * @param output Where to put output, room for filter_max_output() frames
+ * @return Number of output frames
+ *
+ * All the input is consumed.  At @p eof everything remaining is flushed out
+ * and @p f is reset, ready for a new stream.  Nothing is allocated provided
+ * the input fits in the free part of @ref resample_filter::buffer.
+ */
+static size_t filter_run(struct resample_filter *f, const float *input,
+                         size_t nframes, int eof, float *output) {
+  const int channels = f->channels;
+  const size_t taps = f->taps;
+  uint64_t limit, last, n;
+  size_t noutput;
+  float *op;
+
+  filter_append(f, input, nframes);
+  f->in += nframes;
+  if(eof)
+    /* The kernel extends half its width past the last input frame */
+    filter_append(f, NULL, taps / 2);
+  /* Output frame k needs input frames from k*M/L to k*M/L+taps-1 */
+  if(f->dropped + f->nbuffer >= taps) {
+    last = f->dropped + f->nbuffer - taps;
+    limit = ((last + 1) * f->L + f->M - 1) / f->M;
+  } else
+    limit = 0;
+  if(eof && limit > (f->in * f->L + f->M - 1) / f->M)
+    limit = (f->in * f->L + f->M - 1) / f->M;
+  noutput = limit > f->out ? limit - f->out : 0;
+  op = output;
+  for(; f->out < limit; ++f->out) {
+    const uint64_t pos = f->out * f->M;
+    const float *const ip = f->buffer
+      + (pos / f->L - f->dropped) * channels;
+    const float *const h = f->coeffs
+      + (((pos % f->L) * f->phases + f->L / 2) / f->L) * taps;
+
+    for(int c = 0; c < channels; ++c) {
+      float sum = 0;
+
+      for(size_t t = 0; t < taps; ++t)
+        sum += h[t] * ip[t * channels + c];
+      *op++ = sum;
+    }
+  }
+  if(eof)
+    filter_reset(f);
+  else {
+    /* Discard input that no future output frame needs */
+    n = f->out * f->M / f->L - f->dropped;
+    if(n > f->nbuffer)
+      n = f->nbuffer;
+    memmove(f->buffer, f->buffer + n * channels,
+            (f->nbuffer - n) * channels * sizeof (float));
+    f->nbuffer -= n;
+    f->dropped += n;
+  }
+  return noutput;
+}
+
+/** @brief Rate-convert some frames
+ * @param f Rate converter
+ * @param input Input frames
+ * @param nframes Number of input frames
+ * @param eof Set at end of input
+ * @param noutput Where to store number of output frames
+ * @return Output frames
+ *
+ * As filter_run() but allocates the output.
+ */
+static float *filter_process(struct resample_filter *f, const float *input,
+                             size_t nframes, int eof, size_t *noutput) {
+  float *output = xcalloc_noptr(filter_max_output(f, nframes) * f->channels,
+                                sizeof (float));
+
+  *noutput = filter_run(f, input, nframes, eof, output);
+  return output;
+}
+#endif
+
 /** @brief Initialize a resampler
  * @param rs Resampler
  * @param input_bits Bits/sample in input
@@ -79,6 +467,31 @@ void resample_init(struct resampler *rs,
   rs->output_endian = output_endian;
   rs->input_bytes_per_sample = (rs->input_bits + 7) / 8;
   rs->input_bytes_per_frame = rs->input_channels * rs->input_bytes_per_sample;
+  rs->output_bytes_per_sample = (rs->output_bits + 7) / 8;
+  /* Pick the sample converters once, rather than for every sample */
+  switch(rs->input_bits + rs->input_signed + rs->input_endian) {
+  case 8+ENDIAN_BIG:
+  case 8+ENDIAN_LITTLE: rs->get = get_u8; break;
+  case 8+SIGNED+ENDIAN_BIG:
+  case 8+SIGNED+ENDIAN_LITTLE: rs->get = get_s8; break;
+  case 16+ENDIAN_BIG: rs->get = get_u16be; break;
+  case 16+ENDIAN_LITTLE: rs->get = get_u16le; break;
+  case 16+SIGNED+ENDIAN_BIG: rs->get = get_s16be; break;
+  case 16+SIGNED+ENDIAN_LITTLE: rs->get = get_s16le; break;
+  default: assert(!"unsupported sample format");
+  }
+  switch(rs->output_bits + rs->output_signed + rs->output_endian) {
+  case 8+ENDIAN_BIG:
+  case 8+ENDIAN_LITTLE: rs->put = put_u8; break;
+  case 8+SIGNED+ENDIAN_BIG:
+  case 8+SIGNED+ENDIAN_LITTLE: rs->put = put_s8; break;
+  case 16+ENDIAN_BIG: rs->put = put_u16be; break;
+  case 16+ENDIAN_LITTLE: rs->put = put_u16le; break;
+  case 16+SIGNED+ENDIAN_BIG: rs->put = put_s16be; break;
+  case 16+SIGNED+ENDIAN_LITTLE: rs->put = put_s16le; break;
+  default: assert(!"unsupported sample format");
+  }
+  rs->ratio = 1;
   if(rs->input_rate != rs->output_rate) {
 #if HAVE_SAMPLERATE_H
     int error_;
@@ -86,7 +499,8 @@ void resample_init(struct resampler *rs,
     if(!rs->state)
       disorder_fatal(0, "calling src_new: %s", src_strerror(error_));
 #else
-    disorder_fatal(0, "need to resample audio data but libsamplerate not available");
+    rs->filter = filter_new(rs->input_rate, rs->output_rate,
+                            rs->output_channels);
 #endif
   }
 }
@@ -95,107 +509,46 @@ void resample_init(struct resampler *rs,
  * @param rs Resampler
  */
 void resample_close(struct resampler *rs) {
+  xfree(rs->scratch_in);
+  xfree(rs->scratch_out);
+  rs->scratch_in = rs->scratch_out = NULL;
+  rs->scratch_frames = 0;
 #if HAVE_SAMPLERATE_H
   if(rs->state)
     src_delete(rs->state);
 #else
-  if(rs){}                              /* quieten compiler */
+  if(rs->filter)
+    filter_free(rs->filter);
 #endif
 }
 
-/** @brief Get one sample value and normalize it to [-1,1]
- * @param rs Resampler state
- * @param bytes Pointer to input data
- * @param where Where to store result
- * @return Number of bytes consumed
- */
-static size_t resample_get_sample(const struct resampler *rs,
-                                  const uint8_t *bytes,
-                                  float *where) {
-  switch(rs->input_bits + rs->input_signed + rs->input_endian) {
-  case 8+ENDIAN_BIG:
-  case 8+ENDIAN_LITTLE:
-    *where = (bytes[0] - 128)/ 128.0;
-    return 1;
-  case 8+SIGNED+ENDIAN_BIG:
-  case 8+SIGNED+ENDIAN_LITTLE:
-    *where = (int8_t)bytes[0] / 128.0;
-    return 1;
-  case 16+ENDIAN_BIG:
-    *where = (bytes[0] * 256 + bytes[1] - 32768)/ 32768.0;
-    return 2;
-    break;
-  case 16+ENDIAN_LITTLE:
-    *where = (bytes[1] * 256 + bytes[0] - 32768)/ 32768.0;
-    return 2;
-    break;
-  case 16+SIGNED+ENDIAN_BIG:
-    *where = (int16_t)(bytes[0] * 256 + bytes[1])/ 32768.0;
-    return 2;
-    break;
-  case 16+SIGNED+ENDIAN_LITTLE:
-    *where = (int16_t)(bytes[1] * 256 + bytes[0])/ 32768.0;
-    return 2;
-    break;
-  default:
-    assert(!"unsupported sample format");
-  }
-}
-
-static inline int clip(int n, int min, int max) {
-  if(n >= min) {
-    if(n <= max)
-      return n;
-    else
-      return max;
-  } else
-    return min;
-}
-
-/** @brief Store one sample value
- * @param rs Resampler state
- * @param sample Sample value
- * @param bytes Where to store it
- * @return Number of bytes stored
+/** @brief Adjust the conversion ratio of a resampler
+ * @param rs Resampler
+ * @param ratio Extra factor to apply to the output rate
+ * @return 0 on success, -1 if rate conversion is not available
+ *
+ * This is for making small, continuously varying corrections, for instance
+ * to compensate for clock drift; @p ratio might be 1.0001 to produce
+ * slightly more output than input.  libsamplerate moves smoothly to the new
+ * ratio.
  *
- * The value is clipped naively if it will not fit.
+ * If the resampler was not already converting rates then a fast converter is
+ * used, since it will only have to make small adjustments.
  */
-static size_t resample_put_sample(const struct resampler *rs,
-                                  float sample,
-                                  uint8_t *bytes) {
-  unsigned value;
-  switch(rs->output_bits + rs->output_signed + rs->output_endian) {
-  case 8+ENDIAN_BIG:
-  case 8+ENDIAN_LITTLE:
-    *bytes = clip(sample * 128.0 + 128, 0, 255);
-    return 1;
-  case 8+SIGNED+ENDIAN_BIG:
-  case 8+SIGNED+ENDIAN_LITTLE:
-    *bytes = clip((int)(sample * 128.0), -128, 127);
-    return 1;
-  case 16+ENDIAN_BIG:                   /* unsigned */
-    value = clip(sample * 32768.0 + 32768, 0, 65535);
-    *bytes++ = value >> 8;
-    *bytes++ = value;
-    return 2;
-  case 16+ENDIAN_LITTLE:
-    value = clip(sample * 32768.0 + 32768, 0, 65535);
-    *bytes++ = value;
-    *bytes++ = value >> 8;
-    return 2;
-  case 16+SIGNED+ENDIAN_BIG:
-    value = clip(sample * 32768.0, -32768, 32767);
-    *bytes++ = value >> 8;
-    *bytes++ = value;
-    return 2;
-  case 16+SIGNED+ENDIAN_LITTLE:
-    value = clip(sample * 32768.0, -32768, 32767);
-    *bytes++ = value;
-    *bytes++ = value >> 8;
-    return 2;
-  default:
-    assert(!"unsupported sample format");
+int resample_set_ratio(struct resampler *rs, double ratio) {
+#if HAVE_SAMPLERATE_H
+  if(!rs->state) {
+    int error_;
+    rs->state = src_new(SRC_SINC_FASTEST, rs->output_channels, &error_);
+    if(!rs->state)
+      disorder_fatal(0, "calling src_new: %s", src_strerror(error_));
   }
+  rs->ratio = ratio;
+  return 0;
+#else
+  if(rs || ratio){}                     /* quieten compiler */
+  return -1;
+#endif
 }
 
 /** @brief Convert input samples to floats
@@ -203,9 +556,12 @@ static size_t resample_put_sample(const struct resampler *rs,
  * @param bytes Input bytes
  * @param nframes Number of input frames
  * @param floats Where to store converted data
+ * @param tmp Room for @p nframes input frames as floats, or NULL
  *
  * @p floats must be big enough.  As well as converting to floats this
- * also converts to the output's channel format.
+ * also converts to the output's channel format.  If the channel counts
+ * differ, @p tmp is used as workspace; if it is NULL then workspace is
+ * allocated.
  *
  * Excess input channels are just discarded.  If there are insufficient input
  * channels the last one is duplicated as often as necessary to make up the
@@ -217,17 +573,26 @@ static size_t resample_put_sample(const struct resampler *rs,
 static void resample_prepare_input(const struct resampler *rs,
                                    const uint8_t *bytes,
                                    size_t nframes,
-                                   float *floats) {
+                                   float *floats,
+                                   float *tmp) {
+  if(rs->input_channels == rs->output_channels) {
+    /* The usual case; just convert the whole block */
+    rs->get(bytes, nframes * rs->input_channels, floats);
+    return;
+  }
+  float *const input = (tmp ? tmp
+                        : xmalloc_noptr(nframes * rs->input_channels
+                                        * sizeof (float)));
+  const float *ip = input;
+  rs->get(bytes, nframes * rs->input_channels, input);
   while(nframes > 0) {
     int n;
 
-    for(n = 0; n < rs->input_channels && n < rs->output_channels; ++n) {
-      bytes += resample_get_sample(rs, bytes, floats);
-      ++floats;
-    }
+    for(n = 0; n < rs->input_channels && n < rs->output_channels; ++n)
+      *floats++ = *ip++;
     if(n < rs->input_channels) {
       /* More input channels; discard them */
-      bytes += (rs->input_channels - n) * rs->input_bytes_per_sample;
+      ip += rs->input_channels - n;
     } else if(n < rs->output_channels) {
       /* More output channels; duplicate the last input channel */
       for(; n < rs->output_channels; ++n) {
@@ -237,6 +602,8 @@ static void resample_prepare_input(const struct resampler *rs,
     }
     --nframes;
   }
+  if(!tmp)
+    xfree(input);
 }
 
 /** @brief Convert between sample formats
@@ -261,21 +628,25 @@ size_t resample_convert(const struct resampler *rs,
   float *input = xcalloc(nframesin * rs->output_channels, sizeof (float));
   float *output = 0;
 
-  resample_prepare_input(rs, bytes, nframesin, input);
+  resample_prepare_input(rs, bytes, nframesin, input, NULL);
 #if HAVE_SAMPLERATE_H
   if(rs->state) {
     /* A sample-rate conversion must be performed */
     SRC_DATA data;
     memset(&data, 0, sizeof data);
     /* Compute how many frames are expected to come out. */
-    size_t maxframesout = nframesin * rs->output_rate / rs->input_rate + 1;
+    const double ratio = (double)rs->output_rate / rs->input_rate * rs->ratio;
+    size_t maxframesout = nframesin * ratio + 1;
+    if(eof)
+      /* Leave room for whatever is still inside the filter */
+      maxframesout += 4 * SAMPLES * (ratio + 1);
     output = xcalloc(maxframesout * rs->output_channels, sizeof(float));
     data.data_in = input;
     data.data_out = output;
     data.input_frames = nframesin;
     data.output_frames = maxframesout;
     data.end_of_input = eof;
-    data.src_ratio = (double)rs->output_rate / rs->input_rate;
+    data.src_ratio = ratio;
     D(("nframesin=%zu maxframesout=%zu eof=%d ratio=%d.%06d",
        nframesin, maxframesout, eof,
        (int)data.src_ratio,
@@ -287,6 +658,13 @@ size_t resample_convert(const struct resampler *rs,
     nsamplesout = data.output_frames_gen * rs->output_channels;
     D(("new nframesin=%zu nsamplesout=%zu", nframesin, nsamplesout));
   }
+#else
+  if(rs->filter) {
+    /* A sample-rate conversion must be performed */
+    size_t nframesout;
+    output = filter_process(rs->filter, input, nframesin, eof, &nframesout);
+    nsamplesout = nframesout * rs->output_channels;
+  }
 #endif
   if(!output) {
     /* No sample-rate conversion required */
@@ -296,23 +674,125 @@ size_t resample_convert(const struct resampler *rs,
   const float *op = output;
   while(nsamplesout > 0) {
     uint8_t buffer[4096];
-    size_t bufused = 0;
+    size_t n = sizeof buffer / rs->output_bytes_per_sample;
 
-    while(bufused < sizeof buffer && nsamplesout > 0) {
-      bufused += resample_put_sample(rs, *op++, buffer + bufused);
-      --nsamplesout;
-    }
-    converted(buffer, bufused, cd);
+    if(n > nsamplesout)
+      n = nsamplesout;
+    rs->put(op, n, buffer);
+    converted(buffer, n * rs->output_bytes_per_sample, cd);
+    op += n;
+    nsamplesout -= n;
   }
   if(output != input)
     xfree(output);
   xfree(input);
-  if(eof){}                             /* quieten compiler */
   /* Report how many input bytes were actually consumed */
   //fprintf(stderr, "converted %zu frames\n", nframesin);
   return nframesin * rs->input_bytes_per_frame;
 }
 
+/** @brief Set aside scratch space for resample_convert_fixed()
+ * @param rs Resampler
+ * @param frames Most frames to convert in one call
+ *
+ * Call this on a thread that may allocate memory, before using @p rs from one
+ * that may not.
+ */
+void resample_reserve(struct resampler *rs, size_t frames) {
+  const int channels = (rs->input_channels > rs->output_channels
+                        ? rs->input_channels : rs->output_channels);
+
+  xfree(rs->scratch_in);
+  xfree(rs->scratch_out);
+  rs->scratch_in = xcalloc_noptr(frames * rs->output_channels,
+                                 sizeof (float));
+  rs->scratch_out = xcalloc_noptr(frames * channels, sizeof (float));
+  rs->scratch_frames = frames;
+}
+
+/** @brief Convert between sample formats without allocating memory
+ * @param rs Resampler state, set up with resample_reserve()
+ * @param bytes Bytes to convert
+ * @param nbytes Number of bytes to convert
+ * @param output Where to put converted bytes
+ * @param maxoutput Size of @p output in bytes
+ * @param noutput Where to store number of bytes written to @p output
+ * @return Number of bytes consumed
+ *
+ * Like resample_convert() without end of input, but safe to call from audio
+ * threads that must not allocate.  Only as much input is consumed as fits in
+ * the scratch space and produces output that fits in @p output; the rest
+ * should be offered again later.
+ */
+size_t resample_convert_fixed(const struct resampler *rs,
+                              const uint8_t *bytes,
+                              size_t nbytes,
+                              uint8_t *output,
+                              size_t maxoutput,
+                              size_t *noutput) {
+  const size_t output_bytes_per_frame
+    = rs->output_channels * rs->output_bytes_per_sample;
+  size_t nframesin = nbytes / rs->input_bytes_per_frame;
+  size_t maxframesout = maxoutput / output_bytes_per_frame, nframesout;
+
+  if(nframesin > rs->scratch_frames)
+    nframesin = rs->scratch_frames;
+  if(maxframesout > rs->scratch_frames)
+    maxframesout = rs->scratch_frames;
+  if(!nframesin || !maxframesout) {
+    *noutput = 0;
+    return 0;
+  }
+#if HAVE_SAMPLERATE_H
+  if(rs->state) {
+    /* libsamplerate stops when the output is full */
+    SRC_DATA data;
+    memset(&data, 0, sizeof data);
+    resample_prepare_input(rs, bytes, nframesin,
+                           rs->scratch_in, rs->scratch_out);
+    data.data_in = rs->scratch_in;
+    data.data_out = rs->scratch_out;
+    data.input_frames = nframesin;
+    data.output_frames = maxframesout;
+    data.src_ratio = (double)rs->output_rate / rs->input_rate * rs->ratio;
+    int error_ = src_process(rs->state, &data);
+    if(error_)
+      disorder_fatal(0, "calling src_process: %s", src_strerror(error_));
+    nframesin = data.input_frames_used;
+    nframesout = data.output_frames_gen;
+    rs->put(rs->scratch_out, nframesout * rs->output_channels, output);
+  } else
+#else
+  if(rs->filter) {
+    /* Only offer as much as fits in the filter's buffer and whose output is
+     * bound to fit; see filter_max_output() */
+    struct resample_filter *const f = rs->filter;
+    const uint64_t limit = (maxframesout > 0
+                            ? (maxframesout - 1) * f->M / f->L : 0);
+
+    if(nframesin > f->size - f->nbuffer)
+      nframesin = f->size - f->nbuffer;
+    if(nframesin + f->taps > limit)
+      nframesin = limit > f->taps ? limit - f->taps : 0;
+    resample_prepare_input(rs, bytes, nframesin,
+                           rs->scratch_in, rs->scratch_out);
+    nframesout = filter_run(f, rs->scratch_in, nframesin, 0, rs->scratch_out);
+    rs->put(rs->scratch_out, nframesout * rs->output_channels, output);
+  } else
+#endif
+  {
+    /* No sample-rate conversion required */
+    if(nframesin > maxframesout)
+      nframesin = maxframesout;
+    resample_prepare_input(rs, bytes, nframesin,
+                           rs->scratch_in, rs->scratch_out);
+    rs->put(rs->scratch_in, nframesin * rs->output_channels, output);
+    nframesout = nframesin;
+  }
+  *noutput = nframesout * output_bytes_per_frame;
+  return nframesin * rs->input_bytes_per_frame;
+}
+
 /*
 Local Variables:
 c-basic-offset:2
@@ -66,10 +66,40 @@ struct resampler {
 
   /** @brief  */
   int input_bytes_per_frame;
+
+  /** @brief Bytes/sample in output */
+  int output_bytes_per_sample;
+
+  /** @brief Convert a block of input samples to floats */
+  void (*get)(const uint8_t *bytes, size_t nsamples, float *floats);
+
+  /** @brief Convert a block of floats to output samples */
+  void (*put)(const float *floats, size_t nsamples, uint8_t *bytes);
+
+  /** @brief Additional rate adjustment
+   *
+   * Normally 1.  See resample_set_ratio().
+   */
+  double ratio;
 #if HAVE_SAMPLERATE_H
   /** @brief Libsamplerate handle */
   SRC_STATE *state;
+#else
+  /** @brief Built-in rate converter, or NULL */
+  struct resample_filter *filter;
 #endif
+
+  /** @brief Scratch space for prepared input
+   *
+   * See resample_reserve().
+   */
+  float *scratch_in;
+
+  /** @brief Scratch space for output */
+  float *scratch_out;
+
+  /** @brief Capacity of the scratch space in frames */
+  size_t scratch_frames;
 };
 
 void resample_init(struct resampler *rs, 
@@ -88,6 +118,14 @@ size_t resample_convert(const struct resampler *rs,
                                           void *cd),
                         void *cd);
 void resample_close(struct resampler *rs);
+int resample_set_ratio(struct resampler *rs, double ratio);
+void resample_reserve(struct resampler *rs, size_t frames);
+size_t resample_convert_fixed(const struct resampler *rs,
+                              const uint8_t *bytes,
+                              size_t nbytes,
+                              uint8_t *output,
+                              size_t maxoutput,
+                              size_t *noutput);
 
 #endif /* RESAMPLE_H */
 
@@ -0,0 +1,218 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file lib/rtp-opus.c
+ * @brief Opus-compressed RTP payload support
+ *
+ * The rate conversions here are plain linear interpolation.  That would be
+ * poor in general, but the images and aliases it introduces all lie above
+ * 20KHz, which is where Opus cuts off anyway.
+ */
+#include "common.h"
+
+#include <arpa/inet.h>
+
+#include "rtp-opus.h"
+#include "gain.h"
+
+/** @brief Weighted average of two samples, rounded to nearest
+ * @param a First sample
+ * @param b Second sample
+ * @param f Weight of @p b
+ * @param d Total weight
+ * @return Interpolated sample
+ */
+static inline int16_t interpolate(int a, int b, int f, int d) {
+  const int32_t s = a * (d - f) + b * f;
+
+  return (s >= 0 ? s + d / 2 : s - d / 2) / d;
+}
+
+/** @brief Initialize an upsampler
+ * @param u Upsampler
+ * @param channels Number of channels (1 or 2)
+ */
+void rtp_opus_upsampler_init(struct rtp_opus_upsampler *u, int channels) {
+  u->channels = channels;
+  u->last[0] = u->last[1] = 0;
+}
+
+/** @brief Convert one packet's worth of audio from 44.1KHz to 48KHz
+ * @param u Upsampler
+ * @param in @ref RTP_OPUS_FRAMES frames of native-order input
+ * @param out Where to store @ref RTP_OPUS_CODEC_FRAMES frames of output
+ *
+ * Output is delayed by one input frame, so that every output frame lies
+ * between two input frames that have already been seen.
+ */
+void rtp_opus_upsample(struct rtp_opus_upsampler *u,
+                       const int16_t *in, int16_t *out) {
+  const int ch = u->channels;
+  int i, j, f, c;
+
+  for(j = 0; j < RTP_OPUS_CODEC_FRAMES; ++j) {
+    /* Position in the input is j * 147/160 */
+    i = j * RTP_OPUS_FRAMES / RTP_OPUS_CODEC_FRAMES;
+    f = j * RTP_OPUS_FRAMES % RTP_OPUS_CODEC_FRAMES;
+    for(c = 0; c < ch; ++c)
+      *out++ = interpolate(i ? in[(i - 1) * ch + c] : u->last[c],
+                           in[i * ch + c],
+                           f, RTP_OPUS_CODEC_FRAMES);
+  }
+  for(c = 0; c < ch; ++c)
+    u->last[c] = in[(RTP_OPUS_FRAMES - 1) * ch + c];
+}
+
+/** @brief Convert one packet's worth of audio from 48KHz to 44.1KHz
+ * @param in @ref RTP_OPUS_CODEC_FRAMES frames of native-order input
+ * @param out Where to store @ref RTP_OPUS_FRAMES frames of output
+ * @param channels Number of channels (1 or 2)
+ *
+ * Every output frame falls within the input packet, so no state is needed.
+ */
+void rtp_opus_downsample(const int16_t *in, int16_t *out, int channels) {
+  int i, k, f, c;
+
+  for(k = 0; k < RTP_OPUS_FRAMES; ++k) {
+    /* Position in the input is k * 160/147 */
+    i = k * RTP_OPUS_CODEC_FRAMES / RTP_OPUS_FRAMES;
+    f = k * RTP_OPUS_CODEC_FRAMES % RTP_OPUS_FRAMES;
+    for(c = 0; c < channels; ++c)
+      *out++ = interpolate(in[i * channels + c],
+                           in[(i + 1) * channels + c],
+                           f, RTP_OPUS_FRAMES);
+  }
+}
+
+/** @brief Initialize a framer
+ * @param f Framer
+ * @param channels Number of channels (1 or 2)
+ */
+void rtp_opus_framer_init(struct rtp_opus_framer *f, int channels) {
+  memset(f, 0, sizeof *f);
+  f->channels = channels;
+}
+
+/** @brief Discard any partial packet
+ * @param f Framer
+ *
+ * Used when there is a gap in the input.
+ */
+void rtp_opus_framer_reset(struct rtp_opus_framer *f) {
+  f->fill = 0;
+}
+
+/** @brief Add uncompressed audio to a framer
+ * @param f Framer
+ * @param data Network-order samples
+ * @param nsamples Number of samples (not frames) at @p data
+ * @param timestamp RTP timestamp of the first sample
+ * @param marker Nonzero if the input had the marker bit set
+ * @param framed Called for each complete packet
+ * @param u Passed to @p framed
+ *
+ * Opus packets always cover @ref RTP_OPUS_FRAMES frames, so audio accumulates
+ * in @ref rtp_opus_framer::pcm until there is enough.  Timestamps are in the
+ * same units as the uncompressed stream, i.e. samples.  A partial packet is
+ * not continued across a marker or a jump in the timestamps.
+ */
+void rtp_opus_frame(struct rtp_opus_framer *f,
+                    const int16_t *data, size_t nsamples,
+                    uint32_t timestamp, int marker,
+                    rtp_opus_framed_fn *framed, void *u) {
+  const int ch = f->channels;
+  const int16_t *const start = data;
+  size_t frames = nsamples / ch, n;
+
+  if(marker)
+    f->marker = 1;
+  if(f->fill && (marker || timestamp != f->next))
+    f->fill = 0;
+  f->next = timestamp + nsamples;
+  while(frames > 0) {
+    if(!f->fill)
+      f->timestamp = timestamp + (data - start);
+    n = RTP_OPUS_FRAMES - f->fill;
+    if(n > frames)
+      n = frames;
+#if WORDS_BIGENDIAN
+    memcpy(f->pcm + f->fill * ch, data, n * ch * sizeof *data);
+#else
+    gain_swap_s16(f->pcm + f->fill * ch, data, n * ch);
+#endif
+    data += n * ch;
+    frames -= n;
+    f->fill += n;
+    if(f->fill == RTP_OPUS_FRAMES) {
+      framed(f, u);
+      f->fill = 0;
+      f->marker = 0;
+    }
+  }
+}
+
+#if HAVE_OPUS_OPUS_H
+/** @brief Compress one packet
+ * @param encoder Encoder, at @ref RTP_OPUS_CODEC_RATE
+ * @param u Upsampler
+ * @param pcm @ref RTP_OPUS_FRAMES frames of native-order audio
+ * @param data Where to put the packet, room for @ref RTP_OPUS_MAX_BYTES
+ * @return Size of the packet, or an Opus error code
+ */
+int rtp_opus_encode(OpusEncoder *encoder, struct rtp_opus_upsampler *u,
+                    const int16_t *pcm, unsigned char *data) {
+  int16_t up[2 * RTP_OPUS_CODEC_FRAMES];
+
+  rtp_opus_upsample(u, pcm, up);
+  return opus_encode(encoder, up, RTP_OPUS_CODEC_FRAMES,
+                     data, RTP_OPUS_MAX_BYTES);
+}
+
+/** @brief Decompress one stereo packet
+ * @param decoder Decoder, at @ref RTP_OPUS_CODEC_RATE with two channels
+ * @param data Packet
+ * @param nbytes Size of packet
+ * @param out Where to put 2 * @ref RTP_OPUS_FRAMES network-order samples
+ * @return Number of frames decoded, or an Opus error code
+ *
+ * Only if the return value is @ref RTP_OPUS_CODEC_FRAMES is anything written
+ * to @p out.
+ */
+int rtp_opus_decode(OpusDecoder *decoder,
+                    const unsigned char *data, size_t nbytes,
+                    uint16_t *out) {
+  int16_t pcm[2 * RTP_OPUS_CODEC_FRAMES], down[2 * RTP_OPUS_FRAMES];
+  int n;
+
+  n = opus_decode(decoder, data, nbytes, pcm, RTP_OPUS_CODEC_FRAMES, 0);
+  if(n != RTP_OPUS_CODEC_FRAMES)
+    return n;
+  rtp_opus_downsample(pcm, down, 2);
+  for(n = 0; n < 2 * RTP_OPUS_FRAMES; ++n)
+    out[n] = htons(down[n]);
+  return RTP_OPUS_CODEC_FRAMES;
+}
+#endif
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
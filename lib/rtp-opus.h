@@ -0,0 +1,123 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file lib/rtp-opus.h
+ * @brief Opus-compressed RTP payload support
+ *
+ * DisOrder's RTP stream runs at 44.1KHz but Opus only accepts a handful of
+ * rates, the cheapest fit being 48KHz.  Each Opus packet carries 20ms of
+ * audio, which is exactly @ref RTP_OPUS_FRAMES frames at 44.1KHz and @ref
+ * RTP_OPUS_CODEC_FRAMES at 48KHz, so the conversion can be done a packet at
+ * a time with no drift.  RTP timestamps stay in 44.1KHz units, as for the
+ * uncompressed payloads.
+ */
+
+#ifndef RTP_OPUS_H
+#define RTP_OPUS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#if HAVE_OPUS_OPUS_H
+#include <opus/opus.h>
+#endif
+
+/** @brief RTP payload type for Opus
+ *
+ * This is a dynamic payload type.  DisOrder does not use SDP; the sender and
+ * receiver just agree on it.
+ */
+#define RTP_OPUS_PAYLOAD 96
+
+/** @brief Frames per Opus packet at the RTP sample rate (20ms at 44.1KHz) */
+#define RTP_OPUS_FRAMES 882
+
+/** @brief Sample rate used for Opus encoding and decoding */
+#define RTP_OPUS_CODEC_RATE 48000
+
+/** @brief Frames per Opus packet at @ref RTP_OPUS_CODEC_RATE */
+#define RTP_OPUS_CODEC_FRAMES 960
+
+/** @brief Largest possible Opus packet, in bytes
+ *
+ * A single-frame Opus packet never exceeds 1275 bytes (RFC6716 s3.2.1).
+ */
+#define RTP_OPUS_MAX_BYTES 1275
+
+/** @brief State for 44.1KHz to 48KHz conversion */
+struct rtp_opus_upsampler {
+  /** @brief Number of channels (1 or 2) */
+  int channels;
+
+  /** @brief Last input frame of the previous packet */
+  int16_t last[2];
+};
+
+/** @brief Collects uncompressed audio into Opus-sized packets */
+struct rtp_opus_framer {
+  /** @brief Number of channels (1 or 2) */
+  int channels;
+
+  /** @brief Number of frames in @ref pcm */
+  size_t fill;
+
+  /** @brief Timestamp of the first sample in @ref pcm */
+  uint32_t timestamp;
+
+  /** @brief Timestamp expected on the next input */
+  uint32_t next;
+
+  /** @brief Set if the packet in @ref pcm should have the marker bit set */
+  int marker;
+
+  /** @brief Audio for the next packet, in native byte order */
+  int16_t pcm[2 * RTP_OPUS_FRAMES];
+};
+
+/** @brief Called by rtp_opus_frame() when a packet is complete
+ * @param f Framer, with @ref rtp_opus_framer::pcm full
+ * @param u Passed to rtp_opus_frame()
+ */
+typedef void rtp_opus_framed_fn(struct rtp_opus_framer *f, void *u);
+
+void rtp_opus_upsampler_init(struct rtp_opus_upsampler *u, int channels);
+void rtp_opus_upsample(struct rtp_opus_upsampler *u,
+                       const int16_t *in, int16_t *out);
+void rtp_opus_downsample(const int16_t *in, int16_t *out, int channels);
+void rtp_opus_framer_init(struct rtp_opus_framer *f, int channels);
+void rtp_opus_framer_reset(struct rtp_opus_framer *f);
+void rtp_opus_frame(struct rtp_opus_framer *f,
+                    const int16_t *data, size_t nsamples,
+                    uint32_t timestamp, int marker,
+                    rtp_opus_framed_fn *framed, void *u);
+#if HAVE_OPUS_OPUS_H
+int rtp_opus_encode(OpusEncoder *encoder, struct rtp_opus_upsampler *u,
+                    const int16_t *pcm, unsigned char *data);
+int rtp_opus_decode(OpusDecoder *decoder,
+                    const unsigned char *data, size_t nbytes,
+                    uint16_t *out);
+#endif
+
+#endif /* RTP_OPUS_H */
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
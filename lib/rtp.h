@@ -78,6 +78,112 @@ struct attribute((packed)) rtp_extension {
   uint16_t length;
 };
 
+/** @brief RTP payload type for parity FEC packets
+ *
+ * This is a dynamic payload type; see @ref rtp_fec_header.
+ */
+#define RTP_FEC_PAYLOAD 97
+
+/** @brief Largest number of packets protected by one FEC packet */
+#define RTP_FEC_MAX_GROUP 16
+
+/** @brief Parity FEC header format
+ *
+ * See <a href="http://www.ietf.org/rfc/rfc5109.txt">RFC5109</a>.  This is
+ * the FEC header followed by a single level 0 header with a 16-bit mask, and
+ * comes between the RTP header and the FEC payload.  FEC packets have the
+ * same SSRC as the audio they protect but their own sequence numbers.
+ *
+ * Each field except @c sn_base, @c protection_length and @c mask is the XOR
+ * of the corresponding values from the protected packets.  The payload is
+ * the XOR of their payloads, each padded with 0s to @c protection_length
+ * bytes.
+ *
+ * All values in this structure are big-endian.
+ */
+struct attribute((packed)) rtp_fec_header {
+  /** @brief Extension, long mask, padding, extension and CSRC count
+   *
+   * E and L are bits 7 and 6 and are always 0 here.  The remaining bits are
+   * recovery fields for the corresponding bits of @ref rtp_header.vpxcc.
+   */
+  uint8_t elpxcc;
+
+  /** @brief Marker and payload type recovery */
+  uint8_t mpt;
+
+  /** @brief Lowest sequence number protected */
+  uint16_t sn_base;
+
+  /** @brief Timestamp recovery */
+  uint32_t ts_recovery;
+
+  /** @brief Payload length recovery */
+  uint16_t length_recovery;
+
+  /** @brief Number of payload bytes protected */
+  uint16_t protection_length;
+
+  /** @brief Which packets are protected
+   *
+   * The most significant bit stands for @c sn_base, the next for @c sn_base
+   * + 1, and so on.
+   */
+  uint16_t mask;
+};
+
+/** @brief RTCP packet type for a sender report */
+#define RTCP_SR 200
+
+/** @brief RTCP sender report format
+ *
+ * See <a href="http://www.ietf.org/rfc/rfc3550.txt">RFC3550</a> s6.4.1.
+ * DisOrder never includes any reception report blocks.
+ *
+ * RTCP packets are sent on the same port as the RTP packets they describe,
+ * as described in <a href="http://www.ietf.org/rfc/rfc5761.txt">RFC5761</a>.
+ * The packet type occupies the same octet as an RTP packet's marker and
+ * payload type, and is always in the range 192-223 (which no RTP payload
+ * type can produce).
+ *
+ * All values in this structure are big-endian.
+ */
+struct attribute((packed)) rtcp_sender_report {
+  /** @brief Version, padding and reception report count
+   *
+   * Version is bits 6 and 7; currently always 2.  The reception report count
+   * is bits 0-4.
+   */
+  uint8_t vprc;
+
+  /** @brief Packet type (@ref RTCP_SR) */
+  uint8_t pt;
+
+  /** @brief Length in 32-bit words, minus one */
+  uint16_t length;
+
+  /** @brief Synchronization source of the sender */
+  uint32_t ssrc;
+
+  /** @brief Wallclock time, in whole seconds since 1900 */
+  uint32_t ntp_seconds;
+
+  /** @brief Wallclock time, fractional part in units of 2^-32 seconds */
+  uint32_t ntp_fraction;
+
+  /** @brief RTP timestamp corresponding to the wallclock time */
+  uint32_t rtp_timestamp;
+
+  /** @brief Number of RTP packets sent so far */
+  uint32_t packets;
+
+  /** @brief Number of payload octets sent so far */
+  uint32_t octets;
+};
+
+/** @brief Difference between the NTP and Unix epochs, in seconds */
+#define NTP_EPOCH_OFFSET 2208988800UL
+
 #endif /* RTP_H */
 
 /*
@@ -56,6 +56,17 @@ int sink_printf(struct sink *s, const char *fmt, ...) {
   return n;
 }
 
+/** @brief Write an integer to a sink in decimal
+ * @param s Sink to write to
+ * @param n Value to write
+ * @return non-negative on success, -1 on error
+ */
+int sink_writeint(struct sink *s, intmax_t n) {
+  char buffer[BYTE_ITOA_SIZE];
+
+  return sink_writes(s, byte_itoa(buffer, n));
+}
+
 static int sink_generic_flush(struct sink attribute((unused)) *s) {
   return 0;
 }
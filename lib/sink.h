@@ -98,6 +98,9 @@ static inline int sink_writes(struct sink *s, const char *str) {
   return s->write(s, str, strlen(str));
 }
 
+int sink_writeint(struct sink *s, intmax_t n);
+/* write @n@ in decimal to @s@; equivalent to sink_printf(s, "%jd", n) */
+
 static inline int sink_flush(struct sink *s) {
   return s->flush(s);
 }
@@ -21,6 +21,7 @@
 #include "common.h"
 #include "socketio.h"
 #include "mem.h"
+#include "vector.h"
 
 #include <errno.h>
 #include <sys/types.h>
@@ -30,12 +31,24 @@
 #if HAVE_UNISTD_H
 # include <unistd.h>
 #endif
+#if HAVE_ZLIB_H
+# include <zlib.h>
+#endif
+
+#if HAVE_ZLIB_H
+/** @brief Decompression state for a socket */
+struct socketio_inflate {
+  z_stream z;
+  char input[SOCKETIO_BUFFER];          /* compressed input */
+};
+#endif
 
 void socketio_init(struct socketio *sio, SOCKET sd) {
   sio->sd = sd;
   sio->inputptr = sio->inputlimit = sio->input;
   sio->outputused = 0;
   sio->error = 0;
+  sio->inflate = NULL;
 }
 
 int socketio_write(struct socketio *sio, const void *buffer, size_t n) {
@@ -55,8 +68,47 @@ int socketio_write(struct socketio *sio, const void *buffer, size_t n) {
   return 0;
 }
 
+#if HAVE_ZLIB_H
+static int socketio_inflate_fill(struct socketio *sio) {
+  z_stream *z = &sio->inflate->z;
+  int n, rc;
+  for(;;) {
+    if(!z->avail_in) {
+      n = recv(sio->sd, sio->inflate->input, sizeof sio->inflate->input, 0);
+      if(n <= 0) {
+        sio->error = n < 0 ? socket_error() : -1;
+        return -1;
+      }
+      z->next_in = (Bytef *)sio->inflate->input;
+      z->avail_in = n;
+    }
+    z->next_out = (Bytef *)sio->input;
+    z->avail_out = sizeof sio->input;
+    rc = inflate(z, Z_SYNC_FLUSH);
+    if(rc != Z_OK && rc != Z_BUF_ERROR && rc != Z_STREAM_END) {
+      sio->error = EIO;
+      return -1;
+    }
+    if(z->avail_out < sizeof sio->input) {
+      sio->inputptr = sio->input;
+      sio->inputlimit = sio->input + (sizeof sio->input - z->avail_out);
+      return 0;
+    }
+    if(rc == Z_STREAM_END) {
+      sio->error = -1;
+      return -1;
+    }
+  }
+}
+#endif
+
 static int socketio_fill(struct socketio *sio) {
-  int n = recv(sio->sd, sio->input, sizeof sio->input, 0);
+  int n;
+#if HAVE_ZLIB_H
+  if(sio->inflate)
+    return socketio_inflate_fill(sio);
+#endif
+  n = recv(sio->sd, sio->input, sizeof sio->input, 0);
   if(n <= 0) {
     sio->error = n < 0 ? socket_error() : -1;
     return -1;
@@ -74,6 +126,27 @@ int socketio_getc(struct socketio *sio) {
   return *sio->inputptr++;
 }
 
+/* Read a line, appending it to D without the newline or a terminator.
+ * Whole runs of buffered input are copied at once.  Returns 0 on success or
+ * -1 on error or EOF, in which case D holds any partial line. */
+int socketio_getline(struct socketio *sio, struct dynstr *d) {
+  const char *nl;
+
+  for(;;) {
+    if(sio->inputptr >= sio->inputlimit) {
+      if(socketio_fill(sio))
+        return -1;
+    }
+    if((nl = memchr(sio->inputptr, '\n', sio->inputlimit - sio->inputptr))) {
+      dynstr_append_bytes(d, sio->inputptr, nl - sio->inputptr);
+      sio->inputptr = (char *)nl + 1;
+      return 0;
+    }
+    dynstr_append_bytes(d, sio->inputptr, sio->inputlimit - sio->inputptr);
+    sio->inputptr = sio->inputlimit;
+  }
+}
+
 int socketio_flush(struct socketio *sio) {
   size_t written = 0;
   while(written < sio->outputused) {
@@ -88,7 +161,37 @@ int socketio_flush(struct socketio *sio) {
   return 0;
 }
 
+/* Decompress everything read from now on, including anything already
+ * buffered.  Returns 0 on success or -1 if decompression isn't available. */
+#if HAVE_ZLIB_H
+int socketio_decompress(struct socketio *sio) {
+  struct socketio_inflate *zi = xmalloc(sizeof *zi);
+  size_t left = sio->inputlimit - sio->inputptr;
+  if(inflateInit(&zi->z) != Z_OK) {
+    xfree(zi);
+    return -1;
+  }
+  memcpy(zi->input, sio->inputptr, left);
+  zi->z.next_in = (Bytef *)zi->input;
+  zi->z.avail_in = left;
+  sio->inputptr = sio->inputlimit = sio->input;
+  sio->inflate = zi;
+  return 0;
+}
+#else
+int socketio_decompress(struct socketio attribute((unused)) *sio) {
+  return -1;
+}
+#endif
+
 void socketio_close(struct socketio *sio) {
   socketio_flush(sio);
   closesocket(sio->sd);
+#if HAVE_ZLIB_H
+  if(sio->inflate) {
+    inflateEnd(&sio->inflate->z);
+    xfree(sio->inflate);
+    sio->inflate = NULL;
+  }
+#endif
 }
@@ -23,11 +23,15 @@
 
 #define SOCKETIO_BUFFER 4096
 
+struct socketio_inflate;
+struct dynstr;
+
 struct socketio {
   SOCKET sd;
   char *inputptr, *inputlimit;
   size_t outputused;
   int error;
+  struct socketio_inflate *inflate;     /* decompression state or NULL */
   char input[SOCKETIO_BUFFER];
   char output[SOCKETIO_BUFFER];
 };
@@ -35,7 +39,9 @@ struct socketio {
 void socketio_init(struct socketio *sio, SOCKET sd);
 int socketio_write(struct socketio *sio, const void *buffer, size_t n);
 int socketio_getc(struct socketio *sio);
+int socketio_getline(struct socketio *sio, struct dynstr *d);
 int socketio_flush(struct socketio *sio);
+int socketio_decompress(struct socketio *sio);
 void socketio_close(struct socketio *sio);
 
 static inline int socketio_error(struct socketio *sio) {
@@ -22,7 +22,9 @@
 #include "common.h"
 
 #include <sys/socket.h>
+#include <sys/mman.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <stddef.h>
 
@@ -62,6 +64,92 @@ int speaker_recv(int fd, struct speaker_message *sm) {
   return ret;
 }
 
+/** @brief Number of attempts speaker_status_read() makes */
+#define SPEAKER_STATUS_TRIES 1000
+
+/** @brief Map the speaker status page
+ * @param path Path to status file
+ * @param writable Nonzero to create the file and map it for writing
+ * @return Status page, or NULL on error
+ *
+ * The speaker creates the file and the server maps it read-only.
+ */
+struct speaker_status *speaker_status_map(const char *path, int writable) {
+  struct speaker_status *page;
+  int fd;
+
+  if(writable)
+    fd = open(path, O_RDWR|O_CREAT|O_TRUNC, 0600);
+  else
+    fd = open(path, O_RDONLY);
+  if(fd < 0) {
+    disorder_error(errno, "error opening %s", path);
+    return NULL;
+  }
+  if(writable && ftruncate(fd, sizeof *page) < 0) {
+    disorder_error(errno, "error calling ftruncate on %s", path);
+    close(fd);
+    return NULL;
+  }
+  page = mmap(NULL, sizeof *page, writable ? PROT_READ|PROT_WRITE : PROT_READ,
+              MAP_SHARED, fd, 0);
+  close(fd);
+  if(page == MAP_FAILED) {
+    disorder_error(errno, "error mapping %s", path);
+    return NULL;
+  }
+  return page;
+}
+
+/** @brief Update the speaker status page
+ * @param page Status page
+ * @param status New status (@c seq is ignored)
+ *
+ * Only the speaker may call this.
+ */
+void speaker_status_write(struct speaker_status *page,
+                          const struct speaker_status *status) {
+  const unsigned long seq = page->seq;
+
+  __atomic_store_n(&page->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(page->id, status->id, sizeof page->id);
+  page->paused = status->paused;
+  page->sofar = status->sofar;
+  page->buffered = status->buffered;
+  page->buffer_size = status->buffer_size;
+  page->stats = status->stats;
+  __atomic_store_n(&page->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/** @brief Read the speaker status page
+ * @param page Status page
+ * @param status Where to store a consistent copy
+ * @return 0 on success, -1 if the page never settled
+ *
+ * Gives up rather than waiting forever, in case the speaker died part way
+ * through an update.
+ */
+int speaker_status_read(const struct speaker_status *page,
+                        struct speaker_status *status) {
+  unsigned long before, after;
+  int tries;
+
+  for(tries = 0; tries < SPEAKER_STATUS_TRIES; ++tries) {
+    before = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+    if(before & 1)
+      continue;
+    memcpy(status, page, sizeof *status);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    after = __atomic_load_n(&page->seq, __ATOMIC_RELAXED);
+    if(before == after) {
+      status->id[sizeof status->id - 1] = 0;
+      return 0;
+    }
+  }
+  return -1;
+}
+
 /*
 Local Variables:
 c-basic-offset:2
@@ -26,6 +26,7 @@
 #define SPEAKER_PROTOCOL_H
 
 #include "byte-order.h"
+#include "uaudio.h"
 #if HAVE_NETINET_IN_H
 # include <netinet/in.h>
 #endif
@@ -49,6 +50,7 @@ struct speaker_message {
    * - @ref SM_PLAYING
    * - @ref SM_UNKNOWN
    * - @ref SM_ARRIVED
+   * - @ref SM_STATS
    */
   int type;
 
@@ -61,6 +63,9 @@ struct speaker_message {
 
     /** @brief An IP address (for @ref SM_RTP_REQUEST and @ref SM_RTP_CANCEL) */
     struct sockaddr_storage address;
+
+    /** @brief Playback statistics (for @ref SM_STATS) */
+    struct uaudio_stats stats;
   } u;
 };
 
@@ -68,7 +73,8 @@ struct speaker_message {
 
 /** @brief Play track @c id
  *
- * The track must already have been prepared.
+ * The track must already have been prepared.  @c data is the gain to apply,
+ * in hundredths of a decibel; 0 leaves the track unchanged.
  */
 #define SM_PLAY 1
 
@@ -84,7 +90,11 @@ struct speaker_message {
 /** @brief Reload configuration */
 #define SM_RELOAD 5
 
-/** @brief Reload configuration */
+/** @brief Add an RTP recipient
+ *
+ * @c data is the payload encoding, @ref RTP_CODEC_L16 or @ref
+ * RTP_CODEC_OPUS.
+ */
 #define SM_RTP_REQUEST 6
 
 /** @brief Reload configuration */
@@ -122,6 +132,50 @@ struct speaker_message {
 /** @brief A connection for track @c id arrived */
 #define SM_ARRIVED 134
 
+/** @brief Playback statistics are in @c stats
+ *
+ * This is sent from time to time whether or not anything is playing.
+ */
+#define SM_STATS 135
+
+/** @brief Speaker status page
+ *
+ * The speaker keeps this up to date in a file shared with the server, so
+ * that the server can find out how far through the playing track it is
+ * without either of them having to wake up for a message.  Messages are only
+ * sent when something changes.
+ *
+ * Use speaker_status_write() and speaker_status_read() to access it.
+ */
+struct speaker_status {
+  /** @brief Sequence number
+   *
+   * Odd while the speaker is updating the page.
+   */
+  unsigned long seq;
+
+  /** @brief Playing track ID, or "" if none
+   *
+   * A track that the speaker has reported as finished does not appear here.
+   */
+  char id[24];
+
+  /** @brief Nonzero if paused */
+  int paused;
+
+  /** @brief Seconds of the playing track played */
+  long sofar;
+
+  /** @brief Bytes buffered for the playing track */
+  unsigned long long buffered;
+
+  /** @brief Size of the playing track's buffer in bytes */
+  unsigned long long buffer_size;
+
+  /** @brief Playback statistics */
+  struct uaudio_stats stats;
+};
+
 void speaker_send(int fd, const struct speaker_message *sm);
 /* Send a message. */
 
@@ -129,6 +183,12 @@ int speaker_recv(int fd, struct speaker_message *sm);
 /* Receive a message.  Return 0 on EOF, +ve if a message is read, -1 on EAGAIN,
  * terminates on any other error. */
 
+struct speaker_status *speaker_status_map(const char *path, int writable);
+void speaker_status_write(struct speaker_status *page,
+                          const struct speaker_status *status);
+int speaker_status_read(const struct speaker_status *page,
+                        struct speaker_status *status);
+
 /** @brief One chunk in a stream */
 struct stream_header {
   /** @brief Number of bytes */
@@ -24,9 +24,11 @@
 #include <errno.h>
 
 #include "mem.h"
+#include "arena.h"
 #include "split.h"
 #include "log.h"
 #include "vector.h"
+#include "sink.h"
 
 static inline int space(int c) {
   return (c == ' '
@@ -111,25 +113,172 @@ char **split(const char *p,
   return v.vec;
 }
 
+/** @brief Find or unquote the fields of a string in place
+ * @param p String to split
+ * @param vec Where to store fields, or NULL just to count them
+ * @param flags Flags as for split()
+ * @param error_handler Error handler
+ * @param u Passed to @p error_handler
+ * @return Number of fields, or -1 on error
+ *
+ * If @p vec is NULL then @p p is not modified.  Otherwise each field is
+ * terminated and unquoted where it lies, which is possible because a field is
+ * never longer than the text it was parsed from.  Having already counted the
+ * fields of a string, splitting it cannot fail.
+ */
+static int split__inplace(char *p,
+                          char **vec,
+                          unsigned flags,
+                          void (*error_handler)(const char *msg, void *u),
+                          void *u) {
+  char *f, *g, *q;
+  int n = 0, qc;
+
+  while(*p && !(*p == '#' && (flags & SPLIT_COMMENTS))) {
+    if(space(*p)) {
+      ++p;
+      continue;
+    }
+    /* Unquoted text is copied over the opening quote */
+    f = g = p;
+    if((flags & SPLIT_QUOTES) && (*p == '"' || *p == '\'')) {
+      qc = *p++;
+      for(q = p; *q != qc; ++q) {
+        if(!*q) {
+          error_handler("unterminated quoted string", u);
+          return -1;
+        }
+        if(*q == '\\') {
+          switch(*++q) {
+          case '\\':
+          case '"':
+          case '\'':
+            break;
+          case 'n':
+            if(vec)
+              *q = '\n';
+            break;
+          default:
+            error_handler("illegal escape sequence", u);
+            return -1;
+          }
+        }
+        if(vec)
+          *g++ = *q;
+      }
+      p = q + 1;
+    } else {
+      for(q = p; *q && !space(*q); ++q)
+        ;
+      g = q;
+      p = *q ? q + 1 : q;
+    }
+    if(vec) {
+      *g = 0;
+      vec[n] = f;
+    }
+    ++n;
+  }
+  return n;
+}
+
+/** @brief Split a string in place
+ * @param a Arena to allocate the result array from
+ * @param s String to split (will be modified)
+ * @param np Where to store number of fields, or NULL
+ * @param flags Flags as for split()
+ * @param error_handler Error handler, or NULL
+ * @param u Passed to @p error_handler
+ * @return Null-pointer-terminated array of fields, or NULL on error
+ *
+ * Like split(), but the fields are unquoted in place in @p s, and only the
+ * array is allocated, from @p a.  The fields last as long as @p s and the
+ * array until the next arena_reset().  @p s is unchanged if there is an
+ * error.
+ */
+char **split_inplace(struct arena *a,
+                     char *s,
+                     int *np,
+                     unsigned flags,
+                     void (*error_handler)(const char *msg, void *u),
+                     void *u) {
+  char **vec;
+  int n;
+
+  if(!error_handler)
+    error_handler = no_error_handler;
+  if((n = split__inplace(s, 0, flags, error_handler, u)) < 0)
+    return 0;
+  vec = arena_alloc(a, (n + 1) * sizeof *vec);
+  split__inplace(s, vec, flags, error_handler, u);
+  vec[n] = 0;
+  if(np)
+    *np = n;
+  return vec;
+}
+
+/** @brief Split a string in place into a fixed-size array
+ * @param s String to split (will be modified)
+ * @param vec Where to store the fields; must have room for @p max + 1
+ * @param max Maximum number of fields
+ * @param flags Flags as for split()
+ * @param error_handler Error handler, or NULL
+ * @param u Passed to @p error_handler
+ * @return Number of fields, or -1 on error
+ *
+ * Like split_inplace(), but nothing at all is allocated.  More than @p max
+ * fields is an error.  @p s is unchanged if there is an error.
+ */
+int split_fixed(char *s,
+                char **vec,
+                int max,
+                unsigned flags,
+                void (*error_handler)(const char *msg, void *u),
+                void *u) {
+  int n;
+
+  if(!error_handler)
+    error_handler = no_error_handler;
+  if((n = split__inplace(s, 0, flags, error_handler, u)) < 0)
+    return -1;
+  if(n > max) {
+    error_handler("too many fields", u);
+    return -1;
+  }
+  split__inplace(s, vec, flags, error_handler, u);
+  vec[n] = 0;
+  return n;
+}
+
 /* TODO handle initial combining characters sanely */
 
-const char *quoteutf8(const char *s) {
-  size_t len = 3 + strlen(s);
+/** @brief Test whether a UTF-8 string needs quoting
+ * @param s String to test
+ * @return Nonzero if @p s must be quoted
+ */
+static int quoteutf8__needed(const char *s) {
   const char *t;
-  char *r, *q;
-
-  /* see if we need to quote */
-  if(*s) {
-    for(t = s; *t; t++)
-      if((unsigned char)*t <= ' '
-	 || *t == '"'
-	 || *t == '\\'
-	 || *t == '\''
-	 || *t == '#')
-	break;
-    if(!*t)
-      return s;
-  }
+
+  if(!*s)
+    return 1;
+  for(t = s; *t; t++)
+    if((unsigned char)*t <= ' '
+       || *t == '"'
+       || *t == '\\'
+       || *t == '\''
+       || *t == '#')
+      return 1;
+  return 0;
+}
+
+/** @brief Find the length of a quoted UTF-8 string
+ * @param s String to quote
+ * @return Length of quoteutf8(@p s), not including the terminator
+ */
+size_t quoteutf8_size(const char *s) {
+  size_t extra = 0;
+  const char *t;
+  int needed = !*s;
 
   /* we rely on ASCII characters only ever representing themselves in UTF-8. */
   for(t = s; *t; t++) {
@@ -137,11 +286,35 @@ const char *quoteutf8(const char *s) {
     case '"':
     case '\\':
     case '\n':
-      ++len;
+      ++extra;
+      needed = 1;
+      break;
+    case '\'':
+    case '#':
+      needed = 1;
+      break;
+    default:
+      if((unsigned char)*t <= ' ')
+        needed = 1;
       break;
     }
   }
-  q = r = xmalloc_noptr(len);
+  return needed ? (size_t)(t - s) + 2 + extra : (size_t)(t - s);
+}
+
+/** @brief Write a quoted UTF-8 string to a buffer
+ * @param buffer Where to write; must have room for quoteutf8_size(@p s) + 1
+ * @param s String to quote
+ * @return Pointer to the terminator written after the quoted string
+ */
+char *quoteutf8_copy(char *buffer, const char *s) {
+  const char *t;
+  char *q = buffer;
+
+  if(!quoteutf8__needed(s)) {
+    strcpy(q, s);
+    return q + strlen(q);
+  }
   *q++ = '"';
   for(t = s; *t; t++) {
     switch(*t) {
@@ -160,9 +333,65 @@ const char *quoteutf8(const char *s) {
   }
   *q++ = '"';
   *q = 0;
+  return q;
+}
+
+/** @brief Quote a UTF-8 string
+ * @param a Arena to allocate from, or NULL to use xmalloc_noptr()
+ * @param s String to quote
+ * @return Quoted string, or @p s if no quoting is required
+ */
+static const char *quoteutf8__alloc(struct arena *a, const char *s) {
+  size_t len;
+  char *r;
+
+  if(!quoteutf8__needed(s))
+    return s;
+  len = quoteutf8_size(s) + 1;
+  r = a ? arena_alloc(a, len) : xmalloc_noptr(len);
+  quoteutf8_copy(r, s);
   return r;
 }
 
+const char *quoteutf8(const char *s) {
+  return quoteutf8__alloc(NULL, s);
+}
+
+const char *quoteutf8_arena(struct arena *a, const char *s) {
+  return quoteutf8__alloc(a, s);
+}
+
+/** @brief Write a quoted UTF-8 string to a sink
+ * @param sink Sink to write to
+ * @param s String to quote
+ * @return non-negative on success, -1 on error
+ *
+ * Writes the same as quoteutf8() would return, but without constructing it
+ * first.
+ */
+int quoteutf8_sink(struct sink *sink, const char *s) {
+  const char *t;
+
+  if(!quoteutf8__needed(s))
+    return sink_writes(sink, s);
+  if(sink_writec(sink, '"') < 0)
+    return -1;
+  while(*s) {
+    /* Copy everything that needs no escaping in one go */
+    for(t = s; *t && *t != '"' && *t != '\\' && *t != '\n'; ++t)
+      ;
+    if(t > s && sink_write(sink, s, t - s) < 0)
+      return -1;
+    if(!*t)
+      break;
+    if(sink_write(sink, *t == '\n' ? "\\n" : *t == '"' ? "\\\"" : "\\\\",
+                  2) < 0)
+      return -1;
+    s = t + 1;
+  }
+  return sink_writec(sink, '"');
+}
+
 /*
 Local Variables:
 c-basic-offset:2
@@ -21,6 +21,9 @@
 #ifndef SPLIT_H
 #define SPLIT_H
 
+struct arena;
+struct sink;
+
 #define SPLIT_COMMENTS	0001		/* # starts a comment */
 #define SPLIT_QUOTES	0002		/* " and ' quote strings */
 
@@ -37,9 +40,41 @@ char **split(const char *s,
  * split() operates on UTF-8 strings.
  */
 
+char **split_inplace(struct arena *a,
+                     char *s,
+                     int *np,
+                     unsigned flags,
+                     void (*error_handler)(const char *msg, void *u),
+                     void *u);
+/* like split() but unquote the fields in place in @s@, allocating only the
+ * array, from @a@.  @s@ is unchanged on error.  */
+
+int split_fixed(char *s,
+                char **vec,
+                int max,
+                unsigned flags,
+                void (*error_handler)(const char *msg, void *u),
+                void *u);
+/* like split_inplace() but store at most @max@ fields in @vec@, allocating
+ * nothing.  Return the number of fields or -1 on error.  */
+
 const char *quoteutf8(const char *s);
 /* quote a UTF-8 string.  Might return @s@ if no quoting is required.  */
 
+const char *quoteutf8_arena(struct arena *a, const char *s);
+/* like quoteutf8() but allocate the result from @a@.  */
+
+size_t quoteutf8_size(const char *s);
+/* return strlen(quoteutf8(@s@)).  */
+
+char *quoteutf8_copy(char *buffer, const char *s);
+/* write quoteutf8(@s@) to @buffer@ and return a pointer to the
+ * terminator.  */
+
+int quoteutf8_sink(struct sink *sink, const char *s);
+/* write quoteutf8(@s@) to @sink@ without constructing it.  Return -1 on
+ * error.  */
+
 #endif /* SPLIT_H */
 
 /*
@@ -32,6 +32,12 @@
 #if HAVE_SYS_TIME_H
 # include <sys/time.h>
 #endif
+#if HAVE_NETINET_IN_H
+# include <netinet/in.h>
+#endif
+#if HAVE_NETINET_TCP_H
+# include <netinet/tcp.h>
+#endif
 #include <signal.h>
 #include <time.h>
 
@@ -101,6 +107,32 @@ void xsetsockopt(SOCKET fd, int l, int o, const void *v, socklen_t vl) {
   mustnotbeminus1("setsockopt", setsockopt(fd, l, o, v, vl));
 }
 
+/** @brief Send small writes to a socket without delay
+ * @param fd Connected socket
+ *
+ * Disables Nagle's algorithm on TCP sockets.  Client and server each write
+ * a whole command or response at once, so there is nothing to gain by
+ * holding small segments back, and an acknowledgement delayed by the peer
+ * would hold up each reply by tens of milliseconds.
+ *
+ * Does nothing to sockets of other families.  Failure is reported but is
+ * not fatal.
+ */
+void nodelay(SOCKET fd) {
+#ifdef TCP_NODELAY
+  struct sockaddr_storage ss;
+  socklen_t len = sizeof ss;
+  int one = 1;
+
+  if(getsockname(fd, (struct sockaddr *)&ss, &len) < 0)
+    return;
+  if(ss.ss_family != AF_INET && ss.ss_family != AF_INET6)
+    return;
+  if(setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (void *)&one, sizeof one) < 0)
+    disorder_error(socket_error(), "error setting TCP_NODELAY");
+#endif
+}
+
 SOCKET xsocket(int d, int t, int p) {
   SOCKET s = socket(d, t, p);
   if(s == INVALID_SOCKET)
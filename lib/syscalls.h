@@ -62,6 +62,10 @@ void blocking(int fd);
 void cloexec(int fd);
 /* make @fd@ non-blocking/blocking/close-on-exec; call @fatal@ on error. */
 
+void nodelay(SOCKET fd);
+/* disable Nagle's algorithm if @fd@ is a TCP socket; report errors but
+ * don't call @fatal@. */
+
 int mustnotbeminus1(const char *what, int value);
 /* If @value@ is -1, report an error including @what@. */
 
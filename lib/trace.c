@@ -0,0 +1,133 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file lib/trace.c
+ * @brief Track lifecycle tracing
+ *
+ * If @c trace_file is set then disorderd, the speaker and the decoders
+ * record what they do with each track, keyed by its queue ID, by appending
+ * to that file.  This shows where the time went when a track starts late.
+ *
+ * The file is in the Chrome trace event format (see
+ * chrome://tracing or https://ui.perfetto.dev/) with one async event per
+ * line.  Events with the same queue ID are drawn together whichever process
+ * they came from.  The closing @c ] of the array is optional in that format,
+ * so several processes can append to the file at once, and it can be read
+ * while the server is still running.
+ *
+ * Times are from @c CLOCK_MONOTONIC, so are comparable between processes.
+ * Errors writing the file are ignored; tracing must never disturb playback.
+ */
+#include "common.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "mem.h"
+#include "printf.h"
+#include "syscalls.h"
+#include "trace.h"
+
+/** @brief Trace file, or -1 */
+static int trace_fd = -1;
+
+/** @brief Open the trace file
+ * @param path Path to trace file, or NULL to stop tracing
+ *
+ * Any previous trace file is closed.
+ */
+void trace_open(const char *path) {
+  struct stat sb;
+
+  if(trace_fd >= 0) {
+    xclose(trace_fd);
+    trace_fd = -1;
+  }
+  if(!path || !*path)
+    return;
+  if((trace_fd = open(path, O_WRONLY|O_APPEND|O_CREAT, 0644)) < 0) {
+    disorder_error(errno, "error opening %s", path);
+    return;
+  }
+  cloexec(trace_fd);
+  /* The first process to write to the file starts the array */
+  if(fstat(trace_fd, &sb) == 0 && sb.st_size == 0) {
+    if(write(trace_fd, "[\n", 2) < 0)
+      disorder_error(errno, "error writing to %s", path);
+  }
+}
+
+/** @brief Open the trace file for a track's subprocess
+ * @return Queue ID of track, or NULL if it is not being traced
+ *
+ * Used by decoders and disorder-normalize.  The server sets @c
+ * DISORDER_TRACE to the queue ID and the path to the trace file, separated
+ * by a space.
+ */
+const char *trace_inherit(void) {
+  const char *e = getenv("DISORDER_TRACE"), *space;
+
+  if(!e || !(space = strchr(e, ' ')))
+    return NULL;
+  trace_open(space + 1);
+  return xstrndup(e, space - e);
+}
+
+/** @brief Record a trace event
+ * @param phase @ref TRACE_BEGIN, @ref TRACE_END or @ref TRACE_INSTANT
+ * @param name Name of span or event
+ * @param id Queue ID of track, or NULL to do nothing
+ * @param when Time of event, or NULL for now
+ *
+ * @p name and @p id are not quoted, so must not contain @c " or @c \.
+ */
+void trace_event(int phase, const char *name, const char *id,
+                 const struct timespec *when) {
+  struct timespec now;
+  char buffer[256];
+  int n;
+
+  if(trace_fd < 0 || !id)
+    return;
+  if(!when) {
+    xgettime(CLOCK_MONOTONIC, &now);
+    when = &now;
+  }
+  n = byte_snprintf(buffer, sizeof buffer,
+                    "{\"name\":\"%s\",\"cat\":\"track\",\"ph\":\"%c\","
+                    "\"id\":\"%s\",\"ts\":%lld,\"pid\":%ld,\"tid\":%ld},\n",
+                    name, phase, id,
+                    (long long)when->tv_sec * 1000000 + when->tv_nsec / 1000,
+                    (long)getpid(), (long)getpid());
+  /* A single write, so that lines from different processes don't mix */
+  if(n > 0 && (size_t)n < sizeof buffer) {
+    int ignored = write(trace_fd, buffer, n);
+    (void)ignored;
+  }
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
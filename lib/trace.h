@@ -0,0 +1,50 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file lib/trace.h
+ * @brief Track lifecycle tracing
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <time.h>
+
+/** @brief Start of a span */
+#define TRACE_BEGIN 'b'
+
+/** @brief End of a span */
+#define TRACE_END 'e'
+
+/** @brief A single point in time */
+#define TRACE_INSTANT 'n'
+
+void trace_open(const char *path);
+const char *trace_inherit(void);
+void trace_event(int phase, const char *name, const char *id,
+                 const struct timespec *when);
+
+#endif /* TRACE_H */
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
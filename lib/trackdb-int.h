@@ -24,6 +24,7 @@
 
 #include "trackdb.h"
 #include "kvp.h"
+#include "configuration.h"
 
 struct vector;                          /* forward declaration */
 
@@ -32,12 +33,20 @@ extern DB_ENV *trackdb_env;
 extern DB *trackdb_tracksdb;
 extern DB *trackdb_prefsdb;
 extern DB *trackdb_searchdb;
+extern DB *trackdb_wordsdb;
+extern DB *trackdb_trigramsdb;
 extern DB *trackdb_tagsdb;
 extern DB *trackdb_noticeddb;
 extern DB *trackdb_globaldb;
 extern DB *trackdb_usersdb;
 extern DB *trackdb_scheduledb;
 extern DB *trackdb_playlistsdb;
+extern DB *trackdb_lengthsdb;
+extern DB *trackdb_dirsdb;
+
+DB *trackdb_lazy(DB **db);
+/* return a database handle, opening it first if necessary.  Must be used for
+ * trackdb_scheduledb and trackdb_playlistsdb. */
 
 DBC *trackdb_opencursor(DB *db, DB_TXN *tid);
 /* open a transaction */
@@ -49,21 +58,35 @@ int trackdb_notice(const char *track,
                    const char *path);
 int trackdb_notice_tid(const char *track,
                        const char *path,
+                       const char *sig,
                        DB_TXN *tid);
 /* notice a track; return DB_NOTFOUND if new, else 0.  _tid can return
  * DB_LOCK_DEADLOCK too. */
 
+long trackdb_notice_batch(int ntracks, char **tracks, char **paths,
+                          char **sigs);
+/* notice several tracks in one transaction; return the number that were new */
+
+char *trackdb_stat_signature(const char *path);
+/* return a string that changes whenever PATH is modified, or NULL */
+
 int trackdb_obsolete(const char *track, DB_TXN *tid);
 /* obsolete a track */
 
+int trackdb_stats_forget(DB_TXN *tid);
+/* discard the library stats after search.db or tags.db is rebuilt */
+
 DB_TXN *trackdb_begin_transaction(void);
+DB_TXN *trackdb_begin_read_transaction(void);
 void trackdb_abort_transaction(DB_TXN *tid);
 void trackdb_commit_transaction(DB_TXN *tid);
-/* begin, abort or commit a transaction */
+/* begin, abort or commit a transaction.  Read transactions see a snapshot
+ * and must not modify anything. */
 
 /** @brief Evaluate @p expr in a transaction, looping on deadlock
  *
  * @c tid will be the transaction handle.  @p e will be the error code.
+ * Each retry is counted against the calling function by trackdb_deadlocked().
  */
 #define WITH_TRANSACTION(expr) do {             \
   DB_TXN *tid;                                  \
@@ -71,6 +94,7 @@ void trackdb_commit_transaction(DB_TXN *tid);
   tid = trackdb_begin_transaction();            \
   while((e = (expr)) == DB_LOCK_DEADLOCK) {     \
     trackdb_abort_transaction(tid);             \
+    trackdb_deadlocked(__func__);               \
     tid = trackdb_begin_transaction();          \
   }                                             \
   if(e)                                         \
@@ -134,16 +158,25 @@ static inline DBT *prepare_data(DBT *data) {
   return data;
 }
 
-/* encode K and store in DATA, returns DATA */
+/* encode K and store in DATA, returns DATA.  From database version 3 records
+ * are packed rather than url-encoded. */
 static inline DBT *encode_data(DBT *data, const struct kvp *k) {
   size_t size;
   
   memset(data, 0, sizeof *data);
-  data->data = kvp_urlencode(k, &size);
+  if(config->dbversion >= 3)
+    data->data = kvp_pack(k, &size);
+  else
+    data->data = kvp_urlencode(k, &size);
   data->size = size;
   return data;
 }
 
+/* decode DATA in either encoding.  The result may point into DATA. */
+static inline struct kvp *decode_data(const DBT *data) {
+  return kvp_unpack(data->data, data->size);
+}
+
 int trackdb_set_global_tid(const char *name,
                            const char *value,
                            DB_TXN *tid);
@@ -153,6 +186,17 @@ int trackdb_get_global_tid(const char *name,
 
 char **parsetags(const char *s);
 int tag_intersection(char **a, char **b);
+int trackdb_tag_bits(char **tags, char **bitsp, DB_TXN *tid);
+int tag_bits_intersect(const char *a, const char *b);
+
+void trackdb_length_changed(const char *track,
+                            const char *oldlength,
+                            const char *newlength);
+/* note that TRACK's recorded length has changed from OLDLENGTH to NEWLENGTH
+ * (either may be NULL), for the directory summaries */
+
+int trackdb_dirs_flush(DB_TXN *tid);
+/* write pending directory summary changes in transaction TID */
 
 #endif /* TRACKDB_INT_H */
 
@@ -22,6 +22,11 @@
  *
  * This file implements reading and modification of playlists, including access
  * control, but not locking or event logging (at least yet).
+ *
+ * A playlist's own record holds its sharing status, its track count and the
+ * list of its chunks.  The tracks themselves are kept in chunk records, keyed
+ * by the playlist name, a "/" and the chunk ID, so that an edit only rewrites
+ * the chunks it touches.  "/" cannot appear in a playlist name.
  */
 #include "common.h"
 
@@ -34,6 +39,12 @@
 #include "vector.h"
 #include "eventlog.h"
 #include "validity.h"
+#include "printf.h"
+
+/** @brief Return the playlists database, opening it if necessary */
+static DB *playlists_db(void) {
+  return trackdb_lazy(&trackdb_playlistsdb);
+}
 
 static int trackdb_playlist_get_tid(const char *name,
                                     const char *who,
@@ -54,6 +65,62 @@ static int trackdb_playlist_list_tid(const char *who,
 static int trackdb_playlist_delete_tid(const char *name,
                                        const char *who,
                                        DB_TXN *tid);
+static int trackdb_playlist_edit_tid(const char *name,
+                                     const char *who,
+                                     int position,
+                                     char **tracks,
+                                     int ntracks,
+                                     int to,
+                                     DB_TXN *tid);
+
+/** @brief Largest number of tracks normally kept in one playlist chunk
+ *
+ * A chunk that grows past twice this size is split, and a modified chunk is
+ * merged with a neighbour if they fit in this size together.
+ */
+#define PLAYLIST_CHUNK 256
+
+/** @brief One chunk of a playlist */
+struct playlist_chunk {
+  /** @brief Chunk ID, which names its record */
+  int id;
+
+  /** @brief Number of tracks in the chunk */
+  int ntracks;
+
+  /** @brief Tracks in the chunk, or NULL if not loaded yet */
+  char **tracks;
+
+  /** @brief Nonzero if the chunk's record must be written back */
+  int dirty;
+};
+
+/** @brief A playlist being read or modified */
+struct playlist {
+  /** @brief Playlist name */
+  const char *name;
+
+  /** @brief The playlist's own record */
+  struct kvp *k;
+
+  /** @brief Chunks in playlist order */
+  struct playlist_chunk *chunks;
+
+  /** @brief Number of chunks */
+  int nchunks;
+
+  /** @brief Total number of tracks */
+  int ntracks;
+
+  /** @brief Next unused chunk ID */
+  int nextid;
+
+  /** @brief IDs of chunk records to delete */
+  int *dropped;
+
+  /** @brief Number of chunk records to delete */
+  int ndropped;
+};
 
 /** @brief Check read access rights
  * @param name Playlist name
@@ -102,6 +169,462 @@ static int playlist_may_write(const char *name,
   return 0;
 }
 
+/** @brief Return the key of a playlist chunk record
+ * @param name Playlist name
+ * @param id Chunk ID
+ * @return Key
+ */
+static char *playlist_chunk_key(const char *name, int id) {
+  char *key;
+
+  byte_xasprintf(&key, "%s/%d", name, id);
+  return key;
+}
+
+/** @brief Add a chunk to a playlist
+ * @param pl Playlist
+ * @param ci Index to add the new chunk at
+ * @param tracks Tracks for the new chunk
+ * @param ntracks Number of tracks
+ *
+ * The track count of the playlist is not updated.
+ */
+static void playlist_add_chunk(struct playlist *pl, int ci,
+                               char **tracks, int ntracks) {
+  struct playlist_chunk *ch;
+
+  pl->chunks = xrealloc(pl->chunks, (pl->nchunks + 1) * sizeof *pl->chunks);
+  memmove(&pl->chunks[ci + 1], &pl->chunks[ci],
+          (pl->nchunks - ci) * sizeof *pl->chunks);
+  ++pl->nchunks;
+  ch = &pl->chunks[ci];
+  ch->id = pl->nextid++;
+  ch->ntracks = ntracks;
+  ch->tracks = xcalloc(ntracks + 1, sizeof (char *));
+  memcpy(ch->tracks, tracks, ntracks * sizeof (char *));
+  ch->dirty = 1;
+}
+
+/** @brief Remove a chunk from a playlist
+ * @param pl Playlist
+ * @param ci Index of chunk to remove
+ *
+ * The chunk's record is deleted when the playlist is written.  The track count
+ * of the playlist is not updated.
+ */
+static void playlist_drop_chunk(struct playlist *pl, int ci) {
+  pl->dropped = xrealloc(pl->dropped, (pl->ndropped + 1) * sizeof (int));
+  pl->dropped[pl->ndropped++] = pl->chunks[ci].id;
+  memmove(&pl->chunks[ci], &pl->chunks[ci + 1],
+          (pl->nchunks - ci - 1) * sizeof *pl->chunks);
+  --pl->nchunks;
+}
+
+/** @brief Replace all of a playlist's tracks
+ * @param pl Playlist
+ * @param tracks New tracks
+ * @param ntracks Number of tracks
+ */
+static void playlist_replace(struct playlist *pl,
+                             char **tracks, int ntracks) {
+  int n;
+
+  while(pl->nchunks)
+    playlist_drop_chunk(pl, pl->nchunks - 1);
+  for(n = 0; n < ntracks; n += PLAYLIST_CHUNK)
+    playlist_add_chunk(pl, pl->nchunks, tracks + n,
+                       ntracks - n < PLAYLIST_CHUNK ? ntracks - n
+                                                  : PLAYLIST_CHUNK);
+  pl->ntracks = ntracks;
+}
+
+/** @brief Read a playlist's own record
+ * @param name Playlist name
+ * @param pl Where to put the playlist
+ * @param tid Owning transaction
+ * @return 0, DB_NOTFOUND or DB_LOCK_DEADLOCK
+ *
+ * Chunks are loaded on demand.  A playlist in the old format, with its tracks
+ * in its own record, is converted to chunks in memory and will be written back
+ * in the new format.
+ */
+static int playlist_read(const char *name,
+                         struct playlist *pl,
+                         DB_TXN *tid) {
+  const char *s;
+  char *end;
+  long id, count;
+  int e, n, total;
+
+  memset(pl, 0, sizeof *pl);
+  pl->name = name;
+  if((e = trackdb_getdata(playlists_db(), name, &pl->k, tid)))
+    return e;
+  if(!(s = kvp_get(pl->k, "count"))) {
+    disorder_error(0, "playlist '%s' has no 'count' key", name);
+    s = "0";
+  }
+  pl->ntracks = atoi(s);
+  if(pl->ntracks < 0) {
+    disorder_error(0, "playlist '%s' has negative count", name);
+    pl->ntracks = 0;
+  }
+  if((s = kvp_get(pl->k, "chunks"))) {
+    /* The chunk list is "ID:COUNT ID:COUNT ..." */
+    total = 0;
+    while(*s) {
+      id = strtol(s, &end, 10);
+      if(end == s || *end != ':' || id < 0)
+        break;
+      s = end + 1;
+      count = strtol(s, &end, 10);
+      if(end == s || count < 0)
+        break;
+      s = end;
+      while(*s == ' ')
+        ++s;
+      pl->chunks = xrealloc(pl->chunks,
+                            (pl->nchunks + 1) * sizeof *pl->chunks);
+      memset(&pl->chunks[pl->nchunks], 0, sizeof *pl->chunks);
+      pl->chunks[pl->nchunks].id = id;
+      pl->chunks[pl->nchunks].ntracks = count;
+      ++pl->nchunks;
+      if(id >= pl->nextid)
+        pl->nextid = id + 1;
+      total += count;
+    }
+    if(*s)
+      disorder_error(0, "playlist '%s' has a malformed chunk list", name);
+    if(total != pl->ntracks) {
+      disorder_error(0, "playlist '%s' count does not match its chunks", name);
+      pl->ntracks = total;
+    }
+  } else if(pl->ntracks) {
+    /* Old format */
+    char **tracks = xcalloc(pl->ntracks, sizeof (char *));
+    char b[16];
+
+    for(n = 0; n < pl->ntracks; ++n) {
+      snprintf(b, sizeof b, "%d", n);
+      if(!(s = kvp_get(pl->k, b))) {
+        disorder_error(0, "playlist '%s' lacks track %d", name, n);
+        s = "unknown";
+      }
+      tracks[n] = xstrdup(s);
+      kvp_set(&pl->k, b, NULL);
+    }
+    playlist_replace(pl, tracks, pl->ntracks);
+  }
+  return 0;
+}
+
+/** @brief Load a playlist chunk
+ * @param pl Playlist
+ * @param ci Index of chunk to load
+ * @param tid Owning transaction
+ * @return 0 or DB_LOCK_DEADLOCK
+ */
+static int playlist_load_chunk(struct playlist *pl, int ci, DB_TXN *tid) {
+  struct playlist_chunk *ch = &pl->chunks[ci];
+  struct kvp *k;
+  const char *s;
+  char b[16];
+  int e, n;
+
+  if(ch->tracks)
+    return 0;
+  e = trackdb_getdata(playlists_db(), playlist_chunk_key(pl->name, ch->id),
+                      &k, tid);
+  if(e == DB_LOCK_DEADLOCK)
+    return e;
+  if(e == DB_NOTFOUND)
+    disorder_error(0, "playlist '%s' lacks chunk %d", pl->name, ch->id);
+  ch->tracks = xcalloc(ch->ntracks + 1, sizeof (char *));
+  for(n = 0; n < ch->ntracks; ++n) {
+    snprintf(b, sizeof b, "%d", n);
+    if(!(s = kvp_get(k, b))) {
+      if(k)
+        disorder_error(0, "playlist '%s' chunk %d lacks track %d",
+                       pl->name, ch->id, n);
+      s = "unknown";
+    }
+    ch->tracks[n] = xstrdup(s);
+  }
+  return 0;
+}
+
+/** @brief Merge a playlist chunk with its successor
+ * @param pl Playlist
+ * @param ci Index of first chunk
+ * @param tid Owning transaction
+ * @return 0 or DB_LOCK_DEADLOCK
+ */
+static int playlist_merge_chunks(struct playlist *pl, int ci, DB_TXN *tid) {
+  struct playlist_chunk *a, *b;
+  char **tracks;
+  int e;
+
+  if((e = playlist_load_chunk(pl, ci, tid))
+     || (e = playlist_load_chunk(pl, ci + 1, tid)))
+    return e;
+  a = &pl->chunks[ci];
+  b = &pl->chunks[ci + 1];
+  tracks = xcalloc(a->ntracks + b->ntracks + 1, sizeof (char *));
+  memcpy(tracks, a->tracks, a->ntracks * sizeof (char *));
+  memcpy(tracks + a->ntracks, b->tracks, b->ntracks * sizeof (char *));
+  a->tracks = tracks;
+  a->ntracks += b->ntracks;
+  a->dirty = 1;
+  playlist_drop_chunk(pl, ci + 1);
+  return 0;
+}
+
+/** @brief Split, merge or drop modified playlist chunks
+ * @param pl Playlist
+ * @param tid Owning transaction
+ * @return 0 or DB_LOCK_DEADLOCK
+ */
+static int playlist_tidy(struct playlist *pl, DB_TXN *tid) {
+  int ci = 0, e;
+
+  while(ci < pl->nchunks) {
+    struct playlist_chunk *ch = &pl->chunks[ci];
+
+    if(!ch->dirty)
+      ++ci;
+    else if(!ch->ntracks)
+      playlist_drop_chunk(pl, ci);
+    else if(ch->ntracks > 2 * PLAYLIST_CHUNK) {
+      /* Split off everything after the first PLAYLIST_CHUNK tracks; the new
+       * chunk is checked in its turn */
+      playlist_add_chunk(pl, ci + 1, ch->tracks + PLAYLIST_CHUNK,
+                         ch->ntracks - PLAYLIST_CHUNK);
+      pl->chunks[ci++].ntracks = PLAYLIST_CHUNK;
+    } else if(ci > 0
+              && pl->chunks[ci - 1].ntracks + ch->ntracks <= PLAYLIST_CHUNK) {
+      if((e = playlist_merge_chunks(pl, ci - 1, tid)))
+        return e;
+      --ci;
+    } else if(ci + 1 < pl->nchunks
+              && ch->ntracks + pl->chunks[ci + 1].ntracks <= PLAYLIST_CHUNK) {
+      if((e = playlist_merge_chunks(pl, ci, tid)))
+        return e;
+    } else
+      ++ci;
+  }
+  return 0;
+}
+
+/** @brief Get tracks from a playlist
+ * @param pl Playlist
+ * @param position Index of first track
+ * @param ntracks Number of tracks
+ * @param tracksp Where to put the NULL-terminated track list
+ * @param tid Owning transaction
+ * @return 0 or DB_LOCK_DEADLOCK
+ *
+ * Only the chunks covering the range are loaded.
+ */
+static int playlist_tracks(struct playlist *pl,
+                           int position, int ntracks,
+                           char ***tracksp,
+                           DB_TXN *tid) {
+  char **tracks = xcalloc(ntracks + 1, sizeof (char *));
+  int ci, n, got = 0, e;
+
+  for(ci = 0; got < ntracks && ci < pl->nchunks; ++ci) {
+    if(position >= pl->chunks[ci].ntracks) {
+      position -= pl->chunks[ci].ntracks;
+      continue;
+    }
+    if((e = playlist_load_chunk(pl, ci, tid)))
+      return e;
+    n = pl->chunks[ci].ntracks - position;
+    if(n > ntracks - got)
+      n = ntracks - got;
+    memcpy(tracks + got, pl->chunks[ci].tracks + position,
+           n * sizeof (char *));
+    got += n;
+    position = 0;
+  }
+  tracks[got] = 0;
+  *tracksp = tracks;
+  return 0;
+}
+
+/** @brief Insert tracks into a playlist
+ * @param pl Playlist
+ * @param position Index to insert at
+ * @param tracks Tracks to insert
+ * @param ntracks Number of tracks
+ * @param tid Owning transaction
+ * @return 0 or DB_LOCK_DEADLOCK
+ */
+static int playlist_insert(struct playlist *pl,
+                           int position,
+                           char **tracks, int ntracks,
+                           DB_TXN *tid) {
+  struct playlist_chunk *ch;
+  char **newtracks;
+  int ci, e;
+
+  if(!ntracks)
+    return 0;
+  /* An insertion between two chunks goes at the end of the first */
+  for(ci = 0; ci < pl->nchunks && position > pl->chunks[ci].ntracks; ++ci)
+    position -= pl->chunks[ci].ntracks;
+  if(ci == pl->nchunks)
+    playlist_add_chunk(pl, ci, tracks, ntracks);
+  else {
+    if((e = playlist_load_chunk(pl, ci, tid)))
+      return e;
+    ch = &pl->chunks[ci];
+    newtracks = xcalloc(ch->ntracks + ntracks + 1, sizeof (char *));
+    memcpy(newtracks, ch->tracks, position * sizeof (char *));
+    memcpy(newtracks + position, tracks, ntracks * sizeof (char *));
+    memcpy(newtracks + position + ntracks, ch->tracks + position,
+           (ch->ntracks - position) * sizeof (char *));
+    ch->tracks = newtracks;
+    ch->ntracks += ntracks;
+    ch->dirty = 1;
+  }
+  pl->ntracks += ntracks;
+  return playlist_tidy(pl, tid);
+}
+
+/** @brief Remove tracks from a playlist
+ * @param pl Playlist
+ * @param position Index of first track to remove
+ * @param ntracks Number of tracks to remove
+ * @param tid Owning transaction
+ * @return 0 or DB_LOCK_DEADLOCK
+ *
+ * Chunks that are removed completely are not read.
+ */
+static int playlist_remove(struct playlist *pl,
+                           int position, int ntracks,
+                           DB_TXN *tid) {
+  struct playlist_chunk *ch;
+  int ci = 0, n, e;
+
+  while(ntracks > 0 && ci < pl->nchunks) {
+    ch = &pl->chunks[ci];
+    if(position >= ch->ntracks) {
+      position -= ch->ntracks;
+      ++ci;
+    } else if(position == 0 && ntracks >= ch->ntracks) {
+      ntracks -= ch->ntracks;
+      pl->ntracks -= ch->ntracks;
+      playlist_drop_chunk(pl, ci);
+    } else {
+      if((e = playlist_load_chunk(pl, ci, tid)))
+        return e;
+      n = ch->ntracks - position;
+      if(n > ntracks)
+        n = ntracks;
+      memmove(ch->tracks + position, ch->tracks + position + n,
+              (ch->ntracks - position - n) * sizeof (char *));
+      ch->ntracks -= n;
+      ch->dirty = 1;
+      pl->ntracks -= n;
+      ntracks -= n;
+      position = 0;
+      ++ci;
+    }
+  }
+  return playlist_tidy(pl, tid);
+}
+
+/** @brief Write back a modified playlist
+ * @param pl Playlist
+ * @param tid Owning transaction
+ * @return 0 or DB_LOCK_DEADLOCK
+ */
+static int playlist_write(struct playlist *pl, DB_TXN *tid) {
+  struct dynstr chunks[1];
+  struct kvp *k;
+  char b[32];
+  int ci, n, e;
+
+  dynstr_init(chunks);
+  for(ci = 0; ci < pl->nchunks; ++ci) {
+    struct playlist_chunk *ch = &pl->chunks[ci];
+
+    if(ch->dirty) {
+      k = 0;
+      for(n = 0; n < ch->ntracks; ++n) {
+        snprintf(b, sizeof b, "%d", n);
+        kvp_set(&k, b, ch->tracks[n]);
+      }
+      if((e = trackdb_putdata(playlists_db(),
+                              playlist_chunk_key(pl->name, ch->id),
+                              k, tid, 0)))
+        return e;
+    }
+    snprintf(b, sizeof b, "%s%d:%d", ci ? " " : "", ch->id, ch->ntracks);
+    dynstr_append_string(chunks, b);
+  }
+  for(n = 0; n < pl->ndropped; ++n)
+    if((e = trackdb_delkey(playlists_db(),
+                           playlist_chunk_key(pl->name, pl->dropped[n]),
+                           tid)))
+      return e;
+  dynstr_terminate(chunks);
+  kvp_set(&pl->k, "chunks", chunks->vec);
+  snprintf(b, sizeof b, "%d", pl->ntracks);
+  kvp_set(&pl->k, "count", b);
+  return trackdb_putdata(playlists_db(), pl->name, pl->k, tid, 0);
+}
+
+/** @brief Open a playlist for modification
+ * @param name Playlist name
+ * @param who User modifying playlist
+ * @param pl Where to put the playlist
+ * @param eventp Where to put the event to log if it is modified
+ * @param tid Owning transaction
+ * @return 0 on success, non-0 on error
+ *
+ * If the playlist does not exist it is set up in memory with the default
+ * sharing status, and @p *eventp is set to @c playlist_created.
+ */
+static int playlist_open(const char *name,
+                         const char *who,
+                         struct playlist *pl,
+                         const char **eventp,
+                         DB_TXN *tid) {
+  int e;
+  const char *s;
+
+  *eventp = "playlist_modified";
+  if((e = playlist_read(name, pl, tid))
+     && e != DB_NOTFOUND)
+    return e;
+  /* If the playlist doesn't exist set some defaults */
+  if(e == DB_NOTFOUND) {
+    char *defshare, *owner;
+
+    if(playlist_parse_name(name, &owner, &defshare))
+      return EINVAL;
+    /* Can't create a non-shared playlist belonging to someone else.  In fact
+     * this should be picked up by playlist_may_write() below but it's clearer
+     * to do it here. */
+    if(owner && strcmp(owner, who))
+      return EACCES;
+    pl->k = 0;
+    kvp_set(&pl->k, "count", 0);
+    kvp_set(&pl->k, "sharing", defshare);
+    *eventp = "playlist_created";
+  }
+  /* Check that the modification is allowed */
+  if(!(s = kvp_get(pl->k, "sharing"))) {
+    disorder_error(0, "playlist '%s' has no 'sharing' key", name);
+    s = "private";
+  }
+  if(!playlist_may_write(name, who, s))
+    return EACCES;
+  return 0;
+}
+
 /** @brief Get playlist data
  * @param name Name of playlist
  * @param who Who wants to know
@@ -142,14 +665,14 @@ static int trackdb_playlist_get_tid(const char *name,
                                     int *ntracksp,
                                     char **sharep,
                                     DB_TXN *tid) {
-  struct kvp *k;
-  int e, ntracks;
+  struct playlist pl[1];
+  int e;
   const char *s;
 
-  if((e = trackdb_getdata(trackdb_playlistsdb, name, &k, tid)))
+  if((e = playlist_read(name, pl, tid)))
     return e;
   /* Get sharability */
-  if(!(s = kvp_get(k, "sharing"))) {
+  if(!(s = kvp_get(pl->k, "sharing"))) {
     disorder_error(0, "playlist '%s' has no 'sharing' key", name);
     s = "private";
   }
@@ -159,36 +682,12 @@ static int trackdb_playlist_get_tid(const char *name,
   /* Return sharability */
   if(sharep)
     *sharep = xstrdup(s);
-  /* Get track count */
-  if(!(s = kvp_get(k, "count"))) {
-    disorder_error(0, "playlist '%s' has no 'count' key", name);
-    s = "0";
-  }
-  ntracks = atoi(s);
-  if(ntracks < 0) {
-    disorder_error(0, "playlist '%s' has negative count", name);
-    ntracks = 0;
-  }
   /* Return track count */
   if(ntracksp)
-    *ntracksp = ntracks;
-  if(tracksp) {
-    /* Get track list */
-    char **tracks = xcalloc(ntracks + 1, sizeof (char *));
-    char b[16];
-
-    for(int n = 0; n < ntracks; ++n) {
-      snprintf(b, sizeof b, "%d", n);
-      if(!(s = kvp_get(k, b))) {
-        disorder_error(0, "playlist '%s' lacks track %d", name, n);
-        s = "unknown";
-      }
-      tracks[n] = xstrdup(s);
-    }
-    tracks[ntracks] = 0;
-    /* Return track list */
-    *tracksp = tracks;
-  }
+    *ntracksp = pl->ntracks;
+  /* Return track list */
+  if(tracksp)
+    return playlist_tracks(pl, 0, pl->ntracks, tracksp, tid);
   return 0;
 }
 
@@ -256,79 +755,191 @@ static int trackdb_playlist_set_tid(const char *name,
                                     int ntracks,
                                     const char *share,
                                     DB_TXN *tid) {
-  struct kvp *k;
+  struct playlist pl[1];
   int e;
-  const char *s;
-  const char *event = "playlist_modified";
+  const char *event;
 
-  if((e = trackdb_getdata(trackdb_playlistsdb, name, &k, tid))
-     && e != DB_NOTFOUND)
+  if((e = playlist_open(name, who, pl, &event, tid)))
     return e;
-  /* If the playlist doesn't exist set some defaults */
-  if(e == DB_NOTFOUND) {
-    char *defshare, *owner;
-
-    if(playlist_parse_name(name, &owner, &defshare))
-      return EINVAL;
-    /* Can't create a non-shared playlist belonging to someone else.  In fact
-     * this should be picked up by playlist_may_write() below but it's clearer
-     * to do it here. */
-    if(owner && strcmp(owner, who))
-      return EACCES;
-    k = 0;
-    kvp_set(&k, "count", 0);
-    kvp_set(&k, "sharing", defshare);
-    event = "playlist_created";
-  }
-  /* Check that the modification is allowed */
-  if(!(s = kvp_get(k, "sharing"))) {
-    disorder_error(0, "playlist '%s' has no 'sharing' key", name);
-    s = "private";
-  }
-  if(!playlist_may_write(name, who, s))
-    return EACCES;
   /* If no change was requested then don't even create */
   if(!share && !tracks)
     return 0;
   /* Set the new values */
   if(share)
-    kvp_set(&k, "sharing", share);
+    kvp_set(&pl->k, "sharing", share);
   if(tracks) {
-    char b[16];
-    int oldcount, n;
-
     /* Sanity check track count */
     if(ntracks < 0 || ntracks > config->playlist_max) {
       disorder_error(0, "invalid track count %d", ntracks);
       return EINVAL;
     }
-    /* Set the tracks */
-    for(n = 0; n < ntracks; ++n) {
-      snprintf(b, sizeof b, "%d", n);
-      kvp_set(&k, b, tracks[n]);
-    }
-    /* Get the old track count */
-    if((s = kvp_get(k, "count")))
-      oldcount = atoi(s);
-    else
-      oldcount = 0;
-    /* Delete old slots */
-    for(; n < oldcount; ++n) {
-      snprintf(b, sizeof b, "%d", n);
-      kvp_set(&k, b, NULL);
-    }
-    /* Set the new count */
-    snprintf(b, sizeof b, "%d", ntracks);
-    kvp_set(&k, "count", b);
+    playlist_replace(pl, tracks, ntracks);
   }
-  /* Store the resulting record */
-  e = trackdb_putdata(trackdb_playlistsdb, name, k, tid, 0);
+  /* Store the resulting records */
+  e = playlist_write(pl, tid);
   /* Log the event */
   if(!e)
-    eventlog(event, name, kvp_get(k, "sharing"), (char *)0);
+    eventlog(event, name, kvp_get(pl->k, "sharing"), (char *)0);
   return e;
 }
 
+/** @brief Modify part of a playlist
+ * @param name Playlist name
+ * @param who User modifying playlist
+ * @param position Where to insert or remove tracks
+ * @param tracks Tracks to insert, or NULL to remove or move tracks
+ * @param ntracks Number of tracks to insert, remove or move
+ * @param to Where to move the removed tracks to, or -1 to discard them
+ * @return 0 on success, non-0 on error
+ *
+ * Only the chunks the change affects are rewritten.
+ */
+static int playlist_edit(const char *name,
+                         const char *who,
+                         int position,
+                         char **tracks,
+                         int ntracks,
+                         int to) {
+  int e;
+
+  if(playlist_parse_name(name, 0, 0)) {
+    disorder_error(0, "invalid playlist name '%s'", name);
+    return EINVAL;
+  }
+  if(position < 0 || ntracks < 0)
+    return ERANGE;
+  WITH_TRANSACTION(trackdb_playlist_edit_tid(name, who, position,
+                                             tracks, ntracks, to, tid));
+  if(e == DB_NOTFOUND)
+    e = ENOENT;
+  return e;
+}
+
+static int trackdb_playlist_edit_tid(const char *name,
+                                     const char *who,
+                                     int position,
+                                     char **tracks,
+                                     int ntracks,
+                                     int to,
+                                     DB_TXN *tid) {
+  struct playlist pl[1];
+  char **moved;
+  int e;
+  const char *event;
+
+  if((e = playlist_open(name, who, pl, &event, tid)))
+    return e;
+  if(tracks) {
+    /* Insertion */
+    if(position > pl->ntracks)
+      return ERANGE;
+    if(pl->ntracks + ntracks > config->playlist_max) {
+      disorder_error(0, "invalid track count %d", pl->ntracks + ntracks);
+      return EINVAL;
+    }
+    /* Inserting nothing doesn't create the playlist */
+    if(!ntracks)
+      return 0;
+    if((e = playlist_insert(pl, position, tracks, ntracks, tid)))
+      return e;
+  } else {
+    /* Removal or move */
+    if(!strcmp(event, "playlist_created"))
+      return DB_NOTFOUND;
+    if(position + ntracks > pl->ntracks
+       || (to >= 0 && to > pl->ntracks - ntracks))
+      return ERANGE;
+    if(!ntracks || (to >= 0 && to == position))
+      return 0;
+    if(to >= 0
+       && (e = playlist_tracks(pl, position, ntracks, &moved, tid)))
+      return e;
+    if((e = playlist_remove(pl, position, ntracks, tid)))
+      return e;
+    if(to >= 0
+       && (e = playlist_insert(pl, to, moved, ntracks, tid)))
+      return e;
+  }
+  e = playlist_write(pl, tid);
+  if(!e)
+    eventlog(event, name, kvp_get(pl->k, "sharing"), (char *)0);
+  return e;
+}
+
+/** @brief Insert tracks into a playlist
+ * @param name Playlist name
+ * @param who User modifying playlist
+ * @param position Index to insert before, or the track count to append
+ * @param tracks Tracks to insert
+ * @param ntracks Number of tracks to insert
+ * @return 0 on success, non-0 on error
+ *
+ * If the playlist does not exist it is created, as for
+ * trackdb_playlist_set().
+ *
+ * Possible return values:
+ * - @c 0 on success
+ * - @c EINVAL if the playlist name is invalid or it would have too many tracks
+ * - @c EACCES if the playlist cannot be modified by @p who
+ * - @c ERANGE if @p position is out of range
+ */
+int trackdb_playlist_insert(const char *name,
+                            const char *who,
+                            int position,
+                            char **tracks,
+                            int ntracks) {
+  return playlist_edit(name, who, position, tracks, ntracks, -1);
+}
+
+/** @brief Remove tracks from a playlist
+ * @param name Playlist name
+ * @param who User modifying playlist
+ * @param position Index of first track to remove
+ * @param ntracks Number of tracks to remove
+ * @return 0 on success, non-0 on error
+ *
+ * Possible return values:
+ * - @c 0 on success
+ * - @c EINVAL if the playlist name is invalid
+ * - @c EACCES if the playlist cannot be modified by @p who
+ * - @c ENOENT if the playlist doesn't exist
+ * - @c ERANGE if the tracks to remove are out of range
+ */
+int trackdb_playlist_remove(const char *name,
+                            const char *who,
+                            int position,
+                            int ntracks) {
+  return playlist_edit(name, who, position, 0, ntracks, -1);
+}
+
+/** @brief Move tracks within a playlist
+ * @param name Playlist name
+ * @param who User modifying playlist
+ * @param position Index of first track to move
+ * @param ntracks Number of tracks to move
+ * @param to Index to move them to
+ * @return 0 on success, non-0 on error
+ *
+ * @p to is an index in the playlist with the moved tracks taken out, so the
+ * first moved track ends up at index @p to.
+ *
+ * Possible return values:
+ * - @c 0 on success
+ * - @c EINVAL if the playlist name is invalid
+ * - @c EACCES if the playlist cannot be modified by @p who
+ * - @c ENOENT if the playlist doesn't exist
+ * - @c ERANGE if the tracks to move or @p to are out of range
+ */
+int trackdb_playlist_move(const char *name,
+                          const char *who,
+                          int position,
+                          int ntracks,
+                          int to) {
+  if(to < 0)
+    return ERANGE;
+  return playlist_edit(name, who, position, 0, ntracks, to);
+}
+
 /** @brief Get a list of playlists
  * @param who Who wants to know
  * @param playlistsp Where to put list of playlists
@@ -353,12 +964,17 @@ static int trackdb_playlist_list_tid(const char *who,
   int e;
 
   vector_init(v);
-  c = trackdb_opencursor(trackdb_playlistsdb, tid);
+  c = trackdb_opencursor(playlists_db(), tid);
   memset(k, 0, sizeof k);
   while(!(e = c->c_get(c, k, prepare_data(d), DB_NEXT))) {
-    char *name = xstrndup(k->data, k->size), *owner;
-    const char *share = kvp_get(kvp_urldecode(d->data, d->size),
-                                "sharing");
+    char *name, *owner;
+    const char *share;
+
+    /* Skip chunk records */
+    if(memchr(k->data, '/', k->size))
+      continue;
+    name = xstrndup(k->data, k->size);
+    share = kvp_packed_get(d->data, d->size, "sharing");
 
     /* Extract owner; malformed names are skipped */
     if(playlist_parse_name(name, &owner, 0)) {
@@ -426,21 +1042,27 @@ int trackdb_playlist_delete(const char *name,
 static int trackdb_playlist_delete_tid(const char *name,
                                        const char *who,
                                        DB_TXN *tid) {
-  struct kvp *k;
-  int e;
+  struct playlist pl[1];
+  int e, ci;
   const char *s;
 
-  if((e = trackdb_getdata(trackdb_playlistsdb, name, &k, tid)))
+  if((e = playlist_read(name, pl, tid)))
     return e;
   /* Check that modification is allowed */
-  if(!(s = kvp_get(k, "sharing"))) {
+  if(!(s = kvp_get(pl->k, "sharing"))) {
     disorder_error(0, "playlist '%s' has no 'sharing' key", name);
     s = "private";
   }
   if(!playlist_may_write(name, who, s))
     return EACCES;
-  /* Delete the playlist */
-  e = trackdb_delkey(trackdb_playlistsdb, name, tid);
+  /* Delete the playlist's chunks and then the playlist itself.  A converted
+   * old-format playlist has only in-memory chunks but deleting their records is
+   * harmless. */
+  for(ci = 0; ci < pl->nchunks; ++ci)
+    if((e = trackdb_delkey(playlists_db(),
+                           playlist_chunk_key(name, pl->chunks[ci].id), tid)))
+      return e;
+  e = trackdb_delkey(playlists_db(), name, tid);
   if(!e)
     eventlog("playlist_deleted", name, 0);
   return e;
@@ -31,10 +31,16 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <time.h>
+#include <limits.h>
 #include <arpa/inet.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <gcrypt.h>
+#if HAVE_POSIX_SPAWNP
+# include <spawn.h>
+extern char **environ;
+#endif
 
 #include "event.h"
 #include "mem.h"
@@ -52,32 +58,101 @@
 #include "trackname.h"
 #include "trackdb-int.h"
 #include "logfd.h"
-#include "cache.h"
 #include "eventlog.h"
 #include "hash.h"
+#include "heap.h"
 #include "unicode.h"
 #include "unidata.h"
 #include "base64.h"
 #include "sendmail.h"
 #include "validity.h"
+#include "split.h"
+#include "timeval.h"
+#include "hex.h"
 
 #define RESCAN "disorder-rescan"
 #define DEADLOCK "disorder-deadlock"
 
+/** @brief Name of the clean shutdown marker in the database directory
+ *
+ * See trackdb_deinit() and clean_shutdown().
+ */
+#define CLEAN_SHUTDOWN "clean-shutdown"
+
+/** @brief Global preferences that belong to each zone
+ *
+ * See global_key().
+ */
+static const char *const zone_globals[] = {
+  "playing",
+  "random-play",
+};
+
+/** @brief Number of entries in @ref zone_globals */
+#define NZONE_GLOBALS (sizeof zone_globals / sizeof *zone_globals)
+
 static const char *getpart(const char *track,
                            const char *context,
                            const char *part,
                            const struct kvp *p,
+                           const struct kvp_index *pi,
                            int *used_db);
 static char **trackdb_new_tid(int *ntracksp,
                               int maxtracks,
                               DB_TXN *tid);
 static int trackdb_expire_noticed_tid(time_t earliest, DB_TXN *tid);
 static char *normalize_tag(const char *s, size_t ns);
+static int fill_prefix_words(DB_TXN *tid);
+static int fill_trigrams(DB_TXN *tid);
+static int stats_recount(DB_TXN *tid);
+static void dirs_discard(void);
+static int dirs_recount(DB_TXN *tid);
+static int fill_dirs(DB_TXN *tid);
+static void track_filter_add(const char *track, size_t len);
 
-const struct cache_type cache_files_type = { 86400 };
 unsigned long cache_files_hits, cache_files_misses;
 
+/** @brief Bumped whenever the results of a search or listing might change
+ *
+ * This covers new and obsolete tracks, preference changes and the end of a
+ * rescan.  It only counts changes made by this process.  Users of cached
+ * results compare it with the value when the results were computed.
+ */
+unsigned long trackdb_generation;
+
+/** @brief Bumped whenever a user is edited, deleted or confirmed
+ *
+ * Only counts changes made by this process, which for the users database
+ * means the server.  verify_cookie() uses it to invalidate its cache.
+ */
+unsigned long trackdb_users_generation;
+
+/** @brief Called after trackdb_set() changes a preference, if not NULL
+ *
+ * The server uses this to keep its random choice weights up to date.
+ */
+void (*trackdb_pref_changed)(const char *track, const char *name);
+
+/** @brief Total time spent inside database transactions, in microseconds
+ *
+ * Nested transactions are only counted once.  Callers that want to know how
+ * long some piece of work spent in the database compare it before and after.
+ */
+int64_t trackdb_busy_us;
+
+/** @brief Deadlocks by operation
+ *
+ * Keys are operation names and values are <tt>unsigned long</tt> counts.
+ * Only deadlocks in this process are counted.
+ */
+static hash *deadlock_counts;
+
+/** @brief Number of transactions currently open */
+static int transaction_depth;
+
+/** @brief When the outermost open transaction began */
+static struct timeval transaction_started;
+
 /** @brief Set by trackdb_open() */
 int trackdb_existing_database;
 
@@ -89,6 +164,15 @@ int trackdb_existing_database;
  */
 static const char *home;
 
+/** @brief Return the directory holding the database
+ *
+ * Normally this is @c home, but a server that is a zone uses the database of
+ * the server whose home directory is @c library.
+ */
+static const char *db_home(void) {
+  return config->library ? config->library : config->home;
+}
+
 /** @brief Database environment */
 DB_ENV *trackdb_env;
 
@@ -119,6 +203,26 @@ DB *trackdb_prefsdb;
  */
 DB *trackdb_searchdb;
 
+/** @brief The search words database
+ *
+ * - Keys are the keys of @ref trackdb_searchdb
+ * - Values are empty
+ * - This is a btree, so words sharing a prefix are adjacent
+ * - This database can be reconstructed, it contains no user data
+ */
+DB *trackdb_wordsdb;
+
+/** @brief The search trigrams database
+ *
+ * - Keys are runs of three characters from the keys of @ref trackdb_wordsdb,
+ *   padded with a space at each end
+ * - Values are the words containing them
+ * - There can be more than one value per key
+ * - Used to find corrections for misspelt words in fuzzy searches
+ * - This database can be reconstructed, it contains no user data
+ */
+DB *trackdb_trigramsdb;
+
 /** @brief The tags database
  *
  * - Keys are UTF-8(NFKC(casefold(tag)))
@@ -138,7 +242,7 @@ DB *trackdb_tagsdb;			/* the tags database */
 DB *trackdb_globaldb;                   /* global preferences */
 
 /** @brief The noticed database
- * - Keys are 64-bit big-endian timestamps
+ * - Keys are 64-bit big-endian timestamps, in time order
  * - Values are UTF-8(NFC(unicode(path name)))
  * - There can be more than one value per key
  * - Presence of key,value means that path was added at the given time
@@ -154,6 +258,8 @@ DB *trackdb_noticeddb;                   /* when track noticed */
  * - Data cannot be reconstructed
  *
  * See @ref server/schedule.c for further information.
+ *
+ * Opened when first needed; see trackdb_lazy().
  */
 DB *trackdb_scheduledb;
 
@@ -165,18 +271,42 @@ DB *trackdb_scheduledb;
 DB *trackdb_usersdb;
 
 /** @brief The playlists database
- * - Keys are playlist names
+ * - Keys are playlist names, or a playlist name, "/" and a chunk ID
  * - Values are encoded key-value pairs
  * - Data is user data and cannot be reconstructed
+ *
+ * Opened when first needed; see trackdb_lazy().
  */
 DB *trackdb_playlistsdb;
 
+/** @brief The track lengths database
+ * - Keys are stat signatures from trackdb_stat_signature()
+ * - Values are encoded key-value pairs, with the length in @c _length
+ * - Presence of a key means any file with that signature has that length
+ * - Data can be reconstructed, but only by the slow business of computing
+ *   track lengths; it is kept across dumps so that doesn't have to be done
+ *   again
+ */
+DB *trackdb_lengthsdb;
+
+/** @brief The directory summaries database
+ * - Keys are UTF-8(NFC(unicode(directory name)))
+ * - Values are encoded key-value pairs summarizing the tracks below the
+ *   directory; see trackdb_get_dirs()
+ * - Only directories with tracks below them are represented here
+ * - This database can be reconstructed, it contains no user data
+ */
+DB *trackdb_dirsdb;
+
 /** @brief Deadlock manager PID */
 static pid_t db_deadlock_pid = -1;
 
 /** @brief Rescanner PID */
 static pid_t rescan_pid = -1;
 
+/** @brief Background upgrade PID */
+static pid_t upgrade_pid = -1;
+
 /** @brief Set when the database environment exists */
 static int initialized;
 
@@ -186,25 +316,40 @@ static int opened;
 /** @brief Current stats subprocess PIDs */
 static hash *stats_pids;
 
-/** @brief PID of current random track chooser (disorder-choose) */
-static pid_t choose_pid = -1;
+/** @brief A run of disorder-choose */
+struct choose_run {
+  /** @brief Process ID, or -1 if not running */
+  pid_t pid;
+
+  /** @brief Callback to supply the output to */
+  random_callback *callback;
 
-/** @brief Our end of pipe from disorder-choose */
-static int choose_fd;
+  /** @brief Callback to supply the chosen tracks to
+   *
+   * If this is set then it is used instead of @ref callback.
+   */
+  random_tracks_callback *tracks_callback;
 
-/** @brief Callback to supply random track to */
-static random_callback *choose_callback;
+  /** @brief Accumulator for output from disorder-choose */
+  struct dynstr output;
 
-/** @brief Accumulator for output from disorder-choose */
-static struct dynstr choose_output;
+  /** @brief Current completion status of disorder-choose
+   * A bitmap of @ref CHOOSE_READING and @ref CHOOSE_RUNNING.
+   */
+  unsigned complete;
 
-/** @brief Current completion status of disorder-choose
- * A bitmap of @ref CHOOSE_READING and @ref CHOOSE_RUNNING.
- */
-static unsigned choose_complete;
+  /* @brief Exit status from disorder-choose */
+  int status;
+
+  /** @brief Set if empty output is a valid result */
+  int empty_ok;
+};
 
-/* @brief Exit status from disorder-choose */
-static int choose_status;
+/** @brief Current random track choice */
+static struct choose_run choose_pick = { .pid = -1 };
+
+/** @brief Current listing of track weights */
+static struct choose_run choose_weights = { .pid = -1, .empty_ok = 1 };
 
 /** @brief disorder-choose process is running */
 #define CHOOSE_RUNNING 1
@@ -212,6 +357,34 @@ static int choose_status;
 /** @brief disorder-choose pipe is still open */
 #define CHOOSE_READING 2
 
+/** @brief A database that is only opened when first used */
+struct lazy_db {
+  /** @brief Filename */
+  const char *name;
+
+  /** @brief Where the handle lives */
+  DB **db;
+
+  /** @brief Database type */
+  DBTYPE dbtype;
+};
+
+/** @brief Databases that are only opened when first used
+ *
+ * These are needed by few commands and by none of the helper processes, so
+ * there is no point opening them up front.
+ */
+static const struct lazy_db lazy_dbs[] = {
+  { "schedule.db", &trackdb_scheduledb, DB_HASH },
+  { "playlists.db", &trackdb_playlistsdb, DB_HASH },
+};
+
+/** @brief Number of entries in @ref lazy_dbs */
+#define NLAZY_DBS (sizeof lazy_dbs / sizeof *lazy_dbs)
+
+/** @brief Open flags for @ref lazy_dbs, set by trackdb_open() */
+static uint32_t lazy_openflags;
+
 /** @brief Comparison function for filename-based keys */
 static int compare(DB attribute((unused)) *db_,
 		   const DBT *a, const DBT *b) {
@@ -224,10 +397,126 @@ static int compare(DB attribute((unused)) *db_,
 int trackdb_readable(void) {
   char *usersdb;
 
-  byte_xasprintf(&usersdb, "%s/users.db", config->home);
+  byte_xasprintf(&usersdb, "%s/users.db", db_home());
   return access(usersdb, R_OK) == 0;
 }
 
+/** @brief Find the end of the transaction log on disk
+ * @param filep Where to store the number of the last log file
+ * @param sizep Where to store its size
+ * @return 0 on success, non-0 if there are no log files
+ */
+static int log_end(unsigned long *filep, unsigned long *sizep) {
+  DIR *dp;
+  struct dirent *de;
+  struct stat sb;
+  unsigned long n, last = 0;
+  char *end, *p;
+  int found = 0;
+
+  if(!(dp = opendir(db_home())))
+    return -1;
+  while((de = readdir(dp))) {
+    if(strncmp(de->d_name, "log.", 4))
+      continue;
+    errno = 0;
+    n = strtoul(de->d_name + 4, &end, 10);
+    if(errno || *end || end == de->d_name + 4)
+      continue;
+    if(!found || n > last)
+      last = n;
+    found = 1;
+  }
+  closedir(dp);
+  if(!found)
+    return -1;
+  byte_xasprintf(&p, "%s/log.%010lu", db_home(), last);
+  if(stat(p, &sb) < 0)
+    return -1;
+  *filep = last;
+  *sizep = sb.st_size;
+  return 0;
+}
+
+/** @brief Test whether the database was shut down cleanly
+ * @return Nonzero if no recovery is needed
+ *
+ * The marker is removed whatever the answer, so that if anything goes wrong
+ * from now on the next start will recover.  It records where the log ended
+ * after the final checkpoint, so if anything has written to the database
+ * since, for instance @c disorder-dump, recovery is done after all.
+ */
+static int clean_shutdown(void) {
+  char *path, buf[64];
+  unsigned long file, size, endfile, endsize;
+  FILE *fp;
+  int clean = 0;
+
+  byte_xasprintf(&path, "%s/%s", db_home(), CLEAN_SHUTDOWN);
+  if(!(fp = fopen(path, "r")))
+    return 0;
+  if(fgets(buf, sizeof buf, fp)
+     && sscanf(buf, "%lu %lu", &file, &size) == 2
+     && !log_end(&endfile, &endsize)
+     && file == endfile && size == endsize)
+    clean = 1;
+  fclose(fp);
+  if(unlink(path) < 0)
+    disorder_fatal(errno, "error removing %s", path);
+  return clean;
+}
+
+/** @brief Note that the database has been shut down cleanly
+ *
+ * Called from trackdb_deinit() after the final checkpoint.
+ */
+static void mark_clean_shutdown(void) {
+  char *path;
+  unsigned long file, size;
+  FILE *fp;
+
+  if(log_end(&file, &size))
+    return;
+  byte_xasprintf(&path, "%s/%s", db_home(), CLEAN_SHUTDOWN);
+  if(!(fp = fopen(path, "w"))) {
+    disorder_error(errno, "error creating %s", path);
+    return;
+  }
+  if(fprintf(fp, "%lu %lu\n", file, size) < 0
+     || fsync(fileno(fp)) < 0) {
+    disorder_error(errno, "error writing %s", path);
+    fclose(fp);
+    unlink(path);
+    return;
+  }
+  if(fclose(fp) < 0) {
+    disorder_error(errno, "error closing %s", path);
+    unlink(path);
+  }
+}
+
+/** @brief Test whether the library's server is running
+ * @return Nonzero if it is
+ *
+ * The server holds a lock on @c lock in its home directory for as long as it
+ * runs.
+ */
+static int library_running(void) {
+  struct flock lock;
+  char *path;
+  int fd, running;
+
+  byte_xasprintf(&path, "%s/lock", config->library);
+  if((fd = open(path, O_RDONLY)) < 0)
+    return 0;
+  memset(&lock, 0, sizeof lock);
+  lock.l_type = F_WRLCK;
+  lock.l_whence = SEEK_SET;
+  running = fcntl(fd, F_GETLK, &lock) == 0 && lock.l_type != F_UNLCK;
+  xclose(fd);
+  return running;
+}
+
 /** @brief Open database environment
  * @param flags Flags word
  *
@@ -236,19 +525,31 @@ int trackdb_readable(void) {
  * - @ref TRACKDB_NORMAL_RECOVER
  * - @ref TRACKDB_FATAL_RECOVER
  * - @ref TRACKDB_MAY_CREATE
+ *
+ * Normal recovery is skipped if the server shut down cleanly last time.
+ *
+ * A zone (i.e. with @c library set) joins the environment of the library's
+ * server, which must already be running.  Recovery and file permissions are
+ * left to that server.
  */
 void trackdb_init(int flags) {
   int err;
-  const int recover = flags & TRACKDB_RECOVER_MASK;
+  int recover = flags & TRACKDB_RECOVER_MASK;
   static int recover_type[] = { 0, DB_RECOVER, DB_RECOVER_FATAL };
 
   /* sanity checks */
   assert(initialized == 0);
   ++initialized;
   if(home) {
-    if(strcmp(home, config->home))
+    if(strcmp(home, db_home()))
       disorder_fatal(0, "cannot change db home without server restart");
-    home = config->home;
+    home = db_home();
+  }
+  if(config->library) {
+    if(!library_running())
+      disorder_fatal(0, "the server in %s is not running", config->library);
+    flags &= ~TRACKDB_MAY_CREATE;
+    recover = TRACKDB_NO_RECOVER;
   }
 
   if(flags & TRACKDB_MAY_CREATE) {
@@ -264,10 +565,10 @@ void trackdb_init(int flags) {
      *
      * The socket, not being a regular file, is excepted.
      */
-    if(!(dp = opendir(config->home)))
-      disorder_fatal(errno, "error reading %s", config->home);
+    if(!(dp = opendir(db_home())))
+      disorder_fatal(errno, "error reading %s", db_home());
     while((de = readdir(dp))) {
-      byte_xasprintf(&p, "%s/%s", config->home, de->d_name);
+      byte_xasprintf(&p, "%s/%s", db_home(), de->d_name);
       if(lstat(p, &st) == 0
          && S_ISREG(st.st_mode)
          && (st.st_mode & 077)) {
@@ -279,6 +580,20 @@ void trackdb_init(int flags) {
     closedir(dp);
   }
 
+  if(recover == TRACKDB_NORMAL_RECOVER && clean_shutdown()) {
+    /* Everything is on disk, so just discard the old environment, which
+     * recovery would have done; that way new cache settings still take
+     * effect */
+    disorder_info("database was shut down cleanly, skipping recovery");
+    if((err = db_env_create(&trackdb_env, 0)))
+      disorder_fatal(0, "db_env_create: %s", db_strerror(err));
+    if((err = trackdb_env->remove(trackdb_env, db_home(), DB_FORCE))
+       && err != ENOENT)
+      disorder_fatal(0, "trackdb_env->remove %s: %s",
+                     db_home(), db_strerror(err));
+    recover = TRACKDB_NO_RECOVER;
+  }
+
   /* create environment */
   if((err = db_env_create(&trackdb_env, 0)))
     disorder_fatal(0, "db_env_create: %s", db_strerror(err));
@@ -289,7 +604,29 @@ void trackdb_init(int flags) {
     disorder_fatal(0, "trackdb_env->set_lk_max_locks: %s", db_strerror(err));
   if((err = trackdb_env->set_lk_max_objects(trackdb_env, 10000)))
     disorder_fatal(0, "trackdb_env->set_lk_max_objects: %s", db_strerror(err));
-  if((err = trackdb_env->open(trackdb_env, config->home,
+  /* Look for deadlocks whenever a lock request has to wait, rather than
+   * leaving them for disorder-deadlock to find */
+  if((err = trackdb_env->set_lk_detect(trackdb_env, DB_LOCK_DEFAULT)))
+    disorder_fatal(0, "trackdb_env->set_lk_detect: %s", db_strerror(err));
+  /* These only take effect when the environment is created, i.e. after
+   * recovery */
+  if(config->db_cache_kbyte
+     && (err = trackdb_env->set_cachesize(trackdb_env,
+                                          config->db_cache_kbyte / 1048576,
+                                          config->db_cache_kbyte % 1048576
+                                          * 1024,
+                                          1)))
+    disorder_fatal(0, "trackdb_env->set_cachesize: %s", db_strerror(err));
+  if(config->db_log_buffer_kbyte
+     && (err = trackdb_env->set_lg_bsize(trackdb_env,
+                                         config->db_log_buffer_kbyte * 1024)))
+    disorder_fatal(0, "trackdb_env->set_lg_bsize: %s", db_strerror(err));
+  if(config->db_mmap_kbyte
+     && (err = trackdb_env->set_mp_mmapsize(trackdb_env,
+                                            (size_t)config->db_mmap_kbyte
+                                            * 1024)))
+    disorder_fatal(0, "trackdb_env->set_mp_mmapsize: %s", db_strerror(err));
+  if((err = trackdb_env->open(trackdb_env, db_home(),
                               DB_INIT_LOG
                               |DB_INIT_LOCK
                               |DB_INIT_MPOOL
@@ -298,7 +635,7 @@ void trackdb_init(int flags) {
                               |recover_type[recover],
                               0600)))
     disorder_fatal(0, "trackdb_env->open %s: %s",
-                   config->home, db_strerror(err));
+                   db_home(), db_strerror(err));
   trackdb_env->set_errpfx(trackdb_env, "DB");
   trackdb_env->set_errfile(trackdb_env, stderr);
   trackdb_env->set_verbose(trackdb_env, DB_VERB_DEADLOCK, 1);
@@ -333,12 +670,24 @@ static int reap_db_deadlock(ev_source attribute((unused)) *ev,
  * - @c --config to ensure the right config file is used
  * - @c --debug or @c --no-debug to match debug settings
  * - @c --syslog or @c --no-syslog to match log settings
+ *
+ * Where possible the subprocess is started with posix_spawnp(), which does
+ * not have to copy the server's page tables the way fork() does (on Linux it
+ * shares the parent's memory until the new program is executed).  Since that
+ * can't change IDs or priority, fork() is still used when the subprocess
+ * would need to.
  */
 static pid_t subprogram(ev_source *ev, int outputfd, const char *prog,
                         ...) {
   pid_t pid;
   va_list ap;
   const char *args[1024], **argp, *a;
+#if HAVE_POSIX_SPAWNP
+  posix_spawn_file_actions_t fa;
+  posix_spawnattr_t attr;
+  sigset_t ss;
+  int prio, err;
+#endif
 
   argp = args;
   *argp++ = prog;
@@ -351,6 +700,37 @@ static pid_t subprogram(ev_source *ev, int outputfd, const char *prog,
     *argp++ = a;
   va_end(ap);
   *argp = 0;
+#if HAVE_POSIX_SPAWNP
+  errno = 0;
+  prio = getpriority(PRIO_PROCESS, 0);
+  /* The child below only wants to change its priority if it is negative, and
+   * can only do so if it is root */
+  if(getuid() == geteuid()
+     && !errno
+     && (prio == 0 || (prio > 0 && geteuid() != 0))) {
+    posix_spawn_file_actions_init(&fa);
+    if(outputfd != -1) {
+      posix_spawn_file_actions_adddup2(&fa, outputfd, 1);
+      posix_spawn_file_actions_addclose(&fa, outputfd);
+    }
+    /* Handled signals revert to their defaults at exec anyway; SIGPIPE is
+     * ignored and must be restored explicitly */
+    posix_spawnattr_init(&attr);
+    sigemptyset(&ss);
+    posix_spawnattr_setsigmask(&attr, &ss);
+    sigaddset(&ss, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &ss);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK
+                                    |POSIX_SPAWN_SETSIGDEF);
+    err = posix_spawnp(&pid, prog, &fa, &attr, (char **)args, environ);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&fa);
+    if(!err)
+      return pid;
+    /* Fall back to fork(), whose child will report the error */
+    disorder_error(err, "error calling posix_spawnp for %s", prog);
+  }
+#endif
   /* If we're in the background then trap subprocess stdout/stderr */
   if(!(pid = xfork())) {
     exitfn = _exit;
@@ -411,22 +791,28 @@ static void terminate_and_wait(ev_source *ev,
 
 /** @brief Close database environment
  * @param ev Event loop
+ *
+ * In the server, i.e. after trackdb_master(), this takes a final checkpoint
+ * and if nothing else has a transaction open leaves a marker so that the
+ * next start can skip recovery.
  */
 void trackdb_deinit(ev_source *ev) {
-  int err;
+  int err, clean = 0;
+  DB_TXN_STAT *tst;
 
   /* sanity checks */
   assert(initialized == 1);
   --initialized;
 
-  /* close the environment */
-  if((err = trackdb_env->close(trackdb_env, 0)))
-    disorder_fatal(0, "trackdb_env->close: %s", db_strerror(err));
-
+  /* stop our own subprocesses before the final checkpoint */
   terminate_and_wait(ev, rescan_pid, "disorder-rescan");
   rescan_pid = -1;
-  terminate_and_wait(ev, choose_pid, "disorder-choose");
-  choose_pid = -1;
+  terminate_and_wait(ev, upgrade_pid, "disorder-dbupgrade");
+  upgrade_pid = -1;
+  terminate_and_wait(ev, choose_pick.pid, "disorder-choose");
+  choose_pick.pid = -1;
+  terminate_and_wait(ev, choose_weights.pid, "disorder-choose");
+  choose_weights.pid = -1;
 
   if(stats_pids) {
     char **ks = hash_keys(stats_pids);
@@ -438,8 +824,25 @@ void trackdb_deinit(ev_source *ev) {
     stats_pids = NULL;
   }
 
+  if(db_deadlock_pid != -1 && !config->library) {
+    if((err = trackdb_env->txn_checkpoint(trackdb_env, 0, 0, DB_FORCE)))
+      disorder_error(0, "trackdb_env->txn_checkpoint: %s", db_strerror(err));
+    else if((err = trackdb_env->txn_stat(trackdb_env, &tst, 0)))
+      disorder_error(0, "trackdb_env->txn_stat: %s", db_strerror(err));
+    else {
+      clean = !tst->st_nactive;
+      xfree(tst);
+    }
+  }
+
+  /* close the environment */
+  if((err = trackdb_env->close(trackdb_env, 0)))
+    disorder_fatal(0, "trackdb_env->close: %s", db_strerror(err));
+
   terminate_and_wait(ev, db_deadlock_pid, "disorder-deadlock");
   db_deadlock_pid = -1;
+  if(clean)
+    mark_clean_shutdown();
   D(("deinitialized database environment"));
 }
 
@@ -456,17 +859,26 @@ static DB *open_db(const char *path,
                    DBTYPE dbtype,
                    u_int32_t openflags,
                    int mode) {
-  int err, err2;
+  int err, err2, n;
   DB *db;
+  const char *name = path;
 
   D(("open %s", path));
   path = config_get_file(path);
   if((err = db_create(&db, trackdb_env, 0)))
     disorder_fatal(0, "db_create %s: %s", path, db_strerror(err));
+  /* The page size only matters when the database is created */
+  for(n = 0; n < config->db_page_size.n; ++n)
+    if(!strcmp(config->db_page_size.s[n].s[0], name))
+      if((err = db->set_pagesize(db, atol(config->db_page_size.s[n].s[1]))))
+        disorder_fatal(0, "db->set_pagesize %s: %s", path, db_strerror(err));
   if(dbflags)
     if((err = db->set_flags(db, dbflags)))
       disorder_fatal(0, "db->set_flags %s: %s", path, db_strerror(err));
-  if(dbtype == DB_BTREE)
+  /* noticed.db keys are big-endian timestamps, which sort correctly as
+   * bytes.  Before dbversion 4 it used the path name order. */
+  if(dbtype == DB_BTREE
+     && (strcmp(name, "noticed.db") || config->dbversion < 4))
     if((err = db->set_bt_compare(db, compare)))
       disorder_fatal(0, "db->set_bt_compare %s: %s", path, db_strerror(err));
   if((err = db->open(db, 0, path, 0, dbtype,
@@ -496,19 +908,26 @@ static DB *open_db(const char *path,
  * - @p TRACKDB_READ_ONLY, read only access
  */
 void trackdb_open(int flags) {
-  int err;
+  int err, e;
   pid_t pid;
   uint32_t dbflags = flags & TRACKDB_READ_ONLY ? DB_RDONLY : DB_CREATE;
+  /* Databases that are read far more than written keep old page versions so
+   * that read transactions can use a snapshot */
+  uint32_t mvflags = dbflags | DB_MULTIVERSION;
 
   /* sanity checks */
   assert(opened == 0);
   ++opened;
+  /* Upgrades are for the library's server */
+  if(config->library && (flags & TRACKDB_UPGRADE_MASK) == TRACKDB_CAN_UPGRADE)
+    flags = (flags & ~TRACKDB_UPGRADE_MASK) | TRACKDB_NO_UPGRADE;
   /* check the database version first */
   trackdb_globaldb = open_db("global.db", 0, DB_HASH, DB_RDONLY, 0666);
   if(trackdb_globaldb) {
     /* This is an existing database */
     const char *s;
     long oldversion;
+    int online;
 
     s = trackdb_get_global("_dbversion");
     /* Close the database again,  we'll open it property below */
@@ -530,10 +949,14 @@ void trackdb_open(int flags) {
         disorder_fatal(0, "database needs upgrading from %ld to %ld",
                        oldversion, config->dbversion);
       case TRACKDB_CAN_UPGRADE:
-        /* This database needs upgrading */
-        disorder_info("invoking disorder-dbupgrade to upgrade from %ld to %ld",
-             oldversion, config->dbversion);
-        pid = subprogram(0, -1, "disorder-dbupgrade", (char *)0);
+        /* This database needs upgrading.  An online upgrade only does the
+         * parts that can't wait; trackdb_upgrade_background() does the
+         * rest. */
+        online = config->db_online_upgrade && oldversion >= 2;
+        disorder_info("invoking disorder-dbupgrade to upgrade from %ld to %ld%s",
+             oldversion, config->dbversion, online ? " online" : "");
+        pid = subprogram(0, -1, "disorder-dbupgrade",
+                         online ? "--online" : (char *)0, (char *)0);
         while(waitpid(pid, &err, 0) == -1 && errno == EINTR)
           ;
         if(err)
@@ -564,17 +987,22 @@ void trackdb_open(int flags) {
                                  0, DB_HASH, dbflags, 0600)))
     disorder_fatal(0, "cannot open users.db");
   trackdb_tracksdb = open_db("tracks.db",
-                             DB_RECNUM, DB_BTREE, dbflags, 0666);
+                             DB_RECNUM, DB_BTREE, mvflags, 0666);
   trackdb_searchdb = open_db("search.db",
-                             DB_DUP|DB_DUPSORT, DB_HASH, dbflags, 0666);
+                             DB_DUP|DB_DUPSORT, DB_HASH, mvflags, 0666);
+  trackdb_wordsdb = open_db("words.db", 0, DB_BTREE, mvflags, 0666);
+  trackdb_trigramsdb = open_db("trigrams.db",
+                               DB_DUP|DB_DUPSORT, DB_HASH, mvflags, 0666);
   trackdb_tagsdb = open_db("tags.db",
-                           DB_DUP|DB_DUPSORT, DB_HASH, dbflags, 0666);
-  trackdb_prefsdb = open_db("prefs.db", 0, DB_HASH, dbflags, 0666);
+                           DB_DUP|DB_DUPSORT, DB_HASH, mvflags, 0666);
+  trackdb_prefsdb = open_db("prefs.db", 0, DB_HASH, mvflags, 0666);
   trackdb_globaldb = open_db("global.db", 0, DB_HASH, dbflags, 0666);
   trackdb_noticeddb = open_db("noticed.db",
-                             DB_DUPSORT, DB_BTREE, dbflags, 0666);
-  trackdb_scheduledb = open_db("schedule.db", 0, DB_HASH, dbflags, 0666);
-  trackdb_playlistsdb = open_db("playlists.db", 0, DB_HASH, dbflags, 0666);
+                             DB_DUPSORT, DB_BTREE, mvflags, 0666);
+  /* schedule.db and playlists.db wait until trackdb_lazy() */
+  lazy_openflags = dbflags;
+  trackdb_lengthsdb = open_db("lengths.db", 0, DB_HASH, dbflags, 0666);
+  trackdb_dirsdb = open_db("dirs.db", 0, DB_HASH, mvflags, 0666);
   if(!trackdb_existing_database && !(flags & TRACKDB_READ_ONLY)) {
     /* Stash the database version */
     char buf[32];
@@ -582,10 +1010,45 @@ void trackdb_open(int flags) {
     assert(!(flags & TRACKDB_OPEN_FOR_UPGRADE));
     snprintf(buf, sizeof buf, "%ld", config->dbversion);
     trackdb_set_global("_dbversion", buf, 0);
+    /* Start the library statistics at zero */
+    WITH_TRANSACTION(stats_recount(tid));
+    WITH_TRANSACTION(dirs_recount(tid));
+  }
+  if(trackdb_existing_database
+     && (flags & TRACKDB_UPGRADE_MASK) == TRACKDB_CAN_UPGRADE
+     && !(flags & TRACKDB_READ_ONLY)) {
+    /* Databases from before words.db or trigrams.db need them filling in */
+    WITH_TRANSACTION(fill_prefix_words(tid));
+    WITH_TRANSACTION(fill_trigrams(tid));
+    /* Databases from before dirs.db, or whose summaries were discarded,
+     * need them counting */
+    WITH_TRANSACTION(fill_dirs(tid));
   }
   D(("opened databases"));
 }
 
+/** @brief Return a database handle, opening it if necessary
+ * @param db Where the handle lives, e.g. @c &trackdb_scheduledb
+ * @return Database handle
+ *
+ * Databases in @ref lazy_dbs are only opened the first time this is called
+ * for them.  Others are returned as they are.
+ */
+DB *trackdb_lazy(DB **db) {
+  size_t n;
+
+  if(*db)
+    return *db;
+  assert(opened == 1);
+  for(n = 0; n < NLAZY_DBS; ++n)
+    if(lazy_dbs[n].db == db) {
+      *db = open_db(lazy_dbs[n].name, 0, lazy_dbs[n].dbtype,
+                    lazy_openflags, 0666);
+      break;
+    }
+  return *db;
+}
+
 /** @brief Close track databases */
 void trackdb_close(void) {
   int err;
@@ -600,6 +1063,8 @@ void trackdb_close(void) {
 } while(0)
   CLOSE("tracks.db", trackdb_tracksdb);
   CLOSE("search.db", trackdb_searchdb);
+  CLOSE("words.db", trackdb_wordsdb);
+  CLOSE("trigrams.db", trackdb_trigramsdb);
   CLOSE("tags.db", trackdb_tagsdb);
   CLOSE("prefs.db", trackdb_prefsdb);
   CLOSE("global.db", trackdb_globaldb);
@@ -607,6 +1072,8 @@ void trackdb_close(void) {
   CLOSE("schedule.db", trackdb_scheduledb);
   CLOSE("users.db", trackdb_usersdb);
   CLOSE("playlists.db", trackdb_playlistsdb);
+  CLOSE("lengths.db", trackdb_lengthsdb);
+  CLOSE("dirs.db", trackdb_dirsdb);
   D(("closed databases"));
 }
 
@@ -630,7 +1097,7 @@ int trackdb_getdata(DB *db,
                        prepare_data(&data), 0)) {
   case 0:
     if(kp)
-      *kp = kvp_urldecode(data.data, data.size);
+      *kp = decode_data(&data);
     return 0;
   case DB_NOTFOUND:
     if(kp)
@@ -660,6 +1127,9 @@ int trackdb_putdata(DB *db,
   int err;
   DBT key, data;
 
+  /* A transaction that is abandoned just leaves a false positive */
+  if(db == trackdb_tracksdb)
+    track_filter_add(track, strlen(track));
   switch(err = db->put(db, tid, make_key(&key, track),
                        encode_data(&data, k), flags)) {
   case 0:
@@ -779,1759 +1249,4211 @@ int trackdb_delkeydata(DB *db,
   return err;
 }
 
-/** @brief Start a transaction
- * @return Transaction
+/* library statistics ********************************************************/
+
+/** @brief Number of search words kept in the stored league table
+ *
+ * More are kept than trackdb_stats() displays, so that a word which
+ * overtakes a declining entry usually already has a place in the table.
  */
-DB_TXN *trackdb_begin_transaction(void) {
-  DB_TXN *tid;
-  int err;
+#define STATS_LEAGUE 20
 
-  if((err = trackdb_env->txn_begin(trackdb_env, 0, &tid, 0)))
-    disorder_fatal(0, "trackdb_env->txn_begin: %s", db_strerror(err));
-  return tid;
-}
+/** @brief Number of search words reported */
+#define STATS_LEAGUE_SHOWN 10
 
-/** @brief Abort transaction
- * @param tid Transaction (or NULL)
+/** @brief Statistics changes not yet written to global.db
  *
- * If @p tid is NULL then nothing happens.
+ * Changes accumulate here while the databases are updated and stats_flush()
+ * adds them to the stored counters in the same transaction.  They are
+ * discarded if the transaction is aborted.
  */
-void trackdb_abort_transaction(DB_TXN *tid) {
-  int err;
+static struct {
+  /** @brief Change in the number of tracks */
+  long tracks;
 
-  if(tid)
-    if((err = tid->abort(tid)))
-      disorder_fatal(0, "tid->abort: %s", db_strerror(err));
-}
+  /** @brief Change in the number of distinct search words */
+  long words;
 
-/** @brief Commit transaction
- * @param tid Transaction (must not be NULL)
- */
-void trackdb_commit_transaction(DB_TXN *tid) {
-  int err;
+  /** @brief Change in the number of distinct tags */
+  long tags;
 
-  if((err = tid->commit(tid, 0)))
-    disorder_fatal(0, "tid->commit: %s", db_strerror(err));
-}
+  /** @brief Changed search words, mapped to their new track counts */
+  hash *league;
 
-/* search/tags shared code ***************************************************/
+  /** @brief Changed tags, mapped to their new track counts */
+  hash *tag_counts;
+} stats_pending;
 
-/** @brief Comparison function used by dedupe()
- * @param a Pointer to first key
- * @param b Pointer to second key
- * @return -1, 0 or 1
- *
- * Passed to qsort().
- */
-static int wordcmp(const void *a, const void *b) {
-  return strcmp(*(const char **)a, *(const char **)b);
-}
+/** @brief One entry in the search league */
+struct league_entry {
+  /** @brief Search word */
+  const char *word;
 
-/** @brief Sort and de-duplicate @p vec
- * @param vec Vector to sort
- * @param nvec Length of @p vec
- * @return @p vec
- *
- * The returned vector is NULL-terminated, and there must be room for this NULL
- * even if there are no duplicates (i.e. it must have more than @p nvec
- * elements.)
- */
-static char **dedupe(char **vec, int nvec) {
-  int m, n;
+  /** @brief Number of tracks with this word */
+  long n;
+};
 
-  qsort(vec, nvec, sizeof (char *), wordcmp);
-  m = 0;
-  if(nvec) {
-    vec[m++] = vec[0];
-    for(n = 1; n < nvec; ++n)
-      if(strcmp(vec[n], vec[m - 1]))
-	vec[m++] = vec[n];
-  }
-  vec[m] = 0;
-  return vec;
+VECTOR_TYPE(league_entries, struct league_entry, xrealloc);
+
+/** @brief Forget statistics changes that were never stored */
+static void stats_discard(void) {
+  stats_pending.tracks = 0;
+  stats_pending.words = 0;
+  stats_pending.tags = 0;
+  stats_pending.league = 0;
+  stats_pending.tag_counts = 0;
+  dirs_discard();
 }
 
-/** @brief Store a key/data pair
- * @param db Database
- * @param what Description
- * @param track Data
+/** @brief Count the entries for a key
+ * @param db Database (search or tags)
  * @param word Key
+ * @param np Where to store count
  * @param tid Owning transaction
- * @return 0 or DB_DEADLOCK
- *
- * Used by the search and tags databases, hence the odd parameter names.
- * See also trackdb_delkeydata().
+ * @return 0 or DB_LOCK_DEADLOCK
  */
-static int register_word(DB *db, const char *what,
-                         const char *track, const char *word,
-                         DB_TXN *tid) {
-  int err;
+static int word_count(DB *db, const char *word, long *np, DB_TXN *tid) {
+  DBC *c = trackdb_opencursor(db, tid);
   DBT key, data;
+  db_recno_t n = 0;
+  int err;
 
-  switch(err = db->put(db, tid, make_key(&key, word),
-                       make_key(&data, track), DB_NODUPDATA)) {
+  switch(err = c->c_get(c, make_key(&key, word), prepare_data(&data),
+                        DB_SET)) {
   case 0:
-  case DB_KEYEXIST:
-    return 0;
+    if((err = c->c_count(c, &n, 0)) && err != DB_LOCK_DEADLOCK)
+      disorder_fatal(0, "c->c_count: %s", db_strerror(err));
+    break;
+  case DB_NOTFOUND:
+    err = 0;
+    break;
   case DB_LOCK_DEADLOCK:
-    disorder_error(0, "error updating %s.db: %s", what, db_strerror(err));
-    return err;
+    disorder_error(0, "error querying database: %s", db_strerror(err));
+    break;
   default:
-    disorder_fatal(0, "error updating %s.db: %s", what,  db_strerror(err));
+    disorder_fatal(0, "c->c_get: %s", db_strerror(err));
+  }
+  if(trackdb_closecursor(c)) err = DB_LOCK_DEADLOCK;
+  *np = n;
+  return err;
+}
+
+/** @brief Note that a search word or tag has gained or lost a track
+ * @param db Database (search or tags)
+ * @param word Word or tag
+ * @param n Number of tracks @p word now has
+ * @param delta +1 if a track was added, -1 if one was removed
+ */
+static void stats_word_changed(DB *db, const char *word, long n, int delta) {
+  if(n == (delta > 0 ? 1 : 0)) {
+    if(db == trackdb_tagsdb)
+      stats_pending.tags += delta;
+    else
+      stats_pending.words += delta;
+  }
+  if(db == trackdb_searchdb) {
+    if(!stats_pending.league)
+      stats_pending.league = hash_new(sizeof (long));
+    hash_add(stats_pending.league, word, &n, HASH_INSERT_OR_REPLACE);
+  } else {
+    if(!stats_pending.tag_counts)
+      stats_pending.tag_counts = hash_new(sizeof (long));
+    hash_add(stats_pending.tag_counts, word, &n, HASH_INSERT_OR_REPLACE);
   }
 }
 
-/* search primitives *********************************************************/
+/** @brief Order league entries by decreasing count */
+static int compare_league_entries(const void *av, const void *bv) {
+  const struct league_entry *a = av, *b = bv;
 
-/** @brief Return true iff @p name is a trackname_display_ pref
- * @param name Preference name
- * @return Non-zero iff @p name is a trackname_display_ pref
- */
-static int is_display_pref(const char *name) {
-  static const char prefix[] = "trackname_display_";
-  return !strncmp(name, prefix, (sizeof prefix) - 1);
+  if(a->n != b->n)
+    return a->n > b->n ? -1 : 1;
+  return strcmp(a->word, b->word);
 }
 
-/** @brief Word_Break property tailor that treats underscores as spaces
- * @param c Code point
- * @return Tailored property or -1 to use standard value
- *
- * Passed to utf32_word_split() when splitting a track name into words.
- * See word_split() and @ref unicode_property_tailor.
+/** @brief Store the library statistics
+ * @param tracks Number of tracks
+ * @param words Number of distinct search words
+ * @param tags Number of distinct tags
+ * @param league Candidates for the league table, in any order
+ * @param tid Owning transaction
+ * @return 0 or DB_LOCK_DEADLOCK
  */
-static int tailor_underscore_Word_Break_Other(uint32_t c) {
-  switch(c) {
-  default:
-    return -1;
-  case 0x005F: /* LOW LINE (SPACING UNDERSCORE) */
-    return unicode_Word_Break_Other;
+static int stats_store(long tracks, long words, long tags,
+                       struct league_entries *league,
+                       DB_TXN *tid) {
+  struct kvp *counts = 0, *top = 0;
+  char buf[32];
+  int n, err;
+
+  snprintf(buf, sizeof buf, "%ld", tracks);
+  kvp_set(&counts, "tracks", buf);
+  snprintf(buf, sizeof buf, "%ld", words);
+  kvp_set(&counts, "words", buf);
+  snprintf(buf, sizeof buf, "%ld", tags);
+  kvp_set(&counts, "tags", buf);
+  qsort(league->vec, league->nvec, sizeof *league->vec,
+        compare_league_entries);
+  for(n = 0; n < league->nvec && n < STATS_LEAGUE && league->vec[n].n; ++n) {
+    snprintf(buf, sizeof buf, "%ld", league->vec[n].n);
+    kvp_set(&top, league->vec[n].word, buf);
   }
+  if((err = trackdb_set_global_tid("_stats", kvp_urlencode(counts, 0), tid)))
+    return err;
+  return trackdb_set_global_tid("_stats_league", kvp_urlencode(top, 0), tid);
 }
 
-/** @brief Remove all combining characters in-place
- * @param s Pointer to start of string
- * @param ns Length of string
- * @return New, possiblby reduced, length
- */
-static size_t remove_combining_chars(uint32_t *s, size_t ns) {
-  uint32_t *start = s, *t = s, *end = s + ns;
-
-  while(s < end) {
-    const uint32_t c = *s++;
-    if(!utf32_combining_class(c))
-      *t++ = c;
-  }
-  return t - start;
-}
-
-/** @brief Normalize and split a string using a given tailoring
- * @param v Where to store words from string
- * @param s Input string
- * @param pt Word_Break property tailor, or NULL
- *
- * The output words will be:
- * - case-folded
- * - have any combination characters stripped
- * - not include any word break code points (as tailored)
- *
- * Used by track_to_words(), with @p pt set to @ref
- * tailor_underscore_Word_Break_Other, and by normalize_tag() with no
- * tailoring.
+/** @brief Get a counter from the stored statistics
+ * @param counts Decoded value of the @c _stats global preference
+ * @param name Counter name
+ * @return Counter value
  */
-static void word_split(struct vector *v,
-                       const char *s,
-                       unicode_property_tailor *pt) {
-  size_t nw, nt32, i;
-  uint32_t *t32, **w32;
+static long stats_counter(const struct kvp *counts, const char *name) {
+  const char *value = kvp_get(counts, name);
 
-  /* Convert to UTF-32 */
-  if(!(t32 = utf8_to_utf32(s, strlen(s), &nt32)))
-    return;
-  /* Erase case distinctions */
-  if(!(t32 = utf32_casefold_compat(t32, nt32, &nt32)))
-    return;
-  /* Drop combining characters */
-  nt32 = remove_combining_chars(t32, nt32);
-  /* Split into words, treating _ as a space */
-  w32 = utf32_word_split(t32, nt32, &nw, pt);
-  /* Convert words back to UTF-8 and append to result */
-  for(i = 0; i < nw; ++i)
-    vector_append(v, utf32_to_utf8(w32[i], utf32_len(w32[i]), 0));
+  return value ? atol(value) : 0;
 }
 
-/** @brief Normalize a tag
- * @param s Tag
- * @param ns Length of tag
- * @return Normalized string or NULL on error
+/** @brief Add pending statistics changes to the stored counters
+ * @param tid Owning transaction
+ * @return 0 or DB_LOCK_DEADLOCK
  *
- * The return value will be:
- * - case-folded
- * - have no leading or trailing space
- * - have no combining characters
- * - all spacing between words will be a single U+0020 SPACE
+ * If the database has no stored counters then the changes are dropped;
+ * trackdb_stats() will count everything when it's next called.
  */
-static char *normalize_tag(const char *s, size_t ns) {
-  uint32_t *s32, **w32;
-  size_t ns32, nw32, i;
-  struct dynstr d[1];
+static int stats_flush(DB_TXN *tid) {
+  const char *s, *ls, *ts;
+  struct kvp *counts, *k, *tag_counts;
+  struct league_entries league;
+  struct league_entry e;
+  char **words, buf[32];
+  int err, n;
+  long tn;
 
-  if(!(s32 = utf8_to_utf32(s, ns, &ns32)))
+  if((err = trackdb_dirs_flush(tid)))
+    return err;
+  if(!stats_pending.tracks && !stats_pending.words && !stats_pending.tags
+     && !stats_pending.league && !stats_pending.tag_counts)
     return 0;
-  if(!(s32 = utf32_casefold_compat(s32, ns32, &ns32))) /* ->NFKD */
+  if((err = trackdb_get_global_tid("_stats", tid, &s))
+     || (err = trackdb_get_global_tid("_stats_league", tid, &ls)))
+    return err;
+  if(!s) {
+    stats_discard();
     return 0;
-  ns32 = remove_combining_chars(s32, ns32);
-  /* Split into words, no Word_Break tailoring */
-  w32 = utf32_word_split(s32, ns32, &nw32, 0);
-  /* Compose back into a string */
-  dynstr_init(d);
-  for(i = 0; i < nw32; ++i) {
-    if(i)
-      dynstr_append(d, ' ');
-    dynstr_append_string(d, utf32_to_utf8(w32[i], utf32_len(w32[i]), 0));
   }
-  dynstr_terminate(d);
-  return d->vec;
+  counts = kvp_urldecode(s, strlen(s));
+  /* Update the tag directory */
+  if(stats_pending.tag_counts) {
+    if((err = trackdb_get_global_tid("_tag_counts", tid, &ts)))
+      return err;
+    tag_counts = ts ? kvp_urldecode(ts, strlen(ts)) : 0;
+    words = hash_keys(stats_pending.tag_counts);
+    for(n = 0; words[n]; ++n) {
+      tn = *(long *)hash_find(stats_pending.tag_counts, words[n]);
+      snprintf(buf, sizeof buf, "%ld", tn);
+      kvp_set(&tag_counts, words[n], tn ? buf : 0);
+    }
+    if((err = trackdb_set_global_tid("_tag_counts",
+                                     kvp_urlencode(tag_counts, 0), tid)))
+      return err;
+  }
+  /* Merge the changed words into the league table */
+  league_entries_init(&league);
+  for(k = ls ? kvp_urldecode(ls, strlen(ls)) : 0; k; k = k->next)
+    if(!(stats_pending.league && hash_find(stats_pending.league, k->name))) {
+      e.word = k->name;
+      e.n = atol(k->value);
+      league_entries_append(&league, e);
+    }
+  if(stats_pending.league) {
+    words = hash_keys(stats_pending.league);
+    for(n = 0; words[n]; ++n) {
+      e.word = words[n];
+      e.n = *(long *)hash_find(stats_pending.league, words[n]);
+      league_entries_append(&league, e);
+    }
+  }
+  err = stats_store(stats_counter(counts, "tracks") + stats_pending.tracks,
+                    stats_counter(counts, "words") + stats_pending.words,
+                    stats_counter(counts, "tags") + stats_pending.tags,
+                    &league, tid);
+  stats_discard();
+  return err;
 }
 
-/** @brief Compute the words of a track name
- * @param track Track name
- * @param p Preferences (for display prefs)
- * @return NULL-terminated, de-duplicated list or words
+/** @brief Visit each key of a database
+ * @param db Database
+ * @param how @c DB_NEXT to visit every pair or @c DB_NEXT_NODUP for each key
+ * @param visit Called for each pair
+ * @param u Passed to @p visit
+ * @param tid Owning transaction
+ * @return 0 or DB_LOCK_DEADLOCK
  */
-static char **track_to_words(const char *track,
-                             const struct kvp *p) {
-  struct vector v;
-  const char *rootless = track_rootless(track);
+static int stats_scan(DB *db, u_int32_t how,
+                      int (*visit)(DBC *c, const DBT *k, const DBT *d,
+                                   void *u),
+                      void *u, DB_TXN *tid) {
+  DBC *c = trackdb_opencursor(db, tid);
+  DBT k, d;
+  int err;
 
-  if(!rootless)
-    rootless = track;                   /* bodge */
-  vector_init(&v);
-  rootless = strip_extension(rootless);
-  word_split(&v, strip_extension(rootless), tailor_underscore_Word_Break_Other);
-  for(; p; p = p->next)
-    if(is_display_pref(p->name))
-      word_split(&v, p->value, 0);
-  vector_terminate(&v);
-  return dedupe(v.vec, v.nvec);
+  memset(&k, 0, sizeof k);
+  while(!(err = c->c_get(c, &k, prepare_data(&d), how)))
+    if((err = visit(c, &k, &d, u)))
+      break;
+  switch(err) {
+  case 0:
+  case DB_NOTFOUND:
+    err = 0;
+    break;
+  case DB_LOCK_DEADLOCK:
+    disorder_error(0, "error counting library: %s", db_strerror(err));
+    break;
+  default:
+    disorder_fatal(0, "c->c_get: %s", db_strerror(err));
+  }
+  if(trackdb_closecursor(c)) err = DB_LOCK_DEADLOCK;
+  return err;
 }
 
-/** @brief Test for a stopword
- * @param word Word
- * @return Non-zero if @p word is a stopword
+/* Directory summaries *******************************************************/
+
+/** @brief Changes to a directory summary not yet written to dirs.db */
+struct dir_pending {
+  /** @brief Change in the number of tracks below the directory */
+  long tracks;
+
+  /** @brief Change in the total length of those tracks, in seconds */
+  long length;
+
+  /** @brief Change in the number of them whose length is not known */
+  long unknown;
+
+  /** @brief Earliest new track below the directory, or NULL */
+  const char *first;
+
+  /** @brief Set if any track below the directory was removed */
+  int removed;
+};
+
+/** @brief Directory summary changes not yet written to dirs.db
+ *
+ * Keys are directory names and values are @ref dir_pending structures.  Like
+ * @ref stats_pending, changes accumulate here while tracks are noticed and
+ * obsoleted and trackdb_dirs_flush() applies them in the same transaction,
+ * so a batch of tracks from one album updates each directory once.
  */
-static int stopword(const char *word) {
-  int n;
+static hash *dirs_pending;
 
-  for(n = 0; n < config->stopword.n
-        && strcmp(word, config->stopword.s[n]); ++n)
-    ;
-  return n < config->stopword.n;
+/** @brief Forget directory summary changes that were never stored */
+static void dirs_discard(void) {
+  dirs_pending = 0;
 }
 
-/** @brief Register a search term
+/** @brief Note a change to the summaries of the directories above a track
  * @param track Track name
- * @param word A word that appears in the name of @p track
- * @param tid Owning transaction
- * @return  0 or DB_LOCK_DEADLOCK
+ * @param tracks Change in track count (1 for a new track, -1 for a removed
+ * one, otherwise 0)
+ * @param length Change in total length
+ * @param unknown Change in the number of tracks of unknown length
+ *
+ * Every directory containing @p track is affected, however far above it.
  */
-static int register_search_word(const char *track, const char *word,
-                                DB_TXN *tid) {
-  if(stopword(word)) return 0;
-  return register_word(trackdb_searchdb, "search", track, word, tid);
+static void dirs_change(const char *track, long tracks, long length,
+                        long unknown) {
+  const char *end = strrchr(track, '/');
+  struct dir_pending *pd, zero;
+  char *dir;
+
+  if(!dirs_pending)
+    dirs_pending = hash_new(sizeof (struct dir_pending));
+  if(tracks > 0)
+    track = xstrdup(track);
+  memset(&zero, 0, sizeof zero);
+  while(end && end > track) {
+    dir = xstrndup(track, end - track);
+    if(!(pd = hash_find(dirs_pending, dir))) {
+      hash_add(dirs_pending, dir, &zero, HASH_INSERT);
+      pd = hash_find(dirs_pending, dir);
+    }
+    pd->tracks += tracks;
+    pd->length += length;
+    pd->unknown += unknown;
+    if(tracks > 0 && (!pd->first || compare_path(track, pd->first) < 0))
+      pd->first = track;
+    if(tracks < 0)
+      pd->removed = 1;
+    /* Move up to the parent directory */
+    do
+      --end;
+    while(end > track && *end != '/');
+  }
 }
 
-/* Tags **********************************************************************/
+/** @brief Note a change to a track's recorded length
+ * @param track Track name
+ * @param oldlength Previous length in seconds, or NULL if it was not known
+ * @param newlength New length in seconds, or NULL if it is not known
+ *
+ * The directory summaries are updated by the next trackdb_dirs_flush().
+ */
+void trackdb_length_changed(const char *track,
+                            const char *oldlength,
+                            const char *newlength) {
+  dirs_change(track, 0,
+              (newlength ? atol(newlength) : 0)
+              - (oldlength ? atol(oldlength) : 0),
+              !newlength - !oldlength);
+}
 
-/** @brief Test for tag characters
- * @param c Character
- * @return Non-zero if @p c is a tag character
+/** @brief Find the first track below a directory
+ * @param dir Directory name
+ * @param firstp Where to store the first track, or NULL if there is none
+ * @param tid Owning transaction
+ * @return 0 or DB_LOCK_DEADLOCK
  *
- * The current rule is that commas and the control characters 0-31 are not
- * allowed but anything else is permitted.  This is arguably a bit loose.
+ * "First" means first in the order of @ref trackdb_tracksdb, in which
+ * everything below a directory is contiguous.  Aliases are skipped.
  */
-static int tagchar(int c) {
-  switch(c) {
-  case ',':
-    return 0;
+static int dir_first(const char *dir, const char **firstp, DB_TXN *tid) {
+  const size_t dl = strlen(dir);
+  DBC *cursor;
+  DBT k, d;
+  int err;
+
+  *firstp = 0;
+  cursor = trackdb_opencursor(trackdb_tracksdb, tid);
+  err = cursor->c_get(cursor, make_key(&k, dir), prepare_data(&d),
+                      DB_SET_RANGE);
+  while(err == 0
+        && k.size > dl
+        && ((char *)k.data)[dl] == '/'
+        && !memcmp(k.data, dir, dl)) {
+    if(!kvp_packed_get(d.data, d.size, "_alias_for")) {
+      *firstp = xstrndup(k.data, k.size);
+      break;
+    }
+    err = cursor->c_get(cursor, &k, prepare_data(&d), DB_NEXT);
+  }
+  switch(err) {
+  case 0:
+  case DB_NOTFOUND:
+    err = 0;
+    break;
+  case DB_LOCK_DEADLOCK:
+    disorder_error(0, "error reading tracks.db: %s", db_strerror(err));
+    break;
   default:
-    return c >= ' ';
+    disorder_fatal(0, "c->c_get: %s", db_strerror(err));
   }
+  if(trackdb_closecursor(cursor)) err = DB_LOCK_DEADLOCK;
+  return err;
 }
 
-/** @brief Parse a tag list
- * @param s Tag list or NULL (equivalent to "")
- * @return Parsed tag list
+/** @brief Set a numeric field of a directory summary */
+static void dir_counter_set(struct kvp **kp, const char *name, long n) {
+  char buf[32];
+
+  byte_snprintf(buf, sizeof buf, "%ld", n);
+  kvp_set(kp, name, buf);
+}
+
+/** @brief Add pending directory summary changes to dirs.db
+ * @param tid Owning transaction
+ * @return 0 or DB_LOCK_DEADLOCK
  *
- * The tags will be normalized (as per normalize_tag()) and de-duplicated.
+ * If the summaries have not been counted (see fill_dirs()) then the changes
+ * are dropped.
  */
-char **parsetags(const char *s) {
-  const char *t;
-  struct vector v;
+int trackdb_dirs_flush(DB_TXN *tid) {
+  const struct dir_pending *pd;
+  const char *counted, *first;
+  struct kvp *k;
+  char **dirs;
+  long tracks;
+  int err, n;
 
-  vector_init(&v);
-  if(s) {
-    /* skip initial separators */
-    while(*s && (!tagchar(*s) || *s == ' '))
-      ++s;
-    while(*s) {
-      /* find the extent of the tag */
-      t = s;
-      while(*s && tagchar(*s))
-        ++s;
-      /* strip trailing spaces */
-      while(s > t && s[-1] == ' ')
-        --s;
-      /* add tag to list */
-      vector_append(&v, normalize_tag(t, (size_t)(s - t)));
-      /* skip intermediate and trailing separators */
-      while(*s && (!tagchar(*s) || *s == ' '))
-        ++s;
+  if(!dirs_pending)
+    return 0;
+  if((err = trackdb_get_global_tid("_dirs", tid, &counted)))
+    return err;
+  if(!counted) {
+    dirs_discard();
+    return 0;
+  }
+  dirs = hash_keys(dirs_pending);
+  for(n = 0; dirs[n]; ++n) {
+    pd = hash_find(dirs_pending, dirs[n]);
+    if((err = trackdb_getdata(trackdb_dirsdb, dirs[n], &k, tid))
+       && err != DB_NOTFOUND)
+      return err;
+    if((tracks = stats_counter(k, "tracks") + pd->tracks) <= 0) {
+      if((err = trackdb_delkey(trackdb_dirsdb, dirs[n], tid)))
+        return err;
+      continue;
     }
+    dir_counter_set(&k, "tracks", tracks);
+    dir_counter_set(&k, "length", stats_counter(k, "length") + pd->length);
+    dir_counter_set(&k, "unknown", stats_counter(k, "unknown") + pd->unknown);
+    /* A removed track might have been the first one */
+    first = kvp_get(k, "first");
+    if(pd->removed) {
+      if((err = dir_first(dirs[n], &first, tid)))
+        return err;
+    } else if(pd->first && (!first || compare_path(pd->first, first) < 0))
+      first = pd->first;
+    kvp_set(&k, "first", first);
+    if((err = trackdb_putdata(trackdb_dirsdb, dirs[n], k, tid, 0)))
+      return err;
   }
-  vector_terminate(&v);
-  return dedupe(v.vec, v.nvec);
+  dirs_discard();
+  return 0;
 }
 
-/** @brief Register a tag
- * @param track Track name
- * @param tag Tag name
+/** @brief Add a tracks.db entry to the directory summaries */
+static int recount_dir(DBC attribute((unused)) *c, const DBT *k,
+                       const DBT *d, void attribute((unused)) *u) {
+  const char *length;
+
+  if(kvp_packed_get(d->data, d->size, "_alias_for"))
+    return 0;
+  length = kvp_packed_get(d->data, d->size, "_length");
+  dirs_change(xstrndup(k->data, k->size), 1, length ? atol(length) : 0,
+              !length);
+  return 0;
+}
+
+/** @brief Count the directory summaries from scratch
  * @param tid Owning transaction
  * @return 0 or DB_LOCK_DEADLOCK
  */
-static int register_tag(const char *track, const char *tag, DB_TXN *tid) {
-  return register_word(trackdb_tagsdb, "tags", track, tag, tid);
-}
+static int dirs_recount(DB_TXN *tid) {
+  u_int32_t count;
+  int err;
 
-/* aliases *******************************************************************/
+  dirs_discard();
+  switch(err = trackdb_dirsdb->truncate(trackdb_dirsdb, tid, &count, 0)) {
+  case 0:
+    break;
+  case DB_LOCK_DEADLOCK:
+    disorder_error(0, "error truncating dirs.db: %s", db_strerror(err));
+    return err;
+  default:
+    disorder_fatal(0, "error truncating dirs.db: %s", db_strerror(err));
+  }
+  if((err = stats_scan(trackdb_tracksdb, DB_NEXT, recount_dir, 0, tid))
+     || (err = trackdb_set_global_tid("_dirs", "counted", tid)))
+    return err;
+  return trackdb_dirs_flush(tid);
+}
 
-/** @brief Compute an alias
- * @param aliasp Where to put alias (gets NULL if none)
- * @param track Track to find alias for
- * @param p Prefs for @p track
+/** @brief Count the directory summaries if they have not been counted
  * @param tid Owning transaction
  * @return 0 or DB_LOCK_DEADLOCK
  *
- * This function looks up the track name parts for @p track.  By default these
- * amount to the original values from the track name but are overridden by
- * preferences.
- *
- * These values are then substituted into the pattern defined by the @b alias
- * command; see disorder_config(5) for the syntax.
- *
- * The track is only considered to have an alias if all of the following are
- * true:
- * - a preference was used for at least one name part
- * - the result differs from the original track name
- * - the result does not match any existing track or alias
+ * Does nothing if the summaries are already being kept, which is the case
+ * except when the rest of the database predates dirs.db or after
+ * trackdb_stats_forget().
  */
-static int compute_alias(char **aliasp,
-                         const char *track,
-                         const struct kvp *p,
-                         DB_TXN *tid) {
-  struct dynstr d;
-  const char *s = config->alias, *t, *expansion, *part;
-  int c, used_db = 0, slash_prefix, err;
-  struct kvp *at;
-  const char *const root = find_track_root(track);
+static int fill_dirs(DB_TXN *tid) {
+  const char *counted;
+  int err;
 
-  if(!root) {
-    /* Bodge for tracks with no root */
-    *aliasp = 0;
-    return 0;
-  }
-  dynstr_init(&d);
-  dynstr_append_string(&d, root);
-  while((c = (unsigned char)*s++)) {
-    if(c != '{') {
-      dynstr_append(&d, c);
-      continue;
-    }
-    if((slash_prefix = (*s == '/')))
-      s++;
-    t = strchr(s, '}');
-    assert(t != 0);			/* validated at startup */
-    part = xstrndup(s, t - s);
-    expansion = getpart(track, "display", part, p, &used_db);
-    if(*expansion) {
-      if(slash_prefix) dynstr_append(&d, '/');
-      dynstr_append_string(&d, expansion);
-    }
-    s = t + 1;				/* skip {part} */
-  }
-  /* only admit to the alias if we used the db... */
-  if(!used_db) {
-    *aliasp = 0;
-    return 0;
-  }
-  dynstr_terminate(&d);
-  /* ...and the answer differs from the original... */
-  if(!strcmp(track, d.vec)) {
-    *aliasp = 0;
-    return 0;
-  }
-  /* ...and there isn't already a different track with that name (including as
-   * an alias) */
-  switch(err = trackdb_getdata(trackdb_tracksdb, d.vec, &at, tid)) {
-  case 0:
-    if((s = kvp_get(at, "_alias_for"))
-       && !strcmp(s, track)) {
-    case DB_NOTFOUND:
-      *aliasp = d.vec;
-    } else {
-      *aliasp = 0;
-    }
+  if((err = trackdb_get_global_tid("_dirs", tid, &counted)))
+    return err;
+  if(counted)
     return 0;
-  default:
-    *aliasp = 0;
+  if((err = dirs_recount(tid)))
     return err;
-  }
+  disorder_info("summarized directories");
+  return 0;
 }
 
-/** @brief Assert that no alias is allowed for gettrackdata() */
-#define GTD_NOALIAS 0x0001
-
-/** @brief Get all track data
- * @param track Track to look up; aliases allowed unless @ref GTD_NOALIAS
- * @param tp Where to put track data (if not NULL)
- * @param pp Where to put preferences (if not NULL)
- * @param actualp Where to put real (i.e. non-alias) path (if not NULL)
- * @param flags Flag values, see below
- * @param tid Owning transaction
- * @return 0, DB_NOTFOUND (track doesn't exist) or DB_LOCK_DEADLOCK
- *
- * Possible flags values are:
- * - @ref GTD_NOALIAS to assert that an alias is not allowed
+/** @brief Get summaries of many directories at once
+ * @param dirs Directory names
+ * @param ndirs Number of directories
+ * @param summaries Where to store the summaries
  *
- * The return values are always set (even if to NULL).
- */
-static int gettrackdata(const char *track,
-                        struct kvp **tp,
-                        struct kvp **pp,
-                        const char **actualp,
-                        unsigned flags,
-                        DB_TXN *tid) {
-  int err;
-  const char *actual = track;
-  struct kvp *t = 0, *p = 0;
-
-  if((err = trackdb_getdata(trackdb_tracksdb, track, &t, tid))) goto done;
-  if((actual = kvp_get(t, "_alias_for"))) {
-    if(flags & GTD_NOALIAS) {
-      disorder_error(0,
-                     "alias passed to gettrackdata where real path required");
-      abort();
-    }
-    if((err = trackdb_getdata(trackdb_tracksdb, actual, &t, tid))) goto done;
-  } else
-    actual = track;
-  assert(actual != 0);
-  if(pp) {
-    if((err = trackdb_getdata(trackdb_prefsdb, actual, &p, tid)) == DB_LOCK_DEADLOCK)
-      goto done;
-  }
-  err = 0;
-done:
-  if(actualp) *actualp = actual;
-  if(tp) *tp = t;
-  if(pp) *pp = p;
-  return err;
-}
-
-/* trackdb_notice() **********************************************************/
-
-/** @brief Notice a possibly new track
- * @param track NFC UTF-8 track name
- * @param path Raw path name (i.e. the bytes that came out of readdir())
- * @return @c DB_NOTFOUND if new, 0 if already known
+ * All the directories are looked up in a single transaction.  Each summary
+ * has these fields:
+ * - @c tracks: the number of tracks anywhere below the directory
+ * - @c length: the total length of those tracks, in seconds
+ * - @c unknown: how many of those tracks' lengths are not yet known
+ * - @c first: the first track below the directory
  *
- * @c disorder-rescan is responsible for normalizing the track name.
+ * Directories with no tracks, or that haven't been summarized, get a null
+ * pointer.
  */
-int trackdb_notice(const char *track,
-                   const char *path) {
-  int err;
+void trackdb_get_dirs(char **dirs, int ndirs, struct kvp **summaries) {
   DB_TXN *tid;
+  int n;
 
   for(;;) {
-    tid = trackdb_begin_transaction();
-    err = trackdb_notice_tid(track, path, tid);
-    if(err == DB_LOCK_DEADLOCK) goto fail;
+    tid = trackdb_begin_read_transaction();
+    for(n = 0; n < ndirs; ++n)
+      if(trackdb_getdata(trackdb_dirsdb, dirs[n], &summaries[n], tid)
+         == DB_LOCK_DEADLOCK)
+        goto fail;
     break;
-  fail:
+fail:
     trackdb_abort_transaction(tid);
   }
   trackdb_commit_transaction(tid);
-  return err;
 }
 
-/** @brief Notice a possibly new track
- * @param track NFC UTF-8 track name
- * @param path Raw path name (i.e. the bytes that came out of readdir())
- * @param tid Owning transaction
- * @return @c DB_NOTFOUND if new, 0 if already known, @c DB_LOCK_DEADLOCK also
+/* Track name filter *********************************************************/
+
+/** @brief Filter bits per track */
+#define TRACK_FILTER_BITS 16
+
+/** @brief Filter bits set by each track name */
+#define TRACK_FILTER_HASHES 6
+
+/** @brief Bloom filter over the keys of @ref trackdb_tracksdb
  *
- * @c disorder-rescan is responsible for normalizing the track name.
+ * Clients often ask about tracks that don't exist, for instance from stale
+ * playlists, and without this each such question would be a database
+ * lookup.  A name that is absent from the filter is certainly absent from
+ * the database; anything else must be looked up.
+ *
+ * Only the server that owns the database keeps a filter.  It is added to
+ * whenever @c tracks.db is written, and is rebuilt after a rescan or a
+ * background upgrade, since those are done by other processes.  While they
+ * run it is not used at all.
  */
-int trackdb_notice_tid(const char *track,
-                       const char *path,
-                       DB_TXN *tid) {
-  int err, n;
-  struct kvp *t, *a, *p;
-  int t_changed, ret;
-  char *alias, **w, *noticed;
-  time_t now;
+static struct {
+  /** @brief Set by trackdb_filter_tracks() */
+  int wanted;
 
-  /* notice whether the tracks.db entry changes */
-  t_changed = 0;
-  /* get any existing tracks entry */
-  if((err = gettrackdata(track, &t, &p, 0, 0, tid)) == DB_LOCK_DEADLOCK)
-    return err;
-  ret = err;                            /* 0 or DB_NOTFOUND */
-  /* this is a real track */
-  t_changed += kvp_set(&t, "_alias_for", 0);
-  t_changed += kvp_set(&t, "_path", path);
-  xtime(&now);
-  if(ret == DB_NOTFOUND) {
-    /* It's a new track; record the time */
-    byte_xasprintf(&noticed, "%lld", (long long)now);
-    t_changed += kvp_set(&t, "_noticed", noticed);
-  }
-  /* if we have an alias record it in the database */
-  if((err = compute_alias(&alias, track, p, tid))) return err;
-  if(alias) {
-    /* won't overwrite someone else's alias as compute_alias() checks */
-    D(("%s: alias %s", track, alias));
-    a = 0;
-    kvp_set(&a, "_alias_for", track);
-    if((err = trackdb_putdata(trackdb_tracksdb, alias, a, tid, 0))) return err;
+  /** @brief Filter bits, or NULL if there is no filter */
+  uint64_t *bits;
+
+  /** @brief Number of filter bits, less 1 */
+  size_t mask;
+} track_filter;
+
+/** @brief Hash a track name for the filter
+ * @param track Track name
+ * @param len Length of @p track
+ * @return Hash code
+ *
+ * This is 64-bit FNV-1a.
+ */
+static uint64_t track_filter_hash(const char *track, size_t len) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+
+  while(len-- > 0) {
+    h ^= (unsigned char)*track++;
+    h *= 0x100000001b3ULL;
   }
-  /* update search.db */
-  w = track_to_words(track, p);
-  for(n = 0; w[n]; ++n)
-    if((err = register_search_word(track, w[n], tid)))
-      return err;
-  /* update tags.db */
-  w = parsetags(kvp_get(p, "tags"));
-  for(n = 0; w[n]; ++n)
-    if((err = register_tag(track, w[n], tid)))
-      return err;
-  /* only store the tracks.db entry if it has changed */
-  if(t_changed && (err = trackdb_putdata(trackdb_tracksdb, track, t, tid, 0)))
-    return err;
-  if(ret == DB_NOTFOUND) {
-    uint32_t timestamp[2];
-    DBT key, data;
+  return h;
+}
 
-    timestamp[0] = htonl((uint64_t)now >> 32);
-    timestamp[1] = htonl((uint32_t)now);
-    memset(&key, 0, sizeof key);
-    key.data = timestamp;
-    key.size = sizeof timestamp;
-    switch(err = trackdb_noticeddb->put(trackdb_noticeddb, tid, &key,
-                                        make_key(&data, track), 0)) {
-    case 0: break;
-    case DB_LOCK_DEADLOCK: return err;
-    default:
-      disorder_fatal(0, "error updating noticed.db: %s", db_strerror(err));
-    }
+/** @brief Set a hash code's bits in the filter
+ * @param h Hash code from track_filter_hash()
+ */
+static void track_filter_set(uint64_t h) {
+  uint64_t h1 = (uint32_t)h, h2 = (h >> 32) | 1, n;
+  int i;
+
+  for(i = 0; i < TRACK_FILTER_HASHES; ++i) {
+    n = (h1 + i * h2) & track_filter.mask;
+    track_filter.bits[n / 64] |= (uint64_t)1 << (n % 64);
   }
-  return ret;
 }
 
-/* trackdb_obsolete() ********************************************************/
+/** @brief Add a track name to the filter
+ * @param track Track name
+ * @param len Length of @p track
+ */
+static void track_filter_add(const char *track, size_t len) {
+  if(track_filter.bits)
+    track_filter_set(track_filter_hash(track, len));
+}
 
-/** @brief Obsolete a track
+/** @brief Test whether a track might exist
  * @param track Track name
- * @param tid Owning transaction
- * @return 0 or DB_LOCK_DEADLOCK
- *
- * Discards a track from the database when it's known not to exist any more.
- * Returns 0 even if it wasn't recorded.
+ * @return Nonzero unless the filter shows that @p track does not exist
  */
-int trackdb_obsolete(const char *track, DB_TXN *tid) {
-  int err, n;
-  struct kvp *p;
-  char *alias, **w;
+static int track_filter_test(const char *track) {
+  uint64_t h, h1, h2, n;
+  int i;
 
-  if((err = gettrackdata(track, 0, &p, 0,
-                         GTD_NOALIAS, tid)) == DB_LOCK_DEADLOCK)
-    return err;
-  else if(err == DB_NOTFOUND) return 0;
-  /* compute the alias, if any, and delete it */
-  if((err = compute_alias(&alias, track, p, tid))) return err;
-  if(alias) {
-    /* if the alias points to some other track then compute_alias won't
-     * return it */
-    if((err = trackdb_delkey(trackdb_tracksdb, alias, tid))
-       && err != DB_NOTFOUND)
-      return err;
+  if(!track_filter.bits || rescan_pid != -1 || upgrade_pid != -1)
+    return 1;
+  h = track_filter_hash(track, strlen(track));
+  h1 = (uint32_t)h;
+  h2 = (h >> 32) | 1;
+  for(i = 0; i < TRACK_FILTER_HASHES; ++i) {
+    n = (h1 + i * h2) & track_filter.mask;
+    if(!(track_filter.bits[n / 64] & ((uint64_t)1 << (n % 64))))
+      return 0;
   }
-  /* update search.db */
-  w = track_to_words(track, p);
-  for(n = 0; w[n]; ++n)
-    if(trackdb_delkeydata(trackdb_searchdb,
-                          w[n], track, tid) == DB_LOCK_DEADLOCK)
-      return err;
-  /* update tags.db */
-  w = parsetags(kvp_get(p, "tags"));
-  for(n = 0; w[n]; ++n)
-    if(trackdb_delkeydata(trackdb_tagsdb,
-                          w[n], track, tid) == DB_LOCK_DEADLOCK)
-      return err;
-  /* update tracks.db */
-  if(trackdb_delkey(trackdb_tracksdb, track, tid) == DB_LOCK_DEADLOCK)
-    return err;
-  /* We don't delete the prefs, so they survive temporary outages of the
-   * (possibly virtual) track filesystem */
-  return 0;
+  return 1;
 }
 
-/* trackdb_stats() ***********************************************************/
+/** @brief Track name hash codes collected by track_filter_scan() */
+struct track_filter_hashes {
+  uint64_t *h;
+  size_t n, size;
+};
 
-#define H(name) { #name, offsetof(DB_HASH_STAT, name) }
-#define B(name) { #name, offsetof(DB_BTREE_STAT, name) }
+/** @brief Collect the hash code of one tracks.db key */
+static int track_filter_visit(DBC attribute((unused)) *c,
+                              const DBT *k,
+                              const DBT attribute((unused)) *d,
+                              void *u) {
+  struct track_filter_hashes *th = u;
 
-/** @brief Table of libdb stats to return */
-static const struct statinfo {
-  const char *name;
-  size_t offset;
-} statinfo_hash[] = {
-  H(hash_magic),
-  H(hash_version),
-  H(hash_nkeys),
-  H(hash_ndata),
-  H(hash_pagesize),
-  H(hash_ffactor),
-  H(hash_buckets),
-  H(hash_free),
-  H(hash_bfree),
-  H(hash_bigpages),
-  H(hash_big_bfree),
-  H(hash_overflows),
-  H(hash_ovfl_free),
-  H(hash_dup),
-  H(hash_dup_free),
-}, statinfo_btree[] = {
-  B(bt_magic),
-  B(bt_version),
-  B(bt_nkeys),
-  B(bt_ndata),
-  B(bt_pagesize),
-  B(bt_minkey),
-  B(bt_re_len),
-  B(bt_re_pad),
-  B(bt_levels),
-  B(bt_int_pg),
-  B(bt_leaf_pg),
-  B(bt_dup_pg),
-  B(bt_over_pg),
-  B(bt_free),
-  B(bt_int_pgfree),
-  B(bt_leaf_pgfree),
-  B(bt_dup_pgfree),
-  B(bt_over_pgfree),
-};
+  if(th->n >= th->size) {
+    th->size = th->size ? 2 * th->size : 4096;
+    th->h = xrealloc_noptr(th->h, th->size * sizeof *th->h);
+  }
+  th->h[th->n++] = track_filter_hash(k->data, k->size);
+  return 0;
+}
 
-/** @brief Look up DB statistics
- * @param v Where to store stats
- * @param database Database
- * @param si Pointer to table of stats
- * @param nsi Size of @p si
+/** @brief Collect the hash codes of every tracks.db key
+ * @param th Where to store hash codes
  * @param tid Owning transaction
  * @return 0 or DB_LOCK_DEADLOCK
  */
-static int get_stats(struct vector *v,
-                     DB *database,
-                     const struct statinfo *si,
-                     size_t nsi,
-                     DB_TXN *tid) {
-  void *sp;
-  size_t n;
-  char *str;
+static int track_filter_scan(struct track_filter_hashes *th, DB_TXN *tid) {
+  th->n = 0;
+  return stats_scan(trackdb_tracksdb, DB_NEXT, track_filter_visit, th, tid);
+}
+
+/** @brief (Re-)build the filter from the database */
+static void track_filter_build(void) {
+  struct track_filter_hashes th[1];
+  size_t nbits, n;
+  int e;
+
+  if(!track_filter.wanted)
+    return;
+  memset(th, 0, sizeof th);
+  WITH_TRANSACTION(track_filter_scan(th, tid));
+  for(nbits = 65536; nbits / TRACK_FILTER_BITS < th->n; nbits *= 2)
+    ;
+  xfree(track_filter.bits);
+  track_filter.bits = xcalloc_noptr(nbits / 64, sizeof (uint64_t));
+  track_filter.mask = nbits - 1;
+  for(n = 0; n < th->n; ++n)
+    track_filter_set(th->h[n]);
+  xfree(th->h);
+  D(("track filter: %zu keys, %zu bits", th->n, nbits));
+}
+
+/** @brief Keep a filter of track names
+ *
+ * Called by the server once the database is open.  Does nothing in a zone
+ * or replica, whose database is written by another server.
+ */
+void trackdb_filter_tracks(void) {
+  if(config->library)
+    return;
+  track_filter.wanted = 1;
+  track_filter_build();
+}
+
+/** @brief State for stats_recount() */
+struct stats_recount_state {
+  long tracks, words, tags;
+  struct league_entries league;
+  struct kvp *tag_counts;
+};
+
+/** @brief Count a tracks.db entry unless it is an alias */
+static int recount_track(DBC attribute((unused)) *c,
+                         const DBT attribute((unused)) *k,
+                         const DBT *d, void *u) {
+  struct stats_recount_state *rs = u;
+
+  if(!kvp_packed_get(d->data, d->size, "_alias_for"))
+    ++rs->tracks;
+  return 0;
+}
+
+/** @brief Count a search.db key and record how many tracks have it */
+static int recount_word(DBC *c, const DBT *k,
+                        const DBT attribute((unused)) *d, void *u) {
+  struct stats_recount_state *rs = u;
+  struct league_entry e;
+  db_recno_t n;
   int err;
 
-  if(database) {
-    switch(err = database->stat(database, tid, &sp, 0)) {
-    case 0:
-      break;
-    case DB_LOCK_DEADLOCK:
-      disorder_error(0, "error querying database: %s", db_strerror(err));
-      return err;
-    default:
-      disorder_fatal(0, "error querying database: %s", db_strerror(err));
-    }
-    for(n = 0; n < nsi; ++n) {
-      byte_xasprintf(&str, "%s=%"PRIuMAX, si[n].name,
-		     (uintmax_t)*(u_int32_t *)((char *)sp + si[n].offset));
-      vector_append(v, str);
-    }
+  if((err = c->c_count(c, &n, 0))) {
+    if(err != DB_LOCK_DEADLOCK)
+      disorder_fatal(0, "c->c_count: %s", db_strerror(err));
+    return err;
   }
+  ++rs->words;
+  e.word = xstrndup(k->data, k->size);
+  e.n = n;
+  league_entries_append(&rs->league, e);
   return 0;
 }
 
-/** @brief One entry in the search league */
-struct search_entry {
-  char *word;
-  int n;
-};
-
-/** @brief Add a word to the search league
- * @param se Pointer to search league
- * @param count Maximum size for search league
- * @param nse Current size of search league
- * @param word New word, or NULL
- * @param n How often @p word appears
- * @return New size of search league
- */
-static int register_search_entry(struct search_entry *se,
-                                 int count,
-                                 int nse,
-                                 char *word,
-                                 int n) {
-  int i;
+/** @brief Count a tags.db key and record how many tracks have it */
+static int recount_tag(DBC *c, const DBT *k,
+                       const DBT attribute((unused)) *d, void *u) {
+  struct stats_recount_state *rs = u;
+  struct kvp *tc;
+  db_recno_t n;
+  char buf[32];
+  int err;
 
-  if(word && (nse < count || n > se[nse - 1].n)) {
-    /* Find the starting point */
-    if(nse == count)
-      i = nse - 1;
-    else
-      i = nse++;
-    /* Find the insertion point */
-    while(i > 0 && n > se[i - 1].n)
-      --i;
-    memmove(&se[i + 1], &se[i], (nse - i - 1) * sizeof *se);
-    se[i].word = word;
-    se[i].n = n;
+  if((err = c->c_count(c, &n, 0))) {
+    if(err != DB_LOCK_DEADLOCK)
+      disorder_fatal(0, "c->c_count: %s", db_strerror(err));
+    return err;
   }
-  return nse;
+  ++rs->tags;
+  snprintf(buf, sizeof buf, "%lu", (unsigned long)n);
+  tc = xmalloc(sizeof *tc);
+  tc->next = rs->tag_counts;
+  tc->name = xstrndup(k->data, k->size);
+  tc->value = xstrdup(buf);
+  rs->tag_counts = tc;
+  return 0;
 }
 
-/** @brief Find the top @p count words in the search database
- * @param v Where to format the result
- * @param count Maximum number of words
+/** @brief Count the library statistics from scratch
  * @param tid Owning transaction
  * @return 0 or DB_LOCK_DEADLOCK
  */
-static int search_league(struct vector *v, int count, DB_TXN *tid) {
-  struct search_entry *se;
-  DBT k, d;
-  DBC *cursor;
-  int err, n = 0, nse = 0, i;
-  char *word = 0;
-  size_t wl = 0;
-  char *str;
+static int stats_recount(DB_TXN *tid) {
+  struct stats_recount_state rs[1];
+  int err;
 
-  cursor = trackdb_opencursor(trackdb_searchdb, tid);
-  se = xmalloc(count * sizeof *se);
-  /* Walk across the whole database counting up the number of times each
-   * word appears. */
-  while(!(err = cursor->c_get(cursor, prepare_data(&k), prepare_data(&d),
-                              DB_NEXT))) {
-    if(word && wl == k.size && !strncmp(word, k.data, wl))
-      ++n;                              /* same word again */
-    else {
-      nse = register_search_entry(se, count, nse, word, n);
-      word = xstrndup(k.data, wl = k.size);
-      n = 1;
-    }
-  }
-  switch(err) {
-  case DB_NOTFOUND:
-    err = 0;
-    break;
+  memset(rs, 0, sizeof rs);
+  league_entries_init(&rs->league);
+  if((err = stats_scan(trackdb_tracksdb, DB_NEXT, recount_track, rs, tid))
+     || (err = stats_scan(trackdb_searchdb, DB_NEXT_NODUP, recount_word, rs,
+                          tid))
+     || (err = stats_scan(trackdb_tagsdb, DB_NEXT_NODUP, recount_tag, rs,
+                          tid))
+     || (err = trackdb_set_global_tid("_tag_counts",
+                                      kvp_urlencode(rs->tag_counts, 0), tid)))
+    return err;
+  return stats_store(rs->tracks, rs->words, rs->tags, &rs->league, tid);
+}
+
+/** @brief Discard the stored library statistics
+ * @param tid Owning transaction
+ * @return 0 or DB_LOCK_DEADLOCK
+ *
+ * Used when the search or tags databases are rebuilt wholesale.  The
+ * statistics will be counted from scratch when they're next needed.  The
+ * directory summaries are discarded too, and counted again by the next
+ * trackdb_open() that may upgrade the database.
+ */
+int trackdb_stats_forget(DB_TXN *tid) {
+  u_int32_t count;
+  int err;
+
+  stats_discard();
+  if((err = trackdb_set_global_tid("_stats", 0, tid)) == DB_LOCK_DEADLOCK)
+    return err;
+  if((err = trackdb_set_global_tid("_stats_league", 0, tid))
+     == DB_LOCK_DEADLOCK)
+    return err;
+  if((err = trackdb_set_global_tid("_tag_counts", 0, tid))
+     == DB_LOCK_DEADLOCK)
+    return err;
+  if((err = trackdb_set_global_tid("_dirs", 0, tid)) == DB_LOCK_DEADLOCK)
+    return err;
+  switch(err = trackdb_dirsdb->truncate(trackdb_dirsdb, tid, &count, 0)) {
+  case 0:
+    return 0;
   case DB_LOCK_DEADLOCK:
-    disorder_error(0, "error querying search database: %s", db_strerror(err));
-    break;
+    disorder_error(0, "error truncating dirs.db: %s", db_strerror(err));
+    return err;
   default:
-    disorder_fatal(0, "error querying search database: %s", db_strerror(err));
-  }
-  if(trackdb_closecursor(cursor)) err = DB_LOCK_DEADLOCK;
-  if(err) return err;
-  nse = register_search_entry(se, count, nse, word, n);
-  byte_xasprintf(&str, "Top %d search words:", nse);
-  vector_append(v, str);
-  for(i = 0; i < nse; ++i) {
-    byte_xasprintf(&str, "%4d: %5d %s", i + 1, se[i].n, se[i].word);
-    vector_append(v, str);
+    disorder_fatal(0, "error truncating dirs.db: %s", db_strerror(err));
   }
-  return 0;
 }
 
-#define SI(what) statinfo_##what, \
-                 sizeof statinfo_##what / sizeof (struct statinfo)
+/** @brief Start a transaction with the given flags */
+static DB_TXN *begin_transaction(u_int32_t flags) {
+  DB_TXN *tid;
+  int err;
 
-/** @brief Return a list of database stats
- * @param nstatsp Where to store number of lines (or NULL)
- * @return Database stats output
+  if((err = trackdb_env->txn_begin(trackdb_env, 0, &tid, flags)))
+    disorder_fatal(0, "trackdb_env->txn_begin: %s", db_strerror(err));
+  if(!transaction_depth++)
+    xgettimeofday(&transaction_started, NULL);
+  return tid;
+}
+
+/** @brief Start a transaction
+ * @return Transaction
+ */
+DB_TXN *trackdb_begin_transaction(void) {
+  return begin_transaction(0);
+}
+
+/** @brief Start a read-only transaction
+ * @return Transaction
  *
- * This is called by @c disorder-stats.  Don't call it directly from elsewhere
- * as it can take unreasonably long.
+ * The transaction reads a snapshot of the databases opened with @c
+ * DB_MULTIVERSION, so it takes no read locks on them and neither blocks nor
+ * deadlocks against writers.  It must not be used to modify anything.
  */
-char **trackdb_stats(int *nstatsp) {
-  DB_TXN *tid;
-  struct vector v;
+DB_TXN *trackdb_begin_read_transaction(void) {
+  return begin_transaction(DB_TXN_SNAPSHOT);
+}
 
-  vector_init(&v);
-  for(;;) {
-    tid = trackdb_begin_transaction();
-    v.nvec = 0;
-    vector_append(&v, (char *)"Tracks database stats:");
-    if(get_stats(&v, trackdb_tracksdb, SI(btree), tid)) goto fail;
-    vector_append(&v, (char *)"");
-    vector_append(&v, (char *)"Search database stats:");
-    if(get_stats(&v, trackdb_searchdb, SI(hash), tid)) goto fail;
-    vector_append(&v, (char *)"");
-    vector_append(&v, (char *)"Prefs database stats:");
-    if(get_stats(&v, trackdb_prefsdb, SI(hash), tid)) goto fail;
-    vector_append(&v, (char *)"");
-    if(search_league(&v, 10, tid)) goto fail;
-    vector_terminate(&v);
-    break;
-fail:
-    trackdb_abort_transaction(tid);
+/** @brief Note that a transaction has finished
+ *
+ * Updates @ref trackdb_busy_us when the outermost transaction ends.
+ */
+static void transaction_finished(void) {
+  struct timeval now;
+
+  if(transaction_depth > 0 && !--transaction_depth) {
+    xgettimeofday(&now, NULL);
+    trackdb_busy_us += tvsub_us(now, transaction_started);
   }
-  trackdb_commit_transaction(tid);
-  if(nstatsp) *nstatsp = v.nvec;
-  return v.vec;
 }
 
-/** @brief State structure tracking @c disorder-stats */
-struct stats_details {
-  void (*done)(char *data, void *u);
-  void *u;
-  int exited;                           /* subprocess exited */
-  int closed;                           /* pipe close */
-  int wstat;                            /* wait status from subprocess */
-  struct dynstr data[1];                /* data read from pipe */
-};
-
-/** @brief Called when @c disorder-stats may have completed
- * @param d Pointer to state structure
+/** @brief Abort transaction
+ * @param tid Transaction (or NULL)
  *
- * Called from stats_finished() and stats_read().  Only proceeds when the
- * process has terminated and the output is complete.
+ * If @p tid is NULL then nothing happens.
  */
-static void stats_complete(struct stats_details *d) {
-  char *s;
+void trackdb_abort_transaction(DB_TXN *tid) {
+  int err;
 
-  if(!(d->exited && d->closed))
-    return;
-  byte_xasprintf(&s, "\n"
-                 "Server stats:\n"
-                 "track lookup cache hits: %lu\n"
-                 "track lookup cache misses: %lu\n",
-                 cache_files_hits,
-                 cache_files_misses);
-  dynstr_append_string(d->data, s);
-  dynstr_terminate(d->data);
-  d->done(d->data->vec, d->u);
+  if(tid) {
+    if((err = tid->abort(tid)))
+      disorder_fatal(0, "tid->abort: %s", db_strerror(err));
+    transaction_finished();
+    stats_discard();
+  }
 }
 
-/** @brief Called when @c disorder-stats exits
- * @param ev Event loop
- * @param pid Process ID
- * @param status Exit status
- * @param rusage Resource usage
- * @param u Pointer to state structure (@ref stats_details)
- * @return 0
+/** @brief Commit transaction
+ * @param tid Transaction (must not be NULL)
  */
-static int stats_finished(ev_source attribute((unused)) *ev,
-                          pid_t pid,
-                          int status,
-                          const struct rusage attribute((unused)) *rusage,
-                          void *u) {
-  struct stats_details *const d = u;
+void trackdb_commit_transaction(DB_TXN *tid) {
+  int err;
 
-  d->exited = 1;
-  if(status)
-    disorder_error(0, "disorder-stats %s", wstat(status));
-  stats_complete(d);
-  char *k;
-  byte_xasprintf(&k, "%lu", (unsigned long)pid);
-  hash_remove(stats_pids, k);
-  return 0;
+  if((err = tid->commit(tid, 0)))
+    disorder_fatal(0, "tid->commit: %s", db_strerror(err));
+  transaction_finished();
 }
 
-/** @brief Called when pipe from @c disorder-stats is readable
- * @param ev Event loop
- * @param reader Reader state
- * @param ptr Pointer to bytes read
- * @param bytes Number of bytes available
- * @param eof Set at end of file
- * @param u Pointer to state structure (@ref stats_details)
- * @return 0
+/** @brief Count a deadlock
+ * @param operation Name of the operation that must be retried
  */
-static int stats_read(ev_source attribute((unused)) *ev,
-                      ev_reader *reader,
-                      void *ptr,
-                      size_t bytes,
-                      int eof,
-                      void *u) {
-  struct stats_details *const d = u;
+void trackdb_deadlocked(const char *operation) {
+  unsigned long *count, one = 1;
 
-  dynstr_append_bytes(d->data, ptr, bytes);
-  ev_reader_consume(reader, bytes);
-  if(eof)
-    d->closed = 1;
-  stats_complete(d);
-  return 0;
+  if(!deadlock_counts)
+    deadlock_counts = hash_new(sizeof (unsigned long));
+  if((count = hash_find(deadlock_counts, operation)))
+    ++*count;
+  else
+    hash_add(deadlock_counts, operation, &one, HASH_INSERT);
 }
 
-/** @brief Called when pipe from @c disorder-stats errors
- * @param ev Event loop
- * @param errno_value Error code
- * @param u Pointer to state structure (@ref stats_details)
- * @return 0
+/** @brief List operations that have deadlocked
+ * @return NULL-terminated list of operation names
  */
-static int stats_error(ev_source attribute((unused)) *ev,
-                       int errno_value,
-                       void *u) {
-  struct stats_details *const d = u;
+char **trackdb_deadlock_operations(void) {
+  static char *none[] = { NULL };
 
-  disorder_error(errno_value, "error reading from pipe to disorder-stats");
-  d->closed = 1;
-  stats_complete(d);
-  return 0;
+  return deadlock_counts ? hash_keys(deadlock_counts) : none;
 }
 
-/** @brief Get database statistics via background process
- * @param ev Event loop
- * @param done Called on completion
- * @param u Passed to @p done
- *
- * Within the main server use this instead of trackdb_stats(), which can take
- * unreasonably long.
+/** @brief Return the number of times an operation has deadlocked
+ * @param operation Operation name
+ * @return Number of deadlocks
  */
-void trackdb_stats_subprocess(ev_source *ev,
-                              void (*done)(char *data, void *u),
-                              void *u) {
-  int p[2];
-  pid_t pid;
-  struct stats_details *d = xmalloc(sizeof *d);
+unsigned long trackdb_deadlock_count(const char *operation) {
+  const unsigned long *count;
 
-  dynstr_init(d->data);
-  d->done = done;
-  d->u = u;
-  xpipe(p);
-  pid = subprogram(ev, p[1], "disorder-stats", (char *)0);
-  xclose(p[1]);
-  ev_child(ev, pid, 0, stats_finished, d);
-  if(!ev_reader_new(ev, p[0], stats_read, stats_error, d,
-                    "disorder-stats reader"))
-    disorder_fatal(0, "ev_reader_new for disorder-stats reader failed");
-  /* Remember the PID */
-  if(!stats_pids)
-    stats_pids = hash_new(1);
-  char *k;
-  byte_xasprintf(&k, "%lu", (unsigned long)pid);
-  hash_add(stats_pids, k, "", HASH_INSERT);
+  if(!deadlock_counts || !(count = hash_find(deadlock_counts, operation)))
+    return 0;
+  return *count;
 }
 
-/** @brief Parse a track name part preference
- * @param name Preference name
- * @param partp Where to store part name
- * @param contextp Where to store context name
- * @return 0 on success, non-0 if parse fails
+/** @brief Get whole-environment lock statistics
+ * @param waits Where to store the number of lock requests that had to wait
+ * @param deadlocks Where to store the number of deadlocks
+ * @return 0 on success, non-0 on error
+ *
+ * Unlike trackdb_deadlock_count() these cover every process using the
+ * database, including @c disorder-rescan.
  */
-static int trackdb__parse_namepref(const char *name,
-                                   char **partp,
-                                   char **contextp) {
-  char *c;
-  static const char prefix[] = "trackname_";
-  
-  if(strncmp(name, prefix, strlen(prefix)))
-    return -1;                          /* not trackname_* at all */
-  name += strlen(prefix);
-  /* There had better be a _ between context and part */
-  c = strchr(name, '_');
-  if(!c)
-    return -1;
-  /* Context is first in the pref name even though most APIs have the part
-   * first.  Confusing; sorry. */
-  *contextp = xstrndup(name, c - name);
-  ++c;
-  /* There had better NOT be a second _ */
-  if(strchr(c, '_'))
+int trackdb_lock_stats(unsigned long long *waits,
+                       unsigned long long *deadlocks) {
+  DB_LOCK_STAT *ls;
+  int err;
+
+  if((err = trackdb_env->lock_stat(trackdb_env, &ls, 0))) {
+    disorder_error(0, "trackdb_env->lock_stat: %s", db_strerror(err));
     return -1;
-  *partp = xstrdup(c);
+  }
+  *waits = ls->st_lock_wait;
+  *deadlocks = ls->st_ndeadlocks;
+  xfree(ls);
+  return 0;
+}
+
+/* search/tags shared code ***************************************************/
+
+/** @brief Comparison function used by dedupe()
+ * @param a Pointer to first key
+ * @param b Pointer to second key
+ * @return -1, 0 or 1
+ *
+ * Passed to qsort().
+ */
+static int wordcmp(const void *a, const void *b) {
+  return strcmp(*(const char **)a, *(const char **)b);
+}
+
+/** @brief Sort and de-duplicate @p vec
+ * @param vec Vector to sort
+ * @param nvec Length of @p vec
+ * @return @p vec
+ *
+ * The returned vector is NULL-terminated, and there must be room for this NULL
+ * even if there are no duplicates (i.e. it must have more than @p nvec
+ * elements.)
+ */
+static char **dedupe(char **vec, int nvec) {
+  int m, n;
+
+  qsort(vec, nvec, sizeof (char *), wordcmp);
+  m = 0;
+  if(nvec) {
+    vec[m++] = vec[0];
+    for(n = 1; n < nvec; ++n)
+      if(strcmp(vec[n], vec[m - 1]))
+	vec[m++] = vec[n];
+  }
+  vec[m] = 0;
+  return vec;
+}
+
+/** @brief An index update deferred by trackdb_notice_batch() */
+struct index_update {
+  /** @brief Database to update (search or tags) */
+  DB *db;
+
+  /** @brief Database name, for error messages */
+  const char *what;
+
+  /** @brief Word or tag */
+  const char *word;
+
+  /** @brief Track name */
+  const char *track;
+};
+
+VECTOR_TYPE(index_updates, struct index_update, xrealloc);
+
+/** @brief Non-zero to defer index updates to flush_index_updates() */
+static int deferring_index_updates;
+
+/** @brief Index updates deferred by trackdb_notice_batch() */
+static struct index_updates deferred_index_updates;
+
+/** @brief Order index updates by database, then word, then track */
+static int compare_index_updates(const void *av, const void *bv) {
+  const struct index_update *a = av, *b = bv;
+  int c;
+
+  if(a->db != b->db)
+    return a->db == trackdb_searchdb ? -1 : 1;
+  if((c = strcmp(a->word, b->word)))
+    return c;
+  return strcmp(a->track, b->track);
+}
+
+/** @brief Store a key/data pair
+ * @param db Database
+ * @param what Description
+ * @param track Data
+ * @param word Key
+ * @param tid Owning transaction
+ * @return 0 or DB_DEADLOCK
+ *
+ * Used by the search and tags databases, hence the odd parameter names.
+ * See also trackdb_delkeydata().
+ */
+static int register_word(DB *db, const char *what,
+                         const char *track, const char *word,
+                         DB_TXN *tid) {
+  int err;
+  DBT key, data;
+  struct index_update u;
+  long n;
+
+  if(deferring_index_updates) {
+    u.db = db;
+    u.what = what;
+    u.word = word;
+    u.track = track;
+    index_updates_append(&deferred_index_updates, u);
+    return 0;
+  }
+  switch(err = db->put(db, tid, make_key(&key, word),
+                       make_key(&data, track), DB_NODUPDATA)) {
+  case 0:
+    if((err = word_count(db, word, &n, tid)))
+      return err;
+    stats_word_changed(db, word, n, 1);
+    return 0;
+  case DB_KEYEXIST:
+    return 0;
+  case DB_LOCK_DEADLOCK:
+    disorder_error(0, "error updating %s.db: %s", what, db_strerror(err));
+    return err;
+  default:
+    disorder_fatal(0, "error updating %s.db: %s", what,  db_strerror(err));
+  }
+}
+
+/* search primitives *********************************************************/
+
+/** @brief Return true iff @p name is a trackname_display_ pref
+ * @param name Preference name
+ * @return Non-zero iff @p name is a trackname_display_ pref
+ */
+static int is_display_pref(const char *name) {
+  static const char prefix[] = "trackname_display_";
+  return !strncmp(name, prefix, (sizeof prefix) - 1);
+}
+
+/** @brief Word_Break property tailor that treats underscores as spaces
+ * @param c Code point
+ * @return Tailored property or -1 to use standard value
+ *
+ * Passed to utf32_word_split() when splitting a track name into words.
+ * See word_split() and @ref unicode_property_tailor.
+ */
+static int tailor_underscore_Word_Break_Other(uint32_t c) {
+  switch(c) {
+  default:
+    return -1;
+  case 0x005F: /* LOW LINE (SPACING UNDERSCORE) */
+    return unicode_Word_Break_Other;
+  }
+}
+
+/** @brief Remove all combining characters in-place
+ * @param s Pointer to start of string
+ * @param ns Length of string
+ * @return New, possiblby reduced, length
+ */
+static size_t remove_combining_chars(uint32_t *s, size_t ns) {
+  uint32_t *start = s, *t = s, *end = s + ns;
+
+  while(s < end) {
+    const uint32_t c = *s++;
+    if(!utf32_combining_class(c))
+      *t++ = c;
+  }
+  return t - start;
+}
+
+/** @brief Working buffers for fold_string()
+ *
+ * Kept between calls so that normalizing many strings in a row, as rescans
+ * and searches do, doesn't allocate new intermediate strings for each.
+ */
+static struct dynstr_ucs4 fold_in, fold_out, fold_scratch;
+
+/** @brief Case-fold a string and strip combining characters
+ * @param s Input string (UTF-8)
+ * @param ns Length of input string
+ * @param nfp Where to store the length of the result
+ * @return Result, or NULL if @p s is not valid UTF-8
+ *
+ * The result is in @ref fold_out, so only lasts until the next call.
+ */
+static uint32_t *fold_string(const char *s, size_t ns, size_t *nfp) {
+  fold_in.nvec = 0;
+  fold_out.nvec = 0;
+  if(utf8_to_utf32_buf(s, ns, &fold_in)
+     || utf32_casefold_compat_buf(fold_in.vec, fold_in.nvec,
+                                  &fold_out, &fold_scratch)) /* ->NFKD */
+    return 0;
+  *nfp = remove_combining_chars(fold_out.vec, fold_out.nvec);
+  return fold_out.vec;
+}
+
+/** @brief Normalize and split a string using a given tailoring
+ * @param v Where to store words from string
+ * @param s Input string
+ * @param pt Word_Break property tailor, or NULL
+ *
+ * The output words will be:
+ * - case-folded
+ * - have any combination characters stripped
+ * - not include any word break code points (as tailored)
+ *
+ * Used by track_to_words(), with @p pt set to @ref
+ * tailor_underscore_Word_Break_Other, and by normalize_tag() with no
+ * tailoring.
+ */
+static void word_split(struct vector *v,
+                       const char *s,
+                       unicode_property_tailor *pt) {
+  size_t nw, nt32, i;
+  uint32_t *t32, **w32;
+
+  /* Erase case distinctions and drop combining characters */
+  if(!(t32 = fold_string(s, strlen(s), &nt32)))
+    return;
+  /* Split into words, treating _ as a space */
+  w32 = utf32_word_split(t32, nt32, &nw, pt);
+  /* Convert words back to UTF-8 and append to result */
+  for(i = 0; i < nw; ++i)
+    vector_append(v, utf32_to_utf8(w32[i], utf32_len(w32[i]), 0));
+}
+
+/** @brief Normalize a tag
+ * @param s Tag
+ * @param ns Length of tag
+ * @return Normalized string or NULL on error
+ *
+ * The return value will be:
+ * - case-folded
+ * - have no leading or trailing space
+ * - have no combining characters
+ * - all spacing between words will be a single U+0020 SPACE
+ */
+static char *normalize_tag(const char *s, size_t ns) {
+  uint32_t *s32, **w32;
+  size_t ns32, nw32, i;
+  struct dynstr d[1];
+
+  if(!(s32 = fold_string(s, ns, &ns32)))
+    return 0;
+  /* Split into words, no Word_Break tailoring */
+  w32 = utf32_word_split(s32, ns32, &nw32, 0);
+  /* Compose back into a string */
+  dynstr_init(d);
+  for(i = 0; i < nw32; ++i) {
+    if(i)
+      dynstr_append(d, ' ');
+    if(utf32_to_utf8_buf(w32[i], utf32_len(w32[i]), d))
+      return 0;
+  }
+  dynstr_terminate(d);
+  return d->vec;
+}
+
+/** @brief Compute the words of a track name
+ * @param track Track name
+ * @param p Preferences (for display prefs)
+ * @return NULL-terminated, de-duplicated list or words
+ */
+static char **track_to_words(const char *track,
+                             const struct kvp *p) {
+  struct vector v;
+  const char *rootless = track_rootless(track);
+
+  if(!rootless)
+    rootless = track;                   /* bodge */
+  vector_init(&v);
+  rootless = strip_extension(rootless);
+  word_split(&v, strip_extension(rootless), tailor_underscore_Word_Break_Other);
+  for(; p; p = p->next)
+    if(is_display_pref(p->name))
+      word_split(&v, p->value, 0);
+  vector_terminate(&v);
+  return dedupe(v.vec, v.nvec);
+}
+
+/** @brief Format a word list for storage as @c _words
+ * @param w NULL-terminated word list from track_to_words()
+ * @return Space-separated words
+ *
+ * Words never contain spaces, since utf32_word_split() breaks at them.
+ */
+static char *words_to_string(char **w) {
+  struct dynstr d[1];
+
+  dynstr_init(d);
+  for(; *w; ++w) {
+    if(d->nvec)
+      dynstr_append(d, ' ');
+    dynstr_append_string(d, *w);
+  }
+  dynstr_terminate(d);
+  return d->vec;
+}
+
+/** @brief Get the words of a track name
+ * @param track Track name
+ * @param t Track data
+ * @param p Preferences (for display prefs)
+ * @return NULL-terminated, de-duplicated list or words
+ *
+ * The words are stored in @c _words when the track is noticed, and updated
+ * when its display preferences change, so normally they need not be
+ * computed again.  Tracks noticed by older versions don't have them.
+ */
+static char **track_words(const char *track,
+                          const struct kvp *t,
+                          const struct kvp *p) {
+  const char *s = kvp_get(t, "_words");
+  struct vector v;
+  const char *sp;
+
+  if(!s)
+    return track_to_words(track, p);
+  vector_init(&v);
+  while(*s) {
+    if(!(sp = strchr(s, ' ')))
+      sp = s + strlen(s);
+    vector_append(&v, xstrndup(s, sp - s));
+    s = *sp ? sp + 1 : sp;
+  }
+  vector_terminate(&v);
+  return v.vec;
+}
+
+/** @brief Test for a stopword
+ * @param word Word
+ * @return Non-zero if @p word is a stopword
+ */
+static int stopword(const char *word) {
+  int n;
+
+  for(n = 0; n < config->stopword.n
+        && strcmp(word, config->stopword.s[n]); ++n)
+    ;
+  return n < config->stopword.n;
+}
+
+/** @brief Split a word into trigrams
+ * @param v Where to put the trigrams
+ * @param word A key of @ref trackdb_wordsdb
+ *
+ * The word is padded with a space at each end, so that its first and last
+ * letters have trigrams of their own and even a one-letter word has one.
+ * Trigrams are of characters rather than bytes.  Each distinct trigram is
+ * reported once.
+ */
+static void word_trigrams(struct vector *v, const char *word) {
+  uint32_t *w32, *padded;
+  size_t nw32, n;
+  char *t;
+  int i;
+
+  vector_init(v);
+  if(!(w32 = utf8_to_utf32(word, strlen(word), &nw32)))
+    return;
+  padded = xmalloc_noptr((nw32 + 2) * sizeof *padded);
+  padded[0] = ' ';
+  memcpy(padded + 1, w32, nw32 * sizeof *w32);
+  padded[nw32 + 1] = ' ';
+  for(n = 0; n + 3 <= nw32 + 2; ++n) {
+    if(!(t = utf32_to_utf8(padded + n, 3, 0)))
+      continue;
+    for(i = 0; i < v->nvec && strcmp(v->vec[i], t); ++i)
+      ;
+    if(i == v->nvec)
+      vector_append(v, t);
+  }
+}
+
+/** @brief Record a word's trigrams for fuzzy searches
+ * @param word A key of @ref trackdb_wordsdb
+ * @param tid Owning transaction
+ * @return 0 or DB_LOCK_DEADLOCK
+ */
+static int register_trigrams(const char *word, DB_TXN *tid) {
+  struct vector v;
+  DBT key, data;
+  int n, err;
+
+  word_trigrams(&v, word);
+  for(n = 0; n < v.nvec; ++n)
+    switch(err = trackdb_trigramsdb->put(trackdb_trigramsdb, tid,
+                                         make_key(&key, v.vec[n]),
+                                         make_key(&data, word),
+                                         DB_NODUPDATA)) {
+    case 0:
+    case DB_KEYEXIST:
+      break;
+    case DB_LOCK_DEADLOCK:
+      disorder_error(0, "error updating trigrams.db: %s", db_strerror(err));
+      return err;
+    default:
+      disorder_fatal(0, "error updating trigrams.db: %s", db_strerror(err));
+    }
+  return 0;
+}
+
+/** @brief Forget a word's trigrams
+ * @param word A word no longer in @ref trackdb_wordsdb
+ * @param tid Owning transaction
+ * @return 0 or DB_LOCK_DEADLOCK
+ */
+static int unregister_trigrams(const char *word, DB_TXN *tid) {
+  struct vector v;
+  int n, err;
+
+  word_trigrams(&v, word);
+  for(n = 0; n < v.nvec; ++n)
+    if((err = trackdb_delkeydata(trackdb_trigramsdb, v.vec[n], word, tid))
+       == DB_LOCK_DEADLOCK)
+      return err;
+  return 0;
+}
+
+/** @brief Record a word for prefix and fuzzy searches
+ * @param word A key of @ref trackdb_searchdb
+ * @param tid Owning transaction
+ * @return 0 or DB_LOCK_DEADLOCK
+ */
+static int register_prefix_word(const char *word, DB_TXN *tid) {
+  int err;
+  DBT key, data;
+
+  switch(err = trackdb_wordsdb->put(trackdb_wordsdb, tid,
+                                    make_key(&key, word),
+                                    make_key(&data, ""), DB_NOOVERWRITE)) {
+  case 0:
+    return register_trigrams(word, tid);
+  case DB_KEYEXIST:
+    return 0;
+  case DB_LOCK_DEADLOCK:
+    disorder_error(0, "error updating words.db: %s", db_strerror(err));
+    return err;
+  default:
+    disorder_fatal(0, "error updating words.db: %s", db_strerror(err));
+  }
+}
+
+/** @brief Make the index updates deferred during a batch of notices
+ * @param tid Owning transaction
+ * @return 0 or DB_LOCK_DEADLOCK
+ *
+ * The updates are sorted first, so that all the tracks for each word are
+ * added together, and duplicates are made only once.
+ */
+static int flush_index_updates(DB_TXN *tid) {
+  struct index_update *u = deferred_index_updates.vec, *prev = 0;
+  int n, err;
+
+  deferring_index_updates = 0;
+  qsort(u, deferred_index_updates.nvec, sizeof *u, compare_index_updates);
+  for(n = 0; n < deferred_index_updates.nvec; prev = &u[n++]) {
+    if(prev && !compare_index_updates(prev, &u[n]))
+      continue;
+    if((err = register_word(u[n].db, u[n].what, u[n].track, u[n].word, tid)))
+      return err;
+    if(u[n].db == trackdb_searchdb
+       && !(prev && prev->db == u[n].db && !strcmp(prev->word, u[n].word))
+       && (err = register_prefix_word(u[n].word, tid)))
+      return err;
+  }
+  return stats_flush(tid);
+}
+
+/** @brief Register a search term
+ * @param track Track name
+ * @param word A word that appears in the name of @p track
+ * @param tid Owning transaction
+ * @return  0 or DB_LOCK_DEADLOCK
+ */
+static int register_search_word(const char *track, const char *word,
+                                DB_TXN *tid) {
+  int err;
+
+  if(stopword(word)) return 0;
+  if((err = register_word(trackdb_searchdb, "search", track, word, tid)))
+    return err;
+  if(deferring_index_updates)
+    return 0;                           /* flush_index_updates() does it */
+  return register_prefix_word(word, tid);
+}
+
+/** @brief Unregister a search term
+ * @param track Track name
+ * @param word A word that appeared in the name of @p track
+ * @param tid Owning transaction
+ * @return 0 or DB_LOCK_DEADLOCK
+ *
+ * If no other track has the word it is forgotten for prefix and fuzzy
+ * searches too.
+ */
+static int unregister_search_word(const char *track, const char *word,
+                                  DB_TXN *tid) {
+  int err;
+  long n;
+
+  int removed;
+
+  if((err = trackdb_delkeydata(trackdb_searchdb,
+                               word, track, tid)) == DB_LOCK_DEADLOCK)
+    return err;
+  removed = !err;
+  if((err = word_count(trackdb_searchdb, word, &n, tid)))
+    return err;
+  if(removed)
+    stats_word_changed(trackdb_searchdb, word, n, -1);
+  if(n)
+    return 0;
+  if((err = trackdb_delkey(trackdb_wordsdb, word, tid)))
+    return err;
+  return unregister_trigrams(word, tid);
+}
+
+/** @brief Test whether an index is empty
+ * @param db Database
+ * @param name Database name, for error messages
+ * @param emptyp Where to store the answer
+ * @param tid Owning transaction
+ * @return 0 or DB_LOCK_DEADLOCK
+ */
+static int index_empty(DB *db, const char *name, int *emptyp, DB_TXN *tid) {
+  DBC *cursor;
+  DBT k, d;
+  int err;
+
+  cursor = trackdb_opencursor(db, tid);
+  err = cursor->c_get(cursor, prepare_data(&k), prepare_data(&d), DB_FIRST);
+  if(trackdb_closecursor(cursor)) err = DB_LOCK_DEADLOCK;
+  switch(err) {
+  case 0:
+    *emptyp = 0;
+    return 0;
+  case DB_NOTFOUND:
+    *emptyp = 1;
+    return 0;
+  case DB_LOCK_DEADLOCK:
+    disorder_error(0, "error querying %s: %s", name, db_strerror(err));
+    return err;
+  default:
+    disorder_fatal(0, "error querying %s: %s", name, db_strerror(err));
+  }
+}
+
+/** @brief Fill in @ref trackdb_wordsdb from @ref trackdb_searchdb
+ * @param tid Owning transaction
+ * @return 0 or DB_LOCK_DEADLOCK
+ *
+ * Does nothing unless words.db is empty, which is the case when the rest of
+ * the database predates it.
+ */
+static int fill_prefix_words(DB_TXN *tid) {
+  struct vector v[1];
+  int err, n, empty;
+
+  if((err = index_empty(trackdb_wordsdb, "words.db", &empty, tid)))
+    return err;
+  if(!empty)
+    return 0;
+  vector_init(v);
+  if((err = trackdb_listkeys(trackdb_searchdb, v, tid)))
+    return err;
+  for(n = 0; n < v->nvec; ++n)
+    if((err = register_prefix_word(v->vec[n], tid)))
+      return err;
+  if(v->nvec)
+    disorder_info("recorded %d words for prefix searches", v->nvec);
+  return 0;
+}
+
+/** @brief Fill in @ref trackdb_trigramsdb from @ref trackdb_wordsdb
+ * @param tid Owning transaction
+ * @return 0 or DB_LOCK_DEADLOCK
+ *
+ * Does nothing unless trigrams.db is empty, which is the case when the rest
+ * of the database predates it.
+ */
+static int fill_trigrams(DB_TXN *tid) {
+  struct vector v[1];
+  int err, n, empty;
+
+  if((err = index_empty(trackdb_trigramsdb, "trigrams.db", &empty, tid)))
+    return err;
+  if(!empty)
+    return 0;
+  vector_init(v);
+  if((err = trackdb_listkeys(trackdb_wordsdb, v, tid)))
+    return err;
+  for(n = 0; n < v->nvec; ++n)
+    if((err = register_trigrams(v->vec[n], tid)))
+      return err;
+  if(v->nvec)
+    disorder_info("recorded trigrams of %d words for fuzzy searches",
+                  v->nvec);
+  return 0;
+}
+
+/* Tags **********************************************************************/
+
+/** @brief Test for tag characters
+ * @param c Character
+ * @return Non-zero if @p c is a tag character
+ *
+ * The current rule is that commas and the control characters 0-31 are not
+ * allowed but anything else is permitted.  This is arguably a bit loose.
+ */
+static int tagchar(int c) {
+  switch(c) {
+  case ',':
+    return 0;
+  default:
+    return c >= ' ';
+  }
+}
+
+/** @brief Parse a tag list
+ * @param s Tag list or NULL (equivalent to "")
+ * @return Parsed tag list
+ *
+ * The tags will be normalized (as per normalize_tag()) and de-duplicated.
+ */
+char **parsetags(const char *s) {
+  const char *t;
+  struct vector v;
+
+  vector_init(&v);
+  if(s) {
+    /* skip initial separators */
+    while(*s && (!tagchar(*s) || *s == ' '))
+      ++s;
+    while(*s) {
+      /* find the extent of the tag */
+      t = s;
+      while(*s && tagchar(*s))
+        ++s;
+      /* strip trailing spaces */
+      while(s > t && s[-1] == ' ')
+        --s;
+      /* add tag to list */
+      vector_append(&v, normalize_tag(t, (size_t)(s - t)));
+      /* skip intermediate and trailing separators */
+      while(*s && (!tagchar(*s) || *s == ' '))
+        ++s;
+    }
+  }
+  vector_terminate(&v);
+  return dedupe(v.vec, v.nvec);
+}
+
+/** @brief Register a tag
+ * @param track Track name
+ * @param tag Tag name
+ * @param tid Owning transaction
+ * @return 0 or DB_LOCK_DEADLOCK
+ */
+static int register_tag(const char *track, const char *tag, DB_TXN *tid) {
+  return register_word(trackdb_tagsdb, "tags", track, tag, tid);
+}
+
+/** @brief Unregister a tag
+ * @param track Track name
+ * @param tag Tag name
+ * @param tid Owning transaction
+ * @return 0 or DB_LOCK_DEADLOCK
+ */
+static int unregister_tag(const char *track, const char *tag, DB_TXN *tid) {
+  int err;
+  long n;
+
+  switch(err = trackdb_delkeydata(trackdb_tagsdb, tag, track, tid)) {
+  case 0:
+    if((err = word_count(trackdb_tagsdb, tag, &n, tid)))
+      return err;
+    stats_word_changed(trackdb_tagsdb, tag, n, -1);
+    return 0;
+  case DB_LOCK_DEADLOCK:
+    return err;
+  default:
+    return 0;
+  }
+}
+
+/** @brief Compute the tag bitmap for a list of tags
+ * @param tags NULL-terminated list of normalized tags
+ * @param assign Non-zero to give new tags an ID
+ * @param bitsp Where to store bitmap
+ * @param tid Owning transaction
+ * @return 0 or DB_LOCK_DEADLOCK
+ *
+ * Each tag ever seen has a small integer ID, kept in the @c _tag_ids global
+ * preference.  Bit @c n of the bitmap is set if the tag with ID @c n is
+ * present.  The bitmap is a string of hex digits, with IDs 0 to 3 in the
+ * first digit, 4 to 7 in the second and so on.  See tag_bits_intersect().
+ *
+ * If @p assign is 0 then tags without an ID are ignored.
+ */
+static int tag_bits(char **tags, int assign, char **bitsp, DB_TXN *tid) {
+  const char *s, *id;
+  struct kvp *ids, *k;
+  char *bits, buf[32];
+  long *tv, len = 0;
+  int err, n, nids = 0, changed = 0;
+
+  if((err = trackdb_get_global_tid("_tag_ids", tid, &s)))
+    return err;
+  ids = s ? kvp_urldecode(s, strlen(s)) : 0;
+  for(k = ids; k; k = k->next)
+    ++nids;
+  for(n = 0; tags[n]; ++n)
+    ;
+  tv = xmalloc_noptr((n + 1) * sizeof *tv);
+  for(n = 0; tags[n]; ++n) {
+    if(!(id = kvp_get(ids, tags[n]))) {
+      if(!assign) {
+        tv[n] = -1;
+        continue;
+      }
+      snprintf(buf, sizeof buf, "%d", nids++);
+      kvp_set(&ids, tags[n], buf);
+      id = buf;
+      changed = 1;
+    }
+    tv[n] = atol(id);
+    if(tv[n] / 4 + 1 > len)
+      len = tv[n] / 4 + 1;
+  }
+  if(changed && (err = trackdb_set_global_tid("_tag_ids",
+                                              kvp_urlencode(ids, 0), tid)))
+    return err;
+  bits = xmalloc_noptr(len + 1);
+  memset(bits, '0', len);
+  bits[len] = 0;
+  for(n = 0; tags[n]; ++n)
+    if(tv[n] >= 0)
+      bits[tv[n] / 4] = "0123456789abcdef"[unhexdigit(bits[tv[n] / 4])
+                                           | 1 << (tv[n] % 4)];
+  *bitsp = bits;
+  return 0;
+}
+
+/** @brief Compute the tag bitmap for a list of existing tags
+ * @param tags NULL-terminated list of normalized tags
+ * @param bitsp Where to store bitmap
+ * @param tid Owning transaction
+ * @return 0 or DB_LOCK_DEADLOCK
+ *
+ * Tags that no track has ever had are left out.  The result can be compared
+ * against the @c _tagbits value of tracks using tag_bits_intersect().
+ */
+int trackdb_tag_bits(char **tags, char **bitsp, DB_TXN *tid) {
+  return tag_bits(tags, 0, bitsp, tid);
+}
+
+/** @brief Test whether two tag bitmaps have any tags in common
+ * @param a First bitmap
+ * @param b Second bitmap
+ * @return 1 if @p a and @p b have at least one tag in common
+ *
+ * The bitmaps come from trackdb_tag_bits() or the @c _tagbits value of
+ * tracks.  This is the bitmap equivalent of tag_intersection().
+ */
+int tag_bits_intersect(const char *a, const char *b) {
+  for(; *a && *b; ++a, ++b)
+    if(unhexdigit(*a) & unhexdigit(*b))
+      return 1;
+  return 0;
+}
+
+/* aliases *******************************************************************/
+
+/** @brief Compute an alias
+ * @param aliasp Where to put alias (gets NULL if none)
+ * @param track Track to find alias for
+ * @param p Prefs for @p track
+ * @param tid Owning transaction
+ * @return 0 or DB_LOCK_DEADLOCK
+ *
+ * This function looks up the track name parts for @p track.  By default these
+ * amount to the original values from the track name but are overridden by
+ * preferences.
+ *
+ * These values are then substituted into the pattern defined by the @b alias
+ * command; see disorder_config(5) for the syntax.
+ *
+ * The track is only considered to have an alias if all of the following are
+ * true:
+ * - a preference was used for at least one name part
+ * - the result differs from the original track name
+ * - the result does not match any existing track or alias
+ */
+static int compute_alias(char **aliasp,
+                         const char *track,
+                         const struct kvp *p,
+                         DB_TXN *tid) {
+  struct dynstr d;
+  const char *s = config->alias, *t, *expansion, *part;
+  int c, used_db = 0, slash_prefix, err;
+  struct kvp *at;
+  struct kvp_index pi;
+  const char *const root = find_track_root(track);
+
+  if(!root) {
+    /* Bodge for tracks with no root */
+    *aliasp = 0;
+    return 0;
+  }
+  /* Each part of the alias is a lookup in the preferences */
+  kvp_index_init(&pi, p);
+  dynstr_init(&d);
+  dynstr_append_string(&d, root);
+  while((c = (unsigned char)*s++)) {
+    if(c != '{') {
+      dynstr_append(&d, c);
+      continue;
+    }
+    if((slash_prefix = (*s == '/')))
+      s++;
+    t = strchr(s, '}');
+    assert(t != 0);			/* validated at startup */
+    part = xstrndup(s, t - s);
+    expansion = getpart(track, "display", part, p, &pi, &used_db);
+    if(*expansion) {
+      if(slash_prefix) dynstr_append(&d, '/');
+      dynstr_append_string(&d, expansion);
+    }
+    s = t + 1;				/* skip {part} */
+  }
+  /* only admit to the alias if we used the db... */
+  if(!used_db) {
+    *aliasp = 0;
+    return 0;
+  }
+  dynstr_terminate(&d);
+  /* ...and the answer differs from the original... */
+  if(!strcmp(track, d.vec)) {
+    *aliasp = 0;
+    return 0;
+  }
+  /* ...and there isn't already a different track with that name (including as
+   * an alias) */
+  switch(err = trackdb_getdata(trackdb_tracksdb, d.vec, &at, tid)) {
+  case 0:
+    if((s = kvp_get(at, "_alias_for"))
+       && !strcmp(s, track)) {
+    case DB_NOTFOUND:
+      *aliasp = d.vec;
+    } else {
+      *aliasp = 0;
+    }
+    return 0;
+  default:
+    *aliasp = 0;
+    return err;
+  }
+}
+
+/** @brief Assert that no alias is allowed for gettrackdata() */
+#define GTD_NOALIAS 0x0001
+
+/** @brief Get all track data
+ * @param track Track to look up; aliases allowed unless @ref GTD_NOALIAS
+ * @param tp Where to put track data (if not NULL)
+ * @param pp Where to put preferences (if not NULL)
+ * @param actualp Where to put real (i.e. non-alias) path (if not NULL)
+ * @param flags Flag values, see below
+ * @param tid Owning transaction
+ * @return 0, DB_NOTFOUND (track doesn't exist) or DB_LOCK_DEADLOCK
+ *
+ * Possible flags values are:
+ * - @ref GTD_NOALIAS to assert that an alias is not allowed
+ *
+ * The return values are always set (even if to NULL).
+ */
+static int gettrackdata(const char *track,
+                        struct kvp **tp,
+                        struct kvp **pp,
+                        const char **actualp,
+                        unsigned flags,
+                        DB_TXN *tid) {
+  int err;
+  const char *actual = track;
+  struct kvp *t = 0, *p = 0;
+
+  if(!track_filter_test(track)) {
+    err = DB_NOTFOUND;
+    goto done;
+  }
+  if((err = trackdb_getdata(trackdb_tracksdb, track, &t, tid))) goto done;
+  if((actual = kvp_get(t, "_alias_for"))) {
+    if(flags & GTD_NOALIAS) {
+      disorder_error(0,
+                     "alias passed to gettrackdata where real path required");
+      abort();
+    }
+    if((err = trackdb_getdata(trackdb_tracksdb, actual, &t, tid))) goto done;
+  } else
+    actual = track;
+  assert(actual != 0);
+  if(pp) {
+    if((err = trackdb_getdata(trackdb_prefsdb, actual, &p, tid)) == DB_LOCK_DEADLOCK)
+      goto done;
+  }
+  err = 0;
+done:
+  if(actualp) *actualp = actual;
+  if(tp) *tp = t;
+  if(pp) *pp = p;
+  return err;
+}
+
+/* trackdb_notice() **********************************************************/
+
+/** @brief Notice a possibly new track
+ * @param track NFC UTF-8 track name
+ * @param path Raw path name (i.e. the bytes that came out of readdir())
+ * @return @c DB_NOTFOUND if new, 0 if already known
+ *
+ * @c disorder-rescan is responsible for normalizing the track name.
+ */
+int trackdb_notice(const char *track,
+                   const char *path) {
+  int err;
+  DB_TXN *tid;
+
+  for(;;) {
+    tid = trackdb_begin_transaction();
+    err = trackdb_notice_tid(track, path, 0, tid);
+    if(err == DB_LOCK_DEADLOCK) goto fail;
+    break;
+  fail:
+    trackdb_abort_transaction(tid);
+    trackdb_deadlocked(__func__);
+  }
+  trackdb_commit_transaction(tid);
+  return err;
+}
+
+/** @brief Notice a batch of possibly new tracks
+ * @param ntracks Number of tracks
+ * @param tracks NFC UTF-8 track names
+ * @param paths Raw path names
+ * @param sigs Stat signatures from trackdb_stat_signature() (entries may be
+ * NULL)
+ * @return Number of new tracks
+ *
+ * All the tracks are noticed in a single transaction, which is much cheaper
+ * than one each, and the search and tag database updates are deferred and
+ * made in order at the end.  If the transaction deadlocks then just this
+ * batch is retried.
+ */
+long trackdb_notice_batch(int ntracks, char **tracks, char **paths,
+                          char **sigs) {
+  int err, n;
+  long nnew;
+  DB_TXN *tid;
+
+  for(;;) {
+    tid = trackdb_begin_transaction();
+    nnew = 0;
+    index_updates_init(&deferred_index_updates);
+    deferring_index_updates = 1;
+    for(n = 0; n < ntracks; ++n) {
+      err = trackdb_notice_tid(tracks[n], paths[n], sigs[n], tid);
+      if(err == DB_LOCK_DEADLOCK) goto fail;
+      nnew += !!err;
+    }
+    if(flush_index_updates(tid)) goto fail;
+    break;
+  fail:
+    deferring_index_updates = 0;
+    trackdb_abort_transaction(tid);
+    trackdb_deadlocked(__func__);
+    disorder_info("retrying batch of %d tracks", ntracks);
+  }
+  trackdb_commit_transaction(tid);
+  index_updates_init(&deferred_index_updates);
+  return nnew;
+}
+
+/** @brief Notice a possibly new track
+ * @param track NFC UTF-8 track name
+ * @param path Raw path name (i.e. the bytes that came out of readdir())
+ * @param sig Stat signature from trackdb_stat_signature(), or NULL
+ * @param tid Owning transaction
+ * @return @c DB_NOTFOUND if new, 0 if already known, @c DB_LOCK_DEADLOCK also
+ *
+ * @c disorder-rescan is responsible for normalizing the track name.
+ *
+ * If @p sig matches the signature recorded when the track was last noticed
+ * then nothing about it can have changed, and it is not examined any
+ * further.  If it doesn't match then the file has been modified and any
+ * recorded length is discarded, so that the next recheck will recompute it.
+ *
+ * The track's search words are stored in @c _words so that searches need not
+ * compute them again.
+ */
+int trackdb_notice_tid(const char *track,
+                       const char *path,
+                       const char *sig,
+                       DB_TXN *tid) {
+  int err, n;
+  struct kvp *t, *a, *p;
+  int t_changed, ret;
+  char *alias, **w, *noticed, *bits;
+  const char *oldsig;
+  time_t now;
+
+  /* notice whether the tracks.db entry changes */
+  t_changed = 0;
+  /* get any existing tracks entry */
+  if((err = gettrackdata(track, &t, &p, 0, 0, tid)) == DB_LOCK_DEADLOCK)
+    return err;
+  ret = err;                            /* 0 or DB_NOTFOUND */
+  if(sig && ret == 0 && (oldsig = kvp_get(t, "_stat"))) {
+    const char *oldpath = kvp_get(t, "_path");
+
+    /* tracks noticed before _words existed are examined once more */
+    if(!strcmp(oldsig, sig) && oldpath && !strcmp(oldpath, path)
+       && kvp_get(t, "_words"))
+      return 0;                         /* unchanged since last time */
+    /* the file has changed so its length and loudness may have too */
+    if(kvp_get(t, "_length"))
+      trackdb_length_changed(track, kvp_get(t, "_length"), 0);
+    t_changed += kvp_set(&t, "_length", 0);
+    t_changed += kvp_set(&t, "_nolength", 0);
+    t_changed += kvp_set(&t, "_loudness", 0);
+    t_changed += kvp_set(&t, "_noloudness", 0);
+  }
+  /* this is a real track */
+  t_changed += kvp_set(&t, "_alias_for", 0);
+  t_changed += kvp_set(&t, "_path", path);
+  if(sig)
+    t_changed += kvp_set(&t, "_stat", sig);
+  xtime(&now);
+  if(ret == DB_NOTFOUND) {
+    /* It's a new track; record the time */
+    ++trackdb_generation;
+    ++stats_pending.tracks;
+    dirs_change(track, 1, 0, 1);
+    byte_xasprintf(&noticed, "%lld", (long long)now);
+    t_changed += kvp_set(&t, "_noticed", noticed);
+  }
+  /* if we have an alias record it in the database */
+  if((err = compute_alias(&alias, track, p, tid))) return err;
+  if(alias) {
+    /* won't overwrite someone else's alias as compute_alias() checks */
+    D(("%s: alias %s", track, alias));
+    a = 0;
+    kvp_set(&a, "_alias_for", track);
+    if((err = trackdb_putdata(trackdb_tracksdb, alias, a, tid, 0))) return err;
+  }
+  /* update search.db */
+  w = track_to_words(track, p);
+  t_changed += kvp_set(&t, "_words", words_to_string(w));
+  for(n = 0; w[n]; ++n)
+    if((err = register_search_word(track, w[n], tid)))
+      return err;
+  /* update tags.db */
+  w = parsetags(kvp_get(p, "tags"));
+  for(n = 0; w[n]; ++n)
+    if((err = register_tag(track, w[n], tid)))
+      return err;
+  if((err = tag_bits(w, 1, &bits, tid)))
+    return err;
+  t_changed += kvp_set(&t, "_tagbits", bits);
+  /* only store the tracks.db entry if it has changed */
+  if(t_changed && (err = trackdb_putdata(trackdb_tracksdb, track, t, tid, 0)))
+    return err;
+  if(ret == DB_NOTFOUND) {
+    uint32_t timestamp[2];
+    DBT key, data;
+
+    timestamp[0] = htonl((uint64_t)now >> 32);
+    timestamp[1] = htonl((uint32_t)now);
+    memset(&key, 0, sizeof key);
+    key.data = timestamp;
+    key.size = sizeof timestamp;
+    switch(err = trackdb_noticeddb->put(trackdb_noticeddb, tid, &key,
+                                        make_key(&data, track), 0)) {
+    case 0: break;
+    case DB_LOCK_DEADLOCK: return err;
+    default:
+      disorder_fatal(0, "error updating noticed.db: %s", db_strerror(err));
+    }
+  }
+  /* flush_index_updates() does it for a batch */
+  if(!deferring_index_updates && (err = stats_flush(tid)))
+    return err;
+  return ret;
+}
+
+/** @brief Compute a file's stat signature
+ * @param path Raw path name
+ * @return Signature, or NULL if @p path cannot be examined
+ *
+ * The signature changes whenever the file is modified or replaced.
+ */
+char *trackdb_stat_signature(const char *path) {
+  struct stat sb;
+  char *sig;
+
+  if(stat(path, &sb) < 0)
+    return 0;
+  byte_xasprintf(&sig, "%llu %lld %llu %llu",
+                 (unsigned long long)sb.st_size,
+                 (long long)sb.st_mtime,
+                 (unsigned long long)sb.st_ino,
+                 (unsigned long long)sb.st_dev);
+  return sig;
+}
+
+/* trackdb_obsolete() ********************************************************/
+
+/** @brief Obsolete a track
+ * @param track Track name
+ * @param tid Owning transaction
+ * @return 0 or DB_LOCK_DEADLOCK
+ *
+ * Discards a track from the database when it's known not to exist any more.
+ * Returns 0 even if it wasn't recorded.
+ */
+int trackdb_obsolete(const char *track, DB_TXN *tid) {
+  int err, n;
+  struct kvp *t, *p;
+  char *alias, **w;
+  const char *length;
+
+  if((err = gettrackdata(track, &t, &p, 0,
+                         GTD_NOALIAS, tid)) == DB_LOCK_DEADLOCK)
+    return err;
+  else if(err == DB_NOTFOUND) return 0;
+  ++trackdb_generation;
+  --stats_pending.tracks;
+  if((length = kvp_get(t, "_length")))
+    dirs_change(track, -1, -atol(length), 0);
+  else
+    dirs_change(track, -1, 0, -1);
+  /* compute the alias, if any, and delete it */
+  if((err = compute_alias(&alias, track, p, tid))) return err;
+  if(alias) {
+    /* if the alias points to some other track then compute_alias won't
+     * return it */
+    if((err = trackdb_delkey(trackdb_tracksdb, alias, tid))
+       && err != DB_NOTFOUND)
+      return err;
+  }
+  /* update search.db */
+  w = track_words(track, t, p);
+  for(n = 0; w[n]; ++n)
+    if((err = unregister_search_word(track, w[n], tid)))
+      return err;
+  /* update tags.db */
+  w = parsetags(kvp_get(p, "tags"));
+  for(n = 0; w[n]; ++n)
+    if((err = unregister_tag(track, w[n], tid)))
+      return err;
+  /* update tracks.db */
+  if((err = trackdb_delkey(trackdb_tracksdb, track, tid)) == DB_LOCK_DEADLOCK)
+    return err;
+  /* We don't delete the prefs, so they survive temporary outages of the
+   * (possibly virtual) track filesystem */
+  return stats_flush(tid);
+}
+
+/* trackdb_stats() ***********************************************************/
+
+/** @brief Format the stored library statistics
+ * @param nstatsp Where to store number of lines (or NULL)
+ * @param tid Owning transaction
+ * @param statsp Where to store statistics, or NULL if there are none
+ * @return 0 or DB_LOCK_DEADLOCK
+ */
+static int stats_format(int *nstatsp, DB_TXN *tid, char ***statsp) {
+  const char *s, *ls;
+  const struct kvp *counts, *k;
+  struct vector v;
+  char *str;
+  int err, n;
+
+  *statsp = 0;
+  if((err = trackdb_get_global_tid("_stats", tid, &s))
+     || (err = trackdb_get_global_tid("_stats_league", tid, &ls)))
+    return err;
+  if(!s)
+    return 0;
+  counts = kvp_urldecode(s, strlen(s));
+  vector_init(&v);
+  byte_xasprintf(&str, "Tracks: %ld", stats_counter(counts, "tracks"));
+  vector_append(&v, str);
+  byte_xasprintf(&str, "Search words: %ld", stats_counter(counts, "words"));
+  vector_append(&v, str);
+  byte_xasprintf(&str, "Tags: %ld", stats_counter(counts, "tags"));
+  vector_append(&v, str);
+  vector_append(&v, (char *)"");
+  k = ls ? kvp_urldecode(ls, strlen(ls)) : 0;
+  for(n = 0; k && n < STATS_LEAGUE_SHOWN; k = k->next)
+    ++n;
+  byte_xasprintf(&str, "Top %d search words:", n);
+  vector_append(&v, str);
+  k = ls ? kvp_urldecode(ls, strlen(ls)) : 0;
+  for(n = 0; k && n < STATS_LEAGUE_SHOWN; k = k->next, ++n) {
+    byte_xasprintf(&str, "%4d: %5ld %s", n + 1, atol(k->value), k->name);
+    vector_append(&v, str);
+  }
+  vector_terminate(&v);
+  if(nstatsp) *nstatsp = v.nvec;
+  *statsp = v.vec;
+  return 0;
+}
+
+/** @brief Return library statistics if they are already known
+ * @param nstatsp Where to store number of lines (or NULL)
+ * @return Statistics, or NULL if they must be counted first
+ *
+ * The counters are maintained as tracks are noticed and obsoleted, so this
+ * is quick enough for the server to call directly.  If it returns NULL use
+ * trackdb_stats_subprocess() instead.
+ */
+char **trackdb_stats_quick(int *nstatsp) {
+  DB_TXN *tid;
+  char **stats;
+
+  for(;;) {
+    tid = trackdb_begin_read_transaction();
+    if(!stats_format(nstatsp, tid, &stats))
+      break;
+    trackdb_abort_transaction(tid);
+  }
+  trackdb_commit_transaction(tid);
+  return stats;
+}
+
+/** @brief Return library statistics, counting them if necessary
+ * @param nstatsp Where to store number of lines (or NULL)
+ * @return Statistics output
+ *
+ * This is called by @c disorder-stats.  Don't call it directly from elsewhere
+ * as counting the statistics from scratch can take unreasonably long.
+ */
+char **trackdb_stats(int *nstatsp) {
+  DB_TXN *tid;
+  char **stats;
+
+  for(;;) {
+    tid = trackdb_begin_transaction();
+    if(stats_format(nstatsp, tid, &stats))
+      goto fail;
+    if(!stats && (stats_recount(tid) || stats_format(nstatsp, tid, &stats)))
+      goto fail;
+    break;
+fail:
+    trackdb_abort_transaction(tid);
+  }
+  trackdb_commit_transaction(tid);
+  return stats;
+}
+
+/** @brief Format a cache hit ratio
+ * @param hits Number of hits
+ * @param misses Number of misses
+ * @return Percentage to one decimal place
+ */
+static char *hit_ratio(unsigned long long hits, unsigned long long misses) {
+  unsigned long long permille;
+  char *s;
+
+  permille = hits + misses ? hits * 1000 / (hits + misses) : 0;
+  byte_xasprintf(&s, "%llu.%llu%%", permille / 10, permille % 10);
+  return s;
+}
+
+/** @brief Return database environment statistics
+ * @param nstatsp Where to store number of lines (or NULL)
+ * @return Statistics, or NULL on error
+ *
+ * Unlike trackdb_stats() this is quick, so the server can call it directly.
+ */
+char **trackdb_env_stats(int *nstatsp) {
+  DB_MPOOL_STAT *ms;
+  DB_MPOOL_FSTAT **fs;
+  DB_LOCK_STAT *ls;
+  struct vector v;
+  char *s;
+  int err, n;
+  unsigned long long log_size, log_pending_bytes;
+  long recovery;
+
+  if((err = trackdb_env->memp_stat(trackdb_env, &ms, &fs, 0))) {
+    disorder_error(0, "trackdb_env->memp_stat: %s", db_strerror(err));
+    return 0;
+  }
+  if((err = trackdb_env->lock_stat(trackdb_env, &ls, 0))) {
+    disorder_error(0, "trackdb_env->lock_stat: %s", db_strerror(err));
+    return 0;
+  }
+  vector_init(&v);
+  byte_xasprintf(&s, "cache size: %llu kbytes",
+                 (unsigned long long)ms->st_gbytes * 1048576
+                 + ms->st_bytes / 1024);
+  vector_append(&v, s);
+  byte_xasprintf(&s, "cache hits: %llu",
+                 (unsigned long long)ms->st_cache_hit);
+  vector_append(&v, s);
+  byte_xasprintf(&s, "cache misses: %llu",
+                 (unsigned long long)ms->st_cache_miss);
+  vector_append(&v, s);
+  byte_xasprintf(&s, "cache hit ratio: %s",
+                 hit_ratio(ms->st_cache_hit, ms->st_cache_miss));
+  vector_append(&v, s);
+  byte_xasprintf(&s, "pages read: %llu",
+                 (unsigned long long)ms->st_page_in);
+  vector_append(&v, s);
+  byte_xasprintf(&s, "pages written: %llu",
+                 (unsigned long long)ms->st_page_out);
+  vector_append(&v, s);
+  for(n = 0; fs && fs[n]; ++n) {
+    byte_xasprintf(&s, "%s cache hit ratio: %s (%llu hits, %llu misses)",
+                   fs[n]->file_name,
+                   hit_ratio(fs[n]->st_cache_hit, fs[n]->st_cache_miss),
+                   (unsigned long long)fs[n]->st_cache_hit,
+                   (unsigned long long)fs[n]->st_cache_miss);
+    vector_append(&v, s);
+  }
+  byte_xasprintf(&s, "lock requests: %llu",
+                 (unsigned long long)ls->st_nrequests);
+  vector_append(&v, s);
+  byte_xasprintf(&s, "lock waits: %llu",
+                 (unsigned long long)ls->st_lock_wait);
+  vector_append(&v, s);
+  byte_xasprintf(&s, "deadlocks: %llu",
+                 (unsigned long long)ls->st_ndeadlocks);
+  vector_append(&v, s);
+  byte_xasprintf(&s, "lock timeouts: %llu",
+                 (unsigned long long)ls->st_nlocktimeouts);
+  vector_append(&v, s);
+  if(!trackdb_log_stats(&log_size, &log_pending_bytes, &recovery)) {
+    byte_xasprintf(&s, "log files: %llu bytes", log_size);
+    vector_append(&v, s);
+    byte_xasprintf(&s, "log since checkpoint: %llu bytes", log_pending_bytes);
+    vector_append(&v, s);
+    byte_xasprintf(&s, "estimated recovery time: %lds", recovery);
+    vector_append(&v, s);
+  }
+  xfree(ms);
+  xfree(fs);
+  xfree(ls);
+  vector_terminate(&v);
+  if(nstatsp) *nstatsp = v.nvec;
+  return v.vec;
+}
+
+/** @brief State structure tracking @c disorder-stats */
+struct stats_details {
+  void (*done)(char *data, void *u);
+  void *u;
+  int exited;                           /* subprocess exited */
+  int closed;                           /* pipe close */
+  int wstat;                            /* wait status from subprocess */
+  struct dynstr data[1];                /* data read from pipe */
+};
+
+/** @brief Called when @c disorder-stats may have completed
+ * @param d Pointer to state structure
+ *
+ * Called from stats_finished() and stats_read().  Only proceeds when the
+ * process has terminated and the output is complete.
+ */
+static void stats_complete(struct stats_details *d) {
+  char *s;
+
+  if(!(d->exited && d->closed))
+    return;
+  byte_xasprintf(&s, "\n"
+                 "Server stats:\n"
+                 "query result cache hits: %lu\n"
+                 "query result cache misses: %lu\n",
+                 cache_files_hits,
+                 cache_files_misses);
+  dynstr_append_string(d->data, s);
+  dynstr_terminate(d->data);
+  d->done(d->data->vec, d->u);
+}
+
+/** @brief Called when @c disorder-stats exits
+ * @param ev Event loop
+ * @param pid Process ID
+ * @param status Exit status
+ * @param rusage Resource usage
+ * @param u Pointer to state structure (@ref stats_details)
+ * @return 0
+ */
+static int stats_finished(ev_source attribute((unused)) *ev,
+                          pid_t pid,
+                          int status,
+                          const struct rusage attribute((unused)) *rusage,
+                          void *u) {
+  struct stats_details *const d = u;
+
+  d->exited = 1;
+  if(status)
+    disorder_error(0, "disorder-stats %s", wstat(status));
+  stats_complete(d);
+  char *k;
+  byte_xasprintf(&k, "%lu", (unsigned long)pid);
+  hash_remove(stats_pids, k);
+  return 0;
+}
+
+/** @brief Called when pipe from @c disorder-stats is readable
+ * @param ev Event loop
+ * @param reader Reader state
+ * @param ptr Pointer to bytes read
+ * @param bytes Number of bytes available
+ * @param eof Set at end of file
+ * @param u Pointer to state structure (@ref stats_details)
+ * @return 0
+ */
+static int stats_read(ev_source attribute((unused)) *ev,
+                      ev_reader *reader,
+                      void *ptr,
+                      size_t bytes,
+                      int eof,
+                      void *u) {
+  struct stats_details *const d = u;
+
+  dynstr_append_bytes(d->data, ptr, bytes);
+  ev_reader_consume(reader, bytes);
+  if(eof)
+    d->closed = 1;
+  stats_complete(d);
+  return 0;
+}
+
+/** @brief Called when pipe from @c disorder-stats errors
+ * @param ev Event loop
+ * @param errno_value Error code
+ * @param u Pointer to state structure (@ref stats_details)
+ * @return 0
+ */
+static int stats_error(ev_source attribute((unused)) *ev,
+                       int errno_value,
+                       void *u) {
+  struct stats_details *const d = u;
+
+  disorder_error(errno_value, "error reading from pipe to disorder-stats");
+  d->closed = 1;
+  stats_complete(d);
+  return 0;
+}
+
+/** @brief Get database statistics via background process
+ * @param ev Event loop
+ * @param done Called on completion
+ * @param u Passed to @p done
+ *
+ * Within the main server use this instead of trackdb_stats(), which can take
+ * unreasonably long.
+ */
+void trackdb_stats_subprocess(ev_source *ev,
+                              void (*done)(char *data, void *u),
+                              void *u) {
+  int p[2];
+  pid_t pid;
+  struct stats_details *d = xmalloc(sizeof *d);
+
+  dynstr_init(d->data);
+  d->done = done;
+  d->u = u;
+  xpipe(p);
+  pid = subprogram(ev, p[1], "disorder-stats", (char *)0);
+  xclose(p[1]);
+  ev_child(ev, pid, 0, stats_finished, d);
+  if(!ev_reader_new(ev, p[0], stats_read, stats_error, d,
+                    "disorder-stats reader"))
+    disorder_fatal(0, "ev_reader_new for disorder-stats reader failed");
+  /* Remember the PID */
+  if(!stats_pids)
+    stats_pids = hash_new(1);
+  char *k;
+  byte_xasprintf(&k, "%lu", (unsigned long)pid);
+  hash_add(stats_pids, k, "", HASH_INSERT);
+}
+
+/** @brief Parse a track name part preference
+ * @param name Preference name
+ * @param partp Where to store part name
+ * @param contextp Where to store context name
+ * @return 0 on success, non-0 if parse fails
+ */
+static int trackdb__parse_namepref(const char *name,
+                                   char **partp,
+                                   char **contextp) {
+  char *c;
+  static const char prefix[] = "trackname_";
+  
+  if(strncmp(name, prefix, strlen(prefix)))
+    return -1;                          /* not trackname_* at all */
+  name += strlen(prefix);
+  /* There had better be a _ between context and part */
+  c = strchr(name, '_');
+  if(!c)
+    return -1;
+  /* Context is first in the pref name even though most APIs have the part
+   * first.  Confusing; sorry. */
+  *contextp = xstrndup(name, c - name);
+  ++c;
+  /* There had better NOT be a second _ */
+  if(strchr(c, '_'))
+    return -1;
+  *partp = xstrdup(c);
   return 0;
 }
 
 /** @brief Compute the default value for a track preference
  * @param track Track name
- * @param name Preference name
- * @return Default value or 0 if none/not known
+ * @param name Preference name
+ * @return Default value or 0 if none/not known
+ */
+static const char *trackdb__default(const char *track, const char *name) {
+  char *context, *part;
+  
+  if(!trackdb__parse_namepref(name, &part, &context)) {
+    /* We can work out the default for a trackname_ pref */
+    return trackname_part(track, context, part);
+  } else if(!strcmp(name, "weight")) {
+    /* We know the default weight */
+    return "90000";
+  } else if(!strcmp(name, "pick_at_random")) {
+    /* By default everything is eligible for picking at random */
+    return "1";
+  } else if(!strcmp(name, "tags")) {
+    /* By default everything no track has any tags */
+    return "";
+  }
+  return 0;
+}
+
+/** @brief Set a preference
+ * @param track Track to modify
+ * @param name Preference name
+ * @param value New value, or NULL to erase any existing value
+ * @return 0 on success or non-zero if not allowed to set preference
+ */
+int trackdb_set(const char *track,
+                const char *name,
+                const char *value) {
+  struct kvp *t, *p, *a;
+  DB_TXN *tid;
+  int err, cmp, t_changed;
+  char *oldalias, *newalias, **oldtags = 0, **newtags, *bits;
+  const char *def;
+
+  /* If the value matches the default then unset instead, to keep the database
+   * tidy.  Older versions did not have this feature so your database may yet
+   * have some default values stored in it. */
+  if(value) {
+    def = trackdb__default(track, name);
+    if(def && !strcmp(value, def))
+      value = 0;
+  }
+
+  for(;;) {
+    tid = trackdb_begin_transaction();
+    if((err = gettrackdata(track, &t, &p, 0,
+                           0, tid)) == DB_LOCK_DEADLOCK)
+      goto fail;
+    if(err == DB_NOTFOUND) break;
+    if(name[0] == '_') {
+      if(kvp_set(&t, name, value))
+        if(trackdb_putdata(trackdb_tracksdb, track, t, tid, 0))
+          goto fail;
+    } else {
+      /* get the old alias name */
+      if(compute_alias(&oldalias, track, p, tid)) goto fail;
+      /* get the old tags */
+      if(!strcmp(name, "tags"))
+        oldtags = parsetags(kvp_get(p, "tags"));
+      /* set the value */
+      if(kvp_set(&p, name, value))
+        if(trackdb_putdata(trackdb_prefsdb, track, p, tid, 0))
+          goto fail;
+      /* The search words may have changed, so make sure the next rescan
+       * looks at the track even if the file hasn't changed, and searches
+       * see the new words straight away */
+      t_changed = kvp_set(&t, "_stat", 0);
+      if(is_display_pref(name))
+        t_changed += kvp_set(&t, "_words",
+                             words_to_string(track_to_words(track, p)));
+      if(!strcmp(name, "tags")) {
+        if(tag_bits(parsetags(value), 1, &bits, tid)) goto fail;
+        t_changed += kvp_set(&t, "_tagbits", bits);
+      }
+      if(t_changed)
+        if(trackdb_putdata(trackdb_tracksdb, track, t, tid, 0))
+          goto fail;
+      /* compute the new alias name */
+      if(compute_alias(&newalias, track, p, tid)) goto fail;
+      /* check whether alias has changed */
+      if(!(oldalias == newalias
+           || (oldalias && newalias && !strcmp(oldalias, newalias)))) {
+        /* adjust alias records to fit change */
+        if(oldalias
+           && trackdb_delkey(trackdb_tracksdb, oldalias, tid) == DB_LOCK_DEADLOCK)
+          goto fail;
+        if(newalias) {
+          a = 0;
+          kvp_set(&a, "_alias_for", track);
+          if(trackdb_putdata(trackdb_tracksdb, newalias, a, tid, 0)) goto fail;
+        }
+      }
+      /* check whether tags have changed */
+      if(!strcmp(name, "tags")) {
+        newtags = parsetags(value);
+        while(*oldtags || *newtags) {
+          if(*oldtags && *newtags) {
+            cmp = strcmp(*oldtags, *newtags);
+            if(!cmp) {
+              /* keeping this tag */
+              ++oldtags;
+              ++newtags;
+            } else if(cmp < 0)
+              /* old tag fits into a gap in the new list, so delete old */
+              goto delete_old;
+            else
+              /* new tag fits into a gap in the old list, so insert new */
+              goto insert_new;
+          } else if(*oldtags) {
+            /* we've run out of new tags, so remaining old ones are to be
+             * deleted */
+          delete_old:
+            if(unregister_tag(track, *oldtags, tid)) goto fail;
+            ++oldtags;
+          } else {
+            /* we've run out of old tags, so remainig new ones are to be
+             * inserted */
+          insert_new:
+            if(register_tag(track, *newtags, tid)) goto fail;
+            ++newtags;
+          }
+        }
+        if(stats_flush(tid)) goto fail;
+      }
+    }
+    err = 0;
+    break;
+fail:
+    trackdb_abort_transaction(tid);
+    trackdb_deadlocked(__func__);
+  }
+  trackdb_commit_transaction(tid);
+  /* Aliases, name parts and tags all come from preferences */
+  if(err == 0 && name[0] != '_')
+    ++trackdb_generation;
+  if(err == 0 && trackdb_pref_changed)
+    trackdb_pref_changed(track, name);
+  return err == 0 ? 0 : -1;
+}
+
+/** @brief Get the value of a preference
+ * @param track Track name
+ * @param name Preference name
+ * @return Preference value or NULL if it's not set
+ */
+const char *trackdb_get(const char *track,
+                        const char *name) {
+  return kvp_get(trackdb_get_all(track), name);
+}
+
+/** @brief Get the length of a track
+ * @param track Track name
+ * @return Length in seconds as a string, or NULL if not known
+ *
+ * If the track's length has not been recorded yet but some other track
+ * with the same underlying file has had its length computed, that is used.
+ */
+const char *trackdb_get_length(const char *track) {
+  struct kvp *t, *l;
+  const char *length, *path;
+  char *sig;
+  DB_TXN *tid;
+
+  for(;;) {
+    tid = trackdb_begin_read_transaction();
+    length = 0;
+    if(gettrackdata(track, &t, 0, 0, 0, tid) == DB_LOCK_DEADLOCK)
+      goto fail;
+    if(!(length = kvp_get(t, "_length"))
+       && (path = kvp_get(t, "_path"))
+       && (sig = trackdb_stat_signature(path))) {
+      if(trackdb_getdata(trackdb_lengthsdb, sig, &l, tid) == DB_LOCK_DEADLOCK)
+        goto fail;
+      length = kvp_get(l, "_length");
+    }
+    break;
+fail:
+    trackdb_abort_transaction(tid);
+  }
+  trackdb_commit_transaction(tid);
+  return length;
+}
+
+/** @brief Get all preferences for a track
+ * @param track Track name
+ * @return Linked list of preferences
+ */
+struct kvp *trackdb_get_all(const char *track) {
+  struct kvp *t, *p, **pp;
+  DB_TXN *tid;
+
+  for(;;) {
+    tid = trackdb_begin_read_transaction();
+    if(gettrackdata(track, &t, &p, 0, 0, tid) == DB_LOCK_DEADLOCK)
+      goto fail;
+    break;
+fail:
+    trackdb_abort_transaction(tid);
+  }
+  trackdb_commit_transaction(tid);
+  for(pp = &p; *pp; pp = &(*pp)->next)
+    ;
+  *pp = t;
+  return p;
+}
+
+/** @brief Get track data and preferences for many tracks at once
+ * @param tracks Track names (might be aliases)
+ * @param ntracks Number of tracks
+ * @param tps Where to store track data, or a null pointer
+ * @param pps Where to store preferences, or a null pointer
+ * @param actuals Where to store resolved names, or a null pointer
+ *
+ * All the tracks are looked up in a single transaction.  Tracks that do not
+ * exist get null track data and preferences.
+ */
+void trackdb_get_many(char **tracks, int ntracks,
+                      struct kvp **tps, struct kvp **pps,
+                      const char **actuals) {
+  DB_TXN *tid;
+  int n;
+
+  for(;;) {
+    tid = trackdb_begin_read_transaction();
+    for(n = 0; n < ntracks; ++n)
+      if(gettrackdata(tracks[n],
+                      tps ? &tps[n] : 0,
+                      pps ? &pps[n] : 0,
+                      actuals ? &actuals[n] : 0,
+                      0, tid) == DB_LOCK_DEADLOCK)
+        goto fail;
+    break;
+fail:
+    trackdb_abort_transaction(tid);
+  }
+  trackdb_commit_transaction(tid);
+}
+
+/** @brief Resolve an alias
+ * @param track Track name (might be an alias)
+ * @return Real track name (definitely not an alias) or NULL if no such track
+ */
+const char *trackdb_resolve(const char *track) {
+  DB_TXN *tid;
+  const char *actual;
+
+  /* Save a transaction if there's no such track */
+  if(!track_filter_test(track))
+    return track;
+  for(;;) {
+    tid = trackdb_begin_read_transaction();
+    if(gettrackdata(track, 0, 0, &actual, 0, tid) == DB_LOCK_DEADLOCK)
+      goto fail;
+    break;
+fail:
+    trackdb_abort_transaction(tid);
+  }
+  trackdb_commit_transaction(tid);
+  return actual;
+}
+
+/** @brief Detect an alias
+ * @param track Track name
+ * @return Nonzero if @p track exists and is an alias
+ */
+int trackdb_isalias(const char *track) {
+  const char *actual = trackdb_resolve(track);
+
+  return strcmp(actual, track);
+}
+
+/** @brief Detect whether a track exists
+ * @param track Track name (can be an alias)
+ * @return Nonzero if @p track exists (whether or not it's an alias)
+ */
+int trackdb_exists(const char *track) {
+  DB_TXN *tid;
+  int err;
+
+  if(!track_filter_test(track))
+    return 0;
+  for(;;) {
+    tid = trackdb_begin_read_transaction();
+    /* unusually, here we want the return value */
+    if((err = gettrackdata(track, 0, 0, 0, 0, tid)) == DB_LOCK_DEADLOCK)
+      goto fail;
+    break;
+fail:
+    trackdb_abort_transaction(tid);
+  }
+  trackdb_commit_transaction(tid);
+  return (err == 0);
+}
+
+/** @brief List the tags in the tag directory
+ * @param v Where to store tags
+ * @param tid Owning transaction
+ * @return 0 or DB_LOCK_DEADLOCK
+ *
+ * The tag directory is maintained along with the library statistics, so if
+ * they haven't been counted yet then the tags database is listed instead.
+ */
+static int list_tags(struct vector *v, DB_TXN *tid) {
+  const char *s;
+  const struct kvp *k;
+  int err;
+
+  if((err = trackdb_get_global_tid("_tag_counts", tid, &s)))
+    return err;
+  if(!s)
+    return trackdb_listkeys(trackdb_tagsdb, v, tid);
+  v->nvec = 0;
+  for(k = kvp_urldecode(s, strlen(s)); k; k = k->next)
+    vector_append(v, (char *)k->name);
+  vector_terminate(v);
+  return 0;
+}
+
+/** @brief Return list of all known tags
+ * @return NULL-terminated tag list
+ */
+char **trackdb_alltags(void) {
+  DB_TXN *tid;
+  struct vector v[1];
+
+  vector_init(v);
+  for(;;) {
+    tid = trackdb_begin_read_transaction();
+    if(!list_tags(v, tid))
+      break;
+    trackdb_abort_transaction(tid);
+  }
+  trackdb_commit_transaction(tid);
+  return v->vec;
+}
+
+/** @brief List all the keys in @p db
+ * @param db Database
+ * @param v Vector to store keys in
+ * @param tid Transaction ID
+ * @return 0 or DB_LOCK_DEADLOCK
+ */
+int trackdb_listkeys(DB *db, struct vector *v, DB_TXN *tid) {
+  int e;
+  DBT k, d;
+  DBC *const c = trackdb_opencursor(db, tid);
+
+  v->nvec = 0;
+  memset(&k, 0, sizeof k);
+  while(!(e = c->c_get(c, &k, prepare_data(&d), DB_NEXT_NODUP)))
+    vector_append(v, xstrndup(k.data, k.size));
+  switch(e) {
+  case DB_NOTFOUND:
+    break;
+  case DB_LOCK_DEADLOCK:
+    return e;
+  default:
+    disorder_fatal(0, "c->c_get: %s", db_strerror(e));
+  }
+  if((e = trackdb_closecursor(c)))
+    return e;
+  vector_terminate(v);
+  return 0;
+}
+
+/* return 1 iff sorted tag lists A and B have at least one member in common */
+/** @brief Detect intersecting tag lists
+ * @param a First list of tags (NULL-terminated)
+ * @param b Second list of tags (NULL-terminated)
+ * @return 1 if @p a and @p b have at least one member in common
+ *
+ * @p a and @p must be sorted.
+ */
+int tag_intersection(char **a, char **b) {
+  int cmp;
+
+  /* Same sort of logic as trackdb_set() above */
+  while(*a && *b) {
+    if(!(cmp = strcmp(*a, *b))) return 1;
+    else if(cmp < 0) ++a;
+    else ++b;
+  }
+  return 0;
+}
+
+/** @brief Called when disorder-choose might have completed
+ * @param ev Event loop
+ * @param which @ref CHOOSE_RUNNING or @ref CHOOSE_READING
+ *
+ * @param cr Run that might have completed
+ *
+ * Once called with both @p which values, the run's callback is called
+ * (usually chosen_random_tracks()).
+ */
+static void choose_finished(ev_source *ev, unsigned which,
+                            struct choose_run *cr) {
+  cr->complete |= which;
+  if(cr->complete != (CHOOSE_RUNNING|CHOOSE_READING))
+    return;
+  cr->pid = -1;
+  if(cr->tracks_callback) {
+    char **tracks = 0;
+    int ntracks = 0;
+
+    if(cr->status == 0) {
+      dynstr_terminate(&cr->output);
+      if(!(tracks = split(cr->output.vec, &ntracks, SPLIT_QUOTES, 0, 0))) {
+        disorder_error(0, "malformed output from disorder-choose");
+        ntracks = 0;
+      }
+    }
+    cr->tracks_callback(ev, tracks, ntracks);
+  } else if(cr->status == 0 && (cr->output.nvec > 0 || cr->empty_ok)) {
+    dynstr_terminate(&cr->output);
+    cr->callback(ev, xstrdup(cr->output.vec));
+  } else
+    cr->callback(ev, 0);
+}
+
+/** @brief Called when @c disorder-choose terminates
+ * @param ev Event loop
+ * @param pid Process ID
+ * @param status Exit status
+ * @param rusage Resource usage
+ * @param u Run state
+ * @return 0
+ */
+static int choose_exited(ev_source *ev,
+                         pid_t attribute((unused)) pid,
+                         int status,
+                         const struct rusage attribute((unused)) *rusage,
+                         void *u) {
+  struct choose_run *cr = u;
+
+  if(status)
+    disorder_error(0, "disorder-choose %s", wstat(status));
+  cr->status = status;
+  choose_finished(ev, CHOOSE_RUNNING, cr);
+  return 0;
+}
+
+/** @brief Called with data from @c disorder-choose pipe
+ * @param ev Event loop
+ * @param reader Reader state
+ * @param ptr Data read
+ * @param bytes Number of bytes read
+ * @param eof Set at end of file
+ * @param u Run state
+ * @return 0
+ */
+static int choose_readable(ev_source *ev,
+                           ev_reader *reader,
+                           void *ptr,
+                           size_t bytes,
+                           int eof,
+                           void *u) {
+  struct choose_run *cr = u;
+
+  dynstr_append_bytes(&cr->output, ptr, bytes);
+  ev_reader_consume(reader, bytes);
+  if(eof)
+    choose_finished(ev, CHOOSE_READING, cr);
+  return 0;
+}
+
+/** @brief Called when @c disorder-choose pipe errors
+ * @param ev Event loop
+ * @param errno_value Error code
+ * @param u Run state
+ * @return 0
+ */
+static int choose_read_error(ev_source *ev,
+                             int errno_value,
+                             void *u) {
+  disorder_error(errno_value, "error reading disorder-choose pipe");
+  choose_finished(ev, CHOOSE_READING, u);
+  return 0;
+}
+
+/** @brief Start disorder-choose
+ * @param ev Event source
+ * @param cr Run state
+ * @param mode Extra option or NULL
+ * @param arg Argument to @p mode or NULL
+ * @return 0 if a run was initiated, else -1
+ *
+ * The caller sets the run's callback once this has succeeded.
+ */
+static int choose_start(ev_source *ev, struct choose_run *cr,
+                        const char *mode, const char *arg) {
+  int p[2];
+
+  if(cr->pid != -1)
+    return -1;                          /* don't run concurrent chooses */
+  xpipe(p);
+  cloexec(p[0]);
+  cr->pid = subprogram(ev, p[1], "disorder-choose", mode, arg, (char *)0);
+  xclose(p[1]);
+  cr->output.nvec = 0;
+  cr->complete = 0;
+  cr->status = 0;
+  if(!ev_reader_new(ev, p[0], choose_readable, choose_read_error, cr,
+                    "disorder-choose reader")) /* owns p[0] */
+    disorder_fatal(0, "ev_reader_new for disorder-choose reader failed");
+  ev_child(ev, cr->pid, 0, choose_exited, cr); /* owns the subprocess */
+  return 0;
+}
+
+/** @brief Request random tracks
+ * @param ev Event source
+ * @param count Number of tracks to choose
+ * @param callback Called with the random tracks
+ * @return 0 if a request was initiated, else -1
+ *
+ * Initiates a random choice of up to @p count distinct tracks, made in a
+ * single pass over the database.  @p callback will later be called back with
+ * the choices (none on error, or fewer than @p count if there aren't enough
+ * eligible tracks).  If a choice is already underway then -1 is returned and
+ * there will be no additional callback.
+ *
+ * The caller shouldn't assume that the tracks returned actually exist (they
+ * might be removed between the choice and the callback, or between being added
+ * to the queue and being played).
+ */
+int trackdb_request_random(ev_source *ev, int count,
+                           random_tracks_callback *callback) {
+  char countstr[32];
+
+  byte_snprintf(countstr, sizeof countstr, "%d", count);
+  if(choose_start(ev, &choose_pick, "--count", countstr))
+    return -1;
+  choose_pick.tracks_callback = callback;
+  return 0;
+}
+
+/** @brief Request the weights of all tracks
+ * @param ev Event source
+ * @param callback Called with the weight listing or NULL
+ * @return 0 if a request was initiated, else -1
+ *
+ * Runs <tt>disorder-choose --weights</tt>, which lists every track that could
+ * be chosen at random, one per line (see @ref server/chooser.c).  If a listing is
+ * already underway then -1 is returned and there will be no additional
+ * callback.
  */
-static const char *trackdb__default(const char *track, const char *name) {
-  char *context, *part;
-  
-  if(!trackdb__parse_namepref(name, &part, &context)) {
-    /* We can work out the default for a trackname_ pref */
-    return trackname_part(track, context, part);
-  } else if(!strcmp(name, "weight")) {
-    /* We know the default weight */
-    return "90000";
-  } else if(!strcmp(name, "pick_at_random")) {
-    /* By default everything is eligible for picking at random */
-    return "1";
-  } else if(!strcmp(name, "tags")) {
-    /* By default everything no track has any tags */
-    return "";
-  }
+int trackdb_request_weights(ev_source *ev,
+                            random_callback *callback) {
+  if(choose_start(ev, &choose_weights, "--weights", 0))
+    return -1;
+  choose_weights.callback = callback;
   return 0;
 }
 
-/** @brief Set a preference
- * @param track Track to modify
- * @param name Preference name
- * @param value New value, or NULL to erase any existing value
- * @return 0 on success or non-zero if not allowed to set preference
+/** @brief Get a track name part, using prefs
+ * @param track Track name
+ * @param context Context ("display" etc)
+ * @param part Part ("album" etc)
+ * @param p Preference
+ * @param pi Index of @p p, or NULL
+ * @param used_db Set if a preference is used
+ * @return Name part (never NULL)
+ *
+ * Used by compute_alias() and trackdb_getpart().
  */
-int trackdb_set(const char *track,
-                const char *name,
-                const char *value) {
-  struct kvp *t, *p, *a;
+static const char *getpart(const char *track,
+                           const char *context,
+                           const char *part,
+                           const struct kvp *p,
+                           const struct kvp_index *pi,
+                           int *used_db) {
+  const char *result;
+  char *pref;
+
+  byte_xasprintf(&pref, "trackname_%s_%s", context, part);
+  if((result = pi ? kvp_index_get(pi, pref) : kvp_get(p, pref)))
+    *used_db = 1;
+  else
+    result = trackname_part(track, context, part);
+  assert(result != 0);
+  return result;
+}
+
+/** @brief Get a track name part
+ * @param track Track name
+ * @param context Context ("display" etc)
+ * @param part Part ("album" etc)
+ * @return Name part (never NULL)
+ *
+ * This is interface used by c_part().
+ */
+const char *trackdb_getpart(const char *track,
+                            const char *context,
+                            const char *part) {
+  struct kvp *p;
   DB_TXN *tid;
-  int err, cmp;
-  char *oldalias, *newalias, **oldtags = 0, **newtags;
-  const char *def;
+  char *pref;
+  const char *actual;
+  int used_db;
 
-  /* If the value matches the default then unset instead, to keep the database
-   * tidy.  Older versions did not have this feature so your database may yet
-   * have some default values stored in it. */
-  if(value) {
-    def = trackdb__default(track, name);
-    if(def && !strcmp(value, def))
-      value = 0;
+  /* construct the full pref */
+  byte_xasprintf(&pref, "trackname_%s_%s", context, part);
+  for(;;) {
+    tid = trackdb_begin_read_transaction();
+    if(gettrackdata(track, 0, &p, &actual, 0, tid) == DB_LOCK_DEADLOCK)
+      goto fail;
+    break;
+fail:
+    trackdb_abort_transaction(tid);
   }
+  trackdb_commit_transaction(tid);
+  return getpart(actual, context, part, p, 0, &used_db);
+}
+
+/** @brief Get a track name part given its preferences
+ * @param actual Track name (not an alias)
+ * @param context Context ("display" etc)
+ * @param part Part ("album" etc)
+ * @param p Preferences for @p actual
+ * @return Name part (never NULL)
+ *
+ * This is the interface used by c_parts_multi(), with preferences from
+ * trackdb_get_many().
+ */
+const char *trackdb_getpart_prefs(const char *actual,
+                                  const char *context,
+                                  const char *part,
+                                  const struct kvp *p) {
+  int used_db;
+
+  return getpart(actual, context, part, p, 0, &used_db);
+}
+
+/** @brief Get the raw (filesystem) path for @p track
+ * @param track track Track name (can be an alias)
+ * @return Raw path (never NULL)
+ *
+ * The raw path is the actual bytes that came out of readdir() etc.
+ */
+const char *trackdb_rawpath(const char *track) {
+  DB_TXN *tid;
+  struct kvp *t;
+  const char *path;
 
   for(;;) {
-    tid = trackdb_begin_transaction();
-    if((err = gettrackdata(track, &t, &p, 0,
-                           0, tid)) == DB_LOCK_DEADLOCK)
+    tid = trackdb_begin_read_transaction();
+    if(gettrackdata(track, &t, 0, 0, 0, tid) == DB_LOCK_DEADLOCK)
       goto fail;
-    if(err == DB_NOTFOUND) break;
-    if(name[0] == '_') {
-      if(kvp_set(&t, name, value))
-        if(trackdb_putdata(trackdb_tracksdb, track, t, tid, 0))
-          goto fail;
-    } else {
-      /* get the old alias name */
-      if(compute_alias(&oldalias, track, p, tid)) goto fail;
-      /* get the old tags */
-      if(!strcmp(name, "tags"))
-        oldtags = parsetags(kvp_get(p, "tags"));
-      /* set the value */
-      if(kvp_set(&p, name, value))
-        if(trackdb_putdata(trackdb_prefsdb, track, p, tid, 0))
-          goto fail;
-      /* compute the new alias name */
-      if(compute_alias(&newalias, track, p, tid)) goto fail;
-      /* check whether alias has changed */
-      if(!(oldalias == newalias
-           || (oldalias && newalias && !strcmp(oldalias, newalias)))) {
-        /* adjust alias records to fit change */
-        if(oldalias
-           && trackdb_delkey(trackdb_tracksdb, oldalias, tid) == DB_LOCK_DEADLOCK)
-          goto fail;
-        if(newalias) {
-          a = 0;
-          kvp_set(&a, "_alias_for", track);
-          if(trackdb_putdata(trackdb_tracksdb, newalias, a, tid, 0)) goto fail;
-        }
+    break;
+fail:
+    trackdb_abort_transaction(tid);
+  }
+  trackdb_commit_transaction(tid);
+  if(!(path = kvp_get(t, "_path"))) path = track;
+  return path;
+}
+
+/* trackdb_list **************************************************************/
+
+/* this is incredibly ugly, sorry, perhaps it will be rewritten to be actually
+ * readable at some point */
+
+/** @brief Find the target of an alias from its encoded track data
+ * @param ptr Encoded track data
+ * @param n Length of @p ptr
+ * @return Target track, or NULL if this isn't an alias
+ *
+ * Equivalent to kvp_get(decode_data(...), "_alias_for") but only
+ * decodes the one value.
+ */
+static const char *find_alias_target(const char *ptr, size_t n) {
+  static const char key[] = "_alias_for=";
+  const char *const end = ptr + n;
+  const char *amp;
+
+  if(kvp_is_packed(ptr, n))
+    return kvp_packed_get(ptr, n, "_alias_for");
+  while(ptr < end) {
+    if(!(amp = memchr(ptr, '&', end - ptr)))
+      amp = end;
+    if((size_t)(amp - ptr) >= sizeof key - 1
+       && !memcmp(ptr, key, sizeof key - 1))
+      return urldecodestring(ptr + sizeof key - 1,
+                             amp - (ptr + sizeof key - 1));
+    ptr = amp + 1;
+  }
+  return NULL;
+}
+
+/* return true if the basename of TRACK[0..TL-1], as defined by DL, matches RE.
+ * If RE is a null pointer then it matches everything. */
+/** @brief Match a track against a rgeexp
+ * @param dl Length of directory part of track
+ * @param track Track name
+ * @param tl Length of track name
+ * @param re Regular expression or NULL
+ * @return Nonzero on match
+ *
+ * @p tl is the total length of @p track, @p dl is the length of the directory
+ * part (the index of the final "/").  The subject of the regexp match is the
+ * basename, i.e. the part after @p dl.
+ *
+ * If @p re is NULL then always matches.
+ */
+static int track_matches(size_t dl, const char *track, size_t tl,
+			 const regexp *re) {
+  size_t ovec[3];
+  int rc;
+
+  if(!re)
+    return 1;
+  track += dl + 1;
+  tl -= (dl + 1);
+  switch(rc = regexp_match(re, track, tl, 0, ovec, 3)) {
+  case RXERR_NOMATCH: return 0;
+  default:
+    if(rc < 0) {
+      disorder_error(0, "regexp_match returned %d, subject '%s'", rc, track);
+      return 0;
+    }
+    return 1;
+  }
+}
+
+/** @brief Generate a list of tracks and/or directories in @p dir
+ * @param v Where to put results
+ * @param dir Directory to list
+ * @param what Bitmap of objects to return
+ * @param re Regexp to filter matches (or NULL to accept all)
+ * @param tid Owning transaction
+ * @return 0 or DB_LOCK_DEADLOCK
+ */
+static int do_list(struct vector *v, const char *dir,
+                   enum trackdb_listable what, const regexp *re, DB_TXN *tid) {
+  DBC *cursor;
+  DBT k, d;
+  size_t dl;
+  char *ptr;
+  int err;
+  size_t l;
+  char *subdir, *skip, *track;
+  const char *alias_target;
+
+  dl = strlen(dir);
+  cursor = trackdb_opencursor(trackdb_tracksdb, tid);
+  make_key(&k, dir);
+  prepare_data(&d);
+  /* find the first key >= dir */
+  err = cursor->c_get(cursor, &k, &d, DB_SET_RANGE);
+  /* keep going while we're dealing with <dir/anything> */
+  while(err == 0
+	&& k.size > dl
+	&& ((char *)k.data)[dl] == '/'
+	&& !memcmp(k.data, dir, dl)) {
+    ptr = memchr((char *)k.data + dl + 1, '/', k.size - (dl + 1));
+    if(ptr) {
+      /* we have <dir/component/anything>, so <dir/component> is a directory */
+      l = ptr - (char *)k.data;
+      if((what & trackdb_directories)
+         && track_matches(dl, k.data, l, re)) {
+        subdir = xstrndup(k.data, l);
+        vector_append(v, subdir);
       }
-      /* check whether tags have changed */
-      if(!strcmp(name, "tags")) {
-        newtags = parsetags(value);
-        while(*oldtags || *newtags) {
-          if(*oldtags && *newtags) {
-            cmp = strcmp(*oldtags, *newtags);
-            if(!cmp) {
-              /* keeping this tag */
-              ++oldtags;
-              ++newtags;
-            } else if(cmp < 0)
-              /* old tag fits into a gap in the new list, so delete old */
-              goto delete_old;
-            else
-              /* new tag fits into a gap in the old list, so insert new */
-              goto insert_new;
-          } else if(*oldtags) {
-            /* we've run out of new tags, so remaining old ones are to be
-             * deleted */
-          delete_old:
-            if(trackdb_delkeydata(trackdb_tagsdb,
-                                  *oldtags, track, tid) == DB_LOCK_DEADLOCK)
-              goto fail;
-            ++oldtags;
-          } else {
-            /* we've run out of old tags, so remainig new ones are to be
-             * inserted */
-          insert_new:
-            if(register_tag(track, *newtags, tid)) goto fail;
-            ++newtags;
-          }
-        }
+      /* Skip everything else below <dir/component>.  In the database's sort
+       * order (see compare_path_raw()) that all comes before <dir/component>
+       * followed by anything other than a "/", so the smallest such key is
+       * where to continue. */
+      skip = xmalloc_noptr(l + 2);
+      memcpy(skip, k.data, l);
+      skip[l] = 1;
+      skip[l + 1] = 0;
+      make_key(&k, skip);
+      err = cursor->c_get(cursor, &k, &d, DB_SET_RANGE);
+      continue;
+    } else {
+      /* found a plain file */
+      if((what & trackdb_files)
+         && track_matches(dl, k.data, k.size, re)) {
+	track = xstrndup(k.data, k.size);
+        /* There's an awkward question here...
+         *
+         * If a track shares a directory with its alias then we could
+         * do one of three things:
+         * - report both.  Looks ridiculuous in most UIs.
+         * - report just the alias.  Remarkably inconvenient to write
+         *   UI code for!
+         * - report just the real name.  Ugly if the UI doesn't prettify
+         *   names via the name parts.
+         */
+        /* If this file is an alias for a track in the same directory then we
+         * skip it */
+        alias_target = find_alias_target(d.data, d.size);
+        if(!(alias_target
+             && strlen(alias_target) > dl
+             && alias_target[dl] == '/'
+             && !memcmp(alias_target, track, dl)
+             && !strchr(alias_target + dl + 1, '/')))
+          vector_append(v, track);
       }
     }
+    err = cursor->c_get(cursor, &k, &d, DB_NEXT);
+  }
+  switch(err) {
+  case 0:
+    break;
+  case DB_NOTFOUND:
     err = 0;
     break;
-fail:
-    trackdb_abort_transaction(tid);
+  case DB_LOCK_DEADLOCK:
+    disorder_error(0, "error querying database: %s", db_strerror(err));
+    break;
+  default:
+    disorder_fatal(0, "error querying database: %s", db_strerror(err));
   }
-  trackdb_commit_transaction(tid);
-  return err == 0 ? 0 : -1;
-}
-
-/** @brief Get the value of a preference
- * @param track Track name
- * @param name Preference name
- * @return Preference value or NULL if it's not set
- */
-const char *trackdb_get(const char *track,
-                        const char *name) {
-  return kvp_get(trackdb_get_all(track), name);
+  if(trackdb_closecursor(cursor)) err = DB_LOCK_DEADLOCK;
+  return err;
 }
 
-/** @brief Get all preferences for a track
- * @param track Track name
- * @return Linked list of preferences
+/** @brief Get the directories or files below @p dir
+ * @param dir Directory to list
+ * @param np Where to put number of results (or NULL)
+ * @param what Bitmap of objects to return
+ * @param re Regexp to filter matches (or NULL to accept all)
+ * @return List of tracks
  */
-struct kvp *trackdb_get_all(const char *track) {
-  struct kvp *t, *p, **pp;
+char **trackdb_list(const char *dir, int *np, enum trackdb_listable what,
+                    const regexp *re) {
   DB_TXN *tid;
+  int n;
+  struct vector v;
 
+  vector_init(&v);
   for(;;) {
-    tid = trackdb_begin_transaction();
-    if(gettrackdata(track, &t, &p, 0, 0, tid) == DB_LOCK_DEADLOCK)
-      goto fail;
+    tid = trackdb_begin_read_transaction();
+    v.nvec = 0;
+    if(dir) {
+      if(do_list(&v, dir, what, re, tid))
+        goto fail;
+    } else {
+      for(n = 0; n < config->collection.n; ++n)
+        if(do_list(&v, config->collection.s[n].root, what, re, tid))
+          goto fail;
+    }
     break;
 fail:
     trackdb_abort_transaction(tid);
   }
   trackdb_commit_transaction(tid);
-  for(pp = &p; *pp; pp = &(*pp)->next)
-    ;
-  *pp = t;
-  return p;
+  vector_terminate(&v);
+  if(np)
+    *np = v.nvec;
+  return v.vec;
 }
 
-/** @brief Resolve an alias
- * @param track Track name (might be an alias)
- * @return Real track name (definitely not an alias) or NULL if no such track
+/** @brief Detect a tag element in a search string
+ * @param s Element of search string
+ * @return Pointer to tag name (in @p s) if this is a tag: search, else NULL
+ *
+ * Tag searches take the form "tag:TAG".
  */
-const char *trackdb_resolve(const char *track) {
-  DB_TXN *tid;
-  const char *actual;
+static const char *checktag(const char *s) {
+  if(!strncmp(s, "tag:", 4))
+    return s + 4;
+  else
+    return 0;
+}
 
-  for(;;) {
-    tid = trackdb_begin_transaction();
-    if(gettrackdata(track, 0, 0, &actual, 0, tid) == DB_LOCK_DEADLOCK)
-      goto fail;
+/** @brief One indexed term of a search */
+struct search_term {
+  /** @brief Database containing the term's posting list */
+  DB *db;
+
+  /** @brief Database name, for error messages */
+  const char *dbname;
+
+  /** @brief Normalized word or tag */
+  const char *key;
+
+  /** @brief Number of tracks containing the term */
+  db_recno_t count;
+};
+
+/** @brief Report a search database error
+ * @param t Search term
+ * @param err Error code
+ * @return 0 for DB_NOTFOUND, else @p err
+ */
+static int search_term_error(const struct search_term *t, int err) {
+  switch(err) {
+  case 0:
     break;
-fail:
-    trackdb_abort_transaction(tid);
+  case DB_NOTFOUND:
+    err = 0;
+    break;
+  case DB_LOCK_DEADLOCK:
+    disorder_error(0, "error querying %s database: %s",
+                   t->dbname, db_strerror(err));
+    break;
+  default:
+    disorder_fatal(0, "error querying %s database: %s",
+                   t->dbname, db_strerror(err));
   }
-  trackdb_commit_transaction(tid);
-  return actual;
+  return err;
 }
 
-/** @brief Detect an alias
- * @param track Track name
- * @return Nonzero if @p track exists and is an alias
+/** @brief Find how many tracks contain a search term
+ * @param t Search term (count is filled in)
+ * @param tid Owning transaction
+ * @return 0 or DB_LOCK_DEADLOCK
+ *
+ * The count is 0 if no track contains the term.
  */
-int trackdb_isalias(const char *track) {
-  const char *actual = trackdb_resolve(track);
+static int search_term_count(struct search_term *t, DB_TXN *tid) {
+  DBC *cursor;
+  DBT k, d;
+  int err;
 
-  return strcmp(actual, track);
+  t->count = 0;
+  cursor = trackdb_opencursor(t->db, tid);
+  if(!(err = cursor->c_get(cursor, make_key(&k, t->key), prepare_data(&d),
+                           DB_SET)))
+    err = cursor->c_count(cursor, &t->count, 0);
+  err = search_term_error(t, err);
+  if(trackdb_closecursor(cursor)) err = DB_LOCK_DEADLOCK;
+  return err;
 }
 
-/** @brief Detect whether a track exists
- * @param track Track name (can be an alias)
- * @return Nonzero if @p track exists (whether or not it's an alias)
- */
-int trackdb_exists(const char *track) {
-  DB_TXN *tid;
-  int err;
+/** @brief Order search terms by number of matching tracks */
+static int compare_search_terms(const void *av, const void *bv) {
+  const struct search_term *a = av, *b = bv;
 
-  for(;;) {
-    tid = trackdb_begin_transaction();
-    /* unusually, here we want the return value */
-    if((err = gettrackdata(track, 0, 0, 0, 0, tid)) == DB_LOCK_DEADLOCK)
-      goto fail;
-    break;
-fail:
-    trackdb_abort_transaction(tid);
-  }
-  trackdb_commit_transaction(tid);
-  return (err == 0);
+  return a->count < b->count ? -1 : a->count > b->count ? 1 : 0;
 }
 
-/** @brief Return list of all known tags
- * @return NULL-terminated tag list
+/** @brief Compare two postings
+ * @param a First track name
+ * @param b Second track name, @p bn bytes long
+ * @param bn Length of @p b
+ * @return Negative, 0 or positive as @p a is before, equal to or after @p b
+ *
+ * This is the order Berkeley DB keeps sorted duplicates in.
  */
-char **trackdb_alltags(void) {
-  int e;
-  struct vector v[1];
+static int compare_posting(const char *a, const void *b, size_t bn) {
+  size_t an = strlen(a);
+  int c;
 
-  vector_init(v);
-  WITH_TRANSACTION(trackdb_listkeys(trackdb_tagsdb, v, tid));
-  return v->vec;
+  if((c = memcmp(a, b, an < bn ? an : bn)))
+    return c;
+  return an < bn ? -1 : an > bn ? 1 : 0;
 }
 
-/** @brief List all the keys in @p db
- * @param db Database
- * @param v Vector to store keys in
- * @param tid Transaction ID
+/** @brief Read the posting list for a search term
+ * @param v Where to put the tracks (in posting order)
+ * @param t Search term
+ * @param tid Owning transaction
  * @return 0 or DB_LOCK_DEADLOCK
  */
-int trackdb_listkeys(DB *db, struct vector *v, DB_TXN *tid) {
-  int e;
+static int search_term_postings(struct vector *v,
+                                const struct search_term *t,
+                                DB_TXN *tid) {
+  DBC *cursor;
   DBT k, d;
-  DBC *const c = trackdb_opencursor(db, tid);
+  int err, what = DB_SET;
 
   v->nvec = 0;
-  memset(&k, 0, sizeof k);
-  while(!(e = c->c_get(c, &k, prepare_data(&d), DB_NEXT_NODUP)))
-    vector_append(v, xstrndup(k.data, k.size));
-  switch(e) {
-  case DB_NOTFOUND:
-    break;
-  case DB_LOCK_DEADLOCK:
-    return e;
-  default:
-    disorder_fatal(0, "c->c_get: %s", db_strerror(e));
+  cursor = trackdb_opencursor(t->db, tid);
+  make_key(&k, t->key);
+  while(!(err = cursor->c_get(cursor, &k, prepare_data(&d), what))) {
+    vector_append(v, xstrndup(d.data, d.size));
+    what = DB_NEXT_DUP;
   }
-  if((e = trackdb_closecursor(c)))
-    return e;
-  vector_terminate(v);
-  return 0;
+  err = search_term_error(t, err);
+  if(trackdb_closecursor(cursor)) err = DB_LOCK_DEADLOCK;
+  return err;
 }
 
-/* return 1 iff sorted tag lists A and B have at least one member in common */
-/** @brief Detect intersecting tag lists
- * @param a First list of tags (NULL-terminated)
- * @param b Second list of tags (NULL-terminated)
- * @return 1 if @p a and @p b have at least one member in common
+/** @brief Narrow a candidate list to tracks containing a search term
+ * @param v Candidate tracks (in posting order); updated in place
+ * @param t Search term
+ * @param tid Owning transaction
+ * @return 0 or DB_LOCK_DEADLOCK
  *
- * @p a and @p must be sorted.
+ * Rather than reading the whole posting list, we seek it to each candidate in
+ * turn.  When the seek lands past the candidate we gallop forward through the
+ * candidates to catch up, so a long posting list against a short candidate
+ * list costs roughly one seek per candidate and vice versa.
  */
-int tag_intersection(char **a, char **b) {
-  int cmp;
-
-  /* Same sort of logic as trackdb_set() above */
-  while(*a && *b) {
-    if(!(cmp = strcmp(*a, *b))) return 1;
-    else if(cmp < 0) ++a;
-    else ++b;
+static int search_term_intersect(struct vector *v,
+                                 const struct search_term *t,
+                                 DB_TXN *tid) {
+  DBC *cursor;
+  DBT k, d;
+  int err = 0, n = 0, m = 0, step, lo, hi, mid;
+
+  cursor = trackdb_opencursor(t->db, tid);
+  while(n < v->nvec) {
+    make_key(&d, v->vec[n]);
+    /* Find the first posting at or after candidate n */
+    if((err = cursor->c_get(cursor, make_key(&k, t->key), &d,
+                            DB_GET_BOTH_RANGE)))
+      break;
+    if(!compare_posting(v->vec[n], d.data, d.size)) {
+      v->vec[m++] = v->vec[n++];
+      continue;
+    }
+    /* Gallop to the first candidate at or after that posting */
+    lo = n;
+    for(step = 1;
+        n + step < v->nvec && compare_posting(v->vec[n + step],
+                                              d.data, d.size) < 0;
+        step *= 2)
+      lo = n + step;
+    hi = n + step < v->nvec ? n + step : v->nvec;
+    /* vec[lo] is before the posting, vec[hi] (if any) is not */
+    while(hi - lo > 1) {
+      mid = lo + (hi - lo) / 2;
+      if(compare_posting(v->vec[mid], d.data, d.size) < 0)
+        lo = mid;
+      else
+        hi = mid;
+    }
+    n = hi;
+    if(n < v->nvec && !compare_posting(v->vec[n], d.data, d.size))
+      v->vec[m++] = v->vec[n++];
   }
-  return 0;
+  v->nvec = m;
+  err = search_term_error(t, err);
+  if(trackdb_closecursor(cursor)) err = DB_LOCK_DEADLOCK;
+  return err;
 }
 
-/** @brief Called when disorder-choose might have completed
- * @param ev Event loop
- * @param which @ref CHOOSE_RUNNING or @ref CHOOSE_READING
- *
- * Once called with both @p which values, @ref choose_callback is called
- * (usually chosen_random_track()).
+/** @brief Normalize search terms
+ * @param wordlist Search terms
+ * @param nwordlist Number of search terms
+ * @param wp Where to put normalized terms
+ * @param istagp Where to put flags for which terms are tags
+ * @return 0 on success, -1 if a term is not valid UTF-8
  */
-static void choose_finished(ev_source *ev, unsigned which) {
-  choose_complete |= which;
-  if(choose_complete != (CHOOSE_RUNNING|CHOOSE_READING))
-    return;
-  choose_pid = -1;
-  if(choose_status == 0 && choose_output.nvec > 0) {
-    dynstr_terminate(&choose_output);
-    choose_callback(ev, xstrdup(choose_output.vec));
-  } else
-    choose_callback(ev, 0);
-}
+static int search_normalize(char **wordlist, int nwordlist,
+                            const char ***wp, char **istagp) {
+  const char **w;
+  char *istag;
+  int n;
 
-/** @brief Called when @c disorder-choose terminates
- * @param ev Event loop
- * @param pid Process ID
- * @param status Exit status
- * @param rusage Resource usage
- * @param u User data
- * @return 0
- */
-static int choose_exited(ev_source *ev,
-                         pid_t attribute((unused)) pid,
-                         int status,
-                         const struct rusage attribute((unused)) *rusage,
-                         void attribute((unused)) *u) {
-  if(status)
-    disorder_error(0, "disorder-choose %s", wstat(status));
-  choose_status = status;
-  choose_finished(ev, CHOOSE_RUNNING);
-  return 0;
-}
+  w = xmalloc(nwordlist * sizeof (char *));
+  istag = xmalloc_noptr(nwordlist);
+  for(n = 0; n < nwordlist; ++n) {
+    uint32_t *w32;
+    size_t nw32;
 
-/** @brief Called with data from @c disorder-choose pipe
- * @param ev Event loop
- * @param reader Reader state
- * @param ptr Data read
- * @param bytes Number of bytes read
- * @param eof Set at end of file
- * @param u User data
- * @return 0
- */
-static int choose_readable(ev_source *ev,
-                           ev_reader *reader,
-                           void *ptr,
-                           size_t bytes,
-                           int eof,
-                           void attribute((unused)) *u) {
-  dynstr_append_bytes(&choose_output, ptr, bytes);
-  ev_reader_consume(reader, bytes);
-  if(eof)
-    choose_finished(ev, CHOOSE_READING);
+    /* Case-fold and remove combining characters */
+    if(!(w32 = fold_string(wordlist[n], strlen(wordlist[n]), &nw32))
+       || !(w[n] = utf32_to_utf8(w32, nw32, 0)))
+      return -1;
+    if(checktag(w[n])) {
+      /* Normalize the tag */
+      w[n] = normalize_tag(w[n] + 4, strlen(w[n] + 4));
+      istag[n] = 1;
+    } else
+      istag[n] = 0;
+  }
+  *wp = w;
+  *istagp = istag;
   return 0;
 }
 
-/** @brief Called when @c disorder-choose pipe errors
- * @param ev Event loop
- * @param errno_value Error code
- * @param u User data
- * @return 0
+/** @brief Collect the indexed terms of a search
+ * @param terms Where to put the terms (room for @p nwordlist)
+ * @param w Normalized search terms
+ * @param istag Flags for which terms are tags
+ * @param nwordlist Number of search terms
+ * @return Number of terms
+ *
+ * Each distinct word or tag is a term to look up, except for stopwords, which
+ * aren't indexed.
  */
-static int choose_read_error(ev_source *ev,
-                             int errno_value,
-                             void attribute((unused)) *u) {
-  disorder_error(errno_value, "error reading disorder-choose pipe");
-  choose_finished(ev, CHOOSE_READING);
-  return 0;
+static int search_terms(struct search_term *terms,
+                        const char **w, const char *istag, int nwordlist) {
+  int i, n, nterms = 0;
+
+  for(n = 0; n < nwordlist; ++n) {
+    if(!istag[n] && stopword(w[n]))
+      continue;
+    for(i = 0; i < nterms; ++i)
+      if(terms[i].db == (istag[n] ? trackdb_tagsdb : trackdb_searchdb)
+         && !strcmp(terms[i].key, w[n]))
+        break;
+    if(i < nterms)
+      continue;
+    terms[nterms].db = istag[n] ? trackdb_tagsdb : trackdb_searchdb;
+    terms[nterms].dbname = istag[n] ? "tags" : "search";
+    terms[nterms].key = w[n];
+    ++nterms;
+  }
+  return nterms;
 }
 
-/** @brief Request a random track
- * @param ev Event source
- * @param callback Called with random track or NULL
- * @return 0 if a request was initiated, else -1
- *
- * Initiates a random track choice.  @p callback will later be called back with
- * the choice (or NULL on error).  If a choice is already underway then -1 is
- * returned and there will be no additional callback.
+/** @brief Score for each occurrence of a search word in a track's name */
+#define SEARCH_SCORE_WORD 1
+
+/** @brief Extra score for a search word appearing in a track's title */
+#define SEARCH_SCORE_TITLE 2
+
+/** @brief A ranked search result */
+struct search_hit {
+  /** @brief Track name */
+  const char *track;
+
+  /** @brief How well the track's name matches the search words */
+  long score;
+
+  /** @brief Number of times the track has been played or requested */
+  long popularity;
+};
+
+/** @brief Compare search results
+ * @param a First result
+ * @param b Second result
+ * @return Non-zero if @p a ranks below @p b
  *
- * The caller shouldn't assume that the track returned actually exists (it
- * might be removed between the choice and the callback, or between being added
- * to the queue and being played).
+ * Results are ranked by score, then by popularity, then alphabetically.
  */
-int trackdb_request_random(ev_source *ev,
-                           random_callback *callback) {
-  int p[2];
-  
-  if(choose_pid != -1)
-    return -1;                          /* don't run concurrent chooses */
-  xpipe(p);
-  cloexec(p[0]);
-  choose_pid = subprogram(ev, p[1], "disorder-choose", (char *)0);
-  choose_fd = p[0];
-  xclose(p[1]);
-  choose_callback = callback;
-  choose_output.nvec = 0;
-  choose_complete = 0;
-  if(!ev_reader_new(ev, p[0], choose_readable, choose_read_error, 0,
-                    "disorder-choose reader")) /* owns p[0] */
-    disorder_fatal(0, "ev_reader_new for disorder-choose reader failed");
-  ev_child(ev, choose_pid, 0, choose_exited, 0); /* owns the subprocess */
-  return 0;
+static inline int search_hit_lt(const struct search_hit *a,
+                                const struct search_hit *b) {
+  if(a->score != b->score)
+    return a->score < b->score;
+  if(a->popularity != b->popularity)
+    return a->popularity < b->popularity;
+  return strcmp(a->track, b->track) > 0;
 }
 
-/** @brief Get a track name part, using prefs
+HEAP_TYPE(search_heap, struct search_hit *, search_hit_lt);
+HEAP_DEFINE(search_heap, struct search_hit *, search_hit_lt);
+
+/** @brief State for a ranked search */
+struct search_rank {
+  /** @brief The best results so far, worst first */
+  struct search_heap heap;
+
+  /** @brief How many results to keep */
+  int keep;
+
+  /** @brief Total number of matching tracks */
+  int matches;
+};
+
+/** @brief Score a track that matches a search
+ * @param hit Result to fill in
  * @param track Track name
- * @param context Context ("display" etc)
- * @param part Part ("album" etc)
- * @param p Preference
- * @param used_db Set if a preference is used
- * @return Name part (never NULL)
+ * @param p Track preferences
+ * @param w Normalized search terms
+ * @param istag Flags for which terms are tags
+ * @param nwordlist Number of search terms
  *
- * Used by compute_alias() and trackdb_getpart().
+ * Each occurrence of a search word in the track's name words scores
+ * @ref SEARCH_SCORE_WORD, and a search word appearing in the title (the
+ * display title preference if there is one, else the last path component)
+ * scores an extra @ref SEARCH_SCORE_TITLE.
  */
-static const char *getpart(const char *track,
-                           const char *context,
-                           const char *part,
-                           const struct kvp *p,
-                           int *used_db) {
-  const char *result;
-  char *pref;
+static void search_score(struct search_hit *hit, const char *track,
+                         const struct kvp *p, const char **w,
+                         const char *istag, int nwordlist) {
+  struct vector all, title;
+  const struct kvp *q;
+  const char *rootless = track_rootless(track), *s;
+  const char *played, *requested;
+  int i, j;
 
-  byte_xasprintf(&pref, "trackname_%s_%s", context, part);
-  if((result = kvp_get(p, pref)))
-    *used_db = 1;
+  if(!rootless)
+    rootless = track;                   /* bodge */
+  rootless = strip_extension(rootless);
+  vector_init(&all);
+  vector_init(&title);
+  word_split(&all, rootless, tailor_underscore_Word_Break_Other);
+  for(q = p; q; q = q->next)
+    if(is_display_pref(q->name))
+      word_split(&all, q->value, 0);
+  if((s = kvp_get(p, "trackname_display_title")))
+    word_split(&title, s, 0);
   else
-    result = trackname_part(track, context, part);
-  assert(result != 0);
-  return result;
+    word_split(&title, (s = strrchr(rootless, '/')) ? s + 1 : rootless,
+               tailor_underscore_Word_Break_Other);
+  hit->track = track;
+  hit->score = 0;
+  for(i = 0; i < nwordlist; ++i) {
+    if(istag[i])
+      continue;
+    for(j = 0; j < all.nvec; ++j)
+      if(!strcmp(w[i], all.vec[j]))
+        hit->score += SEARCH_SCORE_WORD;
+    for(j = 0; j < title.nvec; ++j)
+      if(!strcmp(w[i], title.vec[j])) {
+        hit->score += SEARCH_SCORE_TITLE;
+        break;
+      }
+  }
+  played = kvp_get(p, "played");
+  requested = kvp_get(p, "requested");
+  hit->popularity = (played ? atol(played) : 0)
+    + (requested ? atol(requested) : 0);
 }
 
-/** @brief Get a track name part
+/** @brief Add a matching track to a ranked search
+ * @param rank Ranked search
  * @param track Track name
- * @param context Context ("display" etc)
- * @param part Part ("album" etc)
- * @return Name part (never NULL)
+ * @param p Track preferences
+ * @param w Normalized search terms
+ * @param istag Flags for which terms are tags
+ * @param nwordlist Number of search terms
  *
- * This is interface used by c_part().
+ * Only the best @c keep results are retained.
  */
-const char *trackdb_getpart(const char *track,
-                            const char *context,
-                            const char *part) {
-  struct kvp *p;
-  DB_TXN *tid;
-  char *pref;
-  const char *actual;
-  int used_db;
+static void search_rank_add(struct search_rank *rank, const char *track,
+                            const struct kvp *p, const char **w,
+                            const char *istag, int nwordlist) {
+  struct search_hit *hit;
 
-  /* construct the full pref */
-  byte_xasprintf(&pref, "trackname_%s_%s", context, part);
-  for(;;) {
-    tid = trackdb_begin_transaction();
-    if(gettrackdata(track, 0, &p, &actual, 0, tid) == DB_LOCK_DEADLOCK)
-      goto fail;
-    break;
-fail:
-    trackdb_abort_transaction(tid);
+  ++rank->matches;
+  if(!rank->keep)
+    return;
+  hit = xmalloc(sizeof *hit);
+  search_score(hit, track, p, w, istag, nwordlist);
+  if(search_heap_count(&rank->heap) < rank->keep)
+    search_heap_insert(&rank->heap, hit);
+  else if(search_hit_lt(search_heap_first(&rank->heap), hit)) {
+    search_heap_remove(&rank->heap);
+    search_heap_insert(&rank->heap, hit);
   }
-  trackdb_commit_transaction(tid);
-  return getpart(actual, context, part, p, &used_db);
 }
 
-/** @brief Get the raw (filesystem) path for @p track
- * @param track track Track name (can be an alias)
- * @return Raw path (never NULL)
+/** @brief Find the tracks matching a search
+ * @param u Where to append matching tracks
+ * @param w Normalized search terms
+ * @param istag Flags for which terms are tags
+ * @param nwordlist Number of search terms
+ * @param terms Indexed terms, with counts filled in and all nonzero
+ * @param nterms Number of indexed terms (at least 1)
+ * @param max Stop when @p u has this many tracks, or 0 for no limit
+ * @param seen Tracks to leave out, updated with those appended; or NULL
+ * @param rank Ranked search to add tracks to instead of @p u, or NULL
+ * @param tid Owning transaction
+ * @return 0 or DB_LOCK_DEADLOCK
  *
- * The raw path is the actual bytes that came out of readdir() etc.
+ * @p terms is reordered.
  */
-const char *trackdb_rawpath(const char *track) {
+static int search_matches(struct vector *u,
+                          const char **w, const char *istag, int nwordlist,
+                          struct search_term *terms, int nterms,
+                          int max, hash *seen, struct search_rank *rank,
+                          DB_TXN *tid) {
+  char **twords, **tags;
+  struct vector v;
+  struct kvp *t, *p;
+  int i, j, n, err;
+
+  /* start from the rarest term and narrow down with the rest in order of
+   * increasing frequency, so the candidate list is as short as possible
+   * throughout */
+  qsort(terms, nterms, sizeof *terms, compare_search_terms);
+  vector_init(&v);
+  if((err = search_term_postings(&v, &terms[0], tid)))
+    return err;
+  for(n = 1; n < nterms && v.nvec; ++n)
+    if((err = search_term_intersect(&v, &terms[n], tid)))
+      return err;
+  /* check the survivors against their current words and tags; this catches
+   * stopwords, which aren't indexed, and display preferences changed since
+   * the track was last indexed */
+  for(n = 0; n < v.nvec && !(max && u->nvec >= max); ++n) {
+    if(seen && hash_find(seen, v.vec[n]))
+      continue;
+    if((err = gettrackdata(v.vec[n], &t, &p, 0, 0, tid) == DB_LOCK_DEADLOCK))
+      return DB_LOCK_DEADLOCK;
+    else if(err) {
+      disorder_error(0, "track %s unexpected error: %s",
+                     v.vec[n], db_strerror(err));
+      continue;
+    }
+    twords = track_words(v.vec[n], t, p);
+    tags = parsetags(kvp_get(p, "tags"));
+    for(i = 0; i < nwordlist; ++i) {
+      if(istag[i]) {
+        /* Track must have this tag */
+        for(j = 0; tags[j]; ++j)
+          if(!strcmp(w[i], tags[j])) break; /* tag found */
+        if(!tags[j]) break;             /* tag not found */
+      } else {
+        /* Track must contain this word */
+        for(j = 0; twords[j]; ++j)
+          if(!strcmp(w[i], twords[j])) break; /* word found */
+        if(!twords[j]) break;		/* word not found */
+      }
+    }
+    if(i >= nwordlist && rank)          /* all words found */
+      search_rank_add(rank, v.vec[n], p, w, istag, nwordlist);
+    else if(i >= nwordlist) {
+      vector_append(u, v.vec[n]);
+      if(seen)
+        hash_add(seen, v.vec[n], "", HASH_INSERT);
+    }
+  }
+  return 0;
+}
+
+/* return a list of tracks containing all of the words given.  If you
+ * ask for only stopwords you get no tracks. */
+char **trackdb_search(char **wordlist, int nwordlist, int *ntracks) {
+  const char **w;
+  char *istag;
+  int n, err, nterms;
+  struct vector u;
   DB_TXN *tid;
-  struct kvp *t;
-  const char *path;
+  struct search_term *terms;
 
+  *ntracks = 0;				/* for early returns */
+  /* normalize all the words */
+  if(search_normalize(wordlist, nwordlist, &w, &istag))
+    return 0;
+  terms = xmalloc(nwordlist * sizeof *terms);
+  if(!(nterms = search_terms(terms, w, istag, nwordlist)))
+    /* Only stopwords */
+    return 0;
+  vector_init(&u);
   for(;;) {
-    tid = trackdb_begin_transaction();
-    if(gettrackdata(track, &t, 0, 0, 0, tid) == DB_LOCK_DEADLOCK)
+    tid = trackdb_begin_read_transaction();
+    u.nvec = 0;
+    /* find out how common each term is; if any matches nothing then so does
+     * the search */
+    for(n = 0; n < nterms; ++n) {
+      if((err = search_term_count(&terms[n], tid)))
+        goto fail;
+      if(!terms[n].count)
+        break;
+    }
+    if(n < nterms)
+      break;
+    if((err = search_matches(&u, w, istag, nwordlist, terms, nterms,
+                             0, 0, 0, tid)))
       goto fail;
     break;
-fail:
+  fail:
     trackdb_abort_transaction(tid);
+    disorder_info("retrying search");
   }
   trackdb_commit_transaction(tid);
-  if(!(path = kvp_get(t, "_path"))) path = track;
-  return path;
+  vector_terminate(&u);
+  if(ntracks)
+    *ntracks = u.nvec;
+  return u.vec;
 }
 
-/* trackdb_list **************************************************************/
-
-/* this is incredibly ugly, sorry, perhaps it will be rewritten to be actually
- * readable at some point */
-
-/* return true if the basename of TRACK[0..TL-1], as defined by DL, matches RE.
- * If RE is a null pointer then it matches everything. */
-/** @brief Match a track against a rgeexp
- * @param dl Length of directory part of track
- * @param track Track name
- * @param tl Length of track name
- * @param re Regular expression or NULL
- * @return Nonzero on match
+/** @brief Search for tracks, ranking the results
+ * @param wordlist Search terms
+ * @param nwordlist Number of search terms
+ * @param offset Number of top-ranked tracks to skip
+ * @param limit Maximum number of tracks to return, or 0 for no limit
+ * @param ntracks Where to store number of tracks returned
+ * @param nmatches Where to store the total number of matching tracks
+ * @return List of tracks, best first
  *
- * @p tl is the total length of @p track, @p dl is the length of the directory
- * part (the index of the final "/").  The subject of the regexp match is the
- * basename, i.e. the part after @p dl.
- *
- * If @p re is NULL then always matches.
+ * Matches tracks in the same way as trackdb_search(), but ranks them as
+ * described for search_score() and returns only the requested page.  Only the
+ * best @p offset + @p limit tracks are kept while searching.
  */
-static int track_matches(size_t dl, const char *track, size_t tl,
-			 const regexp *re) {
-  size_t ovec[3];
-  int rc;
+char **trackdb_search_page(char **wordlist, int nwordlist,
+                           int offset, int limit,
+                           int *ntracks, int *nmatches) {
+  const char **w;
+  char *istag;
+  int n, err, nterms, nhits;
+  struct vector u;
+  DB_TXN *tid;
+  struct search_term *terms;
+  struct search_rank rank;
+  struct search_hit **hits;
 
-  if(!re)
-    return 1;
-  track += dl + 1;
-  tl -= (dl + 1);
-  switch(rc = regexp_match(re, track, tl, 0, ovec, 3)) {
-  case RXERR_NOMATCH: return 0;
-  default:
-    if(rc < 0) {
-      disorder_error(0, "regexp_match returned %d, subject '%s'", rc, track);
-      return 0;
+  *ntracks = 0;				/* for early returns */
+  *nmatches = 0;
+  if(search_normalize(wordlist, nwordlist, &w, &istag))
+    return 0;
+  terms = xmalloc(nwordlist * sizeof *terms);
+  if(!(nterms = search_terms(terms, w, istag, nwordlist)))
+    /* Only stopwords */
+    return 0;
+  if(offset < 0)
+    offset = 0;
+  rank.keep = limit > 0 && limit <= INT_MAX - offset ? offset + limit : INT_MAX;
+  for(;;) {
+    tid = trackdb_begin_read_transaction();
+    search_heap_init(&rank.heap);
+    rank.matches = 0;
+    for(n = 0; n < nterms; ++n) {
+      if((err = search_term_count(&terms[n], tid)))
+        goto fail;
+      if(!terms[n].count)
+        break;
     }
-    return 1;
+    if(n < nterms)
+      break;
+    if((err = search_matches(0, w, istag, nwordlist, terms, nterms,
+                             0, 0, &rank, tid)))
+      goto fail;
+    break;
+  fail:
+    trackdb_abort_transaction(tid);
+    disorder_info("retrying search");
   }
+  trackdb_commit_transaction(tid);
+  /* the heap yields the worst first */
+  nhits = search_heap_count(&rank.heap);
+  hits = xmalloc(nhits * sizeof *hits);
+  for(n = nhits; n > 0; --n)
+    hits[n - 1] = search_heap_remove(&rank.heap);
+  vector_init(&u);
+  for(n = offset; n < nhits; ++n)
+    vector_append(&u, (char *)hits[n]->track);
+  vector_terminate(&u);
+  *ntracks = u.nvec;
+  *nmatches = rank.matches;
+  return u.vec;
 }
 
-/** @brief Generate a list of tracks and/or directories in @p dir
- * @param v Where to put results
- * @param dir Directory to list
- * @param what Bitmap of objects to return
- * @param re Regexp to filter matches (or NULL to accept all)
+/** @brief List the indexed words starting with a prefix
+ * @param v Where to put the words (in order)
+ * @param prefix Normalized prefix
  * @param tid Owning transaction
  * @return 0 or DB_LOCK_DEADLOCK
  */
-static int do_list(struct vector *v, const char *dir,
-                   enum trackdb_listable what, const regexp *re, DB_TXN *tid) {
+static int prefix_words(struct vector *v, const char *prefix, DB_TXN *tid) {
   DBC *cursor;
   DBT k, d;
-  size_t dl;
-  char *ptr;
-  int err;
-  size_t l, last_dir_len = 0;
-  char *last_dir = 0, *track;
-  struct kvp *p;
+  int err, what = DB_SET_RANGE;
+  size_t nprefix = strlen(prefix);
 
-  dl = strlen(dir);
-  cursor = trackdb_opencursor(trackdb_tracksdb, tid);
-  make_key(&k, dir);
-  prepare_data(&d);
-  /* find the first key >= dir */
-  err = cursor->c_get(cursor, &k, &d, DB_SET_RANGE);
-  /* keep going while we're dealing with <dir/anything> */
-  while(err == 0
-	&& k.size > dl
-	&& ((char *)k.data)[dl] == '/'
-	&& !memcmp(k.data, dir, dl)) {
-    ptr = memchr((char *)k.data + dl + 1, '/', k.size - (dl + 1));
-    if(ptr) {
-      /* we have <dir/component/anything>, so <dir/component> is a directory */
-      l = ptr - (char *)k.data;
-      if(what & trackdb_directories)
-	if(!(last_dir
-	     && l == last_dir_len
-	     && !memcmp(last_dir, k.data, l))) {
-	  last_dir = xstrndup(k.data, last_dir_len = l);
-	  if(track_matches(dl, k.data, l, re))
-	    vector_append(v, last_dir);
-	}
-    } else {
-      /* found a plain file */
-      if((what & trackdb_files)) {
-	track = xstrndup(k.data, k.size);
-        if((err = trackdb_getdata(trackdb_prefsdb,
-                                  track, &p, tid)) == DB_LOCK_DEADLOCK)
-          goto deadlocked;
-        /* There's an awkward question here...
-         *
-         * If a track shares a directory with its alias then we could
-         * do one of three things:
-         * - report both.  Looks ridiculuous in most UIs.
-         * - report just the alias.  Remarkably inconvenient to write
-         *   UI code for!
-         * - report just the real name.  Ugly if the UI doesn't prettify
-         *   names via the name parts.
-         */
-#if 1
-        /* If this file is an alias for a track in the same directory then we
-         * skip it */
-        struct kvp *t = kvp_urldecode(d.data, d.size);
-        const char *alias_target = kvp_get(t, "_alias_for");
-        if(!(alias_target
-             && !strcmp(d_dirname(alias_target),
-                        d_dirname(track))))
-	  if(track_matches(dl, k.data, k.size, re))
-	    vector_append(v, track);
-#else
-	/* if this file has an alias in the same directory then we skip it */
-           char *alias;
-        if((err = compute_alias(&alias, track, p, tid)))
-          goto deadlocked;
-        if(!(alias && !strcmp(d_dirname(alias), d_dirname(track))))
-	  if(track_matches(dl, k.data, k.size, re))
-	    vector_append(v, track);
-#endif
-      }
-    }
-    err = cursor->c_get(cursor, &k, &d, DB_NEXT);
+  v->nvec = 0;
+  cursor = trackdb_opencursor(trackdb_wordsdb, tid);
+  make_key(&k, prefix);
+  while(!(err = cursor->c_get(cursor, &k, prepare_data(&d), what))
+        && k.size >= nprefix && !memcmp(k.data, prefix, nprefix)) {
+    vector_append(v, xstrndup(k.data, k.size));
+    what = DB_NEXT;
   }
   switch(err) {
   case 0:
-    break;
   case DB_NOTFOUND:
     err = 0;
     break;
   case DB_LOCK_DEADLOCK:
-    disorder_error(0, "error querying database: %s", db_strerror(err));
+    disorder_error(0, "error querying words.db: %s", db_strerror(err));
     break;
   default:
-    disorder_fatal(0, "error querying database: %s", db_strerror(err));
+    disorder_fatal(0, "error querying words.db: %s", db_strerror(err));
   }
-deadlocked:
   if(trackdb_closecursor(cursor)) err = DB_LOCK_DEADLOCK;
   return err;
 }
 
-/** @brief Get the directories or files below @p dir
- * @param dir Directory to list
- * @param np Where to put number of results (or NULL)
- * @param what Bitmap of objects to return
- * @param re Regexp to filter matches (or NULL to accept all)
- * @return List of tracks
+/** @brief Search for tracks as the search terms are typed
+ * @param wordlist Search terms, the last of which may be incomplete
+ * @param nwordlist Number of search terms
+ * @param max Maximum number of tracks to return, or 0 for no limit
+ * @param ntracks Where to store number of tracks
+ * @return List of matching tracks
+ *
+ * Like trackdb_search(), except that the last term matches any word that
+ * starts with it.  Tracks with the last term as a whole word come first,
+ * and the rest follow in order of the word they matched.  Tags must still
+ * match in full.
  */
-char **trackdb_list(const char *dir, int *np, enum trackdb_listable what,
-                    const regexp *re) {
+char **trackdb_search_prefix(char **wordlist, int nwordlist, int max,
+                             int *ntracks) {
+  const char **w;
+  char *istag;
+  int n, err, nterms;
+  struct vector u, words;
   DB_TXN *tid;
-  int n;
-  struct vector v;
+  struct search_term *terms, *scratch;
+  const char *prefix;
+  hash *seen;
 
-  vector_init(&v);
+  *ntracks = 0;				/* for early returns */
+  if(!nwordlist)
+    return 0;
+  if(search_normalize(wordlist, nwordlist, &w, &istag))
+    return 0;
+  if(istag[nwordlist - 1] || !*w[nwordlist - 1])
+    /* Nothing to complete */
+    return trackdb_search(wordlist, nwordlist, ntracks);
+  prefix = w[nwordlist - 1];
+  terms = xmalloc(nwordlist * sizeof *terms);
+  scratch = xmalloc(nwordlist * sizeof *terms);
+  nterms = search_terms(terms, w, istag, nwordlist - 1);
+  vector_init(&u);
+  vector_init(&words);
   for(;;) {
-    tid = trackdb_begin_transaction();
-    v.nvec = 0;
-    if(dir) {
-      if(do_list(&v, dir, what, re, tid))
+    tid = trackdb_begin_read_transaction();
+    u.nvec = 0;
+    seen = hash_new(1);
+    for(n = 0; n < nterms; ++n) {
+      if((err = search_term_count(&terms[n], tid)))
+        goto fail;
+      if(!terms[n].count)
+        break;
+    }
+    if(n < nterms)
+      break;
+    if((err = prefix_words(&words, prefix, tid)))
+      goto fail;
+    /* try each completion of the last term in turn */
+    for(n = 0; n < words.nvec && !(max && u.nvec >= max); ++n) {
+      memcpy(scratch, terms, nterms * sizeof *terms);
+      scratch[nterms].db = trackdb_searchdb;
+      scratch[nterms].dbname = "search";
+      scratch[nterms].key = words.vec[n];
+      if((err = search_term_count(&scratch[nterms], tid)))
+        goto fail;
+      if(!scratch[nterms].count)
+        continue;
+      w[nwordlist - 1] = words.vec[n];
+      if((err = search_matches(&u, w, istag, nwordlist, scratch, nterms + 1,
+                               max, seen, 0, tid)))
         goto fail;
-    } else {
-      for(n = 0; n < config->collection.n; ++n)
-        if(do_list(&v, config->collection.s[n].root, what, re, tid))
-          goto fail;
     }
     break;
-fail:
+  fail:
     trackdb_abort_transaction(tid);
+    disorder_info("retrying search");
   }
   trackdb_commit_transaction(tid);
-  vector_terminate(&v);
-  if(np)
-    *np = v.nvec;
-  return v.vec;
+  vector_terminate(&u);
+  if(ntracks)
+    *ntracks = u.nvec;
+  return u.vec;
 }
 
-/** @brief Detect a tag element in a search string
- * @param s Element of search string
- * @return Pointer to tag name (in @p s) if this is a tag: search, else NULL
+/** @brief Most words considered as corrections for each fuzzy search term */
+#define FUZZY_CANDIDATES 256
+
+/** @brief Count the edits needed to turn one word into another
+ * @param a First word
+ * @param na Length of @p a
+ * @param b Second word
+ * @param nb Length of @p b
+ * @return Number of characters inserted, deleted or replaced
+ */
+static size_t edit_distance(const uint32_t *a, size_t na,
+                            const uint32_t *b, size_t nb) {
+  size_t *row = xmalloc_noptr((nb + 1) * sizeof *row);
+  size_t i, j, diag, up;
+
+  for(j = 0; j <= nb; ++j)
+    row[j] = j;
+  for(i = 1; i <= na; ++i) {
+    diag = row[0];
+    row[0] = i;
+    for(j = 1; j <= nb; ++j) {
+      up = row[j];
+      row[j] = diag + (a[i - 1] != b[j - 1]);
+      if(up + 1 < row[j])
+        row[j] = up + 1;
+      if(row[j - 1] + 1 < row[j])
+        row[j] = row[j - 1] + 1;
+      diag = up;
+    }
+  }
+  return row[nb];
+}
+
+/** @brief Test whether a word has a trigram
+ * @param t Trigram
+ * @param word Word
+ * @param foundp Where to store the answer
+ * @param tid Owning transaction
+ * @return 0 or DB_LOCK_DEADLOCK
+ */
+static int trigram_has_word(const struct search_term *t, const char *word,
+                            int *foundp, DB_TXN *tid) {
+  DBC *cursor;
+  DBT k, d;
+  int err;
+
+  cursor = trackdb_opencursor(t->db, tid);
+  err = cursor->c_get(cursor, make_key(&k, t->key), make_key(&d, word),
+                      DB_GET_BOTH);
+  *foundp = !err;
+  err = search_term_error(t, err);
+  if(trackdb_closecursor(cursor)) err = DB_LOCK_DEADLOCK;
+  return err;
+}
+
+/** @brief Find the indexed word closest to a misspelt one
+ * @param word Normalized word, not itself indexed
+ * @param bestp Where to store the correction, or NULL if there is none
+ * @param tid Owning transaction
+ * @return 0 or DB_LOCK_DEADLOCK
  *
- * Tag searches take the form "tag:TAG".
+ * Candidates are the words sharing trigrams with @p word.  The trigrams are
+ * read rarest first, and once there are @ref FUZZY_CANDIDATES candidates no
+ * more are taken on; the remaining trigrams are only looked up for the
+ * candidates already found, so the work is bounded however common they are.
+ *
+ * The correction is the candidate with the fewest edits from @p word, then
+ * the most trigrams in common, then the first alphabetically.  Words that
+ * need more than one edit for every four characters, or more than three in
+ * all, are not corrections at all.
  */
-static const char *checktag(const char *s) {
-  if(!strncmp(s, "tag:", 4))
-    return s + 4;
-  else
+static int fuzzy_correct(const char *word, const char **bestp, DB_TXN *tid) {
+  struct vector trigrams, postings;
+  struct search_term *t;
+  hash *shared;
+  char **candidates;
+  uint32_t *w32, *c32;
+  size_t nw32, nc32, distance, best_distance = 0, limit;
+  int n, m, err, found, *count, best_count = 0, ncandidates = 0;
+  const int one = 1;
+
+  *bestp = 0;
+  if(!(w32 = utf8_to_utf32(word, strlen(word), &nw32)))
     return 0;
+  limit = nw32 / 4 + 1;
+  if(limit > 3)
+    limit = 3;
+  word_trigrams(&trigrams, word);
+  t = xcalloc(trigrams.nvec, sizeof *t);
+  for(n = 0; n < trigrams.nvec; ++n) {
+    t[n].db = trackdb_trigramsdb;
+    t[n].dbname = "trigrams";
+    t[n].key = trigrams.vec[n];
+    if((err = search_term_count(&t[n], tid)))
+      return err;
+  }
+  qsort(t, trigrams.nvec, sizeof *t, compare_search_terms);
+  shared = hash_new(sizeof (int));
+  vector_init(&postings);
+  for(n = 0; n < trigrams.nvec; ++n) {
+    if(!t[n].count)
+      continue;
+    if(ncandidates >= FUZZY_CANDIDATES
+       && t[n].count > (db_recno_t)ncandidates) {
+      /* Cheaper to look up each candidate than to read the whole list */
+      candidates = hash_keys(shared);
+      for(m = 0; candidates[m]; ++m) {
+        if((err = trigram_has_word(&t[n], candidates[m], &found, tid)))
+          return err;
+        if(found)
+          ++*(int *)hash_find(shared, candidates[m]);
+      }
+      continue;
+    }
+    if((err = search_term_postings(&postings, &t[n], tid)))
+      return err;
+    for(m = 0; m < postings.nvec; ++m) {
+      if((count = hash_find(shared, postings.vec[m])))
+        ++*count;
+      else if(ncandidates < FUZZY_CANDIDATES) {
+        hash_add(shared, postings.vec[m], &one, HASH_INSERT);
+        ++ncandidates;
+      }
+    }
+  }
+  candidates = hash_keys(shared);
+  for(m = 0; candidates[m]; ++m) {
+    if(!(c32 = utf8_to_utf32(candidates[m], strlen(candidates[m]), &nc32)))
+      continue;
+    /* The lengths alone may rule it out */
+    if((nc32 > nw32 ? nc32 - nw32 : nw32 - nc32) > limit)
+      continue;
+    if((distance = edit_distance(w32, nw32, c32, nc32)) > limit)
+      continue;
+    count = hash_find(shared, candidates[m]);
+    if(!*bestp
+       || distance < best_distance
+       || (distance == best_distance
+           && (*count > best_count
+               || (*count == best_count
+                   && strcmp(candidates[m], *bestp) < 0)))) {
+      *bestp = candidates[m];
+      best_distance = distance;
+      best_count = *count;
+    }
+  }
+  return 0;
 }
 
-/* return a list of tracks containing all of the words given.  If you
- * ask for only stopwords you get no tracks. */
-char **trackdb_search(char **wordlist, int nwordlist, int *ntracks) {
-  const char **w, *best = 0, *tag;
-  char **twords, **tags;
+/** @brief Search for tracks, allowing for misspelt words
+ * @param wordlist Search terms
+ * @param nwordlist Number of search terms
+ * @param max Maximum number of tracks to return, or 0 for no limit
+ * @param ntracks Where to store number of tracks
+ * @return List of matching tracks
+ *
+ * Like trackdb_search(), except that a search word that no track contains is
+ * replaced by the closest word that some track does contain, as found by
+ * fuzzy_correct().  Tags must still match exactly.
+ */
+char **trackdb_search_fuzzy(char **wordlist, int nwordlist, int max,
+                            int *ntracks) {
+  const char **w, *best;
   char *istag;
-  int i, j, n, err, what;
-  DBC *cursor = 0;
-  DBT k, d;
-  struct vector u, v;
+  int i, n, err, nterms;
+  struct vector u;
   DB_TXN *tid;
-  struct kvp *p;
-  int ntags = 0;
-  DB *db;
-  const char *dbname;
+  struct search_term *terms;
 
   *ntracks = 0;				/* for early returns */
-  /* normalize all the words */
-  w = xmalloc(nwordlist * sizeof (char *));
-  istag = xmalloc_noptr(nwordlist);
-  for(n = 0; n < nwordlist; ++n) {
-    uint32_t *w32;
-    size_t nw32;
-
-    w[n] = utf8_casefold_compat(wordlist[n], strlen(wordlist[n]), 0);
-    if(checktag(w[n])) {
-      ++ntags;         /* count up tags */
-      /* Normalize the tag */
-      w[n] = normalize_tag(w[n] + 4, strlen(w[n] + 4));
-      istag[n] = 1;
-    } else {
-      /* Normalize the search term by removing combining characters */
-      if(!(w32 = utf8_to_utf32(w[n], strlen(w[n]), &nw32)))
-        return 0;
-      nw32 = remove_combining_chars(w32, nw32);
-      if(!(w[n] = utf32_to_utf8(w32, nw32, 0)))
-        return 0;
-      istag[n] = 0;
-    }
-  }
-  /* find the longest non-stopword */
-  for(n = 0; n < nwordlist; ++n)
-    if(!istag[n] && !stopword(w[n]))
-      if(!best || strlen(w[n]) > strlen(best))
-	best = w[n];
-  /* TODO: we should at least in principal be able to identify the word or tag
-   * with the least matches in log time, and choose that as our primary search
-   * term. */
-  if(ntags && !best) {
-    /* Only tags are listed.  We limit to the first and narrow down with the
-     * rest. */
-    best = istag[0] ? w[0] : 0;
-    db = trackdb_tagsdb;
-    dbname = "tags";
-  } else if(best) {
-    /* We can limit to some word. */
-    db = trackdb_searchdb;
-    dbname = "search";
-  } else {
+  if(search_normalize(wordlist, nwordlist, &w, &istag))
+    return 0;
+  terms = xmalloc(nwordlist * sizeof *terms);
+  if(!(nterms = search_terms(terms, w, istag, nwordlist)))
     /* Only stopwords */
     return 0;
-  }
   vector_init(&u);
-  vector_init(&v);
   for(;;) {
-    tid = trackdb_begin_transaction();
-    /* find all the tracks that have that word */
-    make_key(&k, best);
-    prepare_data(&d);
-    what = DB_SET;
-    v.nvec = 0;
-    cursor = trackdb_opencursor(db, tid);
-    while(!(err = cursor->c_get(cursor, &k, &d, what))) {
-      vector_append(&v, xstrndup(d.data, d.size));
-      what = DB_NEXT_DUP;
-    }
-    switch(err) {
-    case DB_NOTFOUND:
-      err = 0;
-      break;
-    case DB_LOCK_DEADLOCK:
-      disorder_error(0, "error querying %s database: %s",
-                     dbname, db_strerror(err));
-      break;
-    default:
-      disorder_fatal(0, "error querying %s database: %s",
-                     dbname, db_strerror(err));
-    }
-    if(trackdb_closecursor(cursor)) err = DB_LOCK_DEADLOCK;
-    cursor = 0;
-    if(err)
-      goto fail;
-    cursor = 0;
-    /* do a naive search over that (hopefuly fairly small) list of tracks */
+    tid = trackdb_begin_read_transaction();
     u.nvec = 0;
-    for(n = 0; n < v.nvec; ++n) {
-      if((err = gettrackdata(v.vec[n], 0, &p, 0, 0, tid) == DB_LOCK_DEADLOCK))
+    for(n = 0; n < nterms; ++n) {
+      if((err = search_term_count(&terms[n], tid)))
         goto fail;
-      else if(err) {
-        disorder_error(0, "track %s unexpected error: %s",
-                       v.vec[n], db_strerror(err));
-        continue;
-      }
-      twords = track_to_words(v.vec[n], p);
-      tags = parsetags(kvp_get(p, "tags"));
-      for(i = 0; i < nwordlist; ++i) {
-        if(istag[i]) {
-          tag = w[i];
-          /* Track must have this tag */
-          for(j = 0; tags[j]; ++j)
-            if(!strcmp(tag, tags[j])) break; /* tag found */
-          if(!tags[j]) break;           /* tag not found */
-        } else {
-          /* Track must contain this word */
-          for(j = 0; twords[j]; ++j)
-            if(!strcmp(w[i], twords[j])) break; /* word found */
-          if(!twords[j]) break;		/* word not found */
-        }
+      if(!terms[n].count && terms[n].db == trackdb_searchdb) {
+        if((err = fuzzy_correct(terms[n].key, &best, tid)))
+          goto fail;
+        if(!best)
+          break;
+        /* The survivors are checked against the corrected word */
+        for(i = 0; i < nwordlist; ++i)
+          if(!istag[i] && !strcmp(w[i], terms[n].key))
+            w[i] = best;
+        terms[n].key = best;
+        if((err = search_term_count(&terms[n], tid)))
+          goto fail;
       }
-      if(i >= nwordlist)                /* all words found */
-        vector_append(&u, v.vec[n]);
+      if(!terms[n].count)
+        break;
     }
+    if(n < nterms)
+      break;
+    if((err = search_matches(&u, w, istag, nwordlist, terms, nterms,
+                             max, 0, 0, tid)))
+      goto fail;
     break;
   fail:
-    trackdb_closecursor(cursor);
-    cursor = 0;
     trackdb_abort_transaction(tid);
     disorder_info("retrying search");
   }
@@ -2584,7 +5506,7 @@ int trackdb_scan(const char *root,
        || (k.size > root_len
            && !strncmp(k.data, root, root_len)
            && ((char *)k.data)[root_len] == '/')) {
-      data = kvp_urldecode(d.data, d.size);
+      data = decode_data(&d);
       if(kvp_get(data, "_path")) {
         track = xstrndup(k.data, k.size);
         /* TODO: trackdb_prefsdb is currently a DB_HASH.  This means we have to
@@ -2598,7 +5520,7 @@ int trackdb_scan(const char *root,
         switch(err = trackdb_prefsdb->get(trackdb_prefsdb, tid, &k,
                                           prepare_data(&pd), 0)) {
         case 0:
-          prefs = kvp_urldecode(pd.data, pd.size);
+          prefs = decode_data(&pd);
           break;
         case DB_NOTFOUND:
           prefs = 0;
@@ -2661,28 +5583,125 @@ void trackdb_add_rescanned(void (*rescanned)(void *ru),
   }
 }
 
+/** @brief Called when a rescan has finished
+ *
+ * In the server that ran it or, for a zone, when the library's server is seen
+ * to have finished one.
+ */
+static void rescan_complete(void) {
+  /* Our cached search and listing results are out of date now */
+  ++trackdb_generation;
+  track_filter_build();
+  eventlog("rescanned", (char *)0);
+  /* Call rescanned callbacks */
+  while(rescanned_list) {
+    void (*rescanned)(void *u_) = rescanned_list->rescanned;
+    void *ru = rescanned_list->ru;
+
+    rescanned_list = rescanned_list->next;
+    rescanned(ru);
+  }
+}
+
 /* called when the rescanner terminates */
 static int reap_rescan(ev_source attribute((unused)) *ev,
                        pid_t pid,
                        int status,
                        const struct rusage attribute((unused)) *rusage,
                        void attribute((unused)) *u) {
+  char buf[32];
+  int e;
+
   if(pid == rescan_pid) rescan_pid = -1;
   if(status)
     disorder_error(0, RESCAN": %s", wstat(status));
   else
     D((RESCAN" terminated: %s", wstat(status)));
-  /* Our cache of file lookups is out of date now */
-  cache_clean(&cache_files_type);
-  eventlog("rescanned", (char *)0);
-  /* Call rescanned callbacks */
-  while(rescanned_list) {
-    void (*rescanned)(void *u_) = rescanned_list->rescanned;
-    void *ru = rescanned_list->ru;
+  /* Tell any zones; see trackdb_library_check() */
+  snprintf(buf, sizeof buf, "%ld", (long)xtime(0));
+  WITH_TRANSACTION(trackdb_set_global_tid("_rescanned", buf, tid));
+  rescan_complete();
+  return 0;
+}
 
-    rescanned_list = rescanned_list->next;
-    rescanned(ru);
+/** @brief Notice changes made by other servers
+ *
+ * Only does anything in a zone.  Any change to the shared database, as seen
+ * from the end of the transaction log, invalidates our cached results.  If
+ * the library's server has finished a rescan since the last call then the
+ * rescan completion callbacks are called too.
+ */
+void trackdb_library_check(void) {
+  static DB_LSN last_lsn;
+  static char *last_rescanned;
+  static int checked;
+  DB_LOG_STAT *lst;
+  const char *s;
+  int err;
+
+  if(!config->library)
+    return;
+  if((err = trackdb_env->log_stat(trackdb_env, &lst, 0))) {
+    disorder_error(0, "trackdb_env->log_stat: %s", db_strerror(err));
+    return;
+  }
+  if(checked
+     && lst->st_cur_file == last_lsn.file
+     && lst->st_cur_offset == last_lsn.offset) {
+    xfree(lst);
+    return;
+  }
+  last_lsn.file = lst->st_cur_file;
+  last_lsn.offset = lst->st_cur_offset;
+  xfree(lst);
+  ++trackdb_generation;
+  ++trackdb_users_generation;
+  s = trackdb_get_global("_rescanned");
+  if(checked && s && (!last_rescanned || strcmp(s, last_rescanned))) {
+    disorder_info("library has been rescanned");
+    rescan_complete();
+  }
+  last_rescanned = s ? xstrdup(s) : NULL;
+  checked = 1;
+}
+
+/** @brief Called when the rescanner reports progress
+ *
+ * Each line is <tt>progress PHASE DONE TOTAL NEW RATE ETA</tt> and becomes a
+ * @c rescan_progress event.
+ */
+static int rescan_progress(ev_source attribute((unused)) *ev,
+                           ev_reader *reader,
+                           void *ptr,
+                           size_t bytes,
+                           int eof,
+                           void attribute((unused)) *u) {
+  char *nl, *line, **vec;
+  int len, nvec;
+
+  while((nl = memchr(ptr, '\n', bytes))) {
+    len = nl - (char *)ptr;
+    line = xstrndup(ptr, len);
+    ev_reader_consume(reader, len + 1);
+    ptr = nl + 1;
+    bytes -= len + 1;
+    if((vec = split(line, &nvec, 0, 0, 0)) && nvec == 7
+       && !strcmp(vec[0], "progress"))
+      eventlog("rescan_progress", vec[1], vec[2], vec[3], vec[4], vec[5],
+               vec[6], (char *)0);
+    else
+      disorder_error(0, "unexpected output from "RESCAN": %s", line);
   }
+  if(eof)
+    ev_reader_consume(reader, bytes);
+  return 0;
+}
+
+/** @brief Called when reading rescanner progress fails */
+static int rescan_progress_error(ev_source attribute((unused)) *ev,
+                                 int errno_value,
+                                 void attribute((unused)) *u) {
+  disorder_error(errno_value, "error reading progress from "RESCAN);
   return 0;
 }
 
@@ -2695,16 +5714,58 @@ static int reap_rescan(ev_source attribute((unused)) *ev,
 void trackdb_rescan(ev_source *ev, int recheck,
                     void (*rescanned)(void *ru),
                     void *ru) {
-  int w;
+  trackdb_rescan_dirty(ev, recheck, 0, rescanned, ru);
+}
 
+/** @brief Initiate a rescan of some directories
+ * @param ev Event loop or 0 to block
+ * @param recheck 1 to recheck lengths, 0 to suppress check
+ * @param dirty File listing directories to rescan, or NULL for everything
+ * @param rescanned Called on completion (if not NULL)
+ * @param ru Passed to @p rescanned
+ *
+ * @p dirty contains one directory per line.  Only tracks below those
+ * directories are noticed or rechecked.
+ */
+void trackdb_rescan_dirty(ev_source *ev, int recheck,
+                          const char *dirty,
+                          void (*rescanned)(void *ru),
+                          void *ru) {
+  int w, p[2] = { -1, -1 };
+
+  if(config->library) {
+    /* The library's server does the rescanning; see
+     * trackdb_library_check() */
+    trackdb_add_rescanned(rescanned, ru);
+    return;
+  }
   if(rescan_pid != -1) {
     trackdb_add_rescanned(rescanned, ru);
     disorder_error(0, "rescan already underway");
     return;
   }
-  rescan_pid = subprogram(ev, -1, RESCAN,
-                          recheck ? "--check" : "--no-check",
-                          (char *)0);
+  /* Progress reports only make sense if someone is listening */
+  if(ev) {
+    xpipe(p);
+    cloexec(p[0]);
+    nonblock(p[0]);
+    if(!ev_reader_new(ev, p[0], rescan_progress, rescan_progress_error, 0,
+                      "rescan progress"))
+      disorder_fatal(errno, "error calling ev_reader_new");
+  }
+  if(dirty)
+    rescan_pid = subprogram(ev, p[1], RESCAN,
+                            recheck ? "--check" : "--no-check",
+                            "--dirty", dirty,
+                            ev ? "--progress" : (char *)0,
+                            (char *)0);
+  else
+    rescan_pid = subprogram(ev, p[1], RESCAN,
+                            recheck ? "--check" : "--no-check",
+                            ev ? "--progress" : (char *)0,
+                            (char *)0);
+  if(p[1] != -1)
+    xclose(p[1]);
   trackdb_add_rescanned(rescanned, ru);
   if(ev) {
     ev_child(ev, rescan_pid, 0, reap_rescan, 0);
@@ -2717,6 +5778,40 @@ void trackdb_rescan(ev_source *ev, int recheck,
   }
 }
 
+/* called when the background upgrade terminates */
+static int reap_upgrade(ev_source attribute((unused)) *ev,
+                        pid_t pid,
+                        int status,
+                        const struct rusage attribute((unused)) *rusage,
+                        void attribute((unused)) *u) {
+  if(pid == upgrade_pid) upgrade_pid = -1;
+  if(status)
+    disorder_error(0, "disorder-dbupgrade --background: %s", wstat(status));
+  else
+    disorder_info("background database upgrade complete");
+  /* Re-noticed tracks may have new aliases */
+  ++trackdb_generation;
+  track_filter_build();
+  return 0;
+}
+
+/** @brief Finish an online upgrade in the background
+ * @param ev Event loop
+ *
+ * If an online upgrade has left records in an older format then a
+ * background @c disorder-dbupgrade is started to convert them.  Until it
+ * finishes they are converted as they are written.
+ */
+void trackdb_upgrade_background(ev_source *ev) {
+  if(upgrade_pid != -1 || config->library
+     || !trackdb_get_global("_upgrade_from"))
+    return;
+  upgrade_pid = subprogram(ev, -1, "disorder-dbupgrade", "--background",
+                           (char *)0);
+  ev_child(ev, upgrade_pid, 0, reap_upgrade, 0);
+  D(("started background upgrade"));
+}
+
 /** @brief Cancel a rescan
  * @return Nonzero if a rescan was cancelled
  */
@@ -2725,9 +5820,22 @@ int trackdb_rescan_cancel(void) {
   if(kill(rescan_pid, SIGTERM) < 0)
     disorder_fatal(errno, "error killing rescanner");
   rescan_pid = -1;
+  /* It may not be quite finished; reap_rescan() will rebuild the filter */
+  xfree(track_filter.bits);
+  track_filter.bits = 0;
   return 1;
 }
 
+/** @brief Ask a running rescan to pause
+ *
+ * Called when playback drops out, in case the rescan is starving it of disk
+ * bandwidth.  The rescanner pauses for @c rescan_backoff seconds.
+ */
+void trackdb_rescan_backoff(void) {
+  if(rescan_pid != -1 && config->rescan_backoff)
+    kill(rescan_pid, SIGUSR1);
+}
+
 /** @brief Return true if a rescan is underway */
 int trackdb_rescan_underway(void) {
   return rescan_pid != -1;
@@ -2735,6 +5843,28 @@ int trackdb_rescan_underway(void) {
 
 /* global prefs **************************************************************/
 
+/** @brief Return the database key for a global preference
+ * @param name Global preference name
+ * @return Key to use
+ *
+ * In a zone, the global preferences listed in @ref zone_globals are stored
+ * under <tt>NAME@ZONE</tt> so that each zone has its own; everything else is
+ * shared with the library's server.
+ */
+static const char *global_key(const char *name) {
+  char *key;
+  size_t n;
+
+  if(!config->zone)
+    return name;
+  for(n = 0; n < NZONE_GLOBALS; ++n)
+    if(!strcmp(name, zone_globals[n])) {
+      byte_xasprintf(&key, "%s@%s", name, config->zone);
+      return key;
+    }
+  return name;
+}
+
 /** @brief Set a global preference
  * @param name Global preference name
  * @param value New value
@@ -2749,10 +5879,11 @@ int trackdb_set_global(const char *name,
 
   for(;;) {
     tid = trackdb_begin_transaction();
-    err = trackdb_set_global_tid(name, value, tid);
+    err = trackdb_set_global_tid(global_key(name), value, tid);
     if(err != DB_LOCK_DEADLOCK)
       break;
     trackdb_abort_transaction(tid);
+    trackdb_deadlocked(__func__);
   }
   trackdb_commit_transaction(tid);
   /* log important state changes */
@@ -2813,9 +5944,10 @@ const char *trackdb_get_global(const char *name) {
 
   for(;;) {
     tid = trackdb_begin_transaction();
-    if(!trackdb_get_global_tid(name, tid, &r))
+    if(!trackdb_get_global_tid(global_key(name), tid, &r))
       break;
     trackdb_abort_transaction(tid);
+    trackdb_deadlocked(__func__);
   }
   trackdb_commit_transaction(tid);
   return r;
@@ -2864,7 +5996,7 @@ char **trackdb_new(int *ntracksp,
   char **tracks;
 
   for(;;) {
-    tid = trackdb_begin_transaction();
+    tid = trackdb_begin_read_transaction();
     tracks = trackdb_new_tid(ntracksp, maxtracks, tid);
     if(tracks)
       break;
@@ -2936,6 +6068,7 @@ void trackdb_expire_noticed(time_t earliest) {
     if(!trackdb_expire_noticed_tid(earliest, tid))
       break;
     trackdb_abort_transaction(tid);
+    trackdb_deadlocked(__func__);
   }
   trackdb_commit_transaction(tid);
 }
@@ -2984,17 +6117,132 @@ static int trackdb_expire_noticed_tid(time_t earliest, DB_TXN *tid) {
 
 /* tidying up ****************************************************************/
 
-/** @brief Do database garbage collection
+/** @brief Seconds between routine checkpoints */
+#define TRACKDB_CHECKPOINT_INTERVAL 60
+
+/** @brief Longest a checkpoint may be put off, in seconds */
+#define TRACKDB_CHECKPOINT_MAX_DEFER 30
+
+/** @brief Rate at which recovery is assumed to replay the log, in bytes/s
  *
- * Called form periodic_database_gc().
+ * This is a deliberately cautious guess, for trackdb_log_stats()'s estimate
+ * of recovery time.
+ */
+#define TRACKDB_RECOVERY_RATE (8 * 1024 * 1024)
+
+/** @brief When the last checkpoint was taken */
+static time_t last_checkpoint;
+
+/** @brief When a checkpoint was first put off, or 0 */
+static time_t checkpoint_deferred;
+
+/** @brief Find how much log has been written since the last checkpoint
+ * @param pendingp Where to store the size in bytes
+ * @return 0 on success, non-0 on error
  */
-void trackdb_gc(void) {
+static int log_pending(unsigned long long *pendingp) {
+  DB_LOG_STAT *lst;
+  DB_TXN_STAT *tst;
   int err;
+
+  if((err = trackdb_env->log_stat(trackdb_env, &lst, 0))) {
+    disorder_error(0, "trackdb_env->log_stat: %s", db_strerror(err));
+    return -1;
+  }
+  if((err = trackdb_env->txn_stat(trackdb_env, &tst, 0))) {
+    disorder_error(0, "trackdb_env->txn_stat: %s", db_strerror(err));
+    xfree(lst);
+    return -1;
+  }
+  /* Log file sizes can change, in which case this is only an estimate */
+  if(lst->st_cur_file < tst->st_last_ckp.file)
+    *pendingp = 0;
+  else
+    *pendingp = ((unsigned long long)(lst->st_cur_file
+                                      - tst->st_last_ckp.file)
+                 * lst->st_lg_size
+                 + lst->st_cur_offset) - tst->st_last_ckp.offset;
+  xfree(lst);
+  xfree(tst);
+  return 0;
+}
+
+/** @brief Get transaction log statistics
+ * @param sizep Where to store the total size of the log files in bytes
+ * @param pendingp Where to store the log written since the last checkpoint
+ * @param recoveryp Where to store the estimated recovery time in seconds
+ * @return 0 on success, non-0 on error
+ *
+ * Recovery replays the log since the last checkpoint, so @p recoveryp is an
+ * estimate based on @p pendingp.
+ */
+int trackdb_log_stats(unsigned long long *sizep,
+                      unsigned long long *pendingp,
+                      long *recoveryp) {
+  char **logfiles;
+  struct stat sb;
+  int err, n;
+
+  if(log_pending(pendingp))
+    return -1;
+  if((err = trackdb_env->log_archive(trackdb_env, &logfiles,
+                                     DB_ARCH_LOG|DB_ARCH_ABS))) {
+    disorder_error(0, "trackdb_env->log_archive: %s", db_strerror(err));
+    return -1;
+  }
+  *sizep = 0;
+  for(n = 0; logfiles && logfiles[n]; ++n)
+    if(stat(logfiles[n], &sb) >= 0)
+      *sizep += sb.st_size;
+  xfree(logfiles);
+  *recoveryp = (long)((*pendingp + TRACKDB_RECOVERY_RATE - 1)
+                      / TRACKDB_RECOVERY_RATE);
+  return 0;
+}
+
+/** @brief Do database garbage collection
+ * @param defer Nonzero to put off a checkpoint if possible
+ *
+ * Called frequently from periodic_database_gc().  A checkpoint is taken when
+ * @c checkpoint_log_kbyte of log has been written since the last one, and
+ * otherwise every @ref TRACKDB_CHECKPOINT_INTERVAL seconds subject to @c
+ * checkpoint_kbyte and @c checkpoint_min.  Old log files are removed after
+ * each checkpoint.
+ *
+ * Checkpoints write out every dirty page in the cache, which can hold up
+ * other disk access.  The server passes a nonzero @p defer when that would
+ * hurt playback.  Checkpoints are put off for at most @ref
+ * TRACKDB_CHECKPOINT_MAX_DEFER seconds.
+ */
+void trackdb_gc(int defer) {
+  int err, over;
   char **logfiles;
+  unsigned long long pending;
+  time_t now;
 
+  /* The library's server looks after its database */
+  if(config->library)
+    return;
+  xtime(&now);
+  over = (config->checkpoint_log_kbyte
+          && !log_pending(&pending)
+          && (pending / 1024
+              >= (unsigned long long)config->checkpoint_log_kbyte));
+  if(!over && now - last_checkpoint < TRACKDB_CHECKPOINT_INTERVAL)
+    return;
+  if(defer) {
+    if(!checkpoint_deferred)
+      checkpoint_deferred = now;
+    if(now - checkpoint_deferred < TRACKDB_CHECKPOINT_MAX_DEFER)
+      return;
+  }
+  checkpoint_deferred = 0;
+  last_checkpoint = now;
+  if(over)
+    D(("checkpointing after %llu bytes of log", pending));
   if((err = trackdb_env->txn_checkpoint(trackdb_env,
-                                        config->checkpoint_kbyte,
-                                        config->checkpoint_min,
+                                        over ? 0 : config->checkpoint_kbyte,
+                                        over ? 0 : config->checkpoint_min,
                                         0)))
     disorder_fatal(0, "trackdb_env->txn_checkpoint: %s", db_strerror(err));
   if((err = trackdb_env->log_archive(trackdb_env, &logfiles, DB_ARCH_REMOVE)))
@@ -3126,6 +6374,7 @@ int trackdb_deluser(const char *user) {
   int e;
 
   WITH_TRANSACTION(trackdb_delkey(trackdb_usersdb, user, tid));
+  ++trackdb_users_generation;
   if(e) {
     disorder_error(0, "cannot delete user '%s' because they do not exist",
                    user);
@@ -3210,6 +6459,7 @@ int trackdb_edituserinfo(const char *user,
     return -1;
   }
   WITH_TRANSACTION(trackdb_edituserinfo_tid(user, key, value, tid));
+  ++trackdb_users_generation;
   if(e) {
     disorder_error(0, "unknown user '%s'", user);
     return -1;
@@ -3279,6 +6529,7 @@ int trackdb_confirm(const char *user, const char *confirmation,
   int e;
 
   WITH_TRANSACTION(trackdb_confirm_tid(user, confirmation, rightsp, tid));
+  ++trackdb_users_generation;
   switch(e) {
   case 0:
     disorder_info("registration confirmed for user '%s'", user);
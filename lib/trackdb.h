@@ -25,9 +25,27 @@
 #include "regexp.h"
 #include "rights.h"
 
-extern const struct cache_type cache_files_type;
 extern unsigned long cache_files_hits, cache_files_misses;
-/* Cache entry type and tracking for regexp-based lookups */
+/* Tracking for cached search and listing results */
+
+extern unsigned long trackdb_generation;
+/* Bumped whenever search or listing results might change */
+
+extern unsigned long trackdb_users_generation;
+/* Bumped whenever a user is edited, deleted or confirmed */
+
+extern void (*trackdb_pref_changed)(const char *track, const char *name);
+/* Called after a preference is changed */
+
+extern int64_t trackdb_busy_us;
+/* Total time spent in database transactions */
+
+void trackdb_deadlocked(const char *operation);
+char **trackdb_deadlock_operations(void);
+unsigned long trackdb_deadlock_count(const char *operation);
+int trackdb_lock_stats(unsigned long long *waits,
+                       unsigned long long *deadlocks);
+/* Deadlock and lock contention statistics */
 
 /** @brief Do not attempt database recovery (trackdb_init()) */
 #define TRACKDB_NO_RECOVER 0x0000
@@ -73,7 +91,13 @@ void trackdb_close(void);
 extern int trackdb_existing_database;
 
 char **trackdb_stats(int *nstatsp);
-/* return a list of database stats */
+/* return a list of library stats, counting them if necessary */
+
+char **trackdb_stats_quick(int *nstatsp);
+/* return a list of library stats, or NULL if they have not been counted */
+
+char **trackdb_env_stats(int *nstatsp);
+/* return database cache and lock statistics, or NULL on error */
 
 void trackdb_stats_subprocess(struct ev_source *ev,
                               void (*done)(char *data, void *u),
@@ -92,6 +116,19 @@ const char *trackdb_get(const char *track,
 struct kvp *trackdb_get_all(const char *track);
 /* get all prefs */
 
+const char *trackdb_get_length(const char *track);
+/* get a track's length, or NULL */
+
+void trackdb_get_many(char **tracks, int ntracks,
+                      struct kvp **tps, struct kvp **pps,
+                      const char **actuals);
+/* get track data and prefs for many tracks in one transaction; any of the
+ * output arrays may be null pointers */
+
+void trackdb_get_dirs(char **dirs, int ndirs, struct kvp **summaries);
+/* get summaries of many directories in one transaction; directories without
+ * tracks get a null pointer */
+
 const char *trackdb_resolve(const char *track);
 /* resolve alias - returns a null pointer if not found */
 
@@ -101,6 +138,9 @@ int trackdb_isalias(const char *track);
 int trackdb_exists(const char *track);
 /* test whether a track exists (perhaps an alias) */
 
+void trackdb_filter_tracks(void);
+/* keep a filter so that lookups of missing tracks skip the database */
+
 const char *trackdb_random(int tries);
 /* Pick a random non-alias track, making at most TRIES attempts.  Returns a
  * null pointer on failure. */
@@ -114,6 +154,12 @@ const char *trackdb_getpart(const char *track,
 /* get a track name part, like trackname_part(), but taking the database into
  * account. */
 
+const char *trackdb_getpart_prefs(const char *actual,
+                                  const char *context,
+                                  const char *part,
+                                  const struct kvp *p);
+/* get a track name part given prefs already fetched for ACTUAL */
+
 const char *trackdb_rawpath(const char *track);
 /* get the raw path name for TRACK (might be an alias); returns a null pointer
  * if not found. */
@@ -136,16 +182,46 @@ char **trackdb_search(char **wordlist, int nwordlist, int *ntracks);
 /* return a list of tracks containing all of the words given.  If you
  * ask for only stopwords you get no tracks. */
 
+char **trackdb_search_page(char **wordlist, int nwordlist,
+                           int offset, int limit,
+                           int *ntracks, int *nmatches);
+/* like trackdb_search() but ranked, returning only LIMIT tracks from OFFSET */
+
+char **trackdb_search_prefix(char **wordlist, int nwordlist, int max,
+                             int *ntracks);
+/* like trackdb_search() but the last word may be the start of a word */
+
+char **trackdb_search_fuzzy(char **wordlist, int nwordlist, int max,
+                            int *ntracks);
+/* like trackdb_search() but misspelt words are corrected */
+
 void trackdb_rescan(struct ev_source *ev, int recheck,
                     void (*rescanned)(void *ru),
                     void *ru);
 /* Start a rescan, if one is not running already */
 
+void trackdb_rescan_dirty(struct ev_source *ev, int recheck,
+                          const char *dirty,
+                          void (*rescanned)(void *ru),
+                          void *ru);
+/* Start a rescan of the directories listed in DIRTY */
+
 int trackdb_rescan_cancel(void);
 /* interrupt any running rescan.  Return 1 if one was running, else 0. */
 
-void trackdb_gc(void);
-/* tidy up old database log files */
+void trackdb_rescan_backoff(void);
+/* ask any running rescan to pause for rescan_backoff seconds */
+
+void trackdb_upgrade_background(struct ev_source *ev);
+/* finish an online upgrade, if one is pending */
+
+void trackdb_gc(int defer);
+/* checkpoint and tidy up old database log files */
+
+int trackdb_log_stats(unsigned long long *sizep,
+                      unsigned long long *pendingp,
+                      long *recoveryp);
+/* report log size, log since the last checkpoint and recovery estimate */
 
 int trackdb_set_global(const char *name,
                        const char *value,
@@ -176,11 +252,16 @@ int trackdb_readable(void);
 
 typedef void random_callback(struct ev_source *ev,
                              const char *track);
-int trackdb_request_random(struct ev_source *ev,
-                           random_callback *callback);
+typedef void random_tracks_callback(struct ev_source *ev,
+                                    char **tracks, int ntracks);
+int trackdb_request_random(struct ev_source *ev, int count,
+                           random_tracks_callback *callback);
+int trackdb_request_weights(struct ev_source *ev,
+                            random_callback *callback);
 void trackdb_add_rescanned(void (*rescanned)(void *ru),
                            void *ru);
 int trackdb_rescan_underway(void);
+void trackdb_library_check(void);
 
 int trackdb_playlist_get(const char *name,
                          const char *who,
@@ -197,6 +278,20 @@ void trackdb_playlist_list(const char *who,
                            int *nplaylistsp);
 int trackdb_playlist_delete(const char *name,
                             const char *who);
+int trackdb_playlist_insert(const char *name,
+                            const char *who,
+                            int position,
+                            char **tracks,
+                            int ntracks);
+int trackdb_playlist_remove(const char *name,
+                            const char *who,
+                            int position,
+                            int ntracks);
+int trackdb_playlist_move(const char *name,
+                          const char *who,
+                          int position,
+                          int ntracks,
+                          int to);
 
 #endif /* TRACKDB_H */
 
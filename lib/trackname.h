@@ -64,6 +64,28 @@ static inline int compare_path(const char *ap, const char *bp) {
 			  (const unsigned char *)bp, strlen(bp));
 }
 
+char *track_collation_key(const char *sort, const char *display,
+                          const char *track, size_t *nkeyp);
+/* Compute a key for TRACK that sorts with memcmp() as compare_tracks()
+ * would */
+
+/** @brief Compare two collation keys
+ * @param a First key
+ * @param na Length of @p a
+ * @param b Second key
+ * @param nb Length of @p b
+ * @return -ve, 0 or +ve for a <, = or > b
+ *
+ * See track_collation_key().
+ */
+static inline int compare_collation_keys(const char *a, size_t na,
+                                         const char *b, size_t nb) {
+  int c = memcmp(a, b, na < nb ? na : nb);
+
+  if(c) return c;
+  return na < nb ? -1 : na > nb;
+}
+
 /** @brief Entry in a list of tracks or directories */
 struct tracksort_data {
   /** @brief Track name */
@@ -72,6 +94,10 @@ struct tracksort_data {
   const char *sort;
   /** @brief Display key */
   const char *display;
+  /** @brief Collation key (see track_collation_key()) */
+  char *key;
+  /** @brief Length of @c key */
+  size_t nkey;
 };
 
 struct tracksort_data *tracksort_init(int nvec,
@@ -25,6 +25,7 @@
 #include "trackname.h"
 #include "log.h"
 #include "unicode.h"
+#include "vector.h"
 
 /** @brief Compare two tracks
  * @param sa First sort key
@@ -93,6 +94,52 @@ int compare_path_raw(const unsigned char *ap, size_t an,
     return 0;
 }
 
+/** @brief Append a case-folded string and then the string itself */
+static void collation_append(struct dynstr *d, const char *s) {
+  const size_t ns = strlen(s);
+  const char *f = utf8_casefold_canon(s, ns, 0);
+
+  /* The terminators make a prefix sort before anything that extends it */
+  dynstr_append_string(d, f ? f : s);
+  dynstr_append(d, 0);
+  dynstr_append_bytes(d, s, ns);
+  dynstr_append(d, 0);
+}
+
+/** @brief Compute a binary collation key for a track
+ * @param sort Sort key
+ * @param display Display string
+ * @param track Raw track
+ * @param nkeyp Where to store the length of the key
+ * @return Collation key
+ *
+ * Comparing two keys with compare_collation_keys() gives the same order as
+ * compare_tracks() does with the strings they were computed from, so a sort
+ * need only do the Unicode work once per track rather than once per
+ * comparison.
+ */
+char *track_collation_key(const char *sort, const char *display,
+                          const char *track, size_t *nkeyp) {
+  struct dynstr d[1];
+
+  dynstr_init(d);
+  collation_append(d, sort);
+  collation_append(d, display);
+  /* Map the path so that bytewise order matches compare_path_raw(): '/'
+   * sorts before everything else and the bytes below it move up one to make
+   * room.  Paths contain no 0 bytes so nothing collides. */
+  for(const unsigned char *t = (const unsigned char *)track; *t; ++t) {
+    if(*t == '/')
+      dynstr_append(d, 1);
+    else if(*t < '/')
+      dynstr_append(d, *t + 1);
+    else
+      dynstr_append(d, *t);
+  }
+  *nkeyp = d->nvec;
+  return d->vec;
+}
+
 /*
 Local Variables:
 c-basic-offset:2
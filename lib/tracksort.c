@@ -27,9 +27,7 @@
 static int tracksort_compare(const void *a, const void *b) {
   const struct tracksort_data *ea = a, *eb = b;
 
-  return compare_tracks(ea->sort, eb->sort,
-			ea->display, eb->display,
-			ea->track, eb->track);
+  return compare_collation_keys(ea->key, ea->nkey, eb->key, eb->nkey);
 }
 
 /** @brief Sort tracks
@@ -40,7 +38,8 @@ static int tracksort_compare(const void *a, const void *b) {
  *
  * Tracks are compared using compare_tracks(), with the sort key and display
  * string set according to @p type, which should be "track" if the tracks are
- * really tracks and "dir" if they are directories.
+ * really tracks and "dir" if they are directories.  Each track's collation
+ * key is computed once, so the sort itself only compares bytes.
  */
 struct tracksort_data *tracksort_init(int ntracks,
                                       char **tracks,
@@ -50,6 +49,8 @@ struct tracksort_data *tracksort_init(int ntracks,
     td[n].track = tracks[n];
     td[n].sort = trackname_transform(type, tracks[n], "sort");
     td[n].display = trackname_transform(type, tracks[n], "display");
+    td[n].key = track_collation_key(td[n].sort, td[n].display, tracks[n],
+                                    &td[n].nkey);
   }
   qsort(td, ntracks, sizeof *td, tracksort_compare);
   return td;
@@ -16,17 +16,26 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 /** @file lib/uaudio-alsa.c
- * @brief Support for ALSA backend */
+ * @brief Support for ALSA backend
+ *
+ * By default sound is written with snd_pcm_writei(), fed from @ref
+ * lib/uaudio-thread.c.  If the @c access option is set to @c mmap then a
+ * thread of our own maps the device buffer with snd_pcm_mmap_begin() and has
+ * the callback fill it in place, so samples are copied only once on their way
+ * to the hardware.
+ */
 #include "common.h"
 
 #if HAVE_ALSA_ASOUNDLIB_H
 
 #include <alsa/asoundlib.h>
+#include <pthread.h>
 
 #include "mem.h"
 #include "log.h"
 #include "uaudio.h"
 #include "configuration.h"
+#include "realtime.h"
 
 /** @brief The current PCM handle */
 static snd_pcm_t *alsa_pcm;
@@ -35,9 +44,33 @@ static const char *const alsa_options[] = {
   "device",
   "mixer-control",
   "mixer-channel",
+  "access",
+  "period-size",
+  "buffer-size",
   NULL
 };
 
+/** @brief Set if using mmap access */
+static int alsa_mmap;
+
+/** @brief Period size in frames, as chosen by ALSA */
+static snd_pcm_uframes_t alsa_period_frames;
+
+/** @brief Callback to get audio data in mmap mode */
+static uaudio_callback *alsa_mmap_callback;
+
+/** @brief Passed to @ref alsa_mmap_callback */
+static void *alsa_mmap_userdata;
+
+/** @brief mmap thread ID */
+static pthread_t alsa_mmap_thread;
+
+/** @brief Set while the mmap thread should keep running */
+static int alsa_mmap_running;
+
+/** @brief Set when activated, clear when paused (mmap mode) */
+static int alsa_mmap_activated;
+
 /** @brief Mixer handle */
 snd_mixer_t *alsa_mixer_handle;
 
@@ -56,6 +89,14 @@ static long alsa_mixer_min;
 /** @brief Maximum level */
 static long alsa_mixer_max;
 
+/** @brief Record how much sound is queued in front of the next write */
+static void alsa_delay(void) {
+  snd_pcm_sframes_t delay;
+
+  if(!snd_pcm_delay(alsa_pcm, &delay) && delay >= 0)
+    uaudio_stats_latency(delay);
+}
+
 /** @brief Actually play sound via ALSA */
 static size_t alsa_play(void *buffer, size_t samples, unsigned flags) {
   /* If we're paused we just pretend.  We rely on snd_pcm_writei() blocking so
@@ -83,6 +124,7 @@ static size_t alsa_play(void *buffer, size_t samples, unsigned flags) {
   if(rc < 0) {
     switch(rc) {
     case -EPIPE:
+      uaudio_stats_xrun();
       if((err = snd_pcm_prepare(alsa_pcm)))
 	disorder_fatal(0, "error calling snd_pcm_prepare: %d", err);
       return 0;
@@ -92,14 +134,96 @@ static size_t alsa_play(void *buffer, size_t samples, unsigned flags) {
       disorder_fatal(0, "error calling snd_pcm_writei: %d", (int)rc);
     }
   }
+  alsa_delay();
   return rc * uaudio_channels;
 }
 
+/** @brief Recover from an error in mmap mode
+ * @param err Negative error code
+ * @param what Function that failed
+ */
+static void alsa_mmap_recover(int err, const char *what) {
+  switch(err) {
+  case -EPIPE:
+    uaudio_stats_xrun();
+    if((err = snd_pcm_prepare(alsa_pcm)))
+      disorder_fatal(0, "error calling snd_pcm_prepare: %d", err);
+    break;
+  case -EAGAIN:
+    break;
+  default:
+    disorder_fatal(0, "error calling %s: %d", what, err);
+  }
+}
+
+/** @brief Background thread for mmap mode
+ *
+ * Waits for at least a period of space in the device buffer and has the
+ * callback fill it directly.  While paused the space is filled with silence
+ * instead.
+ */
+static void *alsa_mmap_thread_fn(void attribute((unused)) *arg) {
+  const snd_pcm_channel_area_t *areas;
+  snd_pcm_uframes_t offset, frames;
+  snd_pcm_sframes_t avail, rc;
+  size_t want, got;
+  char *ptr;
+  int err;
+
+  realtime_thread("ALSA mmap");
+  while(__atomic_load_n(&alsa_mmap_running, __ATOMIC_ACQUIRE)) {
+    if((avail = snd_pcm_avail_update(alsa_pcm)) < 0) {
+      alsa_mmap_recover(avail, "snd_pcm_avail_update");
+      continue;
+    }
+    if((snd_pcm_uframes_t)avail < alsa_period_frames) {
+      /* A full buffer that hasn't started yet won't ever drain by itself */
+      if(snd_pcm_state(alsa_pcm) == SND_PCM_STATE_PREPARED) {
+        if((err = snd_pcm_start(alsa_pcm)) < 0)
+          alsa_mmap_recover(err, "snd_pcm_start");
+      } else if((err = snd_pcm_wait(alsa_pcm, 1000)) < 0)
+        alsa_mmap_recover(err, "snd_pcm_wait");
+      continue;
+    }
+    frames = avail;
+    if((err = snd_pcm_mmap_begin(alsa_pcm, &areas, &offset, &frames)) < 0) {
+      alsa_mmap_recover(err, "snd_pcm_mmap_begin");
+      continue;
+    }
+    /* Interleaved access means all channels share the first area */
+    ptr = (char *)areas[0].addr + (areas[0].first + offset * areas[0].step) / 8;
+    want = frames * uaudio_channels;
+    if(__atomic_load_n(&alsa_mmap_activated, __ATOMIC_ACQUIRE)) {
+      for(got = 0; got < want;)
+        got += alsa_mmap_callback(ptr + got * uaudio_sample_size, want - got,
+                                  alsa_mmap_userdata);
+    } else
+      memset(ptr, 0, want * uaudio_sample_size);
+    rc = snd_pcm_mmap_commit(alsa_pcm, offset, frames);
+    if(rc < 0 || (snd_pcm_uframes_t)rc != frames)
+      alsa_mmap_recover(rc < 0 ? rc : -EPIPE, "snd_pcm_mmap_commit");
+    else
+      alsa_delay();
+  }
+  return NULL;
+}
+
 /** @brief Open the ALSA sound device */
 static void alsa_open(void) {
   const char *device = uaudio_get("device", "default");
+  const char *access = uaudio_get("access", "rw");
+  snd_pcm_uframes_t period_size = atol(uaudio_get("period-size", "0"));
+  snd_pcm_uframes_t buffer_size = atol(uaudio_get("buffer-size", "0"));
+  snd_pcm_uframes_t threshold = 1024;
   int err;
 
+  if(!strcmp(access, "mmap"))
+    alsa_mmap = 1;
+  else if(!strcmp(access, "rw"))
+    alsa_mmap = 0;
+  else
+    disorder_fatal(0, "unknown ALSA access mode '%s'", access);
+
   if((err = snd_pcm_open(&alsa_pcm,
 			 device,
 			 SND_PCM_STREAM_PLAYBACK,
@@ -111,7 +235,9 @@ static void alsa_open(void) {
   if((err = snd_pcm_hw_params_any(alsa_pcm, hwparams)) < 0)
     disorder_fatal(0, "error from snd_pcm_hw_params_any: %d", err);
   if((err = snd_pcm_hw_params_set_access(alsa_pcm, hwparams,
-                                         SND_PCM_ACCESS_RW_INTERLEAVED)) < 0)
+                                         alsa_mmap
+                                           ? SND_PCM_ACCESS_MMAP_INTERLEAVED
+                                           : SND_PCM_ACCESS_RW_INTERLEAVED)) < 0)
     disorder_fatal(0, "error from snd_pcm_hw_params_set_access: %d", err);
   int sample_format;
   if(uaudio_bits == 16)
@@ -130,16 +256,45 @@ static void alsa_open(void) {
                                            uaudio_channels)) < 0)
     disorder_fatal(0, "error from snd_pcm_hw_params_set_channels (%d): %d",
           uaudio_channels, err);
+  /* The buffer size is set first since it constrains the period size more
+   * than the other way round */
+  if(buffer_size
+     && (err = snd_pcm_hw_params_set_buffer_size_near(alsa_pcm, hwparams,
+                                                      &buffer_size)) < 0)
+    disorder_fatal(0, "error from snd_pcm_hw_params_set_buffer_size_near (%lu): %d",
+                   (unsigned long)buffer_size, err);
+  if(period_size
+     && (err = snd_pcm_hw_params_set_period_size_near(alsa_pcm, hwparams,
+                                                      &period_size, 0)) < 0)
+    disorder_fatal(0, "error from snd_pcm_hw_params_set_period_size_near (%lu): %d",
+                   (unsigned long)period_size, err);
   if((err = snd_pcm_hw_params(alsa_pcm, hwparams)) < 0)
     disorder_fatal(0, "error calling snd_pcm_hw_params: %d", err);
+  if((err = snd_pcm_hw_params_get_period_size(hwparams, &alsa_period_frames,
+                                              0)) < 0)
+    disorder_fatal(0, "error calling snd_pcm_hw_params_get_period_size: %d",
+                   err);
+  if((err = snd_pcm_hw_params_get_buffer_size(hwparams, &buffer_size)) < 0)
+    disorder_fatal(0, "error calling snd_pcm_hw_params_get_buffer_size: %d",
+                   err);
+  disorder_info("ALSA %s access, period %lu frames, buffer %lu frames",
+                alsa_mmap ? "mmap" : "rw",
+                (unsigned long)alsa_period_frames, (unsigned long)buffer_size);
   /* Software parameters */
   snd_pcm_sw_params_t *swparams;
   snd_pcm_sw_params_alloca(&swparams);
   if((err = snd_pcm_sw_params_current(alsa_pcm, swparams)) < 0)
     disorder_fatal(-err, "error calling snd_pcm_sw_params_current");
-  /* Bump the start threshold a bit since Pulseaudio sulks with the defaults */
-  if((err = snd_pcm_sw_params_set_start_threshold(alsa_pcm, swparams, 1024)) < 0)
+  /* Bump the start threshold a bit since Pulseaudio sulks with the defaults;
+   * but it can't usefully exceed the buffer */
+  if(threshold > buffer_size)
+    threshold = buffer_size;
+  if((err = snd_pcm_sw_params_set_start_threshold(alsa_pcm, swparams,
+                                                  threshold)) < 0)
     disorder_fatal(-err, "error calling snd_pcm_sw_params_set_start_threshold");
+  if((err = snd_pcm_sw_params_set_avail_min(alsa_pcm, swparams,
+                                            alsa_period_frames)) < 0)
+    disorder_fatal(-err, "error calling snd_pcm_sw_params_set_avail_min");
   if((err = snd_pcm_sw_params(alsa_pcm, swparams)) < 0)
     disorder_fatal(-err, "error calling snd_pcm_sw_params");
 }
@@ -153,18 +308,47 @@ static void alsa_start(uaudio_callback *callback,
     disorder_fatal(0, "asked for %d bits/channel but only support 8 or 16",
           uaudio_bits); 
   alsa_open();
-  uaudio_thread_start(callback, userdata, alsa_play,
-                      32 / uaudio_sample_size,
-                      4096 / uaudio_sample_size,
-                      0);
+  if(alsa_mmap) {
+    int e;
+    alsa_mmap_callback = callback;
+    alsa_mmap_userdata = userdata;
+    alsa_mmap_activated = 0;
+    alsa_mmap_running = 1;
+    if((e = pthread_create(&alsa_mmap_thread, NULL, alsa_mmap_thread_fn, NULL)))
+      disorder_fatal(e, "pthread_create");
+  } else
+    uaudio_thread_start(callback, userdata, alsa_play,
+                        32 / uaudio_sample_size,
+                        4096 / uaudio_sample_size,
+                        0);
 }
 
 static void alsa_stop(void) {
-  uaudio_thread_stop();
+  void *result;
+
+  if(alsa_mmap) {
+    __atomic_store_n(&alsa_mmap_running, 0, __ATOMIC_RELEASE);
+    pthread_join(alsa_mmap_thread, &result);
+  } else
+    uaudio_thread_stop();
   snd_pcm_close(alsa_pcm);
   alsa_pcm = 0;
 }
 
+static void alsa_activate(void) {
+  if(alsa_mmap)
+    __atomic_store_n(&alsa_mmap_activated, 1, __ATOMIC_RELEASE);
+  else
+    uaudio_thread_activate();
+}
+
+static void alsa_deactivate(void) {
+  if(alsa_mmap)
+    __atomic_store_n(&alsa_mmap_activated, 0, __ATOMIC_RELEASE);
+  else
+    uaudio_thread_deactivate();
+}
+
 /** @brief Convert a level to a percentage */
 static int to_percent(long n) {
   return (n - alsa_mixer_min) * 100 / (alsa_mixer_max - alsa_mixer_min);
@@ -272,9 +456,16 @@ static void alsa_set_volume(int *left, int *right) {
 }
 
 static void alsa_configure(void) {
+  char buffer[64];
+
   uaudio_set("device", config->device);
   uaudio_set("mixer-control", config->mixer);
   uaudio_set("mixer-channel", config->channel);
+  uaudio_set("access", config->alsa_access);
+  snprintf(buffer, sizeof buffer, "%ld", config->alsa_period_size);
+  uaudio_set("period-size", buffer);
+  snprintf(buffer, sizeof buffer, "%ld", config->alsa_buffer_size);
+  uaudio_set("buffer-size", buffer);
 }
 
 const struct uaudio uaudio_alsa = {
@@ -282,8 +473,8 @@ const struct uaudio uaudio_alsa = {
   .options = alsa_options,
   .start = alsa_start,
   .stop = alsa_stop,
-  .activate = uaudio_thread_activate,
-  .deactivate = uaudio_thread_deactivate,
+  .activate = alsa_activate,
+  .deactivate = alsa_deactivate,
   .open_mixer = alsa_open_mixer,
   .close_mixer = alsa_close_mixer,
   .get_volume = alsa_get_volume,
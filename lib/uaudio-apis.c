@@ -45,7 +45,11 @@ const struct uaudio *const uaudio_apis[] = {
   &uaudio_oss,
 #endif
   &uaudio_rtp,
+#if HAVE_OPUS_OPUS_H
+  &uaudio_http,
+#endif
   &uaudio_command,
+  &uaudio_multi,
   NULL,
 };
 
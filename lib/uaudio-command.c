@@ -23,10 +23,20 @@
  * approximately the 'real' rate.  For disorder-playrtp this isn't very useful
  * (thought it might reduce the size of various buffers downstream of us) but
  * when run from the speaker it means that pausing stands a chance of working.
+ *
+ * On Linux the pipe's capacity can be raised with the @c pipe-size option,
+ * giving a command that occasionally stalls (an encoder feeding a streaming
+ * server, for instance) more slack.
+ *
+ * Samples are written with write().  vmsplice() is not used: the buffer we
+ * are handed is refilled as soon as we return, while pages spliced into the
+ * pipe would remain shared with it until the command got round to reading
+ * them.
  */
 #include "common.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 
 #include "syscalls.h"
@@ -48,6 +58,7 @@ static int command_suspend_on_pause;
 static const char *const command_options[] = {
   "command",
   "pause-mode",
+  "pipe-size",
   NULL
 };
 
@@ -73,10 +84,21 @@ static void command_wait(void) {
 static void command_open(void) {
   int pfd[2];
   const char *command;
+  long pipe_size = atol(uaudio_get("pipe-size", "0"));
 
   if(!(command = uaudio_get("command", NULL)))
     disorder_fatal(0, "'command' not set");
   xpipe(pfd);
+  if(pipe_size > 0) {
+#ifdef F_SETPIPE_SZ
+    /* Failure (e.g. exceeding /proc/sys/fs/pipe-max-size) isn't fatal */
+    if(fcntl(pfd[1], F_SETPIPE_SZ, (int)pipe_size) < 0)
+      disorder_error(errno, "error setting audio command pipe size to %ld",
+                     pipe_size);
+#else
+    disorder_error(0, "pipe-size is not supported on this platform");
+#endif
+  }
   command_pid = xfork();
   if(!command_pid) {
     exitfn = _exit;
@@ -153,6 +175,12 @@ static void command_stop(void) {
 static void command_configure(void) {
   uaudio_set("command", config->speaker_command);
   uaudio_set("pause-mode", config->pause_mode);
+  if(config->pipe_size) {
+    char buffer[64];
+
+    snprintf(buffer, sizeof buffer, "%ld", config->pipe_size);
+    uaudio_set("pipe-size", buffer);
+  }
 }
 
 const struct uaudio uaudio_command = {
@@ -0,0 +1,550 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file lib/uaudio-http.c
+ * @brief Support for HTTP streaming backend
+ *
+ * Sound is compressed once, with Opus, and framed as an Ogg stream (RFC7845)
+ * that any number of HTTP clients can listen to.  The encoded pages go into a
+ * ring buffer shared by all the listeners, each of which just has its own
+ * position in it.  A listener that falls so far behind that its data has
+ * been overwritten is disconnected, rather than being allowed to hold up the
+ * encoder.
+ *
+ * Encoding happens in the play callback and listeners are served by a
+ * separate thread, so slow or stuck clients never disturb the timing.  While
+ * nothing is playing, silence is encoded, so listeners stay connected.
+ */
+#include "common.h"
+
+#if HAVE_OPUS_OPUS_H
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <gcrypt.h>
+#include <opus/opus.h>
+
+#include "uaudio.h"
+#include "mem.h"
+#include "log.h"
+#include "logring.h"
+#include "syscalls.h"
+#include "addr.h"
+#include "configuration.h"
+#include "rtp-opus.h"
+#include "ogg.h"
+
+/** @brief Size of the shared ring of encoded pages, in bytes
+ *
+ * At the default bit rate this is about 20 seconds.
+ */
+#define HTTP_RING 262144
+
+/** @brief Opus packets per Ogg page (200ms) */
+#define HTTP_PAGE_PACKETS 10
+
+/** @brief Most listeners at once */
+#define HTTP_MAX_LISTENERS 64
+
+/** @brief Longest request header accepted, in bytes */
+#define HTTP_REQUEST_MAX 4096
+
+/** @brief A listener */
+struct http_listener {
+  /** @brief Socket */
+  int fd;
+
+  /** @brief Bytes of request read so far */
+  size_t got;
+
+  /** @brief Consecutive newlines at the end of the request so far
+   *
+   * The request is complete when this reaches 2.
+   */
+  int newlines;
+
+  /** @brief Bytes of @ref http_preamble sent */
+  size_t sent;
+
+  /** @brief Position in the ring of the next byte to send */
+  uint64_t offset;
+};
+
+static const char *const http_options[] = {
+  "http-listen-af",
+  "http-listen",
+  "http-listen-port",
+  "http-opus-bitrate",
+  NULL
+};
+
+/** @brief Opus encoder */
+static OpusEncoder *http_encoder;
+
+/** @brief 44.1KHz to 48KHz converter */
+static struct rtp_opus_upsampler http_upsampler;
+
+/** @brief Samples waiting to be encoded */
+static int16_t http_pcm[2 * RTP_OPUS_FRAMES];
+
+/** @brief Number of samples in @ref http_pcm */
+static size_t http_fill;
+
+/** @brief Encoded packets waiting for the next page */
+static unsigned char http_packets[HTTP_PAGE_PACKETS * RTP_OPUS_MAX_BYTES];
+
+/** @brief Lengths of the packets in @ref http_packets */
+static size_t http_lengths[HTTP_PAGE_PACKETS];
+
+/** @brief Number of packets in @ref http_packets */
+static int http_npackets;
+
+/** @brief Total bytes in @ref http_packets */
+static size_t http_nbytes;
+
+/** @brief Granule position (48KHz frames encoded so far) */
+static uint64_t http_granule;
+
+/** @brief Ogg stream state */
+static struct ogg_stream http_ogg;
+
+/** @brief Response header and Ogg header pages, sent to each new listener */
+static unsigned char *http_preamble;
+
+/** @brief Length of @ref http_preamble */
+static size_t http_preamble_len;
+
+/** @brief Ring of encoded pages */
+static unsigned char *http_ring;
+
+/** @brief Number of bytes ever written to @ref http_ring */
+static uint64_t http_written;
+
+/** @brief Position in @ref http_ring of the start of the latest page */
+static uint64_t http_latest;
+
+/** @brief Set to stop the listener thread */
+static int http_quit;
+
+/** @brief Lock protecting the ring and @ref http_quit */
+static pthread_mutex_t http_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** @brief Pipe for waking up the listener thread */
+static int http_wake[2] = { -1, -1 };
+
+/** @brief Listening socket */
+static int http_fd = -1;
+
+/** @brief Listener thread */
+static pthread_t http_server;
+
+/** @brief Connected listeners */
+static struct http_listener http_listeners[HTTP_MAX_LISTENERS];
+
+/** @brief Number of connected listeners */
+static int http_nlisteners;
+
+/** @brief Number of listeners disconnected for falling behind */
+static unsigned long http_dropped;
+
+/** @brief Construct @ref http_preamble */
+static void http_make_preamble(void) {
+  static const char response[] = "HTTP/1.0 200 OK\r\n"
+                                 "Content-Type: audio/ogg\r\n"
+                                 "Cache-Control: no-cache\r\n"
+                                 "\r\n";
+  static const char vendor[] = "DisOrder";
+  unsigned char head[19], tags[16 + sizeof vendor - 1];
+  size_t len, ptr;
+  opus_int32 lookahead = 0;
+
+  /* Identification header (RFC7845 s5.1) */
+  opus_encoder_ctl(http_encoder, OPUS_GET_LOOKAHEAD(&lookahead));
+  memcpy(head, "OpusHead", 8);
+  head[8] = 1;                          /* version */
+  head[9] = uaudio_channels;
+  head[10] = lookahead & 0xFF;          /* pre-skip */
+  head[11] = (lookahead >> 8) & 0xFF;
+  head[12] = uaudio_rate & 0xFF;        /* input sample rate */
+  head[13] = (uaudio_rate >> 8) & 0xFF;
+  head[14] = (uaudio_rate >> 16) & 0xFF;
+  head[15] = (uaudio_rate >> 24) & 0xFF;
+  head[16] = head[17] = 0;              /* output gain */
+  head[18] = 0;                         /* channel mapping family */
+  /* Comment header (RFC7845 s5.2) */
+  memcpy(tags, "OpusTags", 8);
+  tags[8] = sizeof vendor - 1;
+  tags[9] = tags[10] = tags[11] = 0;
+  memcpy(tags + 12, vendor, sizeof vendor - 1);
+  memset(tags + 12 + sizeof vendor - 1, 0, 4); /* no user comments */
+  http_preamble = xmalloc_noptr(sizeof response - 1
+                                + 2 * OGG_HEADER_MAX
+                                + sizeof head + sizeof tags);
+  memcpy(http_preamble, response, sizeof response - 1);
+  ptr = sizeof response - 1;
+  len = sizeof head;
+  ptr += ogg_page(&http_ogg, OGG_BOS, 0, head, &len, 1, http_preamble + ptr);
+  len = sizeof tags;
+  ptr += ogg_page(&http_ogg, 0, 0, tags, &len, 1, http_preamble + ptr);
+  http_preamble_len = ptr;
+}
+
+/** @brief Put the waiting packets into a page and add it to the ring */
+static void http_flush(void) {
+  static unsigned char page[OGG_HEADER_MAX + sizeof http_packets];
+  size_t len, start, n;
+
+  len = ogg_page(&http_ogg, 0, http_granule, http_packets, http_lengths,
+                 http_npackets, page);
+  http_npackets = 0;
+  http_nbytes = 0;
+  pthread_mutex_lock(&http_lock);
+  start = http_written % HTTP_RING;
+  n = len < HTTP_RING - start ? len : HTTP_RING - start;
+  memcpy(http_ring + start, page, n);
+  memcpy(http_ring, page + n, len - n);
+  http_latest = http_written;
+  http_written += len;
+  pthread_mutex_unlock(&http_lock);
+  /* If the pipe is full then the listener thread already has a wakeup
+   * pending */
+  if(write(http_wake[1], "", 1) < 0 && errno != EAGAIN)
+    logring_error(errno, "HTTP: error writing to wakeup pipe");
+}
+
+/** @brief Encode @ref http_pcm */
+static void http_encode(void) {
+  int16_t pcm[2 * RTP_OPUS_CODEC_FRAMES];
+  opus_int32 nbytes;
+
+  rtp_opus_upsample(&http_upsampler, http_pcm, pcm);
+  nbytes = opus_encode(http_encoder, pcm, RTP_OPUS_CODEC_FRAMES,
+                       http_packets + http_nbytes, RTP_OPUS_MAX_BYTES);
+  if(nbytes < 0) {
+    logring_error(0, "HTTP: error encoding Opus packet: %s",
+                  opus_strerror(nbytes));
+    nbytes = 0;
+  }
+  /* A zero-length packet tells the decoder a packet was lost, and keeps the
+   * granule positions right */
+  http_lengths[http_npackets++] = nbytes;
+  http_nbytes += nbytes;
+  http_granule += RTP_OPUS_CODEC_FRAMES;
+  if(http_npackets == HTTP_PAGE_PACKETS)
+    http_flush();
+}
+
+static size_t http_play(void *buffer, size_t nsamples, unsigned flags) {
+  const size_t packet = uaudio_channels * RTP_OPUS_FRAMES;
+  const int16_t *samples = buffer;
+  size_t left = nsamples, n;
+
+  uaudio_schedule_sync();
+  while(left > 0) {
+    n = packet - http_fill < left ? packet - http_fill : left;
+    if(flags & UAUDIO_PAUSED)
+      memset(http_pcm + http_fill, 0, n * sizeof *http_pcm);
+    else
+      memcpy(http_pcm + http_fill, samples, n * sizeof *http_pcm);
+    http_fill += n;
+    samples += n;
+    left -= n;
+    if(http_fill == packet) {
+      http_encode();
+      http_fill = 0;
+    }
+  }
+  uaudio_schedule_sent(nsamples);
+  return nsamples;
+}
+
+/** @brief Accept a new listener */
+static void http_accept(void) {
+  struct http_listener *l;
+  int fd;
+
+  if((fd = accept(http_fd, NULL, NULL)) < 0) {
+    if(errno != EAGAIN && errno != EINTR && errno != ECONNABORTED)
+      logring_error(errno, "HTTP: error calling accept");
+    return;
+  }
+  nonblock(fd);
+  l = &http_listeners[http_nlisteners++];
+  memset(l, 0, sizeof *l);
+  l->fd = fd;
+}
+
+/** @brief Read a listener's request
+ * @param l Listener
+ * @return 0 to carry on, -1 to disconnect
+ *
+ * The request itself is ignored; every listener gets the same stream.
+ */
+static int http_read(struct http_listener *l) {
+  char buffer[1024];
+  ssize_t n, i;
+
+  if((n = read(l->fd, buffer, sizeof buffer)) < 0)
+    return errno == EAGAIN || errno == EINTR ? 0 : -1;
+  if(!n)
+    return -1;
+  for(i = 0; i < n; ++i) {
+    if(buffer[i] == '\n') {
+      if(++l->newlines == 2) {
+        /* Start at the latest page, so playback starts promptly */
+        pthread_mutex_lock(&http_lock);
+        l->offset = http_latest;
+        pthread_mutex_unlock(&http_lock);
+        return 0;
+      }
+    } else if(buffer[i] != '\r')
+      l->newlines = 0;
+  }
+  l->got += n;
+  return l->got > HTTP_REQUEST_MAX ? -1 : 0;
+}
+
+/** @brief Send a listener as much as it will take
+ * @param l Listener
+ * @return 0 to carry on, -1 to disconnect
+ */
+static int http_send(struct http_listener *l) {
+  size_t start, len;
+  ssize_t n;
+  int rc = 0;
+
+  if(l->sent < http_preamble_len) {
+    if((n = write(l->fd, http_preamble + l->sent,
+                  http_preamble_len - l->sent)) < 0)
+      return errno == EAGAIN || errno == EINTR ? 0 : -1;
+    if((l->sent += n) < http_preamble_len)
+      return 0;
+  }
+  pthread_mutex_lock(&http_lock);
+  while(l->offset < http_written) {
+    if(http_written - l->offset > HTTP_RING) {
+      if(!(http_dropped++ & 63))
+        logring_info("HTTP: listener not keeping up, %lu disconnected",
+                     http_dropped);
+      rc = -1;
+      break;
+    }
+    start = l->offset % HTTP_RING;
+    len = http_written - l->offset;
+    if(len > HTTP_RING - start)
+      len = HTTP_RING - start;
+    if((n = write(l->fd, http_ring + start, len)) < 0) {
+      rc = errno == EAGAIN || errno == EINTR ? 0 : -1;
+      break;
+    }
+    l->offset += n;
+  }
+  pthread_mutex_unlock(&http_lock);
+  return rc;
+}
+
+/** @brief Listener thread */
+static void *http_server_fn(void attribute((unused)) *arg) {
+  struct pollfd fds[2 + HTTP_MAX_LISTENERS];
+  struct http_listener *l;
+  char buffer[64];
+  uint64_t written;
+  int n, nlisteners;
+
+  for(;;) {
+    pthread_mutex_lock(&http_lock);
+    written = http_written;
+    if(http_quit) {
+      pthread_mutex_unlock(&http_lock);
+      break;
+    }
+    pthread_mutex_unlock(&http_lock);
+    fds[0].fd = http_wake[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = http_nlisteners < HTTP_MAX_LISTENERS ? http_fd : -1;
+    fds[1].events = POLLIN;
+    nlisteners = http_nlisteners;
+    for(n = 0; n < nlisteners; ++n) {
+      l = &http_listeners[n];
+      fds[2 + n].fd = l->fd;
+      if(l->newlines < 2)
+        fds[2 + n].events = POLLIN;
+      else if(l->sent < http_preamble_len || l->offset < written)
+        fds[2 + n].events = POLLOUT;
+      else
+        fds[2 + n].events = 0;
+    }
+    if(poll(fds, 2 + nlisteners, -1) < 0) {
+      if(errno != EINTR)
+        logring_error(errno, "HTTP: error calling poll");
+      continue;
+    }
+    if(fds[0].revents & POLLIN)
+      while(read(http_wake[0], buffer, sizeof buffer) > 0)
+        ;
+    /* Go backwards, so that removing a listener doesn't disturb the ones
+     * still to be looked at */
+    for(n = nlisteners - 1; n >= 0; --n) {
+      if(!fds[2 + n].revents)
+        continue;
+      l = &http_listeners[n];
+      if(fds[2 + n].revents & (POLLERR|POLLHUP|POLLNVAL)
+         || (l->newlines < 2 ? http_read(l) : http_send(l))) {
+        close(l->fd);
+        *l = http_listeners[--http_nlisteners];
+      }
+    }
+    if(fds[1].revents & POLLIN)
+      http_accept();
+  }
+  for(n = 0; n < http_nlisteners; ++n)
+    close(http_listeners[n].fd);
+  http_nlisteners = 0;
+  return NULL;
+}
+
+/** @brief Open the listening socket */
+static void http_open(void) {
+  struct netaddress na[1];
+  struct resolved *res;
+  size_t nres;
+  static const int one = 1;
+
+  if(uaudio_get_netaddress("http-listen-af",
+                           "http-listen",
+                           "http-listen-port",
+                           na))
+    disorder_fatal(0, "invalid HTTP listen address");
+  if(na->af == -1)
+    disorder_fatal(0, "no HTTP listen address");
+  if(netaddress_resolve(na, 1, SOCK_STREAM, &res, &nres))
+    exit(-1);
+  if((http_fd = socket(res->sa->sa_family, SOCK_STREAM, 0)) < 0)
+    disorder_fatal(errno, "error creating HTTP socket");
+  if(setsockopt(http_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one) < 0)
+    disorder_fatal(errno, "error setting SO_REUSEADDR on HTTP socket");
+  if(bind(http_fd, res->sa, res->len) < 0)
+    disorder_fatal(errno, "error binding HTTP socket to %s",
+                   format_sockaddr(res->sa));
+  if(listen(http_fd, 16) < 0)
+    disorder_fatal(errno, "error listening on HTTP socket");
+  nonblock(http_fd);
+  cloexec(http_fd);
+  disorder_info("HTTP: listening on %s", format_sockaddr(res->sa));
+  netaddress_free_resolved(res, nres);
+}
+
+static void http_start(uaudio_callback *callback,
+                       void *userdata) {
+  int err;
+
+  if(uaudio_rate != 44100 || uaudio_bits != 16 || !uaudio_signed
+     || (uaudio_channels != 1 && uaudio_channels != 2))
+    disorder_fatal(0, "HTTP streaming needs 44.1KHz 16-bit mono or stereo"
+                   " input");
+  http_open();
+  http_encoder = opus_encoder_create(RTP_OPUS_CODEC_RATE, uaudio_channels,
+                                     OPUS_APPLICATION_AUDIO, &err);
+  if(!http_encoder)
+    disorder_fatal(0, "HTTP: error creating Opus encoder: %s",
+                   opus_strerror(err));
+  opus_encoder_ctl(http_encoder,
+                   OPUS_SET_BITRATE(atoi(uaudio_get("http-opus-bitrate",
+                                                    "96000"))));
+  rtp_opus_upsampler_init(&http_upsampler, uaudio_channels);
+  http_fill = 0;
+  http_npackets = 0;
+  http_nbytes = 0;
+  http_granule = 0;
+  gcry_create_nonce(&http_ogg.serial, sizeof http_ogg.serial);
+  http_ogg.sequence = 0;
+  http_make_preamble();
+  http_ring = xmalloc_noptr(HTTP_RING);
+  http_written = http_latest = 0;
+  http_quit = 0;
+  xpipe(http_wake);
+  nonblock(http_wake[0]);
+  nonblock(http_wake[1]);
+  cloexec(http_wake[0]);
+  cloexec(http_wake[1]);
+  if((err = pthread_create(&http_server, NULL, http_server_fn, NULL)))
+    disorder_fatal(err, "pthread_create");
+  uaudio_schedule_init();
+  uaudio_thread_start(callback,
+                      userdata,
+                      http_play,
+                      256 / uaudio_sample_size,
+                      4096 / uaudio_sample_size,
+                      0);
+}
+
+static void http_stop(void) {
+  uaudio_thread_stop();
+  pthread_mutex_lock(&http_lock);
+  http_quit = 1;
+  pthread_mutex_unlock(&http_lock);
+  if(write(http_wake[1], "", 1) < 0 && errno != EAGAIN)
+    disorder_error(errno, "HTTP: error writing to wakeup pipe");
+  pthread_join(http_server, NULL);
+  close(http_wake[0]);
+  close(http_wake[1]);
+  http_wake[0] = http_wake[1] = -1;
+  close(http_fd);
+  http_fd = -1;
+  opus_encoder_destroy(http_encoder);
+  http_encoder = NULL;
+  xfree(http_ring);
+  http_ring = NULL;
+  xfree(http_preamble);
+  http_preamble = NULL;
+}
+
+static void http_configure(void) {
+  char buffer[64];
+
+  uaudio_set_netaddress("http-listen-af",
+                        "http-listen",
+                        "http-listen-port", &config->http_listen);
+  snprintf(buffer, sizeof buffer, "%ld", config->http_opus_bitrate);
+  uaudio_set("http-opus-bitrate", buffer);
+}
+
+const struct uaudio uaudio_http = {
+  .name = "http",
+  .options = http_options,
+  .start = http_start,
+  .stop = http_stop,
+  .activate = uaudio_thread_activate,
+  .deactivate = uaudio_thread_deactivate,
+  .configure = http_configure,
+  .flags = UAUDIO_API_SERVER,
+};
+
+#endif
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
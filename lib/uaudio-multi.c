@@ -0,0 +1,345 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file lib/uaudio-multi.c
+ * @brief Support for playing through several backends at once
+ *
+ * The backends to use are listed in @c config->multi_api.  The first is the
+ * primary output: it gets its sound straight from the real callback, and so
+ * sets the pace for the whole stream.  Everything it receives is also copied
+ * into a ring buffer for each of the other, secondary, outputs.
+ *
+ * Each secondary output takes its sound from its own ring.  If a secondary
+ * output falls behind, its ring fills up and sound for it is discarded rather
+ * than holding up the primary; if it runs ahead, it plays silence until more
+ * arrives.  So a slow or stuck secondary output cannot stall the others.
+ *
+ * Each backend gets its own @ref lib/uaudio-thread.c state via
+ * uaudio_thread_select().  Backends keep their state in static variables so
+ * each may only be listed once.  The @c rtp and @c command backends share
+ * @ref lib/uaudio-schedule.c and so cannot be used together.
+ *
+ * The volume is controlled through the first output that has a mixer.
+ */
+#include "common.h"
+
+#include "mem.h"
+#include "log.h"
+#include "uaudio.h"
+#include "configuration.h"
+
+/** @brief Ring buffer size for secondary outputs, in milliseconds */
+#define MULTI_BUFFER_MS 500
+
+/** @brief One output */
+struct multi_output {
+  /** @brief Backend */
+  const struct uaudio *api;
+
+  /** @brief Ring buffer (secondary outputs only) */
+  char *ring;
+
+  /** @brief Size of @ref ring in bytes */
+  size_t size;
+
+  /** @brief Bytes ever written to @ref ring
+   *
+   * Only modified by the primary output's callback.
+   */
+  size_t head;
+
+  /** @brief Bytes ever read from @ref ring
+   *
+   * Only modified by this output's callback.
+   */
+  size_t tail;
+
+  /** @brief Bytes discarded because @ref ring was full */
+  unsigned long long dropped;
+
+  /** @brief Bytes of silence played because @ref ring was empty */
+  unsigned long long starved;
+};
+
+/** @brief All outputs */
+static struct multi_output *multi_outputs;
+
+/** @brief Number of outputs */
+static int multi_noutputs;
+
+/** @brief Real callback */
+static uaudio_callback *multi_callback;
+
+/** @brief Passed to @ref multi_callback */
+static void *multi_userdata;
+
+static const char *const multi_options[] = {
+  NULL
+};
+
+/** @brief Find the backends to use
+ *
+ * Only does anything the first time it is called.
+ */
+static void multi_init(void) {
+  int n, m;
+
+  if(multi_outputs)
+    return;
+  if(!config->multi_api.n)
+    disorder_fatal(0, "'api multi' but multi_api is not set");
+  if(config->multi_api.n > UAUDIO_THREAD_INSTANCES)
+    disorder_fatal(0, "multi_api lists more than %d backends",
+                   UAUDIO_THREAD_INSTANCES);
+  multi_noutputs = config->multi_api.n;
+  multi_outputs = xcalloc(multi_noutputs, sizeof *multi_outputs);
+  for(n = 0; n < multi_noutputs; ++n) {
+    multi_outputs[n].api = uaudio_find(config->multi_api.s[n]);
+    if(multi_outputs[n].api == &uaudio_multi)
+      disorder_fatal(0, "multi_api cannot include multi");
+    for(m = 0; m < n; ++m)
+      if(multi_outputs[m].api == multi_outputs[n].api)
+        disorder_fatal(0, "multi_api lists %s more than once",
+                       multi_outputs[n].api->name);
+  }
+  for(n = 0; n < multi_noutputs; ++n)
+    if(multi_outputs[n].api == &uaudio_rtp)
+      for(m = 0; m < multi_noutputs; ++m)
+        if(multi_outputs[m].api == &uaudio_command)
+          disorder_fatal(0, "multi_api cannot include both rtp and command");
+}
+
+/** @brief Callback for the primary output
+ *
+ * Gets sound from the real callback and hands a copy to each secondary
+ * output.
+ */
+static size_t multi_primary_callback(void *buffer, size_t max_samples,
+                                     void attribute((unused)) *userdata) {
+  const size_t samples = multi_callback(buffer, max_samples, multi_userdata);
+  const size_t bytes = samples * uaudio_sample_size;
+  size_t head, tail, offset, chunk;
+  int n;
+
+  for(n = 1; n < multi_noutputs; ++n) {
+    struct multi_output *const o = &multi_outputs[n];
+    head = o->head;
+    tail = __atomic_load_n(&o->tail, __ATOMIC_ACQUIRE);
+    if(o->size - (head - tail) < bytes) {
+      /* This output is behind; it will just have to miss this bit */
+      __atomic_add_fetch(&o->dropped, bytes, __ATOMIC_RELAXED);
+      continue;
+    }
+    offset = head % o->size;
+    chunk = o->size - offset < bytes ? o->size - offset : bytes;
+    memcpy(o->ring + offset, buffer, chunk);
+    memcpy(o->ring, (char *)buffer + chunk, bytes - chunk);
+    __atomic_store_n(&o->head, head + bytes, __ATOMIC_RELEASE);
+  }
+  return samples;
+}
+
+/** @brief Callback for a secondary output
+ *
+ * Gets sound from the output's ring, or plays silence if the ring is empty.
+ */
+static size_t multi_secondary_callback(void *buffer, size_t max_samples,
+                                       void *userdata) {
+  struct multi_output *const o = userdata;
+  const size_t frame = uaudio_sample_size * uaudio_channels;
+  size_t head, tail, bytes, offset, chunk;
+
+  head = __atomic_load_n(&o->head, __ATOMIC_ACQUIRE);
+  tail = o->tail;
+  bytes = max_samples * uaudio_sample_size;
+  if(bytes > head - tail)
+    bytes = head - tail;
+  bytes -= bytes % frame;
+  if(!bytes) {
+    bytes = max_samples * uaudio_sample_size;
+    memset(buffer, 0, bytes);
+    __atomic_add_fetch(&o->starved, bytes, __ATOMIC_RELAXED);
+    uaudio_stats_silence(max_samples);
+    return max_samples;
+  }
+  offset = tail % o->size;
+  chunk = o->size - offset < bytes ? o->size - offset : bytes;
+  memcpy(buffer, o->ring + offset, chunk);
+  memcpy((char *)buffer + chunk, o->ring, bytes - chunk);
+  __atomic_store_n(&o->tail, tail + bytes, __ATOMIC_RELEASE);
+  return bytes / uaudio_sample_size;
+}
+
+static void multi_start(uaudio_callback *callback,
+                        void *userdata) {
+  const size_t frame = uaudio_sample_size * uaudio_channels;
+  int n;
+
+  multi_init();
+  multi_callback = callback;
+  multi_userdata = userdata;
+  for(n = 1; n < multi_noutputs; ++n) {
+    struct multi_output *const o = &multi_outputs[n];
+    o->size = (size_t)uaudio_rate * MULTI_BUFFER_MS / 1000 * frame;
+    o->ring = xmalloc_noptr(o->size);
+    o->head = o->tail = 0;
+    o->dropped = o->starved = 0;
+  }
+  for(n = 0; n < multi_noutputs; ++n) {
+    uaudio_thread_select(n);
+    if(n)
+      multi_outputs[n].api->start(multi_secondary_callback, &multi_outputs[n]);
+    else
+      multi_outputs[n].api->start(multi_primary_callback, NULL);
+  }
+  uaudio_thread_select(0);
+}
+
+static void multi_stop(void) {
+  int n;
+
+  for(n = multi_noutputs - 1; n >= 0; --n) {
+    uaudio_thread_select(n);
+    multi_outputs[n].api->stop();
+  }
+  uaudio_thread_select(0);
+  for(n = 1; n < multi_noutputs; ++n) {
+    xfree(multi_outputs[n].ring);
+    multi_outputs[n].ring = NULL;
+  }
+}
+
+static void multi_activate(void) {
+  int n;
+
+  /* Secondaries first, so they are ready for the primary's sound */
+  for(n = multi_noutputs - 1; n >= 0; --n) {
+    uaudio_thread_select(n);
+    multi_outputs[n].api->activate();
+  }
+  uaudio_thread_select(0);
+}
+
+static void multi_deactivate(void) {
+  unsigned long long dropped, starved;
+  int n;
+
+  for(n = 0; n < multi_noutputs; ++n) {
+    uaudio_thread_select(n);
+    multi_outputs[n].api->deactivate();
+  }
+  uaudio_thread_select(0);
+  for(n = 1; n < multi_noutputs; ++n) {
+    dropped = __atomic_exchange_n(&multi_outputs[n].dropped, 0,
+                                  __ATOMIC_RELAXED);
+    starved = __atomic_exchange_n(&multi_outputs[n].starved, 0,
+                                  __ATOMIC_RELAXED);
+    if(dropped || starved)
+      disorder_info("%s: %llu bytes dropped, %llu bytes of silence inserted",
+                    multi_outputs[n].api->name, dropped, starved);
+  }
+}
+
+/** @brief Test whether an output is in use
+ * @param api Backend to test for
+ * @return Nonzero if @p api is one of the outputs
+ */
+int uaudio_multi_uses(const struct uaudio *api) {
+  int n;
+
+  multi_init();
+  for(n = 0; n < multi_noutputs; ++n)
+    if(multi_outputs[n].api == api)
+      return 1;
+  return 0;
+}
+
+/** @brief Return the output whose mixer we use, or NULL */
+static const struct uaudio *multi_mixer(void) {
+  int n;
+
+  multi_init();
+  for(n = 0; n < multi_noutputs; ++n)
+    if(multi_outputs[n].api->open_mixer)
+      return multi_outputs[n].api;
+  return NULL;
+}
+
+static void multi_open_mixer(void) {
+  const struct uaudio *api = multi_mixer();
+
+  if(api)
+    api->open_mixer();
+}
+
+static void multi_close_mixer(void) {
+  const struct uaudio *api = multi_mixer();
+
+  if(api && api->close_mixer)
+    api->close_mixer();
+}
+
+static void multi_get_volume(int *left, int *right) {
+  const struct uaudio *api = multi_mixer();
+
+  if(api && api->get_volume)
+    api->get_volume(left, right);
+  else
+    *left = *right = 0;
+}
+
+static void multi_set_volume(int *left, int *right) {
+  const struct uaudio *api = multi_mixer();
+
+  if(api && api->set_volume)
+    api->set_volume(left, right);
+  else
+    *left = *right = 0;
+}
+
+static void multi_configure(void) {
+  int n;
+
+  multi_init();
+  for(n = 0; n < multi_noutputs; ++n)
+    if(multi_outputs[n].api->configure)
+      multi_outputs[n].api->configure();
+}
+
+const struct uaudio uaudio_multi = {
+  .name = "multi",
+  .options = multi_options,
+  .start = multi_start,
+  .stop = multi_stop,
+  .activate = multi_activate,
+  .deactivate = multi_deactivate,
+  .open_mixer = multi_open_mixer,
+  .close_mixer = multi_close_mixer,
+  .get_volume = multi_get_volume,
+  .set_volume = multi_set_volume,
+  .configure = multi_configure,
+  .flags = UAUDIO_API_SERVER,
+};
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
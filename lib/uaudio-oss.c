@@ -128,6 +128,11 @@ static size_t oss_play(void *buffer, size_t samples, unsigned flags) {
   int rc = write(oss_fd, buffer, bytes);
   if(rc < 0)
     disorder_fatal(errno, "error writing to sound device");
+#ifdef SNDCTL_DSP_GETODELAY
+  int delay;
+  if(ioctl(oss_fd, SNDCTL_DSP_GETODELAY, &delay) == 0 && delay >= 0)
+    uaudio_stats_latency(delay / (uaudio_sample_size * uaudio_channels));
+#endif
   return rc / uaudio_sample_size;
 }
 
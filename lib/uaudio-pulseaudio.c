@@ -16,7 +16,14 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 /** @file lib/uaudio-pulseaudio.c
- * @brief Support for PulseAudio backend */
+ * @brief Support for PulseAudio backend
+ *
+ * By default PulseAudio chooses the buffering, which may amount to a couple
+ * of seconds, and sound is fed to it from @ref lib/uaudio-thread.c.  If the
+ * @c latency option is set then the stream's buffer is limited to that many
+ * milliseconds and PulseAudio's write callback gets sound directly from the
+ * uaudio callback instead.
+ */
 #include "common.h"
 
 #if HAVE_PULSEAUDIO
@@ -34,6 +41,7 @@
 
 static const char *const pulseaudio_options[] = {
   "application",
+  "latency",
   NULL
 };
 
@@ -43,6 +51,18 @@ static pa_stream *str;
 static pa_channel_map cmap;
 static uint32_t strix;
 
+/** @brief Callback to get audio data in low-latency mode, or NULL */
+static uaudio_callback *pulseaudio_callback;
+
+/** @brief Passed to @ref pulseaudio_callback */
+static void *pulseaudio_userdata;
+
+/** @brief Set when activated, clear when paused (low-latency mode)
+ *
+ * Protected by the main loop lock.
+ */
+static int pulseaudio_activated;
+
 #define PAERRSTR pa_strerror(pa_context_errno(ctx))
 
 /** @brief Callback: wake up main loop when the context is ready. */
@@ -79,6 +99,55 @@ static void cb_wakeup(attribute((unused)) pa_stream *xstr,
                       attribute((unused)) void *p)
   { pa_threaded_mainloop_signal(loop, 0); }
 
+/** @brief Record the stream's latency
+ *
+ * Must be called with the main loop locked.
+ */
+static void pulseaudio_latency(void) {
+  pa_usec_t usec;
+  int negative;
+
+  if(!pa_stream_get_latency(str, &usec, &negative) && !negative)
+    uaudio_stats_latency((uint64_t)usec * uaudio_rate / 1000000);
+}
+
+/** @brief Callback: fill output buffer space in low-latency mode. */
+static void cb_write(attribute((unused)) pa_stream *xstr,
+                     size_t sz,
+                     attribute((unused)) void *p) {
+  const size_t frame = uaudio_sample_size * uaudio_channels;
+  size_t n, want, got;
+  void *data;
+
+  while(sz >= frame) {
+    n = sz;
+    if(pa_stream_begin_write(str, &data, &n) < 0)
+      disorder_fatal(0, "failed to get pulseaudio buffer: %s", PAERRSTR);
+    if(n > sz) n = sz;
+    n -= n % frame;
+    if(!n) {
+      pa_stream_cancel_write(str);
+      break;
+    }
+    want = n / uaudio_sample_size;
+    if(pulseaudio_activated) {
+      for(got = 0; got < want;)
+        got += pulseaudio_callback((char *)data + got * uaudio_sample_size,
+                                   want - got, pulseaudio_userdata);
+    } else
+      memset(data, 0, n);
+    if(pa_stream_write(str, data, n, 0, 0, PA_SEEK_RELATIVE) < 0)
+      disorder_fatal(0, "failed to write pulseaudio data: %s", PAERRSTR);
+    sz -= n;
+  }
+  pulseaudio_latency();
+}
+
+/** @brief Callback: the server ran out of data to play */
+static void cb_underflow(attribute((unused)) pa_stream *xstr,
+                         attribute((unused)) void *p)
+  { uaudio_stats_xrun(); }
+
 struct simpleop {
   const char *what;
   int donep;
@@ -97,6 +166,9 @@ static void pulseaudio_open() {
   /* Much of the following is cribbed from the PulseAudio `simple' source. */
 
   pa_sample_spec ss;
+  pa_buffer_attr attr;
+  char *latency = uaudio_get("latency", NULL);
+  long ms = latency ? atol(latency) : 0;
 
   /* Set up the sample format. */
   ss.format = -1;
@@ -133,9 +205,23 @@ static void pulseaudio_open() {
   str = pa_stream_new(ctx, "DisOrder", &ss, 0);
   if(!str)
     disorder_fatal(0, "failed to create pulseaudio stream: %s", PAERRSTR);
-  pa_stream_set_write_callback(str, cb_wakeup, 0);
-  if(pa_stream_connect_playback(str, 0, 0,
-                                PA_STREAM_ADJUST_LATENCY,
+  pa_stream_set_write_callback(str, pulseaudio_callback ? cb_write : cb_wakeup,
+                               0);
+  pa_stream_set_underflow_callback(str, cb_underflow, 0);
+  if(ms > 0) {
+    /* PulseAudio asks for more when the buffer drops by minreq, so this
+     * keeps it between 3/4 and all of the target */
+    attr.maxlength = (uint32_t)-1;
+    attr.tlength = pa_usec_to_bytes(ms * 1000, &ss);
+    attr.prebuf = (uint32_t)-1;
+    attr.minreq = attr.tlength / 4;
+    attr.fragsize = (uint32_t)-1;
+  }
+  xfree(latency);
+  if(pa_stream_connect_playback(str, 0, ms > 0 ? &attr : 0,
+                                PA_STREAM_ADJUST_LATENCY
+                                |PA_STREAM_INTERPOLATE_TIMING
+                                |PA_STREAM_AUTO_TIMING_UPDATE,
                                 0, 0))
     disorder_fatal(0, "failed to connect pulseaudio stream for playback: %s",
                    PAERRSTR);
@@ -175,24 +261,54 @@ static size_t pulseaudio_play(void *buffer, size_t samples,
       disorder_fatal(0, "failed to write pulseaudio data: %s", PAERRSTR);
     p += n; sz -= n;
   }
+  pulseaudio_latency();
   pa_threaded_mainloop_unlock(loop);
   return samples;
 }
 
 static void pulseaudio_start(uaudio_callback *callback,
                              void *userdata) {
+  char *latency = uaudio_get("latency", NULL);
+
+  if(latency && atol(latency) > 0) {
+    pulseaudio_callback = callback;
+    pulseaudio_userdata = userdata;
+    pulseaudio_activated = 0;
+  } else
+    pulseaudio_callback = 0;
+  xfree(latency);
   pulseaudio_open();
-  uaudio_thread_start(callback, userdata, pulseaudio_play,
-                      32 / uaudio_sample_size,
-                      4096 / uaudio_sample_size,
-                      0);
+  if(!pulseaudio_callback)
+    uaudio_thread_start(callback, userdata, pulseaudio_play,
+                        32 / uaudio_sample_size,
+                        4096 / uaudio_sample_size,
+                        0);
 }
 
 static void pulseaudio_stop(void) {
-  uaudio_thread_stop();
+  if(!pulseaudio_callback)
+    uaudio_thread_stop();
   pulseaudio_close();
 }
 
+static void pulseaudio_activate(void) {
+  if(pulseaudio_callback) {
+    pa_threaded_mainloop_lock(loop);
+    pulseaudio_activated = 1;
+    pa_threaded_mainloop_unlock(loop);
+  } else
+    uaudio_thread_activate();
+}
+
+static void pulseaudio_deactivate(void) {
+  if(pulseaudio_callback) {
+    pa_threaded_mainloop_lock(loop);
+    pulseaudio_activated = 0;
+    pa_threaded_mainloop_unlock(loop);
+  } else
+    uaudio_thread_deactivate();
+}
+
 static void pulseaudio_open_mixer(void) {
   if(!str)
     disorder_fatal(0, "won't open pulseaudio mixer with no stream open");
@@ -287,8 +403,8 @@ const struct uaudio uaudio_pulseaudio = {
   .options = pulseaudio_options,
   .start = pulseaudio_start,
   .stop = pulseaudio_stop,
-  .activate = uaudio_thread_activate,
-  .deactivate = uaudio_thread_deactivate,
+  .activate = pulseaudio_activate,
+  .deactivate = pulseaudio_deactivate,
   .open_mixer = pulseaudio_open_mixer,
   .close_mixer = pulseaudio_close_mixer,
   .get_volume = pulseaudio_get_volume,
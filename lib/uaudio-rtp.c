@@ -25,21 +25,29 @@
 #include <net/if.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <gcrypt.h>
 #include <unistd.h>
 #include <time.h>
 #include <sys/uio.h>
 #include <pthread.h>
+#if HAVE_OPUS_OPUS_H
+#include <opus/opus.h>
+#endif
 
 #include "uaudio.h"
 #include "mem.h"
 #include "log.h"
+#include "logring.h"
 #include "syscalls.h"
 #include "rtp.h"
 #include "addr.h"
 #include "ifreq.h"
 #include "timeval.h"
 #include "configuration.h"
+#include "gain.h"
+#include "rtp-opus.h"
+#include "realtime.h"
 
 /** @brief Bytes to send per network packet */
 static int rtp_max_payload;
@@ -74,21 +82,217 @@ static int rtp_errors;
 /** @brief RTP mode */
 static int rtp_mode;
 
+/** @brief Set if samples arrive in network byte order
+ *
+ * Otherwise they are native-endian and must be converted.
+ */
+static int rtp_network_order;
+
 #define RTP_BROADCAST 1
 #define RTP_MULTICAST 2
 #define RTP_UNICAST 3
 #define RTP_REQUEST 4
 #define RTP_AUTO 5
 
+/** @brief Consecutive send errors after which a unicast client is dropped
+ *
+ * At ~120 packets per second this is a couple of seconds.
+ */
+#define RTP_RECIPIENT_MAX_ERRORS 256
+
 /** @brief A unicast client */
 struct rtp_recipient {
   struct rtp_recipient *next;
   struct sockaddr_storage sa;
+
+  /** @brief Consecutive send errors
+   *
+   * Once this reaches @ref RTP_RECIPIENT_MAX_ERRORS no more packets are sent
+   * to this client.  It stays on the list until removed with
+   * rtp_remove_recipient() or re-added with rtp_add_recipient().
+   */
+  int errors;
+
+  /** @brief Payload encoding (@ref RTP_CODEC_L16 or @ref RTP_CODEC_OPUS) */
+  int codec;
 };
 
 /** @brief List of unicast clients */
 static struct rtp_recipient *rtp_recipient_list;
 
+/** @brief One message for rtp_sendmmsg() */
+#if HAVE_SENDMMSG
+typedef struct mmsghdr rtp_mmsghdr;
+#else
+typedef struct {
+  struct msghdr msg_hdr;
+  unsigned msg_len;
+} rtp_mmsghdr;
+#endif
+
+/** @brief A batch of unicast packets for one socket */
+struct rtp_batch {
+  /** @brief Number of messages */
+  size_t n;
+
+  /** @brief Space allocated for messages */
+  size_t size;
+
+  /** @brief Messages */
+  rtp_mmsghdr *msgs;
+
+  /** @brief Recipient for each message */
+  struct rtp_recipient **recipients;
+};
+
+/** @brief IPv4 unicast batch */
+static struct rtp_batch rtp_batch4;
+
+/** @brief IPv6 unicast batch */
+static struct rtp_batch rtp_batch6;
+
+/** @brief Number of packets that can be waiting for the sender thread
+ *
+ * About half a second's worth.
+ */
+#define RTP_QUEUE_SIZE 64
+
+/** @brief A packet waiting to be sent */
+struct rtp_packet {
+  /** @brief RTP header */
+  struct rtp_header header;
+
+  /** @brief Payload size in bytes */
+  size_t nbytes;
+
+  /** @brief Payload, in network byte order */
+  void *data;
+};
+
+/** @brief Packets waiting for the sender thread
+ *
+ * This is a single-producer, single-consumer ring with no lock.  Only
+ * rtp_play() advances @ref rtp_queue_head and only the sender thread
+ * advances @ref rtp_queue_tail.  Both count up forever; the slot is the count
+ * modulo @ref RTP_QUEUE_SIZE.
+ */
+static struct rtp_packet rtp_queue[RTP_QUEUE_SIZE];
+
+/** @brief Number of packets ever queued */
+static size_t rtp_queue_head;
+
+/** @brief Number of packets ever sent */
+static size_t rtp_queue_tail;
+
+/** @brief Number of packets dropped because the queue was full */
+static unsigned long rtp_dropped;
+
+/** @brief Sender thread */
+static pthread_t rtp_sender;
+
+/** @brief Set to make the sender thread exit */
+static int rtp_sender_quit;
+
+/** @brief Mutex used only for the sender thread to sleep on */
+static pthread_mutex_t rtp_sender_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** @brief Signalled when a packet is queued or on shutdown */
+static pthread_cond_t rtp_sender_cond = PTHREAD_COND_INITIALIZER;
+
+/** @brief Set while the sender thread is waiting for packets
+ *
+ * rtp_play() only takes @ref rtp_sender_lock to signal the sender when this
+ * is set, so a busy sender costs it nothing.  The flag is set before the
+ * sender checks the queue for the last time and the new head is stored
+ * before rtp_play() checks the flag, both sequentially consistent, so at
+ * least one of them sees the other and no wakeup is lost.
+ */
+static int rtp_sender_sleeping;
+
+/** @brief Most packets to pass to the kernel at once with UDP GSO
+ *
+ * 0 or 1 means that generic segmentation offload is not used.  Only applies
+ * to @ref rtp_fd, i.e. to broadcast, multicast and unicast modes.
+ */
+static int rtp_gso_max;
+
+/** @brief Packets waiting to be sent in one go, back to back */
+static unsigned char *rtp_gso_buffer;
+
+/** @brief Number of packets in @ref rtp_gso_buffer */
+static int rtp_gso_count;
+
+/** @brief Number of bytes in @ref rtp_gso_buffer */
+static size_t rtp_gso_bytes;
+
+/** @brief Size of each packet in @ref rtp_gso_buffer
+ *
+ * The kernel splits the buffer up at multiples of this size, so only the last
+ * packet may be smaller.
+ */
+static size_t rtp_gso_segment;
+
+/** @brief Audio packets per parity FEC packet, or 0
+ *
+ * Only applies to @ref rtp_fd, i.e. to broadcast, multicast and unicast
+ * modes.
+ */
+static int rtp_fec;
+
+/** @brief FEC header for the FEC packet under construction */
+static struct rtp_fec_header rtp_fec_header;
+
+/** @brief Payload of the FEC packet under construction */
+static unsigned char *rtp_fec_payload;
+
+/** @brief Number of bytes of @ref rtp_fec_payload in use */
+static size_t rtp_fec_length;
+
+/** @brief Number of audio packets in the FEC packet under construction */
+static int rtp_fec_count;
+
+/** @brief Sequence number of the next FEC packet */
+static uint16_t rtp_fec_sequence;
+
+/** @brief Interval between RTCP sender reports, in seconds */
+#define RTP_REPORT_INTERVAL 5
+
+/** @brief Set to send RTCP sender reports */
+static int rtp_rtcp;
+
+/** @brief RTP timestamp at which the next sender report is due */
+static uint32_t rtp_report_due;
+
+/** @brief Number of uncompressed packets sent, for sender reports */
+static uint32_t rtp_packets_sent;
+
+/** @brief Number of uncompressed payload octets sent, for sender reports */
+static uint32_t rtp_octets_sent;
+
+#if HAVE_OPUS_OPUS_H
+/** @brief Opus encoder
+ *
+ * There is only one, however many recipients want Opus; each compressed
+ * packet goes to all of them.  Only used by the sender thread.
+ */
+static OpusEncoder *rtp_opus_encoder;
+
+/** @brief Rate converter feeding @ref rtp_opus_encoder */
+static struct rtp_opus_upsampler rtp_opus_upsampler;
+
+/** @brief Audio waiting to go to @ref rtp_opus_encoder */
+static struct rtp_opus_framer rtp_opus_framer;
+
+/** @brief Sequence number of the next Opus packet */
+static uint16_t rtp_opus_sequence;
+
+/** @brief Number of Opus packets sent, for sender reports */
+static uint32_t rtp_opus_packets_sent;
+
+/** @brief Number of Opus payload octets sent, for sender reports */
+static uint32_t rtp_opus_octets_sent;
+#endif
+
 /** @brief Mutex protecting data structures */
 static pthread_mutex_t rtp_lock = PTHREAD_MUTEX_INITIALIZER;
 
@@ -102,56 +306,480 @@ static const char *const rtp_options[] = {
   "rtp-mode",
   "rtp-max-payload",
   "rtp-mtu-discovery",
+  "rtp-sample-order",
+  "rtp-gso",
+  "rtp-opus-bitrate",
+  "rtp-rtcp",
+  "rtp-fec",
   NULL
 };
 
-static void rtp_get_netconfig(const char *af,
-                              const char *addr,
-                              const char *port,
-                              struct netaddress *na) {
-  char *vec[3];
-  
-  vec[0] = uaudio_get(af, NULL);
-  vec[1] = uaudio_get(addr, NULL);
-  vec[2] = uaudio_get(port, NULL);
-  if(!*vec)
-    na->af = -1;
-  else
-    if(netaddress_parse(na, 3, vec))
-      disorder_fatal(0, "invalid RTP address");
+/** @brief Send several datagrams at once
+ * @param fd Socket
+ * @param msgs Messages to send
+ * @param n Number of messages
+ * @param flags Flags for sendmsg()
+ * @return Number of messages sent, or -1 if the first one failed
+ *
+ * Uses sendmmsg() where available, so that the whole batch costs one system
+ * call.
+ */
+static int rtp_sendmmsg(int fd, rtp_mmsghdr *msgs, size_t n, int flags) {
+#if HAVE_SENDMMSG
+  return sendmmsg(fd, msgs, n, flags);
+#else
+  size_t i;
+  ssize_t bytes;
+
+  for(i = 0; i < n; ++i) {
+    if((bytes = sendmsg(fd, &msgs[i].msg_hdr, flags)) < 0)
+      return i ? (int)i : -1;
+    msgs[i].msg_len = bytes;
+  }
+  return n;
+#endif
 }
 
-static void rtp_set_netconfig(const char *af,
-                              const char *addr,
-                              const char *port,
-                              const struct netaddress *na) {
-  uaudio_set(af, NULL);
-  uaudio_set(addr, NULL);
-  uaudio_set(port, NULL);
-  if(na->af != -1) {
-    int nvec;
-    char **vec;
-
-    netaddress_format(na, &nvec, &vec);
-    if(nvec > 0) {
-      uaudio_set(af, vec[0]);
-      xfree(vec[0]);
+/** @brief Add a recipient to a batch
+ * @param b Batch
+ * @param r Recipient
+ * @param vec Packet contents (2 elements)
+ */
+static void rtp_batch_add(struct rtp_batch *b,
+                          struct rtp_recipient *r,
+                          struct iovec *vec) {
+  struct msghdr *m;
+
+  if(b->n >= b->size) {
+    b->size = b->size ? 2 * b->size : 16;
+    b->msgs = xrealloc(b->msgs, b->size * sizeof *b->msgs);
+    b->recipients = xrealloc(b->recipients, b->size * sizeof *b->recipients);
+  }
+  m = &b->msgs[b->n].msg_hdr;
+  memset(m, 0, sizeof *m);
+  m->msg_name = &r->sa;
+  m->msg_namelen = r->sa.ss_family == AF_INET ?
+    sizeof (struct sockaddr_in) : sizeof (struct sockaddr_in6);
+  m->msg_iov = vec;
+  m->msg_iovlen = 2;
+  b->recipients[b->n++] = r;
+}
+
+/** @brief Send a batch of packets
+ * @param b Batch
+ * @param fd Socket to send it on
+ *
+ * A recipient that fails is skipped and its error count incremented.
+ * Congestion affects the whole socket, so the rest of the batch is dropped
+ * without blaming anyone.  Called with @ref rtp_lock held.
+ */
+static void rtp_batch_send(struct rtp_batch *b, int fd) {
+  size_t i = 0;
+  int n;
+
+  while(i < b->n) {
+    n = rtp_sendmmsg(fd, b->msgs + i, b->n - i, MSG_DONTWAIT|MSG_NOSIGNAL);
+    if(n < 0) {
+      if(errno == EINTR)
+        continue;
+      if(errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+        break;
+      struct rtp_recipient *const r = b->recipients[i++];
+      if(!r->errors)
+        logring_error(errno, "error transmitting audio data to %s",
+                      format_sockaddr((struct sockaddr *)&r->sa));
+      if(++r->errors == RTP_RECIPIENT_MAX_ERRORS)
+        logring_error(0, "RTP: giving up on %s after %d errors",
+                      format_sockaddr((struct sockaddr *)&r->sa),
+                      r->errors);
+    } else
+      while(n-- > 0)
+        b->recipients[i++]->errors = 0;
+  }
+  b->n = 0;
+}
+
+/** @brief Account for a send on @ref rtp_fd
+ * @param written_bytes Return value from the send
+ */
+static void rtp_master_sent(int written_bytes) {
+  if(written_bytes < 0) {
+    disorder_error(errno, "error transmitting audio data");
+    ++rtp_errors;
+    if(rtp_errors == 10)
+      disorder_fatal(0, "too many audio transmission errors");
+  } else
+    rtp_errors /= 2;                    /* gradual decay */
+}
+
+/** @brief Send everything in @ref rtp_gso_buffer */
+static void rtp_gso_flush(void) {
+  size_t offset, len;
+  int written_bytes;
+
+  if(!rtp_gso_count)
+    return;
+#ifdef UDP_SEGMENT
+  if(rtp_gso_count > 1 && rtp_gso_max > 1) {
+    char control[CMSG_SPACE(sizeof (uint16_t))];
+    struct iovec v;
+    struct msghdr m;
+    struct cmsghdr *cm;
+    const uint16_t segment = rtp_gso_segment;
+
+    v.iov_base = rtp_gso_buffer;
+    v.iov_len = rtp_gso_bytes;
+    memset(&m, 0, sizeof m);
+    memset(control, 0, sizeof control);
+    m.msg_iov = &v;
+    m.msg_iovlen = 1;
+    m.msg_control = control;
+    m.msg_controllen = sizeof control;
+    cm = CMSG_FIRSTHDR(&m);
+    cm->cmsg_level = IPPROTO_UDP;
+    cm->cmsg_type = UDP_SEGMENT;
+    cm->cmsg_len = CMSG_LEN(sizeof segment);
+    memcpy(CMSG_DATA(cm), &segment, sizeof segment);
+    do {
+      written_bytes = sendmsg(rtp_fd, &m, 0);
+    } while(written_bytes < 0 && errno == EINTR);
+    if(written_bytes >= 0
+       || (errno != EIO && errno != EINVAL && errno != ENOPROTOOPT
+           && errno != EOPNOTSUPP)) {
+      rtp_master_sent(written_bytes);
+      rtp_gso_count = 0;
+      rtp_gso_bytes = 0;
+      return;
     }
-    if(nvec > 1) {
-      uaudio_set(addr, vec[1]);
-      xfree(vec[1]);
+    /* The kernel or the interface can't do it after all */
+    logring_error(errno, "RTP: UDP segmentation offload failed, disabling it");
+    rtp_gso_max = 0;
+  }
+#endif
+  /* Send the packets one at a time */
+  for(offset = 0; offset < rtp_gso_bytes; offset += len) {
+    len = rtp_gso_bytes - offset;
+    if(len > rtp_gso_segment)
+      len = rtp_gso_segment;
+    do {
+      written_bytes = send(rtp_fd, rtp_gso_buffer + offset, len, 0);
+    } while(written_bytes < 0 && errno == EINTR);
+    rtp_master_sent(written_bytes);
+  }
+  rtp_gso_count = 0;
+  rtp_gso_bytes = 0;
+}
+
+/** @brief Add a packet to @ref rtp_gso_buffer, sending it if it's full
+ * @param p Packet
+ */
+static void rtp_gso_add(const struct rtp_packet *p) {
+  const size_t size = sizeof p->header + p->nbytes;
+
+  /* Only the last segment may be shorter than the rest */
+  if(rtp_gso_count && size > rtp_gso_segment)
+    rtp_gso_flush();
+  if(!rtp_gso_count)
+    rtp_gso_segment = size;
+  memcpy(rtp_gso_buffer + rtp_gso_bytes, &p->header, sizeof p->header);
+  memcpy(rtp_gso_buffer + rtp_gso_bytes + sizeof p->header,
+         p->data, p->nbytes);
+  rtp_gso_bytes += size;
+  ++rtp_gso_count;
+  if(size < rtp_gso_segment || rtp_gso_count >= rtp_gso_max)
+    rtp_gso_flush();
+}
+
+#if HAVE_OPUS_OPUS_H
+/** @brief Compress a packet and send it to the Opus recipients
+ * @param f @ref rtp_opus_framer
+ * @param u Not used
+ */
+static void rtp_opus_send(struct rtp_opus_framer *f,
+                          void attribute((unused)) *u) {
+  unsigned char data[RTP_OPUS_MAX_BYTES];
+  struct rtp_header header;
+  struct iovec vec[2];
+  struct rtp_recipient *r;
+  int nbytes;
+
+  nbytes = rtp_opus_encode(rtp_opus_encoder, &rtp_opus_upsampler, f->pcm,
+                           data);
+  if(nbytes < 0) {
+    logring_error(0, "RTP: error encoding Opus packet: %s",
+                  opus_strerror(nbytes));
+    return;
+  }
+  header.vpxcc = 2 << 6;              /* V=2, P=0, X=0, CC=0 */
+  header.mpt = RTP_OPUS_PAYLOAD | (f->marker ? 0x80 : 0);
+  header.seq = htons(rtp_opus_sequence++);
+  header.timestamp = htonl(f->timestamp);
+  header.ssrc = rtp_id;
+  vec[0].iov_base = (void *)&header;
+  vec[0].iov_len = sizeof header;
+  vec[1].iov_base = data;
+  vec[1].iov_len = nbytes;
+  pthread_mutex_lock(&rtp_lock);
+  for(r = rtp_recipient_list; r; r = r->next)
+    if(r->errors < RTP_RECIPIENT_MAX_ERRORS && r->codec == RTP_CODEC_OPUS)
+      rtp_batch_add(r->sa.ss_family == AF_INET ? &rtp_batch4 : &rtp_batch6,
+                    r, vec);
+  rtp_batch_send(&rtp_batch4, rtp_fd4);
+  rtp_batch_send(&rtp_batch6, rtp_fd6);
+  pthread_mutex_unlock(&rtp_lock);
+  ++rtp_opus_packets_sent;
+  rtp_opus_octets_sent += nbytes;
+}
+
+/** @brief Feed one uncompressed packet to the Opus encoder
+ * @param p Packet
+ *
+ * See rtp_opus_frame().  A partial packet can't be continued across a pause,
+ * a dropped packet or a period with no Opus recipients.  Called from the
+ * sender thread.
+ */
+static void rtp_opus_transmit(const struct rtp_packet *p) {
+  rtp_opus_frame(&rtp_opus_framer, p->data, p->nbytes / uaudio_sample_size,
+                 ntohl(p->header.timestamp), p->header.mpt & 0x80,
+                 rtp_opus_send, NULL);
+}
+#endif
+
+/** @brief Add a packet to the FEC packet under construction
+ * @param p Packet, just sent on @ref rtp_fd
+ *
+ * When @ref rtp_fec packets have been added, the FEC packet is sent too.
+ * Called from the sender thread.
+ */
+static void rtp_fec_add(const struct rtp_packet *p) {
+  struct rtp_fec_header *const f = &rtp_fec_header;
+  const unsigned char *const data = p->data;
+  struct rtp_header header;
+  struct iovec vec[3];
+  size_t n;
+  int written_bytes;
+
+  /* Protected packets must have consecutive sequence numbers, which they
+   * won't across a pause */
+  if(rtp_fec_count
+     && ntohs(p->header.seq) != (uint16_t)(ntohs(f->sn_base)
+                                           + rtp_fec_count))
+    rtp_fec_count = 0;
+  if(!rtp_fec_count) {
+    memset(f, 0, sizeof *f);
+    f->sn_base = p->header.seq;
+    rtp_fec_length = 0;
+  }
+  f->elpxcc ^= p->header.vpxcc & 0x3F;
+  f->mpt ^= p->header.mpt;
+  f->ts_recovery ^= p->header.timestamp;
+  f->length_recovery ^= htons(p->nbytes);
+  if(p->nbytes > rtp_fec_length) {
+    memset(rtp_fec_payload + rtp_fec_length, 0, p->nbytes - rtp_fec_length);
+    rtp_fec_length = p->nbytes;
+  }
+  for(n = 0; n < p->nbytes; ++n)
+    rtp_fec_payload[n] ^= data[n];
+  if(++rtp_fec_count < rtp_fec)
+    return;
+  f->protection_length = htons(rtp_fec_length);
+  f->mask = htons((0xFFFF0000 >> rtp_fec) & 0xFFFF);
+  header.vpxcc = 2 << 6;              /* V=2, P=0, X=0, CC=0 */
+  header.mpt = RTP_FEC_PAYLOAD;
+  header.seq = htons(rtp_fec_sequence++);
+  header.timestamp = p->header.timestamp;
+  header.ssrc = rtp_id;
+  vec[0].iov_base = (void *)&header;
+  vec[0].iov_len = sizeof header;
+  vec[1].iov_base = (void *)f;
+  vec[1].iov_len = sizeof *f;
+  vec[2].iov_base = rtp_fec_payload;
+  vec[2].iov_len = rtp_fec_length;
+  /* GSO can't mix packet sizes */
+  rtp_gso_flush();
+  do {
+    written_bytes = writev(rtp_fd, vec, 3);
+  } while(written_bytes < 0 && errno == EINTR);
+  rtp_master_sent(written_bytes);
+  rtp_fec_count = 0;
+}
+
+/** @brief Send an RTCP sender report, if one is due
+ * @param p Packet just sent
+ *
+ * The report maps @p p's timestamp to the current time.  It goes to the same
+ * places as the audio, using the same ports.  Called from the sender thread.
+ */
+static void rtp_report(const struct rtp_packet *p) {
+  struct rtcp_sender_report sr;
+  struct timespec now;
+  struct iovec vec[2];
+  struct rtp_recipient *r;
+  int written_bytes;
+
+  if((int32_t)(ntohl(p->header.timestamp) - rtp_report_due) < 0)
+    return;
+  rtp_report_due = ntohl(p->header.timestamp)
+    + RTP_REPORT_INTERVAL * uaudio_rate * uaudio_channels;
+  xgettime(CLOCK_REALTIME, &now);
+  sr.vprc = 2 << 6;                     /* V=2, P=0, RC=0 */
+  sr.pt = RTCP_SR;
+  sr.length = htons(sizeof sr / 4 - 1);
+  sr.ssrc = rtp_id;
+  sr.ntp_seconds = htonl((uint32_t)(now.tv_sec + NTP_EPOCH_OFFSET));
+  sr.ntp_fraction = htonl((uint32_t)(((uint64_t)now.tv_nsec << 32)
+                                     / 1000000000));
+  sr.rtp_timestamp = p->header.timestamp;
+  sr.packets = htonl(rtp_packets_sent);
+  sr.octets = htonl(rtp_octets_sent);
+  if(rtp_mode != RTP_REQUEST) {
+    /* GSO can't mix packet sizes, and the report should follow the audio it
+     * describes */
+    rtp_gso_flush();
+    do {
+      written_bytes = send(rtp_fd, &sr, sizeof sr, 0);
+    } while(written_bytes < 0 && errno == EINTR);
+    rtp_master_sent(written_bytes);
+  }
+  vec[0].iov_base = &sr;
+  vec[0].iov_len = sizeof sr;
+  vec[1].iov_base = NULL;
+  vec[1].iov_len = 0;
+  pthread_mutex_lock(&rtp_lock);
+  for(r = rtp_recipient_list; r; r = r->next)
+    if(r->errors < RTP_RECIPIENT_MAX_ERRORS && r->codec == RTP_CODEC_L16)
+      rtp_batch_add(r->sa.ss_family == AF_INET ? &rtp_batch4 : &rtp_batch6,
+                    r, vec);
+  rtp_batch_send(&rtp_batch4, rtp_fd4);
+  rtp_batch_send(&rtp_batch6, rtp_fd6);
+#if HAVE_OPUS_OPUS_H
+  /* The Opus stream has the same timestamps but its own counts */
+  sr.packets = htonl(rtp_opus_packets_sent);
+  sr.octets = htonl(rtp_opus_octets_sent);
+  for(r = rtp_recipient_list; r; r = r->next)
+    if(r->errors < RTP_RECIPIENT_MAX_ERRORS && r->codec == RTP_CODEC_OPUS)
+      rtp_batch_add(r->sa.ss_family == AF_INET ? &rtp_batch4 : &rtp_batch6,
+                    r, vec);
+  rtp_batch_send(&rtp_batch4, rtp_fd4);
+  rtp_batch_send(&rtp_batch6, rtp_fd6);
+#endif
+  pthread_mutex_unlock(&rtp_lock);
+}
+
+/** @brief Transmit one packet to everyone who should get it
+ * @param p Packet
+ *
+ * Called from the sender thread.
+ */
+static void rtp_transmit(struct rtp_packet *p) {
+  struct iovec vec[2];
+  struct rtp_recipient *r;
+  int opus = 0;
+
+  vec[0].iov_base = (void *)&p->header;
+  vec[0].iov_len = sizeof p->header;
+  vec[1].iov_base = p->data;
+  vec[1].iov_len = p->nbytes;
+  /* Send stuff to explicitly registerd unicast addresses unconditionally.
+   * Each address family goes out as a single batch. */
+  pthread_mutex_lock(&rtp_lock);
+  for(r = rtp_recipient_list; r; r = r->next)
+    if(r->errors < RTP_RECIPIENT_MAX_ERRORS) {
+      if(r->codec == RTP_CODEC_OPUS)
+        opus = 1;
+      else
+        rtp_batch_add(r->sa.ss_family == AF_INET ? &rtp_batch4 : &rtp_batch6,
+                      r, vec);
     }
-    if(nvec > 2) {
-      uaudio_set(port, vec[2]);
-      xfree(vec[2]);
+  rtp_batch_send(&rtp_batch4, rtp_fd4);
+  rtp_batch_send(&rtp_batch6, rtp_fd6);
+  pthread_mutex_unlock(&rtp_lock);
+#if HAVE_OPUS_OPUS_H
+  /* The encoder only runs while someone wants its output */
+  if(opus)
+    rtp_opus_transmit(p);
+  else
+    rtp_opus_framer_reset(&rtp_opus_framer);
+#else
+  (void)opus;
+#endif
+  if(rtp_mode != RTP_REQUEST) {
+    if(rtp_gso_max > 1)
+      rtp_gso_add(p);
+    else {
+      int written_bytes;
+      do {
+        written_bytes = writev(rtp_fd, vec, 2);
+      } while(written_bytes < 0 && errno == EINTR);
+      rtp_master_sent(written_bytes);
+    }
+    if(rtp_fec)
+      rtp_fec_add(p);
+  }
+  /* TODO what can we sensibly do about short writes here?  Really that's just
+   * an error and we ought to be using smaller packets. */
+  ++rtp_packets_sent;
+  rtp_octets_sent += p->nbytes;
+  if(rtp_rtcp)
+    rtp_report(p);
+}
+
+/** @brief Sender thread
+ *
+ * Takes packets off @ref rtp_queue and transmits them, until @ref
+ * rtp_sender_quit is set and the queue is empty.
+ *
+ * If packets are being held back for UDP GSO then it doesn't wait for more
+ * than about two packets' worth of time before sending them anyway, so that
+ * an incomplete batch doesn't get stuck when play stops.
+ */
+static void *rtp_sender_fn(void attribute((unused)) *arg) {
+  size_t tail = __atomic_load_n(&rtp_queue_tail, __ATOMIC_RELAXED);
+  struct timespec deadline;
+  int timed_out;
+
+  realtime_thread("RTP sender");
+  for(;;) {
+    if(tail == __atomic_load_n(&rtp_queue_head, __ATOMIC_ACQUIRE)) {
+      /* Nothing to send; wait for rtp_play() */
+      timed_out = 0;
+      if(rtp_gso_count) {
+        const double packet_time = (double)(rtp_gso_segment
+                                            - sizeof (struct rtp_header))
+          / (uaudio_sample_size * uaudio_channels * uaudio_rate);
+        xgettime(CLOCK_REALTIME, &deadline);
+        deadline = double_to_ts(ts_to_double(deadline) + 2 * packet_time);
+      }
+      pthread_mutex_lock(&rtp_sender_lock);
+      __atomic_store_n(&rtp_sender_sleeping, 1, __ATOMIC_SEQ_CST);
+      while(tail == __atomic_load_n(&rtp_queue_head, __ATOMIC_SEQ_CST)
+            && !rtp_sender_quit && !timed_out) {
+        if(rtp_gso_count)
+          timed_out = pthread_cond_timedwait(&rtp_sender_cond,
+                                             &rtp_sender_lock,
+                                             &deadline) == ETIMEDOUT;
+        else
+          pthread_cond_wait(&rtp_sender_cond, &rtp_sender_lock);
+      }
+      __atomic_store_n(&rtp_sender_sleeping, 0, __ATOMIC_SEQ_CST);
+      pthread_mutex_unlock(&rtp_sender_lock);
+      if(tail == __atomic_load_n(&rtp_queue_head, __ATOMIC_ACQUIRE)) {
+        rtp_gso_flush();
+        if(!timed_out)
+          break;                        /* quitting */
+      }
+      continue;
     }
-    xfree(vec);
+    rtp_transmit(&rtp_queue[tail % RTP_QUEUE_SIZE]);
+    __atomic_store_n(&rtp_queue_tail, ++tail, __ATOMIC_RELEASE);
   }
+  return NULL;
 }
 
 static size_t rtp_play(void *buffer, size_t nsamples, unsigned flags) {
+  struct rtp_packet *p;
   struct rtp_header header;
-  struct iovec vec[2];
+  const size_t nbytes = nsamples * uaudio_sample_size;
 
 #if 0
   if(flags & (UAUDIO_PAUSE|UAUDIO_RESUME))
@@ -171,18 +799,29 @@ static size_t rtp_play(void *buffer, size_t nsamples, unsigned flags) {
   /* If we've come out of a pause, set the marker bit */
   if(flags & UAUDIO_RESUME)
     header.mpt |= 0x80;
+  /* Copy the samples into the next free queue slot, in network byte order.
+   * If we're paused we don't actually send a packet, we just pretend. */
+  const size_t head = rtp_queue_head;
+  if(flags & UAUDIO_PAUSED)
+    p = NULL;
+  else if(head - __atomic_load_n(&rtp_queue_tail, __ATOMIC_ACQUIRE)
+          >= RTP_QUEUE_SIZE) {
+    /* The sender thread has fallen behind; better to lose a packet than to
+     * disturb the timing */
+    if(!(rtp_dropped++ & 1023))
+      logring_error(0, "RTP: sender not keeping up, %lu packets dropped",
+                    rtp_dropped);
+    p = NULL;
+  } else {
+    p = &rtp_queue[head % RTP_QUEUE_SIZE];
 #if !WORDS_BIGENDIAN
-  /* Convert samples to network byte order */
-  uint16_t *u = buffer, *const limit = u + nsamples;
-  while(u < limit) {
-    *u = htons(*u);
-    ++u;
-  }
+    if(!rtp_network_order)
+      gain_swap_s16(p->data, buffer, nsamples);
+    else
 #endif
-  vec[0].iov_base = (void *)&header;
-  vec[0].iov_len = sizeof header;
-  vec[1].iov_base = buffer;
-  vec[1].iov_len = nsamples * uaudio_sample_size;
+      memcpy(p->data, buffer, nbytes);
+    p->nbytes = nbytes;
+  }
   const uint32_t timestamp = uaudio_schedule_sync();
   header.timestamp = htonl(rtp_base + (uint32_t)timestamp);
 
@@ -191,51 +830,25 @@ static size_t rtp_play(void *buffer, size_t nsamples, unsigned flags) {
 
   if(!(ntohs(header.seq) & 8191)
      && config->rtp_verbose)
-    disorder_info("RTP: seq %04"PRIx16" %08"PRIx32"+%08"PRIx32"=%08"PRIx32" ns %zu%s",
-                  ntohs(header.seq),
-                  rtp_base,
-                  timestamp,
-                  header.timestamp,
-                  nsamples,
-                  flags & UAUDIO_PAUSED ? " [paused]" : "");
-
-  /* If we're paused don't actually end a packet, we just pretend */
-  if(flags & UAUDIO_PAUSED) {
-    uaudio_schedule_sent(nsamples);
-    return nsamples;
-  }
-  /* Send stuff to explicitly registerd unicast addresses unconditionally */
-  struct rtp_recipient *r;
-  struct msghdr m;
-  memset(&m, 0, sizeof m);
-  m.msg_iov = vec;
-  m.msg_iovlen = 2;
-  pthread_mutex_lock(&rtp_lock);
-  for(r = rtp_recipient_list; r; r = r->next) {
-    m.msg_name = &r->sa;
-    m.msg_namelen = r->sa.ss_family == AF_INET ? 
-      sizeof(struct sockaddr_in) : sizeof (struct sockaddr_in6);
-    sendmsg(r->sa.ss_family == AF_INET ? rtp_fd4 : rtp_fd6,
-            &m, MSG_DONTWAIT|MSG_NOSIGNAL);
-    // TODO similar error handling to other case?
-  }
-  pthread_mutex_unlock(&rtp_lock);
-  if(rtp_mode != RTP_REQUEST) {
-    int written_bytes;
-    do {
-      written_bytes = writev(rtp_fd, vec, 2);
-    } while(written_bytes < 0 && errno == EINTR);
-    if(written_bytes < 0) {
-      disorder_error(errno, "error transmitting audio data");
-      ++rtp_errors;
-      if(rtp_errors == 10)
-        disorder_fatal(0, "too many audio transmission errors");
-      return 0;
-    } else
-      rtp_errors /= 2;                    /* gradual decay */
+    logring_info("RTP: seq %04"PRIx16" %08"PRIx32"+%08"PRIx32"=%08"PRIx32" ns %zu%s",
+                 ntohs(header.seq),
+                 rtp_base,
+                 timestamp,
+                 header.timestamp,
+                 nsamples,
+                 flags & UAUDIO_PAUSED ? " [paused]" : "");
+
+  if(p) {
+    /* Hand the packet over to the sender thread */
+    p->header = header;
+    __atomic_store_n(&rtp_queue_head, head + 1, __ATOMIC_SEQ_CST);
+    /* Only wake the sender if it is waiting; see @ref rtp_sender_sleeping */
+    if(__atomic_load_n(&rtp_sender_sleeping, __ATOMIC_SEQ_CST)) {
+      pthread_mutex_lock(&rtp_sender_lock);
+      pthread_cond_signal(&rtp_sender_cond);
+      pthread_mutex_unlock(&rtp_sender_lock);
+    }
   }
-  /* TODO what can we sensibly do about short writes here?  Really that's just
-   * an error and we ought to be using smaller packets. */
   uaudio_schedule_sent(nsamples);
   return nsamples;
 }
@@ -279,14 +892,15 @@ static void rtp_open(void) {
   else if(!strcmp(mode, "request")) rtp_mode = RTP_REQUEST;
   else rtp_mode = RTP_AUTO;
   /* Get the source and destination addresses (which might be missing) */
-  rtp_get_netconfig("rtp-destination-af",
-                    "rtp-destination",
-                    "rtp-destination-port",
-                    dst);
-  rtp_get_netconfig("rtp-source-af",
-                    "rtp-source",
-                    "rtp-source-port",
-                    src);
+  if(uaudio_get_netaddress("rtp-destination-af",
+                            "rtp-destination",
+                            "rtp-destination-port",
+                            dst)
+     || uaudio_get_netaddress("rtp-source-af",
+                              "rtp-source",
+                              "rtp-source-port",
+                              src))
+    disorder_fatal(0, "invalid RTP address");
   if(dst->af != -1) {
     if(netaddress_resolve(dst, 0, SOCK_DGRAM, &dres, &ndres))
       exit(-1);
@@ -445,7 +1059,65 @@ static void rtp_start(uaudio_callback *callback,
   if(config->rtp_verbose)
     disorder_info("RTP: id %08"PRIx32" base %08"PRIx32" initial seq %08"PRIx16,
                   rtp_id, rtp_base, rtp_sequence);
+  rtp_network_order = !strcmp(uaudio_get("rtp-sample-order", "native"),
+                              "network");
   rtp_open();
+  /* The sender thread does all network I/O, so that a slow socket or a
+   * change to the recipient list can't disturb the audio thread's timing */
+  for(int n = 0; n < RTP_QUEUE_SIZE; ++n)
+    rtp_queue[n].data = xmalloc_noptr(rtp_max_payload);
+  rtp_gso_max = rtp_mode == RTP_REQUEST ? 0 : atoi(uaudio_get("rtp-gso", "0"));
+#ifdef UDP_SEGMENT
+  /* The kernel limits both the number of segments and the total size */
+  if(rtp_gso_max > 64)
+    rtp_gso_max = 64;
+  if(rtp_gso_max > 65000 / rtp_max_payload)
+    rtp_gso_max = 65000 / rtp_max_payload;
+#else
+  if(rtp_gso_max > 1)
+    disorder_error(0, "RTP: UDP segmentation offload not supported");
+  rtp_gso_max = 0;
+#endif
+  if(rtp_gso_max > 1) {
+    rtp_gso_buffer = xmalloc_noptr(rtp_gso_max * rtp_max_payload);
+    rtp_gso_count = 0;
+    rtp_gso_bytes = 0;
+    if(config->rtp_verbose)
+      disorder_info("RTP: sending up to %d packets at once", rtp_gso_max);
+  }
+#if HAVE_OPUS_OPUS_H
+  int err;
+  rtp_opus_encoder = opus_encoder_create(RTP_OPUS_CODEC_RATE, uaudio_channels,
+                                         OPUS_APPLICATION_AUDIO, &err);
+  if(!rtp_opus_encoder)
+    disorder_fatal(0, "RTP: error creating Opus encoder: %s",
+                   opus_strerror(err));
+  opus_encoder_ctl(rtp_opus_encoder,
+                   OPUS_SET_BITRATE(atoi(uaudio_get("rtp-opus-bitrate",
+                                                    "96000"))));
+  rtp_opus_upsampler_init(&rtp_opus_upsampler, uaudio_channels);
+  rtp_opus_framer_init(&rtp_opus_framer, uaudio_channels);
+  rtp_opus_packets_sent = rtp_opus_octets_sent = 0;
+  gcry_create_nonce(&rtp_opus_sequence, sizeof rtp_opus_sequence);
+#endif
+  rtp_fec = rtp_mode == RTP_REQUEST ? 0 : atoi(uaudio_get("rtp-fec", "0"));
+  if(rtp_fec > RTP_FEC_MAX_GROUP)
+    rtp_fec = RTP_FEC_MAX_GROUP;
+  if(rtp_fec > 0) {
+    rtp_fec_payload = xmalloc_noptr(rtp_max_payload);
+    rtp_fec_count = 0;
+    gcry_create_nonce(&rtp_fec_sequence, sizeof rtp_fec_sequence);
+    if(config->rtp_verbose)
+      disorder_info("RTP: one FEC packet per %d packets", rtp_fec);
+  }
+  rtp_rtcp = !strcmp(uaudio_get("rtp-rtcp", "no"), "yes");
+  rtp_report_due = rtp_base;
+  rtp_packets_sent = rtp_octets_sent = 0;
+  rtp_queue_head = rtp_queue_tail = 0;
+  rtp_sender_quit = 0;
+  int e;
+  if((e = pthread_create(&rtp_sender, NULL, rtp_sender_fn, NULL)))
+    disorder_fatal(e, "pthread_create");
   uaudio_schedule_init();
   if(config->rtp_verbose)
     disorder_info("RTP: initialized schedule");
@@ -453,7 +1125,9 @@ static void rtp_start(uaudio_callback *callback,
                       userdata,
                       rtp_play,
                       256 / uaudio_sample_size,
-                      (rtp_max_payload - sizeof(struct rtp_header))
+                      (rtp_max_payload - sizeof(struct rtp_header)
+                       /* leave room for FEC packets' extra header */
+                       - (rtp_fec ? sizeof (struct rtp_fec_header) : 0))
                       / uaudio_sample_size,
                       0);
   if(config->rtp_verbose)
@@ -462,6 +1136,24 @@ static void rtp_start(uaudio_callback *callback,
 
 static void rtp_stop(void) {
   uaudio_thread_stop();
+  /* Let the sender thread drain the queue and exit */
+  pthread_mutex_lock(&rtp_sender_lock);
+  rtp_sender_quit = 1;
+  pthread_cond_signal(&rtp_sender_cond);
+  pthread_mutex_unlock(&rtp_sender_lock);
+  pthread_join(rtp_sender, NULL);
+  for(int n = 0; n < RTP_QUEUE_SIZE; ++n) {
+    xfree(rtp_queue[n].data);
+    rtp_queue[n].data = NULL;
+  }
+  xfree(rtp_gso_buffer);
+  rtp_gso_buffer = NULL;
+  xfree(rtp_fec_payload);
+  rtp_fec_payload = NULL;
+#if HAVE_OPUS_OPUS_H
+  opus_encoder_destroy(rtp_opus_encoder);
+  rtp_opus_encoder = NULL;
+#endif
   if(rtp_fd >= 0) { close(rtp_fd); rtp_fd = -1; }
   if(rtp_fd4 >= 0) { close(rtp_fd4); rtp_fd4 = -1; }
   if(rtp_fd6 >= 0) { close(rtp_fd6); rtp_fd6 = -1; }
@@ -471,40 +1163,64 @@ static void rtp_configure(void) {
   char buffer[64];
 
   uaudio_set("rtp-mode", config->rtp_mode);
-  rtp_set_netconfig("rtp-destination-af",
-                    "rtp-destination",
-                    "rtp-destination-port", &config->broadcast);
-  rtp_set_netconfig("rtp-source-af",
-                    "rtp-source",
-                    "rtp-source-port", &config->broadcast_from);
+  uaudio_set_netaddress("rtp-destination-af",
+                        "rtp-destination",
+                        "rtp-destination-port", &config->broadcast);
+  uaudio_set_netaddress("rtp-source-af",
+                        "rtp-source",
+                        "rtp-source-port", &config->broadcast_from);
   snprintf(buffer, sizeof buffer, "%ld", config->multicast_ttl);
   uaudio_set("multicast-ttl", buffer);
   uaudio_set("multicast-loop", config->multicast_loop ? "yes" : "no");
   snprintf(buffer, sizeof buffer, "%ld", config->rtp_max_payload);
   uaudio_set("rtp-max-payload", buffer);
   uaudio_set("rtp-mtu-discovery", config->rtp_mtu_discovery);
+  snprintf(buffer, sizeof buffer, "%ld", config->rtp_gso);
+  uaudio_set("rtp-gso", buffer);
+  snprintf(buffer, sizeof buffer, "%ld", config->rtp_opus_bitrate);
+  uaudio_set("rtp-opus-bitrate", buffer);
+  uaudio_set("rtp-rtcp", config->rtp_rtcp ? "yes" : "no");
+  snprintf(buffer, sizeof buffer, "%ld", config->rtp_fec);
+  uaudio_set("rtp-fec", buffer);
+  uaudio_set("rtp-sample-order",
+             config->sample_format.endian == ENDIAN_BIG ? "network" : "native");
   if(config->rtp_verbose)
     disorder_info("RTP: configured");
 }
 
 /** @brief Add an RTP recipient address
  * @param sa Pointer to recipient address
+ * @param codec Payload encoding (@ref RTP_CODEC_L16 or @ref RTP_CODEC_OPUS)
  * @return 0 on success, -1 on error
  */
-int rtp_add_recipient(const struct sockaddr_storage *sa) {
+int rtp_add_recipient(const struct sockaddr_storage *sa, int codec) {
   struct rtp_recipient *r;
   int rc;
+#if !HAVE_OPUS_OPUS_H
+  if(codec == RTP_CODEC_OPUS) {
+    disorder_error(0, "RTP: Opus not supported");
+    return -1;
+  }
+#endif
   pthread_mutex_lock(&rtp_lock);
   for(r = rtp_recipient_list;
       r && sockaddrcmp((struct sockaddr *)sa,
                        (struct sockaddr *)&r->sa);
       r = r->next)
     ;
-  if(r)
-    rc = -1;
-  else {
+  if(r) {
+    /* Asking again gives a client we gave up on another chance */
+    if(r->errors >= RTP_RECIPIENT_MAX_ERRORS) {
+      r->errors = 0;
+      r->codec = codec;
+      rc = 0;
+    } else
+      rc = -1;
+  } else {
     r = xmalloc(sizeof *r);
     memcpy(&r->sa, sa, sizeof *sa);
+    r->errors = 0;
+    r->codec = codec;
     r->next = rtp_recipient_list;
     rtp_recipient_list = r;
     rc = 0;
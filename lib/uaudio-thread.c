@@ -21,20 +21,26 @@
 
 #include <pthread.h>
 #include <unistd.h>
+#if HAVE_LINUX_FUTEX_H
+# include <linux/futex.h>
+# include <sys/syscall.h>
+#endif
 
 #include "uaudio.h"
 #include "log.h"
+#include "logring.h"
+#include "realtime.h"
 #include "mem.h"
 #include "syscalls.h"
 #include "timeval.h"
 
-/** @brief Number of buffers
+/** @brief Default number of buffers
  *
- * Must be at least 2 and should normally be at least 3.  We maintain multiple
- * buffers so that we can read new data into one while the previous is being
- * played.
+ * We maintain multiple buffers so that we can read new data into one while
+ * the previous is being played.  The number can be changed with the @c
+ * thread-buffers option; it must be at least 2.
  */
-#define UAUDIO_THREAD_BUFFERS 4
+#define UAUDIO_THREAD_BUFFERS 3
 
 /** @brief Buffer data structure */
 struct uaudio_buffer {
@@ -45,123 +51,192 @@ struct uaudio_buffer {
   size_t nsamples;
 };
 
-/** @brief Input buffers
- *
- * This is actually a ring buffer, managed by @ref uaudio_collect_buffer and
- * @ref uaudio_play_buffer.
- *
- * Initially both pointers are 0.  Whenever the pointers are equal, we
- * interpreted this as meaning that there is no data stored at all.  A
- * consequence of this is that maximal occupancy is when the collect point is
- * just before the play point, so at least one buffer is always empty (hence it
- * being good for @ref UAUDIO_THREAD_BUFFERS to be at least 3).
- */
-static struct uaudio_buffer uaudio_buffers[UAUDIO_THREAD_BUFFERS];
+/** @brief State for one pair of background threads */
+struct uaudio_thread {
+  /** @brief Input buffers
+   *
+   * This is a single-producer, single-consumer ring buffer.  The collection
+   * thread fills buffers and advances @ref collect_count; the play thread
+   * empties them and advances @ref play_count.  Each counter is only written
+   * by one thread, so no lock is needed.  The difference between them is the
+   * number of buffers holding data.
+   */
+  struct uaudio_buffer *buffers;
+
+  /** @brief Number of buffers */
+  unsigned nbuffers;
+
+  /** @brief Count of buffers collected */
+  unsigned collect_count;
+
+  /** @brief Count of buffers played */
+  unsigned play_count;
+
+  /** @brief Collection thread ID */
+  pthread_t collect_thread;
+
+  /** @brief Playing thread ID */
+  pthread_t play_thread;
+
+  /** @brief Flags */
+  unsigned flags;
 
-/** @brief Buffer to read into */
-static unsigned uaudio_collect_buffer;
+  uaudio_callback *collect_callback;
+  uaudio_playcallback *play_callback;
+  void *userdata;
+  int started;
 
-/** @brief Buffer to play from */
-static unsigned uaudio_play_buffer;
+  /** @brief Incremented whenever a waiting thread might have something to do */
+  int wakeups;
 
-/** @brief Collection thread ID */
-static pthread_t uaudio_collect_thread;
+  /** @brief Number of threads waiting on @ref wakeups */
+  int waiters;
 
-/** @brief Playing thread ID */
-static pthread_t uaudio_play_thread;
+  /** @brief Minimum number of samples per chunk */
+  size_t min;
 
-/** @brief Flags */
-static unsigned uaudio_thread_flags;
+  /** @brief Maximum number of samples per chunk */
+  size_t max;
 
-static uaudio_callback *uaudio_thread_collect_callback;
-static uaudio_playcallback *uaudio_thread_play_callback;
-static void *uaudio_thread_userdata;
-static int uaudio_thread_started;
-static int uaudio_thread_collecting;
+  /** @brief Set when activated, clear when paused */
+  int activated;
+
+  /** @brief When playing started */
+  struct timespec base;
+
+  /** @brief Frames played since @ref base */
+  int64_t frames_supplied;
+
+  /** @brief Buffers played since the last report */
+  unsigned long stats_played;
+
+  /** @brief Sum of buffers in use when each was played */
+  unsigned long stats_occupancy;
+
+  /** @brief Times the play thread ran out of data */
+  unsigned long stats_underruns;
+};
+
+/** @brief All thread states
+ *
+ * Normally only the first is used.  @ref lib/uaudio-multi.c uses one for
+ * each of its outputs.
+ */
+static struct uaudio_thread uaudio_threads[UAUDIO_THREAD_INSTANCES];
+
+/** @brief Thread state affected by uaudio_thread_start() etc. */
+static struct uaudio_thread *uaudio_thread_current = &uaudio_threads[0];
+
+#if !HAVE_LINUX_FUTEX_H
 static pthread_mutex_t uaudio_thread_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t uaudio_thread_cond = PTHREAD_COND_INITIALIZER;
+#endif
 
-/** @brief Minimum number of samples per chunk */
-static size_t uaudio_thread_min;
+/** @brief Return number of buffers currently in use */
+static unsigned uaudio_buffers_used(struct uaudio_thread *t) {
+  return __atomic_load_n(&t->collect_count, __ATOMIC_ACQUIRE)
+    - __atomic_load_n(&t->play_count, __ATOMIC_ACQUIRE);
+}
 
-/** @brief Maximum number of samples per chunk */
-static size_t uaudio_thread_max;
+/** @brief Return the current wakeup count
+ *
+ * This must be read before testing the condition to wait for; see @ref
+ * uaudio_thread_wait().
+ */
+static int uaudio_thread_seen(struct uaudio_thread *t) {
+  return __atomic_load_n(&t->wakeups, __ATOMIC_SEQ_CST);
+}
 
-/** @brief Set when activated, clear when paused */
-static int uaudio_thread_activated;
+/** @brief Wait until @ref uaudio_thread_wake() is called
+ * @param t Thread state
+ * @param seen Value returned by an earlier uaudio_thread_seen()
+ *
+ * Returns at once if there has been a wakeup since @p seen was read, so a
+ * wakeup between testing for work and calling this function is not lost.
+ */
+static void uaudio_thread_wait(struct uaudio_thread *t, int seen) {
+  __atomic_add_fetch(&t->waiters, 1, __ATOMIC_SEQ_CST);
+#if HAVE_LINUX_FUTEX_H
+  syscall(SYS_futex, &t->wakeups, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+#else
+  pthread_mutex_lock(&uaudio_thread_lock);
+  while(uaudio_thread_seen(t) == seen)
+    pthread_cond_wait(&uaudio_thread_cond, &uaudio_thread_lock);
+  pthread_mutex_unlock(&uaudio_thread_lock);
+#endif
+  __atomic_sub_fetch(&t->waiters, 1, __ATOMIC_SEQ_CST);
+}
 
-/** @brief Return number of buffers currently in use */
-static int uaudio_buffers_used(void) {
-  return (uaudio_collect_buffer - uaudio_play_buffer) % UAUDIO_THREAD_BUFFERS;
+/** @brief Wake up any thread in uaudio_thread_wait()
+ * @param t Thread state
+ */
+static void uaudio_thread_wake(struct uaudio_thread *t) {
+  __atomic_add_fetch(&t->wakeups, 1, __ATOMIC_SEQ_CST);
+  if(!__atomic_load_n(&t->waiters, __ATOMIC_SEQ_CST))
+    return;
+#if HAVE_LINUX_FUTEX_H
+  syscall(SYS_futex, &t->wakeups, FUTEX_WAKE_PRIVATE, INT_MAX,
+          NULL, NULL, 0);
+#else
+  pthread_mutex_lock(&uaudio_thread_lock);
+  pthread_cond_broadcast(&uaudio_thread_cond);
+  pthread_mutex_unlock(&uaudio_thread_lock);
+#endif
 }
 
 /** @brief Background thread for audio collection
+ * @param arg Thread state
  *
- * Collects data while activated and communicates its status via @ref
- * uaudio_thread_collecting.
+ * Collects data while activated.
  */
-static void *uaudio_collect_thread_fn(void attribute((unused)) *arg) {
-  pthread_mutex_lock(&uaudio_thread_lock);
-  while(uaudio_thread_started) {
-    /* Wait until we're activatd */
-    if(!uaudio_thread_activated) {
-      pthread_cond_wait(&uaudio_thread_cond, &uaudio_thread_lock);
+static void *uaudio_collect_thread_fn(void *arg) {
+  struct uaudio_thread *const t = arg;
+  int seen;
+
+  realtime_thread("audio collect");
+  while(__atomic_load_n(&t->started, __ATOMIC_ACQUIRE)) {
+    seen = uaudio_thread_seen(t);
+    /* Wait until we're activated and at least one buffer is available */
+    if(!__atomic_load_n(&t->activated, __ATOMIC_ACQUIRE)
+       || uaudio_buffers_used(t) >= t->nbuffers) {
+      uaudio_thread_wait(t, seen);
       continue;
     }
-    /* We are definitely active now */
-    uaudio_thread_collecting = 1;
-    pthread_cond_broadcast(&uaudio_thread_cond);
-    while(uaudio_thread_activated) {
-      if(uaudio_buffers_used() < UAUDIO_THREAD_BUFFERS - 1) {
-        /* At least one buffer is available.  We release the lock while
-         * collecting data so that other already-filled buffers can be played
-         * without delay.  */
-        struct uaudio_buffer *const b = &uaudio_buffers[uaudio_collect_buffer];
-        pthread_mutex_unlock(&uaudio_thread_lock);
-        //fprintf(stderr, "C%d.", uaudio_collect_buffer);
-        
-        /* Keep on trying until we get the minimum required amount of data */
-        b->nsamples = 0;
-        if(uaudio_thread_activated) {
-          while(b->nsamples < uaudio_thread_min) {
-            b->nsamples += uaudio_thread_collect_callback
-              ((char *)b->samples
-               + b->nsamples * uaudio_sample_size,
-               uaudio_thread_max - b->nsamples,
-               uaudio_thread_userdata);
-          }
-        }
-        pthread_mutex_lock(&uaudio_thread_lock);
-        /* Advance to next buffer */
-        uaudio_collect_buffer = (1 + uaudio_collect_buffer) % UAUDIO_THREAD_BUFFERS;
-        /* Awaken player */
-        pthread_cond_broadcast(&uaudio_thread_cond);
-      } else
-        /* No space, wait for player */
-        pthread_cond_wait(&uaudio_thread_cond, &uaudio_thread_lock);
+    struct uaudio_buffer *const b = &t->buffers[t->collect_count % t->nbuffers];
+    //fprintf(stderr, "C%u.", t->collect_count % t->nbuffers);
+
+    /* Keep on trying until we get the minimum required amount of data */
+    b->nsamples = 0;
+    while(b->nsamples < t->min) {
+      b->nsamples += t->collect_callback((char *)b->samples
+                                         + b->nsamples * uaudio_sample_size,
+                                         t->max - b->nsamples,
+                                         t->userdata);
     }
-    uaudio_thread_collecting = 0;
-    pthread_cond_broadcast(&uaudio_thread_cond);
+    /* Advance to next buffer and awaken player */
+    __atomic_store_n(&t->collect_count, t->collect_count + 1,
+                     __ATOMIC_RELEASE);
+    uaudio_thread_wake(t);
   }
-  pthread_mutex_unlock(&uaudio_thread_lock);
   return NULL;
 }
 
-static size_t uaudio_play_samples(void *buffer, size_t samples, unsigned flags) {
-  static struct timespec base;
-  static int64_t frames_supplied;
+static size_t uaudio_play_samples(struct uaudio_thread *t,
+                                  void *buffer, size_t samples,
+                                  unsigned flags) {
   struct timespec now;
   struct timespec delay_ts;
   double target, delay;
 
-  if(!base.tv_sec)
-    xgettime(CLOCK_MONOTONIC, &base);
-  samples = uaudio_thread_play_callback(buffer, samples, flags);
-  frames_supplied += samples / uaudio_channels;
+  if(!t->base.tv_sec)
+    xgettime(CLOCK_MONOTONIC, &t->base);
+  samples = t->play_callback(buffer, samples, flags);
+  t->frames_supplied += samples / uaudio_channels;
   /* Set target to the approximate point at which we run out of buffered audio.
    * If no buffer size has been specified, use 1/16th of a second. */
-  target = (frames_supplied - (uaudio_buffer ? uaudio_buffer : uaudio_rate / 16))
-    / (double)uaudio_rate + ts_to_double(base);
+  target = (t->frames_supplied
+            - (uaudio_buffer ? uaudio_buffer : uaudio_rate / 16))
+    / (double)uaudio_rate + ts_to_double(t->base);
   for(;;) {
     xgettime(CLOCK_MONOTONIC, &now);
     delay = target - ts_to_double(now);
@@ -172,9 +247,9 @@ static size_t uaudio_play_samples(void *buffer, size_t samples, unsigned flags)
     //putc('!', stderr);
     /*
     fprintf(stderr, "frames supplied %ld (%lds) base %f target %f now %f want delay %g\n", 
-            frames_supplied,
-            frames_supplied / uaudio_rate,
-            ts_to_double(base),
+            t->frames_supplied,
+            t->frames_supplied / uaudio_rate,
+            ts_to_double(t->base),
             target, 
             ts_to_double(now),
             delay);
@@ -186,68 +261,132 @@ static size_t uaudio_play_samples(void *buffer, size_t samples, unsigned flags)
 }
 
 /** @brief Background thread for audio playing 
+ * @param arg Thread state
  *
  * This thread plays data as long as there is something to play.  So the
  * buffers will drain to empty before deactivation completes.
  */
-static void *uaudio_play_thread_fn(void attribute((unused)) *arg) {
-  int resync = 1;
-  unsigned last_flags = 0;
-  unsigned char zero[uaudio_thread_max * uaudio_sample_size];
+static void *uaudio_play_thread_fn(void *arg) {
+  struct uaudio_thread *const t = arg;
+  int resync = 1, seen;
+  unsigned last_flags = 0, used;
+  unsigned char zero[t->max * uaudio_sample_size];
   memset(zero, 0, sizeof zero);
+  realtime_thread("audio play");
 
-  while(uaudio_thread_started) {
+  while(__atomic_load_n(&t->started, __ATOMIC_ACQUIRE)) {
+    seen = uaudio_thread_seen(t);
     // If we're paused then just play silence
-    if(!uaudio_thread_activated) {
-      pthread_mutex_unlock(&uaudio_thread_lock);
+    if(!__atomic_load_n(&t->activated, __ATOMIC_ACQUIRE)) {
       unsigned flags = UAUDIO_PAUSED;
       if(last_flags & UAUDIO_PLAYING)
         flags |= UAUDIO_PAUSE;
-      uaudio_play_samples(zero, uaudio_thread_max, last_flags = flags);
+      uaudio_play_samples(t, zero, t->max, last_flags = flags);
       /* We expect the play callback to block for a reasonable period */
-      pthread_mutex_lock(&uaudio_thread_lock);
       continue;
     }
-    const int used = uaudio_buffers_used();
+    used = uaudio_buffers_used(t);
     int go;
 
     if(resync)
-      go = (used == UAUDIO_THREAD_BUFFERS - 1);
+      go = (used == t->nbuffers);
     else
       go = (used > 0);
     if(go) {
-      /* At least one buffer is filled.  We release the lock while playing so
-       * that more collection can go on. */
-      struct uaudio_buffer *const b = &uaudio_buffers[uaudio_play_buffer];
-      pthread_mutex_unlock(&uaudio_thread_lock);
-      //fprintf(stderr, "P%d.", uaudio_play_buffer);
+      /* At least one buffer is filled. */
+      struct uaudio_buffer *const b = &t->buffers[t->play_count % t->nbuffers];
+      //fprintf(stderr, "P%u.", t->play_count % t->nbuffers);
       size_t played = 0;
       while(played < b->nsamples) {
         unsigned flags = UAUDIO_PLAYING;
         if(last_flags & UAUDIO_PAUSED)
           flags |= UAUDIO_RESUME;
-        played += uaudio_play_samples((char *)b->samples
+        played += uaudio_play_samples(t,
+                                      (char *)b->samples
                                       + played * uaudio_sample_size,
                                       b->nsamples - played,
                                       last_flags = flags);
       }
-      pthread_mutex_lock(&uaudio_thread_lock);
-      /* Move to next buffer */
-      uaudio_play_buffer = (1 + uaudio_play_buffer) % UAUDIO_THREAD_BUFFERS;
-      /* Awaken collector */
-      pthread_cond_broadcast(&uaudio_thread_cond);
+      /* Move to next buffer and awaken collector */
+      __atomic_store_n(&t->play_count, t->play_count + 1, __ATOMIC_RELEASE);
+      uaudio_thread_wake(t);
+      __atomic_add_fetch(&t->stats_played, 1, __ATOMIC_RELAXED);
+      __atomic_add_fetch(&t->stats_occupancy, used, __ATOMIC_RELAXED);
       resync = 0;
     } else {
       /* Insufficient data to play, wait for collector */
-      pthread_cond_wait(&uaudio_thread_cond, &uaudio_thread_lock);
+      if(!resync) {
+        __atomic_add_fetch(&t->stats_underruns, 1, __ATOMIC_RELAXED);
+        uaudio_stats_underrun();
+      }
+      uaudio_thread_wait(t, seen);
       /* (Still) re-synchronizing */
       resync = 1;
     }
   }
-  pthread_mutex_unlock(&uaudio_thread_lock);
   return NULL;
 }
 
+/** @brief Report buffer statistics since the last report
+ * @param t Thread state
+ */
+static void uaudio_thread_report(struct uaudio_thread *t) {
+  const unsigned long played
+    = __atomic_exchange_n(&t->stats_played, 0, __ATOMIC_RELAXED);
+  const unsigned long occupancy
+    = __atomic_exchange_n(&t->stats_occupancy, 0, __ATOMIC_RELAXED);
+  const unsigned long underruns
+    = __atomic_exchange_n(&t->stats_underruns, 0, __ATOMIC_RELAXED);
+  unsigned long mean;
+
+  if(!played)
+    return;
+  mean = occupancy * 100 / played;
+  if(t == uaudio_threads)
+    disorder_info("audio buffers: %lu played, mean occupancy %lu.%02lu/%u,"
+                  " %lu underruns",
+                  played, mean / 100, mean % 100, t->nbuffers, underruns);
+  else
+    disorder_info("audio buffers %d: %lu played, mean occupancy %lu.%02lu/%u,"
+                  " %lu underruns", (int)(t - uaudio_threads),
+                  played, mean / 100, mean % 100, t->nbuffers, underruns);
+}
+
+/** @brief Get a chunk size option
+ * @param name Option name
+ * @param value Value chosen by backend, in samples
+ * @param lo Smallest acceptable value, in samples
+ * @param hi Largest acceptable value, in samples
+ * @return Chunk size in samples
+ */
+static size_t uaudio_thread_chunk(const char *name, size_t value,
+                                  size_t lo, size_t hi) {
+  char *s = uaudio_get(name, NULL);
+
+  if(s) {
+    value = strtoul(s, NULL, 10) / uaudio_sample_size;
+    xfree(s);
+    if(value < lo)
+      value = lo;
+    if(value > hi)
+      value = hi;
+  }
+  return value;
+}
+
+/** @brief Choose which thread state later calls affect
+ * @param n Index, from 0 to @ref UAUDIO_THREAD_INSTANCES - 1
+ *
+ * uaudio_thread_start(), uaudio_thread_stop(), uaudio_thread_activate() and
+ * uaudio_thread_deactivate() act on the chosen state.  The default is 0.
+ * This allows several backends to run at once, each with its own threads.
+ */
+void uaudio_thread_select(int n) {
+  if(n < 0 || n >= UAUDIO_THREAD_INSTANCES)
+    disorder_fatal(0, "audio thread %d out of range", n);
+  uaudio_thread_current = &uaudio_threads[n];
+}
+
 /** @brief Create background threads for audio processing 
  * @param callback Callback to collect audio data
  * @param userdata Passed to @p callback
@@ -260,6 +399,10 @@ static void *uaudio_play_thread_fn(void attribute((unused)) *arg) {
  * to gather at least @p min samples.  Equally @p playcallback may be called
  * repeatedly in quick succession to play however much was received in a single
  * chunk.
+ *
+ * The @c thread-buffers option sets the number of buffers.  The @c
+ * thread-min-bytes and @c thread-max-bytes options narrow the chunk size
+ * bounds; they cannot widen them beyond @p min and @p max.
  */
 void uaudio_thread_start(uaudio_callback *callback,
 			 void *userdata,
@@ -267,60 +410,80 @@ void uaudio_thread_start(uaudio_callback *callback,
 			 size_t min,
                          size_t max,
                          unsigned flags) {
+  struct uaudio_thread *const t = uaudio_thread_current;
   int e;
-  uaudio_thread_collect_callback = callback;
-  uaudio_thread_userdata = userdata;
-  uaudio_thread_play_callback = playcallback;
-  uaudio_thread_min = min;
-  uaudio_thread_max = max;
-  uaudio_thread_flags = flags;
-  uaudio_thread_started = 1;
-  uaudio_thread_activated = 0;
-  for(int n = 0; n < UAUDIO_THREAD_BUFFERS; ++n)
-    uaudio_buffers[n].samples = xcalloc_noptr(uaudio_thread_max,
-                                              uaudio_sample_size);
-  uaudio_collect_buffer = uaudio_play_buffer = 0;
-  if((e = pthread_create(&uaudio_collect_thread,
+  char *s;
+  logring_start();
+  t->collect_callback = callback;
+  t->userdata = userdata;
+  t->play_callback = playcallback;
+  t->max = uaudio_thread_chunk("thread-max-bytes", max, min, max);
+  t->min = uaudio_thread_chunk("thread-min-bytes", min, min, t->max);
+  t->flags = flags;
+  t->started = 1;
+  t->activated = 0;
+  t->nbuffers = UAUDIO_THREAD_BUFFERS;
+  if((s = uaudio_get("thread-buffers", NULL))) {
+    t->nbuffers = atoi(s);
+    xfree(s);
+    if(t->nbuffers < 2)
+      disorder_fatal(0, "thread-buffers must be at least 2");
+  }
+  t->buffers = xcalloc(t->nbuffers, sizeof *t->buffers);
+  for(unsigned n = 0; n < t->nbuffers; ++n)
+    if(!(t->buffers[n].samples = realtime_alloc(t->max * uaudio_sample_size)))
+      t->buffers[n].samples = xcalloc_noptr(t->max, uaudio_sample_size);
+  t->collect_count = t->play_count = 0;
+  t->base.tv_sec = 0;
+  t->frames_supplied = 0;
+  if((e = pthread_create(&t->collect_thread,
                          NULL,
                          uaudio_collect_thread_fn,
-                         NULL)))
+                         t)))
     disorder_fatal(e, "pthread_create");
-  if((e = pthread_create(&uaudio_play_thread,
+  if((e = pthread_create(&t->play_thread,
                          NULL,
                          uaudio_play_thread_fn,
-                         NULL)))
+                         t)))
     disorder_fatal(e, "pthread_create");
 }
 
 /** @brief Shut down background threads for audio processing */
 void uaudio_thread_stop(void) {
+  struct uaudio_thread *const t = uaudio_thread_current;
   void *result;
 
-  pthread_mutex_lock(&uaudio_thread_lock);
-  uaudio_thread_activated = 0;
-  uaudio_thread_started = 0;
-  pthread_cond_broadcast(&uaudio_thread_cond);
-  pthread_mutex_unlock(&uaudio_thread_lock);
-  pthread_join(uaudio_collect_thread, &result);
-  pthread_join(uaudio_play_thread, &result);
-  for(int n = 0; n < UAUDIO_THREAD_BUFFERS; ++n)
-    xfree(uaudio_buffers[n].samples);
+  __atomic_store_n(&t->activated, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&t->started, 0, __ATOMIC_RELEASE);
+  uaudio_thread_wake(t);
+  pthread_join(t->collect_thread, &result);
+  pthread_join(t->play_thread, &result);
+  uaudio_thread_report(t);
+  for(unsigned n = 0; n < t->nbuffers; ++n)
+    if(!realtime_free(t->buffers[n].samples))
+      xfree(t->buffers[n].samples);
+  xfree(t->buffers);
+  t->buffers = NULL;
 }
 
 /** @brief Activate audio output */
 void uaudio_thread_activate(void) {
-  pthread_mutex_lock(&uaudio_thread_lock);
-  uaudio_thread_activated = 1;
-  pthread_cond_broadcast(&uaudio_thread_cond);
-  pthread_mutex_unlock(&uaudio_thread_lock);
+  struct uaudio_thread *const t = uaudio_thread_current;
+
+  __atomic_store_n(&t->activated, 1, __ATOMIC_RELEASE);
+  uaudio_thread_wake(t);
 }
 
-/** @brief Deactivate audio output */
+/** @brief Deactivate audio output
+ *
+ * Also reports buffer statistics for the period of activity just ended.
+ */
 void uaudio_thread_deactivate(void) {
-  pthread_mutex_lock(&uaudio_thread_lock);
-  uaudio_thread_activated = 0; 
-  pthread_cond_broadcast(&uaudio_thread_cond);
-  pthread_mutex_unlock(&uaudio_thread_lock);
+  struct uaudio_thread *const t = uaudio_thread_current;
+
+  __atomic_store_n(&t->activated, 0, __ATOMIC_RELEASE);
+  uaudio_thread_wake(t);
+  uaudio_thread_report(t);
 }
 
 /*
@@ -25,6 +25,8 @@
 #include "hash.h"
 #include "mem.h"
 #include "log.h"
+#include "addr.h"
+#include "vector.h"
 
 /** @brief Options for chosen uaudio API */
 static hash *uaudio_options;
@@ -75,6 +77,100 @@ char *uaudio_get(const char *name, const char *default_value) {
   return xstrdup(*valuep);
 }
 
+/** @brief Forget all uaudio options */
+void uaudio_clear(void) {
+  if(uaudio_options)
+    uaudio_options = hash_new(sizeof(char *));
+}
+
+/** @brief Compare two option names */
+static int uaudio_compare(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/** @brief Describe all uaudio options
+ * @return Option names and values, one per line, in name order
+ *
+ * Two sets of options are the same if their descriptions are the same.
+ */
+char *uaudio_describe(void) {
+  struct dynstr d[1];
+  char **keys, **valuep;
+  size_t n;
+
+  dynstr_init(d);
+  if(uaudio_options) {
+    keys = hash_keys(uaudio_options);
+    qsort(keys, hash_count(uaudio_options), sizeof *keys, uaudio_compare);
+    for(n = 0; keys[n]; ++n) {
+      valuep = hash_find(uaudio_options, keys[n]);
+      dynstr_append_string(d, keys[n]);
+      dynstr_append(d, '=');
+      dynstr_append_string(d, *valuep);
+      dynstr_append(d, '\n');
+    }
+  }
+  dynstr_terminate(d);
+  return d->vec;
+}
+
+/** @brief Get a network address from three uaudio options
+ * @param af Name of address family option
+ * @param addr Name of host option
+ * @param port Name of port option
+ * @param na Where to store address (af is -1 if not set)
+ * @return 0 on success, non-0 if the address is invalid
+ */
+int uaudio_get_netaddress(const char *af,
+                          const char *addr,
+                          const char *port,
+                          struct netaddress *na) {
+  char *vec[3];
+
+  vec[0] = uaudio_get(af, NULL);
+  vec[1] = uaudio_get(addr, NULL);
+  vec[2] = uaudio_get(port, NULL);
+  if(!*vec) {
+    na->af = -1;
+    return 0;
+  }
+  return netaddress_parse(na, 3, vec);
+}
+
+/** @brief Set three uaudio options from a network address
+ * @param af Name of address family option
+ * @param addr Name of host option
+ * @param port Name of port option
+ * @param na Address (af is -1 if not set)
+ */
+void uaudio_set_netaddress(const char *af,
+                           const char *addr,
+                           const char *port,
+                           const struct netaddress *na) {
+  uaudio_set(af, NULL);
+  uaudio_set(addr, NULL);
+  uaudio_set(port, NULL);
+  if(na->af != -1) {
+    int nvec;
+    char **vec;
+
+    netaddress_format(na, &nvec, &vec);
+    if(nvec > 0) {
+      uaudio_set(af, vec[0]);
+      xfree(vec[0]);
+    }
+    if(nvec > 1) {
+      uaudio_set(addr, vec[1]);
+      xfree(vec[1]);
+    }
+    if(nvec > 2) {
+      uaudio_set(port, vec[2]);
+      xfree(vec[2]);
+    }
+    xfree(vec);
+  }
+}
+
 /** @brief Set sample format
  * @param rate Sample rate in KHz
  * @param channels Number of channels (i.e. 2 for stereo)
@@ -100,6 +196,75 @@ void uaudio_set_format(int rate, int channels, int bits, int signed_) {
   uaudio_sample_size = bits / CHAR_BIT;
 }
 
+/** @brief Playback statistics */
+static struct uaudio_stats uaudio_stats;
+
+/** @brief Upper bounds of @ref uaudio_stats::callback_buckets in microseconds
+ */
+const unsigned uaudio_stats_bounds[UAUDIO_STATS_BUCKETS - 1] = {
+  10, 50, 100, 500, 1000, 5000, 10000
+};
+
+/** @brief Record that the sound device ran out of data
+ *
+ * Called by backends, from any thread.
+ */
+void uaudio_stats_xrun(void) {
+  __atomic_add_fetch(&uaudio_stats.xruns, 1, __ATOMIC_RELAXED);
+}
+
+/** @brief Record that the play thread ran out of data */
+void uaudio_stats_underrun(void) {
+  __atomic_add_fetch(&uaudio_stats.underruns, 1, __ATOMIC_RELAXED);
+}
+
+/** @brief Record that silence was played in place of real sound
+ * @param samples Number of samples of silence
+ */
+void uaudio_stats_silence(size_t samples) {
+  __atomic_add_fetch(&uaudio_stats.silence, samples, __ATOMIC_RELAXED);
+}
+
+/** @brief Record how long a call to the @ref uaudio_callback took
+ * @param us Duration in microseconds
+ */
+void uaudio_stats_callback(uint64_t us) {
+  int b;
+
+  for(b = 0; b < UAUDIO_STATS_BUCKETS - 1 && us > uaudio_stats_bounds[b]; ++b)
+    ;
+  __atomic_add_fetch(&uaudio_stats.callback_buckets[b], 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&uaudio_stats.callback_us, us, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&uaudio_stats.callbacks, 1, __ATOMIC_RELAXED);
+}
+
+/** @brief Record the sound device's output latency
+ * @param frames Frames queued in front of the next one written
+ */
+void uaudio_stats_latency(uint64_t frames) {
+  if(uaudio_rate)
+    __atomic_store_n(&uaudio_stats.latency_us,
+                     frames * 1000000 / uaudio_rate, __ATOMIC_RELAXED);
+}
+
+/** @brief Get a copy of the playback statistics
+ * @param s Where to store statistics
+ */
+void uaudio_stats_get(struct uaudio_stats *s) {
+  int b;
+
+  s->xruns = __atomic_load_n(&uaudio_stats.xruns, __ATOMIC_RELAXED);
+  s->underruns = __atomic_load_n(&uaudio_stats.underruns, __ATOMIC_RELAXED);
+  s->silence = __atomic_load_n(&uaudio_stats.silence, __ATOMIC_RELAXED);
+  s->callbacks = __atomic_load_n(&uaudio_stats.callbacks, __ATOMIC_RELAXED);
+  s->callback_us = __atomic_load_n(&uaudio_stats.callback_us,
+                                   __ATOMIC_RELAXED);
+  for(b = 0; b < UAUDIO_STATS_BUCKETS; ++b)
+    s->callback_buckets[b] = __atomic_load_n(&uaudio_stats.callback_buckets[b],
+                                             __ATOMIC_RELAXED);
+  s->latency_us = __atomic_load_n(&uaudio_stats.latency_us, __ATOMIC_RELAXED);
+}
+
 /** @brief Choose the default audio API by context
  * @param apis Table of APIs or a null pointer
  * @param context @ref UAUDIO_API_SERVER or @ref UAUDIO_API_CLIENT
@@ -165,6 +165,13 @@ struct uaudio {
 void uaudio_set_format(int rate, int channels, int samplesize, int signed_);
 void uaudio_set(const char *name, const char *value);
 char *uaudio_get(const char *name, const char *default_value);
+void uaudio_clear(void);
+char *uaudio_describe(void);
+struct netaddress;
+int uaudio_get_netaddress(const char *af, const char *addr, const char *port,
+                          struct netaddress *na);
+void uaudio_set_netaddress(const char *af, const char *addr, const char *port,
+                           const struct netaddress *na);
 void uaudio_thread_start(uaudio_callback *callback,
 			 void *userdata,
 			 uaudio_playcallback *playcallback,
@@ -173,6 +180,11 @@ void uaudio_thread_start(uaudio_callback *callback,
                          unsigned flags);
 
 void uaudio_thread_stop(void);
+void uaudio_thread_select(int n);
+
+/** @brief Number of separate uaudio_thread_start() states */
+#define UAUDIO_THREAD_INSTANCES 4
+
 void uaudio_thread_activate(void);
 void uaudio_thread_deactivate(void);
 uint32_t uaudio_schedule_sync(void);
@@ -182,7 +194,57 @@ const struct uaudio *uaudio_find(const char *name);
 const struct uaudio *uaudio_default(const struct uaudio *const *apis,
                                     unsigned context);
 
-int rtp_add_recipient(const struct sockaddr_storage *sa);
+/** @brief Uncompressed RTP payload (L16) */
+#define RTP_CODEC_L16 0
+
+/** @brief Opus-compressed RTP payload */
+#define RTP_CODEC_OPUS 1
+
+/** @brief Number of buckets in @ref uaudio_stats::callback_buckets */
+#define UAUDIO_STATS_BUCKETS 8
+
+/** @brief Playback statistics
+ *
+ * Shared by all backends.  Everything except @ref latency_us counts up from
+ * when the process started.
+ */
+struct uaudio_stats {
+  /** @brief Number of times the sound device ran out of data */
+  uint64_t xruns;
+
+  /** @brief Number of times @ref lib/uaudio-thread.c ran out of data */
+  uint64_t underruns;
+
+  /** @brief Samples of silence inserted because no sound was available */
+  uint64_t silence;
+
+  /** @brief Number of calls to the @ref uaudio_callback */
+  uint64_t callbacks;
+
+  /** @brief Total time spent in the @ref uaudio_callback, in microseconds */
+  uint64_t callback_us;
+
+  /** @brief Callback durations
+   *
+   * Bucket @c n counts calls that took no more than @c
+   * uaudio_stats_bounds[n] microseconds but more than the bucket below.  The
+   * last bucket counts everything slower.
+   */
+  uint64_t callback_buckets[UAUDIO_STATS_BUCKETS];
+
+  /** @brief Latest estimate of output latency in microseconds, or 0 */
+  uint64_t latency_us;
+};
+
+extern const unsigned uaudio_stats_bounds[UAUDIO_STATS_BUCKETS - 1];
+void uaudio_stats_xrun(void);
+void uaudio_stats_underrun(void);
+void uaudio_stats_silence(size_t samples);
+void uaudio_stats_callback(uint64_t us);
+void uaudio_stats_latency(uint64_t frames);
+void uaudio_stats_get(struct uaudio_stats *s);
+
+int rtp_add_recipient(const struct sockaddr_storage *sa, int codec);
 int rtp_remove_recipient(const struct sockaddr_storage *sa);
 
 extern uint64_t uaudio_schedule_timestamp;
@@ -206,8 +268,15 @@ extern const struct uaudio uaudio_pulseaudio;
 
 extern const struct uaudio uaudio_rtp;
 
+#if HAVE_OPUS_OPUS_H
+extern const struct uaudio uaudio_http;
+#endif
+
 extern const struct uaudio uaudio_command;
 
+extern const struct uaudio uaudio_multi;
+int uaudio_multi_uses(const struct uaudio *api);
+
 extern const struct uaudio *const uaudio_apis[];
 
 #endif /* UAUDIO_H */
@@ -47,50 +47,79 @@
 /** @defgroup utf32props Unicode Code Point Properties */
 /*@{*/
 
-static const struct unidata *utf32__unidata_hard(uint32_t c);
+static uint32_t utf32__index_hard(uint32_t c);
 
-/** @brief Find definition of code point @p c
+/** @brief Find the table index of code point @p c
  * @param c Code point
- * @return Pointer to @ref unidata structure for @p c
+ * @return Index into the tables in @ref lib/unidata.c
  *
- * @p c can be any 32-bit value, a sensible value will be returned regardless.
- * The returned pointer is NOT guaranteed to be unique to @p c.
+ * The tables leave out the large unassigned parts of the code space, so
+ * code points are mapped into a smaller range first.  @p c can be any 32-bit
+ * value, a sensible value will be returned regardless.  The returned index is
+ * NOT guaranteed to be unique to @p c.
  */
-static inline const struct unidata *utf32__unidata(uint32_t c) {
+static inline uint32_t utf32__index(uint32_t c) {
   /* The bottom half of the table contains almost everything of interest
    * and we can just return the right thing straight away */
   if(c < UNICODE_BREAK_START)
-    return &unidata[c / UNICODE_MODULUS][c % UNICODE_MODULUS];
+    return c;
   else
-    return utf32__unidata_hard(c);
+    return utf32__index_hard(c);
 }
 
-/** @brief Find definition of code point @p c
+/** @brief Find the table index of code point @p c
  * @param c Code point
- * @return Pointer to @ref unidata structure for @p c
+ * @return Index into the tables in @ref lib/unidata.c
  *
- * @p c can be any 32-bit value, a sensible value will be returned regardless.
- * The returned pointer is NOT guaranteed to be unique to @p c.
- *
- * Don't use this function (although it will work fine) - use utf32__unidata()
+ * Don't use this function (although it will work fine) - use utf32__index()
  * instead.
  */
-static const struct unidata *utf32__unidata_hard(uint32_t c) {
+static uint32_t utf32__index_hard(uint32_t c) {
   if(c < UNICODE_BREAK_START)
-    return &unidata[c / UNICODE_MODULUS][c % UNICODE_MODULUS];
+    return c;
   /* Within the break everything is unassigned */
   if(c < UNICODE_BREAK_END)
-    return utf32__unidata(0xFFFF);      /* guaranteed to be Cn */
+    return 0xFFFF;                      /* guaranteed to be Cn */
   /* Planes 15 and 16 are (mostly) private use */
   if((c >= 0xF0000 && c <= 0xFFFFD)
      || (c >= 0x100000 && c <= 0x10FFFD))
-    return utf32__unidata(0xE000);      /* first Co code point */
+    return 0xE000;                      /* first Co code point */
   /* Everything else above the break top is unassigned */
   if(c >= UNICODE_BREAK_TOP)
-    return utf32__unidata(0xFFFF);      /* guaranteed to be Cn */
+    return 0xFFFF;                      /* guaranteed to be Cn */
   /* Currently the rest is language tags and variation selectors */
-  c -= (UNICODE_BREAK_END - UNICODE_BREAK_START);
-  return &unidata[c / UNICODE_MODULUS][c % UNICODE_MODULUS];
+  return c - (UNICODE_BREAK_END - UNICODE_BREAK_START);
+}
+
+/** @brief Find definition of code point @p c
+ * @param c Code point
+ * @return Pointer to @ref unidata structure for @p c
+ *
+ * @p c can be any 32-bit value, a sensible value will be returned regardless.
+ * The returned pointer is NOT guaranteed to be unique to @p c.
+ */
+static inline const struct unidata *utf32__unidata(uint32_t c) {
+  const uint32_t n = utf32__index(c);
+
+  return &unidata[n / UNICODE_MODULUS][n % UNICODE_MODULUS];
+}
+
+/** @brief Look up a property in one of the per-property tables
+ * @param blocks Blocks of property values
+ * @param index Block number for each block of code points
+ * @param c Code point
+ * @return Property value of @p c
+ *
+ * These tables have a byte per code point, so are much denser than
+ * @ref unidata, and are used for the properties that are looked up in inner
+ * loops.
+ */
+static inline unsigned
+utf32__prop(const uint8_t (*blocks)[UNICODE_PROP_BLOCK],
+            const uint16_t *index, uint32_t c) {
+  const uint32_t n = utf32__index(c);
+
+  return blocks[index[n >> UNICODE_PROP_SHIFT]][n & (UNICODE_PROP_BLOCK - 1)];
 }
 
 /** @brief Return the combining class of @p c
@@ -100,7 +129,7 @@ static const struct unidata *utf32__unidata_hard(uint32_t c) {
  * @p c can be any 32-bit value, a sensible value will be returned regardless.
  */
 static inline int utf32__combining_class(uint32_t c) {
-  return utf32__unidata(c)->ccc;
+  return utf32__prop(unicode_ccc_blocks, unicode_ccc_index, c);
 }
 
 /** @brief Return the combining class of @p c
@@ -120,7 +149,8 @@ int utf32_combining_class(uint32_t c) {
  * @p c can be any 32-bit value, a sensible value will be returned regardless.
  */
 static inline enum unicode_General_Category utf32__general_category(uint32_t c) {
-  return utf32__unidata(c)->general_category;
+  return utf32__prop(unicode_general_category_blocks,
+                     unicode_general_category_index, c);
 }
 
 /** @brief Determine Grapheme_Break property
@@ -140,7 +170,8 @@ static inline enum unicode_Grapheme_Break utf32__grapheme_break(uint32_t c) {
  * @p c can be any 32-bit value, a sensible value will be returned regardless.
  */
 static inline enum unicode_Word_Break utf32__word_break(uint32_t c) {
-  return utf32__unidata(c)->word_break;
+  return utf32__prop(unicode_word_break_blocks, unicode_word_break_index,
+                     c);
 }
 
 /** @brief Determine Sentence_Break property
@@ -188,79 +219,128 @@ static inline const uint32_t *utf32__decomposition_compat(uint32_t c) {
 /** @defgroup utftransform Functions that transform between different Unicode encoding forms */
 /*@{*/
 
-/** @brief Convert UTF-32 to UTF-8
+/** @brief Convert UTF-32 to UTF-8, appending to a buffer
  * @param s Source string
  * @param ns Length of source string in code points
- * @param ndp Where to store length of destination string (or NULL)
- * @return Newly allocated destination string or NULL on error
- *
- * If the UTF-32 is not valid then NULL is returned.  A UTF-32 code point is
- * invalid if:
- * - it codes for a UTF-16 surrogate
- * - it codes for a value outside the unicode code space
+ * @param d Where to append the result
+ * @return 0 on success, -1 on error
  *
- * The return value is always 0-terminated.  The value returned via @p *ndp
- * does not include the terminator.
+ * As utf32_to_utf8(), but appends to @p d instead of allocating a new
+ * string, so that the caller can reuse one buffer for many conversions.  @p d
+ * is 0-terminated on success; the terminator is not counted in its length.
+ * On error the contents of @p d are unspecified.
  */
-char *utf32_to_utf8(const uint32_t *s, size_t ns, size_t *ndp) {
-  struct dynstr d;
+int utf32_to_utf8_buf(const uint32_t *s, size_t ns, struct dynstr *d) {
   uint32_t c;
 
-  dynstr_init(&d);
   while(ns > 0) {
     c = *s++;
     if(c < 0x80)
-      dynstr_append(&d, c);
+      dynstr_append(d, c);
     else if(c < 0x0800) {
-      dynstr_append(&d, 0xC0 | (c >> 6));
-      dynstr_append(&d, 0x80 | (c & 0x3F));
+      dynstr_append(d, 0xC0 | (c >> 6));
+      dynstr_append(d, 0x80 | (c & 0x3F));
     } else if(c < 0x10000) {
       if(c >= 0xD800 && c <= 0xDFFF)
-	goto error;
-      dynstr_append(&d, 0xE0 | (c >> 12));
-      dynstr_append(&d, 0x80 | ((c >> 6) & 0x3F));
-      dynstr_append(&d, 0x80 | (c & 0x3F));
+	return -1;
+      dynstr_append(d, 0xE0 | (c >> 12));
+      dynstr_append(d, 0x80 | ((c >> 6) & 0x3F));
+      dynstr_append(d, 0x80 | (c & 0x3F));
     } else if(c < 0x110000) {
-      dynstr_append(&d, 0xF0 | (c >> 18));
-      dynstr_append(&d, 0x80 | ((c >> 12) & 0x3F));
-      dynstr_append(&d, 0x80 | ((c >> 6) & 0x3F));
-      dynstr_append(&d, 0x80 | (c & 0x3F));
+      dynstr_append(d, 0xF0 | (c >> 18));
+      dynstr_append(d, 0x80 | ((c >> 12) & 0x3F));
+      dynstr_append(d, 0x80 | ((c >> 6) & 0x3F));
+      dynstr_append(d, 0x80 | (c & 0x3F));
     } else
-      goto error;
+      return -1;
     --ns;
   }
-  dynstr_terminate(&d);
-  if(ndp)
-    *ndp = d.nvec;
-  return d.vec;
-error:
-  xfree(d.vec);
+  dynstr_terminate(d);
   return 0;
 }
 
-/** @brief Convert UTF-8 to UTF-32
+/** @brief Convert UTF-32 to UTF-8
  * @param s Source string
  * @param ns Length of source string in code points
  * @param ndp Where to store length of destination string (or NULL)
  * @return Newly allocated destination string or NULL on error
  *
+ * If the UTF-32 is not valid then NULL is returned.  A UTF-32 code point is
+ * invalid if:
+ * - it codes for a UTF-16 surrogate
+ * - it codes for a value outside the unicode code space
+ *
  * The return value is always 0-terminated.  The value returned via @p *ndp
  * does not include the terminator.
+ */
+char *utf32_to_utf8(const uint32_t *s, size_t ns, size_t *ndp) {
+  struct dynstr d;
+
+  dynstr_init(&d);
+  if(utf32_to_utf8_buf(s, ns, &d)) {
+    xfree(d.vec);
+    return 0;
+  }
+  if(ndp)
+    *ndp = d.nvec;
+  return d.vec;
+}
+
+/** @brief Find the length of the ASCII prefix of @p [s,s+ns)
+ * @param s Pointer to string
+ * @param ns Length of string
+ * @return Number of leading bytes without their top bit set
  *
- * If the UTF-8 is not valid then NULL is returned.  A UTF-8 sequence
- * for a code point is invalid if:
- * - it is not the shortest possible sequence for the code point
- * - it codes for a UTF-16 surrogate
- * - it codes for a value outside the unicode code space
+ * Runs of ASCII are skipped a word at a time.
  */
-uint32_t *utf8_to_utf32(const char *s, size_t ns, size_t *ndp) {
-  struct dynstr_ucs4 d;
-  uint32_t c32;
+static size_t utf8__ascii_prefix(const uint8_t *s, size_t ns) {
+  uint64_t w;
+  size_t n = 0;
+
+  while(ns - n >= sizeof w) {
+    memcpy(&w, s + n, sizeof w);
+    if(w & 0x8080808080808080ull)
+      break;
+    n += sizeof w;
+  }
+  while(n < ns && !(s[n] & 0x80))
+    ++n;
+  return n;
+}
+
+/** @brief Convert UTF-8 to UTF-32, appending to a buffer
+ * @param s Source string
+ * @param ns Length of source string in bytes
+ * @param d Where to append the result
+ * @return 0 on success, -1 on error
+ *
+ * As utf8_to_utf32(), but appends to @p d instead of allocating a new string,
+ * so that the caller can reuse one buffer for many conversions.  @p d is
+ * 0-terminated on success; the terminator is not counted in its length.  On
+ * error the contents of @p d are unspecified.
+ */
+int utf8_to_utf32_buf(const char *s, size_t ns, struct dynstr_ucs4 *d) {
+  uint32_t *dd, c32;
   const uint8_t *ss = (const uint8_t *)s;
+  size_t nascii;
   int n;
 
-  dynstr_ucs4_init(&d);
+  /* There can be no more code points than bytes */
+  if((size_t)d->nslots < d->nvec + ns + 1) {
+    d->nslots = d->nvec + ns + 1;
+    d->vec = xrealloc_noptr(d->vec, d->nslots * sizeof *d->vec);
+  }
+  dd = d->vec + d->nvec;
   while(ns > 0) {
+    /* Copy runs of ASCII straight across */
+    if(!(*ss & 0x80)) {
+      nascii = utf8__ascii_prefix(ss, ns);
+      for(size_t i = 0; i < nascii; ++i)
+        *dd++ = ss[i];
+      ss += nascii;
+      ns -= nascii;
+      continue;
+    }
     const struct unicode_utf8_row *const r = &unicode_utf8_valid[*ss];
     if(r->count <= ns) {
       switch(r->count) {
@@ -269,40 +349,64 @@ uint32_t *utf8_to_utf32(const char *s, size_t ns, size_t *ndp) {
         break;
       case 2:
         if(ss[1] < r->min2 || ss[1] > r->max2)
-          goto error;
+          return -1;
         c32 = *ss & 0x1F;
         break;
       case 3:
         if(ss[1] < r->min2 || ss[1] > r->max2)
-          goto error;
+          return -1;
         c32 = *ss & 0x0F;
         break;
       case 4:
         if(ss[1] < r->min2 || ss[1] > r->max2)
-          goto error;
+          return -1;
         c32 = *ss & 0x07;
         break;
       default:
-        goto error;
+        return -1;
       }
     } else
-      goto error;
+      return -1;
     for(n = 1; n < r->count; ++n) {
       if(ss[n] < 0x80 || ss[n] > 0xBF)
-        goto error;
+        return -1;
       c32 = (c32 << 6) | (ss[n] & 0x3F);
     }
-    dynstr_ucs4_append(&d, c32);
+    *dd++ = c32;
     ss += r->count;
     ns -= r->count;
   }
-  dynstr_ucs4_terminate(&d);
+  *dd = 0;
+  d->nvec = dd - d->vec;
+  return 0;
+}
+
+/** @brief Convert UTF-8 to UTF-32
+ * @param s Source string
+ * @param ns Length of source string in code points
+ * @param ndp Where to store length of destination string (or NULL)
+ * @return Newly allocated destination string or NULL on error
+ *
+ * The return value is always 0-terminated.  The value returned via @p *ndp
+ * does not include the terminator.
+ *
+ * If the UTF-8 is not valid then NULL is returned.  A UTF-8 sequence
+ * for a code point is invalid if:
+ * - it is not the shortest possible sequence for the code point
+ * - it codes for a UTF-16 surrogate
+ * - it codes for a value outside the unicode code space
+ */
+uint32_t *utf8_to_utf32(const char *s, size_t ns, size_t *ndp) {
+  struct dynstr_ucs4 d;
+
+  dynstr_ucs4_init(&d);
+  if(utf8_to_utf32_buf(s, ns, &d)) {
+    xfree(d.vec);
+    return 0;
+  }
   if(ndp)
     *ndp = d.nvec;
   return d.vec;
-error:
-  xfree(d.vec);
-  return 0;
 }
 
 /** @brief Convert UTF-16 to UTF-8
@@ -442,7 +546,16 @@ error:
  */
 int utf8_valid(const char *s, size_t ns) {
   const uint8_t *ss = (const uint8_t *)s;
+  size_t nascii;
+
   while(ns > 0) {
+    /* Skip runs of ASCII */
+    if(!(*ss & 0x80)) {
+      nascii = utf8__ascii_prefix(ss, ns);
+      ss += nascii;
+      ns -= nascii;
+      continue;
+    }
     const struct unicode_utf8_row *const r = &unicode_utf8_valid[*ss];
     if(r->count <= ns) {
       switch(r->count) {
@@ -1348,24 +1461,53 @@ error:
   return 0;
 }
 
-/** @brief Compatibility case-fold @p [s,s+ns)
+/** @brief One pass of NFKD o toCaseFold, appending to @p dp
  * @param s Pointer to string
  * @param ns Length of string
- * @param ndp Where to store length of result
- * @return Pointer to result string, or NULL on error
- *
- * Case-fold the string at @p s according to full default case-folding rules
- * (s3.13) for compatibility caseless matching.  The result will be in NFKD.
- *
- * Returns NULL if the string is not valid for either of the following reasons:
- * - it codes for a UTF-16 surrogate
- * - it codes for a value outside the unicode code space
+ * @param dp Where to append the result
+ * @return 0 on success, non-0 on error
  */
-uint32_t *utf32_casefold_compat(const uint32_t *s, size_t ns, size_t *ndp) {
-  struct dynstr_ucs4 d;
+static int utf32__casefold_compat_pass(const uint32_t *s, size_t ns,
+                                       struct dynstr_ucs4 *dp) {
+  const int start = dp->nvec;
+  const uint32_t *cf;
   uint32_t c;
+
+  while(ns) {
+    c = *s++;
+    if((c >= 0xD800 && c <= 0xDFFF) || c > 0x10FFFF)
+      return -1;
+    if((cf = utf32__unidata(c)->casefold)) {
+      /* Found a case-fold mapping in the table */
+      while(*cf)
+        utf32__decompose_one_compat(dp, *cf++);
+    } else
+      utf32__decompose_one_compat(dp, c);
+    --ns;
+  }
+  return utf32__canonical_ordering(dp->vec + start, dp->nvec - start);
+}
+
+/** @brief Compatibility case-fold @p [s,s+ns), appending to a buffer
+ * @param s Pointer to string
+ * @param ns Length of string
+ * @param d Where to append the result
+ * @param scratch Working space
+ * @return 0 on success, -1 on error
+ *
+ * As utf32_casefold_compat(), but appends to @p d instead of allocating a new
+ * string.  @p scratch holds the intermediate result; its contents on entry
+ * are discarded.  Callers that fold many strings can keep both buffers and
+ * so avoid allocating for each string.  @p d is 0-terminated on success; the
+ * terminator is not counted in its length.  On error the contents of @p d are
+ * unspecified.
+ */
+int utf32_casefold_compat_buf(const uint32_t *s, size_t ns,
+                              struct dynstr_ucs4 *d,
+                              struct dynstr_ucs4 *scratch) {
   size_t n;
   uint32_t *ss = 0;
+  int ret = -1;
 
   for(n = 0; n < ns; ++n)
     if(utf32__unidata(s[n])->flags & unicode_normalize_before_casefold)
@@ -1373,39 +1515,47 @@ uint32_t *utf32_casefold_compat(const uint32_t *s, size_t ns, size_t *ndp) {
   if(n < ns) {
     /* We need a preliminary _canonical_ decomposition */
     if(!(ss = utf32_decompose_canon(s, ns, &ns)))
-      return 0;
+      return -1;
     s = ss;
   }
-  /* This computes NFKD(toCaseFold(s)) */
-#define compat_casefold_middle() do {                   \
-  dynstr_ucs4_init(&d);                                 \
-  while(ns) {                                           \
-    c = *s++;                                           \
-    if((c >= 0xD800 && c <= 0xDFFF) || c > 0x10FFFF)    \
-      goto error;                                       \
-    utf32__casefold_one(compat);                        \
-    --ns;                                               \
-  }                                                     \
-  if(utf32__canonical_ordering(d.vec, d.nvec))          \
-    goto error;                                         \
-} while(0)
-  /* Do the inner (NFKD o toCaseFold) */
-  compat_casefold_middle();
-  /* We can do away with the NFD'd copy of the input now */
+  /* This computes NFKD(toCaseFold(NFKD(toCaseFold(s)))) */
+  scratch->nvec = 0;
+  if(!utf32__casefold_compat_pass(s, ns, scratch)
+     && !utf32__casefold_compat_pass(scratch->vec, scratch->nvec, d)) {
+    dynstr_ucs4_terminate(d);
+    ret = 0;
+  }
   xfree(ss);
-  s = ss = d.vec;
-  ns = d.nvec;
-  /* Do the outer (NFKD o toCaseFold) */
-  compat_casefold_middle();
-  /* That's all */
-  dynstr_ucs4_terminate(&d);
+  return ret;
+}
+
+/** @brief Compatibility case-fold @p [s,s+ns)
+ * @param s Pointer to string
+ * @param ns Length of string
+ * @param ndp Where to store length of result
+ * @return Pointer to result string, or NULL on error
+ *
+ * Case-fold the string at @p s according to full default case-folding rules
+ * (s3.13) for compatibility caseless matching.  The result will be in NFKD.
+ *
+ * Returns NULL if the string is not valid for either of the following reasons:
+ * - it codes for a UTF-16 surrogate
+ * - it codes for a value outside the unicode code space
+ */
+uint32_t *utf32_casefold_compat(const uint32_t *s, size_t ns, size_t *ndp) {
+  struct dynstr_ucs4 d, scratch;
+
+  dynstr_ucs4_init(&d);
+  dynstr_ucs4_init(&scratch);
+  if(utf32_casefold_compat_buf(s, ns, &d, &scratch)) {
+    xfree(d.vec);
+    xfree(scratch.vec);
+    return 0;
+  }
+  xfree(scratch.vec);
   if(ndp)
     *ndp = d.nvec;
   return d.vec;
-error:
-  xfree(d.vec);
-  xfree(ss);
-  return 0;
 }
 
 /** @brief Order a pair of UTF-32 strings
@@ -1526,12 +1676,53 @@ uint32_t **utf32_word_split(const uint32_t *s, size_t ns, size_t *nwp,
 /** @defgroup utf8 Functions that operate on UTF-8 strings */
 /*@{*/
 
-/** @brief Wrapper to transform a UTF-8 string using the UTF-32 function */
-#define utf8__transform(FN) do {                                \
+/** @brief Test whether @p [s,s+ns) is entirely ASCII
+ * @param s Pointer to string
+ * @param ns Length of string
+ * @return Nonzero if no byte has its top bit set
+ */
+static inline int utf8__ascii(const char *s, size_t ns) {
+  return utf8__ascii_prefix((const uint8_t *)s, ns) == ns;
+}
+
+/** @brief Transform an ASCII string
+ * @param s Pointer to string
+ * @param ns Length of string
+ * @param ndp Where to store length of result, or NULL
+ * @param fold Nonzero to case-fold
+ * @return Pointer to result string
+ *
+ * ASCII characters have no decompositions and compose with nothing, so every
+ * normalization form of an ASCII string is the string itself.  The only
+ * ASCII characters that case-fold are A-Z.
+ */
+static char *utf8__ascii_transform(const char *s, size_t ns, size_t *ndp,
+                                   int fold) {
+  char *d = xmalloc_noptr(ns + 1);
+  size_t n;
+
+  if(fold)
+    for(n = 0; n < ns; ++n)
+      d[n] = s[n] >= 'A' && s[n] <= 'Z' ? s[n] ^ 0x20 : s[n];
+  else
+    memcpy(d, s, ns);
+  d[ns] = 0;
+  if(ndp)
+    *ndp = ns;
+  return d;
+}
+
+/** @brief Wrapper to transform a UTF-8 string using the UTF-32 function
+ *
+ * ASCII strings are handled directly; @p FOLD is nonzero if @p FN
+ * case-folds. */
+#define utf8__transform(FN, FOLD) do {                          \
   uint32_t *to32 = 0, *decomp32 = 0;                            \
   size_t nto32, ndecomp32;                                      \
   char *decomp8 = 0;                                            \
                                                                 \
+  if(utf8__ascii(s, ns))                                        \
+    return utf8__ascii_transform(s, ns, ndp, FOLD);             \
   if(!(to32 = utf8_to_utf32(s, ns, &nto32))) goto error;        \
   if(!(decomp32 = FN(to32, nto32, &ndecomp32))) goto error;     \
   decomp8 = utf32_to_utf8(decomp32, ndecomp32, ndp);            \
@@ -1560,7 +1751,7 @@ error:                                                          \
  * - utf8_compose_canon()
  */
 char *utf8_decompose_canon(const char *s, size_t ns, size_t *ndp) {
-  utf8__transform(utf32_decompose_canon);
+  utf8__transform(utf32_decompose_canon, 0);
 }
 
 /** @brief Compatibility decompose @p [s,s+ns)
@@ -1582,7 +1773,7 @@ char *utf8_decompose_canon(const char *s, size_t ns, size_t *ndp) {
  * - utf8_compose_compat()
  */
 char *utf8_decompose_compat(const char *s, size_t ns, size_t *ndp) {
-  utf8__transform(utf32_decompose_compat);
+  utf8__transform(utf32_decompose_compat, 0);
 }
 
 /** @brief Canonically compose @p [s,s+ns)
@@ -1604,7 +1795,7 @@ char *utf8_decompose_compat(const char *s, size_t ns, size_t *ndp) {
  * - utf8_decompose_canon()
  */
 char *utf8_compose_canon(const char *s, size_t ns, size_t *ndp) {
-  utf8__transform(utf32_compose_canon);
+  utf8__transform(utf32_compose_canon, 0);
 }
 
 /** @brief Compatibility compose @p [s,s+ns)
@@ -1627,7 +1818,7 @@ char *utf8_compose_canon(const char *s, size_t ns, size_t *ndp) {
  * - utf8_decompose_compat()
  */
 char *utf8_compose_compat(const char *s, size_t ns, size_t *ndp) {
-  utf8__transform(utf32_compose_compat);
+  utf8__transform(utf32_compose_compat, 0);
 }
 
 /** @brief Case-fold @p [s,s+ns)
@@ -1643,7 +1834,7 @@ char *utf8_compose_compat(const char *s, size_t ns, size_t *ndp) {
  * this might be.
  */
 char *utf8_casefold_canon(const char *s, size_t ns, size_t *ndp) {
-  utf8__transform(utf32_casefold_canon);
+  utf8__transform(utf32_casefold_canon, 1);
 }
 
 /** @brief Compatibility case-fold @p [s,s+ns)
@@ -1659,7 +1850,7 @@ char *utf8_casefold_canon(const char *s, size_t ns, size_t *ndp) {
  * this might be.
  */
 char *utf8_casefold_compat(const char *s, size_t ns, size_t *ndp) {
-  utf8__transform(utf32_casefold_compat);
+  utf8__transform(utf32_casefold_compat, 1);
 }
 
 /** @brief Split [s,ns) into multiple words
@@ -42,8 +42,13 @@ typedef struct utf32_iterator_data *utf32_iterator;
  */
 typedef int unicode_property_tailor(uint32_t c);
 
+struct dynstr;
+struct dynstr_ucs4;
+
 char *utf32_to_utf8(const uint32_t *s, size_t ns, size_t *nd);
 uint32_t *utf8_to_utf32(const char *s, size_t ns, size_t *nd);
+int utf32_to_utf8_buf(const uint32_t *s, size_t ns, struct dynstr *d);
+int utf8_to_utf32_buf(const char *s, size_t ns, struct dynstr_ucs4 *d);
 char *utf16_to_utf8(const uint16_t *s, size_t ns, size_t *nd);
 uint16_t *utf8_to_utf16(const char *s, size_t ns, size_t *nd);
 int utf8_valid(const char *s, size_t ns);
@@ -70,6 +75,9 @@ uint32_t *utf32_casefold_canon(const uint32_t *s, size_t ns, size_t *ndp);
 char *utf8_casefold_canon(const char *s, size_t ns, size_t *ndp);
 
 uint32_t *utf32_casefold_compat(const uint32_t *s, size_t ns, size_t *ndp);
+int utf32_casefold_compat_buf(const uint32_t *s, size_t ns,
+                              struct dynstr_ucs4 *d,
+                              struct dynstr_ucs4 *scratch);
 char *utf8_casefold_compat(const char *s, size_t ns, size_t *ndp);
 
 int utf32_is_grapheme_boundary(const uint32_t *s, size_t ns, size_t n);
@@ -114,4 +114,12 @@ extern const struct unicode_utf8_row {
 #define UNICODE_BREAK_START 196608
 #define UNICODE_BREAK_END 917504
 #define UNICODE_BREAK_TOP 918016
+#define UNICODE_PROP_SHIFT 7
+#define UNICODE_PROP_BLOCK 128
+extern const uint8_t unicode_ccc_blocks[][128];
+extern const uint16_t unicode_ccc_index[];
+extern const uint8_t unicode_general_category_blocks[][128];
+extern const uint16_t unicode_general_category_index[];
+extern const uint8_t unicode_word_break_blocks[][128];
+extern const uint16_t unicode_word_break_index[];
 #endif
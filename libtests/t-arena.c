@@ -0,0 +1,72 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "test.h"
+
+/** @brief Tests for @ref arena.h */
+static void test_arena(void) {
+  struct arena a[1];
+  char *p[1000], *first, *big;
+  size_t n;
+
+  arena_init(a);
+  /* Lots of small allocations, spanning several chunks */
+  for(n = 0; n < sizeof p / sizeof *p; ++n) {
+    p[n] = arena_alloc(a, n % 37 + 1);
+    insist((uintptr_t)p[n] % sizeof (void *) == 0);
+    memset(p[n], (int)n, n % 37 + 1);
+  }
+  for(n = 0; n < sizeof p / sizeof *p; ++n) {
+    size_t m;
+
+    for(m = 0; m < n % 37 + 1; ++m)
+      check_integer((unsigned char)p[n][m], (unsigned char)n);
+  }
+  /* Strings */
+  check_string(arena_strdup(a, "wibble"), "wibble");
+  check_string(arena_strdup(a, ""), "");
+  check_string(arena_strndup(a, "wibble wobble", 6), "wibble");
+  /* An allocation bigger than a chunk */
+  big = arena_alloc(a, 100000);
+  memset(big, 'x', 100000);
+  check_string(arena_strdup(a, "after"), "after");
+  /* Reset reuses the memory and clears it */
+  first = p[0];
+  arena_reset(a);
+  p[0] = arena_alloc(a, 16);
+  insist(p[0] == first);
+  for(n = 0; n < 16; ++n)
+    check_integer(p[0][n], 0);
+  /* Having dropped the big chunk it can be allocated again */
+  for(n = 0; n < 10; ++n) {
+    big = arena_alloc(a, 100000);
+    memset(big, 'y', 100000);
+    arena_reset(a);
+  }
+  check_string(arena_strdup(a, "wobble"), "wobble");
+}
+
+TEST(arena);
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -18,7 +18,8 @@
 #include "test.h"
 
 static void test_cache(void) {
-  const struct cache_type t1 = { 1 }, t2 = { 10 };
+  const struct cache_type t1 = { 1 }, t2 = { 10 }, t3 = { 1 };
+  struct cache_stats s;
   const char v11[] = "spong", v12[] = "wibble", v2[] = "blat";
 
   cache_put(&t1, "1_1", v11);
@@ -43,6 +44,68 @@ static void test_cache(void) {
   cache_clean(0);
   insist(cache_count() == 0);
   insist(cache_get(&t2, "2") == 0); 
+
+  /* Size limit */
+  cache_budget(100);
+  cache_put_sized(&t2, "s1", v11, 60);
+  cache_put(&t2, "u", v2);
+  insist(cache_bytes() == 60);
+  sleep(1);
+  cache_put_sized(&t2, "s2", v12, 60);
+  insist(cache_bytes() == 60);
+  insist(cache_get(&t2, "s1") == 0);
+  insist(cache_get(&t2, "s2") == v12);
+  insist(cache_get(&t2, "u") == v2);
+  cache_put_sized(&t2, "s2", v11, 30);
+  insist(cache_bytes() == 30);
+  insist(cache_get(&t2, "s2") == v11);
+  cache_clean(0);
+  insist(cache_bytes() == 0);
+
+  /* Least recently used goes first, not oldest */
+  cache_put_sized(&t2, "s1", v11, 40);
+  cache_put_sized(&t2, "s2", v12, 40);
+  insist(cache_get(&t2, "s1") == v11);
+  cache_put_sized(&t2, "s3", v2, 40);
+  insist(cache_bytes() == 80);
+  insist(cache_get(&t2, "s1") == v11);
+  insist(cache_get(&t2, "s2") == 0);
+  insist(cache_get(&t2, "s3") == v2);
+  cache_clean(0);
+  cache_budget(0);
+
+  /* Object limit, counting sized and unsized objects together */
+  cache_limit(2);
+  cache_put(&t2, "u1", v11);
+  cache_put_sized(&t2, "s1", v12, 10);
+  insist(cache_get(&t2, "u1") == v11);
+  cache_put(&t2, "u2", v2);
+  insist(cache_count() == 2);
+  insist(cache_get(&t2, "s1") == 0);
+  insist(cache_get(&t2, "u1") == v11);
+  insist(cache_get(&t2, "u2") == v2);
+  cache_put_sized(&t2, "s2", v12, 10);
+  insist(cache_count() == 2);
+  insist(cache_get(&t2, "u1") == 0);
+  cache_clean(0);
+  cache_limit(0);
+
+  /* Statistics, and expiry on lookup */
+  cache_stats(&t3, &s);
+  insist(s.hits == 0 && s.misses == 0 && s.evictions == 0 && s.expiries == 0);
+  cache_put(&t3, "x", v11);
+  insist(cache_get(&t3, "x") == v11);
+  insist(cache_get(&t3, "y") == 0);
+  sleep(2);
+  insist(cache_get(&t3, "x") == 0);
+  insist(cache_count() == 0);
+  cache_stats(&t3, &s);
+  check_integer(s.hits, 1);
+  check_integer(s.misses, 2);
+  check_integer(s.evictions, 0);
+  check_integer(s.expiries, 1);
+  cache_stats(&t2, &s);
+  check_integer(s.evictions, 4);
 }
 
 TEST(cache);
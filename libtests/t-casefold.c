@@ -69,6 +69,38 @@ static void test_casefold(void) {
     }
   }
   check_string(utf8_casefold_canon("", 0, 0), "");
+  /* Longer strings, pure ASCII or not, of various alignments */
+  check_string(utf8_casefold_compat("The Beatles/Abbey Road/01:Come Together",
+                                    39, 0),
+               "the beatles/abbey road/01:come together");
+  check_string(utf8_casefold_compat("ABCDEFGHI\xC3\x80", 11, 0),
+               "abcdefghia\xCC\x80");
+  check_string(utf8_compose_canon("ABCDEFGHIa\xCC\x80", 12, 0),
+               "ABCDEFGHI\xC3\xA0");
+  check_string(utf8_compose_canon("Abbey Road", 10, 0), "Abbey Road");
+
+  /* Buffer-based variants append, and buffers can be reused */
+  {
+    struct dynstr_ucs4 in, out, scratch;
+    struct dynstr d;
+
+    dynstr_ucs4_init(&in);
+    dynstr_ucs4_init(&out);
+    dynstr_ucs4_init(&scratch);
+    dynstr_init(&d);
+    insist(!utf8_to_utf32_buf("Hello, ", 7, &in));
+    insist(!utf8_to_utf32_buf("\xC3\x80!", 3, &in));
+    check_integer(in.nvec, 9);
+    insist(!utf32_casefold_compat_buf(in.vec, in.nvec, &out, &scratch));
+    insist(!utf32_to_utf8_buf(out.vec, out.nvec, &d));
+    check_string(d.vec, "hello, a\xCC\x80!");
+    in.nvec = out.nvec = d.nvec = 0;
+    insist(!utf8_to_utf32_buf("\xEF\xAC\x81", 3, &in)); /* fi ligature */
+    insist(!utf32_casefold_compat_buf(in.vec, in.nvec, &out, &scratch));
+    insist(!utf32_to_utf8_buf(out.vec, out.nvec, &d));
+    check_string(d.vec, "fi");
+    insist(utf8_to_utf32_buf("\xC3", 1, &in));
+  }
 }
 
 TEST(casefold);
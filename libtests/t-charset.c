@@ -25,6 +25,33 @@ static void test_charset(void) {
 	       "\xC2\xA3");
   fprintf(stderr, "Expect a conversion error:\n");
   insist(any2any("UTF-8", "ISO-8859-1", "\xC2""a") == 0);
+  /* The same descriptor again, after an error */
+  check_string(any2any("UTF-8", "ISO-8859-1", "\xC2\xA3"),
+	       "\xA3");
+
+  /* Conversions that don't need iconv */
+  check_string(any2utf8("UTF-8", "\xC2\xA3"), "\xC2\xA3");
+  check_string(any2utf8("utf8", "\xC2\xA3"), "\xC2\xA3");
+  check_string(any2utf8("US-ASCII", "wibble"), "wibble");
+  check_string(any2any("UTF-8", "ANSI_X3.4-1968", "wibble"), "wibble");
+  fprintf(stderr, "Expect a conversion error:\n");
+  insist(any2utf8("UTF-8", "\xC2""a") == 0);
+  fprintf(stderr, "Expect a conversion error:\n");
+  insist(any2utf8("ASCII", "\xA3") == 0);
+
+  /* More encoding pairs than the descriptor cache holds */
+  for(int n = 0; n < 3; ++n) {
+    check_string(any2utf8("ISO-8859-1", "\xA3"), "\xC2\xA3");
+    check_string(any2utf8("ISO-8859-15", "\xA4"), "\xE2\x82\xAC");
+    check_string(any2utf8("CP1252", "\x80"), "\xE2\x82\xAC");
+    check_string(any2utf8("ISO-8859-2", "\xA3"), "\xC5\x81");
+    check_string(any2any("UTF-8", "ISO-8859-15", "\xE2\x82\xAC"), "\xA4");
+    check_string(any2any("UTF-8", "CP1252", "\xE2\x82\xAC"), "\x80");
+    check_string(any2any("ISO-8859-1", "ISO-8859-15", "a"), "a");
+    check_string(any2any("ISO-8859-15", "ISO-8859-1", "a"), "a");
+    check_string(any2any("CP1252", "ISO-8859-1", "a"), "a");
+    check_string(any2any("ISO-8859-1", "CP1252", "a"), "a");
+  }
 
 #define EL "\xE2\x80\xA6"	/* 2026 HORIZONTAL ELLIPSIS */
   check_string(truncate_for_display("", 0), "");
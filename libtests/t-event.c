@@ -17,6 +17,7 @@
  */
 #include "test.h"
 #include "event.h"
+#include "timeval.h"
 
 #include <time.h>
 #include <sys/time.h>
@@ -46,11 +47,128 @@ static int callback3(ev_source attribute((unused)) *ev,
   return 1;
 }
 
+#define NTIMEOUTS 1000
+
+static ev_timeout_handle handles[NTIMEOUTS];
+static struct timeval whens[NTIMEOUTS];
+static int fired[NTIMEOUTS], early;
+
+static int counted(ev_source *ev,
+                   const struct timeval *now,
+                   void *u) {
+  int n = (int *)u - fired;
+
+  ++fired[n];
+  if(tvlt(now, &whens[n]))
+    early = 1;
+  /* Cancelling the next one takes effect even if it is due now */
+  if(n % 7 == 0 && n + 1 < NTIMEOUTS)
+    ev_timeout_cancel(ev, handles[n + 1]);
+  return 0;
+}
+
+static int last(ev_source attribute((unused)) *ev,
+                const struct timeval attribute((unused)) *now,
+                void attribute((unused)) *u) {
+  return 4;
+}
+
+static int nwritten, nread;
+
+static int writable(ev_source *ev, int fd, void attribute((unused)) *u) {
+  if(write(fd, "x", 1) == 1)
+    ++nwritten;
+  ev_fd_disable(ev, ev_write, fd);
+  return 0;
+}
+
+static int readable(ev_source *ev, int fd, void attribute((unused)) *u) {
+  char c;
+
+  if(read(fd, &c, 1) == 1)
+    ++nread;
+  ev_fd_cancel(ev, ev_read, fd);
+  return 2;
+}
+
+static char sent[100000];
+static size_t nreceived;
+static int mismatch, writer_done;
+
+static int receivable(ev_source *ev, int fd, void attribute((unused)) *u) {
+  char buffer[8192];
+  ssize_t n, i;
+
+  n = read(fd, buffer, sizeof buffer);
+  if(n < 0)
+    return 0;
+  for(i = 0; i < n; ++i)
+    if(nreceived + i >= sizeof sent || buffer[i] != sent[nreceived + i])
+      mismatch = 1;
+  nreceived += n;
+  if(n == 0) {
+    ev_fd_cancel(ev, ev_read, fd);
+    return 3;
+  }
+  return 0;
+}
+
+static int ndrained;
+static size_t drained_level;
+
+static int drained(ev_source attribute((unused)) *ev,
+                   void *u) {
+  ++ndrained;
+  drained_level = ev_writer_buffered(u);
+  return 0;
+}
+
+static size_t ntapped;
+static int tap_mismatch;
+
+static void tapped(const void *ptr, size_t n, void attribute((unused)) *u) {
+  if(memcmp(ptr, sent + ntapped, n))
+    tap_mismatch = 1;
+  ntapped += n;
+}
+
+static char held[sizeof sent];
+static size_t nheld;
+static int nflushes;
+
+/* Hold everything back until told to flush */
+static int holding_filter(ev_writer *w, const void *ptr, size_t n,
+                          void attribute((unused)) *u) {
+  if(!ptr) {
+    ++nflushes;
+    n = nheld;
+    nheld = 0;
+    return ev_writer_raw(w, held, n);
+  }
+  insist(nheld + n <= sizeof held);
+  memcpy(held + nheld, ptr, n);
+  nheld += n;
+  return 0;
+}
+
+static int writer_finished(ev_source attribute((unused)) *ev,
+                           int errno_value,
+                           void attribute((unused)) *u) {
+  writer_done = errno_value ? -1 : 1;
+  return 0;
+}
+
 static void test_event(void) {
   struct timeval w;
   ev_source *ev;
+  int p[2];
+  ev_writer *wr;
+  FILE *fp;
+  size_t n, m;
+  char **timings;
 
   ev = ev_new();
+  ev_instrument(ev, 60000);
   w.tv_sec = xtime(0) + 2;
   w.tv_usec = 0;
   ev_timeout(ev, &t1, &w, callback1, 0);
@@ -64,6 +182,152 @@ static void test_event(void) {
   check_integer(run1, 1);
   check_integer(run2, 0);
   check_integer(run3, 1);
+
+  /* File descriptors */
+  xpipe(p);
+  check_integer(ev_fd(ev, ev_read, p[0], readable, 0, "read"), 0);
+  check_integer(ev_fd(ev, ev_write, p[1], writable, 0, "write"), 0);
+  check_integer(ev_fd(ev, ev_except, p[0], readable, 0, "except"), -1);
+  check_integer(ev_run(ev), 2);
+  check_integer(nwritten, 1);
+  check_integer(nread, 1);
+  ev_fd_cancel(ev, ev_write, p[1]);
+  xclose(p[0]);
+  xclose(p[1]);
+
+  /* Buffered writer, mixing copied, referenced and file data */
+  xpipe(p);
+  nonblock(p[0]);
+  nonblock(p[1]);
+  for(n = 0; n < sizeof sent; ++n)
+    sent[n] = n * 7 + n / 251;
+  fp = tmpfile();
+  insist(fwrite(sent, 1, sizeof sent, fp) == sizeof sent);
+  insist(fflush(fp) == 0);
+  wr = ev_writer_new(ev, p[1], writer_finished, 0, "writer");
+  ev_writer_space_bound(wr, 0);
+  /* The tap sees everything except the file regions, which are skipped
+   * below */
+  ev_writer_tap(wr, tapped, 0);
+  for(n = 0; n < sizeof sent; n += m) {
+    m = (n / 97) % 5000 + 1;
+    if(m > sizeof sent - n)
+      m = sizeof sent - n;
+    switch(n % 3) {
+    case 0:
+      check_integer(ev_writer_reference(wr, sent + n, m), 0);
+      break;
+    case 1:
+      check_integer(ev_writer_file(wr, dup(fileno(fp)), n, m), 0);
+      ntapped += m;
+      break;
+    default:
+      check_integer(sink_write(ev_writer_sink(wr), sent + n, m), 0);
+      break;
+    }
+  }
+  check_integer(ev_writer_buffered(wr), sizeof sent);
+  check_integer(ntapped, sizeof sent);
+  check_integer(tap_mismatch, 0);
+  check_integer(ev_writer_drained(wr, 1000, drained, wr), 0);
+  check_integer(ev_writer_close(wr), 0);
+  check_integer(ev_fd(ev, ev_read, p[0], receivable, 0, "receive"), 0);
+  check_integer(ev_run(ev), 3);
+  check_integer(writer_done, 1);
+  check_integer(ndrained, 1);
+  insist(drained_level <= 1000);
+  check_integer(mismatch, 0);
+  check_integer(nreceived, sizeof sent);
+  xclose(p[0]);
+
+  /* Callback timings */
+  timings = ev_timings(ev);
+  for(n = 0; timings[n]; ++n)
+    ;
+  check_integer(n, 5);
+  check_string_prefix(timings[0], "read 1 ");
+  check_string_prefix(timings[2], "timeout 2 ");
+
+  /* The same through a filter, which only sees the end at close */
+  xpipe(p);
+  nonblock(p[0]);
+  nonblock(p[1]);
+  wr = ev_writer_new(ev, p[1], writer_finished, 0, "filtered writer");
+  ev_writer_space_bound(wr, 0);
+  ev_writer_filter(wr, holding_filter, 0);
+  ev_writer_tap(wr, tapped, 0);
+  ntapped = 0;
+  for(n = 0; n < sizeof sent; n += m) {
+    m = (n / 89) % 7000 + 1;
+    if(m > sizeof sent - n)
+      m = sizeof sent - n;
+    switch(n % 3) {
+    case 0:
+      check_integer(ev_writer_reference(wr, sent + n, m), 0);
+      break;
+    case 1:
+      check_integer(ev_writer_file(wr, dup(fileno(fp)), n, m), 0);
+      break;
+    default:
+      check_integer(sink_write(ev_writer_sink(wr), sent + n, m), 0);
+      break;
+    }
+  }
+  check_integer(ev_writer_buffered(wr), 0);
+  check_integer(ntapped, sizeof sent);
+  check_integer(tap_mismatch, 0);
+  check_integer(ev_writer_close(wr), 0);
+  check_integer(nflushes, 1);
+  check_integer(ev_writer_buffered(wr), sizeof sent);
+  writer_done = 0;
+  nreceived = 0;
+  check_integer(ev_fd(ev, ev_read, p[0], receivable, 0, "receive"), 0);
+  check_integer(ev_run(ev), 3);
+  check_integer(writer_done, 1);
+  check_integer(nflushes, 1);
+  check_integer(mismatch, 0);
+  check_integer(nreceived, sizeof sent);
+  xclose(p[0]);
+  fclose(fp);
+
+  /* Lots of timeouts, some cancelled */
+  xgettimeofday(&w, 0);
+  for(n = 0; n < NTIMEOUTS; ++n) {
+    whens[n] = w;
+    whens[n].tv_usec += (n * 7919) % 1500 * 1000 + n % 1000;
+    whens[n].tv_sec += whens[n].tv_usec / 1000000;
+    whens[n].tv_usec %= 1000000;
+    ev_timeout(ev, &handles[n], &whens[n], counted, &fired[n]);
+  }
+  for(n = 0; n < NTIMEOUTS; n += 5)
+    ev_timeout_cancel(ev, handles[n]);
+  /* Far enough ahead for the top of the wheel, and for the heap */
+  w.tv_sec += 7200;
+  ev_timeout(ev, &t1, &w, callback1, 0);
+  ev_timeout_cancel(ev, t1);
+  w.tv_sec += 86400;
+  ev_timeout(ev, &t1, &w, callback1, 0);
+  ev_timeout_cancel(ev, t1);
+  w.tv_sec -= 7200 + 86400 - 2;
+  ev_timeout(ev, 0, &w, last, 0);
+  run1 = 0;
+  check_integer(ev_run(ev), 4);
+  check_integer(early, 0);
+  check_integer(run1, 0);
+  for(n = 0; n < NTIMEOUTS; ++n) {
+    if(n % 5 == 0)
+      /* Cancelled before ev_run() */
+      check_integer(fired[n], 0);
+    else if(n % 7 == 1 && fired[n - 1]
+            && (whens[n - 1].tv_sec * 1000000 + whens[n - 1].tv_usec + 999)
+               / 1000
+               < (whens[n].tv_sec * 1000000 + whens[n].tv_usec + 999) / 1000)
+      /* Cancelled by the previous callback, which was due a millisecond or
+       * more earlier */
+      check_integer(fired[n], 0);
+    else if(n % 7 != 1 || !fired[n - 1])
+      check_integer(fired[n], 1);
+  }
 }
 
 TEST(event);
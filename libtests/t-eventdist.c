@@ -41,6 +41,25 @@ static void on_wobble2(const char *event, void *eventdata, void *callbackdata) {
   ++wobble2s;
 }
 
+static event_handle nested_handles[8];
+static int nested_calls[8], nested_order[8], nested_n;
+
+/* Handler 2 cancels handler 3 (already called) and handler 1 (not called
+ * yet), and registers handler 4, which shouldn't be called until next time */
+static void on_nested(const char *event, void attribute((unused)) *eventdata,
+                      void *callbackdata) {
+  int n = (int)(intptr_t)callbackdata;
+
+  check_string(event, "nested");
+  ++nested_calls[n];
+  nested_order[nested_n++] = n;
+  if(n == 2 && nested_calls[n] == 1) {
+    event_cancel(nested_handles[1]);
+    event_cancel(nested_handles[3]);
+    nested_handles[4] = event_register("nested", on_nested, (void *)4);
+  }
+}
+
 static void test_eventdist(void) {
   event_handle wibble_handle, wobble_handle, wobble2_handle;
   /* Raising unregistered events should be safe */
@@ -79,6 +98,45 @@ static void test_eventdist(void) {
 
   event_cancel(wibble_handle);
   event_cancel(wobble2_handle);
+  event_raise("wobble", (void *)"wobble_eventdata");
+  check_integer(wobble2s, 3);
+
+  /* Interned IDs are stable and work before any handler is registered */
+  event_id nested = event_intern("nested");
+  insist(nested == event_intern("nested"));
+  insist(nested != event_intern("wobble"));
+  event_raise_id(nested, 0);
+  ++tests;
+
+  /* Most recent first; changes during raising take effect for the rest of
+   * that raise only as far as cancellations go */
+  for(int n = 0; n < 4; ++n)
+    nested_handles[n] = event_register("nested", on_nested, (void *)(intptr_t)n);
+  event_raise_id(nested, 0);
+  check_integer(nested_n, 3);
+  check_integer(nested_order[0], 3);
+  check_integer(nested_order[1], 2);
+  check_integer(nested_order[2], 0);
+  nested_n = 0;
+  event_raise("nested", 0);
+  check_integer(nested_n, 3);
+  check_integer(nested_order[0], 4);
+  check_integer(nested_order[1], 2);
+  check_integer(nested_order[2], 0);
+  check_integer(nested_calls[1], 0);
+  check_integer(nested_calls[3], 1);
+
+  /* Cancelling most handlers compacts the array without losing the rest */
+  event_cancel(nested_handles[4]);
+  event_cancel(nested_handles[2]);
+  nested_n = 0;
+  event_raise_id(nested, 0);
+  check_integer(nested_n, 1);
+  check_integer(nested_order[0], 0);
+  event_cancel(nested_handles[0]);
+  nested_n = 0;
+  event_raise_id(nested, 0);
+  check_integer(nested_n, 0);
 }
 
 TEST(eventdist);
@@ -0,0 +1,82 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "test.h"
+#include "eventlog.h"
+
+static struct vector replayed;
+static unsigned long replayed_seq;
+
+static void replay(unsigned long seq, time_t attribute((unused)) when,
+                   const char *msg, void attribute((unused)) *u) {
+  insist(seq == replayed_seq + 1);
+  replayed_seq = seq;
+  vector_append(&replayed, (char *)msg);
+}
+
+static void test_eventlog(void) {
+  unsigned long start = eventlog_sequence(), mid;
+  char buffer[32];
+  int n;
+
+  insist(start != 0);
+  /* Nothing to replay */
+  vector_init(&replayed);
+  replayed_seq = start;
+  insist(eventlog_replay(start, replay, 0) == 0);
+  insist(replayed.nvec == 0);
+  /* The future isn't known */
+  insist(eventlog_replay(start + 1, replay, 0) == -1);
+  eventlog("volume", "1", "2", (char *)0);
+  eventlog_raw("queue", "id x", (char *)0);
+  insist(eventlog_sequence() == start + 2);
+  insist(eventlog_replay(start, replay, 0) == 0);
+  insist(replayed.nvec == 2);
+  check_string(replayed.vec[0], "volume 1 2");
+  check_string(replayed.vec[1], "queue id x");
+  /* Just the last one */
+  vector_init(&replayed);
+  replayed_seq = start + 1;
+  insist(eventlog_replay(start + 1, replay, 0) == 0);
+  insist(replayed.nvec == 1);
+  check_string(replayed.vec[0], "queue id x");
+  /* Once the ring wraps, old events are forgotten */
+  for(n = 0; n < 2000; ++n) {
+    snprintf(buffer, sizeof buffer, "%d", n);
+    eventlog("test", buffer, (char *)0);
+  }
+  insist(eventlog_replay(start, replay, 0) == -1);
+  insist(eventlog_replay(start, 0, 0) == -1);
+  mid = eventlog_sequence() - 10;
+  vector_init(&replayed);
+  replayed_seq = mid;
+  insist(eventlog_replay(mid, replay, 0) == 0);
+  insist(replayed.nvec == 10);
+  insist(eventlog_replay(mid, 0, 0) == 0);
+  check_string(replayed.vec[9], "test 1999");
+}
+
+TEST(eventlog);
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -0,0 +1,78 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "test.h"
+
+#define NWEIGHTS 257
+
+/** @brief Check @p f against a naive cumulative sum of @p w */
+static void check_fenwick(const struct fenwick *f, const unsigned long *w,
+                          size_t n) {
+  unsigned long long c = 0;
+  size_t i;
+
+  for(i = 0; i < n; ++i) {
+    check_integer(fenwick_get(f, i), w[i]);
+    if(w[i]) {
+      /* The first and last values covered by element i find it */
+      check_integer(fenwick_find(f, c), i);
+      check_integer(fenwick_find(f, c + w[i] - 1), i);
+    }
+    c += w[i];
+  }
+  check_integer(f->total, c);
+}
+
+/** @brief Tests for @ref fenwick.h */
+static void test_fenwick(void) {
+  struct fenwick f[1];
+  unsigned long w[NWEIGHTS];
+  size_t i, n;
+
+  for(n = 1; n <= NWEIGHTS; n += 16) {
+    /* Build from an array, some weights 0 */
+    for(i = 0; i < n; ++i)
+      w[i] = random() % 4 ? random() % 1000 : 0;
+    fenwick_init(f, w, n);
+    check_fenwick(f, w, n);
+    /* Change weights, including to and from 0 */
+    for(i = 0; i < 100; ++i) {
+      const size_t j = random() % n;
+
+      w[j] = random() % 4 ? random() % 1000 : 0;
+      fenwick_set(f, j, w[j]);
+      check_fenwick(f, w, n);
+    }
+    /* Build up from nothing */
+    fenwick_init(f, NULL, n);
+    check_integer(f->total, 0);
+    for(i = 0; i < n; ++i)
+      fenwick_set(f, i, w[i]);
+    check_fenwick(f, w, n);
+  }
+}
+
+TEST(fenwick);
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -0,0 +1,218 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "test.h"
+#include "gain.h"
+
+#include <math.h>
+
+/* Reference implementation, straight from the definition */
+static int16_t ref_clip(double r) {
+  r = floor(r + 0.5);
+  if(r > 32767) return 32767;
+  if(r < -32768) return -32768;
+  return r;
+}
+
+static int16_t ref_s16(int16_t s, double factor) {
+  return ref_clip(s * factor);
+}
+
+static void test_gain(void) {
+  static const double dbs[] = { 0, -6, 6, -0.5, 3.3, -20, 24 };
+  struct gain g;
+  int16_t s[67], o[67];
+  uint8_t u[3];
+  float f[9];
+  size_t i, n;
+
+  gain_init(&g, 0);
+  insist(gain_is_unity(&g));
+  gain_init(&g, -6);
+  insist(!gain_is_unity(&g));
+  /* Silence */
+  gain_init(&g, -1000);
+  for(i = 0; i < 67; ++i)
+    s[i] = i * 997 - 30000;
+  gain_s16(s, 67, &g);
+  for(i = 0; i < 67; ++i)
+    check_integer(s[i], 0);
+  /* Compare the (possibly vectorized) kernel against the definition.  Odd
+   * lengths make sure the scalar tail gets used too. */
+  for(n = 0; n < sizeof dbs / sizeof *dbs; ++n) {
+    gain_init(&g, dbs[n]);
+    for(i = 0; i < 67; ++i)
+      o[i] = s[i] = (int16_t)(i * 977 - 32768 + (i == 66 ? 32767 : 0));
+    gain_s16(s, 67, &g);
+    for(i = 0; i < 67; ++i)
+      check_integer(s[i], ref_s16(o[i], (double)g.mul / (1 << g.shift)));
+    /* The fixed point approximation should be close to the real thing */
+    insist(fabs((double)g.mul / (1 << g.shift) - pow(10, dbs[n] / 20))
+           < 0.01 * pow(10, dbs[n] / 20));
+  }
+  /* Byte-swapped samples */
+  gain_init(&g, -6.0206);               /* i.e. 0.5 */
+  s[0] = 0x0010;                        /* 4096 */
+  s[1] = (int16_t)0xF0FF;               /* 0xFFF0 = -16 */
+  gain_s16_swapped(s, 2, &g);
+  check_integer((uint16_t)s[0], 0x0008);
+  check_integer((uint16_t)s[1], 0xF8FF);
+  /* Swapping, in place and not */
+  for(i = 0; i < 67; ++i)
+    s[i] = (int16_t)(i * 977 - 32768);
+  gain_swap_s16(o, s, 67);
+  for(i = 0; i < 67; ++i)
+    check_integer((uint16_t)o[i], (uint16_t)(((uint16_t)s[i] >> 8)
+                                             | ((uint16_t)s[i] << 8)));
+  gain_swap_s16(o, o, 67);
+  for(i = 0; i < 67; ++i)
+    check_integer(o[i], s[i]);
+  /* Byte-swapped samples must match native ones, including the vector
+   * kernels */
+  gain_init(&g, 3.3);
+  gain_swap_s16(o, s, 67);
+  gain_s16(s, 67, &g);
+  gain_s16_swapped(o, 67, &g);
+  gain_swap_s16(o, o, 67);
+  for(i = 0; i < 67; ++i)
+    check_integer(o[i], s[i]);
+  /* 8-bit unsigned */
+  gain_init(&g, -6.0206);
+  u[0] = 128; u[1] = 255; u[2] = 0;
+  gain_u8(u, 3, &g);
+  check_integer(u[0], 128);
+  check_integer(u[1], 192);
+  check_integer(u[2], 64);
+  gain_init(&g, 24);
+  u[0] = 129; u[1] = 255; u[2] = 0;
+  gain_u8(u, 3, &g);
+  check_integer(u[0], 144);
+  check_integer(u[1], 255);
+  check_integer(u[2], 0);
+  /* Floating point */
+  gain_init(&g, 6);
+  for(i = 0; i < 9; ++i)
+    f[i] = i - 4.0;
+  gain_float(f, 9, &g);
+  for(i = 0; i < 9; ++i)
+    insist(f[i] == (float)(i - 4.0) * g.factor);
+  /* Mixing, again against the definition */
+  for(n = 0; n <= GAIN_MIX_ONE; n += GAIN_MIX_ONE / 8) {
+    int16_t d[67], m[67];
+
+    for(i = 0; i < 67; ++i) {
+      o[i] = m[i] = (int16_t)(i * 977 - 32768);
+      d[i] = (int16_t)(32767 - i * 541);
+    }
+    memcpy(s, d, sizeof s);
+    gain_mix_s16(s, m, 67, GAIN_MIX_ONE - n, n);
+    for(i = 0; i < 67; ++i)
+      check_integer(s[i], ref_clip((d[i] * (double)(GAIN_MIX_ONE - n)
+                                    + o[i] * (double)n) / GAIN_MIX_ONE));
+  }
+  /* Mixing saturates */
+  s[0] = 30000; o[0] = 30000;
+  gain_mix_s16(s, o, 1, GAIN_MIX_ONE, GAIN_MIX_ONE);
+  check_integer(s[0], 32767);
+  {
+    int16_t d[67], m[67], ds[67], ms[67];
+
+    for(i = 0; i < 67; ++i) {
+      m[i] = (int16_t)(i * 977 - 32768);
+      d[i] = (int16_t)(32767 - i * 541);
+    }
+    gain_swap_s16(ds, d, 67);
+    gain_swap_s16(ms, m, 67);
+    gain_mix_s16(d, m, 67, GAIN_MIX_ONE / 3, GAIN_MIX_ONE);
+    gain_mix_s16_swapped(ds, ms, 67, GAIN_MIX_ONE / 3, GAIN_MIX_ONE);
+    gain_swap_s16(ds, ds, 67);
+    for(i = 0; i < 67; ++i)
+      check_integer(ds[i], d[i]);
+  }
+  s[0] = 0x0010; o[0] = 0x0020;         /* 4096 and 8192, swapped */
+  gain_mix_s16_swapped(s, o, 1, GAIN_MIX_ONE / 2, GAIN_MIX_ONE / 2);
+  check_integer((uint16_t)s[0], 0x0018);
+  u[0] = 255; u[1] = 0; u[2] = 128;
+  {
+    static const uint8_t v[3] = { 255, 128, 128 };
+    gain_mix_u8(u, v, 3, GAIN_MIX_ONE / 2, GAIN_MIX_ONE / 2);
+  }
+  check_integer(u[0], 255);
+  check_integer(u[1], 64);
+  check_integer(u[2], 128);
+  /* Scaling and mixing in one go matches the definition, rounded once */
+  {
+    static const double fdbs[][2] = {
+      { -6, 3.3 }, { 0, -20 }, { 24, -0.5 }, { 6, 6 },
+    };
+    struct gain g2;
+    int16_t d[67], m[67], ds[67], ms[67];
+
+    for(n = 0; n < sizeof fdbs / sizeof *fdbs; ++n) {
+      const int a = GAIN_MIX_ONE / 3, b = GAIN_MIX_ONE - a;
+
+      gain_init(&g, fdbs[n][0]);
+      gain_init(&g2, fdbs[n][1]);
+      for(i = 0; i < 67; ++i) {
+        o[i] = m[i] = (int16_t)(i * 977 - 32768);
+        s[i] = d[i] = (int16_t)(32767 - i * 541);
+      }
+      gain_swap_s16(ds, d, 67);
+      gain_swap_s16(ms, m, 67);
+      gain_fade(s, m, 67, 16, 1, &g, &g2, a, b);
+      gain_fade(ds, ms, 67, 16, 0, &g, &g2, a, b);
+      gain_swap_s16(ds, ds, 67);
+      for(i = 0; i < 67; ++i) {
+        check_integer(s[i],
+                      ref_clip((d[i] * ((double)g.mul / (1 << g.shift)) * a
+                                + o[i] * ((double)g2.mul / (1 << g2.shift))
+                                * b) / GAIN_MIX_ONE));
+        check_integer(ds[i], s[i]);
+      }
+    }
+    /* Unity gains are just a mix */
+    gain_init(&g, 0);
+    s[0] = 0x0010; o[0] = 0x0020;
+    gain_fade(s, o, 1, 16, 0, &g, &g, GAIN_MIX_ONE / 2, GAIN_MIX_ONE / 2);
+    check_integer((uint16_t)s[0], 0x0018);
+    gain_init(&g, -6.0206);
+    u[0] = 255; u[1] = 0; u[2] = 128;
+    {
+      static const uint8_t v[3] = { 255, 128, 0 };
+      gain_fade(u, v, 3, 8, 1, &g, &g, GAIN_MIX_ONE / 2, GAIN_MIX_ONE / 2);
+    }
+    check_integer(u[0], 192);
+    check_integer(u[1], 96);
+    check_integer(u[2], 96);
+  }
+  /* Dispatch */
+  gain_init(&g, -6.0206);
+  s[0] = 1000;
+  gain_apply(s, 1, 16, 1, &g);
+  check_integer(s[0], 500);
+}
+
+TEST(gain);
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
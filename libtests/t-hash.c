@@ -17,6 +17,8 @@
  */
 #include "test.h"
 
+#define NKEYS 20000
+
 static int count;
 
 static int test_hash_callback(const char attribute((unused)) *key,
@@ -31,10 +33,22 @@ static int test_hash_callback(const char attribute((unused)) *key,
     return 0;
 }
 
+static int test_hash_remove_callback(const char *key,
+                                     void *value,
+                                     void *u) {
+  /* Remove every odd-numbered entry as it is visited */
+  if(*(int *)value % 2)
+    insist(hash_remove(u, key) == 0);
+  ++count;
+  return 0;
+}
+
 static void test_hash(void) {
   hash *h;
-  int i, *ip;
+  int i, j, *ip;
   char **keys;
+  static int present[NKEYS];
+  size_t n;
 
   h = hash_new(sizeof(int));
   for(i = 0; i < 10000; ++i)
@@ -63,6 +77,60 @@ static void test_hash(void) {
   for(i = 0; i < 10000; ++i)
     insist(hash_remove(h, do_printf("%d", i)) == 0);
   check_integer(hash_count(h), 0);
+  insist(hash_remove(h, "0") == -1);
+  insist(hash_find(h, "0") == 0);
+
+  /* Add modes, and values that stay put as the table grows */
+  h = hash_new(sizeof(int));
+  insist(hash_add(h, "x", NULL, HASH_REPLACE) == -1);
+  insist(hash_add(h, "x", NULL, HASH_INSERT) == 0);
+  insist((ip = hash_find(h, "x")) != 0);
+  check_integer(*ip, 0);
+  insist(hash_add(h, "x", NULL, HASH_INSERT) == -1);
+  i = 7;
+  insist(hash_add(h, "x", &i, HASH_INSERT_OR_REPLACE) == 0);
+  check_integer(*ip, 7);
+  /* Interleave insertions, lookups and removals while big tables are part
+   * way through being moved */
+  memset(present, 0, sizeof present);
+  for(i = 0; i < NKEYS; ++i) {
+    insist(hash_add(h, do_printf("%d", i), &i, HASH_INSERT) == 0);
+    present[i] = 1;
+    if(i % 3 == 0) {
+      j = random() % (i + 1);
+      check_integer(hash_remove(h, do_printf("%d", j)), present[j] ? 0 : -1);
+      present[j] = 0;
+    }
+    j = random() % (i + 1);
+    ip = hash_find(h, do_printf("%d", j));
+    insist((ip != 0) == present[j]);
+    if(ip)
+      check_integer(*ip, j);
+  }
+  check_integer(*(int *)hash_find(h, "x"), 7);
+  insist(hash_remove(h, "x") == 0);
+  for(n = i = 0; i < NKEYS; ++i) {
+    ip = hash_find(h, do_printf("%d", i));
+    insist((ip != 0) == present[i]);
+    if(ip)
+      check_integer(*ip, i);
+    n += present[i];
+  }
+  check_integer(hash_count(h), n);
+  /* Removal from inside hash_foreach() */
+  h = hash_new(sizeof(int));
+  for(i = 0; i < 1000; ++i)
+    insist(hash_add(h, do_printf("%d", i), &i, HASH_INSERT) == 0);
+  count = 0;
+  check_integer(hash_foreach(h, test_hash_remove_callback, h), 0);
+  check_integer(count, 1000);
+  check_integer(hash_count(h), 500);
+  for(i = 0; i < 1000; ++i)
+    insist((hash_find(h, do_printf("%d", i)) == 0) == (i % 2));
+  keys = hash_keys(h);
+  for(i = 0; keys[i]; ++i)
+    ;
+  check_integer(i, 500);
 }
 
 TEST(hash);
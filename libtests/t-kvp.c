@@ -17,6 +17,14 @@
  */
 #include "test.h"
 
+static struct kvp *prepend(struct kvp *k, const char *name,
+                           const char *value) {
+  struct kvp *nk = kvp_make(name, value, (char *)0);
+
+  nk->next = k;
+  return nk;
+}
+
 static void test_kvp(void) {
   struct kvp *k;
   size_t n;
@@ -68,6 +76,54 @@ static void test_kvp(void) {
                (char *)0);
   check_string(kvp_urlencode(k, &n),
                "blit=blat&wibble=");
+  /* packing */
+  {
+    char *p;
+    char big[300];
+
+    memset(big, 'x', sizeof big - 1);
+    big[sizeof big - 1] = 0;
+    k = kvp_make("_path", "/a/b&c",
+                 "unusual key", big,
+                 "tags", "",
+                 (char *)0);
+    p = kvp_pack(k, &n);
+    insist(kvp_is_packed(p, n));
+    insist(!kvp_is_packed("_path=x", 7));
+    check_string(kvp_urlencode(kvp_unpack(p, n), 0),
+                 kvp_urlencode(k, 0));
+    check_string(kvp_packed_get(p, n, "_path"), "/a/b&c");
+    check_string(kvp_packed_get(p, n, "unusual key"), big);
+    check_string(kvp_packed_get(p, n, "tags"), "");
+    insist(kvp_packed_get(p, n, "weight") == 0);
+    insist(kvp_unpack(p, 2) == 0);
+    /* truncated records decode as far as they go */
+    insist(kvp_unpack(p, n - 1)->next->next == 0);
+    check_string(kvp_get(kvp_unpack("a=b&c=d", 7), "c"), "d");
+    check_string(kvp_packed_get("a=b&c=d", 7, "a"), "b");
+  }
+
+  /* indexed lookup, short and long, with a duplicate name */
+  for(n = 1; n <= 64; n *= 4) {
+    struct kvp_index ki;
+    size_t m;
+
+    /* the later "dup" is hidden by the earlier one */
+    k = kvp_make("dup", "last", (char *)0);
+    for(m = 0; m < n; ++m) {
+      if(m == n / 2)
+        k = prepend(k, "dup", "first");
+      k = prepend(k, do_printf("name%zu", m), do_printf("value%zu", m));
+    }
+    kvp_index_init(&ki, k);
+    for(m = 0; m < n; ++m)
+      check_string(kvp_index_get(&ki, do_printf("name%zu", m)),
+                   kvp_get(k, do_printf("name%zu", m)));
+    check_string(kvp_index_get(&ki, "dup"), kvp_get(k, "dup"));
+    insist(kvp_index_get(&ki, "absent") == 0);
+    insist(kvp_index_get(&ki, "") == 0);
+    insist(kvp_index_get(&ki, "zzz") == 0);
+  }
 }
 
 TEST(kvp);
@@ -0,0 +1,86 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "test.h"
+#include "loudness.h"
+
+#include <math.h>
+
+/** @brief Add a 1KHz stereo tone to a measurement
+ * @param l Measurement
+ * @param rate Sample rate
+ * @param dbfs Level
+ * @param seconds Duration
+ */
+static void tone(struct loudness *l, int rate, double dbfs, int seconds) {
+  int16_t buffer[2 * 1024];
+  const double a = 32767 * pow(10.0, dbfs / 20);
+  long n, total = (long)rate * seconds;
+  size_t f;
+
+  for(n = 0; n < total;) {
+    for(f = 0; f < 1024 && n < total; ++f, ++n)
+      buffer[2 * f] = buffer[2 * f + 1] = lround(a * sin(2 * M_PI * 1000
+                                                         * n / rate));
+    loudness_add(l, buffer, f, 0);
+  }
+}
+
+static void test_loudness(void) {
+  struct loudness *l = xmalloc(sizeof *l);
+  int16_t silence[2 * 1024];
+  long result;
+  int n;
+
+  /* EBU Tech 3341 case 1: -23dBFS tone is -23LUFS */
+  loudness_init(l, 48000, 2);
+  tone(l, 48000, -23, 20);
+  check_integer(loudness_result(l, &result), 0);
+  insist(result >= -2310 && result <= -2290);
+
+  /* The same at 44.1KHz */
+  loudness_init(l, 44100, 2);
+  tone(l, 44100, -23, 20);
+  check_integer(loudness_result(l, &result), 0);
+  insist(result >= -2310 && result <= -2290);
+
+  /* EBU Tech 3341 case 3: quiet parts fall below the relative gate */
+  loudness_init(l, 48000, 2);
+  tone(l, 48000, -36, 10);
+  tone(l, 48000, -23, 60);
+  tone(l, 48000, -36, 10);
+  check_integer(loudness_result(l, &result), 0);
+  insist(result >= -2310 && result <= -2290);
+
+  /* Silence has no loudness */
+  loudness_init(l, 44100, 2);
+  memset(silence, 0, sizeof silence);
+  for(n = 0; n < 100; ++n)
+    loudness_add(l, silence, 1024, 0);
+  check_integer(loudness_result(l, &result), -1);
+}
+
+TEST(loudness);
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -199,6 +199,27 @@ static void test_macros(void) {
               "yes\n", 0);
   check_macro("include2", "@include{t-macros-2}",
               "wibble\n", 0);
+  /* Parse trees are reused until the file changes */
+  {
+    const struct mx_node *m1, *m2;
+    FILE *fp;
+
+    insist((fp = fopen("t-macros.tmp", "w")) != 0);
+    fprintf(fp, "one\n");
+    fclose(fp);
+    check_macro("include4", "@include{./t-macros.tmp}", "one\n", 0);
+    m1 = mx_parse_file("./t-macros.tmp");
+    m2 = mx_parse_file("./t-macros.tmp");
+    insist(m1 == m2);
+    ++tests;
+    insist((fp = fopen("t-macros.tmp", "w")) != 0);
+    fprintf(fp, "three\n");
+    fclose(fp);
+    check_macro("include5", "@include{./t-macros.tmp}", "three\n", 0);
+    insist(mx_parse_file("./t-macros.tmp") != m1);
+    ++tests;
+    remove("t-macros.tmp");
+  }
   fprintf(stderr, ">>> expect error message about t-macros-nonesuch:\n");
   check_macro("include3", "<@include{t-macros-nonesuch}>",
               "<[[cannot find 't-macros-nonesuch']]>", 0);
@@ -0,0 +1,74 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "test.h"
+#include "ogg.h"
+
+static void test_ogg(void) {
+  struct ogg_stream s;
+  unsigned char data[555], page[OGG_HEADER_MAX + sizeof data], copy[4];
+  size_t lengths[2], big, len;
+  static const unsigned char lacing[] = { 255, 45, 255, 0 };
+  uint32_t crc;
+  int n;
+
+  check_integer(ogg_crc(0, "123456789", 9), 0x89A1897F);
+  check_integer(ogg_crc(ogg_crc(0, "1234", 4), "56789", 5), 0x89A1897F);
+
+  s.serial = 0x12345678;
+  s.sequence = 7;
+  for(n = 0; n < (int)sizeof data; ++n)
+    data[n] = n;
+  lengths[0] = 300;
+  lengths[1] = 255;
+  len = ogg_page(&s, OGG_BOS, 0x0102030405060708ULL, data, lengths, 2, page);
+  check_integer(len, 27 + 4 + sizeof data);
+  insist(!memcmp(page, "OggS", 4));
+  check_integer(page[4], 0);
+  check_integer(page[5], OGG_BOS);
+  for(n = 0; n < 8; ++n)
+    check_integer(page[6 + n], 8 - n);
+  check_integer(page[14], 0x78);
+  check_integer(page[17], 0x12);
+  check_integer(page[18], 7);
+  check_integer(page[26], 4);
+  insist(!memcmp(page + 27, lacing, sizeof lacing));
+  insist(!memcmp(page + 31, data, sizeof data));
+  check_integer(s.sequence, 8);
+  /* The CRC covers the whole page with the CRC field zeroed */
+  memcpy(copy, page + 22, 4);
+  memset(page + 22, 0, 4);
+  crc = ogg_crc(0, page, len);
+  check_integer(copy[0] | copy[1] << 8 | copy[2] << 16
+                | (uint32_t)copy[3] << 24, crc);
+
+  /* 257 lacing values is too many */
+  big = 255 * 256;
+  check_integer(ogg_page(&s, 0, 0, data, &big, 1, page), 0);
+  check_integer(s.sequence, 8);
+}
+
+TEST(ogg);
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
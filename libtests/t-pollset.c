@@ -0,0 +1,101 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "test.h"
+#include "pollset.h"
+
+static void test_pollset(void) {
+  struct pollset *ps = pollset_new();
+  struct pollset_event ev[8];
+  int p1[2], p2[2], n;
+  static int tag1, tag2;
+  char c;
+
+  xpipe(p1);
+  xpipe(p2);
+  /* Nothing to wait for */
+  check_integer(pollset_wait(ps, ev, 8, 0), 0);
+  insist(pollset_set(ps, p1[0], POLLSET_READ, &tag1) == 0);
+  insist(pollset_set(ps, p2[0], POLLSET_READ, &tag2) == 0);
+  check_integer(pollset_get(ps, p1[0]), POLLSET_READ);
+  check_integer(pollset_get(ps, p1[1]), 0);
+  check_integer(pollset_get(ps, 1000), 0);
+  /* Nothing readable yet */
+  check_integer(pollset_wait(ps, ev, 8, 0), 0);
+  /* Make the second pipe readable */
+  insist(write(p2[1], "x", 1) == 1);
+  n = pollset_wait(ps, ev, 8, 1000);
+  check_integer(n, 1);
+  if(n == 1) {
+    check_integer(ev[0].fd, p2[0]);
+    check_integer(ev[0].events, POLLSET_READ);
+    insist(ev[0].data == &tag2);
+  }
+  /* Interest persists */
+  check_integer(pollset_wait(ps, ev, 8, 0), 1);
+  /* ...until it is removed */
+  insist(pollset_set(ps, p2[0], 0, NULL) == 0);
+  check_integer(pollset_get(ps, p2[0]), 0);
+  check_integer(pollset_wait(ps, ev, 8, 0), 0);
+  /* Re-adding picks it up again, with the new data pointer */
+  insist(pollset_set(ps, p2[0], POLLSET_READ, &tag1) == 0);
+  n = pollset_wait(ps, ev, 8, 0);
+  check_integer(n, 1);
+  if(n == 1)
+    insist(ev[0].data == &tag1);
+  insist(read(p2[0], &c, 1) == 1);
+  check_integer(pollset_wait(ps, ev, 8, 0), 0);
+  /* Write interest */
+  insist(pollset_set(ps, p1[1], POLLSET_WRITE, &tag2) == 0);
+  n = pollset_wait(ps, ev, 8, 0);
+  check_integer(n, 1);
+  if(n == 1) {
+    check_integer(ev[0].fd, p1[1]);
+    check_integer(ev[0].events, POLLSET_WRITE);
+  }
+  /* Modifying interest in place */
+  insist(pollset_set(ps, p1[1], 0, NULL) == 0);
+  insist(pollset_set(ps, p2[1], POLLSET_WRITE, &tag2) == 0);
+  insist(pollset_set(ps, p2[1], POLLSET_READ, &tag2) == 0);
+  check_integer(pollset_wait(ps, ev, 8, 0), 0);
+  /* EOF counts as readable */
+  xclose(p1[1]);
+  n = pollset_wait(ps, ev, 8, 1000);
+  check_integer(n, 1);
+  if(n == 1)
+    check_integer(ev[0].fd, p1[0]);
+  /* Invalid file descriptors are rejected */
+  insist(pollset_set(ps, -1, POLLSET_READ, NULL) < 0);
+  pollset_set(ps, p1[0], 0, NULL);
+  pollset_set(ps, p2[0], 0, NULL);
+  pollset_set(ps, p2[1], 0, NULL);
+  xclose(p1[0]);
+  xclose(p2[0]);
+  xclose(p2[1]);
+  pollset_free(ps);
+}
+
+TEST(pollset);
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -33,7 +33,7 @@ static void test_printf(void) {
   ssize_t ssz;
   ptrdiff_t p;
   char *cp;
-  char buffer[16];
+  char buffer[16], ibuf[BYTE_ITOA_SIZE];
   FILE *fp;
   
   check_string(do_printf("%d", 999), "999");
@@ -172,6 +172,19 @@ static void test_printf(void) {
   check_integer(byte_sinkprintf(sink_error(), "%-2d", 0), -1);
   check_integer(byte_sinkprintf(sink_error(), "%-d", -1), -1);
   check_integer(byte_sinkprintf(sink_error(), "%-#x", 10), -1);
+  check_integer(byte_sinkprintf(sink_error(), "%300s", ""), -1);
+  i = byte_asprintf(&cp, "%250s%s%250s|", "a", "b", "c");
+  insist(i == 502);
+  check_integer(strlen(cp), 502);
+  insist(cp[249] == 'a' && cp[250] == 'b' && cp[500] == 'c');
+
+  check_string(byte_itoa(ibuf, 0), "0");
+  check_string(byte_itoa(ibuf, 999), "999");
+  check_string(byte_itoa(ibuf, -1), "-1");
+  check_string(byte_itoa(ibuf, INTMAX_MAX),
+               do_printf("%jd", INTMAX_MAX));
+  check_string(byte_itoa(ibuf, INTMAX_MIN),
+               do_printf("%jd", INTMAX_MIN));
 
 }
 
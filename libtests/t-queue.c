@@ -0,0 +1,84 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "test.h"
+#include "queue.h"
+
+/** @brief Count unmarshalling errors */
+static void queue_error(const char attribute((unused)) *msg, void *u) {
+  ++*(int *)u;
+}
+
+static void test_queue(void) {
+  static const char marshalled[] =
+    " expected 1357924680 id OgWcgs6QuJZtVcT3NBzH8A origin picked"
+    " played 1357924601 sofar 79 state started submitter rjk"
+    " track \"/jukebox/Pink Floyd/The Wall/01:In the Flesh?.ogg\""
+    " when 1357924000 wstat 0";
+  struct queue_entry *q = xmalloc(sizeof *q), *r = xmalloc(sizeof *r);
+  struct arena a[1];
+  int nerrors = 0;
+
+  insist(!queue_unmarshall(q, marshalled, queue_error, &nerrors));
+  check_string(q->id, "OgWcgs6QuJZtVcT3NBzH8A");
+  check_string(q->track, "/jukebox/Pink Floyd/The Wall/01:In the Flesh?.ogg");
+  check_string(q->submitter, "rjk");
+  insist(q->scratched == 0);
+  check_integer(q->state, playing_started);
+  check_integer(q->origin, origin_picked);
+  check_integer(q->when, 1357924000);
+  check_integer(q->expected, 1357924680);
+  check_integer(q->sofar, 79);
+  check_integer(q->pid, -1);
+  check_string(queue_marshall(q), marshalled);
+  arena_init(a);
+  check_string(queue_marshall_arena(q, a), marshalled);
+  check_string(queue_marshall_unexpected(q),
+               strchr(marshalled + 10, ' '));
+
+  /* Awkward strings survive the round trip */
+  q->scratched = xstrdup("\"quoted\" \\ 'and'\nnewline");
+  q->submitter = xstrdup("");
+  insist(!queue_unmarshall(r, queue_marshall(q), queue_error, &nerrors));
+  check_string(r->scratched, q->scratched);
+  check_string(r->submitter, "");
+  check_string(queue_marshall(r), queue_marshall(q));
+
+  /* Keys in any order are accepted */
+  insist(!queue_unmarshall(r, " when 7 track x id y state ok", queue_error, &nerrors));
+  check_integer(r->when, 7);
+  check_string(r->track, "x");
+  check_string(r->id, "y");
+  check_integer(r->state, playing_ok);
+
+  insist(queue_unmarshall(r, " id", queue_error, &nerrors) < 0);
+  insist(queue_unmarshall(r, " wibble wobble", queue_error, &nerrors) < 0);
+  insist(queue_unmarshall(r, " state wobble", queue_error, &nerrors) < 0);
+  insist(queue_unmarshall(r, " id \"unterminated", queue_error, &nerrors) < 0);
+  check_integer(nerrors, 4);
+}
+
+TEST(queue);
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -19,8 +19,9 @@
 
 static void test_regsub(void) {
   regexp *re;
-  char errstr[RXCERR_LEN];
+  char errstr[RXCERR_LEN], pat[16];
   size_t erroffset;
+  int n;
 
   check_integer(regsub_flags(""), 0);
   check_integer(regsub_flags("g"), REGSUB_GLOBAL);
@@ -62,6 +63,23 @@ static void test_regsub(void) {
                "foo-x:bbb/aaaa:y-bar");
   check_string(regsub(re, "foo-aAaAbBb-bar", "x:$2$$$1:y", 0),
                "foo-x:bBb$aAaA:y-bar");
+
+  /* Cached patterns */
+  re = regexp_compile_cached("b+", 0, errstr, sizeof(errstr), &erroffset);
+  assert(re != 0);
+  insist(regexp_compile_cached("b+", 0, errstr, sizeof(errstr), &erroffset)
+         == re);
+  insist(regexp_compile_cached("b+", RXF_CASELESS,
+                               errstr, sizeof(errstr), &erroffset) != re);
+  insist(regexp_compile_cached("(", 0, errstr, sizeof(errstr), &erroffset)
+         == 0);
+  for(n = 0; n < 40; ++n) {
+    byte_snprintf(pat, sizeof pat, "x%d", n);
+    re = regexp_compile_cached(pat, 0, errstr, sizeof(errstr), &erroffset);
+    assert(re != 0);
+    byte_snprintf(pat, sizeof pat, "-x%d-", n);
+    check_string(regsub(re, pat, "y", 0), "-y-");
+  }
 }
 
 TEST(regsub);
@@ -16,6 +16,9 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "test.h"
+
+#include <math.h>
+
 #include "resample.h"
 #include "vector.h"
 
@@ -162,6 +165,96 @@ static void test_resample(void) {
     }
     ++tests;
   }
+  /* Small ratio adjustments */
+  {
+    struct resampler rs[1];
+
+    resample_init(rs, 16, 2, 44100, 1, ENDIAN_NATIVE,
+                  16, 2, 44100, 1, ENDIAN_NATIVE);
+#if HAVE_SAMPLERATE_H
+    const size_t input_bytes = 44100 * 4;
+    size_t output_bytes;
+
+    insist(resample_set_ratio(rs, 1.01) == 0);
+    convert(rs, xcalloc(input_bytes, 1), input_bytes, &output_bytes);
+    insist(output_bytes > input_bytes);
+    insist(output_bytes <= input_bytes * 101 / 100 + 4);
+#else
+    insist(resample_set_ratio(rs, 1.01) == -1);
+#endif
+    resample_close(rs);
+  }
+  /* Rate conversion of a sine wave */
+  {
+    struct resampler rs[1];
+    struct dynstr d[1];
+    int16_t *input = xcalloc(44100, sizeof *input);
+    size_t n, chunk, consumed, worst = 0;
+
+    for(n = 0; n < 44100; ++n)
+      input[n] = 16384 * sin(2 * M_PI * 1000 * n / 44100.0);
+    resample_init(rs, 16, 1, 44100, 1, ENDIAN_NATIVE,
+                  16, 1, 48000, 1, ENDIAN_NATIVE);
+    dynstr_init(d);
+    for(n = 0; n < 44100; n += consumed / 2) {
+      chunk = 44100 - n > 1000 ? 1000 : 44100 - n;
+      consumed = resample_convert(rs, (const uint8_t *)(input + n), 2 * chunk,
+                                  n + chunk == 44100, converted, d);
+    }
+    const int16_t *output = (const int16_t *)d->vec;
+    const size_t noutput = d->nvec / 2;
+    insist(noutput >= 48000 - 16);
+    insist(noutput <= 48000 + 16);
+    /* Away from the ends the output should be the same sine wave */
+    for(n = 100; n < 47900 && n < noutput; ++n) {
+      const double expected = 16384 * sin(2 * M_PI * 1000 * n / 48000.0);
+      const size_t error = fabs(output[n] - expected);
+      if(error > worst)
+        worst = error;
+    }
+    insist(worst < 64);
+    resample_close(rs);
+    /* Converting into a fixed buffer should give the same output, less
+     * whatever is still in the filter at the end */
+    int16_t fixed[4096];
+    size_t nfixed = 0, produced;
+
+    resample_init(rs, 16, 1, 44100, 1, ENDIAN_NATIVE,
+                  16, 1, 48000, 1, ENDIAN_NATIVE);
+    resample_reserve(rs, 1000);
+    for(n = 0; n < 44100 && nfixed < 2048; n += consumed / 2) {
+      consumed = resample_convert_fixed(rs, (const uint8_t *)(input + n),
+                                        2 * (44100 - n),
+                                        (uint8_t *)(fixed + nfixed),
+                                        sizeof fixed - 2 * nfixed,
+                                        &produced);
+      nfixed += produced / 2;
+      insist(consumed > 0);
+    }
+    insist(nfixed >= 2048);
+    insist(nfixed <= 4096);
+    insist(!memcmp(fixed, output, 2048 * sizeof *fixed));
+    resample_close(rs);
+  }
+  /* Converting channels into a fixed buffer */
+  {
+    struct resampler rs[1];
+    static const int16_t mono[] = { 1, -2, 3, -4, 5 };
+    int16_t stereo[8];
+    size_t consumed, produced;
+
+    resample_init(rs, 16, 1, 44100, 1, ENDIAN_NATIVE,
+                  16, 2, 44100, 1, ENDIAN_NATIVE);
+    resample_reserve(rs, 4);
+    consumed = resample_convert_fixed(rs, (const uint8_t *)mono, sizeof mono,
+                                      (uint8_t *)stereo, sizeof stereo,
+                                      &produced);
+    insist(consumed == 4 * sizeof *mono);
+    insist(produced == sizeof stereo);
+    insist(stereo[0] == 1 && stereo[1] == 1);
+    insist(stereo[6] == -4 && stereo[7] == -4);
+    resample_close(rs);
+  }
 }
 
 TEST(resample);
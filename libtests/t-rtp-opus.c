@@ -0,0 +1,195 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "test.h"
+#include "rtp-opus.h"
+
+#include <arpa/inet.h>
+#include <math.h>
+
+/** @brief Packets collected by framed() */
+struct framed_log {
+  int count;
+  uint32_t timestamps[64];
+  int markers[64];
+  int16_t first[64];
+#if HAVE_OPUS_OPUS_H
+  OpusEncoder *encoder;
+  OpusDecoder *decoder;
+  struct rtp_opus_upsampler upsampler;
+  double in_energy, out_energy;
+#endif
+};
+
+static void framed(struct rtp_opus_framer *f, void *u) {
+  struct framed_log *l = u;
+
+  insist(f->fill == RTP_OPUS_FRAMES);
+  if(l->count < 64) {
+    l->timestamps[l->count] = f->timestamp;
+    l->markers[l->count] = f->marker;
+    l->first[l->count] = f->pcm[0];
+  }
+#if HAVE_OPUS_OPUS_H
+  if(l->encoder) {
+    unsigned char data[RTP_OPUS_MAX_BYTES];
+    uint16_t out[2 * RTP_OPUS_FRAMES];
+    int nbytes, n;
+
+    nbytes = rtp_opus_encode(l->encoder, &l->upsampler, f->pcm, data);
+    insist(nbytes > 0 && nbytes <= RTP_OPUS_MAX_BYTES);
+    check_integer(rtp_opus_decode(l->decoder, data, nbytes, out),
+                  RTP_OPUS_CODEC_FRAMES);
+    /* Skip the first few packets, while the codec gets going */
+    if(l->count >= 4)
+      for(n = 0; n < 2 * RTP_OPUS_FRAMES; ++n) {
+        const double a = f->pcm[n], b = (int16_t)ntohs(out[n]);
+
+        l->in_energy += a * a;
+        l->out_energy += b * b;
+      }
+  }
+#endif
+  ++l->count;
+}
+
+/* Feed packets of 352 stereo frames, numbered by sample, starting at
+ * sample *pos and timestamp ts */
+static void feed(struct rtp_opus_framer *f, struct framed_log *l,
+                 uint32_t ts, int npackets, int marker, long *pos) {
+  int16_t data[2 * 352];
+  int p, n;
+
+  for(p = 0; p < npackets; ++p) {
+    for(n = 0; n < 2 * 352; ++n) {
+      const long s = *pos + n;
+
+      data[n] = htons((int16_t)(8000 * sin(2 * M_PI * 1000 * (s / 2)
+                                          / 44100.0)));
+    }
+    rtp_opus_frame(f, data, 2 * 352, ts, marker && !p, framed, l);
+    *pos += 2 * 352;
+    ts += 2 * 352;
+  }
+}
+
+static void test_rtp_opus(void) {
+  struct rtp_opus_upsampler u;
+  int16_t in[2 * RTP_OPUS_FRAMES], mid[2 * RTP_OPUS_CODEC_FRAMES];
+  int16_t out[2 * RTP_OPUS_FRAMES];
+  int n, f, d;
+
+  /* A constant signal stays constant, except right at the start where it is
+   * interpolated from silence */
+  rtp_opus_upsampler_init(&u, 2);
+  for(n = 0; n < 2 * RTP_OPUS_FRAMES; ++n)
+    in[n] = n % 2 ? -12345 : 321;
+  rtp_opus_upsample(&u, in, mid);
+  for(n = 4; n < 2 * RTP_OPUS_CODEC_FRAMES; ++n)
+    check_integer(mid[n], n % 2 ? -12345 : 321);
+  rtp_opus_upsample(&u, in, mid);
+  for(n = 0; n < 2 * RTP_OPUS_CODEC_FRAMES; ++n)
+    check_integer(mid[n], n % 2 ? -12345 : 321);
+  rtp_opus_downsample(mid, out, 2);
+  for(n = 0; n < 2 * RTP_OPUS_FRAMES; ++n)
+    check_integer(out[n], n % 2 ? -12345 : 321);
+
+  /* Interpolation is exact for a ramp, so a round trip reproduces the input,
+   * one frame late and give or take rounding; the ramp deliberately runs
+   * across packet boundaries. */
+  rtp_opus_upsampler_init(&u, 1);
+  for(f = 0; f < 4; ++f) {
+    for(n = 0; n < RTP_OPUS_FRAMES; ++n)
+      in[n] = (f * RTP_OPUS_FRAMES + n) * 8 - 14000;
+    rtp_opus_upsample(&u, in, mid);
+    rtp_opus_downsample(mid, out, 1);
+    for(n = f ? 0 : 2; n < RTP_OPUS_FRAMES; ++n) {
+      d = out[n] - ((f * RTP_OPUS_FRAMES + n - 1) * 8 - 14000);
+      insist(d >= -1 && d <= 1);
+    }
+  }
+
+  /* Framing: 352-frame packets are collected into 882-frame ones whose
+   * timestamps step by 2 * 882 samples */
+  struct rtp_opus_framer fr;
+  struct framed_log l;
+  long pos = 0;
+
+  memset(&l, 0, sizeof l);
+  rtp_opus_framer_init(&fr, 2);
+  feed(&fr, &l, 1000, 10, 1, &pos);
+  check_integer(l.count, 10 * 352 / 882);
+  for(n = 0; n < l.count; ++n) {
+    check_integer(l.timestamps[n], 1000 + n * 2 * RTP_OPUS_FRAMES);
+    check_integer(l.markers[n], n == 0);
+  }
+  /* A jump in the timestamps abandons the partial packet and starts again
+   * from the new timestamp */
+  f = l.count;
+  feed(&fr, &l, 50000, 5, 0, &pos);
+  check_integer(l.count, f + 5 * 352 / 882);
+  check_integer(l.timestamps[f], 50000);
+  check_integer(l.markers[f], 0);
+  /* A marker does too, and is passed on */
+  f = l.count;
+  feed(&fr, &l, 60000, 3, 1, &pos);
+  check_integer(l.count, f + 1);
+  check_integer(l.timestamps[f], 60000);
+  check_integer(l.markers[f], 1);
+  /* After a reset the next packet starts afresh even though the timestamps
+   * are contiguous */
+  rtp_opus_framer_reset(&fr);
+  f = l.count;
+  feed(&fr, &l, 60000 + 3 * 2 * 352, 3, 0, &pos);
+  check_integer(l.count, f + 1);
+  check_integer(l.timestamps[f], 60000 + 3 * 2 * 352);
+
+#if HAVE_OPUS_OPUS_H
+  /* Round trip through real Opus; framing as above, and the decoded audio
+   * should carry about the same energy as the input */
+  int err;
+
+  memset(&l, 0, sizeof l);
+  l.encoder = opus_encoder_create(RTP_OPUS_CODEC_RATE, 2,
+                                  OPUS_APPLICATION_AUDIO, &err);
+  insist(l.encoder != NULL);
+  l.decoder = opus_decoder_create(RTP_OPUS_CODEC_RATE, 2, &err);
+  insist(l.decoder != NULL);
+  rtp_opus_upsampler_init(&l.upsampler, 2);
+  rtp_opus_framer_init(&fr, 2);
+  pos = 0;
+  feed(&fr, &l, 0, 50, 0, &pos);
+  check_integer(l.count, 50 * 352 / 882);
+  for(n = 0; n < l.count; ++n)
+    check_integer(l.timestamps[n], n * 2 * RTP_OPUS_FRAMES);
+  insist(l.out_energy > l.in_energy * 0.5);
+  insist(l.out_energy < l.in_energy * 1.5);
+  opus_encoder_destroy(l.encoder);
+  opus_decoder_destroy(l.decoder);
+#endif
+}
+
+TEST(rtp_opus);
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
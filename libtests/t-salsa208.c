@@ -46,6 +46,25 @@ static void test_salsa208(void) {
                 "41f4e1e0db3ef6f2",
                 "d3df3ab24ce7ef617148fdd461757d81b1b3abecb808b4e3ebb542675597c0ab6a4ae3888a7717a8eb2f80b8a3ca33e8c4280757b2f71d409c8618ee50648e35810dfdcbb3ad9436368fde5e645ef019",
                 "3132381a28814d1989bcf09656e64a0ee8c6dd723a3ba5f6a02111f86f5156321ea7300976b2393821d44c425754f6cc08b755ea07287cc77fead40c581259d24d127880b7597fc6a9ea8fba89dd3f4c");
+
+  /* long runs are generated several blocks at a time; check they match the
+   * stream taken a few bytes at a time */
+  {
+    uint8_t whole[4093], pieces[sizeof whole];
+    size_t n, m;
+
+    salsa208_setkey(ac, Kbytes, Klen);
+    salsa208_setnonce(ac, Nbytes, Nlen);
+    salsa208_stream(ac, 0, whole, 3);
+    salsa208_stream(ac, 0, whole + 3, sizeof whole - 3);
+    salsa208_setkey(ac, Kbytes, Klen);
+    salsa208_setnonce(ac, Nbytes, Nlen);
+    for(n = 0; n < sizeof pieces; n += m) {
+      m = sizeof pieces - n < 7 ? sizeof pieces - n : 7;
+      salsa208_stream(ac, 0, pieces + n, m);
+    }
+    insist(!memcmp(whole, pieces, sizeof whole));
+  }
 }
 
 TEST(salsa208);
@@ -17,9 +17,59 @@
  */
 #include "test.h"
 
+/** @brief Check that split_inplace() and split_fixed() agree with split() */
+static void check_inplace(struct arena *a, const char *s, unsigned flags) {
+  char **v, **w, *t = xstrdup(s), *f[4], *g = xstrdup(s);
+  int nv, nw, nf, n;
+
+  v = split(s, &nv, flags, 0, 0);
+  w = split_inplace(a, t, &nw, flags, 0, 0);
+  nf = split_fixed(g, f, 3, flags, 0, 0);
+  if(!v) {
+    insist(w == 0);
+    check_string(t, s);
+    check_integer(nf, -1);
+    check_string(g, s);
+    return;
+  }
+  insist(w != 0);
+  check_integer(nw, nv);
+  for(n = 0; n < nv; ++n)
+    check_string(w[n], v[n]);
+  insist(w[nv] == 0);
+  if(nv > 3) {
+    check_integer(nf, -1);
+    check_string(g, s);
+    return;
+  }
+  check_integer(nf, nv);
+  for(n = 0; n < nv; ++n)
+    check_string(f[n], v[n]);
+  insist(f[nv] == 0);
+}
+
 static void test_split(void) {
+  static const char *const inplace[] = {
+    "",
+    "   ",
+    "wibble",
+    "   wibble \t\r\n wobble   ",
+    "wibble wobble #splat",
+    "\"wibble wobble\" #splat",
+    "\"wibble \\\"\\nwobble\"",
+    "'wibble' \"wobble\"splat",
+    "wib\"ble wob'ble",
+    "\"\" ''",
+    "\"misquoted",
+    "'misquoted\\",
+    "'misquoted\\\"",
+    "'mis\\escaped'",
+    "one two three four",
+  };
   char **v;
   int nv;
+  size_t n;
+  struct arena a[1];
 
   insist(split("\"misquoted", &nv, SPLIT_COMMENTS|SPLIT_QUOTES, 0, 0) == 0);
   insist(split("\'misquoted", &nv, SPLIT_COMMENTS|SPLIT_QUOTES, 0, 0) == 0);
@@ -83,6 +133,36 @@ static void test_split(void) {
   check_string(quoteutf8("wibble\nwobble"), "\"wibble\\nwobble\"");
   check_string(quoteutf8("wibble\\wobble"), "\"wibble\\\\wobble\"");
   check_string(quoteutf8("wibble'wobble"), "\"wibble'wobble\"");
+  arena_init(a);
+  check_string(quoteutf8_arena(a, "wibble"), "wibble");
+  check_string(quoteutf8_arena(a, "wibble wobble"), "\"wibble wobble\"");
+  check_string(quoteutf8_arena(a, "wibble\nwobble"), "\"wibble\\nwobble\"");
+
+  {
+    static const char *const quoted[] = {
+      "wibble", "", "  wibble  ", "wibble\"wobble", "wibble\nwobble",
+      "wibble\\wobble", "wibble'wobble", "#", "\"\\\n",
+    };
+    struct dynstr d;
+    char buffer[32], *end;
+
+    for(n = 0; n < sizeof quoted / sizeof *quoted; ++n) {
+      dynstr_init(&d);
+      insist(quoteutf8_sink(sink_dynstr(&d), quoted[n]) >= 0);
+      dynstr_terminate(&d);
+      check_string(d.vec, quoteutf8(quoted[n]));
+      check_integer(quoteutf8_size(quoted[n]), strlen(d.vec));
+      end = quoteutf8_copy(buffer, quoted[n]);
+      check_string(buffer, d.vec);
+      insist(end == buffer + strlen(buffer));
+    }
+  }
+
+  for(n = 0; n < sizeof inplace / sizeof *inplace; ++n) {
+    check_inplace(a, inplace[n], SPLIT_COMMENTS|SPLIT_QUOTES);
+    check_inplace(a, inplace[n], SPLIT_QUOTES);
+    check_inplace(a, inplace[n], SPLIT_COMMENTS);
+  }
 }
 
 TEST(split);
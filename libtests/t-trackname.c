@@ -26,13 +26,43 @@
 			  a, (sizeof a) - 1) == -(EXPECTED));	\
 } while(0)
 
+static int sign(int n) {
+  return n < 0 ? -1 : n > 0;
+}
+
+#define CHECK_KEY_ORDER(A,B) do {                                       \
+  size_t na, nb;                                                        \
+  char *ka = track_collation_key(A[0], A[1], A[2], &na);                \
+  char *kb = track_collation_key(B[0], B[1], B[2], &nb);                \
+  insist(sign(compare_collation_keys(ka, na, kb, nb))                   \
+         == sign(compare_tracks(A[0], B[0], A[1], B[1], A[2], B[2])));  \
+} while(0)
+
 static void test_trackname(void) {
+  static const char *const tracks[][3] = {
+    { "abc", "abc", "/x/abc.ogg" },
+    { "ABC", "ABC", "/x/ABC.ogg" },
+    { "abc", "abd", "/x/abc.ogg" },
+    { "ab", "ab", "/x/ab.ogg" },
+    { "abc", "abc", "/x/y/abc.ogg" },
+    { "abc", "abc", "/x-/abc.ogg" },
+    { "abc", "abc", "/x" },
+    { "\xC3\xA9t\xC3\xA9", "\xC3\xA9t\xC3\xA9", "/x/ete.ogg" },
+    { "\xC3\x89T\xC3\x89", "\xC3\x89T\xC3\x89", "/x/ETE.ogg" },
+    { "", "", "/" },
+  };
+  const size_t ntracks = sizeof tracks / sizeof *tracks;
+
+
   CHECK_PATH_ORDER("/a/b", "/aa/", -1);
   CHECK_PATH_ORDER("/a/b", "/a", 1);
   CHECK_PATH_ORDER("/ab", "/a", 1);
   CHECK_PATH_ORDER("/ab", "/aa", 1);
   CHECK_PATH_ORDER("/aa", "/aa", 0);
   CHECK_PATH_ORDER("/", "/", 0);
+  for(size_t i = 0; i < ntracks; ++i)
+    for(size_t j = 0; j < ntracks; ++j)
+      CHECK_KEY_ORDER(tracks[i], tracks[j]);
 }
 
 TEST(trackname);
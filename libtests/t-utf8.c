@@ -129,6 +129,16 @@ static void test_utf8(void) {
   insist(!validutf8("\xF0\x80\x80\xC0"));
   insist(!validutf8("\xF5\x80\x80\x80"));
   insist(!validutf8("\xF8"));
+
+  /* runs of ASCII either side of other characters, at various alignments */
+  U8("abcdefgh\xC2\x80ijklmnopqrstuvw\xF4\x8F\xBF\xBFxyz",
+     "0x61 0x62 0x63 0x64 0x65 0x66 0x67 0x68 0x80 0x69 0x6a 0x6b 0x6c "
+     "0x6d 0x6e 0x6f 0x70 0x71 0x72 0x73 0x74 0x75 0x76 0x77 0x10FFFF "
+     "0x78 0x79 0x7a");
+  insist(!validutf8("abcdefghijklmnopqrstuvw\x80"));
+  insist(!validutf8("abcdefghijklmnop\xE0\x80\x80qrstuvwxyz"));
+  insist(!validutf8("abcdefg\xC2"));
+  insist(!utf8_to_utf32("abcdefghijklmnopqrstuvw\x80", 24, 0));
 }
 
 TEST(utf8);
@@ -36,12 +36,14 @@
 #include <setjmp.h>
 
 #include "mem.h"
+#include "arena.h"
 #include "log.h"
 #include "vector.h"
 #include "charset.h"
 #include "mime.h"
 #include "hex.h"
 #include "heap.h"
+#include "fenwick.h"
 #include "unicode.h"
 #include "inputline.h"
 #include "wstat.h"
@@ -27,43 +27,154 @@
 #include <syslog.h>
 #include <errno.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <unistd.h>
 
 #include <disorder.h>
 
+/** @brief A directory being read */
+struct scan_dir {
+  /** @brief Directory stream */
+  DIR *dp;
+
+  /** @brief Length of its name in @ref scan_path */
+  size_t len;
+};
+
+/** @brief Name of the current directory entry */
+static char *scan_path;
+
+/** @brief Space available at @ref scan_path */
+static size_t scan_size;
+
+/** @brief Put @p name after the first @p len bytes of @ref scan_path
+ * @return New length of @ref scan_path
+ */
+static size_t scan_append(size_t len, const char *name) {
+  const size_t n = strlen(name);
+
+  if(len + n + 2 > scan_size) {
+    while(len + n + 2 > scan_size)
+      scan_size = scan_size ? 2 * scan_size : 1024;
+    scan_path = disorder_realloc_noptr(scan_path, scan_size);
+  }
+  scan_path[len] = '/';
+  memcpy(scan_path + len + 1, name, n + 1);
+  return len + n + 1;
+}
+
+/** @brief Find out what sort of object a directory entry is
+ * @param fd Directory containing the entry
+ * @param de Directory entry
+ * @return @c S_IFDIR, @c S_IFREG, or 0 for anything else or on error
+ *
+ * Where the directory entry records the type there is no need to stat it.
+ * Symbolic links are followed.
+ */
+static int scan_type(int fd, const struct dirent *de) {
+  struct stat sb;
+
+#ifdef DT_UNKNOWN
+  switch(de->d_type) {
+  case DT_DIR: return S_IFDIR;
+  case DT_REG: return S_IFREG;
+  case DT_UNKNOWN: case DT_LNK: break;
+  default: return 0;
+  }
+#endif
+  if(fstatat(fd, de->d_name, &sb, 0) < 0) {
+    disorder_error(errno, "cannot stat %s", scan_path);
+    return 0;
+  }
+  if(S_ISDIR(sb.st_mode)) return S_IFDIR;
+  if(S_ISREG(sb.st_mode)) return S_IFREG;
+  return 0;
+}
+
+/** @brief List the tracks below @p path
+ *
+ * Directories are opened relative to their parents and the names of their
+ * entries built up in a single buffer, so the cost of each entry is a
+ * readdir() and, for files, an access check.
+ */
 void disorder_scan(const char *path) {
   struct stat sb;
-  DIR *dp;
+  struct scan_dir *stack = 0;
+  size_t depth = 0, stack_size = 0, len;
   struct dirent *de;
-  char *np;
+  DIR *dp;
+  int fd, subfd;
 
   if(stat(path, &sb) < 0) {
     disorder_error(errno, "cannot stat %s", path);
     return;
   }
-  if(S_ISDIR(sb.st_mode)) {
-    if(!(dp = opendir(path))) {
-      disorder_error(errno, "cannot open directory %s", path);
-      return;
-    }
-    while((errno = 0),
-	  (de = readdir(dp))) {
-      if(de->d_name[0] != '.') {
-	disorder_asprintf(&np, "%s/%s", path, de->d_name);
-	disorder_scan(np);
-      }
-    }
-    if(errno)
-      disorder_error(errno, "error reading directory %s", path);
-    closedir(dp);
-  } else if(S_ISREG(sb.st_mode)) {
+  if(S_ISREG(sb.st_mode)) {
     if(access(path, R_OK) < 0) {
       disorder_error(errno, "cannot access file %s", path);
       return;
     }
     if(printf("%s%c", path, 0) < 0)
       disorder_fatal(errno, "error writing to scanner output pipe");
+    return;
+  }
+  if(!S_ISDIR(sb.st_mode))
+    return;
+  if(!(dp = opendir(path))) {
+    disorder_error(errno, "cannot open directory %s", path);
+    return;
+  }
+  len = strlen(path);
+  scan_size = len + 1024;
+  scan_path = disorder_malloc_noptr(scan_size);
+  memcpy(scan_path, path, len + 1);
+  for(;;) {
+    if(depth == stack_size) {
+      stack_size = stack_size ? 2 * stack_size : 16;
+      stack = disorder_realloc(stack, stack_size * sizeof *stack);
+    }
+    stack[depth].dp = dp;
+    stack[depth].len = len;
+    ++depth;
+    /* Read directories until we find a subdirectory or run out */
+    dp = 0;
+    while(!dp && depth) {
+      struct scan_dir *const sd = &stack[depth - 1];
+
+      errno = 0;
+      if(!(de = readdir(sd->dp))) {
+        if(errno) {
+          scan_path[sd->len] = 0;
+          disorder_error(errno, "error reading directory %s", scan_path);
+        }
+        closedir(sd->dp);
+        --depth;
+        continue;
+      }
+      if(de->d_name[0] == '.')
+        continue;
+      len = scan_append(sd->len, de->d_name);
+      fd = dirfd(sd->dp);
+      switch(scan_type(fd, de)) {
+      case S_IFDIR:
+        if((subfd = openat(fd, de->d_name, O_RDONLY|O_DIRECTORY)) < 0
+           || !(dp = fdopendir(subfd))) {
+          disorder_error(errno, "cannot open directory %s", scan_path);
+          if(subfd >= 0)
+            close(subfd);
+        }
+        break;
+      case S_IFREG:
+        if(faccessat(fd, de->d_name, R_OK, 0) < 0)
+          disorder_error(errno, "cannot access file %s", scan_path);
+        else if(printf("%s%c", scan_path, 0) < 0)
+          disorder_fatal(errno, "error writing to scanner output pipe");
+        break;
+      }
+    }
+    if(!dp)
+      break;
   }
 }
 
@@ -41,61 +41,172 @@
 
 #define END ((void *)0)
 
+/* How many discoverers to run at once for a batch. */
+#define NDISCO 4
+
 static GstDiscoverer *disco = 0;
 
-long disorder_tracklength(const char UNUSED *track, const char *path) {
-  GError *err = 0;
-  gchar *dir = 0, *abs = 0, *uri = 0;
-  GstDiscovererInfo *info = 0;
-  long length = -1;
-  GstClockTime t;
+/* A batch of tracks, shared between its discoverers. */
+struct batch {
+  int ntracks, next, running;
+  const char *const *paths;
+  void (*callback)(int n, long length, void *u);
+  void *u;
+  GMainLoop *loop;
+};
 
-  if (!path) goto end;
+/* A discoverer working on a batch, and the track it's currently probing. */
+struct worker {
+  struct batch *b;
+  GstDiscoverer *disco;
+  int n;
+};
 
-  if(!disco) {
-    gst_init(0, 0);
-    disco = gst_discoverer_new(5*GST_SECOND, &err); if(!disco) goto end;
-  }
+static gchar *path_uri(const char *path, GError **err) {
+  gchar *dir, *abs, *uri;
 
   if (g_path_is_absolute(path))
-    uri = g_filename_to_uri(path, 0, &err);
-  else {
-    dir = g_get_current_dir();
-    abs = g_build_filename(dir, path, END);
-    uri = g_filename_to_uri(abs, 0, &err);
-  }
-  if(!uri) goto end;
+    return g_filename_to_uri(path, 0, err);
+  dir = g_get_current_dir();
+  abs = g_build_filename(dir, path, END);
+  uri = g_filename_to_uri(abs, 0, err);
+  g_free(dir); g_free(abs);
+  return uri;
+}
+
+/* Work out the length from what the discoverer told us.  Either of INFO and
+ * ERR may be null.  Doesn't free anything.
+ */
+static long info_length(const char *path,
+                        GstDiscovererInfo *info, const GError *err) {
+  GstClockTime t;
 
-  info = gst_discoverer_discover_uri(disco, uri, &err); if(!info) goto end;
-  switch(gst_discoverer_info_get_result(info)) {
+  if(info) switch(gst_discoverer_info_get_result(info)) {
   case GST_DISCOVERER_OK:
     t = gst_discoverer_info_get_duration(info);
-    length = (t + GST_SECOND/2)/GST_SECOND;
-    break;
+    return (t + GST_SECOND/2)/GST_SECOND;
   case GST_DISCOVERER_TIMEOUT:
     disorder_info("discovery timed out probing `%s'", path);
-    goto swallow_error;
+    return 0;
   case GST_DISCOVERER_MISSING_PLUGINS:
     disorder_info("unrecognized file `%s' (missing plugins?)", path);
-    goto swallow_error;
-  swallow_error:
-    if(err) { g_error_free(err); err = 0; }
-    length = 0;
-    break;
+    return 0;
   default:
-    goto end;
+    break;
   }
-
-end:
-  if(err) {
+  if(err)
     disorder_error(0, "error probing `%s': %s", path, err->message);
-    g_error_free(err);
+  return -1;
+}
+
+long disorder_tracklength(const char UNUSED *track, const char *path) {
+  GError *err = 0;
+  gchar *uri = 0;
+  GstDiscovererInfo *info = 0;
+  long length;
+
+  if (!path) return -1;
+
+  if(!disco) {
+    gst_init(0, 0);
+    disco = gst_discoverer_new(5*GST_SECOND, &err);
   }
+  if(disco && (uri = path_uri(path, &err)) != 0)
+    info = gst_discoverer_discover_uri(disco, uri, &err);
+  length = info_length(path, info, err);
+
+  if(err) g_error_free(err);
   if(info) gst_discoverer_info_unref(info);
-  g_free(dir); g_free(abs); g_free(uri);
+  g_free(uri);
   return length;
 }
 
+/* Give the worker the next track that we can make a URI for.  Returns
+ * nonzero if it has one.
+ */
+static int next_uri(struct worker *w) {
+  struct batch *b = w->b;
+  GError *err = 0;
+  gchar *uri;
+  gboolean ok;
+  int n;
+
+  while(b->next < b->ntracks) {
+    n = b->next++;
+    if(!b->paths[n]) { b->callback(n, -1, b->u); continue; }
+    uri = path_uri(b->paths[n], &err);
+    if(!uri) {
+      b->callback(n, info_length(b->paths[n], 0, err), b->u);
+      g_error_free(err); err = 0;
+      continue;
+    }
+    w->n = n;
+    ok = gst_discoverer_discover_uri_async(w->disco, uri);
+    g_free(uri);
+    if(ok) return 1;
+    b->callback(n, -1, b->u);
+  }
+  return 0;
+}
+
+static void discovered(GstDiscoverer UNUSED *d, GstDiscovererInfo *info,
+                       GError *err, gpointer p) {
+  struct worker *w = p;
+  struct batch *b = w->b;
+
+  b->callback(w->n, info_length(b->paths[w->n], info, err), b->u);
+  next_uri(w);
+}
+
+static void finished(GstDiscoverer UNUSED *d, gpointer p) {
+  struct worker *w = p;
+
+  if(!--w->b->running) g_main_loop_quit(w->b->loop);
+}
+
+/* Probe the tracks with several discoverers in parallel, each taking the
+ * next track as soon as it's done with its last one.
+ */
+void disorder_tracklength_batch(int ntracks,
+                                const char *const UNUSED *tracks,
+                                const char *const *paths,
+                                void (*callback)(int n, long length, void *u),
+                                void *u) {
+  struct batch b;
+  struct worker w[NDISCO];
+  GError *err = 0;
+  int i, nw;
+
+  gst_init(0, 0);
+  b.ntracks = ntracks; b.next = 0; b.running = 0;
+  b.paths = paths; b.callback = callback; b.u = u;
+  b.loop = g_main_loop_new(0, FALSE);
+
+  for(nw = 0; nw < NDISCO && b.next < ntracks; nw++) {
+    w[nw].b = &b;
+    w[nw].disco = gst_discoverer_new(5*GST_SECOND, &err);
+    if(!w[nw].disco) {
+      disorder_error(0, "error making discoverer: %s", err->message);
+      g_error_free(err); err = 0;
+      break;
+    }
+    g_signal_connect(w[nw].disco, "discovered",
+                     G_CALLBACK(discovered), &w[nw]);
+    g_signal_connect(w[nw].disco, "finished", G_CALLBACK(finished), &w[nw]);
+    gst_discoverer_start(w[nw].disco);
+    if(next_uri(&w[nw])) b.running++;
+  }
+  if(b.running) g_main_loop_run(b.loop);
+
+  for(i = 0; i < nw; i++) {
+    gst_discoverer_stop(w[i].disco);
+    g_object_unref(w[i].disco);
+  }
+  /* Anything we never got round to. */
+  for(; b.next < ntracks; b.next++) callback(b.next, -1, u);
+  g_main_loop_unref(b.loop);
+}
+
 #ifdef STANDALONE
 int main(int argc, char *argv[]) {
   int i;
@@ -17,6 +17,11 @@
  */
 /** @file plugins/tracklength-mp3.c
  * @brief Compute track lengths for MP3 files
+ *
+ * Most files can be dealt with just by reading their first few kilobytes:
+ * the first frame usually holds a Xing, Info or VBRI header giving the number
+ * of frames, and failing that an ID3v2 TLEN frame may give the length
+ * directly.  Only if neither is present is the whole file scanned.
  */
 #include "tracklength.h"
 #include <mad.h>
@@ -50,11 +55,136 @@ error:
   return 0;
 }
 
+/** @brief How much of the file to read looking for a frame header */
+#define PROBE_SIZE 8192
+
+/** @brief How much of an ID3v2 tag to search for TLEN */
+#define TAG_PROBE_SIZE 65536
+
+/** @brief Read a big-endian 32-bit value */
+static inline unsigned long be32(const unsigned char *p) {
+  return (unsigned long)p[0] << 24 | (unsigned long)p[1] << 16
+    | p[2] << 8 | p[3];
+}
+
+/** @brief Read a 28-bit "syncsafe" integer */
+static inline unsigned long syncsafe(const unsigned char *p) {
+  return (unsigned long)(p[0] & 0x7f) << 21 | (p[1] & 0x7f) << 14
+    | (p[2] & 0x7f) << 7 | (p[3] & 0x7f);
+}
+
+/** @brief Find the length from an ID3v2 TLEN frame
+ * @param tag ID3v2 tag, starting with its header
+ * @param n Bytes available at @p tag
+ * @return Length in seconds, or -1
+ */
+static long tl_mp3_tlen(const unsigned char *tag, size_t n) {
+  const int version = tag[3];
+  const size_t idlen = version == 2 ? 3 : 4, header = version == 2 ? 6 : 10;
+  size_t pos = 10, size;
+  unsigned long ms = 0;
+  int digits = 0;
+
+  if(tag[5] & 0x80)                     /* unsynchronized; rare */
+    return -1;
+  if(version >= 3 && (tag[5] & 0x40) && n >= 14)
+    /* Skip an extended header */
+    pos += version == 3 ? 4 + be32(tag + 10) : syncsafe(tag + 10);
+  while(pos + header <= n && tag[pos]) {
+    const unsigned char *frame = tag + pos;
+
+    if(version == 2)
+      size = frame[3] << 16 | frame[4] << 8 | frame[5];
+    else if(version == 3)
+      size = be32(frame + 4);
+    else
+      size = syncsafe(frame + 4);
+    if(!memcmp(frame, version == 2 ? "TLE" : "TLEN", idlen)) {
+      if(pos + header + size > n)
+        return -1;
+      /* An encoding byte then digits; the digits may be UTF-16 */
+      for(size_t i = 1; i < size; ++i) {
+        const unsigned char c = frame[header + i];
+        if(c >= '0' && c <= '9') {
+          ms = 10 * ms + c - '0';
+          ++digits;
+        } else if(c && c != 0xFF && c != 0xFE)
+          break;
+      }
+      return digits && ms ? (long)((ms + 999) / 1000) : -1;
+    }
+    pos += header + size;
+  }
+  return -1;
+}
+
+/** @brief Compute a length from the start of the file only
+ * @param path Path to file
+ * @return Length in seconds, or -1 if the whole file must be scanned
+ */
+static long tl_mp3_header(const char *path) {
+  static unsigned char probe[TAG_PROBE_SIZE];
+  struct mad_stream stream[1];
+  struct mad_header header[1];
+  const unsigned char *tag;
+  unsigned long frames = 0, samples;
+  long tlen = -1, seconds = -1;
+  off_t start = 0;
+  ssize_t n;
+  int fd, side;
+
+  if((fd = open(path, O_RDONLY)) < 0)
+    return -1;
+  n = pread(fd, probe, PROBE_SIZE, 0);
+  if(n >= 10 && !memcmp(probe, "ID3", 3)) {
+    /* Look for TLEN in the tag, then skip over it */
+    start = 10 + syncsafe(probe + 6) + (probe[5] & 0x10 ? 10 : 0);
+    n = pread(fd, probe, start < TAG_PROBE_SIZE ? start : TAG_PROBE_SIZE, 0);
+    if(n >= 10)
+      tlen = tl_mp3_tlen(probe, n);
+    n = pread(fd, probe, PROBE_SIZE, start);
+  }
+  close(fd);
+  if(n <= 0)
+    return tlen;
+  mad_stream_init(stream);
+  mad_header_init(header);
+  mad_stream_buffer(stream, probe, n);
+  while(mad_header_decode(header, stream))
+    if(!MAD_RECOVERABLE(stream->error)) {
+      mad_stream_finish(stream);
+      return tlen;
+    }
+  /* A Xing or Info header follows the side information */
+  if(header->flags & MAD_FLAG_LSF_EXT)
+    side = header->mode == MAD_MODE_SINGLE_CHANNEL ? 9 : 17;
+  else
+    side = header->mode == MAD_MODE_SINGLE_CHANNEL ? 17 : 32;
+  tag = stream->this_frame + 4 + side;
+  if(tag + 12 <= probe + n
+     && (!memcmp(tag, "Xing", 4) || !memcmp(tag, "Info", 4))
+     && (be32(tag + 4) & 1))
+    frames = be32(tag + 8);
+  /* A VBRI header is always 32 bytes in */
+  tag = stream->this_frame + 4 + 32;
+  if(!frames && tag + 18 <= probe + n && !memcmp(tag, "VBRI", 4))
+    frames = be32(tag + 14);
+  if(frames && header->samplerate) {
+    samples = frames * 32 * MAD_NSBSAMPLES(header);
+    seconds = (samples + header->samplerate - 1) / header->samplerate;
+  }
+  mad_stream_finish(stream);
+  return seconds >= 0 ? seconds : tlen;
+}
+
 long tl_mp3(const char *path) {
   size_t length;
   void *base;
   buffer b;
+  long seconds;
 
+  if((seconds = tl_mp3_header(path)) >= 0)
+    return seconds;
   if(!(base = mmap_file(path, &length))) return -1;
   b.duration = mad_timer_zero;
   scan_mp3(base, length, &b);
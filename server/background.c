@@ -21,6 +21,314 @@
 
 #include "disorder-server.h"
 
+/* Pre-forked helpers ------------------------------------------------------ */
+
+/** @brief A pre-forked helper process
+ *
+ * Forking the server can be slow since it is a large process.  So we keep a
+ * few children forked in advance, each waiting on a socket for the details of
+ * a track.  When one is needed play_background() just sends it a message and
+ * it carries on exactly as a freshly forked child would.  The pool is topped
+ * up again shortly afterwards.
+ *
+ * Being children of the server the helpers can be waited for and killed just
+ * like any other player.
+ */
+struct helper {
+  /** @brief Next helper */
+  struct helper *next;
+
+  /** @brief Process ID */
+  pid_t pid;
+
+  /** @brief Our end of the control socket */
+  int fd;
+};
+
+/** @brief Idle helpers */
+static struct helper *helpers;
+
+/** @brief Number of idle helpers */
+static int nhelpers;
+
+/** @brief Pending refill of the helper pool */
+static ev_timeout_handle helpers_refill_handle;
+
+/** @brief Largest request we'll send to a helper */
+#define HELPER_MAX_REQUEST 16384
+
+/** @brief Body of a helper process
+ * @param fd Control socket
+ * @return Exit code
+ *
+ * A request consists of a pointer to the child function followed by
+ * null-terminated strings: the queue ID, the track, the raw path, the module
+ * name, "1" or "0" for @ref pbgc_params::direct, the decimal
+ * @ref queue_entry::resume offset, and then the player arguments.  The log
+ * file descriptor, if any, is passed with it.
+ *
+ * The function pointer is valid here since we are a fork of the server.
+ */
+static int helper_main(int fd) {
+  static char buffer[HELPER_MAX_REQUEST];
+  char control[CMSG_SPACE(sizeof(int))];
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  play_background_child_fn *child;
+  struct queue_entry *q;
+  struct pbgc_params params[1];
+  static const char *fields[HELPER_MAX_REQUEST / 2];
+  size_t nfields = 0, i;
+  ssize_t n;
+
+  memset(&msg, 0, sizeof msg);
+  iov.iov_base = buffer;
+  iov.iov_len = sizeof buffer;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof control;
+  while((n = recvmsg(fd, &msg, 0)) < 0 && errno == EINTR)
+    ;
+  if(n < 0)
+    disorder_fatal(errno, "error reading helper request");
+  if(n == 0)
+    return 0;                           /* pool discarded */
+  xclose(fd);
+  /* Pick up the log file descriptor */
+  for(cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      int lfd;
+
+      memcpy(&lfd, CMSG_DATA(cmsg), sizeof lfd);
+      xdup2(lfd, 1);
+      xdup2(lfd, 2);
+      xclose(lfd);
+    }
+  /* Unpack the request */
+  if((size_t)n < sizeof child || buffer[n - 1])
+    disorder_fatal(0, "malformed helper request");
+  memcpy(&child, buffer, sizeof child);
+  for(i = sizeof child; i < (size_t)n; i += strlen(buffer + i) + 1)
+    fields[nfields++] = buffer + i;
+  if(nfields < 6)
+    disorder_fatal(0, "malformed helper request");
+  q = xmalloc(sizeof *q);
+  q->id = fields[0];
+  q->track = fields[1];
+  q->resume = strtol(fields[5], NULL, 10);
+  if(!(q->pl = open_plugin(fields[3], 0)))
+    return 1;
+  q->type = play_get_type(q->pl);
+  memset(params, 0, sizeof params);
+  params->rawpath = fields[2];
+  params->direct = !strcmp(fields[4], "1");
+  params->argc = nfields - 6;
+  params->argv = fields + 6;
+  return child(q, params, NULL);
+}
+
+/** @brief Called when an idle helper terminates */
+static int helper_exited(ev_source attribute((unused)) *ev,
+                         pid_t pid,
+                         int status,
+                         const struct rusage attribute((unused)) *rusage,
+                         void *u) {
+  struct helper *h = u, **hh;
+
+  if(status)
+    disorder_error(0, "helper %lu %s", (unsigned long)pid, wstat(status));
+  for(hh = &helpers; *hh && *hh != h; hh = &(*hh)->next)
+    ;
+  if(*hh) {
+    *hh = h->next;
+    --nhelpers;
+    xclose(h->fd);
+  }
+  return 0;
+}
+
+/** @brief Fork a new helper
+ * @param ev Event loop
+ * @return 0 on success, -1 on error
+ */
+static int helper_spawn(ev_source *ev) {
+  struct helper *h;
+  int sp[2], fd, maxfd;
+  pid_t pid;
+
+  if(socketpair(PF_UNIX, SOCK_DGRAM, 0, sp) < 0) {
+    disorder_error(errno, "error calling socketpair");
+    return -1;
+  }
+  switch(pid = fork()) {
+  case 0:
+    /* Child of disorderd */
+    exitfn = _exit;
+    progname = "disorderd-helper";
+    ev_signal_atfork(ev);
+    signal(SIGPIPE, SIG_DFL);
+    setpgid(0, 0);
+    /* We might sit around for a long time so we mustn't hold on to the
+     * server's file descriptors, in particular client connections. */
+    maxfd = sysconf(_SC_OPEN_MAX);
+    for(fd = 3; fd < maxfd; ++fd)
+      if(fd != sp[1])
+        close(fd);
+    _exit(helper_main(sp[1]));
+  case -1:
+    disorder_error(errno, "error calling fork");
+    xclose(sp[0]);
+    xclose(sp[1]);
+    return -1;
+  }
+  /* See play_background() for why we do this in both processes */
+  setpgid(pid, pid);
+  xclose(sp[1]);
+  cloexec(sp[0]);
+  h = xmalloc(sizeof *h);
+  h->pid = pid;
+  h->fd = sp[0];
+  h->next = helpers;
+  helpers = h;
+  ++nhelpers;
+  ev_child(ev, pid, 0, helper_exited, h);
+  D(("helper %lu ready", (unsigned long)pid));
+  return 0;
+}
+
+/** @brief Top up the helper pool
+ * @param ev Event loop
+ * @param now Current time
+ * @param u Not used
+ * @return 0
+ */
+static int helpers_refill(ev_source *ev,
+                          const struct timeval attribute((unused)) *now,
+                          void attribute((unused)) *u) {
+  helpers_refill_handle = 0;
+  while(nhelpers < config->player_pool)
+    if(helper_spawn(ev))
+      break;
+  return 0;
+}
+
+/** @brief Arrange for the helper pool to be topped up soon
+ * @param ev Event loop
+ *
+ * This is done from a timeout so that forking new helpers doesn't delay
+ * whatever we're doing now.
+ */
+static void helpers_schedule_refill(ev_source *ev) {
+  struct timeval when;
+
+  if(helpers_refill_handle)
+    return;
+  xgettimeofday(&when, NULL);
+  when.tv_sec += 1;
+  ev_timeout(ev, &helpers_refill_handle, &when, helpers_refill, NULL);
+}
+
+/** @brief Hand a track to an idle helper
+ * @param ev Event loop
+ * @param player Pointer to player information
+ * @param q Track to play or decode
+ * @param child Function to run in the helper
+ * @param params Child parameters
+ * @param lfd Log file descriptor or -1
+ * @return 0 on success, -1 if no helper was available
+ */
+static int helper_run(ev_source *ev,
+                      const struct stringlist *player,
+                      struct queue_entry *q,
+                      play_background_child_fn *child,
+                      const struct pbgc_params *params,
+                      int lfd) {
+  struct dynstr d[1];
+  struct helper *h;
+  char control[CMSG_SPACE(sizeof(int))];
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  int n;
+  ssize_t written;
+  char resume[32];
+
+  if(!helpers)
+    return -1;
+  dynstr_init(d);
+  dynstr_append_bytes(d, (const char *)&child, sizeof child);
+  dynstr_append_bytes(d, q->id, strlen(q->id) + 1);
+  dynstr_append_bytes(d, q->track, strlen(q->track) + 1);
+  dynstr_append_bytes(d, params->rawpath, strlen(params->rawpath) + 1);
+  dynstr_append_bytes(d, player->s[1], strlen(player->s[1]) + 1);
+  dynstr_append_bytes(d, params->direct ? "1" : "0", 2);
+  snprintf(resume, sizeof resume, "%ld", q->resume);
+  dynstr_append_bytes(d, resume, strlen(resume) + 1);
+  for(n = 0; n < params->argc; ++n)
+    dynstr_append_bytes(d, params->argv[n], strlen(params->argv[n]) + 1);
+  if(d->nvec > HELPER_MAX_REQUEST)
+    return -1;
+  memset(&msg, 0, sizeof msg);
+  iov.iov_base = d->vec;
+  iov.iov_len = d->nvec;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  if(lfd != -1) {
+    memset(control, 0, sizeof control);
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof control;
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof lfd);
+    memcpy(CMSG_DATA(cmsg), &lfd, sizeof lfd);
+  }
+  /* Whatever happens, this helper is no longer idle */
+  h = helpers;
+  helpers = h->next;
+  --nhelpers;
+  ev_child_cancel(ev, h->pid);
+  helpers_schedule_refill(ev);
+  while((written = sendmsg(h->fd, &msg, 0)) < 0 && errno == EINTR)
+    ;
+  xclose(h->fd);
+  if(written < 0) {
+    disorder_error(errno, "error sending request to helper");
+    /* Closing the socket will have made it exit; make sure it's reaped */
+    ev_child(ev, h->pid, 0, helper_exited, h);
+    return -1;
+  }
+  q->pid = h->pid;
+  D(("helper %lu running %s", (unsigned long)h->pid, q->track));
+  return 0;
+}
+
+/** @brief Reset the helper pool
+ * @param ev Event loop
+ *
+ * Existing helpers were forked with the old configuration, so they are
+ * discarded; closing their control sockets makes them exit.  Then the pool is
+ * refilled.
+ */
+void helpers_reset(ev_source *ev) {
+  struct helper *h;
+
+  while((h = helpers)) {
+    helpers = h->next;
+    --nhelpers;
+    xclose(h->fd);
+  }
+  if(helpers_refill_handle) {
+    ev_timeout_cancel(ev, helpers_refill_handle);
+    helpers_refill_handle = 0;
+  }
+  helpers_refill(ev, NULL, NULL);
+}
+
+/* Background processes ---------------------------------------------------- */
+
 /** @brief Fork the player or decoder for @p q
  * @param ev Event loop
  * @param player Pointer to player information
@@ -46,6 +354,26 @@ int play_background(ev_source *ev,
    * they might not be normalized and if they are they might not be normalized
    * to the same canonical form as DisOrder uses.) */
   params->rawpath = trackdb_rawpath(q->track);
+  /* Parse player arguments */
+  int optc = player->n - 2;
+  const char **optv = (const char **)&player->s[2];
+  while(optc > 0 && optv[0][0] == '-') {
+    if(!strcmp(optv[0], "--")) {
+      ++optv;
+      --optc;
+      break;
+    }
+    if(!strcmp(optv[0], "--direct"))
+      params->direct = 1;
+    else {
+      disorder_error(0, "unknown option %s", optv[0]);
+      return START_HARDFAIL;
+    }
+    ++optv;
+    --optc;
+  }
+  params->argc = optc;
+  params->argv = optv;
   /* Call the prefork function in the player module.  None of the built-in
    * modules use this so it's not well tested, unfortunately. */
   if(q->type & DISORDER_PLAYER_PREFORK)
@@ -55,27 +383,21 @@ int play_background(ev_source *ev,
     }
   /* Capture the player/decoder's stderr and feed it into our logs.
    *
-   * Use the second arg as the tag if available (it's probably a command name),
-   * otherwise the module name. */
+   * Use the first argument after the options as the tag if available (it's
+   * probably a command name), otherwise the module name. */
   if(!isatty(2))
-    lfd = logfd(ev, player->s[2] ? player->s[2] : player->s[1]);
+    lfd = logfd(ev, optc > 0 ? optv[0] : player->s[1]);
   else
     lfd = -1;
-  /* Parse player arguments */
-  int optc = player->n - 2;
-  const char **optv = (const char **)&player->s[2];
-  while(optc > 0 && optv[0][0] == '-') {
-    if(!strcmp(optv[0], "--")) {
-      ++optv;
-      --optc;
-      break;
-    }
-    /* Currently no options supported */
-    disorder_error(0, "unknown option %s", optv[0]);
-    return START_HARDFAIL;
+  /* Use a pre-forked helper if we can.  Prefork data and bgdata belong to this
+   * process, so those cases always get a fresh fork. */
+  if(!(q->type & DISORDER_PLAYER_PREFORK)
+     && !bgdata
+     && !helper_run(ev, player, q, child, params, lfd)) {
+    if(lfd != -1)
+      xclose(lfd);
+    return START_OK;
   }
-  params->argc = optc;
-  params->argv = optv;
   /* Create the child process */
   switch(q->pid = fork()) {
   case 0:
@@ -0,0 +1,673 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file server/chooser.c
+ * @brief Random track weights and the resident chooser
+ *
+ * The weight of a track is split into two parts.  choose_weight() computes
+ * the part that depends only on the database, along with the times at which
+ * it changes.  choose_weight_at() then applies those times.  The queue and
+ * the recently played list are considered separately since they change so
+ * often.  @c disorder-choose uses all of this to pick a single track.
+ *
+ * The server keeps the weight of every track in memory, in a Fenwick tree
+ * over a flat array of tracks (see @ref lib/fenwick.h), so that choosing a
+ * track at random takes logarithmic time.  The array is filled from
+ * <tt>disorder-choose --weights</tt> at startup, after every rescan and
+ * whenever the criteria that apply to every track change.  In between,
+ * preference changes are applied to single tracks as they happen (see @ref
+ * trackdb_pref_changed), and weights that change with the passage of time are
+ * updated from a heap of pending changes.  Tracks in the queue or the
+ * recently played list are excluded for the duration of each choice.
+ *
+ * Each listing is saved to the @c chooser file in the home directory.  At
+ * startup the saved listing is used until a fresh one arrives, so only the
+ * time-dependent parts of the weight need to be evaluated before the first
+ * choice.
+ *
+ * Until the first listing arrives, or if @c choose_resident is turned off,
+ * each choice runs @c disorder-choose instead.
+ */
+
+#include "disorder-server.h"
+#include "fenwick.h"
+#include "heap.h"
+
+/** @brief Weight of a track with no weight preference */
+#define BASE_WEIGHT 90000
+
+/** @brief Read the random choice criteria that apply to every track
+ * @param cc Where to store the criteria
+ * @param tid Owning transaction
+ * @return 0 or a database error
+ */
+int choose_criteria_get(struct choose_criteria *cc, DB_TXN *tid) {
+  const char *tags;
+  int err;
+
+  if((err = trackdb_get_global_tid("required-tags", tid, &tags)))
+    return err;
+  cc->required_tags = parsetags(tags);
+  if((err = trackdb_get_global_tid("prohibited-tags", tid, &tags)))
+    return err;
+  cc->prohibited_tags = parsetags(tags);
+  if((err = trackdb_tag_bits(cc->required_tags, &cc->required_bits, tid)))
+    return err;
+  return trackdb_tag_bits(cc->prohibited_tags, &cc->prohibited_bits, tid);
+}
+
+/** @brief Compute the weight of a track, apart from the queue and the time
+ * @param track Track name (UTF-8)
+ * @param data Track data
+ * @param prefs Track preferences
+ * @param cc Choice criteria
+ * @param eligiblep Where to store the time the track may be played again
+ * @param biasp Where to store the time the new track bias applies, or 0
+ * @return Track weight (non-negative)
+ *
+ * Tracks to be excluded entirely are given a weight of 0.  Pass the result to
+ * choose_weight_at() to find the weight at a particular time.
+ */
+unsigned long choose_weight(const char *track,
+                            struct kvp *data,
+                            struct kvp *prefs,
+                            const struct choose_criteria *cc,
+                            time_t *eligiblep,
+                            time_t *biasp) {
+  const char *s;
+  char **track_tags;
+  struct kvp_index di, pi;
+
+  *eligiblep = 0;
+  *biasp = 0;
+  /* Reject tracks not in any collection (race between edit config and
+   * rescan) */
+  if(!find_track_root(track)) {
+    disorder_info("found track not in any collection: %s", track);
+    return 0;
+  }
+
+  kvp_index_init(&di, data);
+  kvp_index_init(&pi, prefs);
+
+  /* Reject aliases to avoid giving aliased tracks extra weight */
+  if(kvp_index_get(&di, "_alias_for"))
+    return 0;
+
+  /* Reject tracks with random play disabled */
+  if((s = kvp_index_get(&pi, "pick_at_random"))
+     && !strcmp(s, "0"))
+    return 0;
+
+  /* Reject tracks played within the last 8 hours */
+  if((s = kvp_index_get(&pi, "played_time")))
+    *eligiblep = atoll(s) + config->replay_min;
+
+  if((s = kvp_index_get(&di, "_tagbits"))) {
+    /* Reject tracks with prohibited tags */
+    if(tag_bits_intersect(s, cc->prohibited_bits))
+      return 0;
+
+    /* Reject tracks that lack required tags */
+    if(*cc->required_tags && !tag_bits_intersect(s, cc->required_bits))
+      return 0;
+  } else {
+    /* Tracks noticed by older versions have no tag bitmap */
+    track_tags = parsetags(kvp_index_get(&pi, "tags"));
+
+    if(cc->prohibited_tags
+       && tag_intersection(track_tags, cc->prohibited_tags))
+      return 0;
+
+    if(*cc->required_tags && !tag_intersection(track_tags, cc->required_tags))
+      return 0;
+  }
+
+  /* Use the configured weight if available */
+  if((s = kvp_index_get(&pi, "weight"))) {
+    long n;
+    errno = 0;
+
+    n = strtol(s, 0, 10);
+    if((errno == 0 || errno == ERANGE) && n >= 0)
+      return n;
+  }
+
+  /* Bias up tracks that were recently added */
+  if((s = kvp_index_get(&di, "_noticed")))
+    /* Currently we just step up the weight of tracks that are in range.  A
+     * more sophisticated approach would be to linearly decay from new_bias
+     * down to BASE_WEIGHT over the course of the new_bias_age interval
+     * starting when the track is added. */
+    *biasp = atoll(s) + config->new_bias_age;
+
+  return BASE_WEIGHT;
+}
+
+/** @brief Compute the weight of a track at a particular time
+ * @param weight Weight from choose_weight()
+ * @param eligible Time the track may be played again
+ * @param bias Time the new track bias applies, or 0
+ * @param now Current time
+ * @return Track weight (non-negative)
+ */
+unsigned long choose_weight_at(unsigned long weight, time_t eligible,
+                               time_t bias, time_t now) {
+  if(!weight || now < eligible)
+    return 0;
+  if(bias && bias < now)
+    return config->new_bias;
+  return weight;
+}
+
+/** @brief Pick a random integer uniformly from [0, limit) */
+unsigned long long choose_pick_weight(unsigned long long limit) {
+  unsigned char buf[(sizeof(unsigned long long) * CHAR_BIT + 7)/8], m;
+  unsigned long long t, r, slop;
+  int i, nby, nbi;
+
+  D(("pick_weight: limit = %#016llx", limit));
+
+  /* First, decide how many bits of output we actually need; do bytes first
+   * (they're quicker) and then bits.
+   *
+   * To speed this up, we could use a binary search if we knew where to
+   * start.  (Note that shifting by ULLONG_BITS or more (if such a constant
+   * existed) is undefined behaviour, so we mustn't do that.)  Figuring out a
+   * start point involves preprocessor and/or autoconf magic.
+   */
+  for (nby = 1, t = (limit - 1) >> 8; t; nby++, t >>= 8)
+    ;
+  nbi = (nby - 1) << 3; t = limit >> nbi;
+  if (t >> 4) { t >>= 4; nbi += 4; }
+  if (t >> 2) { t >>= 2; nbi += 2; }
+  if (t >> 1) { t >>= 1; nbi += 1; }
+  nbi++;
+  D(("nby = %d; nbi = %d", nby, nbi));
+
+  /* Main randomness collection loop.  We read a number of bytes from the
+   * randomness source, and glue them together into an integer (dropping
+   * bits off the top byte as necessary).  Call the result r; we have
+   * 2^{nbi - 1) <= limit < 2^nbi and r < 2^nbi.  If r < limit then we win;
+   * otherwise we try again.  Given the above bounds, we expect fewer than 2
+   * iterations.
+   *
+   * Unfortunately there are subtleties.  In particular, 2^nbi may in fact be
+   * zero due to overflow.  So in fact what we do is compute slop = 2^nbi -
+   * limit > 0; if r < slop then we try again, otherwise r - slop is our
+   * winner.
+   */
+  slop = ((unsigned long long)2 << (nbi - 1)) - limit;
+  m = nbi & 7 ? (1 << (nbi & 7)) - 1 : 0xff;
+  D(("slop = %#016llx", slop));
+  D(("m = 0x%02x", m));
+
+  do {
+    /* Actually get some random data. */
+    random_get(buf, nby);
+
+    /* Clobber the top byte.  */
+    buf[0] &= m;
+
+    /* Turn it into an integer.  */
+    for (r = 0, i = 0; i < nby; i++)
+      r = (r << 8) | buf[i];
+    D(("r = %#016llx", r));
+  } while (r < slop);
+
+  D(("  result=%#016llx", r - slop));
+  return r - slop;
+}
+
+/* Resident chooser --------------------------------------------------------- */
+
+/** @brief A track that might be chosen */
+struct chooser_track {
+  /** @brief Track name */
+  const char *track;
+
+  /** @brief Weight from choose_weight() */
+  unsigned long weight;
+
+  /** @brief Time the track may be played again */
+  time_t eligible;
+
+  /** @brief Time the new track bias applies, or 0 */
+  time_t bias;
+};
+
+/** @brief A pending change to a track's weight */
+struct chooser_change {
+  /** @brief When the change happens */
+  time_t when;
+
+  /** @brief Index into @ref chooser_tracks */
+  size_t n;
+};
+
+/** @brief Order pending changes by time */
+static inline int chooser_change_lt(struct chooser_change a,
+                                    struct chooser_change b) {
+  return a.when < b.when;
+}
+
+HEAP_TYPE(chooser_heap, struct chooser_change, chooser_change_lt);
+HEAP_DEFINE(chooser_heap, struct chooser_change, chooser_change_lt);
+
+/** @brief Set once the first listing has arrived */
+static int chooser_ready;
+
+/** @brief All tracks that might be chosen */
+static struct chooser_track *chooser_tracks;
+
+/** @brief Number of elements of @ref chooser_tracks */
+static size_t chooser_ntracks;
+
+/** @brief Map from track name to index into @ref chooser_tracks */
+static hash *chooser_index;
+
+/** @brief Current weight of each track */
+static struct fenwick chooser_weights[1];
+
+/** @brief Pending weight changes */
+static struct chooser_heap chooser_changes[1];
+
+/** @brief Set while a listing is underway */
+static int chooser_listing;
+
+/** @brief Set when another listing is needed once this one is done */
+static int chooser_relist;
+
+/** @brief Tracks whose preferences changed during the current listing */
+static struct vector chooser_changed[1];
+
+/** @brief Set while a choice is waiting to be delivered */
+static int chooser_choosing;
+
+/** @brief Callback for the current choice */
+static random_tracks_callback *chooser_callback;
+
+/** @brief Number of tracks for the current choice */
+static int chooser_count;
+
+/** @brief Event loop, once chooser_init() has been called */
+static ev_source *chooser_ev;
+
+/** @brief Event log output watching for rescans and tag criteria */
+static struct eventlog_output chooser_log[1];
+
+/** @brief Return the weight of track @p n at time @p now */
+static unsigned long chooser_weight_at(size_t n, time_t now) {
+  const struct chooser_track *ct = &chooser_tracks[n];
+
+  return choose_weight_at(ct->weight, ct->eligible, ct->bias, now);
+}
+
+/** @brief Schedule any future change to the weight of track @p n */
+static void chooser_schedule(size_t n, time_t now) {
+  const struct chooser_track *ct = &chooser_tracks[n];
+  struct chooser_change c;
+
+  if(!ct->weight)
+    return;
+  c.n = n;
+  if(ct->eligible > now) {
+    c.when = ct->eligible;
+    chooser_heap_insert(chooser_changes, c);
+  }
+  if(ct->bias >= now) {
+    c.when = ct->bias + 1;
+    chooser_heap_insert(chooser_changes, c);
+  }
+}
+
+/** @brief Recompute the current weight of track @p n
+ * @param n Index into @ref chooser_tracks
+ * @param now Current time
+ */
+static void chooser_update(size_t n, time_t now) {
+  fenwick_set(chooser_weights, n, chooser_weight_at(n, now));
+  chooser_schedule(n, now);
+}
+
+/** @brief Recompute the weight of one track from the database */
+static void chooser_refresh(const char *track) {
+  struct choose_criteria cc;
+  struct chooser_track *ct;
+  struct kvp *data, *prefs;
+  const size_t *np;
+  DB_TXN *tid;
+  int err;
+
+  if(!(np = hash_find(chooser_index, track)))
+    return;                             /* picked up by the next listing */
+  ct = &chooser_tracks[*np];
+  for(;;) {
+    tid = trackdb_begin_read_transaction();
+    /* Tag IDs are allocated as tags are first used, so look them up again */
+    if(!(err = choose_criteria_get(&cc, tid))
+       && !(err = trackdb_getdata(trackdb_tracksdb, track, &data, tid))
+       && (err = trackdb_getdata(trackdb_prefsdb, track, &prefs, tid))
+          == DB_NOTFOUND)
+      err = 0;
+    if(err != DB_LOCK_DEADLOCK)
+      break;
+    trackdb_abort_transaction(tid);
+  }
+  trackdb_commit_transaction(tid);
+  switch(err) {
+  case 0:
+    ct->weight = choose_weight(track, data, prefs, &cc,
+                               &ct->eligible, &ct->bias);
+    break;
+  case DB_NOTFOUND:
+    ct->weight = 0;                     /* removed since the last listing */
+    break;
+  default:
+    disorder_error(0, "error reading %s for random choice: %s",
+                   track, db_strerror(err));
+    return;
+  }
+  chooser_update(*np, xtime(0));
+}
+
+/** @brief Called when a preference changes */
+static void chooser_pref_changed(const char *track, const char *name) {
+  if(strcmp(name, "pick_at_random") && strcmp(name, "played_time")
+     && strcmp(name, "tags") && strcmp(name, "weight"))
+    return;
+  if(chooser_listing)
+    /* The listing might predate the change, so look again afterwards */
+    vector_append(chooser_changed, xstrdup(track));
+  if(chooser_ready)
+    chooser_refresh(track);
+}
+
+/** @brief Replace the index with a weight listing
+ * @param listing Output of <tt>disorder-choose --weights</tt>
+ */
+static void chooser_load(const char *listing) {
+  struct chooser_track *tracks;
+  const char *s, *e;
+  char **vec;
+  size_t n, ntracks;
+  const time_t now = xtime(0);
+  int nvec;
+  unsigned long *weights;
+
+  /* Count the lines to size the arrays */
+  for(ntracks = 0, s = listing; *s; ++s)
+    if(*s == '\n')
+      ++ntracks;
+  tracks = xcalloc(ntracks, sizeof *tracks);
+  chooser_index = hash_new(sizeof (size_t));
+  for(n = 0, s = listing; (e = strchr(s, '\n')); s = e + 1) {
+    if(!(vec = split(xstrndup(s, e - s), &nvec, SPLIT_QUOTES, 0, 0))
+       || nvec != 4) {
+      disorder_error(0, "malformed line from disorder-choose --weights");
+      continue;
+    }
+    tracks[n].weight = strtoul(vec[0], 0, 10);
+    tracks[n].eligible = atoll(vec[1]);
+    tracks[n].bias = atoll(vec[2]);
+    tracks[n].track = vec[3];
+    if(hash_add(chooser_index, vec[3], &n, HASH_INSERT))
+      continue;                         /* duplicate */
+    ++n;
+  }
+  chooser_tracks = tracks;
+  chooser_ntracks = n;
+  chooser_ready = 1;
+  weights = xcalloc_noptr(n ? n : 1, sizeof *weights);
+  chooser_changes->nvec = 0;
+  for(n = 0; n < chooser_ntracks; ++n) {
+    weights[n] = chooser_weight_at(n, now);
+    chooser_schedule(n, now);
+  }
+  fenwick_init(chooser_weights, weights, chooser_ntracks);
+}
+
+/** @brief Save the index for use at the next startup */
+static void chooser_save(void) {
+  const char *path = config_get_file("chooser");
+  const struct chooser_track *ct;
+  char *tmp;
+  FILE *fp;
+  size_t n;
+
+  byte_xasprintf(&tmp, "%s.new", path);
+  if(!(fp = fopen(tmp, "w"))) {
+    disorder_error(errno, "error opening %s", tmp);
+    return;
+  }
+  for(n = 0; n < chooser_ntracks; ++n) {
+    ct = &chooser_tracks[n];
+    if(fprintf(fp, "%lu %lld %lld %s\n", ct->weight,
+               (long long)ct->eligible, (long long)ct->bias,
+               quoteutf8(ct->track)) < 0) {
+      disorder_error(errno, "error writing %s", tmp);
+      fclose(fp);
+      unlink(tmp);
+      return;
+    }
+  }
+  if(fclose(fp) < 0) {
+    disorder_error(errno, "error closing %s", tmp);
+    unlink(tmp);
+    return;
+  }
+  if(rename(tmp, path) < 0)
+    disorder_error(errno, "error replacing %s", path);
+}
+
+/** @brief Load the index saved by chooser_save(), if there is one */
+static void chooser_restore(void) {
+  const char *path = config_get_file("chooser");
+  struct dynstr listing[1];
+  char *line;
+  FILE *fp;
+
+  if(!(fp = fopen(path, "r"))) {
+    if(errno != ENOENT)
+      disorder_error(errno, "error opening %s", path);
+    return;
+  }
+  dynstr_init(listing);
+  while(!inputline(path, fp, &line, '\n')) {
+    dynstr_append_string(listing, line);
+    dynstr_append(listing, '\n');
+  }
+  if(ferror(fp)) {
+    disorder_error(errno, "error reading %s", path);
+    fclose(fp);
+    return;
+  }
+  fclose(fp);
+  dynstr_terminate(listing);
+  chooser_load(listing->vec);
+  disorder_info("random choice index has %zu saved tracks", chooser_ntracks);
+}
+
+/** @brief Called with the output of <tt>disorder-choose --weights</tt> */
+static void chooser_listed(ev_source *ev, const char *listing) {
+  int nchanged;
+  char **changed;
+
+  chooser_listing = 0;
+  if(listing) {
+    chooser_load(listing);
+    chooser_save();
+    disorder_info("random choice index has %zu tracks", chooser_ntracks);
+  }
+  /* Catch up with anything that changed during the listing */
+  changed = (char **)chooser_changed->vec;
+  nchanged = chooser_changed->nvec;
+  vector_init(chooser_changed);
+  if(chooser_ready)
+    for(int i = 0; i < nchanged; ++i)
+      chooser_refresh(changed[i]);
+  if(chooser_relist) {
+    chooser_relist = 0;
+    chooser_rebuild(ev);
+  }
+}
+
+/** @brief Rebuild the resident chooser's index
+ * @param ev Event loop
+ *
+ * The current index, if any, is used until the new one is ready.
+ */
+void chooser_rebuild(ev_source *ev) {
+  if(!chooser_ev || !config->choose_resident)
+    return;
+  if(chooser_listing) {
+    chooser_relist = 1;
+    return;
+  }
+  if(!trackdb_request_weights(ev, chooser_listed))
+    chooser_listing = 1;
+}
+
+/** @brief Watch the event log for changes that affect every track */
+static void chooser_logged(const char *msg, void attribute((unused)) *u) {
+  char **vec;
+  int nvec;
+
+  if(!(vec = split(msg, &nvec, SPLIT_QUOTES, 0, 0)) || !nvec)
+    return;
+  if(!strcmp(vec[0], "rescanned")
+     || (!strcmp(vec[0], "global_pref") && nvec >= 2
+         && (!strcmp(vec[1], "required-tags")
+             || !strcmp(vec[1], "prohibited-tags"))))
+    chooser_rebuild(chooser_ev);
+}
+
+/** @brief Start the resident chooser
+ * @param ev Event loop
+ *
+ * Called once the database is open.
+ */
+void chooser_init(ev_source *ev) {
+  chooser_ev = ev;
+  vector_init(chooser_changed);
+  chooser_heap_init(chooser_changes);
+  trackdb_pref_changed = chooser_pref_changed;
+  chooser_log->fn = chooser_logged;
+  eventlog_add(chooser_log);
+  if(config->choose_resident)
+    chooser_restore();
+  chooser_rebuild(ev);
+}
+
+/** @brief Exclude or restore the tracks in a queue
+ * @param head Queue head (@ref qhead or @ref phead)
+ * @param now Current time, or 0 to exclude the tracks
+ */
+static void chooser_exclude(const struct queue_entry *head, time_t now) {
+  for(const struct queue_entry *q = head->next; q != head; q = q->next) {
+    const size_t *np = hash_find(chooser_index, q->track);
+
+    if(np)
+      fenwick_set(chooser_weights, *np, now ? chooser_weight_at(*np, now) : 0);
+  }
+}
+
+/** @brief Choose tracks from the resident index
+ * @param count Number of tracks to choose
+ * @param tracks Where to store the chosen tracks
+ * @return Number of tracks chosen
+ */
+static int chooser_choose(int count, char **tracks) {
+  int nchosen = 0;
+  const time_t now = xtime(0);
+
+  /* Apply any weight changes that are due */
+  while(chooser_heap_count(chooser_changes)
+        && chooser_heap_first(chooser_changes).when <= now) {
+    const size_t n = chooser_heap_remove(chooser_changes).n;
+
+    fenwick_set(chooser_weights, n, chooser_weight_at(n, now));
+  }
+  /* Exclude tracks in the queue or in the recent list */
+  chooser_exclude(&qhead, 0);
+  chooser_exclude(&phead, 0);
+  if(!chooser_weights->total)
+    disorder_error(0, "no tracks match random choice criteria");
+  /* Each winner is given weight 0 so the choice is without replacement */
+  while(nchosen < count && chooser_weights->total) {
+    const unsigned long long r = choose_pick_weight(chooser_weights->total);
+    const size_t n = fenwick_find(chooser_weights, r);
+
+    tracks[nchosen++] = xstrdup(chooser_tracks[n].track);
+    fenwick_set(chooser_weights, n, 0);
+    D(("chose %s", chooser_tracks[n].track));
+  }
+  /* Restore the chosen and excluded tracks */
+  for(int i = 0; i < nchosen; ++i) {
+    const size_t *np = hash_find(chooser_index, tracks[i]);
+
+    fenwick_set(chooser_weights, *np, chooser_weight_at(*np, now));
+  }
+  chooser_exclude(&qhead, now);
+  chooser_exclude(&phead, now);
+  return nchosen;
+}
+
+/** @brief Deliver a choice from the resident index */
+static int chooser_deliver(ev_source *ev,
+                           const struct timeval attribute((unused)) *now,
+                           void attribute((unused)) *u) {
+  char **tracks = xcalloc(chooser_count, sizeof *tracks);
+
+  chooser_choosing = 0;
+  chooser_callback(ev, tracks, chooser_choose(chooser_count, tracks));
+  return 0;
+}
+
+/** @brief Request random tracks
+ * @param ev Event loop
+ * @param count Number of tracks to choose
+ * @param callback Called with the random tracks
+ * @return 0 if a request was initiated, else -1
+ *
+ * Like trackdb_request_random(), but uses the resident index when it is
+ * ready.  The callback is always called after this function has returned.
+ */
+int chooser_request(ev_source *ev, int count,
+                    random_tracks_callback *callback) {
+  if(!config->choose_resident || !chooser_ready) {
+    /* If an earlier listing failed then try again */
+    chooser_rebuild(ev);
+    return trackdb_request_random(ev, count, callback);
+  }
+  if(chooser_choosing)
+    return -1;
+  chooser_choosing = 1;
+  chooser_callback = callback;
+  chooser_count = count;
+  ev_timeout(ev, 0, 0, chooser_deliver, 0);
+  return 0;
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
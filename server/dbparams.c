@@ -47,6 +47,12 @@ void dbparams_check(void) {
   // If the parameters match, return straight away
   if(oldparams && !strcmp(newparams, oldparams))
     return;
+  // A zone must not disturb the library's data
+  if(config->library) {
+    disorder_error(0, "database parameters differ from those of the server"
+                   " in %s", config->library);
+    return;
+  }
   // Log what we're going to do
   for(;;) {
     DB_TXN *tid;
@@ -97,8 +103,18 @@ static int dbparams_cleanup(DB_TXN *tid) {
     disorder_error(err, "truncating search.db: %s", db_strerror(err));
     return err;
   }
+  if((err = trackdb_wordsdb->truncate(trackdb_wordsdb, tid, &count, 0))) {
+    disorder_error(err, "truncating words.db: %s", db_strerror(err));
+    return err;
+  }
+  if((err = trackdb_trigramsdb->truncate(trackdb_trigramsdb, tid,
+                                         &count, 0))) {
+    disorder_error(err, "truncating trigrams.db: %s", db_strerror(err));
+    return err;
+  }
   /* We'll regenerate aliases based on the new alias/namepart settings, so
-   * delete all the alias records currently present
+   * delete all the alias records currently present.  Stat signatures are
+   * discarded too, since otherwise the rescan would skip unchanged tracks.
    *
    * TODO this looks suspiciously similar to part of dump.c
    */
@@ -111,12 +127,18 @@ static int dbparams_cleanup(DB_TXN *tid) {
     goto done;
   }
   while(err == 0) {
-    struct kvp *data = kvp_urldecode(d.data, d.size);
+    struct kvp *data = decode_data(&d);
     if(kvp_get(data, "_alias_for")) {
       if((err = cursor->c_del(cursor, 0))) {
         disorder_error(0, "cursor->c_del: %s", db_strerror(err));
         goto done;
       }
+    } else if(kvp_set(&data, "_stat", 0)) {
+      if((err = cursor->c_put(cursor, &k, encode_data(&d, data),
+                              DB_CURRENT))) {
+        disorder_error(0, "cursor->c_put: %s", db_strerror(err));
+        goto done;
+      }
     }
     err = cursor->c_get(cursor, prepare_data(&k), prepare_data(&d), DB_NEXT);
   }
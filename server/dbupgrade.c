@@ -42,6 +42,8 @@ static const struct option options[] = {
   { "no-debug", no_argument, 0, 'D' },
   { "delete-bad-keys", no_argument, 0, 'x' },
   { "fail-bad-keys", no_argument, 0, 'X' },
+  { "online", no_argument, 0, 'o' },
+  { "background", no_argument, 0, 'b' },
   { "syslog", no_argument, 0, 's' },
   { "no-syslog", no_argument, 0, 'S' },
   { 0, 0, 0, 0 }
@@ -59,6 +61,8 @@ static void attribute((noreturn)) help(void) {
           "  --[no-]syslog           Force logging\n"
           "  --delete-bad-keys, -x   Delete unconvertible keys\n"
           "  --fail-bad-keys, -X     Fail if bad keys are found\n"
+          "  --online, -o            Only do what can't be done later\n"
+          "  --background, -b        Finish an online upgrade\n"
           "\n"
           "Database upgrader for DisOrder.  Not intended to be run\n"
           "directly.\n");
@@ -234,10 +238,31 @@ static int normalize_values(const char *name, DB *db,
   return 0;
 }
 
+static int repack_values(const char *name, DB *db,
+                         DBC attribute((unused)) *c,
+                         DBT *k, DBT *d) {
+  DBT nd[1];
+  int err;
+
+  /* From dbversion 3 records are packed, before that url-encoded */
+  if(kvp_is_packed(d->data, d->size) == (config->dbversion >= 3)) {
+    ++values_already_ok;
+    return 0;
+  }
+  if((err = db->put(db, global_tid, k, encode_data(nd, decode_data(d)), 0))) {
+    if(err != DB_LOCK_DEADLOCK)
+      disorder_fatal(0, "%s: error storing repacked data: %s",
+                     name, db_strerror(err));
+    return err;
+  }
+  ++values_normalized;
+  return 0;
+}
+
 static int renotice(const char *name, DB attribute((unused)) *db,
                     DBC attribute((unused)) *c,
                     DBT *k, DBT *d) {
-  const struct kvp *const t = kvp_urldecode(d->data, d->size);
+  const struct kvp *const t = decode_data(d);
   const char *const track = xstrndup(k->data, k->size);
   const char *const path = kvp_get(t, "_path");
   int err;
@@ -250,7 +275,7 @@ static int renotice(const char *name, DB attribute((unused)) *db,
     disorder_fatal(0, "%s: no '_path' for %.*s", name,
                    (int)k->size, (const char *)k->data);
   }
-  switch(err = trackdb_notice_tid(track, path, global_tid)) {
+  switch(err = trackdb_notice_tid(track, path, 0, global_tid)) {
   case 0:
     ++renoticed;
     return 0;
@@ -264,7 +289,7 @@ static int renotice(const char *name, DB attribute((unused)) *db,
  
 static int remove_aliases_normalize_keys(const char *name, DB *db, DBC *c,
                                          DBT *k, DBT *d) {
-  const struct kvp *const t = kvp_urldecode(d->data, d->size);
+  const struct kvp *const t = decode_data(d);
   int err;
 
   if(kvp_get(t, "_alias_for")) {
@@ -282,6 +307,237 @@ static int remove_aliases_normalize_keys(const char *name, DB *db, DBC *c,
   return normalize_keys(name, db, c, k, d);
 }
 
+/** @brief Re-insert every noticed.db entry
+ * @return 0 or DB_LOCK_DEADLOCK
+ *
+ * @p global_tid must be set.
+ */
+static int rebuild_noticed_tid(void) {
+  DBC *c = trackdb_opencursor(trackdb_noticeddb, global_tid);
+  DBT *keys = 0, *values = 0, k[1], d[1];
+  size_t n, nentries = 0, size = 0;
+  u_int32_t count;
+  int err;
+
+  /* A cursor visits the entries in their stored order, which needs no
+   * comparisons, so this works whichever order they are in */
+  memset(k, 0, sizeof k);
+  while(!(err = c->c_get(c, prepare_data(k), prepare_data(d), DB_NEXT))) {
+    if(nentries == size) {
+      size = size ? 2 * size : 1024;
+      keys = xrealloc(keys, size * sizeof *keys);
+      values = xrealloc(values, size * sizeof *values);
+    }
+    keys[nentries] = *k;
+    values[nentries] = *d;
+    ++nentries;
+  }
+  if(err != DB_NOTFOUND && err != DB_LOCK_DEADLOCK)
+    disorder_fatal(0, "noticed.db: error scanning database: %s",
+                   db_strerror(err));
+  if(trackdb_closecursor(c))
+    err = DB_LOCK_DEADLOCK;
+  if(err == DB_LOCK_DEADLOCK)
+    return err;
+  if((err = trackdb_noticeddb->truncate(trackdb_noticeddb, global_tid,
+                                        &count, 0))) {
+    if(err != DB_LOCK_DEADLOCK)
+      disorder_fatal(0, "error truncating noticed.db: %s", db_strerror(err));
+    return err;
+  }
+  for(n = 0; n < nentries; ++n) {
+    keys[n].flags = 0;
+    values[n].flags = 0;
+    switch(err = trackdb_noticeddb->put(trackdb_noticeddb, global_tid,
+                                        &keys[n], &values[n], DB_NODUPDATA)) {
+    case 0:
+    case DB_KEYEXIST:
+      break;
+    case DB_LOCK_DEADLOCK:
+      return err;
+    default:
+      disorder_fatal(0, "noticed.db: error storing entry: %s",
+                     db_strerror(err));
+    }
+  }
+  disorder_info("noticed.db: %zu entries rebuilt", nentries);
+  return 0;
+}
+
+/** @brief Rebuild noticed.db in timestamp order
+ *
+ * Before dbversion 4 noticed.db sorted its timestamp keys with the path name
+ * comparison, which doesn't order them by time.
+ */
+static void rebuild_noticed(void) {
+  disorder_info("rebuilding noticed.db");
+  for(;;) {
+    global_tid = trackdb_begin_transaction();
+    if(rebuild_noticed_tid()) {
+      trackdb_abort_transaction(global_tid);
+      global_tid = 0;
+      disorder_error(0, "detected deadlock, restarting rebuild");
+      continue;
+    }
+    trackdb_commit_transaction(global_tid);
+    global_tid = 0;
+    break;
+  }
+}
+
+/** @brief Number of records converted per transaction by --background */
+#define BACKGROUND_BATCH 100
+
+/** @brief Re-encode and re-notice one tracks.db entry */
+static int upgrade_track(const char *name, DB *db, DBC *c,
+                         DBT *k, DBT *d) {
+  int err;
+
+  if((err = repack_values(name, db, c, k, d)))
+    return err;
+  return renotice(name, db, c, k, d);
+}
+
+/** @brief Convert the next few records of a database
+ * @param resume Last key converted, or empty to start at the beginning
+ * @param done Set to 1 when the end of the database is reached
+ * @return 0 or DB_LOCK_DEADLOCK
+ *
+ * @p global_tid must be set.  @p resume is only updated when the batch
+ * succeeds.
+ */
+static int background_batch(const char *name, DB *db,
+                            int (*callback)(const char *name, DB *db, DBC *c,
+                                            DBT *k, DBT *d),
+                            struct dynstr *resume, int *done) {
+  DBC *c = trackdb_opencursor(db, global_tid);
+  DBT k[1], d[1];
+  DBTYPE type;
+  struct dynstr last[1];
+  int err, n = 0;
+
+  memset(k, 0, sizeof k);
+  memset(d, 0, sizeof d);
+  dynstr_init(last);
+  if(resume->nvec) {
+    /* A btree finds the next key even if the last one has been deleted since,
+     * but a hash must find it exactly; if it has gone we start again, which
+     * only costs a pass over records that are already converted. */
+    if((err = db->get_type(db, &type)))
+      disorder_fatal(0, "%s: cannot get database type: %s",
+                     name, db_strerror(err));
+    k->data = resume->vec;
+    k->size = resume->nvec;
+    err = c->c_get(c, k, d, type == DB_BTREE ? DB_SET_RANGE : DB_SET);
+    if(!err && k->size == (size_t)resume->nvec
+       && !memcmp(k->data, resume->vec, k->size))
+      err = c->c_get(c, k, d, DB_NEXT);
+    else if(err == DB_NOTFOUND && type != DB_BTREE)
+      err = c->c_get(c, k, d, DB_FIRST);
+  } else
+    err = c->c_get(c, k, d, DB_FIRST);
+  while(!err) {
+    if((err = callback(name, db, c, k, d)))
+      break;
+    last->nvec = 0;
+    dynstr_append_bytes(last, k->data, k->size);
+    if(++n >= BACKGROUND_BATCH)
+      break;
+    err = c->c_get(c, k, d, DB_NEXT);
+  }
+  if(err && err != DB_NOTFOUND && err != DB_LOCK_DEADLOCK)
+    disorder_fatal(0, "%s: error scanning database: %s", name, db_strerror(err));
+  if(trackdb_closecursor(c))
+    err = DB_LOCK_DEADLOCK;
+  if(err == DB_LOCK_DEADLOCK)
+    return err;
+  *done = (err == DB_NOTFOUND);
+  if(n) {
+    resume->nvec = 0;
+    dynstr_append_bytes(resume, last->vec, last->nvec);
+  }
+  return 0;
+}
+
+/** @brief Convert every record of a database in small transactions
+ *
+ * The server is running, so each transaction only holds its locks for a
+ * short time.
+ */
+static void background_scan(const char *name, DB *db,
+                            int (*callback)(const char *name, DB *db, DBC *c,
+                                            DBT *k, DBT *d)) {
+  struct dynstr resume[1];
+  long batches = 0;
+  int done = 0;
+
+  disorder_info("converting %s", name);
+  dynstr_init(resume);
+  values_normalized = values_already_ok = renoticed = 0;
+  while(!done) {
+    global_tid = trackdb_begin_transaction();
+    if(background_batch(name, db, callback, resume, &done)) {
+      trackdb_abort_transaction(global_tid);
+      global_tid = 0;
+      D(("detected deadlock, retrying batch"));
+      continue;
+    }
+    trackdb_commit_transaction(global_tid);
+    global_tid = 0;
+    if(++batches % 100 == 0)
+      disorder_info("converting %s, %ld so far", name,
+                    batches * BACKGROUND_BATCH);
+  }
+  disorder_info("%s: %ld values converted, %ld already ok", name,
+                values_normalized, values_already_ok);
+  if(renoticed)
+    disorder_info("%s: %ld tracks re-noticed", name, renoticed);
+}
+
+/** @brief Do the part of an upgrade that the server can't run without
+ *
+ * Records in an older encoding can still be read, and are converted when
+ * they are written, so that is left to upgrade_background().  Key
+ * normalization (dbversion 1) can't be deferred.
+ */
+static void upgrade_online(void) {
+  const char *s = trackdb_get_global("_dbversion");
+  const char *from = trackdb_get_global("_upgrade_from");
+  long oldversion = s ? atol(s) : 1;
+  char buf[32];
+
+  if(oldversion < 2)
+    disorder_fatal(0, "cannot upgrade dbversion %ld online", oldversion);
+  disorder_info("upgrading database online from dbversion %ld to %ld",
+                oldversion, config->dbversion);
+  /* noticed.db must be in the order its comparison function expects before
+   * anything is looked up in it */
+  if(oldversion < 4)
+    rebuild_noticed();
+  /* If an earlier online upgrade hasn't finished then its starting point
+   * still applies */
+  if(!from || atol(from) > oldversion) {
+    snprintf(buf, sizeof buf, "%ld", oldversion);
+    trackdb_set_global("_upgrade_from", buf, 0);
+  }
+  snprintf(buf, sizeof buf, "%ld", config->dbversion);
+  trackdb_set_global("_dbversion", buf, 0);
+  disorder_info("completed online upgrade; the rest will be done in the background");
+}
+
+/** @brief Finish an upgrade started by upgrade_online() */
+static void upgrade_background(void) {
+  if(!trackdb_get_global("_upgrade_from")) {
+    disorder_info("no background upgrade is pending");
+    return;
+  }
+  disorder_info("finishing database upgrade in the background");
+  background_scan("prefs.db", trackdb_prefsdb, repack_values);
+  background_scan("tracks.db", trackdb_tracksdb, upgrade_track);
+  trackdb_set_global("_upgrade_from", 0, 0);
+  disorder_info("completed background database upgrade");
+}
+
 /** @brief Upgrade the database to the current version
  *
  * This function is supposed to be idempotent, so if it is interrupted
@@ -289,6 +545,7 @@ static int remove_aliases_normalize_keys(const char *name, DB *db, DBC *c,
  */
 static void upgrade(void) {
   char buf[32];
+  int e;
 
   disorder_info("upgrading database to dbversion %ld", config->dbversion);
   /* Normalize keys and values as required.  We will also remove aliases as
@@ -297,26 +554,39 @@ static void upgrade(void) {
   scandb("tracks.db", trackdb_tracksdb, remove_aliases_normalize_keys);
   scandb("prefs.db", trackdb_prefsdb, normalize_keys);
   scandb("global.db", trackdb_globaldb, normalize_keys);
+  /* noticed.db must be in the order its comparison function expects before
+   * anything is looked up in it */
+  rebuild_noticed();
   scandb("noticed.db", trackdb_noticeddb, normalize_values);
+  /* Convert records to the current encoding */
+  disorder_info("re-encoding records");
+  scandb("tracks.db", trackdb_tracksdb, repack_values);
+  scandb("prefs.db", trackdb_prefsdb, repack_values);
   /* search.db and tags.db we will rebuild */
   disorder_info("regenerating search database and aliases");
   truncate_database("search.db", trackdb_searchdb);
+  truncate_database("words.db", trackdb_wordsdb);
+  truncate_database("trigrams.db", trackdb_trigramsdb);
   truncate_database("tags.db", trackdb_tagsdb);
+  WITH_TRANSACTION(trackdb_stats_forget(tid));
   /* Regenerate the search database and aliases */
   scandb("tracks.db", trackdb_tracksdb, renotice);
   /* Finally update the database version */
   snprintf(buf, sizeof buf, "%ld", config->dbversion);
   trackdb_set_global("_dbversion", buf, 0);
+  /* Anything an earlier online upgrade left to do has been done too */
+  if(trackdb_get_global("_upgrade_from"))
+    trackdb_set_global("_upgrade_from", 0, 0);
   disorder_info("completed database upgrade");
 }
 
 int main(int argc, char **argv) {
-  int n, logsyslog = !isatty(2);
+  int n, logsyslog = !isatty(2), online = 0, background = 0;
   
   set_progname(argv);
   mem_init();
   if(!setlocale(LC_CTYPE, "")) disorder_fatal(errno, "error calling setlocale");
-  while((n = getopt_long(argc, argv, "hVc:dDSsxX", options, 0)) >= 0) {
+  while((n = getopt_long(argc, argv, "hVc:dDSsxXob", options, 0)) >= 0) {
     switch(n) {
     case 'h': help();
     case 'V': version("disorder-dbupgrade");
@@ -327,6 +597,8 @@ int main(int argc, char **argv) {
     case 's': logsyslog = 1; break;
     case 'x': badkey = BADKEY_DELETE; break;
     case 'X': badkey = BADKEY_FAIL; break;
+    case 'o': online = 1; break;
+    case 'b': background = 1; break;
     default: disorder_fatal(0, "invalid option");
     }
   }
@@ -339,8 +611,17 @@ int main(int argc, char **argv) {
   if(config_read(0, NULL)) disorder_fatal(0, "cannot read configuration");
   /* Open the database */
   trackdb_init(TRACKDB_NO_RECOVER);
-  trackdb_open(TRACKDB_OPEN_FOR_UPGRADE);
-  upgrade();
+  if(background) {
+    /* The database is already at the current version */
+    trackdb_open(TRACKDB_NO_UPGRADE);
+    upgrade_background();
+  } else {
+    trackdb_open(TRACKDB_OPEN_FOR_UPGRADE);
+    if(online)
+      upgrade_online();
+    else
+      upgrade();
+  }
   return 0;
 }
 
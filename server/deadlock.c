@@ -19,9 +19,20 @@
  * @brief Deadlock monitor
  *
  * Spawned by the server.
+ *
+ * Each process using the database looks for deadlocks itself whenever one of
+ * its lock requests has to wait (see trackdb_init()), so this is a backstop.
+ * It checks often while there is lock contention and backs off while there
+ * is none.
  */
 #include "disorder-server.h"
 
+/** @brief Shortest interval between checks, in milliseconds */
+#define DEADLOCK_MIN_MS 100
+
+/** @brief Longest interval between checks, in milliseconds */
+#define DEADLOCK_MAX_MS 5000
+
 static const struct option options[] = {
   { "help", no_argument, 0, 'h' },
   { "version", no_argument, 0, 'V' },
@@ -52,6 +63,9 @@ static void attribute((noreturn)) help(void) {
 
 int main(int argc, char **argv) {
   int n, err, aborted, logsyslog = !isatty(2);
+  long interval = DEADLOCK_MIN_MS;
+  unsigned long long waits, last_waits = 0, deadlocks;
+  struct timespec ts;
 
   set_progname(argv);
   if(!setlocale(LC_CTYPE, "")) disorder_fatal(errno, "error calling setlocale");
@@ -83,7 +97,18 @@ int main(int argc, char **argv) {
       disorder_fatal(0, "trackdb_env->lock_detect: %s", db_strerror(err));
     if(aborted)
       D(("aborted %d lock requests", aborted));
-    sleep(1);
+    /* Check again soon if anything has had to wait for a lock since last
+     * time, otherwise back off */
+    if(trackdb_lock_stats(&waits, &deadlocks))
+      waits = last_waits + 1;
+    if(aborted || waits != last_waits)
+      interval = DEADLOCK_MIN_MS;
+    else if((interval *= 2) > DEADLOCK_MAX_MS)
+      interval = DEADLOCK_MAX_MS;
+    last_waits = waits;
+    ts.tv_sec = interval / 1000;
+    ts.tv_nsec = interval % 1000 * 1000000;
+    nanosleep(&ts, NULL);
   }
   /* if our parent goes away, it's time to stop */
   disorder_info("stopped (parent terminated)");
@@ -21,13 +21,18 @@
 #include "decode.h"
 #include <FLAC/stream_decoder.h>
 
+/** @brief The file's STREAMINFO block */
+static FLAC__StreamMetadata_StreamInfo flac_streaminfo;
+
 /** @brief Metadata callback for FLAC decoder
  *
- * This is a no-op here.
+ * Keeps the STREAMINFO block, which is what we need to seek.
  */
 static void flac_metadata(const FLAC__StreamDecoder attribute((unused)) *decoder,
-			  const FLAC__StreamMetadata attribute((unused)) *metadata,
+			  const FLAC__StreamMetadata *metadata,
 			  void attribute((unused)) *client_data) {
+  if(metadata->type == FLAC__METADATA_TYPE_STREAMINFO)
+    flac_streaminfo = metadata->data.stream_info;
 }
 
 /** @brief Error callback for FLAC decoder */
@@ -51,7 +56,7 @@ static FLAC__StreamDecoderWriteStatus flac_write
                 frame->header.bits_per_sample,
                 (frame->header.channels * frame->header.blocksize
                  * frame->header.bits_per_sample) / 8,
-                ENDIAN_BIG);
+                output_endian);
   for(n = 0; n < frame->header.blocksize; ++n) {
     for(c = 0; c < frame->header.channels; ++c) {
       switch(frame->header.bits_per_sample) {
@@ -141,7 +146,25 @@ void decode_flac(void) {
     disorder_fatal(0, "FLAC__stream_decoder_init_stream %s: %s",
                    path, FLAC__StreamDecoderInitStatusString[is]);
 
+  if(decode_seek) {
+    FLAC__uint64 target;
+
+    memset(&flac_streaminfo, 0, sizeof flac_streaminfo);
+    FLAC__stream_decoder_process_until_end_of_metadata(sd);
+    target = (FLAC__uint64)decode_seek * flac_streaminfo.sample_rate;
+    /* A total of 0 means the encoder didn't know */
+    if(flac_streaminfo.total_samples
+       && target >= flac_streaminfo.total_samples)
+      goto done;
+    /* The decoder uses the seek table if there is one, and otherwise
+     * bisects the file */
+    if(!FLAC__stream_decoder_seek_absolute(sd, target))
+      disorder_fatal(0, "error seeking in %s: %s", path,
+                     FLAC__StreamDecoderStateString
+                       [FLAC__stream_decoder_get_state(sd)]);
+  }
   FLAC__stream_decoder_process_until_end_of_stream(sd);
+done:
   FLAC__stream_decoder_finish(sd);
   FLAC__stream_decoder_delete(sd);
 }
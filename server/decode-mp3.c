@@ -39,8 +39,8 @@ static inline unsigned long prng(unsigned long state)
 
 /** @brief Generic linear sample quantize and dither routine
  * Filched from mpg321, which credits it to Robert Leslie */
-static long audio_linear_dither(mad_fixed_t sample,
-				struct audio_dither *dither) {
+static inline long audio_linear_dither(mad_fixed_t sample,
+                                       struct audio_dither *dither) {
   unsigned int scalebits;
   mad_fixed_t output, mask, rnd;
   const int bits = 16;
@@ -92,31 +92,63 @@ static long audio_linear_dither(mad_fixed_t sample,
   return output >> scalebits;
 }
 
-/** @brief MP3 output callback */
+/** @brief Quantize and dither one sample for output
+ * @param sample Sample to convert
+ * @param dither Dithering state
+ * @param swap Nonzero to byte-swap the result
+ * @return 16-bit sample in @ref output_endian byte order
+ */
+static inline uint16_t mp3_sample(mad_fixed_t sample,
+                                  struct audio_dither *dither,
+                                  int swap) {
+  const uint16_t s = audio_linear_dither(sample, dither);
+
+  return swap ? (uint16_t)(s << 8 | s >> 8) : s;
+}
+
+/** @brief Output buffer, big enough for one @c mad_pcm */
+static uint16_t mp3_buffer[sizeof ((struct mad_pcm *)0)->samples
+                           / sizeof (mad_fixed_t)];
+
+/** @brief MP3 output callback
+ *
+ * Each channel's noise shaping feeds every sample's error into the next, so
+ * the samples of a channel have to be converted in order.  The dithering
+ * state is kept in local variables for the whole frame, the two channels'
+ * independent chains are interleaved so they can overlap, and the frame is
+ * written with a single call.
+ */
 static enum mad_flow mp3_output(void attribute((unused)) *data,
 				struct mad_header const *header,
 				struct mad_pcm *pcm) {
-  size_t n = pcm->length;
+  const size_t length = pcm->length;
   const mad_fixed_t *l = pcm->samples[0], *r = pcm->samples[1];
+  const int swap = output_endian != ENDIAN_NATIVE;
   static struct audio_dither ld[1], rd[1];
+  struct audio_dither lds = *ld, rds = *rd;
+  uint16_t *out = mp3_buffer;
+  size_t n;
 
   output_header(header->samplerate,
 		pcm->channels,
 		16,
                 2 * pcm->channels * pcm->length,
-                ENDIAN_BIG);
+                output_endian);
   switch(pcm->channels) {
   case 1:
-    while(n--)
-      output_16(audio_linear_dither(*l++, ld));
+    for(n = 0; n < length; ++n)
+      *out++ = mp3_sample(l[n], &lds, swap);
     break;
   case 2:
-    while(n--) {
-      output_16(audio_linear_dither(*l++, ld));
-      output_16(audio_linear_dither(*r++, rd));
+    for(n = 0; n < length; ++n) {
+      *out++ = mp3_sample(l[n], &lds, swap);
+      *out++ = mp3_sample(r[n], &rds, swap);
     }
     break;
   }
+  *ld = lds;
+  *rd = rds;
+  output_bytes(mp3_buffer, (out - mp3_buffer) * sizeof *mp3_buffer);
   return MAD_FLOW_CONTINUE;
 }
 
@@ -164,12 +196,97 @@ static enum mad_flow mp3_error(void attribute((unused)) *data,
   return MAD_FLOW_CONTINUE;
 }
 
+/** @brief Read a big-endian 32-bit value */
+static inline uint32_t mp3_be32(const unsigned char *p) {
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | p[2] << 8 | p[3];
+}
+
+/** @brief Find where to start decoding to skip @ref decode_seek seconds
+ * @return Byte offset in the file
+ *
+ * Files from most encoders start with a frame holding a Xing (or Info)
+ * header.  If it has a table of contents we interpolate in that; otherwise we
+ * assume a constant bitrate.  libmad resynchronizes at the next frame
+ * boundary after the offset we return.
+ */
+static off_t mp3_seek_offset(void) {
+  unsigned char *buffer = (unsigned char *)input_buffer;
+  struct mad_stream stream[1];
+  struct mad_header header[1];
+  const unsigned char *tag;
+  off_t start, end = hreader_size(input), offset;
+  uint32_t flags, frames = 0, bytes = 0;
+  const unsigned char *toc = NULL;
+  double duration, percent, fa, fb;
+  int n, i, side;
+
+  if((n = hreader_pread(input, buffer, sizeof input_buffer, 0)) < 0)
+    disorder_fatal(errno, "reading from %s", path);
+  /* Skip an ID3v2 tag */
+  start = 0;
+  if(n >= 10 && !memcmp(buffer, "ID3", 3))
+    start = 10 + ((buffer[6] & 0x7f) << 21 | (buffer[7] & 0x7f) << 14
+                  | (buffer[8] & 0x7f) << 7 | (buffer[9] & 0x7f))
+      + (buffer[5] & 0x10 ? 10 : 0);
+  if(start >= n)
+    return start;
+  mad_stream_init(stream);
+  mad_header_init(header);
+  mad_stream_buffer(stream, buffer + start, n - start);
+  while(mad_header_decode(header, stream))
+    if(!MAD_RECOVERABLE(stream->error)) {
+      mad_stream_finish(stream);
+      return start;
+    }
+  start = stream->this_frame - buffer;
+  /* The Xing header follows the side information */
+  if(header->flags & MAD_FLAG_LSF_EXT)
+    side = header->mode == MAD_MODE_SINGLE_CHANNEL ? 9 : 17;
+  else
+    side = header->mode == MAD_MODE_SINGLE_CHANNEL ? 17 : 32;
+  tag = stream->this_frame + 4 + side;
+  if(tag + 8 <= buffer + n
+     && (!memcmp(tag, "Xing", 4) || !memcmp(tag, "Info", 4))) {
+    flags = mp3_be32(tag + 4);
+    tag += 8;
+    if(flags & 1 && tag + 4 <= buffer + n) {
+      frames = mp3_be32(tag);
+      tag += 4;
+    }
+    if(flags & 2 && tag + 4 <= buffer + n) {
+      bytes = mp3_be32(tag);
+      tag += 4;
+    }
+    if(flags & 4 && tag + 100 <= buffer + n)
+      toc = tag;
+  }
+  if(toc && frames && header->samplerate) {
+    duration = (double)frames * 32 * MAD_NSBSAMPLES(header)
+      / header->samplerate;
+    percent = decode_seek * 100.0 / duration;
+    if(percent >= 100)
+      offset = end;
+    else {
+      i = (int)percent;
+      fa = toc[i];
+      fb = i < 99 ? toc[i + 1] : 256;
+      offset = start + (fa + (fb - fa) * (percent - i)) / 256.0
+        * (bytes ? (off_t)bytes : end - start);
+    }
+  } else
+    offset = start + (off_t)decode_seek * (header->bitrate / 8);
+  mad_stream_finish(stream);
+  return offset < end ? offset : end;
+}
+
 /** @brief MP3 decoder */
 void decode_mp3(void) {
   struct mad_decoder mad[1];
 
   if(hreader_init(path, input))
     disorder_fatal(errno, "opening %s", path);
+  if(decode_seek && hreader_seek(input, mp3_seek_offset(), SEEK_SET) < 0)
+    disorder_fatal(errno, "seeking in %s", path);
   mad_decoder_init(mad, 0/*data*/, mp3_input, 0/*header*/, 0/*filter*/,
 		   mp3_output, mp3_error, 0/*message*/);
   if(mad_decoder_run(mad, MAD_DECODER_MODE_SYNC))
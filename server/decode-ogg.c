@@ -70,15 +70,24 @@ void decode_ogg(void) {
     disorder_fatal(0, "ov_open_callbacks %s: %d", path, err);
   if(!(vi = ov_info(vf, 0/*link*/)))
     disorder_fatal(0, "ov_info %s: failed", path);
-  while((n = ov_read(vf, input_buffer, sizeof input_buffer, 1/*bigendianp*/,
+  if(decode_seek) {
+    const ogg_int64_t target = (ogg_int64_t)decode_seek * vi->rate;
+
+    if(target >= ov_pcm_total(vf, -1))
+      return;                           /* nothing left to play */
+    /* vorbisfile finds the page by bisecting on granule positions */
+    if((err = ov_pcm_seek(vf, target)))
+      disorder_fatal(0, "ov_pcm_seek %s: %d", path, err);
+  }
+  while((n = ov_read(vf, input_buffer, sizeof input_buffer,
+                     output_endian == ENDIAN_BIG/*bigendianp*/,
                      2/*bytes/word*/, 1/*signed*/, &bitstream))) {
     if(n < 0)
       disorder_fatal(0, "ov_read %s: %ld", path, n);
     if(bitstream > 0)
       disorder_fatal(0, "only single-bitstream ogg files are supported");
-    output_header(vi->rate, vi->channels, 16/*bits*/, n, ENDIAN_BIG);
-    if(fwrite(input_buffer, 1, n, outputfp) < (size_t)n)
-      disorder_fatal(errno, "decoding %s: writing sample data", path);
+    output_header(vi->rate, vi->channels, 16/*bits*/, n, output_endian);
+    output_bytes(input_buffer, n);
   }
 }
 
@@ -26,8 +26,7 @@ static int wav_write(struct wavfile attribute((unused)) *f,
                      const char *data,
                      size_t nbytes,
                      void attribute((unused)) *u) {
-  if(fwrite(data, 1, nbytes, outputfp) < nbytes)
-    disorder_fatal(errno, "decoding %s: writing sample data", path);
+  output_bytes(data, nbytes);
   return 0;
 }
 
@@ -38,6 +37,16 @@ void decode_wav(void) {
 
   if((err = wav_init(f, path)))
     disorder_fatal(err, "opening %s", path);
+  if(decode_seek) {
+    /* Skip whole frames */
+    const off_t frame = f->channels * ((f->bits + 7) / 8);
+    off_t skip = (off_t)decode_seek * f->rate * frame;
+
+    if(skip > f->datasize)
+      skip = f->datasize - f->datasize % frame;
+    f->data += skip;
+    f->datasize -= skip;
+  }
   output_header(f->rate, f->channels, f->bits, f->datasize, ENDIAN_LITTLE);
   if((err = wav_data(f, wav_write, 0)))
     disorder_fatal(err, "error decoding %s", path);
@@ -17,9 +17,28 @@
  */
 /** @file server/decode.c
  * @brief General-purpose decoder for use by speaker process
+ *
+ * Normally the output goes to @c disorder-normalize, which converts it to the
+ * speaker's format.  If @c DISORDER_RAW_FORMAT is set then the output goes
+ * straight to the speaker instead.  As long as the decoded data is already
+ * in the requested format it is written without block headers; if it turns
+ * out not to be then @c disorder-normalize is started at that point and
+ * fed with the rest of the output.
+ *
+ * If @c DISORDER_RAW_SEEK is set then decoding starts that many seconds into
+ * the track.  Each decoder seeks in its own way, without decoding the part
+ * it skips.
+ *
+ * The same code is also built as the @c decode player plugin (with @c
+ * DECODE_PLUGIN defined).  That does the decoding inside the child of @c
+ * disorderd that would otherwise have to execute @c disorder-decode, saving
+ * the cost of starting and dynamically linking a new program for every
+ * track.  The plugin reads the same environment variables.
  */
 #include "decode.h"
 
+#include <sys/wait.h>
+
 #include <mad.h>
 #include <vorbis/vorbisfile.h>
 
@@ -36,10 +55,104 @@ struct decoder {
   void (*decode)(void);
 };
 
-FILE *outputfp;
+int output_fd;
+char output_buffer[OUTPUT_BUFFER_SIZE];
+size_t output_used;
 const char *path;
 char input_buffer[INPUT_BUFFER_SIZE];
 int input_count;
+int output_endian = ENDIAN_BIG;
+long decode_seek;
+
+/** @brief Set while writing directly to the speaker */
+static int direct;
+
+/** @brief Format the speaker wants, if @ref direct is set */
+static struct stream_header direct_format;
+
+/** @brief Process ID of disorder-normalize, or -1 */
+static pid_t normalize_pid = -1;
+
+/** @brief Queue ID to trace, or NULL */
+static const char *trace_id;
+
+/** @brief Set once any output has been written */
+static int output_started;
+
+/** @brief Start disorder-normalize
+ *
+ * It takes over the current @ref output_fd and @ref output_fd becomes a pipe
+ * to it.  Anything already written is flushed first so that it reaches the
+ * speaker in the right order.
+ */
+static void start_normalize(void) {
+  const char *e;
+  int p[2];
+
+  output_flush();
+  xpipe(p);
+  if(!(normalize_pid = xfork())) {
+    exitfn = _exit;
+    xdup2(p[0], 0);
+    xdup2(output_fd, 1);
+    xclose(p[0]);
+    xclose(p[1]);
+    e = getenv("DISORDER_RAW_SYSLOG");
+    execlp("disorder-normalize", "disorder-normalize",
+           e && atoi(e) ? "--syslog" : "--no-syslog",
+           "--config", getenv("DISORDER_RAW_CONFIG"),
+           (char *)0);
+    disorder_fatal(errno, "executing disorder-normalize");
+  }
+  xclose(p[0]);
+  xclose(output_fd);
+  output_fd = p[1];
+}
+
+/** @brief Write out everything in @ref output_buffer */
+void output_flush(void) {
+  size_t written = 0;
+  ssize_t n;
+
+  if(output_used && !output_started) {
+    trace_event(TRACE_INSTANT, "first output", trace_id, NULL);
+    output_started = 1;
+  }
+  while(written < output_used) {
+    n = write(output_fd, output_buffer + written, output_used - written);
+    if(n < 0) {
+      if(errno == EINTR)
+        continue;
+      disorder_fatal(errno, "decoding %s: output error", path);
+    }
+    written += n;
+  }
+  output_used = 0;
+}
+
+/** @brief Write a block of bytes
+ * @param ptr Data to write
+ * @param n Number of bytes
+ *
+ * The data is collected in @ref output_buffer and written out a full buffer
+ * at a time, however it arrives.
+ */
+void output_bytes(const void *ptr, size_t n) {
+  const char *p = ptr;
+  size_t chunk;
+
+  while(n > 0) {
+    if(output_used == OUTPUT_BUFFER_SIZE)
+      output_flush();
+    chunk = OUTPUT_BUFFER_SIZE - output_used;
+    if(chunk > n)
+      chunk = n;
+    memcpy(output_buffer + output_used, p, chunk);
+    output_used += chunk;
+    p += chunk;
+    n -= chunk;
+  }
+}
 
 /** @brief Write a block header
  * @param rate Sample rate in Hz
@@ -71,8 +184,15 @@ void output_header(int rate,
   header.channels = channels;
   header.endian = endian;
   header.nbytes = nbytes;
-  if(fwrite(&header, sizeof header, 1, outputfp) < 1)
-    disorder_fatal(errno, "decoding %s: writing format header", path);
+  if(direct) {
+    /* Data in the right format can go straight to the speaker */
+    if(formats_equal(&header, &direct_format))
+      return;
+    D(("decoding %s: format mismatch, starting normalizer", path));
+    start_normalize();
+    direct = 0;
+  }
+  output_bytes(&header, sizeof header);
 }
 
 /** @brief Lookup table of decoders */
@@ -88,6 +208,88 @@ static const struct decoder decoders[] = {
   { 0, 0 }
 };
 
+/** @brief Pick up output settings from the environment
+ *
+ * Resets all per-track state, so can be called once per track.
+ */
+static void decode_setup(void) {
+  const char *e;
+
+  direct = 0;
+  normalize_pid = -1;
+  output_started = 0;
+  if((trace_id = trace_inherit()))
+    trace_event(TRACE_BEGIN, "decode", trace_id, NULL);
+  output_endian = ENDIAN_BIG;
+  output_used = 0;
+  decode_seek = 0;
+  if((e = getenv("DISORDER_RAW_SEEK")) && (decode_seek = atol(e)) < 0)
+    decode_seek = 0;
+  if((e = getenv("DISORDER_RAW_FD")))
+    output_fd = atoi(e);
+  else
+    output_fd = 1;
+  if((e = getenv("DISORDER_RAW_FORMAT"))) {
+    int rate, bits, channels, endian;
+
+    if(sscanf(e, "%d %d %d %d", &rate, &bits, &channels, &endian) != 4)
+      disorder_fatal(0, "invalid DISORDER_RAW_FORMAT '%s'", e);
+    if(!getenv("DISORDER_RAW_CONFIG"))
+      disorder_fatal(0, "DISORDER_RAW_CONFIG not set");
+    direct_format.rate = rate;
+    direct_format.bits = bits;
+    direct_format.channels = channels;
+    direct_format.endian = endian;
+    direct = 1;
+    /* Produce whatever byte order the speaker wants */
+    if(endian == ENDIAN_LITTLE)
+      output_endian = ENDIAN_LITTLE;
+  }
+}
+
+/** @brief Decode one track
+ * @param p Path to track
+ *
+ * Closes @ref output_fd and waits for @c disorder-normalize (if it was needed)
+ * when done.  Errors are fatal.
+ */
+static void decode_path(const char *p) {
+  int n;
+
+  path = p;
+  for(n = 0;
+      decoders[n].pattern
+	&& fnmatch(decoders[n].pattern, path, 0) != 0;
+      ++n)
+    ;
+  if(!decoders[n].pattern)
+    disorder_fatal(0, "cannot determine file type for %s", path);
+  decoders[n].decode();
+  output_flush();
+  xclose(output_fd);
+  if(normalize_pid != -1) {
+    while(waitpid(normalize_pid, &n, 0) < 0)
+      if(errno != EINTR)
+        disorder_fatal(errno, "error calling waitpid");
+    if(n)
+      disorder_fatal(0, "disorder-normalize %s", wstat(n));
+    normalize_pid = -1;
+  }
+  trace_event(TRACE_END, "decode", trace_id, NULL);
+}
+
+#ifdef DECODE_PLUGIN
+const unsigned long disorder_player_type = DISORDER_PLAYER_RAW;
+
+void disorder_play_track(const char attribute((unused)) *const *parameters,
+			 int attribute((unused)) nparameters,
+			 const char *p,
+			 const char attribute((unused)) *track,
+			 void attribute((unused)) *data) {
+  decode_setup();
+  decode_path(p);
+}
+#else
 static const struct option options[] = {
   { "help", no_argument, 0, 'h' },
   { "version", no_argument, 0, 'V' },
@@ -110,7 +312,6 @@ static void attribute((noreturn)) help(void) {
 
 int main(int argc, char **argv) {
   int n;
-  const char *e;
 
   set_progname(argv);
   if(!setlocale(LC_CTYPE, "")) disorder_fatal(errno, "calling setlocale");
@@ -125,23 +326,11 @@ int main(int argc, char **argv) {
     disorder_fatal(0, "missing filename");
   if(optind + 1 < argc)
     disorder_fatal(0, "excess arguments");
-  if((e = getenv("DISORDER_RAW_FD"))) {
-    if(!(outputfp = fdopen(atoi(e), "wb")))
-      disorder_fatal(errno, "fdopen");
-  } else
-    outputfp = stdout;
-  path = argv[optind];
-  for(n = 0;
-      decoders[n].pattern
-	&& fnmatch(decoders[n].pattern, path, 0) != 0;
-      ++n)
-    ;
-  if(!decoders[n].pattern)
-    disorder_fatal(0, "cannot determine file type for %s", path);
-  decoders[n].decode();
-  xfclose(outputfp);
+  decode_setup();
+  decode_path(argv[optind]);
   return 0;
 }
+#endif
 
 /*
 Local Variables:
@@ -26,9 +26,22 @@
 #include "speaker-protocol.h"
 
 #define INPUT_BUFFER_SIZE 1048576
-  
-/** @brief Output file */
-extern FILE *outputfp;
+
+/** @brief Size of the output buffer
+ *
+ * The speaker reads up to 16384 frames at a time, which is this many bytes at
+ * 16 bits and 2 channels, so a full buffer matches one of its reads.
+ */
+#define OUTPUT_BUFFER_SIZE 65536
+
+/** @brief Output file descriptor */
+extern int output_fd;
+
+/** @brief Output buffer */
+extern char output_buffer[OUTPUT_BUFFER_SIZE];
+
+/** @brief Number of bytes in @ref output_buffer */
+extern size_t output_used;
 
 /** @brief Input filename */
 extern const char *path;
@@ -39,34 +52,52 @@ extern char input_buffer[INPUT_BUFFER_SIZE];
 /** @brief Number of bytes read into buffer */
 extern int input_count;
 
+/** @brief Seconds to skip at the start of the track
+ *
+ * From @c DISORDER_RAW_SEEK; 0 to start at the beginning.
+ */
+extern long decode_seek;
+
+/** @brief Byte order for output_16() etc
+ *
+ * @ref ENDIAN_BIG unless the speaker wants something else.
+ */
+extern int output_endian;
+
+void output_flush(void);
+void output_bytes(const void *ptr, size_t n);
+
 /** @brief Write an 8-bit word */
 static inline void output_8(int n) {
-  if(putc(n, outputfp) < 0)
-    disorder_fatal(errno, "decoding %s: output error", path);
+  if(output_used >= OUTPUT_BUFFER_SIZE)
+    output_flush();
+  output_buffer[output_used++] = n;
+}
+
+/** @brief Write an @p bytes-byte word in @ref output_endian byte order */
+static inline void output_word(uint32_t n, int bytes) {
+  int i;
+
+  if(output_used + bytes > OUTPUT_BUFFER_SIZE)
+    output_flush();
+  for(i = 0; i < bytes; ++i)
+    output_buffer[output_used++]
+      = n >> 8 * (output_endian == ENDIAN_BIG ? bytes - 1 - i : i);
 }
 
-/** @brief Write a 16-bit word in bigendian format */
+/** @brief Write a 16-bit word in @ref output_endian byte order */
 static inline void output_16(uint16_t n) {
-  if(putc(n >> 8, outputfp) < 0
-     || putc(n, outputfp) < 0)
-    disorder_fatal(errno, "decoding %s: output error", path);
+  output_word(n, 2);
 }
 
-/** @brief Write a 24-bit word in bigendian format */
+/** @brief Write a 24-bit word in @ref output_endian byte order */
 static inline void output_24(uint32_t n) {
-  if(putc(n >> 16, outputfp) < 0
-     || putc(n >> 8, outputfp) < 0
-     || putc(n, outputfp) < 0)
-    disorder_fatal(errno, "decoding %s: output error", path);
+  output_word(n, 3);
 }
 
-/** @brief Write a 32-bit word in bigendian format */
+/** @brief Write a 32-bit word in @ref output_endian byte order */
 static inline void output_32(uint32_t n) {
-  if(putc(n >> 24, outputfp) < 0
-     || putc(n >> 16, outputfp) < 0
-     || putc(n >> 8, outputfp) < 0
-     || putc(n, outputfp) < 0)
-    disorder_fatal(errno, "decoding %s: output error", path);
+  output_word(n, 4);
 }
 
 void output_header(int rate,
@@ -58,6 +58,7 @@
 #include "event.h"
 #include "eventlog.h"
 #include "eventlog.h"
+#include "gain.h"
 #include "hash.h"
 #include "hex.h"
 #include "inputline.h"
@@ -76,6 +77,7 @@
 #include "split.h"
 #include "syscalls.h"
 #include "table.h"
+#include "trace.h"
 #include "trackdb-int.h"
 #include "trackdb.h"
 #include "trackname.h"
@@ -145,9 +147,30 @@ struct queue_entry *queue_add(const char *track, const char *submitter,
 void queue_remove(struct queue_entry *q, const char *who);
 /* remove an from the queue */
 
+void queue_inserted(struct queue_entry *q);
+/* report that @q@ has been added to the queue */
+
+void queue_updated(struct queue_entry *q);
+/* report that @q@ has been modified in place */
+
+extern unsigned long queue_generation;
+extern unsigned long recent_generation;
+
+char **queue_changes(unsigned long generation, int *nvecp);
+/* return changes to the queue since @generation@, or a null pointer if they
+ * are no longer known */
+
 struct queue_entry *queue_find(const char *key);
 /* find a track in the queue by name or ID */
 
+struct queue_entry *queue_find_id(const char *id);
+/* find a track in the queue by ID */
+
+void queue_index_add(struct queue_entry *q);
+void queue_index_remove(struct queue_entry *q);
+/* keep the queue indexes up to date; see queue_inserted() and
+ * queue_remove() */
+
 void queue_played(struct queue_entry *q);
 /* add @q@ to the played list */
 
@@ -161,6 +184,11 @@ void queue_moveafter(struct queue_entry *target,
 /* Move all the elements QS to just after TARGET, or to the head if
  * TARGET=0. */
 
+void queue_batch_begin(void);
+void queue_batch_end(const char *who);
+/* bracket several changes to the queue, so that they are saved and reported
+ * to the event log once */
+
 void queue_fix_sofar(struct queue_entry *q);
 /* Fix up the sofar field for standalone players */
 
@@ -173,6 +201,11 @@ char **schedule_list(int *neventsp);
 
 extern struct queue_entry *playing;	/* playing track or 0 */
 extern int paused;			/* non-0 if paused */
+extern struct uaudio_stats speaker_stats; /* last reported by speaker */
+extern unsigned long long speaker_buffered; /* bytes buffered for playing */
+
+void speaker_refresh(void);
+/* bring playing->sofar and the speaker statistics up to date */
 
 void play(ev_source *ev);
 /* try to play something, if playing is enabled and nothing is playing
@@ -228,6 +261,9 @@ void abandon(ev_source *ev,
 	     struct queue_entry *q);
 /* Abandon a possibly-prepared track. */
 
+int preparing_tracks(void);
+/* Return nonzero if any track is being prepared */
+
 void add_random_track(ev_source *ev);
 /* If random play is enabled then try to add a track to the queue. */
 
@@ -240,7 +276,7 @@ int server_start(ev_source *ev, int pf,
 int server_stop(ev_source *ev, int fd);
 /* Stop listening on @fd@ */
 
-void rtp_request(const struct sockaddr_storage *sa);
+void rtp_request(const struct sockaddr_storage *sa, int codec);
 void rtp_request_cancel(const struct sockaddr_storage *sa);
 
 extern int volume_left, volume_right;	/* last known volume */
@@ -269,6 +305,11 @@ const void *get_plugin_object(const struct plugin *handle,
 /* track length computation ***************************************************/
 
 long tracklength(const char *plugin, const char *track, const char *path);
+int tracklength_batched(const char *plugin);
+void tracklength_batch(const char *plugin, int ntracks,
+                       const char *const *tracks, const char *const *paths,
+                       void (*callback)(int n, long length, void *u),
+                       void *u);
 
 /* collection interface *******************************************************/
 
@@ -353,6 +394,8 @@ struct pbgc_params {
   const char **argv;
   /** @brief Raw track name */
   const char *rawpath;
+  /** @brief Set if the player can write straight to the speaker */
+  int direct;
 };
 
 /** @brief Callback to play or prepare a track
@@ -370,6 +413,124 @@ int play_background(ev_source *ev,
                     play_background_child_fn *child,
                     void *bgdata);
 
+void helpers_reset(ev_source *ev);
+
+/** @brief Called with the results of a query
+ * @param results NULL-terminated list of results
+ * @param nresults Number of results
+ * @param u Passed to the query function
+ */
+typedef void query_callback(char **results, int nresults, void *u);
+
+struct query;
+
+/** @brief Called with a batch of streamed query results
+ * @param q Query
+ * @param results Results (not NULL-terminated)
+ * @param nresults Number of results
+ * @param more Nonzero if there will be more results
+ * @param u Passed to query_list_stream()
+ */
+typedef void query_stream_callback(struct query *q,
+                                   char **results, int nresults, int more,
+                                   void *u);
+
+char **query_execute(char **args, int nargs);
+void query_list_stream(ev_source *ev, const char *dir,
+                       enum trackdb_listable what, const char *re,
+                       query_stream_callback *stream, void *u);
+void query_search(ev_source *ev, char **terms, int nterms,
+                  query_callback *done, void *u);
+void query_search_page(ev_source *ev, char **terms, int nterms,
+                       int offset, int limit,
+                       query_callback *done, void *u);
+void query_search_prefix(ev_source *ev, char **terms, int nterms, int max,
+                         query_callback *done, void *u);
+void query_search_fuzzy(ev_source *ev, char **terms, int nterms, int max,
+                        query_callback *done, void *u);
+void query_new(ev_source *ev, int max, query_callback *done, void *u);
+void query_pause(struct query *q);
+void query_resume(struct query *q);
+void query_reset(ev_source *ev);
+
+/** @brief Random choice criteria that apply to every track */
+struct choose_criteria {
+  /** @brief Required tags */
+  char **required_tags;
+
+  /** @brief Prohibited tags */
+  char **prohibited_tags;
+
+  /** @brief Tag bitmap for @ref required_tags */
+  char *required_bits;
+
+  /** @brief Tag bitmap for @ref prohibited_tags */
+  char *prohibited_bits;
+};
+
+int choose_criteria_get(struct choose_criteria *cc, DB_TXN *tid);
+unsigned long choose_weight(const char *track,
+                            struct kvp *data,
+                            struct kvp *prefs,
+                            const struct choose_criteria *cc,
+                            time_t *eligiblep,
+                            time_t *biasp);
+unsigned long choose_weight_at(unsigned long weight, time_t eligible,
+                               time_t bias, time_t now);
+unsigned long long choose_pick_weight(unsigned long long limit);
+
+void chooser_init(ev_source *ev);
+void chooser_rebuild(ev_source *ev);
+int chooser_request(ev_source *ev, int count,
+                    random_tracks_callback *callback);
+
+void watch_reset(ev_source *ev);
+void watch_rescan(ev_source *ev, int recheck,
+                  void (*rescanned)(void *ru),
+                  void *ru);
+
+/** @brief Called with each line of a forwarded command's response
+ * @param line Line, without its newline
+ * @param u Passed to forward_request()
+ */
+typedef void forward_line_callback(const char *line, void *u);
+
+/** @brief Called when a forwarded command has completed
+ * @param ok 1 on success, 0 if the connection to the primary failed
+ * @param u Passed to forward_request()
+ */
+typedef void forward_done_callback(int ok, void *u);
+
+struct forward;
+
+int is_replica(void);
+struct forward *forward_open(ev_source *ev);
+void forward_request(struct forward *f,
+                     const char *request,
+                     forward_line_callback *line,
+                     forward_done_callback *done,
+                     void *u);
+int forward_closed(const struct forward *f);
+void forward_close(struct forward *f);
+
+int decode_direct(struct queue_entry *q,
+                  const struct pbgc_params *params,
+                  int fd);
+const struct stringlist *find_player(const struct queue_entry *q);
+
+void pcmcache_init(void);
+void pcmcache_fill(ev_source *ev);
+int pcmcache_open(const char *track, const char *rawpath);
+void pcmcache_quitting(ev_source *ev);
+int pcmcache_send(int fd, int sfd);
+
+void prefetch_fill(ev_source *ev);
+
+int part_cache_get(const char *track, const char *context, const char *part,
+                   int transform, const char **valuep);
+void part_cache_put(const char *track, const char *context, const char *part,
+                    int transform, const char *value);
+
 /* Return values from start(),  prepare() and play_background() */
 
 #define START_OK 0	   /**< @brief Succeeded. */
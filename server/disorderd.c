@@ -19,6 +19,7 @@
  * @brief Main DisOrder server
  */
 #include "disorder-server.h"
+#include "timeval.h"
 
 static ev_source *ev;
 
@@ -63,6 +64,18 @@ static int handle_sighup(ev_source attribute((unused)) *ev_,
   return 0;
 }
 
+#if MEM_PROFILE
+/* report allocations on SIGUSR1 */
+
+static int handle_sigusr1(ev_source attribute((unused)) *ev_,
+			  int attribute((unused)) sig,
+			  void attribute((unused)) *u) {
+  disorder_info("received SIGUSR1");
+  mem_report_file();
+  return 0;
+}
+#endif
+
 /* fatal signals */
 
 static int handle_sigint(ev_source attribute((unused)) *ev_,
@@ -79,6 +92,31 @@ static int handle_sigterm(ev_source attribute((unused)) *ev_,
   quit(ev);
 }
 
+/* startup timing ----------------------------------------------------------- */
+
+/** @brief When startup began */
+static struct timeval startup_began;
+
+/** @brief When the current startup phase began */
+static struct timeval startup_phase_began;
+
+/** @brief Log how long a startup phase took
+ * @param what Description of the phase that has just finished, or NULL at the
+ * end of startup
+ */
+static void startup_phase(const char *what) {
+  struct timeval now;
+
+  xgettimeofday(&now, NULL);
+  if(what)
+    disorder_info("startup: %s took %lldms", what,
+                  (long long)(tvsub_us(now, startup_phase_began) / 1000));
+  else
+    disorder_info("startup: ready after %lldms",
+                  (long long)(tvsub_us(now, startup_began) / 1000));
+  startup_phase_began = now;
+}
+
 /* periodic actions --------------------------------------------------------- */
 
 /** @brief A job executed periodically by the server */
@@ -126,11 +164,15 @@ static void create_periodic(ev_source *ev_,
 }
 
 static void periodic_rescan(ev_source *ev_) {
-  trackdb_rescan(ev_, 1/*check*/, 0, 0);
+  watch_rescan(ev_, 1/*check*/, 0, 0);
 }
 
 static void periodic_database_gc(ev_source attribute((unused)) *ev_) {
-  trackdb_gc();
+  trackdb_gc(preparing_tracks());
+}
+
+static void periodic_library_check(ev_source attribute((unused)) *ev_) {
+  trackdb_library_check();
 }
 
 static void periodic_volume_check(ev_source attribute((unused)) *ev_) {
@@ -268,8 +310,10 @@ int main(int argc, char **argv) {
     disorder_fatal(0, "cannot read configuration");
   /* make sure the home directory exists and has suitable permissions */
   make_home();
-  /* Start the speaker process (as root! - so it can choose its nice value) */
-  speaker_setup(ev);
+  /* Start the speaker process (as root! - so it can choose its nice value).
+   * A replica plays nothing and so has no speaker. */
+  if(!is_replica())
+    speaker_setup(ev);
   /* set server nice value _after_ starting the speaker, so that they
    * are independently niceable */
   xnice(config->nice_server);
@@ -295,24 +339,45 @@ int main(int argc, char **argv) {
       disorder_fatal(errno, "error locking %s", lockfile);
   }
   /* initialize database environment */
+  xgettimeofday(&startup_began, NULL);
+  startup_phase_began = startup_began;
   trackdb_init(TRACKDB_NORMAL_RECOVER|TRACKDB_MAY_CREATE);
   trackdb_master(ev);
+  startup_phase("database environment");
   /* install new config; don't create socket */
   if(reconfigure(ev, RECONFIGURE_FIRST))
     disorder_fatal(0, "failed to read configuration");
+  /* Discard anything decoded ahead by a previous run */
+  pcmcache_init();
+  startup_phase("configuration");
   /* Open the database */
   trackdb_open(TRACKDB_CAN_UPGRADE);
-  /* load the queue and recently-played list */
-  queue_read();
-  recent_read();
-  /* Arrange timeouts for schedule actions */
-  schedule_init(ev);
+  /* convert anything an online upgrade left behind */
+  trackdb_upgrade_background(ev);
+  /* answer questions about missing tracks without the database */
+  trackdb_filter_tracks();
+  startup_phase("opening databases");
+  /* A replica leaves the queue, random play and the schedule to the
+   * primary */
+  if(!is_replica()) {
+    /* load the queue and recently-played list */
+    queue_read();
+    recent_read();
+    startup_phase("reading queue");
+    /* list track weights for random choice */
+    chooser_init(ev);
+    startup_phase("loading track weights");
+    /* Arrange timeouts for schedule actions */
+    schedule_init(ev);
+    startup_phase("loading schedule");
+  }
   /* create a root login */
   trackdb_create_root();
   /* create sockets */
   reset_sockets(ev);
   /* check for change to database parameters */
   dbparams_check();
+  startup_phase("sockets and parameter checks");
   /* re-read config if we receive a SIGHUP */
   if(ev_signal(ev, SIGHUP, handle_sighup, 0))
     disorder_fatal(0, "ev_signal failed");
@@ -321,20 +386,32 @@ int main(int argc, char **argv) {
     disorder_fatal(0, "ev_signal failed");
   if(ev_signal(ev, SIGTERM, handle_sigterm, 0))
     disorder_fatal(0, "ev_signal failed");
+#if MEM_PROFILE
+  /* report allocations on SIGUSR1 */
+  if(ev_signal(ev, SIGUSR1, handle_sigusr1, 0))
+    disorder_fatal(0, "ev_signal failed");
+#endif
   /* ignore SIGPIPE */
   signal(SIGPIPE, SIG_IGN);
   /* Rescan immediately and then daily */
   create_periodic(ev, periodic_rescan, 86400, 1/*immediate*/);
-  /* Tidy up the database once a minute */
-  create_periodic(ev, periodic_database_gc, 60, 0);
-  /* Check the volume immediately and then once a minute */
-  create_periodic(ev, periodic_volume_check, 60, 1);
-  /* Check for a playable track once a second */
-  create_periodic(ev, periodic_play_check, 1, 0);
-  /* Try adding a random track immediately and once every two seconds */
-  create_periodic(ev, periodic_add_random, 2, 1);
+  /* Check whether the database needs a checkpoint every five seconds */
+  create_periodic(ev, periodic_database_gc, 5, 0);
+  /* In a zone or replica, look for changes made by other servers once a
+   * second */
+  if(config->library)
+    create_periodic(ev, periodic_library_check, 1, 1);
+  if(!is_replica()) {
+    /* Check the volume immediately and then once a minute */
+    create_periodic(ev, periodic_volume_check, 60, 1);
+    /* Check for a playable track once a second */
+    create_periodic(ev, periodic_play_check, 1, 0);
+    /* Try adding a random track immediately and once every two seconds */
+    create_periodic(ev, periodic_add_random, 2, 1);
+  }
   /* Issue a rescan when devices are mounted or unmouted */
   create_periodic(ev, periodic_mount_check, MOUNT_CHECK_INTERVAL, 1);
+  startup_phase(NULL);
   /* enter the event loop */
   n = ev_run(ev);
   /* if we exit the event loop, something must have gone wrong */
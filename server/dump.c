@@ -29,6 +29,7 @@ static const struct option options[] = {
   { "version", no_argument, 0, 'V' },
   { "config", required_argument, 0, 'c' },
   { "dump", no_argument, 0, 'd' },
+  { "binary", no_argument, 0, 'b' },
   { "undump", no_argument, 0, 'u' },
   { "debug", no_argument, 0, 'D' },
   { "recover", no_argument, 0, 'r' },
@@ -49,6 +50,7 @@ static void attribute((noreturn)) help(void) {
 	  "  --version, -V            Display version number\n"
 	  "  --config PATH, -c PATH   Set configuration file\n"
 	  "  --dump, -d               Dump state to PATH\n"
+	  "  --binary, -b             Dump in binary format\n"
 	  "  --undump, -u             Restore state from PATH\n"
 	  "  --recover, -r            Run database recovery\n"
 	  "  --recompute-aliases, -a  Recompute aliases\n"
@@ -59,6 +61,114 @@ static void attribute((noreturn)) help(void) {
   exit(0);
 }
 
+/* Binary dumps start "V1".  The rest of the file is a sequence of blocks,
+ * each consisting of:
+ * - a letter saying which database it belongs to, or 'E' for the end
+ * - its payload length as a 32-bit big-endian integer
+ * - the 4-byte CRC-32 of its payload
+ * - its payload, which is a sequence of records
+ *
+ * A record is its key length as a 32-bit big-endian integer, the key, the
+ * value length and the value.  The last block is an empty 'E' block.
+ */
+
+/** @brief Binary dump block header size */
+#define BLOCK_HEADER 9
+
+/** @brief Binary dump block payload size
+ *
+ * Blocks are written when they reach this size.
+ */
+#define BLOCK_SIZE 262144
+
+/** @brief Store a 32-bit big-endian integer */
+static void put32(char *ptr, uint32_t n) {
+  ptr[0] = n >> 24;
+  ptr[1] = n >> 16;
+  ptr[2] = n >> 8;
+  ptr[3] = n;
+}
+
+/** @brief Fetch a 32-bit big-endian integer */
+static uint32_t get32(const char *ptr) {
+  const unsigned char *p = (const unsigned char *)ptr;
+
+  return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/** @brief Write a binary dump block
+ * @param s Output stream
+ * @param tag Tag for error messages
+ * @param letter Block letter
+ * @param d Payload, which is emptied
+ */
+static void dump_block(struct sink *s,
+                       const char *tag,
+                       int letter,
+                       struct dynstr *d) {
+  char header[BLOCK_HEADER];
+
+  header[0] = letter;
+  put32(header + 1, d->nvec);
+  gcry_md_hash_buffer(GCRY_MD_CRC32, header + 5, d->vec, d->nvec);
+  if(sink_write(s, header, sizeof header) < 0
+     || (d->nvec && sink_write(s, d->vec, d->nvec) < 0))
+    disorder_fatal(errno, "error writing to %s", tag);
+  d->nvec = 0;
+}
+
+/** @brief Dump one database in binary format
+ * @param s Output stream
+ * @param tag Tag for error messages
+ * @param letter Block letter
+ * @param dbname Database name
+ * @param db Database handle
+ * @param tid Transaction handle
+ * @return 0 or @c DB_LOCK_DEADLOCK
+ */
+static int dump_one_binary(struct sink *s,
+                           const char *tag,
+                           int letter,
+                           const char *dbname,
+                           DB *db,
+                           DB_TXN *tid) {
+  int err;
+  DBC *cursor;
+  DBT k, d;
+  struct dynstr block[1];
+  char len[4];
+
+  dynstr_init(block);
+  cursor = trackdb_opencursor(db, tid);
+  err = cursor->c_get(cursor, prepare_data(&k), prepare_data(&d),
+                      DB_FIRST);
+  while(err == 0) {
+    put32(len, k.size);
+    dynstr_append_bytes(block, len, 4);
+    dynstr_append_bytes(block, k.data, k.size);
+    put32(len, d.size);
+    dynstr_append_bytes(block, len, 4);
+    dynstr_append_bytes(block, d.data, d.size);
+    if(block->nvec >= BLOCK_SIZE)
+      dump_block(s, tag, letter, block);
+    err = cursor->c_get(cursor, prepare_data(&k), prepare_data(&d),
+                        DB_NEXT);
+  }
+  switch(err) {
+  case DB_LOCK_DEADLOCK:
+    trackdb_closecursor(cursor);
+    return err;
+  case DB_NOTFOUND:
+    if(block->nvec)
+      dump_block(s, tag, letter, block);
+    return trackdb_closecursor(cursor);
+  case 0:
+    assert(!"cannot happen");
+  default:
+    disorder_fatal(0, "error reading %s: %s", dbname, db_strerror(err));
+  }
+}
+
 /** @brief Dump one record
  * @param s Output stream
  * @param tag Tag for error messages
@@ -115,12 +225,13 @@ static struct {
   { 'U', "users.db",     &trackdb_usersdb },
   { 'W', "schedule.db",  &trackdb_scheduledb },
   { 'L', "playlists.db", &trackdb_playlistsdb },
+  { 'D', "lengths.db",   &trackdb_lengthsdb },
   /* avoid 'T' and 'S' for now */
 };
 #define NDBTABLE (sizeof dbtable / sizeof *dbtable)
 
 /* dump prefs to FP, return nonzero on error */
-static void do_dump(FILE *fp, const char *tag) {
+static void do_dump(FILE *fp, const char *tag, int binary) {
   DB_TXN *tid;
   struct sink *s = sink_stdio(tag, fp);
 
@@ -132,15 +243,21 @@ static void do_dump(FILE *fp, const char *tag) {
       disorder_fatal(errno, "error calling fflush");
     if(ftruncate(fileno(fp), 0) < 0)
       disorder_fatal(errno, "error calling ftruncate");
-    if(fprintf(fp, "V0") < 0)
+    if(fprintf(fp, binary ? "V1" : "V0") < 0)
       disorder_fatal(errno, "error writing to %s", tag);
     for(size_t n = 0; n < NDBTABLE; ++n)
-      if(dump_one(s, tag,
-                  dbtable[n].letter, dbtable[n].dbname, *dbtable[n].db,
-                  tid))
+      if((binary ? dump_one_binary : dump_one)(s, tag,
+                                               dbtable[n].letter,
+                                               dbtable[n].dbname,
+                                               trackdb_lazy(dbtable[n].db),
+                                               tid))
         goto fail;
-    
-    if(fputs("E\n", fp) < 0)
+    if(binary) {
+      struct dynstr end[1];
+
+      dynstr_init(end);
+      dump_block(s, tag, 'E', end);
+    } else if(fputs("E\n", fp) < 0)
       disorder_fatal(errno, "error writing to %s", tag);
     break;
 fail:
@@ -169,7 +286,7 @@ static int remove_aliases(DB_TXN *tid, int remove_pathless) {
     goto done;
   }
   while(err == 0) {
-    data = kvp_urldecode(d.data, d.size);
+    data = decode_data(&d);
     alias = !!kvp_get(data, "_alias_for");
     pathless = !kvp_get(data, "_path");
     if(pathless && !remove_pathless)
@@ -238,14 +355,17 @@ static int undump_from_fp(DB_TXN *tid, FILE *fp, const char *tag) {
   if((err = truncdb(tid, trackdb_prefsdb))) return err;
   if((err = truncdb(tid, trackdb_globaldb))) return err;
   if((err = truncdb(tid, trackdb_searchdb))) return err;
+  if((err = truncdb(tid, trackdb_wordsdb))) return err;
+  if((err = truncdb(tid, trackdb_trigramsdb))) return err;
   if((err = truncdb(tid, trackdb_tagsdb))) return err;
   if((err = truncdb(tid, trackdb_usersdb))) return err;
-  if((err = truncdb(tid, trackdb_scheduledb))) return err;
+  if((err = truncdb(tid, trackdb_lazy(&trackdb_scheduledb)))) return err;
+  if((err = truncdb(tid, trackdb_lengthsdb))) return err;
   c = getc(fp);
   while(!ferror(fp) && !feof(fp)) {
     for(size_t n = 0; n < NDBTABLE; ++n) {
       if(dbtable[n].letter == c) {
-	DB *db = *dbtable[n].db;
+	DB *db = trackdb_lazy(dbtable[n].db);
 	const char *dbname = dbtable[n].dbname;
         DBT k, d;
 
@@ -291,6 +411,200 @@ static int undump_from_fp(DB_TXN *tid, FILE *fp, const char *tag) {
   return 0;
 }
 
+/** @brief A block read from a binary dump */
+struct undump_block {
+  /** @brief Block letter */
+  int letter;
+
+  /** @brief Payload length */
+  uint32_t size;
+
+  /** @brief Payload, or NULL if not read */
+  char *data;
+};
+
+/** @brief Read bytes from a binary dump
+ * @param fd File to read
+ * @param tag Tag for error messages
+ * @param buffer Where to put the bytes
+ * @param n Number of bytes to read
+ * @param offset Offset in file
+ *
+ * This uses pread() so that processes sharing @p fd don't disturb each
+ * other's file position.
+ */
+static void undump_read(int fd, const char *tag,
+                        void *buffer, size_t n, off_t offset) {
+  ssize_t got;
+
+  while(n > 0) {
+    if((got = pread(fd, buffer, n, offset)) < 0) {
+      if(errno == EINTR)
+        continue;
+      disorder_fatal(errno, "error reading %s", tag);
+    }
+    if(got == 0)
+      disorder_fatal(0, "unexpected EOF reading %s", tag);
+    buffer = (char *)buffer + got;
+    n -= got;
+    offset += got;
+  }
+}
+
+/** @brief Read a block from a binary dump
+ * @param fd File to read
+ * @param tag Tag for error messages
+ * @param offset Offset of block; updated to the offset of the next block
+ * @param b Where to put the block
+ * @param letter Only read the payload of blocks with this letter, or 0 for all
+ *
+ * The payloads that are read have their checksum and records verified.
+ */
+static void undump_block(int fd, const char *tag, off_t *offset,
+                         struct undump_block *b, int letter) {
+  char header[BLOCK_HEADER], crc[4];
+  uint32_t pos;
+  int n;
+
+  undump_read(fd, tag, header, sizeof header, *offset);
+  b->letter = (unsigned char)header[0];
+  b->size = get32(header + 1);
+  b->data = 0;
+  if(!letter || b->letter == letter) {
+    b->data = xmalloc_noptr(b->size + 1);
+    undump_read(fd, tag, b->data, b->size, *offset + BLOCK_HEADER);
+    gcry_md_hash_buffer(GCRY_MD_CRC32, crc, b->data, b->size);
+    if(memcmp(crc, header + 5, 4))
+      disorder_fatal(0, "%s: checksum error in block at offset %jd",
+                     tag, (intmax_t)*offset);
+    /* Each record is a key and then a value */
+    for(pos = 0; pos < b->size;)
+      for(n = 0; n < 2; ++n) {
+        if(b->size - pos < 4 || get32(b->data + pos) > b->size - pos - 4)
+          disorder_fatal(0, "%s: malformed block at offset %jd",
+                         tag, (intmax_t)*offset);
+        pos += 4 + get32(b->data + pos);
+      }
+  }
+  *offset += BLOCK_HEADER + b->size;
+}
+
+/** @brief Get the next record from a verified binary dump block
+ * @param b Block
+ * @param pos Offset of record in payload; updated to the next record
+ * @param k Where to put the key
+ * @param d Where to put the value
+ * @return 1 if a record was found, 0 at the end of the block
+ */
+static int undump_record(const struct undump_block *b, uint32_t *pos,
+                         DBT *k, DBT *d) {
+  if(*pos >= b->size)
+    return 0;
+  memset(k, 0, sizeof *k);
+  memset(d, 0, sizeof *d);
+  k->size = get32(b->data + *pos);
+  k->data = b->data + *pos + 4;
+  *pos += 4 + k->size;
+  d->size = get32(b->data + *pos);
+  d->data = b->data + *pos + 4;
+  *pos += 4 + d->size;
+  return 1;
+}
+
+/** @brief Store the records of a binary dump block
+ * @param db Database
+ * @param dbname Database name
+ * @param b Block, which has already been verified
+ * @param tid Owning transaction
+ * @return 0 or DB_LOCK_DEADLOCK
+ *
+ * Where the Berkeley DB version supports it the whole block is stored with a
+ * single bulk DB->put.
+ */
+static int undump_store_block(DB *db, const char *dbname,
+                              const struct undump_block *b, DB_TXN *tid) {
+  uint32_t pos = 0;
+  DBT k, d;
+  int err;
+#ifdef DB_MULTIPLE_KEY_WRITE_NEXT
+  DBT bulk;
+  void *p;
+
+  /* The bulk buffer holds the keys and values, four offsets per record and a
+   * terminator.  The payload has eight bytes of lengths per record, so twice
+   * its size is plenty. */
+  memset(&bulk, 0, sizeof bulk);
+  bulk.ulen = 2 * b->size + 64;
+  bulk.data = xmalloc_noptr(bulk.ulen);
+  bulk.flags = DB_DBT_USERMEM|DB_DBT_BULK;
+  DB_MULTIPLE_WRITE_INIT(p, &bulk);
+  while(undump_record(b, &pos, &k, &d)) {
+    DB_MULTIPLE_KEY_WRITE_NEXT(p, &bulk, k.data, k.size, d.data, d.size);
+    if(!p)
+      disorder_fatal(0, "bulk buffer overflow restoring %s", dbname);
+  }
+  memset(&d, 0, sizeof d);
+  err = db->put(db, tid, &bulk, &d, DB_MULTIPLE_KEY);
+#else
+  err = 0;
+  while(!err && undump_record(b, &pos, &k, &d))
+    err = db->put(db, tid, &k, &d, 0);
+#endif
+  switch(err) {
+  case 0:
+    return 0;
+  case DB_LOCK_DEADLOCK:
+    disorder_error(0, "error updating %s: %s", dbname, db_strerror(err));
+    return err;
+  default:
+    disorder_fatal(0, "error updating %s: %s", dbname, db_strerror(err));
+  }
+}
+
+/** @brief Check a binary dump
+ * @param fd File to read
+ * @param tag Tag for error messages
+ *
+ * Nothing is restored unless every block is intact.
+ */
+static void undump_verify(int fd, const char *tag) {
+  off_t offset = 2;
+  struct undump_block b;
+  size_t n;
+
+  do {
+    undump_block(fd, tag, &offset, &b, 0);
+    for(n = 0; n < NDBTABLE && dbtable[n].letter != b.letter; ++n)
+      ;
+    if(n == NDBTABLE && b.letter != 'E')
+      disorder_fatal(0, "%s: unknown block type 0x%02X", tag, b.letter);
+  } while(b.letter != 'E');
+}
+
+/** @brief Restore one database from a binary dump
+ * @param fd File to read
+ * @param tag Tag for error messages
+ * @param n Index into @ref dbtable
+ * @param tid Owning transaction
+ * @return 0 or DB_LOCK_DEADLOCK
+ */
+static int undump_one_binary(int fd, const char *tag, size_t n, DB_TXN *tid) {
+  DB *db = trackdb_lazy(dbtable[n].db);
+  off_t offset = 2;
+  struct undump_block b;
+  int err;
+
+  if((err = truncdb(tid, db)))
+    return err;
+  for(;;) {
+    undump_block(fd, tag, &offset, &b, dbtable[n].letter);
+    if(b.letter == 'E')
+      return 0;
+    if(b.data && (err = undump_store_block(db, dbtable[n].dbname, &b, tid)))
+      return err;
+  }
+}
+
 /* recompute aliases and search database from prefs, return 0 or
  * DB_LOCK_DEADLOCK */
 static int recompute_aliases(DB_TXN *tid) {
@@ -305,13 +619,13 @@ static int recompute_aliases(DB_TXN *tid) {
   if((err = cursor->c_get(cursor, prepare_data(&k), prepare_data(&d),
                           DB_FIRST)) == DB_LOCK_DEADLOCK) goto done;
   while(err == 0) {
-    data = kvp_urldecode(d.data, d.size);
+    data = decode_data(&d);
     track = xstrndup(k.data, k.size);
     if(!kvp_get(data, "_alias_for")) {
       if(!(path = kvp_get(data, "_path")))
 	disorder_error(0, "%s is not an alias but has no path", utf82mb(track));
       else
-	if((err = trackdb_notice_tid(track, path, tid)) == DB_LOCK_DEADLOCK)
+	if((err = trackdb_notice_tid(track, path, 0, tid)) == DB_LOCK_DEADLOCK)
 	  goto done;
     }
     err = cursor->c_get(cursor, prepare_data(&k), prepare_data(&d),
@@ -341,6 +655,7 @@ static void do_undump(FILE *fp, const char *tag, int remove_pathless) {
     tid = trackdb_begin_transaction();
     if(remove_aliases(tid, remove_pathless)
        || undump_from_fp(tid, fp, tag)
+       || trackdb_stats_forget(tid)
        || recompute_aliases(tid)) goto fail;
     break;
 fail:
@@ -351,6 +666,81 @@ fail:
   trackdb_commit_transaction(tid);
 }
 
+/* rebuild aliases and the search and tag indexes after a binary undump */
+static int rebuild_indexes(DB_TXN *tid, int remove_pathless) {
+  int err;
+
+  if((err = remove_aliases(tid, remove_pathless))
+     || (err = truncdb(tid, trackdb_searchdb))
+     || (err = truncdb(tid, trackdb_wordsdb))
+     || (err = truncdb(tid, trackdb_trigramsdb))
+     || (err = truncdb(tid, trackdb_tagsdb))
+     || (err = trackdb_stats_forget(tid))
+     || (err = recompute_aliases(tid)))
+    return err;
+  return 0;
+}
+
+/* restore from a binary dump in FD, which must already be verified.  Each
+ * database is restored by its own process. */
+static void do_undump_binary(int fd, const char *tag, int recover,
+                             int remove_pathless) {
+  pid_t pids[NDBTABLE], pid;
+  DB_TXN *tid;
+  size_t n;
+  int w, failed = 0;
+
+  /* Run any recovery and create any missing databases before the restore
+   * processes start */
+  trackdb_init(recover|TRACKDB_MAY_CREATE);
+  trackdb_open(TRACKDB_NO_UPGRADE);
+  trackdb_close();
+  trackdb_deinit(NULL);
+  disorder_info("undumping");
+  for(n = 0; n < NDBTABLE; ++n) {
+    if(!(pids[n] = xfork())) {
+      exitfn = _exit;
+      trackdb_init(TRACKDB_NO_RECOVER);
+      trackdb_open(TRACKDB_NO_UPGRADE);
+      for(;;) {
+        tid = trackdb_begin_transaction();
+        if(!undump_one_binary(fd, tag, n, tid))
+          break;
+        disorder_info("aborting transaction and retrying %s",
+                      dbtable[n].dbname);
+        trackdb_abort_transaction(tid);
+      }
+      trackdb_commit_transaction(tid);
+      trackdb_close();
+      trackdb_deinit(NULL);
+      _exit(0);
+    }
+  }
+  for(n = 0; n < NDBTABLE; ++n) {
+    while((pid = waitpid(pids[n], &w, 0)) < 0 && errno == EINTR)
+      ;
+    if(pid < 0)
+      disorder_fatal(errno, "error calling waitpid");
+    if(w) {
+      disorder_error(0, "restoring %s: %s", dbtable[n].dbname, wstat(w));
+      failed = 1;
+    }
+  }
+  if(failed)
+    disorder_fatal(0, "undump failed");
+  trackdb_init(TRACKDB_NO_RECOVER);
+  trackdb_open(TRACKDB_NO_UPGRADE);
+  for(;;) {
+    tid = trackdb_begin_transaction();
+    if(!rebuild_indexes(tid, remove_pathless))
+      break;
+    disorder_info("aborting transaction and retrying index rebuild");
+    trackdb_abort_transaction(tid);
+  }
+  disorder_info("committing undump");
+  trackdb_commit_transaction(tid);
+}
+
 /* just recompute alisaes */
 static void do_recompute(int remove_pathless) {
   DB_TXN *tid;
@@ -370,7 +760,8 @@ fail:
 
 int main(int argc, char **argv) {
   int n, dump = 0, undump = 0, recover = TRACKDB_NO_RECOVER, recompute = 0;
-  int remove_pathless = 0, fd;
+  int remove_pathless = 0, fd, binary = 0;
+  char magic[2];
   int changeuid = !getuid();
   const char *path;
   char *tmp;
@@ -379,12 +770,13 @@ int main(int argc, char **argv) {
   mem_init();
   if(!setlocale(LC_CTYPE, ""))
     disorder_error(errno, "error calling setlocale");
-  while((n = getopt_long(argc, argv, "hVc:dDurRaPR", options, 0)) >= 0) {
+  while((n = getopt_long(argc, argv, "hVc:dbDurRaPR", options, 0)) >= 0) {
     switch(n) {
     case 'h': help();
     case 'V': version("disorder-dump");
     case 'c': configfile = optarg; break;
     case 'd': dump = 1; break;
+    case 'b': binary = 1; break;
     case 'u': undump = 1; break;
     case 'D': debugging = 1; break;
     case 'r': recover = TRACKDB_NORMAL_RECOVER; break;
@@ -397,6 +789,8 @@ int main(int argc, char **argv) {
   }
   if(dump + undump + recompute != 1)
     disorder_fatal(0, "choose exactly one of --dump, --undump or --recompute-aliases");
+  if(binary && !dump)
+    disorder_fatal(0, "--binary only applies to --dump");
   if(recompute) {
     if(optind != argc)
       disorder_fatal(0, "--recompute-aliases does not take a filename");
@@ -421,7 +815,9 @@ int main(int argc, char **argv) {
       disorder_fatal(errno, "fdopen on %s", tmp);
     trackdb_init(recover|TRACKDB_MAY_CREATE);
     trackdb_open(TRACKDB_NO_UPGRADE);
-    do_dump(fp, tmp);
+    if(binary && !gcry_check_version(NULL))
+      disorder_fatal(0, "gcry_check_version failed");
+    do_dump(fp, tmp, binary);
     if(fclose(fp) < 0) disorder_fatal(errno, "error closing %s", tmp);
     if(rename(tmp, path) < 0)
       disorder_fatal(errno, "error renaming %s to %s", tmp, path);
@@ -435,9 +831,16 @@ int main(int argc, char **argv) {
      * if new ones are created */
     if(getuid() == 0)
       disorder_info("you might need to chown database files");
-    trackdb_init(recover|TRACKDB_MAY_CREATE);
-    trackdb_open(TRACKDB_NO_UPGRADE);
-    do_undump(fp, path, remove_pathless);
+    if(fread(magic, 1, 2, fp) == 2 && !memcmp(magic, "V1", 2)) {
+      if(!gcry_check_version(NULL))
+        disorder_fatal(0, "gcry_check_version failed");
+      undump_verify(fileno(fp), path);
+      do_undump_binary(fileno(fp), path, recover, remove_pathless);
+    } else {
+      trackdb_init(recover|TRACKDB_MAY_CREATE);
+      trackdb_open(TRACKDB_NO_UPGRADE);
+      do_undump(fp, path, remove_pathless);
+    }
     xfclose(fp);
   } else if(recompute) {
     do_recompute(remove_pathless);
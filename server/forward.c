@@ -0,0 +1,292 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file server/forward.c
+ * @brief Passing commands on from a replica to its primary
+ *
+ * A replica is a server with @c library set but not @c zone.  It shares the
+ * library server's database, and so can answer listings, searches and
+ * preference lookups itself, but it has no queue and plays nothing.
+ * Everything else is passed on to the library server, through its private
+ * socket, and the response passed back unchanged.
+ *
+ * Each client connection that needs it gets its own connection to the
+ * primary, so that logins and per-connection state such as the @b log
+ * command work as they would if the client had connected directly.
+ *
+ * Requests are sent as soon as they are made and responses matched to them
+ * in order.  A response whose code has 3 as its third digit is followed by a
+ * dot-terminated body; one with 4 there carries on until the connection is
+ * closed.
+ */
+
+#include "disorder-server.h"
+
+/** @brief One request awaiting its response */
+struct forward_request {
+  /** @brief Next request */
+  struct forward_request *next;
+
+  /** @brief Called with each line of the response */
+  forward_line_callback *line;
+
+  /** @brief Called when the response is complete */
+  forward_done_callback *done;
+
+  /** @brief Passed to @ref line and @ref done */
+  void *u;
+};
+
+/** @brief A connection to the primary */
+struct forward {
+  /** @brief Reader, or NULL once closed */
+  ev_reader *r;
+
+  /** @brief Writer, or NULL once closed */
+  ev_writer *w;
+
+  /** @brief Nonzero once the greeting has been read */
+  int greeted;
+
+  /** @brief What the next line of the response is */
+  enum {
+    /** @brief Status line */
+    forward_status,
+    /** @brief Part of a dot-terminated body */
+    forward_body,
+    /** @brief Part of a response that lasts as long as the connection */
+    forward_indefinite
+  } state;
+
+  /** @brief Oldest request awaiting its response */
+  struct forward_request *head;
+
+  /** @brief Where to link the next request */
+  struct forward_request **tail;
+};
+
+/** @brief Test whether this server is a replica
+ * @return Nonzero for a replica
+ */
+int is_replica(void) {
+  return config->library && !config->zone;
+}
+
+/** @brief Shut down a connection to the primary
+ * @param f Connection
+ * @param ok Passed to each waiting request's done callback
+ *
+ * If @p ok is -1 the callbacks are not called.
+ */
+static void forward_shutdown(struct forward *f, int ok) {
+  struct forward_request *fr;
+
+  if(f->r)
+    ev_reader_cancel(f->r);
+  if(f->w)
+    ev_writer_close(f->w);
+  f->r = 0;
+  f->w = 0;
+  while((fr = f->head)) {
+    f->head = fr->next;
+    if(ok >= 0 && fr->done)
+      fr->done(ok, fr->u);
+  }
+  f->tail = &f->head;
+}
+
+/** @brief Called when the connection to the primary fails */
+static int forward_error(ev_source attribute((unused)) *ev,
+                         int errno_value,
+                         void *u) {
+  struct forward *f = u;
+
+  if(errno_value && errno_value != EPIPE && errno_value != ECONNRESET)
+    disorder_error(errno_value, "error talking to primary server");
+  forward_shutdown(f, 0);
+  return 0;
+}
+
+/** @brief Called when the primary has sent something */
+static int forward_read(ev_source attribute((unused)) *ev,
+                        ev_reader *reader,
+                        void *ptr,
+                        size_t bytes,
+                        int eof,
+                        void *u) {
+  struct forward *f = u;
+  struct forward_request *fr;
+  char *eol, *line;
+  int last;
+
+  while((eol = memchr(ptr, '\n', bytes))) {
+    *eol++ = 0;
+    line = ptr;
+    bytes -= eol - (char *)ptr;
+    ptr = eol;
+    ev_reader_consume(reader, eol - line);
+    if(!f->greeted) {
+      if(strncmp(line, "231 ", 4)) {
+        disorder_error(0, "unexpected greeting from primary server: %s",
+                       line);
+        forward_shutdown(f, 0);
+        return 0;
+      }
+      f->greeted = 1;
+      continue;
+    }
+    if(!(fr = f->head)) {
+      disorder_error(0, "primary server sent unexpected output: %s", line);
+      continue;
+    }
+    switch(f->state) {
+    case forward_status:
+      last = 1;
+      if(strlen(line) >= 3 && line[2] == '3') {
+        f->state = forward_body;
+        last = 0;
+      } else if(strlen(line) >= 3 && line[2] == '4') {
+        f->state = forward_indefinite;
+        last = 0;
+      }
+      break;
+    case forward_body:
+      last = !strcmp(line, ".");
+      break;
+    default:
+      last = 0;
+      break;
+    }
+    if(fr->line)
+      fr->line(line, fr->u);
+    /* A callback may have closed us */
+    if(!f->r)
+      return 0;
+    if(last) {
+      f->state = forward_status;
+      if(!(f->head = fr->next))
+        f->tail = &f->head;
+      if(fr->done)
+        fr->done(1, fr->u);
+      if(!f->r)
+        return 0;
+    }
+  }
+  if(eof)
+    forward_shutdown(f, 0);
+  return 0;
+}
+
+/** @brief Connect to the primary
+ * @param ev Event loop
+ * @return Connection, or NULL on error
+ */
+struct forward *forward_open(ev_source *ev) {
+  struct sockaddr_un sun;
+  struct forward *f;
+  char *path;
+  int fd;
+
+  byte_xasprintf(&path, "%s/private/socket", config->library);
+  if(strlen(path) >= sizeof sun.sun_path) {
+    disorder_error(0, "socket path %s is too long", path);
+    return NULL;
+  }
+  memset(&sun, 0, sizeof sun);
+  sun.sun_family = AF_UNIX;
+  strcpy(sun.sun_path, path);
+  if((fd = socket(PF_UNIX, SOCK_STREAM, 0)) < 0) {
+    disorder_error(errno, "error calling socket");
+    return NULL;
+  }
+  if(connect(fd, (const struct sockaddr *)&sun, sizeof sun) < 0) {
+    disorder_error(errno, "error connecting to %s", path);
+    xclose(fd);
+    return NULL;
+  }
+  nonblock(fd);
+  cloexec(fd);
+  f = xmalloc(sizeof *f);
+  f->tail = &f->head;
+  if(!(f->w = ev_writer_new(ev, fd, forward_error, f,
+                            "primary server writer"))) {
+    xclose(fd);
+    return NULL;
+  }
+  /* Responses such as the log may be idle for a long time */
+  ev_writer_time_bound(f->w, 0);
+  if(!(f->r = ev_reader_new(ev, fd, forward_read, forward_error, f,
+                            "primary server reader"))) {
+    ev_writer_close(f->w);
+    return NULL;
+  }
+  ev_tie(f->r, f->w);
+  return f;
+}
+
+/** @brief Send a request to the primary
+ * @param f Connection
+ * @param request Request, including any body and the final newline
+ * @param line Called with each line of the response, or NULL
+ * @param done Called when the response is complete, or NULL
+ * @param u Passed to @p line and @p done
+ *
+ * @p done gets 1 if the response was complete and 0 if the connection failed
+ * first.  @p f must not be closed (see forward_closed()).
+ */
+void forward_request(struct forward *f,
+                     const char *request,
+                     forward_line_callback *line,
+                     forward_done_callback *done,
+                     void *u) {
+  struct forward_request *fr = xmalloc(sizeof *fr);
+
+  fr->line = line;
+  fr->done = done;
+  fr->u = u;
+  assert(f->w);
+  *f->tail = fr;
+  f->tail = &fr->next;
+  sink_writes(ev_writer_sink(f->w), request);
+}
+
+/** @brief Test whether a connection to the primary has closed
+ * @param f Connection
+ * @return Nonzero if @p f can no longer be used
+ */
+int forward_closed(const struct forward *f) {
+  return !f->w;
+}
+
+/** @brief Close a connection to the primary
+ * @param f Connection
+ *
+ * Requests still awaiting their responses are abandoned without calling
+ * their callbacks.
+ */
+void forward_close(struct forward *f) {
+  forward_shutdown(f, -1);
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -17,10 +17,17 @@
  */
 /** @file server/gstdecode.c
  * @brief Decode compressed audio files, and apply ReplayGain.
+ *
+ * If @c DISORDER_RAW_FORMAT is set, as it is for a @c --direct player, then
+ * the pipeline is made to produce exactly that format and the samples are
+ * written straight to the speaker, without block headers.  Since GStreamer
+ * does all the conversion there is never any need for @c disorder-normalize.
  */
 
 #include "disorder-server.h"
 
+#include <sys/uio.h>
+
 #include "speaker-protocol.h"
 
 /* Ugh.  It turns out that libxml tries to define a function called
@@ -49,12 +56,14 @@
 #define N(v) (sizeof(v)/sizeof(*(v)))
 
 static FILE *fp;
+static int outfd = -1;
 static const char *file;
 static GstAppSink *appsink;
 static GstElement *pipeline;
 static GMainLoop *loop;
 static unsigned flags = 0;
 #define f_stream 1u
+#define f_direct 2u
 
 #define MODES(_) _("off", OFF) _("track", TRACK) _("album", ALBUM)
 enum {
@@ -83,9 +92,13 @@ static int mode = ALBUM;
 static int quality = -1;
 static int shape = -1;
 static gdouble fallback = 0.0;
+static long seek = 0;
 
 static struct stream_header hdr;
 
+/* The format the pipeline must produce. */
+static struct stream_header target;
+
 /* Report the pads of an element ELT, as iterated by IT; WHAT is an adjective
  * phrase describing the pads for use in the output.
  */
@@ -215,7 +228,7 @@ static void prepare_pipeline(void)
   GstElement *tail = sink;
   GstElement *gain;
   GstCaps *caps;
-  const struct stream_header *fmt = &config->sample_format;
+  const struct stream_header *fmt = &target;
 
   if(!source || !decode || !resample || !convert || !sink)
     disorder_fatal(0, "failed to create GStreamer elements: "
@@ -399,6 +412,10 @@ static GstFlowReturn cb_preroll(GstAppSink *sink, gpointer UNUSED u)
 
 #endif
 
+  /* The speaker has no way to cope with anything else. */
+  if((flags&f_direct) && !formats_equal(&hdr, &target))
+    disorder_fatal(0, "can't decode `%s': wrong format negotiated", file);
+
 #ifdef HAVE_GSTREAMER_0_10
   gst_buffer_unref(buf);
 #else
@@ -407,6 +424,29 @@ static GstFlowReturn cb_preroll(GstAppSink *sink, gpointer UNUSED u)
   return GST_FLOW_OK;
 }
 
+/* Write out all of the N pieces of data described by IOV, straight to the
+ * output file descriptor.  IOV is modified.
+ */
+static void write_direct(struct iovec *iov, int n)
+{
+  ssize_t w;
+
+  while(n > 0) {
+    if((w = writev(outfd, iov, n)) < 0) {
+      if(errno == EINTR) continue;
+      disorder_fatal(errno, "output");
+    }
+    while(n > 0 && (size_t)w >= iov->iov_len) {
+      w -= iov->iov_len;
+      iov++; n--;
+    }
+    if(n > 0) {
+      iov->iov_base = (char *)iov->iov_base + w;
+      iov->iov_len -= w;
+    }
+  }
+}
+
 /* A new buffer of sample data has arrived, so we should pass it on with
  * appropriate framing.
  */
@@ -418,8 +458,9 @@ static GstFlowReturn cb_buffer(GstAppSink *sink, gpointer UNUSED u)
   GstSample *samp = gst_app_sink_pull_sample(sink);
   GstBuffer *buf = gst_sample_get_buffer(samp);
   GstMemory *mem;
-  GstMapInfo map;
-  gint i, n;
+  GstMapInfo map, maps[16];
+  struct iovec iov[N(maps)];
+  gint i, j, m, n;
 #endif
 
   /* Make sure we actually have a grip on the sample format here. */
@@ -428,19 +469,43 @@ static GstFlowReturn cb_buffer(GstAppSink *sink, gpointer UNUSED u)
   /* Write out a frame of audio data. */
 #ifdef HAVE_GSTREAMER_0_10
   hdr.nbytes = GST_BUFFER_SIZE(buf);
-  if((!(flags&f_stream) && fwrite(&hdr, sizeof(hdr), 1, fp) != 1) ||
-     fwrite(GST_BUFFER_DATA(buf), 1, hdr.nbytes, fp) != hdr.nbytes)
+  if(flags&f_direct) {
+    struct iovec iov[1];
+
+    iov[0].iov_base = GST_BUFFER_DATA(buf);
+    iov[0].iov_len = hdr.nbytes;
+    write_direct(iov, 1);
+  } else if((!(flags&f_stream) && fwrite(&hdr, sizeof(hdr), 1, fp) != 1) ||
+            fwrite(GST_BUFFER_DATA(buf), 1, hdr.nbytes, fp) != hdr.nbytes)
     disorder_fatal(errno, "output");
 #else
-  for(i = 0, n = gst_buffer_n_memory(buf); i < n; i++) {
-    mem = gst_buffer_peek_memory(buf, i);
-    if(!gst_memory_map(mem, &map, GST_MAP_READ))
-      disorder_fatal(0, "failed to map sample buffer");
-    hdr.nbytes = map.size;
-    if((!(flags&f_stream) && fwrite(&hdr, sizeof(hdr), 1, fp) != 1) ||
-       fwrite(map.data, 1, map.size, fp) != map.size)
-      disorder_fatal(errno, "output");
-    gst_memory_unmap(mem, &map);
+  /* Going straight to the speaker, a buffer's memory blocks can all be
+   * written with a single system call, without copying them anywhere. */
+  if(flags&f_direct) {
+    for(i = 0, n = gst_buffer_n_memory(buf); i < n; i += m) {
+      m = n - i < (gint)N(maps) ? n - i : (gint)N(maps);
+      for(j = 0; j < m; j++) {
+        mem = gst_buffer_peek_memory(buf, i + j);
+        if(!gst_memory_map(mem, &maps[j], GST_MAP_READ))
+          disorder_fatal(0, "failed to map sample buffer");
+        iov[j].iov_base = maps[j].data;
+        iov[j].iov_len = maps[j].size;
+      }
+      write_direct(iov, m);
+      for(j = 0; j < m; j++)
+        gst_memory_unmap(maps[j].memory, &maps[j]);
+    }
+  } else {
+    for(i = 0, n = gst_buffer_n_memory(buf); i < n; i++) {
+      mem = gst_buffer_peek_memory(buf, i);
+      if(!gst_memory_map(mem, &map, GST_MAP_READ))
+        disorder_fatal(0, "failed to map sample buffer");
+      hdr.nbytes = map.size;
+      if((!(flags&f_stream) && fwrite(&hdr, sizeof(hdr), 1, fp) != 1) ||
+         fwrite(map.data, 1, map.size, fp) != map.size)
+        disorder_fatal(errno, "output");
+      gst_memory_unmap(mem, &map);
+    }
   }
 #endif
 
@@ -478,6 +543,21 @@ static void decode(void)
   gst_app_sink_set_drop(appsink, FALSE);
   gst_app_sink_set_callbacks(appsink, &callbacks, 0, 0);
 
+  /* If we're resuming part way through, wait for the pipeline to preroll and
+   * then seek.  The demuxer or decoder does the seeking in whatever way suits
+   * the format.
+   */
+  if(seek) {
+    gst_element_set_state(pipeline, GST_STATE_PAUSED);
+    if(gst_element_get_state(pipeline, 0, 0, GST_CLOCK_TIME_NONE) ==
+       GST_STATE_CHANGE_FAILURE)
+      disorder_fatal(0, "can't decode `%s': failed to preroll", file);
+    if(!gst_element_seek_simple(pipeline, GST_FORMAT_TIME,
+                                GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE,
+                                seek*GST_SECOND))
+      disorder_fatal(0, "can't seek in `%s'", file);
+  }
+
   /* Set the ball rolling. */
   gst_element_set_state(pipeline, GST_STATE_PLAYING);
 
@@ -562,7 +642,7 @@ static void NORETURN help(void)
 int main(int argc, char *argv[])
 {
   int n;
-  const char *e;
+  const char *e, *trace_id;
 
   /* Initial setup. */
   set_progname(argv);
@@ -587,23 +667,51 @@ int main(int argc, char *argv[])
   file = argv[optind++];
   if(optind < argc) disorder_fatal(0, "excess arguments");
   config_per_user = 0;
+  if(!configfile && (e = getenv("DISORDER_RAW_CONFIG")) != 0)
+    configfile = xstrdup(e);
   if(config_read(1, 0)) disorder_fatal(0, "cannot read configuration");
 
+  /* Work out what we're meant to produce.  A direct player is told what the
+   * speaker wants.
+   */
+  target = config->sample_format;
+  if((e = getenv("DISORDER_RAW_FORMAT")) != 0) {
+    int rate, bits, channels, endian;
+
+    if(sscanf(e, "%d %d %d %d", &rate, &bits, &channels, &endian) != 4)
+      disorder_fatal(0, "invalid DISORDER_RAW_FORMAT `%s'", e);
+    target.rate = rate;
+    target.bits = bits;
+    target.channels = channels;
+    target.endian = endian;
+    flags |= f_direct;
+  }
+
   /* Set up the GStreamer machinery. */
   gst_init(0, 0);
   prepare_pipeline();
 
   /* Set up the output file. */
-  if((e = getenv("DISORDER_RAW_FD")) != 0) {
+  if((e = getenv("DISORDER_RAW_SEEK")) != 0 && (seek = atol(e)) < 0)
+    seek = 0;
+  if(flags&f_direct)
+    outfd = (e = getenv("DISORDER_RAW_FD")) != 0 ? atoi(e) : 1;
+  else if((e = getenv("DISORDER_RAW_FD")) != 0) {
     if((fp = fdopen(atoi(e), "wb")) == 0) disorder_fatal(errno, "fdopen");
   } else
     fp = stdout;
 
   /* Let's go. */
+  trace_id = trace_inherit();
+  trace_event(TRACE_BEGIN, "decode", trace_id, NULL);
   decode();
 
   /* And now we're done. */
-  xfclose(fp);
+  if(flags&f_direct) {
+    if(close(outfd) < 0) disorder_fatal(errno, "output");
+  } else
+    xfclose(fp);
+  trace_event(TRACE_END, "decode", trace_id, NULL);
   return (0);
 }
 
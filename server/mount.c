@@ -41,6 +41,13 @@ static int compare_fsstat(const void *av, const void *bv) {
 #endif
 
 #if HAVE_GETFSSTAT || defined PATH_MTAB
+/** @brief Called when something has been mounted or unmounted */
+static void mount_changed(ev_source *ev_) {
+  /* Watches don't see into newly mounted filesystems, so start again */
+  watch_reset(ev_);
+  watch_rescan(ev_, 1/*check*/, 0, 0);
+}
+
 void periodic_mount_check(ev_source *ev_) {
   if(!config->mount_rescan)
     return;
@@ -73,7 +80,7 @@ void periodic_mount_check(ev_source *ev_) {
   }
   current = gcry_md_read(h, GCRY_MD_SHA1);
   if(!first && memcmp(current, last, sizeof last))
-    trackdb_rescan(ev_, 1/*check*/, 0, 0);
+    mount_changed(ev_);
   memcpy(last, current, sizeof last);
   first = 0;
   gcry_md_close(h);
@@ -109,7 +116,7 @@ void periodic_mount_check(ev_source *ev_) {
   }
   current = gcry_md_read(h, GCRY_MD_SHA1);
   if(!first && memcmp(current, last, sizeof last))
-    trackdb_rescan(ev_, 1/*check*/, 0, 0);
+    mount_changed(ev_);
   memcpy(last, current, sizeof last);
   first = 0;
  done:
@@ -122,7 +129,7 @@ void periodic_mount_check(ev_source *ev_) {
   
   if(stat(PATH_MTAB, &sb) >= 0) {
     if(last_mount != 0 && last_mount != sb.st_mtime)
-      trackdb_rescan(ev_, 1/*check*/, 0, 0);
+      mount_changed(ev_);
     last_mount = sb.st_mtime;
   }
 #endif
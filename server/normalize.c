@@ -18,9 +18,8 @@
 /** @file server/normalize.c
  * @brief Convert "raw" format output to the configured format
  *
- * If libsamplerate is available then resample_convert() is used to do all
- * conversions.  If not then we invoke sox (even for trivial conversions such
- * as byte-swapping).  The sox support might be removed in a future version.
+ * All conversions are done with resample_convert().  A resampler is kept for
+ * as long as the input stays in the same format.
  */
 
 #include "disorder-server.h"
@@ -56,14 +55,87 @@ static void attribute((noreturn)) help(void) {
   exit(0);
 }
 
+#if HAVE_SPLICE
+/** @brief Pipe for splice_copy(), once created */
+static int splice_pipe[2] = { -1, -1 };
+
+/** @brief Set if splice() can't be used */
+static int splice_unusable;
+
+/** @brief Copy bytes from one file descriptor to another with splice()
+ * @param infd File descriptor read from
+ * @param outfd File descriptor to write to
+ * @param n Number of bytes to copy
+ * @return Number of bytes left to copy some other way
+ *
+ * Neither end is a pipe (they are the decoder's and the speaker's sockets),
+ * so the data goes through a pipe of our own.  It stays in the kernel
+ * throughout.
+ *
+ * If splice() turns out not to work with these file descriptors then it is
+ * not tried again and the caller copies everything instead.
+ */
+static size_t splice_copy(int infd, int outfd, size_t n) {
+  ssize_t in, out;
+
+  if(splice_unusable)
+    return n;
+  if(splice_pipe[0] == -1) {
+    if(pipe(splice_pipe) < 0) {
+      splice_unusable = 1;
+      return n;
+    }
+#ifdef F_SETPIPE_SZ
+    /* Move as much at once as the userspace copy would */
+    fcntl(splice_pipe[1], F_SETPIPE_SZ, (int)sizeof buffer);
+#endif
+  }
+  while(n > 0) {
+    in = splice(infd, NULL, splice_pipe[1], NULL,
+                n > sizeof buffer ? sizeof buffer : n,
+                SPLICE_F_MOVE|SPLICE_F_MORE);
+    if(in < 0) {
+      if(errno == EINTR)
+        continue;
+      if(errno == EINVAL || errno == ENOSYS) {
+        /* Nothing has been taken from infd, so the caller can carry on */
+        splice_unusable = 1;
+        return n;
+      }
+      disorder_fatal(errno, "read error");
+    }
+    if(in == 0)
+      disorder_fatal(0, "unexpected EOF");
+    n -= in;
+    while(in > 0) {
+      out = splice(splice_pipe[0], NULL, outfd, NULL, in,
+                   SPLICE_F_MOVE|SPLICE_F_MORE);
+      if(out < 0) {
+        if(errno == EINTR)
+          continue;
+        disorder_fatal(errno, "write error");
+      }
+      in -= out;
+    }
+  }
+  return 0;
+}
+#endif
+
 /** @brief Copy bytes from one file descriptor to another
  * @param infd File descriptor read from
  * @param outfd File descriptor to write to
  * @param n Number of bytes to copy
+ *
+ * Where possible splice_copy() is used, so that the data never has to be
+ * copied into and out of @ref buffer.
  */
 static void copy(int infd, int outfd, size_t n) {
   ssize_t written;
 
+#if HAVE_SPLICE
+  n = splice_copy(infd, outfd, n);
+#endif
   while(n > 0) {
     const ssize_t readden = read(infd, buffer,
                                  n > sizeof buffer ? sizeof buffer : n);
@@ -86,44 +158,6 @@ static void copy(int infd, int outfd, size_t n) {
   }
 }
 
-#if !HAVE_SAMPLERATE_H
-static void soxargs(const char ***pp, char **qq,
-                    const struct stream_header *header) {
-  *(*pp)++ = "-t.raw";
-  *(*pp)++ = "-s";
-  *qq += sprintf((char *)(*(*pp)++ = *qq), "-r%d", header->rate) + 1;
-  *qq += sprintf((char *)(*(*pp)++ = *qq), "-c%d", header->channels) + 1;
-  /* sox 12.17.9 insists on -b etc; CVS sox insists on -<n> etc; both are
-   * deployed! */
-  switch(config->sox_generation) {
-  case 0:
-    if(header->bits != 8
-       && header->endian != ENDIAN_NATIVE)
-      *(*pp)++ = "-x";
-    switch(header->bits) {
-    case 8: *(*pp)++ = "-b"; break;
-    case 16: *(*pp)++ = "-w"; break;
-    case 32: *(*pp)++ = "-l"; break;
-    case 64: *(*pp)++ = "-d"; break;
-    default: disorder_fatal(0, "cannot handle sample size %d", header->bits);
-    }
-    break;
-  case 1:
-    if(header->bits != 8
-       && header->endian != ENDIAN_NATIVE)
-      switch(header->endian) {
-      case ENDIAN_BIG: *(*pp)++ = "-B"; break;
-      case ENDIAN_LITTLE: *(*pp)++ = "-L"; break;
-      }
-    if(header->bits % 8)
-      disorder_fatal(0, "cannot handle sample size %d", header->bits);
-    *qq += sprintf((char *)(*(*pp)++ = *qq), "-%d", header->bits / 8) + 1;
-    break;
-  default:
-    disorder_fatal(0, "unknown sox_generation %ld", config->sox_generation);
-  }
-}
-#else
 static void converted(uint8_t *bytes,
                       size_t nbytes,
                       void attribute((unused)) *cd) {
@@ -140,13 +174,17 @@ static void converted(uint8_t *bytes,
     nbytes -= n;
   }
 }
-#endif
+
+/** @brief Flush out the end of the data in the old format */
+static void flush(struct resampler *rs) {
+  resample_convert(rs, (uint8_t *)buffer, 0, 1, converted, 0);
+}
 
 int main(int argc, char attribute((unused)) **argv) {
   struct stream_header header, latest_format;
-  int n, outfd = -1, logsyslog = !isatty(2), rs_in_use = 0;
-  pid_t pid = -1;
+  int n, logsyslog = !isatty(2), rs_in_use = 0;
   struct resampler rs[1];
+  const char *trace_id;
 
   set_progname(argv);
   if(!setlocale(LC_CTYPE, ""))
@@ -170,6 +208,8 @@ int main(int argc, char attribute((unused)) **argv) {
     openlog(progname, LOG_PID, LOG_DAEMON);
     log_default = &log_syslog;
   }
+  trace_id = trace_inherit();
+  trace_event(TRACE_BEGIN, "normalize", trace_id, NULL);
   memset(&latest_format, 0, sizeof latest_format);
   for(;;) {
     /* Read one header */
@@ -205,31 +245,14 @@ int main(int argc, char attribute((unused)) **argv) {
     if(header.nbytes == 0)
       continue;
     /* If the format has changed we stop/start the converter */
-#if HAVE_SAMPLERATE_H
-    /* We have libsamplerate */
-    if(formats_equal(&header, &config->sample_format))
-      /* If the format is already correct then we just write out the data */
-      copy(0, 1, header.nbytes);
-    else {
-      /* If we have a resampler active already check it is suitable and destroy
-       * it if not */
+    if(!formats_equal(&header, &latest_format)) {
       if(rs_in_use) {
         D(("call resample_close"));
+        flush(rs);
         resample_close(rs);
         rs_in_use = 0;
       }
-      /*syslog(LOG_INFO, "%d/%d/%d/%d/%d -> %d/%d/%d/%d/%d",
-             header.bits,
-             header.channels, 
-             header.rate,
-             1,
-             header.endian,
-             config->sample_format.bits,
-             config->sample_format.channels, 
-             config->sample_format.rate,
-             1,
-             config->sample_format.endian);*/
-      if(!rs_in_use) {
+      if(!formats_equal(&header, &config->sample_format)) {
         /* Create a suitable resampler. */
         D(("call resample_init"));
         resample_init(rs,
@@ -243,14 +266,20 @@ int main(int argc, char attribute((unused)) **argv) {
                       config->sample_format.rate,
                       1,                /* signed */
                       config->sample_format.endian);
-        latest_format = header;
         rs_in_use = 1;
         /* TODO speaker protocol does not record signedness of samples.  It's
          * assumed that they are always signed.  This should be fixed in the
          * future (and the sample format syntax extended in a compatible
          * way). */
       }
-      /* Feed data through the resampler */
+      latest_format = header;
+    }
+    if(!rs_in_use)
+      /* If the format is already correct then we just write out the data */
+      copy(0, 1, header.nbytes);
+    else {
+      /* Feed data through the resampler.  It is kept between chunks in the
+       * same format so that there is no discontinuity at the boundaries. */
       size_t used = 0, left = header.nbytes;
       while(used || left) {
         if(left) {
@@ -264,83 +293,26 @@ int main(int argc, char attribute((unused)) **argv) {
             disorder_fatal(0, "unexpected EOF");
           left -= r;
           used += r;
-          //syslog(LOG_INFO, "read %zd bytes", r);
           D(("read %zd bytes", r));
         }
-        /*syslog(LOG_INFO, " in: %02x %02x %02x %02x",
-               (uint8_t)buffer[0],
-               (uint8_t)buffer[1], 
-               (uint8_t)buffer[2],
-               (uint8_t)buffer[3]);*/
-        D(("calling resample_convert used=%zu !left=%d", used, !left));
+        D(("calling resample_convert used=%zu", used));
         const size_t consumed = resample_convert(rs,
                                                  (uint8_t *)buffer, used,
-                                                 !left,
+                                                 0,
                                                  converted, 0);
-        //syslog(LOG_INFO, "used=%zu consumed=%zu", used, consumed);
         D(("consumed=%zu", consumed));
         memmove(buffer, buffer + consumed, used - consumed);
         used -= consumed;
+        if(!left && used && !consumed)
+          disorder_fatal(0, "chunk does not contain whole frames");
       }
     }
-#else
-    /* We do not have libsamplerate.  We will use sox instead. */
-    if(!formats_equal(&header, &latest_format)) {
-      if(pid != -1) {
-        /* There's a running converter, stop it */
-        xclose(outfd);
-        if(waitpid(pid, &n, 0) < 0)
-          disorder_fatal(errno, "error calling waitpid");
-        if(n)
-          disorder_fatal(0, "sox failed: %#x", n);
-        pid = -1;
-        outfd = -1;
-      }
-      if(!formats_equal(&header, &config->sample_format)) {
-        const char *av[32], **pp = av;
-        char argbuf[1024], *q = argbuf;
-        
-        /* Input format doesn't match target, need to start a converter */
-        *pp++ = "sox";
-        soxargs(&pp, &q, &header);
-        *pp++ = "-";                  /* stdin */
-        soxargs(&pp, &q, &config->sample_format);
-        *pp++ = "-";                  /* stdout */
-        *pp = 0;
-        /* This pipe will be sox's stdin */
-        int p[2];
-        xpipe(p);
-        if(!(pid = xfork())) {
-          exitfn = _exit;
-          xdup2(p[0], 0);
-          xclose(p[0]);
-          xclose(p[1]);
-          execvp(av[0], (char **)av);
-          disorder_fatal(errno, "sox");
-        }
-        xclose(p[0]);
-        outfd = p[1];
-      } else
-        /* Input format matches output, can just copy bytes */
-        outfd = 1;
-      /* Remember current format for next iteration */
-      latest_format = header;
-    }
-    /* Convert or copy this chunk */
-    copy(0, outfd, header.nbytes);
-#endif
-  }
-  if(outfd != -1)
-    xclose(outfd);
-  if(pid != -1) {
-    /* There's still a converter running */
-    if(waitpid(pid, &n, 0) < 0)
-      disorder_fatal(errno, "error calling waitpid");
-    if(n)
-      disorder_fatal(0, "sox failed: %#x", n);
   }
-  if(rs_in_use)
+  if(rs_in_use) {
+    flush(rs);
     resample_close(rs);
+  }
+  trace_event(TRACE_END, "normalize", trace_id, NULL);
   return 0;
 }
 
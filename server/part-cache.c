@@ -0,0 +1,116 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file server/part-cache.c
+ * @brief Caching name parts
+ *
+ * Clients ask for the same parts of the same tracks over and over, for
+ * instance each time they redisplay the queue.  Working one out means
+ * resolving the track, reading its preferences, matching the name against
+ * the @c namepart regexps and perhaps applying every @c transform, so the
+ * answers are remembered.
+ *
+ * Like the query cache, entries are only used while @ref trackdb_generation
+ * is unchanged, so any preference change, rescan or reconfiguration makes
+ * them stale.  They share the query cache's @c query_cache_kbyte budget.
+ */
+#include "disorder-server.h"
+
+/** @brief Cache type for name parts */
+static const struct cache_type part_cache_type = { 3600 };
+
+/** @brief A cached name part */
+struct part_cached {
+  /** @brief Value of @ref trackdb_generation when the part was found */
+  unsigned long generation;
+
+  /** @brief Name part, or NULL if the track could not be resolved */
+  const char *value;
+};
+
+/** @brief Construct the cache key for a name part
+ * @param track Track name as requested
+ * @param context Context
+ * @param part Part
+ * @param transform Nonzero if the part is transformed for display
+ * @return Cache key
+ */
+static char *part_cache_key(const char *track, const char *context,
+                            const char *part, int transform) {
+  char *key;
+
+  /* The prefix keeps these keys apart from the query cache's */
+  byte_xasprintf(&key, "part %d %s %s %s", transform, quoteutf8(context),
+                 quoteutf8(part), quoteutf8(track));
+  return key;
+}
+
+/** @brief Look up a name part in the cache
+ * @param track Track name as requested
+ * @param context Context
+ * @param part Part
+ * @param transform Nonzero if the part is transformed for display
+ * @param valuep Where to store the part, or NULL if the track could not be
+ * resolved
+ * @return Nonzero if the part was found in the cache
+ */
+int part_cache_get(const char *track, const char *context, const char *part,
+                   int transform, const char **valuep) {
+  const struct part_cached *cached;
+
+  if(!config->query_cache_kbyte)
+    return 0;
+  if(!(cached = cache_get(&part_cache_type,
+                          part_cache_key(track, context, part, transform)))
+     || cached->generation != trackdb_generation)
+    return 0;
+  *valuep = cached->value;
+  return 1;
+}
+
+/** @brief Remember a name part
+ * @param track Track name as requested
+ * @param context Context
+ * @param part Part
+ * @param transform Nonzero if the part is transformed for display
+ * @param value Name part, or NULL if the track could not be resolved
+ */
+void part_cache_put(const char *track, const char *context, const char *part,
+                    int transform, const char *value) {
+  struct part_cached *cached;
+  char *key;
+
+  if(!config->query_cache_kbyte)
+    return;
+  key = part_cache_key(track, context, part, transform);
+  cached = xmalloc(sizeof *cached);
+  cached->generation = trackdb_generation;
+  cached->value = value ? xstrdup(value) : 0;
+  cache_budget((size_t)config->query_cache_kbyte * 1024);
+  cache_put_sized(&part_cache_type, key, cached,
+                  sizeof *cached + strlen(key) + (value ? strlen(value) : 0)
+                  + 2);
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
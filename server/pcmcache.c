@@ -0,0 +1,384 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file server/pcmcache.c
+ * @brief Decode-ahead cache
+ *
+ * If @c decode_ahead is set then the next few tracks in the queue are decoded
+ * in advance into files in the @c decode_cache directory.  When such a track
+ * is prepared the cached copy is sent to the speaker instead of running the
+ * decoder, so a slow or stalled filesystem can't interrupt it once it has
+ * started.
+ *
+ * Only one track is decoded ahead at a time.  Only @c --direct players are
+ * used, since then the decoder's exit status tells us when its output is
+ * complete.  Output goes to a temporary file which is renamed into place on
+ * success.
+ *
+ * Cache files are named after a hash of the track name, sample format and the
+ * track file's stat signature (see trackdb_stat_signature()), so a cached copy
+ * stops being used as soon as the file it was decoded from is modified or
+ * replaced.  The least recently used are deleted to keep the total size within
+ * @c decode_cache_kbyte.  The cache is also emptied when the server starts.
+ *
+ * Any decode-ahead job still running at shutdown is killed and reaped by
+ * pcmcache_quitting().
+ */
+#include "disorder-server.h"
+
+#include <dirent.h>
+#include <utime.h>
+
+/** @brief Track currently being decoded ahead, or NULL
+ *
+ * This is a copy of the queue entry, so that the real one remains free to be
+ * prepared in the normal way.
+ */
+static struct queue_entry *job;
+
+/** @brief Raw path of @ref job's track */
+static const char *job_rawpath;
+
+/** @brief Stat signature of @ref job's track when it was started */
+static char *job_sig;
+
+/** @brief Set once the server is shutting down */
+static int stopped;
+
+/** @brief Cache paths of tracks that could not be decoded ahead */
+static hash *failed;
+
+/** @brief Return the cache directory */
+static const char *pcmcache_dir(void) {
+  return config->decode_cache ? config->decode_cache
+                              : config_get_file("decode-cache");
+}
+
+/** @brief Return the cache file name for a track
+ * @param track Track name
+ * @param sig Stat signature of the track's file
+ * @return Path to cache file
+ */
+static char *pcmcache_path(const char *track, const char *sig) {
+  uint8_t digest[20];
+  char *key, *path;
+
+  byte_xasprintf(&key, "%s\n%d %d %d %d\n%s", track,
+                 (int)config->sample_format.rate,
+                 (int)config->sample_format.bits,
+                 (int)config->sample_format.channels,
+                 (int)config->sample_format.endian,
+                 sig);
+  gcry_md_hash_buffer(GCRY_MD_SHA1, digest, key, strlen(key));
+  byte_xasprintf(&path, "%s/%s", pcmcache_dir(), hex(digest, sizeof digest));
+  return path;
+}
+
+/** @brief Return the temporary file name for a track
+ * @param track Track name
+ * @return Path to temporary file
+ *
+ * This doesn't depend on the stat signature, since the decoder may be run in a
+ * pre-forked helper that only knows the track name.  pcmcache_finished()
+ * renames it to the signature recorded when the job was started.
+ */
+static char *pcmcache_temp(const char *track) {
+  char *tmp;
+
+  byte_xasprintf(&tmp, "%s.tmp", pcmcache_path(track, ""));
+  return tmp;
+}
+
+/** @brief Open the cached copy of a track
+ * @param track Track name
+ * @param rawpath Raw path of the track's file
+ * @return File descriptor or -1 if not cached
+ *
+ * The cache file's modification time is updated, since it is used to find
+ * the least recently used entries.
+ */
+int pcmcache_open(const char *track, const char *rawpath) {
+  char *path, *sig;
+  int fd;
+
+  if(!config->decode_ahead)
+    return -1;
+  if(!(sig = trackdb_stat_signature(rawpath)))
+    return -1;
+  path = pcmcache_path(track, sig);
+  if((fd = open(path, O_RDONLY)) < 0)
+    return -1;
+  utime(path, NULL);
+  D(("using decode-ahead cache for %s", track));
+  return fd;
+}
+
+/** @brief Send a cached track to the speaker
+ * @param fd Cache file
+ * @param sfd Connection to speaker
+ * @return Process exit code
+ *
+ * Called in a subprocess.
+ */
+int pcmcache_send(int fd, int sfd) {
+  static char buffer[65536];
+  ssize_t n, written, w;
+
+  for(;;) {
+    if((n = read(fd, buffer, sizeof buffer)) < 0) {
+      if(errno == EINTR)
+        continue;
+      disorder_fatal(errno, "error reading decode-ahead cache");
+    }
+    if(!n)
+      break;
+    for(written = 0; written < n; written += w)
+      if((w = write(sfd, buffer + written, n - written)) < 0) {
+        if(errno == EINTR)
+          w = 0;
+        else
+          disorder_fatal(errno, "error writing to speaker");
+      }
+  }
+  xclose(fd);
+  xclose(sfd);
+  return 0;
+}
+
+/** @brief Information about a cache file */
+struct pcmcache_file {
+  char *path;
+  off_t size;
+  time_t mtime;
+};
+
+/** @brief Compare cache files by age, oldest first */
+static int pcmcache_compare(const void *av, const void *bv) {
+  const struct pcmcache_file *a = av, *b = bv;
+
+  return a->mtime < b->mtime ? -1 : a->mtime > b->mtime;
+}
+
+/** @brief Delete cache files
+ * @param limit Number of bytes to keep
+ * @param temporary Nonzero to delete temporary files too
+ *
+ * Files are deleted oldest first until no more than @p limit bytes remain.
+ */
+static void pcmcache_trim(unsigned long long limit, int temporary) {
+  const char *dir = pcmcache_dir();
+  DIR *dp;
+  struct dirent *de;
+  struct stat sb;
+  struct pcmcache_file *files = NULL;
+  size_t nfiles = 0, nslots = 0, n;
+  unsigned long long total = 0;
+  char *path;
+
+  if(!(dp = opendir(dir))) {
+    if(errno != ENOENT)
+      disorder_error(errno, "error opening %s", dir);
+    return;
+  }
+  while((de = readdir(dp))) {
+    if(de->d_name[0] == '.')
+      continue;
+    byte_xasprintf(&path, "%s/%s", dir, de->d_name);
+    if(strchr(de->d_name, '.')) {
+      /* Temporary file */
+      if(temporary && unlink(path) < 0)
+        disorder_error(errno, "error removing %s", path);
+      continue;
+    }
+    if(stat(path, &sb) < 0)
+      continue;
+    if(nfiles >= nslots) {
+      nslots = nslots ? 2 * nslots : 16;
+      files = xrealloc(files, nslots * sizeof *files);
+    }
+    files[nfiles].path = path;
+    files[nfiles].size = sb.st_size;
+    files[nfiles].mtime = sb.st_mtime;
+    total += sb.st_size;
+    ++nfiles;
+  }
+  closedir(dp);
+  qsort(files, nfiles, sizeof *files, pcmcache_compare);
+  for(n = 0; n < nfiles && total > limit; ++n) {
+    D(("evicting %s from decode-ahead cache", files[n].path));
+    if(unlink(files[n].path) < 0)
+      disorder_error(errno, "error removing %s", files[n].path);
+    else
+      total -= files[n].size;
+  }
+}
+
+/** @brief Empty the cache
+ *
+ * Called at startup.
+ */
+void pcmcache_init(void) {
+  pcmcache_trim(0, 1);
+}
+
+/** @brief Kill any decode-ahead job
+ * @param ev Event loop
+ *
+ * Called at shutdown.  Waits for the job to exit and removes its partial
+ * output.  No new jobs are started afterwards.
+ */
+void pcmcache_quitting(ev_source *ev) {
+  char *tmp;
+  int w;
+
+  stopped = 1;
+  if(!job)
+    return;
+  D(("killing decode-ahead job for %s", job->track));
+  ev_child_cancel(ev, job->pid);
+  if(kill(-job->pid, SIGTERM) < 0 && errno != ESRCH)
+    disorder_error(errno, "error killing decode-ahead job");
+  while(waitpid(job->pid, &w, 0) < 0 && errno == EINTR)
+    ;
+  tmp = pcmcache_temp(job->track);
+  if(unlink(tmp) < 0 && errno != ENOENT)
+    disorder_error(errno, "error removing %s", tmp);
+  job = NULL;
+}
+
+/** @brief Child-process half of pcmcache_fill()
+ * @return Process exit code
+ */
+static int pcmcache_child(struct queue_entry *q,
+                          const struct pbgc_params *params,
+                          void attribute((unused)) *bgdata) {
+  char *tmp = pcmcache_temp(q->track);
+  int fd;
+
+  if((fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC, 0600)) < 0)
+    disorder_fatal(errno, "error opening %s", tmp);
+  return decode_direct(q, params, fd);
+}
+
+/** @brief Called when a decode-ahead job finishes */
+static int pcmcache_finished(ev_source *ev,
+                             pid_t attribute((unused)) pid,
+                             int status,
+                             const struct rusage attribute((unused)) *rusage,
+                             void *u) {
+  struct queue_entry *q = u;
+  char *path = pcmcache_path(q->track, job_sig);
+  char *tmp = pcmcache_temp(q->track), *sig;
+
+  if(!status) {
+    /* If the file changed while we were reading it then the output is of no
+     * use; it would never be found anyway, under the old signature. */
+    sig = trackdb_stat_signature(job_rawpath);
+    if(!sig || strcmp(sig, job_sig)) {
+      D(("%s changed while being decoded ahead", q->track));
+      unlink(tmp);
+    } else if(rename(tmp, path) < 0)
+      disorder_error(errno, "error renaming %s", tmp);
+  } else {
+    disorder_error(0, "decoding %s ahead: %s", q->track, wstat(status));
+    if(!failed)
+      failed = hash_new(1);
+    hash_add(failed, path, "", HASH_INSERT_OR_REPLACE);
+    unlink(tmp);
+  }
+  job = NULL;
+  pcmcache_trim((unsigned long long)config->decode_cache_kbyte * 1024, 0);
+  pcmcache_fill(ev);
+  return 0;
+}
+
+/** @brief Return nonzero if a player has the @c --direct option */
+static int player_is_direct(const struct stringlist *player) {
+  int n;
+
+  for(n = 2; n < player->n && player->s[n][0] == '-'; ++n) {
+    if(!strcmp(player->s[n], "--"))
+      break;
+    if(!strcmp(player->s[n], "--direct"))
+      return 1;
+  }
+  return 0;
+}
+
+/** @brief Start decoding the next track that should be cached, if any
+ * @param ev Event loop
+ *
+ * Considers the first @c decode_ahead raw-format tracks in the queue.  Those
+ * already being prepared are left alone.
+ */
+void pcmcache_fill(ev_source *ev) {
+  const struct stringlist *player;
+  const struct plugin *pl;
+  struct queue_entry *q, *j;
+  long n = 0;
+  const char *rawpath;
+  char *path, *sig;
+
+  if(!config->decode_ahead || job || stopped)
+    return;
+  for(q = qhead.next; q != &qhead && n < config->decode_ahead; q = q->next) {
+    if(!(player = find_player(q)) || !(pl = open_plugin(player->s[1], 0)))
+      continue;
+    if((play_get_type(pl) & DISORDER_PLAYER_TYPEMASK) != DISORDER_PLAYER_RAW)
+      continue;
+    ++n;
+    if(q->prepared || q->preparing || q->pid >= 0)
+      continue;
+    if(!player_is_direct(player))
+      continue;
+    if(!(rawpath = trackdb_rawpath(q->track))
+       || !(sig = trackdb_stat_signature(rawpath)))
+      continue;
+    path = pcmcache_path(q->track, sig);
+    if(failed && hash_find(failed, path))
+      continue;
+    if(access(path, F_OK) == 0)
+      continue;
+    if(mkdir(pcmcache_dir(), 0700) < 0 && errno != EEXIST) {
+      disorder_error(errno, "error creating %s", pcmcache_dir());
+      return;
+    }
+    D(("decoding %s ahead", q->track));
+    j = xmalloc(sizeof *j);
+    j->id = q->id;
+    j->track = q->track;
+    j->pl = pl;
+    j->type = play_get_type(pl);
+    j->pid = -1;
+    if(play_background(ev, player, j, pcmcache_child, NULL) == START_OK) {
+      ev_child(ev, j->pid, 0, pcmcache_finished, j);
+      job = j;
+      job_rawpath = rawpath;
+      job_sig = sig;
+    }
+    return;
+  }
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -31,6 +31,15 @@ struct queue_entry *playing;
 /** @brief Set when paused */
 int paused;
 
+/** @brief Playback statistics last reported by the speaker */
+struct uaudio_stats speaker_stats;
+
+/** @brief Bytes the speaker had buffered for the playing track */
+unsigned long long speaker_buffered;
+
+/** @brief The speaker's status page, or NULL */
+static const struct speaker_status *speaker_page;
+
 static void finished(ev_source *ev);
 static int start_child(struct queue_entry *q, 
                        const struct pbgc_params *params,
@@ -77,7 +86,7 @@ static int speaker_readable(ev_source *ev, int fd,
   case SM_PAUSED:
     /* track ID is paused, DATA seconds played */
     D(("SM_PAUSED %s %ld", sm.u.id, sm.data));
-    playing->sofar = sm.data;
+    playing->sofar = playing->resume + sm.data;
     break;
   case SM_FINISHED:			/* scratched the playing track */
   case SM_STILLBORN:			/* scratched too early */
@@ -93,7 +102,7 @@ static int speaker_readable(ev_source *ev, int fd,
   case SM_PLAYING:
     /* track ID is playing, DATA seconds played */
     D(("SM_PLAYING %s %ld", sm.u.id, sm.data));
-    playing->sofar = sm.data;
+    playing->sofar = playing->resume + sm.data;
     break;
   case SM_ARRIVED: {
     /* track ID is now prepared */
@@ -101,6 +110,7 @@ static int speaker_readable(ev_source *ev, int fd,
     for(q = qhead.next; q != &qhead && strcmp(q->id, sm.u.id); q = q->next)
       ;
     if(q && q->preparing) {
+      trace_event(TRACE_END, "prepare", q->id, NULL);
       q->preparing = 0;
       q->prepared = 1;
       /* We might be waiting to play the now-prepared track */
@@ -108,6 +118,12 @@ static int speaker_readable(ev_source *ev, int fd,
     }
     break;
   }
+  case SM_STATS:
+    /* The playing track is breaking up; maybe a rescan is to blame */
+    if(playing && !paused)
+      trackdb_rescan_backoff();
+    speaker_stats = sm.u.stats;
+    break;
   default:
     disorder_error(0, "unknown speaker message type %d", sm.type);
   }
@@ -119,6 +135,7 @@ void speaker_setup(ev_source *ev) {
   int sp[2];
   pid_t pid;
   struct speaker_message sm;
+  char *path;
 
   if(socketpair(PF_UNIX, SOCK_DGRAM, 0, sp) < 0)
     disorder_fatal(errno, "error calling socketpair");
@@ -150,14 +167,38 @@ void speaker_setup(ev_source *ev) {
   /* Wait for the speaker to be ready */
   speaker_recv(speaker_fd, &sm);
   nonblock(speaker_fd);
+  /* Without the status page we only know what the speaker tells us */
+  byte_xasprintf(&path, "%s/private/speaker-status", config->home);
+  speaker_page = speaker_status_map(path, 0);
   if(ev_fd(ev, ev_read, speaker_fd, speaker_readable, 0, "speaker read") < 0)
     disorder_fatal(0, "error registering speaker socket fd");
 }
 
+/** @brief Read the speaker's status page
+ *
+ * The speaker only sends messages when something changes, so this must be
+ * called before using @c playing->sofar for a raw-format track, @ref
+ * speaker_stats or @ref speaker_buffered.
+ */
+void speaker_refresh(void) {
+  struct speaker_status status;
+
+  if(!speaker_page || speaker_status_read(speaker_page, &status))
+    return;
+  if(playing && !strcmp(status.id, playing->id)) {
+    playing->sofar = playing->resume + status.sofar;
+    speaker_buffered = status.buffered;
+  } else
+    speaker_buffered = 0;
+  speaker_stats = status.stats;
+}
+
 /** @brief Tell the speaker to reload its configuration */
 void speaker_reload(void) {
   struct speaker_message sm;
 
+  if(speaker_fd == -1)
+    return;                             /* replicas have no speaker */
   memset(&sm, 0, sizeof sm);
   sm.type = SM_RELOAD;
   speaker_send(speaker_fd, &sm);
@@ -186,6 +227,7 @@ static void finished(ev_source *ev) {
     return;
   if(playing->state != playing_scratched)
     notify_not_scratched(playing->track, playing->submitter);
+  trace_event(TRACE_END, "play", playing->id, NULL);
   switch(playing->state) {
   case playing_ok:
     eventlog("completed", playing->track, (char *)0);
@@ -270,7 +312,7 @@ static int player_finished(ev_source *ev,
 /* Track initiation --------------------------------------------------------- */
 
 /** @brief Find the player for @p q */
-static const struct stringlist *find_player(const struct queue_entry *q) {
+const struct stringlist *find_player(const struct queue_entry *q) {
   int n;
   
   for(n = 0; n < config->player.n; ++n)
@@ -282,6 +324,39 @@ static const struct stringlist *find_player(const struct queue_entry *q) {
     return &config->player.s[n];
 }
 
+/** @brief Find the gain for @p q
+ * @param q Track to play
+ * @return Gain in hundredths of a decibel
+ *
+ * The gain comes from the @c gain preference, if it is set.  Otherwise, if
+ * @c loudness_analysis is set and the track's loudness has been measured,
+ * it is the difference between that and @c loudness_target.
+ */
+static long track_gain(const struct queue_entry *q) {
+  const struct kvp *k = trackdb_get_all(q->track);
+  const char *s = kvp_get(k, "gain");
+  char *end;
+  double db;
+
+  if(!s) {
+    if(!config->loudness_analysis || !(s = kvp_get(k, "_loudness")))
+      return 0;
+    db = (config->loudness_target * 100 - atol(s)) / 100.0;
+  } else {
+    errno = 0;
+    db = strtod(s, &end);
+    if(errno || end == s || *end) {
+      disorder_error(0, "invalid gain '%s' for %s", s, q->track);
+      return 0;
+    }
+  }
+  if(db < GAIN_MIN_DB)
+    db = GAIN_MIN_DB;
+  if(db > GAIN_MAX_DB)
+    db = GAIN_MAX_DB;
+  return (long)(db * 100 + (db < 0 ? -0.5 : 0.5));
+}
+
 /** @brief Start to play @p q
  * @param ev Event loop
  * @param q Track to play/prepare
@@ -318,12 +393,17 @@ static int start(ev_source *ev,
     memset(sm, 0, sizeof sm);
     strcpy(sm->u.id, q->id);
     sm->type = SM_PLAY;
+    sm->data = track_gain(q);
+    trace_event(TRACE_BEGIN, "play", q->id, NULL);
     speaker_send(speaker_fd, sm);
     D(("sent SM_PLAY for %s", sm->u.id));
     /* Our caller will set playing and playing->state = playing_started */
     return START_OK;
   } else {
+    trace_event(TRACE_BEGIN, "play", q->id, NULL);
+    trace_event(TRACE_BEGIN, "fork", q->id, NULL);
     rc = play_background(ev, player, q, start_child, NULL);
+    trace_event(TRACE_END, "fork", q->id, NULL);
     if(rc == START_OK)
       ev_child(ev, q->pid, 0, player_finished, q);
       /* Our caller will set playing and playing->state = playing_started */
@@ -360,6 +440,8 @@ int prepare(ev_source *ev,
 	    struct queue_entry *q) {
   const struct stringlist *player;
 
+  /* Maybe start decoding something ahead */
+  pcmcache_fill(ev);
   /* If there's a decoder (or player!) going we do nothing */
   if(q->pid >= 0)
     return START_OK;
@@ -373,7 +455,12 @@ int prepare(ev_source *ev,
   q->type = play_get_type(q->pl);
   if((q->type & DISORDER_PLAYER_TYPEMASK) != DISORDER_PLAYER_RAW)
     return START_OK;                    /* Not a raw player */
+  /* Only a track put back by quitting() has got anywhere yet */
+  q->resume = q->sofar > 0 ? q->sofar : 0;
+  trace_event(TRACE_BEGIN, "prepare", q->id, NULL);
+  trace_event(TRACE_BEGIN, "fork", q->id, NULL);
   int rc = play_background(ev, player, q, prepare_child, NULL);
+  trace_event(TRACE_END, "fork", q->id, NULL);
   if(rc == START_OK) {
     ev_child(ev, q->pid, 0, player_finished, q);
     q->preparing = 1;
@@ -383,18 +470,107 @@ int prepare(ev_source *ev,
   return rc;
 }
 
+/** @brief Connect to the speaker on behalf of @p q
+ * @param q Track to connect for
+ * @return Connected socket
+ *
+ * Called in a subprocess.
+ */
+static int speaker_connect(const struct queue_entry *q) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof addr.sun_path,
+           "%s/private/speaker", config->home);
+  int sfd = xsocket(PF_UNIX, SOCK_STREAM, 0);
+  if(connect(sfd, (const struct sockaddr *)&addr, sizeof addr) < 0)
+    disorder_fatal(errno, "connecting to %s", addr.sun_path);
+  /* Send the ID, with a NATIVE-ENDIAN 32 bit length */
+  uint32_t l = strlen(q->id);
+  if(write(sfd, &l, sizeof l) < 0
+     || write(sfd, q->id, l) < 0)
+    disorder_fatal(errno, "writing to %s", addr.sun_path);
+  /* Await the ack */
+  if (read(sfd, &l, 1) < 0) 
+    disorder_fatal(errno, "reading ack from %s", addr.sun_path);
+  return sfd;
+}
+
+/** @brief Run a @c --direct decoder
+ * @param q Track to decode
+ * @param params Child parameters
+ * @param fd Where to send the decoded audio
+ * @return Process exit code (if it returns at all)
+ *
+ * Called in a subprocess.  The decoder writes audio in the configured sample
+ * format to @p fd, starting disorder-normalize itself if it needs to.
+ */
+int decode_direct(struct queue_entry *q,
+                  const struct pbgc_params *params,
+                  int fd) {
+  char fdbuf[64], formatbuf[128], syslogbuf[64], *configbuf;
+
+  snprintf(fdbuf, sizeof fdbuf, "DISORDER_RAW_FD=%d", fd);
+  snprintf(formatbuf, sizeof formatbuf, "DISORDER_RAW_FORMAT=%d %d %d %d",
+           (int)config->sample_format.rate,
+           (int)config->sample_format.bits,
+           (int)config->sample_format.channels,
+           (int)config->sample_format.endian);
+  snprintf(syslogbuf, sizeof syslogbuf, "DISORDER_RAW_SYSLOG=%d",
+           log_default == &log_syslog);
+  byte_xasprintf(&configbuf, "DISORDER_RAW_CONFIG=%s", configfile);
+  if(putenv(fdbuf) < 0
+     || putenv(formatbuf) < 0
+     || putenv(syslogbuf) < 0
+     || putenv(configbuf) < 0)
+    disorder_fatal(errno, "error calling putenv");
+  play_track(q->pl,
+             params->argv, params->argc,
+             params->rawpath,
+             q->track);
+  return 0;
+}
+
 /** @brief Child-process half of prepare()
  * @return Process exit code
  *
  * Called in subprocess to execute the decoder for a raw-format player.
  *
- * @todo We currently run the normalizer from here in a double-fork.  This is
+ * If the track is in the decode-ahead cache then that copy is sent to the
+ * speaker instead (see @ref server/pcmcache.c).
+ *
+ * If the player was configured with @c --direct then it is connected straight
+ * to the speaker and told the format it wants.  It is then responsible for
+ * starting disorder-normalize itself if its output turns out not to be in
+ * that format.  See @ref server/decode.c.
+ *
+ * @todo Otherwise we run the normalizer from here in a double-fork.  This is
  * unsatisfactory for many reasons: we can't prevent it outliving the main
  * server and we don't adequately report its exit status.
  */
 static int prepare_child(struct queue_entry *q, 
                          const struct pbgc_params *params,
                          void attribute((unused)) *bgdata) {
+  char seekbuf[64], *tracebuf;
+  int fd;
+
+  if(config->trace_file) {
+    /* Tell the decoders which track to trace */
+    byte_xasprintf(&tracebuf, "DISORDER_TRACE=%s %s",
+                   q->id, config->trace_file);
+    if(putenv(tracebuf) < 0)
+      disorder_fatal(errno, "error calling putenv");
+  }
+  if(q->resume) {
+    /* Tell the decoder where to start */
+    snprintf(seekbuf, sizeof seekbuf, "DISORDER_RAW_SEEK=%ld", q->resume);
+    if(putenv(seekbuf) < 0)
+      disorder_fatal(errno, "error calling putenv");
+  } else if((fd = pcmcache_open(q->track, params->rawpath)) >= 0)
+    /* If the track has been decoded in advance, send that */
+    return pcmcache_send(fd, speaker_connect(q));
+  if(params->direct)
+    return decode_direct(q, params, speaker_connect(q));
   /* np will be the pipe to disorder-normalize */
   int np[2];
   if(socketpair(PF_UNIX, SOCK_STREAM, 0, np) < 0)
@@ -417,22 +593,7 @@ static int prepare_child(struct queue_entry *q,
     if(!xfork()) {
       /* Great-grandchild of disorderd */
       /* Connect to the speaker process */
-      struct sockaddr_un addr;
-      memset(&addr, 0, sizeof addr);
-      addr.sun_family = AF_UNIX;
-      snprintf(addr.sun_path, sizeof addr.sun_path,
-               "%s/private/speaker", config->home);
-      int sfd = xsocket(PF_UNIX, SOCK_STREAM, 0);
-      if(connect(sfd, (const struct sockaddr *)&addr, sizeof addr) < 0)
-        disorder_fatal(errno, "connecting to %s", addr.sun_path);
-      /* Send the ID, with a NATIVE-ENDIAN 32 bit length */
-      uint32_t l = strlen(q->id);
-      if(write(sfd, &l, sizeof l) < 0
-         || write(sfd, q->id, l) < 0)
-        disorder_fatal(errno, "writing to %s", addr.sun_path);
-      /* Await the ack */
-      if (read(sfd, &l, 1) < 0) 
-        disorder_fatal(errno, "reading ack from %s", addr.sun_path);
+      int sfd = speaker_connect(q);
       /* Plumbing */
       xdup2(np[0], 0);
       xdup2(sfd, 1);
@@ -505,22 +666,48 @@ void abandon(ev_source attribute((unused)) *ev,
   speaker_send(speaker_fd, &sm);
 }
 
+/** @brief Test whether any track is being prepared
+ * @return Nonzero if a decoder is starting up
+ *
+ * A decoder that is starting up is reading its track as fast as it can, and
+ * anything that competes with that for the disk risks a gap in playback.
+ */
+int preparing_tracks(void) {
+  struct queue_entry *q;
+
+  if(playing && playing->preparing)
+    return 1;
+  for(q = qhead.next; q != &qhead; q = q->next)
+    if(q->preparing)
+      return 1;
+  return 0;
+}
+
 /* Random tracks ------------------------------------------------------------ */
 
-/** @brief Called with a new random track
+/** @brief When the tracks being chosen were requested */
+static struct timespec chooser_requested;
+
+/** @brief Called with new random tracks
  * @param ev Event loop
- * @param track Track name
+ * @param tracks Track names
+ * @param ntracks Number of tracks
  */
-static void chosen_random_track(ev_source *ev,
-				const char *track) {
+static void chosen_random_tracks(ev_source *ev,
+                                 char **tracks, int ntracks) {
   struct queue_entry *q;
 
-  if(!track)
+  if(!ntracks)
     return;
-  /* Add the track to the queue */
-  q = queue_add(track, 0, WHERE_END, NULL, origin_random);
-  D(("picked %p (%s) at random", (void *)q, q->track));
-  queue_write();
+  /* Add the tracks to the queue */
+  queue_batch_begin();
+  for(int n = 0; n < ntracks; ++n) {
+    q = queue_add(tracks[n], 0, WHERE_END, NULL, origin_random);
+    D(("picked %p (%s) at random", (void *)q, q->track));
+    trace_event(TRACE_BEGIN, "choose", q->id, &chooser_requested);
+    trace_event(TRACE_END, "choose", q->id, NULL);
+  }
+  queue_batch_end(0);
   /* Maybe a track can now be played */
   play(ev);
 }
@@ -528,11 +715,13 @@ static void chosen_random_track(ev_source *ev,
 /** @brief Maybe add a randomly chosen track
  * @param ev Event loop
  *
- * Picking can take some time so the track will only be added after this
- * function has returned.
+ * Enough tracks are requested at once to bring the queue up to @c
+ * queue_pad.  Picking can take some time so the tracks will only be added
+ * after this function has returned.
  */
 void add_random_track(ev_source *ev) {
   struct queue_entry *q;
+  struct timespec now;
   long qlen = 0;
 
   /* If random play is not enabled then do nothing. */
@@ -541,9 +730,13 @@ void add_random_track(ev_source *ev) {
   /* Count how big the queue is */
   for(q = qhead.next; q != &qhead; q = q->next)
     ++qlen;
-  /* If it's smaller than the desired size then add a track */
-  if(qlen < config->queue_pad)
-    trackdb_request_random(ev, chosen_random_track);
+  /* If it's smaller than the desired size then make up the difference */
+  if(qlen < config->queue_pad) {
+    xgettime(CLOCK_MONOTONIC, &now);
+    /* If a request is already in progress, it keeps its start time */
+    if(!chooser_request(ev, config->queue_pad - qlen, chosen_random_tracks))
+      chooser_requested = now;
+  }
 }
 
 /* Track initiation (part 2) ------------------------------------------------ */
@@ -558,6 +751,8 @@ void play(ev_source *ev) {
   int random_enabled = random_is_enabled();
 
   D(("play playing=%p", (void *)playing));
+  /* Get upcoming tracks off the disk, whether or not one can start now */
+  prefetch_fill(ev);
   /* If we're shutting down, or there's something playing, or playing is not
    * enabled, give up now */
   if(shutting_down || playing || !playing_is_enabled()) return;
@@ -567,7 +762,7 @@ void play(ev_source *ev) {
      * attempts to add a random track anyway.  However they are rarer than
      * attempts to force a track so we initiate one now. */
     add_random_track(ev);
-    /* chosen_random_track() will call play() when a new random track has been
+    /* chosen_random_tracks() will call play() when a new random track has been
      * added to the queue. */
     return;
   }
@@ -722,7 +917,7 @@ void scratch(const char *who, const char *id) {
       if(next_scratch){
         next_scratch->submitter = who;
         queue_insert_entry(&qhead, next_scratch);
-        eventlog_raw("queue", queue_marshall(next_scratch), (const char *)0);
+        queue_inserted(next_scratch);
         next_scratch = NULL;
       }
     }
@@ -740,17 +935,33 @@ void quitting(ev_source *ev) {
   /* Don't start anything new */
   shutting_down = 1;
   /* Shut down the current player */
+  speaker_refresh();
   if(playing) {
     kill_player(playing);
-    playing->state = playing_quitting;
-    finished(0);
+    if((playing->type & DISORDER_PLAYER_TYPEMASK) == DISORDER_PLAYER_RAW
+       && playing->sofar > 0) {
+      /* Put it back at the head of the queue, so that next time it can carry
+       * on from where it got to */
+      playing->state = playing_unplayed;
+      queue_insert_entry(&qhead, playing);
+      queue_inserted(playing);
+      queue_write();
+      playing = NULL;
+    } else {
+      playing->state = playing_quitting;
+      finished(0);
+    }
   }
   /* Zap any background decoders that are going */
   for(q = qhead.next; q != &qhead; q = q->next)
     kill_player(q);
+  /* ...and the decode-ahead job */
+  pcmcache_quitting(ev);
   /* Don't need the speaker any more */
-  ev_fd_cancel(ev, ev_read, speaker_fd);
-  xclose(speaker_fd);
+  if(speaker_fd != -1) {
+    ev_fd_cancel(ev, ev_read, speaker_fd);
+    xclose(speaker_fd);
+  }
 }
 
 /* Pause and resume --------------------------------------------------------- */
@@ -823,11 +1034,15 @@ void resume_playing(const char *who) {
   eventlog("state", "resume", (char *)0);
 }
 
-/** @brief Request an RTP stream */
-void rtp_request(const struct sockaddr_storage *sa) {
+/** @brief Request an RTP stream
+ * @param sa Destination address
+ * @param codec Payload encoding (@ref RTP_CODEC_L16 or @ref RTP_CODEC_OPUS)
+ */
+void rtp_request(const struct sockaddr_storage *sa, int codec) {
   struct speaker_message sm;
   memset(&sm, 0, sizeof sm);
   sm.type = SM_RTP_REQUEST;
+  sm.data = codec;
   sm.u.address = *sa;
   speaker_send(speaker_fd, &sm);
 }
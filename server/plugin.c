@@ -117,6 +117,46 @@ long tracklength(const char *plugin, const char *track, const char *path) {
   return (*f)(track, path);
 }
 
+typedef void tracklength_batch_fn(int ntracks,
+                                  const char *const *tracks,
+                                  const char *const *paths,
+                                  void (*callback)(int n, long length,
+                                                   void *u),
+                                  void *u);
+
+/** Test whether a tracklength plugin can compute several lengths at once
+ * @param plugin plugin to use, as configured
+ * @return nonzero if tracklength_batch() can be used
+ */
+int tracklength_batched(const char *plugin) {
+  const struct plugin *pl = open_plugin(plugin, PLUGIN_FATAL);
+
+  return dlfunc(pl->dlhandle, "disorder_tracklength_batch") != 0;
+}
+
+/** Compute the lengths of several tracks
+ * @param plugin plugin to use, as configured
+ * @param ntracks number of tracks
+ * @param tracks UTF-8 names of tracks
+ * @param paths file system paths (entries may be 0)
+ * @param callback called with the index and length of each track
+ * @param u passed to @p callback
+ *
+ * The lengths may be reported in any order.  Only use this if
+ * tracklength_batched() says the plugin supports it.
+ */
+void tracklength_batch(const char *plugin, int ntracks,
+                       const char *const *tracks, const char *const *paths,
+                       void (*callback)(int n, long length, void *u),
+                       void *u) {
+  tracklength_batch_fn *f = 0;
+
+  f = (tracklength_batch_fn *)get_plugin_function(open_plugin(plugin,
+                                                              PLUGIN_FATAL),
+                                                  "disorder_tracklength_batch");
+  (*f)(ntracks, tracks, paths, callback, u);
+}
+
 typedef void scan_fn(const char *root);
 
 void scan(const char *module, const char *root) {
@@ -0,0 +1,121 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file server/prefetch.c
+ * @brief Reading ahead of the queue
+ *
+ * On a network filesystem the first access to a track can stall while its
+ * directory entries and attributes are fetched, and again while the start of
+ * the file is read.  If that happens as the track starts, there is a gap.
+ *
+ * So the first @c prefetch_ahead tracks in the queue are opened, once each,
+ * by a short-lived child process, which also asks the kernel to read them
+ * ahead with @c posix_fadvise().  By the time the track is played the
+ * attribute and page caches should already be warm.  The work is done in a
+ * child so that the server itself never waits for the filesystem.
+ *
+ * Only one child runs at a time.  Tracks that arrive while it is running are
+ * picked up when it finishes.
+ */
+#include "disorder-server.h"
+
+/** @brief Process ID of the child, or -1 */
+static pid_t prefetch_pid = -1;
+
+/** @brief Child-process half of prefetch_fill()
+ * @param paths Paths to read ahead
+ * @param npaths Number of paths
+ * @return Process exit code
+ */
+static int prefetch_child(char **paths, int npaths) {
+  int n, fd;
+
+  for(n = 0; n < npaths; ++n) {
+    /* Opening the file is enough to fetch its attributes */
+    if((fd = open(paths[n], O_RDONLY)) < 0)
+      continue;
+#if HAVE_POSIX_FADVISE
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+    close(fd);
+  }
+  return 0;
+}
+
+/** @brief Called when the child finishes */
+static int prefetch_finished(ev_source *ev,
+                             pid_t attribute((unused)) pid,
+                             int status,
+                             const struct rusage attribute((unused)) *rusage,
+                             void attribute((unused)) *u) {
+  if(status)
+    disorder_error(0, "reading ahead: %s", wstat(status));
+  prefetch_pid = -1;
+  prefetch_fill(ev);
+  return 0;
+}
+
+/** @brief Read ahead any new tracks near the head of the queue
+ * @param ev Event loop
+ *
+ * Considers the first @c prefetch_ahead tracks in the queue.  Those that
+ * already have a decoder or player running are left alone.
+ */
+void prefetch_fill(ev_source *ev) {
+  struct queue_entry *q;
+  struct vector paths;
+  long n = 0;
+
+  if(!config->prefetch_ahead || prefetch_pid != -1)
+    return;
+  vector_init(&paths);
+  for(q = qhead.next;
+      q != &qhead && n < config->prefetch_ahead;
+      q = q->next, ++n) {
+    if(q->prefetched)
+      continue;
+    q->prefetched = 1;
+    if(q->pid >= 0)
+      continue;
+    vector_append(&paths, (char *)trackdb_rawpath(q->track));
+  }
+  if(!paths.nvec)
+    return;
+  switch(prefetch_pid = fork()) {
+  case 0:
+    exitfn = _exit;
+    progname = "disorderd-fork";
+    ev_signal_atfork(ev);
+    signal(SIGPIPE, SIG_DFL);
+    _exit(prefetch_child(paths.vec, paths.nvec));
+  case -1:
+    disorder_error(errno, "error calling fork");
+    prefetch_pid = -1;
+    return;
+  }
+  D(("reading ahead %d tracks", paths.nvec));
+  ev_child(ev, prefetch_pid, 0, prefetch_finished, 0);
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -0,0 +1,770 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file server/query-pool.c
+ * @brief Worker processes for slow database lookups
+ *
+ * Searches and track listings can take a long time on a large database, and
+ * nothing else happens in the server while it waits for them.  So they are
+ * handed to a small pool of @c disorder-query processes, which open the
+ * database for themselves (like @c disorder-stats) and send back the results.
+ * Anything that modifies the database or the queue stays in the server.
+ *
+ * A request is a single line, a quoted list of a query name and its
+ * arguments (see query_execute()).  The response is the list of results, one
+ * per line, dot-stuffed and terminated by a line containing just a dot, as in
+ * the client protocol.
+ *
+ * If there are no workers, because @c query_workers is 0 or they could not
+ * be started, queries are run in the server itself, but still from a timeout
+ * so that callers see the same behaviour either way.
+ *
+ * Results can be passed on in batches as they arrive, rather than all at the
+ * end (see query_list_stream()).  The caller can pause the flow with
+ * query_pause(), in which case nothing more is read from the worker until
+ * query_resume() is called.
+ *
+ * Results are cached, keyed on the request, and used again as long as
+ * @ref trackdb_generation hasn't changed in the meantime.  The total size of
+ * the cache is limited by @c query_cache_kbyte.
+ */
+
+#include "disorder-server.h"
+#include "regexp.h"
+
+/** @brief Largest number of results passed on in one go */
+#define QUERY_CHUNK 256
+
+/** @brief Cache type for query results */
+static const struct cache_type query_cache_type = { 86400 };
+
+/** @brief A cached query result */
+struct query_cached {
+  /** @brief Value of @ref trackdb_generation when the query was submitted */
+  unsigned long generation;
+
+  /** @brief NULL-terminated list of results */
+  char **results;
+};
+
+/** @brief A query waiting for, or being run by, a worker */
+struct query {
+  /** @brief Next query waiting */
+  struct query *next;
+
+  /** @brief Query name and arguments */
+  char **args;
+
+  /** @brief Number of elements of @ref args */
+  int nargs;
+
+  /** @brief Request as sent to a worker, without the newline */
+  char *request;
+
+  /** @brief Cache key, or NULL not to cache the results */
+  const char *key;
+
+  /** @brief Value of @ref trackdb_generation when the query was submitted */
+  unsigned long generation;
+
+  /** @brief Approximate size of @ref results */
+  size_t bytes;
+
+  /** @brief Called with the results, if @ref stream is NULL */
+  query_callback *done;
+
+  /** @brief Called with each batch of results, or NULL */
+  query_stream_callback *stream;
+
+  /** @brief Passed to @ref done or @ref stream */
+  void *u;
+
+  /** @brief Event loop */
+  ev_source *ev;
+
+  /** @brief Results so far, if @ref stream is NULL or @ref key is not */
+  struct vector results;
+
+  /** @brief Worker running this query, or NULL */
+  struct query_worker *w;
+
+  /** @brief Results still to pass on, if run in the server */
+  char **inline_results;
+
+  /** @brief Set by query_pause() */
+  int paused;
+
+  /** @brief Set once any results have been passed on */
+  int delivered;
+};
+
+/** @brief A worker process */
+struct query_worker {
+  /** @brief Next worker */
+  struct query_worker *next;
+
+  /** @brief Process ID */
+  pid_t pid;
+
+  /** @brief Reads results from the worker */
+  ev_reader *r;
+
+  /** @brief Sends requests to the worker */
+  ev_writer *w;
+
+  /** @brief Query being run, or NULL if idle */
+  struct query *q;
+
+  /** @brief Set when the worker should exit once it is idle */
+  int retired;
+
+  /** @brief Set once the worker has answered a query */
+  int answered;
+};
+
+/** @brief All live workers */
+static struct query_worker *workers;
+
+/** @brief Number of live workers */
+static int nworkers;
+
+/** @brief Queries waiting for a worker */
+static struct query *pending;
+
+/** @brief Where to add the next waiting query */
+static struct query **pending_tail = &pending;
+
+/** @brief Set if a worker failed without answering anything
+ *
+ * No more are started until query_reset() is called, since they would most
+ * likely fail the same way.
+ */
+static int query_workers_broken;
+
+static void query_dispatch(ev_source *ev);
+
+/** @brief Run a query
+ * @param args Query name and arguments
+ * @param nargs Number of elements of @p args
+ * @return NULL-terminated list of results, or NULL for a malformed query
+ *
+ * This is what a worker does with each request, and what the server does
+ * if there is no worker to do it.  The queries are:
+ * - @c list @p WHAT @p DIR @p REGEXP: trackdb_list(), with @p WHAT as a
+ *   decimal @ref trackdb_listable, and an empty @p DIR or @p REGEXP meaning
+ *   none
+ * - @c search @p TERM...: trackdb_search()
+ * - @c search-prefix @p MAX @p TERM...: trackdb_search_prefix()
+ * - @c search-fuzzy @p MAX @p TERM...: trackdb_search_fuzzy()
+ * - @c search-page @p OFFSET @p LIMIT @p TERM...: trackdb_search_page(), with
+ *   the total number of matches before the tracks
+ * - @c new @p MAX: trackdb_new()
+ */
+char **query_execute(char **args, int nargs) {
+  char errstr[RXCERR_LEN];
+  size_t erroffset;
+  regexp *rec = 0;
+  char **results = 0;
+  int nresults, nmatches;
+  static char *empty[] = { NULL };
+  struct vector v;
+
+  if(nargs < 1)
+    return NULL;
+  if(!strcmp(args[0], "list") && nargs == 4) {
+    if(*args[3]
+       && !(rec = regexp_compile_cached(args[3], RXF_CASELESS,
+                                        errstr, sizeof errstr, &erroffset))) {
+      disorder_error(0, "error compiling regexp: %s", errstr);
+      return empty;
+    }
+    results = trackdb_list(*args[2] ? args[2] : 0, 0,
+                           (enum trackdb_listable)atoi(args[1]), rec);
+  } else if(!strcmp(args[0], "search"))
+    results = trackdb_search(args + 1, nargs - 1, &nresults);
+  else if(!strcmp(args[0], "search-prefix") && nargs >= 2)
+    results = trackdb_search_prefix(args + 2, nargs - 2, atoi(args[1]),
+                                    &nresults);
+  else if(!strcmp(args[0], "search-fuzzy") && nargs >= 2)
+    results = trackdb_search_fuzzy(args + 2, nargs - 2, atoi(args[1]),
+                                   &nresults);
+  else if(!strcmp(args[0], "search-page") && nargs >= 3) {
+    results = trackdb_search_page(args + 3, nargs - 3,
+                                  atoi(args[1]), atoi(args[2]),
+                                  &nresults, &nmatches);
+    vector_init(&v);
+    vector_append(&v, 0);
+    byte_xasprintf(&v.vec[0], "%d", nmatches);
+    if(results)
+      vector_append_many(&v, results, nresults);
+    vector_terminate(&v);
+    results = v.vec;
+  }
+  else if(!strcmp(args[0], "new") && nargs == 2)
+    results = trackdb_new(0, atoi(args[1]));
+  else
+    return NULL;
+  return results ? results : empty;
+}
+
+/** @brief Pass on some results
+ * @param q Query
+ * @param results Results
+ * @param nresults Number of results
+ * @param more Nonzero if there will be more results
+ */
+static void query_deliver(struct query *q, char **results, int nresults,
+                          int more) {
+  struct query_cached *cached;
+  int n;
+
+  if(nresults)
+    q->delivered = 1;
+  if(!more)
+    q->paused = 0;
+  if(!q->stream || q->key) {
+    for(n = 0; n < nresults; ++n) {
+      vector_append(&q->results, results[n]);
+      q->bytes += strlen(results[n]) + 1 + sizeof (char *);
+    }
+    if(q->key && q->bytes > (size_t)config->query_cache_kbyte * 1024 / 4) {
+      /* Too big to be worth caching, and there's no need to collect
+       * streamed results otherwise */
+      q->key = 0;
+      if(q->stream)
+        vector_init(&q->results);
+    }
+    if(!more && (!q->stream || q->key))
+      vector_terminate(&q->results);
+  }
+  if(!more && q->key) {
+    cached = xmalloc(sizeof *cached);
+    cached->generation = q->generation;
+    cached->results = q->results.vec;
+    cache_budget((size_t)config->query_cache_kbyte * 1024);
+    cache_put_sized(&query_cache_type, q->key, cached,
+                    q->bytes + strlen(q->key) + sizeof *cached);
+  }
+  if(q->stream) {
+    q->stream(q, results, nresults, more, q->u);
+    return;
+  }
+  if(!more)
+    q->done(q->results.vec, q->results.nvec, q->u);
+}
+
+/** @brief Pass on the next batch of results for a query run in the server
+ *
+ * Called from a timeout.
+ */
+static int query_inline_more(ev_source *ev,
+                             const struct timeval attribute((unused)) *now,
+                             void *u) {
+  struct query *q = u;
+  char **results = q->inline_results;
+  int n;
+
+  for(n = 0; n < QUERY_CHUNK && results[n]; ++n)
+    ;
+  if(!results[n])
+    q->inline_results = 0;
+  else
+    q->inline_results = results + n;
+  query_deliver(q, results, n, !!q->inline_results);
+  if(q->inline_results && !q->paused)
+    ev_timeout(ev, 0, 0, query_inline_more, q);
+  return 0;
+}
+
+/** @brief Run a query in the server
+ *
+ * Called from a timeout.
+ */
+static int query_inline(ev_source *ev,
+                        const struct timeval *now,
+                        void *u) {
+  struct query *q = u;
+  static char *empty[] = { NULL };
+
+  if(!(q->inline_results = query_execute(q->args, q->nargs)))
+    q->inline_results = empty;
+  return query_inline_more(ev, now, q);
+}
+
+/** @brief Forget about a worker
+ * @param w Worker
+ *
+ * Closing its socket makes it exit.  Any query it was running is run in the
+ * server instead, unless it had already passed on some results, in which
+ * case the rest are lost.
+ */
+static void query_worker_discard(ev_source *ev, struct query_worker *w) {
+  struct query_worker **ww;
+  struct query *q;
+
+  for(ww = &workers; *ww && *ww != w; ww = &(*ww)->next)
+    ;
+  if(!*ww)
+    return;                             /* already discarded */
+  *ww = w->next;
+  --nworkers;
+  if(w->r)
+    ev_reader_cancel(w->r);
+  if(w->w)
+    ev_writer_close(w->w);
+  w->r = 0;
+  w->w = 0;
+  if((q = w->q)) {
+    w->q = 0;
+    q->w = 0;
+    if(q->delivered) {
+      disorder_error(0, "disorder-query %lu failed part way through a query",
+                     (unsigned long)w->pid);
+      q->key = 0;                       /* don't cache partial results */
+      query_deliver(q, 0, 0, 0);
+    } else
+      ev_timeout(ev, 0, 0, query_inline, q);
+  }
+}
+
+/** @brief Called when a worker terminates */
+static int query_worker_exited(ev_source *ev,
+                               pid_t pid,
+                               int status,
+                               const struct rusage attribute((unused)) *rusage,
+                               void *u) {
+  struct query_worker *w = u;
+
+  if(status) {
+    disorder_error(0, "disorder-query %lu %s", (unsigned long)pid,
+                   wstat(status));
+    if(!w->answered && !query_workers_broken) {
+      disorder_error(0, "running queries in the server instead");
+      query_workers_broken = 1;
+    }
+  }
+  query_worker_discard(ev, w);
+  query_dispatch(ev);
+  return 0;
+}
+
+/** @brief Called on error on a worker's socket */
+static int query_worker_error(ev_source *ev,
+                              int errno_value,
+                              void *u) {
+  struct query_worker *w = u;
+
+  if(errno_value && errno_value != EPIPE && errno_value != ECONNRESET)
+    disorder_error(errno_value, "disorder-query %lu socket error",
+                   (unsigned long)w->pid);
+  query_worker_discard(ev, w);
+  query_dispatch(ev);
+  return 0;
+}
+
+/** @brief Called when there are results from a worker */
+static int query_worker_read(ev_source *ev,
+                             ev_reader *reader,
+                             void *ptr,
+                             size_t bytes,
+                             int eof,
+                             void *u) {
+  struct query_worker *w = u;
+  struct query *q;
+  struct vector chunk;
+  char *eol, *line;
+
+  vector_init(&chunk);
+  while((eol = memchr(ptr, '\n', bytes))) {
+    *eol++ = 0;
+    line = ptr;
+    bytes -= eol - (char *)ptr;
+    ptr = eol;
+    ev_reader_consume(reader, eol - line);
+    if(!(q = w->q)) {
+      disorder_error(0, "disorder-query %lu sent unexpected output",
+                     (unsigned long)w->pid);
+      continue;
+    }
+    if(strcmp(line, ".")) {
+      vector_append(&chunk, xstrdup(line[0] == '.' ? line + 1 : line));
+      if(chunk.nvec < QUERY_CHUNK)
+        continue;
+      /* Pass on a batch and let anything else that's waiting run before
+       * doing the rest */
+      query_deliver(q, chunk.vec, chunk.nvec, 1);
+      vector_init(&chunk);
+      if(eof)
+        continue;                       /* no more to come anyway */
+      if(q->paused)
+        ev_reader_disable(reader);
+      else
+        ev_reader_incomplete(reader);
+      return 0;
+    }
+    /* That's the end of the results */
+    w->q = 0;
+    q->w = 0;
+    w->answered = 1;
+    query_deliver(q, chunk.vec, chunk.nvec, 0);
+    vector_init(&chunk);
+    if(w->retired) {
+      query_worker_discard(ev, w);
+      query_dispatch(ev);
+      return 0;
+    }
+    query_dispatch(ev);
+  }
+  if(chunk.nvec) {
+    /* Pass on what we've got so far */
+    q = w->q;
+    query_deliver(q, chunk.vec, chunk.nvec, 1);
+    if(q->paused)
+      ev_reader_disable(reader);
+  }
+  if(eof) {
+    w->r = 0;
+    query_worker_discard(ev, w);
+    query_dispatch(ev);
+  }
+  return 0;
+}
+
+/** @brief Start a new worker
+ * @param ev Event loop
+ * @return New worker, or NULL on error
+ */
+static struct query_worker *query_worker_spawn(ev_source *ev) {
+  struct query_worker *w;
+  int sp[2];
+  pid_t pid;
+
+  if(socketpair(PF_UNIX, SOCK_STREAM, 0, sp) < 0) {
+    disorder_error(errno, "error calling socketpair");
+    return NULL;
+  }
+  if(!(pid = xfork())) {
+    exitfn = _exit;
+    ev_signal_atfork(ev);
+    signal(SIGPIPE, SIG_DFL);
+    xdup2(sp[1], 0);
+    xdup2(sp[1], 1);
+    xclose(sp[0]);
+    xclose(sp[1]);
+    /* ensure we don't leak privilege anywhere */
+    if(setuid(geteuid()) < 0)
+      disorder_fatal(errno, "error calling setuid");
+    execlp("disorder-query", "disorder-query",
+           "--config", configfile,
+           debugging ? "--debug" : "--no-debug",
+           log_default == &log_syslog ? "--syslog" : "--no-syslog",
+           (char *)0);
+    disorder_fatal(errno, "error invoking disorder-query");
+  }
+  xclose(sp[1]);
+  nonblock(sp[0]);
+  cloexec(sp[0]);
+  w = xmalloc(sizeof *w);
+  w->pid = pid;
+  if(!(w->w = ev_writer_new(ev, sp[0], query_worker_error, w,
+                            "disorder-query writer")))
+    disorder_fatal(0, "ev_writer_new for disorder-query writer failed");
+  /* Queries don't have a size limit, and workers may take a while */
+  ev_writer_space_bound(w->w, 0);
+  ev_writer_time_bound(w->w, 0);
+  if(!(w->r = ev_reader_new(ev, sp[0], query_worker_read, query_worker_error,
+                            w, "disorder-query reader")))
+    disorder_fatal(0, "ev_reader_new for disorder-query reader failed");
+  ev_tie(w->r, w->w);
+  ev_child(ev, pid, 0, query_worker_exited, w);
+  w->next = workers;
+  workers = w;
+  ++nworkers;
+  D(("disorder-query %lu started", (unsigned long)pid));
+  return w;
+}
+
+/** @brief Hand waiting queries to idle workers
+ * @param ev Event loop
+ *
+ * New workers are started as needed, up to @c query_workers.  If none can be
+ * started at all then queries are run in the server.
+ */
+static void query_dispatch(ev_source *ev) {
+  struct query_worker *w;
+  struct query *q;
+
+  while((q = pending)) {
+    for(w = workers; w && (w->q || w->retired); w = w->next)
+      ;
+    if(!w && nworkers < config->query_workers && !query_workers_broken)
+      w = query_worker_spawn(ev);
+    if(!w) {
+      if(nworkers)
+        return;                         /* wait for a worker to finish */
+      /* No workers at all; do it ourselves */
+      ev_timeout(ev, 0, 0, query_inline, q);
+    }
+    if(!(pending = q->next))
+      pending_tail = &pending;
+    if(w) {
+      w->q = q;
+      q->w = w;
+      sink_printf(ev_writer_sink(w->w), "%s\n", q->request);
+    }
+  }
+}
+
+/** @brief Submit a query
+ * @param ev Event loop
+ * @param args Query name and arguments; see query_execute()
+ * @param nargs Number of elements of @p args
+ * @param done Called with the results, or NULL
+ * @param stream Called with each batch of results, if @p done is NULL
+ * @param u Passed to @p done or @p stream
+ *
+ * The callback is always called from the event loop, never from inside this
+ * function.
+ */
+static void query_submit(ev_source *ev, char **args, int nargs,
+                         query_callback *done, query_stream_callback *stream,
+                         void *u) {
+  struct query *q = xmalloc(sizeof *q);
+  const struct query_cached *cached;
+  struct dynstr d;
+  int n;
+
+  q->args = args;
+  q->nargs = nargs;
+  q->done = done;
+  q->stream = stream;
+  q->u = u;
+  q->ev = ev;
+  vector_init(&q->results);
+  dynstr_init(&d);
+  for(n = 0; n < nargs; ++n) {
+    if(n)
+      dynstr_append(&d, ' ');
+    dynstr_append_string(&d, quoteutf8(args[n]));
+  }
+  dynstr_terminate(&d);
+  q->request = d.vec;
+  if(config->query_cache_kbyte) {
+    if((cached = cache_get(&query_cache_type, q->request))
+       && cached->generation == trackdb_generation) {
+      /* Pass on the cached results just as if the query had been run in the
+       * server */
+      ++cache_files_hits;
+      q->inline_results = cached->results;
+      ev_timeout(ev, 0, 0, query_inline_more, q);
+      return;
+    }
+    ++cache_files_misses;
+    q->key = q->request;
+    q->generation = trackdb_generation;
+  }
+  *pending_tail = q;
+  pending_tail = &q->next;
+  query_dispatch(ev);
+}
+
+/** @brief List files and/or directories, passing on results as they arrive
+ * @param ev Event loop
+ * @param dir Directory to list, or NULL for all
+ * @param what What to list
+ * @param re Regexp that results must match, or NULL
+ * @param stream Called with each batch of results
+ * @param u Passed to @p stream
+ *
+ * See trackdb_list().  @p re is matched caselessly and must be valid.
+ *
+ * @p stream is called with results in batches, the last one with its @c more
+ * argument 0.  It may call query_pause() to stop the flow.
+ */
+void query_list_stream(ev_source *ev, const char *dir,
+                       enum trackdb_listable what, const char *re,
+                       query_stream_callback *stream, void *u) {
+  char **args = xcalloc(4, sizeof *args);
+
+  args[0] = xstrdup("list");
+  byte_xasprintf(&args[1], "%d", (int)what);
+  args[2] = xstrdup(dir ? dir : "");
+  args[3] = xstrdup(re ? re : "");
+  query_submit(ev, args, 4, 0, stream, u);
+}
+
+/** @brief Stop passing on results for a query
+ * @param q Query
+ *
+ * No more results will be passed on until query_resume() is called.  The
+ * worker running the query will soon stop too, once the socket buffer fills.
+ */
+void query_pause(struct query *q) {
+  q->paused = 1;
+  if(q->w && q->w->r)
+    ev_reader_disable(q->w->r);
+}
+
+/** @brief Start passing on results again after query_pause()
+ * @param q Query
+ *
+ * Nothing is passed on from inside this function, only from the event loop.
+ */
+void query_resume(struct query *q) {
+  if(!q->paused)
+    return;
+  q->paused = 0;
+  if(q->w && q->w->r)
+    ev_reader_enable(q->w->r);
+  else if(q->inline_results)
+    ev_timeout(q->ev, 0, 0, query_inline_more, q);
+}
+
+/** @brief Search for tracks
+ * @param ev Event loop
+ * @param terms Search terms
+ * @param nterms Number of search terms
+ * @param done Called with the results
+ * @param u Passed to @p done
+ *
+ * See trackdb_search().
+ */
+void query_search(ev_source *ev, char **terms, int nterms,
+                  query_callback *done, void *u) {
+  char **args = xcalloc(nterms + 1, sizeof *args);
+  int n;
+
+  args[0] = xstrdup("search");
+  for(n = 0; n < nterms; ++n)
+    args[n + 1] = xstrdup(terms[n]);
+  query_submit(ev, args, nterms + 1, done, 0, u);
+}
+
+/** @brief Search for tracks as the search terms are typed
+ * @param ev Event loop
+ * @param terms Search terms
+ * @param nterms Number of search terms
+ * @param max Maximum number of tracks to find, or 0 for no limit
+ * @param done Called with the results
+ * @param u Passed to @p done
+ *
+ * See trackdb_search_prefix().
+ */
+void query_search_prefix(ev_source *ev, char **terms, int nterms, int max,
+                         query_callback *done, void *u) {
+  char **args = xcalloc(nterms + 2, sizeof *args);
+  int n;
+
+  args[0] = xstrdup("search-prefix");
+  byte_xasprintf(&args[1], "%d", max);
+  for(n = 0; n < nterms; ++n)
+    args[n + 2] = xstrdup(terms[n]);
+  query_submit(ev, args, nterms + 2, done, 0, u);
+}
+
+/** @brief Search for tracks, allowing for misspelt terms
+ * @param ev Event loop
+ * @param terms Search terms
+ * @param nterms Number of search terms
+ * @param max Maximum number of tracks to find, or 0 for no limit
+ * @param done Called with the results
+ * @param u Passed to @p done
+ *
+ * See trackdb_search_fuzzy().
+ */
+void query_search_fuzzy(ev_source *ev, char **terms, int nterms, int max,
+                        query_callback *done, void *u) {
+  char **args = xcalloc(nterms + 2, sizeof *args);
+  int n;
+
+  args[0] = xstrdup("search-fuzzy");
+  byte_xasprintf(&args[1], "%d", max);
+  for(n = 0; n < nterms; ++n)
+    args[n + 2] = xstrdup(terms[n]);
+  query_submit(ev, args, nterms + 2, done, 0, u);
+}
+
+/** @brief Search for tracks, returning one page of ranked results
+ * @param ev Event loop
+ * @param terms Search terms
+ * @param nterms Number of search terms
+ * @param offset Number of top-ranked tracks to skip
+ * @param limit Maximum number of tracks to find, or 0 for no limit
+ * @param done Called with the results
+ * @param u Passed to @p done
+ *
+ * See trackdb_search_page().  The first result passed to @p done is the
+ * total number of matching tracks, in decimal.
+ */
+void query_search_page(ev_source *ev, char **terms, int nterms,
+                       int offset, int limit,
+                       query_callback *done, void *u) {
+  char **args = xcalloc(nterms + 3, sizeof *args);
+  int n;
+
+  args[0] = xstrdup("search-page");
+  byte_xasprintf(&args[1], "%d", offset);
+  byte_xasprintf(&args[2], "%d", limit);
+  for(n = 0; n < nterms; ++n)
+    args[n + 3] = xstrdup(terms[n]);
+  query_submit(ev, args, nterms + 3, done, 0, u);
+}
+
+/** @brief List recently added tracks
+ * @param ev Event loop
+ * @param max Maximum number of tracks to list
+ * @param done Called with the results
+ * @param u Passed to @p done
+ *
+ * See trackdb_new().
+ */
+void query_new(ev_source *ev, int max, query_callback *done, void *u) {
+  char **args = xcalloc(2, sizeof *args);
+
+  args[0] = xstrdup("new");
+  byte_xasprintf(&args[1], "%d", max);
+  query_submit(ev, args, 2, done, 0, u);
+}
+
+/** @brief Reset the worker pool
+ * @param ev Event loop
+ *
+ * Called after the configuration changes.  Existing workers have the old
+ * configuration, so idle ones are discarded now and busy ones when they
+ * finish; new ones are started as needed.
+ */
+void query_reset(ev_source *ev) {
+  struct query_worker *w, *next;
+
+  query_workers_broken = 0;
+  for(w = workers; w; w = next) {
+    next = w->next;
+    w->retired = 1;
+    if(!w->q)
+      query_worker_discard(ev, w);
+  }
+  query_dispatch(ev);
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
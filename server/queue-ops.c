@@ -20,6 +20,123 @@
  */
 #include "disorder-server.h"
 
+/** @brief Number of queue changes remembered for queue_changes() */
+#define QUEUE_CHANGES_MAX 256
+
+/** @brief Current queue generation
+ *
+ * Bumped by every change to the queue.  It starts at an arbitrary value (see
+ * queue_read()) so that clients don't confuse generations from different runs
+ * of the server.
+ */
+unsigned long queue_generation;
+
+/** @brief Bumped by every change to the recently played list */
+unsigned long recent_generation;
+
+/** @brief Recent queue changes
+ *
+ * A ring buffer; the change that produced generation @c G is at index @c G %
+ * @ref QUEUE_CHANGES_MAX.  Each is a line as sent by queue-changes.
+ */
+static char *changes[QUEUE_CHANGES_MAX];
+
+/** @brief Number of valid entries in @ref changes */
+static int nchanges;
+
+/** @brief Nesting depth of queue_batch_begin() */
+static int batch_depth;
+
+/** @brief Set if the queue changed during the current batch */
+static int batch_changed;
+
+/** @brief Record a change to the queue
+ * @param kind Kind of change
+ * @param raw Marshalled queue entry, or NULL
+ * @param ... Extra fields, terminated by (char *)0
+ *
+ * Bumps @ref queue_generation, remembers the change for queue_changes() and
+ * reports it to the event log.
+ */
+static void queue_change(const char *kind, const char *raw, ...) {
+  struct dynstr d;
+  const char *field;
+  char buffer[32];
+  va_list ap;
+
+  ++queue_generation;
+  dynstr_init(&d);
+  snprintf(buffer, sizeof buffer, "%lu", queue_generation);
+  dynstr_append_string(&d, buffer);
+  dynstr_append(&d, ' ');
+  dynstr_append_string(&d, kind);
+  va_start(ap, raw);
+  while((field = va_arg(ap, const char *))) {
+    dynstr_append(&d, ' ');
+    dynstr_append_string(&d, quoteutf8(field));
+  }
+  va_end(ap);
+  if(raw) {
+    dynstr_append(&d, ' ');
+    dynstr_append_string(&d, raw);
+  }
+  dynstr_terminate(&d);
+  changes[queue_generation % QUEUE_CHANGES_MAX] = d.vec;
+  if(nchanges < QUEUE_CHANGES_MAX)
+    ++nchanges;
+  eventlog_raw("queue_change", d.vec, (char *)0);
+}
+
+/** @brief Return the ID of the entry before @p q, or "" if it's first */
+static const char *queue_prev_id(const struct queue_entry *q) {
+  return q->prev == &qhead ? "" : q->prev->id;
+}
+
+/** @brief Report that an entry has been added to the queue
+ * @param q New queue entry
+ *
+ * queue_add() calls this; anything that puts entries on the queue by
+ * other means must call it too.
+ */
+void queue_inserted(struct queue_entry *q) {
+  const char *marshalled = queue_marshall(q);
+
+  queue_index_add(q);
+  if(batch_depth)
+    batch_changed = 1;
+  else
+    eventlog_raw("queue", marshalled, (const char *)0);
+  queue_change("insert", marshalled, queue_prev_id(q), (char *)0);
+}
+
+/** @brief Report that a queue entry has been modified in place
+ * @param q Modified queue entry
+ */
+void queue_updated(struct queue_entry *q) {
+  queue_change("update", queue_marshall(q), (char *)0);
+}
+
+/** @brief Return the changes to the queue since a given generation
+ * @param generation Generation the caller knows about
+ * @param nvecp Where to store the number of changes
+ * @return Changes, one to a line, or NULL if they are no longer known
+ *
+ * NULL is returned if @p generation is too old, or isn't one of ours at all;
+ * the caller must fetch the whole queue.
+ */
+char **queue_changes(unsigned long generation, int *nvecp) {
+  unsigned long behind = queue_generation - generation, n;
+  char **vec;
+
+  if(generation > queue_generation || behind > (unsigned long)nchanges)
+    return NULL;
+  vec = xcalloc(behind + 1, sizeof *vec);
+  for(n = 0; n < behind; ++n)
+    vec[n] = changes[(generation + 1 + n) % QUEUE_CHANGES_MAX];
+  *nvecp = behind;
+  return vec;
+}
+
 static int find_in_list(struct queue_entry *needle,
 			int nqs, struct queue_entry **qs) {
   int n;
@@ -31,12 +148,7 @@ static int find_in_list(struct queue_entry *needle,
 }
 
 static int id_in_use(const char *id) {
-  struct queue_entry *q;
-
-  for(q = qhead.next; q != &qhead; q = q->next)
-    if(!strcmp(id, q->id))
-      return 1;
-  return 0;
+  return queue_find_id(id) != 0;
 }
 
 static void queue_id(struct queue_entry *q) {
@@ -96,10 +208,7 @@ struct queue_entry *queue_add(const char *track, const char *submitter,
       afterme = &qhead;
     else {
       /* Insert after a specific track */
-      afterme = qhead.next;
-      while(afterme != &qhead && strcmp(afterme->id, target))
-        afterme = afterme->next;
-      if(afterme == &qhead)
+      if(!(afterme = queue_find_id(target)))
         return NULL;
     }
     queue_insert_entry(afterme, q);
@@ -110,7 +219,7 @@ struct queue_entry *queue_add(const char *track, const char *submitter,
   /* submitter will be a null pointer for a scratch */
   if(submitter)
     notify_queue(track, submitter);
-  eventlog_raw("queue", queue_marshall(q), (const char *)0);
+  queue_inserted(q);
   return q;
 }
 
@@ -159,7 +268,11 @@ int queue_move(struct queue_entry *q, int delta, const char *who) {
     disorder_info("user %s moved %s", who, q->id);
     notify_queue_move(q->track, who);
     sprintf(buffer, "%d", moved);
-    eventlog("moved", who, (char *)0);
+    if(batch_depth)
+      batch_changed = 1;
+    else
+      eventlog("moved", who, (char *)0);
+    queue_change("move", 0, q->id, queue_prev_id(q), (char *)0);
   }
   
   return delta;
@@ -186,9 +299,13 @@ void queue_moveafter(struct queue_entry *target,
     /* Log the individual tracks */
     disorder_info("user %s moved %s", who, q->id);
     notify_queue_move(q->track, who);
+    queue_change("move", 0, q->id, queue_prev_id(q), (char *)0);
   }
   /* Report that the queue changed to the event log */
-  eventlog("moved", who, (char *)0);
+  if(batch_depth)
+    batch_changed = 1;
+  else
+    eventlog("moved", who, (char *)0);
 }
 
 void queue_remove(struct queue_entry *which, const char *who) {
@@ -196,11 +313,46 @@ void queue_remove(struct queue_entry *which, const char *who) {
     disorder_info("user %s removed %s", who, which->id);
     notify_queue_move(which->track, who);
   }
-  eventlog("removed", which->id, who, (const char *)0);
+  if(batch_depth)
+    batch_changed = 1;
+  else
+    eventlog("removed", which->id, who, (const char *)0);
   queue_delete_entry(which);
+  queue_index_remove(which);
+  queue_change("remove", 0, which->id, (char *)0);
+}
+
+/** @brief Start a batch of changes to the queue
+ *
+ * Until the matching queue_batch_end(), additions, moves and removals are
+ * not reported to the event log individually.  The @b queue_change lines
+ * are still sent for each, since subscribers apply those without fetching
+ * anything.
+ *
+ * Batches may be nested; only the outermost one has any effect.
+ */
+void queue_batch_begin(void) {
+  ++batch_depth;
+}
+
+/** @brief Finish a batch of changes to the queue
+ * @param who Who made the changes, or NULL
+ *
+ * If the queue changed during the batch it is saved, and a single @b moved
+ * event reported in place of the individual events, so that subscribers
+ * that refetch the queue do so only once.
+ */
+void queue_batch_end(const char *who) {
+  assert(batch_depth > 0);
+  if(--batch_depth || !batch_changed)
+    return;
+  batch_changed = 0;
+  queue_write();
+  eventlog("moved", who ? who : "", (char *)0);
 }
 
 void queue_played(struct queue_entry *q) {
+  ++recent_generation;
   while(pcount && pcount >= config->history) {
     eventlog("recent_removed", phead.next->id, (char *)0);
     queue_delete_entry(phead.next);
@@ -22,9 +22,81 @@
  */
 #include "disorder-server.h"
 
+#include <dirent.h>
+#include <poll.h>
+
+#include "loudness.h"
+#if HAVE_SYS_SYSCALL_H
+# include <sys/syscall.h>
+#endif
+
 static time_t last_report;
 static DB_TXN *global_tid;
 
+/** @brief Set to report progress on stdout */
+static int report_progress;
+
+/** @brief Progress through the current phase of the rescan */
+static struct progress {
+  /** @brief Name of phase */
+  const char *phase;
+
+  /** @brief When the phase started */
+  time_t started;
+
+  /** @brief When progress was last reported */
+  time_t reported;
+
+  /** @brief Number of items done */
+  long done;
+
+  /** @brief Expected number of items, or 0 if not known */
+  long total;
+
+  /** @brief Number of new tracks found */
+  long nnew;
+} progress;
+
+/** @brief Number of tracks to notice in each transaction */
+#define NOTICE_BATCH 256
+
+/** @brief Number of computed track lengths to record in each transaction */
+#define LENGTH_BATCH 32
+
+/** @brief Number of tracks to give a batched tracklength plugin at once */
+#define LENGTH_JOB 32
+
+/** @brief One pattern from a @c player or @c tracklength list
+ *
+ * Most patterns are of the form <tt>*.ext</tt>, which can be matched
+ * with a string comparison instead of fnmatch().
+ */
+struct pattern {
+  /** @brief Pattern for fnmatch(), or NULL if @ref suffix is used */
+  const char *glob;
+
+  /** @brief Suffix that matches */
+  const char *suffix;
+
+  /** @brief Length of @ref suffix */
+  size_t len;
+};
+
+/** @brief A precompiled @c player or @c tracklength list */
+struct patterns {
+  /** @brief Number of patterns */
+  int n;
+
+  /** @brief Patterns, in order */
+  struct pattern *p;
+};
+
+/** @brief Precompiled @c player patterns */
+static struct patterns players;
+
+/** @brief Precompiled @c tracklength patterns */
+static struct patterns lengthers;
+
 static const struct option options[] = {
   { "help", no_argument, 0, 'h' },
   { "version", no_argument, 0, 'V' },
@@ -35,6 +107,8 @@ static const struct option options[] = {
   { "no-syslog", no_argument, 0, 'S' },
   { "check", no_argument, 0, 'K' },
   { "no-check", no_argument, 0, 'C' },
+  { "dirty", required_argument, 0, 'F' },
+  { "progress", no_argument, 0, 'P' },
   { 0, 0, 0, 0 }
 };
 
@@ -49,6 +123,8 @@ static void attribute((noreturn)) help(void) {
 	  "  --debug, -d             Turn on debugging\n"
           "  --[no-]syslog           Enable/disable logging to syslog\n"
           "  --[no-]check            Enable/disable track length check\n"
+          "  --dirty PATH            Only rescan directories listed in PATH\n"
+          "  --progress              Report progress on stdout\n"
           "\n"
           "Rescanner for DisOrder.  Not intended to be run\n"
           "directly.\n");
@@ -58,15 +134,117 @@ static void attribute((noreturn)) help(void) {
 
 static volatile sig_atomic_t signalled;
 
+/** @brief Set when the server asks us to back off */
+static volatile sig_atomic_t backoff_signalled;
+
 static void signal_handler(int sig) {
   if(sig == 0) _exit(-1);               /* "Cannot happen" */
   signalled = sig;
 }
 
+static void backoff_handler(int attribute((unused)) sig) {
+  backoff_signalled = 1;
+}
+
 static int aborted(void) {
   return signalled || getppid() == 1;
 }
 
+/** @brief Put the rescanner in the idle I/O class
+ *
+ * Only possible on Linux.  Subprocesses inherit the class.
+ */
+static void idle_io(void) {
+#ifdef SYS_ioprio_set
+  /* From the kernel's include/uapi/linux/ioprio.h */
+  const int IOPRIO_WHO_PROCESS = 1, IOPRIO_CLASS_IDLE = 3;
+  const int IOPRIO_CLASS_SHIFT = 13;
+
+  if(syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+             IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) < 0)
+    disorder_error(errno, "error calling ioprio_set");
+#endif
+}
+
+/** @brief Wait until the rescan may visit more files
+ * @param n Number of files about to be visited
+ *
+ * Limits the rate to @c rescan_rate files per second, and pauses for @c
+ * rescan_backoff seconds if the server has asked us to back off.
+ */
+static void pace(int n) {
+  static int64_t next;
+  struct timespec ts;
+  int64_t now;
+
+  if(backoff_signalled) {
+    backoff_signalled = 0;
+    disorder_info("playback dropped out, pausing for %lds",
+                  config->rescan_backoff);
+    ts.tv_sec = config->rescan_backoff;
+    ts.tv_nsec = 0;
+    while(nanosleep(&ts, &ts) < 0 && errno == EINTR && !signalled)
+      ;
+  }
+  if(!config->rescan_rate)
+    return;
+  xgettime(CLOCK_MONOTONIC, &ts);
+  now = ts.tv_sec * (int64_t)1000000000 + ts.tv_nsec;
+  if(next < now)
+    next = now;
+  next += n * (int64_t)1000000000 / config->rescan_rate;
+  if(next > now) {
+    ts.tv_sec = (next - now) / 1000000000;
+    ts.tv_nsec = (next - now) % 1000000000;
+    while(nanosleep(&ts, &ts) < 0 && errno == EINTR && !signalled)
+      ;
+  }
+}
+
+/** @brief Report progress to the server
+ *
+ * The server turns each line into a @c rescan_progress event.
+ */
+static void progress_report(void) {
+  const time_t now = xtime(0);
+  const long rate = now > progress.started
+    ? progress.done / (now - progress.started) : 0;
+  const long eta = rate && progress.total > progress.done
+    ? (progress.total - progress.done) / rate : 0;
+
+  if(!report_progress)
+    return;
+  /* Flush every time, or subprocesses would inherit the buffer */
+  if(printf("progress %s %ld %ld %ld %ld %ld\n", progress.phase,
+            progress.done, progress.total, progress.nnew, rate, eta) < 0
+     || fflush(stdout) < 0)
+    disorder_fatal(errno, "error writing progress");
+  progress.reported = now;
+}
+
+/** @brief Start a phase of the rescan
+ * @param phase Name of phase
+ * @param total Expected number of items, or 0 if not known
+ */
+static void progress_start(const char *phase, long total) {
+  progress.phase = phase;
+  progress.started = xtime(0);
+  progress.done = progress.nnew = 0;
+  progress.total = total;
+  progress_report();
+}
+
+/** @brief Record progress through the current phase
+ * @param done Number of items just done
+ * @param nnew Number of new tracks just found
+ */
+static void progress_add(long done, long nnew) {
+  progress.done += done;
+  progress.nnew += nnew;
+  if(xtime(0) > progress.reported + 10)
+    progress_report();
+}
+
 /* Exit if our parent has gone away or we have been told to stop. */
 static void checkabort(void) {
   if(getppid() == 1) {
@@ -81,87 +259,374 @@ static void checkabort(void) {
   }
 }
 
-/* rescan a collection */
-static void rescan_collection(const struct collection *c) {
-  pid_t pid, r;
-  int p[2], n, w;
-  FILE *fp = 0;
-  char *path, *track;
-  long ntracks = 0, nnew = 0;
-  
-  checkabort();
-  disorder_info("rescanning %s with %s", c->root, c->module);
-  /* plugin runs in a subprocess */
+/** @brief State for rescanning one collection */
+struct rescan_state {
+  /** @brief Collection being rescanned */
+  const struct collection *c;
+
+  /** @brief Number of tracks found */
+  long ntracks;
+
+  /** @brief Number of new tracks */
+  long nnew;
+
+  /** @brief Number of scanners not yet finished */
+  int unfinished;
+
+  /** @brief Set if any scanner failed */
+  int failed;
+
+  /** @brief Set if the whole collection is being scanned */
+  int full;
+
+  /** @brief Tracks waiting to be noticed */
+  char *tracks[NOTICE_BATCH];
+
+  /** @brief Raw paths of @ref tracks */
+  char *paths[NOTICE_BATCH];
+
+  /** @brief Stat signatures of @ref paths */
+  char *sigs[NOTICE_BATCH];
+
+  /** @brief Number of tracks waiting to be noticed */
+  int nbatch;
+};
+
+/** @brief A scanner subprocess, running or waiting to run */
+struct scanner {
+  /** @brief Next scanner */
+  struct scanner *next;
+
+  /** @brief Collection this scanner is part of */
+  struct rescan_state *rs;
+
+  /** @brief Path to scan */
+  const char *path;
+
+  /** @brief Subprocess, or 0 */
+  pid_t pid;
+
+  /** @brief Pipe from subprocess */
+  int fd;
+
+  /** @brief Incomplete path read from @ref fd */
+  struct dynstr input;
+};
+
+/** @brief Precompile a list of patterns
+ * @param ps Where to store the result
+ * @param sll List, with the pattern first in each entry
+ */
+static void patterns_compile(struct patterns *ps,
+                             const struct stringlistlist *sll) {
+  const char *s;
+  int n;
+
+  ps->n = sll->n;
+  ps->p = xcalloc(ps->n, sizeof *ps->p);
+  for(n = 0; n < ps->n; ++n) {
+    s = sll->s[n].s[0];
+    if(*s == '*' && !strpbrk(s + 1, "*?[\\")) {
+      ps->p[n].suffix = s + 1;
+      ps->p[n].len = strlen(s + 1);
+    } else
+      ps->p[n].glob = s;
+  }
+}
+
+/** @brief Find the first pattern matching a track
+ * @param ps Patterns
+ * @param track Track name
+ * @return Index of the matching pattern, or -1 if none
+ *
+ * Equivalent to trying each pattern with fnmatch() and no flags.
+ */
+static int patterns_match(const struct patterns *ps, const char *track) {
+  const size_t len = strlen(track);
+  const struct pattern *p;
+  int n;
+
+  for(n = 0; n < ps->n; ++n) {
+    p = &ps->p[n];
+    if(p->glob ? fnmatch(p->glob, track, 0) == 0
+       : (len >= p->len && !memcmp(track + len - p->len, p->suffix, p->len)))
+      return n;
+  }
+  return -1;
+}
+
+/** @brief Notice any tracks waiting in a collection's batch */
+static void rescan_flush(struct rescan_state *rs) {
+  long nnew;
+
+  if(rs->nbatch) {
+    nnew = trackdb_notice_batch(rs->nbatch, rs->tracks, rs->paths, rs->sigs);
+    rs->nnew += nnew;
+    progress_add(rs->nbatch, nnew);
+    rs->nbatch = 0;
+  }
+}
+
+/** @brief Return the global preference recording a collection's size */
+static char *collection_count_key(const struct collection *c) {
+  char *key;
+
+  byte_xasprintf(&key, "_rescan_count %s", c->root);
+  return key;
+}
+
+/** @brief Convert a raw path to a track name
+ * @param c Collection containing @p path
+ * @param path Raw path name
+ * @return Track name, or NULL on error
+ */
+static char *path_track(const struct collection *c, const char *path) {
+  char *track;
+
+  if(!(track = any2utf8(c->encoding, path))) {
+    disorder_error(0, "cannot convert track path to UTF-8: %s", path);
+    return 0;
+  }
+  if(config->dbversion > 1) {
+    /* We use NFC track names */
+    if(!(track = utf8_compose_canon(track, strlen(track), 0))) {
+      disorder_error(0, "cannot convert track path to NFC: %s", path);
+      return 0;
+    }
+  }
+  return track;
+}
+
+/** @brief Handle one path from a scanner
+ * @param rs Collection being rescanned
+ * @param path Raw path name
+ */
+static void rescan_path(struct rescan_state *rs, char *path) {
+  const struct collection *c = rs->c;
+  char *track;
+
+  /* actually we can cope relatively well within the server, but they'll go
+   * wrong in track listings */
+  if(strchr(path, '\n')) {
+    disorder_error(0, "cannot cope with tracks with newlines in the name");
+    return;
+  }
+  if(!(track = path_track(c, path)))
+    return;
+  D(("track %s", track));
+  /* only tracks with a known player are admitted */
+  if(patterns_match(&players, track) >= 0) {
+    pace(1);
+    rs->tracks[rs->nbatch] = track;
+    rs->paths[rs->nbatch] = path;
+    rs->sigs[rs->nbatch] = trackdb_stat_signature(path);
+    if(++rs->nbatch == NOTICE_BATCH)
+      rescan_flush(rs);
+    ++rs->ntracks;
+    if(rs->ntracks % 100 == 0 && xtime(0) > last_report + 10) {
+      disorder_info("rescanning %s, %ld tracks so far", c->root, rs->ntracks);
+      xtime(&last_report);
+    }
+  }
+}
+
+/** @brief Start a scanner subprocess */
+static void scanner_start(struct scanner *s) {
+  int p[2];
+
   xpipe(p);
-  if(!(pid = xfork())) {
+  if(!(s->pid = xfork())) {
     exitfn = _exit;
     xclose(p[0]);
     xdup2(p[1], 1);
     xclose(p[1]);
-    scan(c->module, c->root);
+    scan(s->rs->c->module, s->path);
     if(fflush(stdout) < 0)
       disorder_fatal(errno, "error writing to scanner pipe");
     _exit(0);
   }
   xclose(p[1]);
-  if(!(fp = fdopen(p[0], "r")))
-    disorder_fatal(errno, "error calling fdopen");
-  /* read tracks from the plugin */
-  while(!inputline("rescanner", fp, &path, 0)) {
+  s->fd = p[0];
+  dynstr_init(&s->input);
+}
+
+/** @brief Read what's available from a scanner
+ * @param s Scanner
+ * @return 0 if there may be more, 1 at EOF or error
+ */
+static int scanner_read(struct scanner *s) {
+  char buffer[4096];
+  ssize_t n;
+  int i, start;
+
+  if((n = read(s->fd, buffer, sizeof buffer)) < 0) {
+    if(errno == EINTR || errno == EAGAIN)
+      return 0;
+    disorder_error(errno, "error reading from scanner pipe");
+    s->rs->failed = 1;
+    return 1;
+  }
+  if(n == 0) {
+    if(s->input.nvec)
+      disorder_error(0, "error reading rescanner: unexpected EOF");
+    return 1;
+  }
+  /* paths are terminated by a null byte */
+  for(i = start = 0; i < n; ++i)
+    if(!buffer[i]) {
+      dynstr_append_bytes(&s->input, buffer + start, i - start);
+      dynstr_terminate(&s->input);
+      rescan_path(s->rs, s->input.vec);
+      dynstr_init(&s->input);
+      start = i + 1;
+    }
+  dynstr_append_bytes(&s->input, buffer + start, n - start);
+  return 0;
+}
+
+/** @brief Tidy up after a scanner has finished */
+static void scanner_finish(struct scanner *s) {
+  struct rescan_state *rs = s->rs;
+  pid_t r;
+  int w;
+
+  xclose(s->fd);
+  while((r = waitpid(s->pid, &w, 0)) == -1 && errno == EINTR)
+    ;
+  if(r < 0) disorder_fatal(errno, "error calling waitpid");
+  if(w) {
+    disorder_error(0, "scanner subprocess for %s: %s", s->path, wstat(w));
+    rs->failed = 1;
+  }
+  if(--rs->unfinished)
+    return;
+  rescan_flush(rs);
+  if(!rs->failed) {
+    disorder_info("rescanned %s, %ld tracks, %ld new",
+                  rs->c->root, rs->ntracks, rs->nnew);
+    /* Remember how big the collection is for next time's estimate */
+    if(rs->full) {
+      char count[32];
+
+      byte_snprintf(count, sizeof count, "%ld", rs->ntracks);
+      trackdb_set_global(collection_count_key(rs->c), count, 0);
+    }
+  }
+}
+
+/** @brief Add scanners for a collection
+ * @param scanners Where to add scanners
+ * @param c Collection to rescan
+ *
+ * With @c rescan_split, each entry at the top of the collection gets a
+ * scanner of its own.
+ */
+static void rescan_add(struct scanner ***scanners,
+                       const struct collection *c) {
+  struct rescan_state *rs = xmalloc(sizeof *rs);
+  struct scanner *s;
+  DIR *dp;
+  struct dirent *de;
+  struct vector paths;
+  int n;
+
+  rs->c = c;
+  rs->full = 1;
+  vector_init(&paths);
+  if(config->rescan_split) {
+    if(!(dp = opendir(c->root)))
+      disorder_error(errno, "cannot open directory %s", c->root);
+    else {
+      while((errno = 0), (de = readdir(dp)))
+        if(de->d_name[0] != '.')
+          vector_append(&paths, xstrdup(de->d_name));
+      if(errno) {
+        disorder_error(errno, "error reading directory %s", c->root);
+        paths.nvec = 0;
+      }
+      closedir(dp);
+      for(n = 0; n < paths.nvec; ++n)
+        byte_xasprintf(&paths.vec[n], "%s/%s", c->root, paths.vec[n]);
+    }
+  }
+  if(!paths.nvec)
+    vector_append(&paths, (char *)c->root);
+  for(n = 0; n < paths.nvec; ++n) {
+    s = xmalloc(sizeof *s);
+    s->rs = rs;
+    s->path = paths.vec[n];
+    **scanners = s;
+    *scanners = &s->next;
+    ++rs->unfinished;
+  }
+  disorder_info("rescanning %s with %s", c->root, c->module);
+}
+
+/** @brief Run scanners
+ * @param waiting Scanners to run
+ *
+ * Up to @c rescan_scanners scanners run at once, and the tracks they find are
+ * noticed in batches for each collection.
+ */
+static void rescan_run(struct scanner *waiting) {
+  struct scanner *running = 0, *s, **ss;
+  struct pollfd *fds;
+  int n, nrunning = 0;
+
+  fds = xcalloc(config->rescan_scanners, sizeof *fds);
+  while(waiting || running) {
     checkabort();
-    /* actually we can cope relatively well within the server, but they'll go
-     * wrong in track listings */
-    if(strchr(path, '\n')) {
-      disorder_error(0, "cannot cope with tracks with newlines in the name");
-      continue;
+    /* start as many scanners as we're allowed */
+    while(waiting && nrunning < config->rescan_scanners) {
+      s = waiting;
+      waiting = s->next;
+      scanner_start(s);
+      s->next = running;
+      running = s;
+      ++nrunning;
     }
-    if(!(track = any2utf8(c->encoding, path))) {
-      disorder_error(0, "cannot convert track path to UTF-8: %s", path);
-      continue;
+    /* wait for one to have something to say */
+    for(n = 0, s = running; s; s = s->next, ++n) {
+      fds[n].fd = s->fd;
+      fds[n].events = POLLIN;
+      fds[n].revents = 0;
     }
-    if(config->dbversion > 1) {
-      /* We use NFC track names */
-      if(!(track = utf8_compose_canon(track, strlen(track), 0))) {
-        disorder_error(0, "cannot convert track path to NFC: %s", path);
+    if(poll(fds, nrunning, -1) < 0) {
+      if(errno == EINTR)
         continue;
-      }
+      disorder_fatal(errno, "error calling poll");
     }
-    D(("track %s", track));
-    /* only tracks with a known player are admitted */
-    for(n = 0; (n < config->player.n
-		&& fnmatch(config->player.s[n].s[0], track, 0) != 0); ++n)
-      ;
-    if(n < config->player.n) {
-      nnew += !!trackdb_notice(track, path);
-      ++ntracks;
-      if(ntracks % 100 == 0 && xtime(0) > last_report + 10) {
-        disorder_info("rescanning %s, %ld tracks so far", c->root, ntracks);
-        xtime(&last_report);
-      }
+    for(n = 0, ss = &running; (s = *ss); ++n) {
+      if(fds[n].revents && scanner_read(s)) {
+        *ss = s->next;
+        --nrunning;
+        scanner_finish(s);
+      } else
+        ss = &s->next;
     }
   }
-  /* tidy up */
-  if(ferror(fp)) {
-    disorder_error(errno, "error reading from scanner pipe");
-    goto done;
-  }
-  xfclose(fp);
-  fp = 0;
-  while((r = waitpid(pid, &w, 0)) == -1 && errno == EINTR)
-    ;
-  if(r < 0) disorder_fatal(errno, "error calling waitpid");
-  pid = 0;
-  if(w) {
-    disorder_error(0, "scanner subprocess: %s", wstat(w));
-    goto done;
-  }
-  disorder_info("rescanned %s, %ld tracks, %ld new", c->root, ntracks, nnew);
-done:
-  if(fp)
-    xfclose(fp);
-  if(pid)
-    while((waitpid(pid, &w, 0)) == -1 && errno == EINTR)
-      ;
+}
+
+/** @brief Rescan collections
+ * @param cs Collections to rescan
+ * @param ncs Number of collections
+ */
+static void rescan_collections(const struct collection **cs, int ncs) {
+  struct scanner *waiting = 0, **tail = &waiting;
+  int n;
+
+  const char *count;
+  long total = 0;
+
+  checkabort();
+  for(n = 0; n < ncs; ++n)
+    if((count = trackdb_get_global(collection_count_key(cs[n]))))
+      total += atol(count);
+  progress_start("scan", total);
+  for(n = 0; n < ncs; ++n)
+    rescan_add(&tail, cs[n]);
+  rescan_run(waiting);
+  progress_report();
 }
 
 /** @brief State for the recheck phase of the rescan */
@@ -180,6 +645,21 @@ struct recheck_state {
 
   /** @brief Linked list of tracks to recheck */
   struct recheck_track *tracks;
+
+  /** @brief Linked list of tracks whose lengths must be computed */
+  struct recheck_length *lengths;
+
+  /** @brief Length needed by the track just checked, or NULL */
+  struct recheck_length *pending;
+
+  /** @brief Number of loudnesses measured */
+  long nloudness;
+
+  /** @brief Linked list of tracks whose loudness must be measured */
+  struct recheck_loudness *loudness;
+
+  /** @brief Loudness needed by the track just checked, or NULL */
+  struct recheck_loudness *pending_loudness;
 };
 
 /** @brief A track to recheck
@@ -194,6 +674,108 @@ struct recheck_track {
   const char *track;
 };
 
+/** @brief A track whose length is to be computed
+ *
+ * A node in a linked list.
+ */
+struct recheck_length {
+  /** @brief Next track */
+  struct recheck_length *next;
+
+  /** @brief Track */
+  const char *track;
+
+  /** @brief Raw path name */
+  const char *path;
+
+  /** @brief Tracklength plugin */
+  const char *plugin;
+
+  /** @brief Stat signature when the track was checked, or NULL */
+  const char *sig;
+
+  /** @brief Set to compute the length on its own, not in a batch */
+  int single;
+
+  /** @brief Computed length, or a value <= 0 on error */
+  long length;
+};
+
+/** @brief A track whose loudness is to be measured
+ *
+ * A node in a linked list.
+ */
+struct recheck_loudness {
+  /** @brief Next track */
+  struct recheck_loudness *next;
+
+  /** @brief Track */
+  const char *track;
+
+  /** @brief Raw path name */
+  const char *path;
+
+  /** @brief Player */
+  const struct stringlist *player;
+
+  /** @brief Stat signature when the track was checked, or NULL */
+  const char *sig;
+
+  /** @brief Set if the loudness was measured */
+  int measured;
+
+  /** @brief Loudness in hundredths of a LUFS */
+  long loudness;
+};
+
+/** @brief A subprocess measuring the loudness of a track
+ *
+ * A node in a linked list.
+ */
+struct loudness_job {
+  /** @brief Next job */
+  struct loudness_job *next;
+
+  /** @brief Track */
+  struct recheck_loudness *track;
+
+  /** @brief Subprocess measuring the loudness */
+  pid_t pid;
+
+  /** @brief Pipe from subprocess */
+  int fd;
+
+  /** @brief Output read from @ref fd */
+  struct dynstr output;
+};
+
+/** @brief A subprocess computing the lengths of one or more tracks
+ *
+ * A node in a linked list.
+ */
+struct length_job {
+  /** @brief Next job */
+  struct length_job *next;
+
+  /** @brief Tracks */
+  struct recheck_length *tracks[LENGTH_JOB];
+
+  /** @brief Number of tracks */
+  int ntracks;
+
+  /** @brief Set if the plugin's batch interface is used */
+  int batched;
+
+  /** @brief Subprocess computing the lengths */
+  pid_t pid;
+
+  /** @brief Pipe from subprocess */
+  int fd;
+
+  /** @brief Output read from @ref fd */
+  struct dynstr output;
+};
+
 /* called for each non-alias track */
 static int recheck_list_callback(const char *track,
                                  struct kvp attribute((unused)) *data,
@@ -209,16 +791,41 @@ static int recheck_list_callback(const char *track,
   return 0;
 }
 
+/** @brief Return nonzero if a player's output can be measured
+ * @param player Player
+ *
+ * Only @c --direct raw-format players are used, since they will write
+ * unframed samples in the configured format.
+ */
+static int loudness_player(const struct stringlist *player) {
+  const struct plugin *pl;
+  int n;
+
+  if(!(pl = open_plugin(player->s[1], 0))
+     || ((play_get_type(pl) & DISORDER_PLAYER_TYPEMASK)
+         != DISORDER_PLAYER_RAW))
+    return 0;
+  for(n = 2; n < player->n && player->s[n][0] == '-'; ++n) {
+    if(!strcmp(player->s[n], "--"))
+      break;
+    if(!strcmp(player->s[n], "--direct"))
+      return 1;
+  }
+  return 0;
+}
+
 static int recheck_track_tid(struct recheck_state *cs,
                              const struct recheck_track *t,
                              DB_TXN *tid) {
   const struct collection *c = cs->c;
-  const char *path;
-  char buffer[20];
+  const char *path, *sig, *nolength, *length, *noloudness;
   int err, n;
-  long length;
-  struct kvp *data;
+  struct kvp *data, *cached;
+  struct recheck_length *l;
+  struct recheck_loudness *m;
 
+  cs->pending = 0;
+  cs->pending_loudness = 0;
   if((err = trackdb_getdata(trackdb_tracksdb, t->track, &data, tid)))
     return err;
   path = kvp_get(data, "_path");
@@ -234,34 +841,60 @@ static int recheck_track_tid(struct recheck_state *cs,
     }
   }
   /* see if the track has evaporated or no longer has a player */
-  for(n = 0; (n < config->player.n
-              && fnmatch(config->player.s[n].s[0], t->track, 0) != 0); ++n)
-    ;
-  if(n >= config->player.n || check(c->module, c->root, path) == 0) {
+  if(patterns_match(&players, t->track) < 0
+     || check(c->module, c->root, path) == 0) {
     D(("obsoleting %s", t->track));
     if((err = trackdb_obsolete(t->track, tid)))
       return err;
     ++cs->nobsolete;
     return 0;
   }
-  /* make sure we know the length */
-  if(!kvp_get(data, "_length")) {
-    D(("recalculating length of %s", t->track));
-    for(n = 0; n < config->tracklength.n; ++n)
-      if(fnmatch(config->tracklength.s[n].s[0], t->track, 0) == 0)
-        break;
-    if(n >= config->tracklength.n)
-      disorder_error(0, "no tracklength plugin found for %s", t->track);
-    else {
-      length = tracklength(config->tracklength.s[n].s[1], t->track, path);
-      if(length > 0) {
-        byte_snprintf(buffer, sizeof buffer, "%ld", length);
-        kvp_set(&data, "_length", buffer);
+  sig = kvp_get(data, "_stat");
+  /* measure the loudness on the same terms as the length below */
+  noloudness = kvp_get(data, "_noloudness");
+  if(config->loudness_analysis
+     && !kvp_get(data, "_loudness")
+     && !(sig && noloudness && !strcmp(sig, noloudness))
+     && (n = patterns_match(&players, t->track)) >= 0
+     && loudness_player(&config->player.s[n])) {
+    m = xmalloc(sizeof *m);
+    m->track = t->track;
+    m->path = path;
+    m->player = &config->player.s[n];
+    m->sig = sig;
+    cs->pending_loudness = m;
+  }
+  /* make sure we know the length, unless we already failed to work it out
+   * and the file hasn't changed since */
+  nolength = kvp_get(data, "_nolength");
+  if(!kvp_get(data, "_length")
+     && !(sig && nolength && !strcmp(sig, nolength))) {
+    /* if the same file has been seen before, under any name, reuse its
+     * length */
+    if(sig) {
+      if((err = trackdb_getdata(trackdb_lengthsdb, sig, &cached, tid))
+         == DB_LOCK_DEADLOCK)
+        return err;
+      if((length = kvp_get(cached, "_length"))) {
+        kvp_set(&data, "_length", length);
+        kvp_set(&data, "_nolength", 0);
+        trackdb_length_changed(t->track, 0, length);
         if((err = trackdb_putdata(trackdb_tracksdb, t->track, data, tid, 0)))
           return err;
-        ++cs->nlength;
+        return trackdb_dirs_flush(tid);
       }
     }
+    if((n = patterns_match(&lengthers, t->track)) < 0)
+      disorder_error(0, "no tracklength plugin found for %s", t->track);
+    else {
+      /* lengths are computed later, several at once */
+      l = xmalloc(sizeof *l);
+      l->track = t->track;
+      l->path = path;
+      l->plugin = config->tracklength.s[n].s[1];
+      l->sig = sig;
+      cs->pending = l;
+    }
   }
   return 0;
 }
@@ -271,17 +904,526 @@ static int recheck_track(struct recheck_state *cs,
   int e;
 
   WITH_TRANSACTION(recheck_track_tid(cs, t, tid));
+  if(!e && cs->pending) {
+    cs->pending->next = cs->lengths;
+    cs->lengths = cs->pending;
+  }
+  if(!e && cs->pending_loudness) {
+    cs->pending_loudness->next = cs->loudness;
+    cs->loudness = cs->pending_loudness;
+  }
   return e;
 }
 
-/* recheck a collection */
-static void recheck_collection(const struct collection *c) {
+/** @brief Called by a batched tracklength plugin with each result */
+static void length_write(int n, long length, void *u) {
+  char buffer[64];
+  const int fd = *(int *)u;
+
+  byte_snprintf(buffer, sizeof buffer, "%d %ld\n", n, length);
+  if(write(fd, buffer, strlen(buffer)) < 0)
+    disorder_fatal(errno, "error writing to length pipe");
+}
+
+/** @brief Start computing track lengths in a subprocess
+ *
+ * The subprocess writes a line for each track with its index in the job and
+ * its length.
+ */
+static void length_start(struct length_job *j) {
+  const char *tracks[LENGTH_JOB], *paths[LENGTH_JOB];
+  int p[2], n;
+
+  D(("recalculating length of %s and %d more", j->tracks[0]->track,
+     j->ntracks - 1));
+  xpipe(p);
+  if(!(j->pid = xfork())) {
+    exitfn = _exit;
+    xclose(p[0]);
+    if(j->batched) {
+      for(n = 0; n < j->ntracks; ++n) {
+        tracks[n] = j->tracks[n]->track;
+        paths[n] = j->tracks[n]->path;
+      }
+      tracklength_batch(j->tracks[0]->plugin, j->ntracks, tracks, paths,
+                        length_write, &p[1]);
+    } else
+      for(n = 0; n < j->ntracks; ++n)
+        length_write(n, tracklength(j->tracks[n]->plugin, j->tracks[n]->track,
+                                    j->tracks[n]->path), &p[1]);
+    _exit(0);
+  }
+  xclose(p[1]);
+  j->fd = p[0];
+  dynstr_init(&j->output);
+}
+
+/** @brief Read what's available from a length subprocess
+ * @param j Job
+ * @return 0 if there may be more, 1 at EOF or error
+ */
+static int length_read(struct length_job *j) {
+  char buffer[256];
+  ssize_t n;
+
+  if((n = read(j->fd, buffer, sizeof buffer)) < 0) {
+    if(errno == EINTR || errno == EAGAIN)
+      return 0;
+    disorder_error(errno, "error reading from length pipe");
+    return 1;
+  }
+  if(n == 0)
+    return 1;
+  dynstr_append_bytes(&j->output, buffer, n);
+  return 0;
+}
+
+/** @brief Tidy up after a length subprocess has finished
+ * @param j Job
+ * @param retry Where to put tracks to try again on their own
+ *
+ * If a batched subprocess fails, the tracks it had not finished with are
+ * tried again one at a time, so that one bad file cannot spoil the others.
+ */
+static void length_finish(struct length_job *j,
+                          struct recheck_length **retry) {
+  char *line, *end;
+  pid_t r;
+  int w, n;
+  long length;
+
+  xclose(j->fd);
+  while((r = waitpid(j->pid, &w, 0)) == -1 && errno == EINTR)
+    ;
+  if(r < 0) disorder_fatal(errno, "error calling waitpid");
+  for(n = 0; n < j->ntracks; ++n)
+    j->tracks[n]->length = LONG_MIN;
+  dynstr_terminate(&j->output);
+  for(line = j->output.vec; (end = strchr(line, '\n')); line = end + 1) {
+    if(sscanf(line, "%d %ld", &n, &length) == 2 && n >= 0 && n < j->ntracks)
+      j->tracks[n]->length = length;
+  }
+  if(w)
+    disorder_error(0, "computing length of %s%s: %s", j->tracks[0]->track,
+                   j->ntracks > 1 ? " etc" : "", wstat(w));
+  for(n = 0; n < j->ntracks; ++n)
+    if(j->tracks[n]->length == LONG_MIN) {
+      j->tracks[n]->length = -1;
+      if(j->batched) {
+        j->tracks[n]->single = 1;
+        j->tracks[n]->next = *retry;
+        *retry = j->tracks[n];
+      }
+    }
+}
+
+/** @brief Make the next job from the list of tracks waiting
+ * @param waiting Tracks waiting for their lengths to be computed
+ * @return New job
+ *
+ * Tracks for a plugin with a batch interface are grouped together.
+ */
+static struct length_job *length_job(struct recheck_length **waiting) {
+  struct length_job *j = xmalloc(sizeof *j);
+  struct recheck_length *l = *waiting, **ll;
+
+  *waiting = l->next;
+  j->tracks[0] = l;
+  j->ntracks = 1;
+  j->batched = !l->single && tracklength_batched(l->plugin);
+  if(j->batched)
+    for(ll = waiting; *ll && j->ntracks < LENGTH_JOB;) {
+      if(!(*ll)->single && !strcmp((*ll)->plugin, l->plugin)) {
+        j->tracks[j->ntracks++] = *ll;
+        *ll = (*ll)->next;
+      } else
+        ll = &(*ll)->next;
+    }
+  return j;
+}
+
+/** @brief Record a batch of computed lengths */
+static int length_store_tid(struct recheck_length **batch, int nbatch,
+                            DB_TXN *tid) {
+  char buffer[32];
+  struct kvp *data;
+  int n, err;
+
+  for(n = 0; n < nbatch; ++n) {
+    switch(err = trackdb_getdata(trackdb_tracksdb, batch[n]->track, &data,
+                                 tid)) {
+    case 0:
+      break;
+    case DB_NOTFOUND:
+      continue;                         /* obsoleted meanwhile */
+    default:
+      return err;
+    }
+    if(batch[n]->length > 0) {
+      byte_snprintf(buffer, sizeof buffer, "%ld", batch[n]->length);
+      trackdb_length_changed(batch[n]->track, kvp_get(data, "_length"),
+                             buffer);
+      kvp_set(&data, "_length", buffer);
+      kvp_set(&data, "_nolength", 0);
+      if(batch[n]->sig) {
+        /* remember it for any other name for the same file */
+        struct kvp *cached = 0;
+
+        kvp_set(&cached, "_length", buffer);
+        if((err = trackdb_putdata(trackdb_lengthsdb, batch[n]->sig, cached,
+                                  tid, 0)))
+          return err;
+      }
+    } else if(batch[n]->sig)
+      /* don't try again until the file changes */
+      kvp_set(&data, "_nolength", batch[n]->sig);
+    else
+      continue;
+    if((err = trackdb_putdata(trackdb_tracksdb, batch[n]->track, data, tid,
+                              0)))
+      return err;
+  }
+  /* the directory summaries are updated once for the whole batch */
+  return trackdb_dirs_flush(tid);
+}
+
+/** @brief Record a batch of computed lengths */
+static void length_store(struct recheck_state *cs,
+                         struct recheck_length **batch, int nbatch) {
+  int e, n;
+
+  WITH_TRANSACTION(length_store_tid(batch, nbatch, tid));
+  for(n = 0; n < nbatch; ++n)
+    if(batch[n]->length > 0)
+      ++cs->nlength;
+}
+
+/** @brief Compute the lengths that recheck_track() found were missing
+ *
+ * Up to @c rescan_scanners subprocesses are run at once, since plugins need
+ * not be thread-safe.  Each computes one track's length, or if the plugin has
+ * a batch interface, several.
+ */
+static void recheck_lengths(struct recheck_state *cs) {
+  struct recheck_length *waiting = cs->lengths, *l;
+  struct recheck_length *batch[LENGTH_BATCH];
+  struct length_job *running = 0, *j, **jj;
+  struct pollfd *fds;
+  int n, k, nrunning = 0, nbatch = 0;
+  long ndone = 0;
+
+  for(n = 0, l = waiting; l; l = l->next)
+    ++n;
+  progress_start("lengths", n);
+  fds = xcalloc(config->rescan_scanners, sizeof *fds);
+  while(waiting || running) {
+    if(aborted())
+      return;
+    while(waiting && nrunning < config->rescan_scanners) {
+      j = length_job(&waiting);
+      pace(j->ntracks);
+      length_start(j);
+      j->next = running;
+      running = j;
+      ++nrunning;
+    }
+    for(n = 0, j = running; j; j = j->next, ++n) {
+      fds[n].fd = j->fd;
+      fds[n].events = POLLIN;
+      fds[n].revents = 0;
+    }
+    if(poll(fds, nrunning, -1) < 0) {
+      if(errno == EINTR)
+        continue;
+      disorder_fatal(errno, "error calling poll");
+    }
+    for(n = 0, jj = &running; (j = *jj); ++n) {
+      if(fds[n].revents && length_read(j)) {
+        *jj = j->next;
+        --nrunning;
+        length_finish(j, &waiting);
+        for(k = 0; k < j->ntracks; ++k) {
+          l = j->tracks[k];
+          if(l->single && l->length < 0 && j->batched)
+            continue;                   /* to be retried */
+          batch[nbatch++] = l;
+          if(nbatch == LENGTH_BATCH) {
+            length_store(cs, batch, nbatch);
+            nbatch = 0;
+          }
+          progress_add(1, 0);
+          if(++ndone % 100 == 0 && xtime(0) > last_report + 10) {
+            disorder_info("computing track lengths, %ld so far", ndone);
+            xtime(&last_report);
+          }
+        }
+      } else
+        jj = &j->next;
+    }
+  }
+  if(nbatch)
+    length_store(cs, batch, nbatch);
+  progress_report();
+}
+
+/** @brief Measure the loudness of a track
+ * @param m Track
+ * @param fd Where to write the result
+ * @return Process exit code
+ *
+ * Called in a subprocess.  The track's decoder runs in a further subprocess,
+ * set up as for a @c --direct player (see decode_direct() in @ref
+ * server/play.c), and this one measures its output.  The result is written as
+ * a line with the loudness in hundredths of a LUFS, or nothing if it could not
+ * be measured.
+ */
+static int loudness_child(const struct recheck_loudness *m, int fd) {
+  const struct stringlist *player = m->player;
+  const struct stream_header *f = &config->sample_format;
+  const size_t framesize = 2 * f->channels;
+  char fdbuf[64], formatbuf[128], syslogbuf[64], *configbuf, result[64];
+  static int16_t buffer[8192];
+  struct loudness *l;
+  const char **argv;
+  size_t used = 0, nframes;
+  ssize_t n;
+  int p[2], argc, w;
+  pid_t pid;
+  long loudness;
+
+  xpipe(p);
+  if(!(pid = xfork())) {
+    xclose(p[0]);
+    xclose(fd);
+    argc = player->n - 2;
+    argv = (const char **)&player->s[2];
+    while(argc > 0 && argv[0][0] == '-') {
+      --argc;
+      if(!strcmp(*argv++, "--"))
+        break;
+    }
+    snprintf(fdbuf, sizeof fdbuf, "DISORDER_RAW_FD=%d", p[1]);
+    snprintf(formatbuf, sizeof formatbuf, "DISORDER_RAW_FORMAT=%d %d %d %d",
+             (int)f->rate, (int)f->bits, (int)f->channels, (int)f->endian);
+    snprintf(syslogbuf, sizeof syslogbuf, "DISORDER_RAW_SYSLOG=%d",
+             log_default == &log_syslog);
+    byte_xasprintf(&configbuf, "DISORDER_RAW_CONFIG=%s", configfile);
+    if(putenv(fdbuf) < 0
+       || putenv(formatbuf) < 0
+       || putenv(syslogbuf) < 0
+       || putenv(configbuf) < 0)
+      disorder_fatal(errno, "error calling putenv");
+    play_track(open_plugin(player->s[1], 0), argv, argc, m->path, m->track);
+    _exit(0);
+  }
+  xclose(p[1]);
+  l = xmalloc_noptr(sizeof *l);
+  loudness_init(l, f->rate, f->channels);
+  for(;;) {
+    if((n = read(p[0], (char *)buffer + used, sizeof buffer - used)) < 0) {
+      if(errno == EINTR)
+        continue;
+      disorder_fatal(errno, "error reading decoded %s", m->track);
+    }
+    if(!n)
+      break;
+    used += n;
+    nframes = used / framesize;
+    loudness_add(l, buffer, nframes, f->endian != ENDIAN_NATIVE);
+    /* keep any partial frame for next time */
+    memmove(buffer, (char *)buffer + nframes * framesize,
+            used - nframes * framesize);
+    used -= nframes * framesize;
+  }
+  xclose(p[0]);
+  while(waitpid(pid, &w, 0) < 0 && errno == EINTR)
+    ;
+  if(w) {
+    disorder_error(0, "measuring loudness of %s: decoder %s", m->track,
+                   wstat(w));
+    return 1;
+  }
+  if(loudness_result(l, &loudness))
+    return 0;                           /* silent throughout */
+  byte_snprintf(result, sizeof result, "%ld\n", loudness);
+  if(write(fd, result, strlen(result)) < 0)
+    disorder_fatal(errno, "error writing to loudness pipe");
+  return 0;
+}
+
+/** @brief Start measuring a track's loudness in a subprocess */
+static void loudness_start(struct loudness_job *j) {
+  int p[2];
+
+  D(("measuring loudness of %s", j->track->track));
+  xpipe(p);
+  if(!(j->pid = xfork())) {
+    exitfn = _exit;
+    xclose(p[0]);
+    _exit(loudness_child(j->track, p[1]));
+  }
+  xclose(p[1]);
+  j->fd = p[0];
+  dynstr_init(&j->output);
+}
+
+/** @brief Read what's available from a loudness subprocess
+ * @param j Job
+ * @return 0 if there may be more, 1 at EOF or error
+ */
+static int loudness_read(struct loudness_job *j) {
+  char buffer[64];
+  ssize_t n;
+
+  if((n = read(j->fd, buffer, sizeof buffer)) < 0) {
+    if(errno == EINTR || errno == EAGAIN)
+      return 0;
+    disorder_error(errno, "error reading from loudness pipe");
+    return 1;
+  }
+  if(n == 0)
+    return 1;
+  dynstr_append_bytes(&j->output, buffer, n);
+  return 0;
+}
+
+/** @brief Tidy up after a loudness subprocess has finished */
+static void loudness_finish(struct loudness_job *j) {
+  pid_t r;
+  int w;
+
+  xclose(j->fd);
+  while((r = waitpid(j->pid, &w, 0)) == -1 && errno == EINTR)
+    ;
+  if(r < 0) disorder_fatal(errno, "error calling waitpid");
+  if(w)
+    disorder_error(0, "measuring loudness of %s: %s", j->track->track,
+                   wstat(w));
+  dynstr_terminate(&j->output);
+  j->track->measured = (!w
+                        && sscanf(j->output.vec, "%ld",
+                                  &j->track->loudness) == 1);
+}
+
+/** @brief Record a batch of measured loudnesses */
+static int loudness_store_tid(struct recheck_loudness **batch, int nbatch,
+                              DB_TXN *tid) {
+  char buffer[32];
+  struct kvp *data;
+  int n, err;
+
+  for(n = 0; n < nbatch; ++n) {
+    switch(err = trackdb_getdata(trackdb_tracksdb, batch[n]->track, &data,
+                                 tid)) {
+    case 0:
+      break;
+    case DB_NOTFOUND:
+      continue;                         /* obsoleted meanwhile */
+    default:
+      return err;
+    }
+    if(batch[n]->measured) {
+      byte_snprintf(buffer, sizeof buffer, "%ld", batch[n]->loudness);
+      kvp_set(&data, "_loudness", buffer);
+      kvp_set(&data, "_noloudness", 0);
+    } else if(batch[n]->sig)
+      /* don't try again until the file changes */
+      kvp_set(&data, "_noloudness", batch[n]->sig);
+    else
+      continue;
+    if((err = trackdb_putdata(trackdb_tracksdb, batch[n]->track, data, tid,
+                              0)))
+      return err;
+  }
+  return 0;
+}
+
+/** @brief Record a batch of measured loudnesses */
+static void loudness_store(struct recheck_state *cs,
+                           struct recheck_loudness **batch, int nbatch) {
+  int e, n;
+
+  WITH_TRANSACTION(loudness_store_tid(batch, nbatch, tid));
+  for(n = 0; n < nbatch; ++n)
+    if(batch[n]->measured)
+      ++cs->nloudness;
+}
+
+/** @brief Measure the loudnesses that recheck_track() found were missing
+ *
+ * As for recheck_lengths(), up to @c rescan_scanners subprocesses are run at
+ * once.  Each decodes and measures a single track.
+ */
+static void recheck_loudness(struct recheck_state *cs) {
+  struct recheck_loudness *waiting = cs->loudness, *m;
+  struct recheck_loudness *batch[LENGTH_BATCH];
+  struct loudness_job *running = 0, *j, **jj;
+  struct pollfd *fds;
+  int n, nrunning = 0, nbatch = 0;
+  long ndone = 0;
+
+  for(n = 0, m = waiting; m; m = m->next)
+    ++n;
+  progress_start("loudness", n);
+  fds = xcalloc(config->rescan_scanners, sizeof *fds);
+  while(waiting || running) {
+    if(aborted())
+      return;
+    while(waiting && nrunning < config->rescan_scanners) {
+      j = xmalloc(sizeof *j);
+      j->track = waiting;
+      waiting = waiting->next;
+      pace(1);
+      loudness_start(j);
+      j->next = running;
+      running = j;
+      ++nrunning;
+    }
+    for(n = 0, j = running; j; j = j->next, ++n) {
+      fds[n].fd = j->fd;
+      fds[n].events = POLLIN;
+      fds[n].revents = 0;
+    }
+    if(poll(fds, nrunning, -1) < 0) {
+      if(errno == EINTR)
+        continue;
+      disorder_fatal(errno, "error calling poll");
+    }
+    for(n = 0, jj = &running; (j = *jj); ++n) {
+      if(fds[n].revents && loudness_read(j)) {
+        *jj = j->next;
+        --nrunning;
+        loudness_finish(j);
+        batch[nbatch++] = j->track;
+        if(nbatch == LENGTH_BATCH) {
+          loudness_store(cs, batch, nbatch);
+          nbatch = 0;
+        }
+        progress_add(1, 0);
+        if(++ndone % 100 == 0 && xtime(0) > last_report + 10) {
+          disorder_info("measuring loudness, %ld tracks so far", ndone);
+          xtime(&last_report);
+        }
+      } else
+        jj = &j->next;
+    }
+  }
+  if(nbatch)
+    loudness_store(cs, batch, nbatch);
+  progress_report();
+}
+
+/** @brief Recheck tracks
+ * @param c Collection to recheck, or NULL for all tracks
+ * @param root Directory to recheck below, or NULL for all tracks
+ */
+static void recheck_tree(const struct collection *c, const char *root) {
   struct recheck_state cs;
   const struct recheck_track *t;
   long nrc;
 
-  if(c)
-    disorder_info("rechecking %s", c->root);
+  if(root)
+    disorder_info("rechecking %s", root);
   else
     disorder_info("rechecking all tracks");
   /* Doing the checking inside a transaction locks up the server for much too
@@ -294,10 +1436,10 @@ static void recheck_collection(const struct collection *c) {
   for(;;) {
     checkabort();
     disorder_info("getting track list");
-    global_tid = trackdb_begin_transaction();
+    global_tid = trackdb_begin_read_transaction();
     memset(&cs, 0, sizeof cs);
     cs.c = c;
-    if(trackdb_scan(c ? c->root : 0, recheck_list_callback, &cs, global_tid))
+    if(trackdb_scan(root, recheck_list_callback, &cs, global_tid))
       goto fail;
     break;
   fail:
@@ -309,55 +1451,160 @@ static void recheck_collection(const struct collection *c) {
     /* Let anything else that is going on get out of the way. */
     sleep(10);
     checkabort();
-    if(c)
-      disorder_info("resuming recheck of %s", c->root);
+    if(root)
+      disorder_info("resuming recheck of %s", root);
     else
       disorder_info("resuming global recheck");
   }
   trackdb_commit_transaction(global_tid);
   global_tid = 0;
+  for(nrc = 0, t = cs.tracks; t; t = t->next)
+    ++nrc;
+  progress_start("recheck", nrc);
   nrc = 0;
   for(t = cs.tracks; t; t = t->next) {
     if(aborted())
       return;
+    pace(1);
     recheck_track(&cs, t);
+    progress_add(1, 0);
     ++nrc;
     if(nrc % 100 == 0 && xtime(0) > last_report + 10) {
-      if(c)
-        disorder_info("rechecking %s, %ld tracks so far", c->root, nrc);
+      if(root)
+        disorder_info("rechecking %s, %ld tracks so far", root, nrc);
       else
         disorder_info("rechecking all tracks, %ld tracks so far", nrc);
       xtime(&last_report);
     }
   }
-  if(c)
+  progress_report();
+  recheck_lengths(&cs);
+  if(aborted())
+    return;
+  if(cs.loudness) {
+    recheck_loudness(&cs);
+    if(aborted())
+      return;
+  }
+  if(root)
     disorder_info("rechecked %s, %ld obsoleted, %ld lengths calculated",
-                  c->root, cs.nobsolete, cs.nlength);
+                  root, cs.nobsolete, cs.nlength);
   else
     disorder_info("rechecked all tracks, %ld no collection, %ld obsoleted, %ld lengths calculated",
          cs.nnocollection, cs.nobsolete, cs.nlength);
+  if(cs.nloudness)
+    disorder_info("measured the loudness of %ld tracks", cs.nloudness);
 }
 
-/* rescan/recheck a collection by name */
-static void do_directory(const char *s,
-			 void (*fn)(const struct collection *c)) {
+/* recheck a collection */
+static void recheck_collection(const struct collection *c) {
+  recheck_tree(c, c->root);
+}
+
+/* find a collection by name */
+static const struct collection *find_collection(const char *s) {
   int n;
   
   for(n = 0; (n < config->collection.n
 	      && strcmp(config->collection.s[n].root, s)); ++n)
     ;
   if(n < config->collection.n)
-    fn(&config->collection.s[n]);
-  else
-    disorder_error(0, "no collection has root '%s'", s);
+    return &config->collection.s[n];
+  disorder_error(0, "no collection has root '%s'", s);
+  return 0;
 }
 
-/* rescan/recheck all collections */
-static void do_all(void (*fn)(const struct collection *c)) {
+/* recheck a collection by name */
+static void do_directory(const char *s,
+			 void (*fn)(const struct collection *c)) {
+  const struct collection *c;
+
+  if((c = find_collection(s)))
+    fn(c);
+}
+
+/* find the collection containing a directory */
+static const struct collection *find_dir_collection(const char *dir) {
+  const char *root;
+  size_t l;
+  int n;
+
+  for(n = 0; n < config->collection.n; ++n) {
+    root = config->collection.s[n].root;
+    l = strlen(root);
+    if(!strncmp(dir, root, l) && (dir[l] == 0 || dir[l] == '/'))
+      return &config->collection.s[n];
+  }
+  return 0;
+}
+
+/** @brief Rescan the directories listed in a file
+ * @param path File listing directories, one per line
+ * @param do_check Whether to recheck tracks below them too
+ *
+ * The server uses this when it knows which directories have changed since
+ * the last rescan.
+ */
+static void rescan_dirty(const char *path, int do_check) {
+  struct scanner *waiting = 0, **tail = &waiting, *s;
+  struct rescan_state **rss;
+  const struct collection **cs;
+  struct vector dirs;
+  struct stat sb;
+  char *dir, *root;
+  FILE *fp;
+  int n, i;
+
+  if(!(fp = fopen(path, "r")))
+    disorder_fatal(errno, "error opening %s", path);
+  vector_init(&dirs);
+  while(!inputline(path, fp, &dir, '\n'))
+    vector_append(&dirs, dir);
+  if(ferror(fp))
+    disorder_fatal(0, "cannot read %s", path);
+  fclose(fp);
+  checkabort();
+  cs = xcalloc(dirs.nvec, sizeof *cs);
+  rss = xcalloc(config->collection.n, sizeof *rss);
+  for(n = 0; n < dirs.nvec; ++n) {
+    if(!(cs[n] = find_dir_collection(dirs.vec[n]))) {
+      D(("%s is not in any collection", dirs.vec[n]));
+      continue;
+    }
+    /* Directories that have gone away only need rechecking */
+    if(stat(dirs.vec[n], &sb) < 0 || !S_ISDIR(sb.st_mode))
+      continue;
+    i = cs[n] - config->collection.s;
+    if(!rss[i]) {
+      rss[i] = xmalloc(sizeof *rss[i]);
+      rss[i]->c = cs[n];
+    }
+    s = xmalloc(sizeof *s);
+    s->rs = rss[i];
+    s->path = dirs.vec[n];
+    *tail = s;
+    tail = &s->next;
+    ++rss[i]->unfinished;
+    disorder_info("rescanning %s with %s", s->path, cs[n]->module);
+  }
+  progress_start("scan", 0);
+  rescan_run(waiting);
+  progress_report();
+  if(do_check)
+    for(n = 0; n < dirs.nvec; ++n)
+      if(cs[n] && (root = path_track(cs[n], dirs.vec[n])))
+        recheck_tree(cs[n], root);
+}
+
+/* rescan all collections */
+static void do_all(void) {
+  const struct collection **cs;
   int n;
 
+  cs = xcalloc(config->collection.n, sizeof *cs);
   for(n = 0; n < config->collection.n; ++n)
-    fn(&config->collection.s[n]);
+    cs[n] = &config->collection.s[n];
+  rescan_collections(cs, config->collection.n);
   /* TODO: we need to tidy up tracks from collections now removed.  We could do
    * this two ways: either remember collections we think there are and spot
    * their disappearance, or iterate over all tracks and gc any that don't fit
@@ -377,14 +1624,21 @@ static void expire_noticed(void) {
 }
 
 int main(int argc, char **argv) {
-  int n, logsyslog = !isatty(2);
+  int n, ncs, logsyslog = !isatty(2);
   struct sigaction sa;
   int do_check = 1;
+  const struct collection **cs;
+  const char *dirty = 0;
   
   set_progname(argv);
   mem_init();
+  /* The server may ask us to back off as soon as we exist */
+  sa.sa_handler = backoff_handler;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  xsigaction(SIGUSR1, &sa, 0);
   if(!setlocale(LC_CTYPE, "")) disorder_fatal(errno, "error calling setlocale");
-  while((n = getopt_long(argc, argv, "hVc:dDSsKC", options, 0)) >= 0) {
+  while((n = getopt_long(argc, argv, "hVc:dDSsKCF:", options, 0)) >= 0) {
     switch(n) {
     case 'h': help();
     case 'V': version("disorder-rescan");
@@ -395,6 +1649,8 @@ int main(int argc, char **argv) {
     case 's': logsyslog = 1; break;
     case 'K': do_check = 1; break;
     case 'C': do_check = 0; break;
+    case 'F': dirty = optarg; break;
+    case 'P': report_progress = 1; break;
     default: disorder_fatal(0, "invalid option");
     }
   }
@@ -404,7 +1660,15 @@ int main(int argc, char **argv) {
   }
   config_per_user = 0;
   if(config_read(0, NULL)) disorder_fatal(0, "cannot read configuration");
+  patterns_compile(&players, &config->player);
+  patterns_compile(&lengthers, &config->tracklength);
+  if(config->loudness_analysis && config->sample_format.bits != 16) {
+    disorder_error(0, "loudness_analysis needs 16-bit samples");
+    config->loudness_analysis = 0;
+  }
   xnice(config->nice_rescan);
+  if(config->rescan_idle_io)
+    idle_io();
   sa.sa_handler = signal_handler;
   sa.sa_flags = SA_RESTART;
   sigemptyset(&sa.sa_mask);
@@ -413,19 +1677,26 @@ int main(int argc, char **argv) {
   disorder_info("started");
   trackdb_init(TRACKDB_NO_RECOVER);
   trackdb_open(TRACKDB_NO_UPGRADE);
-  if(optind == argc) {
+  if(dirty) {
+    /* Rescan just the directories that have changed */
+    rescan_dirty(dirty, do_check);
+    expire_noticed();
+  } else if(optind == argc) {
     /* Rescan all collections */
-    do_all(rescan_collection);
+    do_all();
     /* Check that every track still exists */
     if(do_check)
-      recheck_collection(0);
+      recheck_tree(0, 0);
     /* Expire noticed.db */
     expire_noticed();
   }
   else {
     /* Rescan specified collections */
-    for(n = optind; n < argc; ++n)
-      do_directory(argv[n], rescan_collection);
+    cs = xcalloc(argc - optind, sizeof *cs);
+    for(n = optind, ncs = 0; n < argc; ++n)
+      if((cs[ncs] = find_collection(argv[n])))
+        ++ncs;
+    rescan_collections(cs, ncs);
     /* Check specified collections for tracks that have gone */
     if(do_check)
       for(n = optind; n < argc; ++n)
@@ -30,6 +30,8 @@
  * - @b key: for @c action=set-global, the global pref to set
  * - @b value: for @c action=set-global, the value to set (omit to unset)
  * - @b priority: the importance of this action
+ * - @b zone: the zone that performs this action (absent for a server that
+ *   isn't a zone)
  * - @b recurs: how the event recurs; NOT IMPLEMENTED
  * - ...others to be defined
  *
@@ -44,10 +46,16 @@
  *   immediately.  (This the default.)
  * - ...others to be defined
  *
- * On startup the schedule database is read and a timeout set on the event loop
- * for each action.  Similarly when an action is added, a timeout is set on the
- * event loop.  The timeout has the ID attached as user data so that the action
- * can easily be found again.
+ * On startup the schedule database is read into memory, and pending actions
+ * are kept in a heap ordered by time.  Only the earliest has a timeout set on
+ * the event loop.  When it fires, every action that is due is performed and
+ * then they are all deleted from the database in a single transaction.
+ *
+ * An action deleted before it is due is dropped from @ref schedule_index at
+ * once but only leaves the heap when it reaches the top.
+ *
+ * Zones share the schedule database with the library's server, so each
+ * server ignores actions that belong to another zone (see schedule_ours()).
  *
  * Recurring events are NOT IMPLEMENTED yet but this is the proposed
  * interface:
@@ -80,6 +88,7 @@
  * TODO: add disorder-dump support
  */
 #include "disorder-server.h"
+#include "heap.h"
 
 static int schedule_trigger(ev_source *ev,
 			    const struct timeval *now,
@@ -87,6 +96,107 @@ static int schedule_trigger(ev_source *ev,
 static int schedule_lookup(const char *id,
 			   struct kvp *actiondata);
 
+/** @brief A pending scheduled event */
+struct scheduled {
+  /** @brief Event ID */
+  const char *id;
+
+  /** @brief When the event is due */
+  time_t when;
+
+  /** @brief Order in which the event was loaded or added */
+  unsigned long serial;
+
+  /** @brief Event data */
+  struct kvp *actiondata;
+
+  /** @brief Set if the event has been deleted */
+  int deleted;
+};
+
+/** @brief Order events by time, and otherwise by when they were added */
+static inline int scheduled_lt(const struct scheduled *a,
+                               const struct scheduled *b) {
+  if(a->when != b->when)
+    return a->when < b->when;
+  return a->serial < b->serial;
+}
+
+HEAP_TYPE(schedule_heap, struct scheduled *, scheduled_lt);
+HEAP_DEFINE(schedule_heap, struct scheduled *, scheduled_lt);
+
+/** @brief Pending events in order */
+static struct schedule_heap schedule_pending;
+
+/** @brief Mapping from event IDs to <tt>struct scheduled *</tt> */
+static hash *schedule_index;
+
+/** @brief Next value for @ref scheduled::serial */
+static unsigned long schedule_serial;
+
+/** @brief Timeout for the earliest event */
+static ev_timeout_handle schedule_timeout;
+
+/** @brief Time @ref schedule_timeout is set for, or -1 if it is not set */
+static time_t schedule_armed = -1;
+
+/** @brief Return the schedule database, opening it if necessary */
+static DB *schedule_db(void) {
+  return trackdb_lazy(&trackdb_scheduledb);
+}
+
+/** @brief Test whether an event belongs to this server
+ * @param actiondata Event data
+ * @return Nonzero if this server should perform it
+ */
+static int schedule_ours(const struct kvp *actiondata) {
+  const char *zone = kvp_get(actiondata, "zone");
+
+  if(!zone)
+    return !config->zone;
+  return config->zone && !strcmp(zone, config->zone);
+}
+
+/** @brief Add an event to the in-memory schedule */
+static void schedule_insert(const char *id, time_t when,
+                            struct kvp *actiondata) {
+  struct scheduled *s = xmalloc(sizeof *s);
+
+  s->id = id;
+  s->when = when;
+  s->serial = schedule_serial++;
+  s->actiondata = actiondata;
+  hash_add(schedule_index, id, &s, HASH_INSERT_OR_REPLACE);
+  schedule_heap_insert(&schedule_pending, s);
+}
+
+/** @brief Make sure the timeout is set for the earliest event
+ * @param ev Event loop
+ */
+static void schedule_arm(ev_source *ev) {
+  struct scheduled *s;
+  struct timeval when;
+
+  /* Deleted events are discarded when they get to the top */
+  while(schedule_heap_count(&schedule_pending)
+        && schedule_heap_first(&schedule_pending)->deleted)
+    schedule_heap_remove(&schedule_pending);
+  s = (schedule_heap_count(&schedule_pending)
+       ? schedule_heap_first(&schedule_pending) : 0);
+  if(s && s->when == schedule_armed)
+    return;
+  if(schedule_armed != -1) {
+    ev_timeout_cancel(ev, schedule_timeout);
+    schedule_armed = -1;
+  }
+  if(s) {
+    when.tv_sec = s->when;
+    when.tv_usec = 0;
+    ev_timeout(ev, &schedule_timeout, &when, schedule_trigger, 0);
+    schedule_armed = s->when;
+  }
+}
+
 /** @brief List of required fields in a scheduled event */
 static const char *const schedule_required[] = {"when", "who", "action"};
 
@@ -119,7 +229,7 @@ static int schedule_parse(const DBT *k,
     return -1;
   }
   id = xstrndup(k->data, k->size);
-  actiondata = kvp_urldecode(d->data, d->size);
+  actiondata = decode_data(d);
   /* Reject items without the required fields */
   for(n = 0; n < NREQUIRED; ++n) {
     if(!kvp_get(actiondata, schedule_required[n])) {
@@ -159,16 +269,18 @@ static int cdel(DBC *cursor) {
  * @param ev Event loop
  * @param tid Transaction ID
  *
- * Sets a callback for all action times except for junk actions that are
- * already in the past, which are discarded.
+ * Loads all actions except for junk actions that are already in the past,
+ * which are discarded.
  */
-static int schedule_init_tid(ev_source *ev,
-			     DB_TXN *tid) {
+static int schedule_init_tid(DB_TXN *tid) {
   DBC *cursor;
   DBT k, d;
   int err;
 
-  cursor = trackdb_opencursor(trackdb_scheduledb, tid);
+  /* Start again from scratch if we are retrying after a deadlock */
+  schedule_index = hash_new(sizeof (struct scheduled *));
+  schedule_heap_init(&schedule_pending);
+  cursor = trackdb_opencursor(schedule_db(), tid);
   while(!(err = cursor->c_get(cursor, prepare_data(&k),  prepare_data(&d),
                               DB_NEXT))) {
     struct timeval when;
@@ -181,6 +293,9 @@ static int schedule_init_tid(ev_source *ev,
 	goto deadlocked;
       continue;
     }
+    /* Leave other zones' actions alone */
+    if(!schedule_ours(actiondata))
+      continue;
     when.tv_usec = 0;
     /* The action might be in the past */
     if(when.tv_sec < xtime(0)) {
@@ -196,8 +311,7 @@ static int schedule_init_tid(ev_source *ev,
         continue;
       }
     }
-    /* Arrange a callback when the scheduled event is due */
-    ev_timeout(ev, 0/*handlep*/, &when, schedule_trigger, id);
+    schedule_insert(id, when.tv_sec, actiondata);
   }
   switch(err) {
   case DB_NOTFOUND:
@@ -218,12 +332,14 @@ deadlocked:
 /** @brief Initialize the schedule
  * @param ev Event loop
  *
- * Sets a callback for all action times except for junk actions that are
- * already in the past, which are discarded.
+ * Sets a callback for the first action time.  Junk actions that are already in
+ * the past are discarded.
  */
 void schedule_init(ev_source *ev) {
   int e;
-  WITH_TRANSACTION(schedule_init_tid(ev, tid));
+
+  WITH_TRANSACTION(schedule_init_tid(tid));
+  schedule_arm(ev);
 }
 
 /******************************************************************************/
@@ -238,13 +354,14 @@ static int schedule_add_tid(const char *id,
 			    DB_TXN *tid) {
   int err;
   DBT k, d;
+  DB *const db = schedule_db();
 
   memset(&k, 0, sizeof k);
   k.data = (void *)id;
   k.size = strlen(id);
-  switch(err = trackdb_scheduledb->put(trackdb_scheduledb, tid, &k,
-                                       encode_data(&d, actiondata),
-				       DB_NOOVERWRITE)) {
+  switch(err = db->put(db, tid, &k,
+                       encode_data(&d, actiondata),
+                       DB_NOOVERWRITE)) {
   case 0:
     break;
   case DB_LOCK_DEADLOCK:
@@ -282,6 +399,9 @@ const char *schedule_add(ev_source *ev,
       return 0;
     }
   }
+  /* It's for this server to perform */
+  if(config->zone)
+    kvp_set(&actiondata, "zone", config->zone);
   /* Check that the user is allowed to do whatever it is */
   if(schedule_lookup("[new]", actiondata) < 0)
     return 0;
@@ -296,7 +416,8 @@ const char *schedule_add(ev_source *ev,
     id = random_id();
     WITH_TRANSACTION(schedule_add_tid(id, actiondata, tid));
   } while(e == DB_KEYEXIST);
-  ev_timeout(ev, 0/*handlep*/, &when, schedule_trigger, (void *)id);
+  schedule_insert(id, when.tv_sec, actiondata);
+  schedule_arm(ev);
   return id;
 }
 
@@ -307,19 +428,10 @@ const char *schedule_add(ev_source *ev,
  * @return Event data or NULL
  */
 struct kvp *schedule_get(const char *id) {
-  int e, n;
-  struct kvp *actiondata;
-  
-  WITH_TRANSACTION(trackdb_getdata(trackdb_scheduledb, id, &actiondata, tid));
-  /* Check that the required field are present */
-  for(n = 0; n < NREQUIRED; ++n) {
-    if(!kvp_get(actiondata, schedule_required[n])) {
-      disorder_error(0, "scheduled event %s is missing required field '%s'",
-                     id, schedule_required[n]);
-      return 0;
-    }
-  }
-  return actiondata;
+  struct scheduled **sp = hash_find(schedule_index, id);
+
+  /* Everything in the index has the required fields */
+  return sp ? (*sp)->actiondata : 0;
 }
 
 /******************************************************************************/
@@ -329,9 +441,14 @@ struct kvp *schedule_get(const char *id) {
  * @return 0 on success, non-0 if it did not exist
  */
 int schedule_del(const char *id) {
+  struct scheduled **sp = hash_find(schedule_index, id);
   int e;
 
-  WITH_TRANSACTION(trackdb_delkey(trackdb_scheduledb, id, tid));
+  if(!sp)
+    return -1;
+  (*sp)->deleted = 1;
+  hash_remove(schedule_index, id);
+  WITH_TRANSACTION(trackdb_delkey(schedule_db(), id, tid));
   return e == 0 ? 0 : -1;
 }
 
@@ -342,14 +459,9 @@ int schedule_del(const char *id) {
  * @return 0-terminate list of ID strings
  */
 char **schedule_list(int *neventsp) {
-  int e;
-  struct vector v[1];
-
-  vector_init(v);
-  WITH_TRANSACTION(trackdb_listkeys(trackdb_scheduledb, v, tid));
   if(neventsp)
-    *neventsp = v->nvec;
-  return v->vec;
+    *neventsp = hash_count(schedule_index);
+  return hash_keys(schedule_index);
 }
 
 /******************************************************************************/
@@ -468,26 +580,58 @@ static int schedule_lookup(const char *id,
   return n;
 }
 
-/** @brief Called when an action is due */
-static int schedule_trigger(ev_source *ev,
-			    const struct timeval attribute((unused)) *now,
-			    void *u) {
-  const char *id = u;
-  struct kvp *actiondata = schedule_get(id);
-  int n;
+/** @brief Delete events that have been performed
+ * @param done Events to delete
+ * @param ndone Number of events
+ * @param tid Transaction ID
+ * @return 0 or @c DB_LOCK_DEADLOCK
+ */
+static int schedule_expire_tid(struct scheduled **done, int ndone,
+                               DB_TXN *tid) {
+  int n, err;
 
-  if(!actiondata)
-    return 0;
-  /* Look up the action */
-  n = schedule_lookup(id, actiondata);
-  if(n < 0)
-    goto done;
-  /* Go ahead and do it */
-  schedule_actions[n].callback(ev, id, kvp_get(actiondata, "who"), actiondata);
-done:
+  for(n = 0; n < ndone; ++n)
+    if((err = trackdb_delkey(schedule_db(), done[n]->id, tid)))
+      return err;
+  return 0;
+}
+
+/** @brief Called when the earliest action is due
+ *
+ * Performs every action that is due, then deletes them all from the
+ * database.
+ */
+static int schedule_trigger(ev_source *ev,
+			    const struct timeval *now,
+			    void attribute((unused)) *u) {
+  struct scheduled *s, **done = 0;
+  int n, ndone = 0, nslots = 0, e;
+
+  schedule_armed = -1;
+  while(schedule_heap_count(&schedule_pending)
+        && schedule_heap_first(&schedule_pending)->when <= now->tv_sec) {
+    s = schedule_heap_remove(&schedule_pending);
+    if(s->deleted)
+      continue;
+    hash_remove(schedule_index, s->id);
+    if(ndone == nslots) {
+      nslots = nslots ? 2 * nslots : 16;
+      done = xrealloc(done, nslots * sizeof *done);
+    }
+    done[ndone++] = s;
+    /* Look up the action */
+    n = schedule_lookup(s->id, s->actiondata);
+    if(n < 0)
+      continue;
+    /* Go ahead and do it */
+    schedule_actions[n].callback(ev, s->id, kvp_get(s->actiondata, "who"),
+                                 s->actiondata);
+  }
   /* TODO: rewrite recurring events for their next trigger time,
    * rather than deleting them */
-  schedule_del(id);
+  if(ndone)
+    WITH_TRANSACTION(schedule_expire_tid(done, ndone, tid));
+  schedule_arm(ev);
   return 0;
 }
 
@@ -38,6 +38,12 @@ long pcount;
 void queue_fix_sofar(struct queue_entry *q) {
   long sofar;
   
+  /* The speaker process knows how far through raw-format tracks are */
+  if(q == playing
+     && (q->type & DISORDER_PLAYER_TYPEMASK) == DISORDER_PLAYER_RAW) {
+    speaker_refresh();
+    return;
+  }
   /* Fake up SOFAR field for currently-playing tracks that don't have it filled
    * in by the speaker process.  XXX this horrible bodge should go away when we
    * have a more general implementation of pausing as that field will always
@@ -59,15 +65,252 @@ void queue_fix_sofar(struct queue_entry *q) {
   }
 }
 
+/* Queue persistence.
+ *
+ * Each list is saved as a snapshot file (e.g. "queue") plus a journal
+ * ("queue.journal").  The snapshot is a version line followed by one
+ * marshalled entry per line.  The journal's first line names the snapshot
+ * it extends; after that it consists of batches of records, each terminated
+ * by a line containing just ".":
+ *
+ *   set ENTRY              - add or replace the entry with ENTRY's ID
+ *   order ID ID ...        - the list now consists of exactly these IDs
+ *
+ * A batch missing its terminator (e.g. because the server died while writing
+ * it) is ignored.  When the journal gets large compared to the snapshot, both
+ * are rewritten from scratch.
+ */
+
+/** @brief Minimum journal size before compaction */
+#define JOURNAL_MIN 65536
+
+/** @brief How much bigger than the snapshot the journal may get */
+#define JOURNAL_RATIO 4
+
+/** @brief Saved state of a list */
+struct queue_journal {
+  /** @brief Head of list */
+  struct queue_entry *head;
+
+  /** @brief Snapshot filename (under the state directory) */
+  const char *name;
+
+  /** @brief Snapshot serial number */
+  unsigned long serial;
+
+  /** @brief Nonzero if the journal matches the snapshot and can be extended */
+  int ready;
+
+  /** @brief Size of snapshot in bytes */
+  long snapshot_size;
+
+  /** @brief Size of journal in bytes */
+  long journal_size;
+
+  /** @brief Marshalled entries as last saved, keyed by ID */
+  hash *saved;
+
+  /** @brief IDs in saved order */
+  struct vector order;
+};
+
+static struct queue_journal queue_journal = { .head = &qhead, .name = "queue" };
+static struct queue_journal recent_journal = { .head = &phead, .name = "recent" };
+
+VECTOR_TYPE(entry_vector, struct queue_entry *, xrealloc);
+
+/* Queue indexes.
+ *
+ * @ref queue_ids maps IDs to entries in @ref qhead, and @ref queue_tracks maps
+ * track names to vectors of entries.  queue_inserted() and queue_remove() keep
+ * them up to date; queue_read() builds them from scratch.
+ */
+
+/** @brief Queue entries by ID */
+static hash *queue_ids;
+
+/** @brief Queue entries by track name */
+static hash *queue_tracks;
+
+static void queue_index_build(void);
+
+
+/** @brief Add @p q to the queue indexes */
+void queue_index_add(struct queue_entry *q) {
+  struct entry_vector **vp, *v;
+
+  if(!queue_ids) {
+    /* q is already on the queue */
+    queue_index_build();
+    return;
+  }
+  hash_add(queue_ids, q->id, &q, HASH_INSERT_OR_REPLACE);
+  if(!(vp = hash_find(queue_tracks, q->track))) {
+    v = xmalloc(sizeof *v);
+    entry_vector_init(v);
+    hash_add(queue_tracks, q->track, &v, HASH_INSERT);
+  } else
+    v = *vp;
+  entry_vector_append(v, q);
+}
+
+/** @brief Remove @p q from the queue indexes */
+void queue_index_remove(struct queue_entry *q) {
+  struct entry_vector **vp, *v;
+  int n;
+
+  if(!queue_ids) {
+    /* q has already left the queue */
+    queue_index_build();
+    return;
+  }
+  hash_remove(queue_ids, q->id);
+  if(!(vp = hash_find(queue_tracks, q->track)))
+    return;
+  v = *vp;
+  for(n = 0; n < v->nvec && v->vec[n] != q; ++n)
+    ;
+  if(n < v->nvec)
+    v->vec[n] = v->vec[--v->nvec];
+  if(!v->nvec)
+    hash_remove(queue_tracks, q->track);
+}
+
+static void queue_index_build(void) {
+  struct queue_entry *q;
+
+  queue_ids = hash_new(sizeof (struct queue_entry *));
+  queue_tracks = hash_new(sizeof (struct entry_vector *));
+  for(q = qhead.next; q != &qhead; q = q->next)
+    queue_index_add(q);
+}
+
 static void queue_read_error(const char *msg,
 			     void *u) {
   disorder_fatal(0, "error parsing queue %s: %s", (const char *)u, msg);
 }
 
-static void queue_do_read(struct queue_entry *head, const char *path) {
-  char *buffer;
-  FILE *fp;
+/** @brief Read a marshalled entry from @p path */
+static struct queue_entry *queue_read_entry(const struct queue_journal *j,
+                                            const char *path,
+                                            const char *line) {
+  struct queue_entry *q = xmalloc(sizeof *q);
+
+  queue_unmarshall(q, line, queue_read_error, (void *)path);
+  if(j->head == &qhead
+     && (!q->track
+         || !q->when))
+    disorder_fatal(0, "incomplete queue entry in %s", path);
+  return q;
+}
+
+/** @brief Record the current contents of @p j's list as saved */
+static void queue_saved(struct queue_journal *j) {
   struct queue_entry *q;
+  char *m;
+
+  j->saved = hash_new(sizeof (char *));
+  vector_init(&j->order);
+  for(q = j->head->next; q != j->head; q = q->next) {
+    m = queue_marshall(q);
+    hash_add(j->saved, q->id, &m, HASH_INSERT_OR_REPLACE);
+    vector_append(&j->order, xstrdup(q->id));
+  }
+}
+
+/** @brief Apply a completed journal batch */
+static void queue_apply_batch(struct queue_journal *j, const char *path,
+                              struct entry_vector *sets,
+                              char **order, int norder) {
+  struct queue_entry *head = j->head, *q, **qq;
+  hash *entries = hash_new(sizeof (struct queue_entry *));
+  int n;
+
+  for(q = head->next; q != head; q = q->next)
+    hash_add(entries, q->id, &q, HASH_INSERT);
+  for(n = 0; n < sets->nvec; ++n) {
+    q = sets->vec[n];
+    if((qq = hash_find(entries, q->id))) {
+      /* Replace the existing entry in place */
+      queue_insert_entry((*qq)->prev, q);
+      queue_delete_entry(*qq);
+      *qq = q;
+    } else {
+      queue_insert_entry(head->prev, q);
+      hash_add(entries, q->id, &q, HASH_INSERT);
+    }
+  }
+  if(order) {
+    head->next = head->prev = head;
+    for(n = 0; n < norder; ++n) {
+      if(!(qq = hash_find(entries, order[n])))
+        disorder_fatal(0, "%s: unknown queue ID %s", path, order[n]);
+      queue_insert_entry(head->prev, *qq);
+    }
+  }
+  sets->nvec = 0;
+}
+
+/** @brief Replay the journal for @p j over the snapshot already read
+ *
+ * A batch with no closing "." was torn by a crash and is ignored.  Its bytes
+ * are still in the file, and appending after them would glue them onto the
+ * next batch, so in that case @p j is left not ready and the next write
+ * compacts instead.  Nothing is written here since disorder-choose reads the
+ * queue too.
+ */
+static void queue_read_journal(struct queue_journal *j, const char *path) {
+  char *buffer, **order = 0;
+  FILE *fp;
+  int norder = 0;
+  long committed;
+  struct entry_vector sets;
+
+  if(!(fp = fopen(path, "r"))) {
+    if(errno == ENOENT)
+      return;
+    disorder_fatal(errno, "error opening %s", path);
+  }
+  if(inputline(path, fp, &buffer, '\n')
+     || strncmp(buffer, "journal ", 8)
+     || strtoul(buffer + 8, 0, 10) != j->serial) {
+    /* Left over from before the last compaction */
+    fclose(fp);
+    return;
+  }
+  entry_vector_init(&sets);
+  committed = ftell(fp);
+  while(!inputline(path, fp, &buffer, '\n')) {
+    if(!strcmp(buffer, ".")) {
+      queue_apply_batch(j, path, &sets, order, norder);
+      order = 0;
+      committed = ftell(fp);
+    } else if(!strncmp(buffer, "set ", 4))
+      entry_vector_append(&sets, queue_read_entry(j, path, buffer + 4));
+    else if(!strncmp(buffer, "order", 5)
+            && (buffer[5] == ' ' || !buffer[5])) {
+      if(!(order = split(buffer + 5, &norder, 0, queue_read_error,
+                         (void *)path)))
+        disorder_fatal(0, "%s: malformed order record", path);
+    } else
+      disorder_fatal(0, "%s: unknown journal record", path);
+  }
+  if(ferror(fp))
+    disorder_fatal(errno, "error reading %s", path);
+  j->journal_size = ftell(fp);
+  fclose(fp);
+  if(j->journal_size != committed) {
+    disorder_info("%s: ignoring incomplete final batch", path);
+    return;
+  }
+  j->ready = 1;
+}
+
+static void queue_do_read(struct queue_journal *j) {
+  const char *path = config_get_file(j->name);
+  char *buffer, *journal;
+  FILE *fp;
+  struct queue_entry *q, *head = j->head;
   int ver = 0;
 
   if(!(fp = fopen(path, "r"))) {
@@ -78,12 +321,13 @@ static void queue_do_read(struct queue_entry *head, const char *path) {
   head->next = head->prev = head;
   while(!inputline(path, fp, &buffer, '\n')) {
     if(buffer[0] == '#') {
-      /* Version indicator */
+      /* Version indicator, optionally followed by a serial number */
       ver = atoi(buffer + 1);
+      if(strchr(buffer, ' '))
+        j->serial = strtoul(strchr(buffer, ' ') + 1, 0, 10);
       continue;
     }
-    q = xmalloc(sizeof *q);
-    queue_unmarshall(q, buffer, queue_read_error, (void *)path);
+    q = queue_read_entry(j, path, buffer);
     if(ver < 1) {
       /* Fix up origin field as best we can; will be wrong in some cases but
        * hopefully not too horribly so. */
@@ -102,25 +346,31 @@ static void queue_do_read(struct queue_entry *head, const char *path) {
         break;
       }
     }
-    if(head == &qhead
-       && (!q->track
-	   || !q->when))
-      disorder_fatal(0, "incomplete queue entry in %s", path);
     queue_insert_entry(head->prev, q);
   }
   if(ferror(fp))
     disorder_fatal(errno, "error reading %s", path);
+  j->snapshot_size = ftell(fp);
   fclose(fp);
+  if(ver >= 1) {
+    byte_xasprintf(&journal, "%s.journal", path);
+    queue_read_journal(j, journal);
+  }
+  queue_saved(j);
 }
 
 void queue_read(void) {
-  queue_do_read(&qhead, config_get_file("queue"));
+  queue_do_read(&queue_journal);
+  queue_index_build();
+  /* Start counting generations somewhere a client from a previous run is
+   * unlikely to have got to */
+  queue_generation = (unsigned long)xtime(0) << 8;
 }
 
 void recent_read(void) {
   struct queue_entry *q;
 
-  queue_do_read(&phead, config_get_file("recent"));
+  queue_do_read(&recent_journal);
   /* reset pcount after loading */
   pcount = 0;
   q = phead.next;
@@ -130,36 +380,125 @@ void recent_read(void) {
   }
 }
 
-static void queue_do_write(const struct queue_entry *head, const char *path) {
-  char *tmp;
+/** @brief Rewrite the snapshot for @p j and start a new journal */
+static void queue_compact(struct queue_journal *j) {
+  const char *path = config_get_file(j->name);
+  char *tmp, *journal;
   FILE *fp;
   struct queue_entry *q;
 
+  ++j->serial;
   byte_xasprintf(&tmp, "%s.new", path);
   if(!(fp = fopen(tmp, "w"))) disorder_fatal(errno, "error opening %s", tmp);
-  /* Save version indicator */
-  if(fprintf(fp, "#1\n") < 0)
+  /* Save version indicator and serial number */
+  if(fprintf(fp, "#1 %lu\n", j->serial) < 0)
     disorder_fatal(errno, "error writing %s", tmp);
-  for(q = head->next; q != head; q = q->next)
+  for(q = j->head->next; q != j->head; q = q->next)
     if(fprintf(fp, "%s\n", queue_marshall(q)) < 0)
       disorder_fatal(errno, "error writing %s", tmp);
+  j->snapshot_size = ftell(fp);
   if(fclose(fp) < 0) disorder_fatal(errno, "error closing %s", tmp);
   if(rename(tmp, path) < 0) disorder_fatal(errno, "error replacing %s", path);
+  /* The old journal no longer matches the snapshot, so it's harmless if we
+   * die before replacing it */
+  byte_xasprintf(&journal, "%s.journal", path);
+  if(!(fp = fopen(journal, "w")))
+    disorder_fatal(errno, "error opening %s", journal);
+  if(fprintf(fp, "journal %lu\n", j->serial) < 0)
+    disorder_fatal(errno, "error writing %s", journal);
+  j->journal_size = ftell(fp);
+  if(fclose(fp) < 0) disorder_fatal(errno, "error closing %s", journal);
+  j->ready = 1;
+  queue_saved(j);
+}
+
+/** @brief Save changes to @p j's list */
+static void queue_do_write(struct queue_journal *j) {
+  char *journal, *m, **old;
+  FILE *fp;
+  struct queue_entry *q;
+  struct dynstr d[1];
+  hash *saved;
+  struct vector order;
+  int reordered = 0, n;
+
+  if(!j->ready) {
+    queue_compact(j);
+    return;
+  }
+  /* Find new and modified entries, and whether the order has changed */
+  dynstr_init(d);
+  saved = hash_new(sizeof (char *));
+  vector_init(&order);
+  for(q = j->head->next; q != j->head; q = q->next) {
+    m = queue_marshall(q);
+    old = hash_find(j->saved, q->id);
+    if(!old || strcmp(*old, m)) {
+      dynstr_append_string(d, "set ");
+      dynstr_append_string(d, m);
+      dynstr_append(d, '\n');
+    }
+    hash_add(saved, q->id, &m, HASH_INSERT_OR_REPLACE);
+    if(order.nvec >= j->order.nvec || strcmp(j->order.vec[order.nvec], q->id))
+      reordered = 1;
+    vector_append(&order, xstrdup(q->id));
+  }
+  if(order.nvec != j->order.nvec)
+    reordered = 1;
+  if(reordered) {
+    dynstr_append_string(d, "order");
+    for(n = 0; n < order.nvec; ++n) {
+      dynstr_append(d, ' ');
+      dynstr_append_string(d, order.vec[n]);
+    }
+    dynstr_append(d, '\n');
+  }
+  if(!d->nvec)
+    return;                             /* nothing changed */
+  dynstr_append_string(d, ".\n");
+  if(j->journal_size + d->nvec > JOURNAL_MIN
+     && j->journal_size + d->nvec > JOURNAL_RATIO * j->snapshot_size) {
+    queue_compact(j);
+    return;
+  }
+  byte_xasprintf(&journal, "%s.journal", config_get_file(j->name));
+  if(!(fp = fopen(journal, "a")))
+    disorder_fatal(errno, "error opening %s", journal);
+  if(fwrite(d->vec, 1, d->nvec, fp) != (size_t)d->nvec)
+    disorder_fatal(errno, "error writing %s", journal);
+  if(fclose(fp) < 0) disorder_fatal(errno, "error closing %s", journal);
+  j->journal_size += d->nvec;
+  j->saved = saved;
+  j->order = order;
 }
 
 void queue_write(void) {
-  queue_do_write(&qhead, config_get_file("queue"));
+  queue_do_write(&queue_journal);
 }
 
 void recent_write(void) {
-  queue_do_write(&phead, config_get_file("recent"));
+  queue_do_write(&recent_journal);
+}
+
+struct queue_entry *queue_find_id(const char *id) {
+  struct queue_entry **qq;
+
+  if(!queue_ids)
+    queue_index_build();
+  return (qq = hash_find(queue_ids, id)) ? *qq : 0;
 }
 
 struct queue_entry *queue_find(const char *key) {
-  struct queue_entry *q;
+  struct queue_entry *q, *byid = queue_find_id(key);
+  struct entry_vector **vp = hash_find(queue_tracks, key);
 
+  if(!vp)
+    return byid;
+  if(!byid && (*vp)->nvec == 1)
+    return (*vp)->vec[0];
+  /* Several candidates; the first in the queue wins */
   for(q = qhead.next;
-      q != &qhead && strcmp(q->track, key) && strcmp(q->id, key);
+      q != &qhead && q != byid && strcmp(q->track, key);
       q = q->next)
     ;
   return q != &qhead ? q : 0;
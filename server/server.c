@@ -17,12 +17,26 @@
  */
 
 #include "disorder-server.h"
+#include "arena.h"
 #include "basen.h"
+#include "timeval.h"
+
+#if HAVE_ZLIB_H
+# include <zlib.h>
+#endif
 
 #ifndef NONCE_SIZE
 # define NONCE_SIZE 16
 #endif
 
+#ifndef TURN_COMMANDS
+/** @brief Maximum commands handled from one connection at a time
+ *
+ * After this many, other connections get a turn before any more are read.
+ */
+# define TURN_COMMANDS 16
+#endif
+
 #ifndef CONFIRM_SIZE
 /** @brief Size of nonce in confirmation string in 32-bit words
  *
@@ -96,6 +110,15 @@ struct conn {
   ev_reader_callback *reader;
   /** @brief Event log output sending to this connection */
   struct eventlog_output *lo;
+  /** @brief Event keywords this connection wants, or NULL for all */
+  char **log_events;
+  /** @brief Number of elements in @ref log_events */
+  int nlog_events;
+  /** @brief Nonzero to put sequence numbers on event log lines
+   *
+   * Set by @b log-resume.
+   */
+  int log_seq;
   /** @brief Parent listener */
   const struct listener *l;
   /** @brief Login cookie or NULL */
@@ -124,8 +147,131 @@ struct conn {
 
   /** @brief RTP destination (if @ref rtp_requested is nonzero) */
   struct sockaddr_storage rtp_destination;
+
+  /** @brief When the last RTP reception report arrived, or 0 if none has */
+  time_t rtp_report_when;
+
+  /** @brief Packets expected, from the last RTP reception report */
+  long rtp_expected;
+
+  /** @brief Packets lost, from the last RTP reception report */
+  long rtp_lost;
+
+  /** @brief Jitter in microseconds, from the last RTP reception report */
+  long rtp_jitter;
+
+  /** @brief Nonzero while waiting for a command to complete
+   *
+   * See conn_suspend().
+   */
+  int suspended;
+
+  /** @brief Metrics for the command awaiting its response, or NULL
+   *
+   * See command_started().
+   */
+  struct command_metrics *metrics;
+
+  /** @brief When the command in @ref metrics arrived */
+  struct timeval command_when;
+
+  /** @brief Database time used by the command in @ref metrics so far */
+  int64_t command_trackdb_us;
+
+  /** @brief First byte of the response to @ref metrics, or 0 */
+  int command_reply;
+
+  /** @brief Nonzero if @ref metrics completes when its response appears */
+  int command_deferred;
+
+#if HAVE_ZLIB_H
+  /** @brief Compressor for responses, or NULL
+   *
+   * See c_compress().
+   */
+  z_stream *deflater;
+#endif
+
+  /** @brief Per-user load this connection counts towards, or NULL
+   *
+   * See user_admit().
+   */
+  struct user_load *load;
+
+  /** @brief Nonzero if this connection counts towards @ref load */
+  int counted;
+
+  /** @brief Nonzero if a suspended command counts towards @ref load */
+  int pending;
+
+  /** @brief Connection to the primary, or NULL
+   *
+   * Only used by replicas.  See forward_command().
+   */
+  struct forward *forward;
+
+  /** @brief User that @ref forward is logged in as, or NULL */
+  const char *forward_who;
+
+  /** @brief Client host as reported by a replica, or NULL
+   *
+   * See c_forwarded_for().
+   */
+  const char *forwarded_for;
+
+  /** @brief Nonzero once part of a forwarded response has been passed on */
+  int forward_started;
+
+  /** @brief Nonzero if waiting for @ref load to drop */
+  int parked;
+
+  /** @brief Next connection waiting for the same @ref load */
+  struct conn *next_parked;
+
+  /** @brief Scratch space for formatting responses
+   *
+   * Reset at the start of each command, so it must only be used for things
+   * that are finished with once they have been written to @ref w.
+   */
+  struct arena arena;
 };
 
+/** @brief Load on the server from one user's connections */
+struct user_load {
+  /** @brief Number of connections logged in */
+  int connections;
+
+  /** @brief Number of suspended commands */
+  int pending;
+
+  /** @brief Connections waiting for a command to finish */
+  struct conn *parked;
+
+  /** @brief Where to add the next waiting connection */
+  struct conn **parked_tail;
+};
+
+/** @brief @ref user_load for each username */
+static hash *user_loads;
+
+/** @brief Admission statistics reported by @c metrics */
+static struct {
+  /** @brief Logins refused by @c user_max_connections */
+  unsigned long rejected;
+
+  /** @brief Times a command waited for @c user_max_pending */
+  unsigned long parked;
+
+  /** @brief Times a connection yielded after @ref TURN_COMMANDS */
+  unsigned long yields;
+
+  /** @brief Suspended commands counted towards users' loads */
+  int pending;
+
+  /** @brief Connections currently waiting */
+  int waiting;
+} admission;
+
 /** @brief Linked list of connections */
 static struct conn *connections;
 
@@ -139,11 +285,18 @@ static int c_playlist_set_body(struct conn *c,
                                char **body,
                                int nbody,
                                void *u);
+static int c_playlist_insert_body(struct conn *c,
+                                  char **body,
+                                  int nbody,
+                                  void *u);
 static int fetch_body(struct conn *c,
                       body_callback_type body_callback,
                       void *u);
 static int body_line(struct conn *c, char *line);
 static int command(struct conn *c, char *line);
+static void user_release(struct conn *c);
+static int c_metrics(struct conn *c, char **vec, int nvec);
+static int conn_resume(struct conn *c);
 
 static const char *noyes[] = { "no", "yes" };
 
@@ -159,6 +312,29 @@ static void remove_connection(struct conn *c) {
     rtp_request_cancel(&c->rtp_destination);
     c->rtp_requested = 0;
   }
+#if HAVE_ZLIB_H
+  if(c->deflater) {
+    deflateEnd(c->deflater);
+    c->deflater = NULL;
+  }
+#endif
+  if(c->forward) {
+    forward_close(c->forward);
+    c->forward = NULL;
+    /* Nothing more will arrive for any command still waiting */
+    if(c->suspended)
+      conn_resume(c);
+  }
+  user_release(c);
+  if(c->parked) {
+    for(cc = &c->load->parked; *cc != c; cc = &(*cc)->next_parked)
+      ;
+    *cc = c->next_parked;
+    if(!*cc)
+      c->load->parked_tail = cc;
+    c->parked = 0;
+    --admission.waiting;
+  }
   for(cc = &connections; *cc && *cc != c; cc = &(*cc)->next)
     ;
   if(*cc)
@@ -214,6 +390,135 @@ static int reader_error(ev_source attribute((unused)) *ev,
   return 0;
 }
 
+/** @brief Stop reading commands until the current one completes
+ * @param c Connection
+ * @return 0, for the command to return
+ *
+ * Used by commands that complete asynchronously.  They must call
+ * conn_resume() when they have written their response.
+ */
+static int conn_suspend(struct conn *c) {
+  c->suspended = 1;
+  if(c->load && !c->pending) {
+    c->pending = 1;
+    ++c->load->pending;
+    ++admission.pending;
+  }
+  ev_reader_disable(c->r);
+  return 0;				/* not yet complete */
+}
+
+/** @brief Let a user's waiting connections try again
+ * @param l User's load
+ *
+ * They are resumed in the order they started waiting; any that still can't
+ * proceed wait again.
+ */
+static void user_wake(struct user_load *l) {
+  struct conn *c;
+
+  while((c = l->parked)) {
+    l->parked = c->next_parked;
+    c->parked = 0;
+    --admission.waiting;
+    if(c->r)
+      ev_reader_enable(c->r);
+  }
+  l->parked_tail = &l->parked;
+}
+
+/** @brief Decide whether a connection may execute a command now
+ * @param c Connection
+ * @return Nonzero if it may, 0 if has to wait
+ *
+ * If the connection's user already has @c user_max_pending commands
+ * suspended then the connection stops reading until one of them finishes.
+ */
+static int command_admit(struct conn *c) {
+  struct user_load *const l = c->load;
+
+  if(!l
+     || !config->user_max_pending
+     || l->pending < config->user_max_pending)
+    return 1;
+  c->parked = 1;
+  c->next_parked = NULL;
+  *l->parked_tail = c;
+  l->parked_tail = &c->next_parked;
+  ++admission.parked;
+  ++admission.waiting;
+  ev_reader_disable(c->r);
+  return 0;
+}
+
+/** @brief Count a login towards a user's load
+ * @param c Connection
+ * @param user Username
+ * @return 0 if the login may proceed, non-0 if it has been refused
+ *
+ * Logins are refused if the user already has @c user_max_connections
+ * connections.  Connections to the private socket are not counted.
+ */
+static int user_admit(struct conn *c, const char *user) {
+  struct user_load *l;
+
+  if(c->l->privileged)
+    return 0;
+  if(!user_loads)
+    user_loads = hash_new(sizeof (struct user_load));
+  if(!(l = hash_find(user_loads, user))) {
+    hash_add(user_loads, user, NULL, HASH_INSERT);
+    l = hash_find(user_loads, user);
+    l->parked_tail = &l->parked;
+  }
+  if(config->user_max_connections
+     && l->connections >= config->user_max_connections
+     && !(c->counted && c->load == l)) {
+    disorder_info("S%x %s has too many connections", c->tag, user);
+    ++admission.rejected;
+    sink_writes(ev_writer_sink(c->w), "530 too many connections\n");
+    return -1;
+  }
+  /* A connection that logs in again stops counting for the old user */
+  user_release(c);
+  ++l->connections;
+  c->load = l;
+  c->counted = 1;
+  return 0;
+}
+
+/** @brief Stop counting a connection towards its user's load
+ * @param c Connection
+ *
+ * Any suspended command still counts until it finishes.
+ */
+static void user_release(struct conn *c) {
+  if(c->counted) {
+    --c->load->connections;
+    c->counted = 0;
+  }
+}
+
+/** @brief Resume reading commands after conn_suspend()
+ * @param c Connection
+ * @return Nonzero if the connection is still open
+ *
+ * Call this before writing the response; if it returns 0, don't.
+ */
+static int conn_resume(struct conn *c) {
+  c->suspended = 0;
+  if(c->pending) {
+    c->pending = 0;
+    --c->load->pending;
+    --admission.pending;
+    user_wake(c->load);
+  }
+  if(!c->w || !c->r)
+    return 0;				/* connection went away */
+  ev_reader_enable(c->r);
+  return 1;
+}
+
 static int c_disable(struct conn *c, char **vec, int nvec) {
   if(nvec == 0)
     disable_playing(c->who, c->ev);
@@ -244,6 +549,42 @@ static int c_enabled(struct conn *c,
   return 1;			/* completed */
 }
 
+/** @brief Number of events logged since the server started */
+static unsigned long state_generation;
+
+/** @brief When @ref state_generation started counting
+ *
+ * Also qualifies @ref trackdb_generation, which restarts from 0 too.
+ */
+static time_t state_epoch;
+
+/** @brief Event log output that counts events */
+static struct eventlog_output state_log[1];
+
+/** @brief Count one event */
+static void state_logged(const char attribute((unused)) *msg,
+			 void attribute((unused)) *user) {
+  ++state_generation;
+}
+
+static int c_state_generation(struct conn *c,
+			      char attribute((unused)) **vec,
+			      int attribute((unused)) nvec) {
+  /* Include the start time so that a restarted server never repeats a
+   * generation */
+  sink_printf(ev_writer_sink(c->w), "252 %lx.%lx\n",
+	      (unsigned long)state_epoch, state_generation);
+  return 1;			/* completed */
+}
+
+static int c_track_generation(struct conn *c,
+			      char attribute((unused)) **vec,
+			      int attribute((unused)) nvec) {
+  sink_printf(ev_writer_sink(c->w), "252 %lx.%lx\n",
+	      (unsigned long)state_epoch, trackdb_generation);
+  return 1;			/* completed */
+}
+
 static int c_play(struct conn *c, char **vec,
 		  int attribute((unused)) nvec) {
   const char *track;
@@ -277,25 +618,28 @@ static int c_playafter(struct conn *c, char **vec,
   const char *track;
   struct queue_entry *q;
   const char *afterme = vec[0];
-
-  for(int n = 1; n < nvec; ++n) {
-    if(!trackdb_exists(vec[n])) {
-      sink_writes(ev_writer_sink(c->w), "550 track is not in database\n");
-      return 1;
-    }
-    if(!(track = trackdb_resolve(vec[n]))) {
-      sink_writes(ev_writer_sink(c->w), "550 cannot resolve track\n");
-      return 1;
-    }
-    q = queue_add(track, c->who, WHERE_AFTER, afterme, origin_picked);
-    if(!q) {
-      sink_printf(ev_writer_sink(c->w), "550 No such ID\n");
-      return 1;
+  const char *err = 0;
+
+  queue_batch_begin();
+  for(int n = 1; n < nvec && !err; ++n) {
+    if(!trackdb_exists(vec[n]))
+      err = "550 track is not in database\n";
+    else if(!(track = trackdb_resolve(vec[n])))
+      err = "550 cannot resolve track\n";
+    else if(!(q = queue_add(track, c->who, WHERE_AFTER, afterme,
+                            origin_picked)))
+      err = "550 No such ID\n";
+    else {
+      disorder_info("added %s as %s after %s", track, q->id, afterme);
+      afterme = q->id;
     }
-    disorder_info("added %s as %s after %s", track, q->id, afterme);
-    afterme = q->id;
   }
-  queue_write();
+  /* Anything added before an error stays on the queue */
+  queue_batch_end(c->who);
+  if(err) {
+    sink_writes(ev_writer_sink(c->w), err);
+    return 1;
+  }
   sink_printf(ev_writer_sink(c->w), "252 OK\n");
   /* We make sure the track at the head of the queue is prepared, just in case
    * we added it.  We could be more subtle but prepare() will ensure we don't
@@ -441,10 +785,10 @@ static void start_fresh_rescan(void *ru) {
      * rescan. */
     if(c->rescan_wait) {
       /* We want to block until the new rescan completes */
-      trackdb_rescan(c->ev, 1/*check*/, finished_rescan, c);
+      watch_rescan(c->ev, 1/*check*/, finished_rescan, c);
     } else {
       /* We can report back immediately */
-      trackdb_rescan(c->ev, 1/*check*/, 0, 0);
+      watch_rescan(c->ev, 1/*check*/, 0, 0);
       sink_writes(ev_writer_sink(c->w), "250 rescan initiated\n");
       /* Turn this connection back on */
       ev_reader_enable(c->r);
@@ -471,6 +815,11 @@ static int c_rescan(struct conn *c,
       return 1;				/* completed */
     }
   }
+  if(config->library) {
+    sink_writes(ev_writer_sink(c->w),
+                "550 rescans are done by the library's server\n");
+    return 1;
+  }
   /* Report what was requested */
   disorder_info("S%x rescan by %s (%s %s)", c->tag, c->who,
 		flag_wait ? "wait" : "",
@@ -504,11 +853,11 @@ static int c_rescan(struct conn *c,
     /* No rescan is underway.  fresh is therefore irrelevant. */
     if(flag_wait) {
       /* We want to block until completion */
-      trackdb_rescan(c->ev, 1/*check*/, finished_rescan, c);
+      watch_rescan(c->ev, 1/*check*/, finished_rescan, c);
       return 0;
     } else {
       /* We don't want to block. */
-      trackdb_rescan(c->ev, 1/*check*/, 0, 0);
+      watch_rescan(c->ev, 1/*check*/, 0, 0);
       sink_writes(ev_writer_sink(c->w), "250 rescan initiated\n");
       return 1;				/* completed */
     }
@@ -529,7 +878,8 @@ static int c_playing(struct conn *c,
   if(playing) {
     queue_fix_sofar(playing);
     playing->expected = 0;
-    sink_printf(ev_writer_sink(c->w), "252 %s\n", queue_marshall(playing));
+    sink_printf(ev_writer_sink(c->w), "252 %s\n",
+		queue_marshall_arena(playing, &c->arena));
   } else
     sink_printf(ev_writer_sink(c->w), "259 nothing playing\n");
   return 1;				/* completed */
@@ -545,6 +895,9 @@ static const char *connection_host(struct conn *c) {
   int n;
   char host[1024];
 
+  /* a replica vouches for the origin of the clients it forwards */
+  if(c->forwarded_for)
+    return c->forwarded_for;
   /* get connection data */
   l = sizeof u;
   if(getpeername(c->fd, &u.sa, &l) < 0) {
@@ -605,6 +958,8 @@ static int c_user(struct conn *c,
   res = authhash(c->nonce, sizeof c->nonce, password,
 		 config->authorization_algorithm);
   if(wideopen || c->l->privileged || (res && !strcmp(res, vec[1]))) {
+    if(user_admit(c, vec[0]))
+      return 1;
     c->who = vec[0];
     c->rights = rights;
     /* currently we only bother logging remote connections */
@@ -622,18 +977,98 @@ static int c_user(struct conn *c,
   return 1;
 }
 
+/** @brief Cached response body for c_recent() */
+static struct {
+  /** @brief Nonzero if @ref body is up to date */
+  int valid;
+
+  /** @brief Value of @ref recent_generation when @ref body was made */
+  unsigned long generation;
+
+  /** @brief Marshalled entries, one to a line */
+  char *body;
+} recent_cache;
+
 static int c_recent(struct conn *c,
 		    char attribute((unused)) **vec,
 		    int attribute((unused)) nvec) {
   const struct queue_entry *q;
-
+  struct dynstr d;
+
+  if(!recent_cache.valid || recent_cache.generation != recent_generation) {
+    dynstr_init(&d);
+    for(q = phead.next; q != &phead; q = q->next) {
+      dynstr_append(&d, ' ');
+      dynstr_append_string(&d, queue_marshall(q));
+      dynstr_append(&d, '\n');
+    }
+    dynstr_terminate(&d);
+    recent_cache.body = d.vec;
+    recent_cache.generation = recent_generation;
+    recent_cache.valid = 1;
+  }
   sink_writes(ev_writer_sink(c->w), "253 Tracks follow\n");
-  for(q = phead.next; q != &phead; q = q->next)
-    sink_printf(ev_writer_sink(c->w), " %s\n", queue_marshall(q));
+  sink_writes(ev_writer_sink(c->w), recent_cache.body);
   sink_writes(ev_writer_sink(c->w), ".\n");
   return 1;				/* completed */
 }
 
+/** @brief Cached rendering of the queue for c_queue()
+ *
+ * Only the @c expected field of each entry changes from one request to the
+ * next, so the rest is kept until the queue changes or the track lengths
+ * might have.
+ */
+static struct {
+  /** @brief Nonzero if the rest is up to date */
+  int valid;
+
+  /** @brief Value of @ref queue_generation when last filled in */
+  unsigned long generation;
+
+  /** @brief Value of @ref trackdb_generation when last filled in */
+  unsigned long track_generation;
+
+  /** @brief Number of entries */
+  int n;
+
+  /** @brief Each entry marshalled without @c expected, with a newline */
+  char **entries;
+
+  /** @brief Each entry's length in seconds, or 0 if not known */
+  long *lengths;
+
+  /** @brief Whole response body with every @c expected 0, or NULL */
+  char *idle;
+} queue_cache;
+
+/** @brief Bring @ref queue_cache up to date */
+static void queue_cache_fill(void) {
+  const struct queue_entry *q;
+  const char *l;
+  int n;
+
+  if(queue_cache.valid
+     && queue_cache.generation == queue_generation
+     && queue_cache.track_generation == trackdb_generation)
+    return;
+  queue_cache.n = 0;
+  for(q = qhead.next; q != &qhead; q = q->next)
+    ++queue_cache.n;
+  queue_cache.entries = xcalloc(queue_cache.n, sizeof (char *));
+  queue_cache.lengths = xcalloc_noptr(queue_cache.n, sizeof (long));
+  for(q = qhead.next, n = 0; q != &qhead; q = q->next, ++n) {
+    byte_xasprintf(&queue_cache.entries[n], "%s\n",
+                   queue_marshall_unexpected(q));
+    if((l = trackdb_get(q->track, "_length")))
+      queue_cache.lengths[n] = atol(l);
+  }
+  queue_cache.idle = 0;
+  queue_cache.generation = queue_generation;
+  queue_cache.track_generation = trackdb_generation;
+  queue_cache.valid = 1;
+}
+
 static int c_queue(struct conn *c,
 		   char attribute((unused)) **vec,
 		   int attribute((unused)) nvec) {
@@ -641,7 +1076,11 @@ static int c_queue(struct conn *c,
   time_t when = 0;
   const char *l;
   long length;
+  struct dynstr d;
+  char buffer[64];
+  int n;
 
+  queue_cache_fill();
   sink_writes(ev_writer_sink(c->w), "253 Tracks follow\n");
   if(playing_is_enabled() && !paused) {
     if(playing) {
@@ -656,30 +1095,137 @@ static int c_queue(struct conn *c,
        * first in the queue can be expected to start immediately. */
       xtime(&when);
   }
-  for(q = qhead.next; q != &qhead; q = q->next) {
-    /* fill in estimated start time */
-    q->expected = when;
-    sink_printf(ev_writer_sink(c->w), " %s\n", queue_marshall(q));
-    /* update for next track */
-    if(when) {
-      if((l = trackdb_get(q->track, "_length"))
-	 && (length = atol(l)))
-	when += length;
-      else
-	when = 0;
+  if(!when) {
+    /* Nothing can be expected, so the whole body is the same every time */
+    if(!queue_cache.idle) {
+      dynstr_init(&d);
+      for(n = 0; n < queue_cache.n; ++n) {
+        dynstr_append_string(&d, " expected 0");
+        dynstr_append_string(&d, queue_cache.entries[n]);
+      }
+      dynstr_terminate(&d);
+      queue_cache.idle = d.vec;
+    }
+    for(q = qhead.next; q != &qhead; q = q->next)
+      q->expected = 0;
+    sink_writes(ev_writer_sink(c->w), queue_cache.idle);
+  } else {
+    for(q = qhead.next, n = 0; q != &qhead; q = q->next, ++n) {
+      /* fill in estimated start time */
+      q->expected = when;
+      byte_snprintf(buffer, sizeof buffer, " expected %jd", (intmax_t)when);
+      sink_writes(ev_writer_sink(c->w), buffer);
+      sink_writes(ev_writer_sink(c->w), queue_cache.entries[n]);
+      /* update for next track */
+      if(when) {
+        if(queue_cache.lengths[n])
+          when += queue_cache.lengths[n];
+        else
+          when = 0;
+      }
     }
   }
   sink_writes(ev_writer_sink(c->w), ".\n");
   return 1;				/* completed */
 }
 
-static int output_list(struct conn *c, char **vec) {
-  while(*vec)
-    sink_printf(ev_writer_sink(c->w), "%s\n", *vec++);
+static int c_queue_generation(struct conn *c,
+			      char attribute((unused)) **vec,
+			      int attribute((unused)) nvec) {
+  sink_printf(ev_writer_sink(c->w), "252 %lu\n", queue_generation);
+  return 1;
+}
+
+static int c_queue_changes(struct conn *c,
+			   char **vec,
+			   int attribute((unused)) nvec) {
+  unsigned long generation;
+  char **changes, *end;
+  int nchanges, n;
+
+  errno = 0;
+  generation = strtoul(vec[0], &end, 10);
+  if(errno || end == vec[0] || *end) {
+    sink_writes(ev_writer_sink(c->w), "550 invalid generation\n");
+    return 1;
+  }
+  if(!(changes = queue_changes(generation, &nchanges))) {
+    sink_writes(ev_writer_sink(c->w), "555 changes not known\n");
+    return 1;
+  }
+  sink_writes(ev_writer_sink(c->w), "253 Changes follow\n");
+  for(n = 0; n < nchanges; ++n)
+    sink_printf(ev_writer_sink(c->w), "%s\n", changes[n]);
   sink_writes(ev_writer_sink(c->w), ".\n");
   return 1;
 }
 
+/** @brief Pause a listing when this much output is waiting to be sent */
+#define FILES_DIRS_HIGH_WATER 65536
+
+/** @brief Carry on with a paused listing once output is down to this */
+#define FILES_DIRS_LOW_WATER 16384
+
+/** @brief State for a files/dirs/allfiles query */
+struct files_dirs_state {
+  /** @brief Connection */
+  struct conn *c;
+
+  /** @brief Query */
+  struct query *q;
+
+  /** @brief Set once the response line has been sent */
+  int started;
+};
+
+/** @brief Called when a paused listing's connection has caught up */
+static int files_dirs_drained(ev_source attribute((unused)) *ev,
+			      void *u) {
+  struct files_dirs_state *fds = u;
+
+  query_resume(fds->q);
+  return 0;
+}
+
+/** @brief Called with each batch of results for a files/dirs/allfiles query
+ *
+ * The results are sent as they arrive, rather than collected first, so
+ * that a big listing doesn't hold up everything else.  If the client falls
+ * behind then the query is paused until it catches up.
+ */
+static void files_dirs_more(struct query *q,
+			    char **fvec,
+			    int nfvec,
+			    int more,
+			    void *u) {
+  struct files_dirs_state *fds = u;
+  struct conn *c = fds->c;
+  int n;
+
+  if(!c->w) {
+    /* The connection has gone away; just let the query finish */
+    if(!more)
+      conn_resume(c);
+    return;
+  }
+  if(!fds->started) {
+    sink_writes(ev_writer_sink(c->w), "253 Listing follow\n");
+    fds->started = 1;
+  }
+  for(n = 0; n < nfvec; ++n)
+    sink_printf(ev_writer_sink(c->w), "%s\n", fvec[n]);
+  if(!more) {
+    sink_writes(ev_writer_sink(c->w), ".\n");
+    conn_resume(c);
+    return;
+  }
+  if(ev_writer_buffered(c->w) > FILES_DIRS_HIGH_WATER) {
+    fds->q = q;
+    query_pause(q);
+    ev_writer_drained(c->w, FILES_DIRS_LOW_WATER, files_dirs_drained, fds);
+  }
+}
+
 static int files_dirs(struct conn *c,
 		      char **vec,
 		      int nvec,
@@ -687,8 +1233,7 @@ static int files_dirs(struct conn *c,
   const char *dir, *re;
   char errstr[RXCERR_LEN];
   size_t erroffset;
-  regexp *rec;
-  char **fvec, *key;
+  struct files_dirs_state *fds;
   
   switch(nvec) {
   case 0: dir = 0; re = 0; break;
@@ -696,56 +1241,22 @@ static int files_dirs(struct conn *c,
   case 2: dir = vec[0]; re = vec[1]; break;
   default: abort();
   }
-  /* A bit of a bodge to make sure the args don't trample on cache keys */
-  if(dir && strchr(dir, '\n')) {
-    sink_writes(ev_writer_sink(c->w), "550 invalid directory name\n");
-    return 1;
-  }
-  if(re && strchr(re, '\n')) {
-    sink_writes(ev_writer_sink(c->w), "550 invalid regexp\n");
+  /* The regexp is checked here so that the error can be reported straight
+   * away; the query compiles it again.  We bother eliminating "" because the
+   * web interface is relatively likely to send it.  The same few patterns
+   * tend to come up again and again so both ends cache them. */
+  if(re && *re
+     && !regexp_compile_cached(re, RXF_CASELESS,
+			       errstr, sizeof(errstr), &erroffset)) {
+    sink_printf(ev_writer_sink(c->w), "550 Error compiling regexp: %s\n",
+		errstr);
     return 1;
   }
-  /* We bother eliminating "" because the web interface is relatively
-   * likely to send it */
-  if(re && *re) {
-    byte_xasprintf(&key, "%d\n%s\n%s", (int)what, dir ? dir : "", re);
-    fvec = (char **)cache_get(&cache_files_type, key);
-    if(fvec) {
-      /* Got a cache hit, don't store the answer in the cache */
-      key = 0;
-      ++cache_files_hits;
-      rec = 0;				/* quieten compiler */
-    } else {
-      /* Cache miss, we'll do the lookup and key != 0 so we'll store the answer
-       * in the cache. */
-      if(!(rec = regexp_compile(re, RXF_CASELESS,
-				errstr, sizeof(errstr), &erroffset))) {
-	sink_printf(ev_writer_sink(c->w), "550 Error compiling regexp: %s\n",
-		    errstr);
-	return 1;
-      }
-      /* It only counts as a miss if the regexp was valid. */
-      ++cache_files_misses;
-    }
-  } else {
-    /* No regexp, don't bother caching the result */
-    rec = 0;
-    key = 0;
-    fvec = 0;
-  }
-  if(!fvec) {
-    /* No cache hit (either because a miss, or because we did not look) so do
-     * the lookup */
-    if(dir && *dir)
-      fvec = trackdb_list(dir, 0, what, rec);
-    else
-      fvec = trackdb_list(0, 0, what, rec);
-  }
-  if(key)
-    /* Put the answer in the cache */
-    cache_put(&cache_files_type, key, fvec);
-  sink_writes(ev_writer_sink(c->w), "253 Listing follow\n");
-  return output_list(c, fvec);
+  /* Results are cached by the query pool */
+  fds = xmalloc(sizeof *fds);
+  fds->c = c;
+  query_list_stream(c->ev, dir, what, re, files_dirs_more, fds);
+  return conn_suspend(c);
 }
 
 static int c_files(struct conn *c,
@@ -766,6 +1277,26 @@ static int c_allfiles(struct conn *c,
   return files_dirs(c, vec, nvec, trackdb_directories|trackdb_files);
 }
 
+/** @brief Record the origin of a forwarded client
+ *
+ * Sent by a replica on its private-socket connection to the primary, before
+ * logging in, when the client it is forwarding for is not local to it.
+ * connection_host() then reports that host, so the session does not get
+ * @ref RIGHT__LOCAL and remote_userman applies as it would for a direct
+ * connection.
+ */
+static int c_forwarded_for(struct conn *c,
+			   char **vec,
+			   int attribute((unused)) nvec) {
+  if(!c->l->privileged || c->who) {
+    sink_writes(ev_writer_sink(c->w), "510 Prohibited\n");
+    return 1;
+  }
+  c->forwarded_for = xstrdup(vec[0]);
+  sink_writes(ev_writer_sink(c->w), "250 OK\n");
+  return 1;
+}
+
 static int c_get(struct conn *c,
 		 char **vec,
 		 int attribute((unused)) nvec) {
@@ -791,7 +1322,7 @@ static int c_length(struct conn *c,
     sink_writes(ev_writer_sink(c->w), "550 cannot resolve track\n");
     return 1;
   }
-  if((v = trackdb_get(track, "_length")))
+  if((v = trackdb_get_length(track)))
     sink_printf(ev_writer_sink(c->w), "252 %s\n", quoteutf8(v));
   else
     sink_writes(ev_writer_sink(c->w), "550 not found\n");
@@ -827,9 +1358,165 @@ static int c_prefs(struct conn *c,
   k = trackdb_get_all(track);
   sink_writes(ev_writer_sink(c->w), "253 prefs follow\n");
   for(; k; k = k->next)
-    if(k->name[0] != '_')		/* omit internal values */
-      sink_printf(ev_writer_sink(c->w),
-		  " %s %s\n", quoteutf8(k->name), quoteutf8(k->value));
+    if(k->name[0] != '_') {		/* omit internal values */
+      sink_writec(ev_writer_sink(c->w), ' ');
+      quoteutf8_sink(ev_writer_sink(c->w), k->name);
+      sink_writec(ev_writer_sink(c->w), ' ');
+      quoteutf8_sink(ev_writer_sink(c->w), k->value);
+      sink_writec(ev_writer_sink(c->w), '\n');
+    }
+  sink_writes(ev_writer_sink(c->w), ".\n");
+  return 1;
+}
+
+/** @brief Start one line of a bulk metadata response
+ * @param c Connection
+ * @param track Track name the line is about
+ *
+ * The rest of the line is written with multi_field() and finished with a
+ * newline.  Used by c_lengths_multi(), c_parts_multi() and c_prefs_multi().
+ */
+static void multi_line(struct conn *c, const char *track) {
+  const char *q = quoteutf8_arena(&c->arena, track);
+
+  sink_printf(ev_writer_sink(c->w), "%s%s", *q == '.' ? "." : "", q);
+}
+
+/** @brief Write one field of a bulk metadata response line
+ * @param c Connection
+ * @param value Value to write
+ */
+static void multi_field(struct conn *c, const char *value) {
+  sink_writec(ev_writer_sink(c->w), ' ');
+  quoteutf8_sink(ev_writer_sink(c->w), value);
+}
+
+static int c_lengths_multi(struct conn *c,
+			   char **vec,
+			   int nvec) {
+  struct kvp **tps = xcalloc(nvec, sizeof *tps);
+  const char *v;
+  int n;
+
+  trackdb_get_many(vec, nvec, tps, 0, 0);
+  sink_writes(ev_writer_sink(c->w), "253 lengths follow\n");
+  for(n = 0; n < nvec; ++n) {
+    multi_line(c, vec[n]);
+    if((v = kvp_get(tps[n], "_length")))
+      multi_field(c, v);
+    sink_writes(ev_writer_sink(c->w), "\n");
+  }
+  sink_writes(ev_writer_sink(c->w), ".\n");
+  return 1;
+}
+
+static int c_parts_multi(struct conn *c,
+			 char **vec,
+			 int nvec) {
+  const char *context = vec[0], *part = vec[1];
+  struct kvp **tps, **pps;
+  const char **actuals, **values;
+  char **misses;
+  int n, m, nmisses = 0;
+
+  vec += 2;
+  nvec -= 2;
+  values = xcalloc(nvec, sizeof *values);
+  misses = xcalloc(nvec, sizeof *misses);
+  /* Only look up the tracks that aren't cached.  A cached null pointer
+   * means the track didn't exist, but we answer for those anyway. */
+  for(n = 0; n < nvec; ++n)
+    if(!part_cache_get(vec[n], context, part, 0, &values[n]) || !values[n])
+      misses[nmisses++] = vec[n];
+  tps = xcalloc(nmisses, sizeof *tps);
+  pps = xcalloc(nmisses, sizeof *pps);
+  actuals = xcalloc(nmisses, sizeof *actuals);
+  trackdb_get_many(misses, nmisses, tps, pps, actuals);
+  for(n = m = 0; m < nmisses; ++n)
+    if(vec[n] == misses[m]) {
+      values[n] = trackdb_getpart_prefs(actuals[m], context, part, pps[m]);
+      /* c_part() refuses tracks that don't exist, so don't cache those */
+      if(tps[m])
+        part_cache_put(vec[n], context, part, 0, values[n]);
+      ++m;
+    }
+  sink_writes(ev_writer_sink(c->w), "253 parts follow\n");
+  for(n = 0; n < nvec; ++n) {
+    multi_line(c, vec[n]);
+    multi_field(c, values[n]);
+    sink_writes(ev_writer_sink(c->w), "\n");
+  }
+  sink_writes(ev_writer_sink(c->w), ".\n");
+  return 1;
+}
+
+static int c_prefs_multi(struct conn *c,
+			 char **vec,
+			 int nvec) {
+  struct kvp **pps = xcalloc(nvec, sizeof *pps), *k;
+  int n;
+
+  trackdb_get_many(vec, nvec, 0, pps, 0);
+  sink_writes(ev_writer_sink(c->w), "253 prefs follow\n");
+  for(n = 0; n < nvec; ++n) {
+    multi_line(c, vec[n]);
+    for(k = pps[n]; k; k = k->next)
+      if(k->name[0] != '_') {		/* omit internal values */
+	multi_field(c, k->name);
+	multi_field(c, k->value);
+      }
+    sink_writes(ev_writer_sink(c->w), "\n");
+  }
+  sink_writes(ev_writer_sink(c->w), ".\n");
+  return 1;
+}
+
+static int c_dir_summaries(struct conn *c,
+			   char **vec,
+			   int nvec) {
+  static const char *const fields[] = { "tracks", "length", "unknown",
+					"first" };
+  static const struct {
+    const char *name, *context, *part;
+  } parts[] = {
+    { "artist", "display", "artist" },
+    { "album", "display", "album" },
+    { "sort-artist", "sort", "artist" },
+    { "sort-album", "sort", "album" },
+  };
+  struct kvp **sums = xcalloc(nvec, sizeof *sums), **pps;
+  const char **firsts, **actuals, *v;
+  int n, m, f, nfirsts = 0;
+
+  trackdb_get_dirs(vec, nvec, sums);
+  /* The name parts come from each directory's first track */
+  firsts = xcalloc(nvec, sizeof *firsts);
+  for(n = 0; n < nvec; ++n)
+    if((v = kvp_get(sums[n], "first")))
+      firsts[nfirsts++] = v;
+  pps = xcalloc(nfirsts, sizeof *pps);
+  actuals = xcalloc(nfirsts, sizeof *actuals);
+  trackdb_get_many((char **)firsts, nfirsts, 0, pps, actuals);
+  sink_writes(ev_writer_sink(c->w), "253 summaries follow\n");
+  for(n = m = 0; n < nvec; ++n) {
+    multi_line(c, vec[n]);
+    if(sums[n]) {
+      for(f = 0; f < (int)(sizeof fields / sizeof *fields); ++f)
+	if((v = kvp_get(sums[n], fields[f]))) {
+	  multi_field(c, fields[f]);
+	  multi_field(c, v);
+	}
+      if(kvp_get(sums[n], "first")) {
+	for(f = 0; f < (int)(sizeof parts / sizeof *parts); ++f) {
+	  multi_field(c, parts[f].name);
+	  multi_field(c, trackdb_getpart_prefs(actuals[m], parts[f].context,
+					       parts[f].part, pps[m]));
+	}
+	++m;
+      }
+    }
+    sink_writes(ev_writer_sink(c->w), "\n");
+  }
   sink_writes(ev_writer_sink(c->w), ".\n");
   return 1;
 }
@@ -846,27 +1533,92 @@ static void search_parse_error(const char *msg, void *u) {
   *(const char **)u = msg;
 }
 
+static void search_done(char **results, int nresults, void *u) {
+  struct conn *c = u;
+  int n;
+
+  if(!conn_resume(c))
+    return;
+  sink_printf(ev_writer_sink(c->w), "253 %d matches\n", nresults);
+  for(n = 0; n < nresults; ++n)
+    sink_printf(ev_writer_sink(c->w), "%s\n", results[n]);
+  sink_writes(ev_writer_sink(c->w), ".\n");
+}
+
+static void search_page_done(char **results, int nresults, void *u) {
+  struct conn *c = u;
+  int n;
+
+  if(!conn_resume(c))
+    return;
+  sink_printf(ev_writer_sink(c->w), "253 %s matches\n",
+              nresults ? results[0] : "0");
+  for(n = 1; n < nresults; ++n)
+    sink_printf(ev_writer_sink(c->w), "%s\n", results[n]);
+  sink_writes(ev_writer_sink(c->w), ".\n");
+}
+
 static int c_search(struct conn *c,
 			  char **vec,
-			  int attribute((unused)) nvec) {
-  char **terms, **results;
-  int nterms, nresults, n;
+			  int nvec) {
+  char **terms;
+  int nterms;
   const char *e = "unknown error";
 
   /* This is a bit of a bodge.  Initially it's there to make the eclient
    * interface a bit more convenient to add searching to, but it has the more
    * compelling advantage that if everything uses it, then interpretation of
    * user-supplied search strings will be the same everywhere. */
-  if(!(terms = split(vec[0], &nterms, SPLIT_QUOTES, search_parse_error, &e))) {
+  if(!(terms = split_inplace(&c->arena, vec[0], &nterms, SPLIT_QUOTES,
+                             search_parse_error, &e))) {
     sink_printf(ev_writer_sink(c->w), "550 %s\n", e);
-  } else {
-    results = trackdb_search(terms, nterms, &nresults);
-    sink_printf(ev_writer_sink(c->w), "253 %d matches\n", nresults);
-    for(n = 0; n < nresults; ++n)
-      sink_printf(ev_writer_sink(c->w), "%s\n", results[n]);
-    sink_writes(ev_writer_sink(c->w), ".\n");
+    return 1;
   }
-  return 1;
+  if(nvec > 1) {
+    /* A page of ranked results */
+    query_search_page(c->ev, terms, nterms,
+                      atoi(vec[1]), nvec > 2 ? atoi(vec[2]) : 0,
+                      search_page_done, c);
+    return conn_suspend(c);
+  }
+  query_search(c->ev, terms, nterms, search_done, c);
+  return conn_suspend(c);
+}
+
+static int c_search_prefix(struct conn *c,
+                           char **vec,
+                           int nvec) {
+  char **terms;
+  int nterms, max = 0;
+  const char *e = "unknown error";
+
+  if(!(terms = split_inplace(&c->arena, vec[0], &nterms, SPLIT_QUOTES,
+                             search_parse_error, &e))) {
+    sink_printf(ev_writer_sink(c->w), "550 %s\n", e);
+    return 1;
+  }
+  if(nvec > 1 && (max = atoi(vec[1])) < 0)
+    max = 0;
+  query_search_prefix(c->ev, terms, nterms, max, search_done, c);
+  return conn_suspend(c);
+}
+
+static int c_search_fuzzy(struct conn *c,
+                          char **vec,
+                          int nvec) {
+  char **terms;
+  int nterms, max = 0;
+  const char *e = "unknown error";
+
+  if(!(terms = split_inplace(&c->arena, vec[0], &nterms, SPLIT_QUOTES,
+                             search_parse_error, &e))) {
+    sink_printf(ev_writer_sink(c->w), "550 %s\n", e);
+    return 1;
+  }
+  if(nvec > 1 && (max = atoi(vec[1])) < 0)
+    max = 0;
+  query_search_fuzzy(c->ev, terms, nterms, max, search_done, c);
+  return conn_suspend(c);
 }
 
 static int c_random_enable(struct conn *c,
@@ -894,19 +1646,38 @@ static int c_random_enabled(struct conn *c,
   return 1;			/* completed */
 }
 
+static int list_response(struct conn *c,
+                         const char *reply,
+                         char **list) {
+  sink_printf(ev_writer_sink(c->w), "253 %s\n", reply);
+  while(*list) {
+    sink_printf(ev_writer_sink(c->w), "%s%s\n",
+		**list == '.' ? "." : "", *list);
+    ++list;
+  }
+  sink_writes(ev_writer_sink(c->w), ".\n");
+  return 1;				/* completed */
+}
+
 static void got_stats(char *stats, void *u) {
   struct conn *const c = u;
 
-  sink_printf(ev_writer_sink(c->w), "253 stats\n%s\n.\n", stats);
   /* Now we can start processing commands again */
-  ev_reader_enable(c->r);
+  if(!conn_resume(c))
+    return;
+  sink_printf(ev_writer_sink(c->w), "253 stats\n%s\n.\n", stats);
 }
 
 static int c_stats(struct conn *c,
 		   char attribute((unused)) **vec,
 		   int attribute((unused)) nvec) {
+  char **stats = trackdb_stats_quick(0);
+
+  if(stats)
+    return list_response(c, "stats", stats);
+  /* The counters have to be built first, which is slow */
   trackdb_stats_subprocess(c->ev, got_stats, c);
-  return 0;				/* not yet complete */
+  return conn_suspend(c);
 }
 
 static int c_volume(struct conn *c,
@@ -983,15 +1754,61 @@ static int logging_reader_callback(ev_source attribute((unused)) *ev,
   return 0;
 }
 
-static void logclient(const char *msg, void *user) {
-  struct conn *c = user;
+/** @brief Message that @ref log_frame was made from */
+static const char *log_frame_msg;
 
-  if(!c->w || !c->r) {
-    /* This connection has gone up in smoke for some reason */
-    eventlog_remove(c->lo);
-    c->lo = 0;
-    return;
-  }
+/** @brief Timestamp in @ref log_frame */
+static time_t log_frame_when;
+
+/** @brief Most recent event log line, as sent to clients */
+static char *log_frame;
+
+/** @brief Length of @ref log_frame */
+static size_t log_frame_len;
+
+/** @brief Message that @ref log_seq_frame was made from */
+static const char *log_seq_frame_msg;
+
+/** @brief Sequence number in @ref log_seq_frame */
+static unsigned long log_seq_frame_seq;
+
+/** @brief Most recent event log line, as sent to @b log-resume clients */
+static char *log_seq_frame;
+
+/** @brief Length of @ref log_seq_frame */
+static size_t log_seq_frame_len;
+
+/** @brief Test whether a connection wants an event
+ * @param c Connection
+ * @param msg Event message, or just its keyword
+ * @return Nonzero if @p c should get the event
+ */
+static int log_wanted(const struct conn *c, const char *msg) {
+  size_t len = strcspn(msg, " ");
+  int n;
+
+  if(!c->log_events)
+    return 1;
+  for(n = 0; n < c->nlog_events; ++n)
+    if(strlen(c->log_events[n]) == len
+       && !strncmp(c->log_events[n], msg, len))
+      return 1;
+  return 0;
+}
+
+/** @brief Send an event log message to one client
+ * @param c Connection
+ * @param seq Sequence number of the event
+ * @param when When the event happened
+ * @param msg Event message
+ *
+ * The line is formatted once per message and shared by every connection
+ * that gets it, without being copied into each writer.  (Keeping
+ * @ref log_frame_msg also stops the message pointer being reused for a
+ * different message while we remember it.)
+ */
+static void log_send(struct conn *c, unsigned long seq, time_t when,
+                     const char *msg) {
   /* user_* messages are restricted */
   if(!strncmp(msg, "user_", 5)) {
     /* They are only sent to admin users */
@@ -1002,38 +1819,119 @@ static void logclient(const char *msg, void *user) {
     if(!config->remote_userman && !(c->rights & RIGHT__LOCAL))
       return;
   }
-  sink_printf(ev_writer_sink(c->w), "%"PRIxMAX" %s\n",
-	      (uintmax_t)xtime(0), msg);
+  if(!log_wanted(c, msg))
+    return;
+  if(c->log_seq) {
+    if(msg != log_seq_frame_msg || seq != log_seq_frame_seq) {
+      log_seq_frame_len = byte_xasprintf(&log_seq_frame,
+                                         "%lx %"PRIxMAX" %s\n",
+                                         seq, (uintmax_t)when, msg);
+      log_seq_frame_msg = msg;
+      log_seq_frame_seq = seq;
+    }
+    ev_writer_reference(c->w, log_seq_frame, log_seq_frame_len);
+    return;
+  }
+  if(msg != log_frame_msg || when != log_frame_when) {
+    log_frame_len = byte_xasprintf(&log_frame, "%"PRIxMAX" %s\n",
+				   (uintmax_t)when, msg);
+    log_frame_msg = msg;
+    log_frame_when = when;
+  }
+  ev_writer_reference(c->w, log_frame, log_frame_len);
 }
 
-static int c_log(struct conn *c,
-		 char attribute((unused)) **vec,
-		 int attribute((unused)) nvec) {
+static void logclient(const char *msg, void *user) {
+  struct conn *c = user;
+
+  if(!c->w || !c->r) {
+    /* This connection has gone up in smoke for some reason */
+    eventlog_remove(c->lo);
+    c->lo = 0;
+    return;
+  }
+  log_send(c, eventlog_sequence(), xtime(0), msg);
+}
+
+/** @brief Called by eventlog_replay() for each missed event */
+static void log_replayed(unsigned long seq, time_t when, const char *msg,
+                         void *u) {
+  log_send(u, seq, when, msg);
+}
+
+/** @brief Start sending the event log to a connection
+ * @param c Connection
+ * @param resumed Nonzero if the client has already been sent the events it
+ * missed, so that it doesn't need the current state
+ */
+static void log_start(struct conn *c, int resumed) {
+  unsigned long seq = eventlog_sequence();
+  char *volume;
   time_t now;
 
-  sink_writes(ev_writer_sink(c->w), "254 OK\n");
-  /* pump out initial state */
-  xtime(&now);
-  sink_printf(ev_writer_sink(c->w), "%"PRIxMAX" state %s\n",
-	      (uintmax_t)now, 
-	      playing_is_enabled() ? "enable_play" : "disable_play");
-  sink_printf(ev_writer_sink(c->w), "%"PRIxMAX" state %s\n",
-	      (uintmax_t)now, 
-	      random_is_enabled() ? "enable_random" : "disable_random");
-  sink_printf(ev_writer_sink(c->w), "%"PRIxMAX" state %s\n",
-	      (uintmax_t)now, 
-	      paused ? "pause" : "resume");
-  if(playing)
-    sink_printf(ev_writer_sink(c->w), "%"PRIxMAX" state playing\n",
-		(uintmax_t)now);
-  /* Initial volume */
-  sink_printf(ev_writer_sink(c->w), "%"PRIxMAX" volume %d %d\n",
-	      (uintmax_t)now, volume_left, volume_right);
+  if(!resumed) {
+    /* pump out initial state */
+    xtime(&now);
+    log_send(c, seq, now,
+             playing_is_enabled() ? "state enable_play"
+                                  : "state disable_play");
+    log_send(c, seq, now,
+             random_is_enabled() ? "state enable_random"
+                                 : "state disable_random");
+    log_send(c, seq, now, paused ? "state pause" : "state resume");
+    if(playing)
+      log_send(c, seq, now, "state playing");
+    /* Initial volume */
+    byte_xasprintf(&volume, "volume %d %d", volume_left, volume_right);
+    log_send(c, seq, now, volume);
+  }
   c->lo = xmalloc(sizeof *c->lo);
   c->lo->fn = logclient;
   c->lo->user = c;
   eventlog_add(c->lo);
   c->reader = logging_reader_callback;
+}
+
+static int c_log(struct conn *c,
+		 char **vec,
+		 int nvec) {
+  if(nvec) {
+    /* The arguments outlast the command, but vec is in the arena */
+    c->log_events = xmalloc(nvec * sizeof *vec);
+    memcpy(c->log_events, vec, nvec * sizeof *vec);
+    c->nlog_events = nvec;
+  }
+  sink_writes(ev_writer_sink(c->w), "254 OK\n");
+  log_start(c, 0);
+  return 0;
+}
+
+static int c_log_resume(struct conn *c,
+                        char **vec,
+                        int nvec) {
+  unsigned long after;
+  char *end;
+  int resumed;
+
+  errno = 0;
+  after = strtoul(vec[0], &end, 16);
+  if(errno || end == vec[0] || *end) {
+    sink_writes(ev_writer_sink(c->w), "550 invalid sequence number\n");
+    return 1;
+  }
+  c->log_seq = 1;
+  if(nvec > 1) {
+    c->log_events = xmalloc((nvec - 1) * sizeof *vec);
+    memcpy(c->log_events, vec + 1, (nvec - 1) * sizeof *vec);
+    c->nlog_events = nvec - 1;
+  }
+  /* 0 means the client has never seen any events */
+  resumed = after && !eventlog_replay(after, 0, 0);
+  sink_writes(ev_writer_sink(c->w),
+              resumed ? "254 resumed\n" : "254 resync\n");
+  if(resumed)
+    eventlog_replay(after, log_replayed, c);
+  log_start(c, resumed);
   return 0;
 }
 
@@ -1105,7 +2003,9 @@ static int c_moveafter(struct conn *c,
 		"510 Not authorized to move those tracks\n");
     return 1;
   }
+  queue_batch_begin();
   queue_moveafter(q, nvec, qs, c->who);
+  queue_batch_end(c->who);
   sink_printf(ev_writer_sink(c->w), "250 Moved tracks\n");
   /* If we've moved to the head of the queue then prepare the track. */
   if(q == qhead.next)
@@ -1116,26 +2016,30 @@ static int c_moveafter(struct conn *c,
 static int c_part(struct conn *c,
 		  char **vec,
 		  int attribute((unused)) nvec) {
-  const char *track;
+  const char *track, *value;
 
   int do_transform = 0;
   if (nvec > 3)
       do_transform = atoi(vec[3]);
 
-  if(!(track = trackdb_resolve(vec[0]))) {
+  if(!part_cache_get(vec[0], vec[1], vec[2], do_transform, &value)) {
+    if(!(track = trackdb_resolve(vec[0])))
+      value = 0;
+    else if(do_transform) {
+      const char *type = "dir";
+      if (!strcmp(vec[2], "title"))
+        type = "track";
+      value = trackname_transform(type, trackdb_getpart(track, vec[1], vec[2]),
+                                  vec[1]);
+    } else
+      value = trackdb_getpart(track, vec[1], vec[2]);
+    part_cache_put(vec[0], vec[1], vec[2], do_transform, value);
+  }
+  if(!value) {
     sink_writes(ev_writer_sink(c->w), "550 cannot resolve track\n");
     return 1;
   }
-  if(do_transform) {
-    const char *type = "dir";
-    if (!strcmp(vec[2], "title"))
-      type = "track";
-    sink_printf(ev_writer_sink(c->w), "252 %s\n",
-        quoteutf8(trackname_transform(type, trackdb_getpart(track, vec[1], vec[2]), vec[1])));
-  } else {
-    sink_printf(ev_writer_sink(c->w), "252 %s\n",
-	    quoteutf8(trackdb_getpart(track, vec[1], vec[2])));
-  }
+  sink_printf(ev_writer_sink(c->w), "252 %s\n", quoteutf8(value));
   return 1;
 }
 
@@ -1152,17 +2056,22 @@ static int c_resolve(struct conn *c,
   return 1;
 }
 
-static int list_response(struct conn *c,
-                         const char *reply,
-                         char **list) {
-  sink_printf(ev_writer_sink(c->w), "253 %s\n", reply);
-  while(*list) {
-    sink_printf(ev_writer_sink(c->w), "%s%s\n",
-		**list == '.' ? "." : "", *list);
-    ++list;
+static int c_event_stats(struct conn *c,
+			 char attribute((unused)) **vec,
+			 int attribute((unused)) nvec) {
+  return list_response(c, "Event loop statistics follow", ev_timings(c->ev));
+}
+
+static int c_db_stats(struct conn *c,
+		      char attribute((unused)) **vec,
+		      int attribute((unused)) nvec) {
+  char **stats = trackdb_env_stats(0);
+
+  if(!stats) {
+    sink_writes(ev_writer_sink(c->w), "550 cannot get database statistics\n");
+    return 1;
   }
-  sink_writes(ev_writer_sink(c->w), ".\n");
-  return 1;				/* completed */
+  return list_response(c, "Database statistics follow", stats);
 }
 
 static int c_tags(struct conn *c,
@@ -1213,11 +2122,86 @@ static int c_nop(struct conn *c,
   return 1;
 }
 
+#if HAVE_ZLIB_H
+/** @brief @ref ev_writer_filter_callback for compressed connections */
+static int deflate_filter(ev_writer *w, const void *ptr, size_t n, void *u) {
+  struct conn *c = u;
+  z_stream *const z = c->deflater;
+  unsigned char buffer[4096];
+  int rc;
+
+  if(!z)
+    return 0;				/* connection is going away */
+  z->next_in = (Bytef *)ptr;
+  z->avail_in = n;
+  do {
+    z->next_out = buffer;
+    z->avail_out = sizeof buffer;
+    rc = deflate(z, ptr ? Z_NO_FLUSH : Z_SYNC_FLUSH);
+    if(rc != Z_OK && rc != Z_BUF_ERROR) {
+      disorder_error(0, "S%x deflate: %s", c->tag, z->msg ? z->msg : "error");
+      return -1;
+    }
+    if((rc = ev_writer_raw(w, buffer, sizeof buffer - z->avail_out)))
+      return rc;
+  } while(z->avail_in || !z->avail_out);
+  return 0;
+}
+#endif
+
+static int c_compress(struct conn *c,
+                      char **vec,
+                      int attribute((unused)) nvec) {
+#if HAVE_ZLIB_H
+  z_stream *z;
+#endif
+
+  if(strcmp(vec[0], "deflate")) {
+    sink_writes(ev_writer_sink(c->w), "550 unsupported compression\n");
+    return 1;
+  }
+#if HAVE_ZLIB_H
+  if(c->deflater) {
+    sink_writes(ev_writer_sink(c->w), "550 already compressing\n");
+    return 1;
+  }
+  z = xmalloc(sizeof *z);
+  if(deflateInit(z, Z_DEFAULT_COMPRESSION) != Z_OK) {
+    disorder_error(0, "S%x deflateInit: %s", c->tag,
+                   z->msg ? z->msg : "error");
+    sink_writes(ev_writer_sink(c->w), "550 cannot compress\n");
+    return 1;
+  }
+  /* The response itself is not compressed; everything after it is */
+  sink_writes(ev_writer_sink(c->w), "250 OK\n");
+  c->deflater = z;
+  ev_writer_filter(c->w, deflate_filter, c);
+#else
+  sink_writes(ev_writer_sink(c->w), "550 unsupported compression\n");
+#endif
+  return 1;
+}
+
+static void new_done(char **tracks,
+		     int attribute((unused)) ntracks,
+		     void *u) {
+  struct conn *c = u;
+
+  if(!conn_resume(c))
+    return;
+  sink_printf(ev_writer_sink(c->w), "253 New track list follows\n");
+  while(*tracks) {
+    sink_printf(ev_writer_sink(c->w), "%s%s\n",
+		**tracks == '.' ? "." : "", *tracks);
+    ++tracks;
+  }
+  sink_writes(ev_writer_sink(c->w), ".\n");
+}
+
 static int c_new(struct conn *c,
 		 char **vec,
 		 int nvec) {
   int max;
-  char **tracks;
 
   if(nvec > 0)
     max = atoi(vec[0]);
@@ -1225,22 +2209,15 @@ static int c_new(struct conn *c,
     max = INT_MAX;
   if(max <= 0 || max > config->new_max)
     max = config->new_max;
-  tracks = trackdb_new(0, max);
-  sink_printf(ev_writer_sink(c->w), "253 New track list follows\n");
-  while(*tracks) {
-    sink_printf(ev_writer_sink(c->w), "%s%s\n",
-		**tracks == '.' ? "." : "", *tracks);
-    ++tracks;
-  }
-  sink_writes(ev_writer_sink(c->w), ".\n");
-  return 1;				/* completed */
-
+  query_new(c->ev, max, new_done, c);
+  return conn_suspend(c);
 }
 
 static int c_rtp_address(struct conn *c,
 			 char attribute((unused)) **vec,
 			 int attribute((unused)) nvec) {
-  if(api == &uaudio_rtp) {
+  if(api == &uaudio_rtp
+     || (api == &uaudio_multi && uaudio_multi_uses(&uaudio_rtp))) {
     char **addr;
 
     if(!strcmp(config->rtp_mode, "request"))
@@ -1269,9 +2246,54 @@ static int c_rtp_cancel(struct conn *c,
   return 1;
 }
 
+static int c_rtp_report(struct conn *c,
+                        char **vec,
+                        int attribute((unused)) nvec) {
+  long n[3];
+  char *e;
+  int i;
+
+  for(i = 0; i < 3; ++i)
+    if(xstrtol(&n[i], vec[i], &e, 10) || *e || e == vec[i]) {
+      sink_writes(ev_writer_sink(c->w), "550 Invalid report\n");
+      return 1;
+    }
+  c->rtp_expected = n[0];
+  c->rtp_lost = n[1];
+  c->rtp_jitter = n[2];
+  c->rtp_report_when = xtime(0);
+  sink_writes(ev_writer_sink(c->w), "250 OK\n");
+  return 1;
+}
+
+static int c_rtp_stats(struct conn *c,
+                       char attribute((unused)) **vec,
+                       int attribute((unused)) nvec) {
+  struct vector v[1];
+  struct conn *d;
+  char *s;
+  const time_t now = xtime(0);
+
+  vector_init(v);
+  for(d = connections; d; d = d->next)
+    if(d->rtp_report_when) {
+      byte_xasprintf(&s, "%s %s %ld %ld %ld %ld",
+                     quoteutf8(d->who ? d->who : "-"),
+                     quoteutf8(d->rtp_requested
+                               ? format_sockaddr((struct sockaddr *)
+                                                 &d->rtp_destination)
+                               : "-"),
+                     d->rtp_expected, d->rtp_lost, d->rtp_jitter,
+                     (long)(now - d->rtp_report_when));
+      vector_append(v, s);
+    }
+  vector_terminate(v);
+  return list_response(c, "RTP statistics follow", v->vec);
+}
+
 static int c_rtp_request(struct conn *c,
                          char **vec,
-                         int attribute((unused)) nvec) {
+                         int nvec) {
   static const struct addrinfo hints = {
     .ai_family = AF_UNSPEC,
     .ai_socktype = SOCK_DGRAM,
@@ -1279,6 +2301,21 @@ static int c_rtp_request(struct conn *c,
     .ai_flags = AI_NUMERICHOST|AI_NUMERICSERV,
   };
   struct addrinfo *res;
+  int codec;
+
+  if(nvec < 3 || !strcmp(vec[2], "l16"))
+    codec = RTP_CODEC_L16;
+  else if(!strcmp(vec[2], "opus")) {
+#if HAVE_OPUS_OPUS_H
+    codec = RTP_CODEC_OPUS;
+#else
+    sink_writes(ev_writer_sink(c->w), "550 Opus not supported\n");
+    return 1;
+#endif
+  } else {
+    sink_writes(ev_writer_sink(c->w), "550 Unknown codec\n");
+    return 1;
+  }
   int rc = getaddrinfo(vec[0], vec[1], &hints, &res);
   if(rc) {
     disorder_error(0, "%s port %s: %s",
@@ -1286,7 +2323,8 @@ static int c_rtp_request(struct conn *c,
     sink_writes(ev_writer_sink(c->w), "550 Invalid address\n");
     return 1;
   }
-  disorder_info("%s requested RTP stream to %s %s", c->who, vec[0], vec[1]);
+  disorder_info("%s requested %s RTP stream to %s %s", c->who,
+                codec == RTP_CODEC_OPUS ? "Opus" : "L16", vec[0], vec[1]);
   /* TODO might be useful to tighten this up to restrict clients to targetting
    * themselves only */
   if(c->rtp_requested) {
@@ -1295,7 +2333,7 @@ static int c_rtp_request(struct conn *c,
   }
   memcpy(&c->rtp_destination, res->ai_addr, res->ai_addrlen);
   freeaddrinfo(res);
-  rtp_request(&c->rtp_destination);
+  rtp_request(&c->rtp_destination, codec);
   c->rtp_requested = 1;
   sink_writes(ev_writer_sink(c->w), "250 Initiated RTP stream\n");
   // TODO teardown on connection close
@@ -1326,6 +2364,8 @@ static int c_cookie(struct conn *c,
     return 1;
   }
   /* Log in */
+  if(user_admit(c, user))
+    return 1;
   c->who = user;
   c->cookie = vec[0];
   c->rights = rights;
@@ -1547,9 +2587,13 @@ static int c_confirm(struct conn *c,
     return 1;
   }
   user = xstrndup(vec[0], sep - vec[0]);
-  if(trackdb_confirm(user, vec[0], &rights))
+  /* Check the limit first, so as not to waste the confirmation */
+  if(user_admit(c, user))
+    return 1;
+  if(trackdb_confirm(user, vec[0], &rights)) {
+    user_release(c);
     sink_writes(ev_writer_sink(c->w), "510 Incorrect confirmation string\n");
-  else {
+  } else {
     c->who = user;
     c->cookie = 0;
     c->rights = rights;
@@ -1772,6 +2816,7 @@ static int c_adopt(struct conn *c,
   q->origin = origin_adopted;
   q->submitter = xstrdup(c->who);
   eventlog("adopted", q->id, q->submitter, (char *)0);
+  queue_updated(q);
   queue_write();
   sink_writes(ev_writer_sink(c->w), "250 OK\n");
   return 1;
@@ -1791,6 +2836,9 @@ static int playlist_response(struct conn *c,
   case ENOENT:
     sink_writes(ev_writer_sink(c->w), "555 No such playlist\n");
     break;
+  case ERANGE:
+    sink_writes(ev_writer_sink(c->w), "550 Invalid playlist position\n");
+    break;
   default:
     sink_writes(ev_writer_sink(c->w), "550 Error accessing playlist\n");
     break;
@@ -1810,12 +2858,111 @@ static int c_playlist_get(struct conn *c,
     return playlist_response(c, err);
 }
 
+/** @brief Add a whole playlist to the queue
+ *
+ * Tracks that are no longer in the database are skipped.  The queue is only
+ * written once, however long the playlist.
+ */
+static int c_playlist_play(struct conn *c,
+                           char **vec,
+                           int nvec) {
+  char **tracks, *t;
+  const char *track, *afterme = NULL;
+  struct queue_entry *q = NULL;
+  int err, ntracks, n, m, queued = 0, where = WHERE_BEFORE_RANDOM;
+
+  if(nvec > 1 && strcmp(vec[1], "in-order") && strcmp(vec[1], "shuffle")) {
+    sink_writes(ev_writer_sink(c->w), "550 invalid argument\n");
+    return 1;
+  }
+  if(nvec > 2) {
+    where = WHERE_AFTER;
+    afterme = vec[2];
+    if(*afterme && !queue_find_id(afterme)) {
+      sink_writes(ev_writer_sink(c->w), "550 No such ID\n");
+      return 1;
+    }
+  }
+  if((err = trackdb_playlist_get(vec[0], c->who, &tracks, &ntracks, 0)))
+    return playlist_response(c, err);
+  if(nvec > 1 && !strcmp(vec[1], "shuffle")) {
+    for(n = ntracks - 1; n > 0; --n) {
+      m = choose_pick_weight(n + 1);
+      t = tracks[n];
+      tracks[n] = tracks[m];
+      tracks[m] = t;
+    }
+  }
+  queue_batch_begin();
+  for(n = 0; n < ntracks; ++n) {
+    if(!trackdb_exists(tracks[n])
+       || !(track = trackdb_resolve(tracks[n])))
+      continue;
+    q = queue_add(track, c->who, where, afterme, origin_picked);
+    afterme = q->id;
+    ++queued;
+  }
+  queue_batch_end(c->who);
+  if(!q) {
+    sink_writes(ev_writer_sink(c->w), "550 No playable tracks in playlist\n");
+    return 1;
+  }
+  disorder_info("%s added %d tracks from playlist %s", c->who, queued, vec[0]);
+  sink_printf(ev_writer_sink(c->w), "252 %s\n", q->id);
+  /* As for c_play() */
+  if(qhead.next != &qhead)
+    prepare(c->ev, qhead.next);
+  if(!playing)
+    resume_playing(0);
+  play(c->ev);
+  return 1;
+}
+
 static int c_playlist_set(struct conn *c,
 			  char **vec,
 			  int attribute((unused)) nvec) {
   return fetch_body(c, c_playlist_set_body, vec[0]);
 }
 
+/** @brief Check that @p playlist is locked by @p c
+ * @return 1 if it is, else 0 after sending an error response
+ */
+static int playlist_is_locked(struct conn *c,
+                              const char *playlist) {
+  if(!c->locked_playlist
+     || strcmp(playlist, c->locked_playlist)) {
+    sink_writes(ev_writer_sink(c->w), "550 Playlist is not locked\n");
+    return 0;
+  }
+  return 1;
+}
+
+/** @brief Parse playlist positions and counts
+ * @param c Connection
+ * @param vec Arguments to parse
+ * @param nvec Number of arguments
+ * @param n Where to put the values
+ * @return 1 on success, else 0 after sending an error response
+ */
+static int playlist_positions(struct conn *c,
+                              char **vec,
+                              int nvec,
+                              int *n) {
+  long l;
+  char *e;
+  int i;
+
+  for(i = 0; i < nvec; ++i) {
+    if(xstrtol(&l, vec[i], &e, 10) || *e || e == vec[i]
+       || l < 0 || l > INT_MAX) {
+      sink_writes(ev_writer_sink(c->w), "550 Invalid playlist position\n");
+      return 0;
+    }
+    n[i] = l;
+  }
+  return 1;
+}
+
 static int c_playlist_set_body(struct conn *c,
                                char **body,
                                int nbody,
@@ -1823,11 +2970,8 @@ static int c_playlist_set_body(struct conn *c,
   const char *playlist = u;
   int err;
 
-  if(!c->locked_playlist
-     || strcmp(playlist, c->locked_playlist)) {
-    sink_writes(ev_writer_sink(c->w), "550 Playlist is not locked\n");
+  if(!playlist_is_locked(c, playlist))
     return 1;
-  }
   if(!(err = trackdb_playlist_set(playlist, c->who,
                                   body, nbody, 0))) {
     sink_printf(ev_writer_sink(c->w), "250 OK\n");
@@ -1836,6 +2980,64 @@ static int c_playlist_set_body(struct conn *c,
     return playlist_response(c, err);
 }
 
+static int c_playlist_insert(struct conn *c,
+                             char **vec,
+                             int attribute((unused)) nvec) {
+  /* The arguments are checked once the body has been read */
+  return fetch_body(c, c_playlist_insert_body, vec);
+}
+
+static int c_playlist_insert_body(struct conn *c,
+                                  char **body,
+                                  int nbody,
+                                  void *u) {
+  char **vec = u;
+  int position, err;
+
+  if(!playlist_positions(c, vec + 1, 1, &position))
+    return 1;
+  if(!playlist_is_locked(c, vec[0]))
+    return 1;
+  if(!(err = trackdb_playlist_insert(vec[0], c->who, position,
+                                     body, nbody))) {
+    sink_writes(ev_writer_sink(c->w), "250 OK\n");
+    return 1;
+  } else
+    return playlist_response(c, err);
+}
+
+static int c_playlist_remove(struct conn *c,
+                             char **vec,
+                             int attribute((unused)) nvec) {
+  int n[2], err;
+
+  if(!playlist_positions(c, vec + 1, 2, n))
+    return 1;
+  if(!playlist_is_locked(c, vec[0]))
+    return 1;
+  if(!(err = trackdb_playlist_remove(vec[0], c->who, n[0], n[1]))) {
+    sink_writes(ev_writer_sink(c->w), "250 OK\n");
+    return 1;
+  } else
+    return playlist_response(c, err);
+}
+
+static int c_playlist_move(struct conn *c,
+                           char **vec,
+                           int attribute((unused)) nvec) {
+  int n[3], err;
+
+  if(!playlist_positions(c, vec + 1, 3, n))
+    return 1;
+  if(!playlist_is_locked(c, vec[0]))
+    return 1;
+  if(!(err = trackdb_playlist_move(vec[0], c->who, n[0], n[1], n[2]))) {
+    sink_writes(ev_writer_sink(c->w), "250 OK\n");
+    return 1;
+  } else
+    return playlist_response(c, err);
+}
+
 static int c_playlist_get_share(struct conn *c,
                                 char **vec,
                                 int attribute((unused)) nvec) {
@@ -1924,6 +3126,21 @@ static int c_playlist_unlock(struct conn *c,
 }
 
 /** @brief Server's definition of a command */
+/** @brief A replica executes this command itself
+ *
+ * Other commands are passed on to the primary by a replica.
+ */
+#define SC_LOCAL 0x0001
+
+/** @brief This command has a body */
+#define SC_BODY 0x0002
+
+/** @brief A 232 response to this command logs the connection in */
+#define SC_LOGIN 0x0004
+
+/** @brief This command's response lasts as long as the connection */
+#define SC_LOG 0x0008
+
 static const struct server_command {
   /** @brief Command name */
   const char *name;
@@ -1943,79 +3160,476 @@ static const struct server_command {
    * bits are listed here any of those rights will do.
    */
   rights_type rights;
+
+  /** @brief Flags
+   *
+   * Any combination of @ref SC_LOCAL, @ref SC_BODY, @ref SC_LOGIN and
+   * @ref SC_LOG.
+   */
+  unsigned flags;
 } commands[] = {
-  { "adduser",        2, 3,       c_adduser,        RIGHT_ADMIN },
-  { "adopt",          1, 1,       c_adopt,          RIGHT_PLAY },
-  { "allfiles",       0, 2,       c_allfiles,       RIGHT_READ },
-  { "confirm",        1, 1,       c_confirm,        0 },
-  { "cookie",         1, 1,       c_cookie,         0 },
-  { "deluser",        1, 1,       c_deluser,        RIGHT_ADMIN },
-  { "dirs",           0, 2,       c_dirs,           RIGHT_READ },
-  { "disable",        0, 1,       c_disable,        RIGHT_GLOBAL_PREFS },
-  { "edituser",       3, 3,       c_edituser,       RIGHT_ADMIN|RIGHT_USERINFO },
-  { "enable",         0, 0,       c_enable,         RIGHT_GLOBAL_PREFS },
-  { "enabled",        0, 0,       c_enabled,        RIGHT_READ },
-  { "exists",         1, 1,       c_exists,         RIGHT_READ },
-  { "files",          0, 2,       c_files,          RIGHT_READ },
-  { "get",            2, 2,       c_get,            RIGHT_READ },
-  { "get-global",     1, 1,       c_get_global,     RIGHT_READ },
-  { "length",         1, 1,       c_length,         RIGHT_READ },
-  { "log",            0, 0,       c_log,            RIGHT_READ },
-  { "make-cookie",    0, 0,       c_make_cookie,    RIGHT_READ },
-  { "move",           2, 2,       c_move,           RIGHT_MOVE__MASK },
-  { "moveafter",      1, INT_MAX, c_moveafter,      RIGHT_MOVE__MASK },
-  { "new",            0, 1,       c_new,            RIGHT_READ },
-  { "nop",            0, 0,       c_nop,            0 },
-  { "part",           3, 4,       c_part,           RIGHT_READ },
-  { "pause",          0, 0,       c_pause,          RIGHT_PAUSE },
-  { "play",           1, 1,       c_play,           RIGHT_PLAY },
-  { "playafter",      2, INT_MAX, c_playafter,      RIGHT_PLAY },
-  { "playing",        0, 0,       c_playing,        RIGHT_READ },
-  { "playlist-delete",    1, 1,   c_playlist_delete,    RIGHT_PLAY },
-  { "playlist-get",       1, 1,   c_playlist_get,       RIGHT_READ },
-  { "playlist-get-share", 1, 1,   c_playlist_get_share, RIGHT_READ },
-  { "playlist-lock",      1, 1,   c_playlist_lock,      RIGHT_PLAY },
-  { "playlist-set",       1, 1,   c_playlist_set,       RIGHT_PLAY },
-  { "playlist-set-share", 2, 2,   c_playlist_set_share, RIGHT_PLAY },
-  { "playlist-unlock",    0, 0,   c_playlist_unlock,    RIGHT_PLAY },
-  { "playlists",          0, 0,   c_playlists,          RIGHT_READ },
-  { "prefs",          1, 1,       c_prefs,          RIGHT_READ },
-  { "queue",          0, 0,       c_queue,          RIGHT_READ },
-  { "random-disable", 0, 0,       c_random_disable, RIGHT_GLOBAL_PREFS },
-  { "random-enable",  0, 0,       c_random_enable,  RIGHT_GLOBAL_PREFS },
-  { "random-enabled", 0, 0,       c_random_enabled, RIGHT_READ },
-  { "recent",         0, 0,       c_recent,         RIGHT_READ },
-  { "reconfigure",    0, 0,       c_reconfigure,    RIGHT_ADMIN },
-  { "register",       3, 3,       c_register,       RIGHT_REGISTER },
-  { "reminder",       1, 1,       c_reminder,       RIGHT__LOCAL },
-  { "remove",         1, 1,       c_remove,         RIGHT_REMOVE__MASK },
-  { "rescan",         0, INT_MAX, c_rescan,         RIGHT_RESCAN },
-  { "resolve",        1, 1,       c_resolve,        RIGHT_READ },
-  { "resume",         0, 0,       c_resume,         RIGHT_PAUSE },
-  { "revoke",         0, 0,       c_revoke,         RIGHT_READ },
-  { "rtp-address",    0, 0,       c_rtp_address,    0 },
-  { "rtp-cancel",     0, 0,       c_rtp_cancel,     0 },
-  { "rtp-request",    2, 2,       c_rtp_request,    RIGHT_READ },
-  { "schedule-add",   3, INT_MAX, c_schedule_add,   RIGHT_READ },
-  { "schedule-del",   1, 1,       c_schedule_del,   RIGHT_READ },
-  { "schedule-get",   1, 1,       c_schedule_get,   RIGHT_READ },
-  { "schedule-list",  0, 0,       c_schedule_list,  RIGHT_READ },
-  { "scratch",        0, 1,       c_scratch,        RIGHT_SCRATCH__MASK },
-  { "search",         1, 1,       c_search,         RIGHT_READ },
-  { "set",            3, 3,       c_set,            RIGHT_PREFS, },
-  { "set-global",     2, 2,       c_set_global,     RIGHT_GLOBAL_PREFS },
-  { "shutdown",       0, 0,       c_shutdown,       RIGHT_ADMIN },
-  { "stats",          0, 0,       c_stats,          RIGHT_READ },
-  { "tags",           0, 0,       c_tags,           RIGHT_READ },
-  { "unset",          2, 2,       c_set,            RIGHT_PREFS },
-  { "unset-global",   1, 1,       c_set_global,     RIGHT_GLOBAL_PREFS },
-  { "user",           2, 2,       c_user,           0 },
-  { "userinfo",       2, 2,       c_userinfo,       RIGHT_READ },
-  { "users",          0, 0,       c_users,          RIGHT_READ },
-  { "version",        0, 0,       c_version,        RIGHT_READ },
-  { "volume",         0, 2,       c_volume,         RIGHT_READ|RIGHT_VOLUME }
+  { "adduser",        2, 3,       c_adduser,        RIGHT_ADMIN, 0 },
+  { "adopt",          1, 1,       c_adopt,          RIGHT_PLAY, 0 },
+  { "allfiles",       0, 2,       c_allfiles,       RIGHT_READ, SC_LOCAL },
+  { "compress",       1, 1,       c_compress,       RIGHT_READ, SC_LOCAL },
+  { "confirm",        1, 1,       c_confirm,        0, SC_LOGIN },
+  { "cookie",         1, 1,       c_cookie,         0, SC_LOGIN },
+  { "db-stats",       0, 0,       c_db_stats,       RIGHT_ADMIN, SC_LOCAL },
+  { "deluser",        1, 1,       c_deluser,        RIGHT_ADMIN, 0 },
+  { "dir-summaries",  0, INT_MAX, c_dir_summaries,  RIGHT_READ, SC_LOCAL },
+  { "dirs",           0, 2,       c_dirs,           RIGHT_READ, SC_LOCAL },
+  { "disable",        0, 1,       c_disable,        RIGHT_GLOBAL_PREFS, 0 },
+  { "edituser",       3, 3,       c_edituser,
+    RIGHT_ADMIN|RIGHT_USERINFO, 0 },
+  { "enable",         0, 0,       c_enable,         RIGHT_GLOBAL_PREFS, 0 },
+  { "enabled",        0, 0,       c_enabled,        RIGHT_READ, 0 },
+  { "event-stats",    0, 0,       c_event_stats,    RIGHT_ADMIN, 0 },
+  { "exists",         1, 1,       c_exists,         RIGHT_READ, SC_LOCAL },
+  { "files",          0, 2,       c_files,          RIGHT_READ, SC_LOCAL },
+  { "forwarded-for",  1, 1,       c_forwarded_for,  0,          SC_LOCAL },
+  { "get",            2, 2,       c_get,            RIGHT_READ, SC_LOCAL },
+  { "get-global",     1, 1,       c_get_global,     RIGHT_READ, SC_LOCAL },
+  { "length",         1, 1,       c_length,         RIGHT_READ, SC_LOCAL },
+  { "lengths-multi",  0, INT_MAX, c_lengths_multi,  RIGHT_READ, SC_LOCAL },
+  { "log",            0, INT_MAX, c_log,            RIGHT_READ, SC_LOG },
+  { "log-resume",     1, INT_MAX, c_log_resume,     RIGHT_READ, SC_LOG },
+  { "make-cookie",    0, 0,       c_make_cookie,    RIGHT_READ, 0 },
+  { "metrics",        0, 0,       c_metrics,        RIGHT_ADMIN, SC_LOCAL },
+  { "move",           2, 2,       c_move,           RIGHT_MOVE__MASK, 0 },
+  { "moveafter",      1, INT_MAX, c_moveafter,      RIGHT_MOVE__MASK, 0 },
+  { "new",            0, 1,       c_new,            RIGHT_READ, SC_LOCAL },
+  { "nop",            0, 0,       c_nop,            0, SC_LOCAL },
+  { "part",           3, 4,       c_part,           RIGHT_READ, SC_LOCAL },
+  { "parts-multi",    2, INT_MAX, c_parts_multi,    RIGHT_READ, SC_LOCAL },
+  { "pause",          0, 0,       c_pause,          RIGHT_PAUSE, 0 },
+  { "play",           1, 1,       c_play,           RIGHT_PLAY, 0 },
+  { "playafter",      2, INT_MAX, c_playafter,      RIGHT_PLAY, 0 },
+  { "playing",        0, 0,       c_playing,        RIGHT_READ, 0 },
+  { "playlist-delete",    1, 1,   c_playlist_delete,    RIGHT_PLAY, 0 },
+  { "playlist-get",       1, 1,   c_playlist_get,       RIGHT_READ, SC_LOCAL },
+  { "playlist-get-share", 1, 1,   c_playlist_get_share, RIGHT_READ, SC_LOCAL },
+  { "playlist-insert",    2, 2,   c_playlist_insert,    RIGHT_PLAY, SC_BODY },
+  { "playlist-lock",      1, 1,   c_playlist_lock,      RIGHT_PLAY, 0 },
+  { "playlist-move",      4, 4,   c_playlist_move,      RIGHT_PLAY, 0 },
+  { "playlist-play",      1, 3,   c_playlist_play,      RIGHT_PLAY, 0 },
+  { "playlist-remove",    3, 3,   c_playlist_remove,    RIGHT_PLAY, 0 },
+  { "playlist-set",       1, 1,   c_playlist_set,       RIGHT_PLAY, SC_BODY },
+  { "playlist-set-share", 2, 2,   c_playlist_set_share, RIGHT_PLAY, 0 },
+  { "playlist-unlock",    0, 0,   c_playlist_unlock,    RIGHT_PLAY, 0 },
+  { "playlists",          0, 0,   c_playlists,          RIGHT_READ, SC_LOCAL },
+  { "prefs",          1, 1,       c_prefs,          RIGHT_READ, SC_LOCAL },
+  { "prefs-multi",    0, INT_MAX, c_prefs_multi,    RIGHT_READ, SC_LOCAL },
+  { "queue",          0, 0,       c_queue,          RIGHT_READ, 0 },
+  { "queue-changes",  1, 1,       c_queue_changes,  RIGHT_READ, 0 },
+  { "queue-generation", 0, 0,     c_queue_generation, RIGHT_READ, 0 },
+  { "random-disable", 0, 0,       c_random_disable, RIGHT_GLOBAL_PREFS, 0 },
+  { "random-enable",  0, 0,       c_random_enable,  RIGHT_GLOBAL_PREFS, 0 },
+  { "random-enabled", 0, 0,       c_random_enabled, RIGHT_READ, 0 },
+  { "recent",         0, 0,       c_recent,         RIGHT_READ, 0 },
+  { "reconfigure",    0, 0,       c_reconfigure,    RIGHT_ADMIN, 0 },
+  { "register",       3, 3,       c_register,       RIGHT_REGISTER, 0 },
+  { "reminder",       1, 1,       c_reminder,       RIGHT__LOCAL, 0 },
+  { "remove",         1, 1,       c_remove,         RIGHT_REMOVE__MASK, 0 },
+  { "rescan",         0, INT_MAX, c_rescan,         RIGHT_RESCAN, 0 },
+  { "resolve",        1, 1,       c_resolve,        RIGHT_READ, SC_LOCAL },
+  { "resume",         0, 0,       c_resume,         RIGHT_PAUSE, 0 },
+  { "revoke",         0, 0,       c_revoke,         RIGHT_READ, 0 },
+  { "rtp-address",    0, 0,       c_rtp_address,    0, 0 },
+  { "rtp-cancel",     0, 0,       c_rtp_cancel,     0, 0 },
+  { "rtp-report",     3, 3,       c_rtp_report,     RIGHT_READ, 0 },
+  { "rtp-request",    2, 3,       c_rtp_request,    RIGHT_READ, 0 },
+  { "rtp-stats",      0, 0,       c_rtp_stats,      RIGHT_ADMIN, 0 },
+  { "schedule-add",   3, INT_MAX, c_schedule_add,   RIGHT_READ, 0 },
+  { "schedule-del",   1, 1,       c_schedule_del,   RIGHT_READ, 0 },
+  { "schedule-get",   1, 1,       c_schedule_get,   RIGHT_READ, 0 },
+  { "schedule-list",  0, 0,       c_schedule_list,  RIGHT_READ, 0 },
+  { "scratch",        0, 1,       c_scratch,        RIGHT_SCRATCH__MASK, 0 },
+  { "search",         1, 3,       c_search,         RIGHT_READ, SC_LOCAL },
+  { "search-fuzzy",   1, 2,       c_search_fuzzy,   RIGHT_READ, SC_LOCAL },
+  { "search-prefix",  1, 2,       c_search_prefix,  RIGHT_READ, SC_LOCAL },
+  { "set",            3, 3,       c_set,            RIGHT_PREFS, 0 },
+  { "set-global",     2, 2,       c_set_global,     RIGHT_GLOBAL_PREFS, 0 },
+  { "shutdown",       0, 0,       c_shutdown,       RIGHT_ADMIN, 0 },
+  { "state-generation", 0, 0,     c_state_generation, RIGHT_READ, 0 },
+  { "stats",          0, 0,       c_stats,          RIGHT_READ, SC_LOCAL },
+  { "tags",           0, 0,       c_tags,           RIGHT_READ, SC_LOCAL },
+  { "track-generation", 0, 0,     c_track_generation, RIGHT_READ, SC_LOCAL },
+  { "unset",          2, 2,       c_set,            RIGHT_PREFS, 0 },
+  { "unset-global",   1, 1,       c_set_global,     RIGHT_GLOBAL_PREFS, 0 },
+  { "user",           2, 2,       c_user,           0, SC_LOCAL },
+  { "userinfo",       2, 2,       c_userinfo,       RIGHT_READ, SC_LOCAL },
+  { "users",          0, 0,       c_users,          RIGHT_READ, SC_LOCAL },
+  { "version",        0, 0,       c_version,        RIGHT_READ, SC_LOCAL },
+  { "volume",         0, 2,       c_volume,
+    RIGHT_READ|RIGHT_VOLUME, 0 }
+};
+
+/* command metrics ***********************************************************/
+
+/** @brief Upper bounds of the command latency histogram buckets
+ *
+ * There is an implicit final bucket for anything slower than the last.
+ */
+static const struct latency_bucket {
+  /** @brief Upper bound in microseconds */
+  int64_t us;
+
+  /** @brief Upper bound in seconds, as written in @c metrics output */
+  const char *le;
+} latency_buckets[] = {
+  { 100, "0.0001" },
+  { 250, "0.00025" },
+  { 500, "0.0005" },
+  { 1000, "0.001" },
+  { 2500, "0.0025" },
+  { 5000, "0.005" },
+  { 10000, "0.01" },
+  { 25000, "0.025" },
+  { 50000, "0.05" },
+  { 100000, "0.1" },
+  { 250000, "0.25" },
+  { 500000, "0.5" },
+  { 1000000, "1" },
+  { 2500000, "2.5" },
+  { 5000000, "5" },
+  { 10000000, "10" },
+};
+
+/** @brief Number of entries in @ref latency_buckets */
+#define LATENCY_BUCKETS (sizeof latency_buckets / sizeof *latency_buckets)
+
+/** @brief Accumulated statistics for one command */
+struct command_metrics {
+  /** @brief Number of times the command has completed */
+  unsigned long count;
+
+  /** @brief Number of those that got an error response */
+  unsigned long errors;
+
+  /** @brief Total time from command to response, in microseconds */
+  int64_t total_us;
+
+  /** @brief Total time spent in database transactions, in microseconds */
+  int64_t trackdb_us;
+
+  /** @brief Latency histogram
+   *
+   * Entry @c n counts commands within @ref latency_buckets entry @c n but not
+   * @c n-1.  The last entry counts everything slower than that.
+   */
+  unsigned long buckets[LATENCY_BUCKETS + 1];
 };
 
+/** @brief Statistics for each entry in @ref commands */
+static struct command_metrics command_metrics[sizeof commands
+                                             / sizeof *commands];
+
+/** @brief Record a completed command
+ * @param c Connection
+ */
+static void command_finished(struct conn *c) {
+  struct command_metrics *const m = c->metrics;
+  struct timeval now;
+  int64_t us;
+  size_t b;
+
+  if(!m)
+    return;
+  c->metrics = NULL;
+  xgettimeofday(&now, NULL);
+  us = tvsub_us(now, c->command_when);
+  ++m->count;
+  if(c->command_reply == '5')
+    ++m->errors;
+  m->total_us += us;
+  m->trackdb_us += c->command_trackdb_us;
+  for(b = 0; b < LATENCY_BUCKETS && us > latency_buckets[b].us; ++b)
+    ;
+  ++m->buckets[b];
+}
+
+/** @brief Start timing a command
+ * @param c Connection
+ * @param n Index into @ref commands
+ */
+static void command_started(struct conn *c, int n) {
+  c->metrics = &command_metrics[n];
+  xgettimeofday(&c->command_when, NULL);
+  c->command_trackdb_us = trackdb_busy_us;
+  c->command_reply = 0;
+  c->command_deferred = 0;
+}
+
+/** @brief Note that a command's function has returned
+ * @param c Connection
+ * @param complete Value returned by the command function
+ * @return @p complete
+ *
+ * A command that hasn't responded yet, because it is suspended or is waiting
+ * for a body, is finished by response_tap() when its response appears.
+ * Database time is only counted up to this point, since once control
+ * returns to the event loop other connections will be using the database
+ * too.
+ */
+static int command_returned(struct conn *c, int complete) {
+  c->command_trackdb_us = trackdb_busy_us - c->command_trackdb_us;
+  if(c->command_reply || (complete && c->line_reader == command))
+    command_finished(c);
+  else
+    c->command_deferred = 1;
+  return complete;
+}
+
+/** @brief @ref ev_writer_tap_callback for client connections
+ *
+ * Notes the status code of a command's response, finishing it if it had been
+ * deferred.
+ */
+static void response_tap(const void *ptr,
+                         size_t attribute((unused)) n,
+                         void *u) {
+  struct conn *c = u;
+
+  if(c->metrics && !c->command_reply) {
+    c->command_reply = *(const char *)ptr;
+    if(c->command_deferred)
+      command_finished(c);
+  }
+}
+
+/** @brief Format a time in microseconds as seconds */
+static const char *metrics_seconds(int64_t us) {
+  char *s;
+
+  byte_xasprintf(&s, "%lld.%06lld",
+                 (long long)(us / 1000000), (long long)(us % 1000000));
+  return s;
+}
+
+/** @brief Add a metric's header to @c metrics output */
+static void metrics_header(struct vector *v, const char *name,
+                           const char *type, const char *help) {
+  char *s;
+
+  byte_xasprintf(&s, "# HELP %s %s", name, help);
+  vector_append(v, s);
+  byte_xasprintf(&s, "# TYPE %s %s", name, type);
+  vector_append(v, s);
+}
+
+/** @brief Add one line per used command to @c metrics output
+ * @param v Output
+ * @param name Metric name
+ * @param what Which statistic: 'c' for the count, 'e' for errors and 't' for
+ * database time
+ */
+static void metrics_per_command(struct vector *v, const char *name,
+                                int what) {
+  const struct command_metrics *m;
+  size_t n;
+  char *s;
+
+  for(n = 0; n < sizeof commands / sizeof *commands; ++n) {
+    m = &command_metrics[n];
+    if(!m->count)
+      continue;
+    switch(what) {
+    case 'c':
+      byte_xasprintf(&s, "%s{command=\"%s\"} %lu",
+                     name, commands[n].name, m->count);
+      break;
+    case 'e':
+      byte_xasprintf(&s, "%s{command=\"%s\"} %lu",
+                     name, commands[n].name, m->errors);
+      break;
+    default:
+      byte_xasprintf(&s, "%s{command=\"%s\"} %s",
+                     name, commands[n].name, metrics_seconds(m->trackdb_us));
+      break;
+    }
+    vector_append(v, s);
+  }
+}
+
+static int c_metrics(struct conn *c,
+                     char attribute((unused)) **vec,
+                     int attribute((unused)) nvec) {
+  const struct command_metrics *m;
+  struct vector v[1];
+  unsigned long cumulative;
+  unsigned long long lock_waits, lock_deadlocks, log_size, log_pending;
+  long recovery;
+  struct mem_gc_stats gc;
+  size_t n, b;
+  char *s, **ops;
+
+  vector_init(v);
+  metrics_header(v, "disorder_commands_total", "counter",
+                 "Protocol commands completed.");
+  metrics_per_command(v, "disorder_commands_total", 'c');
+  metrics_header(v, "disorder_command_errors_total", "counter",
+                 "Protocol commands that got an error response.");
+  metrics_per_command(v, "disorder_command_errors_total", 'e');
+  metrics_header(v, "disorder_command_duration_seconds", "histogram",
+                 "Time from receiving a command to starting its response.");
+  for(n = 0; n < sizeof commands / sizeof *commands; ++n) {
+    m = &command_metrics[n];
+    if(!m->count)
+      continue;
+    cumulative = 0;
+    for(b = 0; b <= LATENCY_BUCKETS; ++b) {
+      cumulative += m->buckets[b];
+      byte_xasprintf(&s, "disorder_command_duration_seconds_bucket"
+                     "{command=\"%s\",le=\"%s\"} %lu",
+                     commands[n].name,
+                     b < LATENCY_BUCKETS ? latency_buckets[b].le : "+Inf",
+                     cumulative);
+      vector_append(v, s);
+    }
+    byte_xasprintf(&s, "disorder_command_duration_seconds_sum"
+                   "{command=\"%s\"} %s",
+                   commands[n].name, metrics_seconds(m->total_us));
+    vector_append(v, s);
+    byte_xasprintf(&s, "disorder_command_duration_seconds_count"
+                   "{command=\"%s\"} %lu",
+                   commands[n].name, m->count);
+    vector_append(v, s);
+  }
+  metrics_header(v, "disorder_command_trackdb_seconds_total", "counter",
+                 "Time spent in database transactions by protocol commands.");
+  metrics_per_command(v, "disorder_command_trackdb_seconds_total", 't');
+  metrics_header(v, "disorder_trackdb_seconds_total", "counter",
+                 "Time spent in database transactions by the server.");
+  byte_xasprintf(&s, "disorder_trackdb_seconds_total %s",
+                 metrics_seconds(trackdb_busy_us));
+  vector_append(v, s);
+  metrics_header(v, "disorder_trackdb_deadlocks_total", "counter",
+                 "Database operations retried after a deadlock.");
+  for(ops = trackdb_deadlock_operations(); *ops; ++ops) {
+    byte_xasprintf(&s, "disorder_trackdb_deadlocks_total"
+                   "{operation=\"%s\"} %lu",
+                   *ops, trackdb_deadlock_count(*ops));
+    vector_append(v, s);
+  }
+  if(!trackdb_lock_stats(&lock_waits, &lock_deadlocks)) {
+    metrics_header(v, "disorder_trackdb_lock_waits_total", "counter",
+                   "Lock requests that had to wait, in any process.");
+    byte_xasprintf(&s, "disorder_trackdb_lock_waits_total %llu", lock_waits);
+    vector_append(v, s);
+    metrics_header(v, "disorder_trackdb_lock_deadlocks_total", "counter",
+                   "Deadlocks broken, in any process.");
+    byte_xasprintf(&s, "disorder_trackdb_lock_deadlocks_total %llu",
+                   lock_deadlocks);
+    vector_append(v, s);
+  }
+  if(!trackdb_log_stats(&log_size, &log_pending, &recovery)) {
+    metrics_header(v, "disorder_trackdb_log_bytes", "gauge",
+                   "Size of the database transaction log.");
+    byte_xasprintf(&s, "disorder_trackdb_log_bytes %llu", log_size);
+    vector_append(v, s);
+    metrics_header(v, "disorder_trackdb_log_pending_bytes", "gauge",
+                   "Transaction log written since the last checkpoint.");
+    byte_xasprintf(&s, "disorder_trackdb_log_pending_bytes %llu", log_pending);
+    vector_append(v, s);
+    metrics_header(v, "disorder_trackdb_recovery_seconds", "gauge",
+                   "Estimated time to recover the database after a crash.");
+    byte_xasprintf(&s, "disorder_trackdb_recovery_seconds %ld", recovery);
+    vector_append(v, s);
+  }
+  metrics_header(v, "disorder_pending_commands", "gauge",
+                 "Suspended commands counted towards user_max_pending.");
+  byte_xasprintf(&s, "disorder_pending_commands %d", admission.pending);
+  vector_append(v, s);
+  metrics_header(v, "disorder_waiting_connections", "gauge",
+                 "Connections waiting because of user_max_pending.");
+  byte_xasprintf(&s, "disorder_waiting_connections %d", admission.waiting);
+  vector_append(v, s);
+  metrics_header(v, "disorder_command_waits_total", "counter",
+                 "Commands that had to wait because of user_max_pending.");
+  byte_xasprintf(&s, "disorder_command_waits_total %lu", admission.parked);
+  vector_append(v, s);
+  metrics_header(v, "disorder_logins_rejected_total", "counter",
+                 "Logins refused because of user_max_connections.");
+  byte_xasprintf(&s, "disorder_logins_rejected_total %lu",
+                 admission.rejected);
+  vector_append(v, s);
+  metrics_header(v, "disorder_connection_yields_total", "counter",
+                 "Times a busy connection gave way to others.");
+  byte_xasprintf(&s, "disorder_connection_yields_total %lu",
+                 admission.yields);
+  vector_append(v, s);
+  if(!mem_gc_stats(&gc)) {
+    metrics_header(v, "disorder_gc_collections_total", "counter",
+                   "Garbage collections.");
+    byte_xasprintf(&s, "disorder_gc_collections_total %lu", gc.collections);
+    vector_append(v, s);
+    if(gc.pauses) {
+      metrics_header(v, "disorder_gc_seconds_total", "counter",
+                     "Time spent in garbage collections.");
+      byte_xasprintf(&s, "disorder_gc_seconds_total %s",
+                     metrics_seconds(gc.total_us));
+      vector_append(v, s);
+      metrics_header(v, "disorder_gc_max_seconds", "gauge",
+                     "Longest garbage collection.");
+      byte_xasprintf(&s, "disorder_gc_max_seconds %s",
+                     metrics_seconds(gc.max_us));
+      vector_append(v, s);
+    }
+    metrics_header(v, "disorder_gc_heap_bytes", "gauge",
+                   "Size of the garbage-collected heap.");
+    byte_xasprintf(&s, "disorder_gc_heap_bytes %zu", gc.heap_bytes);
+    vector_append(v, s);
+    metrics_header(v, "disorder_gc_free_bytes", "gauge",
+                   "Free space in the garbage-collected heap.");
+    byte_xasprintf(&s, "disorder_gc_free_bytes %zu", gc.free_bytes);
+    vector_append(v, s);
+  }
+  speaker_refresh();
+  metrics_header(v, "disorder_speaker_buffered_bytes", "gauge",
+                 "Sound buffered by the speaker for the playing track.");
+  byte_xasprintf(&s, "disorder_speaker_buffered_bytes %llu", speaker_buffered);
+  vector_append(v, s);
+  metrics_header(v, "disorder_audio_xruns_total", "counter",
+                 "Times the sound device ran out of data.");
+  byte_xasprintf(&s, "disorder_audio_xruns_total %llu",
+                 (unsigned long long)speaker_stats.xruns);
+  vector_append(v, s);
+  metrics_header(v, "disorder_audio_underruns_total", "counter",
+                 "Times the speaker's play thread ran out of data.");
+  byte_xasprintf(&s, "disorder_audio_underruns_total %llu",
+                 (unsigned long long)speaker_stats.underruns);
+  vector_append(v, s);
+  metrics_header(v, "disorder_audio_silence_samples_total", "counter",
+                 "Samples of silence played because no sound was ready.");
+  byte_xasprintf(&s, "disorder_audio_silence_samples_total %llu",
+                 (unsigned long long)speaker_stats.silence);
+  vector_append(v, s);
+  metrics_header(v, "disorder_audio_callback_seconds", "histogram",
+                 "Time taken to supply the sound device with data.");
+  cumulative = 0;
+  for(b = 0; b < UAUDIO_STATS_BUCKETS; ++b) {
+    cumulative += speaker_stats.callback_buckets[b];
+    byte_xasprintf(&s, "disorder_audio_callback_seconds_bucket{le=\"%s\"} %lu",
+                   (b < UAUDIO_STATS_BUCKETS - 1
+                    ? metrics_seconds(uaudio_stats_bounds[b]) : "+Inf"),
+                   cumulative);
+    vector_append(v, s);
+  }
+  byte_xasprintf(&s, "disorder_audio_callback_seconds_sum %s",
+                 metrics_seconds(speaker_stats.callback_us));
+  vector_append(v, s);
+  byte_xasprintf(&s, "disorder_audio_callback_seconds_count %llu",
+                 (unsigned long long)speaker_stats.callbacks);
+  vector_append(v, s);
+  metrics_header(v, "disorder_audio_latency_seconds", "gauge",
+                 "Estimated delay before sound sent to the device is heard.");
+  byte_xasprintf(&s, "disorder_audio_latency_seconds %s",
+                 metrics_seconds(speaker_stats.latency_us));
+  vector_append(v, s);
+  vector_terminate(v);
+  return list_response(c, "Metrics follow", v->vec);
+}
+
 /** @brief Fetch a command body
  * @param c Connection
  * @param body_callback Called with body
@@ -2055,12 +3669,218 @@ static int body_line(struct conn *c,
   return 1;                             /* completed */
 }
 
+/** @brief Close a connection whose forwarded response cannot continue
+ * @param c Connection
+ */
+static void forward_hangup(struct conn *c) {
+  if(c->r) {
+    ev_reader_cancel(c->r);
+    c->r = 0;
+  }
+  if(c->w)
+    ev_writer_close(c->w);
+}
+
+/** @brief @ref forward_line_callback passing a response line on */
+static void forward_line(const char *line, void *u) {
+  struct conn *c = u;
+
+  c->forward_started = 1;
+  if(c->w)
+    sink_printf(ev_writer_sink(c->w), "%s\n", line);
+}
+
+/** @brief @ref forward_line_callback for commands that log in
+ *
+ * If the primary accepts the login then the connection is logged in here
+ * too, with the user's rights as recorded in the database.
+ */
+static void forward_login_line(const char *line, void *u) {
+  struct conn *c = u;
+  const char *host;
+  struct kvp *k;
+  rights_type rights;
+  char **vec;
+  int nvec;
+
+  if(!strncmp(line, "232 ", 4)
+     && (vec = split(line + 4, &nvec, SPLIT_QUOTES, 0, 0))
+     && nvec == 1) {
+    c->forward_who = vec[0];
+    if(!(k = trackdb_getuserinfo(vec[0]))
+       || parse_rights(kvp_get(k, "rights"), &rights, 1)) {
+      disorder_error(0, "error parsing rights for %s", vec[0]);
+      sink_writes(ev_writer_sink(c->w), "530 authentication failed\n");
+      return;
+    }
+    if(user_admit(c, vec[0]))
+      return;
+    c->who = vec[0];
+    c->rights = rights;
+    if(!(host = connection_host(c)) || strcmp(host, "local"))
+      disorder_info("S%x %s connected through the primary from %s",
+                    c->tag, vec[0], host ? host : "unknown");
+    else
+      c->rights |= RIGHT__LOCAL;
+  }
+  forward_line(line, u);
+}
+
+/** @brief @ref forward_done_callback for forwarded commands */
+static void forward_done(int ok, void *u) {
+  struct conn *c = u;
+
+  if(!ok) {
+    c->forward = NULL;
+    c->forward_who = NULL;
+  }
+  if(c->reader == logging_reader_callback) {
+    /* The primary has stopped sending the log */
+    forward_hangup(c);
+    return;
+  }
+  if(!conn_resume(c))
+    return;
+  if(!ok) {
+    if(c->forward_started)
+      /* The client cannot tell where the response stopped */
+      forward_hangup(c);
+    else
+      sink_writes(ev_writer_sink(c->w),
+                  "550 lost connection to primary server\n");
+  }
+}
+
+/** @brief Send a command to the primary
+ * @param c Connection
+ * @param flags Command flags
+ * @param request Command line, with any body, including final newline
+ * @return 1 if complete, 0 if incomplete
+ */
+static int forward_send(struct conn *c, unsigned flags, const char *request) {
+  char *login;
+  const char *host;
+
+  if(c->forward && forward_closed(c->forward)) {
+    c->forward = NULL;
+    c->forward_who = NULL;
+  }
+  if(!c->forward) {
+    if(!(c->forward = forward_open(c->ev))) {
+      sink_writes(ev_writer_sink(c->w), "550 cannot reach primary server\n");
+      return 1;
+    }
+    /* The primary would otherwise treat everything arriving on its private
+     * socket as local and grant RIGHT__LOCAL, bypassing remote_userman for
+     * anyone who reached this replica over the network.  So tell it where
+     * the client really is before logging in. */
+    host = connection_host(c);
+    if(!host || strcmp(host, "local")) {
+      byte_xasprintf(&login, "forwarded-for %s\n",
+                     quoteutf8(host ? host : "unknown"));
+      forward_request(c->forward, login, 0, 0, c);
+    }
+  }
+  /* The primary trusts its private socket, so no password is needed; it
+   * still derives the session's rights from the user and the host sent
+   * above. */
+  if(c->who && (!c->forward_who || strcmp(c->who, c->forward_who))) {
+    byte_xasprintf(&login, "user %s x\n", quoteutf8(c->who));
+    forward_request(c->forward, login, 0, 0, c);
+    c->forward_who = c->who;
+  }
+  c->forward_started = 0;
+  forward_request(c->forward, request,
+                  (flags & SC_LOGIN) ? forward_login_line : forward_line,
+                  forward_done, c);
+  if(flags & SC_LOG) {
+    c->reader = logging_reader_callback;
+    return 0;
+  }
+  return conn_suspend(c);
+}
+
+/** @brief @ref body_callback_type for forwarded commands */
+static int forward_body(struct conn *c, char **body, int nbody, void *u) {
+  struct dynstr d[1];
+  int n;
+
+  dynstr_init(d);
+  dynstr_append_string(d, u);
+  for(n = 0; n < nbody; ++n) {
+    if(body[n][0] == '.')
+      dynstr_append(d, '.');
+    dynstr_append_string(d, body[n]);
+    dynstr_append(d, '\n');
+  }
+  dynstr_append_string(d, ".\n");
+  dynstr_terminate(d);
+  return forward_send(c, 0, d->vec);
+}
+
+/** @brief Pass a command on to the primary
+ * @param c Connection
+ * @param cmd Command
+ * @param vec Arguments
+ * @param nvec Number of arguments
+ * @return 1 if complete, 0 if incomplete
+ *
+ * Used by replicas for everything not marked @ref SC_LOCAL.
+ */
+static int forward_command(struct conn *c, const struct server_command *cmd,
+                           char **vec, int nvec) {
+  struct dynstr d[1];
+  int n;
+
+  dynstr_init(d);
+  dynstr_append_string(d, cmd->name);
+  for(n = 0; n < nvec; ++n) {
+    dynstr_append(d, ' ');
+    dynstr_append_string(d, quoteutf8(vec[n]));
+  }
+  dynstr_append(d, '\n');
+  dynstr_terminate(d);
+  if(cmd->flags & SC_BODY)
+    return fetch_body(c, forward_body, d->vec);
+  return forward_send(c, cmd->flags, d->vec);
+}
+
 static void command_error(const char *msg, void *u) {
   struct conn *c = u;
 
   sink_printf(ev_writer_sink(c->w), "500 parse error: %s\n", msg);
 }
 
+/** @brief Check a command's rights and arguments and then execute it
+ * @param c Connection
+ * @param cmd Command
+ * @param vec Arguments
+ * @param nvec Number of arguments
+ * @return 1 if complete, 0 if incomplete
+ */
+static int dispatch(struct conn *c, const struct server_command *cmd,
+                    char **vec, int nvec) {
+  if(cmd->rights
+     && !(c->rights & cmd->rights)) {
+    disorder_error(0, "%s attempted %s but lacks required rights",
+                   c->who ? c->who : "NULL",
+                   cmd->name);
+    sink_writes(ev_writer_sink(c->w), "510 Prohibited\n");
+    return 1;
+  }
+  if(nvec < cmd->minargs) {
+    sink_writes(ev_writer_sink(c->w), "500 missing argument(s)\n");
+    return 1;
+  }
+  if(nvec > cmd->maxargs) {
+    sink_writes(ev_writer_sink(c->w), "500 too many arguments\n");
+    return 1;
+  }
+  if(is_replica() && !(cmd->flags & SC_LOCAL))
+    return forward_command(c, cmd, vec, nvec);
+  return cmd->fn(c, vec, nvec);
+}
+
 /** @brief @ref line_reader_type callback for commands
  * @param c Connection
  * @param line Line
@@ -2073,12 +3893,17 @@ static int command(struct conn *c, char *line) {
   int nvec, n;
 
   D(("server command %s", line));
+  /* Only a command that has completed can have used the arena, and its
+   * response has been written by now */
+  arena_reset(&c->arena);
   /* We force everything into NFC as early as possible */
   if(!(line = utf8_compose_canon(line, strlen(line), 0))) {
     sink_writes(ev_writer_sink(c->w), "500 cannot normalize command\n");
     return 1;
   }
-  if(!(vec = split(line, &nvec, SPLIT_QUOTES, command_error, c))) {
+  /* That was a fresh copy, so it can be split where it lies */
+  if(!(vec = split_inplace(&c->arena, line, &nvec, SPLIT_QUOTES,
+                           command_error, c))) {
     sink_writes(ev_writer_sink(c->w), "500 cannot parse command\n");
     return 1;
   }
@@ -2086,30 +3911,12 @@ static int command(struct conn *c, char *line) {
     sink_writes(ev_writer_sink(c->w), "500 do what?\n");
     return 1;
   }
-  if((n = TABLE_FIND(commands, name, vec[0])) < 0)
+  if((n = TABLE_FIND(commands, name, vec[0])) < 0) {
     sink_writes(ev_writer_sink(c->w), "500 unknown command\n");
-  else {
-    if(commands[n].rights
-       && !(c->rights & commands[n].rights)) {
-      disorder_error(0, "%s attempted %s but lacks required rights",
-		     c->who ? c->who : "NULL",
-	    commands[n].name);
-      sink_writes(ev_writer_sink(c->w), "510 Prohibited\n");
-      return 1;
-    }
-    ++vec;
-    --nvec;
-    if(nvec < commands[n].minargs) {
-      sink_writes(ev_writer_sink(c->w), "500 missing argument(s)\n");
-      return 1;
-    }
-    if(nvec > commands[n].maxargs) {
-      sink_writes(ev_writer_sink(c->w), "500 too many arguments\n");
-      return 1;
-    }
-    return commands[n].fn(c, vec, nvec);
+    return 1;
   }
-  return 1;			/* completed */
+  command_started(c, n);
+  return command_returned(c, dispatch(c, &commands[n], vec + 1, nvec - 1));
 }
 
 /* redirect to the right reader callback for our current state */
@@ -2133,16 +3940,29 @@ static int reader_callback(ev_source attribute((unused)) *ev,
 			   void *u) {
   struct conn *c = u;
   char *eol;
-  int complete;
+  int complete, turn = 0;
 
   D(("server reader_callback"));
   while((eol = memchr(ptr, '\n', bytes))) {
+    if(c->line_reader == command) {
+      /* Give other connections a turn */
+      if(turn++ == TURN_COMMANDS) {
+        ++admission.yields;
+        return ev_reader_incomplete(reader);
+      }
+      /* The command will be read again when the user's load drops */
+      if(!command_admit(c))
+        return 0;
+    }
     *eol++ = 0;
     ev_reader_consume(reader, eol - (char *)ptr);
     complete = c->line_reader(c, ptr);  /* usually command() */
     bytes -= (eol - (char *)ptr);
     ptr = eol;
     if(!complete) {
+      /* a suspended command will re-enable input when it completes */
+      if(c->suspended)
+	return 0;
       /* the command had better have set a new reader callback */
       if(bytes || eof)
 	/* there are further bytes to read, or we are at eof; arrange for the
@@ -2180,6 +4000,7 @@ static int listen_callback(ev_source *ev,
   D(("server listen_callback fd %d (%s)", fd, l->name));
   nonblock(fd);
   cloexec(fd);
+  nodelay(fd);
   c->next = connections;
   c->tag = tags++;
   c->ev = ev;
@@ -2200,11 +4021,13 @@ static int listen_callback(ev_source *ev,
 		   "ev_reader_new for file inbound connection (fd=%d) failed",
 		   fd);
   ev_tie(c->r, c->w);
+  ev_writer_tap(c->w, response_tap, c);
   c->fd = fd;
   c->reader = reader_callback;
   c->l = l;
   c->rights = 0;
   c->line_reader = command;
+  arena_init(&c->arena);
   connections = c;
   gcry_randomize(c->nonce, sizeof c->nonce, GCRY_STRONG_RANDOM);
   sink_printf(ev_writer_sink(c->w), "231 %d %s %s\n",
@@ -2223,6 +4046,11 @@ int server_start(ev_source *ev, int pf,
   static const int one = 1;
 
   D(("server_init socket %s privileged=%d", name, privileged));
+  if(!state_log->fn) {
+    state_epoch = xtime(0);
+    state_log->fn = state_logged;
+    eventlog_add(state_log);
+  }
   /* Sanity check */
   if(privileged && pf != AF_UNIX)
     disorder_fatal(0, "cannot create a privileged listener on a non-local port");
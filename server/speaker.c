@@ -25,15 +25,28 @@
  * process that is about to become disorder-normalize) and plays them in the
  * right order.
  *
- * @b Model.  mainloop() implements a select loop awaiting commands from the
+ * @b Model.  mainloop() implements an event loop awaiting commands from the
  * main server, new connections to the speaker socket, and audio data on those
  * connections.  Each connection starts with a queue ID (with a 32-bit
  * native-endian length word), allowing it to be referred to in commands from
- * the server.
+ * the server.  The file descriptors are kept in a persistent @ref pollset;
+ * interest in a track's connection only changes when its buffer fills or
+ * empties enough to make a difference (see track_interest()).
  *
- * Data read on connections is buffered, up to a limit (currently 1Mbyte per
- * track).  No attempt is made here to limit the number of tracks, it is
- * assumed that the main server won't start outrageously many decoders.
+ * Data read on connections is buffered, up to a limit set by @c
+ * speaker_buffer (by default about 1Mbyte per track).  Buffers are made up of
+ * fixed-size pages taken from a single preallocated arena whose size is set
+ * by @c speaker_memory_kbyte, so the total memory used doesn't depend on how
+ * many tracks the server prepares.  Pages are handed out by priority: the
+ * playing track first, then the next one, and only then anything else (see
+ * pool_may_allocate()).  If @c audio_memory_kbyte is set then the arena is
+ * taken from locked memory (see realtime_memory()).
+ *
+ * A track may start playing before its buffer is full.  How much must be
+ * buffered first is decided by track_prefill(), which uses the rate at which
+ * the decoder has actually been delivering data: a decoder that outpaces
+ * playback comfortably needs only @c speaker_prefill, a slow one must fill
+ * more of its buffer before it is safe to start.
  *
  * Audio is supplied from this buffer to the uaudio play callback.  Playback is
  * enabled when a track is to be played and disabled when its last bytes
@@ -41,11 +54,28 @@
  * obvious way.  If the callback finds itself required to play when there is no
  * playing track it returns dead air.
  *
+ * @b Threads.  The uaudio callback runs in a different thread to mainloop()
+ * and must never wait for it.  Each track's buffer is therefore a
+ * single-producer single-consumer ring: speaker_fill() (in the main thread)
+ * is the only writer of @ref track::head and speaker_callback() is the only
+ * writer of @ref track::tail.  Neither takes a lock.  The only other value the
+ * callback consults is @ref playing; a track is never destroyed while the
+ * callback might still be looking at it (see retire_playing()).
+ *
  * To implement gapless playback, the server is notified that a track has
  * finished slightly early.  @ref SM_PLAY is therefore allowed to arrive while
  * the previous track is still playing provided an early @ref SM_FINISHED has
  * been sent for it.
  *
+ * If @c speaker_crossfade is set then the new track is published to the
+ * callback as @ref incoming once it is playable and the playing track has
+ * reached EOF.  The callback mixes it in over the last @c speaker_crossfade
+ * milliseconds of the playing track (see crossfade()).  When the playing track
+ * runs out the callback carries on with @ref incoming until the main loop
+ * catches up and makes it the playing track.  Until then everything the
+ * callback takes from @ref incoming is kept, so that if the crossfade is
+ * abandoned it can be put back (see set_incoming()).
+ *
  * @b Encodings.  The encodings supported depend entirely on the uaudio backend
  * chosen.  See @ref uaudio.h, etc.
  *
@@ -79,16 +109,18 @@
 #include <sys/wait.h>
 #include <time.h>
 #include <fcntl.h>
-#include <poll.h>
 #include <sys/un.h>
 #include <sys/stat.h>
 #include <pthread.h>
-#include <sys/resource.h>
+#include <sched.h>
 #include <gcrypt.h>
 
 #include "configuration.h"
 #include "syscalls.h"
 #include "log.h"
+#include "logring.h"
+#include "trace.h"
+#include "realtime.h"
 #include "defs.h"
 #include "mem.h"
 #include "speaker-protocol.h"
@@ -96,16 +128,55 @@
 #include "printf.h"
 #include "version.h"
 #include "uaudio.h"
+#include "timeval.h"
+#include "pollset.h"
+#include "gain.h"
+#include "byte-order.h"
 
-/** @brief Maximum number of FDs to poll for */
-#define NFDS 1024
+/** @brief Maximum number of events to collect per wakeup */
+#define NEVENTS 64
 
 /** @brief Number of bytes before end of track to send SM_FINISHED
  *
- * Generally set to 1 second.
+ * Generally set to 1 second, plus the crossfade length if there is one.
  */
 static size_t early_finish;
 
+/** @brief Playback rate in bytes per second */
+static size_t bytes_per_second;
+
+/** @brief Minimum decoder speed, as a multiple of real time, at which a track
+ * may start with only the minimum prefill */
+#define PREFILL_MARGIN 1.5
+
+/** @brief Number of frames in a buffer page
+ *
+ * Pages are a whole number of frames so that the callback never has to deal
+ * with a frame split across two pages.
+ */
+#define PAGE_FRAMES 16384
+
+/** @brief Nonzero if 16-bit samples are in native byte order */
+static int native_samples;
+
+/** @brief Size of a buffer page in bytes */
+static size_t page_size;
+
+/** @brief Start of page arena */
+static char *arena;
+
+/** @brief Total number of pages in @ref arena */
+static size_t arena_pages;
+
+/** @brief Free pages
+ *
+ * Only the main thread allocates and frees pages.
+ */
+static char **free_pages;
+
+/** @brief Number of entries in @ref free_pages */
+static size_t nfree_pages;
+
 /** @brief Track structure
  *
  * Known tracks are kept in a linked list.  Usually there will be at most two
@@ -121,26 +192,70 @@ struct track {
   /** @brief Track ID */
   char id[24];
 
-  /** @brief Start position of data in buffer */
-  size_t start;
+  /** @brief Serial number, for arrival order */
+  unsigned long serial;
+
+  /** @brief Write position
+   *
+   * Only modified by the main thread.  This and @ref tail count modulo twice
+   * @ref size, so that a full buffer can be distinguished from an empty one;
+   * the position in the buffer is the value modulo @ref size.
+   */
+  size_t head;
 
-  /** @brief Number of bytes of data in buffer */
-  size_t used;
+  /** @brief Read position
+   *
+   * Only modified by speaker_callback().
+   */
+  size_t tail;
 
-  /** @brief Set @c fd is at EOF */
+  /** @brief Size of the buffer in bytes
+   *
+   * Always a whole number of pages.
+   */
+  size_t size;
+
+  /** @brief Total bytes received */
+  unsigned long long received;
+
+  /** @brief When the connection arrived */
+  struct timespec connected;
+
+  /** @brief Bytes that must be buffered before play may start
+   *
+   * Recomputed by track_prefill() as data arrives.
+   */
+  size_t prefill;
+
+  /** @brief Set @c fd is at EOF
+   *
+   * Only set after the final update to @ref head.
+   */
   int eof;
 
-  /** @brief Total number of samples played */
+  /** @brief Total number of samples played
+   *
+   * Only modified by speaker_callback(), and by set_incoming() when it puts
+   * back an abandoned crossfade.
+   */
   unsigned long long played;
 
-  /** @brief Slot in @ref fds */
-  int slot;
+  /** @brief When the first sample was played
+   *
+   * Set by speaker_callback() before @ref played becomes nonzero.
+   */
+  struct timespec first_output;
+
+  /** @brief Set once @ref first_output has been traced */
+  int output_traced;
+
+  /** @brief Set when @c fd was reported readable */
+  int readable;
 
   /** @brief Set when playable
    *
-   * A track becomes playable whenever it fills its buffer or reaches EOF; it
-   * stops being playable when it entirely empties its buffer.  Tracks start
-   * out life not playable.
+   * A track becomes playable when it has buffered @ref prefill bytes or
+   * reaches EOF.  Tracks start out life not playable.
    */
   int playable;
 
@@ -151,26 +266,53 @@ struct track {
    * track cannot be paused or cancelled.
    */
   int finished;
-  
-  /** @brief Input buffer
+
+  /** @brief Buffer pages
+   *
+   * There are @ref size / @ref page_size slots.  A slot is only populated
+   * while it might hold data; see track_reclaim().  The main thread sets a
+   * slot before publishing data in it by updating @ref head, so the callback
+   * only ever sees populated slots.
+   */
+  char **pages;
+
+  /** @brief Number of populated slots in @ref pages */
+  size_t held;
+
+  /** @brief Gain to apply
+   *
+   * Set from @ref SM_PLAY before the track can become @ref playing.
+   */
+  struct gain gain;
+
+  /** @brief Length of the fade out in bytes, or 0
    *
-   * 1Mbyte is enough for nearly 6s of 44100Hz 16-bit stereo
+   * Only used by speaker_callback(), which sets it when it starts to fade the
+   * track out.
    */
-  char buffer[1048576];
+  size_t fade;
+
+  /** @brief Set while the track is @ref incoming
+   *
+   * The crossfade might yet be abandoned, so the data the callback takes from
+   * @ref hold onwards is kept until it is over.  Only used by the main
+   * thread.  See set_incoming().
+   */
+  int holding;
+
+  /** @brief Value of @ref tail when the track became @ref incoming */
+  size_t hold;
+
+  /** @brief Value of @ref played when the track became @ref incoming */
+  unsigned long long hold_played;
 };
 
-/** @brief Lock protecting data structures
- *
- * This lock protects values shared between the main thread and the callback.
+/** @brief Nonzero while speaker_callback() is running
  *
- * It is held 'all' the time by the main thread, the exceptions being when
- * called activate/deactivate callbacks and when calling (potentially) slow
- * system calls (in particular poll(), where in fact the main thread will spend
- * most of its time blocked).
- *
- * The callback holds it when it's running.
+ * Used by retire_playing() to wait until the callback can no longer be
+ * referring to a track.
  */
-static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int callback_busy;
 
 /** @brief Linked list of all prepared tracks
  *
@@ -184,6 +326,9 @@ static struct track *tracks;
  * reflect any other state (e.g. activation of uaudio backend).
  *
  * This track remains on @ref track.
+ *
+ * This is the only pointer shared with speaker_callback(), so it is always
+ * accessed atomically.  Only the main thread modifies it.
  */
 static struct track *playing;
 
@@ -195,21 +340,121 @@ static struct track *playing;
  */
 static struct track *pending_playing;
 
-/** @brief Array of file descriptors for poll() */
-static struct pollfd fds[NFDS];
+/** @brief Track being faded in, or NULL
+ *
+ * If not NULL this is always @ref pending_playing.  Like @ref playing it is
+ * shared with speaker_callback() and only modified by the main thread.
+ */
+static struct track *incoming;
+
+/** @brief Crossfade length in bytes */
+static size_t crossfade_bytes;
+
+/** @brief Return the track we expect to play next, or NULL
+ *
+ * If the server has asked for a track then that's the one.  Otherwise we
+ * guess that it's the earliest to arrive, since the server prepares tracks in
+ * queue order.
+ */
+static struct track *next_track(void) {
+  struct track *t, *best = NULL;
+
+  if(pending_playing)
+    return pending_playing;
+  for(t = tracks; t; t = t->next)
+    if(t != playing && (!best || t->serial < best->serial))
+      best = t;
+  return best;
+}
+
+/** @brief Return the number of pages a track could still use */
+static size_t track_deficit(const struct track *t) {
+  return t->eof ? 0 : t->size / page_size - t->held;
+}
 
-/** @brief Next free slot in @ref fds
+/** @brief Return nonzero if a track may take a page from the pool
+ * @param t Pointer to track
  *
- * This is used when filling in the @ref fds array each iteration through the
- * event loop.
+ * The playing track may always have a page.  If the pool is exhausted it gets
+ * one from outside the arena instead, otherwise a pool full of other tracks'
+ * data could prevent anything from playing.
+ *
+ * The next track may have a page provided that leaves enough for the
+ * playing track to fill its buffer; any other track may have one provided
+ * the playing and next tracks could both fill their buffers.
+ */
+static int pool_may_allocate(const struct track *t) {
+  struct track *next;
+  size_t reserve;
+
+  if(t == playing)
+    return 1;
+  if(!nfree_pages)
+    return 0;
+  reserve = playing ? track_deficit(playing) : 0;
+  if(t != (next = next_track()) && next)
+    reserve += track_deficit(next);
+  return nfree_pages > reserve;
+}
+
+/** @brief Get a page for a track
+ * @param t Pointer to track
+ * @return Page or NULL if none is available
+ */
+static char *pool_get(struct track *t) {
+  char *page;
+
+  if(!pool_may_allocate(t))
+    return NULL;
+  ++t->held;
+  if(nfree_pages)
+    return free_pages[--nfree_pages];
+  D(("pool exhausted; allocating overflow page for %s", t->id));
+  if((page = realtime_alloc(page_size)))
+    return page;
+  return xmalloc_noptr(page_size);
+}
+
+/** @brief Return a page to the pool
+ * @param page Page to return
  */
-static int fdno;
+static void pool_put(char *page) {
+  if(page >= arena && page < arena + arena_pages * page_size)
+    free_pages[nfree_pages++] = page;
+  else if(!realtime_free(page))
+    free(page);
+}
+
+/** @brief Set up the page pool */
+static void pool_init(void) {
+  size_t n;
+
+  page_size = PAGE_FRAMES * uaudio_sample_size * uaudio_channels;
+  arena_pages = (size_t)config->speaker_memory_kbyte * 1024 / page_size;
+  if(!arena_pages)
+    arena_pages = 1;
+  if(!(arena = realtime_alloc(arena_pages * page_size)))
+    arena = xmalloc_noptr(arena_pages * page_size);
+  free_pages = xcalloc(arena_pages, sizeof *free_pages);
+  for(n = 0; n < arena_pages; ++n)
+    free_pages[nfree_pages++] = arena + n * page_size;
+  disorder_info("%zu buffer pages of %zu bytes", arena_pages, page_size);
+}
+
+/** @brief File descriptors to wait for */
+static struct pollset *pollset;
 
 /** @brief Listen socket */
 static int listenfd;
 
-/** @brief Timestamp of last potential report to server */
-static time_t last_report;
+/** @brief Timestamp of last statistics report to server */
+static time_t last_stats;
+
+/** @brief Silence count as of the last look by report_stats() */
+static uint64_t reported_silence;
+
+/** @brief Status page shared with the server */
+static struct speaker_status *status_page;
 
 /** @brief Set when paused */
 static int paused;
@@ -217,12 +462,18 @@ static int paused;
 /** @brief Set when back end activated */
 static int activated;
 
-/** @brief Signal pipe back into the poll() loop */
+/** @brief Signal pipe back into the event loop */
 static int sigpipe[2];
 
 /** @brief Selected backend */
 static const struct uaudio *backend;
 
+/** @brief Options the backend was started with
+ *
+ * As returned by uaudio_describe().
+ */
+static char *backend_options;
+
 static const struct option options[] = {
   { "help", no_argument, 0, 'h' },
   { "version", no_argument, 0, 'V' },
@@ -257,7 +508,9 @@ static void attribute((noreturn)) help(void) {
  * @return Pointer to track structure or NULL
  */
 static struct track *findtrack(const char *id, int create) {
+  static unsigned long serial;
   struct track *t;
+  size_t npages;
 
   D(("findtrack %s %d", id, create));
   for(t = tracks; t && strcmp(id, t->id); t = t->next)
@@ -267,6 +520,20 @@ static struct track *findtrack(const char *id, int create) {
     t->next = tracks;
     strcpy(t->id, id);
     t->fd = -1;
+    t->serial = serial++;
+    /* Size the buffer according to the configuration in force when the track
+     * was created, rounded up to a whole page.  There's no point making it
+     * bigger than the whole pool. */
+    npages = ((size_t)config->speaker_buffer * bytes_per_second / 1000
+              + page_size - 1) / page_size;
+    if(npages > arena_pages)
+      npages = arena_pages;
+    if(!npages)
+      npages = 1;
+    t->size = npages * page_size;
+    t->pages = xcalloc(npages, sizeof *t->pages);
+    t->prefill = t->size;
+    gain_init(&t->gain, 0);
     tracks = t;
   }
   return t;
@@ -291,12 +558,193 @@ static struct track *removetrack(const char *id) {
  * @param t Track structure
  */
 static void destroy(struct track *t) {
+  size_t n;
+
   D(("destroy %s", t->id));
-  if(t->fd != -1)
+  if(t->fd != -1) {
+    pollset_set(pollset, t->fd, 0, NULL);
     xclose(t->fd);
+  }
+  for(n = 0; n < t->size / page_size; ++n)
+    if(t->pages[n])
+      pool_put(t->pages[n]);
+  free(t->pages);
   free(t);
 }
 
+/** @brief Return the number of bytes buffered for a track
+ * @param t Pointer to track
+ * @return Bytes available to the callback
+ *
+ * Safe to call from either thread.
+ */
+static inline size_t track_used(const struct track *t) {
+  return (__atomic_load_n(&t->head, __ATOMIC_ACQUIRE) + 2 * t->size
+          - __atomic_load_n(&t->tail, __ATOMIC_ACQUIRE)) % (2 * t->size);
+}
+
+/** @brief Return the number of bytes a track must keep
+ * @param t Pointer to track
+ * @return Bytes between the oldest data that must be kept and the write
+ * position
+ *
+ * The same as track_used(), except that while @ref track::holding is set
+ * data is kept from @ref track::hold rather than @ref track::tail.
+ *
+ * Only called from the main thread.
+ */
+static inline size_t track_kept(const struct track *t) {
+  if(!t->holding)
+    return track_used(t);
+  return (t->head + 2 * t->size - t->hold) % (2 * t->size);
+}
+
+/** @brief Advance a read or write position
+ * @param t Pointer to track
+ * @param pos Old value of @ref track::head or @ref track::tail
+ * @param n Number of bytes
+ * @return New position
+ */
+static inline size_t track_advance(const struct track *t, size_t pos,
+                                   size_t n) {
+  return (pos + n) % (2 * t->size);
+}
+
+/** @brief Return pages that no longer hold any data to the pool
+ * @param t Pointer to track
+ *
+ * Only called from the main thread.  The callback only looks at pages
+ * between @ref track::tail and @ref track::head, and it has finished with
+ * anything before the value of @ref track::tail we see here.  So that value
+ * is loaded exactly once; the callback may move it on while we work.  While
+ * @ref track::holding is set, pages from @ref track::hold onwards are kept
+ * instead.
+ */
+static void track_reclaim(struct track *t) {
+  const size_t tail = (t->holding ? t->hold
+                       : __atomic_load_n(&t->tail, __ATOMIC_ACQUIRE));
+  const size_t used = (t->head + 2 * t->size - tail) % (2 * t->size);
+  size_t npages = t->size / page_size;
+  size_t first = (tail % t->size) / page_size, span = 0, n, k;
+
+  if(used)
+    span = ((tail % page_size) + used + page_size - 1) / page_size;
+  for(n = span; n < npages; ++n) {
+    k = (first + n) % npages;
+    if(t->pages[k]) {
+      pool_put(t->pages[k]);
+      t->pages[k] = NULL;
+      --t->held;
+    }
+  }
+}
+
+/** @brief Return nonzero if a track could accept more data now
+ * @param t Pointer to track
+ */
+static int track_writable(const struct track *t) {
+  if(t->eof || track_kept(t) >= t->size)
+    return 0;
+  return t->pages[(t->head % t->size) / page_size] || pool_may_allocate(t);
+}
+
+/** @brief Compute how much of a track to buffer before playing it
+ * @param t Pointer to track
+ * @return Number of bytes
+ *
+ * If the decoder is comfortably faster than real time then we only need the
+ * configured minimum.  Otherwise the buffer will drain while playing, so we
+ * need to accumulate the expected shortfall over a whole buffer's worth of
+ * playback before starting.
+ */
+static size_t track_prefill(const struct track *t) {
+  size_t minimum = (size_t)config->speaker_prefill * bytes_per_second / 1000;
+  struct timespec now;
+  double elapsed, ratio, want;
+
+  if(minimum > t->size)
+    minimum = t->size;
+  /* Don't try to judge the decoder's speed on too little data */
+  if(t->received < minimum || !t->received)
+    return minimum;
+  xgettime(CLOCK_MONOTONIC, &now);
+  elapsed = ts_to_double(tssub(now, t->connected));
+  if(elapsed <= 0)
+    return minimum;
+  /* How fast the decoder is compared to the required rate */
+  ratio = t->received / elapsed / (bytes_per_second * PREFILL_MARGIN);
+  if(ratio >= 1)
+    return minimum;
+  want = minimum + t->size * (1 - ratio);
+  if(want >= t->size)
+    return t->size;
+  return want;
+}
+
+/** @brief Wait until speaker_callback() is not running
+ *
+ * The callback announces itself before it looks at @ref playing or @ref
+ * incoming, so once we've changed them and seen callback_busy clear, it can't
+ * be using the old tracks.  The callback is quick and non-blocking so this
+ * isn't a long wait.
+ */
+static void quiesce(void) {
+  while(__atomic_load_n(&callback_busy, __ATOMIC_SEQ_CST))
+    sched_yield();
+}
+
+/** @brief Stop playing the current track
+ *
+ * After this returns the callback is guaranteed not to be referring to the
+ * old value of @ref playing, so it may be destroyed.
+ */
+static void retire_playing(void) {
+  __atomic_store_n(&playing, NULL, __ATOMIC_SEQ_CST);
+  quiesce();
+}
+
+/** @brief Change the track being faded in
+ * @param t New track to fade in, or NULL
+ *
+ * After this returns the callback is guaranteed not to be referring to the
+ * old value of @ref incoming.
+ *
+ * If the old value has not become the playing track then the crossfade has
+ * been abandoned, for instance by a pause, and so everything the callback
+ * took from it is put back.  It will start from the beginning when it does
+ * play.
+ */
+static void set_incoming(struct track *t) {
+  struct track *const old = incoming;
+
+  if(t) {
+    t->hold = __atomic_load_n(&t->tail, __ATOMIC_ACQUIRE);
+    t->hold_played = __atomic_load_n(&t->played, __ATOMIC_ACQUIRE);
+    t->holding = 1;
+  }
+  __atomic_store_n(&incoming, t, __ATOMIC_SEQ_CST);
+  quiesce();
+  if(old) {
+    if(old != playing) {
+      __atomic_store_n(&old->tail, old->hold, __ATOMIC_RELEASE);
+      __atomic_store_n(&old->played, old->hold_played, __ATOMIC_RELEASE);
+    }
+    old->holding = 0;
+  }
+}
+
+/** @brief Compute the crossfade length from the configuration */
+static void crossfade_configure(void) {
+  size_t frame = uaudio_sample_size * uaudio_channels;
+  size_t bytes = (size_t)config->speaker_crossfade * bytes_per_second / 1000;
+
+  bytes -= bytes % frame;
+  __atomic_store_n(&crossfade_bytes, bytes, __ATOMIC_RELAXED);
+  /* The server must be told early enough that it sends the next SM_PLAY before
+   * the crossfade starts. */
+  early_finish = bytes_per_second + bytes;
+}
+
 /** @brief Read data into a sample buffer
  * @param t Pointer to track
  * @return 0 on success, -1 on EOF
@@ -308,26 +756,28 @@ static void destroy(struct track *t) {
  * Errors count as EOF.
  */
 static int speaker_fill(struct track *t) {
-  size_t where, left;
+  size_t where, left, used, slot;
   int n, rc;
 
+  used = track_kept(t);
   D(("fill %s: eof=%d used=%zu",
-     t->id, t->eof, t->used));
+     t->id, t->eof, used));
   if(t->eof)
     return -1;
-  if(t->used < sizeof t->buffer) {
+  if(used < t->size) {
     /* there is room left in the buffer */
-    where = (t->start + t->used) % sizeof t->buffer;
-    /* Get as much data as we can */
-    if(where >= t->start)
-      left = (sizeof t->buffer) - where;
-    else
-      left = t->start - where;
-    pthread_mutex_unlock(&lock);
+    where = t->head % t->size;
+    slot = where / page_size;
+    if(!t->pages[slot] && !(t->pages[slot] = pool_get(t)))
+      return 0;                         /* wait for a page */
+    /* Get as much data as we can.  The free space might extend onto the next
+     * page, in which case we'll pick up the rest next time. */
+    left = t->size - used;
+    if(left > page_size - where % page_size)
+      left = page_size - where % page_size;
     do {
-      n = read(t->fd, t->buffer + where, left);
+      n = read(t->fd, t->pages[slot] + where % page_size, left);
     } while(n < 0 && errno == EINTR);
-    pthread_mutex_lock(&lock);
     if(n < 0 && errno == EAGAIN) {
       /* EAGAIN means more later */
       rc = 0;
@@ -338,18 +788,30 @@ static int speaker_fill(struct track *t) {
         disorder_error(errno, "error reading sample stream for %s", t->id);
       else
         D(("fill %s: eof detected", t->id));
-      t->eof = 1;
+      __atomic_store_n(&t->eof, 1, __ATOMIC_RELEASE);
       /* A track always becomes playable at EOF; we're not going to see any
        * more data. */
+      if(!t->playable)
+        trace_event(TRACE_END, "prefill", t->id, NULL);
       t->playable = 1;
       rc = -1;
     } else {
-      t->used += n;
-      /* A track becomes playable when it (first) fills its buffer.  For
-       * 44.1KHz 16-bit stereo this is ~6s of audio data.  The latency will
-       * depend how long that takes to decode (hopefuly not very!) */
-      if(t->used == sizeof t->buffer)
-        t->playable = 1;
+      /* Publish the new data to the callback */
+      __atomic_store_n(&t->head, track_advance(t, t->head, n),
+                       __ATOMIC_RELEASE);
+      if(!t->received)
+        trace_event(TRACE_INSTANT, "first fill", t->id, NULL);
+      t->received += n;
+      /* A track becomes playable when it (first) has enough data buffered.
+       * How much that is depends on how fast the decoder is going. */
+      if(!t->playable) {
+        t->prefill = track_prefill(t);
+        if(used + n >= t->prefill) {
+          D(("fill %s: playable after %llu bytes", t->id, t->received));
+          trace_event(TRACE_END, "prefill", t->id, NULL);
+          t->playable = 1;
+        }
+      }
       rc = 0;
     }
   } else
@@ -357,6 +819,18 @@ static int speaker_fill(struct track *t) {
   return rc;
 }
 
+/** @brief Trace the first output of @p t, if it has happened
+ *
+ * The callback can't write to the trace file itself without risking a
+ * stall, so it just records the time.
+ */
+static void trace_output(struct track *t) {
+  if(!t->output_traced && __atomic_load_n(&t->played, __ATOMIC_ACQUIRE)) {
+    trace_event(TRACE_INSTANT, "first sample out", t->id, &t->first_output);
+    t->output_traced = 1;
+  }
+}
+
 /** @brief Return nonzero if we want to play some audio
  *
  * We want to play audio if there is a current track; and it is not paused; and
@@ -370,12 +844,40 @@ static int speaker_fill(struct track *t) {
  * its start.
  */
 static int playable(void) {
+  /* Only called from the main thread, which never races itself when looking
+   * at playing */
   return playing
          && (!paused || playing->finished)
          && playing->playable;
 }
 
-/** @brief Notify the server what we're up to */
+/** @brief Update the status page
+ *
+ * This is how the server finds out how far through the playing track we are,
+ * without a message every second.
+ */
+static void publish_status(void) {
+  struct speaker_status status;
+
+  memset(&status, 0, sizeof status);
+  /* As with report(), a finished track is none of the server's business */
+  if(playing && !playing->finished) {
+    strcpy(status.id, playing->id);
+    status.sofar = __atomic_load_n(&playing->played, __ATOMIC_RELAXED)
+      / (uaudio_rate * uaudio_channels);
+    status.buffered = track_used(playing);
+    status.buffer_size = playing->size;
+  }
+  status.paused = paused;
+  uaudio_stats_get(&status.stats);
+  speaker_status_write(status_page, &status);
+}
+
+/** @brief Notify the server what we're up to
+ *
+ * Only sent when something changes; otherwise the server reads the status
+ * page (see publish_status()).
+ */
 static void report(void) {
   struct speaker_message sm;
 
@@ -387,24 +889,185 @@ static void report(void) {
     memset(&sm, 0, sizeof sm);
     sm.type = paused ? SM_PAUSED : SM_PLAYING;
     strcpy(sm.u.id, playing->id);
-    sm.data = playing->played / (uaudio_rate * uaudio_channels);
+    sm.data = __atomic_load_n(&playing->played, __ATOMIC_RELAXED)
+      / (uaudio_rate * uaudio_channels);
     speaker_send(1, &sm);
-    xtime(&last_report);
   }
 }
 
-/** @brief Add a file descriptor to the set to poll() for
- * @param fd File descriptor
- * @param events Events to wait for e.g. @c POLLIN
- * @return Slot number
+/** @brief Tell the server if the playing track is breaking up
+ *
+ * Sent at most once a second, and only when silence has been played since
+ * the last time, so that the server can back off any rescan.  The statistics
+ * themselves are on the status page.
  */
-static int addfd(int fd, int events) {
-  if(fdno < NFDS) {
-    fds[fdno].fd = fd;
-    fds[fdno].events = events;
-    return fdno++;
-  } else
-    return -1;
+static void report_stats(void) {
+  struct speaker_message sm;
+
+  if(xtime(0) == last_stats)
+    return;
+  memset(&sm, 0, sizeof sm);
+  uaudio_stats_get(&sm.u.stats);
+  if(sm.u.stats.silence > reported_silence && playing && !paused) {
+    sm.type = SM_STATS;
+    speaker_send(1, &sm);
+    xtime(&last_stats);
+  }
+  reported_silence = sm.u.stats.silence;
+}
+
+/** @brief Update interest in a track's connection
+ * @param t Pointer to track
+ *
+ * We want to read from a track if it is connected, not at EOF and has
+ * buffer space (including a page to put the data in).  The pollset is only
+ * modified if that has changed.
+ */
+static void track_interest(struct track *t) {
+  unsigned want, have;
+
+  if(t->fd < 0)
+    return;
+  want = track_writable(t) ? POLLSET_READ : 0;
+  have = pollset_get(pollset, t->fd);
+  if(want != have && pollset_set(pollset, t->fd, want, t) < 0)
+    disorder_fatal(errno, "error updating interest for %s", t->id);
+}
+
+/** @brief Take a contiguous chunk of data from a track
+ * @param t Pointer to track
+ * @param buffer Where to put sample data
+ * @param max_bytes Maximum number of bytes to take
+ * @param used Number of bytes available, from track_used()
+ * @return Number of bytes taken
+ *
+ * The chunk ends at a page boundary at the latest.  We get called as often as
+ * necessary so there's no need for cleverness here.  The space is handed back
+ * to speaker_fill() but the track's gain is not applied; see track_take().
+ *
+ * Only called from speaker_callback().
+ */
+static size_t track_take_raw(struct track *t, char *buffer, size_t max_bytes,
+                             size_t used) {
+  size_t bytes, where = t->tail % t->size;
+  const char *page = t->pages[where / page_size];
+
+  where %= page_size;
+  if(where + used > page_size)
+    bytes = page_size - where;
+  else
+    bytes = used;
+  /* Limit to what we were asked for */
+  if(bytes > max_bytes)
+    bytes = max_bytes;
+  /* And truncate to a whole number of frames. */
+  bytes -= bytes % (uaudio_sample_size * uaudio_channels);
+  /* Provide it */
+  memcpy(buffer, page + where, bytes);
+  /* Hand the space back to speaker_fill() */
+  __atomic_store_n(&t->tail, track_advance(t, t->tail, bytes),
+                   __ATOMIC_RELEASE);
+  /* The main loop traces the first output; see trace_output() */
+  if(!t->played && bytes)
+    xgettime(CLOCK_MONOTONIC, &t->first_output);
+  __atomic_add_fetch(&t->played, bytes / uaudio_sample_size,
+                     __ATOMIC_RELEASE);
+  return bytes;
+}
+
+/** @brief Apply a track's gain
+ * @param t Pointer to track
+ * @param buffer Sample data
+ * @param bytes Number of bytes at @p buffer
+ */
+static void track_gain(const struct track *t, char *buffer, size_t bytes) {
+  if(!gain_is_unity(&t->gain))
+    gain_apply(buffer, bytes / uaudio_sample_size, uaudio_sample_size * 8,
+               native_samples, &t->gain);
+}
+
+/** @brief Take a chunk of data from a track and apply its gain
+ * @param t Pointer to track
+ * @param buffer Where to put sample data
+ * @param max_bytes Maximum number of bytes to take
+ * @param used Number of bytes available, from track_used()
+ * @return Number of bytes taken
+ *
+ * Only called from speaker_callback().
+ */
+static size_t track_take(struct track *t, char *buffer, size_t max_bytes,
+                         size_t used) {
+  const size_t bytes = track_take_raw(t, buffer, max_bytes, used);
+
+  track_gain(t, buffer, bytes);
+  return bytes;
+}
+
+/** @brief Number of samples mixed at a time during a crossfade
+ *
+ * The weights are constant within each block, so this should be short enough
+ * that the steps are inaudible.
+ */
+#define MIX_SAMPLES 512
+
+/** @brief Fade out the playing track and fade in the next one
+ * @param t Playing track, which has reached EOF
+ * @param in Incoming track, or NULL
+ * @param buffer Data just taken from @p t by track_take_raw()
+ * @param bytes Number of bytes at @p buffer
+ * @param remaining Bytes of @p t that were left before @p buffer was taken
+ *
+ * The fade out starts when @p t first has no more than @ref crossfade_bytes
+ * left and continues until its end.  Once it has started it carries on even
+ * if @p in goes away (for instance because of a pause), otherwise the old
+ * track would jump back to full volume.  What was taken from @p in is put
+ * back when it goes away; see set_incoming().
+ *
+ * Both tracks' gains are applied here.  During the fade they are folded into
+ * the mixing weights by gain_fade(), so that each output sample is rounded
+ * once rather than once for each gain and again for the mix.
+ *
+ * Only called from speaker_callback().
+ */
+static void crossfade(struct track *t, struct track *in,
+                      char *buffer, size_t bytes, size_t remaining) {
+  static int16_t mixbuf[MIX_SAMPLES];
+  char *const mix = (char *)mixbuf;
+  size_t frame = uaudio_sample_size * uaudio_channels;
+  size_t o, seg, got, used, max_seg = sizeof mixbuf - sizeof mixbuf % frame;
+  int a;
+
+  if(!t->fade) {
+    size_t x = __atomic_load_n(&crossfade_bytes, __ATOMIC_RELAXED);
+
+    if(!x || !in || remaining >= x + bytes) {
+      track_gain(t, buffer, bytes);
+      return;
+    }
+    t->fade = remaining < x ? remaining : x;
+  }
+  /* The part of the chunk before the fade starts is not mixed */
+  o = remaining > t->fade ? remaining - t->fade : 0;
+  if(o > bytes)
+    o = bytes;
+  track_gain(t, buffer, o);
+  while(o < bytes) {
+    seg = bytes - o;
+    if(seg > max_seg)
+      seg = max_seg;
+    /* Weight of the outgoing track, based on how far through the fade we
+     * are */
+    a = (unsigned long long)(remaining - o) * GAIN_MIX_ONE / t->fade;
+    got = 0;
+    while(in && got < seg && (used = track_used(in)) > 0)
+      got += track_take_raw(in, mix + got, seg - got, used);
+    /* If the incoming track can't keep up, mix in silence */
+    memset(mix + got, uaudio_sample_size == 1 ? 0x80 : 0, seg - got);
+    gain_fade(buffer + o, mix, seg / uaudio_sample_size,
+              uaudio_sample_size * 8, native_samples,
+              &t->gain, in ? &in->gain : &t->gain, a, GAIN_MIX_ONE - a);
+    o += seg;
+  }
 }
 
 /** @brief Callback to return some sampled data
@@ -419,114 +1082,177 @@ static size_t speaker_callback(void *buffer,
                                size_t max_samples,
                                void attribute((unused)) *userdata) {
   size_t max_bytes = max_samples * uaudio_sample_size;
-  size_t provided_samples = 0;
+  size_t provided_samples = 0, used = 0, bytes;
+  struct track *t, *in;
+  struct timespec started, finished;
+  int eof;
 
+  xgettime(CLOCK_MONOTONIC, &started);
   /* Be sure to keep the amount of data in a buffer a whole number of frames:
    * otherwise the playing threads can become stuck. */
   max_bytes -= max_bytes % (uaudio_sample_size * uaudio_channels);
 
-  pthread_mutex_lock(&lock);
+  /* Announce ourselves before looking at playing; see quiesce() */
+  __atomic_store_n(&callback_busy, 1, __ATOMIC_SEQ_CST);
+  t = __atomic_load_n(&playing, __ATOMIC_SEQ_CST);
+  in = __atomic_load_n(&incoming, __ATOMIC_SEQ_CST);
+  /* The main loop makes the incoming track the playing one before it clears
+   * incoming */
+  if(in == t)
+    in = NULL;
   /* TODO perhaps we should immediately go silent if we've been asked to pause
    * or cancel the playing track (maybe block in the cancel case and see what
    * else turns up?) */
-  if(playing) {
-    if(playing->used > 0) {
-      size_t bytes;
-      /* Compute size of largest contiguous chunk.  We get called as often as
-       * necessary so there's no need for cleverness here. */
-      if(playing->start + playing->used > sizeof playing->buffer)
-        bytes = sizeof playing->buffer - playing->start;
-      else
-        bytes = playing->used;
-      /* Limit to what we were asked for */
-      if(bytes > max_bytes)
-        bytes = max_bytes;
-      /* And truncate to a whole number of frames. */
-      bytes -= bytes % (uaudio_sample_size * uaudio_channels);
-      /* Provide it */
-      memcpy(buffer, playing->buffer + playing->start, bytes);
-      playing->start += bytes;
-      playing->used -= bytes;
-      /* Wrap around to start of buffer */
-      if(playing->start == sizeof playing->buffer)
-        playing->start = 0;
+  if(t) {
+    used = track_used(t);
+    eof = __atomic_load_n(&t->eof, __ATOMIC_ACQUIRE);
+    if(used > 0) {
+      if(eof) {
+        bytes = track_take_raw(t, buffer, max_bytes, used);
+        crossfade(t, in, buffer, bytes, used);
+      } else
+        bytes = track_take(t, buffer, max_bytes, used);
+      used -= bytes;
       /* See if we've reached the end of the track; if so make sure the event
        * loop wakes up. */
-      if(playing->used == 0 && playing->eof) {
+      if(used == 0 && eof) {
         int ignored = write(sigpipe[1], "", 1);
         (void) ignored;
       }
       provided_samples = bytes / uaudio_sample_size;
-      playing->played += provided_samples;
+    } else if(eof && in && (used = track_used(in)) > 0) {
+      /* The playing track has run out but the main loop hasn't caught up
+       * yet; carry on with the one we were fading in. */
+      bytes = track_take(in, buffer, max_bytes, used);
+      provided_samples = bytes / uaudio_sample_size;
     }
   }
+  __atomic_store_n(&callback_busy, 0, __ATOMIC_SEQ_CST);
   /* If we couldn't provide anything at all, play dead air */
   /* TODO maybe it would be better to block, in some cases? */
   if(!provided_samples) {
     memset(buffer, 0, max_bytes);
     provided_samples = max_samples;
-    if(playing)
-      disorder_info("%zu samples silence, playing->used=%zu",
-                    provided_samples, playing->used);
+    uaudio_stats_silence(provided_samples);
+    if(t)
+      logring_info("%zu samples silence, playing->used=%zu",
+                   provided_samples, used);
     else
-      disorder_info("%zu samples silence, playing=NULL", provided_samples);
+      logring_info("%zu samples silence, playing=NULL", provided_samples);
   }
-  pthread_mutex_unlock(&lock);
+  xgettime(CLOCK_MONOTONIC, &finished);
+  uaudio_stats_callback((finished.tv_sec - started.tv_sec) * (uint64_t)1000000
+                        + finished.tv_nsec / 1000 - started.tv_nsec / 1000);
   return provided_samples;
 }
 
+/** @brief Select and configure the backend
+ *
+ * Sets @ref backend and @ref backend_options from the current configuration,
+ * but does not start it.
+ */
+static void configure_backend(void) {
+  char buffer[64];
+
+  uaudio_clear();
+  backend = uaudio_find(config->api);
+  /* backend-specific initialization */
+  if(backend->configure)
+    backend->configure();
+  uaudio_set("application", "disorder-speaker");
+  if(config->speaker_thread_buffers) {
+    snprintf(buffer, sizeof buffer, "%ld", config->speaker_thread_buffers);
+    uaudio_set("thread-buffers", buffer);
+  }
+  if(config->speaker_chunk_max) {
+    snprintf(buffer, sizeof buffer, "%ld", config->speaker_chunk_max);
+    uaudio_set("thread-max-bytes", buffer);
+  }
+  if(config->speaker_chunk_min) {
+    snprintf(buffer, sizeof buffer, "%ld", config->speaker_chunk_min);
+    uaudio_set("thread-min-bytes", buffer);
+  }
+  backend_options = uaudio_describe();
+}
+
+/** @brief Pick up a new configuration for the backend
+ *
+ * The backend is only restarted if its options have actually changed, since
+ * doing so interrupts playback and empties its buffers.
+ */
+static void reconfigure_backend(void) {
+  const struct uaudio *old_backend = backend;
+  char *old_options = backend_options;
+
+  configure_backend();
+  if(backend == old_backend && !strcmp(backend_options, old_options))
+    return;
+  disorder_info("restarting %s backend", backend->name);
+  if(activated)
+    old_backend->deactivate();
+  old_backend->stop();
+  backend->start(speaker_callback, NULL);
+  if(activated)
+    backend->activate();
+}
+
 /** @brief Main event loop */
 static void mainloop(void) {
   struct track *t;
   struct speaker_message sm;
-  int n, fd, stdin_slot, timeout, listen_slot, sigpipe_slot;
+  int n, i, fd, timeout;
+  struct pollset_event events[NEVENTS];
 
-  pthread_mutex_lock(&lock);
+  pollset = pollset_new();
+  D(("using %s", pollset_backend()));
+  /* Always ready for commands from the main server. */
+  if(pollset_set(pollset, 0, POLLSET_READ, NULL) < 0)
+    disorder_fatal(errno, "error watching command input");
+  /* Also always ready for inbound connections */
+  if(pollset_set(pollset, listenfd, POLLSET_READ, NULL) < 0)
+    disorder_fatal(errno, "error watching listen socket");
+  /* Allow the wait to be interrupted at the end of a track */
+  if(pollset_set(pollset, sigpipe[0], POLLSET_READ, NULL) < 0)
+    disorder_fatal(errno, "error watching signal pipe");
   /* Keep going while our parent process is alive */
   while(getppid() != 1) {
     int force_report = 0;
+    int stdin_ready = 0, listen_ready = 0, sigpipe_ready = 0;
 
-    fdno = 0;
     /* By default we will wait up to half a second before thinking about
      * current state. */
     timeout = 500;
-    /* Always ready for commands from the main server. */
-    stdin_slot = addfd(0, POLLIN);
-    /* Also always ready for inbound connections */
-    listen_slot = addfd(listenfd, POLLIN);
-    /* Try to read sample data for the currently playing track if there is
-     * buffer space. */
-    if(playing
-       && playing->fd >= 0
-       && !playing->eof
-       && playing->used < (sizeof playing->buffer))
-      playing->slot = addfd(playing->fd, POLLIN);
-    else if(playing)
-      playing->slot = -1;
-    /* Allow the poll() to be interrupted at the end of a track */
-    sigpipe_slot = addfd(sigpipe[0], POLLIN);
-    /* If any other tracks don't have a full buffer, try to read sample data
-     * from them.  We do this last of all, so that if we run out of slots,
-     * nothing important can't be monitored. */
+    /* Try to read sample data for any track that has buffer space.  The
+     * callback may have drained some buffers since we last looked, so first
+     * return any pages it has finished with. */
+    for(t = tracks; t; t = t->next) {
+      track_reclaim(t);
+      trace_output(t);
+    }
     for(t = tracks; t; t = t->next)
-      if(t != playing) {
-        if(t->fd >= 0
-           && !t->eof
-           && t->used < sizeof t->buffer) {
-          t->slot = addfd(t->fd,  POLLIN | POLLHUP);
-        } else
-          t->slot = -1;
-      }
+      track_interest(t);
     /* Wait for something interesting to happen */
-    pthread_mutex_unlock(&lock);
-    n = poll(fds, fdno, timeout);
-    pthread_mutex_lock(&lock);
+    n = pollset_wait(pollset, events, NEVENTS, timeout);
     if(n < 0) {
       if(errno == EINTR) continue;
-      disorder_fatal(errno, "error calling poll");
+      disorder_fatal(errno, "error waiting for events");
+    }
+    /* Note what happened.  Tracks are dealt with after commands, by which
+     * time some of them may have been destroyed, so we mark them rather than
+     * remembering pointers. */
+    for(i = 0; i < n; ++i) {
+      if(events[i].data) {
+        t = events[i].data;
+        t->readable = 1;
+      } else if(events[i].fd == 0)
+        stdin_ready = 1;
+      else if(events[i].fd == listenfd)
+        listen_ready = 1;
+      else if(events[i].fd == sigpipe[0])
+        sigpipe_ready = 1;
     }
     /* Perhaps a connection has arrived */
-    if(fds[listen_slot].revents & POLLIN) {
+    if(listen_ready) {
       struct sockaddr_un addr;
       socklen_t addrlen = sizeof addr;
       uint32_t l;
@@ -560,6 +1286,8 @@ static void mainloop(void) {
           } else {
             nonblock(fd);
             t->fd = fd;               /* yay */
+            xgettime(CLOCK_MONOTONIC, &t->connected);
+            trace_event(TRACE_BEGIN, "prefill", t->id, &t->connected);
           }
           /* Notify the server that the connection arrived */
           sm.type = SM_ARRIVED;
@@ -570,7 +1298,7 @@ static void mainloop(void) {
         disorder_error(errno, "accept");
     }
     /* Perhaps we have a command to process */
-    if(fds[stdin_slot].revents & POLLIN) {
+    if(stdin_ready) {
       /* There might (in theory) be several commands queued up, but in general
        * this won't be the case, so we don't bother looping around to pick them
        * all up. */ 
@@ -594,7 +1322,8 @@ static void mainloop(void) {
               disorder_fatal(0, "got SM_PLAY but have a pending playing track");
           }
 	  t = findtrack(sm.u.id, 1);
-          D(("SM_PLAY %s fd %d", t->id, t->fd));
+          D(("SM_PLAY %s fd %d gain %ld", t->id, t->fd, sm.data));
+          gain_init(&t->gain, sm.data / 100.0);
           if(t->fd == -1)
             disorder_error(0,
                            "cannot play track because no connection arrived");
@@ -624,14 +1353,17 @@ static void mainloop(void) {
 	case SM_CANCEL:
           D(("SM_CANCEL %s", sm.u.id));
 	  t = removetrack(sm.u.id);
+          if(t && t == incoming)
+            set_incoming(NULL);
 	  if(t) {
 	    if(t == playing || t == pending_playing) {
               /* Scratching the track that the server believes is playing,
                * which might either be the actual playing track or a pending
                * playing track */
               sm.type = SM_FINISHED;
+              trace_event(TRACE_INSTANT, "SM_FINISHED", t->id, NULL);
               if(t == playing)
-                playing = 0;
+                retire_playing();
               else
                 pending_playing = 0;
             } else {
@@ -658,11 +1390,14 @@ static void mainloop(void) {
           D(("SM_RELOAD"));
 	  if(config_read(1, NULL))
             disorder_error(0, "cannot read configuration");
+          crossfade_configure();
+          trace_open(config->trace_file);
+          reconfigure_backend();
           disorder_info("reloaded configuration");
 	  break;
         case SM_RTP_REQUEST:
           /* TODO the error behavior here is really unhelpful */
-          if(rtp_add_recipient(&sm.u.address))
+          if(rtp_add_recipient(&sm.u.address, sm.data))
             disorder_error(0, "unacceptable RTP destination");
           break;
         case SM_RTP_CANCEL:
@@ -675,13 +1410,14 @@ static void mainloop(void) {
     }
     /* Read in any buffered data */
     for(t = tracks; t; t = t->next)
-      if(t->fd != -1
-         && t->slot != -1
-         && (fds[t->slot].revents & (POLLIN | POLLHUP)))
-         speaker_fill(t);
+      if(t->readable) {
+        t->readable = 0;
+        if(t->fd != -1)
+          speaker_fill(t);
+      }
     /* Drain the signal pipe.  We don't care about its contents, merely that it
-     * interrupted poll(). */
-    if(fds[sigpipe_slot].revents & POLLIN) {
+     * interrupted the wait. */
+    if(sigpipe_ready) {
       char buffer[64];
       int ignored; (void)ignored;
 
@@ -695,48 +1431,62 @@ static void mainloop(void) {
     if(playing
        && playing->eof
        && !playing->finished
-       && playing->used <= early_finish) {
+       && track_used(playing) <= early_finish) {
       memset(&sm, 0, sizeof sm);
       sm.type = SM_FINISHED;
       strcpy(sm.u.id, playing->id);
+      trace_event(TRACE_INSTANT, "SM_FINISHED", playing->id, NULL);
       speaker_send(1, &sm);
       playing->finished = 1;
     }
     /* When the track is actually finished, deconfigure it */
-    if(playing && playing->eof && !playing->used) {
+    if(playing && playing->eof && !track_used(playing)) {
       if(!playing->finished) {
         /* should never happen but we'd like to know if it does */
         disorder_fatal(0, "track finish state inconsistent");
       }
-      removetrack(playing->id);
-      destroy(playing);
-      playing = 0;
+      t = playing;
+      removetrack(t->id);
+      retire_playing();
+      destroy(t);
     }
     /* Act on the pending SM_PLAY */
     if(!playing && pending_playing) {
-      playing = pending_playing;
+      __atomic_store_n(&playing, pending_playing, __ATOMIC_SEQ_CST);
       pending_playing = 0;
       force_report = 1;
     }
+    /* Fade the pending track in once the playing one is near its end.  Don't
+     * start a crossfade while paused; and if we pause during one then stop
+     * it, the new track shouldn't be playing.  set_incoming() puts back what
+     * it has played so far. */
+    t = NULL;
+    if(crossfade_bytes
+       && playing
+       && playing->eof
+       && pending_playing
+       && pending_playing->playable
+       && !paused)
+      t = pending_playing;
+    if(t != incoming)
+      set_incoming(t);
     /* Impose any state change required by the above */
     if(playable()) {
       if(!activated) {
         activated = 1;
-        pthread_mutex_unlock(&lock);
         backend->activate();
-        pthread_mutex_lock(&lock);
       }
     } else {
       if(activated) {
         activated = 0;
-        pthread_mutex_unlock(&lock);
         backend->deactivate();
-        pthread_mutex_lock(&lock);
       }
     }
-    /* If we've not reported our state for a second do so now. */
-    if(force_report || xtime(0) > last_report)
+    /* Tell the server about any change of state */
+    publish_status();
+    if(force_report)
       report();
+    report_stats();
   }
 }
 
@@ -747,7 +1497,6 @@ int main(int argc, char **argv) {
   struct speaker_message sm;
   const char *d;
   char *dir;
-  struct rlimit rl[1];
 
   set_progname(argv);
   if(!setlocale(LC_CTYPE, "")) disorder_fatal(errno, "error calling setlocale");
@@ -768,9 +1517,15 @@ int main(int argc, char **argv) {
     openlog(progname, LOG_PID, LOG_DAEMON);
     log_default = &log_syslog;
   }
+  /* the audio callback logs through the ring */
+  logring_start();
   config_uaudio_apis = uaudio_apis;
   config_per_user = 0;
   if(config_read(1, NULL)) disorder_fatal(0, "cannot read configuration");
+  realtime_configure(config->audio_scheduling, config->audio_priority,
+                     config->audio_cpus);
+  realtime_memory((size_t)config->audio_memory_kbyte * 1024,
+                  config->audio_huge_pages);
   /* ignore SIGPIPE */
   signal(SIGPIPE, SIG_IGN);
   /* set nice value */
@@ -780,24 +1535,13 @@ int main(int argc, char **argv) {
   /* make sure we're not root, whatever the config says */
   if(getuid() == 0 || geteuid() == 0)
     disorder_fatal(0, "do not run as root");
-  /* Make sure we can't have more than NFDS files open (it would bust our
-   * poll() array) */
-  if(getrlimit(RLIMIT_NOFILE, rl) < 0)
-    disorder_fatal(errno, "getrlimit RLIMIT_NOFILE");
-  if(rl->rlim_cur > NFDS) {
-    rl->rlim_cur = NFDS;
-    if(setrlimit(RLIMIT_NOFILE, rl) < 0)
-      disorder_fatal(errno, "setrlimit to reduce RLIMIT_NOFILE to %lu",
-            (unsigned long)rl->rlim_cur);
-    disorder_info("set RLIM_NOFILE to %lu", (unsigned long)rl->rlim_cur);
-  } else
-    disorder_info("RLIM_NOFILE is %lu", (unsigned long)rl->rlim_cur);
+  trace_open(config->trace_file);
   /* gcrypt initialization */
   if(!gcry_check_version(NULL))
     disorder_fatal(0, "gcry_check_version failed");
   gcry_control(GCRYCTL_INIT_SECMEM, 0);
   gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
-  /* create a pipe between the backend callback and the poll() loop */
+  /* create a pipe between the backend callback and the event loop */
   xpipe(sigpipe);
   nonblock(sigpipe[0]);
   /* set up audio backend */
@@ -805,13 +1549,11 @@ int main(int argc, char **argv) {
                     config->sample_format.channels,
                     config->sample_format.bits,
                     config->sample_format.bits != 8);
-  early_finish = uaudio_sample_size * uaudio_channels * uaudio_rate;
-  /* TODO other parameters! */
-  backend = uaudio_find(config->api);
-  /* backend-specific initialization */
-  if(backend->configure)
-    backend->configure();
-  uaudio_set("application", "disorder-speaker");
+  native_samples = config->sample_format.endian == ENDIAN_NATIVE;
+  bytes_per_second = uaudio_sample_size * uaudio_channels * uaudio_rate;
+  crossfade_configure();
+  pool_init();
+  configure_backend();
   backend->start(speaker_callback, NULL);
   /* create the private socket directory */
   byte_xasprintf(&dir, "%s/private", config->home);
@@ -831,6 +1573,11 @@ int main(int argc, char **argv) {
     disorder_fatal(errno, "error binding socket to %s", addr.sun_path);
   xlisten(listenfd, 128);
   nonblock(listenfd);
+  /* set up the status page */
+  byte_xasprintf(&dir, "%s/private/speaker-status", config->home);
+  if(!(status_page = speaker_status_map(dir, 1)))
+    disorder_fatal(0, "cannot create status page");
+  publish_status();
   disorder_info("version "VERSION" process ID %lu",
                 (unsigned long)getpid());
   disorder_info("listening on %s", addr.sun_path);
@@ -200,22 +200,38 @@ int reconfigure(ev_source *ev, unsigned flags) {
     else {
       /* Tell the speaker it needs to reload its config too. */
       speaker_reload();
+      /* Name parts depend on the configuration */
+      ++trackdb_generation;
       disorder_info("%s: installed new configuration", configfile);
     }
   }
-  /* New audio API */
-  api = uaudio_find(config->api);
-  if(api->configure)
-    api->configure();
-  if(api->open_mixer)
-    api->open_mixer();
+  ev_instrument(ev, config->slow_callback_ms);
+  trace_open(config->trace_file);
+  /* New audio API; a replica doesn't use one */
+  if(!is_replica()) {
+    api = uaudio_find(config->api);
+    if(api->configure)
+      api->configure();
+    if(api->open_mixer)
+      api->open_mixer();
+  }
+  /* The collections may have changed so watch them afresh */
+  watch_reset(ev);
   /* If we interrupted a rescan of all the tracks, start a new one */
   if(need_another_rescan)
-    trackdb_rescan(ev, 1/*check*/, 0, 0);
+    watch_rescan(ev, 1/*check*/, 0, 0);
   if(!ret && !(flags & RECONFIGURE_FIRST)) {
     /* Open/close sockets */
     reset_sockets(ev);
   }
+  /* Player helpers and query workers have the old configuration so replace
+   * them */
+  if(!ret) {
+    helpers_reset(ev);
+    query_reset(ev);
+    /* Weights depend on the configuration too */
+    chooser_rebuild(ev);
+  }
   return ret;
 }
 
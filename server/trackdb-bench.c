@@ -0,0 +1,526 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file server/trackdb-bench.c
+ * @brief Track database benchmarks
+ *
+ * <tt>disorder-trackdb-bench generate</tt> fills an empty database with a
+ * synthetic library and <tt>disorder-trackdb-bench run</tt> times the
+ * operations that get slower as the library grows.  See
+ * benchmarks/trackdb-bench for a script that does both at several sizes.
+ *
+ * The library is generated from a fixed seed, so the same options always
+ * produce the same library.  Tracks are added with trackdb_notice_batch(), as
+ * disorder-rescan does, and tagged with trackdb_set().  No files are created:
+ * each track's path is just its name.
+ */
+#include "disorder-server.h"
+
+/** @brief Tracks per leaf directory */
+#define TRACKS_PER_DIR 12
+
+/** @brief Tracks per call to trackdb_notice_batch()
+ *
+ * The same as disorder-rescan.
+ */
+#define NOTICE_BATCH 256
+
+/** @brief Largest number of timed runs */
+#define MAX_REPEAT 100
+
+/** @brief Words for names, most common first */
+static const char *const words[] = {
+  "love", "night", "blue", "song", "heart", "time", "girl", "dream",
+  "rain", "fire", "dance", "home", "light", "river", "world", "summer",
+  "moon", "road", "black", "gold", "baby", "angel", "wild", "city",
+  "storm", "train", "sweet", "ghost", "winter", "ocean", "stone", "kiss",
+  "paradise", "electric", "silver", "broken", "hollow", "crimson", "echo",
+  "velvet", "thunder", "shadow", "mountain", "whisper", "lantern", "harbour",
+  "canyon", "meadow", "satellite", "marmalade", "quixotic", "zephyr",
+};
+
+/** @brief Non-ASCII words for names
+ *
+ * Latin with diacritics, Greek, Cyrillic and CJK, so that normalization and
+ * case-folding have something to do.
+ */
+static const char *const unicode_words[] = {
+  "caf\xC3\xA9", "Stra\xC3\x9F" "e", "\xC3\x85ngstr\xC3\xB6m",
+  "ni\xC3\xB1o", "\xC3\x81" "g\xC3\xA6tis", "Dvo\xC5\x99\xC3\xA1k",
+  "\xCE\xB1\xCE\xB3\xCE\xAC\xCF\x80\xCE\xB7",
+  "\xCE\x98\xCE\xAC\xCE\xBB\xCE\xB1\xCF\x83\xCF\x83\xCE\xB1",
+  "\xD0\xBB\xD1\x8E\xD0\xB1\xD0\xBE\xD0\xB2\xD1\x8C",
+  "\xD0\x9C\xD0\xBE\xD1\x81\xD0\xBA\xD0\xB2\xD0\xB0",
+  "\xE6\x9D\xB1\xE4\xBA\xAC", "\xE6\xA1\x9C",
+  "\xE9\x9F\xB3\xE6\xA5\xBD",
+};
+
+/** @brief Tag names, most common first */
+static const char *const tag_names[] = {
+  "rock", "pop", "jazz", "classical", "folk", "electronic", "ambient",
+  "blues", "soul", "metal", "punk", "reggae", "country", "hip-hop",
+  "soundtrack", "live", "christmas", "spoken word",
+};
+
+#define NWORDS (sizeof words / sizeof *words)
+#define NUNICODE_WORDS (sizeof unicode_words / sizeof *unicode_words)
+#define NTAG_NAMES (sizeof tag_names / sizeof *tag_names)
+
+/** @brief Number of tracks to generate */
+static long ntracks = 10000;
+
+/** @brief Directory depth below the collection root */
+static int depth = 3;
+
+/** @brief Number of distinct tags */
+static int ntags = 30;
+
+/** @brief Percentage of name words that are non-ASCII */
+static int unicode_percent = 10;
+
+/** @brief Random seed */
+static unsigned long seed = 1;
+
+/** @brief Number of timed runs of each benchmark */
+static int repeat = 3;
+
+/** @brief State of a pseudo-random number generator
+ *
+ * The generator is splitmix64.  It is not the library's random source
+ * because that is deliberately unrepeatable.
+ */
+struct prng {
+  /** @brief Current state */
+  uint64_t state;
+};
+
+/** @brief Seed a generator
+ * @param r Generator
+ * @param a First seed value
+ * @param b Second seed value
+ */
+static void prng_init(struct prng *r, uint64_t a, uint64_t b) {
+  r->state = a * 0x9E3779B97F4A7C15ULL ^ b * 0xBF58476D1CE4E5B9ULL;
+}
+
+/** @brief Return the next value from a generator */
+static uint64_t prng_next(struct prng *r) {
+  uint64_t z = (r->state += 0x9E3779B97F4A7C15ULL);
+
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+/** @brief Return a value in [0,n) skewed towards 0
+ *
+ * The square of a uniform value, so that index 0 is much more common than
+ * the last index, much as some words are more common than others.
+ */
+static size_t prng_skewed(struct prng *r, size_t n) {
+  const uint64_t u = prng_next(r) >> 32;
+
+  return (size_t)((u * u >> 32) * n >> 32);
+}
+
+/** @brief Append a random name word
+ * @param d Where to put it
+ * @param r Generator
+ */
+static void add_word(struct dynstr *d, struct prng *r) {
+  if((int)(prng_next(r) % 100) < unicode_percent)
+    dynstr_append_string(d, unicode_words[prng_next(r) % NUNICODE_WORDS]);
+  else
+    dynstr_append_string(d, words[prng_skewed(r, NWORDS)]);
+}
+
+/** @brief Append a random name of up to @p max words
+ * @param d Where to put it
+ * @param r Generator
+ * @param max Maximum number of words
+ */
+static void add_name(struct dynstr *d, struct prng *r, int max) {
+  int n = 1 + prng_next(r) % max;
+
+  while(n-- > 0) {
+    add_word(d, r);
+    if(n)
+      dynstr_append(d, ' ');
+  }
+}
+
+/** @brief Construct the name of a tag
+ * @param n Tag number
+ * @return Tag name
+ */
+static const char *tag_name(size_t n) {
+  char *s;
+
+  if(n < NTAG_NAMES)
+    return tag_names[n];
+  byte_xasprintf(&s, "tag%zu", n);
+  return s;
+}
+
+/** @brief Construct the name of a generated track
+ * @param root Collection root
+ * @param n Track number
+ * @param fanout Subdirectories per directory
+ * @return Track name
+ *
+ * Each directory's name depends only on its position in the tree, so all the
+ * tracks in a directory agree about it.
+ */
+static char *track_name(const char *root, long n, long fanout) {
+  struct dynstr d[1];
+  struct prng r[1];
+  long dir = n / TRACKS_PER_DIR, scale = 1;
+  int level;
+  char number[16];
+
+  dynstr_init(d);
+  dynstr_append_string(d, root);
+  for(level = 1; level < depth; ++level)
+    scale *= fanout;
+  for(level = 0; level < depth; ++level) {
+    prng_init(r, seed + level, dir / scale + 1);
+    dynstr_append(d, '/');
+    add_name(d, r, 3);
+    scale /= fanout;
+  }
+  prng_init(r, seed, ~(uint64_t)n);
+  byte_snprintf(number, sizeof number, "/%02ld:", n % TRACKS_PER_DIR + 1);
+  dynstr_append_string(d, number);
+  add_name(d, r, 4);
+  dynstr_append_string(d, ".ogg");
+  dynstr_terminate(d);
+  return d->vec;
+}
+
+/** @brief Generate a synthetic library */
+static void generate(void) {
+  char *tracks[NOTICE_BATCH], *paths[NOTICE_BATCH], *sigs[NOTICE_BATCH];
+  const char *root;
+  struct dynstr tags[1];
+  struct prng r[1];
+  long n, fanout = 1, ndirs = 1, nnew = 0;
+  int nbatch, ntrack_tags, t, l;
+
+  if(!config->collection.n)
+    disorder_fatal(0, "no collection configured");
+  root = config->collection.s[0].root;
+  /* Choose a fanout that spreads the tracks evenly over the tree */
+  while(ndirs * TRACKS_PER_DIR < ntracks) {
+    ++fanout;
+    for(ndirs = 1, l = 0; l < depth; ++l)
+      ndirs *= fanout;
+  }
+  for(n = 0; n < ntracks;) {
+    for(nbatch = 0; nbatch < NOTICE_BATCH && n < ntracks; ++nbatch, ++n) {
+      tracks[nbatch] = paths[nbatch] = track_name(root, n, fanout);
+      sigs[nbatch] = (char *)"bench";
+    }
+    nnew += trackdb_notice_batch(nbatch, tracks, paths, sigs);
+    /* Up to three tags each, with some tags much commoner than others */
+    for(t = 0; t < nbatch; ++t) {
+      prng_init(r, seed, n - nbatch + t);
+      if(!ntags || !(ntrack_tags = prng_next(r) % 4))
+        continue;
+      dynstr_init(tags);
+      while(ntrack_tags-- > 0) {
+        dynstr_append_string(tags, tag_name(prng_skewed(r, ntags)));
+        if(ntrack_tags)
+          dynstr_append_string(tags, ", ");
+      }
+      dynstr_terminate(tags);
+      trackdb_set(tracks[t], "tags", tags->vec);
+    }
+    if(n % 10000 < NOTICE_BATCH)
+      disorder_info("generated %ld/%ld tracks", n, ntracks);
+  }
+  disorder_info("generated %ld tracks, %ld new, %ld directories of %ld",
+                ntracks, nnew, ndirs, fanout);
+}
+
+/** @brief Tracks found by @ref collect_callback */
+static struct vector all_tracks;
+
+/** @brief trackdb_scan() callback that collects track names */
+static int collect_callback(const char *track,
+                            struct kvp attribute((unused)) *data,
+                            struct kvp attribute((unused)) *prefs,
+                            void attribute((unused)) *u,
+                            DB_TXN attribute((unused)) *tid) {
+  vector_append(&all_tracks, (char *)track);
+  return 0;
+}
+
+/** @brief Scan the whole database, as disorder-choose does
+ * @return Number of tracks found
+ */
+static long bench_scan(void) {
+  DB_TXN *tid;
+
+  for(;;) {
+    all_tracks.nvec = 0;
+    tid = trackdb_begin_read_transaction();
+    if(!trackdb_scan(0, collect_callback, 0, tid))
+      break;
+    trackdb_abort_transaction(tid);
+  }
+  trackdb_commit_transaction(tid);
+  return all_tracks.nvec;
+}
+
+/** @brief Search words, set by main() */
+static char *search_words[3];
+
+/** @brief Number of words in @ref search_words */
+static int nsearch_words;
+
+/** @brief Run a search
+ * @return Number of matches
+ */
+static long bench_search(void) {
+  int n;
+
+  trackdb_search(search_words, nsearch_words, &n);
+  return n;
+}
+
+/** @brief Directory to list, set by main() */
+static const char *list_dir;
+
+/** @brief List a directory
+ * @return Number of entries
+ */
+static long bench_list(void) {
+  int n;
+
+  trackdb_list(list_dir, &n, trackdb_files|trackdb_directories, 0);
+  return n;
+}
+
+/** @brief Find the newest tracks, as the web interface does
+ * @return Number of tracks found
+ */
+static long bench_new(void) {
+  int n;
+
+  trackdb_new(&n, config->new_max);
+  return n;
+}
+
+/** @brief Notice every track again, as a rescan of an unchanged library does
+ * @return Number of tracks that were new
+ */
+static long bench_rescan(void) {
+  char *sigs[NOTICE_BATCH];
+  long n, nnew = 0;
+  int m, nbatch;
+
+  for(m = 0; m < NOTICE_BATCH; ++m)
+    sigs[m] = (char *)"bench";
+  for(n = 0; n < all_tracks.nvec; n += nbatch) {
+    nbatch = all_tracks.nvec - n < NOTICE_BATCH
+      ? all_tracks.nvec - n : NOTICE_BATCH;
+    nnew += trackdb_notice_batch(nbatch, all_tracks.vec + n,
+                                 all_tracks.vec + n, sigs);
+  }
+  return nnew;
+}
+
+/** @brief qsort() comparison for doubles */
+static int compare_double(const void *av, const void *bv) {
+  const double a = *(const double *)av, b = *(const double *)bv;
+
+  return a < b ? -1 : a > b;
+}
+
+/** @brief Time a benchmark and report the result
+ * @param name Name of benchmark
+ * @param tracks Size of the library
+ * @param run Function to time
+ */
+static void bench_report(const char *name, long tracks, long (*run)(void)) {
+  double times[MAX_REPEAT];
+  struct timespec started, finished;
+  long results = 0;
+  int r;
+
+  for(r = 0; r < repeat; ++r) {
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    results = run();
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    times[r] = (finished.tv_sec - started.tv_sec) * 1e3
+      + (finished.tv_nsec - started.tv_nsec) / 1e6;
+  }
+  qsort(times, repeat, sizeof *times, compare_double);
+  if(printf("%s\t%ld\t%ld\t%.3f\t%.3f\n", name, tracks, results, times[0],
+            times[repeat / 2]) < 0
+     || fflush(stdout) < 0)
+    disorder_fatal(errno, "error writing to stdout");
+}
+
+/** @brief Find a directory that contains tracks
+ * @return Directory name
+ */
+static const char *leaf_directory(void) {
+  const char *dir = config->collection.s[0].root;
+  char **subdirs;
+  int n;
+
+  while((subdirs = trackdb_list(dir, &n, trackdb_directories, 0)) && n)
+    dir = subdirs[0];
+  return dir;
+}
+
+/** @brief Run all the benchmarks */
+static void run(void) {
+  long tracks;
+
+  if(!config->collection.n)
+    disorder_fatal(0, "no collection configured");
+  xprintf("# benchmark\ttracks\tresults\tmin_ms\tmedian_ms\n");
+  tracks = bench_scan();
+  bench_report("scan", tracks, bench_scan);
+  search_words[0] = (char *)words[0];
+  nsearch_words = 1;
+  bench_report("search-common", tracks, bench_search);
+  search_words[0] = (char *)words[NWORDS - 1];
+  bench_report("search-rare", tracks, bench_search);
+  search_words[0] = (char *)unicode_words[0];
+  bench_report("search-unicode", tracks, bench_search);
+  search_words[0] = (char *)words[0];
+  search_words[1] = (char *)words[1];
+  search_words[2] = (char *)words[2];
+  nsearch_words = 3;
+  bench_report("search-three-words", tracks, bench_search);
+  byte_xasprintf(&search_words[0], "tag:%s", tag_names[0]);
+  nsearch_words = 1;
+  bench_report("search-tag", tracks, bench_search);
+  list_dir = config->collection.s[0].root;
+  bench_report("list-root", tracks, bench_list);
+  list_dir = leaf_directory();
+  bench_report("list-leaf", tracks, bench_list);
+  bench_report("new", tracks, bench_new);
+  bench_report("rescan", tracks, bench_rescan);
+}
+
+static const struct option options[] = {
+  { "help", no_argument, 0, 'h' },
+  { "version", no_argument, 0, 'V' },
+  { "config", required_argument, 0, 'c' },
+  { "debug", no_argument, 0, 'd' },
+  { "no-debug", no_argument, 0, 'D' },
+  { "tracks", required_argument, 0, 'n' },
+  { "depth", required_argument, 0, 'p' },
+  { "tags", required_argument, 0, 't' },
+  { "unicode", required_argument, 0, 'u' },
+  { "seed", required_argument, 0, 'S' },
+  { "repeat", required_argument, 0, 'r' },
+  { 0, 0, 0, 0 }
+};
+
+/* display usage message and terminate */
+static void attribute((noreturn)) help(void) {
+  xprintf("Usage:\n"
+          "  disorder-trackdb-bench [OPTIONS] generate\n"
+          "  disorder-trackdb-bench [OPTIONS] run\n"
+          "Options:\n"
+          "  --help, -h               Display usage message\n"
+          "  --version, -V            Display version number\n"
+          "  --config PATH, -c PATH   Set configuration file\n"
+          "  --[no-]debug, -d         Turn on (off) debugging\n"
+          "Options for generate:\n"
+          "  --tracks, -n COUNT       Number of tracks (10000)\n"
+          "  --depth, -p LEVELS       Directory depth (3)\n"
+          "  --tags, -t COUNT         Number of distinct tags (30)\n"
+          "  --unicode, -u PERCENT    Non-ASCII words in names (10)\n"
+          "  --seed, -S SEED          Random seed (1)\n"
+          "Options for run:\n"
+          "  --repeat, -r COUNT       Number of timed runs (3)\n"
+          "\n"
+          "'generate' adds a synthetic library to an empty database.\n"
+          "'run' times database operations and writes one tab-separated\n"
+          "line per benchmark: name, tracks, results, fastest and median\n"
+          "time in milliseconds.  Not for use on a real database.\n");
+  xfclose(stdout);
+  exit(0);
+}
+
+int main(int argc, char **argv) {
+  const char *mode;
+  int n;
+
+  set_progname(argv);
+  mem_init();
+  if(!setlocale(LC_CTYPE, ""))
+    disorder_fatal(errno, "error calling setlocale");
+  while((n = getopt_long(argc, argv, "hVc:dDn:p:t:u:S:r:",
+                         options, 0)) >= 0) {
+    switch(n) {
+    case 'h': help();
+    case 'V': version("disorder-trackdb-bench");
+    case 'c': configfile = optarg; break;
+    case 'd': debugging = 1; break;
+    case 'D': debugging = 0; break;
+    case 'n': ntracks = atol(optarg); break;
+    case 'p': depth = atoi(optarg); break;
+    case 't': ntags = atoi(optarg); break;
+    case 'u': unicode_percent = atoi(optarg); break;
+    case 'S': seed = strtoul(optarg, 0, 0); break;
+    case 'r': repeat = atoi(optarg); break;
+    default: disorder_fatal(0, "invalid option");
+    }
+  }
+  if(optind != argc - 1)
+    disorder_fatal(0, "specify 'generate' or 'run'");
+  mode = argv[optind];
+  if(ntracks < 0 || depth < 1 || ntags < 0 || unicode_percent < 0
+     || unicode_percent > 100)
+    disorder_fatal(0, "invalid generator option");
+  if(repeat < 1 || repeat > MAX_REPEAT)
+    disorder_fatal(0, "--repeat must be between 1 and %d", MAX_REPEAT);
+  config_per_user = 0;
+  if(config_read(0, NULL))
+    disorder_fatal(0, "cannot read configuration");
+  vector_init(&all_tracks);
+  if(!strcmp(mode, "generate")) {
+    trackdb_init(TRACKDB_NORMAL_RECOVER|TRACKDB_MAY_CREATE);
+    trackdb_open(TRACKDB_NO_UPGRADE);
+    generate();
+  } else if(!strcmp(mode, "run")) {
+    trackdb_init(TRACKDB_NO_RECOVER);
+    trackdb_open(TRACKDB_NO_UPGRADE);
+    run();
+  } else
+    disorder_fatal(0, "unknown mode '%s'", mode);
+  trackdb_close();
+  trackdb_deinit(NULL);
+  xfclose(stdout);
+  return 0;
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -0,0 +1,400 @@
+/*
+ * This file is part of DisOrder.
+ * Copyright (C) 2013 Richard Kettlewell
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/** @file server/watch.c
+ * @brief Track changes to collections between rescans
+ *
+ * With @c rescan_watch set, every directory in each collection is watched
+ * using inotify and we remember which ones have changed.  The next rescan then
+ * only visits those directories.
+ *
+ * If we lose track of changes, for instance because the kernel's event queue
+ * overflowed, then the next rescan visits everything as before.  The same
+ * goes for the first rescan after each (re)configuration, since we don't know
+ * what happened before we started watching.
+ */
+#include "disorder-server.h"
+
+#if HAVE_SYS_INOTIFY_H
+# include <sys/inotify.h>
+# include <dirent.h>
+
+/** @brief Events we care about */
+#define WATCH_EVENTS (IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO     \
+                      |IN_CLOSE_WRITE|IN_DELETE_SELF|IN_MOVE_SELF       \
+                      |IN_ONLYDIR)
+
+/** @brief Set if the next rescan must visit everything */
+static int watch_full = 1;
+
+/** @brief inotify file descriptor, or -1 if not watching */
+static int watch_fd = -1;
+
+/** @brief Map from watch descriptors (in decimal) to directories */
+static hash *watch_dirs;
+
+/** @brief Map from directories to watch descriptors */
+static hash *watch_wds;
+
+/** @brief Directories changed since the last rescan */
+static hash *watch_dirty;
+
+/** @brief Note that a directory has changed */
+static void watch_changed(const char *dir) {
+  /* The rescanner reads one directory per line */
+  if(strchr(dir, '\n'))
+    watch_full = 1;
+  else
+    hash_add(watch_dirty, dir, "", HASH_INSERT_OR_REPLACE);
+}
+
+/** @brief Stop watching
+ * @param ev Event loop
+ */
+static void watch_stop(ev_source *ev) {
+  if(watch_fd != -1) {
+    ev_fd_cancel(ev, ev_read, watch_fd);
+    xclose(watch_fd);
+    watch_fd = -1;
+  }
+  watch_dirs = watch_wds = watch_dirty = 0;
+  watch_full = 1;
+}
+
+/** @brief Watch one directory
+ * @param dir Directory to watch
+ * @return 0 on success, -1 if we should give up watching altogether
+ */
+static int watch_add(const char *dir) {
+  char key[16], *d;
+  int wd;
+
+  if((wd = inotify_add_watch(watch_fd, dir, WATCH_EVENTS)) < 0) {
+    switch(errno) {
+    case ENOENT:
+    case ENOTDIR:
+      /* It went away before we got to it; whoever removed it will have
+       * reported the fact to its parent. */
+      return 0;
+    case ENOSPC:
+      disorder_error(0, "too many directories to watch for changes; "
+                     "raise /proc/sys/fs/inotify/max_user_watches");
+      return -1;
+    default:
+      disorder_error(errno, "error watching %s", dir);
+      return -1;
+    }
+  }
+  byte_snprintf(key, sizeof key, "%d", wd);
+  d = xstrdup(dir);
+  hash_add(watch_dirs, key, &d, HASH_INSERT_OR_REPLACE);
+  hash_add(watch_wds, d, &wd, HASH_INSERT_OR_REPLACE);
+  return 0;
+}
+
+/** @brief Watch a directory and everything below it
+ * @param dir Directory to watch
+ * @return 0 on success, -1 if we should give up watching altogether
+ *
+ * Like the @c fs scanner, entries starting with "." are skipped and symbolic
+ * links are followed.
+ */
+static int watch_tree(const char *dir) {
+  DIR *dp;
+  struct dirent *de;
+  struct stat sb;
+  struct vector subdirs;
+  char *path;
+  int n;
+
+  if(watch_add(dir))
+    return -1;
+  if(!(dp = opendir(dir))) {
+    if(errno != ENOENT && errno != ENOTDIR)
+      disorder_error(errno, "cannot open directory %s", dir);
+    return 0;
+  }
+  vector_init(&subdirs);
+  while((errno = 0), (de = readdir(dp))) {
+    if(de->d_name[0] == '.')
+      continue;
+    byte_xasprintf(&path, "%s/%s", dir, de->d_name);
+    if(stat(path, &sb) == 0 && S_ISDIR(sb.st_mode))
+      vector_append(&subdirs, path);
+  }
+  if(errno)
+    disorder_error(errno, "error reading directory %s", dir);
+  closedir(dp);
+  for(n = 0; n < subdirs.nvec; ++n)
+    if(watch_tree(subdirs.vec[n]))
+      return -1;
+  return 0;
+}
+
+/** @brief Callback for watch_untree() */
+static int watch_untree_callback(const char *dir, void *value, void *u) {
+  const char *top = u;
+  const size_t len = strlen(top);
+  char key[16];
+  int wd;
+
+  if(!strcmp(dir, top) || (!strncmp(dir, top, len) && dir[len] == '/')) {
+    wd = *(int *)value;
+    byte_snprintf(key, sizeof key, "%d", wd);
+    hash_remove(watch_dirs, key);
+    hash_remove(watch_wds, dir);
+    /* The kernel may already have dropped it, so ignore errors */
+    inotify_rm_watch(watch_fd, wd);
+  }
+  return 0;
+}
+
+/** @brief Stop watching a directory and everything below it
+ * @param dir Directory that has been removed or renamed
+ */
+static void watch_untree(const char *dir) {
+  hash_foreach(watch_wds, watch_untree_callback, (void *)dir);
+}
+
+/** @brief Handle one inotify event
+ * @param e Event
+ * @return 0 to carry on, -1 to give up watching
+ */
+static int watch_event(const struct inotify_event *e) {
+  char key[16], **dirp, *dir, *path;
+  int *wdp;
+
+  if(e->mask & IN_Q_OVERFLOW) {
+    disorder_info("lost track of collection changes; "
+                  "next rescan will visit everything");
+    watch_full = 1;
+    return 0;
+  }
+  byte_snprintf(key, sizeof key, "%d", e->wd);
+  if(!(dirp = hash_find(watch_dirs, key)))
+    return 0;                           /* we've already forgotten it */
+  dir = *dirp;
+  if(e->mask & IN_IGNORED) {
+    hash_remove(watch_dirs, key);
+    if((wdp = hash_find(watch_wds, dir)) && *wdp == e->wd)
+      hash_remove(watch_wds, dir);
+    return 0;
+  }
+  if(e->mask & (IN_DELETE_SELF|IN_MOVE_SELF)) {
+    /* Normally our parent will have told us about this already, but not when
+     * it's the root of a collection. */
+    watch_changed(dir);
+    if(e->mask & IN_MOVE_SELF)
+      watch_untree(dir);
+    return 0;
+  }
+  if(!e->len || e->name[0] == '.')
+    return 0;
+  byte_xasprintf(&path, "%s/%s", dir, e->name);
+  if(e->mask & IN_ISDIR) {
+    if(e->mask & (IN_DELETE|IN_MOVED_FROM)) {
+      watch_untree(path);
+      watch_changed(dir);
+    } else if(e->mask & (IN_CREATE|IN_MOVED_TO)) {
+      /* Anything created in the new directory before we started watching it
+       * will be found when it is rescanned */
+      watch_changed(path);
+      return watch_tree(path);
+    }
+  } else
+    watch_changed(dir);
+  return 0;
+}
+
+/** @brief Called when inotify events are available */
+static int watch_read(ev_source *ev,
+                      int fd,
+                      void attribute((unused)) *u) {
+  union {
+    struct inotify_event e;
+    char b[65536];
+  } buffer;
+  const struct inotify_event *e;
+  ssize_t n;
+  char *p;
+
+  for(;;) {
+    if((n = read(fd, &buffer, sizeof buffer)) < 0) {
+      if(errno == EINTR)
+        continue;
+      if(errno == EAGAIN)
+        return 0;
+      disorder_error(errno, "error reading inotify events");
+      watch_stop(ev);
+      return 0;
+    }
+    for(p = buffer.b; p < buffer.b + n; p += sizeof *e + e->len) {
+      e = (const struct inotify_event *)p;
+      if(watch_event(e)) {
+        watch_stop(ev);
+        return 0;
+      }
+    }
+  }
+}
+
+/** @brief Callback for watch_dirty_dirs() */
+static int compare_dirs(const void *av, const void *bv) {
+  return strcmp(*(char **)av, *(char **)bv);
+}
+
+/** @brief Return the changed directories
+ * @param ndirsp Where to store number of directories
+ * @return List of directories
+ *
+ * Directories below some other changed directory are left out, since
+ * rescanning the latter will cover them.
+ */
+static char **watch_dirty_dirs(int *ndirsp) {
+  char **dirs = hash_keys(watch_dirty), *d, *s;
+  int n, m;
+
+  for(n = m = 0; dirs[n]; ++n) {
+    d = xstrdup(dirs[n]);
+    while((s = strrchr(d, '/')) && s != d) {
+      *s = 0;
+      if(hash_find(watch_dirty, d))
+        break;
+    }
+    if(!s || s == d)
+      dirs[m++] = dirs[n];
+  }
+  dirs[m] = 0;
+  qsort(dirs, m, sizeof *dirs, compare_dirs);
+  *ndirsp = m;
+  return dirs;
+}
+
+/** @brief Write the list of changed directories for the rescanner
+ * @return Filename, or NULL on error
+ */
+static char *watch_write_dirty(void) {
+  char **dirs, *path;
+  int n, ndirs;
+  FILE *fp;
+
+  dirs = watch_dirty_dirs(&ndirs);
+  path = config_get_file("rescan-dirty");
+  if(!(fp = fopen(path, "w"))) {
+    disorder_error(errno, "error opening %s", path);
+    return 0;
+  }
+  for(n = 0; n < ndirs; ++n)
+    if(fprintf(fp, "%s\n", dirs[n]) < 0)
+      break;
+  if(n < ndirs || ferror(fp)) {
+    disorder_error(errno, "error writing %s", path);
+    fclose(fp);
+    return 0;
+  }
+  if(fclose(fp) < 0) {
+    disorder_error(errno, "error writing %s", path);
+    return 0;
+  }
+  disorder_info("%d directories have changed since the last rescan", ndirs);
+  return path;
+}
+#endif
+
+/** @brief (Re-)establish watches on collections
+ * @param ev Event loop
+ *
+ * Called after the configuration is (re-)read and when filesystems are
+ * mounted or unmounted.  The next rescan will visit everything.
+ */
+void watch_reset(ev_source *ev) {
+#if HAVE_SYS_INOTIFY_H
+  struct stat sb;
+  int n;
+
+  watch_stop(ev);
+  /* A zone leaves rescans to the library's server */
+  if(!config->rescan_watch || config->library)
+    return;
+  if((watch_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC)) < 0) {
+    disorder_error(errno, "inotify_init1");
+    watch_fd = -1;
+    return;
+  }
+  watch_dirs = hash_new(sizeof (char *));
+  watch_wds = hash_new(sizeof (int));
+  watch_dirty = hash_new(1);
+  for(n = 0; n < config->collection.n; ++n) {
+    const char *root = config->collection.s[n].root;
+
+    if(stat(root, &sb) < 0 || !S_ISDIR(sb.st_mode))
+      continue;
+    if(watch_tree(root)) {
+      watch_stop(ev);
+      return;
+    }
+  }
+  if(ev_fd(ev, ev_read, watch_fd, watch_read, 0, "inotify"))
+    disorder_fatal(0, "ev_fd failed");
+  disorder_info("watching %ld directories for changes",
+                (long)hash_count(watch_wds));
+#else
+  if(config->rescan_watch)
+    disorder_error(0, "rescan_watch is not supported on this platform");
+  (void)ev;
+#endif
+}
+
+/** @brief Initiate a rescan of whatever has changed
+ * @param ev Event loop
+ * @param recheck 1 to recheck lengths, 0 to suppress check
+ * @param rescanned Called on completion (if not NULL)
+ * @param ru Passed to @p rescanned
+ *
+ * Like trackdb_rescan(), but if we know which directories have changed since
+ * the last rescan then only those are visited.
+ */
+void watch_rescan(ev_source *ev, int recheck,
+                  void (*rescanned)(void *ru),
+                  void *ru) {
+#if HAVE_SYS_INOTIFY_H
+  char *dirty;
+
+  if(watch_fd != -1 && !trackdb_rescan_underway()) {
+    /* Pick up anything that's already happened */
+    watch_read(ev, watch_fd, 0);
+  }
+  if(watch_fd != -1 && !trackdb_rescan_underway()) {
+    dirty = watch_full ? 0 : watch_write_dirty();
+    /* Changes from now on are for the next rescan */
+    watch_dirty = hash_new(1);
+    watch_full = 0;
+    trackdb_rescan_dirty(ev, recheck, dirty, rescanned, ru);
+    return;
+  }
+#endif
+  trackdb_rescan(ev, recheck, rescanned, ru);
+}
+
+/*
+Local Variables:
+c-basic-offset:2
+comment-column:40
+fill-column:79
+indent-tabs-mode:nil
+End:
+*/
@@ -55,6 +55,15 @@ def test():
     title = c.part(alias, "display", "title")
     assert title == "blahblahblah", "checking title part"
 
+    print " checking bulk part lookup"
+    parts = c.parts_multi([track, alias], "display", "album")
+    assert parts == {track: "wibble", alias: "wibble"}, "checking bulk parts"
+
+    print " checking pipelined part lookups"
+    responses = c.pipeline([["part", track, "display", "artist"],
+                            ["part", alias, "display", "title"]])
+    assert [r[0] for r in responses] == [252, 252], "checking response codes"
+
     # See defect #20
     print " checking that prefs always belong to the canonical name"
     c.set(alias, "wibble", "spong")
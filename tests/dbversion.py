@@ -16,7 +16,7 @@
 # You should have received a copy of the GNU General Public License
 # along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #
-import dtest,time,disorder,sys,re,subprocess
+import dtest,time,disorder,sys,re,subprocess,os
 
 def test():
     """Database version tests"""
@@ -40,6 +40,31 @@ def test():
     print "Server version: %s" % v
     print " getting server stats"
     s = c.stats()
+    dtest.stop_daemon()
+    # Start again from scratch with dbversion 2, so there is something to
+    # upgrade online
+    home = "%s/home" % dtest.testroot
+    dtest.remove_dir(home)
+    os.makedirs(home)
+    dtest.copyfile(configsave, config)
+    open(config, "a").write("dbversion 2\n")
+    dtest.start_daemon()
+    dtest.create_user()
+    dtest.rescan()
+    dtest.stop_daemon()
+    dtest.copyfile(configsave, config)
+    open(config, "a").write("db_online_upgrade yes\n")
+    print " testing daemon manages to upgrade online..."
+    dtest.start_daemon()
+    assert dtest.check_files() == 0, "dtest.check_files"
+    c = disorder.client()
+    print " waiting for background upgrade to finish..."
+    n = 0
+    while c.getglobal("_upgrade_from") is not None:
+        n += 1
+        assert n < 60, "background upgrade did not finish"
+        time.sleep(1)
+    assert dtest.check_files() == 0, "dtest.check_files after upgrade"
 
 if __name__ == '__main__':
     dtest.run()
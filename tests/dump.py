@@ -83,6 +83,35 @@ def test():
     assert dtest.lists_have_same_contents(c.tags(),
                                           [u"another tag", u"wibble"]),\
            "checking tag list(3)"
+    print " dumping database in binary format"
+    print dtest.command(["disorder-dump", "--config", disorder._configfile,
+                         "--dump", "--binary", dump])
+    print " changing track pref"
+    c.set(track, "foo", "after binary dump");
+    c.set(track, "tags", "binary")
+    dtest.stop_daemon();
+    print "restoring binary dump"
+    print dtest.command(["disorder-dump", "--config", disorder._configfile,
+                         "--undump", dump])
+    dtest.start_daemon(); 
+    c = disorder.client()
+    print " checking track pref"
+    assert c.get(track, "foo") == "before", "checking track foo=before after binary undump"
+    print " checking tags were restored"
+    tracks = c.search(["tag:wibble"])
+    assert len(tracks) == 1, "checking there is exactly one search result"
+    assert tracks[0] == track, "checking for right search result(4)"
+    assert c.search(["tag:binary"]) == [], "checking new tag has gone"
+    print " setting and getting a track pref in a batch"
+    batch = "%s/batch" % dtest.testroot
+    open(batch, "w").write("set \"%s\" batch one\n"
+                           "# comment\n"
+                           "get \"%s\" batch\n" % (track, track))
+    out = dtest.command(["disorder",
+                         "--config", disorder._configfile, "--no-per-user-config",
+                         "--batch", batch])
+    assert out == ["250 OK\n", "252 one\n"], "checking batch responses"
+    assert c.get(track, "batch") == "one", "checking batch set the pref"
 
 if __name__ == '__main__':
     dtest.run()
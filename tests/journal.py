@@ -0,0 +1,56 @@
+#! /usr/bin/env python
+#
+# This file is part of DisOrder.
+# Copyright (C) 2013 Richard Kettlewell
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+# 
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+import dtest,disorder
+
+def queue_ids(c):
+    return map(lambda e:e['id'], c.queue())
+
+def test():
+    """Check a torn queue journal batch is ignored and not appended to"""
+    dtest.start_daemon()
+    dtest.create_user()
+    c = disorder.client()
+    print " disabling all play"
+    c.random_disable()
+    c.disable()
+    for t in c.queue():
+        c.remove(t['id'])
+    t1 = "%s/Joe Bloggs/Third Album/01:First_track.ogg" % dtest.tracks
+    t2 = "%s/Joe Bloggs/Third Album/02:Second_track.ogg" % dtest.tracks
+    print " adding tracks"
+    i1 = c.play(t1)
+    i2 = c.play(t2)
+    assert queue_ids(c) == [i1, i2], "checking initial queue"
+    dtest.stop_daemon()
+    print " tearing the journal"
+    journal = "%s/home/queue.journal" % dtest.testroot
+    open(journal, "a").write("order %s\nset license" % i2)
+    dtest.start_daemon()
+    c = disorder.client()
+    assert queue_ids(c) == [i1, i2], "checking torn batch was ignored"
+    print " adding a track after the torn batch"
+    i3 = c.play(t1)
+    assert queue_ids(c) == [i1, i2, i3], "checking queue after append"
+    dtest.stop_daemon()
+    dtest.start_daemon()
+    c = disorder.client()
+    assert queue_ids(c) == [i1, i2, i3], "checking queue after restart"
+
+if __name__ == '__main__':
+    dtest.run()
@@ -113,6 +113,34 @@ def test():
     for qe in q:
         c.remove(qe["id"])
 
+    print " playing a playlist"
+    c.playlist_lock("fred.play")
+    c.playlist_set("fred.play", [track3, "no such track", track2])
+    c.playlist_unlock()
+    c.play(track)
+    i = c.playlist_play("fred.play")
+    q = c.queue()
+    assert len(q) == 3
+    assert q[1]['track'] == track3
+    assert q[2]['track'] == track2
+    assert q[2]['id'] == i, "check last new ID is returned"
+    print "  at head of queue"
+    c.playlist_play("fred.play", target='')
+    q = c.queue()
+    assert len(q) == 5
+    assert q[0]['track'] == track3
+    assert q[1]['track'] == track2
+    assert q[2]['track'] == track
+    print "  shuffled"
+    c.playlist_play("fred.play", shuffle=True)
+    q = c.queue()
+    assert len(q) == 7
+    assert dtest.lists_have_same_contents([q[5]['track'], q[6]['track']],
+                                          [track3, track2])
+    c.playlist_delete("fred.play")
+    for qe in q:
+        c.remove(qe["id"])
+
     print " testing scratches"
     retry = False
     scratchlimit = 5
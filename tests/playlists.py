@@ -62,6 +62,38 @@ def test():
     l = c.playlist_get("wibble")
     assert l == ["three", "two", "one"], "checking modified playlist contents"
     #
+    print " editing part of a shared playlist"
+    c.playlist_lock("wibble")
+    c.playlist_insert("wibble", 1, ["four", "five"])
+    l = c.playlist_get("wibble")
+    assert l == ["three", "four", "five", "two", "one"], "checking insertion"
+    c.playlist_insert("wibble", 5, ["six"])
+    c.playlist_move("wibble", 1, 2, 3)
+    l = c.playlist_get("wibble")
+    assert l == ["three", "two", "one", "four", "five", "six"], "checking move"
+    c.playlist_remove("wibble", 0, 3)
+    l = c.playlist_get("wibble")
+    assert l == ["four", "five", "six"], "checking removal"
+    try:
+        c.playlist_remove("wibble", 2, 2)
+        print "*** should not be able to remove past the end ***"
+        assert False
+    except disorder.operationError:
+        pass                            # good
+    print " editing a long playlist"
+    tracks = ["t%d" % n for n in range(2000)]
+    c.playlist_set("wibble", tracks)
+    c.playlist_insert("wibble", 0, ["first"])
+    c.playlist_remove("wibble", 100, 600)
+    c.playlist_move("wibble", 0, 1, 1400)
+    tracks = ["first"] + tracks
+    del tracks[100:700]
+    tracks = tracks[1:] + ["first"]
+    l = c.playlist_get("wibble")
+    assert l == tracks, "checking long playlist edits"
+    c.playlist_set("wibble", ["three", "two", "one"])
+    c.playlist_unlock()
+    #
     print " creating a private playlist"
     c.playlist_lock("fred.spong")
     c.playlist_set("fred.spong", ["a", "b", "c"])
@@ -0,0 +1,66 @@
+#! /usr/bin/env python
+#
+# This file is part of DisOrder.
+# Copyright (C) 2013 Richard Kettlewell
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+# 
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+import dtest,disorder,os,time
+
+def wait_for(what, f):
+    limit = 60
+    while not f() and limit > 0:
+        time.sleep(1)
+        limit -= 1
+    assert limit > 0, what
+
+def test():
+    """Check an interrupted track resumes where it got to"""
+    # Record where each decoder is asked to start
+    seeks = "%s/seeks" % dtest.testroot
+    wrapper = "%s/decode-wrapper" % dtest.testroot
+    open(wrapper, "w").write("""#! /bin/sh
+echo "${DISORDER_RAW_SEEK:-0}" >> %s
+exec disorder-decode "$@"
+""" % seeks)
+    os.chmod(wrapper, 0755)
+    config = "%s/config" % dtest.testroot
+    open(config, "w").write(
+        open(config).read().replace("player *.ogg execraw disorder-decode",
+                                    "player *.ogg execraw %s" % wrapper))
+    dtest.start_daemon()
+    dtest.create_user()
+    dtest.rescan()
+    c = disorder.client()
+    c.random_disable()
+    track = u"%s/Fred Smith/Boring/01:Dull.ogg" % dtest.tracks
+    print " playing a track"
+    i = c.play(track)
+    def got_going():
+        p = c.playing()
+        return p is not None and p['id'] == i and int(p['sofar']) >= 1
+    wait_for("checking track started", got_going)
+    dtest.stop_daemon()
+    before = len(open(seeks).readlines())
+    print " restarting"
+    dtest.start_daemon()
+    c = disorder.client()
+    # The default player_pool means the resumed track goes via a helper
+    wait_for("checking track resumed",
+             lambda: len(open(seeks).readlines()) > before)
+    last = open(seeks).readlines()[-1].strip()
+    assert int(last) > 0, "checking decoder was told to seek (got %s)" % last
+
+if __name__ == '__main__':
+    dtest.run()
@@ -20,11 +20,16 @@ import dtest,time,disorder,sys
 
 failures = 0
 
-def check_search_results(terms, expected):
+def check_search_results(terms, expected, prefix=False, fuzzy=False):
     global failures
     # We want a consistent encoding and ordering
     print "terms:    %s" % terms
-    got = client.search(terms)
+    if prefix:
+        got = client.search_prefix(terms)
+    elif fuzzy:
+        got = client.search_fuzzy(terms)
+    else:
+        got = client.search(terms)
     got = map(dtest.nfc, got)
     expected = map(lambda s: "%s/%s" % (dtest.tracks, s), expected)
     expected = map(dtest.nfc, expected)
@@ -89,6 +94,30 @@ def test():
     check_search_results([u"thI\u0301rd"], third)
     # stopwords shouldn't show up
     check_search_results(["01"], [])
+    # prefix searches
+    check_search_results(["fir"], first, prefix=True)
+    check_search_results(["first"], first, prefix=True)
+    check_search_results(["FIRST", "sec"], first_and_second, prefix=True)
+    check_search_results([u"th\u00EDr"], third, prefix=True)
+    check_search_results(["firstx"], [], prefix=True)
+    if len(client.search_prefix(["fi"], 3)) != 3:
+        print "search_prefix limit not honored"
+        failures += 1
+    # fuzzy searches
+    check_search_results(["first"], first, fuzzy=True)
+    check_search_results(["frist"], first, fuzzy=True)
+    check_search_results(["secnd"], second, fuzzy=True)
+    check_search_results(["FIRST", "thrd"],
+                         filter(lambda s: s in third, first), fuzzy=True)
+    check_search_results(["zzzzzz"], [], fuzzy=True)
+    # ranked searches
+    ranked = client.search(["first"], 0, 0)
+    if sorted(map(dtest.nfc, ranked)) != sorted(map(dtest.nfc, client.search(["first"]))):
+        print "ranked search found different tracks"
+        failures += 1
+    if client.search(["first"], 2, 3) != ranked[2:5]:
+        print "ranked search paging inconsistent"
+        failures += 1
     
     if failures > 0:
         sys.exit(1)